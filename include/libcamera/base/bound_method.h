@@ -12,6 +12,8 @@
 #include <type_traits>
 #include <utility>
 
+#include <libcamera/base/memory_pool.h>
+
 namespace libcamera {
 
 class Object;
@@ -72,6 +74,7 @@ public:
 	virtual void invokePack(BoundMethodPackBase *pack) = 0;
 
 protected:
+	ConnectionType connectionType() const;
 	bool activatePack(std::shared_ptr<BoundMethodPackBase> pack,
 			  bool deleteMethod);
 
@@ -158,7 +161,15 @@ public:
 			return (obj->*func_)(args...);
 		}
 
-		auto pack = std::make_shared<PackType>(args...);
+		if (this->connectionType() == ConnectionTypeDirect) {
+			R ret = invoke(args...);
+			if (deleteMethod)
+				delete this;
+			return ret;
+		}
+
+		auto pack = std::allocate_shared<PackType>(PoolAllocator<PackType>(),
+							   args...);
 		bool sync = BoundMethodBase::activatePack(pack, deleteMethod);
 		return sync ? pack->ret_ : R();
 	}
@@ -194,7 +205,15 @@ public:
 			return (obj->*func_)(args...);
 		}
 
-		auto pack = std::make_shared<PackType>(args...);
+		if (this->connectionType() == ConnectionTypeDirect) {
+			invoke(args...);
+			if (deleteMethod)
+				delete this;
+			return;
+		}
+
+		auto pack = std::allocate_shared<PackType>(PoolAllocator<PackType>(),
+							   args...);
 		BoundMethodBase::activatePack(pack, deleteMethod);
 	}
 
@@ -0,0 +1,358 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * coroutine.h - Coroutine support for asynchronous operations
+ */
+#ifndef __LIBCAMERA_BASE_COROUTINE_H__
+#define __LIBCAMERA_BASE_COROUTINE_H__
+
+/*
+ * libcamera is compiled in C++17 mode, coroutines are only available to code
+ * compiled with C++20 coroutines support.
+ */
+#if defined(__DOXYGEN__) || defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <libcamera/base/private.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/memory_pool.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
+
+namespace libcamera {
+
+template<typename T = void>
+class Task;
+
+namespace details {
+
+class TaskPromiseBase
+{
+public:
+	static void *operator new(size_t size)
+	{
+		return MemoryPool::allocate(size);
+	}
+
+	static void operator delete(void *ptr, size_t size)
+	{
+		MemoryPool::deallocate(ptr, size);
+	}
+
+	struct FinalAwaiter {
+		bool await_ready() noexcept { return false; }
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise().continuation_;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() { std::terminate(); }
+
+	std::coroutine_handle<> continuation_;
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+	Task<T> get_return_object();
+	void return_value(T value) { value_.emplace(std::move(value)); }
+
+	std::optional<T> value_;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+	Task<void> get_return_object();
+	void return_void() {}
+};
+
+} /* namespace details */
+
+template<typename T>
+class Task
+{
+public:
+	using promise_type = details::TaskPromise<T>;
+
+	Task(Task &&other) noexcept
+		: handle_(std::exchange(other.handle_, nullptr))
+	{
+	}
+
+	Task &operator=(Task &&other) noexcept
+	{
+		if (this != &other) {
+			if (handle_)
+				handle_.destroy();
+			handle_ = std::exchange(other.handle_, nullptr);
+		}
+
+		return *this;
+	}
+
+	~Task()
+	{
+		if (handle_)
+			handle_.destroy();
+	}
+
+	void start()
+	{
+		if (handle_ && !handle_.done())
+			handle_.resume();
+	}
+
+	bool done() const { return !handle_ || handle_.done(); }
+
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+	{
+		handle_.promise().continuation_ = caller;
+		return handle_;
+	}
+
+	T await_resume()
+	{
+		if constexpr (!std::is_void_v<T>)
+			return std::move(*handle_.promise().value_);
+	}
+
+private:
+	friend promise_type;
+
+	explicit Task(std::coroutine_handle<promise_type> handle)
+		: handle_(handle)
+	{
+	}
+
+	std::coroutine_handle<promise_type> handle_;
+};
+
+namespace details {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+template<typename... Args>
+auto unpackResult(std::tuple<Args...> &&args)
+{
+	if constexpr (sizeof...(Args) == 0)
+		return;
+	else if constexpr (sizeof...(Args) == 1)
+		return std::get<0>(std::move(args));
+	else
+		return std::move(args);
+}
+
+} /* namespace details */
+
+template<typename... Args>
+class SignalAwaiter : public Object
+{
+public:
+	SignalAwaiter(Signal<Args...> &signal)
+		: signal_(signal)
+	{
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		handle_ = handle;
+		signal_.connect(this, &SignalAwaiter::emitted);
+	}
+
+	auto await_resume()
+	{
+		return details::unpackResult(std::move(*args_));
+	}
+
+private:
+	void emitted(Args... args)
+	{
+		/* Only the first emission resumes the coroutine. */
+		if (args_)
+			return;
+
+		args_.emplace(args...);
+		invokeMethod(&SignalAwaiter::resume, ConnectionTypeQueued);
+	}
+
+	void resume()
+	{
+		signal_.disconnect(this);
+		handle_.resume();
+	}
+
+	Signal<Args...> &signal_;
+	std::coroutine_handle<> handle_;
+	std::optional<std::tuple<std::decay_t<Args>...>> args_;
+};
+
+class NotifierAwaiter : public Object
+{
+public:
+	NotifierAwaiter(EventNotifier *notifier)
+		: notifier_(notifier), activated_(false)
+	{
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		handle_ = handle;
+		notifier_->activated.connect(this, &NotifierAwaiter::activated);
+		notifier_->setEnabled(true);
+	}
+
+	void await_resume() {}
+
+private:
+	void activated([[maybe_unused]] EventNotifier *notifier)
+	{
+		if (activated_)
+			return;
+
+		activated_ = true;
+		notifier_->setEnabled(false);
+		invokeMethod(&NotifierAwaiter::resume, ConnectionTypeQueued);
+	}
+
+	void resume()
+	{
+		notifier_->activated.disconnect(this);
+		handle_.resume();
+	}
+
+	EventNotifier *notifier_;
+	std::coroutine_handle<> handle_;
+	bool activated_;
+};
+
+template<typename T, typename R, typename... FuncArgs>
+class InvokeAwaiter : public Object
+{
+public:
+	template<typename... Args>
+	InvokeAwaiter(T *object, R (T::*func)(FuncArgs...), Args &&...args)
+		: object_(object), func_(func), args_(std::forward<Args>(args)...),
+		  caller_(nullptr)
+	{
+	}
+
+	bool await_ready()
+	{
+		if (object_->thread() != Thread::current())
+			return false;
+
+		call();
+		return true;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		handle_ = handle;
+		caller_ = Thread::current();
+
+		moveToThread(object_->thread());
+		invokeMethod(&InvokeAwaiter::execute, ConnectionTypeQueued);
+	}
+
+	R await_resume()
+	{
+		if constexpr (!std::is_void_v<R>)
+			return std::move(*result_);
+	}
+
+private:
+	using ResultType = std::conditional_t<std::is_void_v<R>, bool, R>;
+
+	void call()
+	{
+		auto invoke = [this](auto &...args) -> decltype(auto) {
+			return (object_->*func_)(args...);
+		};
+
+		if constexpr (std::is_void_v<R>)
+			std::apply(invoke, args_);
+		else
+			result_.emplace(std::apply(invoke, args_));
+	}
+
+	void execute()
+	{
+		call();
+
+		moveToThread(caller_);
+		invokeMethod(&InvokeAwaiter::resume, ConnectionTypeQueued);
+	}
+
+	void resume()
+	{
+		handle_.resume();
+	}
+
+	T *object_;
+	R (T::*func_)(FuncArgs...);
+	std::tuple<std::decay_t<FuncArgs>...> args_;
+	std::optional<ResultType> result_;
+
+	Thread *caller_;
+	std::coroutine_handle<> handle_;
+};
+
+template<typename... Args>
+SignalAwaiter<Args...> awaitSignal(Signal<Args...> &signal)
+{
+	return SignalAwaiter<Args...>(signal);
+}
+
+inline NotifierAwaiter awaitNotifier(EventNotifier *notifier)
+{
+	return NotifierAwaiter(notifier);
+}
+
+template<typename T, typename R, typename... FuncArgs, typename... Args,
+	 typename std::enable_if_t<std::is_base_of<Object, T>::value> * = nullptr>
+InvokeAwaiter<T, R, FuncArgs...> invokeAsync(T *object, R (T::*func)(FuncArgs...),
+					     Args &&...args)
+{
+	return InvokeAwaiter<T, R, FuncArgs...>(object, func, std::forward<Args>(args)...);
+}
+
+} /* namespace libcamera */
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* __LIBCAMERA_BASE_COROUTINE_H__ */
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * event_dispatcher_epoll.h - Epoll-based event dispatcher
+ */
+#ifndef __LIBCAMERA_BASE_EVENT_DISPATCHER_EPOLL_H__
+#define __LIBCAMERA_BASE_EVENT_DISPATCHER_EPOLL_H__
+
+#include <chrono>
+#include <map>
+#include <stdint.h>
+
+#include <libcamera/base/private.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/memory_pool.h>
+
+struct epoll_event;
+
+namespace libcamera {
+
+class EventNotifier;
+class Timer;
+
+class EventDispatcherEpoll final : public EventDispatcher
+{
+public:
+	EventDispatcherEpoll();
+	~EventDispatcherEpoll();
+
+	void registerEventNotifier(EventNotifier *notifier);
+	void unregisterEventNotifier(EventNotifier *notifier);
+
+	void registerTimer(Timer *timer);
+	void unregisterTimer(Timer *timer);
+
+	void processEvents();
+	void interrupt();
+
+private:
+	static constexpr unsigned int MaxEvents = 32;
+
+	struct EventNotifierSetEpoll {
+		uint32_t events() const;
+		EventNotifier *notifiers[3];
+		uint32_t registered;
+	};
+
+	int wait(struct epoll_event *events);
+	void armTimer(std::chrono::steady_clock::time_point deadline);
+	void update(int fd, EventNotifierSetEpoll &set);
+	void processInterrupt();
+	void processNotifiers(const struct epoll_event *events, unsigned int count);
+	void processTimers();
+
+	std::map<int, EventNotifierSetEpoll> notifiers_;
+	using TimerQueue = std::multimap<std::chrono::steady_clock::time_point, Timer *,
+					 std::less<std::chrono::steady_clock::time_point>,
+					 PoolAllocator<std::pair<const std::chrono::steady_clock::time_point, Timer *>>>;
+
+	TimerQueue timers_;
+	int epollfd_;
+	int eventfd_;
+	int timerfd_;
+	std::chrono::steady_clock::time_point timerDeadline_;
+
+	int processingFd_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_BASE_EVENT_DISPATCHER_EPOLL_H__ */
@@ -7,13 +7,14 @@
 #ifndef __LIBCAMERA_BASE_EVENT_DISPATCHER_POLL_H__
 #define __LIBCAMERA_BASE_EVENT_DISPATCHER_POLL_H__
 
-#include <list>
+#include <chrono>
 #include <map>
 #include <vector>
 
 #include <libcamera/base/private.h>
 
 #include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/memory_pool.h>
 
 struct pollfd;
 
@@ -49,7 +50,11 @@ private:
 	void processTimers();
 
 	std::map<int, EventNotifierSetPoll> notifiers_;
-	std::list<Timer *> timers_;
+	using TimerQueue = std::multimap<std::chrono::steady_clock::time_point, Timer *,
+					 std::less<std::chrono::steady_clock::time_point>,
+					 PoolAllocator<std::pair<const std::chrono::steady_clock::time_point, Timer *>>>;
+
+	TimerQueue timers_;
 	int eventfd_;
 
 	bool processingEvents_;
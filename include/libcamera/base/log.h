@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_BASE_LOG_H__
 #define __LIBCAMERA_BASE_LOG_H__
 
+#include <atomic>
 #include <chrono>
 #include <sstream>
 
@@ -32,14 +33,16 @@ public:
 	explicit LogCategory(const char *name);
 
 	const char *name() const { return name_; }
-	LogSeverity severity() const { return severity_; }
+	LogSeverity severity() const { return severity_.load(std::memory_order_relaxed); }
 	void setSeverity(LogSeverity severity);
 
+	bool isEnabled(LogSeverity severity) const { return severity >= this->severity(); }
+
 	static const LogCategory &defaultCategory();
 
 private:
 	const char *name_;
-	LogSeverity severity_;
+	std::atomic<LogSeverity> severity_;
 };
 
 #define LOG_DECLARE_CATEGORY(name)					\
@@ -67,19 +70,55 @@ public:
 	const utils::time_point &timestamp() const { return timestamp_; }
 	LogSeverity severity() const { return severity_; }
 	const LogCategory &category() const { return category_; }
-	const std::string &fileInfo() const { return fileInfo_; }
+	std::string fileInfo() const;
 	const std::string msg() const { return msgStream_.str(); }
 
 private:
 	LIBCAMERA_DISABLE_COPY(LogMessage)
 
-	void init(const char *fileName, unsigned int line);
+	friend class Logger;
 
 	std::ostringstream msgStream_;
 	const LogCategory &category_;
 	LogSeverity severity_;
 	utils::time_point timestamp_;
-	std::string fileInfo_;
+	const char *fileName_;
+	unsigned int line_;
+};
+
+class LogEveryN
+{
+public:
+	constexpr LogEveryN()
+		: count_(0)
+	{
+	}
+
+	bool allow(unsigned int n, LogSeverity severity);
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(LogEveryN)
+
+	std::atomic<unsigned int> count_;
+};
+
+class LogRateLimit
+{
+public:
+	constexpr LogRateLimit()
+		: next_(0), suppressed_(0)
+	{
+	}
+
+	bool allow(std::chrono::steady_clock::duration interval,
+		   const LogCategory &category, LogSeverity severity,
+		   const char *fileName, unsigned int line);
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(LogRateLimit)
+
+	std::atomic<int64_t> next_;
+	std::atomic<unsigned int> suppressed_;
 };
 
 class Loggable
@@ -102,10 +141,25 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
 #ifndef __DOXYGEN__
 #define _LOG_CATEGORY(name) logCategory##name
 
+/*
+ * The LOG() macros check the category severity before creating the message,
+ * and skip evaluation of the message stream operands altogether when the
+ * message is disabled. The _LogVoidify operator has a lower precedence than
+ * operator<<() and converts the stream expression to void to match the other
+ * branch of the conditional operator.
+ */
+struct _LogVoidify {
+	void operator&(std::ostream &) {}
+};
+
+#define _LOG_STREAM(category, categoryPtr, severity)			\
+	!(category).isEnabled(severity) ? (void)0 :			\
+	_LogVoidify() & _log(categoryPtr, severity).stream()
+
 #define _LOG1(severity) \
-	_log(nullptr, Log##severity).stream()
+	_LOG_STREAM(LogCategory::defaultCategory(), nullptr, Log##severity)
 #define _LOG2(category, severity) \
-	_log(&_LOG_CATEGORY(category)(), Log##severity).stream()
+	_LOG_STREAM(_LOG_CATEGORY(category)(), &_LOG_CATEGORY(category)(), Log##severity)
 
 /*
  * Expand the LOG() macro to _LOG1() or _LOG2() based on the number of
@@ -113,8 +167,49 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  */
 #define _LOG_MACRO(_1, _2, NAME, ...) NAME
 #define LOG(...) _LOG_MACRO(__VA_ARGS__, _LOG2, _LOG1)(__VA_ARGS__)
+
+/*
+ * The state of sampled messages is stored in a static variable local to a
+ * lambda function, giving each call site its own instance. The state classes
+ * have constexpr constructors, so the variable is constant-initialized and
+ * doesn't need an initialization guard.
+ */
+#define _LOG_STATE(type) \
+	([]() -> type & { static type state; return state; }())
+
+#define _LOG_EVERY_N(category, categoryPtr, severity, n)		\
+	!((category).isEnabled(severity) &&				\
+	  _LOG_STATE(LogEveryN).allow(n, severity)) ? (void)0 :		\
+	_LogVoidify() & _log(categoryPtr, severity).stream()
+
+#define _LOG_EVERY_N2(severity, n) \
+	_LOG_EVERY_N(LogCategory::defaultCategory(), nullptr, Log##severity, n)
+#define _LOG_EVERY_N3(category, severity, n) \
+	_LOG_EVERY_N(_LOG_CATEGORY(category)(), &_LOG_CATEGORY(category)(), \
+		     Log##severity, n)
+
+#define _LOG_RATELIMITED(category, categoryPtr, severity, interval)	\
+	!((category).isEnabled(severity) &&				\
+	  _LOG_STATE(LogRateLimit).allow(interval, category, severity,	\
+					 __FILE__, __LINE__)) ? (void)0 : \
+	_LogVoidify() & _log(categoryPtr, severity).stream()
+
+#define _LOG_RATELIMITED2(severity, interval) \
+	_LOG_RATELIMITED(LogCategory::defaultCategory(), nullptr, Log##severity, \
+			 interval)
+#define _LOG_RATELIMITED3(category, severity, interval) \
+	_LOG_RATELIMITED(_LOG_CATEGORY(category)(), &_LOG_CATEGORY(category)(), \
+			 Log##severity, interval)
+
+#define _LOG_MACRO3(_1, _2, _3, NAME, ...) NAME
+#define LOG_EVERY_N(...) \
+	_LOG_MACRO3(__VA_ARGS__, _LOG_EVERY_N3, _LOG_EVERY_N2)(__VA_ARGS__)
+#define LOG_RATELIMITED(...) \
+	_LOG_MACRO3(__VA_ARGS__, _LOG_RATELIMITED3, _LOG_RATELIMITED2)(__VA_ARGS__)
 #else /* __DOXYGEN___ */
 #define LOG(category, severity)
+#define LOG_EVERY_N(category, severity, n)
+#define LOG_RATELIMITED(category, severity, interval)
 #endif /* __DOXYGEN__ */
 
 #ifndef NDEBUG
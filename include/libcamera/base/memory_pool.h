@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * memory_pool.h - Recycling pool for small objects
+ */
+#ifndef __LIBCAMERA_BASE_MEMORY_POOL_H__
+#define __LIBCAMERA_BASE_MEMORY_POOL_H__
+
+#include <memory>
+#include <new>
+#include <stddef.h>
+
+namespace libcamera {
+
+class MemoryPool
+{
+public:
+	static constexpr size_t MaxBlockSize = 256;
+
+	static void *allocate(size_t size);
+	static void deallocate(void *ptr, size_t size);
+};
+
+template<typename T>
+class PoolAllocator
+{
+public:
+	using value_type = T;
+
+	PoolAllocator() = default;
+
+	template<typename U>
+	PoolAllocator([[maybe_unused]] const PoolAllocator<U> &other)
+	{
+	}
+
+	T *allocate(size_t n)
+	{
+		if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+			return std::allocator<T>().allocate(n);
+		else
+			return static_cast<T *>(MemoryPool::allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *ptr, size_t n)
+	{
+		if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+			std::allocator<T>().deallocate(ptr, n);
+		else
+			MemoryPool::deallocate(ptr, n * sizeof(T));
+	}
+
+	template<typename U>
+	bool operator==([[maybe_unused]] const PoolAllocator<U> &other) const
+	{
+		return true;
+	}
+
+	template<typename U>
+	bool operator!=([[maybe_unused]] const PoolAllocator<U> &other) const
+	{
+		return false;
+	}
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_BASE_MEMORY_POOL_H__ */
@@ -8,12 +8,14 @@
 #define __LIBCAMERA_BASE_MESSAGE_H__
 
 #include <atomic>
+#include <cstddef>
 
 #include <libcamera/base/bound_method.h>
 
 namespace libcamera {
 
 class BoundMethodBase;
+class MessageQueue;
 class Object;
 class Semaphore;
 class Thread;
@@ -37,11 +39,16 @@ public:
 
 	static Type registerMessageType();
 
+	static void *operator new(std::size_t size);
+	static void operator delete(void *ptr, std::size_t size);
+
 private:
+	friend class MessageQueue;
 	friend class Thread;
 
 	Type type_;
 	Object *receiver_;
+	Message *next_;
 
 	static std::atomic_uint nextUserType_;
 };
@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_BASE_OBJECT_H__
 #define __LIBCAMERA_BASE_OBJECT_H__
 
+#include <atomic>
 #include <list>
 #include <memory>
 #include <vector>
@@ -63,7 +64,7 @@ private:
 
 	Thread *thread_;
 	std::list<SignalBase *> signals_;
-	unsigned int pendingMessages_;
+	std::atomic<unsigned int> pendingMessages_;
 };
 
 } /* namespace libcamera */
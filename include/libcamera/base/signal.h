@@ -8,7 +8,6 @@
 #define __LIBCAMERA_BASE_SIGNAL_H__
 
 #include <functional>
-#include <list>
 #include <type_traits>
 #include <vector>
 
@@ -20,18 +19,32 @@ namespace libcamera {
 class SignalBase
 {
 public:
+	SignalBase();
+	~SignalBase();
+
 	void disconnect(Object *object);
 
 protected:
-	using SlotList = std::list<BoundMethodBase *>;
+	using SlotList = std::vector<BoundMethodBase *>;
+
+	struct Emission {
+		SignalBase *signal;
+		unsigned int index;
+		unsigned int end;
+		Emission *outer;
+	};
 
 	void connect(BoundMethodBase *slot);
 	void disconnect(std::function<bool(SlotList::iterator &)> match);
 
-	SlotList slots();
+	void beginEmit(Emission *emission);
+	static BoundMethodBase *nextSlot(Emission *emission);
+	static void endEmit(Emission *emission);
 
 private:
 	SlotList slots_;
+	Emission *emissions_;
+	bool compact_;
 };
 
 template<typename... Args>
@@ -119,11 +132,18 @@ public:
 	void emit(Args... args)
 	{
 		/*
-		 * Make a copy of the slots list as the slot could call the
-		 * disconnect operation, invalidating the iterator.
+		 * Walk the slots by index, as slots may call the connect or
+		 * disconnect operations. Slots connected during emission are
+		 * not called. The emission record lives on the stack, as a
+		 * slot may destroy the signal.
 		 */
-		for (BoundMethodBase *slot : slots())
+		Emission emission;
+		beginEmit(&emission);
+
+		while (BoundMethodBase *slot = nextSlot(&emission))
 			static_cast<BoundMethodArgs<void, Args...> *>(slot)->activate(args...);
+
+		endEmit(&emission);
 	}
 };
 
@@ -9,8 +9,10 @@
 
 #include <memory>
 #include <mutex>
+#include <string>
 #include <sys/types.h>
 #include <thread>
+#include <vector>
 
 #include <libcamera/base/private.h>
 
@@ -41,12 +43,17 @@ public:
 
 	bool isRunning();
 
+	void setName(const std::string &name);
+	int setAffinity(const std::vector<unsigned int> &cpus);
+	int setScheduling(int policy, int priority = 0);
+
 	Signal<Thread *> finished;
 
 	static Thread *current();
 	static pid_t currentId();
 
 	EventDispatcher *eventDispatcher();
+	int setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher);
 
 	void dispatchMessages(Message::Type type = Message::Type::None);
 
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * thread_pool.h - Work-stealing thread pool
+ */
+#ifndef __LIBCAMERA_BASE_THREAD_POOL_H__
+#define __LIBCAMERA_BASE_THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <libcamera/base/private.h>
+
+#include <libcamera/base/bound_method.h>
+#include <libcamera/base/class.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
+
+namespace libcamera {
+
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+
+	ThreadPool(unsigned int size = 0, const std::string &name = "ThreadPool");
+	~ThreadPool();
+
+	unsigned int size() const { return workers_.size(); }
+
+	void run(Task task);
+
+	template<typename T, typename Func,
+		 typename std::enable_if_t<std::is_base_of<Object, T>::value &&
+					   std::is_void<std::invoke_result_t<Func>>::value> * = nullptr>
+	void run(Func &&task, T *object, void (T::*done)())
+	{
+		run([task = std::forward<Func>(task), object, done]() mutable {
+			task();
+			object->invokeMethod(done, ConnectionTypeQueued);
+		});
+	}
+
+	template<typename T, typename Func, typename R,
+		 typename std::enable_if_t<std::is_base_of<Object, T>::value &&
+					   !std::is_void<std::invoke_result_t<Func>>::value> * = nullptr>
+	void run(Func &&task, T *object, void (T::*done)(R))
+	{
+		run([task = std::forward<Func>(task), object, done]() mutable {
+			object->invokeMethod(done, ConnectionTypeQueued, task());
+		});
+	}
+
+	void wait();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(ThreadPool)
+
+	class Worker;
+
+	Task take(unsigned int index);
+	void execute(unsigned int index);
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<unsigned int> next_;
+
+	Mutex mutex_;
+	std::condition_variable taskCv_;
+	std::condition_variable idleCv_;
+	std::atomic<int> queued_;
+	unsigned int outstanding_;
+	unsigned int sleeping_;
+	bool stop_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_BASE_THREAD_POOL_H__ */
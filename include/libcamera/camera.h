@@ -15,10 +15,14 @@
 #include <libcamera/base/class.h>
 #include <libcamera/base/object.h>
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
 
 #include <libcamera/controls.h>
+#include <libcamera/latency_stats.h>
+#include <libcamera/queue_status.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
+#include <libcamera/stream_stats.h>
 #include <libcamera/transform.h>
 
 namespace libcamera {
@@ -78,6 +82,11 @@ class Camera final : public Object, public std::enable_shared_from_this<Camera>,
 	LIBCAMERA_DECLARE_PRIVATE()
 
 public:
+	enum class CompletionOrder {
+		InOrder,
+		OutOfOrder,
+	};
+
 	static std::shared_ptr<Camera> create(PipelineHandler *pipe,
 					      const std::string &id,
 					      const std::set<Stream *> &streams);
@@ -85,8 +94,10 @@ public:
 	const std::string &id() const;
 
 	Signal<Request *, FrameBuffer *> bufferCompleted;
+	Signal<Request *, const ControlList &> metadataAvailable;
 	Signal<Request *> requestCompleted;
 	Signal<Camera *> disconnected;
+	Signal<const QueueStatus &> queueStatusChanged;
 
 	int acquire();
 	int release();
@@ -97,12 +108,25 @@ public:
 	const std::set<Stream *> &streams() const;
 	std::unique_ptr<CameraConfiguration> generateConfiguration(const StreamRoles &roles = {});
 	int configure(CameraConfiguration *config);
+	int setCompletionOrder(CompletionOrder order);
 
 	std::unique_ptr<Request> createRequest(uint64_t cookie = 0);
 	int queueRequest(Request *request);
+	int queueRequests(Span<Request *const> requests);
 
+	int prepare(const ControlList *controls = nullptr);
 	int start(const ControlList *controls = nullptr);
 	int stop();
+	int prepareConfiguration(CameraConfiguration *config);
+	int reconfigure(CameraConfiguration *config);
+
+	RequestLatencyStats latencyStats() const;
+	void resetLatencyStats();
+
+	StreamStats streamStats(const Stream *stream) const;
+	void resetStreamStats();
+
+	QueueStatus queueStatus() const;
 
 private:
 	LIBCAMERA_DISABLE_COPY(Camera)
@@ -114,9 +138,12 @@ private:
 	friend class PipelineHandler;
 	void disconnect();
 	void requestComplete(Request *request);
+	void recordLatency(RequestLatencyStats::Stage stage,
+			   std::chrono::nanoseconds latency);
+	void recordBuffer(const Stream *stream, const FrameBuffer *buffer);
 
 	friend class FrameBufferAllocator;
-	int exportFrameBuffers(Stream *stream,
+	int exportFrameBuffers(Stream *stream, unsigned int count,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 };
 
@@ -16,9 +16,12 @@
 #include <libcamera/base/object.h>
 #include <libcamera/base/signal.h>
 
+#include <libcamera/memory_usage.h>
+
 namespace libcamera {
 
 class Camera;
+class ControlList;
 
 class CameraManager : public Object, public Extensible
 {
@@ -38,6 +41,11 @@ public:
 		       const std::vector<dev_t> &devnums);
 	void removeCamera(std::shared_ptr<Camera> camera);
 
+	int startCameras(const std::vector<std::shared_ptr<Camera>> &cameras,
+			 const ControlList *controls = nullptr);
+
+	std::vector<MemoryUsage> memoryUsage() const;
+
 	static const std::string &version() { return version_; }
 
 	Signal<std::shared_ptr<Camera>> cameraAdded;
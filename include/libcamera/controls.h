@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <libcamera/base/class.h>
@@ -128,6 +129,9 @@ public:
 	ControlValue(const ControlValue &other);
 	ControlValue &operator=(const ControlValue &other);
 
+	ControlValue(ControlValue &&other) noexcept;
+	ControlValue &operator=(ControlValue &&other) noexcept;
+
 	ControlType type() const { return type_; }
 	bool isNone() const { return type_ == ControlTypeNone; }
 	bool isArray() const { return isArray_; }
@@ -201,7 +205,7 @@ private:
 	bool isArray_;
 	std::size_t numElements_ : 32;
 	union {
-		uint64_t value_;
+		uint64_t value_[5];
 		void *storage_;
 	};
 
@@ -349,7 +353,7 @@ private:
 class ControlList
 {
 private:
-	using ControlListMap = std::unordered_map<unsigned int, ControlValue>;
+	using ControlListMap = std::vector<std::pair<unsigned int, ControlValue>>;
 
 public:
 	ControlList();
@@ -412,6 +416,8 @@ private:
 	const ControlValue *find(unsigned int id) const;
 	ControlValue *find(unsigned int id);
 
+	ControlListMap::const_iterator lowerBound(unsigned int id) const;
+
 	ControlValidator *validator_;
 	const ControlIdMap *idmap_;
 	const ControlInfoMap *infoMap_;
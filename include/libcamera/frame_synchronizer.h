@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame_synchronizer.h - Timestamp-based pairing of requests from multiple cameras
+ */
+#ifndef __LIBCAMERA_FRAME_SYNCHRONIZER_H__
+#define __LIBCAMERA_FRAME_SYNCHRONIZER_H__
+
+#include <chrono>
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/signal.h>
+
+namespace libcamera {
+
+class Request;
+
+class FrameSynchronizer
+{
+public:
+	FrameSynchronizer(unsigned int numCameras,
+			  std::chrono::nanoseconds tolerance);
+
+	unsigned int numCameras() const { return queues_.size(); }
+	std::chrono::nanoseconds tolerance() const { return tolerance_; }
+
+	void addRequest(unsigned int index, Request *request);
+	void flush();
+
+	Signal<const std::vector<Request *> &> framesMatched;
+	Signal<unsigned int, Request *> frameDropped;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(FrameSynchronizer)
+
+	struct Frame {
+		int64_t timestamp;
+		Request *request;
+	};
+
+	void match();
+
+	std::chrono::nanoseconds tolerance_;
+	std::vector<std::deque<Frame>> queues_;
+	std::vector<Request *> matched_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_FRAME_SYNCHRONIZER_H__ */
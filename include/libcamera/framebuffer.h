@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_FRAMEBUFFER_H__
 #define __LIBCAMERA_FRAMEBUFFER_H__
 
+#include <memory>
 #include <stdint.h>
 #include <vector>
 
@@ -16,6 +17,7 @@
 
 namespace libcamera {
 
+class Fence;
 class Request;
 
 struct FrameMetadata {
@@ -55,6 +57,8 @@ public:
 	unsigned int cookie() const { return cookie_; }
 	void setCookie(unsigned int cookie) { cookie_ = cookie; }
 
+	std::unique_ptr<Fence> releaseFence();
+
 	void cancel() { metadata_.status = FrameMetadata::FrameCancelled; }
 
 private:
@@ -26,6 +26,7 @@ public:
 	~FrameBufferAllocator();
 
 	int allocate(Stream *stream);
+	int allocate(Stream *stream, unsigned int count);
 	int free(Stream *stream);
 
 	bool allocated() const { return !buffers_.empty(); }
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * framebuffer_pool.h - FrameBuffer pool shared between cameras
+ */
+#ifndef __LIBCAMERA_FRAMEBUFFER_POOL_H__
+#define __LIBCAMERA_FRAMEBUFFER_POOL_H__
+
+#include <memory>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+namespace libcamera {
+
+class FrameBuffer;
+
+class FrameBufferPool : public Extensible
+{
+	LIBCAMERA_DECLARE_PRIVATE()
+
+public:
+	FrameBufferPool(const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
+	~FrameBufferPool();
+
+	FrameBuffer *acquire();
+	int ref(FrameBuffer *buffer);
+	int release(FrameBuffer *buffer);
+
+	unsigned int size() const;
+	unsigned int available() const;
+	unsigned int refCount(const FrameBuffer *buffer) const;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(FrameBufferPool)
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_FRAMEBUFFER_POOL_H__ */
@@ -52,6 +52,10 @@ public:
 	static BayerFormat fromV4L2PixelFormat(V4L2PixelFormat v4l2Format);
 	BayerFormat transform(Transform t) const;
 
+	unsigned int lineSize(unsigned int width) const;
+	int unpackLine(const uint8_t *src, uint16_t *dst, unsigned int width) const;
+	int packLine(const uint16_t *src, uint8_t *dst, unsigned int width) const;
+
 	Order order;
 	uint8_t bitDepth;
 
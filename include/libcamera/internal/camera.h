@@ -8,13 +8,19 @@
 #define __LIBCAMERA_INTERNAL_CAMERA_H__
 
 #include <atomic>
+#include <bitset>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
 
 #include <libcamera/base/class.h>
+#include <libcamera/base/thread.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/latency_stats.h>
+#include <libcamera/stream_stats.h>
 
 namespace libcamera {
 
@@ -30,11 +36,15 @@ public:
 		const std::set<Stream *> &streams);
 	~Private();
 
+	void updateSupportedControls();
+	bool isControlSupported(unsigned int id) const;
+
 private:
 	enum State {
 		CameraAvailable,
 		CameraAcquired,
 		CameraConfigured,
+		CameraPrepared,
 		CameraStopping,
 		CameraRunning,
 	};
@@ -46,8 +56,12 @@ private:
 			    bool allowDisconnected = false,
 			    const char *from = __builtin_FUNCTION()) const;
 
+	int validateRequest(const Request *request) const;
+	int setActiveStreams(const CameraConfiguration *config);
+
 	void disconnect();
 	void setState(State state);
+	void updateQueueStatus(const Request *request);
 
 	std::shared_ptr<PipelineHandler> pipe_;
 	std::string id_;
@@ -56,6 +70,17 @@ private:
 
 	bool disconnected_;
 	std::atomic<State> state_;
+
+	std::bitset<controls::MaxControlId + 1> supportedControls_;
+
+	mutable Mutex latencyLock_;
+	RequestLatencyStats latencyStats_;
+
+	mutable Mutex streamStatsLock_;
+	std::map<const Stream *, StreamStats> streamStats_;
+
+	mutable Mutex queueStatusLock_;
+	QueueStatus queueStatus_;
 };
 
 } /* namespace libcamera */
@@ -18,6 +18,7 @@
 #include <libcamera/geometry.h>
 #include <libcamera/ipa/core_ipa_interface.h>
 
+#include "libcamera/internal/camera_sensor_properties.h"
 #include "libcamera/internal/formats.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 
@@ -33,6 +34,7 @@ public:
 	~CameraSensor();
 
 	int init();
+	static std::vector<int> init(const std::vector<CameraSensor *> &sensors);
 
 	const std::string &model() const { return model_; }
 	const std::string &id() const { return id_; }
@@ -57,6 +59,11 @@ public:
 
 	const ControlList &properties() const { return properties_; }
 	int sensorInfo(IPACameraSensorInfo *info) const;
+	const CameraSensorProperties::SensorDelays &sensorDelays() const
+	{
+		return sensorDelays_;
+	}
+	uint16_t blackLevel() const { return blackLevel_; }
 
 	void updateControlInfo();
 
@@ -66,7 +73,10 @@ protected:
 private:
 	LIBCAMERA_DISABLE_COPY(CameraSensor)
 
+	int open();
+	int probe();
 	int generateId();
+	V4L2Subdevice::Formats enumerateFormats();
 	int validateSensorDriver();
 	void initVimcDefaultProperties();
 	void initStaticProperties();
@@ -89,6 +99,8 @@ private:
 	Size pixelArraySize_;
 	Rectangle activeArea_;
 	const BayerFormat *bayerFormat_;
+	CameraSensorProperties::SensorDelays sensorDelays_;
+	uint16_t blackLevel_;
 
 	ControlList properties_;
 };
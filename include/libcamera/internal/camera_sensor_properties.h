@@ -8,6 +8,7 @@
 #define __LIBCAMERA_SENSOR_CAMERA_SENSOR_PROPERTIES_H__
 
 #include <map>
+#include <stdint.h>
 #include <string>
 
 #include <libcamera/geometry.h>
@@ -19,6 +20,15 @@ struct CameraSensorProperties {
 
 	Size unitCellSize;
 	std::map<int32_t, int32_t> testPatternModes;
+
+	struct SensorDelays {
+		uint8_t exposureDelay;
+		uint8_t gainDelay;
+		uint8_t vblankDelay;
+		uint8_t hblankDelay;
+	} sensorDelays;
+
+	uint16_t blackLevel;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * control_block.h - Fixed-slot storage for libcamera controls
+ */
+#ifndef __LIBCAMERA_INTERNAL_CONTROL_BLOCK_H__
+#define __LIBCAMERA_INTERNAL_CONTROL_BLOCK_H__
+
+#include <array>
+#include <bitset>
+#include <initializer_list>
+#include <type_traits>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+namespace libcamera {
+
+class ControlBlock
+{
+public:
+	static constexpr unsigned int NumSlots = controls::MaxControlId + 1;
+
+	bool empty() const { return present_.none(); }
+	std::size_t size() const { return present_.count(); }
+
+	void clear() { present_.reset(); }
+
+	bool contains(const ControlId &id) const { return contains(id.id()); }
+	bool contains(unsigned int id) const
+	{
+		return id < NumSlots && present_.test(id);
+	}
+
+	template<typename T>
+	T get(const Control<T> &ctrl) const
+	{
+		const ControlValue *val = find(ctrl.id());
+		if (!val)
+			return T{};
+
+		return val->get<T>();
+	}
+
+	template<typename T, typename V>
+	void set(const Control<T> &ctrl, const V &value)
+	{
+		ControlValue *val = slot(ctrl.id());
+		if (!val)
+			return;
+
+		val->set<T>(value);
+	}
+
+	template<typename T, typename V>
+	void set(const Control<T> &ctrl, const std::initializer_list<V> &value)
+	{
+		ControlValue *val = slot(ctrl.id());
+		if (!val)
+			return;
+
+		val->set<T>(Span<const typename std::remove_cv_t<V>>{ value.begin(), value.size() });
+	}
+
+	const ControlValue &get(unsigned int id) const;
+	void set(unsigned int id, const ControlValue &value);
+
+	void merge(const ControlList &list);
+	void toControlList(ControlList &list) const;
+
+private:
+	const ControlValue *find(unsigned int id) const;
+	ControlValue *slot(unsigned int id);
+
+	std::bitset<NumSlots> present_;
+	std::array<ControlValue, NumSlots> values_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_CONTROL_BLOCK_H__ */
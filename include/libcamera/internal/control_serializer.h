@@ -9,8 +9,11 @@
 
 #include <map>
 #include <memory>
+#include <stdint.h>
+#include <utility>
 #include <vector>
 
+#include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 
 namespace libcamera {
@@ -24,33 +27,72 @@ public:
 
 	void reset();
 
+	void setDeltaEncoding(bool enable);
+	bool deltaEncoding() const { return deltaEncoding_; }
+	void restartDeltaEncoding();
+
 	static size_t binarySize(const ControlInfoMap &infoMap);
 	static size_t binarySize(const ControlList &list);
 
 	int serialize(const ControlInfoMap &infoMap, ByteStreamBuffer &buffer);
 	int serialize(const ControlList &list, ByteStreamBuffer &buffer);
+	int serialize(const ControlList &list, std::vector<uint8_t> &data);
 
 	template<typename T>
 	T deserialize(ByteStreamBuffer &buffer);
 
 	bool isCached(const ControlInfoMap &infoMap);
 
+	int takeError();
+
 private:
+	static constexpr unsigned int kMaxInfoMaps = 16;
+
+	struct ListState {
+		uint32_t sequence = 0;
+		ControlList list{ controls::controls };
+	};
+
+	struct SerializedInfoMap {
+		ControlInfoMap infoMap;
+		unsigned int lastUse;
+	};
+
 	static size_t binarySize(const ControlValue &value);
 	static size_t binarySize(const ControlInfo &info);
 
 	static void store(const ControlValue &value, ByteStreamBuffer &buffer);
 	static void store(const ControlInfo &info, ByteStreamBuffer &buffer);
 
+	int encode(const ControlList &list, std::vector<uint8_t> &data,
+		   ListState **state, uint32_t *sequence);
+	void commit(const ControlList &list, ListState *state,
+		    uint32_t sequence);
+	unsigned int findSerialized(const ControlInfoMap &infoMap) const;
+	void setHandle(const ControlInfoMap *infoMap, unsigned int handle);
+	unsigned int evictionCandidate() const;
+	void evictSerialized(unsigned int handle);
+	void evictDeserialized(unsigned int handle);
+
 	ControlValue loadControlValue(ControlType type, ByteStreamBuffer &buffer,
 				      bool isArray = false, unsigned int count = 1);
 	ControlInfo loadControlInfo(ControlType type, ByteStreamBuffer &buffer);
 
 	unsigned int serial_;
-	std::vector<std::unique_ptr<ControlId>> controlIds_;
-	std::vector<std::unique_ptr<ControlIdMap>> controlIdMaps_;
+	std::map<unsigned int, std::vector<std::unique_ptr<ControlId>>> controlIds_;
+	std::map<unsigned int, std::unique_ptr<ControlIdMap>> controlIdMaps_;
 	std::map<unsigned int, ControlInfoMap> infoMaps_;
 	std::map<const ControlInfoMap *, unsigned int> infoMapHandles_;
+	std::map<unsigned int, SerializedInfoMap> serializedInfoMaps_;
+	unsigned int infoMapUses_;
+
+	int error_;
+
+	bool deltaEncoding_;
+	std::map<unsigned int, ListState> serializedLists_;
+	std::map<unsigned int, ListState> deserializedLists_;
+	std::vector<std::pair<unsigned int, const ControlValue *>> delta_;
+	std::vector<uint8_t> scratch_;
 };
 
 } /* namespace libcamera */
@@ -9,9 +9,12 @@
 
 #include <stdint.h>
 #include <unordered_map>
+#include <vector>
 
 #include <libcamera/controls.h>
 
+#include "libcamera/internal/v4l2_control_batch.h"
+
 namespace libcamera {
 
 class V4L2Device;
@@ -22,10 +25,14 @@ public:
 	struct ControlParams {
 		unsigned int delay;
 		bool priorityWrite;
+		unsigned int priority = 0;
 	};
 
+	static constexpr unsigned int DefaultHistoryDepth = 16;
+
 	DelayedControls(V4L2Device *device,
-			const std::unordered_map<uint32_t, ControlParams> &controlParams);
+			const std::unordered_map<uint32_t, ControlParams> &controlParams,
+			unsigned int historyDepth = DefaultHistoryDepth);
 
 	void reset();
 
@@ -33,6 +40,7 @@ public:
 	ControlList get(uint32_t sequence);
 
 	void applyControls(uint32_t sequence);
+	void collectControls(uint32_t sequence, V4L2ControlBatch *batch);
 
 private:
 	class Info : public ControlValue
@@ -51,34 +59,45 @@ private:
 		bool updated;
 	};
 
-	/* \todo: Make the listSize configurable at instance creation time. */
-	static constexpr int listSize = 16;
-	class ControlRingBuffer : public std::array<Info, listSize>
+	class ControlRingBuffer : public std::vector<Info>
 	{
 	public:
 		Info &operator[](unsigned int index)
 		{
-			return std::array<Info, listSize>::operator[](index % listSize);
+			return std::vector<Info>::operator[](index % size());
 		}
 
 		const Info &operator[](unsigned int index) const
 		{
-			return std::array<Info, listSize>::operator[](index % listSize);
+			return std::vector<Info>::operator[](index % size());
 		}
 	};
 
+	struct ControlState {
+		const ControlId *id;
+		ControlParams params;
+		unsigned int group;
+		ControlRingBuffer values;
+	};
+
+	ControlState *findControl(unsigned int id);
+
 	V4L2Device *device_;
-	/* \todo Evaluate if we should index on ControlId * or unsigned int */
-	std::unordered_map<const ControlId *, ControlParams> controlParams_;
+	/* Sorted by control numerical ID. */
+	std::vector<ControlState> controls_;
 	unsigned int maxDelay_;
+	unsigned int historyDepth_;
 
 	bool running_;
 	uint32_t firstSequence_;
 
 	uint32_t queueCount_;
 	uint32_t writeCount_;
-	/* \todo Evaluate if we should index on ControlId * or unsigned int */
-	std::unordered_map<const ControlId *, ControlRingBuffer> values_;
+
+	/* Batched writes, one per priority group in decreasing priority. */
+	std::vector<ControlList> groups_;
+	ControlList priority_;
+	V4L2ControlBatch batch_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * device_cache.h - Persistent cache of device information
+ */
+#ifndef __LIBCAMERA_INTERNAL_DEVICE_CACHE_H__
+#define __LIBCAMERA_INTERNAL_DEVICE_CACHE_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/thread.h>
+
+namespace libcamera {
+
+class DeviceCache
+{
+public:
+	explicit DeviceCache(const std::string &path);
+
+	static DeviceCache *instance();
+
+	const std::string &path() const { return path_; }
+	bool enabled() const { return !path_.empty(); }
+
+	bool lookup(const std::string &key, std::vector<uint8_t> *data);
+	void store(const std::string &key, std::vector<uint8_t> data);
+
+	int save();
+
+	static std::string bootId();
+	static std::string kernelRelease();
+	static std::string nodeId(const std::string &deviceNode);
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(DeviceCache)
+
+	struct Entry {
+		std::vector<uint8_t> data;
+		bool used;
+	};
+
+	void load();
+
+	std::string path_;
+
+	Mutex mutex_;
+	std::map<std::string, Entry> entries_;
+	bool dirty_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_DEVICE_CACHE_H__ */
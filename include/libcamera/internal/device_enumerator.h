@@ -9,6 +9,8 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <libcamera/base/signal.h>
@@ -26,6 +28,8 @@ public:
 
 	bool match(const MediaDevice *device) const;
 
+	std::string key() const;
+
 private:
 	std::string driver_;
 	std::vector<std::string> entities_;
@@ -47,11 +51,15 @@ public:
 
 protected:
 	std::unique_ptr<MediaDevice> createDevice(const std::string &deviceNode);
+	std::vector<std::unique_ptr<MediaDevice>>
+	createDevices(const std::vector<std::string> &deviceNodes);
 	void addDevice(std::unique_ptr<MediaDevice> media);
 	void removeDevice(const std::string &deviceNode);
 
 private:
 	std::vector<std::shared_ptr<MediaDevice>> devices_;
+	std::unordered_map<const MediaDevice *,
+			   std::unordered_set<std::string>> mismatches_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma_heaps.h - Helper class for dma-heap allocations.
+ */
+#ifndef __LIBCAMERA_INTERNAL_DMA_HEAPS_H__
+#define __LIBCAMERA_INTERNAL_DMA_HEAPS_H__
+
+#include <map>
+#include <stddef.h>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/flags.h>
+#include <libcamera/base/thread.h>
+
+#include <libcamera/file_descriptor.h>
+
+namespace libcamera {
+
+class DmaHeap
+{
+public:
+	enum class DmaHeapFlag {
+		Cma = 1 << 0,
+		System = 1 << 1,
+	};
+
+	using DmaHeapFlags = Flags<DmaHeapFlag>;
+
+	DmaHeap(DmaHeapFlags type = DmaHeapFlag::Cma);
+	~DmaHeap();
+
+	bool isValid() const { return dmaHeapHandle_ > -1; }
+	FileDescriptor alloc(const char *name, std::size_t size);
+	void recycle(FileDescriptor &&fd);
+
+	std::size_t poolLimit() const;
+	void setPoolLimit(std::size_t limit);
+	std::size_t poolSize() const;
+	void clearPool();
+
+private:
+	LIBCAMERA_DISABLE_COPY(DmaHeap)
+
+	void trimPool(std::size_t limit);
+
+	int dmaHeapHandle_;
+
+	mutable Mutex poolMutex_;
+	std::size_t poolLimit_;
+	std::size_t poolSize_;
+	std::multimap<std::size_t, FileDescriptor> pool_;
+};
+
+LIBCAMERA_FLAGS_ENABLE_OPERATORS(DmaHeap::DmaHeapFlag)
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_DMA_HEAPS_H__ */
@@ -25,6 +25,19 @@ struct PixelFormatPlaneInfo
 	unsigned int verticalSubSampling;
 };
 
+struct FrameLayout
+{
+	struct Plane {
+		unsigned int offset;
+		unsigned int stride;
+		unsigned int size;
+	};
+
+	unsigned int numPlanes;
+	unsigned int frameSize;
+	std::array<Plane, 3> planes;
+};
+
 class PixelFormatInfo
 {
 public:
@@ -45,6 +58,7 @@ public:
 	unsigned int frameSize(const Size &size, unsigned int align = 1) const;
 	unsigned int frameSize(const Size &size,
 			       const std::array<unsigned int, 3> &strides) const;
+	FrameLayout frameLayout(const Size &size, unsigned int align = 1) const;
 
 	unsigned int numPlanes() const;
 
@@ -7,10 +7,19 @@
 #ifndef __LIBCAMERA_INTERNAL_FRAMEBUFFER_H__
 #define __LIBCAMERA_INTERNAL_FRAMEBUFFER_H__
 
+#include <map>
+#include <memory>
+#include <vector>
+
 #include <libcamera/base/class.h>
+#include <libcamera/base/thread.h>
 
+#include <libcamera/fence.h>
 #include <libcamera/framebuffer.h>
 
+#include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/memory_tracker.h"
+
 namespace libcamera {
 
 class FrameBuffer::Private : public Extensible::Private
@@ -22,8 +31,28 @@ public:
 
 	void setRequest(Request *request) { request_ = request; }
 
+	Fence *fence() const { return fence_.get(); }
+	void setFence(std::unique_ptr<Fence> fence) { fence_ = std::move(fence); }
+
+	int map(MappedFrameBuffer::MapFlags flags,
+		const MappedFrameBuffer **map) const;
+
+	FrameMetadata &metadata();
+
+	void setMemoryAllocation(MemoryTracker::Allocation allocation)
+	{
+		memory_ = std::move(allocation);
+	}
+
 private:
 	Request *request_;
+	std::unique_ptr<Fence> fence_;
+
+	mutable Mutex mapsLock_;
+	mutable std::map<MappedFrameBuffer::MapFlags::Type,
+			 std::unique_ptr<MappedFrameBuffer>> maps_;
+
+	MemoryTracker::Allocation memory_;
 };
 
 } /* namespace libcamera */
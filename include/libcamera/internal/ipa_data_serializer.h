@@ -40,6 +40,15 @@ void appendPOD(std::vector<uint8_t> &vec, T val)
 	memcpy(&*(vec.end() - byteWidth), &val, byteWidth);
 }
 
+template<typename T,
+	 std::enable_if_t<std::is_arithmetic_v<T>> * = nullptr>
+void writePOD(std::vector<uint8_t> &vec, size_t pos, T val)
+{
+	ASSERT(pos + sizeof(val) <= vec.size());
+
+	memcpy(vec.data() + pos, &val, sizeof(val));
+}
+
 template<typename T,
 	 std::enable_if_t<std::is_arithmetic_v<T>> * = nullptr>
 T readPOD(std::vector<uint8_t>::const_iterator it, size_t pos,
@@ -67,7 +76,19 @@ class IPADataSerializer
 {
 public:
 	static std::tuple<std::vector<uint8_t>, std::vector<int32_t>>
-	serialize(const T &data, ControlSerializer *cs = nullptr);
+	serialize(const T &data, ControlSerializer *cs = nullptr)
+	{
+		std::vector<uint8_t> dataVec;
+		std::vector<int32_t> fdsVec;
+
+		serialize(data, dataVec, fdsVec, cs);
+
+		return { std::move(dataVec), std::move(fdsVec) };
+	}
+
+	static void serialize(const T &data, std::vector<uint8_t> &dataVec,
+			      std::vector<int32_t> &fdsVec,
+			      ControlSerializer *cs = nullptr);
 
 	static T deserialize(const std::vector<uint8_t> &data,
 			     ControlSerializer *cs = nullptr);
@@ -87,6 +108,31 @@ public:
 
 #ifndef __DOXYGEN__
 
+namespace {
+
+/*
+ * Serialize a container element in place, preceded by its size in bytes and
+ * its number of fds. Both sizes are filled once the element has been
+ * serialized.
+ */
+template<typename T>
+void serializeElement(const T &data, std::vector<uint8_t> &dataVec,
+		      std::vector<int32_t> &fdsVec, ControlSerializer *cs)
+{
+	size_t sizePos = dataVec.size();
+	size_t fdsStart = fdsVec.size();
+
+	appendPOD<uint32_t>(dataVec, 0);
+	appendPOD<uint32_t>(dataVec, 0);
+
+	IPADataSerializer<T>::serialize(data, dataVec, fdsVec, cs);
+
+	writePOD<uint32_t>(dataVec, sizePos, dataVec.size() - sizePos - 8);
+	writePOD<uint32_t>(dataVec, sizePos + 4, fdsVec.size() - fdsStart);
+}
+
+} /* namespace */
+
 /*
  * Serialization format for vector of type V:
  *
@@ -110,26 +156,21 @@ public:
 		std::vector<uint8_t> dataVec;
 		std::vector<int32_t> fdsVec;
 
+		serialize(data, dataVec, fdsVec, cs);
+
+		return { std::move(dataVec), std::move(fdsVec) };
+	}
+
+	static void serialize(const std::vector<V> &data, std::vector<uint8_t> &dataVec,
+			      std::vector<int32_t> &fdsVec, ControlSerializer *cs = nullptr)
+	{
 		/* Serialize the length. */
 		uint32_t vecLen = data.size();
 		appendPOD<uint32_t>(dataVec, vecLen);
 
 		/* Serialize the members. */
-		for (auto const &it : data) {
-			std::vector<uint8_t> dvec;
-			std::vector<int32_t> fvec;
-
-			std::tie(dvec, fvec) =
-				IPADataSerializer<V>::serialize(it, cs);
-
-			appendPOD<uint32_t>(dataVec, dvec.size());
-			appendPOD<uint32_t>(dataVec, fvec.size());
-
-			dataVec.insert(dataVec.end(), dvec.begin(), dvec.end());
-			fdsVec.insert(fdsVec.end(), fvec.begin(), fvec.end());
-		}
-
-		return { dataVec, fdsVec };
+		for (auto const &it : data)
+			serializeElement(it, dataVec, fdsVec, cs);
 	}
 
 	static std::vector<V> deserialize(std::vector<uint8_t> &data, ControlSerializer *cs = nullptr)
@@ -207,35 +248,23 @@ public:
 		std::vector<uint8_t> dataVec;
 		std::vector<int32_t> fdsVec;
 
+		serialize(data, dataVec, fdsVec, cs);
+
+		return { std::move(dataVec), std::move(fdsVec) };
+	}
+
+	static void serialize(const std::map<K, V> &data, std::vector<uint8_t> &dataVec,
+			      std::vector<int32_t> &fdsVec, ControlSerializer *cs = nullptr)
+	{
 		/* Serialize the length. */
 		uint32_t mapLen = data.size();
 		appendPOD<uint32_t>(dataVec, mapLen);
 
 		/* Serialize the members. */
 		for (auto const &it : data) {
-			std::vector<uint8_t> dvec;
-			std::vector<int32_t> fvec;
-
-			std::tie(dvec, fvec) =
-				IPADataSerializer<K>::serialize(it.first, cs);
-
-			appendPOD<uint32_t>(dataVec, dvec.size());
-			appendPOD<uint32_t>(dataVec, fvec.size());
-
-			dataVec.insert(dataVec.end(), dvec.begin(), dvec.end());
-			fdsVec.insert(fdsVec.end(), fvec.begin(), fvec.end());
-
-			std::tie(dvec, fvec) =
-				IPADataSerializer<V>::serialize(it.second, cs);
-
-			appendPOD<uint32_t>(dataVec, dvec.size());
-			appendPOD<uint32_t>(dataVec, fvec.size());
-
-			dataVec.insert(dataVec.end(), dvec.begin(), dvec.end());
-			fdsVec.insert(fdsVec.end(), fvec.begin(), fvec.end());
+			serializeElement(it.first, dataVec, fdsVec, cs);
+			serializeElement(it.second, dataVec, fdsVec, cs);
 		}
-
-		return { dataVec, fdsVec };
 	}
 
 	static std::map<K, V> deserialize(std::vector<uint8_t> &data, ControlSerializer *cs = nullptr)
@@ -7,10 +7,14 @@
 #ifndef __LIBCAMERA_INTERNAL_IPA_MANAGER_H__
 #define __LIBCAMERA_INTERNAL_IPA_MANAGER_H__
 
+#include <map>
+#include <memory>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
 
 #include <libcamera/ipa/ipa_interface.h>
 #include <libcamera/ipa/ipa_module_info.h>
@@ -23,6 +27,9 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(IPAManager)
 
+class IPAModuleCache;
+class IPCPipeSharedMemory;
+
 class IPAManager
 {
 public:
@@ -47,19 +54,44 @@ public:
 		return proxy;
 	}
 
+	static std::unique_ptr<IPCPipeSharedMemory>
+	createIPCPipe(IPAModule *ipam, const std::string &workerPath);
+	static bool reuseWorkers();
+	static void releaseIPCPipe(IPAModule *ipam, const std::string &workerPath,
+				   std::unique_ptr<IPCPipeSharedMemory> pipe);
+
+	void startWorkers();
+	void releaseWorkers();
+
 private:
+	struct Worker {
+		std::string path;
+		Thread *thread;
+		std::unique_ptr<IPCPipeSharedMemory> pipe;
+	};
+
 	static IPAManager *self_;
 
+	void discoverModules();
 	void parseDir(const char *libDir, unsigned int maxDepth,
 		      std::vector<std::string> &files);
 	unsigned int addDir(const char *libDir, unsigned int maxDepth = 0);
+	IPAModule *loadNextModule();
 
 	IPAModule *module(PipelineHandler *pipe, uint32_t minVersion,
 			  uint32_t maxVersion);
 
 	bool isSignatureValid(IPAModule *ipa) const;
 
+	bool discovered_;
+	std::vector<std::string> moduleFiles_;
+	unsigned int nextModule_;
 	std::vector<IPAModule *> modules_;
+	std::unique_ptr<IPAModuleCache> cache_;
+	Thread *thread_;
+	Mutex workersLock_;
+	std::multimap<IPAModule *, Worker> workers_;
+	bool reuseWorkers_;
 
 #if HAVE_IPA_PUBKEY
 	static const uint8_t publicKeyData_[];
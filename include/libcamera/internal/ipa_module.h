@@ -20,10 +20,13 @@
 
 namespace libcamera {
 
+class IPAModuleCache;
+
 class IPAModule : public Loggable
 {
 public:
-	explicit IPAModule(const std::string &libPath);
+	explicit IPAModule(const std::string &libPath,
+			   IPAModuleCache *cache = nullptr);
 	~IPAModule();
 
 	bool isValid() const;
@@ -43,7 +46,8 @@ protected:
 	std::string logPrefix() const override;
 
 private:
-	int loadIPAModuleInfo();
+	int loadIPAModuleInfo(IPAModuleCache *cache);
+	int parseIPAModuleInfo();
 
 	struct IPAModuleInfo info_;
 	std::vector<uint8_t> signature_;
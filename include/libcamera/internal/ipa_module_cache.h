@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_module_cache.h - Persistent cache of IPA module information
+ */
+#ifndef __LIBCAMERA_INTERNAL_IPA_MODULE_CACHE_H__
+#define __LIBCAMERA_INTERNAL_IPA_MODULE_CACHE_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/ipa/ipa_module_info.h>
+
+namespace libcamera {
+
+class IPAModuleCache
+{
+public:
+	explicit IPAModuleCache(const std::string &path);
+
+	static std::string defaultPath();
+
+	const std::string &path() const { return path_; }
+
+	bool lookup(const std::string &modulePath, IPAModuleInfo *info);
+	void store(const std::string &modulePath, const IPAModuleInfo &info);
+
+	int save();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(IPAModuleCache)
+
+	struct FileKey {
+		uint64_t dev;
+		uint64_t ino;
+		uint64_t size;
+		int64_t mtime;
+		int64_t ctime;
+
+		bool operator==(const FileKey &other) const;
+		bool operator!=(const FileKey &other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	struct Entry {
+		FileKey module;
+		IPAModuleInfo info;
+		bool used;
+	};
+
+	static FileKey fileKey(const std::string &path);
+
+	void load();
+	void readFile(std::map<std::string, Entry> &entries) const;
+	Entry *find(const std::string &modulePath);
+
+	std::string path_;
+	FileKey library_;
+	std::map<std::string, Entry> entries_;
+	bool dirty_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_IPA_MODULE_CACHE_H__ */
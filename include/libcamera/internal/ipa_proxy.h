@@ -8,10 +8,15 @@
 #define __LIBCAMERA_INTERNAL_IPA_PROXY_H__
 
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
+#include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
+
 #include <libcamera/ipa/ipa_interface.h>
+#include <libcamera/latency_stats.h>
 
 namespace libcamera {
 
@@ -33,14 +38,49 @@ public:
 
 	std::string configurationFile(const std::string &file) const;
 
+	struct CallStats {
+		CallStats(const char *method)
+			: name(method), bytesSent(0), bytesReceived(0)
+		{
+		}
+
+		const char *name;
+		uint64_t bytesSent;
+		uint64_t bytesReceived;
+		LatencyHistogram latency;
+	};
+
+	std::vector<CallStats> callStats() const;
+	void resetCallStats();
+	std::string callStatsToJson() const;
+
+	static std::string resolvePath(const std::string &file);
+
 protected:
-	std::string resolvePath(const std::string &file) const;
+	class CallScope
+	{
+	public:
+		CallScope(IPAProxy *proxy, unsigned int index);
+		~CallScope();
+
+	private:
+		IPAProxy *proxy_;
+		CallStats &stats_;
+		utils::time_point start_;
+	};
+
+	void initCallStats(const std::vector<const char *> &methods);
 
 	bool valid_;
 	ProxyState state_;
 
+	std::vector<CallStats> callStats_;
+
 private:
 	IPAModule *ipam_;
+
+	/* Protects the latencies recorded by CallScope from the IPA thread. */
+	mutable Mutex statsLock_;
 };
 
 } /* namespace libcamera */
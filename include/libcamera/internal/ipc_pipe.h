@@ -7,9 +7,11 @@
 #ifndef __LIBCAMERA_INTERNAL_IPA_IPC_H__
 #define __LIBCAMERA_INTERNAL_IPA_IPC_H__
 
+#include <functional>
 #include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
 
 #include "libcamera/internal/ipc_unixsocket.h"
 
@@ -27,8 +29,10 @@ public:
 	IPCMessage(uint32_t cmd);
 	IPCMessage(const Header &header);
 	IPCMessage(const IPCUnixSocket::Payload &payload);
+	IPCMessage(IPCUnixSocket::Payload &&payload);
 
 	IPCUnixSocket::Payload payload() const;
+	Span<const uint8_t> serializedHeader() const;
 
 	Header &header() { return header_; }
 	std::vector<uint8_t> &data() { return data_; }
@@ -58,6 +62,9 @@ public:
 
 	virtual int sendAsync(const IPCMessage &data) = 0;
 
+	using ReplyHandler = std::function<void(int, const IPCMessage &)>;
+	virtual int callAsync(const IPCMessage &in, ReplyHandler handler) = 0;
+
 	Signal<const IPCMessage &> recv;
 
 protected:
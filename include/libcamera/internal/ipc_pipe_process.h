@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_pipe_process.h - Image Processing Algorithm IPC module for proxy worker processes
+ */
+#ifndef __LIBCAMERA_INTERNAL_IPA_IPC_PROCESS_H__
+#define __LIBCAMERA_INTERNAL_IPA_IPC_PROCESS_H__
+
+#include <map>
+#include <memory>
+
+#include "libcamera/internal/ipc_pipe.h"
+#include "libcamera/internal/ipc_unixsocket.h"
+#include "libcamera/internal/process.h"
+
+namespace libcamera {
+
+class IPCPipeProcess : public IPCPipe
+{
+public:
+	~IPCPipeProcess();
+
+	int sendSync(const IPCMessage &in,
+		     IPCMessage *out = nullptr) override;
+
+	int sendAsync(const IPCMessage &data) override;
+
+	int callAsync(const IPCMessage &in, ReplyHandler handler) override;
+
+protected:
+	IPCPipeProcess();
+
+	int startWorker(const char *ipaModulePath, const char *ipaProxyWorkerPath,
+			int fd);
+	void receive(IPCUnixSocket::Payload &&payload);
+
+	virtual int send(const IPCMessage &message) = 0;
+
+private:
+	struct CallData {
+		IPCMessage *response;
+		bool done;
+	};
+
+	int call(const IPCMessage &message, IPCMessage *response);
+	void processFinished(Process *process, enum Process::ExitStatus exitStatus,
+			     int exitCode);
+
+	std::unique_ptr<Process> proc_;
+	std::map<uint32_t, CallData> callData_;
+	std::map<uint32_t, ReplyHandler> pendingCalls_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_IPA_IPC_PROCESS_H__ */
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_pipe_shared_memory.h - Image Processing Algorithm IPC module using shared memory rings
+ */
+#ifndef __LIBCAMERA_INTERNAL_IPA_IPC_SHARED_MEMORY_H__
+#define __LIBCAMERA_INTERNAL_IPA_IPC_SHARED_MEMORY_H__
+
+#include <memory>
+
+#include "libcamera/internal/ipc_pipe_process.h"
+#include "libcamera/internal/ipc_shared_memory.h"
+
+namespace libcamera {
+
+class IPCPipeSharedMemory : public IPCPipeProcess
+{
+public:
+	IPCPipeSharedMemory(const char *ipaModulePath, const char *ipaProxyWorkerPath);
+	~IPCPipeSharedMemory();
+
+protected:
+	int send(const IPCMessage &message) override;
+
+private:
+	void readyRead(IPCSharedMemory *ipc);
+
+	std::unique_ptr<IPCSharedMemory> ipc_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_IPA_IPC_SHARED_MEMORY_H__ */
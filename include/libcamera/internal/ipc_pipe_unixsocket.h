@@ -7,41 +7,26 @@
 #ifndef __LIBCAMERA_INTERNAL_IPA_IPC_UNIXSOCKET_H__
 #define __LIBCAMERA_INTERNAL_IPA_IPC_UNIXSOCKET_H__
 
-#include <map>
 #include <memory>
-#include <vector>
 
-#include "libcamera/internal/ipc_pipe.h"
+#include "libcamera/internal/ipc_pipe_process.h"
 #include "libcamera/internal/ipc_unixsocket.h"
 
 namespace libcamera {
 
-class Process;
-
-class IPCPipeUnixSocket : public IPCPipe
+class IPCPipeUnixSocket : public IPCPipeProcess
 {
 public:
 	IPCPipeUnixSocket(const char *ipaModulePath, const char *ipaProxyWorkerPath);
 	~IPCPipeUnixSocket();
 
-	int sendSync(const IPCMessage &in,
-		     IPCMessage *out = nullptr) override;
-
-	int sendAsync(const IPCMessage &data) override;
+protected:
+	int send(const IPCMessage &message) override;
 
 private:
-	struct CallData {
-		IPCUnixSocket::Payload *response;
-		bool done;
-	};
-
 	void readyRead(IPCUnixSocket *socket);
-	int call(const IPCUnixSocket::Payload &message,
-		 IPCUnixSocket::Payload *response, uint32_t seq);
 
-	std::unique_ptr<Process> proc_;
 	std::unique_ptr<IPCUnixSocket> socket_;
-	std::map<uint32_t, CallData> callData_;
 };
 
 } /* namespace libcamera */
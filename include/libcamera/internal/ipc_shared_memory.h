@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_shared_memory.h - IPC mechanism based on shared memory rings
+ */
+
+#ifndef __LIBCAMERA_INTERNAL_IPC_SHARED_MEMORY_H__
+#define __LIBCAMERA_INTERNAL_IPC_SHARED_MEMORY_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
+
+#include "libcamera/internal/ipc_unixsocket.h"
+
+namespace libcamera {
+
+class EventNotifier;
+
+class IPCSharedMemory
+{
+public:
+	using Payload = IPCUnixSocket::Payload;
+
+	static constexpr size_t RingSize = 256 * 1024;
+	static constexpr unsigned int MaxRegisteredFds = 64;
+	static constexpr unsigned int MaxIdleMessages = 256;
+
+	IPCSharedMemory();
+	~IPCSharedMemory();
+
+	int create();
+	int bind(int fd);
+	void close();
+	bool isBound() const;
+
+	int send(const Payload &payload);
+	int send(Span<const uint8_t> data, Span<const uint8_t> trailer,
+		 Span<const int32_t> fds);
+	int receive(Payload *payload);
+
+	Signal<IPCSharedMemory *> readyRead;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(IPCSharedMemory)
+
+	struct Ring;
+
+	struct FdSlot {
+		int srcFd;
+		int fd;
+		uint64_t lastUse;
+	};
+
+	int map(int memfd, bool owner);
+	void setup(int fd, int memfd, int txEvent, int rxEvent);
+
+	int sendMessage(Span<const uint8_t> data, Span<const uint8_t> trailer,
+			const int32_t *fds, unsigned int num);
+	int recvMessage(void *data, size_t length,
+			int32_t *fds, unsigned int num);
+
+	uint32_t registerFd(int32_t fd);
+	void releaseFd(uint32_t slot);
+	int resolveFds(const uint32_t *refs, unsigned int count,
+		       const int32_t *socketFds, unsigned int numSocketFds,
+		       int32_t *fds);
+
+	void doorbell(EventNotifier *notifier);
+
+	int fd_;
+	int memfd_;
+	int txEvent_;
+	int rxEvent_;
+
+	void *mem_;
+	Ring *tx_;
+	Ring *rx_;
+
+	EventNotifier *notifier_;
+
+	pid_t pid_;
+	bool fdRegistry_;
+	uint64_t txStamp_;
+	std::vector<FdSlot> txFds_;
+	std::vector<int> rxFds_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_IPC_SHARED_MEMORY_H__ */
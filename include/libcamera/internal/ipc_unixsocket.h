@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
 
 namespace libcamera {
 
@@ -35,6 +36,8 @@ public:
 	bool isBound() const;
 
 	int send(const Payload &payload);
+	int send(Span<const uint8_t> data, Span<const uint8_t> trailer,
+		 Span<const int32_t> fds);
 	int receive(Payload *payload);
 
 	Signal<IPCUnixSocket *> readyRead;
@@ -45,7 +48,8 @@ private:
 		uint8_t fds;
 	};
 
-	int sendData(const void *buffer, size_t length, const int32_t *fds, unsigned int num);
+	int sendData(Span<const uint8_t> data, Span<const uint8_t> trailer,
+		     const int32_t *fds, unsigned int num);
 	int recvData(void *buffer, size_t length, int32_t *fds, unsigned int num);
 
 	void dataNotifier(EventNotifier *notifier);
@@ -37,6 +37,7 @@ protected:
 
 	int error_;
 	std::vector<Plane> maps_;
+	std::vector<Plane> mappings_;
 
 private:
 	LIBCAMERA_DISABLE_COPY(MappedBuffer)
@@ -49,11 +50,22 @@ public:
 		Read = 1 << 0,
 		Write = 1 << 1,
 		ReadWrite = Read | Write,
+		Persistent = 1 << 2,
+		Populate = 1 << 3,
 	};
 
 	using MapFlags = Flags<MapFlag>;
 
 	MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags);
+
+	int beginCpuAccess(MapFlags access);
+	int endCpuAccess();
+
+private:
+	int syncDmabufs(uint64_t flags);
+
+	std::vector<FileDescriptor> dmabufs_;
+	uint64_t access_;
 };
 
 LIBCAMERA_FLAGS_ENABLE_OPERATORS(MappedFrameBuffer::MapFlag)
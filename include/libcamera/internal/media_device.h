@@ -8,8 +8,11 @@
 #define __LIBCAMERA_INTERNAL_MEDIA_DEVICE_H__
 
 #include <map>
+#include <memory>
 #include <sstream>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/media.h>
@@ -21,6 +24,8 @@
 
 namespace libcamera {
 
+class MediaRequest;
+
 class MediaDevice : protected Loggable
 {
 public:
@@ -53,6 +58,8 @@ public:
 	MediaLink *link(const MediaPad *source, const MediaPad *sink);
 	int disableLinks();
 
+	std::unique_ptr<MediaRequest> allocateRequest();
+
 	Signal<MediaDevice *> disconnected;
 
 protected:
@@ -89,6 +96,8 @@ private:
 
 	std::map<unsigned int, MediaObject *> objects_;
 	std::vector<MediaEntity *> entities_;
+	std::unordered_map<std::string, MediaEntity *> entitiesByName_;
+	std::unordered_map<uint64_t, MediaLink *> links_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media_request.h - Media request handler
+ */
+#ifndef __LIBCAMERA_INTERNAL_MEDIA_REQUEST_H__
+#define __LIBCAMERA_INTERNAL_MEDIA_REQUEST_H__
+
+#include <string>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/signal.h>
+
+namespace libcamera {
+
+class EventNotifier;
+class MediaDevice;
+
+class MediaRequest : protected Loggable
+{
+public:
+	enum Status {
+		Idle,
+		Queued,
+		Complete,
+	};
+
+	~MediaRequest();
+
+	int fd() const { return fd_; }
+	Status status() const { return status_; }
+
+	int queue();
+	int reinit();
+
+	Signal<MediaRequest *> completed;
+
+protected:
+	std::string logPrefix() const override;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(MediaRequest)
+
+	friend class MediaDevice;
+
+	MediaRequest(const MediaDevice *media, int fd);
+
+	void requestCompleted(EventNotifier *notifier);
+
+	const MediaDevice *media_;
+	int fd_;
+	Status status_;
+
+	EventNotifier *notifier_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_MEDIA_REQUEST_H__ */
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * memory_tracker.h - Accounting of the memory held by libcamera
+ */
+#ifndef __LIBCAMERA_INTERNAL_MEMORY_TRACKER_H__
+#define __LIBCAMERA_INTERNAL_MEMORY_TRACKER_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/thread.h>
+
+#include <libcamera/memory_usage.h>
+
+namespace libcamera {
+
+class FrameBuffer;
+
+class MemoryTracker
+{
+public:
+	class Allocation
+	{
+	public:
+		Allocation();
+		Allocation(Allocation &&other);
+		~Allocation();
+
+		Allocation &operator=(Allocation &&other);
+
+		bool isValid() const { return id_ != 0; }
+		void reset();
+
+	private:
+		LIBCAMERA_DISABLE_COPY(Allocation)
+
+		friend class MemoryTracker;
+		explicit Allocation(uint64_t id);
+
+		uint64_t id_;
+	};
+
+	static MemoryTracker *instance();
+
+	Allocation track(const std::string &camera, const std::string &stream,
+			 MemoryUsage::Category category, uint64_t bytes);
+	static void track(FrameBuffer *buffer, const std::string &camera,
+			  const std::string &stream, MemoryUsage::Category category);
+
+	std::vector<MemoryUsage> usage() const;
+
+private:
+	MemoryTracker();
+
+	void release(uint64_t id);
+
+	mutable Mutex mutex_;
+	uint64_t nextId_;
+	std::map<uint64_t, MemoryUsage> allocations_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_MEMORY_TRACKER_H__ */
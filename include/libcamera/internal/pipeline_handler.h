@@ -10,6 +10,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <queue>
 #include <set>
 #include <string>
 #include <sys/types.h>
@@ -17,8 +18,10 @@
 
 #include <libcamera/base/class.h>
 #include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
 
 #include <libcamera/controls.h>
+#include <libcamera/latency_stats.h>
 #include <libcamera/stream.h>
 
 #include "libcamera/internal/ipa_proxy.h"
@@ -39,17 +42,19 @@ class CameraData
 {
 public:
 	explicit CameraData(PipelineHandler *pipe)
-		: pipe_(pipe), requestSequence_(0)
+		: pipe_(pipe), requestSequence_(0), outOfOrderCompletion_(false)
 	{
 	}
 	virtual ~CameraData() = default;
 
 	PipelineHandler *pipe_;
+	std::queue<Request *> waitingRequests_;
 	std::list<Request *> queuedRequests_;
 	ControlInfoMap controlInfo_;
 	ControlList properties_;
 
 	uint32_t requestSequence_;
+	bool outOfOrderCompletion_;
 
 private:
 	LIBCAMERA_DISABLE_COPY(CameraData)
@@ -63,11 +68,12 @@ public:
 	virtual ~PipelineHandler();
 
 	virtual bool match(DeviceEnumerator *enumerator) = 0;
+	virtual bool supportsDedicatedThread() const { return false; }
 	MediaDevice *acquireMediaDevice(DeviceEnumerator *enumerator,
 					const DeviceMatch &dm);
 
-	bool lock();
-	void unlock();
+	bool lock(Camera *camera);
+	void unlock(Camera *camera);
 
 	const ControlInfoMap &controls(const Camera *camera) const;
 	const ControlList &properties(const Camera *camera) const;
@@ -77,16 +83,30 @@ public:
 	virtual int configure(Camera *camera, CameraConfiguration *config) = 0;
 
 	virtual int exportFrameBuffers(Camera *camera, Stream *stream,
+				       unsigned int count,
 				       std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
 
+	virtual int prepare(Camera *camera, const ControlList *controls);
+	virtual void unprepare(Camera *camera);
 	virtual int start(Camera *camera, const ControlList *controls) = 0;
 	virtual void stop(Camera *camera) = 0;
+	virtual int prepareConfiguration(Camera *camera,
+					 CameraConfiguration *config);
+	virtual int reconfigure(Camera *camera, CameraConfiguration *config);
 	bool hasPendingRequests(const Camera *camera) const;
 
 	void queueRequest(Request *request);
+	void queueRequests(const std::vector<Request *> &requests);
+	void cancelWaitingRequests(Camera *camera);
+	void setOutOfOrderCompletion(Camera *camera, bool enable);
 
 	bool completeBuffer(Request *request, FrameBuffer *buffer);
+	void completeMetadata(Request *request, const ControlList &metadata);
 	void completeRequest(Request *request);
+	bool cancelExpiredRequest(Request *request);
+
+	void recordLatency(Request *request, RequestLatencyStats::Stage stage,
+			   std::chrono::nanoseconds latency);
 
 	const char *name() const { return name_; }
 
@@ -97,21 +117,34 @@ protected:
 
 	virtual int queueRequestDevice(Camera *camera, Request *request) = 0;
 
+	virtual bool acquireDevice(Camera *camera);
+	virtual void releaseDevice(Camera *camera);
+
 	CameraData *cameraData(const Camera *camera);
 	const CameraData *cameraData(const Camera *camera) const;
 
 	CameraManager *manager_;
 
 private:
+	void prepareRequest(Request *request);
+	void recordCompletion(Camera *camera, Request *request);
+	void doQueueRequest(Request *request);
+	void doQueueRequests(Request *request);
+
 	void mediaDeviceDisconnected(MediaDevice *media);
 	virtual void disconnect();
 
+	void unlockMediaDevices();
+
 	std::vector<std::shared_ptr<MediaDevice>> mediaDevices_;
 	std::vector<std::weak_ptr<Camera>> cameras_;
 	std::map<const Camera *, std::unique_ptr<CameraData>> cameraData_;
 
 	const char *name_;
 
+	Mutex lock_;
+	unsigned int useCount_;
+
 	friend class PipelineHandlerFactory;
 };
 
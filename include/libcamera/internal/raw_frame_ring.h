@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * raw_frame_ring.h - Ring of recently captured RAW frames
+ */
+#ifndef __LIBCAMERA_INTERNAL_RAW_FRAME_RING_H__
+#define __LIBCAMERA_INTERNAL_RAW_FRAME_RING_H__
+
+#include <deque>
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/controls.h>
+
+namespace libcamera {
+
+class FrameBuffer;
+class Request;
+
+class RawFrameRing
+{
+public:
+	struct Frame {
+		FrameBuffer *buffer;
+		ControlList metadata;
+	};
+
+	RawFrameRing();
+
+	void reset(unsigned int capacity);
+	std::vector<FrameBuffer *> clear();
+
+	unsigned int capacity() const { return capacity_; }
+	unsigned int size() const { return frames_.size(); }
+	bool empty() const { return frames_.empty(); }
+
+	FrameBuffer *push(FrameBuffer *buffer, ControlList metadata);
+	std::optional<Frame> take(int64_t timestamp = 0);
+
+	static bool requested(Request *request);
+	static int64_t requestedTimestamp(Request *request);
+
+private:
+	LIBCAMERA_DISABLE_COPY(RawFrameRing)
+
+	static int64_t frameTimestamp(const Frame &frame);
+
+	unsigned int capacity_;
+	std::deque<Frame> frames_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_RAW_FRAME_RING_H__ */
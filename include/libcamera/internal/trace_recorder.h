@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * trace_recorder.h - In-process trace event recorder
+ */
+#ifndef __LIBCAMERA_INTERNAL_TRACE_RECORDER_H__
+#define __LIBCAMERA_INTERNAL_TRACE_RECORDER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/thread.h>
+
+namespace libcamera {
+
+class TraceRecorder
+{
+public:
+	static constexpr unsigned int MaxFields = 6;
+
+	struct Hex {
+		uint64_t value;
+	};
+
+	struct Field {
+		enum Type : uint8_t {
+			None,
+			Int,
+			UInt,
+			Hex,
+			Double,
+			String,
+		};
+
+		Type type;
+		union {
+			int64_t i;
+			uint64_t u;
+			double d;
+			char s[24];
+		};
+	};
+
+	struct Event {
+		uint64_t timestamp;
+		const char *name;
+		const char *const *fieldNames;
+		unsigned int numFields;
+		Field fields[MaxFields];
+	};
+
+	static TraceRecorder *instance();
+
+	static bool enabled()
+	{
+		return enabled_.load(std::memory_order_relaxed);
+	}
+
+	void start(unsigned int size = 0);
+	void stop();
+
+	void dump(std::ostream &stream) const;
+	int dump(const std::string &path) const;
+
+	template<size_t N, typename... Args>
+	static void record(const char *name, const char *const (&fieldNames)[N],
+			   const Args &...values)
+	{
+		static_assert(sizeof...(Args) == N, "Invalid number of fields");
+
+		TraceRecorder *recorder = instance();
+		Event *event = recorder->beginEvent();
+
+		event->name = name;
+		event->fieldNames = fieldNames;
+		event->numFields = std::min<unsigned int>(N, MaxFields);
+
+		unsigned int index = 0;
+		(store(event, index++, values), ...);
+
+		recorder->endEvent();
+	}
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(TraceRecorder)
+
+	class Ring;
+
+	TraceRecorder();
+	~TraceRecorder();
+
+	Event *beginEvent();
+	void endEvent();
+
+	template<typename T>
+	static void store(Event *event, unsigned int index, const T &value)
+	{
+		if (index >= MaxFields)
+			return;
+
+		using U = std::decay_t<T>;
+		Field &field = event->fields[index];
+
+		if constexpr (std::is_same_v<U, const char *> || std::is_same_v<U, char *>) {
+			field.type = Field::String;
+			strncpy(field.s, value ? value : "", sizeof(field.s) - 1);
+			field.s[sizeof(field.s) - 1] = '\0';
+		} else if constexpr (std::is_same_v<U, std::string>) {
+			field.type = Field::String;
+			strncpy(field.s, value.c_str(), sizeof(field.s) - 1);
+			field.s[sizeof(field.s) - 1] = '\0';
+		} else if constexpr (std::is_same_v<U, TraceRecorder::Hex>) {
+			field.type = Field::Hex;
+			field.u = value.value;
+		} else if constexpr (std::is_enum_v<U>) {
+			field.type = Field::Int;
+			field.i = static_cast<int64_t>(value);
+		} else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+			field.type = Field::Int;
+			field.i = value;
+		} else if constexpr (std::is_integral_v<U>) {
+			field.type = Field::UInt;
+			field.u = value;
+		} else if constexpr (std::is_floating_point_v<U>) {
+			field.type = Field::Double;
+			field.d = value;
+		} else if constexpr (std::is_pointer_v<U>) {
+			field.type = Field::Hex;
+			field.u = reinterpret_cast<uintptr_t>(value);
+		} else {
+			field.type = Field::None;
+		}
+	}
+
+	void setupSignal();
+	void signalThread();
+	static void signalHandler(int signal);
+
+	static std::atomic<bool> enabled_;
+	static thread_local Ring *ring_;
+
+	mutable Mutex mutex_;
+	std::vector<std::unique_ptr<Ring>> rings_;
+	unsigned int size_;
+
+	std::string path_;
+	int pipe_[2];
+	std::thread thread_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_TRACE_RECORDER_H__ */
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * v4l2_control_batch.h - Batched V4L2 control writes for multiple devices
+ */
+#ifndef __LIBCAMERA_INTERNAL_V4L2_CONTROL_BATCH_H__
+#define __LIBCAMERA_INTERNAL_V4L2_CONTROL_BATCH_H__
+
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/controls.h>
+
+namespace libcamera {
+
+class MediaRequest;
+class V4L2Device;
+
+class V4L2ControlBatch
+{
+public:
+	V4L2ControlBatch();
+
+	bool empty() const { return size_ == 0; }
+	unsigned int size() const { return size_; }
+
+	V4L2Device *device(unsigned int index) const { return entries_[index].device; }
+	const ControlList &controls(unsigned int index) const { return entries_[index].controls; }
+
+	void add(V4L2Device *device, const ControlList &controls);
+	void clear();
+
+	int commit(MediaRequest *request = nullptr);
+
+private:
+	LIBCAMERA_DISABLE_COPY(V4L2ControlBatch)
+
+	struct Entry {
+		V4L2Device *device;
+		ControlList controls;
+	};
+
+	/* Entries past size_ are kept to reuse their storage. */
+	std::vector<Entry> entries_;
+	unsigned int size_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_V4L2_CONTROL_BATCH_H__ */
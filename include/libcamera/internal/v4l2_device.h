@@ -22,6 +22,8 @@
 namespace libcamera {
 
 class EventNotifier;
+class MediaRequest;
+class Thread;
 
 class V4L2Device : protected Loggable
 {
@@ -32,7 +34,7 @@ public:
 	const ControlInfoMap &controls() const { return controls_; }
 
 	ControlList getControls(const std::vector<uint32_t> &ids);
-	int setControls(ControlList *ctrls);
+	int setControls(ControlList *ctrls, MediaRequest *request = nullptr);
 
 	const struct v4l2_query_ext_ctrl *controlInfo(uint32_t id) const;
 
@@ -42,8 +44,12 @@ public:
 	int setFrameStartEnabled(bool enable);
 	Signal<uint32_t> frameStart;
 
+	void setEventThread(Thread *thread);
+
 	void updateControlInfo();
 
+	virtual void invalidateFormatsCache();
+
 protected:
 	V4L2Device(const std::string &deviceNode);
 	~V4L2Device();
@@ -55,6 +61,8 @@ protected:
 
 	int fd() const { return fd_; }
 
+	void invalidateControlsCache();
+
 private:
 	static ControlType v4l2CtrlType(uint32_t ctrlType);
 	static std::unique_ptr<ControlId> v4l2ControlId(const v4l2_query_ext_ctrl &ctrl);
@@ -64,6 +72,9 @@ private:
 	void listControls();
 	void updateControls(ControlList *ctrls,
 			    Span<const v4l2_ext_control> v4l2Ctrls);
+	void cacheControls(const ControlList &ctrls,
+			   Span<const v4l2_ext_control> v4l2Ctrls);
+	static bool isCacheable(const struct v4l2_query_ext_ctrl &ctrl);
 
 	void eventAvailable(EventNotifier *notifier);
 
@@ -71,6 +82,7 @@ private:
 	std::vector<std::unique_ptr<ControlId>> controlIds_;
 	ControlIdMap controlIdMap_;
 	ControlInfoMap controls_;
+	ControlList controlsCache_;
 	std::string deviceNode_;
 	int fd_;
 
@@ -46,6 +46,7 @@ public:
 	~V4L2Subdevice();
 
 	int open();
+	void close();
 
 	const MediaEntity *entity() const { return entity_; }
 
@@ -55,6 +56,7 @@ public:
 			 Rectangle *rect);
 
 	Formats formats(unsigned int pad);
+	void invalidateFormatsCache() override;
 
 	int getFormat(unsigned int pad, V4L2SubdeviceFormat *format,
 		      Whence whence = ActiveFormat);
@@ -75,6 +77,8 @@ private:
 					    unsigned int code);
 
 	const MediaEntity *entity_;
+
+	std::map<unsigned int, Formats> formatsCache_;
 };
 
 } /* namespace libcamera */
@@ -10,8 +10,12 @@
 #include <array>
 #include <atomic>
 #include <memory>
+#include <set>
 #include <stdint.h>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <linux/videodev2.h>
@@ -19,6 +23,7 @@
 #include <libcamera/base/class.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/signal.h>
+#include <libcamera/base/span.h>
 
 #include <libcamera/framebuffer.h>
 #include <libcamera/geometry.h>
@@ -34,6 +39,7 @@ class EventNotifier;
 class FileDescriptor;
 class MediaDevice;
 class MediaEntity;
+class MediaRequest;
 
 struct V4L2Capability final : v4l2_capability {
 	const char *driver() const
@@ -118,9 +124,31 @@ public:
 	V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
 	~V4L2BufferCache();
 
+	enum class EvictionPolicy {
+		LeastRecentlyUsed,
+		LeastFrequentlyUsed,
+	};
+
+	struct Statistics {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+	};
+
+	EvictionPolicy evictionPolicy() const { return policy_; }
+	void setEvictionPolicy(EvictionPolicy policy);
+
+	void addEntries(unsigned int numEntries);
+	void addEntries(const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
+
+	unsigned int size() const { return cache_.size(); }
+
 	int get(const FrameBuffer &buffer);
 	void put(unsigned int index);
 
+	const Statistics &statistics() const { return stats_; }
+	void resetStatistics();
+
 private:
 	class Entry
 	{
@@ -129,9 +157,14 @@ private:
 		Entry(bool free, uint64_t lastUsed, const FrameBuffer &buffer);
 
 		bool operator==(const FrameBuffer &buffer) const;
+		bool isValid() const { return !planes_.empty(); }
+
+		static uint64_t hash(const FrameBuffer &buffer);
 
 		bool free_;
 		uint64_t lastUsed_;
+		uint64_t uses_;
+		uint64_t hash_;
 
 	private:
 		struct Plane {
@@ -147,10 +180,17 @@ private:
 		std::vector<Plane> planes_;
 	};
 
+	using EvictionKey = std::tuple<uint64_t, uint64_t, unsigned int>;
+
+	EvictionKey evictionKey(unsigned int index) const;
+	void removeFromIndex(unsigned int index);
+
+	EvictionPolicy policy_;
 	std::atomic<uint64_t> lastUsedCounter_;
 	std::vector<Entry> cache_;
-	/* \todo Expose the miss counter through an instrumentation API. */
-	unsigned int missCounter_;
+	std::unordered_multimap<uint64_t, unsigned int> index_;
+	std::set<EvictionKey> freeEntries_;
+	Statistics stats_;
 };
 
 class V4L2DeviceFormat
@@ -193,6 +233,7 @@ public:
 	int tryFormat(V4L2DeviceFormat *format);
 	int setFormat(V4L2DeviceFormat *format);
 	Formats formats(uint32_t code = 0);
+	void invalidateFormatsCache() override;
 
 	int setSelection(unsigned int target, Rectangle *rect);
 
@@ -201,11 +242,27 @@ public:
 	int exportBuffers(unsigned int count,
 			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 	int importBuffers(unsigned int count);
+	int addBuffers(unsigned int count,
+		       std::vector<std::unique_ptr<FrameBuffer>> *buffers = nullptr);
 	int releaseBuffers();
 
-	int queueBuffer(FrameBuffer *buffer);
+	V4L2BufferCache::Statistics bufferCacheStatistics() const;
+	void setBufferCacheEvictionPolicy(V4L2BufferCache::EvictionPolicy policy);
+	int setBufferCacheGrowth(unsigned int maxEntries,
+				 float evictionThreshold = 0.25f);
+
+	bool supportsRequests() const
+	{
+		return bufferCaps_ & V4L2_BUF_CAP_SUPPORTS_REQUESTS;
+	}
+
+	int queueBuffer(FrameBuffer *buffer, MediaRequest *request = nullptr);
+	int queueBuffers(Span<FrameBuffer *const> buffers,
+			 unsigned int *queued = nullptr);
 	Signal<FrameBuffer *> bufferReady;
 
+	int setBufferDrainingEnabled(bool enable);
+
 	int streamOn();
 	int streamOff();
 
@@ -238,6 +295,9 @@ private:
 	std::unique_ptr<FrameBuffer> createBuffer(unsigned int index);
 	FileDescriptor exportDmabufFd(unsigned int index, unsigned int plane);
 
+	int enqueueBuffer(FrameBuffer *buffer, MediaRequest *request);
+	void growBufferCache();
+
 	void bufferAvailable(EventNotifier *notifier);
 	FrameBuffer *dequeueBuffer();
 
@@ -245,13 +305,22 @@ private:
 
 	enum v4l2_buf_type bufferType_;
 	enum v4l2_memory memoryType_;
+	uint32_t bufferCaps_;
 
 	V4L2BufferCache *cache_;
-	std::map<unsigned int, FrameBuffer *> queuedBuffers_;
+	V4L2BufferCache::EvictionPolicy cachePolicy_;
+	unsigned int cacheMaxEntries_;
+	float cacheEvictionThreshold_;
+	V4L2BufferCache::Statistics cacheWindowStart_;
+	std::vector<FrameBuffer *> queuedBuffers_;
+	unsigned int queuedCount_;
 
 	EventNotifier *fdBufferNotifier_;
 
+	bool drainBuffers_;
 	bool streaming_;
+
+	std::map<uint32_t, Formats> formatsCache_;
 };
 
 class V4L2M2MDevice
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * latency_stats.h - Request latency statistics
+ */
+#ifndef __LIBCAMERA_LATENCY_STATS_H__
+#define __LIBCAMERA_LATENCY_STATS_H__
+
+#include <array>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+namespace libcamera {
+
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void record(std::chrono::nanoseconds latency);
+	void reset();
+
+	uint64_t count() const { return count_; }
+	std::chrono::nanoseconds min() const;
+	std::chrono::nanoseconds max() const;
+	std::chrono::nanoseconds mean() const;
+	std::chrono::nanoseconds percentile(double percent) const;
+
+	std::string toJson() const;
+
+private:
+	static constexpr unsigned int NumBuckets = 264;
+
+	static unsigned int bucketIndex(uint64_t us);
+	static uint64_t bucketUpperBound(unsigned int index);
+
+	std::array<uint64_t, NumBuckets> buckets_;
+	uint64_t count_;
+	uint64_t sum_;
+	uint64_t min_;
+	uint64_t max_;
+};
+
+class RequestLatencyStats
+{
+public:
+	enum Stage {
+		QueueToDevice,
+		DeviceToBuffer,
+		IpaProcessing,
+		Completion,
+	};
+
+	static constexpr unsigned int NumStages = Completion + 1;
+
+	static const char *stageName(Stage stage);
+
+	const LatencyHistogram &histogram(Stage stage) const
+	{
+		return histograms_[stage];
+	}
+
+	void record(Stage stage, std::chrono::nanoseconds latency);
+	void reset();
+
+	std::string toJson() const;
+
+private:
+	std::array<LatencyHistogram, NumStages> histograms_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_LATENCY_STATS_H__ */
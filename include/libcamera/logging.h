@@ -16,10 +16,11 @@ enum LoggingTarget {
 	LoggingTargetStream,
 };
 
-int logSetFile(const char *path);
+int logSetFile(const char *path, bool binary = false);
 int logSetStream(std::ostream *stream);
 int logSetTarget(LoggingTarget target);
 void logSetLevel(const char *category, const char *level);
+void logSetAsync(bool async);
 
 } /* namespace libcamera */
 
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * memory_usage.h - Memory held by libcamera
+ */
+#ifndef __LIBCAMERA_MEMORY_USAGE_H__
+#define __LIBCAMERA_MEMORY_USAGE_H__
+
+#include <stdint.h>
+#include <string>
+
+namespace libcamera {
+
+struct MemoryUsage {
+	enum class Category {
+		FrameBuffers,
+		InternalBuffers,
+		IPABuffers,
+	};
+
+	static const char *categoryName(Category category);
+
+	std::string camera;
+	std::string stream;
+	Category category;
+	uint64_t bytes;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_MEMORY_USAGE_H__ */
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * queue_status.h - Request queue health of a camera
+ */
+#ifndef __LIBCAMERA_QUEUE_STATUS_H__
+#define __LIBCAMERA_QUEUE_STATUS_H__
+
+#include <chrono>
+#include <stdint.h>
+
+namespace libcamera {
+
+class QueueStatus
+{
+public:
+	QueueStatus();
+
+	void requestQueued();
+	bool requestCompleted(bool starved);
+	bool updateDepth(std::chrono::nanoseconds processing,
+			 std::chrono::nanoseconds interval);
+	void reset();
+
+	unsigned int queued() const { return queued_; }
+	uint64_t starvations() const { return starvations_; }
+	unsigned int recommendedDepth() const;
+
+private:
+	unsigned int queued_;
+	unsigned int peak_;
+	uint64_t starvations_;
+	unsigned int depth_;
+	unsigned int margin_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_QUEUE_STATUS_H__ */
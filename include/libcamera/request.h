@@ -7,23 +7,27 @@
 #ifndef __LIBCAMERA_REQUEST_H__
 #define __LIBCAMERA_REQUEST_H__
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <stdint.h>
 #include <string>
-#include <unordered_set>
+#include <vector>
 
 #include <libcamera/base/class.h>
 #include <libcamera/base/signal.h>
 
 #include <libcamera/controls.h>
+#include <libcamera/fence.h>
 
 namespace libcamera {
 
 class Camera;
 class CameraControlValidator;
+class EventNotifier;
 class FrameBuffer;
 class Stream;
+class Timer;
 
 class Request
 {
@@ -48,10 +52,16 @@ public:
 
 	ControlList &controls() { return *controls_; }
 	ControlList &metadata() { return *metadata_; }
+	std::shared_ptr<const ControlList> sharedMetadata() const { return metadata_; }
 	const BufferMap &buffers() const { return bufferMap_; }
-	int addBuffer(const Stream *stream, FrameBuffer *buffer);
+	int addBuffer(const Stream *stream, FrameBuffer *buffer,
+		      std::unique_ptr<Fence> fence = nullptr);
 	FrameBuffer *findBuffer(const Stream *stream) const;
 
+	void setDeadline(std::chrono::steady_clock::time_point deadline) { deadline_ = deadline; }
+	std::chrono::steady_clock::time_point deadline() const { return deadline_; }
+	bool expired() const;
+
 	uint32_t sequence() const { return sequence_; }
 	uint64_t cookie() const { return cookie_; }
 	Status status() const { return status_; }
@@ -70,17 +80,34 @@ private:
 
 	bool completeBuffer(FrameBuffer *buffer);
 
+	void prepare(std::chrono::milliseconds timeout);
+	void notifierActivated(EventNotifier *notifier);
+	void timeout(Timer *timer);
+	void cancelPrepare();
+	void clearFences();
+
+	Signal<Request *> prepared;
+
 	Camera *camera_;
 	CameraControlValidator *validator_;
 	ControlList *controls_;
-	ControlList *metadata_;
+	std::shared_ptr<ControlList> metadata_;
 	BufferMap bufferMap_;
-	std::unordered_set<FrameBuffer *> pending_;
+	std::vector<BufferMap::node_type> freeNodes_;
+	std::vector<FrameBuffer *> pending_;
+
+	std::map<FrameBuffer *, std::unique_ptr<EventNotifier>> notifiers_;
+	std::unique_ptr<Timer> timer_;
+
+	std::chrono::steady_clock::time_point deadline_;
+	std::chrono::steady_clock::time_point queueTime_;
+	std::chrono::steady_clock::time_point deviceTime_;
 
 	uint32_t sequence_;
 	const uint64_t cookie_;
 	Status status_;
 	bool cancelled_;
+	bool prepared_;
 };
 
 } /* namespace libcamera */
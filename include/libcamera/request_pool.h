@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * request_pool.h - Pool of reusable capture requests
+ */
+#ifndef __LIBCAMERA_REQUEST_POOL_H__
+#define __LIBCAMERA_REQUEST_POOL_H__
+
+#include <memory>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/request.h>
+
+namespace libcamera {
+
+class Camera;
+
+class RequestPool : public Extensible
+{
+	LIBCAMERA_DECLARE_PRIVATE()
+
+public:
+	RequestPool(std::shared_ptr<Camera> camera);
+	~RequestPool();
+
+	int allocate(unsigned int count);
+
+	Request *acquire();
+	int release(Request *request,
+		    Request::ReuseFlag flags = Request::Default);
+
+	unsigned int size() const;
+	unsigned int available() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(RequestPool)
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_REQUEST_POOL_H__ */
@@ -27,13 +27,19 @@ public:
 	StreamFormats();
 	StreamFormats(const std::map<PixelFormat, std::vector<SizeRange>> &formats);
 
-	std::vector<PixelFormat> pixelformats() const;
-	std::vector<Size> sizes(const PixelFormat &pixelformat) const;
+	const std::vector<PixelFormat> &pixelformats() const { return pixelformats_; }
+	const std::vector<Size> &sizes(const PixelFormat &pixelformat) const;
 
 	SizeRange range(const PixelFormat &pixelformat) const;
 
 private:
-	std::map<PixelFormat, std::vector<SizeRange>> formats_;
+	struct Entry {
+		std::vector<Size> sizes;
+		SizeRange range;
+	};
+
+	std::vector<PixelFormat> pixelformats_;
+	std::map<PixelFormat, Entry> entries_;
 };
 
 struct StreamConfiguration {
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * stream_stats.h - Per-stream frame statistics
+ */
+#ifndef __LIBCAMERA_STREAM_STATS_H__
+#define __LIBCAMERA_STREAM_STATS_H__
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+#include <libcamera/latency_stats.h>
+
+namespace libcamera {
+
+struct FrameMetadata;
+
+class StreamStats
+{
+public:
+	StreamStats();
+
+	void record(const FrameMetadata &metadata,
+		    std::chrono::nanoseconds completion);
+	void reset();
+
+	uint64_t frames() const { return frames_; }
+	uint64_t dropped() const { return dropped_; }
+	uint64_t errors() const { return errors_; }
+	double frameRate() const;
+
+	const LatencyHistogram &frameInterval() const { return interval_; }
+	const LatencyHistogram &jitter() const { return jitter_; }
+	const LatencyHistogram &latency() const { return latency_; }
+
+	std::string toJson() const;
+
+private:
+	uint64_t frames_;
+	uint64_t dropped_;
+	uint64_t errors_;
+
+	LatencyHistogram interval_;
+	LatencyHistogram jitter_;
+	LatencyHistogram latency_;
+
+	bool running_;
+	uint32_t lastSequence_;
+	std::chrono::nanoseconds lastCompletion_;
+	std::chrono::nanoseconds lastInterval_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_STREAM_STATS_H__ */
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * buffer_handle_cache.h - Cache of objects associated with gralloc buffers
+ */
+#ifndef __ANDROID_BUFFER_HANDLE_CACHE_H__
+#define __ANDROID_BUFFER_HANDLE_CACHE_H__
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <hardware/camera3.h>
+
+/*
+ * The camera framework cycles through a small set of gralloc buffers for each
+ * stream, and passes the same buffer_handle_t for every request that uses the
+ * same buffer. The BufferHandleCache stores objects derived from a buffer,
+ * such as a libcamera FrameBuffer or a CPU mapping, to avoid recreating them
+ * for every request.
+ *
+ * A buffer_handle_t may be freed and its address reused for a different
+ * buffer. Entries are thus validated against the identity of the dmabuf of
+ * the first plane, and recreated if it doesn't match.
+ *
+ * Objects are returned as shared pointers, entries evicted from the cache, in
+ * least recently used order when the capacity is exceeded, stay alive until
+ * their last user releases them.
+ *
+ * The cache isn't thread-safe, each instance must be used from a single
+ * thread or be protected by the caller.
+ */
+template<typename T>
+class BufferHandleCache
+{
+public:
+	using Factory = std::function<std::unique_ptr<T>(buffer_handle_t)>;
+
+	BufferHandleCache()
+		: capacity_(0), sequence_(0)
+	{
+	}
+
+	void setCapacity(unsigned int capacity)
+	{
+		capacity_ = capacity;
+		trim();
+	}
+
+	std::shared_ptr<T> get(buffer_handle_t handle, const Factory &create)
+	{
+		struct stat st;
+		if (!capacity_ || handle->numFds < 1 ||
+		    fstat(handle->data[0], &st) < 0)
+			return create(handle);
+
+		auto iter = entries_.find(handle);
+		if (iter != entries_.end()) {
+			Entry &entry = iter->second;
+			if (entry.dev == st.st_dev && entry.ino == st.st_ino) {
+				entry.lastUse = ++sequence_;
+				return entry.object;
+			}
+
+			entries_.erase(iter);
+		}
+
+		std::shared_ptr<T> object = create(handle);
+		if (!object)
+			return nullptr;
+
+		entries_[handle] = { st.st_dev, st.st_ino, ++sequence_, object };
+		trim();
+
+		return object;
+	}
+
+	void clear()
+	{
+		entries_.clear();
+	}
+
+private:
+	struct Entry {
+		dev_t dev;
+		ino_t ino;
+		uint64_t lastUse;
+		std::shared_ptr<T> object;
+	};
+
+	void trim()
+	{
+		while (entries_.size() > capacity_) {
+			auto oldest = entries_.begin();
+			for (auto iter = entries_.begin(); iter != entries_.end(); ++iter) {
+				if (iter->second.lastUse < oldest->second.lastUse)
+					oldest = iter;
+			}
+
+			entries_.erase(oldest);
+		}
+	}
+
+	unsigned int capacity_;
+	uint64_t sequence_;
+	std::map<buffer_handle_t, Entry> entries_;
+};
+
+#endif /* __ANDROID_BUFFER_HANDLE_CACHE_H__ */
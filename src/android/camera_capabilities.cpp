@@ -17,10 +17,13 @@
 
 #include <libcamera/base/log.h>
 
+#include <libcamera/camera_manager.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 #include <libcamera/property_ids.h>
 
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/device_cache.h"
 #include "libcamera/internal/formats.h"
 
 using namespace libcamera;
@@ -386,21 +389,125 @@ int CameraCapabilities::initialize(std::shared_ptr<libcamera::Camera> camera,
 	facing_ = facing;
 	rawStreamAvailable_ = false;
 
-	/* Acquire the camera and initialize available stream configurations. */
-	int ret = camera_->acquire();
-	if (ret) {
-		LOG(HAL, Error) << "Failed to temporarily acquire the camera";
-		return ret;
-	}
+	/*
+	 * Probing the stream configurations requires validating a large number
+	 * of configurations. The result only depends on the camera and on the
+	 * libcamera and kernel versions, store it in the device cache to skip
+	 * probing the next time the HAL is started.
+	 */
+	DeviceCache *cache = DeviceCache::instance();
+	std::string key;
+	if (cache->enabled())
+		key = "android:" + CameraManager::version() + ":" +
+		      DeviceCache::kernelRelease() + ":" + camera_->id();
+
+	if (key.empty() || !loadStreamConfigurations(key)) {
+		/* Acquire the camera and initialize available stream configurations. */
+		int ret = camera_->acquire();
+		if (ret) {
+			LOG(HAL, Error) << "Failed to temporarily acquire the camera";
+			return ret;
+		}
+
+		ret = initializeStreamConfigurations();
+		camera_->release();
+		if (ret)
+			return ret;
 
-	ret = initializeStreamConfigurations();
-	camera_->release();
-	if (ret)
-		return ret;
+		if (!key.empty())
+			storeStreamConfigurations(key);
+	}
 
 	return initializeStaticMetadata();
 }
 
+bool CameraCapabilities::loadStreamConfigurations(const std::string &key)
+{
+	std::vector<uint8_t> data;
+	if (!DeviceCache::instance()->lookup(key, &data))
+		return false;
+
+	ByteStreamBuffer buffer(static_cast<const uint8_t *>(data.data()),
+				data.size());
+	uint32_t rawStreamAvailable = 0;
+	uint32_t maxJpegBufferSize = 0;
+	uint32_t numFormats = 0;
+	uint32_t numConfigurations = 0;
+
+	buffer.read(&rawStreamAvailable);
+	buffer.read(&maxJpegBufferSize);
+
+	std::map<int, PixelFormat> formatsMap;
+	buffer.read(&numFormats);
+	for (uint32_t i = 0; i < numFormats && !buffer.overflow(); ++i) {
+		int32_t androidFormat = 0;
+		uint32_t fourcc = 0;
+		uint64_t modifier = 0;
+
+		buffer.read(&androidFormat);
+		buffer.read(&fourcc);
+		buffer.read(&modifier);
+
+		formatsMap[androidFormat] = PixelFormat(fourcc, modifier);
+	}
+
+	std::vector<Camera3StreamConfiguration> streamConfigurations;
+	buffer.read(&numConfigurations);
+	for (uint32_t i = 0; i < numConfigurations && !buffer.overflow(); ++i) {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		int32_t androidFormat = 0;
+
+		buffer.read(&width);
+		buffer.read(&height);
+		buffer.read(&androidFormat);
+
+		streamConfigurations.push_back({ { width, height }, androidFormat });
+	}
+
+	if (buffer.overflow() || buffer.offset() != data.size() ||
+	    streamConfigurations.empty())
+		return false;
+
+	rawStreamAvailable_ = rawStreamAvailable;
+	maxJpegBufferSize_ = maxJpegBufferSize;
+	formatsMap_ = std::move(formatsMap);
+	streamConfigurations_ = std::move(streamConfigurations);
+
+	LOG(HAL, Debug) << "Using cached stream configurations for "
+			<< camera_->id();
+
+	return true;
+}
+
+void CameraCapabilities::storeStreamConfigurations(const std::string &key)
+{
+	std::vector<uint8_t> data;
+	auto append = [&data](const auto &value) {
+		const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&value);
+		data.insert(data.end(), ptr, ptr + sizeof(value));
+	};
+
+	append(static_cast<uint32_t>(rawStreamAvailable_));
+	append(static_cast<uint32_t>(maxJpegBufferSize_));
+
+	append(static_cast<uint32_t>(formatsMap_.size()));
+	for (const auto &[androidFormat, pixelFormat] : formatsMap_) {
+		append(static_cast<int32_t>(androidFormat));
+		append(pixelFormat.fourcc());
+		append(pixelFormat.modifier());
+	}
+
+	append(static_cast<uint32_t>(streamConfigurations_.size()));
+	for (const Camera3StreamConfiguration &entry : streamConfigurations_) {
+		append(entry.resolution.width);
+		append(entry.resolution.height);
+		append(static_cast<int32_t>(entry.androidFormat));
+	}
+
+	DeviceCache::instance()->store(key, std::move(data));
+}
+
 std::vector<Size>
 CameraCapabilities::initializeYUVResolutions(const PixelFormat &pixelFormat,
 					     const std::vector<Size> &resolutions)
@@ -411,11 +518,22 @@ CameraCapabilities::initializeYUVResolutions(const PixelFormat &pixelFormat,
 	StreamConfiguration &cfg = cameraConfig->at(0);
 
 	for (const Size &res : resolutions) {
+		auto key = std::make_pair(pixelFormat, res);
+		auto iter = validatedYUVResolutions_.find(key);
+		if (iter != validatedYUVResolutions_.end()) {
+			if (iter->second)
+				supportedResolutions.push_back(res);
+			continue;
+		}
+
 		cfg.pixelFormat = pixelFormat;
 		cfg.size = res;
 
 		CameraConfiguration::Status status = cameraConfig->validate();
-		if (status != CameraConfiguration::Valid) {
+		bool supported = status == CameraConfiguration::Valid;
+		validatedYUVResolutions_[key] = supported;
+
+		if (!supported) {
 			LOG(HAL, Debug) << cfg.toString() << " not supported";
 			continue;
 		}
@@ -10,6 +10,8 @@
 #include <map>
 #include <memory>
 #include <set>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <libcamera/base/class.h>
@@ -61,6 +63,8 @@ private:
 	std::vector<libcamera::Size>
 	initializeRawResolutions(const libcamera::PixelFormat &pixelFormat);
 	int initializeStreamConfigurations();
+	bool loadStreamConfigurations(const std::string &key);
+	void storeStreamConfigurations(const std::string &key);
 
 	int initializeStaticMetadata();
 
@@ -71,6 +75,12 @@ private:
 	bool rawStreamAvailable_;
 	camera_metadata_enum_android_info_supported_hardware_level hwLevel_;
 
+	/*
+	 * Outcome of the validation of single stream configurations, as
+	 * multiple Android formats map to the same libcamera format.
+	 */
+	std::map<std::pair<libcamera::PixelFormat, libcamera::Size>, bool> validatedYUVResolutions_;
+
 	std::vector<Camera3StreamConfiguration> streamConfigurations_;
 	std::map<int, libcamera::PixelFormat> formatsMap_;
 	std::unique_ptr<CameraMetadata> staticMetadata_;
@@ -21,6 +21,7 @@
 
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
+#include <libcamera/fence.h>
 #include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 
@@ -32,6 +33,27 @@ LOG_DECLARE_CATEGORY(HAL)
 
 namespace {
 
+/*
+ * Capacity of the result metadata packs.
+ *
+ * \todo Keep this in sync with the actual number of entries.
+ * Currently: 40 entries, 156 bytes
+ *
+ * Reserve more space for the JPEG metadata set by the post-processor.
+ * Currently:
+ * ANDROID_JPEG_GPS_COORDINATES (double x 3) = 24 bytes
+ * ANDROID_JPEG_GPS_PROCESSING_METHOD (byte x 32) = 32 bytes
+ * ANDROID_JPEG_GPS_TIMESTAMP (int64) = 8 bytes
+ * ANDROID_JPEG_SIZE (int32_t) = 4 bytes
+ * ANDROID_JPEG_QUALITY (byte) = 1 byte
+ * ANDROID_JPEG_ORIENTATION (int32_t) = 4 bytes
+ * ANDROID_JPEG_THUMBNAIL_QUALITY (byte) = 1 byte
+ * ANDROID_JPEG_THUMBNAIL_SIZE (int32 x 2) = 8 bytes
+ * Total bytes for JPEG metadata: 82
+ */
+constexpr size_t kResultEntryCapacity = 44;
+constexpr size_t kResultDataCapacity = 166;
+
 /*
  * \struct Camera3StreamConfig
  * \brief Data to store StreamConfiguration associated with camera3_stream(s)
@@ -212,40 +234,6 @@ bool validateCropRotate(const camera3_stream_configuration_t &streamList)
 
 } /* namespace */
 
-/*
- * \struct Camera3RequestDescriptor
- *
- * A utility structure that groups information about a capture request to be
- * later re-used at request complete time to notify the framework.
- */
-
-CameraDevice::Camera3RequestDescriptor::Camera3RequestDescriptor(
-	Camera *camera, const camera3_capture_request_t *camera3Request)
-{
-	frameNumber_ = camera3Request->frame_number;
-
-	/* Copy the camera3 request stream information for later access. */
-	const uint32_t numBuffers = camera3Request->num_output_buffers;
-	buffers_.resize(numBuffers);
-	for (uint32_t i = 0; i < numBuffers; i++)
-		buffers_[i] = camera3Request->output_buffers[i];
-
-	/*
-	 * FrameBuffer instances created by wrapping a camera3 provided dmabuf
-	 * are emplaced in this vector of unique_ptr<> for lifetime management.
-	 */
-	frameBuffers_.reserve(numBuffers);
-
-	/* Clone the controls associated with the camera3 request. */
-	settings_ = CameraMetadata(camera3Request->settings);
-
-	/*
-	 * Create the CaptureRequest, stored as a unique_ptr<> to tie its
-	 * lifetime to the descriptor.
-	 */
-	request_ = std::make_unique<CaptureRequest>(camera);
-}
-
 /*
  * \class CameraDevice
  *
@@ -422,10 +410,10 @@ int CameraDevice::open(const hw_module_t *hardwareModule)
 
 void CameraDevice::close()
 {
-	streams_.clear();
-
 	stop();
 
+	streams_.clear();
+
 	camera_->release();
 }
 
@@ -439,9 +427,11 @@ void CameraDevice::flush()
 		state_ = State::Flushing;
 	}
 
-	worker_.stop();
 	camera_->stop();
 
+	for (CameraStream &cameraStream : streams_)
+		cameraStream.flush();
+
 	MutexLocker stateLock(stateMutex_);
 	state_ = State::Stopped;
 }
@@ -452,9 +442,11 @@ void CameraDevice::stop()
 	if (state_ == State::Stopped)
 		return;
 
-	worker_.stop();
 	camera_->stop();
 
+	for (CameraStream &cameraStream : streams_)
+		cameraStream.flush();
+
 	descriptors_.clear();
 	state_ = State::Stopped;
 }
@@ -740,38 +732,24 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 		}
 	}
 
-	config_ = std::move(config);
-	return 0;
-}
-
-FrameBuffer *CameraDevice::createFrameBuffer(const buffer_handle_t camera3buffer)
-{
-	std::vector<FrameBuffer::Plane> planes;
-	for (int i = 0; i < camera3buffer->numFds; i++) {
-		/* Skip unused planes. */
-		if (camera3buffer->data[i] == -1)
-			break;
-
-		FrameBuffer::Plane plane;
-		plane.fd = FileDescriptor(camera3buffer->data[i]);
-		if (!plane.fd.isValid()) {
-			LOG(HAL, Error) << "Failed to obtain FileDescriptor ("
-					<< camera3buffer->data[i] << ") "
-					<< " on plane " << i;
-			return nullptr;
-		}
-
-		off_t length = lseek(plane.fd.fd(), 0, SEEK_END);
-		if (length == -1) {
-			LOG(HAL, Error) << "Failed to query plane length";
-			return nullptr;
-		}
+	/*
+	 * Preallocate result metadata packs for all the requests that can be
+	 * in flight, to avoid allocations when completing requests.
+	 */
+	unsigned int maxRequests = 0;
+	for (const StreamConfiguration &cfg : *config)
+		maxRequests = std::max(maxRequests, cfg.bufferCount);
 
-		plane.length = length;
-		planes.push_back(std::move(plane));
+	{
+		MutexLocker descriptorsLock(descriptorsMutex_);
+		while (resultMetadataPool_.size() < maxRequests)
+			resultMetadataPool_.push_back(
+				std::make_unique<CameraMetadata>(kResultEntryCapacity,
+								 kResultDataCapacity));
 	}
 
-	return new FrameBuffer(std::move(planes));
+	config_ = std::move(config);
+	return 0;
 }
 
 int CameraDevice::processControls(Camera3RequestDescriptor *descriptor)
@@ -841,10 +819,17 @@ void CameraDevice::abortRequest(camera3_capture_request_t *request)
 	result.frame_number = request->frame_number;
 	result.partial_result = 0;
 
+	/*
+	 * The acquire fences are owned by the libcamera request, which closes
+	 * them when the descriptor is destroyed. Return duplicates to the
+	 * framework as release fences.
+	 */
 	std::vector<camera3_stream_buffer_t> resultBuffers(result.num_output_buffers);
 	for (auto [i, buffer] : utils::enumerate(resultBuffers)) {
+		int fence = request->output_buffers[i].acquire_fence;
+
 		buffer = request->output_buffers[i];
-		buffer.release_fence = request->output_buffers[i].acquire_fence;
+		buffer.release_fence = fence != -1 ? ::dup(fence) : -1;
 		buffer.acquire_fence = -1;
 		buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
 	}
@@ -928,7 +913,8 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 	 * The descriptor and the associated memory reserved here are freed
 	 * at request complete time.
 	 */
-	Camera3RequestDescriptor descriptor(camera_.get(), camera3Request);
+	auto descriptor = std::make_unique<Camera3RequestDescriptor>(camera_.get(),
+								     camera3Request);
 
 	/*
 	 * \todo The Android request model is incremental, settings passed in
@@ -939,12 +925,12 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 	if (camera3Request->settings)
 		lastSettings_ = camera3Request->settings;
 	else
-		descriptor.settings_ = lastSettings_;
+		descriptor->settings_ = lastSettings_;
 
-	LOG(HAL, Debug) << "Queueing request " << descriptor.request_->cookie()
-			<< " with " << descriptor.buffers_.size() << " streams";
-	for (unsigned int i = 0; i < descriptor.buffers_.size(); ++i) {
-		const camera3_stream_buffer_t &camera3Buffer = descriptor.buffers_[i];
+	LOG(HAL, Debug) << "Queueing request " << descriptor->request_->cookie()
+			<< " with " << descriptor->buffers_.size() << " streams";
+	for (unsigned int i = 0; i < descriptor->buffers_.size(); ++i) {
+		const camera3_stream_buffer_t &camera3Buffer = descriptor->buffers_[i];
 		camera3_stream *camera3Stream = camera3Buffer.stream;
 		CameraStream *cameraStream = static_cast<CameraStream *>(camera3Stream->priv);
 
@@ -971,13 +957,13 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 
 		case CameraStream::Type::Direct:
 			/*
-			 * Create a libcamera buffer using the dmabuf
-			 * descriptors of the camera3Buffer for each stream and
-			 * associate it with the Camera3RequestDescriptor for
-			 * lifetime management only.
+			 * Import the camera3Buffer in the CameraStream, and
+			 * associate the resulting libcamera buffer with the
+			 * Camera3RequestDescriptor for lifetime management only.
 			 */
-			buffer = createFrameBuffer(*camera3Buffer.buffer);
-			descriptor.frameBuffers_.emplace_back(buffer);
+			descriptor->frameBuffers_.push_back(
+				cameraStream->importBuffer(*camera3Buffer.buffer));
+			buffer = descriptor->frameBuffers_.back().get();
 			LOG(HAL, Debug) << ss.str() << " (direct)";
 			break;
 
@@ -999,15 +985,15 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 			return -ENOMEM;
 		}
 
-		descriptor.request_->addBuffer(cameraStream->stream(), buffer,
+		descriptor->request_->addBuffer(cameraStream->stream(), buffer,
 						camera3Buffer.acquire_fence);
 	}
 
 	/*
 	 * Translate controls from Android to libcamera and queue the request
-	 * to the CameraWorker thread.
+	 * to the camera.
 	 */
-	int ret = processControls(&descriptor);
+	int ret = processControls(descriptor.get());
 	if (ret)
 		return ret;
 
@@ -1023,50 +1009,57 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 	}
 
 	if (state_ == State::Stopped) {
-		worker_.start();
-
 		ret = camera_->start();
 		if (ret) {
 			LOG(HAL, Error) << "Failed to start camera";
-			worker_.stop();
 			return ret;
 		}
 
 		state_ = State::Running;
 	}
 
-	worker_.queueRequest(descriptor.request_.get());
+	CaptureRequest *request = descriptor->request_.get();
 
 	{
 		MutexLocker descriptorsLock(descriptorsMutex_);
-		descriptors_[descriptor.request_->cookie()] = std::move(descriptor);
+		descriptors_.push_back(std::move(descriptor));
 	}
 
+	/*
+	 * Queuing the request doesn't block, libcamera waits for the acquire
+	 * fences asynchronously and hands the request to the pipeline handler
+	 * as soon as they are signalled.
+	 */
+	request->queue();
+
 	return 0;
 }
 
 void CameraDevice::requestComplete(Request *request)
 {
-	decltype(descriptors_)::node_type node;
+	Camera3RequestDescriptor *descriptor = nullptr;
 	{
 		MutexLocker descriptorsLock(descriptorsMutex_);
-		auto it = descriptors_.find(request->cookie());
-		if (it == descriptors_.end()) {
-			/*
-			 * \todo Clarify if the Camera has to be closed on
-			 * ERROR_DEVICE and possibly demote the Fatal to simple
-			 * Error.
-			 */
-			notifyError(0, nullptr, CAMERA3_MSG_ERROR_DEVICE);
-			LOG(HAL, Fatal)
-				<< "Unknown request: " << request->cookie();
+		auto it = std::find_if(descriptors_.begin(), descriptors_.end(),
+				       [request](const auto &desc) {
+					       return desc->request_->cookie() == request->cookie();
+				       });
+		if (it != descriptors_.end())
+			descriptor = it->get();
+	}
 
-			return;
-		}
+	if (!descriptor) {
+		/*
+		 * \todo Clarify if the Camera has to be closed on
+		 * ERROR_DEVICE and possibly demote the Fatal to simple
+		 * Error.
+		 */
+		notifyError(0, nullptr, CAMERA3_MSG_ERROR_DEVICE);
+		LOG(HAL, Fatal)
+			<< "Unknown request: " << request->cookie();
 
-		node = descriptors_.extract(it);
+		return;
 	}
-	Camera3RequestDescriptor &descriptor = node.mapped();
 
 	/*
 	 * Prepare the capture result for the Android camera stack.
@@ -1074,15 +1067,15 @@ void CameraDevice::requestComplete(Request *request)
 	 * The buffer status is set to OK and later changed to ERROR if
 	 * post-processing/compression fails.
 	 */
-	camera3_capture_result_t captureResult = {};
-	captureResult.frame_number = descriptor.frameNumber_;
-	captureResult.num_output_buffers = descriptor.buffers_.size();
-	for (camera3_stream_buffer_t &buffer : descriptor.buffers_) {
+	camera3_capture_result_t &captureResult = descriptor->captureResult_;
+	captureResult.frame_number = descriptor->frameNumber_;
+	captureResult.num_output_buffers = descriptor->buffers_.size();
+	for (camera3_stream_buffer_t &buffer : descriptor->buffers_) {
 		buffer.acquire_fence = -1;
 		buffer.release_fence = -1;
 		buffer.status = CAMERA3_BUFFER_STATUS_OK;
 	}
-	captureResult.output_buffers = descriptor.buffers_.data();
+	captureResult.output_buffers = descriptor->buffers_.data();
 	captureResult.partial_result = 1;
 
 	/*
@@ -1094,13 +1087,38 @@ void CameraDevice::requestComplete(Request *request)
 				<< " not successfully completed: "
 				<< request->status();
 
-		notifyError(descriptor.frameNumber_, nullptr,
+		notifyError(descriptor->frameNumber_, nullptr,
 			    CAMERA3_MSG_ERROR_REQUEST);
 
 		captureResult.partial_result = 0;
-		for (camera3_stream_buffer_t &buffer : descriptor.buffers_)
+		for (camera3_stream_buffer_t &buffer : descriptor->buffers_) {
 			buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
-		callbacks_->process_capture_result(callbacks_, &captureResult);
+
+			/*
+			 * Return the acquire fences that libcamera hasn't
+			 * waited for to the framework as release fences.
+			 */
+			CameraStream *cameraStream =
+				static_cast<CameraStream *>(buffer.stream->priv);
+			if (cameraStream->type() == CameraStream::Type::Mapped)
+				continue;
+
+			FrameBuffer *frameBuffer =
+				request->findBuffer(cameraStream->stream());
+			if (!frameBuffer)
+				continue;
+
+			std::unique_ptr<Fence> fence = frameBuffer->releaseFence();
+			if (fence)
+				buffer.release_fence = ::dup(fence->fd().fd());
+
+			if (cameraStream->type() == CameraStream::Type::Internal)
+				cameraStream->putBuffer(frameBuffer);
+		}
+
+		MutexLocker descriptorsLock(descriptorsMutex_);
+		descriptor->status_ = Camera3RequestDescriptor::Status::Error;
+		sendCaptureResults();
 
 		return;
 	}
@@ -1113,10 +1131,10 @@ void CameraDevice::requestComplete(Request *request)
 	 */
 	uint64_t sensorTimestamp = static_cast<uint64_t>(request->metadata()
 							 .get(controls::SensorTimestamp));
-	notifyShutter(descriptor.frameNumber_, sensorTimestamp);
+	notifyShutter(descriptor->frameNumber_, sensorTimestamp);
 
 	LOG(HAL, Debug) << "Request " << request->cookie() << " completed with "
-			<< descriptor.buffers_.size() << " streams";
+			<< descriptor->buffers_.size() << " streams";
 
 	/*
 	 * Generate the metadata associated with the captured buffers.
@@ -1124,16 +1142,16 @@ void CameraDevice::requestComplete(Request *request)
 	 * Notify if the metadata generation has failed, but continue processing
 	 * buffers and return an empty metadata pack.
 	 */
-	std::unique_ptr<CameraMetadata> resultMetadata = getResultMetadata(descriptor);
-	if (!resultMetadata) {
-		notifyError(descriptor.frameNumber_, nullptr, CAMERA3_MSG_ERROR_RESULT);
+	descriptor->resultMetadata_ = getResultMetadata(*descriptor);
+	if (!descriptor->resultMetadata_) {
+		notifyError(descriptor->frameNumber_, nullptr, CAMERA3_MSG_ERROR_RESULT);
 
 		/* The camera framework expects an empy metadata pack on error. */
-		resultMetadata = std::make_unique<CameraMetadata>(0, 0);
+		descriptor->resultMetadata_ = std::make_unique<CameraMetadata>(0, 0);
 	}
 
-	/* Handle any JPEG compression. */
-	for (camera3_stream_buffer_t &buffer : descriptor.buffers_) {
+	/* Collect the buffers that require JPEG compression. */
+	for (camera3_stream_buffer_t &buffer : descriptor->buffers_) {
 		CameraStream *cameraStream =
 			static_cast<CameraStream *>(buffer.stream->priv);
 
@@ -1144,30 +1162,130 @@ void CameraDevice::requestComplete(Request *request)
 		if (!src) {
 			LOG(HAL, Error) << "Failed to find a source stream buffer";
 			buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
-			notifyError(descriptor.frameNumber_, buffer.stream,
+			notifyError(descriptor->frameNumber_, buffer.stream,
 				    CAMERA3_MSG_ERROR_BUFFER);
 			continue;
 		}
 
-		int ret = cameraStream->process(*src, *buffer.buffer,
-						descriptor.settings_,
-						resultMetadata.get());
-		/*
-		 * Return the FrameBuffer to the CameraStream now that we're
-		 * done processing it.
-		 */
-		if (cameraStream->type() == CameraStream::Type::Internal)
-			cameraStream->putBuffer(src);
+		descriptor->postProcessBuffers_.push_back({ descriptor, &buffer,
+							    cameraStream, src });
+	}
 
-		if (ret) {
-			buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
-			notifyError(descriptor.frameNumber_, buffer.stream,
-				    CAMERA3_MSG_ERROR_BUFFER);
+	/*
+	 * Post-process the buffers asynchronously, to avoid blocking the
+	 * completion of other requests while encoding. The capture result is
+	 * sent, and the descriptor destroyed, when the last buffer has been
+	 * processed, don't access the descriptor after queuing the buffers.
+	 */
+	std::vector<Camera3RequestDescriptor::StreamBuffer *> streamBuffers;
+	{
+		MutexLocker descriptorsLock(descriptorsMutex_);
+		descriptor->pendingPostProcessing_ = descriptor->postProcessBuffers_.size();
+		if (!descriptor->pendingPostProcessing_) {
+			descriptor->status_ = Camera3RequestDescriptor::Status::Success;
+			sendCaptureResults();
+			return;
 		}
+
+		for (Camera3RequestDescriptor::StreamBuffer &streamBuffer :
+		     descriptor->postProcessBuffers_)
+			streamBuffers.push_back(&streamBuffer);
 	}
 
-	captureResult.result = resultMetadata->get();
-	callbacks_->process_capture_result(callbacks_, &captureResult);
+	for (Camera3RequestDescriptor::StreamBuffer *streamBuffer : streamBuffers)
+		streamBuffer->stream->process(streamBuffer);
+}
+
+void CameraDevice::streamProcessingComplete(Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+					    Camera3RequestDescriptor::Status status)
+{
+	Camera3RequestDescriptor *descriptor = streamBuffer->request;
+
+	if (status == Camera3RequestDescriptor::Status::Error) {
+		streamBuffer->camera3Buffer->status = CAMERA3_BUFFER_STATUS_ERROR;
+		notifyError(descriptor->frameNumber_,
+			    streamBuffer->camera3Buffer->stream,
+			    CAMERA3_MSG_ERROR_BUFFER);
+	}
+
+	MutexLocker descriptorsLock(descriptorsMutex_);
+
+	if (--descriptor->pendingPostProcessing_)
+		return;
+
+	descriptor->status_ = Camera3RequestDescriptor::Status::Success;
+	sendCaptureResults();
+}
+
+/*
+ * Send the capture results of all completed requests at the head of the
+ * queue, in the order the requests have been queued. This function shall be
+ * called with the descriptors mutex held.
+ */
+void CameraDevice::sendCaptureResults()
+{
+	while (!descriptors_.empty() && !descriptors_.front()->isPending()) {
+		std::unique_ptr<Camera3RequestDescriptor> descriptor =
+			std::move(descriptors_.front());
+		descriptors_.pop_front();
+
+		camera3_capture_result_t &captureResult = descriptor->captureResult_;
+		if (descriptor->resultMetadata_)
+			captureResult.result = descriptor->resultMetadata_->get();
+
+		callbacks_->process_capture_result(callbacks_, &captureResult);
+
+		/* The framework copies the result metadata, recycle it. */
+		releaseResultMetadata(std::move(descriptor->resultMetadata_));
+	}
+}
+
+/*
+ * Retrieve an empty result metadata pack from the pool, or allocate a new one
+ * if the pool is exhausted.
+ */
+std::unique_ptr<CameraMetadata> CameraDevice::acquireResultMetadata()
+{
+	std::unique_ptr<CameraMetadata> metadata;
+
+	{
+		MutexLocker descriptorsLock(descriptorsMutex_);
+		if (!resultMetadataPool_.empty()) {
+			metadata = std::move(resultMetadataPool_.back());
+			resultMetadataPool_.pop_back();
+		}
+	}
+
+	if (metadata)
+		metadata->clear();
+	else
+		metadata = std::make_unique<CameraMetadata>(kResultEntryCapacity,
+							    kResultDataCapacity);
+
+	if (!metadata->isValid())
+		return nullptr;
+
+	return metadata;
+}
+
+/*
+ * Return a result metadata pack to the pool. Packs that have been enlarged by
+ * the addition of entries are kept with their larger capacity, to avoid
+ * resizing them again for the next results. This function shall be called
+ * with the descriptors mutex held.
+ */
+void CameraDevice::releaseResultMetadata(std::unique_ptr<CameraMetadata> metadata)
+{
+	if (!metadata || !metadata->isValid())
+		return;
+
+	/* Skip the empty packs returned on errors. */
+	auto [entryCapacity, dataCapacity] = metadata->capacity();
+	if (entryCapacity < kResultEntryCapacity ||
+	    dataCapacity < kResultDataCapacity)
+		return;
+
+	resultMetadataPool_.push_back(std::move(metadata));
 }
 
 std::string CameraDevice::logPrefix() const
@@ -1203,32 +1321,15 @@ void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream,
  * Produce a set of fixed result metadata.
  */
 std::unique_ptr<CameraMetadata>
-CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor) const
+CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor)
 {
 	const ControlList &metadata = descriptor.request_->metadata();
 	const CameraMetadata &settings = descriptor.settings_;
 	camera_metadata_ro_entry_t entry;
 	bool found;
 
-	/*
-	 * \todo Keep this in sync with the actual number of entries.
-	 * Currently: 40 entries, 156 bytes
-	 *
-	 * Reserve more space for the JPEG metadata set by the post-processor.
-	 * Currently:
-	 * ANDROID_JPEG_GPS_COORDINATES (double x 3) = 24 bytes
-	 * ANDROID_JPEG_GPS_PROCESSING_METHOD (byte x 32) = 32 bytes
-	 * ANDROID_JPEG_GPS_TIMESTAMP (int64) = 8 bytes
-	 * ANDROID_JPEG_SIZE (int32_t) = 4 bytes
-	 * ANDROID_JPEG_QUALITY (byte) = 1 byte
-	 * ANDROID_JPEG_ORIENTATION (int32_t) = 4 bytes
-	 * ANDROID_JPEG_THUMBNAIL_QUALITY (byte) = 1 byte
-	 * ANDROID_JPEG_THUMBNAIL_SIZE (int32 x 2) = 8 bytes
-	 * Total bytes for JPEG metadata: 82
-	 */
-	std::unique_ptr<CameraMetadata> resultMetadata =
-		std::make_unique<CameraMetadata>(44, 166);
-	if (!resultMetadata->isValid()) {
+	std::unique_ptr<CameraMetadata> resultMetadata = acquireResultMetadata();
+	if (!resultMetadata) {
 		LOG(HAL, Error) << "Failed to allocate result metadata";
 		return nullptr;
 	}
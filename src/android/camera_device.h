@@ -7,6 +7,7 @@
 #ifndef __ANDROID_CAMERA_DEVICE_H__
 #define __ANDROID_CAMERA_DEVICE_H__
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -26,8 +27,8 @@
 
 #include "camera_capabilities.h"
 #include "camera_metadata.h"
+#include "camera_request.h"
 #include "camera_stream.h"
-#include "camera_worker.h"
 #include "jpeg/encoder.h"
 
 struct CameraConfigData;
@@ -60,6 +61,8 @@ public:
 	int configureStreams(camera3_stream_configuration_t *stream_list);
 	int processCaptureRequest(camera3_capture_request_t *request);
 	void requestComplete(libcamera::Request *request);
+	void streamProcessingComplete(Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+				      Camera3RequestDescriptor::Status status);
 
 protected:
 	std::string logPrefix() const override;
@@ -69,20 +72,6 @@ private:
 
 	CameraDevice(unsigned int id, std::shared_ptr<libcamera::Camera> camera);
 
-	struct Camera3RequestDescriptor {
-		Camera3RequestDescriptor() = default;
-		~Camera3RequestDescriptor() = default;
-		Camera3RequestDescriptor(libcamera::Camera *camera,
-					 const camera3_capture_request_t *camera3Request);
-		Camera3RequestDescriptor &operator=(Camera3RequestDescriptor &&) = default;
-
-		uint32_t frameNumber_ = 0;
-		std::vector<camera3_stream_buffer_t> buffers_;
-		std::vector<std::unique_ptr<libcamera::FrameBuffer>> frameBuffers_;
-		CameraMetadata settings_;
-		std::unique_ptr<CaptureRequest> request_;
-	};
-
 	enum class State {
 		Stopped,
 		Flushing,
@@ -91,21 +80,21 @@ private:
 
 	void stop();
 
-	libcamera::FrameBuffer *createFrameBuffer(const buffer_handle_t camera3buffer);
 	void abortRequest(camera3_capture_request_t *request);
 	bool isValidRequest(camera3_capture_request_t *request) const;
 	void notifyShutter(uint32_t frameNumber, uint64_t timestamp);
 	void notifyError(uint32_t frameNumber, camera3_stream_t *stream,
 			 camera3_error_msg_code code);
 	int processControls(Camera3RequestDescriptor *descriptor);
+	void sendCaptureResults();
 	std::unique_ptr<CameraMetadata> getResultMetadata(
-		const Camera3RequestDescriptor &descriptor) const;
+		const Camera3RequestDescriptor &descriptor);
+	std::unique_ptr<CameraMetadata> acquireResultMetadata();
+	void releaseResultMetadata(std::unique_ptr<CameraMetadata> metadata);
 
 	unsigned int id_;
 	camera3_device_t camera3Device_;
 
-	CameraWorker worker_;
-
 	libcamera::Mutex stateMutex_; /* Protects access to the camera state. */
 	State state_;
 
@@ -118,8 +107,12 @@ private:
 
 	std::vector<CameraStream> streams_;
 
-	libcamera::Mutex descriptorsMutex_; /* Protects descriptors_. */
-	std::map<uint64_t, Camera3RequestDescriptor> descriptors_;
+	/* Requests in the order they have been queued by the framework. */
+	libcamera::Mutex descriptorsMutex_; /* Protects descriptors_ and resultMetadataPool_. */
+	std::deque<std::unique_ptr<Camera3RequestDescriptor>> descriptors_;
+
+	/* Result metadata packs recycled across capture results. */
+	std::vector<std::unique_ptr<CameraMetadata>> resultMetadataPool_;
 
 	std::string maker_;
 	std::string model_;
@@ -12,6 +12,8 @@
 #include <libcamera/camera.h>
 #include <libcamera/property_ids.h>
 
+#include "libcamera/internal/device_cache.h"
+
 #include "camera_device.h"
 
 using namespace libcamera;
@@ -29,7 +31,8 @@ LOG_DECLARE_CATEGORY(HAL)
  */
 
 CameraHalManager::CameraHalManager()
-	: cameraManager_(nullptr), callbacks_(nullptr), numInternalCameras_(0),
+	: cameraManager_(nullptr), callbacks_(nullptr), started_(false),
+	  numInternalCameras_(0),
 	  nextExternalCameraId_(firstExternalCameraId_)
 {
 }
@@ -69,6 +72,9 @@ int CameraHalManager::init()
 		return ret;
 	}
 
+	MutexLocker locker(mutex_);
+	started_ = true;
+
 	return 0;
 }
 
@@ -193,6 +199,14 @@ void CameraHalManager::cameraAdded(std::shared_ptr<Camera> cam)
 		callbacks_->camera_device_status_change(callbacks_, id,
 							CAMERA_DEVICE_STATUS_PRESENT);
 
+	/*
+	 * The device cache is saved by the camera manager once the cameras
+	 * present at startup have been enumerated. Save it for cameras added
+	 * later on, to persist their static information.
+	 */
+	if (started_)
+		DeviceCache::instance()->save();
+
 	LOG(HAL, Debug) << "Camera ID: " << id << " added successfully.";
 }
 
@@ -65,6 +65,7 @@ private:
 	std::vector<std::unique_ptr<CameraDevice>> cameras_;
 	std::map<std::string, unsigned int> cameraIdsMap_;
 	Mutex mutex_;
+	bool started_;
 
 	unsigned int numInternalCameras_;
 	unsigned int nextExternalCameraId_;
@@ -65,6 +65,14 @@ std::tuple<size_t, size_t> CameraMetadata::usage() const
 	return { currentEntryCount, currentDataCount };
 }
 
+std::tuple<size_t, size_t> CameraMetadata::capacity() const
+{
+	size_t entryCapacity = get_camera_metadata_entry_capacity(metadata_);
+	size_t dataCapacity = get_camera_metadata_data_capacity(metadata_);
+
+	return { entryCapacity, dataCapacity };
+}
+
 bool CameraMetadata::getEntry(uint32_t tag, camera_metadata_ro_entry_t *entry) const
 {
 	if (find_camera_metadata_ro_entry(metadata_, tag, entry))
@@ -220,6 +228,26 @@ bool CameraMetadata::updateEntry(uint32_t tag, const void *data, size_t count,
 	return false;
 }
 
+/*
+ * \brief Remove all entries from the container
+ *
+ * The memory allocated for the container is preserved, allowing it to be
+ * reused without reallocation.
+ */
+void CameraMetadata::clear()
+{
+	if (!metadata_)
+		return;
+
+	auto [entryCapacity, dataCapacity] = capacity();
+	camera_metadata_t *metadata =
+		place_camera_metadata(metadata_, get_camera_metadata_size(metadata_),
+				      entryCapacity, dataCapacity);
+
+	valid_ = metadata != nullptr;
+	resized_ = false;
+}
+
 camera_metadata_t *CameraMetadata::get()
 {
 	return valid_ ? metadata_ : nullptr;
@@ -24,6 +24,7 @@ public:
 	CameraMetadata &operator=(const CameraMetadata &other);
 
 	std::tuple<size_t, size_t> usage() const;
+	std::tuple<size_t, size_t> capacity() const;
 	bool resized() const { return resized_; }
 
 	bool isValid() const { return valid_; }
@@ -85,6 +86,8 @@ public:
 		return updateEntry(tag, data, count, sizeof(T));
 	}
 
+	void clear();
+
 	camera_metadata_t *get();
 	const camera_metadata_t *get() const;
 
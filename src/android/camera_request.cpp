@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_request.cpp - libcamera Android Camera Request Descriptor
+ */
+
+#include "camera_request.h"
+
+#include <libcamera/fence.h>
+
+using namespace libcamera;
+
+/*
+ * \class CaptureRequest
+ * \brief Wrap a libcamera::Request associated with buffers and fences
+ *
+ * A CaptureRequest is constructed by the CameraDevice, filled with
+ * buffers and fences provided by the camera3 framework and then queued to the
+ * libcamera::Camera. The acquire fences are handed to libcamera along with the
+ * buffers, and waited for by libcamera before the request is queued to the
+ * device, without blocking the caller.
+ */
+CaptureRequest::CaptureRequest(libcamera::Camera *camera)
+	: camera_(camera)
+{
+	request_ = camera_->createRequest(reinterpret_cast<uint64_t>(this));
+}
+
+void CaptureRequest::addBuffer(Stream *stream, FrameBuffer *buffer, int fence)
+{
+	std::unique_ptr<Fence> acquireFence;
+	if (fence != -1)
+		acquireFence = std::make_unique<Fence>(FileDescriptor(std::move(fence)));
+
+	request_->addBuffer(stream, buffer, std::move(acquireFence));
+}
+
+void CaptureRequest::queue()
+{
+	camera_->queueRequest(request_.get());
+}
+
+/*
+ * \struct Camera3RequestDescriptor
+ *
+ * A utility structure that groups information about a capture request to be
+ * later re-used at request complete time to notify the framework.
+ */
+
+Camera3RequestDescriptor::Camera3RequestDescriptor(
+	Camera *camera, const camera3_capture_request_t *camera3Request)
+{
+	frameNumber_ = camera3Request->frame_number;
+
+	/* Copy the camera3 request stream information for later access. */
+	const uint32_t numBuffers = camera3Request->num_output_buffers;
+	buffers_.resize(numBuffers);
+	for (uint32_t i = 0; i < numBuffers; i++)
+		buffers_[i] = camera3Request->output_buffers[i];
+
+	/*
+	 * FrameBuffer instances created by wrapping a camera3 provided dmabuf
+	 * are emplaced in this vector of unique_ptr<> for lifetime management.
+	 */
+	frameBuffers_.reserve(numBuffers);
+
+	/* Clone the controls associated with the camera3 request. */
+	settings_ = CameraMetadata(camera3Request->settings);
+
+	/*
+	 * Create the CaptureRequest, stored as a unique_ptr<> to tie its
+	 * lifetime to the descriptor.
+	 */
+	request_ = std::make_unique<CaptureRequest>(camera);
+}
+
+Camera3RequestDescriptor::~Camera3RequestDescriptor() = default;
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_request.h - libcamera Android Camera Request Descriptor
+ */
+#ifndef __ANDROID_CAMERA_REQUEST_H__
+#define __ANDROID_CAMERA_REQUEST_H__
+
+#include <memory>
+#include <vector>
+
+#include <hardware/camera3.h>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "camera_metadata.h"
+
+class CameraStream;
+
+class CaptureRequest
+{
+public:
+	CaptureRequest(libcamera::Camera *camera);
+
+	libcamera::ControlList &controls() { return request_->controls(); }
+	const libcamera::ControlList &metadata() const
+	{
+		return request_->metadata();
+	}
+	unsigned long cookie() const { return request_->cookie(); }
+
+	void addBuffer(libcamera::Stream *stream,
+		       libcamera::FrameBuffer *buffer, int fence);
+	void queue();
+
+private:
+	libcamera::Camera *camera_;
+	std::unique_ptr<libcamera::Request> request_;
+};
+
+struct Camera3RequestDescriptor {
+	enum class Status {
+		Pending,
+		Success,
+		Error,
+	};
+
+	/* A camera3 buffer produced by post-processing a libcamera buffer. */
+	struct StreamBuffer {
+		Camera3RequestDescriptor *request;
+		camera3_stream_buffer_t *camera3Buffer;
+		CameraStream *stream;
+		libcamera::FrameBuffer *source;
+	};
+
+	Camera3RequestDescriptor(libcamera::Camera *camera,
+				 const camera3_capture_request_t *camera3Request);
+	~Camera3RequestDescriptor();
+
+	bool isPending() const { return status_ == Status::Pending; }
+
+	uint32_t frameNumber_ = 0;
+	std::vector<camera3_stream_buffer_t> buffers_;
+	std::vector<std::shared_ptr<libcamera::FrameBuffer>> frameBuffers_;
+	CameraMetadata settings_;
+	std::unique_ptr<CaptureRequest> request_;
+
+	/*
+	 * Completion state, protected by the CameraDevice descriptors mutex.
+	 * The capture result is sent to the framework once the status isn't
+	 * pending anymore and all previous requests have been completed.
+	 */
+	std::vector<StreamBuffer> postProcessBuffers_;
+	unsigned int pendingPostProcessing_ = 0;
+	std::unique_ptr<CameraMetadata> resultMetadata_;
+	camera3_capture_result_t captureResult_ = {};
+	Status status_ = Status::Pending;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(Camera3RequestDescriptor)
+};
+
+#endif /* __ANDROID_CAMERA_REQUEST_H__ */
@@ -7,7 +7,9 @@
 
 #include "camera_stream.h"
 
+#include <errno.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include "camera_buffer.h"
 #include "camera_device.h"
@@ -59,7 +61,6 @@ CameraStream::CameraStream(CameraDevice *const cameraDevice,
 
 	if (type == Type::Internal) {
 		allocator_ = std::make_unique<FrameBufferAllocator>(cameraDevice_->camera());
-		mutex_ = std::make_unique<std::mutex>();
 	}
 }
 
@@ -81,6 +82,9 @@ int CameraStream::configure()
 		int ret = postProcessor_->configure(configuration(), output);
 		if (ret)
 			return ret;
+
+		worker_ = std::make_unique<PostProcessorWorker>(this);
+		worker_->start();
 	}
 
 	if (allocator_) {
@@ -88,61 +92,246 @@ int CameraStream::configure()
 		if (ret < 0)
 			return ret;
 
-		/* Save a pointer to the reserved frame buffers */
-		for (const auto &frameBuffer : allocator_->buffers(stream()))
-			buffers_.push_back(frameBuffer.get());
+		/* Lend the reserved frame buffers to the capture requests. */
+		pool_ = std::make_unique<FrameBufferPool>(allocator_->buffers(stream()));
 	}
 
 	camera3Stream_->max_buffers = configuration().bufferCount;
 
+	/*
+	 * The framework usually cycles through max_buffers buffers, but may
+	 * allocate more when the consumer holds on to some of them. Leave room
+	 * for those to avoid thrashing the caches.
+	 */
+	frameBuffers_.setCapacity(type_ == Type::Direct ? 2 * camera3Stream_->max_buffers : 0);
+	mappings_.setCapacity(postProcessor_ ? 2 * camera3Stream_->max_buffers : 0);
+
 	return 0;
 }
 
-int CameraStream::process(const libcamera::FrameBuffer &source,
-			  buffer_handle_t camera3Dest,
-			  const CameraMetadata &requestMetadata,
-			  CameraMetadata *resultMetadata)
+/*
+ * Queue a buffer for post-processing. Buffers are processed in order in the
+ * post-processor worker thread, and their completion is notified to the
+ * CameraDevice from that thread.
+ */
+void CameraStream::process(Camera3RequestDescriptor::StreamBuffer *streamBuffer)
 {
-	if (!postProcessor_)
-		return 0;
+	if (!worker_) {
+		processComplete(streamBuffer, 0);
+		return;
+	}
 
-	/*
-	 * \todo Buffer mapping and processing should be moved to a
-	 * separate thread.
-	 */
-	CameraBuffer dest(camera3Dest, PROT_READ | PROT_WRITE);
-	if (!dest.isValid()) {
+	worker_->queueRequest(streamBuffer);
+}
+
+/*
+ * Complete all buffers queued for post-processing with an error, and wait for
+ * the buffer being processed, if any, to complete.
+ */
+void CameraStream::flush()
+{
+	if (worker_)
+		worker_->flush();
+}
+
+int CameraStream::processBuffer(Camera3RequestDescriptor::StreamBuffer *streamBuffer)
+{
+	std::shared_ptr<CameraBuffer> dest =
+		mappings_.get(*streamBuffer->camera3Buffer->buffer,
+			      [](buffer_handle_t handle) -> std::unique_ptr<CameraBuffer> {
+				      auto buffer = std::make_unique<CameraBuffer>(handle,
+										   PROT_READ | PROT_WRITE);
+				      if (!buffer->isValid())
+					      return nullptr;
+				      return buffer;
+			      });
+	if (!dest) {
 		LOG(HAL, Error) << "Failed to map android blob buffer";
 		return -EINVAL;
 	}
 
-	return postProcessor_->process(source, &dest, requestMetadata, resultMetadata);
+	const Camera3RequestDescriptor *request = streamBuffer->request;
+
+	return postProcessor_->process(*streamBuffer->source, dest.get(),
+				       request->settings_,
+				       request->resultMetadata_.get());
 }
 
-FrameBuffer *CameraStream::getBuffer()
+void CameraStream::processComplete(Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+				   int ret)
 {
-	if (!allocator_)
-		return nullptr;
+	/*
+	 * Return the FrameBuffer to the CameraStream now that we're done
+	 * processing it.
+	 */
+	if (type_ == Type::Internal)
+		putBuffer(streamBuffer->source);
 
-	std::lock_guard<std::mutex> locker(*mutex_);
+	cameraDevice_->streamProcessingComplete(streamBuffer,
+						ret ? Camera3RequestDescriptor::Status::Error
+						    : Camera3RequestDescriptor::Status::Success);
+}
 
-	if (buffers_.empty()) {
-		LOG(HAL, Error) << "Buffer underrun";
+FrameBuffer *CameraStream::getBuffer()
+{
+	if (!pool_)
 		return nullptr;
-	}
 
-	FrameBuffer *buffer = buffers_.back();
-	buffers_.pop_back();
+	FrameBuffer *buffer = pool_->acquire();
+	if (!buffer)
+		LOG(HAL, Error) << "Buffer underrun";
 
 	return buffer;
 }
 
 void CameraStream::putBuffer(libcamera::FrameBuffer *buffer)
 {
-	if (!allocator_)
+	if (!pool_)
 		return;
 
-	std::lock_guard<std::mutex> locker(*mutex_);
+	pool_->release(buffer);
+}
+
+/*
+ * Wrap a buffer provided by the framework for a Direct stream in a
+ * FrameBuffer. The FrameBuffer is cached and reused for all requests that use
+ * the same buffer, which also lets the V4L2 buffer cache of the pipeline
+ * handler match it to the V4L2 buffer it has been queued to previously.
+ */
+std::shared_ptr<FrameBuffer> CameraStream::importBuffer(buffer_handle_t camera3Buffer)
+{
+	return frameBuffers_.get(camera3Buffer, createFrameBuffer);
+}
+
+std::unique_ptr<FrameBuffer> CameraStream::createFrameBuffer(buffer_handle_t camera3Buffer)
+{
+	std::vector<FrameBuffer::Plane> planes;
+	for (int i = 0; i < camera3Buffer->numFds; i++) {
+		/* Skip unused planes. */
+		if (camera3Buffer->data[i] == -1)
+			break;
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(camera3Buffer->data[i]);
+		if (!plane.fd.isValid()) {
+			LOG(HAL, Error) << "Failed to obtain FileDescriptor ("
+					<< camera3Buffer->data[i] << ") "
+					<< " on plane " << i;
+			return nullptr;
+		}
+
+		off_t length = lseek(plane.fd.fd(), 0, SEEK_END);
+		if (length == -1) {
+			LOG(HAL, Error) << "Failed to query plane length";
+			return nullptr;
+		}
+
+		plane.length = length;
+		planes.push_back(std::move(plane));
+	}
 
-	buffers_.push_back(buffer);
+	return std::make_unique<FrameBuffer>(std::move(planes));
+}
+
+/*
+ * \class CameraStream::PostProcessorWorker
+ * \brief Post-process buffers in a dedicated thread
+ *
+ * Post-processing, and JPEG encoding in particular, can take a long time for
+ * large frames. Running it in the thread that completes libcamera requests
+ * would delay the completion of all other requests, and stall the preview
+ * stream during still capture. The PostProcessorWorker processes the buffers
+ * of a CameraStream in order in a dedicated thread instead.
+ */
+CameraStream::PostProcessorWorker::PostProcessorWorker(CameraStream *cameraStream)
+	: cameraStream_(cameraStream), state_(State::Stopped)
+{
+	setName("PostProcessor");
+}
+
+CameraStream::PostProcessorWorker::~PostProcessorWorker()
+{
+	flush();
+
+	{
+		MutexLocker lock(mutex_);
+		state_ = State::Stopped;
+	}
+
+	cv_.notify_all();
+	wait();
+}
+
+void CameraStream::PostProcessorWorker::start()
+{
+	{
+		MutexLocker lock(mutex_);
+		state_ = State::Running;
+	}
+
+	Thread::start();
+}
+
+void CameraStream::PostProcessorWorker::queueRequest(Camera3RequestDescriptor::StreamBuffer *request)
+{
+	{
+		MutexLocker lock(mutex_);
+		ASSERT(state_ == State::Running);
+		requests_.push(request);
+	}
+
+	cv_.notify_all();
+}
+
+void CameraStream::PostProcessorWorker::flush()
+{
+	MutexLocker lock(mutex_);
+	if (state_ != State::Running)
+		return;
+
+	state_ = State::Flushing;
+	cv_.notify_all();
+
+	/* Wait for the worker to complete the pending requests. */
+	cv_.wait(lock, [&] { return state_ != State::Flushing; });
+}
+
+void CameraStream::PostProcessorWorker::run()
+{
+	MutexLocker locker(mutex_);
+
+	while (1) {
+		cv_.wait(locker, [&] {
+			return state_ != State::Running || !requests_.empty();
+		});
+
+		if (state_ == State::Stopped)
+			break;
+
+		if (state_ == State::Flushing) {
+			std::queue<Camera3RequestDescriptor::StreamBuffer *> requests =
+				std::move(requests_);
+			requests_ = {};
+			locker.unlock();
+
+			while (!requests.empty()) {
+				cameraStream_->processComplete(requests.front(), -ECANCELED);
+				requests.pop();
+			}
+
+			locker.lock();
+			state_ = State::Running;
+			cv_.notify_all();
+			continue;
+		}
+
+		Camera3RequestDescriptor::StreamBuffer *request = requests_.front();
+		requests_.pop();
+		locker.unlock();
+
+		int ret = cameraStream_->processBuffer(request);
+		cameraStream_->processComplete(request, ret);
+
+		locker.lock();
+	}
 }
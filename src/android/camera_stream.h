@@ -7,18 +7,27 @@
 #ifndef __ANDROID_CAMERA_STREAM_H__
 #define __ANDROID_CAMERA_STREAM_H__
 
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <queue>
 #include <vector>
 
 #include <hardware/camera3.h>
 
+#include <libcamera/base/thread.h>
+
 #include <libcamera/camera.h>
 #include <libcamera/framebuffer.h>
 #include <libcamera/framebuffer_allocator.h>
+#include <libcamera/framebuffer_pool.h>
 #include <libcamera/geometry.h>
 #include <libcamera/pixel_format.h>
 
+#include "buffer_handle_cache.h"
+#include "camera_request.h"
+
+class CameraBuffer;
 class CameraDevice;
 class CameraMetadata;
 class PostProcessor;
@@ -118,14 +127,49 @@ public:
 	libcamera::Stream *stream() const;
 
 	int configure();
-	int process(const libcamera::FrameBuffer &source,
-		    buffer_handle_t camera3Dest,
-		    const CameraMetadata &requestMetadata,
-		    CameraMetadata *resultMetadata);
+	void process(Camera3RequestDescriptor::StreamBuffer *streamBuffer);
+	void flush();
 	libcamera::FrameBuffer *getBuffer();
 	void putBuffer(libcamera::FrameBuffer *buffer);
+	std::shared_ptr<libcamera::FrameBuffer> importBuffer(buffer_handle_t camera3Buffer);
 
 private:
+	class PostProcessorWorker : public libcamera::Thread
+	{
+	public:
+		enum class State {
+			Stopped,
+			Running,
+			Flushing,
+		};
+
+		PostProcessorWorker(CameraStream *cameraStream);
+		~PostProcessorWorker();
+
+		void start();
+		void queueRequest(Camera3RequestDescriptor::StreamBuffer *request);
+		void flush();
+
+	protected:
+		void run() override;
+
+	private:
+		CameraStream *cameraStream_;
+
+		libcamera::Mutex mutex_;
+		std::condition_variable cv_;
+
+		std::queue<Camera3RequestDescriptor::StreamBuffer *> requests_;
+		State state_;
+	};
+
+	static std::unique_ptr<libcamera::FrameBuffer>
+	createFrameBuffer(buffer_handle_t camera3Buffer);
+
+	int processBuffer(Camera3RequestDescriptor::StreamBuffer *streamBuffer);
+	void processComplete(Camera3RequestDescriptor::StreamBuffer *streamBuffer,
+			     int ret);
+
 	CameraDevice *const cameraDevice_;
 	const libcamera::CameraConfiguration *config_;
 	const Type type_;
@@ -133,13 +177,21 @@ private:
 	const unsigned int index_;
 
 	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
-	std::vector<libcamera::FrameBuffer *> buffers_;
 	/*
 	 * The class has to be MoveConstructible as instances are stored in
 	 * an std::vector in CameraDevice.
 	 */
-	std::unique_ptr<std::mutex> mutex_;
+	std::unique_ptr<libcamera::FrameBufferPool> pool_;
 	std::unique_ptr<PostProcessor> postProcessor_;
+	std::unique_ptr<PostProcessorWorker> worker_;
+
+	/*
+	 * Buffers imported from the framework for Direct streams, used in the
+	 * capture request thread, and CPU mappings of the post-processing
+	 * destination buffers, used in the worker thread.
+	 */
+	BufferHandleCache<libcamera::FrameBuffer> frameBuffers_;
+	BufferHandleCache<CameraBuffer> mappings_;
 };
 
 #endif /* __ANDROID_CAMERA_STREAM__ */
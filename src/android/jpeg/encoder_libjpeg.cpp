@@ -7,6 +7,7 @@
 
 #include "encoder_libjpeg.h"
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
@@ -99,6 +100,33 @@ int EncoderLibJpeg::configure(const StreamConfiguration &cfg)
 
 	nv_ = pixelFormatInfo_->numPlanes() == 2;
 	nvSwap_ = info.nvSwap;
+	raw_ = false;
+
+	if (nv_) {
+		/*
+		 * Feed the luma and chroma planes to libjpeg directly with the
+		 * raw data API, when the width is a multiple of the MCU width.
+		 * libjpeg reads full DCT blocks from the input rows, so other
+		 * widths would read past the end of the lines.
+		 */
+		unsigned int c_stride = pixelFormatInfo_->stride(cfg.size.width, 1);
+		unsigned int horzSubSample = 2 * cfg.size.width / c_stride;
+		unsigned int vertSubSample = pixelFormatInfo_->planes[1].verticalSubSampling;
+
+		raw_ = cfg.size.width % (horzSubSample * DCTSIZE) == 0;
+		if (raw_) {
+			compress_.raw_data_in = TRUE;
+#if JPEG_LIB_VERSION >= 70
+			compress_.do_fancy_downsampling = FALSE;
+#endif
+			compress_.comp_info[0].h_samp_factor = horzSubSample;
+			compress_.comp_info[0].v_samp_factor = vertSubSample;
+			for (unsigned int i = 1; i < 3; i++) {
+				compress_.comp_info[i].h_samp_factor = 1;
+				compress_.comp_info[i].v_samp_factor = 1;
+			}
+		}
+	}
 
 	return 0;
 }
@@ -178,17 +206,91 @@ void EncoderLibJpeg::compressNV(Span<const uint8_t> frame)
 	}
 }
 
+/*
+ * Compress the incoming buffer from a supported NV format with the raw data
+ * API. The luma rows are passed to libjpeg in place, only the chroma samples
+ * are deinterleaved to line buffers.
+ */
+void EncoderLibJpeg::compressNVRaw(Span<const uint8_t> frame)
+{
+	unsigned int width = compress_.image_width;
+	unsigned int height = compress_.image_height;
+
+	unsigned int y_stride = pixelFormatInfo_->stride(width, 0);
+	unsigned int c_stride = pixelFormatInfo_->stride(width, 1);
+
+	unsigned int horzSubSample = 2 * width / c_stride;
+	unsigned int vertSubSample = pixelFormatInfo_->planes[1].verticalSubSampling;
+
+	unsigned int c_width = width / horzSubSample;
+	unsigned int c_height = (height + vertSubSample - 1) / vertSubSample;
+	unsigned int cb_pos = nvSwap_ ? 1 : 0;
+	unsigned int cr_pos = nvSwap_ ? 0 : 1;
+
+	const unsigned char *src = frame.data();
+	const unsigned char *src_c = src + y_stride * height;
+
+	/* libjpeg consumes max_v_samp_factor MCU rows of luma per call. */
+	unsigned int lines = vertSubSample * DCTSIZE;
+	unsigned int c_lines = DCTSIZE;
+
+	std::vector<JSAMPROW> y_rows(lines);
+	std::vector<JSAMPROW> cb_rows(c_lines);
+	std::vector<JSAMPROW> cr_rows(c_lines);
+	std::vector<JSAMPLE> cb_data(c_width * c_lines);
+	std::vector<JSAMPLE> cr_data(c_width * c_lines);
+
+	for (unsigned int i = 0; i < c_lines; i++) {
+		cb_rows[i] = &cb_data[i * c_width];
+		cr_rows[i] = &cr_data[i * c_width];
+	}
+
+	JSAMPARRAY planes[3] = { y_rows.data(), cb_rows.data(), cr_rows.data() };
+
+	while (compress_.next_scanline < height) {
+		unsigned int y0 = compress_.next_scanline;
+
+		/* Replicate the last line to pad the last MCU row. */
+		for (unsigned int i = 0; i < lines; i++) {
+			unsigned int y = std::min(y0 + i, height - 1);
+			y_rows[i] = const_cast<JSAMPROW>(src + y * y_stride);
+		}
+
+		for (unsigned int i = 0; i < c_lines; i++) {
+			unsigned int y = std::min(y0 / vertSubSample + i, c_height - 1);
+			const unsigned char *src_cbcr = src_c + y * c_stride;
+
+			for (unsigned int x = 0; x < c_width; x++) {
+				cb_rows[i][x] = src_cbcr[2 * x + cb_pos];
+				cr_rows[i][x] = src_cbcr[2 * x + cr_pos];
+			}
+		}
+
+		jpeg_write_raw_data(&compress_, planes, lines);
+	}
+}
+
 int EncoderLibJpeg::encode(const FrameBuffer &source, Span<uint8_t> dest,
 			   Span<const uint8_t> exifData, unsigned int quality)
 {
-	MappedFrameBuffer frame(&source, MappedFrameBuffer::MapFlag::Read);
+	MappedFrameBuffer frame(&source, MappedFrameBuffer::MapFlag::Read |
+				MappedFrameBuffer::MapFlag::Persistent |
+				MappedFrameBuffer::MapFlag::Populate);
 	if (!frame.isValid()) {
 		LOG(JPEG, Error) << "Failed to map FrameBuffer : "
 				 << strerror(frame.error());
 		return frame.error();
 	}
 
-	return encode(frame.maps()[0], dest, exifData, quality);
+	int ret = frame.beginCpuAccess(MappedFrameBuffer::MapFlag::Read);
+	if (ret < 0)
+		return ret;
+
+	ret = encode(frame.maps()[0], dest, exifData, quality);
+
+	frame.endCpuAccess();
+
+	return ret;
 }
 
 int EncoderLibJpeg::encode(Span<const uint8_t> src, Span<uint8_t> dest,
@@ -220,7 +322,9 @@ int EncoderLibJpeg::encode(Span<const uint8_t> src, Span<uint8_t> dest,
 	LOG(JPEG, Debug) << "JPEG Encode Starting:" << compress_.image_width
 			 << "x" << compress_.image_height;
 
-	if (nv_)
+	if (raw_)
+		compressNVRaw(src);
+	else if (nv_)
 		compressNV(src);
 	else
 		compressRGB(src);
@@ -32,6 +32,7 @@ public:
 private:
 	void compressRGB(libcamera::Span<const uint8_t> frame);
 	void compressNV(libcamera::Span<const uint8_t> frame);
+	void compressNVRaw(libcamera::Span<const uint8_t> frame);
 
 	struct jpeg_compress_struct compress_;
 	struct jpeg_error_mgr jerr_;
@@ -40,6 +41,7 @@ private:
 
 	bool nv_;
 	bool nvSwap_;
+	bool raw_;
 };
 
 #endif /* __ANDROID_JPEG_ENCODER_LIBJPEG_H__ */
@@ -0,0 +1,696 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_v4l2.cpp - JPEG encoding using a V4L2 memory-to-memory encoder
+ */
+
+#include "encoder_v4l2.h"
+
+#include <algorithm>
+#include <array>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+#include "libcamera/internal/formats.h"
+
+using namespace libcamera;
+
+LOG_DECLARE_CATEGORY(JPEG)
+
+namespace {
+
+/* Maximum time to wait for the encoder to process a frame, in milliseconds. */
+constexpr int kEncodeTimeout = 1000;
+
+/*
+ * Drivers of the V4L2 memory-to-memory devices that can encode JPEG. Only the
+ * video nodes they register are probed, to avoid opening unrelated devices
+ * such as the capture nodes of the cameras.
+ */
+const char *const encoderDrivers[] = {
+	"coda",
+	"hantro-vpu",
+	"mtk-jpeg",
+	"mxc-jpeg",
+	"rcar_jpu",
+	"s5p-jpeg",
+};
+
+/* Retrieve the name of the driver bound to the video node \a name. */
+std::string driverName(const std::string &name)
+{
+	std::string link = "/sys/class/video4linux/" + name + "/device/driver";
+	char target[PATH_MAX];
+
+	ssize_t len = readlink(link.c_str(), target, sizeof(target) - 1);
+	if (len < 0)
+		return {};
+
+	target[len] = '\0';
+
+	return utils::basename(target);
+}
+
+int xioctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, request, arg);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : 0;
+}
+
+bool hasFormat(int fd, uint32_t type, uint32_t fourcc)
+{
+	struct v4l2_fmtdesc desc = {};
+	desc.type = type;
+
+	while (!xioctl(fd, VIDIOC_ENUM_FMT, &desc)) {
+		if (desc.pixelformat == fourcc)
+			return true;
+		desc.index++;
+	}
+
+	return false;
+}
+
+bool sameDmabuf(int fd1, int fd2)
+{
+	if (fd1 == fd2)
+		return true;
+
+	struct stat st1, st2;
+	if (fstat(fd1, &st1) || fstat(fd2, &st2))
+		return false;
+
+	return st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+}
+
+} /* namespace */
+
+/*
+ * \class EncoderV4L2
+ * \brief JPEG encoder based on a V4L2 memory-to-memory device
+ *
+ * Many SoCs include a hardware JPEG encoder exposed as a V4L2 m2m device. The
+ * EncoderV4L2 imports the source frame in the encoder through its dmabuf,
+ * without mapping it to the CPU, and captures the compressed data to a single
+ * MMAP buffer. The compressed data is then copied to the destination, with the
+ * EXIF data inserted.
+ *
+ * Encoding is synchronous, and only supports frames stored in a single
+ * dmabuf, with a layout accepted by the device.
+ *
+ * Only the video nodes of known JPEG encoder drivers are considered. They are
+ * enumerated once, and opened at configure time to check the source format.
+ */
+
+EncoderV4L2::EncoderV4L2()
+	: fd_(-1), multiplanar_(false), outputType_(0), captureType_(0),
+	  frameSize_(0), quality_(0), capture_(MAP_FAILED), captureLength_(0)
+{
+}
+
+EncoderV4L2::~EncoderV4L2()
+{
+	close();
+}
+
+int EncoderV4L2::configure(const StreamConfiguration &cfg)
+{
+	close();
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+	if (!info.isValid() ||
+	    info.colourEncoding != PixelFormatInfo::ColourEncodingYUV)
+		return -ENOTSUP;
+
+	if (!enabled())
+		return -ENODEV;
+
+	uint32_t fourcc = info.v4l2Format.fourcc();
+
+	const std::vector<std::string> &nodes = devices();
+	auto node = std::find_if(nodes.begin(), nodes.end(),
+				 [&](const std::string &n) { return probe(n, fourcc); });
+	if (node == nodes.end()) {
+		LOG(JPEG, Debug)
+			<< "No V4L2 JPEG encoder for " << cfg.pixelFormat.toString();
+		return -ENODEV;
+	}
+
+	unsigned int stride = cfg.stride ? cfg.stride
+					 : info.stride(cfg.size.width, 0);
+
+	int ret = setFormats(fourcc, cfg.size, stride);
+	if (ret) {
+		close();
+		return ret;
+	}
+
+	/*
+	 * The device only reports the stride of the first plane for formats
+	 * stored in a single buffer. The stride of the other planes is derived
+	 * from it according to the format.
+	 */
+	std::array<unsigned int, 3> strides = {};
+	unsigned int minStride = info.stride(cfg.size.width, 0);
+	for (unsigned int i = 0; i < info.numPlanes(); ++i)
+		strides[i] = info.stride(cfg.size.width, i) * stride / minStride;
+
+	frameSize_ = info.frameSize(cfg.size, strides);
+
+	ret = allocateBuffers();
+	if (ret) {
+		close();
+		return ret;
+	}
+
+	quality_ = 0;
+
+	LOG(JPEG, Info) << "Using V4L2 JPEG encoder " << *node;
+
+	return 0;
+}
+
+int EncoderV4L2::encode(const FrameBuffer &source, Span<uint8_t> destination,
+			Span<const uint8_t> exifData, unsigned int quality)
+{
+	if (fd_ < 0)
+		return -ENODEV;
+
+	/* The planes must all be stored in the same dmabuf. */
+	const std::vector<FrameBuffer::Plane> &planes = source.planes();
+	int dmabuf = planes[0].fd.fd();
+	unsigned int length = 0;
+
+	for (const FrameBuffer::Plane &plane : planes) {
+		if (!sameDmabuf(plane.fd.fd(), dmabuf)) {
+			LOG(JPEG, Error)
+				<< "Hardware encoding requires a single dmabuf";
+			return -ENOTSUP;
+		}
+
+		length = std::max(length, plane.length);
+	}
+
+	if (length < frameSize_) {
+		LOG(JPEG, Error) << "Source buffer too small";
+		return -EINVAL;
+	}
+
+	if (quality != quality_) {
+		struct v4l2_control ctrl = {};
+		ctrl.id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+		ctrl.value = quality;
+
+		int ret = xioctl(fd_, VIDIOC_S_CTRL, &ctrl);
+		if (ret)
+			LOG(JPEG, Warning)
+				<< "Failed to set the JPEG quality: "
+				<< strerror(-ret);
+
+		quality_ = quality;
+	}
+
+	int ret = queueBuffers(dmabuf, length);
+	if (ret) {
+		restartStreaming();
+		return ret;
+	}
+
+	unsigned int bytesused = 0;
+	ret = dequeueBuffer(captureType_, &bytesused);
+	if (!ret)
+		ret = dequeueBuffer(outputType_, nullptr);
+	if (ret) {
+		LOG(JPEG, Error) << "Hardware encoding failed: " << strerror(-ret);
+		restartStreaming();
+		return ret;
+	}
+
+	Span<const uint8_t> jpeg{ static_cast<const uint8_t *>(capture_),
+				  std::min<size_t>(bytesused, captureLength_) };
+
+	return writeJpeg(jpeg, destination, exifData);
+}
+
+/*
+ * Copy the JPEG data produced by the encoder to the destination, inserting the
+ * EXIF data as an APP1 segment right after the SOI marker. The JFIF APP0
+ * segment written by most encoders is dropped in that case, as EXIF files
+ * shall start with the APP1 segment.
+ */
+int EncoderV4L2::writeJpeg(Span<const uint8_t> jpeg, Span<uint8_t> destination,
+			   Span<const uint8_t> exifData)
+{
+	if (jpeg.size() < 4 || jpeg[0] != 0xff || jpeg[1] != 0xd8) {
+		LOG(JPEG, Error) << "Encoder produced invalid JPEG data";
+		return -EINVAL;
+	}
+
+	size_t offset = 2;
+	size_t exifSize = 0;
+
+	if (!exifData.empty()) {
+		if (exifData.size() > 0xffff - 2) {
+			LOG(JPEG, Error) << "EXIF data too large";
+			return -EINVAL;
+		}
+
+		if (jpeg.size() >= 6 && jpeg[2] == 0xff && jpeg[3] == 0xe0)
+			offset += 2 + ((jpeg[4] << 8) | jpeg[5]);
+
+		if (offset > jpeg.size()) {
+			LOG(JPEG, Error) << "Encoder produced invalid JPEG data";
+			return -EINVAL;
+		}
+
+		exifSize = exifData.size() + 4;
+	}
+
+	size_t size = 2 + exifSize + jpeg.size() - offset;
+	if (size > destination.size()) {
+		LOG(JPEG, Error) << "Destination buffer too small";
+		return -ENOSPC;
+	}
+
+	uint8_t *dst = destination.data();
+	*dst++ = 0xff;
+	*dst++ = 0xd8;
+
+	if (exifSize) {
+		uint16_t length = exifData.size() + 2;
+
+		*dst++ = 0xff;
+		*dst++ = 0xe1;
+		*dst++ = length >> 8;
+		*dst++ = length & 0xff;
+		memcpy(dst, exifData.data(), exifData.size());
+		dst += exifData.size();
+	}
+
+	memcpy(dst, jpeg.data() + offset, jpeg.size() - offset);
+
+	return size;
+}
+
+/*
+ * The hardware encoder is used by default when available, and can be disabled
+ * by setting the LIBCAMERA_ANDROID_JPEG_ENCODER environment variable to
+ * 'libjpeg'.
+ */
+bool EncoderV4L2::enabled()
+{
+	const char *encoder = utils::secure_getenv("LIBCAMERA_ANDROID_JPEG_ENCODER");
+	if (!encoder || !strcmp(encoder, "v4l2"))
+		return true;
+
+	if (strcmp(encoder, "libjpeg"))
+		LOG(JPEG, Warning) << "Unknown JPEG encoder '" << encoder << "'";
+
+	return false;
+}
+
+/*
+ * Enumerate the video nodes of the known JPEG encoder drivers. The device list
+ * is static, it is built once and shared by all encoder instances.
+ */
+const std::vector<std::string> &EncoderV4L2::devices()
+{
+	static const std::vector<std::string> nodes = [] {
+		std::vector<std::string> result;
+
+		DIR *dir = opendir("/sys/class/video4linux");
+		if (!dir)
+			return result;
+
+		struct dirent *ent;
+		while ((ent = readdir(dir)) != nullptr) {
+			std::string name = ent->d_name;
+			if (name.compare(0, 5, "video"))
+				continue;
+
+			std::string driver = driverName(name);
+			auto match = std::find_if(std::begin(encoderDrivers),
+						  std::end(encoderDrivers),
+						  [&](const char *d) { return driver == d; });
+			if (match == std::end(encoderDrivers))
+				continue;
+
+			result.push_back("/dev/" + name);
+		}
+
+		closedir(dir);
+		std::sort(result.begin(), result.end());
+
+		return result;
+	}();
+
+	return nodes;
+}
+
+bool EncoderV4L2::probe(const std::string &deviceNode, uint32_t fourcc)
+{
+	int fd = ::open(deviceNode.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct v4l2_capability caps = {};
+	if (xioctl(fd, VIDIOC_QUERYCAP, &caps)) {
+		::close(fd);
+		return false;
+	}
+
+	uint32_t deviceCaps = caps.capabilities & V4L2_CAP_DEVICE_CAPS
+			    ? caps.device_caps : caps.capabilities;
+	bool multiplanar = deviceCaps & V4L2_CAP_VIDEO_M2M_MPLANE;
+
+	if (!(deviceCaps & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE)) ||
+	    !(deviceCaps & V4L2_CAP_STREAMING)) {
+		::close(fd);
+		return false;
+	}
+
+	uint32_t outputType = multiplanar ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE
+					  : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	uint32_t captureType = multiplanar ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+					   : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	if (!hasFormat(fd, captureType, V4L2_PIX_FMT_JPEG) ||
+	    !hasFormat(fd, outputType, fourcc)) {
+		::close(fd);
+		return false;
+	}
+
+	fd_ = fd;
+	multiplanar_ = multiplanar;
+	outputType_ = outputType;
+	captureType_ = captureType;
+
+	return true;
+}
+
+int EncoderV4L2::setFormats(uint32_t fourcc, const Size &size,
+			    unsigned int stride)
+{
+	struct v4l2_format format = {};
+	unsigned int width, height, bytesperline;
+	uint32_t pixelformat;
+	int ret;
+
+	format.type = outputType_;
+	if (multiplanar_) {
+		struct v4l2_pix_format_mplane *pix = &format.fmt.pix_mp;
+		pix->width = size.width;
+		pix->height = size.height;
+		pix->pixelformat = fourcc;
+		pix->field = V4L2_FIELD_NONE;
+		pix->num_planes = 1;
+		pix->plane_fmt[0].bytesperline = stride;
+	} else {
+		struct v4l2_pix_format *pix = &format.fmt.pix;
+		pix->width = size.width;
+		pix->height = size.height;
+		pix->pixelformat = fourcc;
+		pix->field = V4L2_FIELD_NONE;
+		pix->bytesperline = stride;
+	}
+
+	ret = xioctl(fd_, VIDIOC_S_FMT, &format);
+	if (ret) {
+		LOG(JPEG, Error)
+			<< "Failed to set the encoder input format: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	if (multiplanar_) {
+		width = format.fmt.pix_mp.width;
+		height = format.fmt.pix_mp.height;
+		pixelformat = format.fmt.pix_mp.pixelformat;
+		bytesperline = format.fmt.pix_mp.plane_fmt[0].bytesperline;
+	} else {
+		width = format.fmt.pix.width;
+		height = format.fmt.pix.height;
+		pixelformat = format.fmt.pix.pixelformat;
+		bytesperline = format.fmt.pix.bytesperline;
+	}
+
+	/* The encoder must accept the source buffers as they are. */
+	if (width != size.width || height != size.height ||
+	    pixelformat != fourcc || bytesperline != stride) {
+		LOG(JPEG, Debug)
+			<< "Encoder doesn't support " << size.toString()
+			<< " with stride " << stride;
+		return -EINVAL;
+	}
+
+	format = {};
+	format.type = captureType_;
+	if (multiplanar_) {
+		struct v4l2_pix_format_mplane *pix = &format.fmt.pix_mp;
+		pix->width = size.width;
+		pix->height = size.height;
+		pix->pixelformat = V4L2_PIX_FMT_JPEG;
+		pix->field = V4L2_FIELD_NONE;
+		pix->num_planes = 1;
+	} else {
+		struct v4l2_pix_format *pix = &format.fmt.pix;
+		pix->width = size.width;
+		pix->height = size.height;
+		pix->pixelformat = V4L2_PIX_FMT_JPEG;
+		pix->field = V4L2_FIELD_NONE;
+	}
+
+	ret = xioctl(fd_, VIDIOC_S_FMT, &format);
+	if (ret) {
+		LOG(JPEG, Error)
+			<< "Failed to set the encoder output format: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	pixelformat = multiplanar_ ? format.fmt.pix_mp.pixelformat
+				   : format.fmt.pix.pixelformat;
+	if (pixelformat != V4L2_PIX_FMT_JPEG)
+		return -EINVAL;
+
+	return 0;
+}
+
+int EncoderV4L2::allocateBuffers()
+{
+	struct v4l2_requestbuffers rb = {};
+	int ret;
+
+	rb.count = 1;
+	rb.type = outputType_;
+	rb.memory = V4L2_MEMORY_DMABUF;
+	ret = xioctl(fd_, VIDIOC_REQBUFS, &rb);
+	if (ret || !rb.count) {
+		LOG(JPEG, Error) << "Failed to allocate encoder input buffers";
+		return ret ? ret : -ENOMEM;
+	}
+
+	rb = {};
+	rb.count = 1;
+	rb.type = captureType_;
+	rb.memory = V4L2_MEMORY_MMAP;
+	ret = xioctl(fd_, VIDIOC_REQBUFS, &rb);
+	if (ret || !rb.count) {
+		LOG(JPEG, Error) << "Failed to allocate encoder output buffers";
+		return ret ? ret : -ENOMEM;
+	}
+
+	struct v4l2_buffer buf = {};
+	struct v4l2_plane plane = {};
+
+	buf.index = 0;
+	buf.type = captureType_;
+	buf.memory = V4L2_MEMORY_MMAP;
+	if (multiplanar_) {
+		buf.m.planes = &plane;
+		buf.length = 1;
+	}
+
+	ret = xioctl(fd_, VIDIOC_QUERYBUF, &buf);
+	if (ret)
+		return ret;
+
+	size_t length = multiplanar_ ? plane.length : buf.length;
+	off_t offset = multiplanar_ ? plane.m.mem_offset : buf.m.offset;
+
+	capture_ = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd_, offset);
+	if (capture_ == MAP_FAILED) {
+		ret = -errno;
+		LOG(JPEG, Error)
+			<< "Failed to map encoder output buffer: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	captureLength_ = length;
+
+	int type = outputType_;
+	ret = xioctl(fd_, VIDIOC_STREAMON, &type);
+	if (ret)
+		return ret;
+
+	type = captureType_;
+	return xioctl(fd_, VIDIOC_STREAMON, &type);
+}
+
+void EncoderV4L2::close()
+{
+	if (fd_ < 0)
+		return;
+
+	int type = outputType_;
+	xioctl(fd_, VIDIOC_STREAMOFF, &type);
+	type = captureType_;
+	xioctl(fd_, VIDIOC_STREAMOFF, &type);
+
+	if (capture_ != MAP_FAILED) {
+		munmap(capture_, captureLength_);
+		capture_ = MAP_FAILED;
+		captureLength_ = 0;
+	}
+
+	struct v4l2_requestbuffers rb = {};
+	rb.type = outputType_;
+	rb.memory = V4L2_MEMORY_DMABUF;
+	xioctl(fd_, VIDIOC_REQBUFS, &rb);
+
+	rb = {};
+	rb.type = captureType_;
+	rb.memory = V4L2_MEMORY_MMAP;
+	xioctl(fd_, VIDIOC_REQBUFS, &rb);
+
+	::close(fd_);
+	fd_ = -1;
+}
+
+int EncoderV4L2::queueBuffers(int dmabuf, unsigned int length)
+{
+	struct v4l2_buffer buf = {};
+	struct v4l2_plane plane = {};
+	int ret;
+
+	buf.index = 0;
+	buf.type = outputType_;
+	buf.memory = V4L2_MEMORY_DMABUF;
+	buf.field = V4L2_FIELD_NONE;
+	if (multiplanar_) {
+		plane.m.fd = dmabuf;
+		plane.length = length;
+		plane.bytesused = frameSize_;
+		buf.m.planes = &plane;
+		buf.length = 1;
+	} else {
+		buf.m.fd = dmabuf;
+		buf.length = length;
+		buf.bytesused = frameSize_;
+	}
+
+	ret = xioctl(fd_, VIDIOC_QBUF, &buf);
+	if (ret) {
+		LOG(JPEG, Error)
+			<< "Failed to queue encoder input buffer: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	buf = {};
+	plane = {};
+	buf.index = 0;
+	buf.type = captureType_;
+	buf.memory = V4L2_MEMORY_MMAP;
+	if (multiplanar_) {
+		buf.m.planes = &plane;
+		buf.length = 1;
+	}
+
+	ret = xioctl(fd_, VIDIOC_QBUF, &buf);
+	if (ret) {
+		LOG(JPEG, Error)
+			<< "Failed to queue encoder output buffer: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int EncoderV4L2::dequeueBuffer(uint32_t type, unsigned int *bytesused)
+{
+	/* Capture buffers signal POLLIN, output buffers POLLOUT. */
+	struct pollfd pfd = {};
+	pfd.fd = fd_;
+	pfd.events = type == captureType_ ? POLLIN : POLLOUT;
+
+	int ret = poll(&pfd, 1, kEncodeTimeout);
+	if (ret < 0)
+		return -errno;
+	if (ret == 0)
+		return -ETIMEDOUT;
+	if (pfd.revents & POLLERR)
+		return -EIO;
+
+	struct v4l2_buffer buf = {};
+	struct v4l2_plane plane = {};
+
+	buf.type = type;
+	buf.memory = type == captureType_ ? V4L2_MEMORY_MMAP
+					  : V4L2_MEMORY_DMABUF;
+	if (multiplanar_) {
+		buf.m.planes = &plane;
+		buf.length = 1;
+	}
+
+	ret = xioctl(fd_, VIDIOC_DQBUF, &buf);
+	if (ret)
+		return ret;
+
+	if (buf.flags & V4L2_BUF_FLAG_ERROR)
+		return -EIO;
+
+	if (bytesused)
+		*bytesused = multiplanar_ ? plane.bytesused : buf.bytesused;
+
+	return 0;
+}
+
+/* Return all buffers to the application after an error. */
+int EncoderV4L2::restartStreaming()
+{
+	int type = outputType_;
+	xioctl(fd_, VIDIOC_STREAMOFF, &type);
+	type = captureType_;
+	xioctl(fd_, VIDIOC_STREAMOFF, &type);
+
+	type = outputType_;
+	int ret = xioctl(fd_, VIDIOC_STREAMON, &type);
+	if (ret)
+		return ret;
+
+	type = captureType_;
+	return xioctl(fd_, VIDIOC_STREAMON, &type);
+}
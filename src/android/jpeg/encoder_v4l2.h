@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_v4l2.h - JPEG encoding using a V4L2 memory-to-memory encoder
+ */
+#ifndef __ANDROID_JPEG_ENCODER_V4L2_H__
+#define __ANDROID_JPEG_ENCODER_V4L2_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+#include "encoder.h"
+
+class EncoderV4L2 : public Encoder
+{
+public:
+	EncoderV4L2();
+	~EncoderV4L2();
+
+	int configure(const libcamera::StreamConfiguration &cfg) override;
+	int encode(const libcamera::FrameBuffer &source,
+		   libcamera::Span<uint8_t> destination,
+		   libcamera::Span<const uint8_t> exifData,
+		   unsigned int quality) override;
+
+	static int writeJpeg(libcamera::Span<const uint8_t> jpeg,
+			     libcamera::Span<uint8_t> destination,
+			     libcamera::Span<const uint8_t> exifData);
+
+private:
+	static bool enabled();
+	static const std::vector<std::string> &devices();
+
+	bool probe(const std::string &deviceNode, uint32_t fourcc);
+	int setFormats(uint32_t fourcc, const libcamera::Size &size,
+		       unsigned int stride);
+	int allocateBuffers();
+	void close();
+
+	int queueBuffers(int dmabuf, unsigned int length);
+	int dequeueBuffer(uint32_t type, unsigned int *bytesused);
+	int restartStreaming();
+
+	int fd_;
+	bool multiplanar_;
+	uint32_t outputType_;
+	uint32_t captureType_;
+
+	unsigned int frameSize_;
+	unsigned int quality_;
+
+	void *capture_;
+	size_t captureLength_;
+};
+
+#endif /* __ANDROID_JPEG_ENCODER_V4L2_H__ */
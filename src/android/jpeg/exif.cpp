@@ -8,9 +8,11 @@
 #include "exif.h"
 
 #include <cmath>
+#include <errno.h>
 #include <iomanip>
 #include <map>
 #include <sstream>
+#include <string.h>
 #include <tuple>
 #include <uchar.h>
 
@@ -31,6 +33,71 @@ enum class _ExifTag {
 	OFFSET_TIME_DIGITIZED    = 0x9012,
 };
 
+namespace {
+
+/* Tags of the thumbnail location in IFD1, and of the EXIF IFD pointer. */
+constexpr uint16_t kTagJpegInterchangeFormat = 0x0201;
+constexpr uint16_t kTagJpegInterchangeFormatLength = 0x0202;
+constexpr uint16_t kTagExifIfdPointer = 0x8769;
+
+struct Timestamp {
+	std::string dateTime;
+	std::string offset;
+	std::string subsec;
+};
+
+Timestamp formatTimestamp(time_t timestamp, std::chrono::milliseconds msec)
+{
+	Timestamp ts;
+	struct tm tm;
+	localtime_r(&timestamp, &tm);
+
+	char str[20];
+	strftime(str, sizeof(str), "%Y:%m:%d %H:%M:%S", &tm);
+	ts.dateTime = str;
+
+	/* Query the timezone information if available. */
+	int r = strftime(str, sizeof(str), "%z", &tm);
+	if (r <= 0)
+		return ts;
+
+	ts.offset = str;
+	ts.offset.insert(3, 1, ':');
+
+	std::stringstream sstr;
+	sstr << std::setfill('0') << std::setw(3) << msec.count();
+	ts.subsec = sstr.str();
+
+	return ts;
+}
+
+uint16_t orientationValue(int orientation)
+{
+	switch (orientation) {
+	case 0:
+	default:
+		return 1;
+	case 90:
+		return 6;
+	case 180:
+		return 3;
+	case 270:
+		return 8;
+	}
+}
+
+ExifRational exposureTimeRational(uint64_t nsec)
+{
+	return { static_cast<ExifLong>(nsec), 1000000000 };
+}
+
+ExifRational apertureRational(float size)
+{
+	return { static_cast<ExifLong>(size * 10000), 10000 };
+}
+
+} /* namespace */
+
 /*
  * The Exif class should be instantiated and specific properties set
  * through the exposed public API.
@@ -292,44 +359,33 @@ void Exif::setSize(const Size &size)
 
 void Exif::setTimestamp(time_t timestamp, std::chrono::milliseconds msec)
 {
-	struct tm tm;
-	localtime_r(&timestamp, &tm);
-
-	char str[20];
-	strftime(str, sizeof(str), "%Y:%m:%d %H:%M:%S", &tm);
-	std::string ts(str);
+	Timestamp ts = formatTimestamp(timestamp, msec);
 
-	setString(EXIF_IFD_0, EXIF_TAG_DATE_TIME, EXIF_FORMAT_ASCII, ts);
-	setString(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_ORIGINAL, EXIF_FORMAT_ASCII, ts);
-	setString(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_DIGITIZED, EXIF_FORMAT_ASCII, ts);
+	setString(EXIF_IFD_0, EXIF_TAG_DATE_TIME, EXIF_FORMAT_ASCII, ts.dateTime);
+	setString(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_ORIGINAL, EXIF_FORMAT_ASCII,
+		  ts.dateTime);
+	setString(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_DIGITIZED, EXIF_FORMAT_ASCII,
+		  ts.dateTime);
 
-	/* Query and set timezone information if available. */
-	int r = strftime(str, sizeof(str), "%z", &tm);
-	if (r <= 0)
+	if (ts.offset.empty())
 		return;
 
-	std::string tz(str);
-	tz.insert(3, 1, ':');
 	setString(EXIF_IFD_EXIF,
 		  static_cast<ExifTag>(_ExifTag::OFFSET_TIME),
-		  EXIF_FORMAT_ASCII, tz);
+		  EXIF_FORMAT_ASCII, ts.offset);
 	setString(EXIF_IFD_EXIF,
 		  static_cast<ExifTag>(_ExifTag::OFFSET_TIME_ORIGINAL),
-		  EXIF_FORMAT_ASCII, tz);
+		  EXIF_FORMAT_ASCII, ts.offset);
 	setString(EXIF_IFD_EXIF,
 		  static_cast<ExifTag>(_ExifTag::OFFSET_TIME_DIGITIZED),
-		  EXIF_FORMAT_ASCII, tz);
-
-	std::stringstream sstr;
-	sstr << std::setfill('0') << std::setw(3) << msec.count();
-	std::string subsec = sstr.str();
+		  EXIF_FORMAT_ASCII, ts.offset);
 
 	setString(EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME,
-		  EXIF_FORMAT_ASCII, subsec);
+		  EXIF_FORMAT_ASCII, ts.subsec);
 	setString(EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME_ORIGINAL,
-		  EXIF_FORMAT_ASCII, subsec);
+		  EXIF_FORMAT_ASCII, ts.subsec);
 	setString(EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME_DIGITIZED,
-		  EXIF_FORMAT_ASCII, subsec);
+		  EXIF_FORMAT_ASCII, ts.subsec);
 }
 
 void Exif::setGPSDateTimestamp(time_t timestamp)
@@ -410,24 +466,7 @@ void Exif::setGPSMethod(const std::string &method)
 
 void Exif::setOrientation(int orientation)
 {
-	int value;
-	switch (orientation) {
-	case 0:
-	default:
-		value = 1;
-		break;
-	case 90:
-		value = 6;
-		break;
-	case 180:
-		value = 3;
-		break;
-	case 270:
-		value = 8;
-		break;
-	}
-
-	setShort(EXIF_IFD_0, EXIF_TAG_ORIENTATION, value);
+	setShort(EXIF_IFD_0, EXIF_TAG_ORIENTATION, orientationValue(orientation));
 }
 
 /*
@@ -452,14 +491,13 @@ void Exif::setFocalLength(float length)
 
 void Exif::setExposureTime(uint64_t nsec)
 {
-	ExifRational rational = { static_cast<ExifLong>(nsec), 1000000000 };
-	setRational(EXIF_IFD_EXIF, EXIF_TAG_EXPOSURE_TIME, rational);
+	setRational(EXIF_IFD_EXIF, EXIF_TAG_EXPOSURE_TIME,
+		    exposureTimeRational(nsec));
 }
 
 void Exif::setAperture(float size)
 {
-	ExifRational rational = { static_cast<ExifLong>(size * 10000), 10000 };
-	setRational(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, rational);
+	setRational(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, apertureRational(size));
 }
 
 void Exif::setISO(uint16_t iso)
@@ -523,3 +561,220 @@ std::u16string Exif::utf8ToUtf16(const std::string &str)
 
 	return 0;
 }
+
+/*
+ * \class ExifTemplate
+ * \brief Patch per-frame fields in pre-generated EXIF data
+ *
+ * Generating EXIF data with libexif for every frame allocates and serializes
+ * all the entries, while most of them don't change between frames. The
+ * ExifTemplate is initialized with EXIF data generated once by the Exif class,
+ * with placeholder values for the per-frame fields. It locates the entries in
+ * the serialized data, and then updates their values in place for each frame.
+ *
+ * Only values whose size doesn't depend on the frame can be patched. The
+ * thumbnail, if present in the template, is stored by libexif at the end of
+ * the data and can thus be replaced with a thumbnail of a different size.
+ *
+ * The template only supports data in little-endian byte order, as generated by
+ * the Exif class.
+ */
+ExifTemplate::ExifTemplate()
+	: valid_(false), tiffBase_(0), thumbnailOffset_(0)
+{
+}
+
+int ExifTemplate::initialize(Span<const uint8_t> data)
+{
+	static const uint8_t exifHeader[] = { 'E', 'x', 'i', 'f', 0, 0 };
+
+	valid_ = false;
+	fields_.clear();
+	thumbnailOffset_ = 0;
+	data_.assign(data.begin(), data.end());
+
+	tiffBase_ = 0;
+	if (data_.size() >= sizeof(exifHeader) &&
+	    !memcmp(data_.data(), exifHeader, sizeof(exifHeader)))
+		tiffBase_ = sizeof(exifHeader);
+
+	if (data_.size() < tiffBase_ + 8 ||
+	    data_[tiffBase_] != 'I' || data_[tiffBase_ + 1] != 'I') {
+		LOG(EXIF, Error) << "Unsupported EXIF data layout";
+		return -EINVAL;
+	}
+
+	uint32_t ifd1 = 0;
+	int ret = parseIfd(EXIF_IFD_0, tiffBase_,
+			   exif_get_long(&data_[tiffBase_ + 4], EXIF_BYTE_ORDER_INTEL),
+			   &ifd1);
+	if (ret)
+		return ret;
+
+	if (ifd1) {
+		ret = parseIfd(EXIF_IFD_1, tiffBase_, ifd1, nullptr);
+		if (ret)
+			return ret;
+	}
+
+	const Field *offset = field(EXIF_IFD_1, kTagJpegInterchangeFormat);
+	const Field *length = field(EXIF_IFD_1, kTagJpegInterchangeFormatLength);
+	if (offset && length) {
+		/* The thumbnail must be located at the end of the data. */
+		size_t start = tiffBase_ +
+			       exif_get_long(&data_[offset->offset], EXIF_BYTE_ORDER_INTEL);
+		size_t size = exif_get_long(&data_[length->offset], EXIF_BYTE_ORDER_INTEL);
+		if (start + size != data_.size()) {
+			LOG(EXIF, Error) << "Thumbnail isn't located at the end";
+			return -EINVAL;
+		}
+
+		thumbnailOffset_ = start;
+	}
+
+	valid_ = true;
+	return 0;
+}
+
+int ExifTemplate::parseIfd(ExifIfd ifd, size_t base, uint32_t offset,
+			   uint32_t *next)
+{
+	size_t pos = base + offset;
+	if (pos + 2 > data_.size())
+		return -EINVAL;
+
+	unsigned int count = exif_get_short(&data_[pos], EXIF_BYTE_ORDER_INTEL);
+	pos += 2;
+
+	if (pos + count * 12 + 4 > data_.size())
+		return -EINVAL;
+
+	for (unsigned int i = 0; i < count; ++i, pos += 12) {
+		const uint8_t *entry = &data_[pos];
+		uint16_t tag = exif_get_short(entry, EXIF_BYTE_ORDER_INTEL);
+		ExifFormat format = static_cast<ExifFormat>(
+			exif_get_short(entry + 2, EXIF_BYTE_ORDER_INTEL));
+		uint32_t components = exif_get_long(entry + 4, EXIF_BYTE_ORDER_INTEL);
+		uint32_t value = exif_get_long(entry + 8, EXIF_BYTE_ORDER_INTEL);
+
+		size_t size = exif_format_get_size(format) * components;
+		if (!size)
+			continue;
+
+		size_t dataOffset = size > 4 ? base + value : pos + 8;
+		if (dataOffset + size > data_.size())
+			return -EINVAL;
+
+		fields_[{ ifd, tag }] = { dataOffset, size };
+
+		if (ifd == EXIF_IFD_0 && tag == kTagExifIfdPointer) {
+			int ret = parseIfd(EXIF_IFD_EXIF, base, value, nullptr);
+			if (ret)
+				return ret;
+		}
+	}
+
+	if (next)
+		*next = exif_get_long(&data_[pos], EXIF_BYTE_ORDER_INTEL);
+
+	return 0;
+}
+
+const ExifTemplate::Field *ExifTemplate::field(ExifIfd ifd, uint16_t tag) const
+{
+	auto it = fields_.find({ ifd, tag });
+	return it != fields_.end() ? &it->second : nullptr;
+}
+
+void ExifTemplate::setShort(ExifIfd ifd, uint16_t tag, uint16_t value)
+{
+	const Field *f = field(ifd, tag);
+	if (f && f->size == 2)
+		exif_set_short(&data_[f->offset], EXIF_BYTE_ORDER_INTEL, value);
+}
+
+void ExifTemplate::setLong(ExifIfd ifd, uint16_t tag, uint32_t value)
+{
+	const Field *f = field(ifd, tag);
+	if (f && f->size == 4)
+		exif_set_long(&data_[f->offset], EXIF_BYTE_ORDER_INTEL, value);
+}
+
+void ExifTemplate::setRational(ExifIfd ifd, uint16_t tag, ExifRational value)
+{
+	const Field *f = field(ifd, tag);
+	if (f && f->size == sizeof(ExifRational))
+		exif_set_rational(&data_[f->offset], EXIF_BYTE_ORDER_INTEL, value);
+}
+
+void ExifTemplate::setString(ExifIfd ifd, uint16_t tag, const std::string &value)
+{
+	/* ASCII strings are null-terminated. */
+	const Field *f = field(ifd, tag);
+	if (!f || f->size != value.size() + 1) {
+		LOG(EXIF, Debug) << "Can't patch tag "
+				 << utils::hex(static_cast<uint32_t>(tag), 4);
+		return;
+	}
+
+	memcpy(&data_[f->offset], value.c_str(), f->size);
+}
+
+void ExifTemplate::setOrientation(int orientation)
+{
+	setShort(EXIF_IFD_0, EXIF_TAG_ORIENTATION, orientationValue(orientation));
+}
+
+void ExifTemplate::setTimestamp(time_t timestamp, std::chrono::milliseconds msec)
+{
+	Timestamp ts = formatTimestamp(timestamp, msec);
+
+	setString(EXIF_IFD_0, EXIF_TAG_DATE_TIME, ts.dateTime);
+	setString(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_ORIGINAL, ts.dateTime);
+	setString(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_DIGITIZED, ts.dateTime);
+
+	if (ts.offset.empty())
+		return;
+
+	setString(EXIF_IFD_EXIF, static_cast<uint16_t>(_ExifTag::OFFSET_TIME),
+		  ts.offset);
+	setString(EXIF_IFD_EXIF, static_cast<uint16_t>(_ExifTag::OFFSET_TIME_ORIGINAL),
+		  ts.offset);
+	setString(EXIF_IFD_EXIF, static_cast<uint16_t>(_ExifTag::OFFSET_TIME_DIGITIZED),
+		  ts.offset);
+
+	setString(EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME, ts.subsec);
+	setString(EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME_ORIGINAL, ts.subsec);
+	setString(EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME_DIGITIZED, ts.subsec);
+}
+
+void ExifTemplate::setExposureTime(uint64_t nsec)
+{
+	setRational(EXIF_IFD_EXIF, EXIF_TAG_EXPOSURE_TIME,
+		    exposureTimeRational(nsec));
+}
+
+void ExifTemplate::setAperture(float size)
+{
+	setRational(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, apertureRational(size));
+}
+
+void ExifTemplate::setISO(uint16_t iso)
+{
+	setShort(EXIF_IFD_EXIF, EXIF_TAG_ISO_SPEED_RATINGS, iso);
+}
+
+/*
+ * Replace the thumbnail of the template. This is only valid for templates that
+ * contain a thumbnail.
+ */
+void ExifTemplate::setThumbnail(Span<const unsigned char> thumbnail)
+{
+	if (!thumbnailOffset_)
+		return;
+
+	data_.resize(thumbnailOffset_);
+	data_.insert(data_.end(), thumbnail.begin(), thumbnail.end());
+
+	setLong(EXIF_IFD_1, kTagJpegInterchangeFormatLength, thumbnail.size());
+}
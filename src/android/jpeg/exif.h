@@ -8,8 +8,11 @@
 #define __ANDROID_JPEG_EXIF_H__
 
 #include <chrono>
+#include <map>
 #include <string>
 #include <time.h>
+#include <utility>
+#include <vector>
 
 #include <libexif/exif-data.h>
 
@@ -108,4 +111,44 @@ private:
 	unsigned int size_;
 };
 
+class ExifTemplate
+{
+public:
+	ExifTemplate();
+
+	int initialize(libcamera::Span<const uint8_t> data);
+	bool isValid() const { return valid_; }
+	bool hasThumbnail() const { return thumbnailOffset_ != 0; }
+
+	void setOrientation(int orientation);
+	void setTimestamp(time_t timestamp, std::chrono::milliseconds msec);
+	void setExposureTime(uint64_t nsec);
+	void setAperture(float size);
+	void setISO(uint16_t iso);
+	void setThumbnail(libcamera::Span<const unsigned char> thumbnail);
+
+	libcamera::Span<const uint8_t> data() const { return data_; }
+
+private:
+	struct Field {
+		size_t offset;
+		size_t size;
+	};
+
+	int parseIfd(ExifIfd ifd, size_t base, uint32_t offset,
+		     uint32_t *next);
+	const Field *field(ExifIfd ifd, uint16_t tag) const;
+
+	void setShort(ExifIfd ifd, uint16_t tag, uint16_t value);
+	void setLong(ExifIfd ifd, uint16_t tag, uint32_t value);
+	void setRational(ExifIfd ifd, uint16_t tag, ExifRational value);
+	void setString(ExifIfd ifd, uint16_t tag, const std::string &value);
+
+	bool valid_;
+	std::vector<uint8_t> data_;
+	std::map<std::pair<ExifIfd, uint16_t>, Field> fields_;
+	size_t tiffBase_;
+	size_t thumbnailOffset_;
+};
+
 #endif /* __ANDROID_JPEG_EXIF_H__ */
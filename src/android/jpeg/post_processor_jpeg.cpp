@@ -8,10 +8,12 @@
 #include "post_processor_jpeg.h"
 
 #include <chrono>
+#include <optional>
 
 #include "../camera_device.h"
 #include "../camera_metadata.h"
 #include "encoder_libjpeg.h"
+#include "encoder_v4l2.h"
 #include "exif.h"
 
 #include <libcamera/base/log.h>
@@ -45,6 +47,13 @@ int PostProcessorJpeg::configure(const StreamConfiguration &inCfg,
 
 	thumbnailer_.configure(inCfg.size, inCfg.pixelFormat);
 
+	initializeExifTemplates();
+
+	/* Prefer a hardware encoder, and fall back to libjpeg. */
+	encoder_ = std::make_unique<EncoderV4L2>();
+	if (!encoder_->configure(inCfg))
+		return 0;
+
 	encoder_ = std::make_unique<EncoderLibJpeg>();
 
 	return encoder_->configure(inCfg);
@@ -82,6 +91,61 @@ void PostProcessorJpeg::generateThumbnail(const FrameBuffer &source,
 	}
 }
 
+/* Set the EXIF tags that don't depend on the frame. */
+void PostProcessorJpeg::setStaticExif(Exif *exif) const
+{
+	exif->setMake(cameraDevice_->maker());
+	exif->setModel(cameraDevice_->model());
+	exif->setSize(streamSize_);
+	exif->setFlash(Exif::Flash::FlashNotPresent);
+	exif->setWhiteBalance(Exif::WhiteBalance::Auto);
+	exif->setFocalLength(1.0);
+}
+
+unsigned int PostProcessorJpeg::exifTemplateIndex(bool aperture, bool thumbnail)
+{
+	return (aperture ? 1 : 0) | (thumbnail ? 2 : 0);
+}
+
+/*
+ * Generate the EXIF data once for each combination of the optional tags, with
+ * placeholder values for the fields that change with every frame. The
+ * templates are then patched in process(), avoiding the libexif allocations
+ * and serialization for every picture. Pictures with GPS information use the
+ * slow path, as the size of the GPS tags isn't fixed.
+ */
+void PostProcessorJpeg::initializeExifTemplates()
+{
+	static const unsigned char placeholderThumbnail[] = { 0xff, 0xd8, 0xff, 0xd9 };
+
+	for (bool aperture : { false, true }) {
+		for (bool thumbnail : { false, true }) {
+			ExifTemplate &exifTemplate =
+				exifTemplates_[exifTemplateIndex(aperture, thumbnail)];
+
+			Exif exif;
+			setStaticExif(&exif);
+			exif.setOrientation(0);
+			exif.setTimestamp(std::time(nullptr), 0ms);
+			exif.setExposureTime(0);
+			exif.setISO(100);
+			if (aperture)
+				exif.setAperture(1.0);
+			if (thumbnail)
+				exif.setThumbnail(placeholderThumbnail,
+						  Exif::Compression::JPEG);
+
+			if (exif.generate() != 0 ||
+			    exifTemplate.initialize(exif.data()) < 0 ||
+			    exifTemplate.hasThumbnail() != thumbnail) {
+				LOG(JPEG, Debug) << "EXIF template unavailable, "
+						 << "using libexif for every frame";
+				exifTemplate = ExifTemplate();
+			}
+		}
+	}
+}
+
 int PostProcessorJpeg::process(const FrameBuffer &source,
 			       CameraBuffer *destination,
 			       const CameraMetadata &requestMetadata,
@@ -95,46 +159,30 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 	camera_metadata_ro_entry_t entry;
 	int ret;
 
-	/* Set EXIF metadata for various tags. */
-	Exif exif;
-	exif.setMake(cameraDevice_->maker());
-	exif.setModel(cameraDevice_->model());
-
 	ret = requestMetadata.getEntry(ANDROID_JPEG_ORIENTATION, &entry);
 
 	const uint32_t jpegOrientation = ret ? *entry.data.i32 : 0;
 	resultMetadata->addEntry(ANDROID_JPEG_ORIENTATION, jpegOrientation);
-	exif.setOrientation(jpegOrientation);
 
-	exif.setSize(streamSize_);
 	/*
 	 * We set the frame's EXIF timestamp as the time of encode.
 	 * Since the precision we need for EXIF timestamp is only one
 	 * second, it is good enough.
 	 */
-	exif.setTimestamp(std::time(nullptr), 0ms);
+	const time_t timestamp = std::time(nullptr);
 
 	ret = resultMetadata->getEntry(ANDROID_SENSOR_EXPOSURE_TIME, &entry);
-	exif.setExposureTime(ret ? *entry.data.i64 : 0);
+	const uint64_t exposureTime = ret ? *entry.data.i64 : 0;
+
+	std::optional<float> aperture;
 	ret = requestMetadata.getEntry(ANDROID_LENS_APERTURE, &entry);
 	if (ret)
-		exif.setAperture(*entry.data.f);
+		aperture = *entry.data.f;
 
 	ret = resultMetadata->getEntry(ANDROID_SENSOR_SENSITIVITY, &entry);
-	exif.setISO(ret ? *entry.data.i32 : 100);
-
-	exif.setFlash(Exif::Flash::FlashNotPresent);
-	exif.setWhiteBalance(Exif::WhiteBalance::Auto);
-
-	exif.setFocalLength(1.0);
-
-	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_TIMESTAMP, &entry);
-	if (ret) {
-		exif.setGPSDateTimestamp(*entry.data.i64);
-		resultMetadata->addEntry(ANDROID_JPEG_GPS_TIMESTAMP,
-					 *entry.data.i64);
-	}
+	const uint16_t iso = ret ? *entry.data.i32 : 100;
 
+	std::vector<unsigned char> thumbnail;
 	ret = requestMetadata.getEntry(ANDROID_JPEG_THUMBNAIL_SIZE, &entry);
 	if (ret) {
 		const int32_t *data = entry.data.i32;
@@ -145,19 +193,57 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 		uint8_t quality = ret ? *entry.data.u8 : 95;
 		resultMetadata->addEntry(ANDROID_JPEG_THUMBNAIL_QUALITY, quality);
 
-		if (thumbnailSize != Size(0, 0)) {
-			std::vector<unsigned char> thumbnail;
+		if (thumbnailSize != Size(0, 0))
 			generateThumbnail(source, thumbnailSize, quality, &thumbnail);
-			if (!thumbnail.empty())
-				exif.setThumbnail(thumbnail, Exif::Compression::JPEG);
-		}
 
 		resultMetadata->addEntry(ANDROID_JPEG_THUMBNAIL_SIZE, data, 2);
 	}
 
+	bool hasGps = requestMetadata.hasEntry(ANDROID_JPEG_GPS_TIMESTAMP) ||
+		      requestMetadata.hasEntry(ANDROID_JPEG_GPS_COORDINATES) ||
+		      requestMetadata.hasEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD);
+
+	/* Patch the EXIF template if possible, or generate the EXIF data. */
+	Span<const uint8_t> exifData;
+	std::optional<Exif> exif;
+
+	ExifTemplate &exifTemplate =
+		exifTemplates_[exifTemplateIndex(aperture.has_value(),
+						 !thumbnail.empty())];
+	if (!hasGps && exifTemplate.isValid()) {
+		exifTemplate.setOrientation(jpegOrientation);
+		exifTemplate.setTimestamp(timestamp, 0ms);
+		exifTemplate.setExposureTime(exposureTime);
+		if (aperture)
+			exifTemplate.setAperture(*aperture);
+		exifTemplate.setISO(iso);
+		if (!thumbnail.empty())
+			exifTemplate.setThumbnail(thumbnail);
+
+		exifData = exifTemplate.data();
+	} else {
+		exif.emplace();
+		setStaticExif(&*exif);
+		exif->setOrientation(jpegOrientation);
+		exif->setTimestamp(timestamp, 0ms);
+		exif->setExposureTime(exposureTime);
+		if (aperture)
+			exif->setAperture(*aperture);
+		exif->setISO(iso);
+		if (!thumbnail.empty())
+			exif->setThumbnail(thumbnail, Exif::Compression::JPEG);
+	}
+
+	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_TIMESTAMP, &entry);
+	if (ret) {
+		exif->setGPSDateTimestamp(*entry.data.i64);
+		resultMetadata->addEntry(ANDROID_JPEG_GPS_TIMESTAMP,
+					 *entry.data.i64);
+	}
+
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_COORDINATES, &entry);
 	if (ret) {
-		exif.setGPSLocation(entry.data.d);
+		exif->setGPSLocation(entry.data.d);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_COORDINATES,
 					 entry.data.d, 3);
 	}
@@ -165,20 +251,24 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD, &entry);
 	if (ret) {
 		std::string method(entry.data.u8, entry.data.u8 + entry.count);
-		exif.setGPSMethod(method);
+		exif->setGPSMethod(method);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD,
 					 entry.data.u8, entry.count);
 	}
 
-	if (exif.generate() != 0)
-		LOG(JPEG, Error) << "Failed to generate valid EXIF data";
+	if (exif) {
+		if (exif->generate() != 0)
+			LOG(JPEG, Error) << "Failed to generate valid EXIF data";
+
+		exifData = exif->data();
+	}
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_QUALITY, &entry);
 	const uint8_t quality = ret ? *entry.data.u8 : 95;
 	resultMetadata->addEntry(ANDROID_JPEG_QUALITY, quality);
 
 	int jpeg_size = encoder_->encode(source, destination->plane(0),
-					 exif.data(), quality);
+					 exifData, quality);
 	if (jpeg_size < 0) {
 		LOG(JPEG, Error) << "Failed to encode stream image";
 		return jpeg_size;
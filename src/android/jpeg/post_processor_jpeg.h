@@ -9,8 +9,11 @@
 
 #include "../post_processor.h"
 #include "encoder_libjpeg.h"
+#include "exif.h"
 #include "thumbnailer.h"
 
+#include <array>
+
 #include <libcamera/geometry.h>
 
 class CameraDevice;
@@ -33,11 +36,17 @@ private:
 			       unsigned int quality,
 			       std::vector<unsigned char> *thumbnail);
 
+	void setStaticExif(Exif *exif) const;
+	void initializeExifTemplates();
+	static unsigned int exifTemplateIndex(bool aperture, bool thumbnail);
+
 	CameraDevice *const cameraDevice_;
 	std::unique_ptr<Encoder> encoder_;
 	libcamera::Size streamSize_;
 	EncoderLibJpeg thumbnailEncoder_;
 	Thumbnailer thumbnailer_;
+
+	std::array<ExifTemplate, 4> exifTemplates_;
 };
 
 #endif /* __ANDROID_POST_PROCESSOR_JPEG_H__ */
@@ -41,7 +41,9 @@ void Thumbnailer::createThumbnail(const FrameBuffer &source,
 				  const Size &targetSize,
 				  std::vector<unsigned char> *destination)
 {
-	MappedFrameBuffer frame(&source, MappedFrameBuffer::MapFlag::Read);
+	MappedFrameBuffer frame(&source, MappedFrameBuffer::MapFlag::Read |
+				MappedFrameBuffer::MapFlag::Persistent |
+				MappedFrameBuffer::MapFlag::Populate);
 	if (!frame.isValid()) {
 		LOG(Thumbnailer, Error)
 			<< "Failed to map FrameBuffer : "
@@ -54,6 +56,9 @@ void Thumbnailer::createThumbnail(const FrameBuffer &source,
 		return;
 	}
 
+	if (frame.beginCpuAccess(MappedFrameBuffer::MapFlag::Read) < 0)
+		return;
+
 	const unsigned int sw = sourceSize_.width;
 	const unsigned int sh = sourceSize_.height;
 	const unsigned int tw = targetSize.width;
@@ -61,35 +66,22 @@ void Thumbnailer::createThumbnail(const FrameBuffer &source,
 
 	ASSERT(tw % 2 == 0 && th % 2 == 0);
 
-	/* Image scaling block implementing nearest-neighbour algorithm. */
-	unsigned char *src = static_cast<unsigned char *>(frame.maps()[0].data());
-	unsigned char *srcC = src + sh * sw;
-	unsigned char *srcCb, *srcCr;
-	unsigned char *dstY, *srcY;
+	if ((scaler_.sourceSize() != sourceSize_ ||
+	     scaler_.destinationSize() != targetSize) &&
+	    scaler_.configure(sourceSize_, targetSize) < 0) {
+		frame.endCpuAccess();
+		return;
+	}
+
+	const unsigned char *src = frame.maps()[0].data();
+	const unsigned char *srcC = src + sh * sw;
 
 	size_t dstSize = (th * tw) + ((th / 2) * tw);
 	destination->resize(dstSize);
 	unsigned char *dst = destination->data();
 	unsigned char *dstC = dst + th * tw;
 
-	for (unsigned int y = 0; y < th; y += 2) {
-		unsigned int sourceY = (sh * y + th / 2) / th;
+	scaler_.scale(src, sw, srcC, sw, dst, tw, dstC, tw);
 
-		dstY = dst + y * tw;
-		srcY = src + sw * sourceY;
-		srcCb = srcC + (sourceY / 2) * sw + 0;
-		srcCr = srcC + (sourceY / 2) * sw + 1;
-
-		for (unsigned int x = 0; x < tw; x += 2) {
-			unsigned int sourceX = (sw * x + tw / 2) / tw;
-
-			dstY[x] = srcY[sourceX];
-			dstY[tw + x] = srcY[sw + sourceX];
-			dstY[x + 1] = srcY[sourceX + 1];
-			dstY[tw + x + 1] = srcY[sw + sourceX + 1];
-
-			dstC[(y / 2) * tw + x + 0] = srcCb[(sourceX / 2) * 2];
-			dstC[(y / 2) * tw + x + 1] = srcCr[(sourceX / 2) * 2];
-		}
-	}
+	frame.endCpuAccess();
 }
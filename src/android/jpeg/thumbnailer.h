@@ -12,6 +12,8 @@
 
 #include "libcamera/internal/formats.h"
 
+#include "../yuv/yuv_scaler.h"
+
 class Thumbnailer
 {
 public:
@@ -27,6 +29,7 @@ public:
 private:
 	libcamera::PixelFormat pixelFormat_;
 	libcamera::Size sourceSize_;
+	YuvScaler scaler_;
 
 	bool valid_;
 };
@@ -39,6 +39,7 @@ CameraBuffer::Private::Private([[maybe_unused]] CameraBuffer *cameraBuffer,
 			       buffer_handle_t camera3Buffer, int flags)
 {
 	maps_.reserve(camera3Buffer->numFds);
+	mappings_.reserve(camera3Buffer->numFds);
 	error_ = 0;
 
 	for (int i = 0; i < camera3Buffer->numFds; i++) {
@@ -60,8 +61,9 @@ CameraBuffer::Private::Private([[maybe_unused]] CameraBuffer *cameraBuffer,
 			break;
 		}
 
-		maps_.emplace_back(static_cast<uint8_t *>(address),
-				   static_cast<size_t>(length));
+		mappings_.emplace_back(static_cast<uint8_t *>(address),
+				       static_cast<size_t>(length));
+		maps_.push_back(mappings_.back());
 	}
 }
 
@@ -2,13 +2,11 @@
 /*
  * Copyright (C) 2021, Google Inc.
  *
- * post_processor_yuv.cpp - Post Processor using libyuv
+ * post_processor_yuv.cpp - Post Processor for YUV scaling
  */
 
 #include "post_processor_yuv.h"
 
-#include <libyuv/scale.h>
-
 #include <libcamera/base/log.h>
 
 #include <libcamera/formats.h>
@@ -46,7 +44,8 @@ int PostProcessorYuv::configure(const StreamConfiguration &inCfg,
 	}
 
 	calculateLengths(inCfg, outCfg);
-	return 0;
+
+	return scaler_.configure(inCfg.size, outCfg.size);
 }
 
 int PostProcessorYuv::process(const FrameBuffer &source,
@@ -57,28 +56,24 @@ int PostProcessorYuv::process(const FrameBuffer &source,
 	if (!isValidBuffers(source, *destination))
 		return -EINVAL;
 
-	const MappedFrameBuffer sourceMapped(&source, MappedFrameBuffer::MapFlag::Read);
+	MappedFrameBuffer sourceMapped(&source,
+				       MappedFrameBuffer::MapFlag::Read |
+				       MappedFrameBuffer::MapFlag::Persistent |
+				       MappedFrameBuffer::MapFlag::Populate);
 	if (!sourceMapped.isValid()) {
 		LOG(YUV, Error) << "Failed to mmap camera frame buffer";
 		return -EINVAL;
 	}
 
-	int ret = libyuv::NV12Scale(sourceMapped.maps()[0].data(),
-				    sourceStride_[0],
-				    sourceMapped.maps()[1].data(),
-				    sourceStride_[1],
-				    sourceSize_.width, sourceSize_.height,
-				    destination->plane(0).data(),
-				    destinationStride_[0],
-				    destination->plane(1).data(),
-				    destinationStride_[1],
-				    destinationSize_.width,
-				    destinationSize_.height,
-				    libyuv::FilterMode::kFilterBilinear);
-	if (ret) {
-		LOG(YUV, Error) << "Failed NV12 scaling: " << ret;
+	if (sourceMapped.beginCpuAccess(MappedFrameBuffer::MapFlag::Read) < 0)
 		return -EINVAL;
-	}
+
+	scaler_.scale(sourceMapped.maps()[0].data(), sourceStride_[0],
+		      sourceMapped.maps()[1].data(), sourceStride_[1],
+		      destination->plane(0).data(), destinationStride_[0],
+		      destination->plane(1).data(), destinationStride_[1]);
+
+	sourceMapped.endCpuAccess();
 
 	return 0;
 }
@@ -130,15 +125,15 @@ void PostProcessorYuv::calculateLengths(const StreamConfiguration &inCfg,
 	destinationSize_ = outCfg.size;
 
 	const PixelFormatInfo &nv12Info = PixelFormatInfo::info(formats::NV12);
+	const FrameLayout destinationLayout = nv12Info.frameLayout(destinationSize_);
 	for (unsigned int i = 0; i < 2; i++) {
 		sourceStride_[i] = inCfg.stride;
-		destinationStride_[i] = nv12Info.stride(destinationSize_.width, i, 1);
+		destinationStride_[i] = destinationLayout.planes[i].stride;
 
 		const unsigned int vertSubSample =
 			nv12Info.planes[i].verticalSubSampling;
 		sourceLength_[i] = sourceStride_[i] *
 			((sourceSize_.height + vertSubSample - 1) / vertSubSample);
-		destinationLength_[i] = destinationStride_[i] *
-			((destinationSize_.height + vertSubSample - 1) / vertSubSample);
+		destinationLength_[i] = destinationLayout.planes[i].size;
 	}
 }
@@ -2,7 +2,7 @@
 /*
  * Copyright (C) 2021, Google Inc.
  *
- * post_processor_yuv.h - Post Processor using libyuv
+ * post_processor_yuv.h - Post Processor for YUV scaling
  */
 #ifndef __ANDROID_POST_PROCESSOR_YUV_H__
 #define __ANDROID_POST_PROCESSOR_YUV_H__
@@ -11,6 +11,8 @@
 
 #include <libcamera/geometry.h>
 
+#include "yuv_scaler.h"
+
 class CameraDevice;
 
 class PostProcessorYuv : public PostProcessor
@@ -37,6 +39,8 @@ private:
 	unsigned int destinationLength_[2] = {};
 	unsigned int sourceStride_[2] = {};
 	unsigned int destinationStride_[2] = {};
+
+	YuvScaler scaler_;
 };
 
 #endif /* __ANDROID_POST_PROCESSOR_YUV_H__ */
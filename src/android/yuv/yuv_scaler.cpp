@@ -0,0 +1,309 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * yuv_scaler.cpp - NV12 image scaler
+ */
+
+#include "yuv_scaler.h"
+
+#include <algorithm>
+
+#include <libcamera/base/log.h>
+
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(YuvScaler)
+
+namespace {
+
+/*
+ * Frames whose source is smaller than this are scaled in the caller's thread,
+ * as the cost of dispatching strips to the thread pool would outweigh the
+ * gain.
+ */
+constexpr unsigned int kParallelThreshold = 1280 * 720;
+constexpr unsigned int kStripsPerWorker = 2;
+
+/*
+ * The vertical pass of both filters produces an intermediate row of samples
+ * in 8.8 fixed point. The loops operate on contiguous arrays without
+ * dependencies between iterations, for the compiler to vectorize them.
+ */
+void verticalBilinear(const uint8_t *row0, const uint8_t *row1,
+		      unsigned int weight, unsigned int length, uint16_t *out)
+{
+	const unsigned int weight0 = 256 - weight;
+
+	for (unsigned int i = 0; i < length; ++i)
+		out[i] = row0[i] * weight0 + row1[i] * weight;
+}
+
+void verticalBox(const uint8_t *row, unsigned int stride, unsigned int count,
+		 unsigned int weight, unsigned int length, uint32_t *acc,
+		 uint16_t *out)
+{
+	std::fill(acc, acc + length, 0);
+
+	for (unsigned int y = 0; y < count; ++y, row += stride) {
+		for (unsigned int i = 0; i < length; ++i)
+			acc[i] += row[i];
+	}
+
+	for (unsigned int i = 0; i < length; ++i)
+		out[i] = (acc[i] * weight + 128) >> 8;
+}
+
+template<unsigned int Channels>
+void horizontalBilinear(const uint16_t *in, const unsigned int *start,
+			const unsigned int *end, const unsigned int *weight,
+			unsigned int width, uint8_t *out)
+{
+	for (unsigned int x = 0; x < width; ++x) {
+		const uint16_t *a = in + start[x];
+		const uint16_t *b = in + end[x];
+		const unsigned int w1 = weight[x];
+		const unsigned int w0 = 256 - w1;
+
+		for (unsigned int c = 0; c < Channels; ++c)
+			out[c] = (a[c] * w0 + b[c] * w1 + (1 << 15)) >> 16;
+
+		out += Channels;
+	}
+}
+
+template<unsigned int Channels>
+void horizontalBox(const uint16_t *in, const unsigned int *start,
+		   const unsigned int *end, const unsigned int *weight,
+		   unsigned int width, uint8_t *out)
+{
+	for (unsigned int x = 0; x < width; ++x) {
+		uint32_t sum[Channels] = {};
+
+		for (unsigned int i = start[x]; i < end[x]; i += Channels) {
+			for (unsigned int c = 0; c < Channels; ++c)
+				sum[c] += in[i + c];
+		}
+
+		for (unsigned int c = 0; c < Channels; ++c) {
+			uint64_t value = (static_cast<uint64_t>(sum[c]) * weight[x]
+					  + (1 << 23)) >> 24;
+			out[c] = std::min<uint64_t>(value, 255);
+		}
+
+		out += Channels;
+	}
+}
+
+/*
+ * Compute the position of the first source sample of each destination sample
+ * for a bilinear filter, aligning the centres of the source and destination
+ * grids, and the weight of the next source sample in 0.8 fixed point.
+ */
+void bilinearTaps(unsigned int source, unsigned int destination,
+		  std::vector<unsigned int> *first,
+		  std::vector<unsigned int> *second,
+		  std::vector<unsigned int> *weight)
+{
+	first->resize(destination);
+	second->resize(destination);
+	weight->resize(destination);
+
+	for (unsigned int i = 0; i < destination; ++i) {
+		int64_t pos = (static_cast<int64_t>(2 * i + 1) * source * 256)
+			    / (2 * destination) - 128;
+		pos = std::max<int64_t>(pos, 0);
+
+		unsigned int index = pos >> 8;
+		unsigned int frac = pos & 255;
+		if (index >= source - 1) {
+			index = source - 1;
+			frac = 0;
+		}
+
+		(*first)[i] = index;
+		(*second)[i] = std::min(index + 1, source - 1);
+		(*weight)[i] = frac;
+	}
+}
+
+/*
+ * Compute the range of source samples averaged for each destination sample
+ * for a box filter, and the reciprocal of its size in 0.16 fixed point.
+ */
+void boxTaps(unsigned int source, unsigned int destination,
+	     std::vector<unsigned int> *first,
+	     std::vector<unsigned int> *last,
+	     std::vector<unsigned int> *weight)
+{
+	first->resize(destination);
+	last->resize(destination);
+	weight->resize(destination);
+
+	for (unsigned int i = 0; i < destination; ++i) {
+		unsigned int start = static_cast<uint64_t>(i) * source / destination;
+		unsigned int end = static_cast<uint64_t>(i + 1) * source / destination;
+		end = std::clamp(end, start + 1, source);
+
+		unsigned int count = end - start;
+
+		(*first)[i] = start;
+		(*last)[i] = end;
+		(*weight)[i] = ((1 << 16) + count / 2) / count;
+	}
+}
+
+} /* namespace */
+
+/*
+ * The YuvScaler resizes NV12 frames with a bilinear filter, or a box filter
+ * that averages all source samples covered by each destination sample. The
+ * box filter avoids the aliasing of bilinear interpolation for large
+ * downscaling ratios, typically when generating thumbnails.
+ *
+ * Each plane is scaled separately, in two passes. The vertical pass filters
+ * the source rows into an intermediate row, and the horizontal pass filters
+ * the intermediate row into a destination row. Large frames are split in
+ * strips of destination rows processed concurrently by a thread pool.
+ */
+YuvScaler::YuvScaler()
+	: strips_(1)
+{
+}
+
+YuvScaler::~YuvScaler() = default;
+
+int YuvScaler::configure(const Size &sourceSize, const Size &destinationSize,
+			 Filter filter)
+{
+	if (sourceSize.isNull() || destinationSize.isNull() ||
+	    destinationSize.width % 2 || destinationSize.height % 2) {
+		LOG(YuvScaler, Error)
+			<< "Invalid scaling from " << sourceSize.toString()
+			<< " to " << destinationSize.toString();
+		return -EINVAL;
+	}
+
+	if (filter == Filter::Auto) {
+		bool downscale = sourceSize.width >= destinationSize.width * 2 &&
+				 sourceSize.height >= destinationSize.height * 2;
+		filter = downscale ? Filter::Box : Filter::Bilinear;
+	}
+
+	sourceSize_ = sourceSize;
+	destinationSize_ = destinationSize;
+
+	Size sourceChroma{ (sourceSize.width + 1) / 2,
+			   (sourceSize.height + 1) / 2 };
+	Size destinationChroma{ destinationSize.width / 2,
+				destinationSize.height / 2 };
+
+	planes_[0].configure(sourceSize, destinationSize, 1, filter);
+	planes_[1].configure(sourceChroma, destinationChroma, 2, filter);
+
+	if (sourceSize.width * sourceSize.height < kParallelThreshold) {
+		pool_.reset();
+		strips_ = 1;
+		return 0;
+	}
+
+	if (!pool_)
+		pool_ = std::make_unique<ThreadPool>(0, "YuvScaler");
+
+	strips_ = std::min(pool_->size() * kStripsPerWorker,
+			   destinationChroma.height);
+
+	return 0;
+}
+
+void YuvScaler::scale(const uint8_t *srcY, unsigned int srcStrideY,
+		      const uint8_t *srcUV, unsigned int srcStrideUV,
+		      uint8_t *dstY, unsigned int dstStrideY,
+		      uint8_t *dstUV, unsigned int dstStrideUV)
+{
+	const uint8_t *src[2] = { srcY, srcUV };
+	const unsigned int srcStride[2] = { srcStrideY, srcStrideUV };
+	uint8_t *dst[2] = { dstY, dstUV };
+	const unsigned int dstStride[2] = { dstStrideY, dstStrideUV };
+
+	if (!pool_) {
+		for (unsigned int i = 0; i < 2; ++i)
+			planes_[i].scale(src[i], srcStride[i], dst[i], dstStride[i],
+					 0, planes_[i].destination.height);
+		return;
+	}
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		const Plane &plane = planes_[i];
+		const unsigned int height = plane.destination.height;
+
+		for (unsigned int strip = 0; strip < strips_; ++strip) {
+			unsigned int begin = height * strip / strips_;
+			unsigned int end = height * (strip + 1) / strips_;
+
+			pool_->run([&plane, s = src[i], ss = srcStride[i],
+				    d = dst[i], ds = dstStride[i], begin, end]() {
+				plane.scale(s, ss, d, ds, begin, end);
+			});
+		}
+	}
+
+	/* The pool is private to the scaler, wait for all strips. */
+	pool_->wait();
+}
+
+void YuvScaler::Plane::configure(const Size &sourceSize,
+				 const Size &destinationSize,
+				 unsigned int numChannels, Filter filterType)
+{
+	source = sourceSize;
+	destination = destinationSize;
+	channels = numChannels;
+	filter = filterType;
+
+	if (filter == Filter::Box) {
+		boxTaps(source.width, destination.width,
+			&columnStart, &columnEnd, &columnWeight);
+		boxTaps(source.height, destination.height,
+			&rowStart, &rowEnd, &rowWeight);
+	} else {
+		bilinearTaps(source.width, destination.width,
+			     &columnStart, &columnEnd, &columnWeight);
+		bilinearTaps(source.height, destination.height,
+			     &rowStart, &rowEnd, &rowWeight);
+	}
+
+	/* Convert the column indices to offsets in the intermediate row. */
+	for (unsigned int &offset : columnStart)
+		offset *= channels;
+	for (unsigned int &offset : columnEnd)
+		offset *= channels;
+}
+
+void YuvScaler::Plane::scale(const uint8_t *src, unsigned int srcStride,
+			     uint8_t *dst, unsigned int dstStride,
+			     unsigned int begin, unsigned int end) const
+{
+	const unsigned int length = source.width * channels;
+	std::vector<uint16_t> row(length);
+	std::vector<uint32_t> acc(filter == Filter::Box ? length : 0);
+
+	auto horizontal = filter == Filter::Box
+			? (channels == 1 ? horizontalBox<1> : horizontalBox<2>)
+			: (channels == 1 ? horizontalBilinear<1> : horizontalBilinear<2>);
+
+	for (unsigned int y = begin; y < end; ++y) {
+		const uint8_t *line = src + rowStart[y] * srcStride;
+
+		if (filter == Filter::Box)
+			verticalBox(line, srcStride, rowEnd[y] - rowStart[y],
+				    rowWeight[y], length, acc.data(), row.data());
+		else
+			verticalBilinear(line, src + rowEnd[y] * srcStride,
+					 rowWeight[y], length, row.data());
+
+		horizontal(row.data(), columnStart.data(), columnEnd.data(),
+			   columnWeight.data(), destination.width,
+			   dst + y * dstStride);
+	}
+}
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * yuv_scaler.h - NV12 image scaler
+ */
+#ifndef __ANDROID_YUV_SCALER_H__
+#define __ANDROID_YUV_SCALER_H__
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/thread_pool.h>
+
+#include <libcamera/geometry.h>
+
+class YuvScaler
+{
+public:
+	enum class Filter {
+		Auto,
+		Bilinear,
+		Box,
+	};
+
+	YuvScaler();
+	~YuvScaler();
+
+	int configure(const libcamera::Size &sourceSize,
+		      const libcamera::Size &destinationSize,
+		      Filter filter = Filter::Auto);
+
+	const libcamera::Size &sourceSize() const { return sourceSize_; }
+	const libcamera::Size &destinationSize() const { return destinationSize_; }
+
+	void scale(const uint8_t *srcY, unsigned int srcStrideY,
+		   const uint8_t *srcUV, unsigned int srcStrideUV,
+		   uint8_t *dstY, unsigned int dstStrideY,
+		   uint8_t *dstUV, unsigned int dstStrideUV);
+
+private:
+	struct Plane {
+		void configure(const libcamera::Size &source,
+			       const libcamera::Size &destination,
+			       unsigned int channels, Filter filter);
+		void scale(const uint8_t *src, unsigned int srcStride,
+			   uint8_t *dst, unsigned int dstStride,
+			   unsigned int begin, unsigned int end) const;
+
+		libcamera::Size source;
+		libcamera::Size destination;
+		unsigned int channels;
+		Filter filter;
+
+		/*
+		 * Bilinear: offsets of the two source samples and weight of the
+		 * second one. Box: offset of the first and last source samples
+		 * and reciprocal of the number of samples.
+		 */
+		std::vector<unsigned int> columnStart;
+		std::vector<unsigned int> columnEnd;
+		std::vector<unsigned int> columnWeight;
+		std::vector<unsigned int> rowStart;
+		std::vector<unsigned int> rowEnd;
+		std::vector<unsigned int> rowWeight;
+	};
+
+	libcamera::Size sourceSize_;
+	libcamera::Size destinationSize_;
+
+	Plane planes_[2];
+
+	std::unique_ptr<libcamera::ThreadPool> pool_;
+	unsigned int strips_;
+};
+
+#endif /* __ANDROID_YUV_SCALER_H__ */
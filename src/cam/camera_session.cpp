@@ -9,9 +9,11 @@
 #include <iostream>
 #include <limits.h>
 #include <sstream>
+#include <sys/resource.h>
 
 #include <libcamera/control_ids.h>
 #include <libcamera/property_ids.h>
+#include <libcamera/stream_stats.h>
 
 #include "camera_session.h"
 #include "event_loop.h"
@@ -30,7 +32,8 @@ CameraSession::CameraSession(CameraManager *cm,
 			     const OptionsParser::Options &options)
 	: options_(options), cameraIndex_(cameraIndex), last_(0),
 	  queueCount_(0), captureCount_(0), captureLimit_(0),
-	  printMetadata_(false)
+	  printMetadata_(false), benchmark_(false), firstTimestamp_(0),
+	  cpuTimeStart_(0.0), threaded_(false), workerRunning_(false)
 {
 	char *endptr;
 	unsigned long index = strtoul(cameraId.c_str(), &endptr, 10);
@@ -170,6 +173,8 @@ int CameraSession::start()
 	captureCount_ = 0;
 	captureLimit_ = options_[OptCapture].toInteger();
 	printMetadata_ = options_.isSet(OptMetadata);
+	benchmark_ = options_.isSet(OptBenchmark);
+	threaded_ = options_.isSet(OptThread);
 
 	ret = camera_->configure(config_.get());
 	if (ret < 0) {
@@ -187,8 +192,24 @@ int CameraSession::start()
 	camera_->requestCompleted.connect(this, &CameraSession::requestComplete);
 
 #ifdef HAVE_KMS
-	if (options_.isSet(OptDisplay))
-		sink_ = std::make_unique<KMSSink>(options_[OptDisplay].toString());
+	if (options_.isSet(OptDisplay)) {
+		/*
+		 * The KMS sink handles page flip events in the main event
+		 * loop, and can't process requests from a different thread.
+		 */
+		if (threaded_) {
+			std::cerr << "Display can't be used with --thread"
+				  << std::endl;
+			return -EINVAL;
+		}
+
+		unsigned int queueDepth = 1;
+		if (options_.isSet(OptDisplayQueue))
+			queueDepth = options_[OptDisplayQueue].toInteger();
+
+		sink_ = std::make_unique<KMSSink>(options_[OptDisplay].toString(),
+						  queueDepth);
+	}
 #endif
 
 	if (options_.isSet(OptFile)) {
@@ -214,8 +235,38 @@ int CameraSession::start()
 	return startCapture();
 }
 
+namespace {
+
+/* Return the CPU time consumed by the process, in seconds. */
+double cpuTime()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return 0.0;
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+	       usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+double toMs(std::chrono::nanoseconds duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+} /* namespace */
+
 void CameraSession::stop()
 {
+	/*
+	 * Stop the worker thread first, to ensure it doesn't access the session
+	 * concurrently. Requests completed from now on won't be processed or
+	 * requeued.
+	 */
+	stopWorker();
+
+	if (benchmark_)
+		printBenchmark();
+
 	int ret = camera_->stop();
 	if (ret)
 		std::cout << "Failed to stop capture" << std::endl;
@@ -290,23 +341,45 @@ int CameraSession::startCapture()
 		}
 	}
 
+	if (benchmark_) {
+		camera_->resetLatencyStats();
+		camera_->resetStreamStats();
+		frameInterval_.reset();
+		firstTimestamp_ = 0;
+		startLatency_ = {};
+		startTime_ = std::chrono::steady_clock::now();
+		cpuTimeStart_ = cpuTime();
+	}
+
+	startWorker();
+
 	ret = camera_->start();
 	if (ret) {
 		std::cout << "Failed to start capture" << std::endl;
+		stopWorker();
 		if (sink_)
 			sink_->stop();
 		return ret;
 	}
 
+	/* Prime the camera with all requests, up to the capture limit. */
+	std::vector<Request *> requests;
 	for (std::unique_ptr<Request> &request : requests_) {
-		ret = queueRequest(request.get());
-		if (ret < 0) {
-			std::cerr << "Can't queue request" << std::endl;
-			camera_->stop();
-			if (sink_)
-				sink_->stop();
-			return ret;
-		}
+		if (captureLimit_ && queueCount_ >= captureLimit_)
+			break;
+
+		requests.push_back(request.get());
+		queueCount_++;
+	}
+
+	ret = camera_->queueRequests(requests);
+	if (ret < 0) {
+		std::cerr << "Can't queue requests" << std::endl;
+		stopWorker();
+		camera_->stop();
+		if (sink_)
+			sink_->stop();
+		return ret;
 	}
 
 	if (captureLimit_)
@@ -337,10 +410,10 @@ void CameraSession::requestComplete(Request *request)
 		return;
 
 	/*
-	 * Defer processing of the completed request to the event loop, to avoid
-	 * blocking the camera manager thread.
+	 * Defer processing of the completed request to the event loop or the
+	 * worker thread, to avoid blocking the camera manager thread.
 	 */
-	EventLoop::instance()->callLater([=]() { processRequest(request); });
+	dispatch([=]() { processRequest(request); });
 }
 
 void CameraSession::processRequest(Request *request)
@@ -354,16 +427,31 @@ void CameraSession::processRequest(Request *request)
 	uint64_t ts = buffers.begin()->second->metadata().timestamp;
 	double fps = ts - last_;
 	fps = last_ != 0 && fps ? 1000000000.0 / fps : 0.0;
-	last_ = ts;
 
 	bool requeue = true;
 
+	/*
+	 * In benchmark mode, only record the timings, to avoid perturbing the
+	 * measurements with console output.
+	 */
+	if (benchmark_) {
+		if (!firstTimestamp_) {
+			firstTimestamp_ = ts;
+			startLatency_ = std::chrono::steady_clock::now() - startTime_;
+		} else if (ts > last_) {
+			frameInterval_.record(std::chrono::nanoseconds(ts - last_));
+		}
+	}
+
+	last_ = ts;
+
 	std::stringstream info;
-	info << ts / 1000000000 << "."
-	     << std::setw(6) << std::setfill('0') << ts / 1000 % 1000000
-	     << " (" << std::fixed << std::setprecision(2) << fps << " fps)";
+	if (!benchmark_)
+		info << ts / 1000000000 << "."
+		     << std::setw(6) << std::setfill('0') << ts / 1000 % 1000000
+		     << " (" << std::fixed << std::setprecision(2) << fps << " fps)";
 
-	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+	for (auto it = buffers.begin(); it != buffers.end() && !benchmark_; ++it) {
 		const Stream *stream = it->first;
 		FrameBuffer *buffer = it->second;
 
@@ -386,7 +474,8 @@ void CameraSession::processRequest(Request *request)
 			requeue = false;
 	}
 
-	std::cout << info.str() << std::endl;
+	if (!benchmark_)
+		std::cout << info.str() << std::endl;
 
 	if (printMetadata_) {
 		const ControlList &requestMetadata = request->metadata();
@@ -399,7 +488,10 @@ void CameraSession::processRequest(Request *request)
 
 	captureCount_++;
 	if (captureLimit_ && captureCount_ >= captureLimit_) {
-		captureDone.emit();
+		if (threaded_)
+			EventLoop::instance()->callLater([this]() { captureDone.emit(); });
+		else
+			captureDone.emit();
 		return;
 	}
 
@@ -416,6 +508,142 @@ void CameraSession::processRequest(Request *request)
 
 void CameraSession::sinkRelease(Request *request)
 {
+	/*
+	 * Sinks may release requests from the main event loop, requeue them
+	 * from the worker thread that owns the session state.
+	 */
+	if (threaded_) {
+		dispatch([=]() {
+			request->reuse(Request::ReuseBuffers);
+			queueRequest(request);
+		});
+		return;
+	}
+
 	request->reuse(Request::ReuseBuffers);
 	queueRequest(request);
 }
+
+void CameraSession::dispatch(const std::function<void()> &func)
+{
+	if (!threaded_) {
+		EventLoop::instance()->callLater(func);
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> locker(workerLock_);
+		if (!workerRunning_)
+			return;
+
+		workQueue_.push_back(func);
+	}
+
+	workerCv_.notify_one();
+}
+
+void CameraSession::startWorker()
+{
+	if (!threaded_)
+		return;
+
+	workerRunning_ = true;
+	worker_ = std::thread(&CameraSession::runWorker, this);
+}
+
+void CameraSession::stopWorker()
+{
+	if (!worker_.joinable())
+		return;
+
+	{
+		std::unique_lock<std::mutex> locker(workerLock_);
+		workerRunning_ = false;
+		workQueue_.clear();
+	}
+
+	workerCv_.notify_one();
+	worker_.join();
+}
+
+void CameraSession::runWorker()
+{
+	std::unique_lock<std::mutex> locker(workerLock_);
+
+	while (true) {
+		workerCv_.wait(locker, [&]() {
+			return !workerRunning_ || !workQueue_.empty();
+		});
+
+		if (!workerRunning_)
+			break;
+
+		std::function<void()> func = std::move(workQueue_.front());
+		workQueue_.pop_front();
+
+		locker.unlock();
+		func();
+		locker.lock();
+	}
+}
+
+void CameraSession::printBenchmark() const
+{
+	const std::string prefix = "cam" + std::to_string(cameraIndex_) + ": ";
+	uint64_t frames = captureCount_;
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << prefix << "Benchmark: " << frames << " frames" << std::endl;
+
+	if (!frames)
+		return;
+
+	std::cout << prefix << "  start latency: " << toMs(startLatency_)
+		  << " ms" << std::endl;
+
+	/* The steady-state frame rate excludes the first frame. */
+	if (last_ > firstTimestamp_)
+		std::cout << prefix << "  frame rate: "
+			  << (frames - 1) * 1e9 / (last_ - firstTimestamp_)
+			  << " fps" << std::endl;
+
+	if (frameInterval_.count())
+		std::cout << prefix << "  frame interval: mean "
+			  << toMs(frameInterval_.mean()) << " ms, p50 "
+			  << toMs(frameInterval_.percentile(50)) << " ms, p99 "
+			  << toMs(frameInterval_.percentile(99)) << " ms, max "
+			  << toMs(frameInterval_.max()) << " ms" << std::endl;
+
+	double cpu = cpuTime() - cpuTimeStart_;
+	std::cout << prefix << "  CPU time: " << cpu * 1000.0 / frames
+		  << " ms per frame" << std::endl;
+
+	for (const StreamConfiguration &cfg : *config_) {
+		const Stream *stream = cfg.stream();
+		const StreamStats stats = camera_->streamStats(stream);
+		const std::string &name = streamName_.at(stream);
+
+		std::cout << prefix << "  " << name << ": " << stats.frames()
+			  << " frames, " << stats.dropped() << " dropped, "
+			  << stats.errors() << " errors" << std::endl;
+
+		const LatencyHistogram &jitter = stats.jitter();
+		if (jitter.count())
+			std::cout << prefix << "  " << name << ": jitter p50 "
+				  << toMs(jitter.percentile(50)) << " ms, p90 "
+				  << toMs(jitter.percentile(90)) << " ms, p99 "
+				  << toMs(jitter.percentile(99)) << " ms" << std::endl;
+	}
+
+	const RequestLatencyStats latency = camera_->latencyStats();
+	for (unsigned int i = 0; i < RequestLatencyStats::NumStages; ++i) {
+		const auto stage = static_cast<RequestLatencyStats::Stage>(i);
+		const LatencyHistogram &histogram = latency.histogram(stage);
+		if (!histogram.count())
+			continue;
+
+		std::cout << prefix << "  " << RequestLatencyStats::stageName(stage)
+			  << ": mean " << toMs(histogram.mean()) << " ms, p99 "
+			  << toMs(histogram.percentile(99)) << " ms" << std::endl;
+	}
+}
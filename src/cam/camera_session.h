@@ -7,9 +7,15 @@
 #ifndef __CAM_CAMERA_SESSION_H__
 #define __CAM_CAMERA_SESSION_H__
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <libcamera/base/signal.h>
@@ -18,6 +24,7 @@
 #include <libcamera/camera_manager.h>
 #include <libcamera/framebuffer.h>
 #include <libcamera/framebuffer_allocator.h>
+#include <libcamera/latency_stats.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
@@ -43,6 +50,8 @@ public:
 	void listProperties() const;
 	void infoConfiguration() const;
 
+	unsigned int captureCount() const { return captureCount_; }
+
 	int start();
 	void stop();
 
@@ -55,6 +64,12 @@ private:
 	void requestComplete(libcamera::Request *request);
 	void processRequest(libcamera::Request *request);
 	void sinkRelease(libcamera::Request *request);
+	void printBenchmark() const;
+
+	void dispatch(const std::function<void()> &func);
+	void startWorker();
+	void stopWorker();
+	void runWorker();
 
 	const OptionsParser::Options &options_;
 	std::shared_ptr<libcamera::Camera> camera_;
@@ -71,6 +86,22 @@ private:
 	unsigned int captureLimit_;
 	bool printMetadata_;
 
+	/* Benchmark mode state */
+	bool benchmark_;
+	std::chrono::steady_clock::time_point startTime_;
+	std::chrono::steady_clock::duration startLatency_;
+	uint64_t firstTimestamp_;
+	libcamera::LatencyHistogram frameInterval_;
+	double cpuTimeStart_;
+
+	/* Worker thread state, used when the session runs in its own thread */
+	bool threaded_;
+	std::thread worker_;
+	std::mutex workerLock_;
+	std::condition_variable workerCv_;
+	std::deque<std::function<void()>> workQueue_;
+	bool workerRunning_;
+
 	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
 	std::vector<std::unique_ptr<libcamera::Request>> requests_;
 };
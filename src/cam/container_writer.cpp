@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * container_writer.cpp - Chunked recording container writer
+ */
+
+#include "container_writer.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+
+using namespace libcamera;
+
+namespace {
+
+constexpr uint32_t kVersion = 1;
+constexpr size_t kAlignment = 8;
+
+/*
+ * Payloads smaller than the chunk size are accumulated with the record headers
+ * and written in one go, larger payloads are written directly from the frame
+ * buffer.
+ */
+constexpr size_t kChunkSize = 1 << 20;
+
+size_t alignUp(size_t size)
+{
+	return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+} /* namespace */
+
+ContainerWriter::ContainerWriter()
+	: fd_(-1), offset_(0)
+{
+	chunk_.reserve(kChunkSize);
+}
+
+ContainerWriter::~ContainerWriter()
+{
+	close();
+}
+
+void ContainerWriter::configure(const CameraConfiguration &config)
+{
+	streams_.clear();
+
+	for (const StreamConfiguration &cfg : config)
+		streams_.push_back({ cfg.pixelFormat.fourcc(),
+				     cfg.size.width, cfg.size.height,
+				     cfg.stride, cfg.frameSize,
+				     cfg.pixelFormat.modifier() });
+}
+
+int ContainerWriter::open(const std::string &filename)
+{
+	fd_ = ::open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+		     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (fd_ == -1) {
+		int ret = -errno;
+		std::cerr << "failed to open file " << filename << ": "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	offset_ = 0;
+	index_.clear();
+	chunk_.clear();
+
+	append("LCRF", 4);
+	append32(kVersion);
+	append32(streams_.size());
+	append32(0);
+
+	for (const StreamInfo &info : streams_) {
+		append32(info.fourcc);
+		append32(info.width);
+		append32(info.height);
+		append32(info.stride);
+		append32(info.frameSize);
+		append32(0);
+		append64(info.modifier);
+	}
+
+	return 0;
+}
+
+int ContainerWriter::close()
+{
+	if (fd_ == -1)
+		return 0;
+
+	uint64_t indexOffset = offset_;
+
+	append("INDX", 4);
+	append32(index_.size());
+
+	for (const IndexEntry &entry : index_) {
+		append64(entry.offset);
+		append32(entry.stream);
+		append32(entry.sequence);
+		append64(entry.timestamp);
+	}
+
+	append("LCRE", 4);
+	append32(0);
+	append64(indexOffset);
+
+	int ret = flush();
+
+	::close(fd_);
+	fd_ = -1;
+
+	return ret;
+}
+
+int ContainerWriter::write(unsigned int stream, const FrameBuffer *buffer,
+			   const std::vector<Span<const uint8_t>> &planes,
+			   const ControlList &metadata)
+{
+	if (fd_ == -1)
+		return -EBADF;
+
+	const FrameMetadata &frameMetadata = buffer->metadata();
+
+	size_t metadataSize = 0;
+	for (const auto &[id, value] : metadata)
+		metadataSize += 16 + alignUp(value.data().size());
+
+	size_t recordSize = 40 + alignUp(planes.size() * 4) + metadataSize;
+	for (const Span<const uint8_t> &plane : planes)
+		recordSize += alignUp(plane.size());
+
+	index_.push_back({ offset_, stream, frameMetadata.sequence,
+			   frameMetadata.timestamp });
+
+	append("FRME", 4);
+	append32(recordSize);
+	append32(stream);
+	append32(frameMetadata.sequence);
+	append64(frameMetadata.timestamp);
+	append32(frameMetadata.status);
+	append32(planes.size());
+	append32(metadataSize);
+	append32(0);
+
+	for (const Span<const uint8_t> &plane : planes)
+		append32(plane.size());
+	pad();
+
+	for (const auto &[id, value] : metadata) {
+		Span<const uint8_t> data = value.data();
+
+		append32(id);
+		append32(value.type());
+		append32(value.isArray() ? value.numElements() : 0);
+		append32(data.size());
+		append(data.data(), data.size());
+		pad();
+	}
+
+	for (const Span<const uint8_t> &plane : planes) {
+		int ret = append(plane.data(), plane.size());
+		if (ret < 0)
+			return ret;
+		pad();
+	}
+
+	return 0;
+}
+
+void ContainerWriter::append32(uint32_t value)
+{
+	value = htole32(value);
+	append(&value, sizeof(value));
+}
+
+void ContainerWriter::append64(uint64_t value)
+{
+	value = htole64(value);
+	append(&value, sizeof(value));
+}
+
+void ContainerWriter::pad()
+{
+	static const uint8_t zeros[kAlignment] = {};
+
+	append(zeros, alignUp(offset_) - offset_);
+}
+
+int ContainerWriter::append(const void *data, size_t size)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+	offset_ += size;
+
+	if (chunk_.size() + size <= kChunkSize) {
+		chunk_.insert(chunk_.end(), bytes, bytes + size);
+		return 0;
+	}
+
+	int ret = flush();
+	if (ret < 0)
+		return ret;
+
+	if (size < kChunkSize) {
+		chunk_.insert(chunk_.end(), bytes, bytes + size);
+		return 0;
+	}
+
+	while (size) {
+		ssize_t written = ::write(fd_, bytes, size);
+		if (written < 0) {
+			ret = -errno;
+			std::cerr << "write error: " << strerror(-ret)
+				  << std::endl;
+			return ret;
+		}
+
+		bytes += written;
+		size -= written;
+	}
+
+	return 0;
+}
+
+int ContainerWriter::flush()
+{
+	const uint8_t *bytes = chunk_.data();
+	size_t size = chunk_.size();
+	int ret = 0;
+
+	while (size) {
+		ssize_t written = ::write(fd_, bytes, size);
+		if (written < 0) {
+			ret = -errno;
+			std::cerr << "write error: " << strerror(-ret)
+				  << std::endl;
+			break;
+		}
+
+		bytes += written;
+		size -= written;
+	}
+
+	chunk_.clear();
+
+	return ret;
+}
@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * container_writer.h - Chunked recording container writer
+ */
+#ifndef __CAM_CONTAINER_WRITER_H__
+#define __CAM_CONTAINER_WRITER_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/controls.h>
+#include <libcamera/framebuffer.h>
+
+/*
+ * The container stores frames from all streams in a single file, with their
+ * sequence numbers, timestamps and request metadata. All integers are stored
+ * in little-endian order, and all records are aligned to 8 bytes.
+ *
+ * The file starts with a header:
+ *   char[4] magic "LCRF", u32 version, u32 number of streams, u32 reserved,
+ *   and for each stream: u32 fourcc, u32 width, u32 height, u32 stride,
+ *   u32 frame size, u32 reserved, u64 modifier
+ *
+ * Each frame is then stored in a record:
+ *   char[4] magic "FRME", u32 record size, including the payload and padding,
+ *   u32 stream index, u32 sequence, u64 timestamp, u32 status,
+ *   u32 number of planes, u32 metadata size, u32 reserved,
+ *   u32 bytes used for each plane, padded to 8 bytes,
+ *   the metadata, padded to 8 bytes, and the plane payloads, padded to 8
+ *   bytes
+ *
+ * The metadata is a sequence of controls, each stored as u32 id, u32 type,
+ * u32 number of elements (0 for non-array controls) and u32 data size,
+ * followed by the control data padded to 8 bytes.
+ *
+ * The file ends with an index of the frames, to seek without scanning all
+ * records:
+ *   char[4] magic "INDX", u32 number of frames, and for each frame:
+ *   u64 record offset, u32 stream index, u32 sequence, u64 timestamp
+ * followed by a trailer:
+ *   char[4] magic "LCRE", u32 reserved, u64 index offset
+ */
+class ContainerWriter
+{
+public:
+	ContainerWriter();
+	~ContainerWriter();
+
+	void configure(const libcamera::CameraConfiguration &config);
+
+	int open(const std::string &filename);
+	int close();
+
+	int write(unsigned int stream, const libcamera::FrameBuffer *buffer,
+		  const std::vector<libcamera::Span<const uint8_t>> &planes,
+		  const libcamera::ControlList &metadata);
+
+	uint64_t bytesWritten() const { return offset_; }
+
+private:
+	struct StreamInfo {
+		uint32_t fourcc;
+		uint32_t width;
+		uint32_t height;
+		uint32_t stride;
+		uint32_t frameSize;
+		uint64_t modifier;
+	};
+
+	struct IndexEntry {
+		uint64_t offset;
+		uint32_t stream;
+		uint32_t sequence;
+		uint64_t timestamp;
+	};
+
+	void append32(uint32_t value);
+	void append64(uint64_t value);
+	void pad();
+	int append(const void *data, size_t size);
+	int flush();
+
+	std::vector<StreamInfo> streams_;
+	std::vector<IndexEntry> index_;
+
+	/* Chunk buffer, to write the headers in large sequential writes */
+	std::vector<uint8_t> chunk_;
+
+	int fd_;
+	uint64_t offset_;
+};
+
+#endif /* __CAM_CONTAINER_WRITER_H__ */
@@ -11,22 +11,44 @@
 #include <event2/event.h>
 #include <event2/thread.h>
 #include <iostream>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 EventLoop *EventLoop::instance_ = nullptr;
 
 EventLoop::EventLoop()
+	: calls_(64), callsHead_(0), callsCount_(0), callEvent_(nullptr)
 {
 	assert(!instance_);
 
 	evthread_use_pthreads();
 	base_ = event_base_new();
 	instance_ = this;
+
+	callFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (callFd_ < 0) {
+		std::cerr << "Failed to create eventfd" << std::endl;
+		return;
+	}
+
+	callEvent_ = event_new(base_, callFd_, EV_READ | EV_PERSIST,
+			       &EventLoop::dispatchCallback, this);
+	if (callEvent_)
+		event_add(callEvent_, nullptr);
 }
 
 EventLoop::~EventLoop()
 {
 	instance_ = nullptr;
 
+	if (callEvent_) {
+		event_del(callEvent_);
+		event_free(callEvent_);
+	}
+	if (callFd_ >= 0)
+		close(callFd_);
+
 	events_.clear();
 	event_base_free(base_);
 	libevent_global_shutdown();
@@ -50,14 +72,38 @@ void EventLoop::exit(int code)
 	event_base_loopbreak(base_);
 }
 
-void EventLoop::callLater(const std::function<void()> &func)
+void EventLoop::callLater(std::function<void()> func)
 {
+	bool wakeup;
+
 	{
 		std::unique_lock<std::mutex> locker(lock_);
-		calls_.push_back(func);
+
+		if (callsCount_ == calls_.size()) {
+			/* Grow the ring, moving the pending calls to the front. */
+			std::vector<std::function<void()>> calls(calls_.size() * 2);
+			for (size_t i = 0; i < callsCount_; ++i)
+				calls[i] = std::move(calls_[(callsHead_ + i) % calls_.size()]);
+
+			calls_ = std::move(calls);
+			callsHead_ = 0;
+		}
+
+		calls_[(callsHead_ + callsCount_) % calls_.size()] = std::move(func);
+
+		/*
+		 * Only wake the loop up for the first pending call, the
+		 * following ones will be dispatched in the same batch.
+		 */
+		wakeup = callsCount_++ == 0;
 	}
 
-	event_base_once(base_, -1, EV_TIMEOUT, dispatchCallback, this, nullptr);
+	if (wakeup) {
+		uint64_t value = 1;
+		ssize_t ret = write(callFd_, &value, sizeof(value));
+		if (ret != sizeof(value))
+			std::cerr << "Failed to wake up event loop" << std::endl;
+	}
 }
 
 void EventLoop::addEvent(int fd, EventType type,
@@ -88,23 +134,34 @@ void EventLoop::dispatchCallback([[maybe_unused]] evutil_socket_t fd,
 				 [[maybe_unused]] short flags, void *param)
 {
 	EventLoop *loop = static_cast<EventLoop *>(param);
-	loop->dispatchCall();
+	loop->dispatchCalls();
 }
 
-void EventLoop::dispatchCall()
+void EventLoop::dispatchCalls()
 {
-	std::function<void()> call;
-
-	{
-		std::unique_lock<std::mutex> locker(lock_);
-		if (calls_.empty())
-			return;
-
-		call = calls_.front();
-		calls_.pop_front();
+	/* Clear the eventfd, a failure only means a concurrent read. */
+	uint64_t value;
+	[[maybe_unused]] ssize_t ret = read(callFd_, &value, sizeof(value));
+
+	/*
+	 * Dispatch all pending calls, including the ones queued by the calls
+	 * themselves. The lock is released while running each call.
+	 */
+	while (true) {
+		std::function<void()> call;
+
+		{
+			std::unique_lock<std::mutex> locker(lock_);
+			if (!callsCount_)
+				return;
+
+			call = std::move(calls_[callsHead_]);
+			callsHead_ = (callsHead_ + 1) % calls_.size();
+			callsCount_--;
+		}
+
+		call();
 	}
-
-	call();
 }
 
 EventLoop::Event::Event(const std::function<void()> &callback)
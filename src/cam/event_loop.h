@@ -11,6 +11,7 @@
 #include <memory>
 #include <list>
 #include <mutex>
+#include <vector>
 
 #include <event2/util.h>
 
@@ -32,7 +33,7 @@ public:
 	int exec();
 	void exit(int code = 0);
 
-	void callLater(const std::function<void()> &func);
+	void callLater(std::function<void()> func);
 
 	void addEvent(int fd, EventType type,
 		      const std::function<void()> &handler);
@@ -53,13 +54,22 @@ private:
 	struct event_base *base_;
 	int exitCode_;
 
-	std::list<std::function<void()>> calls_;
+	/*
+	 * Deferred calls are stored in a ring buffer, grown when full, and the
+	 * loop is woken up through an eventfd.
+	 */
+	std::vector<std::function<void()>> calls_;
+	size_t callsHead_;
+	size_t callsCount_;
+	int callFd_;
+	struct event *callEvent_;
+
 	std::list<std::unique_ptr<Event>> events_;
 	std::mutex lock_;
 
 	static void dispatchCallback(evutil_socket_t fd, short flags,
 				     void *param);
-	void dispatchCall();
+	void dispatchCalls();
 };
 
 #endif /* __CAM_EVENT_LOOP_H__ */
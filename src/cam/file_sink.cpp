@@ -8,24 +8,30 @@
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
-#include <sstream>
+#include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/request.h>
 
+#include "event_loop.h"
 #include "file_sink.h"
 
 using namespace libcamera;
 
 FileSink::FileSink(const std::string &pattern)
-	: pattern_(pattern)
+	: pattern_(pattern), idPos_(std::string::npos), fd_(-1),
+	  stopping_(false), bytesWritten_(0), framesWritten_(0),
+	  writeTime_(0)
 {
 }
 
 FileSink::~FileSink()
 {
+	stop();
+
 	for (auto &iter : mappedBuffers_) {
 		void *memory = iter.second.first;
 		unsigned int length = iter.second.second;
@@ -41,9 +47,33 @@ int FileSink::configure(const libcamera::CameraConfiguration &config)
 		return ret;
 
 	streamNames_.clear();
+	streamIndices_.clear();
 	for (unsigned int index = 0; index < config.size(); ++index) {
 		const StreamConfiguration &cfg = config.at(index);
 		streamNames_[cfg.stream()] = "stream" + std::to_string(index);
+		streamIndices_[cfg.stream()] = index;
+	}
+
+	/* Parse the pattern once, instead of for every frame. */
+	filename_ = pattern_;
+	if (filename_.empty() || filename_.back() == '/')
+		filename_ += "frame-#.bin";
+
+	idPos_ = filename_.find_first_of('#');
+	if (idPos_ != std::string::npos)
+		filename_.erase(idPos_, 1);
+
+	/*
+	 * Record all frames in a container when the file name has the .lcr
+	 * extension, to preserve their boundaries, timestamps and metadata.
+	 */
+	const std::string extension = ".lcr";
+	container_.reset();
+	if (idPos_ == std::string::npos && filename_.size() > extension.size() &&
+	    filename_.compare(filename_.size() - extension.size(),
+			      extension.size(), extension) == 0) {
+		container_ = std::make_unique<ContainerWriter>();
+		container_->configure(config);
 	}
 
 	return 0;
@@ -60,44 +90,181 @@ void FileSink::mapBuffer(FrameBuffer *buffer)
 	}
 }
 
+int FileSink::start()
+{
+	if (thread_.joinable())
+		return 0;
+
+	if (container_) {
+		int ret = container_->open(filename_);
+		if (ret < 0)
+			return ret;
+	}
+
+	stopping_ = false;
+	bytesWritten_ = 0;
+	framesWritten_ = 0;
+	writeTime_ = std::chrono::steady_clock::duration::zero();
+
+	thread_ = std::thread(&FileSink::run, this);
+
+	return 0;
+}
+
+int FileSink::stop()
+{
+	if (!thread_.joinable())
+		return 0;
+
+	/*
+	 * Let the writer thread complete the pending writes, the requests are
+	 * then released synchronously, without emitting requestProcessed.
+	 */
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		stopping_ = true;
+	}
+	cv_.notify_one();
+	thread_.join();
+
+	if (fd_ != -1) {
+		close(fd_);
+		fd_ = -1;
+	}
+
+	if (container_) {
+		container_->close();
+		bytesWritten_ = container_->bytesWritten();
+	}
+
+	double seconds = std::chrono::duration<double>(writeTime_).count();
+	double mib = bytesWritten_ / (1024.0 * 1024.0);
+
+	std::cout << "Wrote " << framesWritten_ << " frames, " << std::fixed
+		  << std::setprecision(1) << mib << " MiB in "
+		  << std::setprecision(2) << seconds << "s";
+	if (seconds > 0.0)
+		std::cout << " (" << std::setprecision(1) << mib / seconds
+			  << " MiB/s)";
+	std::cout << std::endl;
+
+	return 0;
+}
+
 bool FileSink::processRequest(Request *request)
 {
-	for (auto [stream, buffer] : request->buffers())
-		writeBuffer(stream, buffer);
+	/*
+	 * Hold the request until its buffers have been written by the writer
+	 * thread, to avoid blocking the event loop on file I/O.
+	 */
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		queue_.push_back(request);
+	}
+	cv_.notify_one();
 
-	return true;
+	return false;
 }
 
-void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer)
+void FileSink::run()
 {
-	std::string filename;
-	size_t pos;
-	int fd, ret = 0;
+	std::unique_lock<std::mutex> locker(mutex_);
 
-	if (!pattern_.empty())
-		filename = pattern_;
+	while (true) {
+		cv_.wait(locker, [&]() { return stopping_ || !queue_.empty(); });
+		if (queue_.empty())
+			break;
+
+		Request *request = queue_.front();
+		queue_.pop_front();
+
+		locker.unlock();
+
+		auto begin = std::chrono::steady_clock::now();
 
-	if (filename.empty() || filename.back() == '/')
-		filename += "frame-#.bin";
+		writeRequest(request);
 
-	pos = filename.find_first_of('#');
-	if (pos != std::string::npos) {
-		std::stringstream ss;
-		ss << streamNames_[stream] << "-" << std::setw(6)
-		   << std::setfill('0') << buffer->metadata().sequence;
-		filename.replace(pos, 1, ss.str());
+		writeTime_ += std::chrono::steady_clock::now() - begin;
+		framesWritten_++;
+
+		locker.lock();
+
+		/*
+		 * Release the request from the event loop, unless the sink is
+		 * being stopped.
+		 */
+		if (!stopping_)
+			EventLoop::instance()->callLater([this, request]() {
+				requestProcessed.emit(request);
+			});
 	}
+}
 
-	fd = open(filename.c_str(), O_CREAT | O_WRONLY |
-		  (pos == std::string::npos ? O_APPEND : O_TRUNC),
-		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-	if (fd == -1) {
-		ret = -errno;
-		std::cerr << "failed to open file " << filename << ": "
-			  << strerror(-ret) << std::endl;
+void FileSink::writeRequest(Request *request)
+{
+	if (!container_) {
+		for (auto [stream, buffer] : request->buffers())
+			writeBuffer(stream, buffer);
 		return;
 	}
 
+	for (auto [stream, buffer] : request->buffers()) {
+		std::vector<Span<const uint8_t>> planes;
+
+		for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
+			const FrameBuffer::Plane &plane = buffer->planes()[i];
+			const FrameMetadata::Plane &meta = buffer->metadata().planes[i];
+
+			const uint8_t *data = static_cast<const uint8_t *>(
+				mappedBuffers_[plane.fd.fd()].first);
+			unsigned int length = std::min(meta.bytesused, plane.length);
+
+			planes.emplace_back(data, length);
+		}
+
+		int ret = container_->write(streamIndices_[stream], buffer,
+					    planes, request->metadata());
+		if (ret < 0)
+			break;
+	}
+}
+
+void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer)
+{
+	int fd, ret = 0;
+
+	if (idPos_ != std::string::npos) {
+		std::string filename = filename_;
+		char sequence[16];
+
+		snprintf(sequence, sizeof(sequence), "-%06u",
+			 buffer->metadata().sequence);
+		filename.insert(idPos_, streamNames_[stream] + sequence);
+
+		fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+			  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		if (fd == -1) {
+			ret = -errno;
+			std::cerr << "failed to open file " << filename << ": "
+				  << strerror(-ret) << std::endl;
+			return;
+		}
+	} else {
+		/* Reuse the same file descriptor for all frames. */
+		if (fd_ == -1) {
+			fd_ = open(filename_.c_str(), O_CREAT | O_WRONLY | O_APPEND,
+				   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+			if (fd_ == -1) {
+				ret = -errno;
+				std::cerr << "failed to open file " << filename_
+					  << ": " << strerror(-ret) << std::endl;
+				return;
+			}
+		}
+
+		fd = fd_;
+	}
+
 	for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
 		const FrameBuffer::Plane &plane = buffer->planes()[i];
 		const FrameMetadata::Plane &meta = buffer->metadata().planes[i];
@@ -122,7 +289,10 @@ void FileSink::writeBuffer(const Stream *stream, FrameBuffer *buffer)
 				  << length << std::endl;
 			break;
 		}
+
+		bytesWritten_ += length;
 	}
 
-	close(fd);
+	if (fd != fd_)
+		close(fd);
 }
@@ -7,11 +7,19 @@
 #ifndef __CAM_FILE_SINK_H__
 #define __CAM_FILE_SINK_H__
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
 #include <string>
+#include <thread>
 
 #include <libcamera/stream.h>
 
+#include "container_writer.h"
 #include "frame_sink.h"
 
 class FileSink : public FrameSink
@@ -24,15 +32,45 @@ public:
 
 	void mapBuffer(libcamera::FrameBuffer *buffer) override;
 
+	int start() override;
+	int stop() override;
+
 	bool processRequest(libcamera::Request *request) override;
 
 private:
+	void run();
 	void writeBuffer(const libcamera::Stream *stream,
 			 libcamera::FrameBuffer *buffer);
+	void writeRequest(libcamera::Request *request);
 
 	std::map<const libcamera::Stream *, std::string> streamNames_;
 	std::string pattern_;
 	std::map<int, std::pair<void *, unsigned int>> mappedBuffers_;
+
+	/*
+	 * Filename prefix and suffix around the frame identifier, the
+	 * identifier position is npos if all frames are written to a single
+	 * file, kept open in fd_.
+	 */
+	std::string filename_;
+	size_t idPos_;
+	int fd_;
+
+	/* Container writer, when recording to a .lcr file */
+	std::unique_ptr<ContainerWriter> container_;
+	std::map<const libcamera::Stream *, unsigned int> streamIndices_;
+
+	/* Writer thread and queue of requests to be written */
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<libcamera::Request *> queue_;
+	bool stopping_;
+
+	/* Write statistics */
+	uint64_t bytesWritten_;
+	unsigned int framesWritten_;
+	std::chrono::steady_clock::duration writeTime_;
 };
 
 #endif /* __CAM_FILE_SINK_H__ */
@@ -20,8 +20,9 @@
 
 #include "drm.h"
 
-KMSSink::KMSSink(const std::string &connectorName)
-	: connector_(nullptr), crtc_(nullptr), plane_(nullptr), mode_(nullptr)
+KMSSink::KMSSink(const std::string &connectorName, unsigned int queueDepth)
+	: connector_(nullptr), crtc_(nullptr), plane_(nullptr), mode_(nullptr),
+	  queueDepth_(std::max(queueDepth, 1U))
 {
 	int ret = dev_.init();
 	if (ret < 0)
@@ -70,9 +71,15 @@ void KMSSink::mapBuffer(libcamera::FrameBuffer *buffer)
 	if (!drmBuffer)
 		return;
 
-	buffers_.emplace(std::piecewise_construct,
-			 std::forward_as_tuple(buffer),
-			 std::forward_as_tuple(std::move(drmBuffer)));
+	/*
+	 * Prepare the atomic request that displays the buffer once, and
+	 * commit it for every frame.
+	 */
+	std::unique_ptr<DRM::AtomicRequest> flipRequest =
+		std::make_unique<DRM::AtomicRequest>(&dev_);
+	flipRequest->addProperty(plane_, "FB_ID", drmBuffer->id());
+
+	buffers_[buffer] = { std::move(drmBuffer), std::move(flipRequest) };
 }
 
 int KMSSink::configure(const libcamera::CameraConfiguration &config)
@@ -218,7 +225,7 @@ int KMSSink::stop()
 	}
 
 	/* Free all buffers. */
-	pending_.reset();
+	pending_.clear();
 	queued_.reset();
 	active_.reset();
 	buffers_.clear();
@@ -228,26 +235,23 @@ int KMSSink::stop()
 
 bool KMSSink::processRequest(libcamera::Request *camRequest)
 {
-	/*
-	 * Perform a very crude rate adaptation by simply dropping the request
-	 * if the display queue is full.
-	 */
-	if (pending_)
-		return true;
-
 	libcamera::FrameBuffer *buffer = camRequest->buffers().begin()->second;
 	auto iter = buffers_.find(buffer);
 	if (iter == buffers_.end())
 		return true;
 
-	DRM::FrameBuffer *drmBuffer = iter->second.get();
+	const Buffer &drmBuffer = iter->second;
+	std::unique_ptr<Request> request;
+	std::unique_ptr<Request> dropped;
 
-	unsigned int flags = DRM::AtomicRequest::FlagAsync;
-	DRM::AtomicRequest *drmRequest = new DRM::AtomicRequest(&dev_);
-	drmRequest->addProperty(plane_, "FB_ID", drmBuffer->id());
+	std::unique_lock<std::mutex> lock(lock_);
 
-	if (!active_ && !queued_) {
+	if (!active_ && !queued_ && pending_.empty()) {
 		/* Enable the display pipeline on the first frame. */
+		auto drmRequest = std::make_unique<DRM::AtomicRequest>(&dev_);
+
+		drmRequest->addProperty(plane_, "FB_ID", drmBuffer.drmBuffer->id());
+
 		drmRequest->addProperty(connector_, "CRTC_ID", crtc_->id());
 
 		drmRequest->addProperty(crtc_, "ACTIVE", 1);
@@ -263,15 +267,22 @@ bool KMSSink::processRequest(libcamera::Request *camRequest)
 		drmRequest->addProperty(plane_, "CRTC_W", mode_->hdisplay);
 		drmRequest->addProperty(plane_, "CRTC_H", mode_->vdisplay);
 
-		flags |= DRM::AtomicRequest::FlagAllowModeset;
+		request = std::make_unique<Request>(std::move(drmRequest), camRequest);
+		request->flags_ |= DRM::AtomicRequest::FlagAllowModeset;
+	} else {
+		request = std::make_unique<Request>(drmBuffer.flipRequest.get(),
+						    camRequest);
 	}
 
-	pending_ = std::make_unique<Request>(drmRequest, camRequest);
-
-	std::lock_guard<std::mutex> lock(lock_);
-
+	/*
+	 * Commits are paced by the page flip events, a single request is
+	 * queued to the device at a time and the next one is committed when
+	 * the previous one completes. When the queue of pending requests is
+	 * full, drop the oldest one to display the most recent frames with
+	 * the lowest latency.
+	 */
 	if (!queued_) {
-		int ret = drmRequest->commit(flags);
+		int ret = request->drmRequest_->commit(request->flags_);
 		if (ret < 0) {
 			std::cerr
 				<< "Failed to commit atomic request: "
@@ -279,9 +290,21 @@ bool KMSSink::processRequest(libcamera::Request *camRequest)
 			/* \todo Implement error handling */
 		}
 
-		queued_ = std::move(pending_);
+		queued_ = std::move(request);
+	} else {
+		if (pending_.size() >= queueDepth_) {
+			dropped = std::move(pending_.front());
+			pending_.pop_front();
+		}
+
+		pending_.push_back(std::move(request));
 	}
 
+	lock.unlock();
+
+	if (dropped)
+		requestProcessed.emit(dropped->camRequest_);
+
 	return false;
 }
 
@@ -289,7 +312,7 @@ void KMSSink::requestComplete(DRM::AtomicRequest *request)
 {
 	std::lock_guard<std::mutex> lock(lock_);
 
-	assert(queued_ && queued_->drmRequest_.get() == request);
+	assert(queued_ && queued_->drmRequest_ == request);
 
 	/* Complete the active request, if any. */
 	if (active_)
@@ -298,9 +321,10 @@ void KMSSink::requestComplete(DRM::AtomicRequest *request)
 	/* The queued request becomes active. */
 	active_ = std::move(queued_);
 
-	/* Queue the pending request, if any. */
-	if (pending_) {
-		pending_->drmRequest_->commit(DRM::AtomicRequest::FlagAsync);
-		queued_ = std::move(pending_);
+	/* Queue the oldest pending request, if any. */
+	if (!pending_.empty()) {
+		queued_ = std::move(pending_.front());
+		pending_.pop_front();
+		queued_->drmRequest_->commit(queued_->flags_);
 	}
 }
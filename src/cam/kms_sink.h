@@ -7,6 +7,7 @@
 #ifndef __CAM_KMS_SINK_H__
 #define __CAM_KMS_SINK_H__
 
+#include <deque>
 #include <list>
 #include <memory>
 #include <mutex>
@@ -24,7 +25,7 @@
 class KMSSink : public FrameSink
 {
 public:
-	KMSSink(const std::string &connectorName);
+	KMSSink(const std::string &connectorName, unsigned int queueDepth = 1);
 
 	void mapBuffer(libcamera::FrameBuffer *buffer) override;
 
@@ -43,8 +44,23 @@ private:
 		{
 		}
 
-		std::unique_ptr<DRM::AtomicRequest> drmRequest_;
+		Request(std::unique_ptr<DRM::AtomicRequest> drmRequest,
+			libcamera::Request *camRequest)
+			: modesetRequest_(std::move(drmRequest)),
+			  drmRequest_(modesetRequest_.get()), camRequest_(camRequest)
+		{
+		}
+
+		std::unique_ptr<DRM::AtomicRequest> modesetRequest_;
+		DRM::AtomicRequest *drmRequest_;
 		libcamera::Request *camRequest_;
+		unsigned int flags_ = DRM::AtomicRequest::FlagAsync;
+	};
+
+	struct Buffer {
+		std::unique_ptr<DRM::FrameBuffer> drmBuffer;
+		/* Atomic request flipping to the buffer, reused for all frames */
+		std::unique_ptr<DRM::AtomicRequest> flipRequest;
 	};
 
 	int configurePipeline(const libcamera::PixelFormat &format);
@@ -61,10 +77,12 @@ private:
 	libcamera::Size size_;
 	unsigned int stride_;
 
-	std::map<libcamera::FrameBuffer *, std::unique_ptr<DRM::FrameBuffer>> buffers_;
+	std::map<libcamera::FrameBuffer *, Buffer> buffers_;
+
+	unsigned int queueDepth_;
 
 	std::mutex lock_;
-	std::unique_ptr<Request> pending_;
+	std::deque<std::unique_ptr<Request>> pending_;
 	std::unique_ptr<Request> queued_;
 	std::unique_ptr<Request> active_;
 };
@@ -6,6 +6,7 @@
  */
 
 #include <atomic>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
 #include <signal.h>
@@ -137,6 +138,11 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "Display viewfinder through DRM/KMS on specified connector",
 			 "display", ArgumentOptional, "connector", false,
 			 OptCamera);
+	parser.addOption(OptDisplayQueue, OptionInteger,
+			 "Set the number of frames queued for display (default: 1)\n"
+			 "The oldest queued frame is dropped when the queue is full",
+			 "display-queue", ArgumentRequired, "depth", false,
+			 OptCamera);
 #endif
 	parser.addOption(OptFile, OptionString,
 			 "Write captured frames to disk\n"
@@ -144,7 +150,9 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "to write files, using the default file name. Otherwise it sets the\n"
 			 "full file path and name. The first '#' character in the file name\n"
 			 "is expanded to the camera index, stream name and frame sequence number.\n"
-			 "The default file name is 'frame-#.bin'.",
+			 "The default file name is 'frame-#.bin'. If the file name has no\n"
+			 "'#' and ends with '.lcr', all frames are recorded in a single\n"
+			 "container file along with their timestamps and metadata.",
 			 "file", ArgumentOptional, "filename", false,
 			 OptCamera);
 	parser.addOption(OptStream, &streamKeyValue,
@@ -158,6 +166,16 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "Print the metadata for completed requests",
 			 "metadata", ArgumentNone, nullptr, false,
 			 OptCamera);
+	parser.addOption(OptBenchmark, OptionNone,
+			 "Suppress the per-frame output and print performance statistics\n"
+			 "when the capture stops",
+			 "benchmark", ArgumentNone, nullptr, false,
+			 OptCamera);
+	parser.addOption(OptThread, OptionNone,
+			 "Process completed requests and frame sinks in a dedicated thread\n"
+			 "for the camera instead of the main event loop",
+			 "thread", ArgumentNone, nullptr, false,
+			 OptCamera);
 
 	options_ = parser.parse(argc, argv);
 	if (!options_.valid())
@@ -244,6 +262,9 @@ int CamApp::run()
 	}
 
 	/* 4. Start capture. */
+	unsigned int capturing = 0;
+	auto startTime = std::chrono::steady_clock::now();
+
 	for (const auto &session : sessions) {
 		if (!session->options().isSet(OptCapture))
 			continue;
@@ -255,6 +276,7 @@ int CamApp::run()
 		}
 
 		loopUsers_++;
+		capturing++;
 	}
 
 	/* 5. Enable hotplug monitoring. */
@@ -272,11 +294,24 @@ int CamApp::run()
 		loop_.exec();
 
 	/* 6. Stop capture. */
+	auto elapsed = std::chrono::steady_clock::now() - startTime;
+	uint64_t frames = 0;
+
 	for (const auto &session : sessions) {
 		if (!session->options().isSet(OptCapture))
 			continue;
 
 		session->stop();
+		frames += session->captureCount();
+	}
+
+	/* Report the aggregate throughput when capturing from multiple cameras. */
+	if (capturing > 1) {
+		double seconds = std::chrono::duration<double>(elapsed).count();
+		std::cout << "Captured " << frames << " frames from " << capturing
+			  << " cameras in " << std::fixed << std::setprecision(2)
+			  << seconds << " s (" << (seconds ? frames / seconds : 0.0)
+			  << " fps)" << std::endl;
 	}
 
 	return 0;
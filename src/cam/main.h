@@ -21,6 +21,9 @@ enum {
 	OptListControls = 256,
 	OptStrictFormats = 257,
 	OptMetadata = 258,
+	OptDisplayQueue = 259,
+	OptBenchmark = 260,
+	OptThread = 261,
 };
 
 #endif /* __CAM_MAIN_H__ */
@@ -178,3 +178,32 @@ gst_libcamera_resume_task(GstTask *task)
 		GST_TASK_SIGNAL(task);
 	}
 }
+
+G_LOCK_DEFINE_STATIC(cm_singleton_lock);
+static std::weak_ptr<CameraManager> cm_singleton_ptr;
+
+/*
+ * libcamera supports a single CameraManager per process. Share a started
+ * instance between the device provider and all the sources, and destroy it
+ * when the last user releases it.
+ */
+std::shared_ptr<CameraManager>
+gst_libcamera_get_camera_manager(int &ret)
+{
+	std::shared_ptr<CameraManager> cm;
+
+	G_LOCK(cm_singleton_lock);
+
+	cm = cm_singleton_ptr.lock();
+	if (!cm) {
+		cm = std::make_shared<CameraManager>();
+		cm_singleton_ptr = cm;
+		ret = cm->start();
+	} else {
+		ret = 0;
+	}
+
+	G_UNLOCK(cm_singleton_lock);
+
+	return cm;
+}
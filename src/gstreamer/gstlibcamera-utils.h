@@ -12,6 +12,9 @@
 #include <gst/gst.h>
 #include <gst/video/video.h>
 
+#include <memory>
+
+#include <libcamera/camera_manager.h>
 #include <libcamera/stream.h>
 
 GstCaps *gst_libcamera_stream_formats_to_caps(const libcamera::StreamFormats &formats);
@@ -19,6 +22,7 @@ GstCaps *gst_libcamera_stream_configuration_to_caps(const libcamera::StreamConfi
 void gst_libcamera_configure_stream_from_caps(libcamera::StreamConfiguration &stream_cfg,
 					      GstCaps *caps);
 void gst_libcamera_resume_task(GstTask *task);
+std::shared_ptr<libcamera::CameraManager> gst_libcamera_get_camera_manager(int &ret);
 
 /**
  * \class GLibLocker
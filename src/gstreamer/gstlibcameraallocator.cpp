@@ -26,11 +26,17 @@ static gboolean gst_libcamera_allocator_release(GstMiniObject *mini_object);
  * This wrapper maintains a count of the outstanding GstMemory (there may be
  * multiple GstMemory per FrameBuffer), and give back the FrameBuffer to the
  * allocator pool when all memory objects have returned.
+ *
+ * The FrameBuffer is either allocated by the FrameBufferAllocator, or
+ * imported from a GstBuffer acquired from a downstream buffer pool, in which
+ * case the FrameWrap owns both the FrameBuffer and the GstBuffer.
  */
 
 struct FrameWrap {
 	FrameWrap(GstAllocator *allocator, FrameBuffer *buffer,
 		  gpointer stream);
+	FrameWrap(GstAllocator *allocator, std::unique_ptr<FrameBuffer> buffer,
+		  GstBuffer *imported, gpointer stream);
 	~FrameWrap();
 
 	void acquirePlane() { ++outstandingPlanes_; }
@@ -42,6 +48,9 @@ struct FrameWrap {
 	FrameBuffer *buffer_;
 	std::vector<GstMemory *> planes_;
 	gint outstandingPlanes_;
+
+	std::unique_ptr<FrameBuffer> importedFrameBuffer_;
+	GstBuffer *imported_;
 };
 
 FrameWrap::FrameWrap(GstAllocator *allocator, FrameBuffer *buffer,
@@ -49,7 +58,8 @@ FrameWrap::FrameWrap(GstAllocator *allocator, FrameBuffer *buffer,
 
 	: stream_(stream),
 	  buffer_(buffer),
-	  outstandingPlanes_(0)
+	  outstandingPlanes_(0),
+	  imported_(nullptr)
 {
 	for (const FrameBuffer::Plane &plane : buffer->planes()) {
 		GstMemory *mem = gst_fd_allocator_alloc(allocator, plane.fd.fd(), plane.length,
@@ -61,6 +71,14 @@ FrameWrap::FrameWrap(GstAllocator *allocator, FrameBuffer *buffer,
 	}
 }
 
+FrameWrap::FrameWrap(GstAllocator *allocator, std::unique_ptr<FrameBuffer> buffer,
+		     GstBuffer *imported, gpointer stream)
+	: FrameWrap(allocator, buffer.get(), stream)
+{
+	importedFrameBuffer_ = std::move(buffer);
+	imported_ = imported;
+}
+
 FrameWrap::~FrameWrap()
 {
 	for (GstMemory *mem : planes_) {
@@ -68,6 +86,10 @@ FrameWrap::~FrameWrap()
 		g_object_ref(mem->allocator);
 		gst_memory_unref(mem);
 	}
+
+	/* Give the imported buffer back to its pool. */
+	if (imported_)
+		gst_buffer_unref(imported_);
 }
 
 GQuark FrameWrap::getQuark()
@@ -98,6 +120,8 @@ struct _GstLibcameraAllocator {
 	 * FrameWrap.
 	 */
 	GHashTable *pools;
+	/* The downstream buffer pools the frames have been imported from. */
+	GPtrArray *import_pools;
 };
 
 G_DEFINE_TYPE(GstLibcameraAllocator, gst_libcamera_allocator,
@@ -140,11 +164,21 @@ gst_libcamera_allocator_free_pool(gpointer data)
 	g_queue_free(queue);
 }
 
+static void
+gst_libcamera_allocator_free_import_pool(gpointer data)
+{
+	GstBufferPool *pool = GST_BUFFER_POOL(data);
+
+	gst_buffer_pool_set_active(pool, FALSE);
+	gst_object_unref(pool);
+}
+
 static void
 gst_libcamera_allocator_init(GstLibcameraAllocator *self)
 {
 	self->pools = g_hash_table_new_full(nullptr, nullptr, nullptr,
 					    gst_libcamera_allocator_free_pool);
+	self->import_pools = g_ptr_array_new_with_free_func(gst_libcamera_allocator_free_import_pool);
 	GST_OBJECT_FLAG_SET(self, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
 }
 
@@ -158,6 +192,12 @@ gst_libcamera_allocator_dispose(GObject *object)
 		self->pools = nullptr;
 	}
 
+	/* Deactivate the import pools after all their buffers are returned. */
+	if (self->import_pools) {
+		g_ptr_array_unref(self->import_pools);
+		self->import_pools = nullptr;
+	}
+
 	G_OBJECT_CLASS(gst_libcamera_allocator_parent_class)->dispose(object);
 }
 
@@ -182,18 +222,137 @@ gst_libcamera_allocator_class_init(GstLibcameraAllocatorClass *klass)
 	allocator_class->alloc = nullptr;
 }
 
+/*
+ * Wrap the dmabufs of a GstBuffer in a FrameBuffer, with one plane per
+ * memory. The buffer is rejected if its layout doesn't match the one expected
+ * by libcamera for the stream.
+ */
+static std::unique_ptr<FrameBuffer>
+gst_libcamera_allocator_wrap_buffer(GstBuffer *buffer,
+				    const StreamConfiguration &stream_cfg)
+{
+	std::vector<FrameBuffer::Plane> planes;
+	gsize size = 0;
+
+	for (guint i = 0; i < gst_buffer_n_memory(buffer); i++) {
+		GstMemory *mem = gst_buffer_peek_memory(buffer, i);
+
+		/* FrameBuffer planes can't start at an offset in the dmabuf. */
+		if (!gst_is_dmabuf_memory(mem) || mem->offset)
+			return nullptr;
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(gst_dmabuf_memory_get_fd(mem));
+		if (!plane.fd.isValid())
+			return nullptr;
+
+		plane.length = mem->size;
+		size += mem->size;
+		planes.push_back(std::move(plane));
+	}
+
+	if (planes.empty() || size < stream_cfg.frameSize)
+		return nullptr;
+
+	/*
+	 * Buffers without a video meta use the default GStreamer layout, check
+	 * the stride against it in that case.
+	 */
+	gint stride;
+	GstVideoMeta *meta = gst_buffer_get_video_meta(buffer);
+	if (meta) {
+		stride = meta->stride[0];
+	} else {
+		g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
+		GstVideoInfo info;
+
+		if (!gst_video_info_from_caps(&info, caps))
+			return std::make_unique<FrameBuffer>(std::move(planes));
+
+		stride = GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+	}
+
+	if (stream_cfg.stride && static_cast<guint>(stride) != stream_cfg.stride)
+		return nullptr;
+
+	return std::make_unique<FrameBuffer>(std::move(planes));
+}
+
+/*
+ * Acquire bufferCount buffers from a downstream pool and import them for the
+ * stream, for the camera to capture directly to memory allocated by
+ * downstream, avoiding a copy when it has specific requirements (scanout,
+ * encoder alignment, ...). The buffers are held for the lifetime of the
+ * allocator.
+ */
+static GQueue *
+gst_libcamera_allocator_import(GstLibcameraAllocator *self,
+			       const StreamConfiguration &stream_cfg,
+			       GstBufferPool *import_pool)
+{
+	GQueue *pool = g_queue_new();
+
+	for (unsigned int i = 0; i < stream_cfg.bufferCount; i++) {
+		GstBuffer *buffer;
+
+		if (gst_buffer_pool_acquire_buffer(import_pool, &buffer,
+						   nullptr) != GST_FLOW_OK)
+			break;
+
+		std::unique_ptr<FrameBuffer> fb =
+			gst_libcamera_allocator_wrap_buffer(buffer, stream_cfg);
+		if (!fb) {
+			gst_buffer_unref(buffer);
+			break;
+		}
+
+		auto *frame = new FrameWrap(GST_ALLOCATOR(self), std::move(fb),
+					    buffer, stream_cfg.stream());
+		g_queue_push_tail(pool, frame);
+	}
+
+	if (pool->length != stream_cfg.bufferCount) {
+		gst_libcamera_allocator_free_pool(pool);
+		return nullptr;
+	}
+
+	return pool;
+}
+
 GstLibcameraAllocator *
 gst_libcamera_allocator_new(std::shared_ptr<Camera> camera,
-			    CameraConfiguration *config_)
+			    CameraConfiguration *config_,
+			    const std::map<Stream *, GstBufferPool *> &import_pools)
 {
 	auto *self = GST_LIBCAMERA_ALLOCATOR(g_object_new(GST_TYPE_LIBCAMERA_ALLOCATOR,
 							  nullptr));
 
+	/* Take ownership of the import pools. */
+	for (const auto &[stream, pool] : import_pools)
+		g_ptr_array_add(self->import_pools, pool);
+
 	self->fb_allocator = new FrameBufferAllocator(camera);
 	for (StreamConfiguration &streamCfg : *config_) {
 		Stream *stream = streamCfg.stream();
 		gint ret;
 
+		auto iter = import_pools.find(stream);
+		if (iter != import_pools.end()) {
+			GQueue *pool = gst_libcamera_allocator_import(self, streamCfg,
+								      iter->second);
+			if (pool) {
+				g_hash_table_insert(self->pools, stream, pool);
+				continue;
+			}
+
+			GST_WARNING_OBJECT(self, "Failed to import downstream buffers, "
+					   "allocating buffers for stream %s",
+					   streamCfg.toString().c_str());
+
+			/* Deactivate and release the pool. */
+			g_ptr_array_remove(self->import_pools, iter->second);
+		}
+
 		ret = self->fb_allocator->allocate(stream);
 		if (ret == 0)
 			return nullptr;
@@ -9,6 +9,8 @@
 #ifndef __GST_LIBCAMERA_ALLOCATOR_H__
 #define __GST_LIBCAMERA_ALLOCATOR_H__
 
+#include <map>
+
 #include <gst/gst.h>
 #include <gst/allocators/allocators.h>
 
@@ -19,8 +21,14 @@
 G_DECLARE_FINAL_TYPE(GstLibcameraAllocator, gst_libcamera_allocator,
 		     GST_LIBCAMERA, ALLOCATOR, GstDmaBufAllocator)
 
+/*
+ * The allocator takes ownership of the active downstream pools in
+ * import_pools, and imports the buffers of the corresponding streams from
+ * them instead of allocating buffers.
+ */
 GstLibcameraAllocator *gst_libcamera_allocator_new(std::shared_ptr<libcamera::Camera> camera,
-						   libcamera::CameraConfiguration *config_);
+						   libcamera::CameraConfiguration *config_,
+						   const std::map<libcamera::Stream *, GstBufferPool *> &import_pools = {});
 
 bool gst_libcamera_allocator_prepare_buffer(GstLibcameraAllocator *self,
 					    libcamera::Stream *stream,
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gstlibcamerameta.cpp - GStreamer libcamera Request Metadata
+ */
+
+#include "gstlibcamerameta.h"
+
+#include <new>
+
+using namespace libcamera;
+
+GType
+gst_libcamera_meta_api_get_type()
+{
+	static gsize type = 0;
+	static const gchar *tags[] = { nullptr };
+
+	if (g_once_init_enter(&type)) {
+		GType api = gst_meta_api_type_register("GstLibcameraMetaAPI", tags);
+		g_once_init_leave(&type, api);
+	}
+
+	return type;
+}
+
+static gboolean
+gst_libcamera_meta_init(GstMeta *meta, [[maybe_unused]] gpointer params,
+			[[maybe_unused]] GstBuffer *buffer)
+{
+	auto *self = reinterpret_cast<GstLibcameraMeta *>(meta);
+
+	/* The meta is allocated by GStreamer, construct the C++ members. */
+	new (&self->metadata) std::shared_ptr<const ControlList>();
+
+	return TRUE;
+}
+
+static void
+gst_libcamera_meta_free(GstMeta *meta, [[maybe_unused]] GstBuffer *buffer)
+{
+	auto *self = reinterpret_cast<GstLibcameraMeta *>(meta);
+
+	self->metadata.~shared_ptr();
+}
+
+static gboolean
+gst_libcamera_meta_transform(GstBuffer *dest, GstMeta *meta,
+			     [[maybe_unused]] GstBuffer *buffer, GQuark type,
+			     [[maybe_unused]] gpointer data)
+{
+	auto *self = reinterpret_cast<GstLibcameraMeta *>(meta);
+
+	/* The metadata applies to the frame regardless of its memory. */
+	if (!GST_META_TRANSFORM_IS_COPY(type))
+		return FALSE;
+
+	return gst_buffer_add_libcamera_meta(dest, self->metadata) != nullptr;
+}
+
+const GstMetaInfo *
+gst_libcamera_meta_get_info()
+{
+	static const GstMetaInfo *meta_info = nullptr;
+
+	if (g_once_init_enter(const_cast<GstMetaInfo **>(&meta_info))) {
+		const GstMetaInfo *info =
+			gst_meta_register(GST_LIBCAMERA_META_API_TYPE, "GstLibcameraMeta",
+					  sizeof(GstLibcameraMeta),
+					  gst_libcamera_meta_init,
+					  gst_libcamera_meta_free,
+					  gst_libcamera_meta_transform);
+		g_once_init_leave(const_cast<GstMetaInfo **>(&meta_info),
+				  const_cast<GstMetaInfo *>(info));
+	}
+
+	return meta_info;
+}
+
+GstLibcameraMeta *
+gst_buffer_add_libcamera_meta(GstBuffer *buffer,
+			      std::shared_ptr<const ControlList> metadata)
+{
+	auto *meta = reinterpret_cast<GstLibcameraMeta *>(
+		gst_buffer_add_meta(buffer, GST_LIBCAMERA_META_INFO, nullptr));
+	if (!meta)
+		return nullptr;
+
+	meta->metadata = std::move(metadata);
+
+	return meta;
+}
+
+GstLibcameraMeta *
+gst_buffer_get_libcamera_meta(GstBuffer *buffer)
+{
+	return reinterpret_cast<GstLibcameraMeta *>(
+		gst_buffer_get_meta(buffer, GST_LIBCAMERA_META_API_TYPE));
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gstlibcamerameta.h - GStreamer libcamera Request Metadata
+ */
+
+#ifndef __GST_LIBCAMERA_META_H__
+#define __GST_LIBCAMERA_META_H__
+
+#include <memory>
+
+#include <gst/gst.h>
+
+#include <libcamera/controls.h>
+
+/**
+ * \struct GstLibcameraMeta
+ * \brief A GstMeta carrying the metadata of the request a buffer belongs to
+ *
+ * The meta holds a shared reference to the immutable metadata of the completed
+ * request, as returned by libcamera::Request::sharedMetadata(). It is shared,
+ * not copied, when the buffer is copied.
+ */
+struct GstLibcameraMeta {
+	GstMeta meta;
+	std::shared_ptr<const libcamera::ControlList> metadata;
+};
+
+GType gst_libcamera_meta_api_get_type();
+#define GST_LIBCAMERA_META_API_TYPE (gst_libcamera_meta_api_get_type())
+
+const GstMetaInfo *gst_libcamera_meta_get_info();
+#define GST_LIBCAMERA_META_INFO (gst_libcamera_meta_get_info())
+
+GstLibcameraMeta *gst_buffer_add_libcamera_meta(GstBuffer *buffer,
+						std::shared_ptr<const libcamera::ControlList> metadata);
+
+GstLibcameraMeta *gst_buffer_get_libcamera_meta(GstBuffer *buffer);
+
+#endif /* __GST_LIBCAMERA_META_H__ */
@@ -20,6 +20,9 @@ struct _GstLibcameraPad {
 	GstLibcameraPool *pool;
 	GQueue pending_buffers;
 	GstClockTime latency;
+	/* Flow return of the last push, and task to notify of failures. */
+	GstFlowReturn flow_ret;
+	GstTask *src_task;
 };
 
 enum {
@@ -81,6 +84,7 @@ static void
 gst_libcamera_pad_init(GstLibcameraPad *self)
 {
 	GST_PAD_QUERYFUNC(self) = gst_libcamera_pad_query;
+	self->flow_ret = GST_FLOW_OK;
 }
 
 static GType
@@ -161,32 +165,103 @@ gst_libcamera_pad_queue_buffer(GstPad *pad, GstBuffer *buffer)
 	auto *self = GST_LIBCAMERA_PAD(pad);
 	GLibLocker lock(GST_OBJECT(self));
 
+	/* Drop the buffers once downstream has stopped accepting them. */
+	if (self->flow_ret != GST_FLOW_OK && self->flow_ret != GST_FLOW_NOT_LINKED) {
+		gst_buffer_unref(buffer);
+		return;
+	}
+
 	g_queue_push_head(&self->pending_buffers, buffer);
+
+	if (GST_PAD_TASK(pad))
+		gst_libcamera_resume_task(GST_PAD_TASK(pad));
 }
 
-GstFlowReturn
-gst_libcamera_pad_push_pending(GstPad *pad)
+/*
+ * Each pad pushes its buffers from its own task, for a slow downstream branch
+ * not to delay the other streams. The task pauses when it runs out of buffers,
+ * and is resumed when a buffer is queued.
+ */
+static void
+gst_libcamera_pad_push_loop(gpointer user_data)
 {
+	GstPad *pad = GST_PAD(user_data);
 	auto *self = GST_LIBCAMERA_PAD(pad);
 	GstBuffer *buffer;
 
 	{
 		GLibLocker lock(GST_OBJECT(self));
 		buffer = GST_BUFFER(g_queue_pop_tail(&self->pending_buffers));
+		if (!buffer) {
+			gst_task_pause(GST_PAD_TASK(pad));
+			return;
+		}
 	}
 
-	if (!buffer)
-		return GST_FLOW_OK;
+	GstFlowReturn ret = gst_pad_push(pad, buffer);
+
+	/* Buffers pushed to unlinked pads are dropped, keep streaming. */
+	if (ret == GST_FLOW_OK || ret == GST_FLOW_NOT_LINKED) {
+		GLibLocker lock(GST_OBJECT(self));
+		self->flow_ret = ret;
+		return;
+	}
 
-	return gst_pad_push(pad, buffer);
+	if (ret == GST_FLOW_EOS) {
+		/* Serialize the EOS event after the buffers of the pad. */
+		g_autoptr(GstEvent) eos = gst_event_new_eos();
+		gst_event_set_seqnum(eos, gst_util_seqnum_next());
+		gst_pad_push_event(pad, gst_event_ref(eos));
+	}
+
+	GstTask *src_task;
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		self->flow_ret = ret;
+		src_task = self->src_task;
+		gst_task_pause(GST_PAD_TASK(pad));
+	}
+
+	/* Let the source task handle the failure. */
+	gst_libcamera_resume_task(src_task);
 }
 
 bool
-gst_libcamera_pad_has_pending(GstPad *pad)
+gst_libcamera_pad_start_task(GstPad *pad, GstTask *src_task)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		self->flow_ret = GST_FLOW_OK;
+		self->src_task = src_task;
+	}
+
+	return gst_pad_start_task(pad, gst_libcamera_pad_push_loop, pad, nullptr);
+}
+
+void
+gst_libcamera_pad_stop_task(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GstBuffer *buffer;
+
+	gst_pad_stop_task(pad);
+
+	GLibLocker lock(GST_OBJECT(self));
+	while ((buffer = GST_BUFFER(g_queue_pop_head(&self->pending_buffers))))
+		gst_buffer_unref(buffer);
+
+	self->src_task = nullptr;
+}
+
+GstFlowReturn
+gst_libcamera_pad_get_flow_return(GstPad *pad)
 {
 	auto *self = GST_LIBCAMERA_PAD(pad);
 	GLibLocker lock(GST_OBJECT(self));
-	return self->pending_buffers.length > 0;
+	return self->flow_ret;
 }
 
 void
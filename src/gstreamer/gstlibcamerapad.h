@@ -28,9 +28,11 @@ libcamera::Stream *gst_libcamera_pad_get_stream(GstPad *pad);
 
 void gst_libcamera_pad_queue_buffer(GstPad *pad, GstBuffer *buffer);
 
-GstFlowReturn gst_libcamera_pad_push_pending(GstPad *pad);
+bool gst_libcamera_pad_start_task(GstPad *pad, GstTask *src_task);
 
-bool gst_libcamera_pad_has_pending(GstPad *pad);
+void gst_libcamera_pad_stop_task(GstPad *pad);
+
+GstFlowReturn gst_libcamera_pad_get_flow_return(GstPad *pad);
 
 void gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency);
 
@@ -27,10 +27,53 @@ struct _GstLibcameraPool {
 	GstAtomicQueue *queue;
 	GstLibcameraAllocator *allocator;
 	Stream *stream;
+	/*
+	 * The layout of the frames produced by the stream, used to attach a
+	 * GstVideoMeta to the buffers. The format is GST_VIDEO_FORMAT_UNKNOWN
+	 * for non-raw streams.
+	 */
+	GstVideoInfo info;
 };
 
 G_DEFINE_TYPE(GstLibcameraPool, gst_libcamera_pool, GST_TYPE_BUFFER_POOL)
 
+static void
+gst_libcamera_pool_add_video_meta(GstLibcameraPool *self, GstBuffer *buffer)
+{
+	const GstVideoInfo *info = &self->info;
+	guint n_planes = GST_VIDEO_INFO_N_PLANES(info);
+	guint n_memory = gst_buffer_n_memory(buffer);
+	gsize offset[GST_VIDEO_MAX_PLANES] = {};
+
+	if (GST_VIDEO_INFO_FORMAT(info) == GST_VIDEO_FORMAT_UNKNOWN)
+		return;
+
+	if (n_memory == 1) {
+		/* All planes are stored contiguously in a single dmabuf. */
+		for (guint i = 0; i < n_planes; i++)
+			offset[i] = GST_VIDEO_INFO_PLANE_OFFSET(info, i);
+	} else if (n_memory == n_planes) {
+		/*
+		 * Each plane is stored in its own dmabuf, the offsets are
+		 * relative to the start of the first memory of the buffer.
+		 */
+		for (guint i = 1; i < n_planes; i++)
+			offset[i] = offset[i - 1] +
+				    gst_buffer_peek_memory(buffer, i - 1)->size;
+	} else {
+		GST_WARNING_OBJECT(self, "Can't map %u planes to %u memories",
+				   n_planes, n_memory);
+		return;
+	}
+
+	gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+				       GST_VIDEO_INFO_FORMAT(info),
+				       GST_VIDEO_INFO_WIDTH(info),
+				       GST_VIDEO_INFO_HEIGHT(info),
+				       n_planes, offset,
+				       const_cast<gint *>(info->stride));
+}
+
 static GstFlowReturn
 gst_libcamera_pool_acquire_buffer(GstBufferPool *pool, GstBuffer **buffer,
 				  [[maybe_unused]] GstBufferPoolAcquireParams *params)
@@ -45,6 +88,12 @@ gst_libcamera_pool_acquire_buffer(GstBufferPool *pool, GstBuffer **buffer,
 		return GST_FLOW_ERROR;
 	}
 
+	/*
+	 * The video meta is removed when the buffer is reset, add it every
+	 * time the buffer is acquired.
+	 */
+	gst_libcamera_pool_add_video_meta(self, buf);
+
 	*buffer = buf;
 	return GST_FLOW_OK;
 }
@@ -111,6 +160,45 @@ gst_libcamera_pool_class_init(GstLibcameraPoolClass *klass)
 						     G_TYPE_NONE, 0);
 }
 
+/*
+ * Compute the layout of the frames from the stride reported by libcamera, as
+ * it may differ from the default GStreamer alignment. The strides of the
+ * chroma planes are scaled from the luma stride.
+ */
+static void
+gst_libcamera_pool_update_video_info(GstVideoInfo *info, guint stride)
+{
+	const GstVideoFormatInfo *finfo = info->finfo;
+	guint n_planes = GST_VIDEO_INFO_N_PLANES(info);
+	gint default_stride = GST_VIDEO_INFO_PLANE_STRIDE(info, 0);
+	gsize offset = 0;
+
+	if (!stride || !default_stride)
+		return;
+
+	for (guint i = 0; i < n_planes; i++) {
+		guint height = 0;
+
+		info->stride[i] = static_cast<guint64>(info->stride[i]) * stride
+				  / default_stride;
+		info->offset[i] = offset;
+
+		/* Find the first component stored in the plane. */
+		for (guint comp = 0; comp < GST_VIDEO_FORMAT_INFO_N_COMPONENTS(finfo); comp++) {
+			if (GST_VIDEO_FORMAT_INFO_PLANE(finfo, comp) != i)
+				continue;
+
+			height = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT(finfo, comp,
+								    GST_VIDEO_INFO_HEIGHT(info));
+			break;
+		}
+
+		offset += static_cast<gsize>(info->stride[i]) * height;
+	}
+
+	info->size = offset;
+}
+
 GstLibcameraPool *
 gst_libcamera_pool_new(GstLibcameraAllocator *allocator, Stream *stream)
 {
@@ -119,6 +207,12 @@ gst_libcamera_pool_new(GstLibcameraAllocator *allocator, Stream *stream)
 	pool->allocator = GST_LIBCAMERA_ALLOCATOR(g_object_ref(allocator));
 	pool->stream = stream;
 
+	const StreamConfiguration &stream_cfg = stream->configuration();
+	g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
+	gst_video_info_init(&pool->info);
+	if (gst_video_info_from_caps(&pool->info, caps))
+		gst_libcamera_pool_update_video_info(&pool->info, stream_cfg.stride);
+
 	gsize pool_size = gst_libcamera_allocator_get_pool_size(allocator, stream);
 	for (gsize i = 0; i < pool_size; i++) {
 		GstBuffer *buffer = gst_buffer_new();
@@ -123,15 +123,16 @@ gst_libcamera_device_class_init(GstLibcameraDeviceClass *klass)
 	g_object_class_install_property(object_class, PROP_DEVICE_NAME, pspec);
 }
 
-static GstDevice *
-gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
+static GstCaps *
+gst_libcamera_device_get_caps(const std::shared_ptr<Camera> &camera)
 {
-	g_autoptr(GstCaps) caps = gst_caps_new_empty();
-	const gchar *name = camera->id().c_str();
+	GstCaps *caps = gst_caps_new_empty();
 	StreamRoles roles;
 
 	roles.push_back(StreamRole::VideoRecording);
 	std::unique_ptr<CameraConfiguration> config = camera->generateConfiguration(roles);
+	if (!config)
+		return caps;
 
 	for (const StreamConfiguration &stream_cfg : *config) {
 		GstCaps *sub_caps = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
@@ -139,6 +140,14 @@ gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
 			gst_caps_append(caps, sub_caps);
 	}
 
+	return caps;
+}
+
+static GstDevice *
+gst_libcamera_device_new(const std::shared_ptr<Camera> &camera, GstCaps *caps)
+{
+	const gchar *name = camera->id().c_str();
+
 	return GST_DEVICE(g_object_new(GST_TYPE_LIBCAMERA_DEVICE,
 				       /* \todo Use a unique identifier instead of camera name. */
 				       "name", name,
@@ -158,7 +167,12 @@ gst_libcamera_device_new(const std::shared_ptr<Camera> &camera)
 
 struct _GstLibcameraProvider {
 	GstDeviceProvider parent;
-	CameraManager *cm;
+	/*
+	 * A hash table of the caps of each camera, using the camera ID as
+	 * key. Generating the caps requires generating a configuration, which
+	 * can be slow, and they don't change for the lifetime of the process.
+	 */
+	GHashTable *caps_cache;
 };
 
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraProvider, gst_libcamera_provider,
@@ -170,18 +184,21 @@ static GList *
 gst_libcamera_provider_probe(GstDeviceProvider *provider)
 {
 	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(provider);
-	CameraManager *cm = self->cm;
+	std::shared_ptr<CameraManager> cm;
 	GList *devices = nullptr;
 	gint ret;
 
 	GST_INFO_OBJECT(self, "Probing cameras using libcamera");
 
-	/* \todo Move the CameraMananger start()/stop() calls into
-	 * GstDeviceProvider start()/stop() virtual function when CameraMananger
-	 * gains monitoring support. Meanwhile we need to cycle start()/stop()
-	 * to ensure every probe() calls return the latest list.
+	/*
+	 * Use the CameraManager shared with the sources, started on demand,
+	 * for probing not to conflict with running sources.
+	 *
+	 * \todo Keep the CameraManager across probe() calls in the
+	 * GstDeviceProvider start()/stop() virtual functions, and report
+	 * hotplug events.
 	 */
-	ret = cm->start();
+	cm = gst_libcamera_get_camera_manager(ret);
 	if (ret) {
 		GST_ERROR_OBJECT(self, "Failed to retrieve device list: %s",
 				 g_strerror(-ret));
@@ -189,13 +206,20 @@ gst_libcamera_provider_probe(GstDeviceProvider *provider)
 	}
 
 	for (const std::shared_ptr<Camera> &camera : cm->cameras()) {
-		GST_INFO_OBJECT(self, "Found camera '%s'", camera->id().c_str());
+		const gchar *id = camera->id().c_str();
+
+		GST_INFO_OBJECT(self, "Found camera '%s'", id);
+
+		auto *caps = reinterpret_cast<GstCaps *>(g_hash_table_lookup(self->caps_cache, id));
+		if (!caps) {
+			caps = gst_libcamera_device_get_caps(camera);
+			g_hash_table_insert(self->caps_cache, g_strdup(id), caps);
+		}
+
 		devices = g_list_append(devices,
-					g_object_ref_sink(gst_libcamera_device_new(camera)));
+					g_object_ref_sink(gst_libcamera_device_new(camera, caps)));
 	}
 
-	cm->stop();
-
 	return devices;
 }
 
@@ -204,7 +228,8 @@ gst_libcamera_provider_init(GstLibcameraProvider *self)
 {
 	GstDeviceProvider *provider = GST_DEVICE_PROVIDER(self);
 
-	self->cm = new CameraManager();
+	self->caps_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+						 (GDestroyNotify)gst_caps_unref);
 
 	/* Avoid devices being duplicated. */
 	gst_device_provider_hide_provider(provider, "v4l2deviceprovider");
@@ -216,7 +241,7 @@ gst_libcamera_provider_finalize(GObject *object)
 	GstLibcameraProvider *self = GST_LIBCAMERA_PROVIDER(object);
 	gpointer klass = gst_libcamera_provider_parent_class;
 
-	delete self->cm;
+	g_hash_table_unref(self->caps_cache);
 
 	return G_OBJECT_CLASS(klass)->finalize(object);
 }
@@ -14,17 +14,14 @@
  *    + Prevent the main thread from accessing streaming thread
  *  - Implement renegotiation (even if slow)
  *  - Implement GstElement::request-new-pad (multi stream)
- *    + Evaluate if a single streaming thread is fine
  *  - Add application driven request (snapshot)
  *  - Add framerate control
- *  - Add buffer importation support
  *
  *  Requires new libcamera API:
  *  - Add framerate negotiation support
  *  - Add colorimetry support
  *  - Add timestamp support
  *  - Use unique names to select the camera devices
- *  - Add GstVideoMeta support (strides and offsets)
  *
  * \todo libcamera UVC drivers picks the lowest possible resolution first, this
  * should be fixed so that we get a decent resolution and framerate for the
@@ -33,6 +30,8 @@
 
 #include "gstlibcamerasrc.h"
 
+#include <algorithm>
+#include <map>
 #include <queue>
 #include <vector>
 
@@ -42,6 +41,7 @@
 #include <libcamera/camera_manager.h>
 
 #include "gstlibcameraallocator.h"
+#include "gstlibcamerameta.h"
 #include "gstlibcamerapad.h"
 #include "gstlibcamerapool.h"
 #include "gstlibcamera-utils.h"
@@ -57,6 +57,7 @@ struct RequestWrap {
 
 	void attachBuffer(GstBuffer *buffer);
 	GstBuffer *detachBuffer(Stream *stream);
+	void reset();
 
 	std::unique_ptr<Request> request_;
 	std::map<Stream *, GstBuffer *> buffers_;
@@ -75,6 +76,18 @@ RequestWrap::~RequestWrap()
 	}
 }
 
+/* Release the buffers and prepare the request to be queued again. */
+void RequestWrap::reset()
+{
+	for (std::pair<Stream *const, GstBuffer *> &item : buffers_) {
+		if (item.second)
+			gst_buffer_unref(item.second);
+	}
+
+	buffers_.clear();
+	request_->reuse();
+}
+
 void RequestWrap::attachBuffer(GstBuffer *buffer)
 {
 	FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
@@ -106,16 +119,39 @@ GstBuffer *RequestWrap::detachBuffer(Stream *stream)
 
 /* Used for C++ object with destructors. */
 struct GstLibcameraSrcState {
+	GstLibcameraSrcState();
+	~GstLibcameraSrcState();
+
 	GstLibcameraSrc *src_;
 
-	std::unique_ptr<CameraManager> cm_;
+	std::shared_ptr<CameraManager> cm_;
 	std::shared_ptr<Camera> cam_;
 	std::unique_ptr<CameraConfiguration> config_;
 	std::vector<GstPad *> srcpads_;
-	std::queue<std::unique_ptr<RequestWrap>> requests_;
 	guint group_id_;
 
+	/*
+	 * The queued and free requests are protected by a dedicated lock, to
+	 * avoid contention with the object lock between the streaming task
+	 * and the completion handler. Completed requests are recycled to
+	 * avoid allocating a Request for every frame.
+	 */
+	GMutex lock_;
+	std::queue<std::unique_ptr<RequestWrap>> requests_;
+	std::vector<std::unique_ptr<RequestWrap>> free_requests_;
+	guint queue_depth_;
+
+	/*
+	 * Caps of the formats supported by each stream, for each set of
+	 * roles. Only accessed with the stream lock held.
+	 */
+	std::map<StreamRoles, std::vector<GstCaps *>> formats_caps_;
+
+	const std::vector<GstCaps *> &formatsCaps(const StreamRoles &roles);
+	void clearFormatsCaps();
+
 	void requestCompleted(Request *request);
+	void recycleRequest(std::unique_ptr<RequestWrap> wrap);
 };
 
 struct _GstLibcameraSrc {
@@ -125,6 +161,7 @@ struct _GstLibcameraSrc {
 	GstTask *task;
 
 	gchar *camera_name;
+	guint queue_depth;
 
 	GstLibcameraSrcState *state;
 	GstLibcameraAllocator *allocator;
@@ -133,7 +170,8 @@ struct _GstLibcameraSrc {
 
 enum {
 	PROP_0,
-	PROP_CAMERA_NAME
+	PROP_CAMERA_NAME,
+	PROP_QUEUE_DEPTH,
 };
 
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraSrc, gst_libcamera_src, GST_TYPE_ELEMENT,
@@ -152,15 +190,70 @@ GstStaticPadTemplate request_src_template = {
 	"src_%u", GST_PAD_SRC, GST_PAD_REQUEST, TEMPLATE_CAPS
 };
 
+GstLibcameraSrcState::GstLibcameraSrcState()
+	: queue_depth_(0)
+{
+	g_mutex_init(&lock_);
+}
+
+GstLibcameraSrcState::~GstLibcameraSrcState()
+{
+	clearFormatsCaps();
+	g_mutex_clear(&lock_);
+}
+
+/*
+ * Return the caps of the formats supported by the streams of the current
+ * configuration, generated for the given roles. Converting the stream formats
+ * to caps is costly for cameras supporting many formats and sizes, the caps
+ * are thus cached, as they only depend on the camera and the roles.
+ */
+const std::vector<GstCaps *> &
+GstLibcameraSrcState::formatsCaps(const StreamRoles &roles)
+{
+	auto iter = formats_caps_.find(roles);
+	if (iter != formats_caps_.end())
+		return iter->second;
+
+	std::vector<GstCaps *> &caps = formats_caps_[roles];
+	for (const StreamConfiguration &stream_cfg : *config_)
+		caps.push_back(gst_libcamera_stream_formats_to_caps(stream_cfg.formats()));
+
+	return caps;
+}
+
+void
+GstLibcameraSrcState::clearFormatsCaps()
+{
+	for (auto &[roles, caps] : formats_caps_) {
+		for (GstCaps *c : caps)
+			gst_caps_unref(c);
+	}
+
+	formats_caps_.clear();
+}
+
+void
+GstLibcameraSrcState::recycleRequest(std::unique_ptr<RequestWrap> wrap)
+{
+	wrap->reset();
+
+	GLibLocker lock(&lock_);
+	free_requests_.push_back(std::move(wrap));
+}
+
 void
 GstLibcameraSrcState::requestCompleted(Request *request)
 {
-	GLibLocker lock(GST_OBJECT(src_));
+	std::unique_ptr<RequestWrap> wrap;
 
-	GST_DEBUG_OBJECT(src_, "buffers are ready");
+	{
+		GLibLocker lock(&lock_);
+		wrap = std::move(requests_.front());
+		requests_.pop();
+	}
 
-	std::unique_ptr<RequestWrap> wrap = std::move(requests_.front());
-	requests_.pop();
+	GST_DEBUG_OBJECT(src_, "buffers are ready");
 
 	g_return_if_fail(wrap->request_.get() == request);
 
@@ -169,10 +262,14 @@ GstLibcameraSrcState::requestCompleted(Request *request)
 		return;
 	}
 
+	GLibLocker lock(GST_OBJECT(src_));
+
 	GstBuffer *buffer;
 	for (GstPad *srcpad : srcpads_) {
 		Stream *stream = gst_libcamera_pad_get_stream(srcpad);
 		buffer = wrap->detachBuffer(stream);
+		if (!buffer)
+			continue;
 
 		FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
 
@@ -193,22 +290,30 @@ GstLibcameraSrcState::requestCompleted(Request *request)
 		GST_BUFFER_OFFSET(buffer) = fb->metadata().sequence;
 		GST_BUFFER_OFFSET_END(buffer) = fb->metadata().sequence;
 
+		/*
+		 * Share the request metadata with downstream. The request
+		 * detaches from it when it's reused.
+		 */
+		gst_buffer_add_libcamera_meta(buffer, request->sharedMetadata());
+
 		gst_libcamera_pad_queue_buffer(srcpad, buffer);
 	}
 
+	recycleRequest(std::move(wrap));
+
 	gst_libcamera_resume_task(this->src_->task);
 }
 
 static bool
 gst_libcamera_src_open(GstLibcameraSrc *self)
 {
-	std::unique_ptr<CameraManager> cm = std::make_unique<CameraManager>();
+	std::shared_ptr<CameraManager> cm;
 	std::shared_ptr<Camera> cam;
 	gint ret = 0;
 
 	GST_DEBUG_OBJECT(self, "Opening camera device ...");
 
-	ret = cm->start();
+	cm = gst_libcamera_get_camera_manager(ret);
 	if (ret) {
 		GST_ELEMENT_ERROR(self, LIBRARY, INIT,
 				  ("Failed listing cameras."),
@@ -265,55 +370,85 @@ gst_libcamera_src_task_run(gpointer user_data)
 {
 	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
 	GstLibcameraSrcState *state = self->state;
+	std::unique_ptr<RequestWrap> wrap;
+	bool queue_full = false;
 
-	std::unique_ptr<Request> request = state->cam_->createRequest();
-	if (!request) {
-		GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
-				  ("Failed to allocate request for camera '%s'.",
-				   state->cam_->id().c_str()),
-				  ("libcamera::Camera::createRequest() failed"));
-		gst_task_stop(self->task);
-		return;
+	{
+		GLibLocker lock(&state->lock_);
+
+		if (state->queue_depth_ &&
+		    state->requests_.size() >= state->queue_depth_) {
+			queue_full = true;
+		} else if (!state->free_requests_.empty()) {
+			wrap = std::move(state->free_requests_.back());
+			state->free_requests_.pop_back();
+		}
 	}
 
-	std::unique_ptr<RequestWrap> wrap =
-		std::make_unique<RequestWrap>(std::move(request));
+	if (!queue_full && !wrap) {
+		std::unique_ptr<Request> request = state->cam_->createRequest();
+		if (!request) {
+			GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
+					  ("Failed to allocate request for camera '%s'.",
+					   state->cam_->id().c_str()),
+					  ("libcamera::Camera::createRequest() failed"));
+			gst_task_stop(self->task);
+			return;
+		}
 
+		wrap = std::make_unique<RequestWrap>(std::move(request));
+	}
+
+	/*
+	 * Queue the request with buffers for the pads that have free buffers
+	 * only, for a pad whose buffers are held downstream not to throttle
+	 * the other streams.
+	 */
 	for (GstPad *srcpad : state->srcpads_) {
+		if (!wrap)
+			break;
+
+		GstFlowReturn flow_ret = gst_libcamera_pad_get_flow_return(srcpad);
+		if (flow_ret != GST_FLOW_OK && flow_ret != GST_FLOW_NOT_LINKED)
+			continue;
+
 		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
 		GstBuffer *buffer;
 		GstFlowReturn ret;
 
 		ret = gst_buffer_pool_acquire_buffer(GST_BUFFER_POOL(pool),
 						     &buffer, nullptr);
-		if (ret != GST_FLOW_OK) {
-			/*
-			 * RequestWrap has ownership of the rquest, and we
-			 * won't be queueing this one due to lack of buffers.
-			 */
-			wrap.release();
-			break;
-		}
+		if (ret != GST_FLOW_OK)
+			continue;
 
 		wrap->attachBuffer(buffer);
 	}
 
+	if (wrap && wrap->buffers_.empty()) {
+		/*
+		 * We won't be queueing this request due to lack of buffers,
+		 * keep it for the next iteration.
+		 */
+		state->recycleRequest(std::move(wrap));
+	}
+
+	bool queued = false;
 	if (wrap) {
-		GLibLocker lock(GST_OBJECT(self));
+		GLibLocker lock(&state->lock_);
 		GST_TRACE_OBJECT(self, "Requesting buffers");
 		state->cam_->queueRequest(wrap->request_.get());
 		state->requests_.push(std::move(wrap));
+		queued = true;
 
-		/* The RequestWrap will be deleted in the completion handler. */
+		/* The RequestWrap will be recycled in the completion handler. */
 	}
 
+	/* Buffers are pushed by the pad tasks, combine their flow returns. */
 	GstFlowReturn ret = GST_FLOW_OK;
 	gst_flow_combiner_reset(self->flow_combiner);
-	for (GstPad *srcpad : state->srcpads_) {
-		ret = gst_libcamera_pad_push_pending(srcpad);
-		ret = gst_flow_combiner_update_pad_flow(self->flow_combiner,
-							srcpad, ret);
-	}
+	for (GstPad *srcpad : state->srcpads_)
+		ret = gst_flow_combiner_update_pad_flow(self->flow_combiner, srcpad,
+							gst_libcamera_pad_get_flow_return(srcpad));
 
 	{
 		/*
@@ -323,32 +458,73 @@ gst_libcamera_src_task_run(gpointer user_data)
 		 */
 		GLibLocker lock(GST_OBJECT(self));
 		if (ret != GST_FLOW_OK) {
-			if (ret == GST_FLOW_EOS) {
-				g_autoptr(GstEvent) eos = gst_event_new_eos();
-				guint32 seqnum = gst_util_seqnum_next();
-				gst_event_set_seqnum(eos, seqnum);
-				for (GstPad *srcpad : state->srcpads_)
-					gst_pad_push_event(srcpad, gst_event_ref(eos));
-			} else if (ret != GST_FLOW_FLUSHING) {
+			/* The pad tasks have pushed EOS already. */
+			if (ret != GST_FLOW_EOS && ret != GST_FLOW_FLUSHING)
 				GST_ELEMENT_FLOW_ERROR(self, ret);
-			}
 			gst_task_stop(self->task);
 			return;
 		}
 
-		bool do_pause = true;
-		for (GstPad *srcpad : state->srcpads_) {
-			if (gst_libcamera_pad_has_pending(srcpad)) {
-				do_pause = false;
-				break;
-			}
-		}
-
-		if (do_pause)
+		/*
+		 * Keep queueing requests as long as buffers are available, and
+		 * wait for buffers to be returned or requests to complete
+		 * otherwise.
+		 */
+		if (!queued)
 			gst_task_pause(self->task);
 	}
 }
 
+/*
+ * Query downstream for a buffer pool to capture to, and configure and activate
+ * it for the stream. Only pools whose buffers can be imported by libcamera,
+ * that is dmabuf-backed pools, are useful, which is verified when importing
+ * them in the allocator.
+ */
+static GstBufferPool *
+gst_libcamera_src_negotiate_pool(GstLibcameraSrc *self, GstPad *srcpad,
+				 const StreamConfiguration &stream_cfg)
+{
+	g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
+	g_autoptr(GstQuery) query = gst_query_new_allocation(caps, TRUE);
+	GstBufferPool *pool = nullptr;
+	guint size, min, max;
+
+	if (!gst_pad_peer_query(srcpad, query) ||
+	    !gst_query_get_n_allocation_pools(query))
+		return nullptr;
+
+	gst_query_parse_nth_allocation_pool(query, 0, &pool, &size, &min, &max);
+	if (!pool)
+		return nullptr;
+
+	if (max && max < stream_cfg.bufferCount) {
+		GST_DEBUG_OBJECT(self, "Downstream pool is too small (%u < %u)",
+				 max, stream_cfg.bufferCount);
+		gst_object_unref(pool);
+		return nullptr;
+	}
+
+	GstStructure *config = gst_buffer_pool_get_config(pool);
+	gst_buffer_pool_config_set_params(config, caps,
+					  std::max(size, stream_cfg.frameSize),
+					  std::max(min, stream_cfg.bufferCount), max);
+	if (gst_buffer_pool_has_option(pool, GST_BUFFER_POOL_OPTION_VIDEO_META))
+		gst_buffer_pool_config_add_option(config,
+						  GST_BUFFER_POOL_OPTION_VIDEO_META);
+
+	if (!gst_buffer_pool_set_config(pool, config) ||
+	    !gst_buffer_pool_set_active(pool, TRUE)) {
+		GST_DEBUG_OBJECT(self, "Failed to configure downstream pool");
+		gst_object_unref(pool);
+		return nullptr;
+	}
+
+	GST_DEBUG_OBJECT(self, "Using downstream pool %" GST_PTR_FORMAT, pool);
+
+	return pool;
+}
+
 static void
 gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 			     gpointer user_data)
@@ -386,12 +562,14 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 	}
 	g_assert(state->config_->size() == state->srcpads_.size());
 
+	const std::vector<GstCaps *> &formats_caps = state->formatsCaps(roles);
+
 	for (gsize i = 0; i < state->srcpads_.size(); i++) {
 		GstPad *srcpad = state->srcpads_[i];
 		StreamConfiguration &stream_cfg = state->config_->at(i);
 
 		/* Retrieve the supported caps. */
-		g_autoptr(GstCaps) filter = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
+		GstCaps *filter = formats_caps[i];
 		g_autoptr(GstCaps) caps = gst_pad_peer_query_caps(srcpad, filter);
 		if (gst_caps_is_empty(caps)) {
 			flow_ret = GST_FLOW_NOT_NEGOTIATED;
@@ -441,7 +619,23 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 		return;
 	}
 
-	self->allocator = gst_libcamera_allocator_new(state->cam_, state->config_.get());
+	/*
+	 * Capture directly to the buffers of downstream pools when available.
+	 * The allocator takes ownership of the pools, and deactivates them
+	 * when destroyed.
+	 */
+	std::map<Stream *, GstBufferPool *> import_pools;
+	for (gsize i = 0; i < state->srcpads_.size(); i++) {
+		const StreamConfiguration &stream_cfg = state->config_->at(i);
+		GstBufferPool *pool = gst_libcamera_src_negotiate_pool(self, state->srcpads_[i],
+								       stream_cfg);
+		if (pool)
+			import_pools[stream_cfg.stream()] = pool;
+	}
+
+	self->allocator = gst_libcamera_allocator_new(state->cam_, state->config_.get(),
+						      import_pools);
+
 	if (!self->allocator) {
 		GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
 				  ("Failed to allocate memory"),
@@ -461,6 +655,39 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 
 		gst_libcamera_pad_set_pool(srcpad, pool);
 		gst_flow_combiner_add_pad(self->flow_combiner, srcpad);
+
+		if (!gst_libcamera_pad_start_task(srcpad, task)) {
+			GST_ELEMENT_ERROR(self, RESOURCE, FAILED,
+					  ("Failed to start the pad streaming task"),
+					  ("gst_pad_start_task() failed"));
+			gst_task_stop(task);
+			return;
+		}
+	}
+
+	/*
+	 * Pre-create the requests, as many as can be queued at a time, which
+	 * is bounded by the queue depth if set, or by the smallest pool.
+	 */
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		state->queue_depth_ = self->queue_depth;
+	}
+
+	guint num_requests = state->queue_depth_;
+	for (GstPad *srcpad : state->srcpads_) {
+		gsize pool_size = gst_libcamera_allocator_get_pool_size(self->allocator,
+									gst_libcamera_pad_get_stream(srcpad));
+		if (!num_requests || pool_size < num_requests)
+			num_requests = pool_size;
+	}
+
+	for (guint i = 0; i < num_requests; i++) {
+		std::unique_ptr<Request> request = state->cam_->createRequest();
+		if (!request)
+			break;
+
+		state->free_requests_.push_back(std::make_unique<RequestWrap>(std::move(request)));
 	}
 
 	ret = state->cam_->start();
@@ -495,8 +722,15 @@ gst_libcamera_src_task_leave([[maybe_unused]] GstTask *task,
 
 	state->cam_->stop();
 
-	for (GstPad *srcpad : state->srcpads_)
+	{
+		GLibLocker lock(&state->lock_);
+		state->free_requests_.clear();
+	}
+
+	for (GstPad *srcpad : state->srcpads_) {
+		gst_libcamera_pad_stop_task(srcpad);
 		gst_libcamera_pad_set_pool(srcpad, nullptr);
+	}
 
 	g_clear_object(&self->allocator);
 	g_clear_pointer(&self->flow_combiner,
@@ -512,6 +746,7 @@ gst_libcamera_src_close(GstLibcameraSrc *self)
 	GST_DEBUG_OBJECT(self, "Releasing resources");
 
 	state->config_.reset();
+	state->clearFormatsCaps();
 
 	ret = state->cam_->release();
 	if (ret) {
@@ -521,7 +756,6 @@ gst_libcamera_src_close(GstLibcameraSrc *self)
 	}
 
 	state->cam_.reset();
-	state->cm_->stop();
 	state->cm_.reset();
 }
 
@@ -537,6 +771,9 @@ gst_libcamera_src_set_property(GObject *object, guint prop_id,
 		g_free(self->camera_name);
 		self->camera_name = g_value_dup_string(value);
 		break;
+	case PROP_QUEUE_DEPTH:
+		self->queue_depth = g_value_get_uint(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -554,6 +791,9 @@ gst_libcamera_src_get_property(GObject *object, guint prop_id, GValue *value,
 	case PROP_CAMERA_NAME:
 		g_value_set_string(value, self->camera_name);
 		break;
+	case PROP_QUEUE_DEPTH:
+		g_value_set_uint(value, self->queue_depth);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -722,4 +962,13 @@ gst_libcamera_src_class_init(GstLibcameraSrcClass *klass)
 							     | G_PARAM_READWRITE
 							     | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property(object_class, PROP_CAMERA_NAME, spec);
+
+	spec = g_param_spec_uint("queue-depth", "Queue Depth",
+				 "Maximum number of requests queued to the camera, lower "
+				 "values reduce latency. 0 only limits the number of "
+				 "requests by the number of buffers.", 0, G_MAXUINT, 0,
+				 (GParamFlags)(GST_PARAM_MUTABLE_READY
+					       | G_PARAM_READWRITE
+					       | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_QUEUE_DEPTH, spec);
 }
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_context.h - IPU3 IPA context
+ */
+#ifndef __LIBCAMERA_IPU3_IPA_CONTEXT_H__
+#define __LIBCAMERA_IPU3_IPA_CONTEXT_H__
+
+#include <stdint.h>
+
+#include <linux/intel-ipu3.h>
+
+#include <libcamera/ipa/ipu3_ipa_interface.h>
+
+#include "libipa/module.h"
+
+#include "ipu3_stats.h"
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+/*
+ * The IPA context holds the state shared by the algorithms, carried over
+ * from frame to frame.
+ */
+struct IPAContext {
+	struct {
+		ipu3_uapi_grid_config bdsGrid;
+	} configuration;
+
+	struct {
+		/* Sensor exposure (in lines) and analogue gain to apply. */
+		uint32_t exposure;
+		double gain;
+		/* True when the last processed frame produced new settings. */
+		bool updateControls;
+		double gamma;
+	} agc;
+};
+
+/* Results computed by the algorithms for one frame. */
+struct IPAFrameContext {
+	IPU3Statistics stats;
+
+	struct {
+		uint32_t exposure;
+		double gain;
+	} agc;
+
+	struct {
+		double redGain;
+		double blueGain;
+		uint32_t temperatureK;
+	} awb;
+};
+
+using Module = ipa::Module<IPAContext, IPAFrameContext, IPAConfigInfo,
+			   ipu3_uapi_params, ipu3_uapi_stats_3a>;
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPU3_IPA_CONTEXT_H__ */
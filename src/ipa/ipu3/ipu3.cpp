@@ -29,13 +29,18 @@
 
 #include "libcamera/internal/mapped_framebuffer.h"
 
+#include "ipa_context.h"
 #include "ipu3_agc.h"
 #include "ipu3_awb.h"
+#include "libipa/buffer_registry.h"
 #include "libipa/camera_sensor_helper.h"
 
 static constexpr uint32_t kMaxCellWidthPerSet = 160;
 static constexpr uint32_t kMaxCellHeightPerSet = 56;
 
+/* Number of frame contexts kept for the frames in flight */
+static constexpr unsigned int kMaxFrameContexts = 16;
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPAIPU3)
@@ -50,8 +55,10 @@ public:
 		 const ControlInfoMap &sensorControls,
 		 ControlInfoMap *ipaControls) override;
 
+	IPAIPU3();
+
 	int start() override;
-	void stop() override {}
+	void stop() override;
 
 	int configure(const IPAConfigInfo &configInfo) override;
 
@@ -66,10 +73,11 @@ private:
 			     int64_t frameTimestamp,
 			     const ipu3_uapi_stats_3a *stats);
 
+	void metadataReady(unsigned int frame);
 	void setControls(unsigned int frame);
 	void calculateBdsGrid(const Size &bdsOutputSize);
 
-	std::map<unsigned int, MappedFrameBuffer> buffers_;
+	BufferRegistry buffers_;
 
 	ControlInfoMap ctrls_;
 
@@ -84,19 +92,24 @@ private:
 	uint32_t minGain_;
 	uint32_t maxGain_;
 
-	/* Interface to the AWB algorithm */
-	std::unique_ptr<IPU3Awb> awbAlgo_;
-	/* Interface to the AEC/AGC algorithm */
-	std::unique_ptr<IPU3Agc> agcAlgo_;
+	/* The AEC/AGC and AWB algorithms, run in that order */
+	Module module_;
 	/* Interface to the Camera Helper */
 	std::unique_ptr<CameraSensorHelper> camHelper_;
 
-	/* Local parameter storage */
-	struct ipu3_uapi_params params_;
+	/* State shared by the algorithms */
+	IPAContext context_;
 
 	struct ipu3_uapi_grid_config bdsGrid_;
 };
 
+IPAIPU3::IPAIPU3()
+	: module_(kMaxFrameContexts)
+{
+	module_.addAlgorithm(std::make_unique<IPU3Agc>());
+	module_.addAlgorithm(std::make_unique<IPU3Awb>());
+}
+
 /**
  * Initialize the IPA module and its controls.
  *
@@ -175,6 +188,12 @@ int IPAIPU3::start()
 	return 0;
 }
 
+void IPAIPU3::stop()
+{
+	module_.logTimings();
+	module_.resetTimings();
+}
+
 /**
  * This function calculates a grid for the AWB algorithm in the IPU3 firmware.
  * Its input is the BDS output size calculated in the ImgU.
@@ -262,39 +281,26 @@ int IPAIPU3::configure(const IPAConfigInfo &configInfo)
 	maxGain_ = itGain->second.max().get<int32_t>();
 	gain_ = minGain_;
 
-	defVBlank_ = itVBlank->second.def().get<int32_t>();
+	camHelper_->prepareGainCodes(minGain_, maxGain_);
 
-	params_ = {};
+	defVBlank_ = itVBlank->second.def().get<int32_t>();
 
 	calculateBdsGrid(configInfo.bdsOutputSize);
 
-	awbAlgo_ = std::make_unique<IPU3Awb>();
-	awbAlgo_->initialise(params_, configInfo.bdsOutputSize, bdsGrid_);
-
-	agcAlgo_ = std::make_unique<IPU3Agc>();
-	agcAlgo_->initialise(bdsGrid_, sensorInfo_);
+	context_ = {};
+	context_.configuration.bdsGrid = bdsGrid_;
 
-	return 0;
+	return module_.configure(context_, configInfo);
 }
 
 void IPAIPU3::mapBuffers(const std::vector<IPABuffer> &buffers)
 {
-	for (const IPABuffer &buffer : buffers) {
-		const FrameBuffer fb(buffer.planes);
-		buffers_.emplace(buffer.id,
-				 MappedFrameBuffer(&fb, MappedFrameBuffer::MapFlag::ReadWrite));
-	}
+	buffers_.map(buffers);
 }
 
 void IPAIPU3::unmapBuffers(const std::vector<unsigned int> &ids)
 {
-	for (unsigned int id : ids) {
-		auto it = buffers_.find(id);
-		if (it == buffers_.end())
-			continue;
-
-		buffers_.erase(it);
-	}
+	buffers_.unmap(ids);
 }
 
 void IPAIPU3::processEvent(const IPU3Event &event)
@@ -305,31 +311,39 @@ void IPAIPU3::processEvent(const IPU3Event &event)
 		break;
 	}
 	case EventStatReady: {
-		auto it = buffers_.find(event.bufferId);
-		if (it == buffers_.end()) {
-			LOG(IPAIPU3, Error) << "Could not find stats buffer!";
-			return;
+		/* End the CPU access before the buffer is handed back. */
+		{
+			BufferRegistry::Access access(buffers_, event.bufferId,
+						      MappedFrameBuffer::MapFlag::Read);
+			const ipu3_uapi_stats_3a *stats = access.data<ipu3_uapi_stats_3a>();
+			if (!stats) {
+				LOG(IPAIPU3, Error) << "Could not find stats buffer!";
+				return;
+			}
+
+			parseStatistics(event.frame, event.frameTimestamp, stats);
 		}
 
-		Span<uint8_t> mem = it->second.maps()[0];
-		const ipu3_uapi_stats_3a *stats =
-			reinterpret_cast<ipu3_uapi_stats_3a *>(mem.data());
-
-		parseStatistics(event.frame, event.frameTimestamp, stats);
+		metadataReady(event.frame);
 		break;
 	}
 	case EventFillParams: {
-		auto it = buffers_.find(event.bufferId);
-		if (it == buffers_.end()) {
-			LOG(IPAIPU3, Error) << "Could not find param buffer!";
-			return;
+		{
+			BufferRegistry::Access access(buffers_, event.bufferId,
+						      MappedFrameBuffer::MapFlag::Write);
+			ipu3_uapi_params *params = access.data<ipu3_uapi_params>();
+			if (!params) {
+				LOG(IPAIPU3, Error) << "Could not find param buffer!";
+				return;
+			}
+
+			fillParams(event.frame, params);
 		}
 
-		Span<uint8_t> mem = it->second.maps()[0];
-		ipu3_uapi_params *params =
-			reinterpret_cast<ipu3_uapi_params *>(mem.data());
+		IPU3Action op;
+		op.op = ActionParamFilled;
 
-		fillParams(event.frame, params);
+		queueFrameAction.emit(event.frame, op);
 		break;
 	}
 	default:
@@ -338,39 +352,42 @@ void IPAIPU3::processEvent(const IPU3Event &event)
 	}
 }
 
-void IPAIPU3::processControls([[maybe_unused]] unsigned int frame,
+void IPAIPU3::processControls(unsigned int frame,
 			      [[maybe_unused]] const ControlList &controls)
 {
+	module_.alloc(frame);
+
 	/* \todo Start processing for 'frame' based on 'controls'. */
 }
 
 void IPAIPU3::fillParams(unsigned int frame, ipu3_uapi_params *params)
 {
-	if (agcAlgo_->updateControls())
-		awbAlgo_->updateWbParameters(params_, agcAlgo_->gamma());
-
-	*params = params_;
+	*params = {};
 
-	IPU3Action op;
-	op.op = ActionParamFilled;
-
-	queueFrameAction.emit(frame, op);
+	module_.prepare(context_, frame, params);
 }
 
 void IPAIPU3::parseStatistics(unsigned int frame,
 			      [[maybe_unused]] int64_t frameTimestamp,
-			      [[maybe_unused]] const ipu3_uapi_stats_3a *stats)
+			      const ipu3_uapi_stats_3a *stats)
 {
-	ControlList ctrls(controls::controls);
+	module_.frameContext(frame).stats.parse(bdsGrid_, stats);
+
+	context_.agc.exposure = exposure_;
+	context_.agc.gain = camHelper_->gain(gain_);
 
-	double gain = camHelper_->gain(gain_);
-	agcAlgo_->process(stats, exposure_, gain);
-	gain_ = camHelper_->gainCode(gain);
+	module_.process(context_, frame, stats);
 
-	awbAlgo_->calculateWBGains(stats);
+	exposure_ = context_.agc.exposure;
+	gain_ = camHelper_->gainCode(context_.agc.gain);
 
-	if (agcAlgo_->updateControls())
+	if (context_.agc.updateControls)
 		setControls(frame);
+}
+
+void IPAIPU3::metadataReady(unsigned int frame)
+{
+	ControlList ctrls(controls::controls);
 
 	/* \todo Use VBlank value calculated from each frame exposure. */
 	int64_t frameDuration = sensorInfo_.lineLength * (defVBlank_ + sensorInfo_.outputSize.height) /
@@ -44,12 +44,8 @@ static constexpr uint32_t kMinExposure = 1;
 static constexpr uint32_t kMaxExposure = 1976;
 
 /* Histogram constants */
-static constexpr uint32_t knumHistogramBins = 256;
 static constexpr double kEvGainTarget = 0.5;
 
-/* A cell is 8 bytes and contains averages for RGB values and saturation ratio */
-static constexpr uint8_t kCellSize = 8;
-
 IPU3Agc::IPU3Agc()
 	: frameCount_(0), lastFrame_(0), converged_(false),
 	  updateControls_(false), iqMean_(0.0), gamma_(1.0),
@@ -59,56 +55,38 @@ IPU3Agc::IPU3Agc()
 {
 }
 
-void IPU3Agc::initialise(struct ipu3_uapi_grid_config &bdsGrid, const IPACameraSensorInfo &sensorInfo)
+int IPU3Agc::configure(IPAContext &context, const IPAConfigInfo &configInfo)
 {
-	aeGrid_ = bdsGrid;
+	const IPACameraSensorInfo &sensorInfo = configInfo.sensorInfo;
 
 	lineDuration_ = sensorInfo.lineLength * 1.0s / sensorInfo.pixelRate;
 	maxExposureTime_ = kMaxExposure * lineDuration_;
+
+	/* Restart convergence from scratch for the new configuration. */
+	frameCount_ = 0;
+	lastFrame_ = 0;
+	converged_ = false;
+	updateControls_ = false;
+	iqMean_ = 0.0;
+	gamma_ = 1.0;
+	prevExposure_ = 0s;
+	prevExposureNoDg_ = 0s;
+	currentExposure_ = 0s;
+	currentExposureNoDg_ = 0s;
+
+	context.agc.updateControls = false;
+	context.agc.gamma = gamma_;
+
+	return 0;
 }
 
-void IPU3Agc::processBrightness(const ipu3_uapi_stats_3a *stats)
+void IPU3Agc::processBrightness(const IPU3Statistics &stats)
 {
-	const struct ipu3_uapi_grid_config statsAeGrid = stats->stats_4a_config.awb_config.grid;
-	Rectangle aeRegion = { statsAeGrid.x_start,
-			       statsAeGrid.y_start,
-			       static_cast<unsigned int>(statsAeGrid.x_end - statsAeGrid.x_start) + 1,
-			       static_cast<unsigned int>(statsAeGrid.y_end - statsAeGrid.y_start) + 1 };
-	Point topleft = aeRegion.topLeft();
-	int topleftX = topleft.x >> aeGrid_.block_width_log2;
-	int topleftY = topleft.y >> aeGrid_.block_height_log2;
-
-	/* Align to the grid cell width and height */
-	uint32_t startX = topleftX << aeGrid_.block_width_log2;
-	uint32_t startY = topleftY * aeGrid_.width << aeGrid_.block_width_log2;
-	uint32_t endX = (startX + (aeRegion.size().width >> aeGrid_.block_width_log2)) << aeGrid_.block_width_log2;
-	uint32_t i, j;
-	uint32_t count = 0;
-
-	uint32_t hist[knumHistogramBins] = { 0 };
-	for (j = topleftY;
-	     j < topleftY + (aeRegion.size().height >> aeGrid_.block_height_log2);
-	     j++) {
-		for (i = startX + startY; i < endX + startY; i += kCellSize) {
-			/*
-			 * The grid width (and maybe height) is not reliable.
-			 * We observed a bit shift which makes the value 160 to be 32 in the stats grid.
-			 * Use the one passed at init time.
-			 */
-			if (stats->awb_raw_buffer.meta_data[i + 4 + j * aeGrid_.width] == 0) {
-				uint8_t Gr = stats->awb_raw_buffer.meta_data[i + 0 + j * aeGrid_.width];
-				uint8_t Gb = stats->awb_raw_buffer.meta_data[i + 3 + j * aeGrid_.width];
-				hist[(Gr + Gb) / 2]++;
-				count++;
-			}
-		}
-	}
-
 	/* Limit the gamma effect for now */
 	gamma_ = 1.1;
 
 	/* Estimate the quantile mean of the top 2% of the histogram */
-	iqMean_ = Histogram(Span<uint32_t>(hist)).interQuantileMean(0.98, 1.0);
+	iqMean_ = Histogram(stats.histogram).interQuantileMean(0.98, 1.0);
 }
 
 void IPU3Agc::filterExposure()
@@ -156,11 +134,11 @@ void IPU3Agc::lockExposureGain(uint32_t &exposure, double &gain)
 		return;
 
 	/* Are we correctly exposed ? */
-	if (std::abs(iqMean_ - kEvGainTarget * knumHistogramBins) <= 1) {
+	if (std::abs(iqMean_ - kEvGainTarget * kNumHistogramBins) <= 1) {
 		LOG(IPU3Agc, Debug) << "!!! Good exposure with iqMean = " << iqMean_;
 		converged_ = true;
 	} else {
-		double newGain = kEvGainTarget * knumHistogramBins / iqMean_;
+		double newGain = kEvGainTarget * kNumHistogramBins / iqMean_;
 
 		/* extracted from Rpi::Agc::computeTargetExposure */
 		libcamera::utils::Duration currentShutter = exposure * lineDuration_;
@@ -193,11 +171,20 @@ void IPU3Agc::lockExposureGain(uint32_t &exposure, double &gain)
 	lastFrame_ = frameCount_;
 }
 
-void IPU3Agc::process(const ipu3_uapi_stats_3a *stats, uint32_t &exposure, double &gain)
+void IPU3Agc::process(IPAContext &context, [[maybe_unused]] uint32_t frame,
+		      IPAFrameContext &frameContext,
+		      [[maybe_unused]] const ipu3_uapi_stats_3a *stats)
 {
-	processBrightness(stats);
-	lockExposureGain(exposure, gain);
+	processBrightness(frameContext.stats);
+	lockExposureGain(context.agc.exposure, context.agc.gain);
 	frameCount_++;
+
+	/* \todo Use a metadata exchange between IPAs */
+	context.agc.updateControls = updateControls_;
+	context.agc.gamma = gamma_;
+
+	frameContext.agc.exposure = context.agc.exposure;
+	frameContext.agc.gain = context.agc.gain;
 }
 
 } /* namespace ipa::ipu3 */
@@ -11,38 +11,32 @@
 
 #include <libcamera/base/utils.h>
 
-#include <libcamera/geometry.h>
-
-#include "libipa/algorithm.h"
+#include "ipa_context.h"
 
 namespace libcamera {
 
-struct IPACameraSensorInfo;
-
 namespace ipa::ipu3 {
 
 using utils::Duration;
 
-class IPU3Agc : public Algorithm
+class IPU3Agc : public ipa::Algorithm<Module>
 {
 public:
 	IPU3Agc();
 	~IPU3Agc() = default;
 
-	void initialise(struct ipu3_uapi_grid_config &bdsGrid, const IPACameraSensorInfo &sensorInfo);
-	void process(const ipu3_uapi_stats_3a *stats, uint32_t &exposure, double &gain);
+	const char *name() const override { return "IPU3Agc"; }
+
+	int configure(IPAContext &context, const IPAConfigInfo &configInfo) override;
+	void process(IPAContext &context, uint32_t frame, IPAFrameContext &frameContext,
+		     const ipu3_uapi_stats_3a *stats) override;
 	bool converged() { return converged_; }
-	bool updateControls() { return updateControls_; }
-	/* \todo Use a metadata exchange between IPAs */
-	double gamma() { return gamma_; }
 
 private:
-	void processBrightness(const ipu3_uapi_stats_3a *stats);
+	void processBrightness(const IPU3Statistics &stats);
 	void filterExposure();
 	void lockExposureGain(uint32_t &exposure, double &gain);
 
-	struct ipu3_uapi_grid_config aeGrid_;
-
 	uint64_t frameCount_;
 	uint64_t lastFrame_;
 
@@ -20,29 +20,6 @@ LOG_DEFINE_CATEGORY(IPU3Awb)
 static constexpr uint32_t kMinZonesCounted = 16;
 static constexpr uint32_t kMinGreenLevelInZone = 32;
 
-/**
- * \struct IspStatsRegion
- * \brief RGB statistics for a given region
- *
- * The IspStatsRegion structure is intended to abstract the ISP specific
- * statistics and use an agnostic algorithm to compute AWB.
- *
- * \var IspStatsRegion::counted
- * \brief Number of pixels used to calculate the sums
- *
- * \var IspStatsRegion::uncounted
- * \brief Remaining number of pixels in the region
- *
- * \var IspStatsRegion::rSum
- * \brief Sum of the red values in the region
- *
- * \var IspStatsRegion::gSum
- * \brief Sum of the green values in the region
- *
- * \var IspStatsRegion::bSum
- * \brief Sum of the blue values in the region
- */
-
 /**
  * \struct AwbStatus
  * \brief AWB parameters calculated
@@ -63,32 +40,6 @@ static constexpr uint32_t kMinGreenLevelInZone = 32;
  * \brief Gain calculated for the blue channel
  */
 
-/**
- * \struct Ipu3AwbCell
- * \brief Memory layout for each cell in AWB metadata
- *
- * The Ipu3AwbCell structure is used to get individual values
- * such as red average or saturation ratio in a particular cell.
- *
- * \var Ipu3AwbCell::greenRedAvg
- * \brief Green average for red lines in the cell
- *
- * \var Ipu3AwbCell::redAvg
- * \brief Red average in the cell
- *
- * \var Ipu3AwbCell::blueAvg
- * \brief blue average in the cell
- *
- * \var Ipu3AwbCell::greenBlueAvg
- * \brief Green average for blue lines
- *
- * \var Ipu3AwbCell::satRatio
- * \brief Saturation ratio in the cell
- *
- * \var Ipu3AwbCell::padding
- * \brief array of unused bytes for padding
- */
-
 /* Default settings for Bayer noise reduction replicated from the Kernel */
 static const struct ipu3_uapi_bnr_static_config imguCssBnrDefaults = {
 	.wb_gains = { 16, 16, 16, 16 },
@@ -161,47 +112,80 @@ const struct ipu3_uapi_gamma_corr_lut imguCssGammaLut = { {
 IPU3Awb::IPU3Awb()
 	: Algorithm()
 {
-	asyncResults_.blueGain = 1.0;
-	asyncResults_.greenGain = 1.0;
-	asyncResults_.redGain = 1.0;
-	asyncResults_.temperatureK = 4500;
 }
 
 IPU3Awb::~IPU3Awb()
 {
 }
 
-void IPU3Awb::initialise(ipu3_uapi_params &params, const Size &bdsOutputSize, struct ipu3_uapi_grid_config &bdsGrid)
+int IPU3Awb::configure(IPAContext &context, const IPAConfigInfo &configInfo)
 {
-	params.use.acc_awb = 1;
-	params.acc_param.awb.config = imguCssAwbDefaults;
+	const Size &bdsOutputSize = configInfo.bdsOutputSize;
 
-	awbGrid_ = bdsGrid;
-	params.acc_param.awb.config.grid = awbGrid_;
+	awbGrid_ = context.configuration.bdsGrid;
 
-	params.use.acc_bnr = 1;
-	params.acc_param.bnr = imguCssBnrDefaults;
+	bnr_ = imguCssBnrDefaults;
 	/**
 	 * Optical center is column (respectively row) startminus X (respectively Y) center.
 	 * For the moment use BDS as a first approximation, but it should
 	 * be calculated based on Shading (SHD) parameters.
 	 */
-	params.acc_param.bnr.column_size = bdsOutputSize.width;
-	params.acc_param.bnr.opt_center.x_reset = awbGrid_.x_start - (bdsOutputSize.width / 2);
-	params.acc_param.bnr.opt_center.y_reset = awbGrid_.y_start - (bdsOutputSize.height / 2);
-	params.acc_param.bnr.opt_center_sqr.x_sqr_reset = params.acc_param.bnr.opt_center.x_reset
-							* params.acc_param.bnr.opt_center.x_reset;
-	params.acc_param.bnr.opt_center_sqr.y_sqr_reset = params.acc_param.bnr.opt_center.y_reset
-							* params.acc_param.bnr.opt_center.y_reset;
+	bnr_.column_size = bdsOutputSize.width;
+	bnr_.opt_center.x_reset = awbGrid_.x_start - (bdsOutputSize.width / 2);
+	bnr_.opt_center.y_reset = awbGrid_.y_start - (bdsOutputSize.height / 2);
+	bnr_.opt_center_sqr.x_sqr_reset = bnr_.opt_center.x_reset
+					* bnr_.opt_center.x_reset;
+	bnr_.opt_center_sqr.y_sqr_reset = bnr_.opt_center.y_reset
+					* bnr_.opt_center.y_reset;
 
-	params.use.acc_ccm = 1;
-	params.acc_param.ccm = imguCssCcmDefault;
-
-	params.use.acc_gamma = 1;
-	params.acc_param.gamma.gc_lut = imguCssGammaLut;
-	params.acc_param.gamma.gc_ctrl.enable = 1;
+	gammaLut_ = imguCssGammaLut;
 
+	zones_.clear();
 	zones_.reserve(kAwbStatsSizeX * kAwbStatsSizeY);
+
+	/* Start from neutral gains for the new configuration. */
+	asyncResults_.blueGain = 1.0;
+	asyncResults_.greenGain = 1.0;
+	asyncResults_.redGain = 1.0;
+	asyncResults_.temperatureK = 4500;
+
+	return 0;
+}
+
+void IPU3Awb::prepare(IPAContext &context, [[maybe_unused]] uint32_t frame,
+		      [[maybe_unused]] IPAFrameContext &frameContext,
+		      ipu3_uapi_params *params)
+{
+	if (context.agc.updateControls)
+		updateWbParameters(context.agc.gamma);
+
+	params->use.acc_awb = 1;
+	params->acc_param.awb.config = imguCssAwbDefaults;
+	params->acc_param.awb.config.grid = awbGrid_;
+
+	params->use.acc_bnr = 1;
+	params->acc_param.bnr = bnr_;
+
+	/* The CCM matrix may change when color temperature will be used */
+	params->use.acc_ccm = 1;
+	params->acc_param.ccm = imguCssCcmDefault;
+
+	params->use.acc_gamma = 1;
+	params->acc_param.gamma.gc_lut = gammaLut_;
+	params->acc_param.gamma.gc_ctrl.enable = 1;
+}
+
+void IPU3Awb::process([[maybe_unused]] IPAContext &context,
+		      [[maybe_unused]] uint32_t frame,
+		      IPAFrameContext &frameContext,
+		      const ipu3_uapi_stats_3a *stats)
+{
+	ASSERT(stats->stats_3a_status.awb_en);
+	calculateWBGains(frameContext.stats);
+
+	frameContext.awb.redGain = asyncResults_.redGain;
+	frameContext.awb.blueGain = asyncResults_.blueGain;
+	frameContext.awb.temperatureK = asyncResults_.temperatureK;
 }
 
 /**
@@ -235,66 +219,22 @@ uint32_t IPU3Awb::estimateCCT(double red, double green, double blue)
 }
 
 /* Generate an RGB vector with the average values for each region */
-void IPU3Awb::generateZones(std::vector<RGB> &zones)
+void IPU3Awb::generateZones(const IPU3Statistics &stats, std::vector<RGB> &zones)
 {
-	for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
+	for (const IspStatsRegion &region : stats.awbRegions) {
 		RGB zone;
-		double counted = awbStats_[i].counted;
+		double counted = region.counted;
 		if (counted >= kMinZonesCounted) {
-			zone.G = awbStats_[i].gSum / counted;
+			zone.G = region.gSum / counted;
 			if (zone.G >= kMinGreenLevelInZone) {
-				zone.R = awbStats_[i].rSum / counted;
-				zone.B = awbStats_[i].bSum / counted;
+				zone.R = region.rSum / counted;
+				zone.B = region.bSum / counted;
 				zones.push_back(zone);
 			}
 		}
 	}
 }
 
-/* Translate the IPU3 statistics into the default statistics region array */
-void IPU3Awb::generateAwbStats(const ipu3_uapi_stats_3a *stats)
-{
-	uint32_t regionWidth = round(awbGrid_.width / static_cast<double>(kAwbStatsSizeX));
-	uint32_t regionHeight = round(awbGrid_.height / static_cast<double>(kAwbStatsSizeY));
-
-	/*
-	 * Generate a (kAwbStatsSizeX x kAwbStatsSizeY) array from the IPU3 grid which is
-	 * (awbGrid_.width x awbGrid_.height).
-	 */
-	for (unsigned int j = 0; j < kAwbStatsSizeY * regionHeight; j++) {
-		for (unsigned int i = 0; i < kAwbStatsSizeX * regionWidth; i++) {
-			uint32_t cellPosition = j * awbGrid_.width + i;
-			uint32_t cellX = (cellPosition / regionWidth) % kAwbStatsSizeX;
-			uint32_t cellY = ((cellPosition / awbGrid_.width) / regionHeight) % kAwbStatsSizeY;
-
-			uint32_t awbRegionPosition = cellY * kAwbStatsSizeX + cellX;
-			cellPosition *= 8;
-
-			/* Cast the initial IPU3 structure to simplify the reading */
-			Ipu3AwbCell *currentCell = reinterpret_cast<Ipu3AwbCell *>(const_cast<uint8_t *>(&stats->awb_raw_buffer.meta_data[cellPosition]));
-			if (currentCell->satRatio == 0) {
-				/* The cell is not saturated, use the current cell */
-				awbStats_[awbRegionPosition].counted++;
-				uint32_t greenValue = currentCell->greenRedAvg + currentCell->greenBlueAvg;
-				awbStats_[awbRegionPosition].gSum += greenValue / 2;
-				awbStats_[awbRegionPosition].rSum += currentCell->redAvg;
-				awbStats_[awbRegionPosition].bSum += currentCell->blueAvg;
-			}
-		}
-	}
-}
-
-void IPU3Awb::clearAwbStats()
-{
-	for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
-		awbStats_[i].bSum = 0;
-		awbStats_[i].rSum = 0;
-		awbStats_[i].gSum = 0;
-		awbStats_[i].counted = 0;
-		awbStats_[i].uncounted = 0;
-	}
-}
-
 void IPU3Awb::awbGreyWorld()
 {
 	LOG(IPU3Awb, Debug) << "Grey world AWB";
@@ -335,13 +275,10 @@ void IPU3Awb::awbGreyWorld()
 	asyncResults_.blueGain = blueGain;
 }
 
-void IPU3Awb::calculateWBGains(const ipu3_uapi_stats_3a *stats)
+void IPU3Awb::calculateWBGains(const IPU3Statistics &stats)
 {
-	ASSERT(stats->stats_3a_status.awb_en);
 	zones_.clear();
-	clearAwbStats();
-	generateAwbStats(stats);
-	generateZones(zones_);
+	generateZones(stats, zones_);
 	LOG(IPU3Awb, Debug) << "Valid zones: " << zones_.size();
 	if (zones_.size() > 10) {
 		awbGreyWorld();
@@ -350,29 +287,26 @@ void IPU3Awb::calculateWBGains(const ipu3_uapi_stats_3a *stats)
 	}
 }
 
-void IPU3Awb::updateWbParameters(ipu3_uapi_params &params, double agcGamma)
+void IPU3Awb::updateWbParameters(double agcGamma)
 {
 	/*
 	 * Green gains should not be touched and considered 1.
 	 * Default is 16, so do not change it at all.
 	 * 4096 is the value for a gain of 1.0
 	 */
-	params.acc_param.bnr.wb_gains.gr = 16;
-	params.acc_param.bnr.wb_gains.r = 4096 * asyncResults_.redGain;
-	params.acc_param.bnr.wb_gains.b = 4096 * asyncResults_.blueGain;
-	params.acc_param.bnr.wb_gains.gb = 16;
+	bnr_.wb_gains.gr = 16;
+	bnr_.wb_gains.r = 4096 * asyncResults_.redGain;
+	bnr_.wb_gains.b = 4096 * asyncResults_.blueGain;
+	bnr_.wb_gains.gb = 16;
 
 	LOG(IPU3Awb, Debug) << "Color temperature estimated: " << asyncResults_.temperatureK
 			    << " and gamma calculated: " << agcGamma;
 
-	/* The CCM matrix may change when color temperature will be used */
-	params.acc_param.ccm = imguCssCcmDefault;
-
 	for (uint32_t i = 0; i < 256; i++) {
 		double j = i / 255.0;
 		double gamma = std::pow(j, 1.0 / agcGamma);
 		/* The maximum value 255 is represented on 13 bits in the IPU3 */
-		params.acc_param.gamma.gc_lut.lut[i] = gamma * 8191;
+		gammaLut_.lut[i] = gamma * 8191;
 	}
 }
 
@@ -13,36 +13,27 @@
 
 #include <libcamera/geometry.h>
 
-#include "libipa/algorithm.h"
+#include "ipa_context.h"
 
 namespace libcamera {
 
 namespace ipa::ipu3 {
 
-/* Region size for the statistics generation algorithm */
-static constexpr uint32_t kAwbStatsSizeX = 16;
-static constexpr uint32_t kAwbStatsSizeY = 12;
-
-class IPU3Awb : public Algorithm
+class IPU3Awb : public ipa::Algorithm<Module>
 {
 public:
 	IPU3Awb();
 	~IPU3Awb();
 
-	void initialise(ipu3_uapi_params &params, const Size &bdsOutputSize, struct ipu3_uapi_grid_config &bdsGrid);
-	void calculateWBGains(const ipu3_uapi_stats_3a *stats);
-	void updateWbParameters(ipu3_uapi_params &params, double agcGamma);
+	const char *name() const override { return "IPU3Awb"; }
 
-	struct Ipu3AwbCell {
-		unsigned char greenRedAvg;
-		unsigned char redAvg;
-		unsigned char blueAvg;
-		unsigned char greenBlueAvg;
-		unsigned char satRatio;
-		unsigned char padding[3];
-	} __attribute__((packed));
+	int configure(IPAContext &context, const IPAConfigInfo &configInfo) override;
+	void prepare(IPAContext &context, uint32_t frame, IPAFrameContext &frameContext,
+		     ipu3_uapi_params *params) override;
+	void process(IPAContext &context, uint32_t frame, IPAFrameContext &frameContext,
+		     const ipu3_uapi_stats_3a *stats) override;
 
-	/* \todo Make these three structs available to all the ISPs ? */
+	/* \todo Make these two structs available to all the ISPs ? */
 	struct RGB {
 		RGB(double _R = 0, double _G = 0, double _B = 0)
 			: R(_R), G(_G), B(_B)
@@ -56,14 +47,6 @@ public:
 		}
 	};
 
-	struct IspStatsRegion {
-		unsigned int counted;
-		unsigned int uncounted;
-		unsigned long long rSum;
-		unsigned long long gSum;
-		unsigned long long bSum;
-	};
-
 	struct AwbStatus {
 		double temperatureK;
 		double redGain;
@@ -72,16 +55,19 @@ public:
 	};
 
 private:
-	void generateZones(std::vector<RGB> &zones);
-	void generateAwbStats(const ipu3_uapi_stats_3a *stats);
-	void clearAwbStats();
+	void calculateWBGains(const IPU3Statistics &stats);
+	void updateWbParameters(double agcGamma);
+	void generateZones(const IPU3Statistics &stats, std::vector<RGB> &zones);
 	void awbGreyWorld();
 	uint32_t estimateCCT(double red, double green, double blue);
 
 	struct ipu3_uapi_grid_config awbGrid_;
 
+	/* ISP parameters, updated when the AGC produces new settings. */
+	struct ipu3_uapi_bnr_static_config bnr_;
+	struct ipu3_uapi_gamma_corr_lut gammaLut_;
+
 	std::vector<RGB> zones_;
-	IspStatsRegion awbStats_[kAwbStatsSizeX * kAwbStatsSizeY];
 	AwbStatus asyncResults_;
 };
 
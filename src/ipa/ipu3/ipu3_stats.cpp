@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipu3_stats.cpp - IPU3 3A statistics parser
+ */
+
+#include "ipu3_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+/**
+ * \struct Ipu3AwbCell
+ * \brief Memory layout for each cell in AWB metadata
+ *
+ * The Ipu3AwbCell structure is used to get individual values
+ * such as red average or saturation ratio in a particular cell.
+ *
+ * \var Ipu3AwbCell::greenRedAvg
+ * \brief Green average for red lines in the cell
+ *
+ * \var Ipu3AwbCell::redAvg
+ * \brief Red average in the cell
+ *
+ * \var Ipu3AwbCell::blueAvg
+ * \brief blue average in the cell
+ *
+ * \var Ipu3AwbCell::greenBlueAvg
+ * \brief Green average for blue lines
+ *
+ * \var Ipu3AwbCell::satRatio
+ * \brief Saturation ratio in the cell
+ *
+ * \var Ipu3AwbCell::padding
+ * \brief array of unused bytes for padding
+ */
+
+/**
+ * \struct IspStatsRegion
+ * \brief RGB statistics for a given region
+ *
+ * The IspStatsRegion structure is intended to abstract the ISP specific
+ * statistics and use an agnostic algorithm to compute AWB.
+ *
+ * \var IspStatsRegion::counted
+ * \brief Number of pixels used to calculate the sums
+ *
+ * \var IspStatsRegion::rSum
+ * \brief Sum of the red values in the region
+ *
+ * \var IspStatsRegion::gSum
+ * \brief Sum of the green values in the region
+ *
+ * \var IspStatsRegion::bSum
+ * \brief Sum of the blue values in the region
+ */
+
+/**
+ * \struct IPU3Statistics
+ * \brief Statistics extracted from the IPU3 3A statistics buffer
+ *
+ * The AWB and AGC algorithms both consume the AWB cells of the 3A statistics
+ * grid. The IPU3Statistics structure gathers the data they need in a single
+ * pass over the grid, so that the statistics buffer is read only once per
+ * frame.
+ *
+ * \var IPU3Statistics::awbRegions
+ * \brief Sums of the unsaturated cells, for a (kAwbStatsSizeX x
+ * kAwbStatsSizeY) array of regions covering the grid
+ *
+ * \var IPU3Statistics::histogram
+ * \brief Histogram of the green level of the unsaturated cells
+ */
+
+/**
+ * \brief Parse the AWB cells of the 3A statistics
+ * \param[in] grid The statistics grid configuration
+ * \param[in] stats The 3A statistics buffer
+ *
+ * The \a grid shall be the one the ISP has been configured with. The grid
+ * reported in the statistics buffer is not reliable: we observed a bit shift
+ * which makes the width value 160 to be 32.
+ */
+void IPU3Statistics::parse(const ipu3_uapi_grid_config &grid,
+			   const ipu3_uapi_stats_3a *stats)
+{
+	awbRegions.fill({});
+	histogram.fill(0);
+
+	/*
+	 * Generate a (kAwbStatsSizeX x kAwbStatsSizeY) array of regions. The
+	 * cells beyond the last full region are only accounted for in the
+	 * histogram.
+	 */
+	uint32_t regionWidth = std::max<uint32_t>(round(grid.width / static_cast<double>(kAwbStatsSizeX)), 1);
+	uint32_t regionHeight = std::max<uint32_t>(round(grid.height / static_cast<double>(kAwbStatsSizeY)), 1);
+	uint32_t awbWidth = std::min<uint32_t>(grid.width, kAwbStatsSizeX * regionWidth);
+	uint32_t awbHeight = std::min<uint32_t>(grid.height, kAwbStatsSizeY * regionHeight);
+
+	const Ipu3AwbCell *cells =
+		reinterpret_cast<const Ipu3AwbCell *>(stats->awb_raw_buffer.meta_data);
+
+	for (uint32_t y = 0; y < grid.height; y++) {
+		const Ipu3AwbCell *row = &cells[y * grid.width];
+		uint32_t x = 0;
+
+		if (y < awbHeight) {
+			IspStatsRegion *region = &awbRegions[(y / regionHeight) * kAwbStatsSizeX];
+
+			for (uint32_t regionEnd = regionWidth; x < awbWidth;
+			     regionEnd += regionWidth, region++) {
+				for (; x < std::min(regionEnd, awbWidth); x++) {
+					const Ipu3AwbCell &cell = row[x];
+					if (cell.satRatio)
+						continue;
+
+					uint32_t green = (cell.greenRedAvg + cell.greenBlueAvg) / 2;
+					histogram[green]++;
+
+					region->counted++;
+					region->gSum += green;
+					region->rSum += cell.redAvg;
+					region->bSum += cell.blueAvg;
+				}
+			}
+		}
+
+		for (; x < grid.width; x++) {
+			const Ipu3AwbCell &cell = row[x];
+			if (!cell.satRatio)
+				histogram[(cell.greenRedAvg + cell.greenBlueAvg) / 2]++;
+		}
+	}
+}
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
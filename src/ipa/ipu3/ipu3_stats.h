@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipu3_stats.h - IPU3 3A statistics parser
+ */
+#ifndef __LIBCAMERA_IPU3_STATS_H__
+#define __LIBCAMERA_IPU3_STATS_H__
+
+#include <array>
+#include <stdint.h>
+
+#include <linux/intel-ipu3.h>
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+/* Region size for the statistics generation algorithm */
+static constexpr uint32_t kAwbStatsSizeX = 16;
+static constexpr uint32_t kAwbStatsSizeY = 12;
+
+/* Number of bins of the brightness histogram */
+static constexpr uint32_t kNumHistogramBins = 256;
+
+struct Ipu3AwbCell {
+	unsigned char greenRedAvg;
+	unsigned char redAvg;
+	unsigned char blueAvg;
+	unsigned char greenBlueAvg;
+	unsigned char satRatio;
+	unsigned char padding[3];
+} __attribute__((packed));
+
+struct IspStatsRegion {
+	unsigned int counted;
+	unsigned long long rSum;
+	unsigned long long gSum;
+	unsigned long long bSum;
+};
+
+struct IPU3Statistics {
+	void parse(const ipu3_uapi_grid_config &grid,
+		   const ipu3_uapi_stats_3a *stats);
+
+	std::array<IspStatsRegion, kAwbStatsSizeX * kAwbStatsSizeY> awbRegions;
+	std::array<uint32_t, kNumHistogramBins> histogram;
+};
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPU3_STATS_H__ */
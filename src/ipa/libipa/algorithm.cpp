@@ -26,13 +26,67 @@ namespace ipa {
 /**
  * \class Algorithm
  * \brief The base class for all IPA algorithms
+ * \tparam Module The IPA module type for this class of algorithms
  *
  * The Algorithm class defines a standard interface for IPA algorithms. By
  * abstracting algorithms, it makes possible the implementation of generic code
  * to manage algorithms regardless of their specific type.
+ *
+ * Algorithms are grouped and run by a Module, which defines the types of the
+ * contexts, configuration, ISP parameters and statistics they operate on. All
+ * algorithm operations are optional, the default implementations do nothing.
+ */
+
+/**
+ * \fn Algorithm::name()
+ * \brief Retrieve the algorithm name
+ *
+ * The name identifies the algorithm in log messages and timing reports.
+ *
+ * \return The algorithm name
+ */
+
+/**
+ * \fn Algorithm::configure()
+ * \brief Configure the Algorithm given an IPA configuration
+ * \param[in] context The shared IPA context
+ * \param[in] config The IPA configuration data, received from the pipeline
+ * handler
+ *
+ * This function is called when the IPA module is configured, before any
+ * frame is processed. Algorithms shall store the configuration data they
+ * need to share with other algorithms in the \a context, and reset their
+ * internal state.
+ *
+ * \return 0 if successful, or a negative error code otherwise
  */
 
-Algorithm::~Algorithm() = default;
+/**
+ * \fn Algorithm::prepare()
+ * \brief Fill the \a params buffer with ISP processing parameters for a frame
+ * \param[in] context The shared IPA context
+ * \param[in] frame The frame sequence number
+ * \param[in] frameContext The context of the frame
+ * \param[out] params The ISP specific parameters
+ *
+ * This function is called for every frame, before the ISP processes it.
+ * Algorithms shall fill in the parameter structure fields they are
+ * responsible for.
+ */
+
+/**
+ * \fn Algorithm::process()
+ * \brief Process ISP statistics, and run algorithm operations
+ * \param[in] context The shared IPA context
+ * \param[in] frame The frame sequence number
+ * \param[in] frameContext The context of the frame
+ * \param[in] stats The IPA statistics and ISP results
+ *
+ * This function is called for every frame when the ISP statistics are
+ * available. Algorithms shall store the results they compute for the frame
+ * in the \a frameContext, and the results other algorithms depend on in the
+ * \a context.
+ */
 
 } /* namespace ipa */
 
@@ -7,14 +7,39 @@
 #ifndef __LIBCAMERA_IPA_LIBIPA_ALGORITHM_H__
 #define __LIBCAMERA_IPA_LIBIPA_ALGORITHM_H__
 
+#include <stdint.h>
+
 namespace libcamera {
 
 namespace ipa {
 
+template<typename Module>
 class Algorithm
 {
 public:
-	virtual ~Algorithm();
+	virtual ~Algorithm() = default;
+
+	virtual const char *name() const = 0;
+
+	virtual int configure([[maybe_unused]] typename Module::Context &context,
+			      [[maybe_unused]] const typename Module::Config &config)
+	{
+		return 0;
+	}
+
+	virtual void prepare([[maybe_unused]] typename Module::Context &context,
+			     [[maybe_unused]] uint32_t frame,
+			     [[maybe_unused]] typename Module::FrameContext &frameContext,
+			     [[maybe_unused]] typename Module::Params *params)
+	{
+	}
+
+	virtual void process([[maybe_unused]] typename Module::Context &context,
+			     [[maybe_unused]] uint32_t frame,
+			     [[maybe_unused]] typename Module::FrameContext &frameContext,
+			     [[maybe_unused]] const typename Module::Stats *stats)
+	{
+	}
 };
 
 } /* namespace ipa */
@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * buffer_registry.cpp - Registry of buffers mapped by IPA modules
+ */
+
+#include "buffer_registry.h"
+
+#include <string.h>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/framebuffer.h>
+
+/**
+ * \file buffer_registry.h
+ * \brief Registry of buffers mapped by IPA modules
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPABufferRegistry)
+
+namespace ipa {
+
+/**
+ * \class BufferRegistry
+ * \brief Keep the buffers shared by a pipeline handler mapped in an IPA module
+ *
+ * Pipeline handlers share parameters and statistics buffers with their IPA
+ * module through the IPAInterface mapBuffers() function, and then reference
+ * them by numerical ID for every frame. The BufferRegistry maps the buffers
+ * once when they are registered with map(), and keeps the mappings until the
+ * buffers are unregistered with unmap(). The mappings are populated when they
+ * are created, so the first frame doesn't pay the page faults cost either.
+ *
+ * Planes that share a dmabuf are mapped once, as for MappedFrameBuffer.
+ *
+ * The mappings may be cached on non-coherent platforms. CPU accesses to the
+ * buffers shall be performed within the scope of an Access instance, which
+ * synchronizes the CPU caches with the device:
+ *
+ * \code{.cpp}
+ * BufferRegistry::Access access(buffers_, bufferId,
+ *			      MappedFrameBuffer::MapFlag::Read);
+ * const struct stats *stats = access.data<const struct stats>();
+ * if (!stats)
+ *	return;
+ *
+ * parseStatistics(stats);
+ * \endcode
+ */
+
+/**
+ * \class BufferRegistry::Access
+ * \brief Scope of a CPU access to a registered buffer
+ *
+ * The Access class starts a CPU access to a buffer of a BufferRegistry when
+ * constructed, and ends it when destroyed, synchronizing the CPU caches as
+ * required by the access type. Only one Access to a given buffer may exist at
+ * a time.
+ */
+
+/**
+ * \brief Start a CPU access to a registered buffer
+ * \param[in] registry The buffer registry
+ * \param[in] id The buffer ID
+ * \param[in] access The type of access, MapFlag::Read, MapFlag::Write or both
+ *
+ * The caller shall check that the access is valid with isValid() before
+ * accessing the buffer memory.
+ */
+BufferRegistry::Access::Access(BufferRegistry &registry, unsigned int id,
+			       MappedFrameBuffer::MapFlags access)
+	: buffer_(nullptr)
+{
+	auto it = registry.buffers_.find(id);
+	if (it == registry.buffers_.end()) {
+		LOG(IPABufferRegistry, Error) << "Buffer " << id << " not mapped";
+		return;
+	}
+
+	if (it->second.beginCpuAccess(access) < 0)
+		return;
+
+	buffer_ = &it->second;
+}
+
+BufferRegistry::Access::~Access()
+{
+	if (buffer_)
+		buffer_->endCpuAccess();
+}
+
+/**
+ * \fn BufferRegistry::Access::isValid()
+ * \brief Check if the CPU access has been started
+ * \return True if the buffer exists and the CPU access has been started, false
+ * otherwise
+ */
+
+/**
+ * \brief Retrieve the memory of a plane of the buffer
+ * \param[in] index The plane index
+ * \return The plane memory, or an empty span if the access is invalid or the
+ * plane doesn't exist
+ */
+Span<uint8_t> BufferRegistry::Access::plane(unsigned int index) const
+{
+	if (!buffer_ || index >= buffer_->maps().size())
+		return {};
+
+	return buffer_->maps()[index];
+}
+
+/**
+ * \fn BufferRegistry::Access::data()
+ * \brief Retrieve the memory of the first plane of the buffer as a \a T
+ * \tparam T The type of the buffer contents
+ * \return A pointer to the buffer memory, or nullptr if the access is invalid
+ * or the first plane is smaller than \a T
+ */
+
+/**
+ * \brief Construct an empty BufferRegistry
+ * \param[in] flags The protection flags of the buffer mappings
+ */
+BufferRegistry::BufferRegistry(MappedFrameBuffer::MapFlags flags)
+	: flags_(flags)
+{
+}
+
+/**
+ * \brief Register and map buffers
+ * \param[in] buffers The buffers to register
+ *
+ * Buffers whose ID is already registered are replaced.
+ *
+ * \return 0 on success or a negative error code if any of the buffers failed
+ * to be mapped
+ */
+int BufferRegistry::map(const std::vector<IPABuffer> &buffers)
+{
+	int ret = 0;
+
+	for (const IPABuffer &buffer : buffers) {
+		const FrameBuffer fb(buffer.planes);
+		MappedFrameBuffer mapped(&fb, flags_ | MappedFrameBuffer::MapFlag::Populate);
+		if (!mapped.isValid()) {
+			LOG(IPABufferRegistry, Error)
+				<< "Failed to map buffer " << buffer.id << ": "
+				<< strerror(-mapped.error());
+			ret = mapped.error();
+			continue;
+		}
+
+		buffers_.erase(buffer.id);
+		buffers_.emplace(buffer.id, std::move(mapped));
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Unregister and unmap buffers
+ * \param[in] ids The IDs of the buffers to unregister
+ *
+ * Unknown IDs are ignored.
+ */
+void BufferRegistry::unmap(const std::vector<unsigned int> &ids)
+{
+	for (unsigned int id : ids)
+		buffers_.erase(id);
+}
+
+/**
+ * \brief Unregister and unmap all buffers
+ */
+void BufferRegistry::clear()
+{
+	buffers_.clear();
+}
+
+/**
+ * \brief Check if a buffer is registered
+ * \param[in] id The buffer ID
+ * \return True if the buffer with ID \a id is registered, false otherwise
+ */
+bool BufferRegistry::contains(unsigned int id) const
+{
+	return buffers_.find(id) != buffers_.end();
+}
+
+/**
+ * \brief Retrieve the memory of a plane of a registered buffer
+ * \param[in] id The buffer ID
+ * \param[in] index The plane index
+ *
+ * This function gives access to the buffer memory without synchronizing the
+ * CPU caches. It is meant for buffers that are not written by the device, or
+ * for platforms where the caller handles coherency otherwise. Use Access for
+ * all other cases.
+ *
+ * \return The plane memory, or an empty span if the buffer or plane doesn't
+ * exist
+ */
+Span<uint8_t> BufferRegistry::plane(unsigned int id, unsigned int index) const
+{
+	auto it = buffers_.find(id);
+	if (it == buffers_.end() || index >= it->second.maps().size())
+		return {};
+
+	return it->second.maps()[index];
+}
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * buffer_registry.h - Registry of buffers mapped by IPA modules
+ */
+#ifndef __LIBCAMERA_IPA_LIBIPA_BUFFER_REGISTRY_H__
+#define __LIBCAMERA_IPA_LIBIPA_BUFFER_REGISTRY_H__
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/span.h>
+
+#include <libcamera/ipa/core_ipa_interface.h>
+
+#include "libcamera/internal/mapped_framebuffer.h"
+
+namespace libcamera {
+
+namespace ipa {
+
+class BufferRegistry
+{
+public:
+	class Access
+	{
+	public:
+		Access(BufferRegistry &registry, unsigned int id,
+		       MappedFrameBuffer::MapFlags access);
+		~Access();
+
+		bool isValid() const { return buffer_ != nullptr; }
+		Span<uint8_t> plane(unsigned int index = 0) const;
+
+		template<typename T>
+		T *data() const
+		{
+			Span<uint8_t> mem = plane(0);
+			if (mem.size() < sizeof(T))
+				return nullptr;
+			return reinterpret_cast<T *>(mem.data());
+		}
+
+	private:
+		LIBCAMERA_DISABLE_COPY_AND_MOVE(Access)
+
+		MappedFrameBuffer *buffer_;
+	};
+
+	BufferRegistry(MappedFrameBuffer::MapFlags flags = MappedFrameBuffer::MapFlag::ReadWrite);
+
+	int map(const std::vector<IPABuffer> &buffers);
+	void unmap(const std::vector<unsigned int> &ids);
+	void clear();
+
+	bool contains(unsigned int id) const;
+	Span<uint8_t> plane(unsigned int id, unsigned int index = 0) const;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(BufferRegistry)
+
+	MappedFrameBuffer::MapFlags flags_;
+	std::map<unsigned int, MappedFrameBuffer> buffers_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_LIBIPA_BUFFER_REGISTRY_H__ */
@@ -7,6 +7,8 @@
  */
 #include "camera_sensor_helper.h"
 
+#include <algorithm>
+
 #include <libcamera/base/log.h>
 
 /**
@@ -28,6 +30,13 @@ LOG_DEFINE_CATEGORY(CameraSensorHelper)
 
 namespace ipa {
 
+namespace {
+
+/* Maximum number of gain codes stored in the lookup table */
+constexpr uint32_t kMaxGainCodes = 4096;
+
+} /* namespace */
+
 /**
  * \class CameraSensorHelper
  * \brief Base class for computing sensor tuning parameters using
@@ -54,10 +63,22 @@ namespace ipa {
  * The parameters come from the MIPI Alliance Camera Specification for
  * Camera Command Set (CCS).
  *
+ * When a gain code table has been prepared with prepareGainCodes(), the gain
+ * is quantized to the largest code in the table whose gain doesn't exceed
+ * \a gain, or to the smallest code if no such code exists.
+ *
  * \return The gain code to pass to V4L2
  */
 uint32_t CameraSensorHelper::gainCode(double gain) const
 {
+	if (!gains_.empty()) {
+		auto it = std::upper_bound(gains_.begin(), gains_.end(), gain);
+		if (it == gains_.begin())
+			return minGainCode_;
+
+		return minGainCode_ + (it - gains_.begin()) - 1;
+	}
+
 	ASSERT(analogueGainConstants_.m0 == 0 || analogueGainConstants_.m1 == 0);
 	ASSERT(analogueGainConstants_.type == AnalogueGainLinear);
 
@@ -80,6 +101,9 @@ uint32_t CameraSensorHelper::gainCode(double gain) const
  */
 double CameraSensorHelper::gain(uint32_t gainCode) const
 {
+	if (gainCode >= minGainCode_ && gainCode - minGainCode_ < gains_.size())
+		return gains_[gainCode - minGainCode_];
+
 	ASSERT(analogueGainConstants_.m0 == 0 || analogueGainConstants_.m1 == 0);
 	ASSERT(analogueGainConstants_.type == AnalogueGainLinear);
 
@@ -87,6 +111,51 @@ double CameraSensorHelper::gain(uint32_t gainCode) const
 	       (analogueGainConstants_.m1 * static_cast<double>(gainCode) + analogueGainConstants_.c1);
 }
 
+/**
+ * \brief Precompute the gains of a range of gain codes
+ * \param[in] minCode The minimum gain code supported by the sensor
+ * \param[in] maxCode The maximum gain code supported by the sensor
+ *
+ * Build a table of the real gains for all gain codes in the [\a minCode,
+ * \a maxCode] range, typically the limits of the V4L2 analogue gain control
+ * retrieved when configuring the IPA. Once the table is prepared, gain() is a
+ * table lookup and gainCode() a binary search in the table, which is cheaper
+ * than evaluating the gain model in the AGC loops and guarantees that the
+ * computed gain codes are within the sensor limits.
+ *
+ * The table isn't built, and the gain model is evaluated for every call, if
+ * the range is too large or if the gain doesn't increase monotonically with
+ * the gain code.
+ */
+void CameraSensorHelper::prepareGainCodes(uint32_t minCode, uint32_t maxCode)
+{
+	gains_.clear();
+
+	if (maxCode < minCode || maxCode - minCode >= kMaxGainCodes) {
+		LOG(CameraSensorHelper, Debug)
+			<< "Not building gain table for codes "
+			<< minCode << "-" << maxCode;
+		return;
+	}
+
+	std::vector<double> gains;
+	gains.reserve(maxCode - minCode + 1);
+
+	for (uint32_t code = minCode; code <= maxCode; ++code) {
+		double value = gain(code);
+		if (!gains.empty() && value <= gains.back()) {
+			LOG(CameraSensorHelper, Warning)
+				<< "Gain isn't monotonic at code " << code;
+			return;
+		}
+
+		gains.push_back(value);
+	}
+
+	minGainCode_ = minCode;
+	gains_ = std::move(gains);
+}
+
 /**
  * \enum CameraSensorHelper::AnalogueGainType
  * \brief The gain calculation modes as defined by the MIPI CCS
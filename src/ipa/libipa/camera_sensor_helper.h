@@ -28,6 +28,8 @@ public:
 	virtual uint32_t gainCode(double gain) const;
 	virtual double gain(uint32_t gainCode) const;
 
+	void prepareGainCodes(uint32_t minCode, uint32_t maxCode);
+
 protected:
 	enum AnalogueGainType {
 		AnalogueGainLinear,
@@ -46,6 +48,9 @@ protected:
 
 private:
 	LIBCAMERA_DISABLE_COPY_AND_MOVE(CameraSensorHelper)
+
+	uint32_t minGainCode_ = 0;
+	std::vector<double> gains_;
 };
 
 class CameraSensorHelperFactory
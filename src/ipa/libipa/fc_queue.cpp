@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * fc_queue.cpp - IPA frame context queue
+ */
+
+#include "fc_queue.h"
+
+/**
+ * \file fc_queue.h
+ * \brief Queue of per-frame contexts
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(FCQueue)
+
+namespace ipa {
+
+/**
+ * \class FCQueue
+ * \brief A ring of preallocated per-frame contexts
+ * \tparam FrameContext The frame context type
+ *
+ * IPA modules need to keep the state of an algorithm for a frame from the
+ * time the ISP parameters are computed for it until its statistics have been
+ * processed, and the pipeline usually has several frames in flight. The
+ * FCQueue stores one context for each of the last \a size frames, indexed by
+ * frame sequence number.
+ *
+ * All contexts are allocated when the queue is constructed. Allocating a
+ * context for a frame resets the slot it occupies in the ring to a default
+ * constructed FrameContext, which doesn't allocate memory as long as the
+ * FrameContext type doesn't. The queue must be at least as large as the
+ * number of frames in flight in the pipeline, or contexts will be reused
+ * before the frames they belong to complete.
+ */
+
+/**
+ * \fn FCQueue::FCQueue()
+ * \brief Construct a frame context queue of a given size
+ * \param[in] size The number of frame contexts in the queue
+ */
+
+/**
+ * \fn FCQueue::clear()
+ * \brief Mark all frame contexts as free
+ *
+ * This function shall be called when the IPA module restarts streaming, as
+ * frame sequence numbers restart from zero.
+ */
+
+/**
+ * \fn FCQueue::alloc()
+ * \brief Allocate the context of a frame
+ * \param[in] frame The frame sequence number
+ *
+ * The frame context slot for \a frame is reset and associated with \a frame,
+ * discarding the context of the frame that previously occupied it.
+ *
+ * \return A reference to the frame context
+ */
+
+/**
+ * \fn FCQueue::get()
+ * \brief Retrieve the context of a frame
+ * \param[in] frame The frame sequence number
+ *
+ * If no context has been allocated for \a frame, one is allocated.
+ *
+ * \return A reference to the frame context
+ */
+
+/**
+ * \fn FCQueue::size()
+ * \brief Retrieve the number of frame contexts in the queue
+ * \return The queue size
+ */
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * fc_queue.h - IPA frame context queue
+ */
+#ifndef __LIBCAMERA_IPA_LIBIPA_FC_QUEUE_H__
+#define __LIBCAMERA_IPA_LIBIPA_FC_QUEUE_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(FCQueue)
+
+namespace ipa {
+
+template<typename FrameContext>
+class FCQueue
+{
+public:
+	FCQueue(unsigned int size)
+		: contexts_(size), frames_(size)
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		for (Entry &frame : frames_)
+			frame = { false, 0 };
+	}
+
+	FrameContext &alloc(uint32_t frame)
+	{
+		unsigned int index = frame % contexts_.size();
+
+		contexts_[index] = {};
+		frames_[index] = { true, frame };
+
+		return contexts_[index];
+	}
+
+	FrameContext &get(uint32_t frame)
+	{
+		unsigned int index = frame % contexts_.size();
+
+		if (frames_[index].valid && frames_[index].frame == frame)
+			return contexts_[index];
+
+		LOG(FCQueue, Debug)
+			<< "Context for frame " << frame << " not allocated";
+
+		return alloc(frame);
+	}
+
+	unsigned int size() const { return contexts_.size(); }
+
+private:
+	struct Entry {
+		bool valid;
+		uint32_t frame;
+	};
+
+	std::vector<FrameContext> contexts_;
+	std::vector<Entry> frames_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_LIBIPA_FC_QUEUE_H__ */
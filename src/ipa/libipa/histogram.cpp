@@ -6,7 +6,7 @@
  */
 #include "histogram.h"
 
-#include <cmath>
+#include <algorithm>
 
 #include <libcamera/base/log.h>
 
@@ -26,18 +26,29 @@ namespace ipa {
  * This class stores a cumulative frequency histogram, which is a mapping that
  * counts the cumulative number of observations in all of the bins up to the
  * specified bin. It can be used to find quantiles and averages between quantiles.
+ *
+ * A second cumulative table of the bin-weighted frequencies is stored
+ * alongside, so that quantiles and inter-quantile means are computed in
+ * logarithmic time without walking the bins.
  */
 
 /**
  * \brief Create a cumulative histogram
  * \param[in] data A pre-sorted histogram to be passed
  */
-Histogram::Histogram(Span<uint32_t> data)
+Histogram::Histogram(Span<const uint32_t> data)
 {
-	cumulative_.reserve(data.size());
-	cumulative_.push_back(0);
-	for (const uint32_t &value : data)
-		cumulative_.push_back(cumulative_.back() + value);
+	cumulative_.resize(data.size() + 1);
+	weighted_.resize(data.size() + 1);
+
+	uint64_t cumulative = 0;
+	uint64_t weighted = 0;
+	for (size_t i = 0; i < data.size(); i++) {
+		cumulative += data[i];
+		weighted += static_cast<uint64_t>(data[i]) * i;
+		cumulative_[i + 1] = cumulative;
+		weighted_[i + 1] = weighted;
+	}
 }
 
 /**
@@ -108,7 +119,8 @@ double Histogram::quantile(double q, uint32_t first, uint32_t last) const
 	if (cumulative_[first + 1] == cumulative_[first])
 		frac = 0;
 	else
-		frac = (item - cumulative_[first]) / (cumulative_[first + 1] - cumulative_[first]);
+		frac = static_cast<double>(item - cumulative_[first]) /
+		       (cumulative_[first + 1] - cumulative_[first]);
 	return first + frac;
 }
 
@@ -130,20 +142,34 @@ double Histogram::interQuantileMean(double lowQuantile, double highQuantile) con
 	double lowPoint = quantile(lowQuantile);
 	/* Proportion of pixels which lies below highQuantile */
 	double highPoint = quantile(highQuantile, static_cast<uint32_t>(lowPoint));
-	double sumBinFreq = 0, cumulFreq = 0;
-
-	for (double p_next = floor(lowPoint) + 1.0;
-	     p_next <= ceil(highPoint);
-	     lowPoint = p_next, p_next += 1.0) {
-		int bin = floor(lowPoint);
-		double freq = (cumulative_[bin + 1] - cumulative_[bin])
-			* (std::min(p_next, highPoint) - lowPoint);
-
-		/* Accumulate weigthed bin */
-		sumBinFreq += bin * freq;
-		/* Accumulate weights */
-		cumulFreq += freq;
+
+	/*
+	 * The bins between the two points are weighted by the fraction of
+	 * them that lies within the range. Only the first and last bins can
+	 * be partial, the contribution of all bins in-between is taken from
+	 * the cumulative tables.
+	 */
+	uint32_t lowBin = std::min<uint32_t>(lowPoint, bins() - 1);
+	uint32_t highBin = highPoint;
+	auto frequency = [&](uint32_t bin) {
+		return static_cast<double>(cumulative_[bin + 1] - cumulative_[bin]);
+	};
+
+	double sumBinFreq, cumulFreq;
+	if (lowBin == highBin) {
+		cumulFreq = frequency(lowBin) * (highPoint - lowPoint);
+		sumBinFreq = lowBin * cumulFreq;
+	} else {
+		double lowFreq = frequency(lowBin) * (lowBin + 1 - lowPoint);
+		double highFreq = highBin < bins()
+				? frequency(highBin) * (highPoint - highBin) : 0;
+
+		cumulFreq = lowFreq + highFreq +
+			    (cumulative_[highBin] - cumulative_[lowBin + 1]);
+		sumBinFreq = lowBin * lowFreq + highBin * highFreq +
+			     (weighted_[highBin] - weighted_[lowBin + 1]);
 	}
+
 	/* add 0.5 to give an average for bin mid-points */
 	return sumBinFreq / cumulFreq + 0.5;
 }
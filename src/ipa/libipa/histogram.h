@@ -22,7 +22,7 @@ namespace ipa {
 class Histogram
 {
 public:
-	Histogram(Span<uint32_t> data);
+	Histogram(Span<const uint32_t> data);
 	size_t bins() const { return cumulative_.size() - 1; }
 	uint64_t total() const { return cumulative_[cumulative_.size() - 1]; }
 	uint64_t cumulativeFrequency(double bin) const;
@@ -31,6 +31,7 @@ public:
 
 private:
 	std::vector<uint64_t> cumulative_;
+	std::vector<uint64_t> weighted_;
 };
 
 } /* namespace ipa */
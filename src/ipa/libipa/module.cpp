@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * module.cpp - IPA algorithm pipeline
+ */
+
+#include "module.h"
+
+/**
+ * \file module.h
+ * \brief IPA module algorithm pipeline
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPAAlgorithms)
+
+namespace ipa {
+
+/**
+ * \class Module
+ * \brief The pipeline of algorithms of an IPA module
+ * \tparam _Context The type of the shared IPA context
+ * \tparam _FrameContext The type of the per-frame context
+ * \tparam _Config The type of the IPA configuration data
+ * \tparam _Params The type of the ISP parameters buffer
+ * \tparam _Stats The type of the ISP statistics buffer
+ *
+ * The Module groups the algorithms of an IPA module and runs them in the
+ * order they have been added, for each of the configure, prepare and process
+ * operations. It stores a per-frame context for the last frames in an FCQueue,
+ * passed to the algorithms along with the shared IPA context, so that state
+ * specific to a frame can be kept across the prepare and process operations
+ * without any allocation at runtime.
+ *
+ * The time spent in each algorithm is recorded for every prepare and process
+ * operation, and can be retrieved with timing() or logged with logTimings().
+ *
+ * IPA modules typically define the Module for their types, and derive their
+ * algorithms from the corresponding Algorithm:
+ *
+ * \code{.cpp}
+ * using Module = ipa::Module<IPAContext, IPAFrameContext, IPAConfigInfo,
+ *                            ipu3_uapi_params, ipu3_uapi_stats_3a>;
+ *
+ * class Agc : public ipa::Algorithm<Module>
+ * {
+ *         ...
+ * };
+ * \endcode
+ */
+
+/**
+ * \typedef Module::Context
+ * \brief The type of the shared IPA context
+ */
+
+/**
+ * \typedef Module::FrameContext
+ * \brief The type of the per-frame context
+ */
+
+/**
+ * \typedef Module::Config
+ * \brief The type of the IPA configuration data
+ */
+
+/**
+ * \typedef Module::Params
+ * \brief The type of the ISP parameters buffer
+ */
+
+/**
+ * \typedef Module::Stats
+ * \brief The type of the ISP statistics buffer
+ */
+
+/**
+ * \struct Module::Timing
+ * \brief Processing time statistics for an algorithm
+ *
+ * \var Module::Timing::prepare
+ * \brief Time spent in Algorithm::prepare()
+ *
+ * \var Module::Timing::process
+ * \brief Time spent in Algorithm::process()
+ */
+
+/**
+ * \fn Module::Module()
+ * \brief Construct a Module
+ * \param[in] frameContexts The number of frame contexts to preallocate
+ */
+
+/**
+ * \fn Module::addAlgorithm()
+ * \brief Add an algorithm at the end of the pipeline
+ * \param[in] algorithm The algorithm
+ */
+
+/**
+ * \fn Module::algorithms()
+ * \brief Retrieve the algorithms in the pipeline
+ * \return The list of algorithms, in execution order
+ */
+
+/**
+ * \fn Module::configure()
+ * \brief Configure all algorithms
+ * \param[in] context The shared IPA context
+ * \param[in] config The IPA configuration data
+ *
+ * All frame contexts are freed, and the algorithms are configured in order.
+ * Configuration stops at the first algorithm that fails.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+
+/**
+ * \fn Module::alloc()
+ * \brief Allocate the context of a frame
+ * \param[in] frame The frame sequence number
+ *
+ * This function shall be called when the IPA module is notified of a new
+ * frame, before running any algorithm for it.
+ *
+ * \return A reference to the frame context
+ */
+
+/**
+ * \fn Module::frameContext()
+ * \brief Retrieve the context of a frame
+ * \param[in] frame The frame sequence number
+ * \return A reference to the frame context
+ */
+
+/**
+ * \fn Module::prepare()
+ * \brief Run the prepare operation of all algorithms for a frame
+ * \param[in] context The shared IPA context
+ * \param[in] frame The frame sequence number
+ * \param[out] params The ISP parameters buffer
+ */
+
+/**
+ * \fn Module::process()
+ * \brief Run the process operation of all algorithms for a frame
+ * \param[in] context The shared IPA context
+ * \param[in] frame The frame sequence number
+ * \param[in] stats The ISP statistics buffer
+ */
+
+/**
+ * \fn Module::timing()
+ * \brief Retrieve the processing time statistics of an algorithm
+ * \param[in] index The algorithm index in the pipeline
+ * \return The processing time statistics
+ */
+
+/**
+ * \fn Module::resetTimings()
+ * \brief Reset the processing time statistics of all algorithms
+ */
+
+/**
+ * \fn Module::logTimings()
+ * \brief Log the processing time statistics of all algorithms
+ */
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * module.h - IPA algorithm pipeline
+ */
+#ifndef __LIBCAMERA_IPA_LIBIPA_MODULE_H__
+#define __LIBCAMERA_IPA_LIBIPA_MODULE_H__
+
+#include <chrono>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/latency_stats.h>
+
+#include "algorithm.h"
+#include "fc_queue.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPAAlgorithms)
+
+namespace ipa {
+
+template<typename _Context, typename _FrameContext, typename _Config,
+	 typename _Params, typename _Stats>
+class Module
+{
+public:
+	using Context = _Context;
+	using FrameContext = _FrameContext;
+	using Config = _Config;
+	using Params = _Params;
+	using Stats = _Stats;
+
+	struct Timing {
+		LatencyHistogram prepare;
+		LatencyHistogram process;
+	};
+
+	Module(unsigned int frameContexts)
+		: frameContexts_(frameContexts)
+	{
+	}
+
+	void addAlgorithm(std::unique_ptr<Algorithm<Module>> algorithm)
+	{
+		algorithms_.push_back(std::move(algorithm));
+		timings_.emplace_back();
+	}
+
+	const std::vector<std::unique_ptr<Algorithm<Module>>> &algorithms() const
+	{
+		return algorithms_;
+	}
+
+	int configure(Context &context, const Config &config)
+	{
+		frameContexts_.clear();
+
+		for (auto &algorithm : algorithms_) {
+			int ret = algorithm->configure(context, config);
+			if (ret) {
+				LOG(IPAAlgorithms, Error)
+					<< "Failed to configure " << algorithm->name();
+				return ret;
+			}
+		}
+
+		return 0;
+	}
+
+	FrameContext &alloc(uint32_t frame)
+	{
+		return frameContexts_.alloc(frame);
+	}
+
+	FrameContext &frameContext(uint32_t frame)
+	{
+		return frameContexts_.get(frame);
+	}
+
+	void prepare(Context &context, uint32_t frame, Params *params)
+	{
+		FrameContext &frameContext = frameContexts_.get(frame);
+
+		for (unsigned int i = 0; i < algorithms_.size(); i++) {
+			auto start = std::chrono::steady_clock::now();
+			algorithms_[i]->prepare(context, frame, frameContext, params);
+			timings_[i].prepare.record(std::chrono::steady_clock::now() - start);
+		}
+	}
+
+	void process(Context &context, uint32_t frame, const Stats *stats)
+	{
+		FrameContext &frameContext = frameContexts_.get(frame);
+
+		for (unsigned int i = 0; i < algorithms_.size(); i++) {
+			auto start = std::chrono::steady_clock::now();
+			algorithms_[i]->process(context, frame, frameContext, stats);
+			timings_[i].process.record(std::chrono::steady_clock::now() - start);
+		}
+	}
+
+	const Timing &timing(unsigned int index) const { return timings_[index]; }
+
+	void resetTimings()
+	{
+		for (Timing &timing : timings_) {
+			timing.prepare.reset();
+			timing.process.reset();
+		}
+	}
+
+	void logTimings() const
+	{
+		for (unsigned int i = 0; i < algorithms_.size(); i++) {
+			const Timing &timing = timings_[i];
+
+			LOG(IPAAlgorithms, Debug)
+				<< algorithms_[i]->name() << ": prepare mean "
+				<< timing.prepare.mean().count() / 1000 << "us max "
+				<< timing.prepare.max().count() / 1000 << "us, process mean "
+				<< timing.process.mean().count() / 1000 << "us max "
+				<< timing.process.max().count() / 1000 << "us";
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<Algorithm<Module>>> algorithms_;
+	std::vector<Timing> timings_;
+	FCQueue<FrameContext> frameContexts_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_LIBIPA_MODULE_H__ */
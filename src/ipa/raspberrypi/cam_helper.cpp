@@ -167,21 +167,29 @@ unsigned int CamHelper::MistrustFramesModeSwitch() const
 	return 0;
 }
 
+bool CamHelper::ValidFramesOnRestart() const
+{
+	/*
+	 * Sensors may return bad frames after any stream restart, unless known
+	 * otherwise.
+	 */
+	return false;
+}
+
 void CamHelper::parseEmbeddedData(Span<const uint8_t> buffer,
 				  Metadata &metadata)
 {
-	MdParser::RegisterMap registers;
 	Metadata parsedMetadata;
 
 	if (buffer.empty())
 		return;
 
-	if (parser_->Parse(buffer, registers) != MdParser::Status::OK) {
+	if (parser_->Parse(buffer, registers_) != MdParser::Status::OK) {
 		LOG(IPARPI, Error) << "Embedded data buffer parsing failed";
 		return;
 	}
 
-	PopulateMetadata(registers, parsedMetadata);
+	PopulateMetadata(registers_, parsedMetadata);
 	metadata.Merge(parsedMetadata);
 
 	/*
@@ -65,6 +65,9 @@ namespace RPiController {
 // MistrustFramesModeSwitch(): The number of frames, after a mode switch
 //    (other than start-up), for which control algorithms should not run
 //    (for example, metadata may be unreliable).
+// ValidFramesOnRestart(): Whether the sensor returns valid frames and
+//    metadata straight away when restarted in the same mode. If not, the
+//    mode switch values above also apply to such restarts.
 
 class CamHelper
 {
@@ -91,6 +94,7 @@ public:
 	virtual unsigned int HideFramesModeSwitch() const;
 	virtual unsigned int MistrustFramesStartup() const;
 	virtual unsigned int MistrustFramesModeSwitch() const;
+	virtual bool ValidFramesOnRestart() const;
 
 protected:
 	void parseEmbeddedData(libcamera::Span<const uint8_t> buffer,
@@ -102,6 +106,8 @@ protected:
 	CameraMode mode_;
 
 private:
+	/* Kept across frames to let the parser update the values in place. */
+	MdParser::RegisterMap registers_;
 	bool initialized_;
 	/*
 	 * Smallest difference between the frame length and integration time,
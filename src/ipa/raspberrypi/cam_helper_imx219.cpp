@@ -42,6 +42,7 @@ public:
 	uint32_t GainCode(double gain) const override;
 	double Gain(uint32_t gain_code) const override;
 	unsigned int MistrustFramesModeSwitch() const override;
+	bool ValidFramesOnRestart() const override;
 	bool SensorEmbeddedDataPresent() const override;
 
 private:
@@ -84,6 +85,17 @@ unsigned int CamHelperImx219::MistrustFramesModeSwitch() const
 	return 1;
 }
 
+bool CamHelperImx219::ValidFramesOnRestart() const
+{
+	/*
+	 * The bogus metadata frame is only seen when the sensor mode changes.
+	 * Restarting in the same mode writes unchanged values to the mode
+	 * registers, and the exposure and gain carry over, so frames and
+	 * metadata are valid straight away.
+	 */
+	return true;
+}
+
 bool CamHelperImx219::SensorEmbeddedDataPresent() const
 {
 	return ENABLE_EMBEDDED_DATA;
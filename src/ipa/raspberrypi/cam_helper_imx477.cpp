@@ -82,7 +82,6 @@ double CamHelperImx477::Gain(uint32_t gain_code) const
 
 void CamHelperImx477::Prepare(libcamera::Span<const uint8_t> buffer, Metadata &metadata)
 {
-	MdParser::RegisterMap registers;
 	DeviceStatus deviceStatus;
 
 	if (metadata.Get("device.status", deviceStatus)) {
@@ -43,6 +43,14 @@ public:
 		return controller_->GetGlobalMetadata();
 	}
 
+protected:
+	// Algorithms running calculations in their own thread report the time
+	// they take with this, for the controller's timing statistics.
+	void RecordAsyncTime(std::chrono::nanoseconds time)
+	{
+		controller_->RecordAsyncTime(this, time);
+	}
+
 private:
 	Controller *controller_;
 	bool paused_;
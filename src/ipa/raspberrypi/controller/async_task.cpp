@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * async_task.cpp - asynchronous algorithm jobs run by a shared thread pool
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+#include "async_task.hpp"
+
+using namespace RPiController;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(RPiAsync)
+
+// Maximum number of threads in the pool. A couple of threads are enough to
+// overlap the ALSC and AWB calculations of a camera while keeping the number
+// of mostly idle threads low on multi-camera systems.
+#define MAX_THREADS 2
+
+namespace RPiController {
+
+class AsyncScheduler
+{
+public:
+	static AsyncScheduler &Get()
+	{
+		static AsyncScheduler scheduler;
+		return scheduler;
+	}
+
+	void Queue(AsyncTask *task, AsyncTask::Clock::time_point deadline);
+	bool Finished(AsyncTask const *task);
+	void Cancel(AsyncTask *task);
+
+private:
+	AsyncScheduler();
+	~AsyncScheduler();
+	void workerFunc();
+	AsyncTask *next();
+
+	std::mutex mutex_;
+	// condvar for the workers to wait on for tasks
+	std::condition_variable work_signal_;
+	// condvar to wait on for running tasks to complete
+	std::condition_variable done_signal_;
+	std::vector<AsyncTask *> queue_;
+	std::vector<std::thread> threads_;
+	uint64_t sequence_;
+	bool abort_;
+};
+
+} // namespace RPiController
+
+AsyncScheduler::AsyncScheduler()
+	: sequence_(0), abort_(false)
+{
+	unsigned int count = std::clamp(std::thread::hardware_concurrency(),
+					1U, (unsigned int)MAX_THREADS);
+	for (unsigned int i = 0; i < count; i++)
+		threads_.emplace_back(&AsyncScheduler::workerFunc, this);
+	LOG(RPiAsync, Debug) << "Started " << count << " async threads";
+}
+
+AsyncScheduler::~AsyncScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		abort_ = true;
+	}
+	work_signal_.notify_all();
+	for (auto &thread : threads_)
+		thread.join();
+}
+
+void AsyncScheduler::Queue(AsyncTask *task, AsyncTask::Clock::time_point deadline)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (task->state_ == AsyncTask::State::Queued ||
+		    task->state_ == AsyncTask::State::Running) {
+			LOG(RPiAsync, Warning) << "Task already scheduled";
+			return;
+		}
+		task->state_ = AsyncTask::State::Queued;
+		task->deadline_ = deadline;
+		task->sequence_ = sequence_++;
+		queue_.push_back(task);
+	}
+	work_signal_.notify_one();
+}
+
+bool AsyncScheduler::Finished(AsyncTask const *task)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return task->state_ == AsyncTask::State::Finished;
+}
+
+void AsyncScheduler::Cancel(AsyncTask *task)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (task->state_ == AsyncTask::State::Queued)
+		queue_.erase(std::find(queue_.begin(), queue_.end(), task));
+	done_signal_.wait(lock, [&] {
+		return task->state_ != AsyncTask::State::Running;
+	});
+	task->state_ = AsyncTask::State::Idle;
+}
+
+AsyncTask *AsyncScheduler::next()
+{
+	// The queue only ever holds a few tasks, a linear search will do.
+	auto it = std::min_element(queue_.begin(), queue_.end(),
+				   [](AsyncTask const *a, AsyncTask const *b) {
+					   return std::make_tuple(a->deadline_, -a->priority_, a->sequence_) <
+						  std::make_tuple(b->deadline_, -b->priority_, b->sequence_);
+				   });
+	AsyncTask *task = *it;
+	queue_.erase(it);
+	return task;
+}
+
+void AsyncScheduler::workerFunc()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		work_signal_.wait(lock, [&] {
+			return !queue_.empty() || abort_;
+		});
+		if (abort_)
+			break;
+		AsyncTask *task = next();
+		task->state_ = AsyncTask::State::Running;
+		if (AsyncTask::Clock::now() > task->deadline_)
+			LOG(RPiAsync, Debug) << "Task started after its deadline";
+		lock.unlock();
+		task->func_();
+		lock.lock();
+		task->state_ = AsyncTask::State::Finished;
+		done_signal_.notify_all();
+	}
+}
+
+AsyncTask::AsyncTask(std::function<void()> func, int priority)
+	: func_(std::move(func)), priority_(priority), scheduled_(false),
+	  state_(State::Idle), sequence_(0)
+{
+}
+
+AsyncTask::~AsyncTask()
+{
+	Cancel();
+}
+
+void AsyncTask::Schedule(libcamera::utils::Duration delay)
+{
+	scheduled_ = true;
+	AsyncScheduler::Get().Queue(this, Clock::now() +
+				   std::chrono::duration_cast<Clock::duration>(delay));
+}
+
+bool AsyncTask::Finished() const
+{
+	return AsyncScheduler::Get().Finished(this);
+}
+
+void AsyncTask::Cancel()
+{
+	if (scheduled_)
+		AsyncScheduler::Get().Cancel(this);
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * async_task.hpp - asynchronous algorithm jobs run by a shared thread pool
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include <libcamera/base/utils.h>
+
+// Some algorithms (such as ALSC and AWB) run their calculations outside of the
+// per-frame Prepare and Process calls. Rather than each of them owning a
+// thread, they hold an AsyncTask which they schedule on a thread pool shared by
+// all the algorithms of all the cameras in the process.
+//
+// Queued tasks run in order of their deadline, which is the time at which the
+// algorithm next wants the results, and then of their priority (higher
+// first). A task can only be queued once at a time.
+
+namespace RPiController {
+
+class AsyncTask
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	AsyncTask(std::function<void()> func, int priority = 0);
+	~AsyncTask();
+	AsyncTask(AsyncTask const &) = delete;
+	AsyncTask &operator=(AsyncTask const &) = delete;
+
+	// Queue the task, with its results wanted within the given delay.
+	void Schedule(libcamera::utils::Duration delay);
+	// Return true if the task has run since it was last scheduled.
+	bool Finished() const;
+	// Remove the task from the queue, or wait for it to complete if it is
+	// already running.
+	void Cancel();
+
+private:
+	friend class AsyncScheduler;
+
+	enum class State { Idle, Queued, Running, Finished };
+
+	std::function<void()> func_;
+	int priority_;
+	// Only accessed by the owner, to skip cancelling tasks never scheduled.
+	bool scheduled_;
+	// The following are protected by the scheduler lock.
+	State state_;
+	Clock::time_point deadline_;
+	uint64_t sequence_;
+};
+
+} // namespace RPiController
@@ -5,24 +5,36 @@
  * controller.cpp - ISP controller
  */
 
+#include <algorithm>
+#include <sstream>
+
 #include <libcamera/base/log.h>
 
 #include "algorithm.hpp"
 #include "controller.hpp"
+#include "timing_status.h"
+#include "tuning.hpp"
 
-#include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 using namespace RPiController;
 using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(RPiController)
+LOG_DEFINE_CATEGORY(RPiControllerTiming)
+
+// Number of frames between two reports of the algorithms execution times.
+#define TIMING_REPORT_PERIOD 300
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
 
 Controller::Controller()
-	: switch_mode_called_(false) {}
+	: switch_mode_called_(false), frame_count_(0) {}
 
 Controller::Controller(char const *json_filename)
-	: switch_mode_called_(false)
+	: switch_mode_called_(false), frame_count_(0)
 {
 	Read(json_filename);
 	Initialise();
@@ -33,12 +45,18 @@ Controller::~Controller() {}
 void Controller::Read(char const *filename)
 {
 	boost::property_tree::ptree root;
-	boost::property_tree::read_json(filename, root);
+	ReadTuningFile(filename, root);
 	for (auto const &key_and_value : root) {
 		Algorithm *algo = CreateAlgorithm(key_and_value.first.c_str());
 		if (algo) {
 			algo->Read(key_and_value.second);
 			algorithms_.push_back(AlgorithmPtr(algo));
+			unsigned int period =
+				key_and_value.second.get<unsigned int>("process_period", 1);
+			process_periods_.push_back(std::max(period, 1U));
+			process_phases_.push_back(0);
+			std::lock_guard<std::mutex> lock(timings_mutex_);
+			timings_.emplace_back();
 		} else
 			LOG(RPiController, Warning)
 				<< "No algorithm found for \"" << key_and_value.first << "\"";
@@ -55,29 +73,63 @@ void Controller::Initialise()
 {
 	for (auto &algo : algorithms_)
 		algo->Initialise();
+	ResetTimings();
+	frame_count_ = 0;
 }
 
 void Controller::SwitchMode(CameraMode const &camera_mode, Metadata *metadata)
 {
 	for (auto &algo : algorithms_)
 		algo->SwitchMode(camera_mode, metadata);
+	// Process the first frame in the new mode with all the algorithms.
+	std::fill(process_phases_.begin(), process_phases_.end(), 0);
 	switch_mode_called_ = true;
 }
 
 void Controller::Prepare(Metadata *image_metadata)
 {
 	assert(switch_mode_called_);
-	for (auto &algo : algorithms_)
-		if (!algo->IsPaused())
-			algo->Prepare(image_metadata);
+	nanoseconds total(0);
+	for (unsigned int i = 0; i < algorithms_.size(); i++) {
+		if (algorithms_[i]->IsPaused())
+			continue;
+		auto start = steady_clock::now();
+		algorithms_[i]->Prepare(image_metadata);
+		nanoseconds time = duration_cast<nanoseconds>(steady_clock::now() - start);
+		total += time;
+		std::lock_guard<std::mutex> lock(timings_mutex_);
+		timings_[i].prepare.record(time);
+	}
+	TimingStatus timing_status = {};
+	timing_status.prepare_time = total.count() / 1000.0;
+	image_metadata->Set("timing.status", timing_status);
 }
 
 void Controller::Process(StatisticsPtr stats, Metadata *image_metadata)
 {
 	assert(switch_mode_called_);
-	for (auto &algo : algorithms_)
-		if (!algo->IsPaused())
-			algo->Process(stats, image_metadata);
+	nanoseconds total(0);
+	for (unsigned int i = 0; i < algorithms_.size(); i++) {
+		if (algorithms_[i]->IsPaused())
+			continue;
+		// Skip the frames decimated by the algorithm's process period.
+		unsigned int phase = process_phases_[i];
+		process_phases_[i] = (phase + 1) % process_periods_[i];
+		if (phase)
+			continue;
+		auto start = steady_clock::now();
+		algorithms_[i]->Process(stats, image_metadata);
+		nanoseconds time = duration_cast<nanoseconds>(steady_clock::now() - start);
+		total += time;
+		std::lock_guard<std::mutex> lock(timings_mutex_);
+		timings_[i].process.record(time);
+	}
+	TimingStatus timing_status = {};
+	image_metadata->Get("timing.status", timing_status);
+	timing_status.process_time = total.count() / 1000.0;
+	image_metadata->Set("timing.status", timing_status);
+	if (++frame_count_ % TIMING_REPORT_PERIOD == 0)
+		reportTimings();
 }
 
 Metadata &Controller::GetGlobalMetadata()
@@ -102,3 +154,56 @@ Algorithm *Controller::GetAlgorithm(std::string const &name) const
 	}
 	return nullptr;
 }
+
+std::map<std::string, AlgorithmTiming> Controller::GetTimings() const
+{
+	std::lock_guard<std::mutex> lock(timings_mutex_);
+	std::map<std::string, AlgorithmTiming> timings;
+	for (unsigned int i = 0; i < timings_.size(); i++)
+		timings[algorithms_[i]->Name()] = timings_[i];
+	return timings;
+}
+
+void Controller::ResetTimings()
+{
+	std::lock_guard<std::mutex> lock(timings_mutex_);
+	for (auto &timing : timings_) {
+		timing.prepare.reset();
+		timing.process.reset();
+		timing.async.reset();
+	}
+}
+
+void Controller::RecordAsyncTime(Algorithm const *algo, nanoseconds time)
+{
+	// This is called from the algorithms' own threads.
+	std::lock_guard<std::mutex> lock(timings_mutex_);
+	for (unsigned int i = 0; i < timings_.size(); i++) {
+		if (algorithms_[i].get() == algo) {
+			timings_[i].async.record(time);
+			break;
+		}
+	}
+}
+
+static void report_histogram(std::ostream &stream, char const *name,
+			     libcamera::LatencyHistogram const &histogram)
+{
+	if (!histogram.count())
+		return;
+	stream << " " << name
+	       << " p50 " << histogram.percentile(50).count() / 1000.0
+	       << "us p99 " << histogram.percentile(99).count() / 1000.0
+	       << "us max " << histogram.max().count() / 1000.0 << "us";
+}
+
+void Controller::reportTimings()
+{
+	for (auto const &[name, timing] : GetTimings()) {
+		std::ostringstream ss;
+		report_histogram(ss, "prepare", timing.prepare);
+		report_histogram(ss, "process", timing.process);
+		report_histogram(ss, "async", timing.async);
+		LOG(RPiControllerTiming, Debug) << name << ":" << ss.str();
+	}
+}
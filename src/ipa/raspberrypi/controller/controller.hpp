@@ -10,11 +10,16 @@
 // "control algorithms" (such as AWB etc.) and for running them all in a
 // convenient manner.
 
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <string>
 
 #include <linux/bcm2835-isp.h>
 
+#include <libcamera/latency_stats.h>
+
 #include "camera_mode.h"
 #include "device_status.h"
 #include "metadata.hpp"
@@ -25,10 +30,26 @@ class Algorithm;
 typedef std::unique_ptr<Algorithm> AlgorithmPtr;
 typedef std::shared_ptr<bcm2835_isp_stats> StatisticsPtr;
 
+// Execution time statistics of an algorithm. The async histogram measures the
+// calculations that some algorithms (such as ALSC and AWB) run in their own
+// thread, outside of the per-frame Prepare and Process calls.
+
+struct AlgorithmTiming {
+	libcamera::LatencyHistogram prepare;
+	libcamera::LatencyHistogram process;
+	libcamera::LatencyHistogram async;
+};
+
 // The Controller holds a pointer to some global_metadata, which is how
 // different controllers and control algorithms within them can exchange
 // information. The Prepare function returns a pointer to metadata for this
 // specific image, and which should be passed on to the Process function.
+//
+// To save CPU time at high frame rates, the statistics processing of an
+// algorithm can be decimated with an optional "process_period" entry in its
+// tuning file section, giving the number of frames between two calls to its
+// Process method (1 by default). Prepare still runs on every frame and
+// carries the latest results over to the frames in between.
 
 class Controller
 {
@@ -44,11 +65,21 @@ public:
 	void Process(StatisticsPtr stats, Metadata *image_metadata);
 	Metadata &GetGlobalMetadata();
 	Algorithm *GetAlgorithm(std::string const &name) const;
+	std::map<std::string, AlgorithmTiming> GetTimings() const;
+	void ResetTimings();
+	void RecordAsyncTime(Algorithm const *algo, std::chrono::nanoseconds time);
 
 protected:
+	void reportTimings();
 	Metadata global_metadata_;
 	std::vector<AlgorithmPtr> algorithms_;
 	bool switch_mode_called_;
+	// One entry per algorithm, in the same order as algorithms_.
+	std::vector<AlgorithmTiming> timings_;
+	std::vector<unsigned int> process_periods_;
+	std::vector<unsigned int> process_phases_;
+	mutable std::mutex timings_mutex_;
+	unsigned int frame_count_;
 };
 
 } // namespace RPiController
@@ -7,43 +7,115 @@
 #pragma once
 
 // A simple class for carrying arbitrary metadata, for example about an image.
+//
+// The statuses posted by the control algorithms, listed below with their tags,
+// are stored in dedicated typed slots rather than in the general map. They
+// can be accessed with the string tag like any other metadata, which then
+// only costs a string comparison, or with the typed functions that take no
+// tag at all.
 
 #include <any>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <tuple>
+
+#include "agc_status.h"
+#include "alsc_status.h"
+#include "awb_status.h"
+#include "black_level_status.h"
+#include "ccm_status.h"
+#include "contrast_status.h"
+#include "denoise_status.h"
+#include "device_status.h"
+#include "dpc_status.h"
+#include "focus_status.h"
+#include "geq_status.h"
+#include "lux_status.h"
+#include "noise_status.h"
+#include "sharpen_status.h"
+#include "timing_status.h"
 
 namespace RPiController {
 
+template<typename T>
+struct MetadataTag {
+	static constexpr char const *name = nullptr;
+};
+
+#define RPI_METADATA_TAG(type, tag)                        \
+	template<>                                         \
+	struct MetadataTag<type> {                         \
+		static constexpr char const *name = tag;   \
+	};
+
+RPI_METADATA_TAG(AgcStatus, "agc.status")
+RPI_METADATA_TAG(AlscStatus, "alsc.status")
+RPI_METADATA_TAG(AwbStatus, "awb.status")
+RPI_METADATA_TAG(BlackLevelStatus, "black_level.status")
+RPI_METADATA_TAG(CcmStatus, "ccm.status")
+RPI_METADATA_TAG(ContrastStatus, "contrast.status")
+RPI_METADATA_TAG(DenoiseStatus, "denoise.status")
+RPI_METADATA_TAG(DeviceStatus, "device.status")
+RPI_METADATA_TAG(DpcStatus, "dpc.status")
+RPI_METADATA_TAG(FocusStatus, "focus.status")
+RPI_METADATA_TAG(GeqStatus, "geq.status")
+RPI_METADATA_TAG(LuxStatus, "lux.status")
+RPI_METADATA_TAG(NoiseStatus, "noise.status")
+RPI_METADATA_TAG(SharpenStatus, "sharpen.status")
+RPI_METADATA_TAG(TimingStatus, "timing.status")
+
+#undef RPI_METADATA_TAG
+
 class Metadata
 {
 public:
-	Metadata() = default;
+	Metadata()
+		: slots_(std::make_unique<Slots>())
+	{
+	}
 
 	Metadata(Metadata const &other)
+		: slots_(std::make_unique<Slots>())
 	{
 		std::scoped_lock other_lock(other.mutex_);
 		data_ = other.data_;
+		*slots_ = *other.slots_;
 	}
 
 	Metadata(Metadata &&other)
+		: slots_(std::make_unique<Slots>())
 	{
 		std::scoped_lock other_lock(other.mutex_);
 		data_ = std::move(other.data_);
 		other.data_.clear();
+		std::swap(slots_, other.slots_);
 	}
 
 	template<typename T>
 	void Set(std::string const &tag, T const &value)
 	{
 		std::scoped_lock lock(mutex_);
-		data_[tag] = value;
+		SetLocked(tag, value);
+	}
+
+	template<typename T>
+	void Set(T const &value)
+	{
+		std::scoped_lock lock(mutex_);
+		slot<T>() = value;
 	}
 
 	template<typename T>
 	int Get(std::string const &tag, T &value) const
 	{
 		std::scoped_lock lock(mutex_);
+		if constexpr (HasSlot<T>) {
+			if (tag == MetadataTag<T>::name)
+				return getSlot(value);
+		}
 		auto it = data_.find(tag);
 		if (it == data_.end())
 			return -1;
@@ -51,16 +123,25 @@ public:
 		return 0;
 	}
 
+	template<typename T>
+	int Get(T &value) const
+	{
+		std::scoped_lock lock(mutex_);
+		return getSlot(value);
+	}
+
 	void Clear()
 	{
 		std::scoped_lock lock(mutex_);
 		data_.clear();
+		clearSlots();
 	}
 
 	Metadata &operator=(Metadata const &other)
 	{
 		std::scoped_lock lock(mutex_, other.mutex_);
 		data_ = other.data_;
+		*slots_ = *other.slots_;
 		return *this;
 	}
 
@@ -69,6 +150,10 @@ public:
 		std::scoped_lock lock(mutex_, other.mutex_);
 		data_ = std::move(other.data_);
 		other.data_.clear();
+		// Swap the slots to avoid copying them, and clear the ones
+		// handed back.
+		std::swap(slots_, other.slots_);
+		other.clearSlots();
 		return *this;
 	}
 
@@ -76,6 +161,14 @@ public:
 	{
 		std::scoped_lock lock(mutex_, other.mutex_);
 		data_.merge(other.data_);
+		// As for the map, only take the entries we don't have already.
+		std::apply([&](auto &...mine) {
+			std::apply([&](auto &...theirs) {
+				((!mine && theirs ? (mine = std::move(theirs), theirs.reset())
+						  : void()),
+				 ...);
+			}, *other.slots_);
+		}, *slots_);
 	}
 
 	template<typename T>
@@ -83,16 +176,33 @@ public:
 	{
 		// This allows in-place access to the Metadata contents,
 		// for which you should be holding the lock.
+		if constexpr (HasSlot<T>) {
+			if (tag == MetadataTag<T>::name)
+				return GetLocked<T>();
+		}
 		auto it = data_.find(tag);
 		if (it == data_.end())
 			return nullptr;
 		return std::any_cast<T>(&it->second);
 	}
 
+	template<typename T>
+	T *GetLocked()
+	{
+		std::optional<T> &value = slot<T>();
+		return value ? &*value : nullptr;
+	}
+
 	template<typename T>
 	void SetLocked(std::string const &tag, T const &value)
 	{
 		// Use this only if you're holding the lock yourself.
+		if constexpr (HasSlot<T>) {
+			if (tag == MetadataTag<T>::name) {
+				slot<T>() = value;
+				return;
+			}
+		}
 		data_[tag] = value;
 	}
 
@@ -103,8 +213,50 @@ public:
 	void unlock() { mutex_.unlock(); }
 
 private:
+	using Slots = std::tuple<std::optional<AgcStatus>,
+				 std::optional<AlscStatus>,
+				 std::optional<AwbStatus>,
+				 std::optional<BlackLevelStatus>,
+				 std::optional<CcmStatus>,
+				 std::optional<ContrastStatus>,
+				 std::optional<DenoiseStatus>,
+				 std::optional<DeviceStatus>,
+				 std::optional<DpcStatus>,
+				 std::optional<FocusStatus>,
+				 std::optional<GeqStatus>,
+				 std::optional<LuxStatus>,
+				 std::optional<NoiseStatus>,
+				 std::optional<SharpenStatus>,
+				 std::optional<TimingStatus>>;
+
+	template<typename T>
+	static constexpr bool HasSlot = MetadataTag<T>::name != nullptr;
+
+	template<typename T>
+	std::optional<T> &slot()
+	{
+		return std::get<std::optional<T>>(*slots_);
+	}
+
+	template<typename T>
+	int getSlot(T &value) const
+	{
+		std::optional<T> const &s = std::get<std::optional<T>>(*slots_);
+		if (!s)
+			return -1;
+		value = *s;
+		return 0;
+	}
+
+	void clearSlots()
+	{
+		std::apply([](auto &...s) { (s.reset(), ...); }, *slots_);
+	}
+
 	mutable std::mutex mutex_;
 	std::map<std::string, std::any> data_;
+	// Heap allocated to keep moving metadata as cheap as moving the map.
+	std::unique_ptr<Slots> slots_;
 };
 
 } // namespace RPiController
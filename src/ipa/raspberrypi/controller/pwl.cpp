@@ -5,6 +5,7 @@
  * pwl.cpp - piecewise linear functions
  */
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
@@ -14,6 +15,7 @@ using namespace RPiController;
 
 void Pwl::Read(boost::property_tree::ptree const &params)
 {
+	span_lookup_.clear();
 	for (auto it = params.begin(); it != params.end(); it++) {
 		double x = it->second.get_value<double>();
 		assert(it == params.begin() || x > points_.back().x);
@@ -26,14 +28,18 @@ void Pwl::Read(boost::property_tree::ptree const &params)
 
 void Pwl::Append(double x, double y, const double eps)
 {
-	if (points_.empty() || points_.back().x + eps < x)
+	if (points_.empty() || points_.back().x + eps < x) {
 		points_.push_back(Point(x, y));
+		span_lookup_.clear();
+	}
 }
 
 void Pwl::Prepend(double x, double y, const double eps)
 {
-	if (points_.empty() || points_.front().x - eps > x)
+	if (points_.empty() || points_.front().x - eps > x) {
 		points_.insert(points_.begin(), Point(x, y));
+		span_lookup_.clear();
+	}
 }
 
 Pwl::Interval Pwl::Domain() const
@@ -56,9 +62,8 @@ bool Pwl::Empty() const
 
 double Pwl::Eval(double x, int *span_ptr, bool update_span) const
 {
-	int span = findSpan(x, span_ptr && *span_ptr != -1
-				       ? *span_ptr
-				       : points_.size() / 2 - 1);
+	int span = span_ptr && *span_ptr != -1 ? findSpan(x, *span_ptr)
+					       : initialSpan(x);
 	if (span_ptr && update_span)
 		*span_ptr = span;
 	return points_[span].y +
@@ -66,10 +71,50 @@ double Pwl::Eval(double x, int *span_ptr, bool update_span) const
 		       (points_[span + 1].x - points_[span].x);
 }
 
+int Pwl::initialSpan(double x) const
+{
+	// Without a hint, either start from the lookup table (if there is
+	// one) and walk the last few spans, or binary search the whole Pwl.
+	// Both give the same span as the linear search.
+	if (!span_lookup_.empty()) {
+		double pos = (x - points_[0].x) * lookup_scale_;
+		int cell = pos <= 0 ? 0
+				    : std::min<double>(pos, span_lookup_.size() - 1);
+		return findSpan(x, span_lookup_[cell]);
+	}
+	if (points_.size() < 3)
+		return 0;
+	auto it = std::upper_bound(points_.begin() + 1, points_.end() - 1, x,
+				   [](double v, Point const &p) { return v < p.x; });
+	return it - points_.begin() - 1;
+}
+
+void Pwl::PrepareLookup(unsigned int cells_per_point)
+{
+	span_lookup_.clear();
+	if (points_.size() < 3 || !cells_per_point)
+		return;
+	unsigned int cells = cells_per_point * points_.size();
+	double len = Domain().Len();
+	if (len <= 0)
+		return;
+	lookup_scale_ = cells / len;
+	// Each cell records the span containing its start, so findSpan only
+	// ever needs to walk forwards from there.
+	std::vector<int> lookup(cells);
+	int span = 0;
+	for (unsigned int i = 0; i < cells; i++) {
+		span = findSpan(points_[0].x + i / lookup_scale_, span);
+		lookup[i] = span;
+	}
+	span_lookup_ = std::move(lookup);
+}
+
 int Pwl::findSpan(double x, int span) const
 {
-	// Pwls are generally small, so linear search may well be faster than
-	// binary, though could review this if large PWls start turning up.
+	// Pwls are generally small, so linear search from a nearby hint is
+	// the fast path. Callers without a hint get a binary search or lookup
+	// table instead, see initialSpan().
 	int last_span = points_.size() - 2;
 	// some algorithms may call us with span pointing directly at the last
 	// control point
@@ -102,11 +102,20 @@ public:
 	void MatchDomain(Interval const &domain, bool clip = true,
 			 const double eps = 1e-6);
 	Pwl &operator*=(double d);
+	// Build a table mapping uniform cells of the domain to the span
+	// containing them, so that Eval calls without a span hint start the
+	// search right next to the answer. Worth doing for curves that are
+	// evaluated often at scattered points. Evaluated values are
+	// unchanged. The table is discarded if the control points change.
+	void PrepareLookup(unsigned int cells_per_point = 2);
 	void Debug(FILE *fp = stdout) const;
 
 private:
 	int findSpan(double x, int span) const;
+	int initialSpan(double x) const;
 	std::vector<Point> points_;
+	std::vector<int> span_lookup_;
+	double lookup_scale_ = 0;
 };
 
 } // namespace RPiController
@@ -11,9 +11,10 @@
 
 #include <libcamera/base/log.h>
 
+#include "libipa/histogram.h"
+
 #include "../awb_status.h"
 #include "../device_status.h"
-#include "../histogram.hpp"
 #include "../lux_status.h"
 #include "../metadata.hpp"
 
@@ -21,6 +22,7 @@
 
 using namespace RPiController;
 using namespace libcamera;
+using libcamera::ipa::Histogram;
 using libcamera::utils::Duration;
 
 LOG_DEFINE_CATEGORY(RPiAgc)
@@ -479,14 +481,12 @@ void Agc::housekeepConfig()
 void Agc::fetchCurrentExposure(Metadata *image_metadata)
 {
 	std::unique_lock<Metadata> lock(*image_metadata);
-	DeviceStatus *device_status =
-		image_metadata->GetLocked<DeviceStatus>("device.status");
+	DeviceStatus *device_status = image_metadata->GetLocked<DeviceStatus>();
 	if (!device_status)
 		throw std::runtime_error("Agc: no device metadata");
 	current_.shutter = device_status->shutter_speed;
 	current_.analogue_gain = device_status->analogue_gain;
-	AgcStatus *agc_status =
-		image_metadata->GetLocked<AgcStatus>("agc.status");
+	AgcStatus *agc_status = image_metadata->GetLocked<AgcStatus>();
 	current_.total_exposure = agc_status ? agc_status->total_exposure_value : 0s;
 	current_.total_exposure_no_dg = current_.shutter * current_.analogue_gain;
 }
@@ -541,7 +541,7 @@ static double constraint_compute_gain(AgcConstraint &c, Histogram &h,
 {
 	target_Y = c.Y_target.Eval(c.Y_target.Domain().Clip(lux));
 	target_Y = std::min(EV_GAIN_Y_TARGET_LIMIT, target_Y * ev_gain);
-	double iqm = h.InterQuantileMean(c.q_lo, c.q_hi);
+	double iqm = h.interQuantileMean(c.q_lo, c.q_hi);
 	return (target_Y * NUM_HISTOGRAM_BINS) / iqm;
 }
 
@@ -552,7 +552,7 @@ void Agc::computeGain(bcm2835_isp_stats *statistics, Metadata *image_metadata,
 	lux.lux = 400; // default lux level to 400 in case no metadata found
 	if (image_metadata->Get("lux.status", lux) != 0)
 		LOG(RPiAgc, Warning) << "Agc: no lux level found";
-	Histogram h(statistics->hist[0].g_hist, NUM_HISTOGRAM_BINS);
+	Histogram h(statistics->hist[0].g_hist);
 	double ev_gain = status_.ev * config_.base_ev;
 	// The initial gain and target_Y come from some of the regions. After
 	// that we consider the histogram constraints.
@@ -4,6 +4,7 @@
  *
  * alsc.cpp - ALSC (auto lens shading correction) control algorithm
  */
+#include <algorithm>
 #include <math.h>
 
 #include <libcamera/base/log.h>
@@ -26,20 +27,14 @@ static const int XY = X * Y;
 static const double INSUFFICIENT_DATA = -1.0;
 
 Alsc::Alsc(Controller *controller)
-	: Algorithm(controller)
+	: Algorithm(controller), async_task_(std::bind(&Alsc::asyncFunc, this))
 {
-	async_abort_ = async_start_ = async_started_ = async_finished_ = false;
-	async_thread_ = std::thread(std::bind(&Alsc::asyncFunc, this));
+	async_started_ = false;
 }
 
 Alsc::~Alsc()
 {
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_abort_ = true;
-	}
-	async_signal_.notify_one();
-	async_thread_.join();
+	async_task_.Cancel();
 }
 
 char const *Alsc::Name() const
@@ -149,6 +144,17 @@ void Alsc::Read(boost::property_tree::ptree const &params)
 	read_calibrations(config_.calibrations_Cb, params, "calibrations_Cb");
 	config_.default_ct = params.get<double>("default_ct", 4500.0);
 	config_.threshold = params.get<double>("threshold", 1e-3);
+	std::string solver = params.get<std::string>("solver", "gauss_seidel");
+	if (solver == "red_black")
+		config_.red_black = true;
+	else if (solver == "gauss_seidel")
+		config_.red_black = false;
+	else
+		throw std::runtime_error("Alsc: unknown solver " + solver);
+	config_.single_precision = params.get<int>("single_precision", 0);
+	if (config_.single_precision && !config_.red_black)
+		LOG(RPiAlsc, Warning)
+			<< "single precision requires the red_black solver";
 }
 
 static double get_ct(Metadata *metadata, double default_ct);
@@ -179,11 +185,9 @@ void Alsc::waitForAysncThread()
 {
 	if (async_started_) {
 		async_started_ = false;
-		std::unique_lock<std::mutex> lock(mutex_);
-		sync_signal_.wait(lock, [&] {
-			return async_finished_;
-		});
-		async_finished_ = false;
+		// The results are discarded, so there's no need to run a task
+		// that hasn't started yet.
+		async_task_.Cancel();
 	}
 }
 
@@ -257,7 +261,6 @@ void Alsc::SwitchMode(CameraMode const &camera_mode,
 void Alsc::fetchAsyncResults()
 {
 	LOG(RPiAlsc, Debug) << "Fetch ALSC results";
-	async_finished_ = false;
 	async_started_ = false;
 	memcpy(sync_results_, async_results_, sizeof(sync_results_));
 }
@@ -313,11 +316,9 @@ void Alsc::restartAsync(StatisticsPtr &stats, Metadata *image_metadata)
 	copy_stats(statistics_, stats, alsc_status);
 	frame_phase_ = 0;
 	async_started_ = true;
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_start_ = true;
-	}
-	async_signal_.notify_one();
+	// The results are wanted when the frame period has elapsed.
+	async_task_.Schedule(camera_mode_.line_length *
+			     camera_mode_.min_frame_length * config_.frame_period);
 }
 
 void Alsc::Prepare(Metadata *image_metadata)
@@ -331,11 +332,8 @@ void Alsc::Prepare(Metadata *image_metadata)
 			       : config_.speed;
 	LOG(RPiAlsc, Debug)
 		<< "frame_count " << frame_count_ << " speed " << speed;
-	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if (async_started_ && async_finished_)
-			fetchAsyncResults();
-	}
+	if (async_started_ && async_task_.Finished())
+		fetchAsyncResults();
 	// Apply IIR filter to results and program into the pipeline.
 	double *ptr = (double *)sync_results_,
 	       *pptr = (double *)prev_sync_results_;
@@ -368,23 +366,9 @@ void Alsc::Process(StatisticsPtr &stats, Metadata *image_metadata)
 
 void Alsc::asyncFunc()
 {
-	while (true) {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			async_signal_.wait(lock, [&] {
-				return async_start_ || async_abort_;
-			});
-			async_start_ = false;
-			if (async_abort_)
-				break;
-		}
-		doAlsc();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			async_finished_ = true;
-		}
-		sync_signal_.notify_one();
-	}
+	auto start = std::chrono::steady_clock::now();
+	doAlsc();
+	RecordAsyncTime(std::chrono::steady_clock::now() - start);
 }
 
 void get_cal_table(double ct, std::vector<AlscCalibration> const &calibrations,
@@ -643,6 +627,51 @@ static double gauss_seidel2_SOR(double const M[XY][4], double omega,
 	return max_diff;
 }
 
+// Red-black ordered successive over-relaxation. The cells of one colour only
+// depend on cells of the other colour, so each half sweep has no loop-carried
+// dependency and can be vectorised by the compiler. The coefficients are
+// stored per direction and lambda in a grid padded with zeros, which removes
+// the special cases at the edges. Returns true if the iterations converged.
+template<typename T>
+static bool red_black_SOR(double const M[XY][4], double omega, int n_iter,
+			  double threshold, double lambda[XY])
+{
+	constexpr int PX = X + 2;
+	T m[4][XY];
+	T l[(Y + 2) * PX] = {};
+	for (int i = 0; i < XY; i++) {
+		for (int k = 0; k < 4; k++)
+			m[k][i] = M[i][k];
+		l[(i / X + 1) * PX + i % X + 1] = lambda[i];
+	}
+	bool converged = false;
+	for (int iter = 0; iter < n_iter && !converged; iter++) {
+		T max_diff = 0;
+		for (int colour = 0; colour < 2; colour++) {
+			for (int y = 0; y < Y; y++) {
+				T *row = &l[(y + 1) * PX + 1];
+				T const *m0 = &m[0][y * X], *m1 = &m[1][y * X],
+					*m2 = &m[2][y * X], *m3 = &m[3][y * X];
+				for (int x = (y + colour) & 1; x < X; x += 2) {
+					T v = m0[x] * row[x - PX] + m1[x] * row[x + 1] +
+					      m2[x] * row[x + PX] + m3[x] * row[x - 1];
+					T diff = (v - row[x]) * static_cast<T>(omega);
+					row[x] += diff;
+					max_diff = std::max(max_diff, std::abs(diff));
+				}
+			}
+		}
+		if (max_diff < threshold) {
+			LOG(RPiAlsc, Debug)
+				<< "Stop after " << iter + 1 << " iterations";
+			converged = true;
+		}
+	}
+	for (int i = 0; i < XY; i++)
+		lambda[i] = l[(i / X + 1) * PX + i % X + 1];
+	return converged;
+}
+
 // Normalise the values so that the smallest value is 1.
 static void normalise(double *ptr, size_t n)
 {
@@ -654,11 +683,22 @@ static void normalise(double *ptr, size_t n)
 }
 
 static void run_matrix_iterations(double const C[XY], double lambda[XY],
-				  double const W[XY][4], double omega,
-				  int n_iter, double threshold)
+				  double const W[XY][4], AlscConfig const &config)
 {
 	double M[XY][4];
 	construct_M(C, W, M);
+	if (config.red_black) {
+		if (config.single_precision)
+			red_black_SOR<float>(M, config.omega, config.n_iter,
+					     config.threshold, lambda);
+		else
+			red_black_SOR<double>(M, config.omega, config.n_iter,
+					      config.threshold, lambda);
+		normalise(lambda, XY);
+		return;
+	}
+	double omega = config.omega, threshold = config.threshold;
+	int n_iter = config.n_iter;
 	double last_max_diff = std::numeric_limits<double>::max();
 	for (int i = 0; i < n_iter; i++) {
 		double max_diff = fabs(gauss_seidel2_SOR(M, omega, lambda));
@@ -736,10 +776,8 @@ void Alsc::doAlsc()
 	compute_W(Cr, config_.sigma_Cr, Wr);
 	compute_W(Cb, config_.sigma_Cb, Wb);
 	// Run Gauss-Seidel iterations over the resulting matrix, for R and B.
-	run_matrix_iterations(Cr, lambda_r_, Wr, config_.omega, config_.n_iter,
-			      config_.threshold);
-	run_matrix_iterations(Cb, lambda_b_, Wb, config_.omega, config_.n_iter,
-			      config_.threshold);
+	run_matrix_iterations(Cr, lambda_r_, Wr, config_);
+	run_matrix_iterations(Cb, lambda_b_, Wb, config_);
 	// Fold the calibrated gains into our final lambda values. (Note that on
 	// the next run, we re-start with the lambda values that don't have the
 	// calibration gains included.)
@@ -6,11 +6,8 @@
  */
 #pragma once
 
-#include <mutex>
-#include <condition_variable>
-#include <thread>
-
 #include "../algorithm.hpp"
+#include "../async_task.hpp"
 #include "../alsc_status.h"
 
 namespace RPiController {
@@ -41,6 +38,11 @@ struct AlscConfig {
 	std::vector<AlscCalibration> calibrations_Cb;
 	double default_ct; // colour temperature if no metadata found
 	double threshold; // iteration termination threshold
+	// Use a red-black ordered solver, which the compiler can vectorise,
+	// instead of the sequential Gauss-Seidel one, optionally in single
+	// precision.
+	bool red_black;
+	bool single_precision;
 };
 
 class Alsc : public Algorithm
@@ -61,22 +63,12 @@ private:
 	bool first_time_;
 	CameraMode camera_mode_;
 	double luminance_table_[ALSC_CELLS_X * ALSC_CELLS_Y];
-	std::thread async_thread_;
-	void asyncFunc(); // asynchronous thread function
-	std::mutex mutex_;
-	// condvar for async thread to wait on
-	std::condition_variable async_signal_;
-	// condvar for synchronous thread to wait on
-	std::condition_variable sync_signal_;
-	// for sync thread to check  if async thread finished (requires mutex)
-	bool async_finished_;
-	// for async thread to check if it's been told to run (requires mutex)
-	bool async_start_;
-	// for async thread to check if it's been told to quit (requires mutex)
-	bool async_abort_;
+	// asynchronous calculation, run on the shared thread pool
+	AsyncTask async_task_;
+	void asyncFunc();
 
 	// The following are only for the synchronous thread to use:
-	// for sync thread to note its has asked async thread to run
+	// for sync thread to note its has asked async task to run
 	bool async_started_;
 	// counts up to frame_period before restarting the async thread
 	int frame_phase_;
@@ -87,8 +79,8 @@ private:
 	double sync_results_[3][ALSC_CELLS_Y][ALSC_CELLS_X];
 	double prev_sync_results_[3][ALSC_CELLS_Y][ALSC_CELLS_X];
 	void waitForAysncThread();
-	// The following are for the asynchronous thread to use, though the main
-	// thread can set/reset them if the async thread is known to be idle:
+	// The following are for the asynchronous task to use, though the main
+	// thread can set/reset them if the async task is known to be idle:
 	void restartAsync(StatisticsPtr &stats, Metadata *image_metadata);
 	// copy out the results from the async thread so that it can be restarted
 	void fetchAsyncResults();
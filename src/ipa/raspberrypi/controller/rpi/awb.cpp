@@ -18,6 +18,10 @@ LOG_DEFINE_CATEGORY(RPiAwb)
 
 #define NAME "rpi.awb"
 
+// ALSC uses the colour temperature found by AWB, so run AWB first when both
+// want their results at the same time.
+static constexpr int AwbTaskPriority = 1;
+
 #define AWB_STATS_SIZE_X DEFAULT_AWB_REGIONS_X
 #define AWB_STATS_SIZE_Y DEFAULT_AWB_REGIONS_Y
 
@@ -120,23 +124,19 @@ void AwbConfig::Read(boost::property_tree::ptree const &params)
 }
 
 Awb::Awb(Controller *controller)
-	: AwbAlgorithm(controller)
+	: AwbAlgorithm(controller),
+	  async_task_(std::bind(&Awb::asyncFunc, this), AwbTaskPriority)
 {
-	async_abort_ = async_start_ = async_started_ = async_finished_ = false;
+	async_started_ = false;
+	frame_duration_ = std::chrono::nanoseconds(0);
 	mode_ = nullptr;
 	manual_r_ = manual_b_ = 0.0;
 	first_switch_mode_ = true;
-	async_thread_ = std::thread(std::bind(&Awb::asyncFunc, this));
 }
 
 Awb::~Awb()
 {
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_abort_ = true;
-	}
-	async_signal_.notify_one();
-	async_thread_.join();
+	async_task_.Cancel();
 }
 
 char const *Awb::Name() const
@@ -201,9 +201,9 @@ void Awb::SetManualGains(double manual_r, double manual_b)
 	}
 }
 
-void Awb::SwitchMode([[maybe_unused]] CameraMode const &camera_mode,
-		     Metadata *metadata)
+void Awb::SwitchMode(CameraMode const &camera_mode, Metadata *metadata)
 {
+	frame_duration_ = camera_mode.line_length * camera_mode.min_frame_length;
 	// On the first mode switch we'll have no meaningful colour
 	// temperature, so try to dead reckon one if in manual mode.
 	if (!isAutoEnabled() && first_switch_mode_ && config_.bayes) {
@@ -227,7 +227,6 @@ bool Awb::isAutoEnabled() const
 void Awb::fetchAsyncResults()
 {
 	LOG(RPiAwb, Debug) << "Fetch AWB results";
-	async_finished_ = false;
 	async_started_ = false;
 	// It's possible manual gains could be set even while the async
 	// thread was running, so only copy the results if still in auto mode.
@@ -251,11 +250,8 @@ void Awb::restartAsync(StatisticsPtr &stats, double lux)
 	size_t len = mode_name_.copy(async_results_.mode,
 				     sizeof(async_results_.mode) - 1);
 	async_results_.mode[len] = '\0';
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_start_ = true;
-	}
-	async_signal_.notify_one();
+	// The results are wanted when the frame period has elapsed.
+	async_task_.Schedule(frame_duration_ * config_.frame_period);
 }
 
 void Awb::Prepare(Metadata *image_metadata)
@@ -267,11 +263,8 @@ void Awb::Prepare(Metadata *image_metadata)
 			       : config_.speed;
 	LOG(RPiAwb, Debug)
 		<< "frame_count " << frame_count_ << " speed " << speed;
-	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if (async_started_ && async_finished_)
-			fetchAsyncResults();
-	}
+	if (async_started_ && async_task_.Finished())
+		fetchAsyncResults();
 	// Finally apply IIR filter to results and put into metadata.
 	memcpy(prev_sync_results_.mode, sync_results_.mode,
 	       sizeof(prev_sync_results_.mode));
@@ -315,23 +308,9 @@ void Awb::Process(StatisticsPtr &stats, Metadata *image_metadata)
 
 void Awb::asyncFunc()
 {
-	while (true) {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			async_signal_.wait(lock, [&] {
-				return async_start_ || async_abort_;
-			});
-			async_start_ = false;
-			if (async_abort_)
-				break;
-		}
-		doAwb();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			async_finished_ = true;
-		}
-		sync_signal_.notify_one();
-	}
+	auto start = std::chrono::steady_clock::now();
+	doAwb();
+	RecordAsyncTime(std::chrono::steady_clock::now() - start);
 }
 
 static void generate_stats(std::vector<Awb::RGB> &zones,
@@ -369,20 +348,29 @@ void Awb::prepareStats()
 			zone.B *= config_.sensitivity_b;
 }
 
-double Awb::computeDelta2Sum(double gain_r, double gain_b)
+void Awb::computeDelta2Sums()
 {
 	// Compute the sum of the squared colour error (non-greyness) as it
-	// appears in the log likelihood equation.
-	double delta2_sum = 0;
+	// appears in the log likelihood equation, for all the candidate gains
+	// together. Looping over the candidates innermost lets the compiler
+	// vectorise the calculation, while summing the zones of each candidate
+	// in the same order as one candidate at a time would.
+	size_t count = gains_r_.size();
+	delta2_sums_.assign(count, 0.0);
+	double const *gains_r = gains_r_.data(), *gains_b = gains_b_.data();
+	double *delta2_sums = delta2_sums_.data();
+	double const whitepoint_r = config_.whitepoint_r,
+		     whitepoint_b = config_.whitepoint_b,
+		     delta_limit = config_.delta_limit;
 	for (auto &z : zones_) {
-		double delta_r = gain_r * z.R - 1 - config_.whitepoint_r;
-		double delta_b = gain_b * z.B - 1 - config_.whitepoint_b;
-		double delta2 = delta_r * delta_r + delta_b * delta_b;
-		//LOG(RPiAwb, Debug) << "delta_r " << delta_r << " delta_b " << delta_b << " delta2 " << delta2;
-		delta2 = std::min(delta2, config_.delta_limit);
-		delta2_sum += delta2;
+		double const R = z.R, B = z.B;
+		for (size_t k = 0; k < count; k++) {
+			double delta_r = gains_r[k] * R - 1 - whitepoint_r;
+			double delta_b = gains_b[k] * B - 1 - whitepoint_b;
+			double delta2 = delta_r * delta_r + delta_b * delta_b;
+			delta2_sums[k] += std::min(delta2, delta_limit);
+		}
 	}
-	return delta2_sum;
 }
 
 Pwl Awb::interpolatePrior()
@@ -429,32 +417,40 @@ static double interpolate_quadatric(Pwl::Point const &A, Pwl::Point const &B,
 double Awb::coarseSearch(Pwl const &prior)
 {
 	points_.clear(); // assume doesn't deallocate memory
-	size_t best_point = 0;
+	gains_r_.clear();
+	gains_b_.clear();
 	double t = mode_->ct_lo;
 	int span_r = 0, span_b = 0;
-	// Step down the CT curve evaluating log likelihood.
+	// Step down the CT curve collecting the points to evaluate.
 	while (true) {
 		double r = config_.ct_r.Eval(t, &span_r);
 		double b = config_.ct_b.Eval(t, &span_b);
-		double gain_r = 1 / r, gain_b = 1 / b;
-		double delta2_sum = computeDelta2Sum(gain_r, gain_b);
-		double prior_log_likelihood =
-			prior.Eval(prior.Domain().Clip(t));
-		double final_log_likelihood = delta2_sum - prior_log_likelihood;
-		LOG(RPiAwb, Debug)
-			<< "t: " << t << " gain_r " << gain_r << " gain_b "
-			<< gain_b << " delta2_sum " << delta2_sum
-			<< " prior " << prior_log_likelihood << " final "
-			<< final_log_likelihood;
-		points_.push_back(Pwl::Point(t, final_log_likelihood));
-		if (points_.back().y < points_[best_point].y)
-			best_point = points_.size() - 1;
+		gains_r_.push_back(1 / r);
+		gains_b_.push_back(1 / b);
+		points_.push_back(Pwl::Point(t, 0));
 		if (t == mode_->ct_hi)
 			break;
 		// for even steps along the r/b curve scale them by the current t
 		t = std::min(t + t / 10 * config_.coarse_step,
 			     mode_->ct_hi);
 	}
+	// Evaluate the log likelihood of all the points together.
+	computeDelta2Sums();
+	size_t best_point = 0;
+	int span_prior = 0;
+	for (size_t i = 0; i < points_.size(); i++) {
+		double prior_log_likelihood =
+			prior.Eval(prior.Domain().Clip(points_[i].x), &span_prior);
+		double final_log_likelihood = delta2_sums_[i] - prior_log_likelihood;
+		LOG(RPiAwb, Debug)
+			<< "t: " << points_[i].x << " gain_r " << gains_r_[i]
+			<< " gain_b " << gains_b_[i] << " delta2_sum "
+			<< delta2_sums_[i] << " prior " << prior_log_likelihood
+			<< " final " << final_log_likelihood;
+		points_[i].y = final_log_likelihood;
+		if (points_[i].y < points_[best_point].y)
+			best_point = i;
+	}
 	t = points_[best_point].x;
 	LOG(RPiAwb, Debug) << "Coarse search found CT " << t;
 	// We have the best point of the search, but refine it with a quadratic
@@ -500,44 +496,71 @@ void Awb::fineSearch(double &t, double &r, double &b, Pwl const &prior)
 	// Step down CT curve. March a bit further if the transverse range is
 	// large.
 	nsteps += num_deltas;
+	int num_steps = 2 * nsteps + 1;
+	// Collect the measurements transversely *off* the CT curve for all the
+	// steps, to evaluate them all together.
+	std::vector<double> prior_log_likelihoods(num_steps);
+	std::vector<Pwl::Point> rb_curves(num_steps);
+	gains_r_.clear();
+	gains_b_.clear();
+	int span_prior = -1;
 	for (int i = -nsteps; i <= nsteps; i++) {
 		double t_test = t + i * step;
-		double prior_log_likelihood =
-			prior.Eval(prior.Domain().Clip(t_test));
+		prior_log_likelihoods[i + nsteps] =
+			prior.Eval(prior.Domain().Clip(t_test), &span_prior);
 		double r_curve = config_.ct_r.Eval(t_test, &span_r);
 		double b_curve = config_.ct_b.Eval(t_test, &span_b);
+		rb_curves[i + nsteps] = Pwl::Point(r_curve, b_curve);
+		for (int j = 0; j < num_deltas; j++) {
+			double x = -config_.transverse_neg +
+				   (transverse_range * j) / (num_deltas - 1);
+			Pwl::Point rb_test = rb_curves[i + nsteps] + transverse * x;
+			gains_r_.push_back(1 / rb_test.x);
+			gains_b_.push_back(1 / rb_test.y);
+		}
+	}
+	computeDelta2Sums();
+	// For each step, we have num_deltas points transversely across the CT
+	// curve, now let's do a quadratic interpolation for the best result,
+	// and evaluate all the interpolated points together.
+	std::vector<Pwl::Point> rb_tests(num_steps);
+	for (int s = 0; s < num_steps; s++) {
+		double t_test = t + (s - nsteps) * step;
 		// x will be distance off the curve, y the log likelihood there
 		Pwl::Point points[MAX_NUM_DELTAS];
 		int best_point = 0;
-		// Take some measurements transversely *off* the CT curve.
 		for (int j = 0; j < num_deltas; j++) {
 			points[j].x = -config_.transverse_neg +
 				      (transverse_range * j) / (num_deltas - 1);
-			Pwl::Point rb_test = Pwl::Point(r_curve, b_curve) +
-					     transverse * points[j].x;
-			double r_test = rb_test.x, b_test = rb_test.y;
-			double gain_r = 1 / r_test, gain_b = 1 / b_test;
-			double delta2_sum = computeDelta2Sum(gain_r, gain_b);
-			points[j].y = delta2_sum - prior_log_likelihood;
+			points[j].y = delta2_sums_[s * num_deltas + j] -
+				      prior_log_likelihoods[s];
 			LOG(RPiAwb, Debug)
-				<< "At t " << t_test << " r " << r_test << " b "
-				<< b_test << ": " << points[j].y;
+				<< "At t " << t_test << " r "
+				<< 1 / gains_r_[s * num_deltas + j] << " b "
+				<< 1 / gains_b_[s * num_deltas + j] << ": "
+				<< points[j].y;
 			if (points[j].y < points[best_point].y)
 				best_point = j;
 		}
-		// We have NUM_DELTAS points transversely across the CT curve,
-		// now let's do a quadratic interpolation for the best result.
 		best_point = std::max(1, std::min(best_point, num_deltas - 2));
-		Pwl::Point rb_test =
-			Pwl::Point(r_curve, b_curve) +
-			transverse *
-				interpolate_quadatric(points[best_point - 1],
-						      points[best_point],
-						      points[best_point + 1]);
-		double r_test = rb_test.x, b_test = rb_test.y;
-		double gain_r = 1 / r_test, gain_b = 1 / b_test;
-		double delta2_sum = computeDelta2Sum(gain_r, gain_b);
-		double final_log_likelihood = delta2_sum - prior_log_likelihood;
+		rb_tests[s] = rb_curves[s] +
+			      transverse *
+				      interpolate_quadatric(points[best_point - 1],
+							    points[best_point],
+							    points[best_point + 1]);
+	}
+	gains_r_.clear();
+	gains_b_.clear();
+	for (Pwl::Point const &rb_test : rb_tests) {
+		gains_r_.push_back(1 / rb_test.x);
+		gains_b_.push_back(1 / rb_test.y);
+	}
+	computeDelta2Sums();
+	for (int s = 0; s < num_steps; s++) {
+		double t_test = t + (s - nsteps) * step;
+		double r_test = rb_tests[s].x, b_test = rb_tests[s].y;
+		double final_log_likelihood =
+			delta2_sums_[s] - prior_log_likelihoods[s];
 		LOG(RPiAwb, Debug)
 			<< "Finally "
 			<< t_test << " r " << r_test << " b " << b_test << ": "
@@ -554,7 +577,7 @@ void Awb::fineSearch(double &t, double &r, double &b, Pwl const &prior)
 
 void Awb::awbBayes()
 {
-	// May as well divide out G to save computeDelta2Sum from doing it over
+	// May as well divide out G to save computeDelta2Sums from doing it over
 	// and over.
 	for (auto &z : zones_)
 		z.R = z.R / (z.G + 1), z.B = z.B / (z.G + 1);
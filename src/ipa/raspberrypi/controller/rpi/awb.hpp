@@ -6,10 +6,8 @@
  */
 #pragma once
 
-#include <mutex>
-#include <condition_variable>
-#include <thread>
 
+#include "../async_task.hpp"
 #include "../awb_algorithm.hpp"
 #include "../pwl.hpp"
 #include "../awb_status.h"
@@ -106,31 +104,23 @@ private:
 	bool isAutoEnabled() const;
 	// configuration is read-only, and available to both threads
 	AwbConfig config_;
-	std::thread async_thread_;
-	void asyncFunc(); // asynchronous thread function
-	std::mutex mutex_;
-	// condvar for async thread to wait on
-	std::condition_variable async_signal_;
-	// condvar for synchronous thread to wait on
-	std::condition_variable sync_signal_;
-	// for sync thread to check  if async thread finished (requires mutex)
-	bool async_finished_;
-	// for async thread to check if it's been told to run (requires mutex)
-	bool async_start_;
-	// for async thread to check if it's been told to quit (requires mutex)
-	bool async_abort_;
+	// asynchronous calculation, run on the shared thread pool
+	AsyncTask async_task_;
+	void asyncFunc();
 
 	// The following are only for the synchronous thread to use:
-	// for sync thread to note its has asked async thread to run
+	// for sync thread to note its has asked async task to run
 	bool async_started_;
+	// frame duration of the current mode, to set the async task deadline
+	libcamera::utils::Duration frame_duration_;
 	// counts up to frame_period before restarting the async thread
 	int frame_phase_;
 	int frame_count_; // counts up to startup_frames
 	AwbStatus sync_results_;
 	AwbStatus prev_sync_results_;
 	std::string mode_name_;
-	// The following are for the asynchronous thread to use, though the main
-	// thread can set/reset them if the async thread is known to be idle:
+	// The following are for the asynchronous task to use, though the main
+	// thread can set/reset them if the async task is known to be idle:
 	void restartAsync(StatisticsPtr &stats, double lux);
 	// copy out the results from the async thread so that it can be restarted
 	void fetchAsyncResults();
@@ -142,12 +132,14 @@ private:
 	void awbBayes();
 	void awbGrey();
 	void prepareStats();
-	double computeDelta2Sum(double gain_r, double gain_b);
+	void computeDelta2Sums();
 	Pwl interpolatePrior();
 	double coarseSearch(Pwl const &prior);
 	void fineSearch(double &t, double &r, double &b, Pwl const &prior);
 	std::vector<RGB> zones_;
 	std::vector<Pwl::Point> points_;
+	// candidate gains evaluated together by computeDelta2Sums
+	std::vector<double> gains_r_, gains_b_, delta2_sums_;
 	// manual r setting
 	double manual_r_;
 	// manual b setting
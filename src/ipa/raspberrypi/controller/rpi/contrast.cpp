@@ -8,13 +8,15 @@
 
 #include <libcamera/base/log.h>
 
+#include "libipa/histogram.h"
+
 #include "../contrast_status.h"
-#include "../histogram.hpp"
 
 #include "contrast.hpp"
 
 using namespace RPiController;
 using namespace libcamera;
+using libcamera::ipa::Histogram;
 
 LOG_DEFINE_CATEGORY(RPiContrast)
 
@@ -51,6 +53,8 @@ void Contrast::Read(boost::property_tree::ptree const &params)
 	config_.hi_level = params.get<double>("hi_level", 0.95);
 	config_.hi_max = params.get<double>("hi_max", 2000);
 	config_.gamma_curve.Read(params.get_child("gamma_curve"));
+	// The unmodified gamma curve is copied into every frame's results.
+	config_.gamma_curve.PrepareLookup();
 }
 
 void Contrast::SetBrightness(double brightness)
@@ -68,12 +72,13 @@ static void fill_in_status(ContrastStatus &status, double brightness,
 {
 	status.brightness = brightness;
 	status.contrast = contrast;
+	int span = 0;
 	for (int i = 0; i < CONTRAST_NUM_POINTS - 1; i++) {
 		int x = i < 16 ? i * 1024
 			       : (i < 24 ? (i - 16) * 2048 + 16384
 					 : (i - 24) * 4096 + 32768);
 		status.points[i].x = x;
-		status.points[i].y = std::min(65535.0, gamma_curve.Eval(x));
+		status.points[i].y = std::min(65535.0, gamma_curve.Eval(x, &span));
 	}
 	status.points[CONTRAST_NUM_POINTS - 1].x = 65535;
 	status.points[CONTRAST_NUM_POINTS - 1].y = 65535;
@@ -99,7 +104,7 @@ Pwl compute_stretch_curve(Histogram const &histogram,
 	enhance.Append(0, 0);
 	// If the start of the histogram is rather empty, try to pull it down a
 	// bit.
-	double hist_lo = histogram.Quantile(config.lo_histogram) *
+	double hist_lo = histogram.quantile(config.lo_histogram) *
 			 (65536 / NUM_HISTOGRAM_BINS);
 	double level_lo = config.lo_level * 65536;
 	LOG(RPiContrast, Debug)
@@ -112,12 +117,12 @@ Pwl compute_stretch_curve(Histogram const &histogram,
 	enhance.Append(hist_lo, level_lo);
 	// Keep the mid-point (median) in the same place, though, to limit the
 	// apparent amount of global brightness shift.
-	double mid = histogram.Quantile(0.5) * (65536 / NUM_HISTOGRAM_BINS);
+	double mid = histogram.quantile(0.5) * (65536 / NUM_HISTOGRAM_BINS);
 	enhance.Append(mid, mid);
 
 	// If the top to the histogram is empty, try to pull the pixel values
 	// there up.
-	double hist_hi = histogram.Quantile(config.hi_histogram) *
+	double hist_hi = histogram.quantile(config.hi_histogram) *
 			 (65536 / NUM_HISTOGRAM_BINS);
 	double level_hi = config.hi_level * 65536;
 	LOG(RPiContrast, Debug)
@@ -150,7 +155,7 @@ Pwl apply_manual_contrast(Pwl const &gamma_curve, double brightness,
 void Contrast::Process(StatisticsPtr &stats,
 		       [[maybe_unused]] Metadata *image_metadata)
 {
-	Histogram histogram(stats->hist[0].g_hist, NUM_HISTOGRAM_BINS);
+	Histogram histogram(stats->hist[0].g_hist);
 	// We look at the histogram and adjust the gamma curve in the following
 	// ways: 1. Adjust the gamma curve so as to pull the start of the
 	// histogram down, and possibly push the end up.
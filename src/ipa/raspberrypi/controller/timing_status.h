@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * timing_status.h - Controller algorithms execution time status
+ */
+#pragma once
+
+// The controller measures the time spent by all the algorithms in their
+// Prepare and Process methods for every frame, and reports it in the image
+// metadata. Both values are in microseconds.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct TimingStatus {
+	double prepare_time;
+	double process_time;
+};
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * tuning.cpp - Tuning file loading
+ */
+
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/span.h>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include "tuning.hpp"
+
+using namespace RPiController;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(RPiTuning)
+
+namespace {
+
+// See utils/raspberrypi/compile-tuning.py for a description of the format.
+constexpr char kBinaryMagic[4] = { 'R', 'P', 'T', 'B' };
+constexpr uint32_t kBinaryVersion = 1;
+constexpr unsigned int kMaxDepth = 32;
+
+class BinaryTuningReader
+{
+public:
+	BinaryTuningReader(Span<const uint8_t> data)
+		: data_(data), offset_(0)
+	{
+	}
+
+	void Read(boost::property_tree::ptree &root)
+	{
+		char magic[4];
+		if (!readBytes(magic, sizeof(magic)) ||
+		    memcmp(magic, kBinaryMagic, sizeof(magic)))
+			throw std::runtime_error("Tuning: bad binary file magic");
+
+		uint32_t version;
+		if (!readU32(&version) || version != kBinaryVersion)
+			throw std::runtime_error("Tuning: unsupported binary file version");
+
+		// The key of the root node is empty and ignored.
+		std::string key;
+		readString(key);
+		readNode(root, 0);
+
+		if (offset_ != data_.size())
+			throw std::runtime_error("Tuning: trailing data in binary file");
+	}
+
+private:
+	bool readBytes(void *dst, size_t size)
+	{
+		if (data_.size() - offset_ < size)
+			return false;
+
+		memcpy(dst, data_.data() + offset_, size);
+		offset_ += size;
+		return true;
+	}
+
+	bool readU32(uint32_t *value)
+	{
+		uint8_t bytes[4];
+		if (!readBytes(bytes, sizeof(bytes)))
+			return false;
+
+		*value = bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
+			 static_cast<uint32_t>(bytes[3]) << 24;
+		return true;
+	}
+
+	void readString(std::string &str)
+	{
+		uint32_t length;
+		if (!readU32(&length) || data_.size() - offset_ < length)
+			throw std::runtime_error("Tuning: truncated binary file");
+
+		str.assign(reinterpret_cast<const char *>(data_.data() + offset_),
+			   length);
+		offset_ += length;
+	}
+
+	void readNode(boost::property_tree::ptree &node, unsigned int depth)
+	{
+		if (depth > kMaxDepth)
+			throw std::runtime_error("Tuning: binary file nested too deeply");
+
+		readString(node.data());
+
+		uint32_t count;
+		if (!readU32(&count))
+			throw std::runtime_error("Tuning: truncated binary file");
+
+		// Each child takes at least 12 bytes, reject bogus counts early.
+		if (count > (data_.size() - offset_) / 12)
+			throw std::runtime_error("Tuning: truncated binary file");
+
+		std::string key;
+		for (uint32_t i = 0; i < count; i++) {
+			// Fill the child in place to avoid copying subtrees.
+			readString(key);
+			auto child = node.push_back({ key, boost::property_tree::ptree() });
+			readNode(child->second, depth + 1);
+		}
+	}
+
+	Span<const uint8_t> data_;
+	size_t offset_;
+};
+
+} // namespace
+
+void RPiController::ReadTuningFile(char const *filename,
+				   boost::property_tree::ptree &root)
+{
+	File file(filename);
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		throw std::runtime_error(std::string("Tuning: failed to open ") + filename);
+
+	char magic[sizeof(kBinaryMagic)] = {};
+	if (file.read({ reinterpret_cast<uint8_t *>(magic), sizeof(magic) }) !=
+		    sizeof(magic) ||
+	    memcmp(magic, kBinaryMagic, sizeof(magic))) {
+		file.close();
+		boost::property_tree::read_json(filename, root);
+		return;
+	}
+
+	Span<uint8_t> data = file.map(0, -1, File::MapFlag::Private);
+	if (data.empty())
+		throw std::runtime_error(std::string("Tuning: failed to map ") + filename);
+
+	LOG(RPiTuning, Debug) << "Loading binary tuning file " << filename;
+
+	BinaryTuningReader reader(data);
+	reader.Read(root);
+}
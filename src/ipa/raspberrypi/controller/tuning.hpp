@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * tuning.hpp - Tuning file loading
+ */
+#pragma once
+
+#include <boost/property_tree/ptree.hpp>
+
+namespace RPiController {
+
+// Tuning files are written in JSON. They can also be compiled to a binary
+// representation of the same tree with utils/raspberrypi/compile-tuning.py,
+// which is loaded without parsing any text. The format of the file is detected
+// automatically, and both produce the same tree.
+
+void ReadTuningFile(char const *filename, boost::property_tree::ptree &root);
+
+} // namespace RPiController
@@ -10,6 +10,8 @@
 #include <map>
 #include <optional>
 #include <stdint.h>
+#include <utility>
+#include <vector>
 
 #include <libcamera/base/span.h>
 
@@ -44,6 +46,10 @@
  * (Note that the CamHelper class converts to/from exposure lines and time,
  * and gain_code / actual gain.)
  *
+ * The parser may update the values of a RegisterMap that has been filled by a
+ * previous call to Parse in place, so it is best to keep the same RegisterMap
+ * across frames.
+ *
  * If you suspect your embedded data may have changed its layout, change any line
  * lengths, number of lines, bits per pixel etc. that are different, and
  * then:
@@ -127,8 +133,10 @@ public:
 			       RegisterMap &registers) override;
 
 private:
-	/* Maps register address to offset in the buffer. */
-	using OffsetMap = std::map<uint32_t, std::optional<uint32_t>>;
+	/* Offsets in the buffer of the registers, in the order of registers_. */
+	using OffsetTable = std::vector<std::optional<uint32_t>>;
+	/* Embedded data layout, as bits per pixel and line length in bytes. */
+	using Layout = std::pair<int, unsigned int>;
 
 	/*
 	 * Note that error codes > 0 are regarded as non-fatal; codes < 0
@@ -147,9 +155,16 @@ private:
 		BAD_PADDING   = -5
 	};
 
-	ParseStatus findRegs(libcamera::Span<const uint8_t> buffer);
+	ParseStatus findRegs(libcamera::Span<const uint8_t> buffer,
+			     OffsetTable &offsets);
 
-	OffsetMap offsets_;
+	/* Sorted addresses of the registers to parse. */
+	std::vector<uint32_t> registers_;
+	/*
+	 * Offset tables for the layouts seen so far, to avoid searching the
+	 * buffer again when switching back to a previous sensor mode.
+	 */
+	std::map<Layout, OffsetTable> offsets_;
 };
 
 } // namespace RPi
@@ -5,6 +5,8 @@
  * md_parser_smia.cpp - SMIA specification based embedded data parser
  */
 
+#include <algorithm>
+
 #include <libcamera/base/log.h>
 #include "md_parser.hpp"
 
@@ -28,53 +30,72 @@ constexpr unsigned int REG_VALUE = 0x5a;
 constexpr unsigned int REG_SKIP = 0x55;
 
 MdParserSmia::MdParserSmia(std::initializer_list<uint32_t> registerList)
+	: registers_(registerList)
 {
-	for (auto r : registerList)
-		offsets_[r] = {};
+	std::sort(registers_.begin(), registers_.end());
+	registers_.erase(std::unique(registers_.begin(), registers_.end()),
+			 registers_.end());
 }
 
 MdParser::Status MdParserSmia::Parse(libcamera::Span<const uint8_t> buffer,
 				     RegisterMap &registers)
 {
-	if (reset_) {
+	Layout layout{ bits_per_pixel_, line_length_bytes_ };
+	auto iter = offsets_.find(layout);
+
+	if (reset_ || iter == offsets_.end()) {
 		/*
 		 * Search again through the metadata for all the registers
 		 * requested.
 		 */
 		ASSERT(bits_per_pixel_);
 
-		for (const auto &kv : offsets_)
-			offsets_[kv.first] = {};
-
-		ParseStatus ret = findRegs(buffer);
+		OffsetTable offsets(registers_.size());
+		ParseStatus ret = findRegs(buffer, offsets);
 		/*
 		 * > 0 means "worked partially but parse again next time",
 		 * < 0 means "hard error".
 		 *
 		 * In either case, we retry parsing on the next frame.
 		 */
-		if (ret != PARSE_OK)
+		if (ret != PARSE_OK) {
+			offsets_.erase(layout);
 			return ERROR;
+		}
 
+		iter = offsets_.insert_or_assign(layout, std::move(offsets)).first;
 		reset_ = false;
 	}
 
-	/* Populate the register values requested. */
-	registers.clear();
-	for (const auto &[reg, offset] : offsets_) {
-		if (!offset) {
+	/*
+	 * Populate the register values requested with direct loads from the
+	 * offset table, reusing the map nodes if the map already contains
+	 * the requested registers.
+	 */
+	if (registers.size() != registers_.size() ||
+	    !std::equal(registers_.begin(), registers_.end(), registers.begin(),
+			[](uint32_t reg, const auto &kv) { return reg == kv.first; })) {
+		registers.clear();
+		for (uint32_t reg : registers_)
+			registers[reg] = 0;
+	}
+
+	auto reg = registers.begin();
+	for (const std::optional<uint32_t> &offset : iter->second) {
+		if (!offset || *offset >= buffer.size()) {
 			reset_ = true;
 			return NOTFOUND;
 		}
-		registers[reg] = buffer[offset.value()];
+		(reg++)->second = buffer[*offset];
 	}
 
 	return OK;
 }
 
-MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t> buffer)
+MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t> buffer,
+						 OffsetTable &offsets)
 {
-	ASSERT(offsets_.size());
+	ASSERT(registers_.size());
 
 	if (buffer[0] != LINE_START)
 		return NO_LINE_START;
@@ -133,12 +154,13 @@ MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t>
 			else if (tag == REG_SKIP)
 				reg_num++;
 			else if (tag == REG_VALUE) {
-				auto reg = offsets_.find(reg_num);
+				auto reg = std::lower_bound(registers_.begin(),
+							    registers_.end(), reg_num);
 
-				if (reg != offsets_.end()) {
-					offsets_[reg_num] = current_offset - 1;
+				if (reg != registers_.end() && *reg == reg_num) {
+					offsets[reg - registers_.begin()] = current_offset - 1;
 
-					if (++regs_done == offsets_.size())
+					if (++regs_done == registers_.size())
 						return PARSE_OK;
 				}
 				reg_num++;
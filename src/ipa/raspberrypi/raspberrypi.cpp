@@ -7,8 +7,10 @@
 
 #include <algorithm>
 #include <array>
+#include <deque>
 #include <fcntl.h>
 #include <math.h>
+#include <optional>
 #include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -28,8 +30,11 @@
 #include <libcamera/ipa/raspberrypi_ipa_interface.h>
 #include <libcamera/request.h>
 
+#include "libcamera/internal/control_block.h"
 #include "libcamera/internal/mapped_framebuffer.h"
 
+#include "libipa/buffer_registry.h"
+
 #include "agc_algorithm.hpp"
 #include "agc_status.h"
 #include "alsc_status.h"
@@ -74,19 +79,38 @@ constexpr Duration controllerMinFrameDuration = 1.0s / 60.0;
 
 LOG_DEFINE_CATEGORY(IPARPI)
 
+namespace {
+
+/*
+ * Compare the sensor-related parameters of two camera modes. The transform is
+ * ignored, as flips don't affect the exposure or the validity of the frames.
+ */
+bool sameSensorMode(const CameraMode &a, const CameraMode &b)
+{
+	return a.bitdepth == b.bitdepth &&
+	       a.width == b.width && a.height == b.height &&
+	       a.crop_x == b.crop_x && a.crop_y == b.crop_y &&
+	       a.scale_x == b.scale_x && a.scale_y == b.scale_y &&
+	       a.line_length == b.line_length &&
+	       a.min_frame_length == b.min_frame_length &&
+	       a.max_frame_length == b.max_frame_length;
+}
+
+} /* namespace */
+
 class IPARPi : public ipa::RPi::IPARPiInterface
 {
 public:
 	IPARPi()
-		: controller_(), frameCount_(0), checkCount_(0), mistrustCount_(0),
-		  lastRunTimestamp_(0), lsTable_(nullptr), firstStart_(true)
+		: mode_(), controller_(), frameCount_(0), checkCount_(0), mistrustCount_(0),
+		  lastRunTimestamp_(0), lsTableIndex_(0), firstStart_(true),
+		  modeChanged_(true)
 	{
 	}
 
 	~IPARPi()
 	{
-		if (lsTable_)
-			munmap(lsTable_, ipa::RPi::MaxLsGridSize);
+		unmapLsTables();
 	}
 
 	int init(const IPASettings &settings, ipa::RPi::SensorConfig *sensorConfig) override;
@@ -126,13 +150,15 @@ private:
 	void applySharpen(const struct SharpenStatus *sharpenStatus, ControlList &ctrls);
 	void applyDPC(const struct DpcStatus *dpcStatus, ControlList &ctrls);
 	void applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls);
+	void unmapLsTables();
 	void resampleTable(uint16_t dest[], double const src[12][16], int destW, int destH);
 
-	std::map<unsigned int, MappedFrameBuffer> buffers_;
+	ipa::BufferRegistry buffers_;
 
 	ControlInfoMap sensorCtrls_;
 	ControlInfoMap ispCtrls_;
-	ControlList libcameraMetadata_;
+	ControlBlock libcameraMetadata_;
+	ControlList metadataList_;
 
 	/* Camera sensor params. */
 	CameraMode mode_;
@@ -163,13 +189,32 @@ private:
 	/* Do we run a Controller::process() for this frame? */
 	bool processPending_;
 
-	/* LS table allocation passed in from the pipeline handler. */
-	FileDescriptor lsTableHandle_;
-	void *lsTable_;
+	/*
+	 * Frames prepared for the ISP whose statistics haven't been processed
+	 * yet, when the pipeline handler runs multiple frames concurrently.
+	 * The metadata of the latest prepared frame is stored in rpiMetadata_.
+	 */
+	struct PendingFrame {
+		RPiController::Metadata metadata;
+		bool processPending;
+		uint64_t frameCount;
+	};
+	std::deque<PendingFrame> pendingFrames_;
+
+	/*
+	 * LS table allocations passed in from the pipeline handler, one per
+	 * frame in flight. The tables are written in turn.
+	 */
+	std::vector<FileDescriptor> lsTableHandles_;
+	std::vector<void *> lsTables_;
+	unsigned int lsTableIndex_;
 
 	/* Distinguish the first camera start from others. */
 	bool firstStart_;
 
+	/* Has the sensor mode changed since the previous start? */
+	bool modeChanged_;
+
 	/* Frame duration (1/fps) limits. */
 	Duration minFrameDuration_;
 	Duration maxFrameDuration_;
@@ -240,6 +285,7 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 	 */
 	frameCount_ = 0;
 	checkCount_ = 0;
+	pendingFrames_.clear();
 	if (firstStart_) {
 		dropFrameCount_ = helper_->HideFramesStartup();
 		mistrustCount_ = helper_->MistrustFramesStartup();
@@ -271,9 +317,20 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 
 		dropFrameCount_ = std::max({ dropFrameCount_, agcConvergenceFrames, awbConvergenceFrames });
 		LOG(IPARPI, Debug) << "Drop " << dropFrameCount_ << " frames on startup";
-	} else {
+	} else if (modeChanged_ || !helper_->ValidFramesOnRestart()) {
 		dropFrameCount_ = helper_->HideFramesModeSwitch();
 		mistrustCount_ = helper_->MistrustFramesModeSwitch();
+	} else {
+		/*
+		 * The camera has been restarted in the same sensor mode, for
+		 * instance to reconfigure the ISP outputs for a still capture.
+		 * The algorithms carry their state over, the exposure is
+		 * unchanged and the sensor returns valid frames straight away,
+		 * so there are no frames to hide or mistrust.
+		 */
+		dropFrameCount_ = 0;
+		mistrustCount_ = 0;
+		LOG(IPARPI, Debug) << "Restarting in unchanged sensor mode";
 	}
 
 	startConfig->dropFrameCount = dropFrameCount_;
@@ -358,31 +415,34 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 	}
 
 	/* Setup a metadata ControlList to output metadata. */
-	libcameraMetadata_ = ControlList(controls::controls);
+	libcameraMetadata_.clear();
+	metadataList_ = ControlList(controls::controls);
 
 	/* Re-assemble camera mode using the sensor info. */
+	CameraMode previousMode = mode_;
 	setMode(sensorInfo);
+	modeChanged_ = firstStart_ || !sameSensorMode(previousMode, mode_);
 
 	mode_.transform = static_cast<libcamera::Transform>(ipaConfig.transform);
 
-	/* Store the lens shading table pointer and handle if available. */
-	if (ipaConfig.lsTableHandle.isValid()) {
-		/* Remove any previous table, if there was one. */
-		if (lsTable_) {
-			munmap(lsTable_, ipa::RPi::MaxLsGridSize);
-			lsTable_ = nullptr;
-		}
+	/* Store the lens shading table pointers and handles if available. */
+	if (!ipaConfig.lsTableHandles.empty()) {
+		/* Remove any previous tables, if there were some. */
+		unmapLsTables();
 
-		/* Map the LS table buffer into user space. */
-		lsTableHandle_ = std::move(ipaConfig.lsTableHandle);
-		if (lsTableHandle_.isValid()) {
-			lsTable_ = mmap(nullptr, ipa::RPi::MaxLsGridSize, PROT_READ | PROT_WRITE,
-					MAP_SHARED, lsTableHandle_.fd(), 0);
+		/* Map the LS table buffers into user space. */
+		lsTableHandles_ = std::move(ipaConfig.lsTableHandles);
+		for (const FileDescriptor &handle : lsTableHandles_) {
+			void *table = mmap(nullptr, ipa::RPi::MaxLsGridSize, PROT_READ | PROT_WRITE,
+					   MAP_SHARED, handle.fd(), 0);
 
-			if (lsTable_ == MAP_FAILED) {
+			if (table == MAP_FAILED) {
 				LOG(IPARPI, Error) << "dmaHeap mmap failure for LS table.";
-				lsTable_ = nullptr;
+				unmapLsTables();
+				break;
 			}
+
+			lsTables_.push_back(table);
 		}
 	}
 
@@ -409,34 +469,49 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 
 void IPARPi::mapBuffers(const std::vector<IPABuffer> &buffers)
 {
-	for (const IPABuffer &buffer : buffers) {
-		const FrameBuffer fb(buffer.planes);
-		buffers_.emplace(buffer.id,
-				 MappedFrameBuffer(&fb, MappedFrameBuffer::MapFlag::ReadWrite));
-	}
+	buffers_.map(buffers);
 }
 
 void IPARPi::unmapBuffers(const std::vector<unsigned int> &ids)
 {
-	for (unsigned int id : ids) {
-		auto it = buffers_.find(id);
-		if (it == buffers_.end())
-			continue;
-
-		buffers_.erase(id);
-	}
+	buffers_.unmap(ids);
 }
 
 void IPARPi::signalStatReady(uint32_t bufferId)
 {
-	if (++checkCount_ != frameCount_) /* assert here? */
+	if (++checkCount_ != frameCount_ - pendingFrames_.size()) /* assert here? */
 		LOG(IPARPI, Error) << "WARNING: Prepare/Process mismatch!!!";
-	if (processPending_ && frameCount_ > mistrustCount_)
+
+	/*
+	 * If the next frames have already been prepared, process the
+	 * statistics with the metadata of the frame they belong to, and
+	 * restore the metadata of the latest prepared frame afterwards.
+	 */
+	bool processPending = processPending_;
+	uint64_t frameCount = frameCount_;
+	RPiController::Metadata latestMetadata;
+	bool pipelined = !pendingFrames_.empty();
+
+	if (pipelined) {
+		PendingFrame &frame = pendingFrames_.front();
+		latestMetadata = std::move(rpiMetadata_);
+		rpiMetadata_ = std::move(frame.metadata);
+		processPending = frame.processPending;
+		frameCount = frame.frameCount;
+		pendingFrames_.pop_front();
+	}
+
+	if (processPending && frameCount > mistrustCount_)
 		processStats(bufferId);
 
 	reportMetadata();
 
-	statsMetadataComplete.emit(bufferId & ipa::RPi::MaskID, libcameraMetadata_);
+	if (pipelined)
+		rpiMetadata_ = std::move(latestMetadata);
+
+	metadataList_.clear();
+	libcameraMetadata_.toControlList(metadataList_);
+	statsMetadataComplete.emit(bufferId & ipa::RPi::MaskID, metadataList_);
 }
 
 void IPARPi::signalQueueRequest(const ControlList &controls)
@@ -446,6 +521,13 @@ void IPARPi::signalQueueRequest(const ControlList &controls)
 
 void IPARPi::signalIspPrepare(const ipa::RPi::ISPConfig &data)
 {
+	/*
+	 * If the statistics of the previous frame haven't been processed yet,
+	 * keep its metadata around for signalStatReady().
+	 */
+	if (checkCount_ + pendingFrames_.size() < frameCount_)
+		pendingFrames_.push_back({ rpiMetadata_, processPending_, frameCount_ });
+
 	/*
 	 * At start-up, or after a mode-switch, we may want to
 	 * avoid running the control algos for a few frames in case
@@ -467,7 +549,7 @@ void IPARPi::reportMetadata()
 	 * processed can be extracted and placed into the libcamera metadata
 	 * buffer, where an application could query it.
 	 */
-	DeviceStatus *deviceStatus = rpiMetadata_.GetLocked<DeviceStatus>("device.status");
+	DeviceStatus *deviceStatus = rpiMetadata_.GetLocked<DeviceStatus>();
 	if (deviceStatus) {
 		libcameraMetadata_.set(controls::ExposureTime,
 				       deviceStatus->shutter_speed.get<std::micro>());
@@ -476,24 +558,24 @@ void IPARPi::reportMetadata()
 				       helper_->Exposure(deviceStatus->frame_length).get<std::micro>());
 	}
 
-	AgcStatus *agcStatus = rpiMetadata_.GetLocked<AgcStatus>("agc.status");
+	AgcStatus *agcStatus = rpiMetadata_.GetLocked<AgcStatus>();
 	if (agcStatus) {
 		libcameraMetadata_.set(controls::AeLocked, agcStatus->locked);
 		libcameraMetadata_.set(controls::DigitalGain, agcStatus->digital_gain);
 	}
 
-	LuxStatus *luxStatus = rpiMetadata_.GetLocked<LuxStatus>("lux.status");
+	LuxStatus *luxStatus = rpiMetadata_.GetLocked<LuxStatus>();
 	if (luxStatus)
 		libcameraMetadata_.set(controls::Lux, luxStatus->lux);
 
-	AwbStatus *awbStatus = rpiMetadata_.GetLocked<AwbStatus>("awb.status");
+	AwbStatus *awbStatus = rpiMetadata_.GetLocked<AwbStatus>();
 	if (awbStatus) {
 		libcameraMetadata_.set(controls::ColourGains, { static_cast<float>(awbStatus->gain_r),
 								static_cast<float>(awbStatus->gain_b) });
 		libcameraMetadata_.set(controls::ColourTemperature, awbStatus->temperature_K);
 	}
 
-	BlackLevelStatus *blackLevelStatus = rpiMetadata_.GetLocked<BlackLevelStatus>("black_level.status");
+	BlackLevelStatus *blackLevelStatus = rpiMetadata_.GetLocked<BlackLevelStatus>();
 	if (blackLevelStatus)
 		libcameraMetadata_.set(controls::SensorBlackLevels,
 				       { static_cast<int32_t>(blackLevelStatus->black_level_r),
@@ -501,7 +583,7 @@ void IPARPi::reportMetadata()
 					 static_cast<int32_t>(blackLevelStatus->black_level_g),
 					 static_cast<int32_t>(blackLevelStatus->black_level_b) });
 
-	FocusStatus *focusStatus = rpiMetadata_.GetLocked<FocusStatus>("focus.status");
+	FocusStatus *focusStatus = rpiMetadata_.GetLocked<FocusStatus>();
 	if (focusStatus && focusStatus->num == 12) {
 		/*
 		 * We get a 4x3 grid of regions by default. Calculate the average
@@ -512,7 +594,7 @@ void IPARPi::reportMetadata()
 		libcameraMetadata_.set(controls::FocusFoM, focusFoM);
 	}
 
-	CcmStatus *ccmStatus = rpiMetadata_.GetLocked<CcmStatus>("ccm.status");
+	CcmStatus *ccmStatus = rpiMetadata_.GetLocked<CcmStatus>();
 	if (ccmStatus) {
 		float m[9];
 		for (unsigned int i = 0; i < 9; i++)
@@ -906,6 +988,10 @@ void IPARPi::queueRequest(const ControlList &controls)
 			break;
 		}
 
+		case controls::ZERO_SHUTTER_LAG_TIMESTAMP:
+			/* Handled by the pipeline handler. */
+			break;
+
 		default:
 			LOG(IPARPI, Warning)
 				<< "Ctrl " << controls::controls.at(ctrl.first)->name()
@@ -924,6 +1010,7 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 {
 	int64_t frameTimestamp = data.controls.get(controls::SensorTimestamp);
 	RPiController::Metadata lastMetadata;
+	std::optional<ipa::BufferRegistry::Access> embeddedAccess;
 	Span<uint8_t> embeddedBuffer;
 
 	lastMetadata = std::move(rpiMetadata_);
@@ -934,9 +1021,10 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 		 * Pipeline handler has supplied us with an embedded data buffer,
 		 * we must pass it to the CamHelper for parsing.
 		 */
-		auto it = buffers_.find(data.embeddedBufferId);
-		ASSERT(it != buffers_.end());
-		embeddedBuffer = it->second.maps()[0];
+		ASSERT(buffers_.contains(data.embeddedBufferId));
+		embeddedAccess.emplace(buffers_, data.embeddedBufferId,
+				       MappedFrameBuffer::MapFlag::Read);
+		embeddedBuffer = embeddedAccess->plane();
 	}
 
 	/*
@@ -944,6 +1032,7 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 	 * metadata, and may also do additional custom processing.
 	 */
 	helper_->Prepare(embeddedBuffer, rpiMetadata_);
+	embeddedAccess.reset();
 
 	/* Done with embedded data now, return to pipeline handler asap. */
 	if (data.embeddedBufferPresent)
@@ -974,43 +1063,43 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 	/* Lock the metadata buffer to avoid constant locks/unlocks. */
 	std::unique_lock<RPiController::Metadata> lock(rpiMetadata_);
 
-	AwbStatus *awbStatus = rpiMetadata_.GetLocked<AwbStatus>("awb.status");
+	AwbStatus *awbStatus = rpiMetadata_.GetLocked<AwbStatus>();
 	if (awbStatus)
 		applyAWB(awbStatus, ctrls);
 
-	CcmStatus *ccmStatus = rpiMetadata_.GetLocked<CcmStatus>("ccm.status");
+	CcmStatus *ccmStatus = rpiMetadata_.GetLocked<CcmStatus>();
 	if (ccmStatus)
 		applyCCM(ccmStatus, ctrls);
 
-	AgcStatus *dgStatus = rpiMetadata_.GetLocked<AgcStatus>("agc.status");
+	AgcStatus *dgStatus = rpiMetadata_.GetLocked<AgcStatus>();
 	if (dgStatus)
 		applyDG(dgStatus, ctrls);
 
-	AlscStatus *lsStatus = rpiMetadata_.GetLocked<AlscStatus>("alsc.status");
+	AlscStatus *lsStatus = rpiMetadata_.GetLocked<AlscStatus>();
 	if (lsStatus)
 		applyLS(lsStatus, ctrls);
 
-	ContrastStatus *contrastStatus = rpiMetadata_.GetLocked<ContrastStatus>("contrast.status");
+	ContrastStatus *contrastStatus = rpiMetadata_.GetLocked<ContrastStatus>();
 	if (contrastStatus)
 		applyGamma(contrastStatus, ctrls);
 
-	BlackLevelStatus *blackLevelStatus = rpiMetadata_.GetLocked<BlackLevelStatus>("black_level.status");
+	BlackLevelStatus *blackLevelStatus = rpiMetadata_.GetLocked<BlackLevelStatus>();
 	if (blackLevelStatus)
 		applyBlackLevel(blackLevelStatus, ctrls);
 
-	GeqStatus *geqStatus = rpiMetadata_.GetLocked<GeqStatus>("geq.status");
+	GeqStatus *geqStatus = rpiMetadata_.GetLocked<GeqStatus>();
 	if (geqStatus)
 		applyGEQ(geqStatus, ctrls);
 
-	DenoiseStatus *denoiseStatus = rpiMetadata_.GetLocked<DenoiseStatus>("denoise.status");
+	DenoiseStatus *denoiseStatus = rpiMetadata_.GetLocked<DenoiseStatus>();
 	if (denoiseStatus)
 		applyDenoise(denoiseStatus, ctrls);
 
-	SharpenStatus *sharpenStatus = rpiMetadata_.GetLocked<SharpenStatus>("sharpen.status");
+	SharpenStatus *sharpenStatus = rpiMetadata_.GetLocked<SharpenStatus>();
 	if (sharpenStatus)
 		applySharpen(sharpenStatus, ctrls);
 
-	DpcStatus *dpcStatus = rpiMetadata_.GetLocked<DpcStatus>("dpc.status");
+	DpcStatus *dpcStatus = rpiMetadata_.GetLocked<DpcStatus>();
 	if (dpcStatus)
 		applyDPC(dpcStatus, ctrls);
 
@@ -1037,15 +1126,19 @@ void IPARPi::fillDeviceStatus(const ControlList &sensorControls)
 
 void IPARPi::processStats(unsigned int bufferId)
 {
-	auto it = buffers_.find(bufferId);
-	if (it == buffers_.end()) {
-		LOG(IPARPI, Error) << "Could not find stats buffer!";
-		return;
-	}
+	RPiController::StatisticsPtr statistics;
+
+	{
+		ipa::BufferRegistry::Access access(buffers_, bufferId,
+						   MappedFrameBuffer::MapFlag::Read);
+		const bcm2835_isp_stats *stats = access.data<bcm2835_isp_stats>();
+		if (!stats) {
+			LOG(IPARPI, Error) << "Could not find stats buffer!";
+			return;
+		}
 
-	Span<uint8_t> mem = it->second.maps()[0];
-	bcm2835_isp_stats *stats = reinterpret_cast<bcm2835_isp_stats *>(mem.data());
-	RPiController::StatisticsPtr statistics = std::make_shared<bcm2835_isp_stats>(*stats);
+		statistics = std::make_shared<bcm2835_isp_stats>(*stats);
+	}
 	helper_->Process(statistics, rpiMetadata_);
 	controller_.Process(statistics, &rpiMetadata_);
 
@@ -1292,21 +1385,28 @@ void IPARPi::applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls)
 		.grid_width = w,
 		.grid_stride = w,
 		.grid_height = h,
-		/* .dmabuf will be filled in by pipeline handler. */
+		/* The table index, replaced by the dmabuf by the pipeline handler. */
 		.dmabuf = 0,
 		.ref_transform = 0,
 		.corner_sampled = 1,
 		.gain_format = GAIN_FORMAT_U4P10
 	};
 
-	if (!lsTable_ || w * h * 4 * sizeof(uint16_t) > ipa::RPi::MaxLsGridSize) {
+	if (lsTables_.empty() || w * h * 4 * sizeof(uint16_t) > ipa::RPi::MaxLsGridSize) {
 		LOG(IPARPI, Error) << "Do not have a correctly allocate lens shading table!";
 		return;
 	}
 
+	/*
+	 * The ISP may still be reading the tables of the previous frames in
+	 * flight, write the next table.
+	 */
+	lsTableIndex_ = (lsTableIndex_ + 1) % lsTables_.size();
+	ls.dmabuf = lsTableIndex_;
+
 	if (lsStatus) {
 		/* Format will be u4.10 */
-		uint16_t *grid = static_cast<uint16_t *>(lsTable_);
+		uint16_t *grid = static_cast<uint16_t *>(lsTables_[lsTableIndex_]);
 
 		resampleTable(grid, lsStatus->r, w, h);
 		resampleTable(grid + w * h, lsStatus->g, w, h);
@@ -1319,6 +1419,16 @@ void IPARPi::applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls)
 	ctrls.set(V4L2_CID_USER_BCM2835_ISP_LENS_SHADING, c);
 }
 
+void IPARPi::unmapLsTables()
+{
+	for (void *table : lsTables_)
+		munmap(table, ipa::RPi::MaxLsGridSize);
+
+	lsTables_.clear();
+	lsTableHandles_.clear();
+	lsTableIndex_ = 0;
+}
+
 /*
  * Resamples a 16x12 table with central sampling to destW x destH with corner
  * sampling.
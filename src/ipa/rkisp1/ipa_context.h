@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_context.h - RkISP1 IPA context
+ */
+#ifndef __LIBCAMERA_RKISP1_IPA_CONTEXT_H__
+#define __LIBCAMERA_RKISP1_IPA_CONTEXT_H__
+
+#include <stdint.h>
+
+#include <linux/rkisp1-config.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/ipa/core_ipa_interface.h>
+
+#include "libipa/module.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+/*
+ * The IPA context holds the state shared by the algorithms, carried over
+ * from frame to frame.
+ */
+struct IPAContext {
+	struct {
+		/* Revision-specific sizes of the measurement blocks. */
+		struct {
+			unsigned int numAeCells;
+			unsigned int numHistogramBins;
+			unsigned int numHistogramWeights;
+		} hw;
+
+		/* ISP input size, empty if the sensor doesn't report it. */
+		Size sensorSize;
+
+		/* Exposure limits in lines, and analogue gain limits. */
+		struct {
+			uint32_t minExposure;
+			uint32_t maxExposure;
+			double minGain;
+			double maxGain;
+		} agc;
+	} configuration;
+
+	struct {
+		/* Sensor exposure (in lines) and analogue gain to apply. */
+		uint32_t exposure;
+		double gain;
+		bool autoEnabled;
+		/* True when the last processed frame produced new settings. */
+		bool updateControls;
+	} agc;
+
+	struct {
+		/* Colour gains to apply in the ISP. */
+		double redGain;
+		double blueGain;
+	} awb;
+};
+
+/* Parameters applied to and results computed for one frame. */
+struct IPAFrameContext {
+	struct {
+		bool measured;
+		bool locked;
+	} agc;
+
+	struct {
+		double redGain;
+		double blueGain;
+	} awb;
+};
+
+using Module = ipa::Module<IPAContext, IPAFrameContext, IPACameraSensorInfo,
+			   rkisp1_params_cfg, rkisp1_stat_buffer>;
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RKISP1_IPA_CONTEXT_H__ */
@@ -6,11 +6,9 @@
  */
 
 #include <algorithm>
-#include <math.h>
-#include <queue>
+#include <memory>
 #include <stdint.h>
 #include <string.h>
-#include <sys/mman.h>
 
 #include <linux/rkisp1-config.h>
 #include <linux/v4l2-controls.h>
@@ -24,18 +22,32 @@
 #include <libcamera/ipa/rkisp1_ipa_interface.h>
 #include <libcamera/request.h>
 
+#include "libcamera/internal/mapped_framebuffer.h"
+
+#include "libipa/buffer_registry.h"
+#include "libipa/camera_sensor_helper.h"
+
+#include "ipa_context.h"
+#include "rkisp1_agc.h"
+#include "rkisp1_awb.h"
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPARkISP1)
 
 namespace ipa::rkisp1 {
 
+/* Maximum number of frame contexts tracked by the algorithms */
+static constexpr uint32_t kMaxFrameContexts = 16;
+
 class IPARkISP1 : public IPARkISP1Interface
 {
 public:
-	int init(unsigned int hwRevision) override;
+	IPARkISP1();
+
+	int init(const IPASettings &settings, unsigned int hwRevision) override;
 	int start() override;
-	void stop() override {}
+	void stop() override;
 
 	int configure(const IPACameraSensorInfo &info,
 		      const std::map<uint32_t, IPAStream> &streamConfig,
@@ -51,44 +63,49 @@ private:
 			      const rkisp1_stat_buffer *stats);
 
 	void setControls(unsigned int frame);
-	void metadataReady(unsigned int frame, unsigned int aeState);
+	void metadataReady(unsigned int frame);
+
+	double gain(uint32_t gainCode) const;
+	uint32_t gainCode(double gain) const;
 
-	std::map<unsigned int, FrameBuffer> buffers_;
-	std::map<unsigned int, void *> buffersMemory_;
+	BufferRegistry buffers_;
 
 	ControlInfoMap ctrls_;
 
 	/* Camera sensor controls. */
-	bool autoExposure_;
 	uint32_t exposure_;
-	uint32_t minExposure_;
-	uint32_t maxExposure_;
 	uint32_t gain_;
 	uint32_t minGain_;
-	uint32_t maxGain_;
 
-	/* revision-specific data */
-	unsigned int hwAeMeanMax_;
-	unsigned int hwHistBinNMax_;
-	unsigned int hwGammaOutMaxSamples_;
-	unsigned int hwHistogramWeightGridsSize_;
+	/* Interface to the camera sensor gain model, if known. */
+	std::unique_ptr<CameraSensorHelper> camHelper_;
+
+	Module module_;
+	IPAContext context_;
 };
 
-int IPARkISP1::init(unsigned int hwRevision)
+IPARkISP1::IPARkISP1()
+	: module_(kMaxFrameContexts)
 {
+	module_.addAlgorithm(std::make_unique<RkISP1Agc>());
+	module_.addAlgorithm(std::make_unique<RkISP1Awb>());
+}
+
+int IPARkISP1::init(const IPASettings &settings, unsigned int hwRevision)
+{
+	auto &hw = context_.configuration.hw;
+
 	/* \todo Add support for other revisions */
 	switch (hwRevision) {
 	case RKISP1_V10:
-		hwAeMeanMax_ = RKISP1_CIF_ISP_AE_MEAN_MAX_V10;
-		hwHistBinNMax_ = RKISP1_CIF_ISP_HIST_BIN_N_MAX_V10;
-		hwGammaOutMaxSamples_ = RKISP1_CIF_ISP_GAMMA_OUT_MAX_SAMPLES_V10;
-		hwHistogramWeightGridsSize_ = RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V10;
+		hw.numAeCells = RKISP1_CIF_ISP_AE_MEAN_MAX_V10;
+		hw.numHistogramBins = RKISP1_CIF_ISP_HIST_BIN_N_MAX_V10;
+		hw.numHistogramWeights = RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V10;
 		break;
 	case RKISP1_V12:
-		hwAeMeanMax_ = RKISP1_CIF_ISP_AE_MEAN_MAX_V12;
-		hwHistBinNMax_ = RKISP1_CIF_ISP_HIST_BIN_N_MAX_V12;
-		hwGammaOutMaxSamples_ = RKISP1_CIF_ISP_GAMMA_OUT_MAX_SAMPLES_V12;
-		hwHistogramWeightGridsSize_ = RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V12;
+		hw.numAeCells = RKISP1_CIF_ISP_AE_MEAN_MAX_V12;
+		hw.numHistogramBins = RKISP1_CIF_ISP_HIST_BIN_N_MAX_V12;
+		hw.numHistogramWeights = RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V12;
 		break;
 	default:
 		LOG(IPARkISP1, Error)
@@ -98,6 +115,17 @@ int IPARkISP1::init(unsigned int hwRevision)
 	}
 
 	LOG(IPARkISP1, Debug) << "Hardware revision is " << hwRevision;
+
+	/*
+	 * Without a helper, the analogue gain is assumed to be linear in the
+	 * gain code, with the minimum code corresponding to a unity gain.
+	 */
+	camHelper_ = CameraSensorHelperFactory::create(settings.sensorModel);
+	if (!camHelper_)
+		LOG(IPARkISP1, Warning)
+			<< "No camera sensor helper for '" << settings.sensorModel
+			<< "', assuming a linear gain model";
+
 	return 0;
 }
 
@@ -108,13 +136,19 @@ int IPARkISP1::start()
 	return 0;
 }
 
+void IPARkISP1::stop()
+{
+	module_.logTimings();
+	module_.resetTimings();
+}
+
 /**
  * \todo The RkISP1 pipeline currently provides an empty IPACameraSensorInfo
  * if the connected sensor does not provide enough information to properly
  * assemble one. Make sure the reported sensor information are relevant
  * before accessing them.
  */
-int IPARkISP1::configure([[maybe_unused]] const IPACameraSensorInfo &info,
+int IPARkISP1::configure(const IPACameraSensorInfo &info,
 			 [[maybe_unused]] const std::map<uint32_t, IPAStream> &streamConfig,
 			 const std::map<uint32_t, ControlInfoMap> &entityControls)
 {
@@ -135,61 +169,49 @@ int IPARkISP1::configure([[maybe_unused]] const IPACameraSensorInfo &info,
 		return -EINVAL;
 	}
 
-	autoExposure_ = true;
-
-	minExposure_ = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
-	maxExposure_ = itExp->second.max().get<int32_t>();
-	exposure_ = minExposure_;
+	uint32_t minExposure = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
+	uint32_t maxExposure = itExp->second.max().get<int32_t>();
 
 	minGain_ = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
-	maxGain_ = itGain->second.max().get<int32_t>();
-	gain_ = minGain_;
+	uint32_t maxGain = itGain->second.max().get<int32_t>();
 
 	LOG(IPARkISP1, Info)
-		<< "Exposure: " << minExposure_ << "-" << maxExposure_
-		<< " Gain: " << minGain_ << "-" << maxGain_;
+		<< "Exposure: " << minExposure << "-" << maxExposure
+		<< " Gain: " << minGain_ << "-" << maxGain;
+
+	if (camHelper_)
+		camHelper_->prepareGainCodes(minGain_, maxGain);
+
+	/* Keep the hardware revision data and reset the rest of the context. */
+	auto hw = context_.configuration.hw;
+	context_ = {};
+	context_.configuration.hw = hw;
+
+	context_.configuration.sensorSize = info.outputSize;
+	context_.configuration.agc.minExposure = minExposure;
+	context_.configuration.agc.maxExposure = maxExposure;
+	context_.configuration.agc.minGain = gain(minGain_);
+	context_.configuration.agc.maxGain = gain(maxGain);
+	context_.agc.autoEnabled = true;
+
+	int ret = module_.configure(context_, info);
+	if (ret)
+		return ret;
+
+	exposure_ = context_.agc.exposure;
+	gain_ = gainCode(context_.agc.gain);
 
 	return 0;
 }
 
 void IPARkISP1::mapBuffers(const std::vector<IPABuffer> &buffers)
 {
-	for (const IPABuffer &buffer : buffers) {
-		auto elem = buffers_.emplace(std::piecewise_construct,
-					     std::forward_as_tuple(buffer.id),
-					     std::forward_as_tuple(buffer.planes));
-		const FrameBuffer &fb = elem.first->second;
-
-		/*
-		 * \todo Provide a helper to mmap() buffers (possibly exposed
-		 * to applications).
-		 */
-		buffersMemory_[buffer.id] = mmap(NULL,
-						 fb.planes()[0].length,
-						 PROT_READ | PROT_WRITE,
-						 MAP_SHARED,
-						 fb.planes()[0].fd.fd(),
-						 0);
-
-		if (buffersMemory_[buffer.id] == MAP_FAILED) {
-			int ret = -errno;
-			LOG(IPARkISP1, Fatal) << "Failed to mmap buffer: "
-					      << strerror(-ret);
-		}
-	}
+	buffers_.map(buffers);
 }
 
 void IPARkISP1::unmapBuffers(const std::vector<unsigned int> &ids)
 {
-	for (unsigned int id : ids) {
-		const auto fb = buffers_.find(id);
-		if (fb == buffers_.end())
-			continue;
-
-		munmap(buffersMemory_[id], fb->second.planes()[0].length);
-		buffersMemory_.erase(id);
-		buffers_.erase(id);
-	}
+	buffers_.unmap(ids);
 }
 
 void IPARkISP1::processEvent(const RkISP1Event &event)
@@ -199,20 +221,44 @@ void IPARkISP1::processEvent(const RkISP1Event &event)
 		unsigned int frame = event.frame;
 		unsigned int bufferId = event.bufferId;
 
-		const rkisp1_stat_buffer *stats =
-			static_cast<rkisp1_stat_buffer *>(buffersMemory_[bufferId]);
+		/* End the CPU access before the buffer is handed back. */
+		{
+			BufferRegistry::Access access(buffers_, bufferId,
+						      MappedFrameBuffer::MapFlag::Read);
+			const rkisp1_stat_buffer *stats = access.data<rkisp1_stat_buffer>();
+
+			/* Report metadata for the frame even without statistics. */
+			if (stats)
+				updateStatistics(frame, stats);
+			else
+				LOG(IPARkISP1, Error)
+					<< "Invalid statistics buffer " << bufferId;
+		}
 
-		updateStatistics(frame, stats);
+		metadataReady(frame);
 		break;
 	}
 	case EventQueueRequest: {
 		unsigned int frame = event.frame;
 		unsigned int bufferId = event.bufferId;
 
-		rkisp1_params_cfg *params =
-			static_cast<rkisp1_params_cfg *>(buffersMemory_[bufferId]);
+		{
+			BufferRegistry::Access access(buffers_, bufferId,
+						      MappedFrameBuffer::MapFlag::Write);
+			rkisp1_params_cfg *params = access.data<rkisp1_params_cfg>();
+			if (!params) {
+				LOG(IPARkISP1, Error)
+					<< "Invalid parameters buffer " << bufferId;
+				return;
+			}
+
+			queueRequest(frame, params, event.controls);
+		}
+
+		RkISP1Action op;
+		op.op = ActionParamFilled;
 
-		queueRequest(frame, params, event.controls);
+		queueFrameAction.emit(frame, op);
 		break;
 	}
 	default:
@@ -228,63 +274,29 @@ void IPARkISP1::queueRequest(unsigned int frame, rkisp1_params_cfg *params,
 	memset(params, 0, sizeof(*params));
 
 	/* Auto Exposure on/off. */
-	if (controls.contains(controls::AeEnable)) {
-		autoExposure_ = controls.get(controls::AeEnable);
-		if (autoExposure_)
-			params->module_ens = RKISP1_CIF_ISP_MODULE_AEC;
-
-		params->module_en_update = RKISP1_CIF_ISP_MODULE_AEC;
-	}
+	if (controls.contains(controls::AeEnable))
+		context_.agc.autoEnabled = controls.get(controls::AeEnable);
 
-	RkISP1Action op;
-	op.op = ActionParamFilled;
-
-	queueFrameAction.emit(frame, op);
+	module_.alloc(frame);
+	module_.prepare(context_, frame, params);
 }
 
 void IPARkISP1::updateStatistics(unsigned int frame,
 				 const rkisp1_stat_buffer *stats)
 {
-	const rkisp1_cif_isp_stat *params = &stats->params;
-	unsigned int aeState = 0;
-
-	if (stats->meas_type & RKISP1_CIF_ISP_STAT_AUTOEXP) {
-		const rkisp1_cif_isp_ae_stat *ae = &params->ae;
-
-		const unsigned int target = 60;
-
-		unsigned int value = 0;
-		unsigned int num = 0;
-		for (unsigned int i = 0; i < hwAeMeanMax_; i++) {
-			if (ae->exp_mean[i] <= 15)
-				continue;
-
-			value += ae->exp_mean[i];
-			num++;
-		}
-		value /= num;
-
-		double factor = (double)target / value;
+	/* Start from the settings last sent to the sensor. */
+	context_.agc.exposure = exposure_;
+	context_.agc.gain = gain(gain_);
 
-		if (frame % 3 == 0) {
-			double exposure;
+	module_.process(context_, frame, stats);
 
-			exposure = factor * exposure_ * gain_ / minGain_;
-			exposure_ = std::clamp<uint64_t>((uint64_t)exposure,
-							 minExposure_,
-							 maxExposure_);
+	if (!context_.agc.updateControls)
+		return;
 
-			exposure = exposure / exposure_ * minGain_;
-			gain_ = std::clamp<uint64_t>((uint64_t)exposure,
-						     minGain_, maxGain_);
+	exposure_ = context_.agc.exposure;
+	gain_ = gainCode(context_.agc.gain);
 
-			setControls(frame + 1);
-		}
-
-		aeState = fabs(factor - 1.0f) < 0.05f ? 2 : 1;
-	}
-
-	metadataReady(frame, aeState);
+	setControls(frame + 1);
 }
 
 void IPARkISP1::setControls(unsigned int frame)
@@ -300,12 +312,13 @@ void IPARkISP1::setControls(unsigned int frame)
 	queueFrameAction.emit(frame, op);
 }
 
-void IPARkISP1::metadataReady(unsigned int frame, unsigned int aeState)
+void IPARkISP1::metadataReady(unsigned int frame)
 {
+	const IPAFrameContext &frameContext = module_.frameContext(frame);
 	ControlList ctrls(controls::controls);
 
-	if (aeState)
-		ctrls.set(controls::AeLocked, aeState == 2);
+	if (frameContext.agc.measured)
+		ctrls.set(controls::AeLocked, frameContext.agc.locked);
 
 	RkISP1Action op;
 	op.op = ActionMetadata;
@@ -314,6 +327,22 @@ void IPARkISP1::metadataReady(unsigned int frame, unsigned int aeState)
 	queueFrameAction.emit(frame, op);
 }
 
+double IPARkISP1::gain(uint32_t gainCode) const
+{
+	if (camHelper_)
+		return camHelper_->gain(gainCode);
+
+	return static_cast<double>(gainCode) / minGain_;
+}
+
+uint32_t IPARkISP1::gainCode(double gain) const
+{
+	if (camHelper_)
+		return camHelper_->gainCode(gain);
+
+	return static_cast<uint32_t>(gain * minGain_);
+}
+
 } /* namespace ipa::rkisp1 */
 
 /*
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rkisp1_agc.cpp - AGC/AEC control algorithm
+ */
+
+#include "rkisp1_agc.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/span.h>
+
+#include "libipa/histogram.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+LOG_DEFINE_CATEGORY(RkISP1Agc)
+
+/* Number of frames between exposure updates, to cover the sensor delays */
+static constexpr uint32_t kFrameSkipCount = 3;
+
+/* Target mean luminance of the frame */
+static constexpr double kRelativeLuminanceTarget = 0.16;
+
+/*
+ * Lower bound on the mean luminance of the brightest 2% of the pixels, to
+ * avoid underexposing scenes with bright highlights on a dark background.
+ */
+static constexpr double kHighlightQuantile = 0.98;
+static constexpr double kHighlightTarget = 0.5;
+
+/* Gain error below which the exposure is considered locked */
+static constexpr double kLockThreshold = 0.05;
+
+RkISP1Agc::RkISP1Agc()
+	: filteredExposure_(0.0)
+{
+}
+
+int RkISP1Agc::configure(IPAContext &context,
+			 [[maybe_unused]] const IPACameraSensorInfo &sensorInfo)
+{
+	context.agc.exposure = context.configuration.agc.minExposure;
+	context.agc.gain = context.configuration.agc.minGain;
+	context.agc.updateControls = false;
+
+	filteredExposure_ = 0.0;
+
+	return 0;
+}
+
+void RkISP1Agc::prepare(IPAContext &context, uint32_t frame,
+			[[maybe_unused]] IPAFrameContext &frameContext,
+			rkisp1_params_cfg *params)
+{
+	/*
+	 * The measurement configuration is reset by the driver when streaming
+	 * starts, and kept afterwards. Only program it in the first frame.
+	 */
+	if (frame > 0)
+		return;
+
+	/* Keep the driver default windows if the sensor size is unknown. */
+	const Size &size = context.configuration.sensorSize;
+	if (!size.isNull()) {
+		rkisp1_cif_isp_window window = {};
+		window.h_size = size.width;
+		window.v_size = size.height;
+
+		params->meas.aec_config.meas_window = window;
+		params->meas.hst_config.meas_window = window;
+	}
+
+	/* Measure the luminance as (R + G + B) x (85/256). */
+	params->meas.aec_config.mode = RKISP1_CIF_ISP_EXP_MEASURING_MODE_1;
+	params->meas.aec_config.autostop = RKISP1_CIF_ISP_EXP_CTRL_AUTOSTOP_0;
+
+	/* Produce an evenly weighted luminance histogram. */
+	params->meas.hst_config.mode = RKISP1_CIF_ISP_HISTOGRAM_MODE_Y_HISTOGRAM;
+	Span<uint8_t> weights{ params->meas.hst_config.hist_weight,
+			       context.configuration.hw.numHistogramWeights };
+	std::fill(weights.begin(), weights.end(), 1);
+	/* The step size can't be less than 3. */
+	params->meas.hst_config.histogram_predivider = 4;
+
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_AEC |
+				    RKISP1_CIF_ISP_MODULE_HST;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_AEC |
+			      RKISP1_CIF_ISP_MODULE_HST;
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_AEC |
+				     RKISP1_CIF_ISP_MODULE_HST;
+}
+
+/*
+ * Compute the gain to apply to the current exposure to reach the luminance
+ * targets, from the block means measured by the AEC module and the histogram.
+ * Both are read in place from the statistics buffer.
+ */
+double RkISP1Agc::computeGain(const IPAContext &context,
+			      const rkisp1_cif_isp_stat *stats,
+			      bool histogram) const
+{
+	const unsigned int numCells = context.configuration.hw.numAeCells;
+
+	unsigned int sum = 0;
+	for (unsigned int i = 0; i < numCells; i++)
+		sum += stats->ae.exp_mean[i];
+
+	double mean = std::max(sum / (numCells * 255.0), 1e-3);
+	double gain = kRelativeLuminanceTarget / mean;
+
+	if (histogram) {
+		const unsigned int numBins = context.configuration.hw.numHistogramBins;
+		Histogram hist(Span<const uint32_t>(stats->hist.hist_bins, numBins));
+
+		if (hist.total()) {
+			double iqMean = hist.interQuantileMean(kHighlightQuantile, 1.0);
+			double highlightGain = kHighlightTarget * numBins / iqMean;
+			gain = std::max(gain, highlightGain);
+		}
+	}
+
+	LOG(RkISP1Agc, Debug)
+		<< "Mean luminance " << mean << ", required gain " << gain;
+
+	return gain;
+}
+
+void RkISP1Agc::filterExposure(double exposure)
+{
+	double speed = 0.2;
+
+	if (filteredExposure_ == 0.0) {
+		filteredExposure_ = exposure;
+		return;
+	}
+
+	/*
+	 * If we are close to the desired result, go faster to avoid making
+	 * multiple micro-adjustments.
+	 */
+	if (filteredExposure_ < 1.2 * exposure &&
+	    filteredExposure_ > 0.8 * exposure)
+		speed = sqrt(speed);
+
+	filteredExposure_ = speed * exposure + filteredExposure_ * (1.0 - speed);
+}
+
+void RkISP1Agc::process(IPAContext &context, uint32_t frame,
+			IPAFrameContext &frameContext,
+			const rkisp1_stat_buffer *stats)
+{
+	context.agc.updateControls = false;
+
+	if (!(stats->meas_type & RKISP1_CIF_ISP_STAT_AUTOEXP))
+		return;
+
+	double gain = computeGain(context, &stats->params,
+				  stats->meas_type & RKISP1_CIF_ISP_STAT_HIST);
+
+	frameContext.agc.measured = true;
+	frameContext.agc.locked = std::abs(gain - 1.0) < kLockThreshold;
+
+	if (!context.agc.autoEnabled || frame % kFrameSkipCount)
+		return;
+
+	/*
+	 * Work on the total exposure, expressed as the product of the
+	 * exposure time in lines and the analogue gain, as the line duration
+	 * may not be known.
+	 */
+	const auto &limits = context.configuration.agc;
+	double minExposure = limits.minExposure * limits.minGain;
+	double maxExposure = limits.maxExposure * limits.maxGain;
+	double exposure = context.agc.exposure * context.agc.gain * gain;
+
+	filterExposure(std::clamp(exposure, minExposure, maxExposure));
+
+	/* Favour the exposure time over the gain to limit noise. */
+	uint32_t lines = std::clamp<double>(filteredExposure_ / limits.minGain,
+					    limits.minExposure, limits.maxExposure);
+	double analogueGain = std::clamp(filteredExposure_ / lines,
+					 limits.minGain, limits.maxGain);
+
+	LOG(RkISP1Agc, Debug)
+		<< "Total exposure " << exposure << " filtered to "
+		<< filteredExposure_ << ": exposure " << lines
+		<< " lines, gain " << analogueGain;
+
+	context.agc.updateControls = lines != context.agc.exposure ||
+				     analogueGain != context.agc.gain;
+	context.agc.exposure = lines;
+	context.agc.gain = analogueGain;
+}
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
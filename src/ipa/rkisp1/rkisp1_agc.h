@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rkisp1_agc.h - RkISP1 AGC/AEC control algorithm
+ */
+#ifndef __LIBCAMERA_RKISP1_AGC_H__
+#define __LIBCAMERA_RKISP1_AGC_H__
+
+#include <linux/rkisp1-config.h>
+
+#include "ipa_context.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+class RkISP1Agc : public ipa::Algorithm<Module>
+{
+public:
+	RkISP1Agc();
+	~RkISP1Agc() = default;
+
+	const char *name() const override { return "RkISP1Agc"; }
+
+	int configure(IPAContext &context, const IPACameraSensorInfo &sensorInfo) override;
+	void prepare(IPAContext &context, uint32_t frame, IPAFrameContext &frameContext,
+		     rkisp1_params_cfg *params) override;
+	void process(IPAContext &context, uint32_t frame, IPAFrameContext &frameContext,
+		     const rkisp1_stat_buffer *stats) override;
+
+private:
+	double computeGain(const IPAContext &context,
+			   const rkisp1_cif_isp_stat *stats, bool histogram) const;
+	void filterExposure(double exposure);
+
+	double filteredExposure_;
+};
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RKISP1_AGC_H__ */
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rkisp1_awb.cpp - AWB control algorithm
+ */
+
+#include "rkisp1_awb.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <libcamera/base/log.h>
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+LOG_DEFINE_CATEGORY(RkISP1Awb)
+
+/* Minimum proportion of the window pixels used to consider a measurement */
+static constexpr double kMinPixelRatio = 0.01;
+
+/* Gains are 10 bit values with 8 fractional bits */
+static constexpr double kMinGain = 1.0 / 256;
+static constexpr double kMaxGain = 1023.0 / 256;
+
+/* Speed at which the gains converge to their estimated values */
+static constexpr double kSpeed = 0.2;
+
+int RkISP1Awb::configure(IPAContext &context,
+			 [[maybe_unused]] const IPACameraSensorInfo &sensorInfo)
+{
+	context.awb.redGain = 1.0;
+	context.awb.blueGain = 1.0;
+
+	return 0;
+}
+
+void RkISP1Awb::prepare(IPAContext &context, uint32_t frame,
+			IPAFrameContext &frameContext,
+			rkisp1_params_cfg *params)
+{
+	/* Record the gains the frame is processed with. */
+	frameContext.awb.redGain = context.awb.redGain;
+	frameContext.awb.blueGain = context.awb.blueGain;
+
+	rkisp1_cif_isp_awb_gain_config &gains = params->others.awb_gain_config;
+	gains.gain_red = std::clamp<int>(context.awb.redGain * 256, 0, 0x3ff);
+	gains.gain_green_r = 0x100;
+	gains.gain_blue = std::clamp<int>(context.awb.blueGain * 256, 0, 0x3ff);
+	gains.gain_green_b = 0x100;
+
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+
+	/* The measurement configuration only needs to be set once. */
+	if (frame > 0)
+		return;
+
+	rkisp1_cif_isp_awb_meas_config &config = params->meas.awb_meas_config;
+
+	const Size &size = context.configuration.sensorSize;
+	if (!size.isNull()) {
+		config.awb_wnd.h_size = size.width;
+		config.awb_wnd.v_size = size.height;
+	}
+
+	/* Measure the means over a single frame, in the YCbCr space. */
+	config.frames = 0;
+	config.awb_mode = RKISP1_CIF_ISP_AWB_MODE_YCBCR;
+	/* Only consider pixels between the Y min and max. */
+	config.min_y = 16;
+	config.max_y = 250;
+	config.enable_ymax_cmp = 1;
+	/* Exclude strongly coloured pixels. */
+	config.max_csum = 250;
+	config.min_c = 16;
+	config.awb_ref_cr = 128;
+	config.awb_ref_cb = 128;
+
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_AWB;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_AWB;
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_AWB;
+}
+
+void RkISP1Awb::process(IPAContext &context, [[maybe_unused]] uint32_t frame,
+			IPAFrameContext &frameContext,
+			const rkisp1_stat_buffer *stats)
+{
+	if (!(stats->meas_type & RKISP1_CIF_ISP_STAT_AWB))
+		return;
+
+	const rkisp1_cif_isp_awb_meas &awb = stats->params.awb.awb_mean[0];
+
+	const Size &size = context.configuration.sensorSize;
+	if (!size.isNull() && awb.cnt < size.width * size.height * kMinPixelRatio) {
+		LOG(RkISP1Awb, Debug) << "Not enough white pixels: " << awb.cnt;
+		return;
+	}
+
+	/*
+	 * Convert the means from YCbCr to RGB. The hardware uses
+	 *
+	 * Y  =  16 + 0.2500 R + 0.5000 G + 0.1094 B
+	 * Cb = 128 - 0.1406 R - 0.2969 G + 0.4375 B
+	 * Cr = 128 + 0.4375 R - 0.3750 G - 0.0625 B
+	 */
+	double y = awb.mean_y_or_g - 16.0;
+	double cb = awb.mean_cb_or_b - 128.0;
+	double cr = awb.mean_cr_or_r - 128.0;
+
+	double red = 1.1636 * y - 0.0623 * cb + 1.6008 * cr;
+	double green = 1.1636 * y - 0.4045 * cb - 0.7949 * cr;
+	double blue = 1.1636 * y + 1.9912 * cb - 0.0250 * cr;
+
+	/*
+	 * The means are measured after the colour gains are applied. Undo the
+	 * gains the frame has been processed with to estimate the raw means.
+	 */
+	red /= frameContext.awb.redGain;
+	blue /= frameContext.awb.blueGain;
+
+	if (red <= 1.0 || green <= 1.0 || blue <= 1.0)
+		return;
+
+	/* Grey world estimate. */
+	double redGain = std::clamp(green / red, kMinGain, kMaxGain);
+	double blueGain = std::clamp(green / blue, kMinGain, kMaxGain);
+
+	context.awb.redGain = kSpeed * redGain + (1.0 - kSpeed) * context.awb.redGain;
+	context.awb.blueGain = kSpeed * blueGain + (1.0 - kSpeed) * context.awb.blueGain;
+
+	LOG(RkISP1Awb, Debug)
+		<< "Means [" << red << ", " << green << ", " << blue
+		<< "], gains [" << context.awb.redGain << ", "
+		<< context.awb.blueGain << "]";
+}
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rkisp1_awb.h - RkISP1 AWB control algorithm
+ */
+#ifndef __LIBCAMERA_RKISP1_AWB_H__
+#define __LIBCAMERA_RKISP1_AWB_H__
+
+#include <linux/rkisp1-config.h>
+
+#include "ipa_context.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+class RkISP1Awb : public ipa::Algorithm<Module>
+{
+public:
+	RkISP1Awb() = default;
+	~RkISP1Awb() = default;
+
+	const char *name() const override { return "RkISP1Awb"; }
+
+	int configure(IPAContext &context, const IPACameraSensorInfo &sensorInfo) override;
+	void prepare(IPAContext &context, uint32_t frame, IPAFrameContext &frameContext,
+		     rkisp1_params_cfg *params) override;
+	void process(IPAContext &context, uint32_t frame, IPAFrameContext &frameContext,
+		     const rkisp1_stat_buffer *stats) override;
+};
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RKISP1_AWB_H__ */
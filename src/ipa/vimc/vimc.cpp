@@ -11,7 +11,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <iostream>
+#include <numeric>
+#include <random>
 
 #include <libcamera/base/file.h>
 #include <libcamera/base/log.h>
@@ -30,19 +33,25 @@ public:
 	~IPAVimc();
 
 	int init(const IPASettings &settings) override;
+	int configure(const ipa::vimc::SyntheticLoad &load) override;
 
 	int start() override;
 	void stop() override;
 
+	void processStats(uint32_t frame, const std::vector<uint8_t> &stats) override;
+
 private:
 	void initTrace();
 	void trace(enum ipa::vimc::IPAOperationCode operation);
 
 	int fd_;
+
+	ipa::vimc::SyntheticLoad load_;
+	std::minstd_rand random_;
 };
 
 IPAVimc::IPAVimc()
-	: fd_(-1)
+	: fd_(-1), load_({})
 {
 	initTrace();
 }
@@ -70,6 +79,17 @@ int IPAVimc::init(const IPASettings &settings)
 	return 0;
 }
 
+int IPAVimc::configure(const ipa::vimc::SyntheticLoad &load)
+{
+	LOG(IPAVimc, Debug)
+		<< "Synthetic load: " << load.busyTime << "us busy time, "
+		<< load.jitter << "us jitter";
+
+	load_ = load;
+
+	return 0;
+}
+
 int IPAVimc::start()
 {
 	trace(ipa::vimc::IPAOperationStart);
@@ -86,6 +106,29 @@ void IPAVimc::stop()
 	LOG(IPAVimc, Debug) << "stop vimc IPA!";
 }
 
+void IPAVimc::processStats(uint32_t frame, const std::vector<uint8_t> &stats)
+{
+	/*
+	 * Emulate the cost of running algorithms on the statistics: walk
+	 * through the statistics buffer, and keep the CPU busy for the
+	 * configured time, plus a random delay up to the configured jitter.
+	 */
+	uint32_t busyTime = load_.busyTime;
+	if (load_.jitter)
+		busyTime += random_() % (load_.jitter + 1);
+
+	auto deadline = std::chrono::steady_clock::now()
+		      + std::chrono::microseconds(busyTime);
+
+	volatile unsigned int sum = std::accumulate(stats.begin(), stats.end(), 0U);
+	(void)sum;
+
+	while (std::chrono::steady_clock::now() < deadline)
+		;
+
+	statsProcessed.emit(frame);
+}
+
 void IPAVimc::initTrace()
 {
 	struct stat fifoStat;
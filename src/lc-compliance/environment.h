@@ -7,6 +7,8 @@
 #ifndef __LC_COMPLIANCE_ENVIRONMENT_H__
 #define __LC_COMPLIANCE_ENVIRONMENT_H__
 
+#include <chrono>
+
 #include <libcamera/libcamera.h>
 
 using namespace libcamera;
@@ -21,11 +23,15 @@ public:
 	const std::string &cameraId() const { return cameraId_; }
 	CameraManager *cm() const { return cm_; }
 
+	void setSoakDuration(std::chrono::seconds duration) { soakDuration_ = duration; }
+	std::chrono::seconds soakDuration() const { return soakDuration_; }
+
 private:
 	Environment() = default;
 
 	std::string cameraId_;
 	CameraManager *cm_;
+	std::chrono::seconds soakDuration_ = std::chrono::seconds(60);
 };
 
 #endif /* __LC_COMPLIANCE_ENVIRONMENT_H__ */
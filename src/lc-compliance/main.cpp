@@ -20,10 +20,12 @@
 using namespace libcamera;
 
 enum {
+	OptBenchmark = 'b',
 	OptCamera = 'c',
 	OptList = 'l',
 	OptFilter = 'f',
 	OptHelp = 'h',
+	OptSoak = 's',
 };
 
 /*
@@ -103,17 +105,29 @@ static int initGtestParameters(char *arg0, OptionsParser::Options options)
 		argc++;
 	}
 
-	if (options.isSet(OptFilter)) {
-		/*
-		 * The filter flag needs to be passed as a single parameter, in
-		 * the format --gtest_filter=filterStr
-		 */
-		filterParam = gtestFlags.at("filter") + "=" +
-			      static_cast<const std::string &>(options[OptFilter]);
+	/*
+	 * The performance and soak tests take a long time to run and are only
+	 * run in benchmark and soak modes respectively, unless explicitly
+	 * selected by a filter.
+	 */
+	std::string filter;
+	if (options.isSet(OptFilter))
+		filter = static_cast<const std::string &>(options[OptFilter]);
+	else if (options.isSet(OptBenchmark))
+		filter = "PerformanceTests/*";
+	else if (options.isSet(OptSoak))
+		filter = "SoakTests/*";
+	else
+		filter = "-PerformanceTests/*:SoakTests/*";
 
-		argv[argc] = const_cast<char *>(filterParam.c_str());
-		argc++;
-	}
+	/*
+	 * The filter flag needs to be passed as a single parameter, in the
+	 * format --gtest_filter=filterStr
+	 */
+	filterParam = gtestFlags.at("filter") + "=" + filter;
+
+	argv[argc] = const_cast<char *>(filterParam.c_str());
+	argc++;
 
 	argv[argc] = nullptr;
 
@@ -138,6 +152,9 @@ static int initGtest(char *arg0, OptionsParser::Options options)
 static int parseOptions(int argc, char **argv, OptionsParser::Options *options)
 {
 	OptionsParser parser;
+	parser.addOption(OptBenchmark, OptionNone,
+			 "Run the performance tests instead of the compliance tests",
+			 "benchmark");
 	parser.addOption(OptCamera, OptionString,
 			 "Specify which camera to operate on, by id", "camera",
 			 ArgumentRequired, "camera");
@@ -147,6 +164,9 @@ static int parseOptions(int argc, char **argv, OptionsParser::Options *options)
 			 ArgumentRequired, "filter");
 	parser.addOption(OptHelp, OptionNone, "Display this help message",
 			 "help");
+	parser.addOption(OptSoak, OptionInteger,
+			 "Run the soak tests instead of the compliance tests, for the given duration in seconds",
+			 "soak", ArgumentRequired, "seconds");
 
 	*options = parser.parse(argc, argv);
 	if (!options->valid())
@@ -156,9 +176,21 @@ static int parseOptions(int argc, char **argv, OptionsParser::Options *options)
 		parser.usage();
 		std::cerr << "Further options from Googletest can be passed as environment variables"
 			  << std::endl;
+		std::cerr << "Benchmark results can be saved with GTEST_OUTPUT=json:<file>"
+			  << std::endl;
 		return -EINTR;
 	}
 
+	if (options->isSet(OptSoak)) {
+		int duration = (*options)[OptSoak].toInteger();
+		if (duration <= 0) {
+			std::cerr << "Invalid soak duration " << duration << std::endl;
+			return -EINVAL;
+		}
+
+		Environment::get()->setSoakDuration(std::chrono::seconds(duration));
+	}
+
 	return 0;
 }
 
@@ -0,0 +1,284 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance_test.cpp - Measure camera capture performance
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sys/resource.h>
+
+#include <gtest/gtest.h>
+
+#include "environment.h"
+#include "simple_capture.h"
+
+using namespace libcamera;
+using namespace std::chrono;
+
+namespace {
+
+const std::vector<StreamRole> ROLES = { Raw, StillCapture, VideoRecording, Viewfinder };
+
+constexpr unsigned int NumRequests = 200;
+constexpr unsigned int NumReconfigurations = 5;
+
+microseconds cpuTime()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+	       microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+int64_t toMicroseconds(steady_clock::duration duration)
+{
+	return duration_cast<microseconds>(duration).count();
+}
+
+void report(const std::string &key, int64_t value)
+{
+	testing::Test::RecordProperty(key, std::to_string(value));
+	std::cout << std::setw(24) << std::left << key << value << std::endl;
+}
+
+} /* namespace */
+
+class CaptureBenchmark : public SimpleCapture
+{
+public:
+	CaptureBenchmark(std::shared_ptr<Camera> camera)
+		: SimpleCapture(camera)
+	{
+	}
+
+	/*
+	 * Allocate buffers, start the camera, capture numRequests frames and
+	 * stop the camera. The time to first frame is measured from the call to
+	 * Camera::start() to the completion of the first request.
+	 */
+	void capture(unsigned int numRequests)
+	{
+		setupStart_ = steady_clock::now();
+
+		Stream *stream = config_->at(0).stream();
+		int count = allocator_->allocate(stream);
+		ASSERT_GE(count, 0) << "Failed to allocate buffers";
+
+		const std::vector<std::unique_ptr<FrameBuffer>> &buffers = allocator_->buffers(stream);
+
+		requests_.clear();
+		for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			ASSERT_TRUE(request) << "Can't create request";
+			ASSERT_EQ(request->addBuffer(stream, buffer.get()), 0)
+				<< "Can't set buffer for request";
+			requests_.push_back(std::move(request));
+		}
+
+		queueCount_ = 0;
+		captureCount_ = 0;
+		captureLimit_ = numRequests;
+		latencies_.clear();
+
+		camera_->requestCompleted.connect(this, &CaptureBenchmark::requestComplete);
+
+		startTime_ = steady_clock::now();
+		ASSERT_EQ(camera_->start(), 0) << "Failed to start camera";
+
+		for (std::unique_ptr<Request> &request : requests_)
+			ASSERT_EQ(queueRequest(request.get()), 0) << "Failed to queue request";
+
+		loop_ = new EventLoop();
+		int status = loop_->exec();
+
+		steady_clock::time_point stopStart = steady_clock::now();
+		stop();
+		stopTime_ = steady_clock::now() - stopStart;
+
+		camera_->requestCompleted.disconnect(this);
+
+		delete loop_;
+
+		ASSERT_EQ(status, 0);
+		ASSERT_EQ(captureCount_, captureLimit_);
+	}
+
+	steady_clock::duration setupTime() const { return startTime_ - setupStart_; }
+	steady_clock::duration timeToFirstFrame() const { return firstFrame_ - startTime_; }
+	steady_clock::duration stopTime() const { return stopTime_; }
+	steady_clock::duration captureTime() const { return lastFrame_ - firstFrame_; }
+	const std::vector<steady_clock::duration> &latencies() const { return latencies_; }
+
+private:
+	int queueRequest(Request *request)
+	{
+		queueCount_++;
+		if (queueCount_ > captureLimit_)
+			return 0;
+
+		queueTimes_[request] = steady_clock::now();
+		return camera_->queueRequest(request);
+	}
+
+	void requestComplete(Request *request) override
+	{
+		steady_clock::time_point now = steady_clock::now();
+
+		if (!captureCount_)
+			firstFrame_ = now;
+		lastFrame_ = now;
+
+		/*
+		 * The first requests are queued before streaming starts, don't
+		 * include them in the steady-state latency.
+		 */
+		if (captureCount_ >= requests_.size())
+			latencies_.push_back(now - queueTimes_[request]);
+
+		captureCount_++;
+		if (captureCount_ >= captureLimit_) {
+			loop_->exit(0);
+			return;
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		if (queueRequest(request))
+			loop_->exit(-EINVAL);
+	}
+
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::map<Request *, steady_clock::time_point> queueTimes_;
+	std::vector<steady_clock::duration> latencies_;
+
+	steady_clock::time_point setupStart_;
+	steady_clock::time_point startTime_;
+	steady_clock::duration stopTime_;
+	steady_clock::time_point firstFrame_;
+	steady_clock::time_point lastFrame_;
+
+	unsigned int queueCount_;
+	unsigned int captureCount_;
+	unsigned int captureLimit_;
+};
+
+class Performance : public testing::TestWithParam<StreamRole>
+{
+public:
+	static std::string nameParameters(const testing::TestParamInfo<Performance::ParamType> &info);
+
+protected:
+	void SetUp() override;
+	void TearDown() override;
+
+	std::shared_ptr<Camera> camera_;
+};
+
+void Performance::SetUp()
+{
+	Environment *env = Environment::get();
+
+	camera_ = env->cm()->get(env->cameraId());
+
+	ASSERT_EQ(camera_->acquire(), 0);
+}
+
+void Performance::TearDown()
+{
+	if (!camera_)
+		return;
+
+	camera_->release();
+	camera_.reset();
+}
+
+std::string Performance::nameParameters(const testing::TestParamInfo<Performance::ParamType> &info)
+{
+	std::map<StreamRole, std::string> rolesMap = { { Raw, "Raw" },
+						       { StillCapture, "StillCapture" },
+						       { VideoRecording, "VideoRecording" },
+						       { Viewfinder, "Viewfinder" } };
+
+	return rolesMap[info.param];
+}
+
+/*
+ * Measure the capture latency
+ *
+ * Reports the time from start() to the completion of the first request, the
+ * percentiles of the round-trip latency of requests in steady state, from
+ * queueing to completion, and the CPU time consumed by the process per frame.
+ */
+TEST_P(Performance, CaptureLatency)
+{
+	CaptureBenchmark capture(camera_);
+
+	capture.configure(GetParam());
+
+	microseconds cpuStart = cpuTime();
+	capture.capture(NumRequests);
+	microseconds cpu = cpuTime() - cpuStart;
+
+	std::vector<steady_clock::duration> latencies = capture.latencies();
+	ASSERT_FALSE(latencies.empty()) << "No steady-state request completed";
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](unsigned int percent) {
+		unsigned int index = (latencies.size() - 1) * percent / 100;
+		return toMicroseconds(latencies[index]);
+	};
+
+	report("time_to_first_frame_us", toMicroseconds(capture.timeToFirstFrame()));
+	report("latency_p50_us", percentile(50));
+	report("latency_p90_us", percentile(90));
+	report("latency_p99_us", percentile(99));
+	report("latency_max_us", toMicroseconds(latencies.back()));
+	report("frame_interval_us",
+	       toMicroseconds(capture.captureTime()) / (NumRequests - 1));
+	report("cpu_per_frame_us", cpu.count() / NumRequests);
+}
+
+/*
+ * Measure the reconfiguration time
+ *
+ * Reports the time to stop the camera, configure it again, allocate buffers and
+ * restart it, up to the completion of the first request with the new
+ * configuration.
+ */
+TEST_P(Performance, Reconfiguration)
+{
+	CaptureBenchmark capture(camera_);
+
+	capture.configure(GetParam());
+	capture.capture(NumRequests / 10);
+
+	steady_clock::duration total{};
+	steady_clock::duration worst{};
+
+	for (unsigned int i = 0; i < NumReconfigurations; i++) {
+		steady_clock::duration duration = capture.stopTime();
+
+		steady_clock::time_point start = steady_clock::now();
+		capture.configure(GetParam());
+		duration += steady_clock::now() - start;
+
+		capture.capture(1);
+		duration += capture.setupTime() + capture.timeToFirstFrame();
+
+		total += duration;
+		worst = std::max(worst, duration);
+	}
+
+	report("reconfigure_mean_us", toMicroseconds(total) / NumReconfigurations);
+	report("reconfigure_max_us", toMicroseconds(worst));
+}
+
+INSTANTIATE_TEST_SUITE_P(PerformanceTests,
+			 Performance,
+			 testing::ValuesIn(ROLES),
+			 Performance::nameParameters);
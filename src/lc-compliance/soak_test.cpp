@@ -0,0 +1,434 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * soak_test.cpp - Long running camera capture tests
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits.h>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "environment.h"
+#include "simple_capture.h"
+
+using namespace libcamera;
+using namespace std::chrono;
+
+namespace {
+
+/*
+ * Memory allocated by the process and file descriptors opened during the
+ * first seconds of capture, such as lazily initialized caches, are not
+ * considered as leaks. The resources usage is sampled after a warm-up
+ * capture.
+ */
+constexpr seconds WarmupDuration = seconds(2);
+
+/* Duration of each capture session in the reconfiguration cycles. */
+constexpr milliseconds CycleDuration = milliseconds(500);
+
+/* Number of frames over which the steady-state latency is averaged. */
+constexpr unsigned int LatencyWindow = 100;
+
+/* Resident memory growth tolerated over a soak test, in bytes. */
+constexpr int64_t MaxMemoryGrowth = 8 << 20;
+
+struct ResourceUsage {
+	int64_t rss;
+	unsigned int fds;
+};
+
+ResourceUsage resourceUsage()
+{
+	ResourceUsage usage{};
+
+	/* The second field of statm is the resident set size in pages. */
+	std::ifstream statm("/proc/self/statm");
+	int64_t size, resident;
+	if (statm >> size >> resident)
+		usage.rss = resident * sysconf(_SC_PAGESIZE);
+
+	DIR *dir = opendir("/proc/self/fd");
+	if (dir) {
+		struct dirent *ent;
+		while ((ent = readdir(dir)) != nullptr) {
+			if (ent->d_name[0] != '.')
+				usage.fds++;
+		}
+
+		closedir(dir);
+	}
+
+	return usage;
+}
+
+int64_t toMicroseconds(steady_clock::duration duration)
+{
+	return duration_cast<microseconds>(duration).count();
+}
+
+void report(const std::string &key, int64_t value)
+{
+	testing::Test::RecordProperty(key, std::to_string(value));
+	std::cout << std::setw(24) << std::left << key << value << std::endl;
+}
+
+} /* namespace */
+
+class SoakCapture : public SimpleCapture
+{
+public:
+	SoakCapture(std::shared_ptr<Camera> camera)
+		: SimpleCapture(camera)
+	{
+	}
+
+	~SoakCapture()
+	{
+		stop();
+	}
+
+	/*
+	 * Configure the camera with one stream per role. Adjusted
+	 * configurations are accepted, as not all cameras support all
+	 * combinations of roles with their default sizes.
+	 */
+	void configure(const StreamRoles &roles)
+	{
+		config_ = camera_->generateConfiguration(roles);
+		if (!config_) {
+			std::cout << "Roles not supported by camera" << std::endl;
+			GTEST_SKIP();
+		}
+
+		if (config_->validate() == CameraConfiguration::Invalid) {
+			config_.reset();
+			std::cout << "Stream combination not supported by camera" << std::endl;
+			GTEST_SKIP();
+		}
+
+		if (camera_->configure(config_.get())) {
+			config_.reset();
+			FAIL() << "Failed to configure camera";
+		}
+	}
+
+	/*
+	 * Allocate buffers for all streams, start the camera, and keep all
+	 * requests queued until the duration elapses. The request depth is the
+	 * smallest number of buffers allocated for a stream.
+	 */
+	void capture(steady_clock::duration duration)
+	{
+		unsigned int depth = UINT_MAX;
+		for (const StreamConfiguration &cfg : *config_) {
+			int count = allocator_->allocate(cfg.stream());
+			ASSERT_GT(count, 0) << "Failed to allocate buffers";
+			depth = std::min<unsigned int>(depth, count);
+		}
+
+		requests_.clear();
+		for (unsigned int i = 0; i < depth; i++) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			ASSERT_TRUE(request) << "Can't create request";
+
+			for (const StreamConfiguration &cfg : *config_) {
+				Stream *stream = cfg.stream();
+				const std::unique_ptr<FrameBuffer> &buffer =
+					allocator_->buffers(stream)[i];
+				ASSERT_EQ(request->addBuffer(stream, buffer.get()), 0)
+					<< "Can't set buffer for request";
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		captureCount_ = 0;
+		failed_ = 0;
+		drops_ = 0;
+		hasSequence_ = false;
+		lastSequence_ = 0;
+		latencies_.clear();
+		latencySum_ = {};
+		earlyLatency_ = {};
+		stopping_ = false;
+
+		camera_->requestCompleted.connect(this, &SoakCapture::requestComplete);
+
+		deadline_ = steady_clock::now() + duration;
+		ASSERT_EQ(camera_->start(), 0) << "Failed to start camera";
+
+		for (std::unique_ptr<Request> &request : requests_)
+			ASSERT_EQ(queueRequest(request.get()), 0) << "Failed to queue request";
+
+		loop_ = new EventLoop();
+		int status = loop_->exec();
+		delete loop_;
+		loop_ = nullptr;
+
+		stop();
+
+		ASSERT_EQ(status, 0) << "Failed to queue request";
+		ASSERT_EQ(failed_, 0U) << "Requests completed with errors";
+		ASSERT_GT(captureCount_, 0U) << "No request completed";
+	}
+
+	unsigned int captureCount() const { return captureCount_; }
+	unsigned int drops() const { return drops_; }
+
+	/*
+	 * The latency drift is the difference between the mean request latency
+	 * over the last frames of the capture and over the first frames in
+	 * steady state.
+	 */
+	steady_clock::duration latencyDrift() const
+	{
+		if (latencies_.size() < LatencyWindow || earlyLatency_ == steady_clock::duration{})
+			return {};
+
+		return latencySum_ / LatencyWindow - earlyLatency_;
+	}
+
+private:
+	void stop()
+	{
+		if (!config_ || !allocator_->allocated())
+			return;
+
+		camera_->stop();
+		camera_->requestCompleted.disconnect(this);
+
+		for (const StreamConfiguration &cfg : *config_)
+			allocator_->free(cfg.stream());
+
+		requests_.clear();
+	}
+
+	int queueRequest(Request *request)
+	{
+		std::lock_guard<std::mutex> locker(lock_);
+		queueTimes_[request] = steady_clock::now();
+		return camera_->queueRequest(request);
+	}
+
+	void requestComplete(Request *request) override
+	{
+		steady_clock::time_point now = steady_clock::now();
+
+		if (stopping_)
+			return;
+
+		if (request->status() != Request::RequestComplete) {
+			failed_++;
+			stopping_ = true;
+			loop_->exit(0);
+			return;
+		}
+
+		/* Count the frames skipped by the first stream. */
+		const FrameMetadata &metadata =
+			request->buffers().begin()->second->metadata();
+		if (hasSequence_ && metadata.sequence > lastSequence_ + 1)
+			drops_ += metadata.sequence - lastSequence_ - 1;
+		lastSequence_ = metadata.sequence;
+		hasSequence_ = true;
+
+		/*
+		 * The first requests are queued before streaming starts, don't
+		 * include them in the steady-state latency.
+		 */
+		if (captureCount_ >= requests_.size()) {
+			std::lock_guard<std::mutex> locker(lock_);
+			steady_clock::duration latency = now - queueTimes_[request];
+
+			latencies_.push_back(latency);
+			latencySum_ += latency;
+			if (latencies_.size() > LatencyWindow) {
+				latencySum_ -= latencies_.front();
+				latencies_.pop_front();
+			}
+
+			if (latencies_.size() == LatencyWindow &&
+			    earlyLatency_ == steady_clock::duration{})
+				earlyLatency_ = latencySum_ / LatencyWindow;
+		}
+
+		captureCount_++;
+		if (now >= deadline_) {
+			stopping_ = true;
+			loop_->exit(0);
+			return;
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		if (queueRequest(request)) {
+			stopping_ = true;
+			loop_->exit(-EINVAL);
+		}
+	}
+
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	std::mutex lock_;
+	std::map<Request *, steady_clock::time_point> queueTimes_;
+	std::deque<steady_clock::duration> latencies_;
+	steady_clock::duration latencySum_;
+	steady_clock::duration earlyLatency_;
+
+	steady_clock::time_point deadline_;
+	bool stopping_;
+
+	unsigned int captureCount_;
+	unsigned int failed_;
+	unsigned int drops_;
+	bool hasSequence_;
+	unsigned int lastSequence_;
+};
+
+class Soak : public testing::TestWithParam<StreamRoles>
+{
+public:
+	static std::string nameParameters(const testing::TestParamInfo<Soak::ParamType> &info);
+
+protected:
+	void SetUp() override;
+	void TearDown() override;
+
+	void checkResources(const ResourceUsage &before);
+
+	std::shared_ptr<Camera> camera_;
+};
+
+void Soak::SetUp()
+{
+	Environment *env = Environment::get();
+
+	camera_ = env->cm()->get(env->cameraId());
+
+	ASSERT_EQ(camera_->acquire(), 0);
+}
+
+void Soak::TearDown()
+{
+	if (!camera_)
+		return;
+
+	camera_->release();
+	camera_.reset();
+}
+
+std::string Soak::nameParameters(const testing::TestParamInfo<Soak::ParamType> &info)
+{
+	std::map<StreamRole, std::string> rolesMap = { { Raw, "Raw" },
+						       { StillCapture, "StillCapture" },
+						       { VideoRecording, "VideoRecording" },
+						       { Viewfinder, "Viewfinder" } };
+
+	std::string name;
+	for (StreamRole role : info.param) {
+		if (!name.empty())
+			name += "_";
+		name += rolesMap[role];
+	}
+
+	return name;
+}
+
+/*
+ * Report the growth of the resident memory and of the number of open file
+ * descriptors, and fail if the process leaks resources.
+ */
+void Soak::checkResources(const ResourceUsage &before)
+{
+	ResourceUsage after = resourceUsage();
+	int64_t memoryGrowth = after.rss - before.rss;
+	int64_t fdGrowth = static_cast<int64_t>(after.fds) - before.fds;
+
+	report("memory_growth_kb", memoryGrowth / 1024);
+	report("fd_growth", fdGrowth);
+
+	EXPECT_LE(memoryGrowth, MaxMemoryGrowth) << "Memory usage keeps growing";
+	EXPECT_LE(fdGrowth, 0) << "File descriptors are leaking";
+}
+
+/*
+ * Capture continuously at the maximum request depth
+ *
+ * Keeps all the requests queued for the soak duration. Reports the number of
+ * frames captured and dropped and the drift of the request latency, and checks
+ * that resources don't leak. Example failure is a pipeline handler that
+ * accumulates per-frame state.
+ */
+TEST_P(Soak, Capture)
+{
+	SoakCapture capture(camera_);
+
+	capture.configure(GetParam());
+	capture.capture(WarmupDuration);
+
+	ResourceUsage before = resourceUsage();
+
+	capture.capture(Environment::get()->soakDuration());
+
+	report("frames", capture.captureCount());
+	report("frame_drops", capture.drops());
+	report("latency_drift_us", toMicroseconds(capture.latencyDrift()));
+
+	checkResources(before);
+}
+
+/*
+ * Repeatedly reconfigure, start and stop the camera
+ *
+ * Runs short capture sessions, each with a new configuration and new buffers,
+ * for the soak duration, and checks that resources don't leak. Example failure
+ * is a pipeline handler that doesn't release internal buffers on stop.
+ */
+TEST_P(Soak, Reconfigure)
+{
+	SoakCapture capture(camera_);
+
+	capture.configure(GetParam());
+	capture.capture(CycleDuration);
+
+	ResourceUsage before = resourceUsage();
+	steady_clock::time_point end = steady_clock::now() +
+				       Environment::get()->soakDuration();
+	unsigned int cycles = 0;
+	unsigned int drops = 0;
+
+	while (steady_clock::now() < end) {
+		capture.configure(GetParam());
+		capture.capture(CycleDuration);
+
+		drops += capture.drops();
+		cycles++;
+	}
+
+	report("cycles", cycles);
+	report("frame_drops", drops);
+
+	checkResources(before);
+}
+
+INSTANTIATE_TEST_SUITE_P(SoakTests,
+			 Soak,
+			 testing::Values(StreamRoles{ Raw },
+					 StreamRoles{ StillCapture },
+					 StreamRoles{ VideoRecording },
+					 StreamRoles{ Viewfinder },
+					 StreamRoles{ Viewfinder, StillCapture },
+					 StreamRoles{ VideoRecording, Viewfinder },
+					 StreamRoles{ Raw, VideoRecording }),
+			 Soak::nameParameters);
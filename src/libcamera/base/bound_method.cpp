@@ -49,6 +49,33 @@ namespace libcamera {
  * blocks until the receiver signals the completion of the invocation.
  */
 
+/**
+ * \brief Resolve the connection type for an invocation from the current thread
+ *
+ * Automatic connections are resolved to direct or queued connections, and
+ * blocking connections to direct connections, depending on whether the
+ * current thread is the thread of the receiver object. This allows callers to
+ * invoke the method directly without packing its arguments when the connection
+ * resolves to ConnectionTypeDirect.
+ *
+ * \return The effective connection type
+ */
+ConnectionType BoundMethodBase::connectionType() const
+{
+	ConnectionType type = connectionType_;
+	if (type == ConnectionTypeAuto) {
+		if (Thread::current() == object_->thread())
+			type = ConnectionTypeDirect;
+		else
+			type = ConnectionTypeQueued;
+	} else if (type == ConnectionTypeBlocking) {
+		if (Thread::current() == object_->thread())
+			type = ConnectionTypeDirect;
+	}
+
+	return type;
+}
+
 /**
  * \brief Invoke the bound method with packed arguments
  * \param[in] pack Packed arguments
@@ -67,18 +94,7 @@ namespace libcamera {
 bool BoundMethodBase::activatePack(std::shared_ptr<BoundMethodPackBase> pack,
 				   bool deleteMethod)
 {
-	ConnectionType type = connectionType_;
-	if (type == ConnectionTypeAuto) {
-		if (Thread::current() == object_->thread())
-			type = ConnectionTypeDirect;
-		else
-			type = ConnectionTypeQueued;
-	} else if (type == ConnectionTypeBlocking) {
-		if (Thread::current() == object_->thread())
-			type = ConnectionTypeDirect;
-	}
-
-	switch (type) {
+	switch (connectionType()) {
 	case ConnectionTypeDirect:
 	default:
 		invokePack(pack.get());
@@ -0,0 +1,248 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * coroutine.cpp - Coroutine support for asynchronous operations
+ */
+
+#include <libcamera/base/coroutine.h>
+
+/**
+ * \file base/coroutine.h
+ * \brief Coroutine support for asynchronous operations
+ *
+ * Asynchronous processing chains, such as a pipeline handler waiting for a
+ * buffer, calling the IPA and queuing the result to a device, are usually
+ * written as state machines driven by signals. C++20 coroutines allow writing
+ * them as linear code instead, suspending execution while waiting for an
+ * event.
+ *
+ * This file provides a Task type for coroutines, and awaitables for signals,
+ * event notifiers and method invocations on Object instances. All awaitables
+ * resume the coroutine from the event loop of the thread that suspended it,
+ * preserving the libcamera threading model: a coroutine runs in a single
+ * thread, and doesn't need to synchronize access to the data of the objects
+ * bound to that thread.
+ *
+ * libcamera itself is compiled in C++17 mode, the contents of this file are
+ * only available when compiling with C++20 coroutines support.
+ */
+
+namespace libcamera {
+
+/**
+ * \class Task
+ * \brief A coroutine returning a value of type \a T
+ * \tparam T The type of the value returned by the coroutine
+ *
+ * The Task class is the return type of libcamera coroutines. A coroutine is
+ * suspended when created, and starts executing when awaited by another
+ * coroutine, or when started with start() for a top-level coroutine. An
+ * awaiting coroutine is resumed with the returned value when the task
+ * completes.
+ *
+ * The Task owns the coroutine frame, which is destroyed with the Task. Frames
+ * are allocated from the MemoryPool. Destroying a task while it is suspended
+ * is allowed only when waiting for a signal or an event notifier.
+ */
+
+/**
+ * \fn Task::Task(Task &&other)
+ * \brief Move-construct a Task
+ * \param[in] other The other task
+ */
+
+/**
+ * \fn Task::operator=(Task &&other)
+ * \brief Move-assign a Task
+ * \param[in] other The other task
+ * \return A reference to this task
+ */
+
+/**
+ * \fn Task::start()
+ * \brief Start executing a top-level coroutine
+ *
+ * The coroutine executes until it suspends or completes. This function shall
+ * not be called on tasks awaited by other coroutines.
+ */
+
+/**
+ * \fn Task::done()
+ * \brief Check if the coroutine has completed
+ * \return True if the coroutine has completed, false otherwise
+ */
+
+/**
+ * \typedef Task::promise_type
+ * \brief The coroutine promise type
+ */
+
+/**
+ * \fn Task::await_ready()
+ * \brief Awaitable interface, don't call directly
+ * \return False
+ */
+
+/**
+ * \fn Task::await_suspend()
+ * \brief Awaitable interface, don't call directly
+ * \param[in] caller The awaiting coroutine
+ * \return The coroutine to resume
+ */
+
+/**
+ * \fn Task::await_resume()
+ * \brief Awaitable interface, don't call directly
+ * \return The value returned by the coroutine
+ */
+
+/**
+ * \class SignalAwaiter
+ * \brief Awaitable waiting for the next emission of a signal
+ * \tparam Args The signal arguments
+ *
+ * The coroutine is resumed from the event loop after the signal is emitted,
+ * with the emitted arguments as the result of the co_await expression. A
+ * signal with no argument yields void, a signal with a single argument yields
+ * the argument value, and a signal with multiple arguments yields a
+ * std::tuple. Only the first emission after the coroutine suspends is taken
+ * into account.
+ *
+ * Instances are created with awaitSignal().
+ */
+
+/**
+ * \fn SignalAwaiter::SignalAwaiter()
+ * \brief Construct a SignalAwaiter
+ * \param[in] signal The signal to wait for
+ */
+
+/**
+ * \fn SignalAwaiter::await_ready()
+ * \brief Awaitable interface, don't call directly
+ * \return False
+ */
+
+/**
+ * \fn SignalAwaiter::await_suspend()
+ * \brief Awaitable interface, don't call directly
+ * \param[in] handle The awaiting coroutine
+ */
+
+/**
+ * \fn SignalAwaiter::await_resume()
+ * \brief Awaitable interface, don't call directly
+ * \return The emitted arguments
+ */
+
+/**
+ * \class NotifierAwaiter
+ * \brief Awaitable waiting for an event notifier to be activated
+ *
+ * The event notifier is enabled when the coroutine suspends, and disabled when
+ * it gets activated. The coroutine is then resumed from the event loop.
+ *
+ * Instances are created with awaitNotifier().
+ */
+
+/**
+ * \fn NotifierAwaiter::NotifierAwaiter()
+ * \brief Construct a NotifierAwaiter
+ * \param[in] notifier The event notifier to wait for
+ */
+
+/**
+ * \fn NotifierAwaiter::await_ready()
+ * \brief Awaitable interface, don't call directly
+ * \return False
+ */
+
+/**
+ * \fn NotifierAwaiter::await_suspend()
+ * \brief Awaitable interface, don't call directly
+ * \param[in] handle The awaiting coroutine
+ */
+
+/**
+ * \fn NotifierAwaiter::await_resume()
+ * \brief Awaitable interface, don't call directly
+ */
+
+/**
+ * \class InvokeAwaiter
+ * \brief Awaitable invoking a method in the thread of an Object
+ * \tparam T The object type
+ * \tparam R The method return type
+ * \tparam FuncArgs The method argument types
+ *
+ * The method is invoked in the thread the object is bound to, and the
+ * coroutine is resumed from the event loop of its own thread with the method
+ * return value as the result of the co_await expression. If the object is
+ * bound to the coroutine thread, the method is invoked synchronously without
+ * suspending the coroutine.
+ *
+ * The task shall not be destroyed while the method invocation is in progress.
+ *
+ * Instances are created with invokeAsync().
+ */
+
+/**
+ * \fn InvokeAwaiter::InvokeAwaiter()
+ * \brief Construct an InvokeAwaiter
+ * \param[in] object The object to invoke the method on
+ * \param[in] func The method to invoke
+ * \param[in] args The method arguments
+ */
+
+/**
+ * \fn InvokeAwaiter::await_ready()
+ * \brief Awaitable interface, don't call directly
+ * \return True if the method has been invoked synchronously, false otherwise
+ */
+
+/**
+ * \fn InvokeAwaiter::await_suspend()
+ * \brief Awaitable interface, don't call directly
+ * \param[in] handle The awaiting coroutine
+ */
+
+/**
+ * \fn InvokeAwaiter::await_resume()
+ * \brief Awaitable interface, don't call directly
+ * \return The method return value
+ */
+
+/**
+ * \fn awaitSignal()
+ * \brief Wait for the next emission of a signal in a coroutine
+ * \param[in] signal The signal
+ *
+ * \code{.cpp}
+ * FrameBuffer *buffer = co_await awaitSignal(video->bufferReady);
+ * \endcode
+ *
+ * \return An awaitable yielding the emitted arguments
+ */
+
+/**
+ * \fn awaitNotifier()
+ * \brief Wait for an event notifier to be activated in a coroutine
+ * \param[in] notifier The event notifier
+ * \return An awaitable resuming the coroutine when \a notifier is activated
+ */
+
+/**
+ * \fn invokeAsync()
+ * \brief Invoke a method in the thread of an object from a coroutine
+ * \param[in] object The object
+ * \param[in] func The method to invoke
+ * \param[in] args The method arguments
+ *
+ * The arguments are copied and the method invoked in the thread \a object is
+ * bound to, without blocking the thread running the coroutine.
+ *
+ * \return An awaitable yielding the method return value
+ */
+
+} /* namespace libcamera */
@@ -0,0 +1,375 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * event_dispatcher_epoll.cpp - Epoll-based event dispatcher
+ */
+
+#include <libcamera/base/event_dispatcher_epoll.h>
+
+#include <chrono>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file base/event_dispatcher_epoll.h
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+static const char *notifierType(EventNotifier::Type type)
+{
+	if (type == EventNotifier::Read)
+		return "read";
+	if (type == EventNotifier::Write)
+		return "write";
+	if (type == EventNotifier::Exception)
+		return "exception";
+
+	return "";
+}
+
+/**
+ * \class EventDispatcherEpoll
+ * \brief An epoll-based event dispatcher
+ *
+ * The EventDispatcherEpoll keeps the file descriptors of the registered event
+ * notifiers in an epoll instance, updated when notifiers are registered and
+ * unregistered. Only the file descriptors that are ready are reported when
+ * processing events, making the cost of the event loop proportional to the
+ * number of events instead of the number of registered notifiers.
+ *
+ * Timers are implemented with a timerfd armed with the earliest timer deadline,
+ * providing the same precision as the timers themselves.
+ *
+ * As epoll tracks open file descriptions, a file descriptor shall not be closed
+ * before all the event notifiers watching it have been disabled or destroyed.
+ */
+
+EventDispatcherEpoll::EventDispatcherEpoll()
+	: timerDeadline_(), processingFd_(-1)
+{
+	/*
+	 * Create the epoll, event and timer fds. Failures are fatal as we
+	 * can't implement an interruptible dispatcher without them.
+	 */
+	epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create epoll instance";
+
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create eventfd";
+
+	timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timerfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create timerfd";
+
+	for (int fd : { eventfd_, timerfd_ }) {
+		struct epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+
+		if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &event) < 0)
+			LOG(Event, Fatal) << "Unable to watch fd " << fd;
+	}
+}
+
+EventDispatcherEpoll::~EventDispatcherEpoll()
+{
+	close(timerfd_);
+	close(eventfd_);
+	close(epollfd_);
+}
+
+void EventDispatcherEpoll::registerEventNotifier(EventNotifier *notifier)
+{
+	EventNotifierSetEpoll &set = notifiers_[notifier->fd()];
+	EventNotifier::Type type = notifier->type();
+
+	if (set.notifiers[type] && set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< "Ignoring duplicate " << notifierType(type)
+			<< " notifier for fd " << notifier->fd();
+		return;
+	}
+
+	set.notifiers[type] = notifier;
+	update(notifier->fd(), set);
+}
+
+void EventDispatcherEpoll::unregisterEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+	EventNotifier::Type type = notifier->type();
+
+	if (!set.notifiers[type])
+		return;
+
+	if (set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< notifierType(type) << " notifier for fd "
+			<< notifier->fd() << " is not registered";
+		return;
+	}
+
+	set.notifiers[type] = nullptr;
+	update(notifier->fd(), set);
+
+	/*
+	 * Don't race with event processing if this function is called from an
+	 * event notifier for the same fd. The notifiers_ entry will be erased
+	 * by processNotifiers().
+	 */
+	if (processingFd_ == notifier->fd())
+		return;
+
+	if (!set.notifiers[0] && !set.notifiers[1] && !set.notifiers[2])
+		notifiers_.erase(iter);
+}
+
+void EventDispatcherEpoll::registerTimer(Timer *timer)
+{
+	timers_.emplace(timer->deadline(), timer);
+}
+
+void EventDispatcherEpoll::unregisterTimer(Timer *timer)
+{
+	auto range = timers_.equal_range(timer->deadline());
+	for (auto iter = range.first; iter != range.second; ++iter) {
+		if (iter->second == timer) {
+			timers_.erase(iter);
+			return;
+		}
+	}
+}
+
+void EventDispatcherEpoll::processEvents()
+{
+	struct epoll_event events[MaxEvents];
+	int ret;
+
+	Thread::current()->dispatchMessages();
+
+	/* Wait for events and process notifiers and timers. */
+	do {
+		ret = wait(events);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Event, Warning) << "epoll_wait() failed with " << strerror(-ret);
+	} else if (ret > 0) {
+		processNotifiers(events, ret);
+	}
+
+	processTimers();
+}
+
+void EventDispatcherEpoll::interrupt()
+{
+	uint64_t value = 1;
+	ssize_t ret = write(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to interrupt event dispatcher ("
+			<< ret << ")";
+	}
+}
+
+uint32_t EventDispatcherEpoll::EventNotifierSetEpoll::events() const
+{
+	uint32_t events = 0;
+
+	if (notifiers[EventNotifier::Read])
+		events |= EPOLLIN;
+	if (notifiers[EventNotifier::Write])
+		events |= EPOLLOUT;
+	if (notifiers[EventNotifier::Exception])
+		events |= EPOLLPRI;
+
+	return events;
+}
+
+int EventDispatcherEpoll::wait(struct epoll_event *events)
+{
+	/*
+	 * Arm the timerfd with the earliest timer deadline, or don't wait at
+	 * all if the deadline has already passed.
+	 */
+	int timeout = -1;
+
+	if (!timers_.empty()) {
+		std::chrono::steady_clock::time_point deadline = timers_.begin()->first;
+
+		if (deadline > utils::clock::now())
+			armTimer(deadline);
+		else
+			timeout = 0;
+	} else {
+		armTimer({});
+	}
+
+	return epoll_wait(epollfd_, events, MaxEvents, timeout);
+}
+
+void EventDispatcherEpoll::armTimer(std::chrono::steady_clock::time_point deadline)
+{
+	if (deadline == timerDeadline_)
+		return;
+
+	/* A zero deadline disarms the timer. */
+	struct itimerspec spec = {};
+	spec.it_value = utils::duration_to_timespec(deadline.time_since_epoch());
+
+	if (timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+		LOG(Event, Error)
+			<< "Failed to arm timer: " << strerror(errno);
+		return;
+	}
+
+	timerDeadline_ = deadline;
+
+	LOG(Event, Debug)
+		<< "timer deadline " << utils::time_point_to_string(deadline);
+}
+
+void EventDispatcherEpoll::update(int fd, EventNotifierSetEpoll &set)
+{
+	uint32_t events = set.events();
+	if (events == set.registered)
+		return;
+
+	struct epoll_event event = {};
+	event.events = events;
+	event.data.fd = fd;
+
+	int op = !set.registered ? EPOLL_CTL_ADD
+	       : events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+
+	if (epoll_ctl(epollfd_, op, fd, &event) < 0) {
+		int ret = -errno;
+
+		/*
+		 * The file descriptor is removed from the epoll instance when
+		 * it gets closed, there's nothing left to remove in that case.
+		 */
+		if (op == EPOLL_CTL_DEL) {
+			set.registered = 0;
+			return;
+		}
+
+		LOG(Event, Warning)
+			<< "Failed to watch fd " << fd << ": " << strerror(-ret);
+
+		if (op == EPOLL_CTL_ADD)
+			return;
+	}
+
+	set.registered = events;
+}
+
+void EventDispatcherEpoll::processInterrupt()
+{
+	uint64_t value;
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process interrupt (" << ret << ")";
+	}
+}
+
+void EventDispatcherEpoll::processNotifiers(const struct epoll_event *events,
+					    unsigned int count)
+{
+	static const struct {
+		EventNotifier::Type type;
+		uint32_t events;
+	} types[] = {
+		{ EventNotifier::Read, EPOLLIN },
+		{ EventNotifier::Write, EPOLLOUT },
+		{ EventNotifier::Exception, EPOLLPRI },
+	};
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const struct epoll_event &event = events[i];
+		int fd = event.data.fd;
+
+		if (fd == eventfd_) {
+			processInterrupt();
+			continue;
+		}
+
+		if (fd == timerfd_) {
+			/* Timers are processed by processTimers(). */
+			uint64_t expirations;
+			if (read(timerfd_, &expirations, sizeof(expirations)) < 0 &&
+			    errno != EAGAIN)
+				LOG(Event, Error) << "Failed to read timerfd";
+			continue;
+		}
+
+		/*
+		 * The notifiers for the fd may have been unregistered by a
+		 * previous notifier.
+		 */
+		auto iter = notifiers_.find(fd);
+		if (iter == notifiers_.end())
+			continue;
+
+		EventNotifierSetEpoll &set = iter->second;
+
+		processingFd_ = fd;
+
+		for (const auto &type : types) {
+			EventNotifier *notifier = set.notifiers[type.type];
+
+			if (notifier && event.events & type.events)
+				notifier->activated.emit(notifier);
+		}
+
+		processingFd_ = -1;
+
+		/* Erase the notifiers_ entry if it is now empty. */
+		if (!set.notifiers[0] && !set.notifiers[1] && !set.notifiers[2])
+			notifiers_.erase(iter);
+	}
+}
+
+void EventDispatcherEpoll::processTimers()
+{
+	utils::time_point now = utils::clock::now();
+
+	while (!timers_.empty()) {
+		auto iter = timers_.begin();
+		if (iter->first > now)
+			break;
+
+		Timer *timer = iter->second;
+		timers_.erase(iter);
+		timer->stop();
+		timer->timeout.emit(timer);
+	}
+}
+
+} /* namespace libcamera */
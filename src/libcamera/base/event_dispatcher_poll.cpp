@@ -114,30 +114,17 @@ void EventDispatcherPoll::unregisterEventNotifier(EventNotifier *notifier)
 
 void EventDispatcherPoll::registerTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if ((*iter)->deadline() > timer->deadline()) {
-			timers_.insert(iter, timer);
-			return;
-		}
-	}
-
-	timers_.push_back(timer);
+	timers_.emplace(timer->deadline(), timer);
 }
 
 void EventDispatcherPoll::unregisterTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if (*iter == timer) {
+	auto range = timers_.equal_range(timer->deadline());
+	for (auto iter = range.first; iter != range.second; ++iter) {
+		if (iter->second == timer) {
 			timers_.erase(iter);
 			return;
 		}
-
-		/*
-		 * As the timers list is ordered, we can stop as soon as we go
-		 * past the deadline.
-		 */
-		if ((*iter)->deadline() > timer->deadline())
-			break;
 	}
 }
 
@@ -203,7 +190,7 @@ short EventDispatcherPoll::EventNotifierSetPoll::events() const
 int EventDispatcherPoll::poll(std::vector<struct pollfd> *pollfds)
 {
 	/* Compute the timeout. */
-	Timer *nextTimer = !timers_.empty() ? timers_.front() : nullptr;
+	Timer *nextTimer = !timers_.empty() ? timers_.begin()->second : nullptr;
 	struct timespec timeout;
 
 	if (nextTimer) {
@@ -294,11 +281,12 @@ void EventDispatcherPoll::processTimers()
 	utils::time_point now = utils::clock::now();
 
 	while (!timers_.empty()) {
-		Timer *timer = timers_.front();
-		if (timer->deadline() > now)
+		auto iter = timers_.begin();
+		if (iter->first > now)
 			break;
 
-		timers_.pop_front();
+		Timer *timer = iter->second;
+		timers_.erase(iter);
 		timer->stop();
 		timer->timeout.emit(timer);
 	}
@@ -7,19 +7,29 @@
 
 #include <libcamera/base/log.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #if HAVE_BACKTRACE
 #include <execinfo.h>
 #endif
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <thread>
 #include <time.h>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <libcamera/logging.h>
 
@@ -53,6 +63,22 @@
  * the file. The file must be writable and is truncated if it exists. If any
  * error occurs when opening the file, the file is ignored and the log is output
  * to stderr.
+ *
+ * Log messages are written synchronously by default, in the context of the
+ * thread that logs them. When the LIBCAMERA_LOG_ASYNC environment variable is
+ * set to a non-empty value, or when asynchronous logging is enabled with
+ * logSetAsync(), messages are instead queued to a per-thread ring buffer and
+ * formatted and written by a background thread. Messages that don't fit in the
+ * ring buffer are dropped, and the number of dropped messages is reported in
+ * the log. Fatal messages are always written synchronously, after all queued
+ * messages.
+ *
+ * Log files are written in text format by default. Setting the
+ * LIBCAMERA_LOG_FORMAT environment variable to "binary", or passing true to the
+ * \a binary argument of logSetFile(), selects a compact binary format instead,
+ * which avoids formatting the timestamp, severity, category and file
+ * information of every message. Binary log files can be converted to text with
+ * the utils/decode-log.py script.
  */
 
 /**
@@ -98,6 +124,23 @@ static const char *log_severity_name(LogSeverity severity)
 		return "UNKWN";
 }
 
+/**
+ * \brief A log message ready to be written to a log output
+ *
+ * The LogRecord stores the information needed to format a log message, captured
+ * in the context of the thread that logs the message, to allow deferring
+ * formatting to a different thread.
+ */
+struct LogRecord {
+	utils::time_point timestamp;
+	pid_t tid;
+	LogSeverity severity;
+	const LogCategory *category;
+	const char *fileName;
+	unsigned int line;
+	std::string msg;
+};
+
 /**
  * \brief Log output
  *
@@ -106,31 +149,60 @@ static const char *log_severity_name(LogSeverity severity)
 class LogOutput
 {
 public:
-	LogOutput(const char *path);
+	LogOutput(const char *path, bool binary);
 	LogOutput(std::ostream *stream);
 	LogOutput();
 	~LogOutput();
 
 	bool isValid() const;
-	void write(const LogMessage &msg);
+	void write(const LogRecord &record);
 	void write(const std::string &msg);
 
 private:
+	enum BinaryRecordType : uint8_t {
+		BinaryRecordCategory = 1,
+		BinaryRecordLocation = 2,
+		BinaryRecordMessage = 3,
+		BinaryRecordText = 4,
+	};
+
 	void writeSyslog(LogSeverity severity, const std::string &msg);
 	void writeStream(const std::string &msg);
+	void writeBinary(const LogRecord &record);
+	void writeBinary(const std::string &str);
 
 	std::ostream *stream_;
 	LoggingTarget target_;
+
+	bool binary_;
+	std::mutex binaryMutex_;
+	std::string binaryBuffer_;
+	std::unordered_map<const LogCategory *, uint16_t> categoryIds_;
+	std::map<std::pair<const char *, unsigned int>, uint32_t> locationIds_;
 };
 
 /**
  * \brief Construct a log output based on a file
  * \param[in] path Full path to log file
+ * \param[in] binary True to write the log in binary format
  */
-LogOutput::LogOutput(const char *path)
-	: target_(LoggingTargetFile)
+LogOutput::LogOutput(const char *path, bool binary)
+	: target_(LoggingTargetFile), binary_(binary)
 {
-	stream_ = new std::ofstream(path);
+	if (!binary) {
+		stream_ = new std::ofstream(path);
+		return;
+	}
+
+	stream_ = new std::ofstream(path, std::ios::binary);
+
+	/*
+	 * The file header is made of a magic number, written in native byte
+	 * order to let the decoder detect endianness, followed by the format
+	 * version.
+	 */
+	const uint32_t header[2] = { 0x4c43424c, 1 };
+	stream_->write(reinterpret_cast<const char *>(header), sizeof(header));
 }
 
 /**
@@ -138,7 +210,7 @@ LogOutput::LogOutput(const char *path)
  * \param[in] stream Stream to send log output to
  */
 LogOutput::LogOutput(std::ostream *stream)
-	: stream_(stream), target_(LoggingTargetStream)
+	: stream_(stream), target_(LoggingTargetStream), binary_(false)
 {
 }
 
@@ -146,7 +218,7 @@ LogOutput::LogOutput(std::ostream *stream)
  * \brief Construct a log output to syslog
  */
 LogOutput::LogOutput()
-	: stream_(nullptr), target_(LoggingTargetSyslog)
+	: stream_(nullptr), target_(LoggingTargetSyslog), binary_(false)
 {
 	openlog("libcamera", LOG_PID, 0);
 }
@@ -183,26 +255,33 @@ bool LogOutput::isValid() const
 
 /**
  * \brief Write message to log output
- * \param[in] msg Message to write
+ * \param[in] record Message to write
  */
-void LogOutput::write(const LogMessage &msg)
+void LogOutput::write(const LogRecord &record)
 {
+	if (binary_) {
+		writeBinary(record);
+		return;
+	}
+
+	std::string fileInfo = std::string(utils::basename(record.fileName)) + ":"
+			     + std::to_string(record.line);
 	std::string str;
 
 	switch (target_) {
 	case LoggingTargetSyslog:
-		str = std::string(log_severity_name(msg.severity())) + " "
-		    + msg.category().name() + " " + msg.fileInfo() + " "
-		    + msg.msg();
-		writeSyslog(msg.severity(), str);
+		str = std::string(log_severity_name(record.severity)) + " "
+		    + record.category->name() + " " + fileInfo + " "
+		    + record.msg;
+		writeSyslog(record.severity, str);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
-		str = "[" + utils::time_point_to_string(msg.timestamp()) + "] ["
-		    + std::to_string(Thread::currentId()) + "] "
-		    + log_severity_name(msg.severity()) + " "
-		    + msg.category().name() + " " + msg.fileInfo() + " "
-		    + msg.msg();
+		str = "[" + utils::time_point_to_string(record.timestamp) + "] ["
+		    + std::to_string(record.tid) + "] "
+		    + log_severity_name(record.severity) + " "
+		    + record.category->name() + " " + fileInfo + " "
+		    + record.msg;
 		writeStream(str);
 		break;
 	default:
@@ -216,6 +295,11 @@ void LogOutput::write(const LogMessage &msg)
  */
 void LogOutput::write(const std::string &str)
 {
+	if (binary_) {
+		writeBinary(str);
+		return;
+	}
+
 	switch (target_) {
 	case LoggingTargetSyslog:
 		writeSyslog(LogDebug, str);
@@ -240,6 +324,191 @@ void LogOutput::writeStream(const std::string &str)
 	stream_->flush();
 }
 
+namespace {
+
+template<typename T>
+void appendBinary(std::string &buffer, T value)
+{
+	buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+} /* namespace */
+
+/*
+ * The binary log format is a sequence of records, each starting with a one
+ * byte BinaryRecordType and followed by native-endian fields:
+ *
+ * - BinaryRecordCategory: u16 category id, u16 name length, name
+ * - BinaryRecordLocation: u32 location id, u32 line, u16 file name length,
+ *   file name
+ * - BinaryRecordMessage: u64 timestamp in ns, u32 thread id, u8 severity,
+ *   u16 category id, u32 location id, u32 message length, message
+ * - BinaryRecordText: u32 text length, text
+ *
+ * Categories and locations are defined once, before the first message that
+ * references them, to avoid repeating the strings in every message.
+ */
+void LogOutput::writeBinary(const LogRecord &record)
+{
+	std::lock_guard<std::mutex> locker(binaryMutex_);
+
+	binaryBuffer_.clear();
+
+	auto category = categoryIds_.find(record.category);
+	if (category == categoryIds_.end()) {
+		const std::string &name = record.category->name();
+		uint16_t id = categoryIds_.size();
+
+		appendBinary<uint8_t>(binaryBuffer_, BinaryRecordCategory);
+		appendBinary<uint16_t>(binaryBuffer_, id);
+		appendBinary<uint16_t>(binaryBuffer_, name.size());
+		binaryBuffer_.append(name);
+
+		category = categoryIds_.emplace(record.category, id).first;
+	}
+
+	/* The file name is a string literal, its address identifies it. */
+	auto location = locationIds_.find({ record.fileName, record.line });
+	if (location == locationIds_.end()) {
+		const char *name = utils::basename(record.fileName);
+		uint16_t length = strlen(name);
+		uint32_t id = locationIds_.size();
+
+		appendBinary<uint8_t>(binaryBuffer_, BinaryRecordLocation);
+		appendBinary<uint32_t>(binaryBuffer_, id);
+		appendBinary<uint32_t>(binaryBuffer_, record.line);
+		appendBinary<uint16_t>(binaryBuffer_, length);
+		binaryBuffer_.append(name, length);
+
+		location = locationIds_.emplace(std::make_pair(record.fileName, record.line), id).first;
+	}
+
+	/* Drop the trailing newline, the decoder adds it back. */
+	size_t length = record.msg.size();
+	if (length && record.msg[length - 1] == '\n')
+		length--;
+
+	uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		record.timestamp.time_since_epoch()).count();
+
+	appendBinary<uint8_t>(binaryBuffer_, BinaryRecordMessage);
+	appendBinary<uint64_t>(binaryBuffer_, timestamp);
+	appendBinary<uint32_t>(binaryBuffer_, record.tid);
+	appendBinary<uint8_t>(binaryBuffer_, record.severity);
+	appendBinary<uint16_t>(binaryBuffer_, category->second);
+	appendBinary<uint32_t>(binaryBuffer_, location->second);
+	appendBinary<uint32_t>(binaryBuffer_, length);
+	binaryBuffer_.append(record.msg, 0, length);
+
+	stream_->write(binaryBuffer_.data(), binaryBuffer_.size());
+
+	/*
+	 * Only flush the stream for important messages, the cost of flushing is
+	 * significant compared to the cost of writing a binary record.
+	 */
+	if (record.severity >= LogWarning)
+		stream_->flush();
+}
+
+void LogOutput::writeBinary(const std::string &str)
+{
+	std::lock_guard<std::mutex> locker(binaryMutex_);
+
+	binaryBuffer_.clear();
+	appendBinary<uint8_t>(binaryBuffer_, BinaryRecordText);
+	appendBinary<uint32_t>(binaryBuffer_, str.size());
+	binaryBuffer_.append(str);
+
+	stream_->write(binaryBuffer_.data(), binaryBuffer_.size());
+	stream_->flush();
+}
+
+/**
+ * \brief Single-producer single-consumer ring buffer of log records
+ *
+ * Each thread that logs messages asynchronously owns a LogRing, to which it
+ * pushes records without locking. The records are popped by the log writer
+ * thread. When the ring is full, records are dropped and counted.
+ */
+class LogRing
+{
+public:
+	static constexpr unsigned int Size = 256;
+
+	LogRing()
+		: head_(0), tail_(0), dropped_(0), reported_(0)
+	{
+	}
+
+	bool push(LogRecord &&record);
+	bool pop(LogRecord *record);
+
+	uint64_t takeDropped();
+
+private:
+	std::array<LogRecord, Size> records_;
+	std::atomic<unsigned int> head_;
+	std::atomic<unsigned int> tail_;
+	std::atomic<uint64_t> dropped_;
+	uint64_t reported_;
+};
+
+/**
+ * \brief Push a record to the ring
+ * \param[in] record The record
+ *
+ * This function shall only be called by the thread that owns the ring.
+ *
+ * \return True if the record has been queued, false if it has been dropped
+ */
+bool LogRing::push(LogRecord &&record)
+{
+	unsigned int tail = tail_.load(std::memory_order_relaxed);
+	unsigned int head = head_.load(std::memory_order_acquire);
+
+	if (tail - head == Size) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	records_[tail % Size] = std::move(record);
+	tail_.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+/**
+ * \brief Pop a record from the ring
+ * \param[out] record The record
+ *
+ * This function shall only be called by the log writer thread.
+ *
+ * \return True if a record has been popped, false if the ring is empty
+ */
+bool LogRing::pop(LogRecord *record)
+{
+	unsigned int head = head_.load(std::memory_order_relaxed);
+	unsigned int tail = tail_.load(std::memory_order_acquire);
+
+	if (head == tail)
+		return false;
+
+	*record = std::move(records_[head % Size]);
+	head_.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+/**
+ * \brief Retrieve the number of records dropped since the last call
+ * \return The number of dropped records
+ */
+uint64_t LogRing::takeDropped()
+{
+	uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+	uint64_t count = dropped - reported_;
+	reported_ = dropped;
+	return count;
+}
+
 /**
  * \brief Message logger
  *
@@ -255,10 +524,11 @@ public:
 	void write(const LogMessage &msg);
 	void backtrace();
 
-	int logSetFile(const char *path);
+	int logSetFile(const char *path, bool binary);
 	int logSetStream(std::ostream *stream);
 	int logSetTarget(LoggingTarget target);
 	void logSetLevel(const char *category, const char *level);
+	void logSetAsync(bool async);
 
 private:
 	Logger();
@@ -270,10 +540,29 @@ private:
 	friend LogCategory;
 	void registerCategory(LogCategory *category);
 
+	void setOutput(std::shared_ptr<LogOutput> output);
+
+	LogRing *ring();
+	void flush();
+	void writerThread();
+	bool drain();
+
 	std::unordered_set<LogCategory *> categories_;
 	std::list<std::pair<std::string, LogSeverity>> levels_;
 
 	std::shared_ptr<LogOutput> output_;
+
+	std::atomic<bool> async_;
+	std::thread writer_;
+	std::atomic<bool> writerIdle_;
+
+	std::mutex mutex_;
+	std::condition_variable writerCv_;
+	std::condition_variable flushCv_;
+	std::vector<std::shared_ptr<LogRing>> rings_;
+	uint64_t flushRequest_;
+	uint64_t flushDone_;
+	bool stop_;
 };
 
 /**
@@ -296,18 +585,23 @@ private:
 /**
  * \brief Direct logging to a file
  * \param[in] path Full path to the log file
+ * \param[in] binary True to write the log in binary format
  *
  * This function directs the log output to the file identified by \a path. The
  * previous log target, if any, is closed, and all new log messages will be
  * written to the new log file.
  *
+ * When \a binary is true, log messages are written in a compact binary format
+ * that is cheaper to produce than text. The binary log can be converted to
+ * text with the utils/decode-log.py script.
+ *
  * If the function returns an error, the log target is not changed.
  *
  * \return Zero on success, or a negative error code otherwise
  */
-int logSetFile(const char *path)
+int logSetFile(const char *path, bool binary)
 {
-	return Logger::instance()->logSetFile(path);
+	return Logger::instance()->logSetFile(path, binary);
 }
 
 /**
@@ -370,8 +664,38 @@ void logSetLevel(const char *category, const char *level)
 	Logger::instance()->logSetLevel(category, level);
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] async True to write log messages asynchronously
+ *
+ * When asynchronous logging is enabled, log messages are queued to a ring
+ * buffer owned by the thread that logs them, and are formatted and written to
+ * the log output by a background thread. This minimizes the logging overhead
+ * in time-critical threads, at the cost of dropping messages when they are
+ * produced faster than they can be written. The number of dropped messages is
+ * reported in the log.
+ *
+ * Disabling asynchronous logging writes all queued messages before returning.
+ * Changing the log output also writes all queued messages to the previous
+ * output first.
+ */
+void logSetAsync(bool async)
+{
+	Logger::instance()->logSetAsync(async);
+}
+
 Logger::~Logger()
 {
+	if (writer_.joinable()) {
+		{
+			std::lock_guard<std::mutex> locker(mutex_);
+			stop_ = true;
+		}
+
+		writerCv_.notify_one();
+		writer_.join();
+	}
+
 	for (LogCategory *category : categories_)
 		delete category;
 }
@@ -396,11 +720,167 @@ Logger *Logger::instance()
  */
 void Logger::write(const LogMessage &msg)
 {
+	LogRecord record{ msg.timestamp(), Thread::currentId(), msg.severity(),
+			  &msg.category(), msg.fileName_, msg.line_, msg.msg() };
+
+	if (async_.load(std::memory_order_relaxed)) {
+		if (record.severity != LogFatal) {
+			ring()->push(std::move(record));
+
+			if (writerIdle_.exchange(false, std::memory_order_relaxed))
+				writerCv_.notify_one();
+			return;
+		}
+
+		/* Write the queued messages before the fatal message. */
+		flush();
+	}
+
 	std::shared_ptr<LogOutput> output = std::atomic_load(&output_);
 	if (!output)
 		return;
 
-	output->write(msg);
+	output->write(record);
+}
+
+/**
+ * \brief Retrieve the log ring of the current thread
+ *
+ * The ring is created and registered with the log writer the first time the
+ * thread logs a message asynchronously. The writer keeps a reference to the
+ * ring, and releases it when the thread has exited and the ring has been
+ * drained.
+ *
+ * \return The log ring of the current thread
+ */
+LogRing *Logger::ring()
+{
+	static thread_local std::shared_ptr<LogRing> ring;
+
+	if (!ring) {
+		ring = std::make_shared<LogRing>();
+
+		std::lock_guard<std::mutex> locker(mutex_);
+		rings_.push_back(ring);
+	}
+
+	return ring.get();
+}
+
+/**
+ * \brief Wait for the log writer to write all queued messages
+ */
+void Logger::flush()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	if (!writer_.joinable() || std::this_thread::get_id() == writer_.get_id())
+		return;
+
+	uint64_t request = ++flushRequest_;
+	writerCv_.notify_one();
+
+	flushCv_.wait(locker, [&]() { return flushDone_ >= request; });
+}
+
+/**
+ * \brief Write the messages queued in all log rings
+ *
+ * Records are written in timestamp order within each batch of records popped
+ * from the rings. This function shall only be called from the log writer
+ * thread, without holding the mutex_.
+ *
+ * \return True if any record has been written, false otherwise
+ */
+bool Logger::drain()
+{
+	std::vector<std::shared_ptr<LogRing>> rings;
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		/* Release the rings of threads that have exited. */
+		auto iter = std::partition(rings_.begin(), rings_.end(),
+					   [](const std::shared_ptr<LogRing> &ring) {
+						   return ring.use_count() > 1;
+					   });
+		rings.assign(rings_.begin(), rings_.end());
+		rings_.erase(iter, rings_.end());
+	}
+
+	std::vector<LogRecord> records;
+	std::vector<uint64_t> dropped;
+
+	for (const std::shared_ptr<LogRing> &ring : rings) {
+		LogRecord record;
+		while (ring->pop(&record))
+			records.push_back(std::move(record));
+
+		uint64_t count = ring->takeDropped();
+		if (count)
+			dropped.push_back(count);
+	}
+
+	if (records.empty() && dropped.empty())
+		return false;
+
+	std::stable_sort(records.begin(), records.end(),
+			 [](const LogRecord &a, const LogRecord &b) {
+				 return a.timestamp < b.timestamp;
+			 });
+
+	std::shared_ptr<LogOutput> output = std::atomic_load(&output_);
+	if (!output)
+		return true;
+
+	for (uint64_t count : dropped)
+		output->write("[" + utils::time_point_to_string(utils::clock::now())
+			      + "] " + std::to_string(count)
+			      + " log messages dropped\n");
+
+	for (const LogRecord &record : records)
+		output->write(record);
+
+	return true;
+}
+
+/**
+ * \brief Main function of the log writer thread
+ */
+void Logger::writerThread()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		uint64_t request = flushRequest_;
+		bool stop = stop_;
+
+		locker.unlock();
+
+		/*
+		 * Drain until the rings are empty, as records removed from rings
+		 * of exited threads are only released by the next drain.
+		 */
+		while (drain());
+
+		locker.lock();
+
+		flushDone_ = request;
+		flushCv_.notify_all();
+
+		if (stop)
+			break;
+
+		/*
+		 * Producers only wake up the writer when they see it idle.
+		 * Messages queued between the last drain and this point are
+		 * picked up after the timeout.
+		 */
+		writerIdle_.store(true, std::memory_order_relaxed);
+		writerCv_.wait_for(locker, std::chrono::milliseconds(10), [&]() {
+			return stop_ || flushRequest_ != flushDone_ ||
+			       !writerIdle_.load(std::memory_order_relaxed);
+		});
+	}
 }
 
 /**
@@ -438,18 +918,19 @@ void Logger::backtrace()
 /**
  * \brief Set the log file
  * \param[in] path Full path to the log file
+ * \param[in] binary True to write the log in binary format
  *
  * \sa libcamera::logSetFile()
  *
  * \return Zero on success, or a negative error code otherwise.
  */
-int Logger::logSetFile(const char *path)
+int Logger::logSetFile(const char *path, bool binary)
 {
-	std::shared_ptr<LogOutput> output = std::make_shared<LogOutput>(path);
+	std::shared_ptr<LogOutput> output = std::make_shared<LogOutput>(path, binary);
 	if (!output->isValid())
 		return -EINVAL;
 
-	std::atomic_store(&output_, output);
+	setOutput(output);
 	return 0;
 }
 
@@ -464,7 +945,7 @@ int Logger::logSetFile(const char *path)
 int Logger::logSetStream(std::ostream *stream)
 {
 	std::shared_ptr<LogOutput> output = std::make_shared<LogOutput>(stream);
-	std::atomic_store(&output_, output);
+	setOutput(output);
 	return 0;
 }
 
@@ -483,11 +964,10 @@ int Logger::logSetTarget(enum LoggingTarget target)
 	switch (target) {
 	case LoggingTargetSyslog:
 		output = std::make_shared<LogOutput>();
-		std::atomic_store(&output_, output);
+		setOutput(output);
 		break;
 	case LoggingTargetNone:
-		output = nullptr;
-		std::atomic_store(&output_, std::shared_ptr<LogOutput>());
+		setOutput(nullptr);
 		break;
 	default:
 		return -EINVAL;
@@ -517,13 +997,54 @@ void Logger::logSetLevel(const char *category, const char *level)
 	}
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] async True to write log messages asynchronously
+ *
+ * \sa libcamera::logSetAsync()
+ */
+void Logger::logSetAsync(bool async)
+{
+	if (async) {
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		if (!writer_.joinable())
+			writer_ = std::thread(&Logger::writerThread, this);
+
+		async_.store(true, std::memory_order_relaxed);
+		return;
+	}
+
+	async_.store(false, std::memory_order_relaxed);
+	flush();
+}
+
+/**
+ * \brief Replace the log output
+ * \param[in] output The new log output
+ *
+ * Messages queued for asynchronous output are written to the previous output
+ * before it is replaced, as the caller may destroy the stream backing it.
+ */
+void Logger::setOutput(std::shared_ptr<LogOutput> output)
+{
+	flush();
+	std::atomic_store(&output_, output);
+}
+
 /**
  * \brief Construct a logger
  */
 Logger::Logger()
+	: async_(false), writerIdle_(false), flushRequest_(0), flushDone_(0),
+	  stop_(false)
 {
 	parseLogFile();
 	parseLogLevels();
+
+	const char *async = utils::secure_getenv("LIBCAMERA_LOG_ASYNC");
+	if (async && async[0] != '\0')
+		logSetAsync(true);
 }
 
 /**
@@ -533,6 +1054,9 @@ Logger::Logger()
  * points to and redirect the logger output to it. If the environment variable
  * is set to "syslog", then the logger output will be directed to syslog. Errors
  * are silently ignored and don't affect the logger output (set to stderr).
+ *
+ * Log files are written in binary format if the LIBCAMERA_LOG_FORMAT
+ * environment variable is set to "binary".
  */
 void Logger::parseLogFile()
 {
@@ -547,7 +1071,10 @@ void Logger::parseLogFile()
 		return;
 	}
 
-	logSetFile(file);
+	const char *format = utils::secure_getenv("LIBCAMERA_LOG_FORMAT");
+	bool binary = format && !strcmp(format, "binary");
+
+	logSetFile(file, binary);
 }
 
 /**
@@ -719,6 +1246,13 @@ LogCategory::LogCategory(const char *name)
  * \return Return the severity of the log category
  */
 
+/**
+ * \fn LogCategory::isEnabled()
+ * \brief Check if messages of a given severity are enabled for the category
+ * \param[in] severity The message severity
+ * \return True if messages of \a severity are printed, false otherwise
+ */
+
 /**
  * \brief Set the severity of the log category
  *
@@ -727,7 +1261,7 @@ LogCategory::LogCategory(const char *name)
  */
 void LogCategory::setSeverity(LogSeverity severity)
 {
-	severity_ = severity;
+	severity_.store(severity, std::memory_order_relaxed);
 }
 
 /**
@@ -768,9 +1302,9 @@ const LogCategory &LogCategory::defaultCategory()
  */
 LogMessage::LogMessage(const char *fileName, unsigned int line,
 		       const LogCategory &category, LogSeverity severity)
-	: category_(category), severity_(severity)
+	: category_(category), severity_(severity),
+	  timestamp_(utils::clock::now()), fileName_(fileName), line_(line)
 {
-	init(fileName, line);
 }
 
 /**
@@ -787,31 +1321,22 @@ LogMessage::LogMessage(const char *fileName, unsigned int line,
  */
 LogMessage::LogMessage(LogMessage &&other)
 	: msgStream_(std::move(other.msgStream_)), category_(other.category_),
-	  severity_(other.severity_)
+	  severity_(other.severity_), timestamp_(other.timestamp_),
+	  fileName_(other.fileName_), line_(other.line_)
 {
 	other.severity_ = LogInvalid;
 }
 
-void LogMessage::init(const char *fileName, unsigned int line)
-{
-	/* Log the timestamp, severity and file information. */
-	timestamp_ = utils::clock::now();
-
-	std::ostringstream ossFileInfo;
-	ossFileInfo << utils::basename(fileName) << ":" << line;
-	fileInfo_ = ossFileInfo.str();
-}
-
 LogMessage::~LogMessage()
 {
 	/* Don't print anything if we have been moved to another LogMessage. */
 	if (severity_ == LogInvalid)
 		return;
 
-	msgStream_ << std::endl;
-
-	if (severity_ >= category_.severity())
+	if (severity_ >= category_.severity()) {
+		msgStream_ << std::endl;
 		Logger::instance()->write(*this);
+	}
 
 	if (severity_ == LogSeverity::LogFatal) {
 		Logger::instance()->backtrace();
@@ -848,10 +1373,17 @@ LogMessage::~LogMessage()
  */
 
 /**
- * \fn LogMessage::fileInfo()
  * \brief Retrieve the file info of the log message
+ *
+ * The file info is formatted when this function is called, to avoid the cost
+ * for messages that are not output.
+ *
  * \return The file info of the message
  */
+std::string LogMessage::fileInfo() const
+{
+	return std::string(utils::basename(fileName_)) + ":" + std::to_string(line_);
+}
 
 /**
  * \fn LogMessage::msg()
@@ -859,6 +1391,91 @@ LogMessage::~LogMessage()
  * \return The message text of the message, as a string
  */
 
+/**
+ * \class LogEveryN
+ * \brief Per call site state of the LOG_EVERY_N() macro
+ *
+ * The LogEveryN class counts the enabled messages logged from a call site, to
+ * output only one message out of every N. It is not meant to be used directly.
+ */
+
+/**
+ * \fn LogEveryN::LogEveryN()
+ * \brief Construct a LogEveryN
+ */
+
+/**
+ * \brief Check if a message should be output
+ * \param[in] n The sampling period
+ * \param[in] severity The message severity
+ *
+ * Fatal messages are always output.
+ *
+ * \return True for the first message and every \a n messages after it, false
+ * otherwise
+ */
+bool LogEveryN::allow(unsigned int n, LogSeverity severity)
+{
+	if (severity == LogFatal || n <= 1)
+		return true;
+
+	return count_.fetch_add(1, std::memory_order_relaxed) % n == 0;
+}
+
+/**
+ * \class LogRateLimit
+ * \brief Per call site state of the LOG_RATELIMITED() macro
+ *
+ * The LogRateLimit class limits the rate of messages logged from a call site to
+ * one message per interval, and counts the suppressed messages. It is not meant
+ * to be used directly.
+ */
+
+/**
+ * \fn LogRateLimit::LogRateLimit()
+ * \brief Construct a LogRateLimit
+ */
+
+/**
+ * \brief Check if a message should be output
+ * \param[in] interval The minimum interval between two messages
+ * \param[in] category The message category
+ * \param[in] severity The message severity
+ * \param[in] fileName The file name where the message is logged from
+ * \param[in] line The line number where the message is logged from
+ *
+ * If messages have been suppressed since the last output message, a message
+ * reporting the number of suppressed messages is logged before returning true.
+ * Fatal messages are always output.
+ *
+ * \return True if the message should be output, false if it is suppressed
+ */
+bool LogRateLimit::allow(std::chrono::steady_clock::duration interval,
+			 const LogCategory &category, LogSeverity severity,
+			 const char *fileName, unsigned int line)
+{
+	if (severity == LogFatal)
+		return true;
+
+	int64_t now = utils::clock::now().time_since_epoch().count();
+	int64_t next = next_.load(std::memory_order_relaxed);
+
+	/* Let a single thread through when messages race at the deadline. */
+	if (now < next ||
+	    !next_.compare_exchange_strong(next, now + interval.count(),
+					   std::memory_order_relaxed)) {
+		suppressed_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	unsigned int suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+	if (suppressed)
+		LogMessage(fileName, line, category, severity).stream()
+			<< suppressed << " similar messages suppressed";
+
+	return true;
+}
+
 /**
  * \class Loggable
  * \brief Base class to support log message extensions
@@ -904,7 +1521,10 @@ LogMessage Loggable::_log(const LogCategory *category, LogSeverity severity,
 		       category ? *category : LogCategory::defaultCategory(),
 		       severity);
 
-	msg.stream() << logPrefix() << ": ";
+	/* Skip building the prefix for messages that will not be output. */
+	if (severity >= msg.category().severity())
+		msg.stream() << logPrefix() << ": ";
+
 	return msg;
 }
 
@@ -968,6 +1588,11 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  * absent the default category is used. The  \a severity controls whether the
  * message is printed or discarded, depending on the log level for the category.
  *
+ * The severity is checked before the message is created. Disabled messages
+ * only cost a load of the category severity and a branch, and the operands of
+ * the stream insertion operators are not evaluated. Expressions with side
+ * effects should thus not be logged.
+ *
  * If the severity is set to Fatal, execution is aborted and the program
  * terminates immediately after printing the message.
  *
@@ -978,6 +1603,40 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  * possible extent
  */
 
+/**
+ * \def LOG_EVERY_N(category, severity, n)
+ * \hideinitializer
+ * \brief Log one message out of every \a n
+ * \param[in] category Category (optional)
+ * \param[in] severity Severity
+ * \param[in] n The sampling period
+ *
+ * This macro behaves like LOG(), but only outputs the first message and one of
+ * every \a n messages after it. Messages are counted per call site, and only
+ * when their severity is enabled for the category. It is meant for messages
+ * that may be logged for every frame in hot paths.
+ *
+ * Fatal messages are never skipped.
+ */
+
+/**
+ * \def LOG_RATELIMITED(category, severity, interval)
+ * \hideinitializer
+ * \brief Log at most one message per \a interval
+ * \param[in] category Category (optional)
+ * \param[in] severity Severity
+ * \param[in] interval The minimum interval between two messages, as a
+ * std::chrono duration
+ *
+ * This macro behaves like LOG(), but suppresses messages logged from the same
+ * call site less than \a interval after the last output message. The number of
+ * suppressed messages is reported in the log before the next output message.
+ * It is meant for warnings about conditions that may persist and would
+ * otherwise flood the log.
+ *
+ * Fatal messages are never suppressed.
+ */
+
 /**
  * \def ASSERT(condition)
  * \hideinitializer
@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * memory_pool.cpp - Recycling pool for small objects
+ */
+
+#include <libcamera/base/memory_pool.h>
+
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+/**
+ * \file base/memory_pool.h
+ * \brief Recycling pool for small objects
+ */
+
+namespace libcamera {
+
+namespace {
+
+constexpr size_t BlockSizes[] = { 64, 128, MemoryPool::MaxBlockSize };
+constexpr unsigned int NumClasses = std::size(BlockSizes);
+
+/* Number of blocks moved between a thread cache and the global pool at once. */
+constexpr unsigned int BatchSize = 32;
+/* Maximum number of blocks held by a thread cache, per size class. */
+constexpr unsigned int MaxCachedBlocks = 2 * BatchSize;
+/* Maximum number of batches held by the global pool, per size class. */
+constexpr unsigned int MaxGlobalBatches = 64;
+
+struct FreeBlock {
+	FreeBlock *next;
+};
+
+struct Batch {
+	FreeBlock *head;
+	unsigned int count;
+};
+
+int sizeClass(size_t size)
+{
+	for (unsigned int i = 0; i < NumClasses; ++i) {
+		if (size <= BlockSizes[i])
+			return i;
+	}
+
+	return -1;
+}
+
+void freeBlocks(FreeBlock *head)
+{
+	while (head) {
+		FreeBlock *next = head->next;
+		::operator delete(head);
+		head = next;
+	}
+}
+
+class GlobalPool
+{
+public:
+	bool get(unsigned int cls, Batch *batch)
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		std::vector<Batch> &batches = batches_[cls];
+		if (batches.empty())
+			return false;
+
+		*batch = batches.back();
+		batches.pop_back();
+		return true;
+	}
+
+	void put(unsigned int cls, const Batch &batch)
+	{
+		{
+			std::lock_guard<std::mutex> locker(mutex_);
+
+			std::vector<Batch> &batches = batches_[cls];
+			if (batches.size() < MaxGlobalBatches) {
+				batches.push_back(batch);
+				return;
+			}
+		}
+
+		freeBlocks(batch.head);
+	}
+
+private:
+	std::mutex mutex_;
+	std::vector<Batch> batches_[NumClasses];
+};
+
+GlobalPool &globalPool()
+{
+	/*
+	 * The global pool is never destroyed, as thread caches may be flushed
+	 * after static objects have been destroyed when the process exits.
+	 */
+	static GlobalPool *pool = new GlobalPool();
+	return *pool;
+}
+
+/*
+ * The thread cache is trivially destructible to remain usable for the whole
+ * lifetime of the thread, including while other thread-local objects are
+ * destroyed. Its blocks are returned to the global pool by a separate
+ * CacheFlusher when the thread exits.
+ */
+struct ThreadCache {
+	Batch lists[NumClasses];
+	bool active;
+	bool finished;
+
+	void flush()
+	{
+		for (unsigned int cls = 0; cls < NumClasses; ++cls) {
+			if (lists[cls].head)
+				globalPool().put(cls, lists[cls]);
+			lists[cls] = {};
+		}
+	}
+};
+
+thread_local ThreadCache threadCache = {};
+
+struct CacheFlusher {
+	~CacheFlusher()
+	{
+		threadCache.flush();
+		threadCache.finished = true;
+	}
+};
+
+ThreadCache *currentCache()
+{
+	ThreadCache &cache = threadCache;
+	if (cache.finished)
+		return nullptr;
+
+	if (!cache.active) {
+		thread_local CacheFlusher flusher;
+		cache.active = true;
+	}
+
+	return &cache;
+}
+
+} /* namespace */
+
+/**
+ * \class MemoryPool
+ * \brief Recycle the memory of small objects allocated and freed at a high rate
+ *
+ * Objects such as messages and packed method arguments are allocated for every
+ * queued signal emission and method invocation, and freed right after being
+ * delivered, often in a different thread. The MemoryPool recycles the memory
+ * blocks backing those objects to avoid going through the system allocator on
+ * every allocation.
+ *
+ * Blocks are grouped in size classes up to MaxBlockSize bytes. Each thread
+ * keeps a cache of free blocks for each size class, and exchanges batches of
+ * blocks with a global pool shared by all threads when its cache runs empty or
+ * grows too large. This keeps the fast path free of locks while allowing
+ * blocks allocated by one thread and freed by another to be reused. Larger
+ * allocations are forwarded to the system allocator.
+ *
+ * The pool is primarily meant to be used through class-specific allocation
+ * functions and through the PoolAllocator.
+ */
+
+/**
+ * \var MemoryPool::MaxBlockSize
+ * \brief The maximum allocation size handled by the pool
+ */
+
+/**
+ * \brief Allocate a block of memory
+ * \param[in] size The block size in bytes
+ *
+ * The returned block is suitably aligned for any object type whose alignment
+ * doesn't exceed the default new alignment. It shall be freed with
+ * deallocate(), with the same \a size.
+ *
+ * \return A pointer to the allocated block
+ */
+void *MemoryPool::allocate(size_t size)
+{
+	int cls = sizeClass(size);
+	ThreadCache *cache = cls >= 0 ? currentCache() : nullptr;
+	if (!cache)
+		return ::operator new(cls >= 0 ? BlockSizes[cls] : size);
+
+	Batch &list = cache->lists[cls];
+	if (!list.head && !globalPool().get(cls, &list))
+		return ::operator new(BlockSizes[cls]);
+
+	FreeBlock *block = list.head;
+	list.head = block->next;
+	list.count--;
+
+	return block;
+}
+
+/**
+ * \brief Free a block of memory
+ * \param[in] ptr The block returned by allocate()
+ * \param[in] size The block size that has been passed to allocate()
+ *
+ * The block is returned to the cache of the calling thread, which may differ
+ * from the thread that has allocated it.
+ */
+void MemoryPool::deallocate(void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	int cls = sizeClass(size);
+	ThreadCache *cache = cls >= 0 ? currentCache() : nullptr;
+	if (!cache) {
+		::operator delete(ptr);
+		return;
+	}
+
+	Batch &list = cache->lists[cls];
+	FreeBlock *block = static_cast<FreeBlock *>(ptr);
+	block->next = list.head;
+	list.head = block;
+	list.count++;
+
+	if (list.count < MaxCachedBlocks)
+		return;
+
+	/* Move a batch of blocks to the global pool. */
+	Batch batch = { list.head, BatchSize };
+	FreeBlock *last = list.head;
+	for (unsigned int i = 1; i < BatchSize; ++i)
+		last = last->next;
+
+	list.head = last->next;
+	list.count -= BatchSize;
+	last->next = nullptr;
+
+	globalPool().put(cls, batch);
+}
+
+/**
+ * \class PoolAllocator
+ * \brief A standard allocator backed by the MemoryPool
+ * \tparam T The type of the allocated objects
+ *
+ * The PoolAllocator meets the requirements of the C++ Allocator named
+ * requirement. It is typically used with std::allocate_shared() to allocate an
+ * object and its shared pointer control block in a single pooled block.
+ * Over-aligned types are allocated with std::allocator.
+ */
+
+/**
+ * \typedef PoolAllocator::value_type
+ * \brief The type of the allocated objects
+ */
+
+/**
+ * \fn PoolAllocator::PoolAllocator()
+ * \brief Construct a PoolAllocator
+ */
+
+/**
+ * \fn PoolAllocator::PoolAllocator(const PoolAllocator<U> &other)
+ * \brief Construct a PoolAllocator from an allocator for a different type
+ * \param[in] other The other allocator
+ */
+
+/**
+ * \fn PoolAllocator::allocate()
+ * \brief Allocate storage for \a n objects
+ * \param[in] n The number of objects
+ * \return A pointer to the allocated storage
+ */
+
+/**
+ * \fn PoolAllocator::deallocate()
+ * \brief Free storage allocated by allocate()
+ * \param[in] ptr The storage returned by allocate()
+ * \param[in] n The number of objects passed to allocate()
+ */
+
+/**
+ * \fn PoolAllocator::operator==()
+ * \brief Compare allocators for equality
+ * \param[in] other The other allocator
+ * \return True, as all pool allocators share the same pool
+ */
+
+/**
+ * \fn PoolAllocator::operator!=()
+ * \brief Compare allocators for inequality
+ * \param[in] other The other allocator
+ * \return False, as all pool allocators share the same pool
+ */
+
+} /* namespace libcamera */
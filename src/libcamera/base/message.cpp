@@ -8,6 +8,7 @@
 #include <libcamera/base/message.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/memory_pool.h>
 #include <libcamera/base/signal.h>
 
 /**
@@ -59,7 +60,7 @@ std::atomic_uint Message::nextUserType_{ Message::UserMessage };
  * \param[in] type The message type
  */
 Message::Message(Message::Type type)
-	: type_(type)
+	: type_(type), receiver_(nullptr), next_(nullptr)
 {
 }
 
@@ -111,6 +112,30 @@ Message::Type Message::registerMessageType()
 	return static_cast<Message::Type>(nextUserType_++);
 }
 
+/**
+ * \brief Allocate memory for a message
+ * \param[in] size The message size in bytes
+ *
+ * Messages are allocated from the MemoryPool, as they are created and destroyed
+ * at a high rate for queued signal emissions and method invocations.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *Message::operator new(std::size_t size)
+{
+	return MemoryPool::allocate(size);
+}
+
+/**
+ * \brief Free the memory of a message
+ * \param[in] ptr The memory returned by operator new()
+ * \param[in] size The message size in bytes
+ */
+void Message::operator delete(void *ptr, std::size_t size)
+{
+	MemoryPool::deallocate(ptr, size);
+}
+
 /**
  * \class InvokeMessage
  * \brief A message carrying a method invocation across threads
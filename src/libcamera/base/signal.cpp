@@ -7,6 +7,8 @@
 
 #include <libcamera/base/signal.h>
 
+#include <algorithm>
+
 #include <libcamera/base/thread.h>
 
 /**
@@ -27,6 +29,20 @@ Mutex signalsLock;
 
 } /* namespace */
 
+SignalBase::SignalBase()
+	: emissions_(nullptr), compact_(false)
+{
+}
+
+SignalBase::~SignalBase()
+{
+	MutexLocker locker(signalsLock);
+
+	/* Stop the emissions in progress if a slot destroys the signal. */
+	for (Emission *emission = emissions_; emission; emission = emission->outer)
+		emission->signal = nullptr;
+}
+
 void SignalBase::connect(BoundMethodBase *slot)
 {
 	MutexLocker locker(signalsLock);
@@ -49,23 +65,91 @@ void SignalBase::disconnect(std::function<bool(SlotList::iterator &)> match)
 	MutexLocker locker(signalsLock);
 
 	for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-		if (match(iter)) {
-			Object *object = (*iter)->object();
-			if (object)
-				object->disconnect(this);
+		if (!*iter || !match(iter)) {
+			++iter;
+			continue;
+		}
 
-			delete *iter;
-			iter = slots_.erase(iter);
-		} else {
+		Object *object = (*iter)->object();
+		if (object)
+			object->disconnect(this);
+
+		delete *iter;
+
+		/*
+		 * Don't invalidate the slot indices while the signal is being
+		 * emitted, the slots list will be compacted by endEmit().
+		 */
+		if (emissions_) {
+			*iter = nullptr;
+			compact_ = true;
 			++iter;
+		} else {
+			iter = slots_.erase(iter);
 		}
 	}
 }
 
-SignalBase::SlotList SignalBase::slots()
+/*
+ * Emission walks the slots list by index without copying it. The slots
+ * connected during emission are appended after the end index recorded by
+ * beginEmit(), and the slots disconnected during emission are replaced by a
+ * null pointer until the outermost emission completes.
+ *
+ * The emissions in progress are tracked by records stored on the stack of the
+ * emitters. If a slot destroys the signal, the signal is removed from the
+ * records, and nextSlot() and endEmit() then don't access it anymore.
+ */
+void SignalBase::beginEmit(Emission *emission)
 {
 	MutexLocker locker(signalsLock);
-	return slots_;
+
+	emission->signal = this;
+	emission->index = 0;
+	emission->end = slots_.size();
+	emission->outer = emissions_;
+	emissions_ = emission;
+}
+
+BoundMethodBase *SignalBase::nextSlot(Emission *emission)
+{
+	MutexLocker locker(signalsLock);
+
+	SignalBase *signal = emission->signal;
+	if (!signal)
+		return nullptr;
+
+	while (emission->index < emission->end) {
+		BoundMethodBase *slot = signal->slots_[emission->index++];
+		if (slot)
+			return slot;
+	}
+
+	return nullptr;
+}
+
+void SignalBase::endEmit(Emission *emission)
+{
+	MutexLocker locker(signalsLock);
+
+	SignalBase *signal = emission->signal;
+	if (!signal)
+		return;
+
+	for (Emission **iter = &signal->emissions_; *iter; iter = &(*iter)->outer) {
+		if (*iter == emission) {
+			*iter = emission->outer;
+			break;
+		}
+	}
+
+	if (signal->emissions_ || !signal->compact_)
+		return;
+
+	signal->slots_.erase(std::remove(signal->slots_.begin(),
+					 signal->slots_.end(), nullptr),
+			     signal->slots_.end());
+	signal->compact_ = false;
 }
 
 /**
@@ -7,17 +7,27 @@
 
 #include <libcamera/base/thread.h>
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
-#include <list>
+#include <errno.h>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <string.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
 
 #include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/event_dispatcher_epoll.h>
 #include <libcamera/base/event_dispatcher_poll.h>
 #include <libcamera/base/log.h>
 #include <libcamera/base/message.h>
+#include <libcamera/base/utils.h>
 
 /**
  * \page thread Thread Support
@@ -110,18 +120,158 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Thread)
 
+namespace {
+
+/*
+ * Find the value for a thread \a name in a thread configuration environment
+ * variable. The variable stores a semicolon-separated list of name=value
+ * entries, where the name may end with a '*' wildcard to match all threads
+ * whose name starts with the given prefix.
+ */
+std::string threadConfigValue(const char *variable, const std::string &name)
+{
+	const char *config = utils::secure_getenv(variable);
+	if (!config || name.empty())
+		return {};
+
+	for (const auto &entry : utils::split(config, ";")) {
+		size_t pos = entry.find('=');
+		if (pos == std::string::npos)
+			continue;
+
+		std::string pattern = entry.substr(0, pos);
+		bool match;
+
+		if (!pattern.empty() && pattern.back() == '*') {
+			pattern.pop_back();
+			match = !name.compare(0, pattern.size(), pattern);
+		} else {
+			match = pattern == name;
+		}
+
+		if (match)
+			return entry.substr(pos + 1);
+	}
+
+	return {};
+}
+
+/* Parse a CPU list made of comma-separated CPU numbers and ranges. */
+std::vector<unsigned int> parseCpuList(const std::string &list)
+{
+	std::vector<unsigned int> cpus;
+
+	for (const auto &range : utils::split(list, ",")) {
+		unsigned int first, last;
+		char dash;
+
+		std::istringstream iss(range);
+		if (!(iss >> first))
+			return {};
+
+		if (iss >> dash) {
+			if (dash != '-' || !(iss >> last) || last < first)
+				return {};
+		} else {
+			last = first;
+		}
+
+		for (unsigned int cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+bool validPolicy(int policy, int priority)
+{
+	switch (policy) {
+	case SCHED_OTHER:
+	case SCHED_BATCH:
+	case SCHED_IDLE:
+	case SCHED_FIFO:
+	case SCHED_RR:
+		break;
+	default:
+		return false;
+	}
+
+	return priority >= sched_get_priority_min(policy) &&
+	       priority <= sched_get_priority_max(policy);
+}
+
+} /* namespace */
+
 class ThreadMain;
 
 /**
  * \brief A queue of posted messages
+ *
+ * Messages are posted to a lock-free stack, linked through the Message next_
+ * field, which doesn't require allocating memory or taking a lock. The thread
+ * that owns the queue moves the posted messages to the \ref list_, in posting
+ * order, before processing them.
  */
 class MessageQueue
 {
 public:
+	~MessageQueue()
+	{
+		Message *msg = posted_.exchange(nullptr, std::memory_order_acquire);
+		while (msg) {
+			Message *next = msg->next_;
+			delete msg;
+			msg = next;
+		}
+	}
+
+	/**
+	 * \brief Post a message to the queue
+	 * \param[in] msg The message
+	 *
+	 * \context This function is \threadsafe.
+	 */
+	void post(std::unique_ptr<Message> msg)
+	{
+		Message *message = msg.release();
+
+		message->next_ = posted_.load(std::memory_order_relaxed);
+		while (!posted_.compare_exchange_weak(message->next_, message,
+						      std::memory_order_release,
+						      std::memory_order_relaxed))
+			;
+	}
+
+	/**
+	 * \brief Move the posted messages to the \ref list_
+	 *
+	 * The \ref mutex_ shall be held by the caller.
+	 */
+	void collect()
+	{
+		Message *msg = posted_.exchange(nullptr, std::memory_order_acquire);
+		if (!msg)
+			return;
+
+		/* The stack holds the messages in reverse posting order. */
+		size_t end = list_.size();
+		for (; msg; msg = msg->next_)
+			list_.emplace_back(msg);
+
+		std::reverse(list_.begin() + end, list_.end());
+
+		for (auto iter = list_.begin() + end; iter != list_.end(); ++iter)
+			(*iter)->next_ = nullptr;
+	}
+
+	/**
+	 * \brief Stack of posted messages not yet moved to the \ref list_
+	 */
+	std::atomic<Message *> posted_{ nullptr };
 	/**
 	 * \brief List of queued Message instances
 	 */
-	std::list<std::unique_ptr<Message>> list_;
+	std::vector<std::unique_ptr<Message>> list_;
 	/**
 	 * \brief Protects the \ref list_
 	 */
@@ -140,7 +290,8 @@ class ThreadData
 {
 public:
 	ThreadData()
-		: thread_(nullptr), running_(false), dispatcher_(nullptr)
+		: thread_(nullptr), running_(false), policy_(-1), priority_(0),
+		  dispatcher_(nullptr)
 	{
 	}
 
@@ -150,10 +301,20 @@ private:
 	friend class Thread;
 	friend class ThreadMain;
 
+	void loadConfiguration();
+	int applyName(pthread_t thread);
+	int applyAffinity(pthread_t thread);
+	int applyScheduling(pthread_t thread);
+
 	Thread *thread_;
 	bool running_;
 	pid_t tid_;
 
+	std::string name_;
+	std::vector<unsigned int> cpus_;
+	int policy_;
+	int priority_;
+
 	Mutex mutex_;
 
 	std::atomic<EventDispatcher *> dispatcher_;
@@ -205,6 +366,100 @@ ThreadData *ThreadData::current()
 	return data;
 }
 
+/*
+ * Override the thread attributes with the LIBCAMERA_THREAD_AFFINITY and
+ * LIBCAMERA_THREAD_SCHEDULING environment variables.
+ */
+void ThreadData::loadConfiguration()
+{
+	std::string affinity = threadConfigValue("LIBCAMERA_THREAD_AFFINITY", name_);
+	if (!affinity.empty()) {
+		std::vector<unsigned int> cpus = parseCpuList(affinity);
+		if (!cpus.empty())
+			cpus_ = std::move(cpus);
+		else
+			LOG(Thread, Warning)
+				<< "Invalid affinity '" << affinity
+				<< "' for thread " << name_;
+	}
+
+	std::string scheduling = threadConfigValue("LIBCAMERA_THREAD_SCHEDULING", name_);
+	if (!scheduling.empty()) {
+		static const std::map<std::string, int> policies = {
+			{ "other", SCHED_OTHER },
+			{ "batch", SCHED_BATCH },
+			{ "idle", SCHED_IDLE },
+			{ "fifo", SCHED_FIFO },
+			{ "rr", SCHED_RR },
+		};
+
+		size_t pos = scheduling.find(':');
+		auto policy = policies.find(scheduling.substr(0, pos));
+		int priority = 0;
+		bool valid = true;
+
+		if (pos != std::string::npos) {
+			std::istringstream iss(scheduling.substr(pos + 1));
+			valid = (iss >> priority) && iss.eof();
+		}
+
+		if (valid && policy != policies.end() &&
+		    validPolicy(policy->second, priority)) {
+			policy_ = policy->second;
+			priority_ = priority;
+		} else {
+			LOG(Thread, Warning)
+				<< "Invalid scheduling '" << scheduling
+				<< "' for thread " << name_;
+		}
+	}
+}
+
+int ThreadData::applyName(pthread_t thread)
+{
+	if (name_.empty())
+		return 0;
+
+	/* Thread names are limited to 15 characters. */
+	return -pthread_setname_np(thread, name_.substr(0, 15).c_str());
+}
+
+int ThreadData::applyAffinity(pthread_t thread)
+{
+	if (cpus_.empty())
+		return 0;
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	for (unsigned int cpu : cpus_)
+		CPU_SET(cpu, &cpuset);
+
+	int ret = -pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset);
+	if (ret < 0)
+		LOG(Thread, Warning)
+			<< "Failed to set affinity of thread " << name_ << ": "
+			<< strerror(-ret);
+
+	return ret;
+}
+
+int ThreadData::applyScheduling(pthread_t thread)
+{
+	if (policy_ < 0)
+		return 0;
+
+	struct sched_param param = {};
+	param.sched_priority = priority_;
+
+	int ret = -pthread_setschedparam(thread, policy_, &param);
+	if (ret < 0)
+		LOG(Thread, Warning)
+			<< "Failed to set scheduling policy of thread " << name_
+			<< ": " << strerror(-ret);
+
+	return ret;
+}
+
 /**
  * \typedef Mutex
  * \brief An alias for std::mutex
@@ -326,9 +581,118 @@ void Thread::startThread()
 	data_->tid_ = syscall(SYS_gettid);
 	currentThreadData = data_;
 
+	{
+		MutexLocker locker(data_->mutex_);
+		pthread_t self = pthread_self();
+
+		data_->loadConfiguration();
+		data_->applyName(self);
+		data_->applyAffinity(self);
+		data_->applyScheduling(self);
+	}
+
 	run();
 }
 
+/**
+ * \brief Set the thread name
+ * \param[in] name The thread name
+ *
+ * The thread name is visible to system tools, and is used to select the
+ * thread attributes set through the LIBCAMERA_THREAD_AFFINITY and
+ * LIBCAMERA_THREAD_SCHEDULING environment variables when the thread is
+ * started. System tools only show the first 15 characters of the name.
+ *
+ * The name of the main thread is not changed.
+ *
+ * \context This function is \threadsafe.
+ */
+void Thread::setName(const std::string &name)
+{
+	MutexLocker locker(data_->mutex_);
+
+	data_->name_ = name;
+
+	if (data_->running_ && thread_.joinable())
+		data_->applyName(thread_.native_handle());
+}
+
+/**
+ * \brief Set the CPU affinity of the thread
+ * \param[in] cpus The CPUs the thread is allowed to run on
+ *
+ * If the thread is running, its affinity is changed immediately. Otherwise it
+ * is applied when the thread is started. The LIBCAMERA_THREAD_AFFINITY
+ * environment variable, when it contains an entry for the thread name,
+ * overrides the affinity set by this function when the thread starts.
+ *
+ * The affinity of the main thread is not changed.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The CPU list is empty or contains invalid CPU numbers
+ */
+int Thread::setAffinity(const std::vector<unsigned int> &cpus)
+{
+	if (cpus.empty())
+		return -EINVAL;
+
+	for (unsigned int cpu : cpus) {
+		if (cpu >= CPU_SETSIZE)
+			return -EINVAL;
+	}
+
+	MutexLocker locker(data_->mutex_);
+
+	data_->cpus_ = cpus;
+
+	if (data_->running_ && thread_.joinable())
+		return data_->applyAffinity(thread_.native_handle());
+
+	return 0;
+}
+
+/**
+ * \brief Set the scheduling policy and priority of the thread
+ * \param[in] policy The scheduling policy (SCHED_OTHER, SCHED_BATCH,
+ * SCHED_IDLE, SCHED_FIFO or SCHED_RR)
+ * \param[in] priority The static priority, in the range supported by \a policy
+ *
+ * If the thread is running, its scheduling parameters are changed immediately.
+ * Otherwise they are applied when the thread is started. The
+ * LIBCAMERA_THREAD_SCHEDULING environment variable, when it contains an entry
+ * for the thread name, overrides the parameters set by this function when the
+ * thread starts.
+ *
+ * Real-time policies typically require the CAP_SYS_NICE capability or a
+ * suitable RLIMIT_RTPRIO limit. Failure to apply the parameters when the
+ * thread starts is reported but doesn't prevent the thread from running.
+ *
+ * The scheduling parameters of the main thread are not changed.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The policy or priority is invalid
+ * \retval -EPERM The caller isn't allowed to set the scheduling parameters
+ */
+int Thread::setScheduling(int policy, int priority)
+{
+	if (!validPolicy(policy, priority))
+		return -EINVAL;
+
+	MutexLocker locker(data_->mutex_);
+
+	data_->policy_ = policy;
+	data_->priority_ = priority;
+
+	if (data_->running_ && thread_.joinable())
+		return data_->applyScheduling(thread_.native_handle());
+
+	return 0;
+}
+
 /**
  * \brief Enter the event loop
  *
@@ -506,13 +870,52 @@ pid_t Thread::currentId()
  */
 EventDispatcher *Thread::eventDispatcher()
 {
-	if (!data_->dispatcher_.load(std::memory_order_relaxed))
-		data_->dispatcher_.store(new EventDispatcherPoll(),
-					 std::memory_order_release);
+	if (!data_->dispatcher_.load(std::memory_order_relaxed)) {
+		const char *type = utils::secure_getenv("LIBCAMERA_EVENT_DISPATCHER");
+		EventDispatcher *dispatcher;
+
+		if (type && !strcmp(type, "epoll"))
+			dispatcher = new EventDispatcherEpoll();
+		else
+			dispatcher = new EventDispatcherPoll();
+
+		data_->dispatcher_.store(dispatcher, std::memory_order_release);
+	}
 
 	return data_->dispatcher_.load(std::memory_order_relaxed);
 }
 
+/**
+ * \brief Set the event dispatcher
+ * \param[in] dispatcher The event dispatcher
+ *
+ * This function sets the event dispatcher used by the thread, and transfers its
+ * ownership to the thread. It allows selecting an event dispatcher
+ * implementation on a per-thread basis, and shall be called before the event
+ * dispatcher is first used, typically before starting the thread. Otherwise
+ * the thread creates an EventDispatcherPoll, or an EventDispatcherEpoll if the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable is set to "epoll".
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The thread already has an event dispatcher
+ */
+int Thread::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher)
+{
+	EventDispatcher *expected = nullptr;
+
+	if (!data_->dispatcher_.compare_exchange_strong(expected, dispatcher.get(),
+							 std::memory_order_release,
+							 std::memory_order_relaxed)) {
+		LOG(Thread, Error) << "Thread already has an event dispatcher";
+		return -EBUSY;
+	}
+
+	dispatcher.release();
+	return 0;
+}
+
 /**
  * \brief Post a message to the thread for the \a receiver
  * \param[in] msg The message
@@ -541,10 +944,8 @@ void Thread::postMessage(std::unique_ptr<Message> msg, Object *receiver)
 
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
-	data_->messages_.list_.push_back(std::move(msg));
 	receiver->pendingMessages_++;
-	locker.unlock();
+	data_->messages_.post(std::move(msg));
 
 	EventDispatcher *dispatcher =
 		data_->dispatcher_.load(std::memory_order_acquire);
@@ -562,10 +963,12 @@ void Thread::removeMessages(Object *receiver)
 {
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
 	if (!receiver->pendingMessages_)
 		return;
 
+	MutexLocker locker(data_->messages_.mutex_);
+	data_->messages_.collect();
+
 	std::vector<std::unique_ptr<Message>> toDelete;
 	for (std::unique_ptr<Message> &msg : data_->messages_.list_) {
 		if (!msg)
@@ -613,9 +1016,20 @@ void Thread::dispatchMessages(Message::Type type)
 
 	MutexLocker locker(data_->messages_.mutex_);
 
-	std::list<std::unique_ptr<Message>> &messages = data_->messages_.list_;
+	std::vector<std::unique_ptr<Message>> &messages = data_->messages_.list_;
+
+	/*
+	 * Iterate by index, as the list may grow when collecting messages
+	 * posted in the meantime, here or in recursive calls.
+	 */
+	for (size_t i = 0; ; ++i) {
+		if (i == messages.size()) {
+			data_->messages_.collect();
+			if (i == messages.size())
+				break;
+		}
 
-	for (std::unique_ptr<Message> &msg : messages) {
+		std::unique_ptr<Message> &msg = messages[i];
 		if (!msg)
 			continue;
 
@@ -644,14 +1058,9 @@ void Thread::dispatchMessages(Message::Type type)
 	 * can't do so during recursion, as it would invalidate the iterator of
 	 * the outer calls.
 	 */
-	if (!--data_->messages_.recursion_) {
-		for (auto iter = messages.begin(); iter != messages.end(); ) {
-			if (!*iter)
-				iter = messages.erase(iter);
-			else
-				++iter;
-		}
-	}
+	if (!--data_->messages_.recursion_)
+		messages.erase(std::remove(messages.begin(), messages.end(), nullptr),
+			       messages.end());
 }
 
 /**
@@ -677,6 +1086,9 @@ void Thread::moveObject(Object *object, ThreadData *currentData,
 	if (object->pendingMessages_) {
 		unsigned int movedMessages = 0;
 
+		currentData->messages_.collect();
+		targetData->messages_.collect();
+
 		for (std::unique_ptr<Message> &msg : currentData->messages_.list_) {
 			if (!msg)
 				continue;
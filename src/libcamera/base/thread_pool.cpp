@@ -0,0 +1,287 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * thread_pool.cpp - Work-stealing thread pool
+ */
+
+#include <libcamera/base/thread_pool.h>
+
+#include <algorithm>
+
+#include <libcamera/base/log.h>
+
+/**
+ * \file base/thread_pool.h
+ * \brief Work-stealing thread pool
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(ThreadPool)
+
+/**
+ * \brief A worker thread of the ThreadPool
+ *
+ * Each worker owns a queue of tasks. The worker pops tasks from the back of its
+ * own queue, and steals tasks from the front of the queues of the other
+ * workers when its queue is empty.
+ */
+class ThreadPool::Worker : public Thread
+{
+public:
+	Worker(ThreadPool *pool, unsigned int index)
+		: pool_(pool), index_(index)
+	{
+	}
+
+	ThreadPool *pool() const { return pool_; }
+
+	void push(Task &&task);
+	bool pop(Task *task);
+	bool steal(Task *task);
+
+	static thread_local Worker *current_;
+
+protected:
+	void run() override;
+
+private:
+	ThreadPool *pool_;
+	unsigned int index_;
+
+	Mutex mutex_;
+	std::deque<Task> tasks_;
+};
+
+thread_local ThreadPool::Worker *ThreadPool::Worker::current_ = nullptr;
+
+void ThreadPool::Worker::push(Task &&task)
+{
+	MutexLocker locker(mutex_);
+	tasks_.push_back(std::move(task));
+}
+
+/*
+ * The most recently queued task is popped first, as the data it uses is most
+ * likely to still be in the CPU caches.
+ */
+bool ThreadPool::Worker::pop(Task *task)
+{
+	MutexLocker locker(mutex_);
+	if (tasks_.empty())
+		return false;
+
+	*task = std::move(tasks_.back());
+	tasks_.pop_back();
+	return true;
+}
+
+bool ThreadPool::Worker::steal(Task *task)
+{
+	MutexLocker locker(mutex_);
+	if (tasks_.empty())
+		return false;
+
+	*task = std::move(tasks_.front());
+	tasks_.pop_front();
+	return true;
+}
+
+void ThreadPool::Worker::run()
+{
+	current_ = this;
+	pool_->execute(index_);
+	current_ = nullptr;
+}
+
+/**
+ * \class ThreadPool
+ * \brief A pool of threads to execute CPU-intensive tasks
+ *
+ * The ThreadPool runs tasks concurrently on a fixed set of worker threads. It
+ * is meant for CPU-intensive processing, such as image encoding or format
+ * conversion, that benefits from being split in independent tasks spread over
+ * multiple CPU cores.
+ *
+ * Each worker has its own task queue. Tasks queued from outside of the pool are
+ * distributed to the workers in a round-robin fashion, while tasks queued from
+ * a task running in the pool are added to the queue of the current worker.
+ * Workers that run out of tasks steal tasks from the other workers, balancing
+ * the load without contending on a single queue.
+ *
+ * Completion of a task can be reported to an Object, by queuing a call to one
+ * of its member functions in the thread the object is bound to. This allows
+ * processing the results of a task in the context of the caller without
+ * additional synchronization. The object shall outlive the task's completion,
+ * which can be ensured by calling wait() before destroying it.
+ *
+ * Tasks are run in Thread instances, the Thread API can thus be used from
+ * within tasks. The pool doesn't run an event loop in its threads though,
+ * objects shall not be bound to the worker threads.
+ */
+
+/**
+ * \typedef ThreadPool::Task
+ * \brief A task executed by the thread pool
+ */
+
+/**
+ * \brief Construct a thread pool
+ * \param[in] size The number of worker threads
+ * \param[in] name The name of the worker threads
+ *
+ * The worker threads are started immediately. Their names are created by
+ * appending the worker index to \a name. If \a size is zero, one worker is
+ * created for every CPU core in the system.
+ */
+ThreadPool::ThreadPool(unsigned int size, const std::string &name)
+	: next_(0), queued_(0), outstanding_(0), sleeping_(0), stop_(false)
+{
+	if (!size)
+		size = std::max(std::thread::hardware_concurrency(), 1U);
+
+	for (unsigned int i = 0; i < size; ++i) {
+		workers_.push_back(std::make_unique<Worker>(this, i));
+		workers_.back()->setName(name + std::to_string(i));
+	}
+
+	for (std::unique_ptr<Worker> &worker : workers_)
+		worker->start();
+}
+
+/**
+ * \brief Destroy the thread pool
+ *
+ * All the tasks queued to the pool are run before it is destroyed.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		MutexLocker locker(mutex_);
+		stop_ = true;
+	}
+
+	taskCv_.notify_all();
+
+	for (std::unique_ptr<Worker> &worker : workers_)
+		worker->wait();
+}
+
+/**
+ * \fn ThreadPool::size()
+ * \brief Retrieve the number of worker threads
+ * \return The number of worker threads
+ */
+
+/**
+ * \brief Queue a task to the pool
+ * \param[in] task The task
+ *
+ * The task is run asynchronously by one of the worker threads. This function
+ * is thread-safe.
+ */
+void ThreadPool::run(Task task)
+{
+	Worker *worker = Worker::current_;
+	if (!worker || worker->pool() != this) {
+		unsigned int index = next_.fetch_add(1, std::memory_order_relaxed);
+		worker = workers_[index % workers_.size()].get();
+	}
+
+	MutexLocker locker(mutex_);
+
+	outstanding_++;
+	worker->push(std::move(task));
+	queued_.fetch_add(1, std::memory_order_release);
+
+	if (sleeping_)
+		taskCv_.notify_one();
+}
+
+/**
+ * \fn ThreadPool::run(Func &&task, T *object, void (T::*done)())
+ * \brief Queue a task to the pool and report its completion to an object
+ * \param[in] task The task
+ * \param[in] object The object to report completion to
+ * \param[in] done The member function called when the task completes
+ *
+ * The \a done function is invoked on \a object, in the thread the object is
+ * bound to, after \a task completes.
+ */
+
+/**
+ * \fn ThreadPool::run(Func &&task, T *object, void (T::*done)(R))
+ * \brief Queue a task to the pool and pass its result to an object
+ * \param[in] task The task
+ * \param[in] object The object to report completion to
+ * \param[in] done The member function called with the task result
+ *
+ * The \a done function is invoked on \a object, in the thread the object is
+ * bound to, with the value returned by \a task as argument.
+ */
+
+/**
+ * \brief Wait for all queued tasks to complete
+ *
+ * Tasks queued to the pool while waiting, including by the running tasks, are
+ * waited for as well. This function shall not be called from a task.
+ */
+void ThreadPool::wait()
+{
+	if (Worker::current_ && Worker::current_->pool() == this) {
+		LOG(ThreadPool, Error) << "Waiting for the pool from a task";
+		return;
+	}
+
+	MutexLocker locker(mutex_);
+	idleCv_.wait(locker, [&]() { return outstanding_ == 0; });
+}
+
+/*
+ * Take the next task for worker \a index, from its own queue or by stealing
+ * from the other workers, starting with the next one to spread the load.
+ */
+ThreadPool::Task ThreadPool::take(unsigned int index)
+{
+	Task task;
+
+	if (workers_[index]->pop(&task))
+		return task;
+
+	for (unsigned int i = 1; i < workers_.size(); ++i) {
+		Worker *victim = workers_[(index + i) % workers_.size()].get();
+		if (victim->steal(&task))
+			return task;
+	}
+
+	return task;
+}
+
+void ThreadPool::execute(unsigned int index)
+{
+	while (true) {
+		Task task = take(index);
+		if (task) {
+			queued_.fetch_sub(1, std::memory_order_relaxed);
+			task();
+
+			MutexLocker locker(mutex_);
+			if (--outstanding_ == 0)
+				idleCv_.notify_all();
+			continue;
+		}
+
+		MutexLocker locker(mutex_);
+		if (stop_ && queued_.load(std::memory_order_acquire) <= 0)
+			break;
+
+		sleeping_++;
+		taskCv_.wait(locker, [&]() {
+			return stop_ || queued_.load(std::memory_order_acquire) > 0;
+		});
+		sleeping_--;
+	}
+}
+
+} /* namespace libcamera */
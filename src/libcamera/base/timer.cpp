@@ -100,15 +100,19 @@ void Timer::start(std::chrono::steady_clock::time_point deadline)
 		return;
 	}
 
+	/*
+	 * Unregister the timer before updating the deadline, as dispatchers
+	 * look timers up by deadline.
+	 */
+	if (isRunning())
+		unregisterTimer();
+
 	deadline_ = deadline;
 
 	LOG(Timer, Debug)
 		<< "Starting timer " << this << ": deadline "
 		<< utils::time_point_to_string(deadline_);
 
-	if (isRunning())
-		unregisterTimer();
-
 	registerTimer();
 }
 
@@ -8,11 +8,19 @@
 #include "libcamera/internal/bayer_format.h"
 
 #include <algorithm>
+#include <errno.h>
 #include <map>
+#include <string.h>
 #include <unordered_map>
 
 #include <linux/media-bus-format.h>
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include <libcamera/transform.h>
 
 /**
@@ -308,6 +316,354 @@ BayerFormat BayerFormat::transform(Transform t) const
 	return result;
 }
 
+namespace {
+
+/*
+ * Line unpacking and packing kernels. Unpacked samples are stored in 16-bit
+ * words, right-aligned. Packed samples are processed in groups of pixels that
+ * span an integer number of bytes. Incomplete groups at the end of a line are
+ * stored entirely, with the missing pixels set to zero when packing.
+ */
+
+void unpackCSI2P10(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	unsigned int x = 0;
+
+#if defined(__SSSE3__) || (defined(__ARM_NEON) && defined(__aarch64__))
+	/*
+	 * Process 8 pixels (10 bytes) per iteration, with 16-byte loads. The
+	 * loop stops early enough to avoid reading past the end of the line.
+	 */
+	const unsigned int lineBytes = (width + 3) / 4 * 5;
+
+	for (; x + 8 <= width && x / 4 * 5 + 16 <= lineBytes; x += 8) {
+		const uint8_t *in = src + x / 4 * 5;
+#if defined(__SSSE3__)
+		__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+		__m128i msb = _mm_shuffle_epi8(data, _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1,
+								   5, -1, 6, -1, 7, -1, 8, -1));
+		__m128i lsb = _mm_shuffle_epi8(data, _mm_setr_epi8(4, -1, 4, -1, 4, -1, 4, -1,
+								   9, -1, 9, -1, 9, -1, 9, -1));
+
+		/* Shift the low bits right by 0, 2, 4 and 6 with a multiplication. */
+		lsb = _mm_mullo_epi16(lsb, _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1));
+		lsb = _mm_and_si128(_mm_srli_epi16(lsb, 6), _mm_set1_epi16(3));
+
+		__m128i pixels = _mm_or_si128(_mm_slli_epi16(msb, 2), lsb);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), pixels);
+#else
+		static const uint8_t msbIndices[16] = { 0, 255, 1, 255, 2, 255, 3, 255,
+							5, 255, 6, 255, 7, 255, 8, 255 };
+		static const uint8_t lsbIndices[16] = { 4, 255, 4, 255, 4, 255, 4, 255,
+							9, 255, 9, 255, 9, 255, 9, 255 };
+		static const int16_t lsbShifts[8] = { 0, -2, -4, -6, 0, -2, -4, -6 };
+
+		uint8x16_t data = vld1q_u8(in);
+		uint16x8_t msb = vreinterpretq_u16_u8(vqtbl1q_u8(data, vld1q_u8(msbIndices)));
+		uint16x8_t lsb = vreinterpretq_u16_u8(vqtbl1q_u8(data, vld1q_u8(lsbIndices)));
+
+		lsb = vandq_u16(vshlq_u16(lsb, vld1q_s16(lsbShifts)), vdupq_n_u16(3));
+		vst1q_u16(dst + x, vorrq_u16(vshlq_n_u16(msb, 2), lsb));
+#endif
+	}
+#endif
+
+	for (; x < width; x += 4) {
+		const uint8_t *in = src + x / 4 * 5;
+		uint16_t pixels[4];
+
+		for (unsigned int i = 0; i < 4; ++i)
+			pixels[i] = in[i] << 2 | ((in[4] >> (i * 2)) & 0x03);
+
+		std::copy(pixels, pixels + std::min(4U, width - x), dst + x);
+	}
+}
+
+void packCSI2P10(const uint16_t *src, uint8_t *dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x += 4) {
+		uint16_t pixels[4] = {};
+		std::copy(src + x, src + x + std::min(4U, width - x), pixels);
+
+		uint8_t *out = dst + x / 4 * 5;
+		out[4] = 0;
+
+		for (unsigned int i = 0; i < 4; ++i) {
+			out[i] = pixels[i] >> 2;
+			out[4] |= (pixels[i] & 0x03) << (i * 2);
+		}
+	}
+}
+
+void unpackCSI2P12(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	unsigned int x = 0;
+
+#if defined(__SSSE3__) || (defined(__ARM_NEON) && defined(__aarch64__))
+	/* Process 8 pixels (12 bytes) per iteration, with 16-byte loads. */
+	const unsigned int lineBytes = (width + 1) / 2 * 3;
+
+	for (; x + 8 <= width && x / 2 * 3 + 16 <= lineBytes; x += 8) {
+		const uint8_t *in = src + x / 2 * 3;
+#if defined(__SSSE3__)
+		__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+		__m128i msb = _mm_shuffle_epi8(data, _mm_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1,
+								   6, -1, 7, -1, 9, -1, 10, -1));
+		__m128i lsb = _mm_shuffle_epi8(data, _mm_setr_epi8(2, -1, 2, -1, 5, -1, 5, -1,
+								   8, -1, 8, -1, 11, -1, 11, -1));
+
+		/* Shift the low bits right by 0 and 4 with a multiplication. */
+		lsb = _mm_mullo_epi16(lsb, _mm_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1));
+		lsb = _mm_and_si128(_mm_srli_epi16(lsb, 4), _mm_set1_epi16(0x0f));
+
+		__m128i pixels = _mm_or_si128(_mm_slli_epi16(msb, 4), lsb);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), pixels);
+#else
+		static const uint8_t msbIndices[16] = { 0, 255, 1, 255, 3, 255, 4, 255,
+							6, 255, 7, 255, 9, 255, 10, 255 };
+		static const uint8_t lsbIndices[16] = { 2, 255, 2, 255, 5, 255, 5, 255,
+							8, 255, 8, 255, 11, 255, 11, 255 };
+		static const int16_t lsbShifts[8] = { 0, -4, 0, -4, 0, -4, 0, -4 };
+
+		uint8x16_t data = vld1q_u8(in);
+		uint16x8_t msb = vreinterpretq_u16_u8(vqtbl1q_u8(data, vld1q_u8(msbIndices)));
+		uint16x8_t lsb = vreinterpretq_u16_u8(vqtbl1q_u8(data, vld1q_u8(lsbIndices)));
+
+		lsb = vandq_u16(vshlq_u16(lsb, vld1q_s16(lsbShifts)), vdupq_n_u16(0x0f));
+		vst1q_u16(dst + x, vorrq_u16(vshlq_n_u16(msb, 4), lsb));
+#endif
+	}
+#endif
+
+	for (; x < width; x += 2) {
+		const uint8_t *in = src + x / 2 * 3;
+
+		dst[x] = in[0] << 4 | (in[2] & 0x0f);
+		if (x + 1 < width)
+			dst[x + 1] = in[1] << 4 | in[2] >> 4;
+	}
+}
+
+void packCSI2P12(const uint16_t *src, uint8_t *dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x += 2) {
+		uint16_t p0 = src[x];
+		uint16_t p1 = x + 1 < width ? src[x + 1] : 0;
+		uint8_t *out = dst + x / 2 * 3;
+
+		out[0] = p0 >> 4;
+		out[1] = p1 >> 4;
+		out[2] = (p0 & 0x0f) | (p1 & 0x0f) << 4;
+	}
+}
+
+void unpackCSI2P14(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x += 4) {
+		const uint8_t *in = src + x / 4 * 7;
+		uint32_t lsb = in[4] | in[5] << 8 | in[6] << 16;
+		unsigned int count = std::min(4U, width - x);
+
+		for (unsigned int i = 0; i < count; ++i)
+			dst[x + i] = in[i] << 6 | ((lsb >> (i * 6)) & 0x3f);
+	}
+}
+
+void packCSI2P14(const uint16_t *src, uint8_t *dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x += 4) {
+		uint16_t pixels[4] = {};
+		std::copy(src + x, src + x + std::min(4U, width - x), pixels);
+
+		uint8_t *out = dst + x / 4 * 7;
+		uint32_t lsb = 0;
+
+		for (unsigned int i = 0; i < 4; ++i) {
+			out[i] = pixels[i] >> 6;
+			lsb |= (pixels[i] & 0x3f) << (i * 6);
+		}
+
+		out[4] = lsb;
+		out[5] = lsb >> 8;
+		out[6] = lsb >> 16;
+	}
+}
+
+/*
+ * The IPU3 format packs 25 pixels in 32 bytes, as a little-endian stream of
+ * 10-bit samples followed by 6 bits of padding.
+ */
+void unpackIPU3(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x += 25) {
+		uint64_t words[5] = {};
+		memcpy(words, src + x / 25 * 32, 32);
+
+		unsigned int count = std::min(25U, width - x);
+		for (unsigned int i = 0; i < count; ++i) {
+			unsigned int bit = i * 10;
+			unsigned int shift = bit % 64;
+			uint64_t value = words[bit / 64] >> shift;
+			if (shift > 54)
+				value |= words[bit / 64 + 1] << (64 - shift);
+
+			dst[x + i] = value & 0x3ff;
+		}
+	}
+}
+
+void packIPU3(const uint16_t *src, uint8_t *dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x += 25) {
+		uint64_t words[5] = {};
+
+		unsigned int count = std::min(25U, width - x);
+		for (unsigned int i = 0; i < count; ++i) {
+			unsigned int bit = i * 10;
+			unsigned int shift = bit % 64;
+			uint64_t value = src[x + i] & 0x3ff;
+
+			words[bit / 64] |= value << shift;
+			if (shift > 54)
+				words[bit / 64 + 1] |= value >> (64 - shift);
+		}
+
+		memcpy(dst + x / 25 * 32, words, 32);
+	}
+}
+
+} /* namespace */
+
+/**
+ * \brief Compute the size in bytes of a line of pixels in this format
+ * \param[in] width The line width, in pixels
+ *
+ * Lines of packed formats are padded to an integer number of pixel groups. The
+ * returned size doesn't include any additional padding that devices may add at
+ * the end of lines.
+ *
+ * \return The size of the line in bytes, or 0 if the format is invalid or its
+ * packing is unsupported
+ */
+unsigned int BayerFormat::lineSize(unsigned int width) const
+{
+	switch (packing) {
+	case None:
+		if (!bitDepth || bitDepth > 16)
+			return 0;
+		return bitDepth == 8 ? width : width * 2;
+
+	case CSI2Packed:
+		switch (bitDepth) {
+		case 10:
+			return (width + 3) / 4 * 5;
+		case 12:
+			return (width + 1) / 2 * 3;
+		case 14:
+			return (width + 3) / 4 * 7;
+		default:
+			return 0;
+		}
+
+	case IPU3Packed:
+		return bitDepth == 10 ? (width + 24) / 25 * 32 : 0;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Unpack a line of pixels to 16-bit samples
+ * \param[in] src The line of pixels in this format
+ * \param[out] dst The unpacked samples
+ * \param[in] width The line width, in pixels
+ *
+ * Unpack \a width pixels from \a src, which must contain at least
+ * lineSize(\a width) bytes, and store them in \a dst as 16-bit samples,
+ * right-aligned, without scaling. Samples of 8-bit unpacked formats are
+ * expanded to 16 bits.
+ *
+ * The CSI-2 10-bit and 12-bit kernels are vectorized when SSSE3 or AArch64 NEON
+ * instructions are available at build time.
+ *
+ * \return 0 on success, or -EINVAL if the format is not supported
+ */
+int BayerFormat::unpackLine(const uint8_t *src, uint16_t *dst,
+			    unsigned int width) const
+{
+	if (!lineSize(width))
+		return -EINVAL;
+
+	switch (packing) {
+	case None:
+		if (bitDepth == 8)
+			std::copy(src, src + width, dst);
+		else
+			memcpy(dst, src, width * 2);
+		break;
+
+	case CSI2Packed:
+		if (bitDepth == 10)
+			unpackCSI2P10(src, dst, width);
+		else if (bitDepth == 12)
+			unpackCSI2P12(src, dst, width);
+		else
+			unpackCSI2P14(src, dst, width);
+		break;
+
+	case IPU3Packed:
+		unpackIPU3(src, dst, width);
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Pack a line of 16-bit samples in this format
+ * \param[in] src The 16-bit samples, right-aligned
+ * \param[out] dst The line of pixels in this format
+ * \param[in] width The line width, in pixels
+ *
+ * Pack \a width samples from \a src and store them in \a dst, which must
+ * have room for lineSize(\a width) bytes. This is the reverse operation of
+ * unpackLine(). The bits of the samples beyond the bit depth of the format are
+ * ignored.
+ *
+ * \return 0 on success, or -EINVAL if the format is not supported
+ */
+int BayerFormat::packLine(const uint16_t *src, uint8_t *dst,
+			  unsigned int width) const
+{
+	if (!lineSize(width))
+		return -EINVAL;
+
+	switch (packing) {
+	case None:
+		if (bitDepth == 8)
+			std::transform(src, src + width, dst,
+				       [](uint16_t value) { return value & 0xff; });
+		else
+			memcpy(dst, src, width * 2);
+		break;
+
+	case CSI2Packed:
+		if (bitDepth == 10)
+			packCSI2P10(src, dst, width);
+		else if (bitDepth == 12)
+			packCSI2P12(src, dst, width);
+		else
+			packCSI2P14(src, dst, width);
+		break;
+
+	case IPU3Packed:
+		packIPU3(src, dst, width);
+		break;
+	}
+
+	return 0;
+}
+
 /**
  * \var BayerFormat::order
  * \brief The order of the colour channels in the Bayer pattern
@@ -13,6 +13,7 @@
 
 #include <libcamera/base/log.h>
 #include <libcamera/base/thread.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/framebuffer_allocator.h>
 #include <libcamera/request.h>
@@ -350,6 +351,7 @@ static const char *const camera_state_names[] = {
 	"Available",
 	"Acquired",
 	"Configured",
+	"Prepared",
 	"Stopping",
 	"Running",
 };
@@ -401,6 +403,124 @@ int Camera::Private::isAccessAllowed(State low, State high,
 	return -EACCES;
 }
 
+int Camera::Private::validateRequest(const Request *request) const
+{
+	if (request->buffers().empty()) {
+		LOG(Camera, Error) << "Request contains no buffers";
+		return -EINVAL;
+	}
+
+	for (auto const &it : request->buffers()) {
+		const Stream *stream = it.first;
+
+		if (activeStreams_.find(stream) == activeStreams_.end()) {
+			LOG(Camera, Error) << "Invalid request";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+int Camera::Private::setActiveStreams(const CameraConfiguration *config)
+{
+	activeStreams_.clear();
+	for (const StreamConfiguration &cfg : *config) {
+		Stream *stream = cfg.stream();
+		if (!stream) {
+			LOG(Camera, Fatal)
+				<< "Pipeline handler failed to update stream configuration";
+			activeStreams_.clear();
+			return -EINVAL;
+		}
+
+		stream->configuration_ = cfg;
+		activeStreams_.insert(stream);
+	}
+
+	return 0;
+}
+
+/*
+ * Precompute the table of supported libcamera controls, used to validate
+ * request controls without looking them up in the camera's ControlInfoMap.
+ * This shall be called when the camera is registered, and every time the
+ * pipeline handler may update the camera controls.
+ */
+void Camera::Private::updateSupportedControls()
+{
+	Camera *const o = LIBCAMERA_O_PTR();
+
+	supportedControls_.reset();
+	for (const auto &ctrl : pipe_->controls(o)) {
+		unsigned int id = ctrl.first->id();
+		if (id <= controls::MaxControlId)
+			supportedControls_.set(id);
+	}
+}
+
+bool Camera::Private::isControlSupported(unsigned int id) const
+{
+	if (id <= controls::MaxControlId)
+		return supportedControls_.test(id);
+
+	const Camera *const o = LIBCAMERA_O_PTR();
+	const ControlInfoMap &controls = pipe_->controls(o);
+	return controls.find(id) != controls.end();
+}
+
+/*
+ * Update the queue status with the completion of a request. The pipeline
+ * starves if no other request is queued to the pipeline handler while the
+ * camera is running. The pipeline timings are taken from the statistics of
+ * the active streams, using the longest processing time and the shortest frame
+ * interval.
+ */
+void Camera::Private::updateQueueStatus(const Request *request)
+{
+	Camera *const o = LIBCAMERA_O_PTR();
+
+	bool starved = state_.load(std::memory_order_acquire) == CameraRunning &&
+		       request->status() == Request::RequestComplete &&
+		       !pipe_->hasPendingRequests(o);
+
+	std::chrono::nanoseconds processing{};
+	std::chrono::nanoseconds interval{};
+
+	{
+		MutexLocker locker(streamStatsLock_);
+
+		for (const Stream *stream : activeStreams_) {
+			auto it = streamStats_.find(stream);
+			if (it == streamStats_.end() ||
+			    !it->second.frameInterval().count())
+				continue;
+
+			const StreamStats &stats = it->second;
+			std::chrono::nanoseconds median =
+				stats.frameInterval().percentile(50);
+
+			processing = std::max(processing, stats.latency().mean());
+			if (!interval.count() || median < interval)
+				interval = median;
+		}
+	}
+
+	QueueStatus status;
+	bool changed;
+
+	{
+		MutexLocker locker(queueStatusLock_);
+
+		changed = queueStatus_.requestCompleted(starved);
+		changed |= queueStatus_.updateDepth(processing, interval);
+		status = queueStatus_;
+	}
+
+	if (changed)
+		o->queueStatusChanged.emit(status);
+}
+
 void Camera::Private::disconnect()
 {
 	/*
@@ -408,7 +528,8 @@ void Camera::Private::disconnect()
 	 * state to Configured state to allow applications to free resources
 	 * and call release() before deleting the camera.
 	 */
-	if (state_.load(std::memory_order_acquire) == Private::CameraRunning)
+	State state = state_.load(std::memory_order_acquire);
+	if (state == Private::CameraPrepared || state == Private::CameraRunning)
 		state_.store(Private::CameraConfigured, std::memory_order_release);
 
 	disconnected_ = true;
@@ -475,12 +596,17 @@ void Camera::Private::setState(State state)
  *   Acquired -> Configured [label = "configure()"];
  *
  *   Configured -> Available [label = "release()"];
- *   Configured -> Configured [label = "configure(), createRequest()"];
+ *   Configured -> Configured [label = "configure(), createRequest(),\nprepareConfiguration()"];
  *   Configured -> Running [label = "start()"];
+ *   Configured -> Prepared [label = "prepare()"];
+ *
+ *   Prepared -> Configured [label = "stop()"];
+ *   Prepared -> Prepared [label = "createRequest()"];
+ *   Prepared -> Running [label = "start()"];
  *
  *   Running -> Stopping [label = "stop()"];
  *   Stopping -> Configured;
- *   Running -> Running [label = "createRequest(), queueRequest()"];
+ *   Running -> Running [label = "createRequest(), queueRequest(),\nprepareConfiguration(), reconfigure()"];
  * }
  * \enddot
  *
@@ -497,7 +623,14 @@ void Camera::Private::setState(State state)
  * \subsubsection Configured
  * The camera is configured and ready to be started. The application may
  * release() the camera and to get back to the Available state or start()
- * it to progress to the Running state.
+ * it to progress to the Running state. It may alternatively prepare() the
+ * camera to progress to the Prepared state.
+ *
+ * \subsubsection Prepared
+ * The camera has acquired all the resources needed to capture frames, and is
+ * ready to start streaming with minimal latency. The application may start()
+ * the camera to progress to the Running state, or stop() it to release the
+ * resources and get back to the Configured state.
  *
  * \subsubsection Stopping
  * The camera has been asked to stop. Pending requests are being completed or
@@ -575,6 +708,35 @@ const std::string &Camera::id() const
  * \var Camera::bufferCompleted
  * \brief Signal emitted when a buffer for a request queued to the camera has
  * completed
+ *
+ * Buffers of a request complete independently of each other, and the signal is
+ * emitted as soon as the camera is done with a buffer, without waiting for the
+ * other buffers of the request. After the signal has been emitted the camera
+ * doesn't access the buffer anymore. Its contents can be consumed and the
+ * buffer recycled immediately, for instance by returning it to a
+ * FrameBufferPool and adding it to another request, before the request it
+ * belongs to completes. The request shall then not be reused with
+ * Request::ReuseBuffers.
+ *
+ * Together with the \ref metadataAvailable signal, this allows applications to
+ * process partial results of a request, such as displaying a viewfinder frame
+ * without waiting for the slowest stream of the request to complete.
+ */
+
+/**
+ * \var Camera::metadataAvailable
+ * \brief Signal emitted when part of the metadata of a request is available
+ *
+ * Pipeline handlers may produce the metadata of a request in multiple parts,
+ * for instance recording the sensor timestamp when the frame is captured, and
+ * the results of the image processing algorithms later. This signal is emitted
+ * for each of those parts with the request and a list containing the metadata
+ * that has just become available. Metadata reported through this signal is
+ * final, and is also accumulated in the Request::metadata() list.
+ *
+ * Not all metadata is guaranteed to be reported through this signal. The
+ * complete metadata of a request is only available through
+ * Request::metadata() when the \ref requestCompleted signal is emitted.
  */
 
 /**
@@ -582,6 +744,17 @@ const std::string &Camera::id() const
  * \brief Signal emitted when a request queued to the camera has completed
  */
 
+/**
+ * \var Camera::queueStatusChanged
+ * \brief Signal emitted when the request queue status of the camera changes
+ *
+ * This signal is emitted when the pipeline runs out of requests while the
+ * camera is running, and when the recommended request depth changes. It is
+ * emitted before the requestCompleted signal of the request whose completion
+ * caused the change, to let applications adapt the number of requests they
+ * queue back. See QueueStatus for more information.
+ */
+
 /**
  * \var Camera::disconnected
  * \brief Signal emitted when the camera is disconnected from the system
@@ -624,7 +797,7 @@ void Camera::disconnect()
 	disconnected.emit(this);
 }
 
-int Camera::exportFrameBuffers(Stream *stream,
+int Camera::exportFrameBuffers(Stream *stream, unsigned int count,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	Private *const d = _d();
@@ -641,7 +814,7 @@ int Camera::exportFrameBuffers(Stream *stream,
 
 	return d->pipe_->invokeMethod(&PipelineHandler::exportFrameBuffers,
 				      ConnectionTypeBlocking, this, stream,
-				      buffers);
+				      count, buffers);
 }
 
 /**
@@ -680,9 +853,9 @@ int Camera::acquire()
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
-	if (!d->pipe_->lock()) {
+	if (!d->pipe_->lock(this)) {
 		LOG(Camera, Info)
-			<< "Pipeline handler in use by another process";
+			<< "Pipeline handler in use by another process or camera";
 		return -EBUSY;
 	}
 
@@ -714,7 +887,15 @@ int Camera::release()
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
-	d->pipe_->unlock();
+	/*
+	 * A camera that hasn't been acquired doesn't hold the pipeline lock.
+	 * Restore the default completion order for the next user otherwise.
+	 */
+	if (d->state_.load(std::memory_order_acquire) != Private::CameraAvailable) {
+		d->pipe_->invokeMethod(&PipelineHandler::setOutOfOrderCompletion,
+				       ConnectionTypeBlocking, this, false);
+		d->pipe_->unlock(this);
+	}
 
 	d->setState(Private::CameraAvailable);
 
@@ -874,25 +1055,69 @@ int Camera::configure(CameraConfiguration *config)
 	if (ret)
 		return ret;
 
-	d->activeStreams_.clear();
-	for (const StreamConfiguration &cfg : *config) {
-		Stream *stream = cfg.stream();
-		if (!stream) {
-			LOG(Camera, Fatal)
-				<< "Pipeline handler failed to update stream configuration";
-			d->activeStreams_.clear();
-			return -EINVAL;
-		}
-
-		stream->configuration_ = cfg;
-		d->activeStreams_.insert(stream);
-	}
+	ret = d->setActiveStreams(config);
+	if (ret)
+		return ret;
 
+	d->updateSupportedControls();
 	d->setState(Private::CameraConfigured);
 
 	return 0;
 }
 
+/**
+ * \enum Camera::CompletionOrder
+ * \brief The order in which requests are completed
+ * \var Camera::CompletionOrder::InOrder
+ * \brief Requests complete in the order they have been queued
+ * \var Camera::CompletionOrder::OutOfOrder
+ * \brief Requests complete as soon as they are done
+ */
+
+/**
+ * \brief Select the order in which requests complete
+ * \param[in] order The request completion order
+ *
+ * By default requests are returned to the application through the
+ * \ref requestCompleted signal in the order they have been queued. A request
+ * that takes longer to process, for instance because it captures a still image
+ * that requires additional processing, then delays the completion of all the
+ * requests queued after it, even if they are done.
+ *
+ * Setting \a order to CompletionOrder::OutOfOrder causes requests to complete
+ * as soon as they are done. Applications that need to reorder the completed
+ * requests can use Request::sequence(), which reflects the order in which the
+ * requests have been queued to the device.
+ *
+ * The completion order is retained until it is changed by another call to this
+ * function, or until the camera is released. Releasing the camera restores the
+ * default in-order completion.
+ *
+ * \context This function may only be called when the camera is in the Acquired
+ * or Configured state as defined in \ref camera_operation, and shall be
+ * synchronized by the caller with other functions that affect the camera
+ * state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where the order can be set
+ */
+int Camera::setCompletionOrder(CompletionOrder order)
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraAcquired,
+				     Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	d->pipe_->invokeMethod(&PipelineHandler::setOutOfOrderCompletion,
+			       ConnectionTypeBlocking, this,
+			       order == CompletionOrder::OutOfOrder);
+
+	return 0;
+}
+
 /**
  * \brief Create a request object for the camera
  * \param[in] cookie Opaque cookie for application use
@@ -909,6 +1134,10 @@ int Camera::configure(CameraConfiguration *config)
  * responsible for deleting it. The request may be deleted in the completion
  * handler, or reused after resetting its state with Request::reuse().
  *
+ * Requests should be created once and recycled with Request::reuse() for the
+ * duration of a capture session, for instance through a RequestPool, instead
+ * of being created for every frame.
+ *
  * \context This function is \threadsafe. It may only be called when the camera
  * is in the Configured or Running state as defined in \ref camera_operation.
  *
@@ -960,18 +1189,13 @@ int Camera::queueRequest(Request *request)
 	 * this.
 	 */
 
-	if (request->buffers().empty()) {
-		LOG(Camera, Error) << "Request contains no buffers";
-		return -EINVAL;
-	}
-
-	for (auto const &it : request->buffers()) {
-		const Stream *stream = it.first;
+	ret = d->validateRequest(request);
+	if (ret < 0)
+		return ret;
 
-		if (d->activeStreams_.find(stream) == d->activeStreams_.end()) {
-			LOG(Camera, Error) << "Invalid request";
-			return -EINVAL;
-		}
+	{
+		MutexLocker locker(d->queueStatusLock_);
+		d->queueStatus_.requestQueued();
 	}
 
 	d->pipe_->invokeMethod(&PipelineHandler::queueRequest,
@@ -980,6 +1204,105 @@ int Camera::queueRequest(Request *request)
 	return 0;
 }
 
+/**
+ * \brief Queue multiple requests to the camera
+ * \param[in] requests The requests to queue to the camera
+ *
+ * This function queues all the \a requests to the camera for capture, in the
+ * order they appear in the span. It behaves as calling queueRequest() for each
+ * request, but hands all of them to the pipeline handler at once, avoiding the
+ * cost of a cross-thread call per request. It is best used to prime the camera
+ * with requests after starting it, or to queue a burst of captures.
+ *
+ * All requests are validated before any of them is queued. If any request is
+ * invalid, no request is queued and the function returns an error.
+ *
+ * \context This function is \threadsafe. It may only be called when the camera
+ * is in the Running state as defined in \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running so requests can't be queued
+ * \retval -EINVAL One of the requests is invalid
+ */
+int Camera::queueRequests(Span<Request *const> requests)
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	for (const Request *request : requests) {
+		ret = d->validateRequest(request);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (requests.empty())
+		return 0;
+
+	{
+		MutexLocker locker(d->queueStatusLock_);
+		for (unsigned int i = 0; i < requests.size(); i++)
+			d->queueStatus_.requestQueued();
+	}
+
+	d->pipe_->invokeMethod(&PipelineHandler::queueRequests,
+			       ConnectionTypeQueued,
+			       std::vector<Request *>(requests.begin(),
+						      requests.end()));
+
+	return 0;
+}
+
+/**
+ * \brief Prepare the camera for capture
+ * \param[in] controls Controls to be applied before starting the Camera
+ *
+ * Acquire all the resources needed to start the camera capture session, such
+ * as buffers and image processing algorithms, without starting streaming. A
+ * prepared camera can then be started with start() with minimal latency. This
+ * is useful for applications that need to start capturing frames as fast as
+ * possible on an external trigger.
+ *
+ * The \a controls are applied when preparing the camera, in the same way as
+ * they are when passed to start(). The resources acquired by prepare() are
+ * released by stop().
+ *
+ * Not all pipeline handlers support splitting the preparation from the start of
+ * streaming. For those that don't, this function has no effect other than
+ * moving the camera to the Prepared state, and all the work is done in start().
+ *
+ * \context This function may only be called when the camera is in the
+ * Configured state as defined in \ref camera_operation, and shall be
+ * synchronized by the caller with other functions that affect the camera
+ * state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where it can be prepared
+ */
+int Camera::prepare(const ControlList *controls)
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	LOG(Camera, Debug) << "Preparing capture";
+
+	ret = d->pipe_->invokeMethod(&PipelineHandler::prepare,
+				     ConnectionTypeBlocking, this, controls);
+	if (ret)
+		return ret;
+
+	d->setState(Private::CameraPrepared);
+
+	return 0;
+}
+
 /**
  * \brief Start capture from camera
  * \param[in] controls Controls to be applied before starting the Camera
@@ -989,9 +1312,12 @@ int Camera::queueRequest(Request *request)
  * requests to the camera to process and return to the application until the
  * capture session is terminated with \a stop().
  *
+ * If the camera has been prepared with prepare(), this function only starts
+ * streaming. Otherwise it prepares the camera first.
+ *
  * \context This function may only be called when the camera is in the
- * Configured state as defined in \ref camera_operation, and shall be
- * synchronized by the caller with other functions that affect the camera
+ * Configured or Prepared state as defined in \ref camera_operation, and shall
+ * be synchronized by the caller with other functions that affect the camera
  * state.
  *
  * \return 0 on success or a negative error code otherwise
@@ -1002,16 +1328,32 @@ int Camera::start(const ControlList *controls)
 {
 	Private *const d = _d();
 
-	int ret = d->isAccessAllowed(Private::CameraConfigured);
+	int ret = d->isAccessAllowed(Private::CameraConfigured,
+				     Private::CameraPrepared);
 	if (ret < 0)
 		return ret;
 
+	if (d->state_.load(std::memory_order_acquire) == Private::CameraConfigured) {
+		ret = prepare(controls);
+		if (ret)
+			return ret;
+	}
+
 	LOG(Camera, Debug) << "Starting capture";
 
+	{
+		MutexLocker locker(d->queueStatusLock_);
+		d->queueStatus_.reset();
+	}
+
 	ret = d->pipe_->invokeMethod(&PipelineHandler::start,
 				     ConnectionTypeBlocking, this, controls);
-	if (ret)
+	if (ret) {
+		d->pipe_->invokeMethod(&PipelineHandler::unprepare,
+				       ConnectionTypeBlocking, this);
+		d->setState(Private::CameraConfigured);
 		return ret;
+	}
 
 	d->setState(Private::CameraRunning);
 
@@ -1023,6 +1365,8 @@ int Camera::start(const ControlList *controls)
  *
  * This function stops capturing and processing requests immediately. All
  * pending requests are cancelled and complete synchronously in an error state.
+ * If the camera has been prepared with prepare() but not started, this function
+ * releases the resources acquired by prepare().
  *
  * \context This function may be called in any camera state as defined in \ref
  * camera_operation, and shall be synchronized by the caller with other
@@ -1037,6 +1381,16 @@ int Camera::stop()
 {
 	Private *const d = _d();
 
+	if (d->state_.load(std::memory_order_acquire) == Private::CameraPrepared) {
+		LOG(Camera, Debug) << "Releasing prepared resources";
+
+		d->pipe_->invokeMethod(&PipelineHandler::unprepare,
+				       ConnectionTypeBlocking, this);
+		d->setState(Private::CameraConfigured);
+
+		return 0;
+	}
+
 	/*
 	 * \todo Make calling stop() when not in 'Running' part of the state
 	 * machine rather than take this shortcut
@@ -1054,6 +1408,8 @@ int Camera::stop()
 
 	d->pipe_->invokeMethod(&PipelineHandler::stop, ConnectionTypeBlocking,
 			       this);
+	d->pipe_->invokeMethod(&PipelineHandler::cancelWaitingRequests,
+			       ConnectionTypeBlocking, this);
 
 	ASSERT(!d->pipe_->hasPendingRequests(this));
 
@@ -1062,20 +1418,274 @@ int Camera::stop()
 	return 0;
 }
 
+/**
+ * \brief Prepare an alternate configuration for a fast switch
+ * \param[in] config The alternate camera configuration
+ *
+ * This function validates the \a config and lets the pipeline handler prepare
+ * the resources it needs to switch to it, without affecting the current
+ * configuration of the camera. The camera can then be switched to the prepared
+ * configuration with reconfigure(). Depending on the pipeline handler, the
+ * switch may be limited to stopping the video devices, changing their formats
+ * and restarting them.
+ *
+ * A configuration stays prepared until the camera is configured again with
+ * configure(). Multiple configurations can be prepared, for instance to switch
+ * back and forth between preview and still capture. The configurations are
+ * identified by the pixel formats and sizes of their streams, modifying the
+ * \a config after it has been prepared makes the preparation ineffective but
+ * is otherwise harmless.
+ *
+ * \context This function may only be called when the camera is in the
+ * Configured or Running state as defined in \ref camera_operation, and shall be
+ * synchronized by the caller with other functions that affect the camera
+ * state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not configured or running
+ * \retval -EINVAL The configuration is not valid
+ */
+int Camera::prepareConfiguration(CameraConfiguration *config)
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraConfigured,
+				     Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	for (auto it : *config)
+		it.setStream(nullptr);
+
+	if (config->validate() != CameraConfiguration::Valid) {
+		LOG(Camera, Error)
+			<< "Can't prepare an invalid configuration";
+		return -EINVAL;
+	}
+
+	return d->pipe_->invokeMethod(&PipelineHandler::prepareConfiguration,
+				      ConnectionTypeBlocking, this, config);
+}
+
+/**
+ * \brief Switch a running camera to a new configuration
+ * \param[in] config The new camera configuration
+ *
+ * This function applies a new configuration to the camera without stopping it
+ * from the application's point of view. It is equivalent to calling stop(),
+ * configure() and start(), but lets the pipeline handler implement a faster
+ * switch, and avoids a round trip through the application for each step. It
+ * is typically used to switch from a preview configuration to a still capture
+ * configuration with minimal latency.
+ *
+ * The \a config is validated before the camera is affected. If it isn't valid,
+ * the function returns -EINVAL and the camera keeps running with its current
+ * configuration. Otherwise all pending requests are cancelled and complete with
+ * the Request::RequestCancelled status, the new configuration is applied, and
+ * the camera is ready to accept requests for the new configuration when the
+ * function returns.
+ *
+ * Switching to a configuration prepared with prepareConfiguration() allows the
+ * pipeline handler to only swap the formats of its video devices, keeping the
+ * rest of the pipeline running. Other configurations result in a full stop and
+ * restart of the pipeline.
+ *
+ * Buffers for the new configuration can't be allocated while the camera is
+ * running. Applications shall prepare them beforehand, either by importing
+ * buffers large enough for all the configurations they switch between, or by
+ * allocating buffers with the FrameBufferAllocator for each configuration
+ * before starting the camera.
+ *
+ * \context This function may only be called when the camera is in the Running
+ * state as defined in \ref camera_operation, and shall be synchronized by the
+ * caller with other functions that affect the camera state.
+ *
+ * \return 0 on success or a negative error code otherwise. On error, except
+ * for an invalid \a config, the camera is stopped and left in the Acquired
+ * state, and shall be configured again before being restarted.
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running
+ * \retval -EINVAL The configuration is not valid
+ */
+int Camera::reconfigure(CameraConfiguration *config)
+{
+	Private *const d = _d();
+
+	int ret = d->isAccessAllowed(Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	for (auto it : *config)
+		it.setStream(nullptr);
+
+	if (config->validate() != CameraConfiguration::Valid) {
+		LOG(Camera, Error)
+			<< "Can't reconfigure camera with invalid configuration";
+		return -EINVAL;
+	}
+
+	LOG(Camera, Debug) << "Reconfiguring capture";
+
+	d->setState(Private::CameraStopping);
+
+	ret = d->pipe_->invokeMethod(&PipelineHandler::reconfigure,
+				     ConnectionTypeBlocking, this, config);
+	if (!ret)
+		ret = d->setActiveStreams(config);
+	if (ret) {
+		d->activeStreams_.clear();
+		d->setState(Private::CameraAcquired);
+		return ret;
+	}
+
+	d->updateSupportedControls();
+	d->setState(Private::CameraRunning);
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the request latency statistics
+ *
+ * The camera measures the latency of the processing stages of all requests
+ * queued to it, as described in RequestLatencyStats::Stage. The measurements
+ * are accumulated until they are reset with resetLatencyStats(), across
+ * start() and stop() sequences. They are kept enabled at all times, and can be
+ * exported in JSON format with RequestLatencyStats::toJson().
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return A copy of the request latency statistics
+ */
+RequestLatencyStats Camera::latencyStats() const
+{
+	const Private *const d = _d();
+
+	MutexLocker locker(d->latencyLock_);
+	return d->latencyStats_;
+}
+
+/**
+ * \brief Reset the request latency statistics
+ *
+ * \context This function is \threadsafe.
+ */
+void Camera::resetLatencyStats()
+{
+	Private *const d = _d();
+
+	MutexLocker locker(d->latencyLock_);
+	d->latencyStats_.reset();
+}
+
+/**
+ * \brief Retrieve the frame statistics of a stream
+ * \param[in] stream The stream
+ *
+ * The camera maintains frame delivery statistics for each of its streams, as
+ * described in StreamStats. The statistics are updated for every completed
+ * buffer, and are accumulated until they are reset with resetStreamStats(),
+ * across start() and stop() sequences.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return A copy of the statistics of \a stream, or empty statistics if no
+ * buffer has completed for \a stream
+ */
+StreamStats Camera::streamStats(const Stream *stream) const
+{
+	const Private *const d = _d();
+
+	MutexLocker locker(d->streamStatsLock_);
+	auto it = d->streamStats_.find(stream);
+	if (it == d->streamStats_.end())
+		return {};
+
+	return it->second;
+}
+
+/**
+ * \brief Reset the frame statistics of all streams
+ *
+ * \context This function is \threadsafe.
+ */
+void Camera::resetStreamStats()
+{
+	Private *const d = _d();
+
+	MutexLocker locker(d->streamStatsLock_);
+	d->streamStats_.clear();
+}
+
+/**
+ * \brief Retrieve the request queue status
+ *
+ * The queue status reports the number of requests queued to the camera, the
+ * starvation events since the camera has been started, and the request depth
+ * recommended to avoid starvation with the lowest latency, as described in
+ * QueueStatus. Changes of the status are signalled by queueStatusChanged.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return A copy of the request queue status
+ */
+QueueStatus Camera::queueStatus() const
+{
+	const Private *const d = _d();
+
+	MutexLocker locker(d->queueStatusLock_);
+	return d->queueStatus_;
+}
+
+/**
+ * \brief Record a request latency measurement
+ * \param[in] stage The request processing stage
+ * \param[in] latency The measured latency
+ */
+void Camera::recordLatency(RequestLatencyStats::Stage stage,
+			   std::chrono::nanoseconds latency)
+{
+	Private *const d = _d();
+
+	MutexLocker locker(d->latencyLock_);
+	d->latencyStats_.record(stage, latency);
+}
+
+/**
+ * \brief Record the completion of a buffer in the stream statistics
+ * \param[in] stream The stream the buffer belongs to
+ * \param[in] buffer The completed buffer
+ */
+void Camera::recordBuffer(const Stream *stream, const FrameBuffer *buffer)
+{
+	Private *const d = _d();
+
+	std::chrono::nanoseconds now = utils::clock::now().time_since_epoch();
+
+	MutexLocker locker(d->streamStatsLock_);
+	d->streamStats_[stream].record(buffer->metadata(), now);
+}
+
 /**
  * \brief Handle request completion and notify application
  * \param[in] request The request that has completed
  *
  * This function is called by the pipeline handler to notify the camera that
- * the request has completed. It emits the requestCompleted signal.
+ * the request has completed. It updates the queue status and emits the
+ * requestCompleted signal.
  */
 void Camera::requestComplete(Request *request)
 {
+	Private *const d = _d();
+
 	/* Disconnected cameras are still able to complete requests. */
-	if (_d()->isAccessAllowed(Private::CameraStopping, Private::CameraRunning,
-				  true))
+	if (d->isAccessAllowed(Private::CameraStopping, Private::CameraRunning,
+			       true))
 		LOG(Camera, Fatal) << "Trying to complete a request when stopped";
 
+	d->updateQueueStatus(request);
+
 	requestCompleted.emit(request);
 }
 
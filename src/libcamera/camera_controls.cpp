@@ -10,6 +10,8 @@
 #include <libcamera/camera.h>
 #include <libcamera/controls.h>
 
+#include "libcamera/internal/camera.h"
+
 /**
  * \file camera_controls.h
  * \brief Controls for Camera instances
@@ -22,7 +24,9 @@ namespace libcamera {
  * \brief A control validator for Camera instances
  *
  * This ControlValidator specialisation validates that controls exist in the
- * Camera associated with the validator.
+ * Camera associated with the validator. Validation uses a table of the
+ * supported controls precomputed by the Camera, and doesn't require a lookup
+ * in the camera's ControlInfoMap.
  */
 
 /**
@@ -46,8 +50,7 @@ const std::string &CameraControlValidator::name() const
  */
 bool CameraControlValidator::validate(unsigned int id) const
 {
-	const ControlInfoMap &controls = camera_->controls();
-	return controls.find(id) != controls.end();
+	return camera_->_d()->isControlSupported(id);
 }
 
 } /* namespace libcamera */
@@ -7,20 +7,27 @@
 
 #include <libcamera/camera_manager.h>
 
+#include <algorithm>
 #include <condition_variable>
 #include <map>
+#include <stdlib.h>
+#include <string>
 
 #include <libcamera/camera.h>
 
 #include <libcamera/base/utils.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/message.h>
 #include <libcamera/base/thread.h>
 
+#include "libcamera/internal/device_cache.h"
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/memory_tracker.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/process.h"
+#include "libcamera/internal/trace_recorder.h"
 
 /**
  * \file camera_manager.h
@@ -34,6 +41,97 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Camera)
 
+namespace {
+
+/*
+ * Helper object living in the camera manager thread, used to start a group of
+ * cameras without a thread switch between each of them.
+ */
+class CameraGroupStarter : public Object
+{
+public:
+	int start(const std::vector<std::shared_ptr<Camera>> &cameras,
+		  const ControlList *controls)
+	{
+		for (auto it = cameras.begin(); it != cameras.end(); ++it) {
+			int ret = (*it)->start(controls);
+			if (ret >= 0)
+				continue;
+
+			LOG(Camera, Error)
+				<< "Failed to start camera '" << (*it)->id()
+				<< "' in group";
+
+			/*
+			 * Stop the cameras already started, and release the
+			 * resources of the cameras still prepared.
+			 */
+			for (const std::shared_ptr<Camera> &camera : cameras) {
+				if (camera != *it)
+					camera->stop();
+			}
+
+			return ret;
+		}
+
+		return 0;
+	}
+};
+
+/*
+ * Helper object living in the camera manager thread, used to emit the
+ * cameraAdded and cameraRemoved signals from that thread when cameras are
+ * registered or unregistered by pipeline handlers running in their own
+ * thread.
+ */
+class CameraNotifier : public Object
+{
+public:
+	CameraNotifier(CameraManager *manager)
+		: manager_(manager)
+	{
+	}
+
+	void added(std::shared_ptr<Camera> camera)
+	{
+		manager_->cameraAdded.emit(camera);
+	}
+
+	void removed(std::shared_ptr<Camera> camera)
+	{
+		manager_->cameraRemoved.emit(camera);
+	}
+
+private:
+	CameraManager *manager_;
+};
+
+/*
+ * Thread running pipeline handlers. Cameras, and thus pipeline handlers, are
+ * destroyed with deleteLater(), process the pending deletions when the thread
+ * is stopped.
+ */
+class PipelineThread : public Thread
+{
+protected:
+	void run() override
+	{
+		exec();
+		dispatchMessages(Message::Type::DeferredDelete);
+	}
+};
+
+unsigned int camerasPerThreadFromEnv()
+{
+	const char *count = utils::secure_getenv("LIBCAMERA_CAMERAS_PER_THREAD");
+	if (!count || *count == '\0')
+		return 0;
+
+	return strtoul(count, nullptr, 10);
+}
+
+} /* namespace */
+
 class CameraManager::Private : public Extensible::Private, public Thread
 {
 	LIBCAMERA_DECLARE_PUBLIC(CameraManager)
@@ -46,6 +144,9 @@ public:
 		       const std::vector<dev_t> &devnums);
 	void removeCamera(Camera *camera);
 
+	CameraGroupStarter groupStarter_;
+	std::unique_ptr<CameraNotifier> notifier_;
+
 	/*
 	 * This mutex protects
 	 *
@@ -62,6 +163,8 @@ protected:
 private:
 	int init();
 	void createPipelineHandlers();
+	bool matchPipelineHandler(const std::shared_ptr<PipelineHandler> &pipe);
+	Thread *pipelineThread();
 	void cleanup();
 
 	std::condition_variable cv_;
@@ -70,13 +173,24 @@ private:
 
 	std::unique_ptr<DeviceEnumerator> enumerator_;
 
+	/*
+	 * Pipeline handlers that support it are spread across threads, with
+	 * up to camerasPerThread_ pipeline handler instances per thread.
+	 */
+	unsigned int camerasPerThread_;
+	unsigned int threadedPipelines_;
+	std::vector<std::unique_ptr<PipelineThread>> pipelineThreads_;
+
 	IPAManager ipaManager_;
 	ProcessManager processManager_;
 };
 
 CameraManager::Private::Private()
-	: initialized_(false)
+	: initialized_(false), camerasPerThread_(camerasPerThreadFromEnv()),
+	  threadedPipelines_(0)
 {
+	setName("CameraManager");
+	groupStarter_.moveToThread(this);
 }
 
 int CameraManager::Private::start()
@@ -125,12 +239,23 @@ void CameraManager::Private::run()
 
 int CameraManager::Private::init()
 {
+	notifier_ = std::make_unique<CameraNotifier>(_o<CameraManager>());
+
+	/* Start the proxy workers early to overlap with device enumeration. */
+	ipaManager_.startWorkers();
+
 	enumerator_ = DeviceEnumerator::create();
-	if (!enumerator_ || enumerator_->enumerate())
+	if (!enumerator_ || enumerator_->enumerate()) {
+		ipaManager_.releaseWorkers();
 		return -ENODEV;
+	}
 
 	createPipelineHandlers();
 
+	ipaManager_.releaseWorkers();
+
+	enumerator_->devicesAdded.connect(this, &Private::createPipelineHandlers);
+
 	return 0;
 }
 
@@ -156,7 +281,7 @@ void CameraManager::Private::createPipelineHandlers()
 		 */
 		while (1) {
 			std::shared_ptr<PipelineHandler> pipe = factory->create(o);
-			if (!pipe->match(enumerator_.get()))
+			if (!matchPipelineHandler(pipe))
 				break;
 
 			LOG(Camera, Debug)
@@ -165,7 +290,44 @@ void CameraManager::Private::createPipelineHandlers()
 		}
 	}
 
-	enumerator_->devicesAdded.connect(this, &Private::createPipelineHandlers);
+	/* Persist the information gathered from the devices for the next run. */
+	DeviceCache::instance()->save();
+}
+
+bool CameraManager::Private::matchPipelineHandler(const std::shared_ptr<PipelineHandler> &pipe)
+{
+	Thread *thread = camerasPerThread_ && pipe->supportsDedicatedThread()
+		       ? pipelineThread() : nullptr;
+	if (!thread)
+		return pipe->match(enumerator_.get());
+
+	/*
+	 * Match the pipeline handler in its thread, for all the objects it
+	 * creates, including event notifiers and timers, to be bound to that
+	 * thread.
+	 */
+	pipe->moveToThread(thread);
+	bool matched = pipe->invokeMethod(&PipelineHandler::match,
+					  ConnectionTypeBlocking,
+					  enumerator_.get());
+	if (matched)
+		threadedPipelines_++;
+
+	return matched;
+}
+
+Thread *CameraManager::Private::pipelineThread()
+{
+	unsigned int index = threadedPipelines_ / camerasPerThread_;
+
+	if (index == pipelineThreads_.size()) {
+		auto thread = std::make_unique<PipelineThread>();
+		thread->setName("Pipeline:" + std::to_string(index));
+		thread->start();
+		pipelineThreads_.push_back(std::move(thread));
+	}
+
+	return pipelineThreads_[index].get();
 }
 
 void CameraManager::Private::cleanup()
@@ -182,7 +344,18 @@ void CameraManager::Private::cleanup()
 	cameras_.clear();
 	dispatchMessages(Message::Type::DeferredDelete);
 
+	/* Stop the pipeline threads, destroying their cameras. */
+	for (std::unique_ptr<PipelineThread> &thread : pipelineThreads_) {
+		thread->exit();
+		thread->wait();
+	}
+	pipelineThreads_.clear();
+
+	notifier_.reset();
 	enumerator_.reset(nullptr);
+
+	/* Terminate the proxy workers kept for reuse by destroyed IPA proxies. */
+	ipaManager_.releaseWorkers();
 }
 
 void CameraManager::Private::addCamera(std::shared_ptr<Camera> camera,
@@ -265,6 +438,9 @@ CameraManager::CameraManager()
 			<< "Multiple CameraManager objects are not allowed";
 
 	self_ = this;
+
+	/* Start recording trace events if requested by the environment. */
+	TraceRecorder::instance();
 }
 
 /**
@@ -432,17 +608,24 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
  * \a devnums are used by the V4L2 compatibility layer to map V4L2 device nodes
  * to Camera instances.
  *
- * \context This function shall be called from the CameraManager thread.
+ * When called from a pipeline handler thread, the cameraAdded signal is
+ * emitted asynchronously from the CameraManager thread.
+ *
+ * \context This function shall be called from the CameraManager thread or
+ * from a pipeline handler thread.
  */
 void CameraManager::addCamera(std::shared_ptr<Camera> camera,
 			      const std::vector<dev_t> &devnums)
 {
 	Private *const d = _d();
 
-	ASSERT(Thread::current() == d);
-
 	d->addCamera(camera, devnums);
-	cameraAdded.emit(camera);
+
+	if (Thread::current() == d)
+		cameraAdded.emit(camera);
+	else
+		d->notifier_->invokeMethod(&CameraNotifier::added,
+					   ConnectionTypeQueued, camera);
 }
 
 /**
@@ -453,16 +636,106 @@ void CameraManager::addCamera(std::shared_ptr<Camera> camera,
  * camera manager. Unregistered cameras won't be reported anymore by the
  * cameras() and get() calls, but references may still exist in applications.
  *
- * \context This function shall be called from the CameraManager thread.
+ * When called from a pipeline handler thread, the cameraRemoved signal is
+ * emitted asynchronously from the CameraManager thread.
+ *
+ * \context This function shall be called from the CameraManager thread or
+ * from a pipeline handler thread.
  */
 void CameraManager::removeCamera(std::shared_ptr<Camera> camera)
 {
 	Private *const d = _d();
 
-	ASSERT(Thread::current() == d);
-
 	d->removeCamera(camera.get());
-	cameraRemoved.emit(camera);
+
+	if (Thread::current() == d)
+		cameraRemoved.emit(camera);
+	else
+		d->notifier_->invokeMethod(&CameraNotifier::removed,
+					   ConnectionTypeQueued, camera);
+}
+
+/**
+ * \brief Start a group of cameras with minimal phase offset
+ * \param[in] cameras The cameras to start
+ * \param[in] controls Controls to be applied before starting the cameras
+ *
+ * Applications that capture from multiple cameras together, such as stereo
+ * pairs, need the cameras to start streaming as close as possible to each
+ * other. Starting each camera with Camera::start() separately incurs the
+ * cost of resource allocation and a thread switch between the cameras.
+ *
+ * This function first prepares all the \a cameras with Camera::prepare(),
+ * without starting them. It then starts all the cameras back to back from the
+ * camera manager thread, in which the pipeline handlers run, so that only the
+ * stream-on operations separate the start of two cameras. The same \a controls
+ * are applied to all cameras.
+ *
+ * If any camera fails to prepare or start, all the cameras in the group are
+ * stopped and returned to the Configured state.
+ *
+ * Completed requests from the cameras can be paired based on their timestamps
+ * with a FrameSynchronizer.
+ *
+ * \context The \a cameras shall all be in the Configured state as defined in
+ * \ref camera_operation. This function shall be synchronized by the caller
+ * with other functions that affect the state of the cameras.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The group is empty or contains the same camera twice
+ * \retval -ENODEV A camera has been disconnected from the system
+ * \retval -EACCES A camera is not in a state where it can be started
+ */
+int CameraManager::startCameras(const std::vector<std::shared_ptr<Camera>> &cameras,
+				const ControlList *controls)
+{
+	Private *const d = _d();
+
+	if (cameras.empty())
+		return -EINVAL;
+
+	for (auto it = cameras.begin(); it != cameras.end(); ++it) {
+		if (!*it || std::find(cameras.begin(), it, *it) != it) {
+			LOG(Camera, Error) << "Invalid camera group";
+			return -EINVAL;
+		}
+	}
+
+	for (auto it = cameras.begin(); it != cameras.end(); ++it) {
+		int ret = (*it)->prepare(controls);
+		if (ret >= 0)
+			continue;
+
+		for (auto prev = cameras.begin(); prev != it; ++prev)
+			(*prev)->stop();
+
+		return ret;
+	}
+
+	return d->groupStarter_.invokeMethod(&CameraGroupStarter::start,
+					     ConnectionTypeBlocking, cameras,
+					     controls);
+}
+
+/**
+ * \brief Retrieve the memory held by libcamera
+ *
+ * This function reports the memory held by libcamera at the time of the call,
+ * broken down by camera, stream and category. The frame buffers allocated for
+ * applications with a FrameBufferAllocator are reported along with the buffers
+ * allocated by pipeline handlers for their internal use and for the IPA
+ * modules. Memory allocated by IPA modules themselves isn't reported.
+ *
+ * Applications can use the memory usage to enforce a memory budget, or compare
+ * the memory usage across reconfigurations of a camera to detect leaks.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The memory usage entries, one per camera, stream and category
+ */
+std::vector<MemoryUsage> CameraManager::memoryUsage() const
+{
+	return MemoryTracker::instance()->usage();
 }
 
 /**
@@ -15,15 +15,20 @@
 #include <math.h>
 #include <regex>
 #include <string.h>
+#include <thread>
 
 #include <libcamera/property_ids.h>
 
+#include <libcamera/base/thread_pool.h>
 #include <libcamera/base/utils.h>
 
 #include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/byte_stream_buffer.h"
 #include "libcamera/internal/camera_sensor_properties.h"
+#include "libcamera/internal/device_cache.h"
 #include "libcamera/internal/formats.h"
 #include "libcamera/internal/sysfs.h"
+#include "libcamera/internal/tracepoints.h"
 
 /**
  * \file camera_sensor.h
@@ -55,7 +60,7 @@ LOG_DEFINE_CATEGORY(CameraSensor)
  */
 CameraSensor::CameraSensor(const MediaEntity *entity)
 	: entity_(entity), pad_(UINT_MAX), bayerFormat_(nullptr),
-	  properties_(properties::properties)
+	  sensorDelays_{}, blackLevel_(0), properties_(properties::properties)
 {
 }
 
@@ -75,6 +80,66 @@ CameraSensor::~CameraSensor()
  * \return 0 on success or a negative error code otherwise
  */
 int CameraSensor::init()
+{
+	int ret = open();
+	if (ret)
+		return ret;
+
+	return probe();
+}
+
+/**
+ * \brief Initialize multiple camera sensor instances concurrently
+ * \param[in] sensors The camera sensors to initialize
+ *
+ * This function initializes all \a sensors as init() does. Probing the
+ * capabilities of a sensor requires many ioctl calls, which serializes camera
+ * registration on systems with multiple sensors. The sensor subdevices are thus
+ * opened in the calling thread, and the sensors are then probed in parallel in
+ * a thread pool. This function returns when all sensors have been initialized.
+ *
+ * The same rules as for init() apply, the function shall be called once and
+ * only once for each sensor, and \a sensors shall not contain duplicates.
+ *
+ * \return The result of the initialization of each sensor, stored in the same
+ * order as \a sensors, with 0 on success or a negative error code otherwise
+ */
+std::vector<int> CameraSensor::init(const std::vector<CameraSensor *> &sensors)
+{
+	std::vector<int> results(sensors.size());
+
+	/*
+	 * The subdevices are opened in the calling thread, as opening them
+	 * creates objects bound to the current thread.
+	 */
+	std::vector<unsigned int> opened;
+	for (unsigned int i = 0; i < sensors.size(); ++i) {
+		results[i] = sensors[i]->open();
+		if (!results[i])
+			opened.push_back(i);
+	}
+
+	if (opened.size() <= 1) {
+		for (unsigned int i : opened)
+			results[i] = sensors[i]->probe();
+		return results;
+	}
+
+	unsigned int size = std::min<unsigned int>(opened.size(),
+						   std::max(std::thread::hardware_concurrency(), 1U));
+	ThreadPool pool(size, "SensorProbe");
+
+	for (unsigned int i : opened)
+		pool.run([&sensors, &results, i]() {
+			results[i] = sensors[i]->probe();
+		});
+
+	pool.wait();
+
+	return results;
+}
+
+int CameraSensor::open()
 {
 	for (const MediaPad *pad : entity_->pads()) {
 		if (pad->flags() & MEDIA_PAD_FL_SOURCE) {
@@ -107,8 +172,20 @@ int CameraSensor::init()
 	if (ret < 0)
 		return ret;
 
+	return 0;
+}
+
+/*
+ * Probe the sensor capabilities and properties. This function only accesses
+ * state private to the sensor and thread-safe global resources, and may thus
+ * be called concurrently for different sensors.
+ */
+int CameraSensor::probe()
+{
+	int ret;
+
 	/* Enumerate, sort and cache media bus codes and sizes. */
-	formats_ = subdev_->formats(pad_);
+	formats_ = enumerateFormats();
 	if (formats_.empty()) {
 		LOG(CameraSensor, Error) << "No image format found";
 		return -EINVAL;
@@ -164,6 +241,74 @@ int CameraSensor::init()
 	return 0;
 }
 
+/*
+ * Enumerating the media bus codes and sizes supported by the sensor takes one
+ * ioctl call per code and size. As they only depend on the sensor driver, store
+ * them in the device cache, keyed by the kernel release and the sensor entity
+ * name, which includes the sensor bus address for I2C sensors.
+ */
+V4L2Subdevice::Formats CameraSensor::enumerateFormats()
+{
+	DeviceCache *cache = DeviceCache::instance();
+	if (!cache->enabled())
+		return subdev_->formats(pad_);
+
+	std::string key = "sensor:" + DeviceCache::kernelRelease() + ":" +
+			  entity_->device()->driver() + ":" + entity_->name() +
+			  ":" + std::to_string(pad_);
+	std::vector<uint8_t> data;
+
+	if (cache->lookup(key, &data)) {
+		ByteStreamBuffer buffer(static_cast<const uint8_t *>(data.data()),
+					data.size());
+		V4L2Subdevice::Formats formats;
+		uint32_t numCodes = 0;
+
+		buffer.read(&numCodes);
+		for (uint32_t i = 0; i < numCodes && !buffer.overflow(); ++i) {
+			uint32_t code = 0;
+			uint32_t numRanges = 0;
+
+			buffer.read(&code);
+			buffer.read(&numRanges);
+
+			const SizeRange *ranges = buffer.read<SizeRange>(numRanges);
+			if (!ranges)
+				break;
+
+			formats[code] = { ranges, ranges + numRanges };
+		}
+
+		if (!buffer.overflow() && !formats.empty() &&
+		    buffer.offset() == data.size()) {
+			LOG(CameraSensor, Debug)
+				<< "Using cached formats for " << entity_->name();
+			return formats;
+		}
+	}
+
+	V4L2Subdevice::Formats formats = subdev_->formats(pad_);
+	if (formats.empty())
+		return formats;
+
+	data.clear();
+	auto append = [&data](const auto &value, size_t count = 1) {
+		const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&value);
+		data.insert(data.end(), ptr, ptr + count * sizeof(value));
+	};
+
+	append(static_cast<uint32_t>(formats.size()));
+	for (const auto &[code, ranges] : formats) {
+		append(static_cast<uint32_t>(code));
+		append(static_cast<uint32_t>(ranges.size()));
+		append(ranges[0], ranges.size());
+	}
+
+	cache->store(key, std::move(data));
+
+	return formats;
+}
+
 int CameraSensor::validateSensorDriver()
 {
 	int err = 0;
@@ -300,6 +445,19 @@ void CameraSensor::initVimcDefaultProperties()
 
 void CameraSensor::initStaticProperties()
 {
+	/*
+	 * Default to delay values that are correct for many sensors, as used
+	 * by the Raspberry Pi IPA.
+	 */
+	static constexpr CameraSensorProperties::SensorDelays defaultDelays = {
+		.exposureDelay = 2,
+		.gainDelay = 1,
+		.vblankDelay = 2,
+		.hblankDelay = 2,
+	};
+
+	sensorDelays_ = defaultDelays;
+
 	const CameraSensorProperties *props = CameraSensorProperties::get(model_);
 	if (!props)
 		return;
@@ -307,6 +465,15 @@ void CameraSensor::initStaticProperties()
 	/* Register the properties retrieved from the sensor database. */
 	properties_.set(properties::UnitCellSize, props->unitCellSize);
 
+	if (props->sensorDelays.exposureDelay || props->sensorDelays.gainDelay ||
+	    props->sensorDelays.vblankDelay || props->sensorDelays.hblankDelay)
+		sensorDelays_ = props->sensorDelays;
+	else
+		LOG(CameraSensor, Debug)
+			<< "No sensor delays for '" << model() << "', using defaults";
+
+	blackLevel_ = props->blackLevel;
+
 	initTestPatternModes(props->testPatternModes);
 }
 
@@ -678,6 +845,8 @@ ControlList CameraSensor::getControls(const std::vector<uint32_t> &ids)
  */
 int CameraSensor::setControls(ControlList *ctrls)
 {
+	LIBCAMERA_TRACEPOINT(camera_sensor_set_controls, this, ctrls);
+
 	return subdev_->setControls(ctrls);
 }
 
@@ -694,6 +863,32 @@ int CameraSensor::setControls(ControlList *ctrls)
  * \return The list of camera sensor properties
  */
 
+/**
+ * \fn CameraSensor::sensorDelays()
+ * \brief Retrieve the sensor control delays
+ *
+ * The delays are retrieved from the sensor properties database. Sensors not
+ * listed in the database, or for which delays are unknown, report default
+ * values that are correct for many sensors.
+ *
+ * The delays are meant to configure the DelayedControls used by pipeline
+ * handlers to apply sensor controls. Combined with the line length and pixel
+ * rate reported by sensorInfo(), they allow predicting the first frame that a
+ * set of controls will apply to, and its exposure timing.
+ *
+ * \return The sensor control delays
+ */
+
+/**
+ * \fn CameraSensor::blackLevel()
+ * \brief Retrieve the sensor black level
+ *
+ * The black level is retrieved from the sensor properties database, and is
+ * expressed in the 16-bit pixel range (as if pixels ranged from 0 to 65535).
+ *
+ * \return The sensor black level, or 0 if unknown
+ */
+
 /**
  * \brief Assemble and return the camera sensor info
  * \param[out] info The camera sensor info
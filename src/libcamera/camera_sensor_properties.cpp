@@ -41,6 +41,34 @@ LOG_DEFINE_CATEGORY(CameraSensorProperties)
  * \brief Map that associates the indexes of the sensor test pattern modes as
  * returned by V4L2_CID_TEST_PATTERN with the corresponding TestPattern
  * control value
+ *
+ * \var CameraSensorProperties::sensorDelays
+ * \brief The number of frames between the time a control is written to the
+ * sensor and the first frame it applies to, for each control subject to delays
+ *
+ * All delays are set to 0 when they are unknown for a sensor.
+ *
+ * \var CameraSensorProperties::blackLevel
+ * \brief The black level of the sensor, expressed in the 16-bit pixel range
+ * (as if pixels ranged from 0 to 65535), or 0 if unknown
+ */
+
+/**
+ * \struct CameraSensorProperties::SensorDelays
+ * \brief Sensor control delays, in frames
+ *
+ * \var CameraSensorProperties::SensorDelays::exposureDelay
+ * \brief Number of frames between the exposure time being set and applied
+ *
+ * \var CameraSensorProperties::SensorDelays::gainDelay
+ * \brief Number of frames between the analogue gain being set and applied
+ *
+ * \var CameraSensorProperties::SensorDelays::vblankDelay
+ * \brief Number of frames between the vertical blanking being set and applied
+ *
+ * \var CameraSensorProperties::SensorDelays::hblankDelay
+ * \brief Number of frames between the horizontal blanking being set and
+ * applied
  */
 
 /**
@@ -61,6 +89,13 @@ const CameraSensorProperties *CameraSensorProperties::get(const std::string &sen
 				{ 3, controls::draft::TestPatternModeColorBarsFadeToGray },
 				{ 4, controls::draft::TestPatternModePn9 },
 			},
+			.sensorDelays = {
+				.exposureDelay = 2,
+				.gainDelay = 1,
+				.vblankDelay = 2,
+				.hblankDelay = 2,
+			},
+			.blackLevel = 4096,
 		} },
 		{ "imx258", {
 			.unitCellSize = { 1120, 1120 },
@@ -71,10 +106,19 @@ const CameraSensorProperties *CameraSensorProperties::get(const std::string &sen
 				{ 3, controls::draft::TestPatternModeColorBarsFadeToGray },
 				{ 4, controls::draft::TestPatternModePn9 },
 			},
+			.sensorDelays = {},
+			.blackLevel = 0,
 		} },
 		{ "ov5647", {
 			.unitCellSize = { 1400, 1400 },
 			.testPatternModes = {},
+			.sensorDelays = {
+				.exposureDelay = 2,
+				.gainDelay = 2,
+				.vblankDelay = 2,
+				.hblankDelay = 2,
+			},
+			.blackLevel = 1024,
 		} },
 		{ "ov5670", {
 			.unitCellSize = { 1120, 1120 },
@@ -82,6 +126,8 @@ const CameraSensorProperties *CameraSensorProperties::get(const std::string &sen
 				{ 0, controls::draft::TestPatternModeOff },
 				{ 1, controls::draft::TestPatternModeColorBars },
 			},
+			.sensorDelays = {},
+			.blackLevel = 0,
 		} },
 		{ "ov5693", {
 			.unitCellSize = { 1400, 1400 },
@@ -94,6 +140,8 @@ const CameraSensorProperties *CameraSensorProperties::get(const std::string &sen
 				 * Rolling Bar".
 				 */
 			},
+			.sensorDelays = {},
+			.blackLevel = 0,
 		} },
 		{ "ov8865", {
 			.unitCellSize = { 1400, 1400 },
@@ -108,6 +156,8 @@ const CameraSensorProperties *CameraSensorProperties::get(const std::string &sen
 				 * 5: "Color squares with rolling bar"
 				 */
 			},
+			.sensorDelays = {},
+			.blackLevel = 0,
 		} },
 		{ "ov13858", {
 			.unitCellSize = { 1120, 1120 },
@@ -115,6 +165,8 @@ const CameraSensorProperties *CameraSensorProperties::get(const std::string &sen
 				{ 0, controls::draft::TestPatternModeOff },
 				{ 1, controls::draft::TestPatternModeColorBars },
 			},
+			.sensorDelays = {},
+			.blackLevel = 0,
 		} },
 	};
 
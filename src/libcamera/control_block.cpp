@@ -0,0 +1,192 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * control_block.cpp - Fixed-slot storage for libcamera controls
+ */
+
+#include "libcamera/internal/control_block.h"
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file control_block.h
+ * \brief Fixed-slot storage for libcamera controls
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Controls)
+
+/**
+ * \class ControlBlock
+ * \brief Store libcamera control values in slots indexed by control ID
+ *
+ * The ControlList class stores controls of any object, including V4L2
+ * controls, and validates them against the object they refer to. Accessing a
+ * control requires a search in the list and, when setting a control, a call to
+ * the validator. This cost adds up in pipeline handlers and IPA modules that
+ * set or read tens of controls for every frame.
+ *
+ * The libcamera controls generated from control_ids.yaml are numbered densely
+ * from 1 to controls::MaxControlId. The ControlBlock stores them in a
+ * fixed-size array indexed by control ID, along with a bitmask of the controls
+ * present in the block. Accessing a control is a direct array access, and the
+ * storage is allocated once with the block. A ControlBlock is meant to be kept
+ * across frames and cleared with clear(), which only resets the bitmask.
+ *
+ * The get() and set() functions mirror the ControlList API, making it
+ * possible to replace a per-frame ControlList with a ControlBlock. Control
+ * values are not validated; the caller is responsible for setting only the
+ * controls supported by the camera. Conversion to and from ControlList is
+ * performed at API boundaries with merge() and toControlList().
+ */
+
+/**
+ * \var ControlBlock::NumSlots
+ * \brief The number of control slots in the block
+ */
+
+/**
+ * \fn ControlBlock::empty()
+ * \brief Identify if the block is empty
+ * \return True if the block does not contain any control, false otherwise
+ */
+
+/**
+ * \fn ControlBlock::size()
+ * \brief Retrieve the number of controls in the block
+ * \return The number of controls stored in the block
+ */
+
+/**
+ * \fn ControlBlock::clear()
+ * \brief Remove all controls from the block
+ *
+ * The storage of the control values is retained for reuse.
+ */
+
+/**
+ * \fn ControlBlock::contains(const ControlId &id) const
+ * \brief Check if the block contains a control with the specified \a id
+ * \param[in] id The control ID
+ * \return True if the block contains a matching control, false otherwise
+ */
+
+/**
+ * \fn ControlBlock::contains(unsigned int id) const
+ * \brief Check if the block contains a control with the specified \a id
+ * \param[in] id The control numerical ID
+ * \return True if the block contains a matching control, false otherwise
+ */
+
+/**
+ * \fn template<typename T> T ControlBlock::get(const Control<T> &ctrl) const
+ * \brief Get the value of control \a ctrl
+ * \param[in] ctrl The control
+ *
+ * The control value type shall match the type T, otherwise the behaviour is
+ * undefined.
+ *
+ * \return The control value, or a default-constructed value if the control is
+ * not present in the block
+ */
+
+/**
+ * \fn template<typename T, typename V> void ControlBlock::set(const Control<T> &ctrl, const V &value)
+ * \brief Set the control \a ctrl value to \a value
+ * \param[in] ctrl The control
+ * \param[in] value The control value
+ *
+ * The value is stored in the slot of \a ctrl, replacing any previous value.
+ * Controls that are not libcamera controls are ignored.
+ */
+
+/**
+ * \fn template<typename T, typename V> void ControlBlock::set(const Control<T> &ctrl, const std::initializer_list<V> &value)
+ * \copydoc ControlBlock::set(const Control<T> &ctrl, const V &value)
+ */
+
+/**
+ * \brief Get the value of control \a id
+ * \param[in] id The control numerical ID
+ *
+ * \return The control value, or an empty value if the control is not present
+ * in the block
+ */
+const ControlValue &ControlBlock::get(unsigned int id) const
+{
+	static const ControlValue zero;
+
+	const ControlValue *val = find(id);
+	if (!val)
+		return zero;
+
+	return *val;
+}
+
+/**
+ * \brief Set the value of control \a id to \a value
+ * \param[in] id The control numerical ID
+ * \param[in] value The control value
+ */
+void ControlBlock::set(unsigned int id, const ControlValue &value)
+{
+	ControlValue *val = slot(id);
+	if (!val)
+		return;
+
+	*val = value;
+}
+
+/**
+ * \brief Merge the controls of \a list into the block
+ * \param[in] list The libcamera controls list
+ *
+ * Copy all the controls of \a list to the block, overwriting the values of
+ * controls already present in the block.
+ */
+void ControlBlock::merge(const ControlList &list)
+{
+	for (const auto &[id, value] : list)
+		set(id, value);
+}
+
+/**
+ * \brief Copy the controls of the block to a ControlList
+ * \param[out] list The libcamera controls list
+ *
+ * Copy all the controls of the block to \a list, in ascending ID order,
+ * overwriting the values of controls already present in the list. Reusing the
+ * same \a list for every frame avoids memory allocations.
+ */
+void ControlBlock::toControlList(ControlList &list) const
+{
+	for (unsigned int id = 1; id < NumSlots; ++id) {
+		if (present_.test(id))
+			list.set(id, values_[id]);
+	}
+}
+
+const ControlValue *ControlBlock::find(unsigned int id) const
+{
+	if (!contains(id))
+		return nullptr;
+
+	return &values_[id];
+}
+
+ControlValue *ControlBlock::slot(unsigned int id)
+{
+	if (id >= NumSlots) {
+		LOG(Controls, Error)
+			<< "Control " << utils::hex(id) << " not supported";
+		return nullptr;
+	}
+
+	present_.set(id);
+	return &values_[id];
+}
+
+} /* namespace libcamera */
@@ -8,7 +8,9 @@
 #include "libcamera/internal/control_serializer.h"
 
 #include <algorithm>
+#include <errno.h>
 #include <memory>
+#include <string.h>
 #include <vector>
 
 #include <libcamera/base/log.h>
@@ -69,16 +71,47 @@ LOG_DEFINE_CATEGORY(Serializer)
  * that constraint results in serialization or deserialization failure of the
  * ControlList.
  *
+ * ControlInfoMap instances are often serialized multiple times with identical
+ * contents, for instance when an IPA is reconfigured with the controls of the
+ * same sensor. The serializer keeps a copy of the ControlInfoMap instances it
+ * has serialized, and serializes an identical ControlInfoMap as a reference
+ * to the handle of the previous one, without any entry. The deserializer then
+ * returns the ControlInfoMap it has cached for that handle, avoiding the
+ * reconstruction of the ControlInfoMap and of its ControlId instances.
+ *
+ * The number of cached ControlInfoMap instances is bounded. When the cache is
+ * full, serializing a new ControlInfoMap evicts the least recently serialized
+ * or referenced one, and the packet of the new map instructs the deserializer
+ * to evict it too. This invalidates the ControlInfoMap and ControlList
+ * instances deserialized from the evicted map, which is only expected for maps
+ * that are not in use anymore, such as the controls of a previous sensor mode.
+ *
  * The serializer can be reset() to clear its internal state. This may be
- * performed when reconfiguring an IPA to avoid constant growth of the internal
- * state, especially if the contents of the ControlInfoMap instances change at
- * that time. A reset of the serializer invalidates all ControlList and
- * ControlInfoMap that have been previously deserialized. The caller shall thus
- * proceed with care to avoid stale references.
+ * performed when the peer serializer is reset, to avoid constant growth of
+ * the internal state. A reset of the serializer invalidates all ControlList
+ * and ControlInfoMap that have been previously deserialized. The caller shall
+ * thus proceed with care to avoid stale references.
+ *
+ * Control lists exchanged with an IPA for every frame are often nearly
+ * identical from frame to frame. To reduce the size of the serialized data,
+ * delta encoding can be enabled with setDeltaEncoding(). The serializer then
+ * keeps a copy of the last control list serialized for each ControlInfoMap
+ * handle, and only serializes the controls that have changed since that list.
+ * The deserializer keeps a copy of the last control list deserialized for each
+ * handle, and applies the delta to it to recreate the full list. Delta
+ * encoding requires the serialized lists to be deserialized in the same order
+ * by a single deserializer, as is the case for an IPC channel. When a list may
+ * have been lost on the way, restartDeltaEncoding() resynchronizes the
+ * serializers. Deserializing delta-encoded lists is always supported.
+ *
+ * Deserialization functions return an empty object on failure, which can't be
+ * told apart from a valid empty ControlList. Users that need to detect
+ * failures, such as a delta-encoded list whose base is missing, shall check the
+ * error state with takeError() after deserialization.
  */
 
 ControlSerializer::ControlSerializer()
-	: serial_(0)
+	: serial_(0), infoMapUses_(0), error_(0), deltaEncoding_(false)
 {
 }
 
@@ -91,13 +124,95 @@ ControlSerializer::ControlSerializer()
 void ControlSerializer::reset()
 {
 	serial_ = 0;
+	infoMapUses_ = 0;
+	error_ = 0;
 
 	infoMapHandles_.clear();
 	infoMaps_.clear();
+	serializedInfoMaps_.clear();
 	controlIds_.clear();
 	controlIdMaps_.clear();
+
+	/*
+	 * Restart delta encoding from full lists. The state used to decode
+	 * delta-encoded lists is kept, as the peer serializer may not be reset
+	 * at the same time.
+	 */
+	serializedLists_.clear();
+}
+
+/**
+ * \brief Enable or disable delta encoding of control lists
+ * \param[in] enable True to enable delta encoding, false to disable it
+ *
+ * When delta encoding is enabled, control lists are serialized relative to
+ * the previous list serialized with the same ControlInfoMap handle, if this
+ * results in a smaller packet. The deserializer shall deserialize all the
+ * lists in the order in which they have been serialized.
+ */
+void ControlSerializer::setDeltaEncoding(bool enable)
+{
+	deltaEncoding_ = enable;
+	serializedLists_.clear();
+}
+
+/**
+ * \fn ControlSerializer::deltaEncoding()
+ * \brief Retrieve the delta encoding state
+ * \return True if delta encoding is enabled, false otherwise
+ */
+
+/**
+ * \brief Restart delta encoding from full control lists
+ *
+ * Delta encoding assumes that every serialized control list reaches the
+ * deserializer. When a message carrying serialized control lists fails to be
+ * sent, or the peer reports an error, the deserializer may lack the base of the
+ * next deltas, and would reject all of them. This function drops the state
+ * used to compute the deltas, such that the next control list serialized for
+ * each ControlInfoMap handle is sent in full. The deserializer accepts full
+ * lists regardless of its state and resynchronizes on them.
+ *
+ * Users that enable delta encoding shall call this function when a message
+ * fails to reach its destination, or when the destination reports an error.
+ */
+void ControlSerializer::restartDeltaEncoding()
+{
+	serializedLists_.clear();
 }
 
+namespace {
+
+enum ipa_controls_id_map_type idMapTypeOf(const ControlIdMap *idmap)
+{
+	if (idmap == &controls::controls)
+		return IPA_CONTROL_ID_MAP_CONTROLS;
+	else if (idmap == &properties::properties)
+		return IPA_CONTROL_ID_MAP_PROPERTIES;
+	else
+		return IPA_CONTROL_ID_MAP_V4L2;
+}
+
+/*
+ * Only the minimum and maximum of the ControlInfo are serialized, which are
+ * the fields compared by ControlInfo::operator==().
+ */
+bool isIdentical(const ControlInfoMap &a, const ControlInfoMap &b)
+{
+	if (&a.idmap() != &b.idmap() || a.size() != b.size())
+		return false;
+
+	for (const auto &[id, info] : a) {
+		auto iter = b.find(id);
+		if (iter == b.end() || iter->second != info)
+			return false;
+	}
+
+	return true;
+}
+
+} /* namespace */
+
 size_t ControlSerializer::binarySize(const ControlValue &value)
 {
 	return value.data().size_bytes();
@@ -171,15 +286,38 @@ void ControlSerializer::store(const ControlInfo &info, ByteStreamBuffer &buffer)
  * The serializer stores a reference to the \a infoMap internally. The caller
  * shall ensure that \a infoMap stays valid until the serializer is reset().
  *
+ * If a ControlInfoMap identical to \a infoMap has already been serialized,
+ * only a packet header that references its handle is serialized.
+ *
  * \return 0 on success, a negative error code otherwise
  * \retval -ENOSPC Not enough space is available in the buffer
  */
 int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 				 ByteStreamBuffer &buffer)
 {
-	if (isCached(infoMap)) {
+	enum ipa_controls_id_map_type idMapType = idMapTypeOf(&infoMap.idmap());
+
+	unsigned int handle = findSerialized(infoMap);
+	if (handle) {
 		LOG(Serializer, Debug)
-			<< "Skipping already serialized ControlInfoMap";
+			<< "Referencing already serialized ControlInfoMap";
+
+		struct ipa_controls_header hdr;
+		hdr.version = IPA_CONTROLS_FORMAT_VERSION;
+		hdr.handle = handle;
+		hdr.entries = 0;
+		hdr.size = sizeof(hdr);
+		hdr.data_offset = sizeof(hdr);
+		hdr.id_map_type = idMapType;
+		hdr.sequence = 0;
+		hdr.base_sequence = handle;
+
+		buffer.write(&hdr);
+		if (buffer.overflow())
+			return -ENOSPC;
+
+		serializedInfoMaps_[handle].lastUse = ++infoMapUses_;
+		setHandle(&infoMap, handle);
 		return 0;
 	}
 
@@ -190,14 +328,13 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 	for (const auto &ctrl : infoMap)
 		valuesSize += binarySize(ctrl.second);
 
-	const ControlIdMap *idmap = &infoMap.idmap();
-	enum ipa_controls_id_map_type idMapType;
-	if (idmap == &controls::controls)
-		idMapType = IPA_CONTROL_ID_MAP_CONTROLS;
-	else if (idmap == &properties::properties)
-		idMapType = IPA_CONTROL_ID_MAP_PROPERTIES;
-	else
-		idMapType = IPA_CONTROL_ID_MAP_V4L2;
+	/*
+	 * If the cache is full, select a map to evict, and record its handle in
+	 * the sequence field for the deserializer to evict it too.
+	 */
+	unsigned int evicted = 0;
+	if (serializedInfoMaps_.size() >= kMaxInfoMaps)
+		evicted = evictionCandidate();
 
 	/* Prepare the packet header, assign a handle to the ControlInfoMap. */
 	struct ipa_controls_header hdr;
@@ -207,6 +344,8 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
 	hdr.data_offset = sizeof(hdr) + entriesSize;
 	hdr.id_map_type = idMapType;
+	hdr.sequence = evicted;
+	hdr.base_sequence = 0;
 
 	buffer.write(&hdr);
 
@@ -233,15 +372,115 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 	if (buffer.overflow())
 		return -ENOSPC;
 
+	if (evicted)
+		evictSerialized(evicted);
+
 	/*
 	 * Store the map to handle association, to be used to serialize and
 	 * deserialize control lists.
 	 */
-	infoMapHandles_[&infoMap] = hdr.handle;
+	setHandle(&infoMap, hdr.handle);
+	serializedInfoMaps_.emplace(hdr.handle,
+				    SerializedInfoMap{ infoMap, ++infoMapUses_ });
+
+	return 0;
+}
+
+/*
+ * Find the handle of a serialized ControlInfoMap identical to infoMap. The
+ * ControlInfoMap last serialized from the same instance is checked first, as
+ * it is the most likely match.
+ */
+unsigned int ControlSerializer::findSerialized(const ControlInfoMap &infoMap) const
+{
+	auto handle = infoMapHandles_.find(&infoMap);
+	if (handle != infoMapHandles_.end()) {
+		auto iter = serializedInfoMaps_.find(handle->second);
+		if (iter != serializedInfoMaps_.end() &&
+		    isIdentical(infoMap, iter->second.infoMap))
+			return iter->first;
+	}
+
+	for (const auto &[serial, cached] : serializedInfoMaps_) {
+		if (isIdentical(infoMap, cached.infoMap))
+			return serial;
+	}
 
 	return 0;
 }
 
+/*
+ * Associate infoMap with a serialized handle. Other instances associated with
+ * the same handle are forgotten, as they may have been destroyed since they
+ * were serialized. The map deserialized with the same handle from the peer, if
+ * any, is kept.
+ */
+void ControlSerializer::setHandle(const ControlInfoMap *infoMap, unsigned int handle)
+{
+	auto deserialized = infoMaps_.find(handle);
+	const ControlInfoMap *peerMap = deserialized != infoMaps_.end()
+				      ? &deserialized->second : nullptr;
+
+	for (auto iter = infoMapHandles_.begin(); iter != infoMapHandles_.end();) {
+		if (iter->second == handle && iter->first != infoMap &&
+		    iter->first != peerMap)
+			iter = infoMapHandles_.erase(iter);
+		else
+			++iter;
+	}
+
+	infoMapHandles_[infoMap] = handle;
+}
+
+/* Select the least recently used serialized ControlInfoMap. */
+unsigned int ControlSerializer::evictionCandidate() const
+{
+	auto lru = std::min_element(serializedInfoMaps_.begin(),
+				    serializedInfoMaps_.end(),
+				    [](const auto &a, const auto &b) {
+					    return a.second.lastUse < b.second.lastUse;
+				    });
+
+	return lru != serializedInfoMaps_.end() ? lru->first : 0;
+}
+
+void ControlSerializer::evictSerialized(unsigned int handle)
+{
+	LOG(Serializer, Debug) << "Evicting serialized ControlInfoMap " << handle;
+
+	auto deserialized = infoMaps_.find(handle);
+	const ControlInfoMap *peerMap = deserialized != infoMaps_.end()
+				      ? &deserialized->second : nullptr;
+
+	for (auto iter = infoMapHandles_.begin(); iter != infoMapHandles_.end();) {
+		if (iter->second == handle && iter->first != peerMap)
+			iter = infoMapHandles_.erase(iter);
+		else
+			++iter;
+	}
+
+	serializedInfoMaps_.erase(handle);
+	serializedLists_.erase(handle);
+}
+
+void ControlSerializer::evictDeserialized(unsigned int handle)
+{
+	auto iter = infoMaps_.find(handle);
+	if (iter == infoMaps_.end())
+		return;
+
+	LOG(Serializer, Debug) << "Evicting deserialized ControlInfoMap " << handle;
+
+	auto entry = infoMapHandles_.find(&iter->second);
+	if (entry != infoMapHandles_.end() && entry->second == handle)
+		infoMapHandles_.erase(entry);
+
+	infoMaps_.erase(iter);
+	controlIds_.erase(handle);
+	controlIdMaps_.erase(handle);
+	deserializedLists_.erase(handle);
+}
+
 /**
  * \brief Serialize a ControlList in a buffer
  * \param[in] list The control list to serialize
@@ -250,12 +489,69 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
  * Serialize the \a list into the \a buffer using the serialization format
  * defined by the IPA context interface in ipa_controls.h.
  *
+ * When delta encoding is enabled, the serialized data may be smaller than the
+ * size reported by binarySize(). The number of bytes written to the \a buffer
+ * is reported by ByteStreamBuffer::offset().
+ *
  * \return 0 on success, a negative error code otherwise
  * \retval -ENOENT The ControlList is related to an unknown ControlInfoMap
  * \retval -ENOSPC Not enough space is available in the buffer
  */
 int ControlSerializer::serialize(const ControlList &list,
 				 ByteStreamBuffer &buffer)
+{
+	ListState *state;
+	uint32_t sequence;
+
+	scratch_.clear();
+	int ret = encode(list, scratch_, &state, &sequence);
+	if (ret)
+		return ret;
+
+	buffer.write(Span<const uint8_t>(scratch_));
+	if (buffer.overflow())
+		return -ENOSPC;
+
+	commit(list, state, sequence);
+
+	return 0;
+}
+
+/**
+ * \brief Serialize a ControlList at the end of a vector
+ * \param[in] list The control list to serialize
+ * \param[inout] data The vector to append the serialized ControlList to
+ *
+ * Serialize the \a list using the serialization format defined by the IPA
+ * context interface in ipa_controls.h, and append it to \a data. Unlike
+ * serialize(const ControlList &, ByteStreamBuffer &), this function doesn't
+ * require the size of the serialized data to be computed beforehand with
+ * binarySize(), and serializes the list in a single pass. If \a data has
+ * enough capacity, no memory is allocated.
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOENT The ControlList is related to an unknown ControlInfoMap
+ */
+int ControlSerializer::serialize(const ControlList &list,
+				 std::vector<uint8_t> &data)
+{
+	ListState *state;
+	uint32_t sequence;
+
+	size_t offset = data.size();
+	int ret = encode(list, data, &state, &sequence);
+	if (ret) {
+		data.resize(offset);
+		return ret;
+	}
+
+	commit(list, state, sequence);
+
+	return 0;
+}
+
+int ControlSerializer::encode(const ControlList &list, std::vector<uint8_t> &data,
+			      ListState **state, uint32_t *sequence)
 {
 	/*
 	 * Find the ControlInfoMap handle for the ControlList if it has one, or
@@ -264,57 +560,139 @@ int ControlSerializer::serialize(const ControlList &list,
 	unsigned int infoMapHandle;
 	if (list.infoMap()) {
 		auto iter = infoMapHandles_.find(list.infoMap());
-		if (iter == infoMapHandles_.end()) {
-			LOG(Serializer, Error)
-				<< "Can't serialize ControlList: unknown ControlInfoMap";
-			return -ENOENT;
+		if (iter != infoMapHandles_.end()) {
+			infoMapHandle = iter->second;
+		} else {
+			/*
+			 * The ControlInfoMap may have been forgotten in favour
+			 * of an identical instance, look it up by contents.
+			 */
+			infoMapHandle = findSerialized(*list.infoMap());
+			if (!infoMapHandle) {
+				LOG(Serializer, Error)
+					<< "Can't serialize ControlList: unknown ControlInfoMap";
+				return -ENOENT;
+			}
+
+			setHandle(list.infoMap(), infoMapHandle);
 		}
-
-		infoMapHandle = iter->second;
 	} else {
 		infoMapHandle = 0;
 	}
 
-	size_t entriesSize = list.size() * sizeof(struct ipa_control_value_entry);
-	size_t valuesSize = 0;
-	for (const auto &ctrl : list)
-		valuesSize += binarySize(ctrl.second);
+	/*
+	 * Compute the delta from the previous list serialized with the same
+	 * handle, and use it if it's smaller than the full list. Removed
+	 * controls are stored with no value.
+	 */
+	uint32_t baseSequence = 0;
+	*state = nullptr;
 
-	/* Prepare the packet header. */
-	struct ipa_controls_header hdr;
-	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
-	hdr.handle = infoMapHandle;
-	hdr.entries = list.size();
-	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
-	hdr.data_offset = sizeof(hdr) + entriesSize;
+	if (deltaEncoding_) {
+		*state = &serializedLists_[infoMapHandle];
 
-	buffer.write(&hdr);
+		if ((*state)->sequence) {
+			const ControlList &base = (*state)->list;
+			size_t valuesSize = 0;
+			size_t deltaValuesSize = 0;
 
-	ByteStreamBuffer entries = buffer.carveOut(entriesSize);
-	ByteStreamBuffer values = buffer.carveOut(valuesSize);
+			delta_.clear();
+
+			auto prev = base.begin();
+			for (const auto &ctrl : list) {
+				valuesSize += binarySize(ctrl.second);
+
+				for (; prev != base.end() && prev->first < ctrl.first; ++prev)
+					delta_.emplace_back(prev->first, nullptr);
+
+				if (prev != base.end() && prev->first == ctrl.first) {
+					bool changed = prev->second != ctrl.second;
+					++prev;
+					if (!changed)
+						continue;
+				}
+
+				delta_.emplace_back(ctrl.first, &ctrl.second);
+				deltaValuesSize += binarySize(ctrl.second);
+			}
+
+			for (; prev != base.end(); ++prev)
+				delta_.emplace_back(prev->first, nullptr);
+
+			if (delta_.size() * sizeof(struct ipa_control_value_entry) + deltaValuesSize <
+			    list.size() * sizeof(struct ipa_control_value_entry) + valuesSize)
+				baseSequence = (*state)->sequence;
+		}
+	}
+
+	*sequence = *state ? (*state)->sequence + 1 : 0;
+
+	/*
+	 * Reserve space for the header and entries, and append the values as
+	 * the entries are written. The header is written last, when the size
+	 * of the values is known.
+	 */
+	unsigned int numEntries = baseSequence ? delta_.size() : list.size();
+	size_t entriesSize = numEntries * sizeof(struct ipa_control_value_entry);
+	size_t hdrOffset = data.size();
+	size_t entryOffset = hdrOffset + sizeof(struct ipa_controls_header);
+	size_t dataOffset = entryOffset + entriesSize;
+
+	data.resize(dataOffset);
 
-	/* Serialize all entries. */
-	for (const auto &ctrl : list) {
-		unsigned int id = ctrl.first;
-		const ControlValue &value = ctrl.second;
+	auto storeEntry = [&](unsigned int id, const ControlValue &value) {
+		Span<const uint8_t> bytes = value.data();
 
 		struct ipa_control_value_entry entry;
 		entry.id = id;
 		entry.type = value.type();
 		entry.is_array = value.isArray();
 		entry.count = value.numElements();
-		entry.offset = values.offset();
-		entries.write(&entry);
+		entry.offset = data.size() - dataOffset;
+		entry.padding[0] = 0;
+
+		memcpy(data.data() + entryOffset, &entry, sizeof(entry));
+		entryOffset += sizeof(entry);
 
-		store(value, values);
+		data.insert(data.end(), bytes.begin(), bytes.end());
+	};
+
+	if (baseSequence) {
+		static const ControlValue removed;
+
+		for (const auto &[id, value] : delta_)
+			storeEntry(id, value ? *value : removed);
+	} else {
+		for (const auto &ctrl : list)
+			storeEntry(ctrl.first, ctrl.second);
 	}
 
-	if (buffer.overflow())
-		return -ENOSPC;
+	struct ipa_controls_header hdr;
+	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
+	hdr.handle = infoMapHandle;
+	hdr.entries = numEntries;
+	hdr.size = data.size() - hdrOffset;
+	hdr.data_offset = sizeof(hdr) + entriesSize;
+	hdr.id_map_type = list.infoMap() ? idMapTypeOf(&list.infoMap()->idmap())
+					 : IPA_CONTROL_ID_MAP_CONTROLS;
+	hdr.sequence = *sequence;
+	hdr.base_sequence = baseSequence;
+
+	memcpy(data.data() + hdrOffset, &hdr, sizeof(hdr));
 
 	return 0;
 }
 
+void ControlSerializer::commit(const ControlList &list, ListState *state,
+			       uint32_t sequence)
+{
+	if (!state)
+		return;
+
+	state->sequence = sequence;
+	state->list = list;
+}
+
 ControlValue ControlSerializer::loadControlValue(ControlType type,
 						 ByteStreamBuffer &buffer,
 						 bool isArray,
@@ -364,6 +742,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 	const struct ipa_controls_header *hdr = buffer.read<decltype(*hdr)>();
 	if (!hdr) {
 		LOG(Serializer, Error) << "Out of data";
+		error_ = -EINVAL;
 		return {};
 	}
 
@@ -373,13 +752,25 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 		return iter->second;
 	}
 
+	if (hdr->base_sequence) {
+		LOG(Serializer, Error)
+			<< "Reference to unknown ControlInfoMap " << hdr->handle;
+		error_ = -EINVAL;
+		return {};
+	}
+
 	if (hdr->version != IPA_CONTROLS_FORMAT_VERSION) {
 		LOG(Serializer, Error)
 			<< "Unsupported controls format version "
 			<< hdr->version;
+		error_ = -EINVAL;
 		return {};
 	}
 
+	/* Evict the map the serializer has evicted to make room for this one. */
+	if (hdr->sequence)
+		evictDeserialized(hdr->sequence);
+
 	/*
 	 * Use the ControlIdMap corresponding to the id map type. If the type
 	 * references a globally defined id map (such as controls::controls
@@ -397,13 +788,14 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 		idMap = &properties::properties;
 		break;
 	case IPA_CONTROL_ID_MAP_V4L2:
-		controlIdMaps_.emplace_back(std::make_unique<ControlIdMap>());
-		localIdMap = controlIdMaps_.back().get();
+		controlIdMaps_[hdr->handle] = std::make_unique<ControlIdMap>();
+		localIdMap = controlIdMaps_[hdr->handle].get();
 		idMap = localIdMap;
 		break;
 	default:
 		LOG(Serializer, Error)
 			<< "Unknown id map type: " << hdr->id_map_type;
+		error_ = -EINVAL;
 		return {};
 	}
 
@@ -412,6 +804,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 
 	if (buffer.overflow()) {
 		LOG(Serializer, Error) << "Out of data";
+		error_ = -EINVAL;
 		return {};
 	}
 
@@ -421,6 +814,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 			entries.read<decltype(*entry)>();
 		if (!entry) {
 			LOG(Serializer, Error) << "Out of data";
+			error_ = -EINVAL;
 			return {};
 		}
 
@@ -432,9 +826,9 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 			 * \todo Find a way to preserve the control name for
 			 * debugging purpose.
 			 */
-			controlIds_.emplace_back(std::make_unique<ControlId>(entry->id,
-									     "", type));
-			(*localIdMap)[entry->id] = controlIds_.back().get();
+			std::vector<std::unique_ptr<ControlId>> &ids = controlIds_[hdr->handle];
+			ids.emplace_back(std::make_unique<ControlId>(entry->id, "", type));
+			(*localIdMap)[entry->id] = ids.back().get();
 		}
 
 		const ControlId *controlId = idMap->at(entry->id);
@@ -444,6 +838,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 			LOG(Serializer, Error)
 				<< "Bad data, entry offset mismatch (entry "
 				<< i << ")";
+			error_ = -EINVAL;
 			return {};
 		}
 
@@ -477,6 +872,7 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 	const struct ipa_controls_header *hdr = buffer.read<decltype(*hdr)>();
 	if (!hdr) {
 		LOG(Serializer, Error) << "Out of data";
+		error_ = -EINVAL;
 		return {};
 	}
 
@@ -484,6 +880,7 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 		LOG(Serializer, Error)
 			<< "Unsupported controls format version "
 			<< hdr->version;
+		error_ = -EINVAL;
 		return {};
 	}
 
@@ -492,6 +889,7 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 
 	if (buffer.overflow()) {
 		LOG(Serializer, Error) << "Out of data";
+		error_ = -EINVAL;
 		return {};
 	}
 
@@ -511,6 +909,7 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 		if (iter == infoMapHandles_.end()) {
 			LOG(Serializer, Error)
 				<< "Can't deserialize ControlList: unknown ControlInfoMap";
+			error_ = -EINVAL;
 			return {};
 		}
 
@@ -519,13 +918,30 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 		infoMap = nullptr;
 	}
 
+	const ControlList *base = nullptr;
+	if (hdr->base_sequence) {
+		auto iter = deserializedLists_.find(hdr->handle);
+		if (iter == deserializedLists_.end() ||
+		    iter->second.sequence != hdr->base_sequence) {
+			LOG(Serializer, Error)
+				<< "Can't deserialize ControlList: missing delta base "
+				<< hdr->base_sequence << " for handle " << hdr->handle;
+			error_ = -EPROTO;
+			return {};
+		}
+
+		base = &iter->second.list;
+	}
+
 	ControlList ctrls(infoMap ? infoMap->idmap() : controls::controls);
+	std::vector<unsigned int> removed;
 
 	for (unsigned int i = 0; i < hdr->entries; ++i) {
 		const struct ipa_control_value_entry *entry =
 			entries.read<decltype(*entry)>();
 		if (!entry) {
 			LOG(Serializer, Error) << "Out of data";
+			error_ = -EINVAL;
 			return {};
 		}
 
@@ -533,15 +949,45 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 			LOG(Serializer, Error)
 				<< "Bad data, entry offset mismatch (entry "
 				<< i << ")";
+			error_ = -EINVAL;
 			return {};
 		}
 
 		ControlType type = static_cast<ControlType>(entry->type);
+		if (base && type == ControlTypeNone) {
+			removed.push_back(entry->id);
+			continue;
+		}
+
 		ctrls.set(entry->id,
 			  loadControlValue(type, values, entry->is_array,
 					   entry->count));
 	}
 
+	/* Add the unchanged controls from the delta base. */
+	if (base) {
+		for (const auto &[id, value] : *base) {
+			if (ctrls.contains(id) ||
+			    std::find(removed.begin(), removed.end(), id) != removed.end())
+				continue;
+
+			ctrls.set(id, value);
+		}
+	}
+
+	/*
+	 * Store a copy of the list as the base for the next delta. Copy the
+	 * values only, as the ControlIdMap of the list may be invalidated by a
+	 * reset() while the peer serializer still encodes deltas.
+	 */
+	if (hdr->sequence) {
+		ListState &state = deserializedLists_[hdr->handle];
+		state.sequence = hdr->sequence;
+		state.list.clear();
+		for (const auto &[id, value] : ctrls)
+			state.list.set(id, value);
+	}
+
 	return ctrls;
 }
 
@@ -559,4 +1005,25 @@ bool ControlSerializer::isCached(const ControlInfoMap &infoMap)
 	return infoMapHandles_.count(&infoMap);
 }
 
+/**
+ * \brief Retrieve and clear the deserialization error state
+ *
+ * The error state records the last error that occurred when deserializing a
+ * ControlList or ControlInfoMap since the last call to this function. It
+ * allows detecting failures that can't be told apart from a valid empty object
+ * returned by deserialize().
+ *
+ * \return 0 if no deserialization error occurred, or a negative error code
+ * otherwise
+ * \retval -EPROTO A delta-encoded ControlList references a base list that
+ * hasn't been deserialized, the serializers are out of sync
+ * \retval -EINVAL The serialized data is invalid
+ */
+int ControlSerializer::takeError()
+{
+	int error = error_;
+	error_ = 0;
+	return error;
+}
+
 } /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #include <libcamera/controls.h>
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <string>
@@ -89,8 +90,14 @@ static constexpr size_t ControlValueSize[] = {
  * \brief Abstract type representing the value of a control
  */
 
-/** \todo Revisit the ControlValue layout when stabilizing the ABI */
-static_assert(sizeof(ControlValue) == 16, "Invalid size of ControlValue class");
+/*
+ * Values up to 40 bytes are stored inline, to cover the array controls commonly
+ * set for every frame, such as rectangles, colour gains and colour correction
+ * matrices, without a memory allocation.
+ *
+ * \todo Revisit the ControlValue layout when stabilizing the ABI
+ */
+static_assert(sizeof(ControlValue) == 48, "Invalid size of ControlValue class");
 
 /**
  * \brief Construct an empty ControlValue.
@@ -150,6 +157,48 @@ ControlValue &ControlValue::operator=(const ControlValue &other)
 	return *this;
 }
 
+/**
+ * \brief Construct a ControlValue by moving the content of \a other
+ * \param[in] other The ControlValue to move content from
+ *
+ * The storage of \a other is transferred to the new ControlValue without
+ * copying the data. The \a other ControlValue is left empty.
+ */
+ControlValue::ControlValue(ControlValue &&other) noexcept
+	: type_(ControlTypeNone), numElements_(0)
+{
+	*this = std::move(other);
+}
+
+/**
+ * \brief Replace the content of the ControlValue by moving the content of
+ * \a other
+ * \param[in] other The ControlValue to move content from
+ *
+ * The storage of \a other is transferred to this ControlValue without copying
+ * the data. The \a other ControlValue is left empty.
+ *
+ * \return The ControlValue with its content replaced with the one of \a other
+ */
+ControlValue &ControlValue::operator=(ControlValue &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	release();
+
+	type_ = other.type_;
+	isArray_ = other.isArray_;
+	numElements_ = other.numElements_;
+	memcpy(value_, other.value_, sizeof(value_));
+
+	other.type_ = ControlTypeNone;
+	other.isArray_ = false;
+	other.numElements_ = 0;
+
+	return *this;
+}
+
 /**
  * \fn ControlValue::type()
  * \brief Retrieve the data type of the value
@@ -188,7 +237,7 @@ Span<const uint8_t> ControlValue::data() const
 	std::size_t size = numElements_ * ControlValueSize[type_];
 	const uint8_t *data = size > sizeof(value_)
 			    ? reinterpret_cast<const uint8_t *>(storage_)
-			    : reinterpret_cast<const uint8_t *>(&value_);
+			    : reinterpret_cast<const uint8_t *>(value_);
 	return { data, size };
 }
 
@@ -799,6 +848,13 @@ ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
  * Control lists are constructed with a map of all the controls supported by
  * their object, and an optional ControlValidator to further validate the
  * controls.
+ *
+ * Controls are stored in a contiguous array sorted by control ID, and are
+ * iterated in that order. Lists typically hold a few tens of controls at most,
+ * for which a sorted array is faster to search than a hash table and avoids
+ * per-control memory allocations. The storage is retained when the list is
+ * cleared, making reuse of a ControlList allocation-free once it has grown to
+ * its working size.
  */
 
 /**
@@ -899,9 +955,6 @@ ControlList::ControlList(const ControlInfoMap &infoMap, ControlValidator *valida
  *
  * Only control lists created from the same ControlIdMap or ControlInfoMap may
  * be merged. Attempting to do otherwise results in undefined behaviour.
- *
- * \todo Reimplement or implement an overloaded version which internally uses
- * std::unordered_map::merge() and accepts a non-const argument.
  */
 void ControlList::merge(const ControlList &source)
 {
@@ -937,7 +990,7 @@ void ControlList::merge(const ControlList &source)
  */
 bool ControlList::contains(const ControlId &id) const
 {
-	return controls_.find(id.id()) != controls_.end();
+	return contains(id.id());
 }
 
 /**
@@ -948,7 +1001,8 @@ bool ControlList::contains(const ControlId &id) const
  */
 bool ControlList::contains(unsigned int id) const
 {
-	return controls_.find(id) != controls_.end();
+	auto iter = lowerBound(id);
+	return iter != controls_.end() && iter->first == id;
 }
 
 /**
@@ -1040,8 +1094,8 @@ void ControlList::set(unsigned int id, const ControlValue &value)
 
 const ControlValue *ControlList::find(unsigned int id) const
 {
-	const auto iter = controls_.find(id);
-	if (iter == controls_.end()) {
+	const auto iter = lowerBound(id);
+	if (iter == controls_.end() || iter->first != id) {
 		LOG(Controls, Error)
 			<< "Control " << utils::hex(id) << " not found";
 
@@ -1060,7 +1114,21 @@ ControlValue *ControlList::find(unsigned int id)
 		return nullptr;
 	}
 
-	return &controls_[id];
+	auto iter = controls_.begin() + (lowerBound(id) - controls_.cbegin());
+	if (iter == controls_.end() || iter->first != id)
+		iter = controls_.emplace(iter, id, ControlValue{});
+
+	return &iter->second;
+}
+
+ControlList::ControlListMap::const_iterator
+ControlList::lowerBound(unsigned int id) const
+{
+	return std::lower_bound(controls_.begin(), controls_.end(), id,
+				[](const ControlListMap::value_type &ctrl,
+				   unsigned int value) {
+					return ctrl.first < value;
+				});
 }
 
 } /* namespace libcamera */
@@ -7,10 +7,14 @@
 
 #include "libcamera/internal/delayed_controls.h"
 
+#include <algorithm>
+#include <functional>
+
 #include <libcamera/base/log.h>
 
 #include <libcamera/controls.h>
 
+#include "libcamera/internal/tracepoints.h"
 #include "libcamera/internal/v4l2_device.h"
 
 /**
@@ -55,6 +59,19 @@ LOG_DEFINE_CATEGORY(DelayedControls)
  * does not reject \a V4L2_CID_EXPOSURE control values that may be outside of
  * the existing vertical blanking specified bounds, but are within the new
  * blanking bounds.
+ *
+ * \var ControlParams::priority
+ * \brief Priority group of the control, ignored if priorityWrite is set
+ *
+ * Controls that are not priority writes are batched per priority group. Each
+ * group is written with a separate device access, in decreasing priority order,
+ * after all priority writes. Controls in the same group are written together.
+ * All controls are in group 0 by default.
+ */
+
+/**
+ * \var DelayedControls::DefaultHistoryDepth
+ * \brief The default number of frames of control values history
  */
 
 /**
@@ -62,24 +79,33 @@ LOG_DEFINE_CATEGORY(DelayedControls)
  * \param[in] device The V4L2 device the controls have to be applied to
  * \param[in] controlParams Map of the numerical V4L2 control ids to their
  * associated control parameters.
+ * \param[in] historyDepth Number of frames of control values to keep
+ *
+ * The control parameters comprise of delays (in frames), a priority write
+ * flag and a priority group. If the priority write flag is set, the relevant
+ * control is written separately from, and ahead of the rest of the batched
+ * controls. The other controls are batched per priority group, see
+ * ControlParams::priority.
  *
- * The control parameters comprise of delays (in frames) and a priority write
- * flag. If this flag is set, the relevant control is written separately from,
- * and ahead of the rest of the batched controls.
+ * The \a historyDepth sets the size of the ring buffer that stores the queued
+ * and past control values, and thus bounds how far ahead controls can be pushed
+ * and how old a sequence number can be passed to get(). It is raised to the
+ * largest control delay plus one if smaller.
  *
  * Only controls specified in \a controlParams are handled. If it's desired to
  * mix delayed controls and controls that take effect immediately the immediate
  * controls must be listed in the \a controlParams map with a delay value of 0.
  */
 DelayedControls::DelayedControls(V4L2Device *device,
-				 const std::unordered_map<uint32_t, ControlParams> &controlParams)
-	: device_(device), maxDelay_(0)
+				 const std::unordered_map<uint32_t, ControlParams> &controlParams,
+				 unsigned int historyDepth)
+	: device_(device), maxDelay_(0), priority_(device->controls())
 {
 	const ControlInfoMap &controls = device_->controls();
 
 	/*
-	 * Create a map of control ids to delays for controls exposed by the
-	 * device.
+	 * Create the state of the controls exposed by the device, sorted by
+	 * numerical ID.
 	 */
 	for (auto const &param : controlParams) {
 		auto it = controls.find(param.first);
@@ -94,16 +120,47 @@ DelayedControls::DelayedControls(V4L2Device *device,
 
 		const ControlId *id = it->first;
 
-		controlParams_[id] = param.second;
+		controls_.push_back({ id, param.second, 0, {} });
 
 		LOG(DelayedControls, Debug)
-			<< "Set a delay of " << controlParams_[id].delay
-			<< " and priority write flag " << controlParams_[id].priorityWrite
+			<< "Set a delay of " << param.second.delay
+			<< ", priority write flag " << param.second.priorityWrite
+			<< " and priority " << param.second.priority
 			<< " for " << id->name();
 
-		maxDelay_ = std::max(maxDelay_, controlParams_[id].delay);
+		maxDelay_ = std::max(maxDelay_, param.second.delay);
 	}
 
+	std::sort(controls_.begin(), controls_.end(),
+		  [](const ControlState &a, const ControlState &b) {
+			  return a.id->id() < b.id->id();
+		  });
+
+	historyDepth_ = historyDepth;
+	if (historyDepth_ <= maxDelay_) {
+		LOG(DelayedControls, Warning)
+			<< "History depth " << historyDepth
+			<< " too small for a delay of " << maxDelay_;
+		historyDepth_ = maxDelay_ + 1;
+	}
+
+	/* Assign the controls to priority groups in decreasing priority. */
+	std::vector<unsigned int> priorities;
+	for (const ControlState &state : controls_)
+		priorities.push_back(state.params.priority);
+
+	std::sort(priorities.begin(), priorities.end(), std::greater<>());
+	priorities.erase(std::unique(priorities.begin(), priorities.end()),
+			 priorities.end());
+
+	for (ControlState &state : controls_) {
+		auto it = std::find(priorities.begin(), priorities.end(),
+				    state.params.priority);
+		state.group = it - priorities.begin();
+	}
+
+	groups_.resize(priorities.size(), ControlList(device_->controls()));
+
 	reset();
 }
 
@@ -122,20 +179,25 @@ void DelayedControls::reset()
 
 	/* Retrieve control as reported by the device. */
 	std::vector<uint32_t> ids;
-	for (auto const &param : controlParams_)
-		ids.push_back(param.first->id());
+	for (const ControlState &state : controls_)
+		ids.push_back(state.id->id());
 
 	ControlList controls = device_->getControls(ids);
 
 	/* Seed the control queue with the controls reported by the device. */
-	values_.clear();
+	for (ControlState &state : controls_)
+		state.values.assign(historyDepth_, Info());
+
 	for (const auto &ctrl : controls) {
-		const ControlId *id = device_->controls().idmap().at(ctrl.first);
+		ControlState *state = findControl(ctrl.first);
+		if (!state)
+			continue;
+
 		/*
 		 * Do not mark this control value as updated, it does not need
 		 * to be written to to device on startup.
 		 */
-		values_[id][0] = Info(ctrl.second, false);
+		state->values[0] = Info(ctrl.second, false);
 	}
 }
 
@@ -151,37 +213,36 @@ void DelayedControls::reset()
 bool DelayedControls::push(const ControlList &controls)
 {
 	/* Copy state from previous frame. */
-	for (auto &ctrl : values_) {
-		Info &info = ctrl.second[queueCount_];
-		info = values_[ctrl.first][queueCount_ - 1];
+	for (ControlState &state : controls_) {
+		Info &info = state.values[queueCount_];
+		info = state.values[queueCount_ - 1];
 		info.updated = false;
 	}
 
 	/* Update with new controls. */
-	const ControlIdMap &idmap = device_->controls().idmap();
 	for (const auto &control : controls) {
-		const auto &it = idmap.find(control.first);
-		if (it == idmap.end()) {
-			LOG(DelayedControls, Warning)
-				<< "Unknown control " << control.first;
+		ControlState *state = findControl(control.first);
+		if (!state) {
+			const ControlIdMap &idmap = device_->controls().idmap();
+			if (idmap.find(control.first) == idmap.end())
+				LOG(DelayedControls, Warning)
+					<< "Unknown control " << control.first;
 			return false;
 		}
 
-		const ControlId *id = it->second;
-
-		if (controlParams_.find(id) == controlParams_.end())
-			return false;
-
-		Info &info = values_[id][queueCount_];
+		Info &info = state->values[queueCount_];
 
 		info = Info(control.second);
 
 		LOG(DelayedControls, Debug)
-			<< "Queuing " << id->name()
+			<< "Queuing " << state->id->name()
 			<< " to " << info.toString()
 			<< " at index " << queueCount_;
 	}
 
+	LIBCAMERA_TRACEPOINT(delayed_controls_push, this, queueCount_,
+			     controls.size());
+
 	queueCount_++;
 
 	return true;
@@ -192,13 +253,13 @@ bool DelayedControls::push(const ControlList &controls)
  * \param[in] sequence The sequence number to get controls for
  *
  * Read back what controls where in effect at a specific sequence number. The
- * history is a ring buffer of 16 entries where new and old values coexist. It's
- * the callers responsibility to not read too old sequence numbers that have been
- * pushed out of the history.
+ * history is a ring buffer of history depth entries where new and old values
+ * coexist. It's the callers responsibility to not read too old sequence numbers
+ * that have been pushed out of the history.
  *
  * Historic values are evicted by pushing new values onto the queue using
  * push(). The max history from the current sequence number that yields valid
- * values are thus 16 minus number of controls pushed.
+ * values are thus the history depth minus number of controls pushed.
  *
  * \return The controls at \a sequence number
  */
@@ -208,14 +269,15 @@ ControlList DelayedControls::get(uint32_t sequence)
 	unsigned int index = std::max<int>(0, adjustedSeq - maxDelay_);
 
 	ControlList out(device_->controls());
-	for (const auto &ctrl : values_) {
-		const ControlId *id = ctrl.first;
-		const Info &info = ctrl.second[index];
+	for (const ControlState &state : controls_) {
+		const Info &info = state.values[index];
+		if (info.isNone())
+			continue;
 
-		out.set(id->id(), info);
+		out.set(state.id->id(), info);
 
 		LOG(DelayedControls, Debug)
-			<< "Reading " << id->name()
+			<< "Reading " << state.id->name()
 			<< " to " << info.toString()
 			<< " at index " << index;
 	}
@@ -231,8 +293,30 @@ ControlList DelayedControls::get(uint32_t sequence)
  * number. Any user of these helpers is responsible to inform the helper about
  * the start of any frame. This can be connected with ease to the start of a
  * exposure (SOE) V4L2 event.
+ *
+ * The controls that need to be written for the frame are written to the device
+ * immediately. The control lists are reused from frame to frame, this function
+ * thus doesn't allocate memory once the lists have reached their working size.
  */
 void DelayedControls::applyControls(uint32_t sequence)
+{
+	collectControls(sequence, &batch_);
+	batch_.commit();
+}
+
+/**
+ * \brief Inform DelayedControls of the start of a new frame, deferring writes
+ * \param[in] sequence Sequence number of the frame that started
+ * \param[in] batch The batch to add the controls to
+ *
+ * This function behaves as applyControls(), but adds the controls that need to
+ * be written to the device to the \a batch instead of writing them. It allows
+ * pipeline handlers to gather the controls of multiple devices and write them
+ * back to back with V4L2ControlBatch::commit(). Priority writes and priority
+ * groups are added to the batch as separate lists, in the order they would
+ * have been written by applyControls().
+ */
+void DelayedControls::collectControls(uint32_t sequence, V4L2ControlBatch *batch)
 {
 	LOG(DelayedControls, Debug) << "frame " << sequence << " started";
 
@@ -245,40 +329,48 @@ void DelayedControls::applyControls(uint32_t sequence)
 	 * Create control list peeking ahead in the value queue to ensure
 	 * values are set in time to satisfy the sensor delay.
 	 */
-	ControlList out(device_->controls());
-	for (auto &ctrl : values_) {
-		const ControlId *id = ctrl.first;
-		unsigned int delayDiff = maxDelay_ - controlParams_[id].delay;
+	for (ControlList &group : groups_)
+		group.clear();
+
+	unsigned int count = 0;
+
+	for (ControlState &state : controls_) {
+		unsigned int delayDiff = maxDelay_ - state.params.delay;
 		unsigned int index = std::max<int>(0, writeCount_ - delayDiff);
-		Info &info = ctrl.second[index];
+		Info &info = state.values[index];
 
 		if (info.updated) {
-			if (controlParams_[id].priorityWrite) {
+			if (state.params.priorityWrite) {
 				/*
 				 * This control must be written now, it could
 				 * affect validity of the other controls.
 				 */
-				ControlList priority(device_->controls());
-				priority.set(id->id(), info);
-				device_->setControls(&priority);
+				priority_.clear();
+				priority_.set(state.id->id(), info);
+				batch->add(device_, priority_);
 			} else {
 				/*
-				 * Batch up the list of controls and write them
-				 * at the end of the function.
+				 * Batch up the list of controls per priority
+				 * group and write them after the priority
+				 * writes.
 				 */
-				out.set(id->id(), info);
+				groups_[state.group].set(state.id->id(), info);
 			}
 
 			LOG(DelayedControls, Debug)
-				<< "Setting " << id->name()
+				<< "Setting " << state.id->name()
 				<< " to " << info.toString()
 				<< " at index " << index;
 
 			/* Done with this update, so mark as completed. */
 			info.updated = false;
+			count++;
 		}
 	}
 
+	LIBCAMERA_TRACEPOINT(delayed_controls_apply, this, sequence,
+			     writeCount_, count);
+
 	writeCount_++;
 
 	while (writeCount_ > queueCount_) {
@@ -287,7 +379,20 @@ void DelayedControls::applyControls(uint32_t sequence)
 		push({});
 	}
 
-	device_->setControls(&out);
+	for (ControlList &group : groups_)
+		batch->add(device_, group);
+}
+
+DelayedControls::ControlState *DelayedControls::findControl(unsigned int id)
+{
+	auto it = std::lower_bound(controls_.begin(), controls_.end(), id,
+				   [](const ControlState &state, unsigned int value) {
+					   return state.id->id() < value;
+				   });
+	if (it == controls_.end() || it->id->id() != id)
+		return nullptr;
+
+	return &*it;
 }
 
 } /* namespace libcamera */
@@ -0,0 +1,388 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * device_cache.cpp - Persistent cache of device information
+ */
+
+#include "libcamera/internal/device_cache.h"
+
+#include <errno.h>
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file device_cache.h
+ * \brief Persistent cache of device information
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DeviceCache)
+
+namespace {
+
+constexpr char CacheMagic[8] = { 'L', 'C', 'D', 'E', 'V', 'C', '0', '1' };
+
+/* Sanity limits to reject corrupted cache files. */
+constexpr uint32_t MaxKeySize = 4096;
+constexpr uint32_t MaxDataSize = 16 * 1024 * 1024;
+
+template<typename T>
+void append(std::vector<uint8_t> &data, const T &value)
+{
+	const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&value);
+	data.insert(data.end(), ptr, ptr + sizeof(value));
+}
+
+} /* namespace */
+
+/**
+ * \class DeviceCache
+ * \brief Cache information retrieved from devices on disk
+ *
+ * Populating the media graph of media devices and enumerating the formats
+ * supported by camera sensors require a large number of ioctl calls, which
+ * take a significant amount of time when starting the camera manager on
+ * systems with many devices. The DeviceCache stores the results of those
+ * operations in a file to skip them when the hardware hasn't changed since the
+ * last time libcamera was started.
+ *
+ * The cache stores opaque data blobs, keyed by strings. The users of the cache
+ * are responsible for serializing their data, and for including in the key all
+ * the information required to guarantee that a cache entry is valid. The
+ * bootId(), kernelRelease() and nodeId() helpers are provided for this
+ * purpose.
+ *
+ * The global cache instance used by libcamera, returned by instance(), is
+ * disabled by default, and is enabled by setting the LIBCAMERA_DEVICE_CACHE
+ * environment variable to the path of the cache file. The cache file is only
+ * used if it is owned by the effective user and not writable by other users.
+ * Entries that haven't been used or stored since the cache was loaded are
+ * dropped when the cache is saved.
+ *
+ * The DeviceCache is thread-safe.
+ */
+
+/**
+ * \brief Construct a DeviceCache and load the cache file at \a path
+ * \param[in] path The path to the cache file, or an empty string to disable
+ * the cache
+ *
+ * A missing or invalid cache file results in an empty cache.
+ */
+DeviceCache::DeviceCache(const std::string &path)
+	: path_(path), dirty_(false)
+{
+	if (!path_.empty())
+		load();
+}
+
+/**
+ * \brief Retrieve the global device cache instance
+ *
+ * The global instance is used by libcamera to cache information about the
+ * devices it enumerates. It is created on first use, with the path stored in
+ * the LIBCAMERA_DEVICE_CACHE environment variable.
+ *
+ * \return The global device cache instance
+ */
+DeviceCache *DeviceCache::instance()
+{
+	static DeviceCache instance([]() {
+		const char *path = utils::secure_getenv("LIBCAMERA_DEVICE_CACHE");
+		return std::string(path ? path : "");
+	}());
+
+	return &instance;
+}
+
+/**
+ * \fn DeviceCache::path()
+ * \brief Retrieve the path to the cache file
+ * \return The path to the cache file, or an empty string if the cache is
+ * disabled
+ */
+
+/**
+ * \fn DeviceCache::enabled()
+ * \brief Check if the cache is enabled
+ * \return True if the cache is enabled, false otherwise
+ */
+
+/**
+ * \brief Look up a cache entry
+ * \param[in] key The entry key
+ * \param[out] data The entry data
+ * \return True if an entry has been found for \a key and stored in \a data,
+ * false otherwise
+ */
+bool DeviceCache::lookup(const std::string &key, std::vector<uint8_t> *data)
+{
+	if (!enabled())
+		return false;
+
+	MutexLocker locker(mutex_);
+
+	auto iter = entries_.find(key);
+	if (iter == entries_.end())
+		return false;
+
+	iter->second.used = true;
+	*data = iter->second.data;
+
+	return true;
+}
+
+/**
+ * \brief Store a cache entry
+ * \param[in] key The entry key
+ * \param[in] data The entry data
+ *
+ * The entry is written to disk by the next call to save().
+ */
+void DeviceCache::store(const std::string &key, std::vector<uint8_t> data)
+{
+	if (!enabled())
+		return;
+
+	MutexLocker locker(mutex_);
+
+	entries_[key] = { std::move(data), true };
+	dirty_ = true;
+}
+
+/**
+ * \brief Write the cache to disk
+ *
+ * The cache file is written atomically, by writing to a temporary file and
+ * renaming it. The file isn't written if no entry has been stored or dropped
+ * since the cache was loaded or last saved.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DeviceCache::save()
+{
+	if (!enabled())
+		return 0;
+
+	MutexLocker locker(mutex_);
+
+	for (auto iter = entries_.begin(); iter != entries_.end();) {
+		if (iter->second.used) {
+			++iter;
+			continue;
+		}
+
+		iter = entries_.erase(iter);
+		dirty_ = true;
+	}
+
+	if (!dirty_)
+		return 0;
+
+	std::vector<uint8_t> data;
+
+	data.insert(data.end(), CacheMagic, CacheMagic + sizeof(CacheMagic));
+	append(data, static_cast<uint32_t>(entries_.size()));
+
+	for (const auto &[key, entry] : entries_) {
+		append(data, static_cast<uint32_t>(key.size()));
+		data.insert(data.end(), key.begin(), key.end());
+		append(data, static_cast<uint32_t>(entry.data.size()));
+		data.insert(data.end(), entry.data.begin(), entry.data.end());
+	}
+
+	std::string dir = path_.substr(0, path_.rfind('/'));
+	if (!dir.empty() && mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+		int ret = -errno;
+		LOG(DeviceCache, Debug)
+			<< "Failed to create " << dir << ": " << strerror(-ret);
+		return ret;
+	}
+
+	std::string tmpPath = path_ + ".XXXXXX";
+	int fd = mkstemp(tmpPath.data());
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(DeviceCache, Debug)
+			<< "Failed to create " << tmpPath << ": " << strerror(-ret);
+		return ret;
+	}
+
+	int ret = 0;
+	size_t offset = 0;
+
+	while (offset < data.size()) {
+		ssize_t len = write(fd, data.data() + offset, data.size() - offset);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+
+		offset += len;
+	}
+
+	close(fd);
+
+	if (!ret && rename(tmpPath.c_str(), path_.c_str()) < 0)
+		ret = -errno;
+
+	if (ret) {
+		LOG(DeviceCache, Debug)
+			<< "Failed to write " << path_ << ": " << strerror(-ret);
+		unlink(tmpPath.c_str());
+		return ret;
+	}
+
+	LOG(DeviceCache, Debug)
+		<< "Saved " << entries_.size() << " entries to " << path_;
+
+	dirty_ = false;
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the identifier of the current boot
+ *
+ * Cache entries that depend on the device probe order, such as device numbers,
+ * are only valid until the system reboots, and shall include the boot ID in
+ * their key.
+ *
+ * \return The boot ID, or an empty string if it can't be retrieved
+ */
+std::string DeviceCache::bootId()
+{
+	static const std::string id = []() {
+		std::ifstream file("/proc/sys/kernel/random/boot_id");
+		std::string line;
+		std::getline(file, line);
+		return line;
+	}();
+
+	return id;
+}
+
+/**
+ * \brief Retrieve the release of the running kernel
+ *
+ * Cache entries that depend on the kernel drivers only shall include the kernel
+ * release in their key, to be invalidated when the kernel is updated.
+ *
+ * \return The kernel release, or an empty string if it can't be retrieved
+ */
+std::string DeviceCache::kernelRelease()
+{
+	static const std::string release = []() {
+		struct utsname name;
+		if (uname(&name) < 0)
+			return std::string();
+		return std::string(name.release);
+	}();
+
+	return release;
+}
+
+/**
+ * \brief Retrieve an identifier for a device node
+ * \param[in] deviceNode The path to the device node
+ *
+ * The identifier contains the device number and the change time of the device
+ * node, which differ when a device is unplugged and plugged back, even if the
+ * device node path is identical.
+ *
+ * \return The device node identifier, or an empty string if the device node
+ * doesn't exist
+ */
+std::string DeviceCache::nodeId(const std::string &deviceNode)
+{
+	struct stat st;
+
+	if (stat(deviceNode.c_str(), &st) < 0)
+		return std::string();
+
+	return std::to_string(st.st_rdev) + "-" +
+	       std::to_string(st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec);
+}
+
+void DeviceCache::load()
+{
+	File file{ path_ };
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		return;
+
+	struct stat st;
+	if (stat(path_.c_str(), &st) < 0)
+		return;
+
+	if (st.st_uid != geteuid() || st.st_mode & (S_IWGRP | S_IWOTH)) {
+		LOG(DeviceCache, Warning)
+			<< "Ignoring " << path_ << " with unsafe permissions";
+		return;
+	}
+
+	Span<const uint8_t> data = file.map(0, -1, File::MapFlag::Private);
+	size_t offset = 0;
+
+	auto read = [&](void *dst, size_t size) {
+		if (data.size() - offset < size)
+			return false;
+
+		memcpy(dst, data.data() + offset, size);
+		offset += size;
+		return true;
+	};
+
+	char magic[sizeof(CacheMagic)];
+	uint32_t count;
+
+	if (!read(magic, sizeof(magic)) ||
+	    memcmp(magic, CacheMagic, sizeof(magic)) ||
+	    !read(&count, sizeof(count))) {
+		LOG(DeviceCache, Debug) << "Discarding stale " << path_;
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t length;
+
+		if (!read(&length, sizeof(length)) || length > MaxKeySize ||
+		    data.size() - offset < length) {
+			LOG(DeviceCache, Warning) << "Discarding invalid " << path_;
+			entries_.clear();
+			return;
+		}
+
+		std::string key(reinterpret_cast<const char *>(data.data() + offset),
+				length);
+		offset += length;
+
+		if (!read(&length, sizeof(length)) || length > MaxDataSize ||
+		    data.size() - offset < length) {
+			LOG(DeviceCache, Warning) << "Discarding invalid " << path_;
+			entries_.clear();
+			return;
+		}
+
+		Entry &entry = entries_[key];
+		entry.data.assign(data.data() + offset, data.data() + offset + length);
+		entry.used = false;
+		offset += length;
+	}
+
+	LOG(DeviceCache, Debug)
+		<< "Loaded " << entries_.size() << " entries from " << path_;
+}
+
+} /* namespace libcamera */
@@ -7,9 +7,12 @@
 
 #include "libcamera/internal/device_enumerator.h"
 
+#include <algorithm>
 #include <string.h>
+#include <thread>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread_pool.h>
 
 #include "libcamera/internal/device_enumerator_sysfs.h"
 #include "libcamera/internal/device_enumerator_udev.h"
@@ -97,22 +100,33 @@ bool DeviceMatch::match(const MediaDevice *device) const
 		return false;
 
 	for (const std::string &name : entities_) {
-		bool found = false;
-
-		for (const MediaEntity *entity : device->entities()) {
-			if (name == entity->name()) {
-				found = true;
-				break;
-			}
-		}
-
-		if (!found)
+		if (!device->getEntityByName(name))
 			return false;
 	}
 
 	return true;
 }
 
+/**
+ * \brief Retrieve a string that uniquely identifies the search pattern
+ *
+ * Two search patterns with the same driver name and entity names produce the
+ * same key, and match the same media devices.
+ *
+ * \return The search pattern key
+ */
+std::string DeviceMatch::key() const
+{
+	std::string key = driver_;
+
+	for (const std::string &name : entities_) {
+		key += '\0';
+		key += name;
+	}
+
+	return key;
+}
+
 /**
  * \class DeviceEnumerator
  * \brief Enumerate, store and search media devices
@@ -228,6 +242,47 @@ std::unique_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
 	return media;
 }
 
+/**
+ * \brief Create multiple media device instances concurrently
+ * \param[in] deviceNodes paths to the media devices to create
+ *
+ * Create a media device for each entry of \a deviceNodes as createDevice()
+ * does. Populating the media graph of a device requires multiple ioctl calls
+ * and can take a significant amount of time on systems with many media
+ * devices, the devices are thus created in parallel in a thread pool.
+ *
+ * The returned media devices are stored in the same order as \a deviceNodes
+ * regardless of the order in which they are populated, with a nullptr entry
+ * for each device that couldn't be created, to keep the enumeration order
+ * deterministic.
+ *
+ * \return The created media device instances
+ */
+std::vector<std::unique_ptr<MediaDevice>>
+DeviceEnumerator::createDevices(const std::vector<std::string> &deviceNodes)
+{
+	std::vector<std::unique_ptr<MediaDevice>> devices(deviceNodes.size());
+
+	if (deviceNodes.size() <= 1) {
+		for (unsigned int i = 0; i < deviceNodes.size(); ++i)
+			devices[i] = createDevice(deviceNodes[i]);
+		return devices;
+	}
+
+	unsigned int size = std::min<unsigned int>(deviceNodes.size(),
+						   std::max(std::thread::hardware_concurrency(), 1U));
+	ThreadPool pool(size, "DeviceEnum");
+
+	for (unsigned int i = 0; i < deviceNodes.size(); ++i)
+		pool.run([this, &devices, &deviceNodes, i]() {
+			devices[i] = createDevice(deviceNodes[i]);
+		});
+
+	pool.wait();
+
+	return devices;
+}
+
 /**
 * \var DeviceEnumerator::devicesAdded
 * \brief Notify of new media devices being found
@@ -285,6 +340,8 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
 		return;
 	}
 
+	mismatches_.erase(media.get());
+
 	LOG(DeviceEnumerator, Debug)
 		<< "Media device for node " << deviceNode << " removed.";
 
@@ -300,20 +357,35 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
  * it the caller is responsible for acquiring the MediaDevice object and
  * releasing it when done with it.
  *
+ * As the media graph of a media device doesn't change once the device has been
+ * added to the enumerator, the result of failed matches is cached, and media
+ * devices are only compared once with a given search pattern. This keeps the
+ * cost of matching pipeline handlers against the pool of media devices
+ * proportional to the number of newly added devices when devices are
+ * hotplugged.
+ *
  * \return pointer to the matching MediaDevice, or nullptr if no match is found
  */
 std::shared_ptr<MediaDevice> DeviceEnumerator::search(const DeviceMatch &dm)
 {
+	const std::string key = dm.key();
+
 	for (std::shared_ptr<MediaDevice> &media : devices_) {
 		if (media->busy())
 			continue;
 
+		std::unordered_set<std::string> &mismatches = mismatches_[media.get()];
+		if (mismatches.count(key))
+			continue;
+
 		if (dm.match(media.get())) {
 			LOG(DeviceEnumerator, Debug)
 				<< "Successful match for media device \""
 				<< media->driver() << "\"";
 			return media;
 		}
+
+		mismatches.insert(key);
 	}
 
 	return nullptr;
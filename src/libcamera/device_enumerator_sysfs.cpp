@@ -10,6 +10,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <fstream>
+#include <set>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -53,6 +54,8 @@ int DeviceEnumeratorSysfs::enumerate()
 		return -ENODEV;
 	}
 
+	std::set<unsigned int> indexes;
+
 	while ((ent = readdir(dir)) != nullptr) {
 		if (strncmp(ent->d_name, "media", 5))
 			continue;
@@ -73,7 +76,20 @@ int DeviceEnumeratorSysfs::enumerate()
 			continue;
 		}
 
-		std::unique_ptr<MediaDevice> media = createDevice(devnode);
+		indexes.insert(idx);
+	}
+
+	closedir(dir);
+
+	/*
+	 * Enumerate the devices in the order of their index to make it
+	 * deterministic, and populate them in parallel.
+	 */
+	std::vector<std::string> devnodes;
+	for (unsigned int idx : indexes)
+		devnodes.push_back("/dev/media" + std::to_string(idx));
+
+	for (std::unique_ptr<MediaDevice> &media : createDevices(devnodes)) {
 		if (!media)
 			continue;
 
@@ -88,8 +104,6 @@ int DeviceEnumeratorSysfs::enumerate()
 		addDevice(std::move(media));
 	}
 
-	closedir(dir);
-
 	return 0;
 }
 
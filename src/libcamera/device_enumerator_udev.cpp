@@ -81,32 +81,7 @@ int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev)
 		if (!media)
 			return -ENODEV;
 
-		DependencyMap deps;
-		int ret = populateMediaDevice(media.get(), &deps);
-		if (ret < 0) {
-			LOG(DeviceEnumerator, Warning)
-				<< "Failed to populate media device "
-				<< media->deviceNode()
-				<< " (" << media->driver() << "), skipping";
-			return ret;
-		}
-
-		if (!deps.empty()) {
-			LOG(DeviceEnumerator, Debug)
-				<< "Defer media device " << media->deviceNode()
-				<< " due to " << deps.size()
-				<< " missing dependencies";
-
-			pending_.emplace_back(std::move(media), std::move(deps));
-			MediaDeviceDeps *mediaDeps = &pending_.back();
-			for (const auto &dep : mediaDeps->deps_)
-				devMap_[dep.first] = mediaDeps;
-
-			return 0;
-		}
-
-		addDevice(std::move(media));
-		return 0;
+		return addMediaDevice(std::move(media));
 	}
 
 	if (!strcmp(subsystem, "video4linux")) {
@@ -117,10 +92,44 @@ int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev)
 	return -ENODEV;
 }
 
+int DeviceEnumeratorUdev::addMediaDevice(std::unique_ptr<MediaDevice> media)
+{
+	DependencyMap deps;
+	int ret = populateMediaDevice(media.get(), &deps);
+	if (ret < 0) {
+		LOG(DeviceEnumerator, Warning)
+			<< "Failed to populate media device "
+			<< media->deviceNode()
+			<< " (" << media->driver() << "), skipping";
+		return ret;
+	}
+
+	if (!deps.empty()) {
+		LOG(DeviceEnumerator, Debug)
+			<< "Defer media device " << media->deviceNode()
+			<< " due to " << deps.size()
+			<< " missing dependencies";
+
+		pending_.emplace_back(std::move(media), std::move(deps));
+		MediaDeviceDeps *mediaDeps = &pending_.back();
+		for (const auto &dep : mediaDeps->deps_)
+			devMap_[dep.first] = mediaDeps;
+
+		return 0;
+	}
+
+	addDevice(std::move(media));
+	return 0;
+}
+
 int DeviceEnumeratorUdev::enumerate()
 {
 	struct udev_enumerate *udev_enum = nullptr;
 	struct udev_list_entry *ents, *ent;
+	std::vector<struct udev_device *> devices;
+	std::vector<std::string> mediaNodes;
+	std::vector<std::unique_ptr<MediaDevice>> medias;
+	unsigned int mediaIndex;
 	int ret;
 
 	udev_enum = udev_enumerate_new(udev_);
@@ -169,15 +178,41 @@ int DeviceEnumeratorUdev::enumerate()
 			continue;
 		}
 
-		if (addUdevDevice(dev) < 0)
+		devices.push_back(dev);
+
+		const char *subsystem = udev_device_get_subsystem(dev);
+		if (subsystem && !strcmp(subsystem, "media"))
+			mediaNodes.push_back(devnode);
+	}
+
+	/*
+	 * Populate the media devices in parallel, and add all devices in the
+	 * udev enumeration order to keep the result deterministic.
+	 */
+	medias = createDevices(mediaNodes);
+	mediaIndex = 0;
+
+	for (struct udev_device *dev : devices) {
+		const char *syspath = udev_device_get_syspath(dev);
+		const char *subsystem = udev_device_get_subsystem(dev);
+
+		if (subsystem && !strcmp(subsystem, "media")) {
+			std::unique_ptr<MediaDevice> &media = medias[mediaIndex++];
+			if (!media || addMediaDevice(std::move(media)) < 0)
+				LOG(DeviceEnumerator, Warning)
+					<< "Failed to add device for '"
+					<< syspath << "', skipping";
+		} else if (addUdevDevice(dev) < 0) {
 			LOG(DeviceEnumerator, Warning)
 				<< "Failed to add device for '"
 				<< syspath << "', skipping";
-
-		udev_device_unref(dev);
+		}
 	}
 
 done:
+	for (struct udev_device *dev : devices)
+		udev_device_unref(dev);
+
 	udev_enumerate_unref(udev_enum);
 	if (ret < 0)
 		return ret;
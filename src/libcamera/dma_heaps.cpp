@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma_heaps.cpp - Helper class for dma-heap allocations.
+ */
+
+#include "libcamera/internal/dma_heaps.h"
+
+#include <array>
+#include <fcntl.h>
+#include <iterator>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <libcamera/base/log.h>
+
+/**
+ * \file libcamera/internal/dma_heaps.h
+ * \brief dma-heap memory allocation
+ */
+
+namespace libcamera {
+
+namespace {
+
+struct DmaHeapInfo {
+	DmaHeap::DmaHeapFlag type;
+	const char *deviceNodeName;
+};
+
+/*
+ * /dev/dma-heap/linux,cma is the dma-heap allocator, which allows dmaheap-cma
+ * to only have to worry about importing.
+ *
+ * Annoyingly, should the cma heap size be specified on the kernel command line
+ * instead of DT, the heap gets named "reserved" instead.
+ */
+constexpr std::array<DmaHeapInfo, 3> heapInfos = { {
+	{ DmaHeap::DmaHeapFlag::Cma, "/dev/dma_heap/linux,cma" },
+	{ DmaHeap::DmaHeapFlag::Cma, "/dev/dma_heap/reserved" },
+	{ DmaHeap::DmaHeapFlag::System, "/dev/dma_heap/system" },
+} };
+
+} /* namespace */
+
+LOG_DEFINE_CATEGORY(DmaHeap)
+
+/**
+ * \class DmaHeap
+ * \brief Helper class for dma-heap allocations
+ *
+ * DMA heaps are kernel devices that provide an API to allocate memory from
+ * different pools called "heaps", wrap each allocated piece of memory in a
+ * dmabuf object, and return the dmabuf file descriptor to userspace. The
+ * DmaHeap class allocates memory from the CMA heap, the system heap, or the
+ * first of them available.
+ *
+ * Allocating and freeing large amounts of contiguous memory is expensive, as
+ * the kernel needs to migrate pages out of the CMA area and zero the memory.
+ * To avoid paying that cost every time buffers are reallocated, for instance
+ * when a camera is stopped and restarted or reconfigured, the DmaHeap can keep
+ * released buffers in a recycling pool with a configurable size limit. Buffers
+ * returned to the heap with recycle() are then reused by subsequent calls to
+ * alloc() for allocations of a similar size.
+ *
+ * The recycling pool is disabled by default. The pool is thread-safe, buffers
+ * can be allocated and recycled concurrently from multiple threads.
+ */
+
+/**
+ * \enum DmaHeap::DmaHeapFlag
+ * \brief Type of the dma-heap
+ * \var DmaHeap::Cma
+ * \brief Allocate from a CMA dma-heap, providing physically contiguous memory
+ * \var DmaHeap::System
+ * \brief Allocate from the system dma-heap, using the page allocator
+ */
+
+/**
+ * \typedef DmaHeap::DmaHeapFlags
+ * \brief A bitwise combination of DmaHeap::DmaHeapFlag values
+ */
+
+/**
+ * \brief Open a dma-heap allocator
+ * \param[in] type The type(s) of the dma-heap to open
+ *
+ * The heap is opened from the first heap device found that matches one of the
+ * requested \a type, in order of preference CMA then system. Devices that need
+ * contiguous memory and lack an IOMMU shall only request the CMA heap. Use
+ * isValid() to check if the heap is usable.
+ */
+DmaHeap::DmaHeap(DmaHeapFlags type)
+	: dmaHeapHandle_(-1), poolLimit_(0), poolSize_(0)
+{
+	for (const DmaHeapInfo &info : heapInfos) {
+		if (!(type & info.type))
+			continue;
+
+		const char *name = info.deviceNodeName;
+		int ret = ::open(name, O_RDWR, 0);
+		if (ret < 0) {
+			ret = errno;
+			LOG(DmaHeap, Debug) << "Failed to open " << name << ": "
+					    << strerror(ret);
+			continue;
+		}
+
+		dmaHeapHandle_ = ret;
+		break;
+	}
+
+	if (dmaHeapHandle_ < 0)
+		LOG(DmaHeap, Error) << "Could not open any dmaHeap device";
+}
+
+/**
+ * \brief Destroy the dma-heap allocator
+ *
+ * All the buffers in the recycling pool are freed. Buffers previously
+ * allocated and not recycled remain valid.
+ */
+DmaHeap::~DmaHeap()
+{
+	clearPool();
+
+	if (dmaHeapHandle_ > -1)
+		::close(dmaHeapHandle_);
+}
+
+/**
+ * \fn DmaHeap::isValid()
+ * \brief Check if the dma-heap allocator is valid
+ * \return True if the allocator is valid, false otherwise
+ */
+
+/**
+ * \brief Allocate a dma-heap buffer
+ * \param[in] name The name to set for the allocated buffer
+ * \param[in] size The size of the buffer to allocate
+ *
+ * If the recycling pool contains a buffer large enough for \a size and not
+ * larger than 125% of \a size, it is reused and renamed to \a name. Otherwise
+ * a new buffer is allocated from the heap.
+ *
+ * \return The FileDescriptor of the allocated buffer, or an invalid
+ * FileDescriptor if the allocation failed
+ */
+FileDescriptor DmaHeap::alloc(const char *name, std::size_t size)
+{
+	int ret;
+
+	if (!name)
+		return FileDescriptor();
+
+	/* Reuse the smallest pooled buffer that fits with little waste. */
+	FileDescriptor fd;
+	{
+		MutexLocker locker(poolMutex_);
+
+		auto it = pool_.lower_bound(size);
+		if (it != pool_.end() && it->first <= size + size / 4) {
+			fd = std::move(it->second);
+			poolSize_ -= it->first;
+			pool_.erase(it);
+		}
+	}
+
+	if (fd.isValid()) {
+		ret = ::ioctl(fd.fd(), DMA_BUF_SET_NAME, name);
+		if (ret < 0)
+			LOG(DmaHeap, Warning) << "dmaHeap naming failure for "
+					      << name;
+
+		LOG(DmaHeap, Debug) << "Recycled buffer for " << name;
+
+		return fd;
+	}
+
+	struct dma_heap_allocation_data alloc = {};
+
+	alloc.len = size;
+	alloc.fd_flags = O_CLOEXEC | O_RDWR;
+
+	ret = ::ioctl(dmaHeapHandle_, DMA_HEAP_IOCTL_ALLOC, &alloc);
+
+	if (ret < 0) {
+		LOG(DmaHeap, Error) << "dmaHeap allocation failure for "
+				    << name;
+		return FileDescriptor();
+	}
+
+	ret = ::ioctl(alloc.fd, DMA_BUF_SET_NAME, name);
+	if (ret < 0) {
+		LOG(DmaHeap, Error) << "dmaHeap naming failure for "
+				    << name;
+		::close(alloc.fd);
+		return FileDescriptor();
+	}
+
+	return FileDescriptor(std::move(alloc.fd));
+}
+
+/**
+ * \brief Return a buffer to the recycling pool
+ * \param[in] fd The buffer file descriptor
+ *
+ * Add the buffer referenced by \a fd to the recycling pool if it fits within
+ * the pool size limit, or free it otherwise. The caller shall not use the
+ * buffer after recycling it, and shall ensure that no other reference to the
+ * dmabuf, such as a FrameBuffer or a V4L2 buffer, remains.
+ */
+void DmaHeap::recycle(FileDescriptor &&fd)
+{
+	if (!fd.isValid())
+		return;
+
+	off_t size = lseek(fd.fd(), 0, SEEK_END);
+
+	MutexLocker locker(poolMutex_);
+
+	if (size < 0 || poolSize_ + size > poolLimit_)
+		return;
+
+	poolSize_ += size;
+	pool_.emplace(size, std::move(fd));
+}
+
+/**
+ * \brief Retrieve the recycling pool size limit
+ * \return The maximum total size of the buffers in the recycling pool, in bytes
+ */
+std::size_t DmaHeap::poolLimit() const
+{
+	MutexLocker locker(poolMutex_);
+	return poolLimit_;
+}
+
+/**
+ * \brief Set the recycling pool size limit
+ * \param[in] limit The maximum total size of the pooled buffers, in bytes
+ *
+ * Setting the limit to 0 disables the recycling pool. Pooled buffers that
+ * exceed the new limit are freed.
+ */
+void DmaHeap::setPoolLimit(std::size_t limit)
+{
+	MutexLocker locker(poolMutex_);
+	poolLimit_ = limit;
+	trimPool(limit);
+}
+
+/**
+ * \brief Retrieve the total size of the buffers in the recycling pool
+ * \return The total size of the pooled buffers, in bytes
+ */
+std::size_t DmaHeap::poolSize() const
+{
+	MutexLocker locker(poolMutex_);
+	return poolSize_;
+}
+
+/**
+ * \brief Free all the buffers in the recycling pool
+ */
+void DmaHeap::clearPool()
+{
+	MutexLocker locker(poolMutex_);
+	trimPool(0);
+}
+
+void DmaHeap::trimPool(std::size_t limit)
+{
+	/* Free the largest buffers first. */
+	while (poolSize_ > limit) {
+		auto it = std::prev(pool_.end());
+		poolSize_ -= it->first;
+		pool_.erase(it);
+	}
+}
+
+} /* namespace libcamera */
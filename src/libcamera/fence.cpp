@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * fence.cpp - Synchronization fence
+ */
+
+#include <libcamera/fence.h>
+
+/**
+ * \file fence.h
+ * \brief Synchronization fence
+ */
+
+namespace libcamera {
+
+/**
+ * \class Fence
+ * \brief Synchronization primitive to manage resources
+ *
+ * A Fence wraps a file descriptor that becomes readable when the resource it
+ * guards is available, such as a sync_file produced by a display or a GPU
+ * that still accesses a buffer. Applications associate a Fence with a
+ * FrameBuffer when adding it to a Request with Request::addBuffer(). libcamera
+ * then waits for the fence to be signalled, without blocking any thread,
+ * before queueing the request to the hardware.
+ *
+ * If the fence is signalled in time, it is consumed and destroyed by
+ * libcamera. Otherwise the request is cancelled, and the fence is handed back
+ * to the application, which retrieves it with FrameBuffer::releaseFence().
+ */
+
+/**
+ * \brief Create a Fence
+ * \param[in] fd The fence file descriptor
+ *
+ * The file descriptor ownership is shared with \a fd, see FileDescriptor.
+ */
+Fence::Fence(const FileDescriptor &fd)
+	: fd_(fd)
+{
+}
+
+/**
+ * \fn Fence::isValid()
+ * \brief Check if a Fence is valid
+ * \return True if the Fence wraps a valid file descriptor, false otherwise
+ */
+
+/**
+ * \fn Fence::fd()
+ * \brief Retrieve the fence file descriptor
+ * \return The fence file descriptor
+ */
+
+} /* namespace libcamera */
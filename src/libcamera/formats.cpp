@@ -9,6 +9,8 @@
 
 #include <algorithm>
 #include <errno.h>
+#include <iterator>
+#include <stdint.h>
 
 #include <libcamera/base/log.h>
 
@@ -39,6 +41,38 @@ LOG_DEFINE_CATEGORY(Formats)
  * to the number of rows of pixels in the plane.
  */
 
+/**
+ * \struct FrameLayout
+ * \brief Layout of a frame stored contiguously in memory
+ *
+ * The FrameLayout structure describes how the planes of a frame are laid out
+ * in a single memory buffer, as computed by PixelFormatInfo::frameLayout().
+ *
+ * \var FrameLayout::numPlanes
+ * \brief The number of planes in the frame
+ *
+ * \var FrameLayout::frameSize
+ * \brief The total size of the frame, in bytes
+ *
+ * \var FrameLayout::planes
+ * \brief The layout of each plane, only the first \a numPlanes entries are
+ * valid
+ */
+
+/**
+ * \struct FrameLayout::Plane
+ * \brief Layout of a plane in a frame
+ *
+ * \var FrameLayout::Plane::offset
+ * \brief The offset of the plane from the start of the frame, in bytes
+ *
+ * \var FrameLayout::Plane::stride
+ * \brief The number of bytes between the start of two consecutive lines
+ *
+ * \var FrameLayout::Plane::size
+ * \brief The size of the plane, in bytes
+ */
+
 /**
  * \class PixelFormatInfo
  * \brief Information about pixel formats
@@ -141,11 +175,11 @@ LOG_DEFINE_CATEGORY(Formats)
 
 namespace {
 
-const PixelFormatInfo pixelFormatInfoInvalid{};
+constexpr PixelFormatInfo pixelFormatInfoInvalid{};
 
-const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
+constexpr PixelFormatInfo pixelFormatInfo[] = {
 	/* RGB formats. */
-	{ formats::RGB565, {
+	{
 		.name = "RGB565",
 		.format = formats::RGB565,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_RGB565),
@@ -154,8 +188,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::RGB565_BE, {
+	},
+	{
 		.name = "RGB565_BE",
 		.format = formats::RGB565_BE,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_RGB565X),
@@ -164,8 +198,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::BGR888, {
+	},
+	{
 		.name = "BGR888",
 		.format = formats::BGR888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_RGB24),
@@ -174,8 +208,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::RGB888, {
+	},
+	{
 		.name = "RGB888",
 		.format = formats::RGB888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_BGR24),
@@ -184,8 +218,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::XRGB8888, {
+	},
+	{
 		.name = "XRGB8888",
 		.format = formats::XRGB8888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_XBGR32),
@@ -194,8 +228,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::XBGR8888, {
+	},
+	{
 		.name = "XBGR8888",
 		.format = formats::XBGR8888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_RGBX32),
@@ -204,8 +238,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::BGRX8888, {
+	},
+	{
 		.name = "BGRX8888",
 		.format = formats::BGRX8888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_XRGB32),
@@ -214,8 +248,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::ABGR8888, {
+	},
+	{
 		.name = "ABGR8888",
 		.format = formats::ABGR8888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_RGBA32),
@@ -224,8 +258,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::ARGB8888, {
+	},
+	{
 		.name = "ARGB8888",
 		.format = formats::ARGB8888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_ABGR32),
@@ -234,8 +268,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::BGRA8888, {
+	},
+	{
 		.name = "BGRA8888",
 		.format = formats::BGRA8888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_ARGB32),
@@ -244,8 +278,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::RGBA8888, {
+	},
+	{
 		.name = "RGBA8888",
 		.format = formats::RGBA8888,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_BGRA32),
@@ -254,10 +288,10 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
+	},
 
 	/* YUV packed formats. */
-	{ formats::YUYV, {
+	{
 		.name = "YUYV",
 		.format = formats::YUYV,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_YUYV),
@@ -266,8 +300,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::YVYU, {
+	},
+	{
 		.name = "YVYU",
 		.format = formats::YVYU,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_YVYU),
@@ -276,8 +310,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::UYVY, {
+	},
+	{
 		.name = "UYVY",
 		.format = formats::UYVY,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_UYVY),
@@ -286,8 +320,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::VYUY, {
+	},
+	{
 		.name = "VYUY",
 		.format = formats::VYUY,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_VYUY),
@@ -296,10 +330,10 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
+	},
 
 	/* YUV planar formats. */
-	{ formats::NV12, {
+	{
 		.name = "NV12",
 		.format = formats::NV12,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_NV12),
@@ -308,8 +342,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }},
-	} },
-	{ formats::NV21, {
+	},
+	{
 		.name = "NV21",
 		.format = formats::NV21,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_NV21),
@@ -318,8 +352,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }},
-	} },
-	{ formats::NV16, {
+	},
+	{
 		.name = "NV16",
 		.format = formats::NV16,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_NV16),
@@ -328,8 +362,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 2, 1 }, { 0, 0 } }},
-	} },
-	{ formats::NV61, {
+	},
+	{
 		.name = "NV61",
 		.format = formats::NV61,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_NV61),
@@ -338,8 +372,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 2, 1 }, { 0, 0 } }},
-	} },
-	{ formats::NV24, {
+	},
+	{
 		.name = "NV24",
 		.format = formats::NV24,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_NV24),
@@ -348,8 +382,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 1, 1 }, { 2, 1 }, { 0, 0 } }},
-	} },
-	{ formats::NV42, {
+	},
+	{
 		.name = "NV42",
 		.format = formats::NV42,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_NV42),
@@ -358,8 +392,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 1, 1 }, { 2, 1 }, { 0, 0 } }},
-	} },
-	{ formats::YUV420, {
+	},
+	{
 		.name = "YUV420",
 		.format = formats::YUV420,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_YUV420),
@@ -368,8 +402,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 1, 2 }, { 1, 2 } }},
-	} },
-	{ formats::YVU420, {
+	},
+	{
 		.name = "YVU420",
 		.format = formats::YVU420,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_YVU420),
@@ -378,8 +412,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 1, 2 }, { 1, 2 } }},
-	} },
-	{ formats::YUV422, {
+	},
+	{
 		.name = "YUV422",
 		.format = formats::YUV422,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_YUV422P),
@@ -388,10 +422,10 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 1, 1 }, { 1, 1 } }},
-	} },
+	},
 
 	/* Greyscale formats. */
-	{ formats::R8, {
+	{
 		.name = "R8",
 		.format = formats::R8,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_GREY),
@@ -400,10 +434,10 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 1, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
+	},
 
 	/* Bayer formats. */
-	{ formats::SBGGR8, {
+	{
 		.name = "SBGGR8",
 		.format = formats::SBGGR8,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SBGGR8),
@@ -412,8 +446,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGBRG8, {
+	},
+	{
 		.name = "SGBRG8",
 		.format = formats::SGBRG8,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGBRG8),
@@ -422,8 +456,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGRBG8, {
+	},
+	{
 		.name = "SGRBG8",
 		.format = formats::SGRBG8,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG8),
@@ -432,8 +466,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SRGGB8, {
+	},
+	{
 		.name = "SRGGB8",
 		.format = formats::SRGGB8,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SRGGB8),
@@ -442,8 +476,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SBGGR10, {
+	},
+	{
 		.name = "SBGGR10",
 		.format = formats::SBGGR10,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SBGGR10),
@@ -452,8 +486,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGBRG10, {
+	},
+	{
 		.name = "SGBRG10",
 		.format = formats::SGBRG10,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGBRG10),
@@ -462,8 +496,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGRBG10, {
+	},
+	{
 		.name = "SGRBG10",
 		.format = formats::SGRBG10,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG10),
@@ -472,8 +506,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SRGGB10, {
+	},
+	{
 		.name = "SRGGB10",
 		.format = formats::SRGGB10,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SRGGB10),
@@ -482,8 +516,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SBGGR10_CSI2P, {
+	},
+	{
 		.name = "SBGGR10_CSI2P",
 		.format = formats::SBGGR10_CSI2P,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SBGGR10P),
@@ -492,8 +526,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 4,
 		.planes = {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGBRG10_CSI2P, {
+	},
+	{
 		.name = "SGBRG10_CSI2P",
 		.format = formats::SGBRG10_CSI2P,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGBRG10P),
@@ -502,8 +536,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 4,
 		.planes = {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGRBG10_CSI2P, {
+	},
+	{
 		.name = "SGRBG10_CSI2P",
 		.format = formats::SGRBG10_CSI2P,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG10P),
@@ -512,8 +546,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 4,
 		.planes = {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SRGGB10_CSI2P, {
+	},
+	{
 		.name = "SRGGB10_CSI2P",
 		.format = formats::SRGGB10_CSI2P,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SRGGB10P),
@@ -522,8 +556,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 4,
 		.planes = {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SBGGR12, {
+	},
+	{
 		.name = "SBGGR12",
 		.format = formats::SBGGR12,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SBGGR12),
@@ -532,8 +566,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGBRG12, {
+	},
+	{
 		.name = "SGBRG12",
 		.format = formats::SGBRG12,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGBRG12),
@@ -542,8 +576,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGRBG12, {
+	},
+	{
 		.name = "SGRBG12",
 		.format = formats::SGRBG12,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG12),
@@ -552,8 +586,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SRGGB12, {
+	},
+	{
 		.name = "SRGGB12",
 		.format = formats::SRGGB12,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SRGGB12),
@@ -562,8 +596,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SBGGR12_CSI2P, {
+	},
+	{
 		.name = "SBGGR12_CSI2P",
 		.format = formats::SBGGR12_CSI2P,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SBGGR12P),
@@ -572,8 +606,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGBRG12_CSI2P, {
+	},
+	{
 		.name = "SGBRG12_CSI2P",
 		.format = formats::SGBRG12_CSI2P,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGBRG12P),
@@ -582,8 +616,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGRBG12_CSI2P, {
+	},
+	{
 		.name = "SGRBG12_CSI2P",
 		.format = formats::SGRBG12_CSI2P,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG12P),
@@ -592,8 +626,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SRGGB12_CSI2P, {
+	},
+	{
 		.name = "SRGGB12_CSI2P",
 		.format = formats::SRGGB12_CSI2P,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SRGGB12P),
@@ -602,8 +636,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SBGGR16, {
+	},
+	{
 		.name = "SBGGR16",
 		.format = formats::SBGGR16,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SBGGR16),
@@ -612,8 +646,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGBRG16, {
+	},
+	{
 		.name = "SGBRG16",
 		.format = formats::SGBRG16,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGBRG16),
@@ -622,8 +656,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGRBG16, {
+	},
+	{
 		.name = "SGRBG16",
 		.format = formats::SGRBG16,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG16),
@@ -632,8 +666,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SRGGB16, {
+	},
+	{
 		.name = "SRGGB16",
 		.format = formats::SRGGB16,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_SRGGB16),
@@ -642,8 +676,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 2,
 		.planes = {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SBGGR10_IPU3, {
+	},
+	{
 		.name = "SBGGR10_IPU3",
 		.format = formats::SBGGR10_IPU3,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_IPU3_SBGGR10),
@@ -653,8 +687,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		/* \todo remember to double this in the ipu3 pipeline handler */
 		.pixelsPerGroup = 25,
 		.planes = {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGBRG10_IPU3, {
+	},
+	{
 		.name = "SGBRG10_IPU3",
 		.format = formats::SGBRG10_IPU3,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_IPU3_SGBRG10),
@@ -663,8 +697,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 25,
 		.planes = {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SGRBG10_IPU3, {
+	},
+	{
 		.name = "SGRBG10_IPU3",
 		.format = formats::SGRBG10_IPU3,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_IPU3_SGRBG10),
@@ -673,8 +707,8 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 25,
 		.planes = {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
-	{ formats::SRGGB10_IPU3, {
+	},
+	{
 		.name = "SRGGB10_IPU3",
 		.format = formats::SRGGB10_IPU3,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_IPU3_SRGGB10),
@@ -683,10 +717,10 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = true,
 		.pixelsPerGroup = 25,
 		.planes = {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
+	},
 
 	/* Compressed formats. */
-	{ formats::MJPEG, {
+	{
 		.name = "MJPEG",
 		.format = formats::MJPEG,
 		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_MJPEG),
@@ -695,9 +729,90 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.packed = false,
 		.pixelsPerGroup = 1,
 		.planes = {{ { 1, 1 }, { 0, 0 }, { 0, 0 } }},
-	} },
+	},
 };
 
+constexpr size_t kNumPixelFormats = std::size(pixelFormatInfo);
+
+constexpr int compareNames(const char *a, const char *b)
+{
+	for (; *a && *a == *b; ++a, ++b)
+		;
+
+	return static_cast<unsigned char>(*a) - static_cast<unsigned char>(*b);
+}
+
+constexpr bool lessByFormat(const PixelFormatInfo &a, const PixelFormatInfo &b)
+{
+	if (a.format.fourcc() != b.format.fourcc())
+		return a.format.fourcc() < b.format.fourcc();
+	return a.format.modifier() < b.format.modifier();
+}
+
+constexpr bool lessByV4L2Format(const PixelFormatInfo &a, const PixelFormatInfo &b)
+{
+	return a.v4l2Format.fourcc() < b.v4l2Format.fourcc();
+}
+
+constexpr bool lessByName(const PixelFormatInfo &a, const PixelFormatInfo &b)
+{
+	return compareNames(a.name, b.name) < 0;
+}
+
+/*
+ * Sort the indices of the pixelFormatInfo entries at compile time. The
+ * insertion sort is stable, when multiple entries share the same V4L2 format
+ * the first one in the table is thus found first by the lookups.
+ */
+template<typename Less>
+constexpr std::array<uint8_t, kNumPixelFormats> sortedIndices(Less less)
+{
+	std::array<uint8_t, kNumPixelFormats> indices{};
+
+	for (size_t i = 0; i < kNumPixelFormats; ++i) {
+		size_t j = i;
+		for (; j > 0 && less(pixelFormatInfo[i], pixelFormatInfo[indices[j - 1]]); --j)
+			indices[j] = indices[j - 1];
+		indices[j] = i;
+	}
+
+	return indices;
+}
+
+constexpr std::array<uint8_t, kNumPixelFormats> formatIndices = sortedIndices(lessByFormat);
+constexpr std::array<uint8_t, kNumPixelFormats> v4l2FormatIndices = sortedIndices(lessByV4L2Format);
+constexpr std::array<uint8_t, kNumPixelFormats> nameIndices = sortedIndices(lessByName);
+
+static_assert(kNumPixelFormats <= UINT8_MAX, "Too many pixel formats for the indices");
+
+/*
+ * Find the first entry in the \a indices that isn't less than the \a key,
+ * and return it if it matches the key.
+ */
+template<typename Compare>
+const PixelFormatInfo *find(const std::array<uint8_t, kNumPixelFormats> &indices,
+			    Compare compare)
+{
+	size_t first = 0;
+	size_t count = kNumPixelFormats;
+
+	while (count > 0) {
+		size_t step = count / 2;
+		if (compare(pixelFormatInfo[indices[first + step]]) < 0) {
+			first += step + 1;
+			count -= step + 1;
+		} else {
+			count = step;
+		}
+	}
+
+	if (first == kNumPixelFormats ||
+	    compare(pixelFormatInfo[indices[first]]) != 0)
+		return nullptr;
+
+	return &pixelFormatInfo[indices[first]];
+}
+
 } /* namespace */
 
 /**
@@ -714,15 +829,21 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
  */
 const PixelFormatInfo &PixelFormatInfo::info(const PixelFormat &format)
 {
-	const auto iter = pixelFormatInfo.find(format);
-	if (iter == pixelFormatInfo.end()) {
+	const PixelFormatInfo *info = find(formatIndices, [&](const PixelFormatInfo &entry) {
+		if (entry.format.fourcc() != format.fourcc())
+			return entry.format.fourcc() < format.fourcc() ? -1 : 1;
+		if (entry.format.modifier() != format.modifier())
+			return entry.format.modifier() < format.modifier() ? -1 : 1;
+		return 0;
+	});
+	if (!info) {
 		LOG(Formats, Warning)
 			<< "Unsupported pixel format 0x"
 			<< utils::hex(format.fourcc());
 		return pixelFormatInfoInvalid;
 	}
 
-	return iter->second;
+	return *info;
 }
 
 /**
@@ -733,14 +854,15 @@ const PixelFormatInfo &PixelFormatInfo::info(const PixelFormat &format)
  */
 const PixelFormatInfo &PixelFormatInfo::info(const V4L2PixelFormat &format)
 {
-	const auto &info = std::find_if(pixelFormatInfo.begin(), pixelFormatInfo.end(),
-					[format](auto pair) {
-						return pair.second.v4l2Format == format;
-					});
-	if (info == pixelFormatInfo.end())
+	const PixelFormatInfo *info = find(v4l2FormatIndices, [&](const PixelFormatInfo &entry) {
+		if (entry.v4l2Format.fourcc() != format.fourcc())
+			return entry.v4l2Format.fourcc() < format.fourcc() ? -1 : 1;
+		return 0;
+	});
+	if (!info)
 		return pixelFormatInfoInvalid;
 
-	return info->second;
+	return *info;
 }
 
 /**
@@ -751,12 +873,13 @@ const PixelFormatInfo &PixelFormatInfo::info(const V4L2PixelFormat &format)
  */
 const PixelFormatInfo &PixelFormatInfo::info(const std::string &name)
 {
-	for (const auto &info : pixelFormatInfo) {
-		if (info.second.name == name)
-			return info.second;
-	}
+	const PixelFormatInfo *info = find(nameIndices, [&](const PixelFormatInfo &entry) {
+		return compareNames(entry.name, name.c_str());
+	});
+	if (!info)
+		return pixelFormatInfoInvalid;
 
-	return pixelFormatInfoInvalid;
+	return *info;
 }
 
 /**
@@ -819,17 +942,7 @@ unsigned int PixelFormatInfo::stride(unsigned int width, unsigned int plane,
  */
 unsigned int PixelFormatInfo::frameSize(const Size &size, unsigned int align) const
 {
-	/* stride * ceil(height / verticalSubSampling) */
-	unsigned int sum = 0;
-	for (unsigned int i = 0; i < 3; i++) {
-		unsigned int vertSubSample = planes[i].verticalSubSampling;
-		if (!vertSubSample)
-			continue;
-		sum += stride(size.width, i, align)
-		     * ((size.height + vertSubSample - 1) / vertSubSample);
-	}
-
-	return sum;
+	return frameLayout(size, align).frameSize;
 }
 
 /**
@@ -861,6 +974,47 @@ PixelFormatInfo::frameSize(const Size &size,
 	return sum;
 }
 
+/**
+ * \brief Compute the layout of a frame in memory
+ * \param[in] size The size of the frame, in pixels
+ * \param[in] align The stride alignment, in bytes (1 for default alignment)
+ *
+ * This function computes the stride, size and offset of all planes of a frame
+ * stored contiguously in memory, as well as the total frame size, in a single
+ * pass. It is equivalent to calling stride() for each plane and frameSize(),
+ * and should be preferred when more than one of those values is needed.
+ *
+ * \return The frame layout, with no plane and a zero frame size if the
+ * PixelFormatInfo instance is not valid
+ */
+FrameLayout PixelFormatInfo::frameLayout(const Size &size, unsigned int align) const
+{
+	FrameLayout layout{};
+
+	for (const PixelFormatPlaneInfo &plane : planes) {
+		if (!plane.bytesPerGroup)
+			break;
+
+		/* ceil(ceil(width / pixelsPerGroup) * bytesPerGroup / align) * align */
+		unsigned int stride = (size.width + pixelsPerGroup - 1) / pixelsPerGroup
+				    * plane.bytesPerGroup;
+		stride = (stride + align - 1) / align * align;
+
+		/* stride * ceil(height / verticalSubSampling) */
+		unsigned int vertSubSample = plane.verticalSubSampling;
+		unsigned int height = (size.height + vertSubSample - 1) / vertSubSample;
+
+		FrameLayout::Plane &layoutPlane = layout.planes[layout.numPlanes++];
+		layoutPlane.offset = layout.frameSize;
+		layoutPlane.stride = stride;
+		layoutPlane.size = stride * height;
+
+		layout.frameSize += layoutPlane.size;
+	}
+
+	return layout;
+}
+
 /**
  * \brief Retrieve the number of planes represented by the format
  * \return The number of planes used by the format
@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame_synchronizer.cpp - Timestamp-based pairing of requests from multiple cameras
+ */
+
+#include <libcamera/frame_synchronizer.h>
+
+#include <algorithm>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/request.h>
+
+/**
+ * \file frame_synchronizer.h
+ * \brief Timestamp-based pairing of requests from multiple cameras
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Camera)
+
+/**
+ * \class FrameSynchronizer
+ * \brief Group completed requests from multiple cameras by capture time
+ *
+ * When capturing from multiple cameras started together with
+ * CameraManager::startCameras(), applications such as stereo matching need to
+ * process the frames captured at the same time by all the cameras. Even when
+ * the cameras are synchronized, their requests complete independently, and a
+ * camera may drop frames. The FrameSynchronizer pairs completed requests based
+ * on their controls::SensorTimestamp metadata.
+ *
+ * The synchronizer is created for a number of cameras, each identified by an
+ * index. Completed requests are passed to addRequest() along with the index of
+ * their camera, typically from the Camera::requestCompleted signal handlers.
+ * When a set of requests, one per camera, whose timestamps all differ by at
+ * most the tolerance is available, the framesMatched signal is emitted with
+ * the requests ordered by camera index.
+ *
+ * Requests that can't be matched, because a frame is missing from another
+ * camera, because they have been cancelled, or because they carry no
+ * timestamp, are reported through the frameDropped signal. They are matched
+ * against the oldest frames of the other cameras only, so the synchronizer
+ * holds at most a few requests per camera.
+ *
+ * The application keeps ownership of the requests, and shall reuse or queue
+ * them again from the signal handlers.
+ *
+ * The FrameSynchronizer is not thread-safe. All its functions shall be called
+ * from the same thread, and the signals are emitted synchronously from
+ * addRequest() and flush().
+ */
+
+/**
+ * \var FrameSynchronizer::framesMatched
+ * \brief Signal emitted when a set of requests captured at the same time is
+ * available
+ *
+ * The vector contains one request per camera, ordered by camera index.
+ */
+
+/**
+ * \var FrameSynchronizer::frameDropped
+ * \brief Signal emitted when a request can't be matched
+ *
+ * The signal carries the camera index and the request.
+ */
+
+/**
+ * \brief Construct a FrameSynchronizer
+ * \param[in] numCameras The number of cameras to synchronize
+ * \param[in] tolerance The maximum difference between the timestamps of
+ * matching frames
+ *
+ * The \a tolerance should be smaller than half the frame duration, to ensure a
+ * frame can't be matched with two consecutive frames of another camera.
+ */
+FrameSynchronizer::FrameSynchronizer(unsigned int numCameras,
+				     std::chrono::nanoseconds tolerance)
+	: tolerance_(tolerance), queues_(numCameras)
+{
+	matched_.reserve(numCameras);
+}
+
+/**
+ * \fn FrameSynchronizer::numCameras()
+ * \brief Retrieve the number of cameras being synchronized
+ * \return The number of cameras
+ */
+
+/**
+ * \fn FrameSynchronizer::tolerance()
+ * \brief Retrieve the tolerance used to match timestamps
+ * \return The maximum difference between the timestamps of matching frames
+ */
+
+/**
+ * \brief Add a completed request to the synchronizer
+ * \param[in] index The index of the camera that completed the request
+ * \param[in] request The completed request
+ *
+ * Requests from one camera shall be added in completion order. This function
+ * may emit the framesMatched and frameDropped signals synchronously.
+ */
+void FrameSynchronizer::addRequest(unsigned int index, Request *request)
+{
+	if (index >= queues_.size()) {
+		LOG(Camera, Error) << "Invalid camera index " << index;
+		return;
+	}
+
+	const ControlList &metadata = request->metadata();
+	if (request->status() == Request::RequestCancelled ||
+	    !metadata.contains(controls::SensorTimestamp)) {
+		frameDropped.emit(index, request);
+		return;
+	}
+
+	queues_[index].push_back({ metadata.get(controls::SensorTimestamp),
+				   request });
+
+	match();
+}
+
+/**
+ * \brief Drop all the requests waiting for a match
+ *
+ * This function emits the frameDropped signal for all the requests held by
+ * the synchronizer. It shall be called when stopping the cameras.
+ */
+void FrameSynchronizer::flush()
+{
+	for (unsigned int i = 0; i < queues_.size(); ++i) {
+		std::deque<Frame> &queue = queues_[i];
+
+		while (!queue.empty()) {
+			Request *request = queue.front().request;
+			queue.pop_front();
+			frameDropped.emit(i, request);
+		}
+	}
+}
+
+void FrameSynchronizer::match()
+{
+	const int64_t tolerance = tolerance_.count();
+
+	while (true) {
+		/* A match requires one frame from every camera. */
+		for (const std::deque<Frame> &queue : queues_) {
+			if (queue.empty())
+				return;
+		}
+
+		/*
+		 * Drop the frames older than the most recent of the oldest
+		 * frames by more than the tolerance, they can't be matched
+		 * anymore.
+		 */
+		int64_t latest = 0;
+		for (const std::deque<Frame> &queue : queues_)
+			latest = std::max(latest, queue.front().timestamp);
+
+		bool dropped = false;
+		for (unsigned int i = 0; i < queues_.size(); ++i) {
+			std::deque<Frame> &queue = queues_[i];
+
+			while (!queue.empty() &&
+			       queue.front().timestamp < latest - tolerance) {
+				Request *request = queue.front().request;
+				queue.pop_front();
+				frameDropped.emit(i, request);
+				dropped = true;
+			}
+		}
+
+		if (dropped)
+			continue;
+
+		matched_.clear();
+		for (std::deque<Frame> &queue : queues_) {
+			matched_.push_back(queue.front().request);
+			queue.pop_front();
+		}
+
+		framesMatched.emit(matched_);
+	}
+}
+
+} /* namespace libcamera */
@@ -120,6 +120,88 @@ FrameBuffer::Private::Private()
  * handlers, it is called by the pipeline handlers themselves.
  */
 
+/**
+ * \fn FrameBuffer::Private::fence()
+ * \brief Retrieve the acquire fence associated with the buffer
+ *
+ * The fence is set by Request::addBuffer() and waited for before the request
+ * is queued to the device. It is reset when signalled.
+ *
+ * \return The acquire fence, or nullptr if the buffer has no fence
+ */
+
+/**
+ * \fn FrameBuffer::Private::setFence()
+ * \brief Set the acquire fence associated with the buffer
+ * \param[in] fence The acquire fence, or nullptr to reset it
+ */
+
+/**
+ * \brief Retrieve persistent CPU mappings of the frame buffer planes
+ * \param[in] flags The mapping flags
+ * \param[out] map The cached mapping
+ *
+ * This function maps the frame buffer with the \a flags the first time it is
+ * called, and returns the same mappings on subsequent calls with the same
+ * flags. The mappings are cached for the lifetime of the frame buffer, sparing
+ * the cost of mapping and unmapping the planes for every frame when the buffer
+ * is accessed repeatedly by the CPU.
+ *
+ * The mappings are unmapped when the frame buffer is destroyed. Callers shall
+ * not access them past the lifetime of the frame buffer.
+ *
+ * This function is thread-safe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int FrameBuffer::Private::map(MappedFrameBuffer::MapFlags flags,
+			      const MappedFrameBuffer **map) const
+{
+	MutexLocker locker(mapsLock_);
+
+	auto key = static_cast<MappedFrameBuffer::MapFlags::Type>(flags);
+	auto it = maps_.find(key);
+	if (it == maps_.end()) {
+		const FrameBuffer *const o = LIBCAMERA_O_PTR();
+		auto mapped = std::make_unique<MappedFrameBuffer>(o, flags);
+		if (!mapped->isValid())
+			return mapped->error();
+
+		it = maps_.emplace(key, std::move(mapped)).first;
+	}
+
+	*map = it->second.get();
+	return 0;
+}
+
+/**
+ * \brief Retrieve the dynamic metadata of the frame buffer for update
+ *
+ * Buffers are usually completed by a V4L2VideoDevice, which fills their
+ * metadata. Pipeline handlers that produce frames without a video device, such
+ * as software processing stages, use this function to fill the metadata before
+ * completing the buffer.
+ *
+ * \return The frame buffer dynamic metadata
+ */
+FrameMetadata &FrameBuffer::Private::metadata()
+{
+	FrameBuffer *const o = LIBCAMERA_O_PTR();
+	return o->metadata_;
+}
+
+/**
+ * \fn FrameBuffer::Private::setMemoryAllocation()
+ * \brief Account the memory of the buffer
+ * \param[in] allocation The MemoryTracker record of the buffer memory
+ *
+ * The \a allocation replaces the previous record of the buffer, if any, and is
+ * released when the buffer is destroyed.
+ *
+ * \sa MemoryTracker::track(FrameBuffer *buffer, const std::string &camera,
+ * const std::string &stream, MemoryUsage::Category category)
+ */
+
 /**
  * \class FrameBuffer
  * \brief Frame buffer data and its associated dynamic metadata
@@ -238,6 +320,23 @@ Request *FrameBuffer::request() const
  * libcamera core never modifies the buffer cookie.
  */
 
+/**
+ * \brief Extract the acquire fence associated with the buffer
+ *
+ * When a buffer is added to a Request with an acquire fence, libcamera waits
+ * for the fence to be signalled before using the buffer, and destroys the fence
+ * once signalled. If the fence isn't signalled in time, the request is
+ * cancelled and the fence stays attached to the buffer. Applications shall
+ * then retrieve it with this function, for instance to return it to the
+ * producer of the buffer.
+ *
+ * \return The acquire fence, or nullptr if the buffer has no fence
+ */
+std::unique_ptr<Fence> FrameBuffer::releaseFence()
+{
+	return std::move(_d()->fence_);
+}
+
 /**
  * \fn FrameBuffer::cancel()
  * \brief Marks the buffer as cancelled
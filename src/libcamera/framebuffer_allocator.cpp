@@ -15,6 +15,7 @@
 #include <libcamera/framebuffer.h>
 #include <libcamera/stream.h>
 
+#include "libcamera/internal/memory_tracker.h"
 #include "libcamera/internal/pipeline_handler.h"
 
 /**
@@ -93,11 +94,58 @@ int FrameBufferAllocator::allocate(Stream *stream)
 		return -EBUSY;
 	}
 
-	int ret = camera_->exportFrameBuffers(stream, &buffers_[stream]);
+	return allocate(stream, stream->configuration().bufferCount);
+}
+
+/**
+ * \brief Allocate a number of buffers for a configured stream
+ * \param[in] stream The stream to allocate buffers for
+ * \param[in] count The number of buffers to allocate
+ *
+ * Allocate \a count buffers suitable for capturing frames from the \a stream,
+ * in addition to the buffers already allocated for the stream, if any. This
+ * allows applications to allocate buffers incrementally, for instance to
+ * allocate a minimal number of buffers to shorten the time to first frame, and
+ * to grow the number of buffers later. The same conditions as for
+ * allocate(Stream *stream) apply, in particular the Camera shall be stopped.
+ * Growing the buffers thus requires stopping the camera.
+ *
+ * Buffers previously allocated for the \a stream remain valid, and the newly
+ * allocated buffers are appended to the buffers returned by buffers().
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ * \retval -EACCES The camera is not in a state where buffers can be allocated
+ * \retval -EINVAL The \a stream does not belong to the camera, the stream is
+ * not part of the active camera configuration, or \a count is zero
+ */
+int FrameBufferAllocator::allocate(Stream *stream, unsigned int count)
+{
+	if (!count)
+		return -EINVAL;
+
+	/*
+	 * Export into a separate vector, as pipeline handlers expect an empty
+	 * vector and may clear it on error.
+	 */
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+	int ret = camera_->exportFrameBuffers(stream, count, &buffers);
 	if (ret == -EINVAL)
 		LOG(Allocator, Error)
 			<< "Stream is not part of " << camera_->id()
 			<< " active configuration";
+	if (ret < 0)
+		return ret;
+
+	const std::string streamName = stream->configuration().toString();
+
+	std::vector<std::unique_ptr<FrameBuffer>> &streamBuffers = buffers_[stream];
+	for (std::unique_ptr<FrameBuffer> &buffer : buffers) {
+		MemoryTracker::track(buffer.get(), camera_->id(), streamName,
+				     MemoryUsage::Category::FrameBuffers);
+		streamBuffers.push_back(std::move(buffer));
+	}
+
 	return ret;
 }
 
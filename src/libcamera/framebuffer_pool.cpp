@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * framebuffer_pool.cpp - FrameBuffer pool shared between cameras
+ */
+
+#include <libcamera/framebuffer_pool.h>
+
+#include <errno.h>
+#include <map>
+#include <mutex>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/framebuffer.h>
+
+/**
+ * \file framebuffer_pool.h
+ * \brief FrameBuffer pool shared between cameras
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Allocator)
+
+class FrameBufferPool::Private : public Extensible::Private
+{
+	LIBCAMERA_DECLARE_PUBLIC(FrameBufferPool)
+
+public:
+	Private(const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
+
+	mutable std::mutex mutex_;
+	std::map<const FrameBuffer *, unsigned int> refCounts_;
+	std::vector<FrameBuffer *> free_;
+};
+
+FrameBufferPool::Private::Private(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+{
+	free_.reserve(buffers.size());
+
+	/* Store the buffers in reverse order to lend them in order. */
+	for (auto it = buffers.rbegin(); it != buffers.rend(); ++it) {
+		refCounts_[it->get()] = 0;
+		free_.push_back(it->get());
+	}
+}
+
+/**
+ * \class FrameBufferPool
+ * \brief A pool of frame buffers lent to requests of one or more cameras
+ *
+ * Applications that operate multiple cameras, or multiple streams, with
+ * compatible configurations often don't need a dedicated set of buffers for
+ * each of them, as the buffers are processed and recycled at a rate that
+ * allows a smaller number of buffers to circulate. Allocating a single set of
+ * buffers with a FrameBufferAllocator and sharing them through a
+ * FrameBufferPool reduces the memory footprint accordingly.
+ *
+ * The FrameBufferPool lends buffers to its users. A buffer is acquired from
+ * the pool with acquire(), added to a Request for any of the cameras sharing
+ * the pool, and returned to the pool with release() once the request has
+ * completed and the buffer contents have been consumed.
+ *
+ * Lending is reference-counted. A buffer acquired from the pool can be shared
+ * with additional users, such as the consumers of the frame it contains, by
+ * taking a reference with ref(). Every reference is dropped with release(),
+ * and the buffer returns to the pool when its last reference is released.
+ * The pool doesn't arbitrate accesses to the buffer memory between its users.
+ * In particular, a buffer shall not be added to a Request while other users
+ * are reading its contents.
+ *
+ * The pool doesn't own the buffers. They shall remain valid, and shall not be
+ * freed with FrameBufferAllocator::free(), for the lifetime of the pool. All
+ * buffers shall have a size and format compatible with the configuration of
+ * every stream they are used with.
+ *
+ * The FrameBufferPool is thread-safe, and is typically shared between its
+ * users through a std::shared_ptr.
+ */
+
+/**
+ * \brief Construct a FrameBufferPool lending \a buffers
+ * \param[in] buffers The buffers to lend
+ */
+FrameBufferPool::FrameBufferPool(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+	: Extensible(new Private(buffers))
+{
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+	const Private *const d = _d();
+
+	if (d->free_.size() != d->refCounts_.size())
+		LOG(Allocator, Warning)
+			<< "Destroying pool with "
+			<< d->refCounts_.size() - d->free_.size()
+			<< " buffers still lent";
+}
+
+/**
+ * \brief Acquire a free buffer from the pool
+ *
+ * Buffers are lent in the reverse order of their release, to maximize reuse of
+ * the buffers most recently used, whose mappings are most likely to be cached
+ * by the cameras. The buffer is lent with a single reference held by the
+ * caller.
+ *
+ * \return A free buffer, or nullptr if all buffers are lent
+ */
+FrameBuffer *FrameBufferPool::acquire()
+{
+	Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	if (d->free_.empty())
+		return nullptr;
+
+	FrameBuffer *buffer = d->free_.back();
+	d->free_.pop_back();
+	d->refCounts_[buffer] = 1;
+
+	return buffer;
+}
+
+/**
+ * \brief Take an additional reference to a lent buffer
+ * \param[in] buffer The buffer to reference
+ *
+ * The \a buffer stays lent until the reference is dropped with release(), in
+ * addition to all the other references.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a buffer doesn't belong to the pool or isn't lent
+ */
+int FrameBufferPool::ref(FrameBuffer *buffer)
+{
+	Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	auto it = d->refCounts_.find(buffer);
+	if (it == d->refCounts_.end() || !it->second) {
+		LOG(Allocator, Error) << "Buffer not lent by the pool";
+		return -EINVAL;
+	}
+
+	it->second++;
+
+	return 0;
+}
+
+/**
+ * \brief Drop a reference to a lent buffer
+ * \param[in] buffer The buffer to release
+ *
+ * The \a buffer returns to the pool when its last reference is released.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a buffer doesn't belong to the pool or isn't lent
+ */
+int FrameBufferPool::release(FrameBuffer *buffer)
+{
+	Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	auto it = d->refCounts_.find(buffer);
+	if (it == d->refCounts_.end() || !it->second) {
+		LOG(Allocator, Error) << "Buffer not lent by the pool";
+		return -EINVAL;
+	}
+
+	if (--it->second == 0)
+		d->free_.push_back(buffer);
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the number of buffers in the pool
+ * \return The total number of buffers, free or lent
+ */
+unsigned int FrameBufferPool::size() const
+{
+	return _d()->refCounts_.size();
+}
+
+/**
+ * \brief Retrieve the number of free buffers in the pool
+ * \return The number of buffers available for acquire()
+ */
+unsigned int FrameBufferPool::available() const
+{
+	const Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	return d->free_.size();
+}
+
+/**
+ * \brief Retrieve the number of references to a buffer
+ * \param[in] buffer The buffer
+ * \return The number of references held on \a buffer, 0 if the buffer is free
+ * or doesn't belong to the pool
+ */
+unsigned int FrameBufferPool::refCount(const FrameBuffer *buffer) const
+{
+	const Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	auto it = d->refCounts_.find(buffer);
+	if (it == d->refCounts_.end())
+		return 0;
+
+	return it->second;
+}
+
+} /* namespace libcamera */
@@ -71,6 +71,14 @@
  * data section, and after the data section. They shall be ignored when parsing
  * the packet.
  *
+ * A ControlList packet may be delta-encoded relative to the previous
+ * ControlList packet sent with the same handle. Delta-encoded packets have a
+ * non-zero ipa_controls_header::base_sequence equal to the
+ * ipa_controls_header::sequence of the packet they are relative to, and only
+ * contain the controls that have been added or modified since that packet.
+ * Controls that have been removed are stored as entries of type
+ * ControlTypeNone with no value data.
+ *
  * The following diagram describes the layout of the ControlInfoMap packet.
  *
  * ~~~~
@@ -100,6 +108,16 @@
  *
  * The packet header is identical to the ControlList packet header.
  *
+ * A ControlInfoMap identical to one previously sent may be sent as a reference
+ * packet that only contains the header, with no entry. Reference packets have
+ * an ipa_controls_header::base_sequence equal to the handle of the
+ * ControlInfoMap they reference, which the receiver has cached.
+ *
+ * The sender bounds the number of ControlInfoMap it keeps cached. When a full
+ * ControlInfoMap packet replaces a cached map, its
+ * ipa_controls_header::sequence is set to the handle of the replaced map, which
+ * the receiver shall drop from its cache.
+ *
  * Entries are described by the ipa_control_info_entry structure. They contain
  * the numerical ID and type of the control. The control info data is stored
  * in the data section as described by the following diagram.
@@ -178,8 +196,15 @@
  * Offset in bytes from the beginning of the packet of the data section start
  * \var ipa_controls_header::id_map_type
  * The id map type as defined by the ipa_controls_id_map_type enumeration
- * \var ipa_controls_header::reserved
- * Reserved for future extensions
+ * \var ipa_controls_header::sequence
+ * For ControlList packets that can be used as the base of delta-encoded
+ * packets, a non-zero sequence number that increases with every packet sent
+ * with the same handle. For ControlInfoMap packets, the handle of a cached
+ * ControlInfoMap to drop, if any. 0 otherwise
+ * \var ipa_controls_header::base_sequence
+ * For delta-encoded ControlList packets, the sequence number of the packet the
+ * delta is relative to. For ControlInfoMap reference packets, the handle of
+ * the referenced ControlInfoMap. 0 otherwise
  */
 
 static_assert(sizeof(ipa_controls_header) == 32,
@@ -46,6 +46,21 @@ namespace {
  * generated IPA proxies.
  */
 
+/**
+ * \fn template<typename T> void writePOD(std::vector<uint8_t> &vec, size_t pos, T val)
+ * \brief Overwrite POD in byte vector, in little-endian order
+ * \tparam T Type of POD to write
+ * \param[in] vec Byte vector to write to
+ * \param[in] pos Index in \a vec to start writing at
+ * \param[in] val Value to write
+ *
+ * This function is meant to be used by the IPA data serializer, and the
+ * generated IPA proxies, to fill size fields that have been reserved with
+ * appendPOD() once the data they describe has been serialized.
+ *
+ * The \a pos plus the byte-width of \a val must not be past the end of \a vec.
+ */
+
 /**
  * \fn template<typename T> T readPOD(std::vector<uint8_t>::iterator it, size_t pos,
  * 				      std::vector<uint8_t>::iterator end)
@@ -100,6 +115,30 @@ namespace {
  * of \a data
  */
 
+/**
+ * \fn template<typename T> IPADataSerializer<T>::serialize(
+ * 	const T &data,
+ * 	std::vector<uint8_t> &dataVec,
+ * 	std::vector<int32_t> &fdsVec,
+ * 	ControlSerializer *cs = nullptr)
+ * \brief Serialize an object at the end of a byte vector and fd vector
+ * \tparam T Type of object to serialize
+ * \param[in] data Object to serialize
+ * \param[inout] dataVec Byte vector to append the serialized data to
+ * \param[inout] fdsVec Fd vector to append the serialized fds to
+ * \param[in] cs ControlSerializer
+ *
+ * This version of serialize() appends the serialized form of \a data to the
+ * caller-owned \a dataVec and \a fdsVec. Containers and structures serialize
+ * their members directly in the same vectors, without intermediate buffers,
+ * and the vectors can be reused across calls to avoid allocations.
+ *
+ * If serialization fails, \a dataVec and \a fdsVec are left unmodified.
+ *
+ * \a cs is only necessary if the object type \a T or its members contain
+ * ControlList or ControlInfoMap.
+ */
+
 /**
  * \fn template<typename T> IPADataSerializer<T>::deserialize(
  * 	const std::vector<uint8_t> &data,
@@ -187,15 +226,12 @@ namespace {
 #define DEFINE_POD_SERIALIZER(type)					\
 									\
 template<>								\
-std::tuple<std::vector<uint8_t>, std::vector<int32_t>>			\
-IPADataSerializer<type>::serialize(const type &data,			\
-				  [[maybe_unused]] ControlSerializer *cs) \
+void IPADataSerializer<type>::serialize(const type &data,		\
+					std::vector<uint8_t> &dataVec,	\
+					[[maybe_unused]] std::vector<int32_t> &fdsVec, \
+					[[maybe_unused]] ControlSerializer *cs) \
 {									\
-	std::vector<uint8_t> dataVec;					\
-	dataVec.reserve(sizeof(type));					\
 	appendPOD<type>(dataVec, data);					\
-									\
-	return { dataVec, {} };						\
 }									\
 									\
 template<>								\
@@ -249,11 +285,13 @@ DEFINE_POD_SERIALIZER(double)
  * function parameter serdes).
  */
 template<>
-std::tuple<std::vector<uint8_t>, std::vector<int32_t>>
+void
 IPADataSerializer<std::string>::serialize(const std::string &data,
+					  std::vector<uint8_t> &dataVec,
+					  [[maybe_unused]] std::vector<int32_t> &fdsVec,
 					  [[maybe_unused]] ControlSerializer *cs)
 {
-	return { { data.cbegin(), data.end() }, {} };
+	dataVec.insert(dataVec.end(), data.cbegin(), data.cend());
 }
 
 template<>
@@ -305,51 +343,56 @@ IPADataSerializer<std::string>::deserialize(std::vector<uint8_t>::const_iterator
  * be used. The serialized ControlInfoMap will have zero length.
  */
 template<>
-std::tuple<std::vector<uint8_t>, std::vector<int32_t>>
-IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerializer *cs)
+void
+IPADataSerializer<ControlList>::serialize(const ControlList &data,
+					  std::vector<uint8_t> &dataVec,
+					  [[maybe_unused]] std::vector<int32_t> &fdsVec,
+					  ControlSerializer *cs)
 {
 	if (!cs)
 		LOG(IPADataSerializer, Fatal)
 			<< "ControlSerializer not provided for serialization of ControlList";
 
-	size_t size;
-	std::vector<uint8_t> infoData;
+	/*
+	 * Serialize the ControlInfoMap and ControlList directly in the output
+	 * vector, after the two sizes.
+	 */
+	size_t offset = dataVec.size();
+	uint32_t infoDataSize = 0;
 	int ret;
 
+	dataVec.resize(offset + 8);
+
 	/*
 	 * \todo Revisit this opportunistic serialization of the
 	 * ControlInfoMap, as it could be fragile
 	 */
 	if (data.infoMap() && !cs->isCached(*data.infoMap())) {
-		size = cs->binarySize(*data.infoMap());
-		infoData.resize(size);
-		ByteStreamBuffer buffer(infoData.data(), infoData.size());
+		infoDataSize = cs->binarySize(*data.infoMap());
+		dataVec.resize(dataVec.size() + infoDataSize);
+		ByteStreamBuffer buffer(dataVec.data() + offset + 8, infoDataSize);
 		ret = cs->serialize(*data.infoMap(), buffer);
 
 		if (ret < 0 || buffer.overflow()) {
 			LOG(IPADataSerializer, Error) << "Failed to serialize ControlList's ControlInfoMap";
-			return { {}, {} };
+			dataVec.resize(offset);
+			return;
 		}
-	}
 
-	size = cs->binarySize(data);
-	std::vector<uint8_t> listData(size);
-	ByteStreamBuffer buffer(listData.data(), listData.size());
-	ret = cs->serialize(data, buffer);
+		infoDataSize = buffer.offset();
+		dataVec.resize(offset + 8 + infoDataSize);
+	}
 
-	if (ret < 0 || buffer.overflow()) {
+	ret = cs->serialize(data, dataVec);
+	if (ret < 0) {
 		LOG(IPADataSerializer, Error) << "Failed to serialize ControlList";
-		return { {}, {} };
+		dataVec.resize(offset);
+		return;
 	}
 
-	std::vector<uint8_t> dataVec;
-	dataVec.reserve(8 + infoData.size() + listData.size());
-	appendPOD<uint32_t>(dataVec, infoData.size());
-	appendPOD<uint32_t>(dataVec, listData.size());
-	dataVec.insert(dataVec.end(), infoData.begin(), infoData.end());
-	dataVec.insert(dataVec.end(), listData.begin(), listData.end());
-
-	return { dataVec, {} };
+	uint32_t listDataSize = dataVec.size() - offset - 8 - infoDataSize;
+	writePOD<uint32_t>(dataVec, offset, infoDataSize);
+	writePOD<uint32_t>(dataVec, offset + 4, listDataSize);
 }
 
 template<>
@@ -429,29 +472,34 @@ IPADataSerializer<ControlList>::deserialize(std::vector<uint8_t>::const_iterator
  * X bytes - Serialized ControlInfoMap (using ControlSerializer)
  */
 template<>
-std::tuple<std::vector<uint8_t>, std::vector<int32_t>>
+void
 IPADataSerializer<ControlInfoMap>::serialize(const ControlInfoMap &map,
+					     std::vector<uint8_t> &dataVec,
+					     [[maybe_unused]] std::vector<int32_t> &fdsVec,
 					     ControlSerializer *cs)
 {
 	if (!cs)
 		LOG(IPADataSerializer, Fatal)
 			<< "ControlSerializer not provided for serialization of ControlInfoMap";
 
+	size_t offset = dataVec.size();
 	size_t size = cs->binarySize(map);
-	std::vector<uint8_t> infoData(size);
-	ByteStreamBuffer buffer(infoData.data(), infoData.size());
+
+	appendPOD<uint32_t>(dataVec, size);
+	dataVec.resize(dataVec.size() + size);
+
+	ByteStreamBuffer buffer(dataVec.data() + offset + 4, size);
 	int ret = cs->serialize(map, buffer);
 
 	if (ret < 0 || buffer.overflow()) {
 		LOG(IPADataSerializer, Error) << "Failed to serialize ControlInfoMap";
-		return { {}, {} };
+		dataVec.resize(offset);
+		return;
 	}
 
-	std::vector<uint8_t> dataVec;
-	appendPOD<uint32_t>(dataVec, infoData.size());
-	dataVec.insert(dataVec.end(), infoData.begin(), infoData.end());
-
-	return { dataVec, {} };
+	/* References to serialized maps are smaller than the full map. */
+	dataVec.resize(offset + 4 + buffer.offset());
+	writePOD<uint32_t>(dataVec, offset, buffer.offset());
 }
 
 template<>
@@ -522,16 +570,15 @@ IPADataSerializer<ControlInfoMap>::deserialize(std::vector<uint8_t>::const_itera
  * 32-bit alignment of all serialized data
  */
 template<>
-std::tuple<std::vector<uint8_t>, std::vector<int32_t>>
+void
 IPADataSerializer<FileDescriptor>::serialize(const FileDescriptor &data,
+					     std::vector<uint8_t> &dataVec,
+					     std::vector<int32_t> &fdsVec,
 					     [[maybe_unused]] ControlSerializer *cs)
 {
-	std::vector<uint8_t> dataVec = { data.isValid() };
-	std::vector<int32_t> fdVec;
+	dataVec.push_back(data.isValid());
 	if (data.isValid())
-		fdVec.push_back(data.fd());
-
-	return { dataVec, fdVec };
+		fdsVec.push_back(data.fd());
 }
 
 template<>
@@ -565,23 +612,14 @@ FileDescriptor IPADataSerializer<FileDescriptor>::deserialize(const std::vector<
  * 4 bytes - uint32_t Length
  */
 template<>
-std::tuple<std::vector<uint8_t>, std::vector<int32_t>>
+void
 IPADataSerializer<FrameBuffer::Plane>::serialize(const FrameBuffer::Plane &data,
+						 std::vector<uint8_t> &dataVec,
+						 std::vector<int32_t> &fdsVec,
 						 [[maybe_unused]] ControlSerializer *cs)
 {
-	std::vector<uint8_t> dataVec;
-	std::vector<int32_t> fdsVec;
-
-	std::vector<uint8_t> fdBuf;
-	std::vector<int32_t> fdFds;
-	std::tie(fdBuf, fdFds) =
-		IPADataSerializer<FileDescriptor>::serialize(data.fd);
-	dataVec.insert(dataVec.end(), fdBuf.begin(), fdBuf.end());
-	fdsVec.insert(fdsVec.end(), fdFds.begin(), fdFds.end());
-
+	IPADataSerializer<FileDescriptor>::serialize(data.fd, dataVec, fdsVec);
 	appendPOD<uint32_t>(dataVec, data.length);
-
-	return { dataVec, fdsVec };
 }
 
 template<>
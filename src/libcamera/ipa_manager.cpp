@@ -14,10 +14,13 @@
 
 #include <libcamera/base/file.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
 #include <libcamera/base/utils.h>
 
 #include "libcamera/internal/ipa_module.h"
+#include "libcamera/internal/ipa_module_cache.h"
 #include "libcamera/internal/ipa_proxy.h"
+#include "libcamera/internal/ipc_pipe_shared_memory.h"
 #include "libcamera/internal/pipeline_handler.h"
 
 /**
@@ -93,6 +96,19 @@ LOG_DEFINE_CATEGORY(IPAManager)
  * serialized to Plain Old Data, either for the purpose of passing it to the IPA
  * context plain C API, or to transmit the data to the isolated process through
  * IPC.
+ *
+ * Parsing the IPA modules is costly. The IPA module information is stored in an
+ * IPAModuleCache and reused across runs for the modules that haven't changed.
+ * Signatures are verified every time a signed module is loaded, as the cache
+ * file can't be trusted to store their validity.
+ *
+ * Starting a proxy worker process and loading the IPA module in it takes time.
+ * When the LIBCAMERA_IPA_PRESPAWN_WORKERS environment variable is set, the
+ * manager starts one proxy worker for each isolated IPA module when the camera
+ * manager starts, before enumerating devices. The workers start up in parallel
+ * with the pipeline handlers matching, and are handed over to the IPA proxies
+ * when they are created. Workers not claimed once the pipeline handlers have
+ * been matched are terminated.
  */
 
 IPAManager *IPAManager::self_ = nullptr;
@@ -102,15 +118,52 @@ IPAManager *IPAManager::self_ = nullptr;
  *
  * The IPAManager class is meant to only be instantiated once, by the
  * CameraManager.
+ *
+ * IPA modules are not discovered when the IPAManager is constructed, but when
+ * the first IPA is created, and only the modules needed to find a match for
+ * the pipeline handler are then loaded.
  */
 IPAManager::IPAManager()
+	: discovered_(false), nextModule_(0), thread_(nullptr)
 {
 	if (self_)
 		LOG(IPAManager, Fatal)
 			<< "Multiple IPAManager objects are not allowed";
 
+	const char *reuse = utils::secure_getenv("LIBCAMERA_IPA_REUSE_WORKERS");
+	reuseWorkers_ = reuse && reuse[0] != '\0';
+
+	self_ = this;
+}
+
+IPAManager::~IPAManager()
+{
+	for (IPAModule *module : modules_)
+		delete module;
+
+	self_ = nullptr;
+}
+
+/**
+ * \brief Discover the IPA modules shared objects in the search paths
+ *
+ * Locate the shared objects in all IPA module search paths, in search order,
+ * without loading them. This is performed once, the first time IPA modules
+ * are needed.
+ */
+void IPAManager::discoverModules()
+{
+	if (discovered_)
+		return;
+
+	discovered_ = true;
+
 	unsigned int ipaCount = 0;
 
+	std::string cachePath = IPAModuleCache::defaultPath();
+	if (!cachePath.empty())
+		cache_ = std::make_unique<IPAModuleCache>(cachePath);
+
 	/* User-specified paths take precedence. */
 	const char *modulePaths = utils::secure_getenv("LIBCAMERA_IPA_MODULE_PATH");
 	if (modulePaths) {
@@ -148,16 +201,191 @@ IPAManager::IPAManager()
 	if (!ipaCount)
 		LOG(IPAManager, Warning)
 			<< "No IPA found in '" IPA_MODULE_DIR "'";
+}
 
-	self_ = this;
+/**
+ * \brief Load the next discovered IPA module
+ *
+ * Invalid IPA modules are skipped.
+ *
+ * \return The loaded IPA module, or nullptr if it is invalid or all modules
+ * have been loaded
+ */
+IPAModule *IPAManager::loadNextModule()
+{
+	if (nextModule_ >= moduleFiles_.size())
+		return nullptr;
+
+	const std::string &file = moduleFiles_[nextModule_++];
+
+	IPAModule *ipaModule = new IPAModule(file, cache_.get());
+	if (!ipaModule->isValid()) {
+		delete ipaModule;
+		return nullptr;
+	}
+
+	LOG(IPAManager, Debug) << "Loaded IPA module '" << file << "'";
+
+	modules_.push_back(ipaModule);
+
+	return ipaModule;
 }
 
-IPAManager::~IPAManager()
+/**
+ * \brief Create an IPC pipe to a proxy worker for an isolated IPA module
+ * \param[in] ipam The IPA module
+ * \param[in] workerPath The path to the proxy worker executable
+ *
+ * This function is used by IPA proxies to connect to their proxy worker. If a
+ * worker has been pre-spawned or released by a previous proxy for \a ipam with
+ * the same executable, in the calling thread, and is still running, its IPC
+ * pipe is handed over to the caller. Otherwise a new proxy worker process is
+ * started.
+ *
+ * \return The IPC pipe to the proxy worker, which the caller shall check with
+ * IPCPipe::isConnected()
+ */
+std::unique_ptr<IPCPipeSharedMemory>
+IPAManager::createIPCPipe(IPAModule *ipam, const std::string &workerPath)
 {
-	for (IPAModule *module : modules_)
-		delete module;
+	if (self_) {
+		MutexLocker locker(self_->workersLock_);
+
+		auto range = self_->workers_.equal_range(ipam);
+		for (auto iter = range.first; iter != range.second; ++iter) {
+			Worker &worker = iter->second;
+			if (worker.path != workerPath ||
+			    worker.thread != Thread::current())
+				continue;
 
-	self_ = nullptr;
+			std::unique_ptr<IPCPipeSharedMemory> pipe = std::move(worker.pipe);
+			self_->workers_.erase(iter);
+
+			if (!pipe->isConnected())
+				break;
+
+			LOG(IPAManager, Debug)
+				<< "Using idle proxy worker for " << ipam->path();
+			return pipe;
+		}
+	}
+
+	return std::make_unique<IPCPipeSharedMemory>(ipam->path().c_str(),
+						     workerPath.c_str());
+}
+
+/**
+ * \brief Check if proxy workers should be kept alive for reuse
+ *
+ * Proxy workers are terminated when their IPA proxy is destroyed, and a new
+ * worker process is started for the next proxy. When the
+ * LIBCAMERA_IPA_REUSE_WORKERS environment variable is set to a non-empty
+ * string, IPA proxies instead reset the IPA in their worker and hand the worker
+ * over to releaseIPCPipe(), for the next proxy of the same IPA module to avoid
+ * the cost of starting a new process. This is useful when pipeline handlers are
+ * recreated, for instance when cameras are unplugged and plugged back.
+ *
+ * \return True if proxy workers should be reused, false otherwise
+ */
+bool IPAManager::reuseWorkers()
+{
+	return self_ && self_->reuseWorkers_;
+}
+
+/**
+ * \brief Return an idle proxy worker for reuse
+ * \param[in] ipam The IPA module
+ * \param[in] workerPath The path to the proxy worker executable
+ * \param[in] pipe The IPC pipe to the proxy worker
+ *
+ * This function is used by IPA proxies when they are destroyed, after resetting
+ * the IPA in their worker, if reuseWorkers() returns true. The worker is kept
+ * alive to be handed over by createIPCPipe(), until releaseWorkers() is called.
+ *
+ * Only the workers of proxies destroyed in the camera manager thread are kept,
+ * the IPC pipes of the other workers are bound to pipeline handler threads that
+ * may stop before the workers are reused.
+ */
+void IPAManager::releaseIPCPipe(IPAModule *ipam, const std::string &workerPath,
+				std::unique_ptr<IPCPipeSharedMemory> pipe)
+{
+	if (!self_ || self_->thread_ != Thread::current() || !pipe->isConnected())
+		return;
+
+	MutexLocker locker(self_->workersLock_);
+	self_->workers_.emplace(ipam, Worker{ workerPath, Thread::current(), std::move(pipe) });
+}
+
+/**
+ * \brief Pre-spawn proxy workers for the isolated IPA modules
+ *
+ * When the LIBCAMERA_IPA_PRESPAWN_WORKERS environment variable is set to a
+ * non-empty string, start a proxy worker for each IPA module that requires
+ * isolation, to be handed over by createIPCPipe(). This function is called by
+ * the camera manager before enumerating devices, and shall be called from the
+ * thread the IPA proxies are created in.
+ */
+void IPAManager::startWorkers()
+{
+	thread_ = Thread::current();
+
+	const char *prespawn = utils::secure_getenv("LIBCAMERA_IPA_PRESPAWN_WORKERS");
+	if (!prespawn || prespawn[0] == '\0')
+		return;
+
+	/* All modules are candidates, load them. */
+	discoverModules();
+	while (nextModule_ < moduleFiles_.size())
+		loadNextModule();
+
+	if (cache_)
+		cache_->save();
+
+	for (IPAModule *m : modules_) {
+		if (isSignatureValid(m))
+			continue;
+
+		/* Proxy workers are named after the IPA module. */
+		std::string path = IPAProxy::resolvePath(std::string(m->info().name) +
+							 "_ipa_proxy");
+		if (path.empty())
+			continue;
+
+		auto pipe = std::make_unique<IPCPipeSharedMemory>(m->path().c_str(),
+								  path.c_str());
+		if (!pipe->isConnected()) {
+			LOG(IPAManager, Warning)
+				<< "Failed to pre-spawn proxy worker for "
+				<< m->path();
+			continue;
+		}
+
+		LOG(IPAManager, Debug)
+			<< "Pre-spawned proxy worker " << path << " for "
+			<< m->path();
+
+		MutexLocker locker(workersLock_);
+		workers_.emplace(m, Worker{ path, Thread::current(), std::move(pipe) });
+	}
+}
+
+/**
+ * \brief Terminate the idle proxy workers that haven't been claimed
+ *
+ * IPA proxies are created when pipeline handlers match devices. This function
+ * is called by the camera manager once all pipeline handlers have been matched
+ * to release the resources of the pre-spawned workers that are not needed, and
+ * when the camera manager stops to terminate the workers kept for reuse.
+ */
+void IPAManager::releaseWorkers()
+{
+	std::multimap<IPAModule *, Worker> workers;
+
+	{
+		MutexLocker locker(workersLock_);
+		workers = std::move(workers_);
+		workers_.clear();
+	}
 }
 
 /**
@@ -208,17 +436,17 @@ void IPAManager::parseDir(const char *libDir, unsigned int maxDepth,
 }
 
 /**
- * \brief Load IPA modules from a directory
+ * \brief Add the IPA modules from a directory
  * \param[in] libDir The directory to search for IPA modules
  * \param[in] maxDepth The maximum depth of sub-directories to search
  *
- * This function tries to create an IPAModule instance for every shared object
- * found in \a libDir, and skips invalid IPA modules.
+ * This function adds every shared object found in \a libDir to the list of IPA
+ * modules to be loaded on demand.
  *
  * Sub-directories are searched up to a depth of \a maxDepth. A \a maxDepth
  * value of 0 only searches the directory specified in \a libDir.
  *
- * \return Number of modules loaded by this call
+ * \return Number of shared objects found by this call
  */
 unsigned int IPAManager::addDir(const char *libDir, unsigned int maxDepth)
 {
@@ -229,21 +457,9 @@ unsigned int IPAManager::addDir(const char *libDir, unsigned int maxDepth)
 	/* Ensure a stable ordering of modules. */
 	std::sort(files.begin(), files.end());
 
-	unsigned int count = 0;
-	for (const std::string &file : files) {
-		IPAModule *ipaModule = new IPAModule(file);
-		if (!ipaModule->isValid()) {
-			delete ipaModule;
-			continue;
-		}
+	moduleFiles_.insert(moduleFiles_.end(), files.begin(), files.end());
 
-		LOG(IPAManager, Debug) << "Loaded IPA module '" << file << "'";
-
-		modules_.push_back(ipaModule);
-		count++;
-	}
-
-	return count;
+	return files.size();
 }
 
 /**
@@ -260,7 +476,23 @@ IPAModule *IPAManager::module(PipelineHandler *pipe, uint32_t minVersion,
 			return module;
 	}
 
-	return nullptr;
+	/*
+	 * The loaded modules precede the ones not loaded yet in search order,
+	 * load the remaining modules until one matches.
+	 */
+	discoverModules();
+
+	IPAModule *match = nullptr;
+	while (!match && nextModule_ < moduleFiles_.size()) {
+		IPAModule *module = loadNextModule();
+		if (module && module->match(pipe, minVersion, maxVersion))
+			match = module;
+	}
+
+	if (cache_)
+		cache_->save();
+
+	return match;
 }
 
 /**
@@ -285,6 +517,13 @@ bool IPAManager::isSignatureValid([[maybe_unused]] IPAModule *ipa) const
 		return false;
 	}
 
+	/* Skip hashing the module if it isn't signed. */
+	if (ipa->signature().empty()) {
+		LOG(IPAManager, Debug)
+			<< "IPA module " << ipa->path() << " is not signed";
+		return false;
+	}
+
 	File file{ ipa->path() };
 	if (!file.open(File::OpenModeFlag::ReadOnly))
 		return false;
@@ -25,6 +25,7 @@
 #include <libcamera/base/span.h>
 #include <libcamera/base/utils.h>
 
+#include "libcamera/internal/ipa_module_cache.h"
 #include "libcamera/internal/pipeline_handler.h"
 
 /**
@@ -247,19 +248,22 @@ Span<const uint8_t> elfLoadSymbol(Span<const uint8_t> elf, const char *symbol)
 /**
  * \brief Construct an IPAModule instance
  * \param[in] libPath path to IPA module shared object
+ * \param[in] cache The IPA module information cache (optional)
  *
  * Loads the IPAModuleInfo from the IPA module shared object at libPath.
  * The IPA module shared object file must be of the same endianness and
- * bitness as libcamera.
+ * bitness as libcamera. If a \a cache is given, the IPAModuleInfo is retrieved
+ * from the cache when the shared object hasn't changed, and stored in the
+ * cache otherwise.
  *
  * The caller shall call the isValid() function after constructing an
  * IPAModule instance to verify the validity of the IPAModule.
  */
-IPAModule::IPAModule(const std::string &libPath)
+IPAModule::IPAModule(const std::string &libPath, IPAModuleCache *cache)
 	: libPath_(libPath), valid_(false), loaded_(false),
 	  dlHandle_(nullptr), ipaCreate_(nullptr)
 {
-	if (loadIPAModuleInfo() < 0)
+	if (loadIPAModuleInfo(cache) < 0)
 		return;
 
 	valid_ = true;
@@ -271,7 +275,7 @@ IPAModule::~IPAModule()
 		dlclose(dlHandle_);
 }
 
-int IPAModule::loadIPAModuleInfo()
+int IPAModule::parseIPAModuleInfo()
 {
 	File file{ libPath_ };
 	if (!file.open(File::OpenModeFlag::ReadOnly)) {
@@ -295,6 +299,18 @@ int IPAModule::loadIPAModuleInfo()
 
 	memcpy(&info_, info.data(), info.size());
 
+	return 0;
+}
+
+int IPAModule::loadIPAModuleInfo(IPAModuleCache *cache)
+{
+	bool cached = cache && cache->lookup(libPath_, &info_);
+	if (!cached) {
+		int ret = parseIPAModuleInfo();
+		if (ret)
+			return ret;
+	}
+
 	if (info_.moduleAPIVersion != IPA_MODULE_API_VERSION) {
 		LOG(IPAModule, Error) << "IPA module API version mismatch";
 		return -EINVAL;
@@ -314,6 +330,9 @@ int IPAModule::loadIPAModuleInfo()
 		return -EINVAL;
 	}
 
+	if (cache && !cached)
+		cache->store(libPath_, info_);
+
 	/* Load the signature. Failures are not fatal. */
 	File sign{ libPath_ + ".sign" };
 	if (!sign.open(File::OpenModeFlag::ReadOnly)) {
@@ -322,7 +341,7 @@ int IPAModule::loadIPAModuleInfo()
 		return 0;
 	}
 
-	data = sign.map(0, -1, File::MapFlag::Private);
+	Span<const uint8_t> data = sign.map(0, -1, File::MapFlag::Private);
 	signature_.resize(data.size());
 	memcpy(signature_.data(), data.data(), data.size());
 
@@ -0,0 +1,366 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_module_cache.cpp - Persistent cache of IPA module information
+ */
+
+#include "libcamera/internal/ipa_module_cache.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/file.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file ipa_module_cache.h
+ * \brief Persistent cache of IPA module information
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPAModuleCache)
+
+namespace {
+
+constexpr char CacheMagic[8] = { 'L', 'C', 'I', 'P', 'A', 'M', 'C', '2' };
+
+template<typename T>
+void append(std::vector<uint8_t> &data, const T &value)
+{
+	const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&value);
+	data.insert(data.end(), ptr, ptr + sizeof(value));
+}
+
+} /* namespace */
+
+/**
+ * \class IPAModuleCache
+ * \brief Cache the information of IPA modules on disk
+ *
+ * Creating an IPAModule requires mapping the module shared object and parsing
+ * its ELF headers to locate the IPA module information. The IPAModuleCache
+ * stores the results in a file to skip the parsing for modules that haven't
+ * changed since the last time libcamera was started.
+ *
+ * Cache entries are keyed by the module path, and are valid as long as the
+ * device, inode, size, modification and change times of the module shared
+ * object are unchanged. The whole cache is discarded when the libcamera library
+ * itself changes, as the IPA module API version is part of the library.
+ *
+ * The cache file is only used if it is owned by the effective user and not
+ * writable by other users. As it can still be modified by any process running
+ * as that user, it doesn't store the validity of IPA module signatures, which
+ * are verified every time a signed module is loaded.
+ */
+
+/**
+ * \brief Construct an IPAModuleCache and load the cache file at \a path
+ * \param[in] path The path to the cache file
+ *
+ * A missing, stale or invalid cache file results in an empty cache.
+ */
+IPAModuleCache::IPAModuleCache(const std::string &path)
+	: path_(path), library_({}), dirty_(false)
+{
+	Dl_info info;
+	int ret = dladdr(reinterpret_cast<void *>(&IPAModuleCache::defaultPath),
+			 &info);
+	if (ret == 0 || !info.dli_fname) {
+		path_.clear();
+		return;
+	}
+
+	library_ = fileKey(info.dli_fname);
+
+	load();
+}
+
+/**
+ * \brief Retrieve the default path of the IPA module cache file
+ *
+ * The cache file path is specified by the LIBCAMERA_IPA_MODULE_CACHE
+ * environment variable. An empty value disables the cache. If the variable
+ * isn't set, the cache is stored in libcamera/ipa_modules.cache in the user
+ * cache directory, as specified by XDG_CACHE_HOME, or $HOME/.cache by default.
+ *
+ * \return The path to the cache file, or an empty string if the cache is
+ * disabled
+ */
+std::string IPAModuleCache::defaultPath()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_IPA_MODULE_CACHE");
+	if (path)
+		return path;
+
+	const char *cacheHome = utils::secure_getenv("XDG_CACHE_HOME");
+	if (cacheHome && cacheHome[0] != '\0')
+		return std::string(cacheHome) + "/libcamera/ipa_modules.cache";
+
+	const char *home = utils::secure_getenv("HOME");
+	if (home && home[0] != '\0')
+		return std::string(home) + "/.cache/libcamera/ipa_modules.cache";
+
+	return std::string();
+}
+
+/**
+ * \fn IPAModuleCache::path()
+ * \brief Retrieve the path to the cache file
+ * \return The path to the cache file
+ */
+
+/**
+ * \brief Look up the information of an IPA module in the cache
+ * \param[in] modulePath The path to the IPA module shared object
+ * \param[out] info The IPA module information
+ *
+ * \return True if a valid entry has been found for \a modulePath and \a info
+ * has been filled, false otherwise
+ */
+bool IPAModuleCache::lookup(const std::string &modulePath, IPAModuleInfo *info)
+{
+	Entry *entry = find(modulePath);
+	if (!entry)
+		return false;
+
+	*info = entry->info;
+	return true;
+}
+
+/**
+ * \brief Store the information of an IPA module in the cache
+ * \param[in] modulePath The path to the IPA module shared object
+ * \param[in] info The IPA module information
+ */
+void IPAModuleCache::store(const std::string &modulePath,
+			   const IPAModuleInfo &info)
+{
+	entries_[modulePath] = { fileKey(modulePath), info, true };
+	dirty_ = true;
+}
+
+/**
+ * \brief Write the cache to disk
+ *
+ * As IPA modules are loaded on demand, a run doesn't necessarily look up all
+ * the modules stored in the cache. The entries currently stored in the cache
+ * file, including the ones written by other processes since the cache was
+ * loaded, are merged with the entries of this cache. Entries of modules that
+ * have been removed or modified are dropped. The file is replaced atomically,
+ * and is not written if the cache hasn't been modified.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPAModuleCache::save()
+{
+	if (!dirty_ || path_.empty())
+		return 0;
+
+	/* Merge the entries stored on disk, the entries of this cache win. */
+	std::map<std::string, Entry> stored;
+	readFile(stored);
+	entries_.merge(stored);
+
+	for (auto it = entries_.begin(); it != entries_.end();) {
+		const Entry &entry = it->second;
+
+		if (!entry.used && entry.module != fileKey(it->first))
+			it = entries_.erase(it);
+		else
+			++it;
+	}
+
+	std::vector<uint8_t> data;
+	uint32_t count = entries_.size();
+
+	data.insert(data.end(), CacheMagic, CacheMagic + sizeof(CacheMagic));
+	append(data, library_);
+	append(data, count);
+
+	for (const auto &[modulePath, entry] : entries_) {
+		append(data, entry.module);
+		append(data, entry.info);
+		append(data, static_cast<uint32_t>(modulePath.size()));
+		data.insert(data.end(), modulePath.begin(), modulePath.end());
+	}
+
+	std::string dir = path_.substr(0, path_.rfind('/'));
+	if (!dir.empty() && mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+		int ret = -errno;
+		LOG(IPAModuleCache, Debug)
+			<< "Failed to create " << dir << ": " << strerror(-ret);
+		return ret;
+	}
+
+	std::string tmpPath = path_ + ".XXXXXX";
+	int fd = mkstemp(tmpPath.data());
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(IPAModuleCache, Debug)
+			<< "Failed to create " << tmpPath << ": " << strerror(-ret);
+		return ret;
+	}
+
+	int ret = 0;
+	size_t offset = 0;
+
+	while (offset < data.size()) {
+		ssize_t len = write(fd, data.data() + offset, data.size() - offset);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+
+		offset += len;
+	}
+
+	close(fd);
+
+	if (!ret && rename(tmpPath.c_str(), path_.c_str()) < 0)
+		ret = -errno;
+
+	if (ret) {
+		LOG(IPAModuleCache, Debug)
+			<< "Failed to write " << path_ << ": " << strerror(-ret);
+		unlink(tmpPath.c_str());
+		return ret;
+	}
+
+	dirty_ = false;
+
+	return 0;
+}
+
+bool IPAModuleCache::FileKey::operator==(const FileKey &other) const
+{
+	return dev == other.dev && ino == other.ino && size == other.size &&
+	       mtime == other.mtime && ctime == other.ctime;
+}
+
+IPAModuleCache::FileKey IPAModuleCache::fileKey(const std::string &path)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st) < 0)
+		return {};
+
+	FileKey key;
+	key.dev = st.st_dev;
+	key.ino = st.st_ino;
+	key.size = st.st_size;
+	key.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	key.ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+
+	return key;
+}
+
+void IPAModuleCache::load()
+{
+	if (path_.empty())
+		return;
+
+	readFile(entries_);
+
+	LOG(IPAModuleCache, Debug)
+		<< "Loaded " << entries_.size() << " entries from " << path_;
+}
+
+void IPAModuleCache::readFile(std::map<std::string, Entry> &entries) const
+{
+	if (path_.empty())
+		return;
+
+	File file{ path_ };
+	if (!file.open(File::OpenModeFlag::ReadOnly))
+		return;
+
+	struct stat st;
+	if (stat(path_.c_str(), &st) < 0)
+		return;
+
+	if (st.st_uid != geteuid() || st.st_mode & (S_IWGRP | S_IWOTH)) {
+		LOG(IPAModuleCache, Warning)
+			<< "Ignoring " << path_ << " with unsafe permissions";
+		return;
+	}
+
+	Span<const uint8_t> data = file.map(0, -1, File::MapFlag::Private);
+	size_t offset = 0;
+
+	auto read = [&](void *dst, size_t size) {
+		if (data.size() - offset < size)
+			return false;
+
+		memcpy(dst, data.data() + offset, size);
+		offset += size;
+		return true;
+	};
+
+	char magic[sizeof(CacheMagic)];
+	FileKey library;
+	uint32_t count;
+
+	if (!read(magic, sizeof(magic)) ||
+	    memcmp(magic, CacheMagic, sizeof(magic)) ||
+	    !read(&library, sizeof(library)) || library != library_ ||
+	    !read(&count, sizeof(count))) {
+		LOG(IPAModuleCache, Debug) << "Discarding stale " << path_;
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		Entry entry = {};
+		uint32_t length;
+
+		if (!read(&entry.module, sizeof(entry.module)) ||
+		    !read(&entry.info, sizeof(entry.info)) ||
+		    !read(&length, sizeof(length)) || length > PATH_MAX ||
+		    data.size() - offset < length) {
+			LOG(IPAModuleCache, Warning) << "Discarding invalid " << path_;
+			entries.clear();
+			return;
+		}
+
+		std::string modulePath(reinterpret_cast<const char *>(data.data() + offset),
+				       length);
+		offset += length;
+
+		/* Ensure the strings are terminated. */
+		entry.info.pipelineName[sizeof(entry.info.pipelineName) - 1] = '\0';
+		entry.info.name[sizeof(entry.info.name) - 1] = '\0';
+
+		entries[modulePath] = entry;
+	}
+}
+
+IPAModuleCache::Entry *IPAModuleCache::find(const std::string &modulePath)
+{
+	auto iter = entries_.find(modulePath);
+	if (iter == entries_.end())
+		return nullptr;
+
+	Entry &entry = iter->second;
+
+	if (entry.module != fileKey(modulePath)) {
+		entries_.erase(iter);
+		dirty_ = true;
+		return nullptr;
+	}
+
+	entry.used = true;
+
+	return &entry;
+}
+
+} /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/ipa_proxy.h"
 
+#include <sstream>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -16,6 +17,7 @@
 #include <libcamera/base/utils.h>
 
 #include "libcamera/internal/ipa_module.h"
+#include "libcamera/internal/tracepoints.h"
 
 /**
  * \file ipa_proxy.h
@@ -31,6 +33,9 @@ LOG_DEFINE_CATEGORY(IPAProxy)
  * \brief IPA Proxy
  *
  * Isolate IPA into separate process.
+ *
+ * The proxy also records statistics about the calls to the IPA module methods,
+ * see callStats().
  */
 
 /**
@@ -167,7 +172,7 @@ std::string IPAProxy::configurationFile(const std::string &name) const
  * \return The full path to the proxy worker executable, or an empty string if
  * no valid executable path
  */
-std::string IPAProxy::resolvePath(const std::string &file) const
+std::string IPAProxy::resolvePath(const std::string &file)
 {
 	std::string proxyFile = "/" + file;
 
@@ -238,4 +243,164 @@ std::string IPAProxy::resolvePath(const std::string &file) const
  * while still enabling events to complete when the IPAProxy is stopping.
  */
 
+/**
+ * \struct IPAProxy::CallStats
+ * \brief Statistics about the calls to an IPA module method
+ *
+ * The number of calls is given by the number of measurements in the latency
+ * histogram.
+ *
+ * \var IPAProxy::CallStats::name
+ * \brief The method name
+ *
+ * \var IPAProxy::CallStats::bytesSent
+ * \brief The amount of serialized data sent to the IPA module, in bytes
+ *
+ * The IPA payload is only serialized when the IPA module is isolated, this
+ * field is always zero for threaded IPA modules.
+ *
+ * \var IPAProxy::CallStats::bytesReceived
+ * \brief The amount of serialized data received from the IPA module in reply
+ * to the calls, in bytes
+ *
+ * The IPA payload is only serialized when the IPA module is isolated, this
+ * field is always zero for threaded IPA modules.
+ *
+ * \var IPAProxy::CallStats::latency
+ * \brief The histogram of the call latencies
+ *
+ * The latency of synchronous calls is measured from the call to the proxy to
+ * its return, and includes the serialization and IPC costs for isolated IPA
+ * modules. The latency of asynchronous calls to threaded IPA modules is
+ * measured in the IPA thread and covers the processing of the call by the IPA
+ * module, excluding the time spent waiting in the thread message queue. For
+ * isolated IPA modules, the latency of asynchronous calls only covers their
+ * serialization and transmission to the proxy worker. The latency of the
+ * asynchronous variants of synchronous calls is measured until their reply is
+ * received.
+ */
+
+/**
+ * \fn IPAProxy::CallStats::CallStats()
+ * \brief Construct empty statistics for a method
+ * \param[in] method The method name
+ */
+
+/**
+ * \brief Retrieve the statistics of the calls to the IPA module methods
+ *
+ * The statistics are recorded for all methods of the IPA interface, in the
+ * order they are declared in the interface definition.
+ *
+ * \return A copy of the call statistics for all IPA interface methods
+ */
+std::vector<IPAProxy::CallStats> IPAProxy::callStats() const
+{
+	MutexLocker locker(statsLock_);
+	return callStats_;
+}
+
+/**
+ * \brief Discard the statistics of the calls to the IPA module methods
+ */
+void IPAProxy::resetCallStats()
+{
+	MutexLocker locker(statsLock_);
+
+	for (CallStats &stats : callStats_) {
+		stats.bytesSent = 0;
+		stats.bytesReceived = 0;
+		stats.latency.reset();
+	}
+}
+
+/**
+ * \brief Export the statistics of the calls in JSON format
+ *
+ * The statistics are exported as a JSON object containing one member per IPA
+ * interface method, named after the method. Each member is an object that
+ * contains the amount of data sent and received in bytes, and the latency
+ * histogram as documented in LatencyHistogram::toJson().
+ *
+ * \return A string containing the JSON representation of the call statistics
+ */
+std::string IPAProxy::callStatsToJson() const
+{
+	MutexLocker locker(statsLock_);
+	std::ostringstream ss;
+
+	ss << "{";
+
+	for (unsigned int i = 0; i < callStats_.size(); i++) {
+		const CallStats &stats = callStats_[i];
+
+		ss << (i ? ", " : " ") << "\"" << stats.name << "\": { "
+		   << "\"bytesSent\": " << stats.bytesSent << ", "
+		   << "\"bytesReceived\": " << stats.bytesReceived << ", "
+		   << "\"latency\": " << stats.latency.toJson() << " }";
+	}
+
+	ss << " }";
+
+	return ss.str();
+}
+
+/**
+ * \brief Initialize the statistics of the calls to the IPA module methods
+ * \param[in] methods The IPA interface method names
+ *
+ * This function is meant to be called by the generated proxies at
+ * construction time. The \a methods index is used to identify the method with
+ * CallScope.
+ */
+void IPAProxy::initCallStats(const std::vector<const char *> &methods)
+{
+	callStats_.clear();
+	callStats_.reserve(methods.size());
+
+	for (const char *method : methods)
+		callStats_.emplace_back(method);
+}
+
+/**
+ * \var IPAProxy::callStats_
+ * \brief The statistics of the calls to the IPA module methods
+ */
+
+/**
+ * \class IPAProxy::CallScope
+ * \brief Measure a call to an IPA module method
+ *
+ * The CallScope measures the duration of a call to an IPA module method,
+ * from its construction to its destruction, and records it in the method call
+ * statistics. It also emits the ipa_call_begin and ipa_call_end tracepoints.
+ *
+ * A CallScope may be used in the IPA thread, to measure the processing of
+ * asynchronous calls by threaded IPA modules.
+ */
+
+/**
+ * \brief Start measuring a call to an IPA module method
+ * \param[in] proxy The IPA proxy
+ * \param[in] index The method index, as passed to initCallStats()
+ */
+IPAProxy::CallScope::CallScope(IPAProxy *proxy, unsigned int index)
+	: proxy_(proxy), stats_(proxy->callStats_[index]),
+	  start_(utils::clock::now())
+{
+	LIBCAMERA_TRACEPOINT(ipa_call_begin, proxy_->ipam_->info().name,
+			     stats_.name);
+}
+
+IPAProxy::CallScope::~CallScope()
+{
+	{
+		MutexLocker locker(proxy_->statsLock_);
+		stats_.latency.record(utils::clock::now() - start_);
+	}
+
+	LIBCAMERA_TRACEPOINT(ipa_call_end, proxy_->ipam_->info().name,
+			     stats_.name);
+}
+
 } /* namespace libcamera */
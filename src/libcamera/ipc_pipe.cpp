@@ -7,6 +7,8 @@
 
 #include "libcamera/internal/ipc_pipe.h"
 
+#include <string.h>
+
 #include <libcamera/base/log.h>
 
 /**
@@ -77,19 +79,54 @@ IPCMessage::IPCMessage(const Header &header)
  *
  * This essentially converts an IPCUnixSocket payload into an IPCMessage.
  * The header is extracted from the payload into the IPCMessage's header field.
+ *
+ * The header is stored at the end of the payload data, see payload().
  */
 IPCMessage::IPCMessage(const IPCUnixSocket::Payload &payload)
+	: header_(Header{ 0, 0 })
 {
-	memcpy(&header_, payload.data.data(), sizeof(header_));
-	data_ = std::vector<uint8_t>(payload.data.begin() + sizeof(header_),
-				     payload.data.end());
+	if (payload.data.size() < sizeof(header_))
+		return;
+
+	size_t size = payload.data.size() - sizeof(header_);
+
+	memcpy(&header_, payload.data.data() + size, sizeof(header_));
+	data_ = std::vector<uint8_t>(payload.data.begin(),
+				     payload.data.begin() + size);
 	fds_ = payload.fds;
 }
 
+/**
+ * \brief Construct an IPCMessage instance by taking over an IPC payload
+ * \param[in] payload The IPCUnixSocket payload to construct from
+ *
+ * This constructor behaves as IPCMessage(const IPCUnixSocket::Payload &), but
+ * takes ownership of the \a payload data and file descriptors instead of
+ * copying them. As the header is stored at the end of the payload data, it is
+ * removed without moving the message data.
+ */
+IPCMessage::IPCMessage(IPCUnixSocket::Payload &&payload)
+	: header_(Header{ 0, 0 })
+{
+	if (payload.data.size() < sizeof(header_))
+		return;
+
+	size_t size = payload.data.size() - sizeof(header_);
+
+	memcpy(&header_, payload.data.data() + size, sizeof(header_));
+	data_ = std::move(payload.data);
+	data_.resize(size);
+	fds_ = std::move(payload.fds);
+}
+
 /**
  * \brief Create an IPCUnixSocket payload from the IPCMessage
  *
- * This essentially converts the IPCMessage into an IPCUnixSocket payload.
+ * This essentially converts the IPCMessage into an IPCUnixSocket payload. The
+ * payload data contains the message data followed by the header.
+ *
+ * This function copies the message data. The IPC transports can instead send
+ * the message without copy by gathering data() and serializedHeader().
  *
  * \todo Resolve the layering violation (add other converters later?)
  */
@@ -97,18 +134,29 @@ IPCUnixSocket::Payload IPCMessage::payload() const
 {
 	IPCUnixSocket::Payload payload;
 
-	payload.data.resize(sizeof(Header) + data_.size());
-	payload.fds.reserve(fds_.size());
+	payload.data.reserve(data_.size() + sizeof(Header));
+	payload.data = data_;
 
-	memcpy(payload.data.data(), &header_, sizeof(Header));
-
-	/* \todo Make this work without copy */
-	memcpy(payload.data.data() + sizeof(Header), data_.data(), data_.size());
+	Span<const uint8_t> header = serializedHeader();
+	payload.data.insert(payload.data.end(), header.begin(), header.end());
 	payload.fds = fds_;
 
 	return payload;
 }
 
+/**
+ * \brief Retrieve the header in its serialized form
+ *
+ * The serialized header is sent after the message data(), and is used to
+ * transmit the message without assembling a payload.
+ *
+ * \return The bytes of the message header
+ */
+Span<const uint8_t> IPCMessage::serializedHeader() const
+{
+	return { reinterpret_cast<const uint8_t *>(&header_), sizeof(header_) };
+}
+
 /**
  * \fn IPCMessage::header()
  * \brief Returns a reference to the header
@@ -144,8 +192,8 @@ IPCUnixSocket::Payload IPCMessage::payload() const
  * \brief IPC message pipe for IPA isolation
  *
  * Virtual class to model an IPC message pipe for use by IPA proxies for IPA
- * isolation. sendSync() and sendAsync() must be implemented, and the recvMessage
- * signal must be emitted whenever new data is available.
+ * isolation. sendSync(), sendAsync() and callAsync() must be implemented, and
+ * the recvMessage signal must be emitted whenever new data is available.
  */
 
 /**
@@ -195,6 +243,34 @@ IPCPipe::~IPCPipe()
  * \return Zero on success, negative error code otherwise
  */
 
+/**
+ * \typedef IPCPipe::ReplyHandler
+ * \brief Function called with the result of an asynchronous call
+ *
+ * The first argument is zero when a reply has been received, or a negative
+ * error code if the call failed. The second argument is the reply, and is
+ * empty on error.
+ */
+
+/**
+ * \fn IPCPipe::callAsync()
+ * \brief Send a message over IPC and receive the reply asynchronously
+ * \param[in] in Data to send
+ * \param[in] handler Function to call with the reply
+ *
+ * This function sends the message \a in and returns immediately, without
+ * waiting for the reply. When the reply is received, the \a handler is called
+ * from the event loop of the thread that called callAsync(). Unlike sendSync(),
+ * this function doesn't run a nested event loop, and thus doesn't block the
+ * caller during the round-trip.
+ *
+ * If the remote end terminates before replying, the \a handler is called with
+ * an error code. The \a handler is not called if sending the message fails, or
+ * if the IPCPipe is destroyed before the reply is received.
+ *
+ * \return Zero on success, negative error code otherwise
+ */
+
 /**
  * \var IPCPipe::recv
  * \brief Signal to be emitted when a message is received over IPC
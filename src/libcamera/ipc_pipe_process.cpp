@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_pipe_process.cpp - Image Processing Algorithm IPC module for proxy worker processes
+ */
+
+#include "libcamera/internal/ipc_pipe_process.h"
+
+#include <errno.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+/**
+ * \file ipc_pipe_process.h
+ * \brief IPC message pipe to a proxy worker process
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPCPipe)
+
+/**
+ * \class IPCPipeProcess
+ * \brief IPC message pipe to a proxy worker process
+ *
+ * The IPCPipeProcess class implements the parts of an IPCPipe that are common
+ * to all transports to a proxy worker process: starting the process, matching
+ * replies to synchronous and asynchronous calls by cookie, and failing the
+ * pending calls when the process terminates.
+ *
+ * Transports derive from this class. They create the channel to the worker,
+ * start the worker with startWorker(), implement send() to write a message to
+ * the channel, and pass the payloads read from the channel to receive().
+ */
+
+/**
+ * \brief Construct an IPCPipeProcess instance
+ */
+IPCPipeProcess::IPCPipeProcess()
+	: IPCPipe()
+{
+}
+
+IPCPipeProcess::~IPCPipeProcess()
+{
+}
+
+int IPCPipeProcess::sendSync(const IPCMessage &in, IPCMessage *out)
+{
+	IPCMessage response;
+
+	int ret = call(in, &response);
+	if (ret) {
+		LOG(IPCPipe, Error) << "Failed to call sync";
+		return ret;
+	}
+
+	if (out)
+		*out = std::move(response);
+
+	return 0;
+}
+
+int IPCPipeProcess::sendAsync(const IPCMessage &data)
+{
+	int ret = send(data);
+	if (ret) {
+		LOG(IPCPipe, Error) << "Failed to call async";
+		return ret;
+	}
+
+	return 0;
+}
+
+int IPCPipeProcess::callAsync(const IPCMessage &in, ReplyHandler handler)
+{
+	uint32_t cookie = in.header().cookie;
+
+	pendingCalls_[cookie] = std::move(handler);
+
+	int ret = send(in);
+	if (ret) {
+		LOG(IPCPipe, Error) << "Failed to call async";
+		pendingCalls_.erase(cookie);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Start the proxy worker process
+ * \param[in] ipaModulePath Path to the IPA module, passed to the worker
+ * \param[in] ipaProxyWorkerPath Path to the proxy worker executable
+ * \param[in] fd File descriptor of the worker end of the channel
+ *
+ * The worker is started with the IPA module path and the channel file
+ * descriptor as arguments. The pipe is marked as connected on success.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCPipeProcess::startWorker(const char *ipaModulePath,
+				const char *ipaProxyWorkerPath, int fd)
+{
+	std::vector<std::string> args = { ipaModulePath, std::to_string(fd) };
+	std::vector<int> fds = { fd };
+
+	proc_ = std::make_unique<Process>();
+	proc_->finished.connect(this, &IPCPipeProcess::processFinished);
+	int ret = proc_->start(ipaProxyWorkerPath, args, fds);
+	if (ret) {
+		LOG(IPCPipe, Error)
+			<< "Failed to start proxy worker process";
+		return ret;
+	}
+
+	connected_ = true;
+
+	return 0;
+}
+
+/**
+ * \brief Handle a payload received from the proxy worker
+ * \param[in] payload The payload read from the channel
+ *
+ * Replies to calls are dispatched to the pending sendSync() or callAsync()
+ * call with the same cookie. Other messages are calls from the IPA, and are
+ * emitted through the recv signal.
+ */
+void IPCPipeProcess::receive(IPCUnixSocket::Payload &&payload)
+{
+	if (payload.data.size() < sizeof(IPCMessage::Header)) {
+		LOG(IPCPipe, Error) << "Not enough data received";
+		return;
+	}
+
+	IPCMessage ipcMessage(std::move(payload));
+
+	auto callData = callData_.find(ipcMessage.header().cookie);
+	if (callData != callData_.end()) {
+		*callData->second.response = std::move(ipcMessage);
+		callData->second.done = true;
+		return;
+	}
+
+	auto pendingCall = pendingCalls_.find(ipcMessage.header().cookie);
+	if (pendingCall != pendingCalls_.end()) {
+		ReplyHandler handler = std::move(pendingCall->second);
+		pendingCalls_.erase(pendingCall);
+		handler(0, ipcMessage);
+		return;
+	}
+
+	/* Received unexpected data, this means it's a call from the IPA. */
+	recv.emit(ipcMessage);
+}
+
+/**
+ * \fn IPCPipeProcess::send()
+ * \brief Write a message to the channel to the proxy worker
+ * \param[in] message The message to write
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+
+int IPCPipeProcess::call(const IPCMessage &message, IPCMessage *response)
+{
+	uint32_t cookie = message.header().cookie;
+	Timer timeout;
+	int ret;
+
+	const auto result = callData_.insert({ cookie, { response, false } });
+	const auto &iter = result.first;
+
+	ret = send(message);
+	if (ret) {
+		callData_.erase(iter);
+		return ret;
+	}
+
+	/* \todo Make this less dangerous, see IPCPipe::sendSync() */
+	timeout.start(2000);
+	while (!iter->second.done) {
+		if (!timeout.isRunning()) {
+			LOG(IPCPipe, Error) << "Call timeout!";
+			callData_.erase(iter);
+			return -ETIMEDOUT;
+		}
+
+		Thread::current()->eventDispatcher()->processEvents();
+	}
+
+	callData_.erase(iter);
+
+	return 0;
+}
+
+void IPCPipeProcess::processFinished([[maybe_unused]] Process *process,
+				     [[maybe_unused]] enum Process::ExitStatus exitStatus,
+				     [[maybe_unused]] int exitCode)
+{
+	connected_ = false;
+
+	/* Fail the pending asynchronous calls, no reply will be received. */
+	std::map<uint32_t, ReplyHandler> pendingCalls = std::move(pendingCalls_);
+	pendingCalls_.clear();
+
+	if (!pendingCalls.empty())
+		LOG(IPCPipe, Error) << "Proxy worker terminated before replying";
+
+	for (auto &call : pendingCalls)
+		call.second(-EPIPE, IPCMessage());
+}
+
+} /* namespace libcamera */
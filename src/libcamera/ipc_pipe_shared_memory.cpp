@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_pipe_shared_memory.cpp - Image Processing Algorithm IPC module using shared memory rings
+ */
+
+#include "libcamera/internal/ipc_pipe_shared_memory.h"
+
+#include <libcamera/base/log.h>
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPCPipe)
+
+IPCPipeSharedMemory::IPCPipeSharedMemory(const char *ipaModulePath,
+					 const char *ipaProxyWorkerPath)
+{
+	ipc_ = std::make_unique<IPCSharedMemory>();
+	int fd = ipc_->create();
+	if (fd < 0) {
+		LOG(IPCPipe, Error) << "Failed to create shared memory channel";
+		return;
+	}
+	ipc_->readyRead.connect(this, &IPCPipeSharedMemory::readyRead);
+
+	startWorker(ipaModulePath, ipaProxyWorkerPath, fd);
+}
+
+IPCPipeSharedMemory::~IPCPipeSharedMemory()
+{
+}
+
+int IPCPipeSharedMemory::send(const IPCMessage &message)
+{
+	return ipc_->send(message.data(), message.serializedHeader(),
+			  message.fds());
+}
+
+void IPCPipeSharedMemory::readyRead(IPCSharedMemory *ipc)
+{
+	IPCSharedMemory::Payload payload;
+	int ret = ipc->receive(&payload);
+	if (ret) {
+		LOG(IPCPipe, Error) << "Receive message failed" << ret;
+		return;
+	}
+
+	receive(std::move(payload));
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,896 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_shared_memory.cpp - IPC mechanism based on shared memory rings
+ */
+
+#include "libcamera/internal/ipc_shared_memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/kcmp.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+
+/**
+ * \file ipc_shared_memory.h
+ * \brief IPC mechanism based on shared memory rings
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPCSharedMemory)
+
+namespace {
+
+/* Magic value identifying the setup message, "lcsm". */
+constexpr uint32_t SetupMagic = 0x6d73636c;
+
+/* Maximum number of file descriptors passed with a single message. */
+constexpr unsigned int MaxFds = 253;
+
+/* Maximum size of the data of a message carried by the socket. */
+constexpr uint32_t MaxSocketData = 16 * 1024 * 1024;
+
+struct SetupMessage {
+	uint32_t magic;
+	uint32_t ringSize;
+};
+
+struct Entry {
+	uint32_t data;
+	uint32_t fds;
+	uint32_t socketFds;
+	uint32_t flags;
+	uint32_t released;
+};
+
+/* The entry data didn't fit in the ring and is carried by the socket. */
+constexpr uint32_t EntryDataInSocket = 1 << 0;
+
+/* The file descriptor is carried by the socket and stored in the registry. */
+constexpr uint32_t FdRefNew = 1u << 31;
+
+/* The file descriptor is carried by the socket and isn't registered. */
+constexpr uint32_t FdRefUnregistered = 0xffffffff;
+
+} /* namespace */
+
+struct IPCSharedMemory::Ring {
+	/* Written by the producer only. */
+	alignas(64) std::atomic<uint32_t> head;
+	/* Written by the consumer only. */
+	alignas(64) std::atomic<uint32_t> tail;
+	alignas(64) uint8_t data[RingSize];
+
+	void write(uint32_t pos, const void *src, size_t length)
+	{
+		if (!length)
+			return;
+
+		const uint8_t *bytes = static_cast<const uint8_t *>(src);
+		size_t offset = pos % RingSize;
+		size_t count = std::min(length, RingSize - offset);
+
+		memcpy(data + offset, bytes, count);
+		memcpy(data, bytes + count, length - count);
+	}
+
+	void read(uint32_t pos, void *dst, size_t length) const
+	{
+		uint8_t *bytes = static_cast<uint8_t *>(dst);
+		size_t offset = pos % RingSize;
+		size_t count = std::min(length, RingSize - offset);
+
+		memcpy(bytes, data + offset, count);
+		memcpy(bytes + count, data, length - count);
+	}
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+	      "Shared memory rings require lock-free atomics");
+static_assert((IPCSharedMemory::RingSize & (IPCSharedMemory::RingSize - 1)) == 0,
+	      "The ring size must be a power of two");
+
+/**
+ * \class IPCSharedMemory
+ * \brief IPC mechanism based on shared memory rings
+ *
+ * The IPCSharedMemory class implements the same bidirectional message passing
+ * model as the IPCUnixSocket, but carries the message payloads through two
+ * single-producer single-consumer rings, one per direction, stored in a shared
+ * memory region. The availability of new messages in a ring is signalled to the
+ * consumer with an eventfd doorbell. This avoids the cost of the sendmsg() and
+ * recvmsg() system calls and of the data copies in the kernel for every
+ * message.
+ *
+ * A Unix socket is still used to set up the communication channel and to pass
+ * file descriptors, which can't be shared through memory. Messages that carry
+ * file descriptors send them over the socket before being published in the
+ * ring, so the receiver always finds the file descriptors of a message on the
+ * socket when it reads the message from the ring, and message ordering is
+ * preserved. Messages too large to fit in the free space of the ring are
+ * carried by the socket in the same way.
+ *
+ * The communication channel is created by the first end with create(), which
+ * returns the file descriptor of the socket for the second end. The second end
+ * binds to the channel with bind(), which retrieves the shared memory region
+ * and the doorbells set up by the first end. Messages are sent with send(),
+ * and the readyRead signal is emitted for every message available for
+ * reception, which shall then be retrieved with receive().
+ *
+ * To avoid passing the same file descriptors with every message, each end
+ * keeps a registry of up to MaxRegisteredFds file descriptors already passed
+ * to the other end. A message references the registered file descriptors by
+ * their registry slot, and only the file descriptors not registered yet are
+ * passed through the socket. The least recently used file descriptors are
+ * evicted when the registry is full. File descriptors are matched to the
+ * registry by open file description with kcmp(), if the system doesn't
+ * support it all file descriptors are passed through the socket. The
+ * registry holds a duplicate of the registered file descriptors, which keeps
+ * the underlying files open until they are evicted or the channel is closed.
+ * To avoid pinning the memory of buffers freed by the application, file
+ * descriptors not referenced by the last MaxIdleMessages messages are released
+ * by the sender, and the slots released are listed in the next message for the
+ * receiver to close its duplicates.
+ *
+ * The receiver always gets file descriptors it owns, duplicated from the
+ * registry for registered file descriptors.
+ *
+ * The peer is not trusted: all the ring indices and sizes read from the shared
+ * memory are validated before use, and the shared memory region is sealed to
+ * prevent it from being resized.
+ */
+
+/**
+ * \typedef IPCSharedMemory::Payload
+ * \brief Container for an IPC payload, identical to IPCUnixSocket::Payload
+ */
+
+/**
+ * \var IPCSharedMemory::RingSize
+ * \brief The size in bytes of the data area of each ring
+ */
+
+/**
+ * \var IPCSharedMemory::MaxRegisteredFds
+ * \brief The maximum number of file descriptors registered in each direction
+ */
+
+/**
+ * \var IPCSharedMemory::MaxIdleMessages
+ * \brief The number of messages after which a registered file descriptor not
+ * referenced by any of them is released
+ */
+
+IPCSharedMemory::IPCSharedMemory()
+	: fd_(-1), memfd_(-1), txEvent_(-1), rxEvent_(-1), mem_(nullptr),
+	  tx_(nullptr), rx_(nullptr), notifier_(nullptr), pid_(-1),
+	  fdRegistry_(false), txStamp_(0)
+{
+}
+
+IPCSharedMemory::~IPCSharedMemory()
+{
+	close();
+}
+
+/**
+ * \brief Create a new IPC channel
+ *
+ * This function creates a new IPC channel backed by a shared memory region.
+ * The channel is immediately bound to the first end. The file descriptor for
+ * the second end is returned, and shall be passed to the other process to be
+ * bound with bind().
+ *
+ * \return A file descriptor. It is valid on success or invalid otherwise.
+ */
+int IPCSharedMemory::create()
+{
+	int sockets[2] = { -1, -1 };
+	int memfd = -1;
+	int events[2] = { -1, -1 };
+	int ret;
+
+	ret = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, sockets);
+	if (ret) {
+		ret = -errno;
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to create socket pair: " << strerror(-ret);
+		return ret;
+	}
+
+	memfd = memfd_create("libcamera-ipc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0) {
+		ret = -errno;
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to create shared memory: " << strerror(-ret);
+		goto error;
+	}
+
+	/* Seal the size to prevent the peer from causing SIGBUS errors. */
+	if (ftruncate(memfd, 2 * sizeof(Ring)) < 0 ||
+	    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		ret = -errno;
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to size shared memory: " << strerror(-ret);
+		goto error;
+	}
+
+	for (int &event : events) {
+		event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (event < 0) {
+			ret = -errno;
+			LOG(IPCSharedMemory, Error)
+				<< "Failed to create doorbell: " << strerror(-ret);
+			goto error;
+		}
+	}
+
+	ret = map(memfd, true);
+	if (ret)
+		goto error;
+
+	setup(sockets[0], memfd, events[0], events[1]);
+
+	/* Pass the shared memory and the doorbells to the second end. */
+	{
+		const SetupMessage message = { SetupMagic, RingSize };
+		const int32_t fds[3] = { memfd, events[0], events[1] };
+
+		ret = sendMessage({ reinterpret_cast<const uint8_t *>(&message),
+				    sizeof(message) }, {}, fds, 3);
+		if (ret) {
+			close();
+			::close(sockets[1]);
+			return ret;
+		}
+	}
+
+	return sockets[1];
+
+error:
+	for (int fd : { sockets[0], sockets[1], memfd, events[0], events[1] }) {
+		if (fd >= 0)
+			::close(fd);
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Bind to an existing IPC channel
+ * \param[in] fd File descriptor
+ *
+ * This function binds the IPCSharedMemory instance to an existing IPC channel
+ * identified by the file descriptor \a fd. The file descriptor is obtained
+ * from the IPCSharedMemory::create() function.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCSharedMemory::bind(int fd)
+{
+	if (isBound())
+		return -EINVAL;
+
+	SetupMessage message = {};
+	int32_t fds[3] = { -1, -1, -1 };
+
+	fd_ = fd;
+	int ret = recvMessage(&message, sizeof(message), fds, 3);
+	fd_ = -1;
+	if (ret)
+		return ret;
+
+	if (message.magic != SetupMagic || message.ringSize != RingSize) {
+		LOG(IPCSharedMemory, Error) << "Invalid setup message";
+		ret = -EPROTO;
+		goto error;
+	}
+
+	ret = map(fds[0], false);
+	if (ret)
+		goto error;
+
+	/* The doorbells are swapped on the second end. */
+	setup(fd, fds[0], fds[2], fds[1]);
+
+	return 0;
+
+error:
+	for (int32_t f : fds)
+		::close(f);
+
+	return ret;
+}
+
+/**
+ * \brief Close the IPC channel
+ *
+ * No communication is possible after close() has been called.
+ */
+void IPCSharedMemory::close()
+{
+	delete notifier_;
+	notifier_ = nullptr;
+
+	if (mem_)
+		munmap(mem_, 2 * sizeof(Ring));
+
+	mem_ = nullptr;
+	tx_ = nullptr;
+	rx_ = nullptr;
+
+	for (int *fd : { &fd_, &memfd_, &txEvent_, &rxEvent_ }) {
+		if (*fd >= 0)
+			::close(*fd);
+		*fd = -1;
+	}
+
+	for (const FdSlot &slot : txFds_) {
+		if (slot.fd >= 0)
+			::close(slot.fd);
+	}
+
+	for (int fd : rxFds_) {
+		if (fd >= 0)
+			::close(fd);
+	}
+
+	txFds_.clear();
+	rxFds_.clear();
+}
+
+/**
+ * \brief Check if the IPC channel is bound
+ * \return True if the IPC channel is bound, false otherwise
+ */
+bool IPCSharedMemory::isBound() const
+{
+	return fd_ != -1;
+}
+
+/**
+ * \brief Send a message payload
+ * \param[in] payload Message payload to send
+ *
+ * This function queues the message payload for transmission to the other end
+ * of the IPC channel. It returns immediately, before the message is delivered
+ * to the remote side.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOBUFS The ring is full
+ * \retval -EINVAL The payload is empty or carries too many file descriptors
+ */
+int IPCSharedMemory::send(const Payload &payload)
+{
+	return send(payload.data, {}, payload.fds);
+}
+
+/**
+ * \brief Send a message payload from separate buffers
+ * \param[in] data Message data to send
+ * \param[in] trailer Additional data to send after \a data
+ * \param[in] fds File descriptors to send
+ *
+ * This function behaves as send(const Payload &), but gathers the message
+ * payload from the \a data and \a trailer buffers and the \a fds. The message
+ * is received as a single payload whose data is the concatenation of \a data
+ * and \a trailer. This avoids copying the message to a Payload when its parts
+ * are stored separately.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCSharedMemory::send(Span<const uint8_t> data, Span<const uint8_t> trailer,
+			  Span<const int32_t> fds)
+{
+	if (!isBound())
+		return -ENOTCONN;
+
+	size_t size = data.size() + trailer.size();
+	if (!size && fds.empty())
+		return -EINVAL;
+
+	if (fds.size() > MaxFds || size > MaxSocketData)
+		return -EINVAL;
+
+	uint32_t head = tx_->head.load(std::memory_order_relaxed);
+	uint32_t tail = tx_->tail.load(std::memory_order_acquire);
+	uint32_t used = head - tail;
+	if (used > RingSize) {
+		LOG(IPCSharedMemory, Error) << "Corrupted ring";
+		return -EPROTO;
+	}
+
+	Entry entry = {};
+	entry.data = size;
+	entry.fds = fds.size();
+
+	/* Collect the idle registry slots to be released with this message. */
+	uint32_t released[MaxRegisteredFds];
+
+	txStamp_++;
+	for (unsigned int i = 0; i < txFds_.size(); i++) {
+		const FdSlot &slot = txFds_[i];
+
+		if (slot.fd >= 0 && txStamp_ - slot.lastUse > MaxIdleMessages)
+			released[entry.released++] = i;
+	}
+
+	size_t refsSize = (fds.size() + entry.released) * sizeof(uint32_t);
+	size_t length = sizeof(entry) + refsSize + size;
+	if (length > RingSize - used) {
+		if (sizeof(entry) + refsSize > RingSize - used) {
+			LOG(IPCSharedMemory, Error) << "Ring full";
+			return -ENOBUFS;
+		}
+
+		entry.flags |= EntryDataInSocket;
+		length = sizeof(entry) + refsSize;
+	}
+
+	/*
+	 * Replace the file descriptors with references to the registry, and
+	 * only pass the ones unknown to the receiver.
+	 */
+	uint32_t refs[MaxFds];
+	int32_t socketFds[MaxFds];
+
+	for (unsigned int i = 0; i < entry.released; i++)
+		releaseFd(released[i]);
+
+	for (unsigned int i = 0; i < fds.size(); i++) {
+		refs[i] = registerFd(fds[i]);
+		if (refs[i] & FdRefNew)
+			socketFds[entry.socketFds++] = fds[i];
+	}
+
+	/*
+	 * File descriptors, and data that doesn't fit in the ring, are sent
+	 * through the socket before the entry is published in the ring.
+	 */
+	if (entry.socketFds || entry.flags & EntryDataInSocket) {
+		const uint8_t marker = 0;
+		int ret;
+
+		if (entry.flags & EntryDataInSocket)
+			ret = sendMessage(data, trailer, socketFds, entry.socketFds);
+		else
+			ret = sendMessage({ &marker, 1 }, {}, socketFds,
+					  entry.socketFds);
+		if (ret) {
+			/* The receiver hasn't registered the new file descriptors. */
+			for (unsigned int i = 0; i < fds.size(); i++) {
+				if (refs[i] != FdRefUnregistered && refs[i] & FdRefNew)
+					releaseFd(refs[i] & ~FdRefNew);
+			}
+
+			return ret;
+		}
+	}
+
+	tx_->write(head, &entry, sizeof(entry));
+	tx_->write(head + sizeof(entry), refs, fds.size() * sizeof(uint32_t));
+	tx_->write(head + sizeof(entry) + fds.size() * sizeof(uint32_t),
+		   released, entry.released * sizeof(uint32_t));
+	if (!(entry.flags & EntryDataInSocket)) {
+		uint32_t pos = head + sizeof(entry) + refsSize;
+
+		tx_->write(pos, data.data(), data.size());
+		tx_->write(pos + data.size(), trailer.data(), trailer.size());
+	}
+
+	tx_->head.store(head + length, std::memory_order_release);
+
+	uint64_t value = 1;
+	if (::write(txEvent_, &value, sizeof(value)) < 0) {
+		int ret = -errno;
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to ring doorbell: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Receive a message payload
+ * \param[out] payload Payload where to write the received message
+ *
+ * This function receives the oldest message available in the ring into the
+ * \a payload. It shall be called from the readyRead signal handler.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EAGAIN No message is available
+ * \retval -EPROTO The message is invalid
+ */
+int IPCSharedMemory::receive(Payload *payload)
+{
+	if (!isBound())
+		return -ENOTCONN;
+
+	uint32_t head = rx_->head.load(std::memory_order_acquire);
+	uint32_t tail = rx_->tail.load(std::memory_order_relaxed);
+	if (head == tail)
+		return -EAGAIN;
+
+	uint32_t available = head - tail;
+	if (available > RingSize || available < sizeof(Entry)) {
+		LOG(IPCSharedMemory, Error) << "Corrupted ring";
+		return -EPROTO;
+	}
+
+	Entry entry;
+	rx_->read(tail, &entry, sizeof(entry));
+
+	if (entry.fds > MaxFds || entry.socketFds > entry.fds ||
+	    entry.released > rxFds_.size()) {
+		LOG(IPCSharedMemory, Error) << "Invalid message";
+		return -EPROTO;
+	}
+
+	bool inSocket = entry.flags & EntryDataInSocket;
+	size_t refsSize = (entry.fds + entry.released) * sizeof(uint32_t);
+	size_t length = sizeof(entry) + refsSize + (inSocket ? 0 : entry.data);
+
+	if (length > available || (inSocket && entry.data > MaxSocketData)) {
+		LOG(IPCSharedMemory, Error) << "Invalid message";
+		return -EPROTO;
+	}
+
+	uint32_t refs[MaxFds];
+	uint32_t released[MaxRegisteredFds];
+	rx_->read(tail + sizeof(entry), refs, entry.fds * sizeof(uint32_t));
+	rx_->read(tail + sizeof(entry) + entry.fds * sizeof(uint32_t),
+		  released, entry.released * sizeof(uint32_t));
+
+	payload->data.resize(entry.data);
+	payload->fds.resize(entry.fds);
+
+	if (!inSocket)
+		rx_->read(tail + sizeof(entry) + refsSize, payload->data.data(),
+			  entry.data);
+
+	int32_t socketFds[MaxFds];
+
+	if (entry.socketFds || inSocket) {
+		uint8_t marker;
+		int ret;
+
+		if (inSocket)
+			ret = recvMessage(payload->data.data(), entry.data,
+					  socketFds, entry.socketFds);
+		else
+			ret = recvMessage(&marker, sizeof(marker),
+					  socketFds, entry.socketFds);
+		if (ret)
+			return ret;
+	}
+
+	rx_->tail.store(tail + length, std::memory_order_release);
+
+	/*
+	 * Close the slots released by the sender before resolving the
+	 * references, as released slots can be reused by the same message.
+	 */
+	for (unsigned int i = 0; i < entry.released; i++) {
+		uint32_t slot = released[i];
+		if (slot >= rxFds_.size())
+			continue;
+
+		if (rxFds_[slot] >= 0)
+			::close(rxFds_[slot]);
+		rxFds_[slot] = -1;
+	}
+
+	return resolveFds(refs, entry.fds, socketFds, entry.socketFds,
+			  payload->fds.data());
+}
+
+/**
+ * \var IPCSharedMemory::readyRead
+ * \brief A Signal emitted when a message is ready to be read
+ */
+
+int IPCSharedMemory::map(int memfd, bool owner)
+{
+	struct stat st;
+	if (fstat(memfd, &st) < 0) {
+		int ret = -errno;
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to stat shared memory: " << strerror(-ret);
+		return ret;
+	}
+
+	if (static_cast<size_t>(st.st_size) < 2 * sizeof(Ring)) {
+		LOG(IPCSharedMemory, Error) << "Shared memory too small";
+		return -EINVAL;
+	}
+
+	void *mem = mmap(nullptr, 2 * sizeof(Ring), PROT_READ | PROT_WRITE,
+			 MAP_SHARED, memfd, 0);
+	if (mem == MAP_FAILED) {
+		int ret = -errno;
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to map shared memory: " << strerror(-ret);
+		return ret;
+	}
+
+	mem_ = mem;
+
+	/*
+	 * The first ring carries messages from the first end to the second
+	 * end, the second ring messages in the opposite direction.
+	 */
+	Ring *rings = static_cast<Ring *>(mem);
+	tx_ = owner ? &rings[0] : &rings[1];
+	rx_ = owner ? &rings[1] : &rings[0];
+
+	return 0;
+}
+
+void IPCSharedMemory::setup(int fd, int memfd, int txEvent, int rxEvent)
+{
+	fd_ = fd;
+	memfd_ = memfd;
+	txEvent_ = txEvent;
+	rxEvent_ = rxEvent;
+
+	/* The file descriptor registry requires kcmp() support. */
+	pid_ = getpid();
+	fdRegistry_ = syscall(SYS_kcmp, pid_, pid_, KCMP_FILE, fd_, fd_) == 0;
+	if (!fdRegistry_)
+		LOG(IPCSharedMemory, Debug)
+			<< "kcmp() not supported, file descriptor registry disabled";
+
+	txStamp_ = 0;
+	txFds_.assign(MaxRegisteredFds, { -1, -1, 0 });
+	rxFds_.assign(MaxRegisteredFds, -1);
+
+	notifier_ = new EventNotifier(rxEvent_, EventNotifier::Read);
+	notifier_->activated.connect(this, &IPCSharedMemory::doorbell);
+}
+
+int IPCSharedMemory::sendMessage(Span<const uint8_t> data,
+				 Span<const uint8_t> trailer,
+				 const int32_t *fds, unsigned int num)
+{
+	struct iovec iov[2];
+	iov[0].iov_base = const_cast<uint8_t *>(data.data());
+	iov[0].iov_len = data.size();
+	iov[1].iov_base = const_cast<uint8_t *>(trailer.data());
+	iov[1].iov_len = trailer.size();
+
+	char buf[CMSG_SPACE(MaxFds * sizeof(int32_t))];
+	memset(buf, 0, sizeof(buf));
+
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	if (num) {
+		struct cmsghdr *cmsg = reinterpret_cast<struct cmsghdr *>(buf);
+		cmsg->cmsg_len = CMSG_LEN(num * sizeof(int32_t));
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		memcpy(CMSG_DATA(cmsg), fds, num * sizeof(int32_t));
+
+		msg.msg_control = cmsg;
+		msg.msg_controllen = CMSG_SPACE(num * sizeof(int32_t));
+	}
+
+	if (sendmsg(fd_, &msg, 0) < 0) {
+		int ret = -errno;
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to sendmsg: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int IPCSharedMemory::recvMessage(void *data, size_t length,
+				 int32_t *fds, unsigned int num)
+{
+	struct iovec iov[1];
+	iov[0].iov_base = data;
+	iov[0].iov_len = length;
+
+	char buf[CMSG_SPACE(MaxFds * sizeof(int32_t))];
+	memset(buf, 0, sizeof(buf));
+
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	ssize_t size = recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+	if (size < 0) {
+		int ret = -errno;
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to recvmsg: " << strerror(-ret);
+		return ret;
+	}
+
+	unsigned int received = 0;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS)
+		received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int32_t);
+
+	const int32_t *passed = reinterpret_cast<const int32_t *>(cmsg ? CMSG_DATA(cmsg) : nullptr);
+
+	if (static_cast<size_t>(size) != length || received != num ||
+	    msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		LOG(IPCSharedMemory, Error) << "Invalid socket message";
+		for (unsigned int i = 0; i < received; ++i)
+			::close(passed[i]);
+		return -EPROTO;
+	}
+
+	if (num)
+		memcpy(fds, passed, num * sizeof(int32_t));
+
+	return 0;
+}
+
+/*
+ * Find a file descriptor in the transmit registry, or register it. Return the
+ * registry slot, with the FdRefNew flag if the file descriptor has been newly
+ * registered and must be passed to the receiver, or FdRefUnregistered if it
+ * can't be registered.
+ */
+uint32_t IPCSharedMemory::registerFd(int32_t fd)
+{
+	if (!fdRegistry_)
+		return FdRefUnregistered;
+
+	FdSlot *victim = nullptr;
+
+	for (FdSlot &slot : txFds_) {
+		if (slot.fd >= 0 && slot.srcFd == fd) {
+			int ret = syscall(SYS_kcmp, pid_, pid_, KCMP_FILE, fd, slot.fd);
+			if (ret == 0) {
+				slot.lastUse = txStamp_;
+				return &slot - txFds_.data();
+			}
+
+			if (ret < 0)
+				return FdRefUnregistered;
+
+			/* The fd number has been reused, replace the slot. */
+			victim = &slot;
+			break;
+		}
+
+		/*
+		 * Evict the least recently used slot, free slots having a zero
+		 * usage stamp. Slots used by the current message can't be
+		 * evicted.
+		 */
+		if (slot.fd >= 0 && slot.lastUse == txStamp_)
+			continue;
+
+		if (!victim || slot.lastUse < victim->lastUse)
+			victim = &slot;
+	}
+
+	if (!victim)
+		return FdRefUnregistered;
+
+	int dupFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (dupFd < 0)
+		return FdRefUnregistered;
+
+	if (victim->fd >= 0)
+		::close(victim->fd);
+
+	*victim = { fd, dupFd, txStamp_ };
+
+	return (victim - txFds_.data()) | FdRefNew;
+}
+
+void IPCSharedMemory::releaseFd(uint32_t slot)
+{
+	FdSlot &entry = txFds_[slot];
+
+	if (entry.fd >= 0)
+		::close(entry.fd);
+
+	entry = { -1, -1, 0 };
+}
+
+/*
+ * Resolve the file descriptor references of a received message into file
+ * descriptors owned by the receiver, registering the new file descriptors
+ * passed through the socket.
+ */
+int IPCSharedMemory::resolveFds(const uint32_t *refs, unsigned int count,
+				const int32_t *socketFds, unsigned int numSocketFds,
+				int32_t *fds)
+{
+	unsigned int next = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		uint32_t ref = refs[i];
+
+		if (ref & FdRefNew && next >= numSocketFds)
+			break;
+
+		if (ref == FdRefUnregistered) {
+			fds[i] = socketFds[next++];
+			continue;
+		}
+
+		uint32_t slot = ref & ~FdRefNew;
+		if (slot >= rxFds_.size())
+			break;
+
+		if (ref & FdRefNew) {
+			if (rxFds_[slot] >= 0)
+				::close(rxFds_[slot]);
+			rxFds_[slot] = socketFds[next++];
+		}
+
+		if (rxFds_[slot] < 0)
+			break;
+
+		fds[i] = fcntl(rxFds_[slot], F_DUPFD_CLOEXEC, 0);
+		if (fds[i] < 0)
+			break;
+	}
+
+	if (i == count && next == numSocketFds)
+		return 0;
+
+	LOG(IPCSharedMemory, Error) << "Invalid file descriptor references";
+
+	for (unsigned int j = 0; j < i; j++)
+		::close(fds[j]);
+	for (; next < numSocketFds; next++)
+		::close(socketFds[next]);
+
+	return -EPROTO;
+}
+
+void IPCSharedMemory::doorbell([[maybe_unused]] EventNotifier *notifier)
+{
+	uint64_t value;
+	if (::read(rxEvent_, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+		LOG(IPCSharedMemory, Error)
+			<< "Failed to read doorbell, disabling notifier";
+		notifier_->setEnabled(false);
+		return;
+	}
+
+	/*
+	 * Emit readyRead for every message available in the ring. Stop if the
+	 * receiver doesn't consume the message, or closes the channel.
+	 */
+	while (isBound()) {
+		uint32_t tail = rx_->tail.load(std::memory_order_relaxed);
+		if (rx_->head.load(std::memory_order_acquire) == tail)
+			break;
+
+		readyRead.emit(this);
+
+		if (!isBound() ||
+		    rx_->tail.load(std::memory_order_relaxed) == tail)
+			break;
+	}
+}
+
+} /* namespace libcamera */
@@ -169,6 +169,26 @@ bool IPCUnixSocket::isBound() const
  * \return 0 on success or a negative error code otherwise
  */
 int IPCUnixSocket::send(const Payload &payload)
+{
+	return send(payload.data, {}, payload.fds);
+}
+
+/**
+ * \brief Send a message payload from separate buffers
+ * \param[in] data Message data to send
+ * \param[in] trailer Additional data to send after \a data
+ * \param[in] fds File descriptors to send
+ *
+ * This function behaves as send(const Payload &), but gathers the message
+ * payload from the \a data and \a trailer buffers and the \a fds. The message
+ * is received as a single payload whose data is the concatenation of \a data
+ * and \a trailer. This avoids copying the message to a Payload when its parts
+ * are stored separately.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCUnixSocket::send(Span<const uint8_t> data, Span<const uint8_t> trailer,
+			Span<const int32_t> fds)
 {
 	int ret;
 
@@ -176,8 +196,8 @@ int IPCUnixSocket::send(const Payload &payload)
 		return -ENOTCONN;
 
 	Header hdr = {};
-	hdr.data = payload.data.size();
-	hdr.fds = payload.fds.size();
+	hdr.data = data.size() + trailer.size();
+	hdr.fds = fds.size();
 
 	if (!hdr.data && !hdr.fds)
 		return -EINVAL;
@@ -190,7 +210,7 @@ int IPCUnixSocket::send(const Payload &payload)
 		return ret;
 	}
 
-	return sendData(payload.data.data(), hdr.data, payload.fds.data(), hdr.fds);
+	return sendData(data, trailer, fds.data(), hdr.fds);
 }
 
 /**
@@ -237,12 +257,14 @@ int IPCUnixSocket::receive(Payload *payload)
  * \brief A Signal emitted when a message is ready to be read
  */
 
-int IPCUnixSocket::sendData(const void *buffer, size_t length,
+int IPCUnixSocket::sendData(Span<const uint8_t> data, Span<const uint8_t> trailer,
 			    const int32_t *fds, unsigned int num)
 {
-	struct iovec iov[1];
-	iov[0].iov_base = const_cast<void *>(buffer);
-	iov[0].iov_len = length;
+	struct iovec iov[2];
+	iov[0].iov_base = const_cast<uint8_t *>(data.data());
+	iov[0].iov_len = data.size();
+	iov[1].iov_base = const_cast<uint8_t *>(trailer.data());
+	iov[1].iov_len = trailer.size();
 
 	char buf[CMSG_SPACE(num * sizeof(uint32_t))];
 	memset(buf, 0, sizeof(buf));
@@ -256,7 +278,7 @@ int IPCUnixSocket::sendData(const void *buffer, size_t length,
 	msg.msg_name = nullptr;
 	msg.msg_namelen = 0;
 	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
+	msg.msg_iovlen = 2;
 	msg.msg_control = cmsg;
 	msg.msg_controllen = cmsg->cmsg_len;
 	msg.msg_flags = 0;
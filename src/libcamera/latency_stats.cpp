@@ -0,0 +1,294 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * latency_stats.cpp - Request latency statistics
+ */
+
+#include <libcamera/latency_stats.h>
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+/**
+ * \file latency_stats.h
+ * \brief Request latency statistics
+ */
+
+namespace libcamera {
+
+/**
+ * \class LatencyHistogram
+ * \brief A histogram of latency measurements
+ *
+ * The LatencyHistogram accumulates latency measurements in a fixed set of
+ * buckets, with a constant cost per measurement and no memory allocation. It
+ * is meant to be kept enabled at all times to monitor latencies in production.
+ *
+ * Measurements are stored with a microsecond granularity in buckets whose
+ * width grows with the latency. Latencies below 8µs have one bucket per
+ * microsecond, and each power of two above is split in 8 buckets of equal
+ * width. Percentiles computed from the histogram are thus accurate to 12.5%.
+ * The minimum, maximum and mean latencies are exact.
+ */
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+/**
+ * \brief Record a latency measurement
+ * \param[in] latency The measured latency
+ *
+ * Negative latencies are recorded as zero.
+ */
+void LatencyHistogram::record(std::chrono::nanoseconds latency)
+{
+	uint64_t ns = std::max<int64_t>(latency.count(), 0);
+
+	buckets_[bucketIndex(ns / 1000)]++;
+	count_++;
+	sum_ += ns;
+	min_ = std::min(min_, ns);
+	max_ = std::max(max_, ns);
+}
+
+/**
+ * \brief Discard all measurements
+ */
+void LatencyHistogram::reset()
+{
+	buckets_.fill(0);
+	count_ = 0;
+	sum_ = 0;
+	min_ = std::numeric_limits<uint64_t>::max();
+	max_ = 0;
+}
+
+/**
+ * \fn LatencyHistogram::count()
+ * \brief Retrieve the number of measurements
+ * \return The number of measurements recorded since the last reset
+ */
+
+/**
+ * \brief Retrieve the lowest latency measurement
+ * \return The lowest latency, or 0 if no measurement has been recorded
+ */
+std::chrono::nanoseconds LatencyHistogram::min() const
+{
+	return std::chrono::nanoseconds(count_ ? min_ : 0);
+}
+
+/**
+ * \brief Retrieve the highest latency measurement
+ * \return The highest latency, or 0 if no measurement has been recorded
+ */
+std::chrono::nanoseconds LatencyHistogram::max() const
+{
+	return std::chrono::nanoseconds(max_);
+}
+
+/**
+ * \brief Retrieve the mean latency
+ * \return The mean latency, or 0 if no measurement has been recorded
+ */
+std::chrono::nanoseconds LatencyHistogram::mean() const
+{
+	return std::chrono::nanoseconds(count_ ? sum_ / count_ : 0);
+}
+
+/**
+ * \brief Compute a percentile of the latency measurements
+ * \param[in] percent The percentile, between 0 and 100
+ *
+ * The percentile is estimated as the upper bound of the bucket containing it,
+ * capped to the highest measurement.
+ *
+ * \return The latency below which \a percent of the measurements fall, or 0 if
+ * no measurement has been recorded
+ */
+std::chrono::nanoseconds LatencyHistogram::percentile(double percent) const
+{
+	if (!count_)
+		return std::chrono::nanoseconds(0);
+
+	percent = std::clamp(percent, 0.0, 100.0);
+	uint64_t rank = std::max<uint64_t>(count_ * percent / 100.0 + 0.5, 1);
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < NumBuckets; i++) {
+		total += buckets_[i];
+		if (total >= rank) {
+			uint64_t ns = bucketUpperBound(i) * 1000;
+			return std::chrono::nanoseconds(std::min(ns, max_));
+		}
+	}
+
+	return std::chrono::nanoseconds(max_);
+}
+
+/**
+ * \brief Export the histogram in JSON format
+ *
+ * The histogram is exported as a JSON object containing the number of
+ * measurements, the minimum, maximum and mean latencies, the 50th, 90th, 99th
+ * and 99.9th percentiles, and the non-empty buckets as an array of [upper
+ * bound, count] pairs. All latencies are expressed in microseconds.
+ *
+ * \return A string containing the JSON representation of the histogram
+ */
+std::string LatencyHistogram::toJson() const
+{
+	std::ostringstream ss;
+
+	ss << "{ \"count\": " << count_
+	   << ", \"min\": " << min().count() / 1000.0
+	   << ", \"max\": " << max().count() / 1000.0
+	   << ", \"mean\": " << mean().count() / 1000.0
+	   << ", \"p50\": " << percentile(50).count() / 1000.0
+	   << ", \"p90\": " << percentile(90).count() / 1000.0
+	   << ", \"p99\": " << percentile(99).count() / 1000.0
+	   << ", \"p99.9\": " << percentile(99.9).count() / 1000.0
+	   << ", \"buckets\": [";
+
+	bool first = true;
+	for (unsigned int i = 0; i < NumBuckets; i++) {
+		if (!buckets_[i])
+			continue;
+
+		ss << (first ? " " : ", ")
+		   << "[" << bucketUpperBound(i) << ", " << buckets_[i] << "]";
+		first = false;
+	}
+
+	ss << (first ? "] }" : " ] }");
+
+	return ss.str();
+}
+
+unsigned int LatencyHistogram::bucketIndex(uint64_t us)
+{
+	if (us < 8)
+		return us;
+
+	unsigned int exp = 63 - __builtin_clzll(us);
+	unsigned int index = 8 + (exp - 3) * 8 + ((us >> (exp - 3)) & 7);
+
+	return std::min(index, NumBuckets - 1);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(unsigned int index)
+{
+	if (index < 8)
+		return index + 1;
+
+	unsigned int exp = (index - 8) / 8 + 3;
+	uint64_t sub = (index - 8) % 8;
+
+	return (8 + sub + 1) << (exp - 3);
+}
+
+/**
+ * \class RequestLatencyStats
+ * \brief Latency statistics of the requests processed by a camera
+ *
+ * The RequestLatencyStats stores one LatencyHistogram for each stage of the
+ * processing of requests by a camera. The statistics are retrieved from a
+ * camera with Camera::latencyStats().
+ */
+
+/**
+ * \enum RequestLatencyStats::Stage
+ * \brief The stages of request processing
+ * \var RequestLatencyStats::QueueToDevice
+ * \brief Time from queuing a request to the camera to queuing it to the
+ * device, including waiting for its acquire fences
+ * \var RequestLatencyStats::DeviceToBuffer
+ * \brief Time from queuing a request to the device to completion of each of
+ * its buffers
+ * \var RequestLatencyStats::IpaProcessing
+ * \brief Time spent by the IPA module to process the statistics of a frame,
+ * for pipeline handlers that report it
+ * \var RequestLatencyStats::Completion
+ * \brief Time from queuing a request to the device to returning it to the
+ * application
+ */
+
+/**
+ * \var RequestLatencyStats::NumStages
+ * \brief The number of request processing stages
+ */
+
+/**
+ * \brief Retrieve the name of a request processing stage
+ * \param[in] stage The stage
+ * \return The stage name, as used in the JSON export
+ */
+const char *RequestLatencyStats::stageName(Stage stage)
+{
+	static const char *const names[] = {
+		"queue-to-device",
+		"device-to-buffer",
+		"ipa-processing",
+		"completion",
+	};
+
+	return names[stage];
+}
+
+/**
+ * \fn RequestLatencyStats::histogram()
+ * \brief Retrieve the latency histogram for a stage
+ * \param[in] stage The stage
+ * \return The latency histogram for \a stage
+ */
+
+/**
+ * \brief Record a latency measurement for a stage
+ * \param[in] stage The stage
+ * \param[in] latency The measured latency
+ */
+void RequestLatencyStats::record(Stage stage, std::chrono::nanoseconds latency)
+{
+	histograms_[stage].record(latency);
+}
+
+/**
+ * \brief Discard all measurements for all stages
+ */
+void RequestLatencyStats::reset()
+{
+	for (LatencyHistogram &histogram : histograms_)
+		histogram.reset();
+}
+
+/**
+ * \brief Export the statistics in JSON format
+ *
+ * The statistics are exported as a JSON object containing one member per
+ * stage, named after stageName(), whose value is the JSON representation of
+ * the stage histogram as documented in LatencyHistogram::toJson().
+ *
+ * \return A string containing the JSON representation of the statistics
+ */
+std::string RequestLatencyStats::toJson() const
+{
+	std::ostringstream ss;
+
+	ss << "{";
+
+	for (unsigned int i = 0; i < NumStages; i++) {
+		Stage stage = static_cast<Stage>(i);
+		ss << (i ? ", " : " ") << "\"" << stageName(stage) << "\": "
+		   << histograms_[i].toJson();
+	}
+
+	ss << " }";
+
+	return ss.str();
+}
+
+} /* namespace libcamera */
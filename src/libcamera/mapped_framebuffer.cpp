@@ -7,11 +7,19 @@
 
 #include "libcamera/internal/mapped_framebuffer.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <utility>
+
+#include <linux/dma-buf.h>
 
 #include <libcamera/base/log.h>
 
+#include "libcamera/internal/framebuffer.h"
+
 /**
  * \file libcamera/internal/mapped_framebuffer.h
  * \brief Frame buffer memory mapping support
@@ -80,6 +88,7 @@ MappedBuffer &MappedBuffer::operator=(MappedBuffer &&other)
 {
 	error_ = other.error_;
 	maps_ = std::move(other.maps_);
+	mappings_ = std::move(other.mappings_);
 	other.error_ = -ENOENT;
 
 	return *this;
@@ -87,7 +96,7 @@ MappedBuffer &MappedBuffer::operator=(MappedBuffer &&other)
 
 MappedBuffer::~MappedBuffer()
 {
-	for (Plane &map : maps_)
+	for (Plane &map : mappings_)
 		munmap(map.data(), map.size());
 }
 
@@ -130,14 +139,30 @@ MappedBuffer::~MappedBuffer()
  * \var MappedBuffer::maps_
  * \brief Stores the internal mapped planes
  *
- * MappedBuffer derived classes shall store the mappings they create in this
- * vector which is parsed during destruct to unmap any memory mappings which
- * completed successfully.
+ * MappedBuffer derived classes shall store in this vector one entry per plane,
+ * pointing to the plane data in the memory mappings.
+ */
+
+/**
+ * \var MappedBuffer::mappings_
+ * \brief Stores the memory mappings
+ *
+ * MappedBuffer derived classes shall store the memory mappings they create in
+ * this vector which is parsed during destruct to unmap any memory mappings
+ * which completed successfully. Multiple planes may point to the same memory
+ * mapping, in which case the maps_ and mappings_ vectors differ in size.
  */
 
 /**
  * \class MappedFrameBuffer
  * \brief Map a FrameBuffer using the MappedBuffer interface
+ *
+ * Frame buffers are backed by dmabufs, which are not guaranteed to be coherent
+ * with the CPU caches. CPU accesses to the mapped memory shall be bracketed by
+ * calls to beginCpuAccess() and endCpuAccess(), which synchronize the caches
+ * with the device. This allows exporters to provide cached mappings on
+ * non-coherent platforms, dramatically speeding up CPU accesses, without the
+ * risk of reading stale data or losing writes.
  */
 
 /**
@@ -149,6 +174,14 @@ MappedBuffer::~MappedBuffer()
  * \brief Create a write-only mapping
  * \var MappedFrameBuffer::ReadWrite
  * \brief Create a mapping that can be both read and written
+ * \var MappedFrameBuffer::Persistent
+ * \brief Reuse mappings cached in the FrameBuffer for its whole lifetime
+ * \var MappedFrameBuffer::Populate
+ * \brief Pre-fault the page tables of the mapping
+ *
+ * Populating the mapping when it is created avoids taking page faults on the
+ * first CPU access to every page of the buffer. This is useful for large
+ * buffers that must be processed with low latency from the first frame.
  */
 
 /**
@@ -164,10 +197,33 @@ MappedBuffer::~MappedBuffer()
  * Construct an object to map a frame buffer for CPU access. The mapping can be
  * made as Read only, Write only or support Read and Write operations by setting
  * the MapFlag flags accordingly.
+ *
+ * By default the frame buffer is mapped when the MappedFrameBuffer is
+ * constructed and unmapped when it is destroyed. When the MapFlag::Persistent
+ * flag is set, the mappings are instead created once and cached in the frame
+ * buffer, and reused by all subsequent persistent MappedFrameBuffer instances
+ * for the same buffer and protection flags. This avoids the cost of mapping
+ * and unmapping buffers for every frame when they are repeatedly accessed by
+ * the CPU. The persistent mappings are only valid for the lifetime of the
+ * frame buffer, and the MappedFrameBuffer must not be used after the frame
+ * buffer is destroyed.
+ *
+ * Planes that share the same dmabuf, through the same file descriptor or
+ * through duplicated file descriptors, are mapped once, with all the planes
+ * pointing to the same memory mapping.
  */
 MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags)
+	: access_(0)
 {
-	maps_.reserve(buffer->planes().size());
+	if (flags & MapFlag::Persistent) {
+		const MappedFrameBuffer *map;
+		error_ = buffer->_d()->map(flags ^ MapFlag::Persistent, &map);
+		if (!error_) {
+			maps_ = map->maps_;
+			dmabufs_ = map->dmabufs_;
+		}
+		return;
+	}
 
 	int mmapFlags = 0;
 
@@ -177,18 +233,166 @@ MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, MapFlags flags)
 	if (flags & MapFlag::Write)
 		mmapFlags |= PROT_WRITE;
 
-	for (const FrameBuffer::Plane &plane : buffer->planes()) {
-		void *address = mmap(nullptr, plane.length, mmapFlags,
-				     MAP_SHARED, plane.fd.fd(), 0);
+	int mapFlags = MAP_SHARED;
+
+	if (flags & MapFlag::Populate)
+		mapFlags |= MAP_POPULATE;
+
+	/*
+	 * Group the planes by dmabuf. Planes that share a dmabuf either use
+	 * the same file descriptor, or file descriptors that refer to the same
+	 * inode.
+	 */
+	struct Region {
+		const FileDescriptor *fd;
+		std::pair<dev_t, ino_t> inode;
+		size_t length;
+	};
+
+	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+	std::vector<Region> regions;
+	std::vector<unsigned int> planeRegions;
+	planeRegions.reserve(planes.size());
+
+	for (const FrameBuffer::Plane &plane : planes) {
+		int fd = plane.fd.fd();
+		std::pair<dev_t, ino_t> inode{ 0, 0 };
+
+		struct stat st;
+		if (!fstat(fd, &st))
+			inode = { st.st_dev, st.st_ino };
+
+		auto it = std::find_if(regions.begin(), regions.end(),
+				       [&](const Region &region) {
+					       return region.fd->fd() == fd ||
+						      (inode.second &&
+						       region.inode == inode);
+				       });
+		if (it == regions.end()) {
+			planeRegions.push_back(regions.size());
+			regions.push_back({ &plane.fd, inode, plane.length });
+		} else {
+			planeRegions.push_back(it - regions.begin());
+			it->length = std::max<size_t>(it->length, plane.length);
+		}
+	}
+
+	mappings_.reserve(regions.size());
+	dmabufs_.reserve(regions.size());
+
+	for (const Region &region : regions) {
+		void *address = mmap(nullptr, region.length, mmapFlags,
+				     mapFlags, region.fd->fd(), 0);
 		if (address == MAP_FAILED) {
 			error_ = -errno;
 			LOG(Buffer, Error) << "Failed to mmap plane: "
 					   << strerror(-error_);
-			break;
+			return;
 		}
 
-		maps_.emplace_back(static_cast<uint8_t *>(address), plane.length);
+		mappings_.emplace_back(static_cast<uint8_t *>(address),
+				       region.length);
+		dmabufs_.push_back(*region.fd);
+	}
+
+	maps_.reserve(planes.size());
+
+	for (unsigned int i = 0; i < planes.size(); i++)
+		maps_.emplace_back(mappings_[planeRegions[i]].data(),
+				   planes[i].length);
+}
+
+/**
+ * \brief Start a CPU access to the mapped frame buffer
+ * \param[in] access The type of access, MapFlag::Read, MapFlag::Write or both
+ *
+ * This function prepares the mapped memory for access by the CPU, invalidating
+ * or flushing CPU caches as required by the platform. It shall be called
+ * before the CPU accesses the mapped planes, after the device has finished
+ * writing to the buffer. Every call to beginCpuAccess() shall be balanced by a
+ * call to endCpuAccess() once the CPU access is complete, and before the
+ * buffer is handed back to the device.
+ *
+ * Only one access scope can be active at a time for a MappedFrameBuffer.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY A CPU access scope is already active
+ * \retval -EINVAL The \a access type is invalid
+ */
+int MappedFrameBuffer::beginCpuAccess(MapFlags access)
+{
+	if (access_) {
+		LOG(Buffer, Error) << "CPU access already started";
+		return -EBUSY;
+	}
+
+	uint64_t flags = 0;
+
+	if (access & MapFlag::Read)
+		flags |= DMA_BUF_SYNC_READ;
+
+	if (access & MapFlag::Write)
+		flags |= DMA_BUF_SYNC_WRITE;
+
+	if (!flags)
+		return -EINVAL;
+
+	int ret = syncDmabufs(DMA_BUF_SYNC_START | flags);
+	if (ret < 0)
+		return ret;
+
+	access_ = flags;
+	return 0;
+}
+
+/**
+ * \brief End a CPU access to the mapped frame buffer
+ *
+ * This function completes a CPU access started by beginCpuAccess(), flushing
+ * CPU caches for write accesses as required by the platform.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL No CPU access scope is active
+ */
+int MappedFrameBuffer::endCpuAccess()
+{
+	if (!access_) {
+		LOG(Buffer, Error) << "CPU access not started";
+		return -EINVAL;
+	}
+
+	int ret = syncDmabufs(DMA_BUF_SYNC_END | access_);
+	access_ = 0;
+
+	return ret;
+}
+
+int MappedFrameBuffer::syncDmabufs(uint64_t flags)
+{
+	struct dma_buf_sync sync = {};
+	sync.flags = flags;
+
+	for (const FileDescriptor &dmabuf : dmabufs_) {
+		int ret;
+
+		do {
+			ret = ioctl(dmabuf.fd(), DMA_BUF_IOCTL_SYNC, &sync);
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+		if (ret < 0) {
+			ret = -errno;
+
+			/* Buffers that are not dmabufs need no synchronization. */
+			if (ret == -ENOTTY)
+				continue;
+
+			LOG(Buffer, Error) << "Failed to sync dmabuf: "
+					   << strerror(-ret);
+			return ret;
+		}
 	}
+
+	return 0;
 }
 
 } /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/media_device.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
@@ -20,6 +21,9 @@
 
 #include <libcamera/base/log.h>
 
+#include "libcamera/internal/device_cache.h"
+#include "libcamera/internal/media_request.h"
+
 /**
  * \file media_device.h
  * \brief Provide a representation of a Linux kernel Media Controller device
@@ -30,6 +34,121 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(MediaDevice)
 
+namespace {
+
+/* Build the key used to index links by their source and sink pad IDs. */
+uint64_t linkKey(unsigned int sourceId, unsigned int sinkId)
+{
+	return static_cast<uint64_t>(sourceId) << 32 | sinkId;
+}
+
+/*
+ * Storage for the arrays of a media graph topology, and their serialization
+ * to the device cache.
+ */
+struct MediaTopology {
+	/*
+	 * Initial sizes of the arrays, large enough for the media graphs of
+	 * most devices to be retrieved with a single G_TOPOLOGY call.
+	 */
+	MediaTopology()
+		: entities(32), interfaces(32), links(128), pads(128)
+	{
+	}
+
+	struct media_v2_topology topology()
+	{
+		struct media_v2_topology topology = {};
+		topology.num_entities = entities.size();
+		topology.num_interfaces = interfaces.size();
+		topology.num_links = links.size();
+		topology.num_pads = pads.size();
+		topology.ptr_entities = reinterpret_cast<uintptr_t>(entities.data());
+		topology.ptr_interfaces = reinterpret_cast<uintptr_t>(interfaces.data());
+		topology.ptr_links = reinterpret_cast<uintptr_t>(links.data());
+		topology.ptr_pads = reinterpret_cast<uintptr_t>(pads.data());
+		return topology;
+	}
+
+	std::vector<uint8_t> serialize(const struct media_v2_topology &topology) const
+	{
+		std::vector<uint8_t> data;
+
+		const uint8_t *header = reinterpret_cast<const uint8_t *>(&version);
+		data.insert(data.end(), header, header + sizeof(version));
+
+		auto append = [&data](const auto &array, uint32_t count) {
+			const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&count);
+			data.insert(data.end(), ptr, ptr + sizeof(count));
+			ptr = reinterpret_cast<const uint8_t *>(array.data());
+			data.insert(data.end(), ptr, ptr + count * sizeof(array[0]));
+		};
+
+		append(entities, topology.num_entities);
+		append(interfaces, topology.num_interfaces);
+		append(links, topology.num_links);
+		append(pads, topology.num_pads);
+
+		return data;
+	}
+
+	bool deserialize(const std::vector<uint8_t> &data)
+	{
+		size_t offset = sizeof(version);
+
+		if (data.size() < offset)
+			return false;
+
+		memcpy(&version, data.data(), sizeof(version));
+
+		auto read = [&data, &offset](auto &array) {
+			uint32_t count;
+			if (data.size() - offset < sizeof(count))
+				return false;
+
+			memcpy(&count, data.data() + offset, sizeof(count));
+			offset += sizeof(count);
+
+			size_t size = count * sizeof(array[0]);
+			if (data.size() - offset < size)
+				return false;
+
+			array.resize(count);
+			memcpy(array.data(), data.data() + offset, size);
+			offset += size;
+			return true;
+		};
+
+		return read(entities) && read(interfaces) && read(links) &&
+		       read(pads) && offset == data.size();
+	}
+
+	std::vector<struct media_v2_entity> entities;
+	std::vector<struct media_v2_interface> interfaces;
+	std::vector<struct media_v2_link> links;
+	std::vector<struct media_v2_pad> pads;
+
+	/* Identification of the hardware and graph the arrays describe. */
+	struct Version {
+		uint64_t topology;
+		uint32_t hwRevision;
+		uint32_t driverVersion;
+	} version = {};
+
+	bool matches(const Version &other, const struct media_v2_topology &sizes) const
+	{
+		return version.topology == other.topology &&
+		       version.hwRevision == other.hwRevision &&
+		       version.driverVersion == other.driverVersion &&
+		       entities.size() == sizes.num_entities &&
+		       interfaces.size() == sizes.num_interfaces &&
+		       links.size() == sizes.num_links &&
+		       pads.size() == sizes.num_pads;
+	}
+};
+
+} /* namespace */
+
 /**
  * \class MediaDevice
  * \brief The MediaDevice represents a Media Controller device with its full
@@ -205,12 +324,11 @@ void MediaDevice::unlock()
  */
 int MediaDevice::populate()
 {
+	DeviceCache *cache = DeviceCache::instance();
 	struct media_v2_topology topology = {};
-	struct media_v2_entity *ents = nullptr;
-	struct media_v2_interface *interfaces = nullptr;
-	struct media_v2_link *links = nullptr;
-	struct media_v2_pad *pads = nullptr;
-	__u64 version = -1;
+	MediaTopology graph;
+	std::vector<uint8_t> cached;
+	std::string cacheKey;
 	int ret;
 
 	clear();
@@ -234,16 +352,23 @@ int MediaDevice::populate()
 	hwRevision_ = info.hw_revision;
 
 	/*
-	 * Keep calling G_TOPOLOGY until the version number stays stable.
+	 * The media graph contains device numbers, which depend on the device
+	 * probe order. Cached topologies are thus only valid for the current
+	 * boot, and for the same device node instance.
+	 *
+	 * The graph of a device can also change at runtime, or with a firmware
+	 * or driver update. The cache entry records the topology version and
+	 * the hardware and driver revisions, and is only used if they match the
+	 * values currently reported by the device. The entry is overwritten
+	 * with the current topology otherwise.
 	 */
-	while (true) {
-		topology.topology_version = 0;
-		topology.ptr_entities = reinterpret_cast<uintptr_t>(ents);
-		topology.ptr_interfaces = reinterpret_cast<uintptr_t>(interfaces);
-		topology.ptr_links = reinterpret_cast<uintptr_t>(links);
-		topology.ptr_pads = reinterpret_cast<uintptr_t>(pads);
+	if (cache->enabled()) {
+		cacheKey = "media:" + DeviceCache::bootId() + ":" +
+			   DeviceCache::nodeId(deviceNode_) + ":" + driver_ + ":" +
+			   info.bus_info;
 
-		ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+		struct media_v2_topology sizes = {};
+		ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &sizes);
 		if (ret < 0) {
 			ret = -errno;
 			LOG(MediaDevice, Error)
@@ -252,22 +377,76 @@ int MediaDevice::populate()
 			goto done;
 		}
 
-		if (version == topology.topology_version)
+		const MediaTopology::Version current = {
+			sizes.topology_version,
+			info.hw_revision,
+			info.driver_version,
+		};
+
+		if (cache->lookup(cacheKey, &cached) && graph.deserialize(cached)) {
+			if (graph.matches(current, sizes)) {
+				LOG(MediaDevice, Debug)
+					<< "Using cached topology for " << deviceNode_;
+				topology = graph.topology();
+				goto populate;
+			}
+
+			LOG(MediaDevice, Debug)
+				<< "Cached topology for " << deviceNode_
+				<< " is stale, refreshing";
+			graph = MediaTopology();
+		}
+
+		graph.version = current;
+	}
+
+	/*
+	 * The kernel retrieves the whole topology atomically, and fails with
+	 * -ENOSPC if any of the arrays is too small. Query the number of
+	 * elements, grow the arrays and try again in that case, until the
+	 * topology fits.
+	 */
+	while (true) {
+		topology = graph.topology();
+
+		ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+		if (!ret)
 			break;
 
-		delete[] ents;
-		delete[] interfaces;
-		delete[] pads;
-		delete[] links;
+		ret = -errno;
+		if (ret != -ENOSPC) {
+			LOG(MediaDevice, Error)
+				<< "Failed to enumerate topology: "
+				<< strerror(-ret);
+			goto done;
+		}
+
+		struct media_v2_topology sizes = {};
+		ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &sizes);
+		if (ret < 0) {
+			ret = -errno;
+			LOG(MediaDevice, Error)
+				<< "Failed to enumerate topology: "
+				<< strerror(-ret);
+			goto done;
+		}
 
-		ents = new struct media_v2_entity[topology.num_entities]();
-		interfaces = new struct media_v2_interface[topology.num_interfaces]();
-		links = new struct media_v2_link[topology.num_links]();
-		pads = new struct media_v2_pad[topology.num_pads]();
+		graph.entities.resize(std::max<size_t>(sizes.num_entities,
+						       graph.entities.size()));
+		graph.interfaces.resize(std::max<size_t>(sizes.num_interfaces,
+							 graph.interfaces.size()));
+		graph.links.resize(std::max<size_t>(sizes.num_links,
+						    graph.links.size()));
+		graph.pads.resize(std::max<size_t>(sizes.num_pads,
+						   graph.pads.size()));
+	}
 
-		version = topology.topology_version;
+	if (cache->enabled()) {
+		graph.version.topology = topology.topology_version;
+		cache->store(cacheKey, graph.serialize(topology));
 	}
 
+populate:
 	/* Populate entities, pads and links. */
 	if (populateEntities(topology) &&
 	    populatePads(topology) &&
@@ -278,11 +457,6 @@ int MediaDevice::populate()
 done:
 	close();
 
-	delete[] ents;
-	delete[] interfaces;
-	delete[] pads;
-	delete[] links;
-
 	if (!valid_) {
 		clear();
 		return -EINVAL;
@@ -346,11 +520,11 @@ done:
  */
 MediaEntity *MediaDevice::getEntityByName(const std::string &name) const
 {
-	for (MediaEntity *e : entities_)
-		if (e->name() == name)
-			return e;
+	auto iter = entitiesByName_.find(name);
+	if (iter == entitiesByName_.end())
+		return nullptr;
 
-	return nullptr;
+	return iter->second;
 }
 
 /**
@@ -425,12 +599,11 @@ MediaLink *MediaDevice::link(const MediaEntity *source, unsigned int sourceIdx,
  */
 MediaLink *MediaDevice::link(const MediaPad *source, const MediaPad *sink)
 {
-	for (MediaLink *link : source->links()) {
-		if (link->sink()->id() == sink->id())
-			return link;
-	}
+	auto iter = links_.find(linkKey(source->id(), sink->id()));
+	if (iter == links_.end())
+		return nullptr;
 
-	return nullptr;
+	return iter->second;
 }
 
 /**
@@ -462,6 +635,36 @@ int MediaDevice::disableLinks()
 	return 0;
 }
 
+/**
+ * \brief Allocate a request of the Media Controller request API
+ *
+ * Allocate a new MediaRequest to bind buffers and controls of devices in the
+ * media graph and apply them atomically. The media device must have been
+ * acquired, and its driver must support the request API.
+ *
+ * \return A new MediaRequest on success, or nullptr if the request couldn't
+ * be allocated
+ */
+std::unique_ptr<MediaRequest> MediaDevice::allocateRequest()
+{
+	if (fd_ == -1) {
+		LOG(MediaDevice, Error)
+			<< "Media device must be acquired to allocate requests";
+		return nullptr;
+	}
+
+	int requestFd;
+	int ret = ioctl(fd_, MEDIA_IOC_REQUEST_ALLOC, &requestFd);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to allocate request: " << strerror(-ret);
+		return nullptr;
+	}
+
+	return std::unique_ptr<MediaRequest>(new MediaRequest(this, requestFd));
+}
+
 /**
  * \var MediaDevice::disconnected
  * \brief Signal emitted when the media device is disconnected from the system
@@ -580,6 +783,8 @@ void MediaDevice::clear()
 
 	objects_.clear();
 	entities_.clear();
+	entitiesByName_.clear();
+	links_.clear();
 	valid_ = false;
 }
 
@@ -588,6 +793,17 @@ void MediaDevice::clear()
  * \brief Global list of media entities in the media graph
  */
 
+/**
+ * \var MediaDevice::entitiesByName_
+ * \brief Media entities in the media graph, indexed by name
+ */
+
+/**
+ * \var MediaDevice::links_
+ * \brief Pad-to-pad links in the media graph, indexed by the source and sink
+ * pad IDs
+ */
+
 /**
  * \brief Find the interface associated with an entity
  * \param[in] topology The media topology as returned by MEDIA_IOC_G_TOPOLOGY
@@ -667,6 +883,7 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 		}
 
 		entities_.push_back(entity);
+		entitiesByName_.emplace(entity->name(), entity);
 	}
 
 	return true;
@@ -745,6 +962,7 @@ bool MediaDevice::populateLinks(const struct media_v2_topology &topology)
 
 		source->addLink(link);
 		sink->addLink(link);
+		links_.emplace(linkKey(source_id, sink_id), link);
 	}
 
 	return true;
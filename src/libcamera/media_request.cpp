@@ -0,0 +1,180 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media_request.cpp - Media request handler
+ */
+
+#include "libcamera/internal/media_request.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/log.h>
+
+#include "libcamera/internal/media_device.h"
+
+/**
+ * \file media_request.h
+ * \brief Media Controller request API support
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(MediaDevice)
+
+/**
+ * \class MediaRequest
+ * \brief A request of the Media Controller request API
+ *
+ * The Media Controller request API allows binding buffers and control values
+ * for multiple devices of a media graph together, and applying them
+ * atomically for a given frame. A MediaRequest models a request object
+ * allocated on a MediaDevice with MediaDevice::allocateRequest().
+ *
+ * Buffers and controls are added to the request by passing it to
+ * V4L2VideoDevice::queueBuffer() and V4L2Device::setControls() respectively.
+ * The request is then queued to the kernel with queue(). Once all the
+ * operations bound to the request have been performed by the kernel, the
+ * request completes and the completed signal is emitted. Buffers bound to the
+ * request are then dequeued and emitted through the
+ * V4L2VideoDevice::bufferReady signal as usual.
+ *
+ * Completed requests can be reused for a new set of operations after being
+ * reinitialized with reinit().
+ */
+
+/**
+ * \enum MediaRequest::Status
+ * \brief The request status
+ * \var MediaRequest::Idle
+ * The request has been allocated or reinitialized, and can be populated with
+ * buffers and controls
+ * \var MediaRequest::Queued
+ * The request has been queued to the kernel and hasn't completed yet
+ * \var MediaRequest::Complete
+ * The request has completed
+ */
+
+/**
+ * \brief Construct a MediaRequest
+ * \param[in] media The media device the request has been allocated on
+ * \param[in] fd The request file descriptor
+ *
+ * The MediaRequest takes ownership of the file descriptor \a fd.
+ */
+MediaRequest::MediaRequest(const MediaDevice *media, int fd)
+	: media_(media), fd_(fd), status_(Idle)
+{
+	/* Request completion is signalled through POLLPRI. */
+	notifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+	notifier_->activated.connect(this, &MediaRequest::requestCompleted);
+	notifier_->setEnabled(false);
+}
+
+MediaRequest::~MediaRequest()
+{
+	delete notifier_;
+	::close(fd_);
+}
+
+std::string MediaRequest::logPrefix() const
+{
+	return media_->deviceNode() + "[request:" + std::to_string(fd_) + "]";
+}
+
+/**
+ * \fn MediaRequest::fd()
+ * \brief Retrieve the request file descriptor
+ *
+ * The file descriptor is used by V4L2 devices to bind buffers and controls to
+ * the request.
+ *
+ * \return The request file descriptor
+ */
+
+/**
+ * \fn MediaRequest::status()
+ * \brief Retrieve the request status
+ * \return The request status
+ */
+
+/**
+ * \brief Queue the request to the kernel
+ *
+ * Queue the request and all the buffers and controls bound to it. The
+ * completed signal is emitted once the request completes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The request has already been queued
+ */
+int MediaRequest::queue()
+{
+	if (status_ != Idle) {
+		LOG(MediaDevice, Error) << "Request is not idle";
+		return -EBUSY;
+	}
+
+	int ret = ::ioctl(fd_, MEDIA_REQUEST_IOC_QUEUE);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to queue request: " << strerror(-ret);
+		return ret;
+	}
+
+	status_ = Queued;
+	notifier_->setEnabled(true);
+
+	return 0;
+}
+
+/**
+ * \brief Reinitialize the request for reuse
+ *
+ * Reset the request to its initial state, releasing the buffers and control
+ * values bound to it. This function shall not be called while the request is
+ * queued.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The request is queued
+ */
+int MediaRequest::reinit()
+{
+	if (status_ == Queued) {
+		LOG(MediaDevice, Error) << "Can't reinit a queued request";
+		return -EBUSY;
+	}
+
+	int ret = ::ioctl(fd_, MEDIA_REQUEST_IOC_REINIT);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to reinit request: " << strerror(-ret);
+		return ret;
+	}
+
+	status_ = Idle;
+
+	return 0;
+}
+
+/**
+ * \var MediaRequest::completed
+ * \brief A Signal emitted when the request completes
+ */
+
+void MediaRequest::requestCompleted([[maybe_unused]] EventNotifier *notifier)
+{
+	notifier_->setEnabled(false);
+	status_ = Complete;
+
+	completed.emit(this);
+}
+
+} /* namespace libcamera */
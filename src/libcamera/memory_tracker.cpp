@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * memory_tracker.cpp - Accounting of the memory held by libcamera
+ */
+
+#include "libcamera/internal/memory_tracker.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/framebuffer.h"
+
+/**
+ * \file memory_tracker.h
+ * \brief Accounting of the memory held by libcamera
+ */
+
+namespace libcamera {
+
+/**
+ * \class MemoryTracker
+ * \brief Process-wide registry of the memory held by libcamera
+ *
+ * The MemoryTracker records the size of the large memory allocations made by
+ * libcamera, such as frame buffers, along with the camera and stream they
+ * belong to and their category. Components that allocate memory register it
+ * with track(), which returns an Allocation that removes the record when
+ * destroyed. The Allocation shall thus live as long as the memory it accounts
+ * for, typically as a member of the object that owns the memory.
+ *
+ * The records are aggregated by usage(), which backs
+ * CameraManager::memoryUsage().
+ *
+ * The tracker is thread-safe, allocations can be tracked and released from
+ * any thread.
+ */
+
+/**
+ * \class MemoryTracker::Allocation
+ * \brief Handle to a memory allocation recorded in the MemoryTracker
+ *
+ * The Allocation is a move-only handle to a record of the MemoryTracker. The
+ * record is removed when the Allocation is destroyed, reset, or assigned
+ * another Allocation.
+ */
+
+/**
+ * \brief Construct an invalid Allocation
+ */
+MemoryTracker::Allocation::Allocation()
+	: id_(0)
+{
+}
+
+MemoryTracker::Allocation::Allocation(uint64_t id)
+	: id_(id)
+{
+}
+
+/**
+ * \brief Construct an Allocation by taking over the record of \a other
+ * \param[in] other The other Allocation
+ */
+MemoryTracker::Allocation::Allocation(Allocation &&other)
+	: id_(other.id_)
+{
+	other.id_ = 0;
+}
+
+/**
+ * \brief Destroy the Allocation and remove its record
+ */
+MemoryTracker::Allocation::~Allocation()
+{
+	reset();
+}
+
+/**
+ * \brief Remove the record of this Allocation and take over the one of \a other
+ * \param[in] other The other Allocation
+ * \return A reference to this Allocation
+ */
+MemoryTracker::Allocation &MemoryTracker::Allocation::operator=(Allocation &&other)
+{
+	if (this != &other) {
+		reset();
+		id_ = other.id_;
+		other.id_ = 0;
+	}
+
+	return *this;
+}
+
+/**
+ * \fn MemoryTracker::Allocation::isValid()
+ * \brief Check if the Allocation references a record
+ * \return True if the Allocation references a record, false otherwise
+ */
+
+/**
+ * \brief Remove the record of the Allocation
+ *
+ * The Allocation is invalid after this function returns.
+ */
+void MemoryTracker::Allocation::reset()
+{
+	if (!id_)
+		return;
+
+	MemoryTracker::instance()->release(id_);
+	id_ = 0;
+}
+
+MemoryTracker::MemoryTracker()
+	: nextId_(1)
+{
+}
+
+/**
+ * \brief Retrieve the MemoryTracker instance
+ * \return The process-wide MemoryTracker
+ */
+MemoryTracker *MemoryTracker::instance()
+{
+	static MemoryTracker tracker;
+	return &tracker;
+}
+
+/**
+ * \brief Record a memory allocation
+ * \param[in] camera The ID of the camera the memory belongs to
+ * \param[in] stream The name of the stream the memory belongs to
+ * \param[in] category The category of the memory
+ * \param[in] bytes The size of the allocation in bytes
+ *
+ * \return An Allocation that removes the record when destroyed
+ */
+MemoryTracker::Allocation MemoryTracker::track(const std::string &camera,
+					       const std::string &stream,
+					       MemoryUsage::Category category,
+					       uint64_t bytes)
+{
+	MutexLocker locker(mutex_);
+
+	uint64_t id = nextId_++;
+	allocations_[id] = { camera, stream, category, bytes };
+
+	return Allocation(id);
+}
+
+/**
+ * \brief Record the memory of a frame buffer
+ * \param[in] buffer The frame buffer
+ * \param[in] camera The ID of the camera the buffer belongs to
+ * \param[in] stream The name of the stream the buffer belongs to
+ * \param[in] category The category of the buffer
+ *
+ * The size of the buffer is the sum of the length of its planes. The record is
+ * stored in the \a buffer and removed when the buffer is destroyed. Tracking a
+ * buffer again replaces its previous record.
+ */
+void MemoryTracker::track(FrameBuffer *buffer, const std::string &camera,
+			  const std::string &stream, MemoryUsage::Category category)
+{
+	uint64_t bytes = 0;
+	for (const FrameBuffer::Plane &plane : buffer->planes())
+		bytes += plane.length;
+
+	buffer->_d()->setMemoryAllocation(
+		instance()->track(camera, stream, category, bytes));
+}
+
+/**
+ * \brief Retrieve the memory held by libcamera
+ *
+ * The records are summed per camera, stream and category. The entries are
+ * sorted by camera, stream and category.
+ *
+ * \return The memory held by libcamera
+ */
+std::vector<MemoryUsage> MemoryTracker::usage() const
+{
+	std::vector<MemoryUsage> usage;
+
+	MutexLocker locker(mutex_);
+
+	for (const auto &[id, allocation] : allocations_) {
+		if (!allocation.bytes)
+			continue;
+
+		auto iter = std::find_if(usage.begin(), usage.end(),
+					 [&](const MemoryUsage &entry) {
+						 return entry.camera == allocation.camera &&
+							entry.stream == allocation.stream &&
+							entry.category == allocation.category;
+					 });
+		if (iter != usage.end())
+			iter->bytes += allocation.bytes;
+		else
+			usage.push_back(allocation);
+	}
+
+	locker.unlock();
+
+	std::sort(usage.begin(), usage.end(),
+		  [](const MemoryUsage &a, const MemoryUsage &b) {
+			  return std::tie(a.camera, a.stream, a.category) <
+				 std::tie(b.camera, b.stream, b.category);
+		  });
+
+	return usage;
+}
+
+void MemoryTracker::release(uint64_t id)
+{
+	MutexLocker locker(mutex_);
+	allocations_.erase(id);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * memory_usage.cpp - Memory held by libcamera
+ */
+
+#include <libcamera/memory_usage.h>
+
+/**
+ * \file memory_usage.h
+ * \brief Memory held by libcamera
+ */
+
+namespace libcamera {
+
+/**
+ * \struct MemoryUsage
+ * \brief Amount of memory held by libcamera for a category of allocations
+ *
+ * The MemoryUsage reports the number of bytes held by libcamera for one
+ * category of allocations of a stream of a camera. The memory usage of all
+ * cameras is retrieved with CameraManager::memoryUsage(), which returns one
+ * entry per camera, stream and category with a non-zero number of bytes.
+ * Applications can sum the entries to enforce a memory budget, or compare
+ * them across reconfigurations to detect leaks.
+ *
+ * Only memory whose size scales with the stream configurations is accounted
+ * for, small allocations for the internal state of libcamera are not.
+ */
+
+/**
+ * \enum MemoryUsage::Category
+ * \brief Category of the memory allocations
+ *
+ * \var MemoryUsage::Category::FrameBuffers
+ * \brief Frame buffers allocated for the application with a
+ * FrameBufferAllocator
+ *
+ * \var MemoryUsage::Category::InternalBuffers
+ * \brief Buffers allocated by the pipeline handler for its internal use,
+ * such as raw frames or statistics
+ *
+ * \var MemoryUsage::Category::IPABuffers
+ * \brief Buffers allocated by the pipeline handler to be shared with the IPA
+ * module, such as lens shading tables
+ */
+
+/**
+ * \brief Retrieve the name of a memory category
+ * \param[in] category The memory category
+ * \return The name of the \a category, or "Unknown" if the category is not
+ * valid
+ */
+const char *MemoryUsage::categoryName(Category category)
+{
+	switch (category) {
+	case Category::FrameBuffers:
+		return "FrameBuffers";
+	case Category::InternalBuffers:
+		return "InternalBuffers";
+	case Category::IPABuffers:
+		return "IPABuffers";
+	}
+
+	return "Unknown";
+}
+
+/**
+ * \var MemoryUsage::camera
+ * \brief The ID of the camera holding the memory
+ */
+
+/**
+ * \var MemoryUsage::stream
+ * \brief The name of the stream holding the memory
+ *
+ * Stream names are specific to each pipeline handler. Frame buffers allocated
+ * for the application are reported with the stream configuration, as returned
+ * by StreamConfiguration::toString().
+ */
+
+/**
+ * \var MemoryUsage::category
+ * \brief The category of the memory
+ */
+
+/**
+ * \var MemoryUsage::bytes
+ * \brief The number of bytes held
+ */
+
+} /* namespace libcamera */
@@ -7,8 +7,12 @@
 
 #include "cio2.h"
 
+#include <algorithm>
+#include <optional>
+
 #include <linux/media-bus-format.h>
 
+#include <libcamera/control_ids.h>
 #include <libcamera/formats.h>
 #include <libcamera/geometry.h>
 #include <libcamera/stream.h>
@@ -76,6 +80,51 @@ std::vector<SizeRange> CIO2Device::sizes() const
 	return sizes;
 }
 
+namespace {
+
+/* Retrieve the link between the sensor and the CSI-2 receiver at \a index. */
+MediaLink *sensorLink(const MediaDevice *media, unsigned int index)
+{
+	std::string csi2Name = "ipu3-csi2 " + std::to_string(index);
+	MediaEntity *csi2Entity = media->getEntityByName(csi2Name);
+	const std::vector<MediaPad *> &pads = csi2Entity->pads();
+	if (pads.empty())
+		return nullptr;
+
+	/* IPU3 CSI-2 receivers have a single sink pad at index 0. */
+	MediaPad *sink = pads[0];
+	const std::vector<MediaLink *> &links = sink->links();
+	if (links.empty())
+		return nullptr;
+
+	return links[0];
+}
+
+} /* namespace */
+
+/**
+ * \brief Create the camera sensor connected to the CIO2 device with \a index
+ * \param[in] media The CIO2 media device
+ * \param[in] index The CIO2 device index
+ *
+ * Create the CameraSensor instance for the image sensor connected to the CSI-2
+ * receiver of this CIO2 instance, without initializing it. This allows the
+ * caller to initialize the sensors of all CIO2 instances concurrently with
+ * CameraSensor::init() before calling init().
+ *
+ * \return The camera sensor, or nullptr if no sensor is connected to this CIO2
+ * instance
+ */
+CameraSensor *CIO2Device::createSensor(const MediaDevice *media, unsigned int index)
+{
+	MediaLink *link = sensorLink(media, index);
+	if (!link)
+		return nullptr;
+
+	sensor_ = std::make_unique<CameraSensor>(link->source()->entity());
+	return sensor_.get();
+}
+
 /**
  * \brief Initialize components of the CIO2 device with \a index
  * \param[in] media The CIO2 media device
@@ -86,6 +135,10 @@ std::vector<SizeRange> CIO2Device::sizes() const
  * this CIO2 instance.  Enable the media links connecting the CIO2 components
  * to prepare for capture operations and cached the sensor maximum size.
  *
+ * If the camera sensor has been created with createSensor(), the caller shall
+ * have initialized it successfully before calling this function. Otherwise
+ * the sensor is created and initialized here.
+ *
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV No supported image sensor is connected to this CIO2 instance
  */
@@ -97,24 +150,16 @@ int CIO2Device::init(const MediaDevice *media, unsigned int index)
 	 * Verify that a sensor subdevice is connected to this CIO2 instance
 	 * and enable the media link between the two.
 	 */
-	std::string csi2Name = "ipu3-csi2 " + std::to_string(index);
-	MediaEntity *csi2Entity = media->getEntityByName(csi2Name);
-	const std::vector<MediaPad *> &pads = csi2Entity->pads();
-	if (pads.empty())
+	MediaLink *link = sensorLink(media, index);
+	if (!link)
 		return -ENODEV;
 
-	/* IPU3 CSI-2 receivers have a single sink pad at index 0. */
-	MediaPad *sink = pads[0];
-	const std::vector<MediaLink *> &links = sink->links();
-	if (links.empty())
-		return -ENODEV;
-
-	MediaLink *link = links[0];
-	MediaEntity *sensorEntity = link->source()->entity();
-	sensor_ = std::make_unique<CameraSensor>(sensorEntity);
-	ret = sensor_->init();
-	if (ret)
-		return ret;
+	if (!sensor_) {
+		sensor_ = std::make_unique<CameraSensor>(link->source()->entity());
+		ret = sensor_->init();
+		if (ret)
+			return ret;
+	}
 
 	ret = link->setEnabled(true);
 	if (ret)
@@ -142,14 +187,20 @@ int CIO2Device::init(const MediaDevice *media, unsigned int index)
 	 * might impact on power consumption.
 	 */
 
-	csi2_ = std::make_unique<V4L2Subdevice>(csi2Entity);
+	csi2_ = std::make_unique<V4L2Subdevice>(link->sink()->entity());
 	ret = csi2_->open();
 	if (ret)
 		return ret;
 
 	std::string cio2Name = "ipu3-cio2 " + std::to_string(index);
 	output_ = V4L2VideoDevice::fromEntityName(media, cio2Name);
-	return output_->open();
+	ret = output_->open();
+	if (ret)
+		return ret;
+
+	output_->bufferReady.connect(this, &CIO2Device::cio2BufferReady);
+
+	return 0;
 }
 
 /**
@@ -225,24 +276,62 @@ int CIO2Device::exportBuffers(unsigned int count,
 	return output_->exportBuffers(count, buffers);
 }
 
-int CIO2Device::start()
+/**
+ * \brief Allocate the CIO2 internal buffers
+ * \param[in] bufferCount The number of frames in flight for requests
+ * \param[in] zslDepth The number of captured frames to keep for zero shutter
+ * lag operation, 0 to disable it
+ *
+ * Internal buffers are allocated to capture frames for requests that don't
+ * contain a raw buffer. Their number is sized to \a bufferCount, independently
+ * of the raw stream buffer count.
+ *
+ * In zero shutter lag mode, \a zslDepth additional buffers are allocated and
+ * the CIO2 streams continuously into the internal buffers. The last
+ * \a zslDepth captured frames are kept in a RawFrameRing, and requests without
+ * a raw buffer are served with one of them by takeCapturedBuffer(), instead of
+ * waiting for a frame to be captured after they are queued.
+ *
+ * The buffers are released by freeBuffers().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CIO2Device::allocateBuffers(unsigned int bufferCount, unsigned int zslDepth)
 {
-	int ret = output_->exportBuffers(CIO2_BUFFER_COUNT, &buffers_);
+	unsigned int count = std::max(bufferCount, CIO2_BUFFER_COUNT) + zslDepth;
+
+	int ret = output_->exportBuffers(count, &buffers_);
 	if (ret < 0)
 		return ret;
 
-	ret = output_->importBuffers(CIO2_BUFFER_COUNT);
-	if (ret)
+	ret = output_->importBuffers(count);
+	if (ret) {
 		LOG(IPU3, Error) << "Failed to import CIO2 buffers";
+		freeBuffers();
+		return ret;
+	}
 
 	for (std::unique_ptr<FrameBuffer> &buffer : buffers_)
 		availableBuffers_.push(buffer.get());
 
-	ret = output_->streamOn();
-	if (ret) {
-		freeBuffers();
+	zslRing_.reset(zslDepth);
+
+	return 0;
+}
+
+/**
+ * \brief Start capture on the CIO2
+ *
+ * The internal buffers must have been allocated with allocateBuffers(). In zero
+ * shutter lag mode, they are all queued to the CIO2 output.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CIO2Device::start()
+{
+	int ret = output_->streamOn();
+	if (ret)
 		return ret;
-	}
 
 	ret = csi2_->setFrameStartEnabled(true);
 	if (ret) {
@@ -250,9 +339,34 @@ int CIO2Device::start()
 		return ret;
 	}
 
+	/*
+	 * Keep all internal buffers queued in zero shutter lag mode, captured
+	 * frames are handed to requests from the zero shutter lag ring.
+	 */
+	if (zslRing_.capacity()) {
+		while (!availableBuffers_.empty()) {
+			FrameBuffer *buffer = availableBuffers_.front();
+			availableBuffers_.pop();
+
+			buffer->_d()->setRequest(nullptr);
+			ret = output_->queueBuffer(buffer);
+			if (ret) {
+				stop();
+				return ret;
+			}
+		}
+	}
+
 	return 0;
 }
 
+/**
+ * \brief Stop capture on the CIO2
+ *
+ * The internal buffers are kept allocated until freeBuffers() is called.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
 int CIO2Device::stop()
 {
 	int ret;
@@ -261,8 +375,6 @@ int CIO2Device::stop()
 
 	ret = output_->streamOff();
 
-	freeBuffers();
-
 	return ret;
 }
 
@@ -289,6 +401,30 @@ FrameBuffer *CIO2Device::queueBuffer(Request *request, FrameBuffer *rawBuffer)
 	return buffer;
 }
 
+/**
+ * \brief Retrieve a frame captured in zero shutter lag mode
+ * \param[in] request The request to associate the frame with
+ *
+ * The frame is selected by the controls::ZeroShutterLagTimestamp control of
+ * \a request, and defaults to the most recent frame if the control isn't
+ * present. The returned buffer has completed capture already.
+ *
+ * \return The captured buffer, or nullptr if zero shutter lag mode is disabled
+ * or no frame has been captured yet
+ */
+FrameBuffer *CIO2Device::takeCapturedBuffer(Request *request)
+{
+	std::optional<RawFrameRing::Frame> frame =
+		zslRing_.take(RawFrameRing::requestedTimestamp(request));
+	if (!frame)
+		return nullptr;
+
+	FrameBuffer *buffer = frame->buffer;
+	buffer->_d()->setRequest(request);
+
+	return buffer;
+}
+
 void CIO2Device::tryReturnBuffer(FrameBuffer *buffer)
 {
 	/*
@@ -298,18 +434,53 @@ void CIO2Device::tryReturnBuffer(FrameBuffer *buffer)
 	 * FrameBuffer.
 	 */
 	for (const std::unique_ptr<FrameBuffer> &buf : buffers_) {
-		if (buf.get() == buffer) {
-			availableBuffers_.push(buffer);
-			break;
+		if (buf.get() != buffer)
+			continue;
+
+		/* Resume capturing to the buffer in zero shutter lag mode. */
+		if (zslRing_.capacity() && buffer->metadata().status != FrameMetadata::FrameCancelled) {
+			buffer->_d()->setRequest(nullptr);
+			if (!output_->queueBuffer(buffer))
+				break;
 		}
+
+		availableBuffers_.push(buffer);
+		break;
+	}
+
+	bufferAvailable.emit();
+}
+
+void CIO2Device::cio2BufferReady(FrameBuffer *buffer)
+{
+	/* Frames captured for requests are handed to the pipeline handler. */
+	if (buffer->request()) {
+		bufferReady_.emit(buffer);
+		return;
 	}
 
+	/* Internal buffers are only queued without a request in ZSL mode. */
+	if (buffer->metadata().status == FrameMetadata::FrameCancelled)
+		return;
+
+	ControlList metadata(controls::controls);
+	metadata.set(controls::SensorTimestamp,
+		     static_cast<int64_t>(buffer->metadata().timestamp));
+
+	FrameBuffer *evicted = zslRing_.push(buffer, std::move(metadata));
+	if (evicted)
+		output_->queueBuffer(evicted);
+
 	bufferAvailable.emit();
 }
 
+/**
+ * \brief Release the CIO2 internal buffers allocated by allocateBuffers()
+ */
 void CIO2Device::freeBuffers()
 {
 	availableBuffers_ = {};
+	zslRing_.reset(0);
 	buffers_.clear();
 
 	if (output_->releaseBuffers())
@@ -13,6 +13,7 @@
 
 #include <libcamera/base/signal.h>
 
+#include "libcamera/internal/raw_frame_ring.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
@@ -37,6 +38,7 @@ public:
 	std::vector<PixelFormat> formats() const;
 	std::vector<SizeRange> sizes() const;
 
+	CameraSensor *createSensor(const MediaDevice *media, unsigned int index);
 	int init(const MediaDevice *media, unsigned int index);
 	int configure(const Size &size, V4L2DeviceFormat *outputFormat);
 
@@ -45,6 +47,9 @@ public:
 	int exportBuffers(unsigned int count,
 			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 
+	int allocateBuffers(unsigned int bufferCount, unsigned int zslDepth = 0);
+	void freeBuffers();
+
 	int start();
 	int stop();
 
@@ -52,15 +57,14 @@ public:
 	const CameraSensor *sensor() const { return sensor_.get(); }
 
 	FrameBuffer *queueBuffer(Request *request, FrameBuffer *rawBuffer);
+	FrameBuffer *takeCapturedBuffer(Request *request);
 	void tryReturnBuffer(FrameBuffer *buffer);
-	Signal<FrameBuffer *> &bufferReady() { return output_->bufferReady; }
+	Signal<FrameBuffer *> &bufferReady() { return bufferReady_; }
 	Signal<uint32_t> &frameStart() { return csi2_->frameStart; }
 
 	Signal<> bufferAvailable;
 
 private:
-	void freeBuffers();
-
 	void cio2BufferReady(FrameBuffer *buffer);
 
 	std::unique_ptr<CameraSensor> sensor_;
@@ -69,6 +73,11 @@ private:
 
 	std::vector<std::unique_ptr<FrameBuffer>> buffers_;
 	std::queue<FrameBuffer *> availableBuffers_;
+
+	/* Frames captured in zero shutter lag mode. */
+	RawFrameRing zslRing_;
+
+	Signal<FrameBuffer *> bufferReady_;
 };
 
 } /* namespace libcamera */
@@ -31,7 +31,12 @@ void IPU3Frames::init(const std::vector<std::unique_ptr<FrameBuffer>> &paramBuff
 	for (const std::unique_ptr<FrameBuffer> &buffer : statBuffers)
 		availableStatBuffers_.push(buffer.get());
 
-	frameInfo_.clear();
+	/*
+	 * Each frame in flight holds a parameters buffer, size the ring of
+	 * frame information accordingly. Entries are indexed by frame id
+	 * modulo the ring size, and are free when they have no request.
+	 */
+	frameInfo_.assign(paramBuffers.size(), {});
 }
 
 void IPU3Frames::clear()
@@ -54,6 +59,12 @@ IPU3Frames::Info *IPU3Frames::create(Request *request)
 		return nullptr;
 	}
 
+	Info *info = &frameInfo_[id % frameInfo_.size()];
+	if (info->request) {
+		LOG(IPU3, Debug) << "Frame information underrun";
+		return nullptr;
+	}
+
 	FrameBuffer *paramBuffer = availableParamBuffers_.front();
 	FrameBuffer *statBuffer = availableStatBuffers_.front();
 
@@ -63,9 +74,6 @@ IPU3Frames::Info *IPU3Frames::create(Request *request)
 	availableParamBuffers_.pop();
 	availableStatBuffers_.pop();
 
-	/* \todo Remove the dynamic allocation of Info */
-	std::unique_ptr<Info> info = std::make_unique<Info>();
-
 	info->id = id;
 	info->request = request;
 	info->rawBuffer = nullptr;
@@ -74,9 +82,7 @@ IPU3Frames::Info *IPU3Frames::create(Request *request)
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
 
-	frameInfo_[id] = std::move(info);
-
-	return frameInfo_[id].get();
+	return info;
 }
 
 void IPU3Frames::remove(IPU3Frames::Info *info)
@@ -85,8 +91,8 @@ void IPU3Frames::remove(IPU3Frames::Info *info)
 	availableParamBuffers_.push(info->paramBuffer);
 	availableStatBuffers_.push(info->statBuffer);
 
-	/* Delete the extended frame information. */
-	frameInfo_.erase(info->id);
+	/* Release the extended frame information. */
+	info->request = nullptr;
 }
 
 bool IPU3Frames::tryComplete(IPU3Frames::Info *info)
@@ -111,10 +117,11 @@ bool IPU3Frames::tryComplete(IPU3Frames::Info *info)
 
 IPU3Frames::Info *IPU3Frames::find(unsigned int id)
 {
-	const auto &itInfo = frameInfo_.find(id);
-
-	if (itInfo != frameInfo_.end())
-		return itInfo->second.get();
+	if (!frameInfo_.empty()) {
+		Info *info = &frameInfo_[id % frameInfo_.size()];
+		if (info->request && info->id == id)
+			return info;
+	}
 
 	LOG(IPU3, Fatal) << "Can't find tracking information for frame " << id;
 
@@ -123,15 +130,15 @@ IPU3Frames::Info *IPU3Frames::find(unsigned int id)
 
 IPU3Frames::Info *IPU3Frames::find(FrameBuffer *buffer)
 {
-	for (auto const &itInfo : frameInfo_) {
-		Info *info = itInfo.second.get();
-
-		for (auto const itBuffers : info->request->buffers())
-			if (itBuffers.second == buffer)
-				return info;
-
-		if (info->rawBuffer == buffer || info->paramBuffer == buffer ||
-		    info->statBuffer == buffer)
+	/*
+	 * All buffers involved in a frame, including the internal raw,
+	 * parameters and statistics buffers, are associated with the request
+	 * until they complete. The request sequence number is the frame id.
+	 */
+	Request *request = buffer->request();
+	if (request && !frameInfo_.empty()) {
+		Info *info = &frameInfo_[request->sequence() % frameInfo_.size()];
+		if (info->request == request)
 			return info;
 	}
 
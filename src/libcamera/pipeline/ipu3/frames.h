@@ -7,12 +7,12 @@
 #ifndef __LIBCAMERA_PIPELINE_IPU3_FRAMES_H__
 #define __LIBCAMERA_PIPELINE_IPU3_FRAMES_H__
 
-#include <map>
 #include <memory>
 #include <queue>
 #include <vector>
 
 #include <libcamera/base/signal.h>
+#include <libcamera/base/utils.h>
 
 namespace libcamera {
 
@@ -36,6 +36,8 @@ public:
 
 		bool paramDequeued;
 		bool metadataProcessed;
+
+		utils::time_point statsReadyTime;
 	};
 
 	IPU3Frames();
@@ -57,7 +59,7 @@ private:
 	std::queue<FrameBuffer *> availableParamBuffers_;
 	std::queue<FrameBuffer *> availableStatBuffers_;
 
-	std::map<unsigned int, std::unique_ptr<Info>> frameInfo_;
+	std::vector<Info> frameInfo_;
 };
 
 } /* namespace libcamera */
@@ -8,12 +8,15 @@
 #include "imgu.h"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <limits>
+#include <map>
 
 #include <linux/media-bus-format.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/formats.h>
@@ -69,7 +72,8 @@ const std::vector<float> gdcScalingFactors = {
 	14.25, 14.5, 14.75, 15, 15.25, 15.5, 15.75, 16,
 };
 
-std::vector<ImgUDevice::PipeConfig> pipeConfigs;
+/* Maximum number of pipe configurations kept in the cache */
+static constexpr unsigned int PIPE_CONFIG_CACHE_SIZE = 32;
 
 struct FOV {
 	float w;
@@ -122,7 +126,8 @@ bool isSameRatio(const Size &in, const Size &out)
 }
 
 void calculateBDSHeight(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc,
-			unsigned int bdsWidth, float bdsSF)
+			unsigned int bdsWidth, float bdsSF,
+			std::vector<ImgUDevice::PipeConfig> &pipeConfigs)
 {
 	unsigned int minIFHeight = iif.height - IF_CROP_MAX_H;
 	unsigned int minBDSHeight = gdc.height + FILTER_H * 2;
@@ -198,7 +203,8 @@ void calculateBDSHeight(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc
 	}
 }
 
-void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, float bdsSF)
+void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, float bdsSF,
+		  std::vector<ImgUDevice::PipeConfig> &pipeConfigs)
 {
 	unsigned int minBDSWidth = gdc.width + FILTER_W * 2;
 	unsigned int minBDSHeight = gdc.height + FILTER_H * 2;
@@ -214,7 +220,8 @@ void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, floa
 			unsigned int bdsIntHeight = static_cast<unsigned int>(bdsHeight);
 			if (!(bdsIntWidth % BDS_ALIGN_W) && bdsWidth >= minBDSWidth &&
 			    !(bdsIntHeight % BDS_ALIGN_H) && bdsHeight >= minBDSHeight)
-				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf);
+				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf,
+						   pipeConfigs);
 		}
 
 		sf += BDS_SF_STEP;
@@ -231,7 +238,8 @@ void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, floa
 			unsigned int bdsIntHeight = static_cast<unsigned int>(bdsHeight);
 			if (!(bdsIntWidth % BDS_ALIGN_W) && bdsWidth >= minBDSWidth &&
 			    !(bdsIntHeight % BDS_ALIGN_H) && bdsHeight >= minBDSHeight)
-				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf);
+				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf,
+						   pipeConfigs);
 		}
 
 		sf -= BDS_SF_STEP;
@@ -287,6 +295,105 @@ FOV calcFOV(const Size &in, const ImgUDevice::PipeConfig &pipe)
 	return fov;
 }
 
+ImgUDevice::PipeConfig searchPipeConfig(ImgUDevice::Pipe *pipe,
+				       ImgUDevice::PipeConfigPolicy policy)
+{
+	std::vector<ImgUDevice::PipeConfig> pipeConfigs;
+
+	LOG(IPU3, Debug) << "Calculating pipe configuration for: ";
+	LOG(IPU3, Debug) << "input: " << pipe->input.toString();
+	LOG(IPU3, Debug) << "main: " << pipe->main.toString();
+	LOG(IPU3, Debug) << "vf: " << pipe->viewfinder.toString();
+
+	const Size &in = pipe->input;
+
+	/*
+	 * \todo Filter out all resolutions < IF_CROP_MAX.
+	 * See https://bugs.libcamera.org/show_bug.cgi?id=32
+	 */
+	if (in.width < IF_CROP_MAX_W || in.height < IF_CROP_MAX_H) {
+		LOG(IPU3, Error) << "Input resolution " << in.toString()
+				 << " not supported";
+		return {};
+	}
+
+	Size gdc = calculateGDC(pipe);
+
+	float bdsSF = static_cast<float>(in.width) / gdc.width;
+	float sf = findScaleFactor(bdsSF, bdsScalingFactors, true);
+
+	/* Populate the configurations vector by scaling width and height. */
+	unsigned int ifWidth = utils::alignUp(in.width, IF_ALIGN_W);
+	unsigned int ifHeight = utils::alignUp(in.height, IF_ALIGN_H);
+	unsigned int minIfWidth = in.width - IF_CROP_MAX_W;
+	unsigned int minIfHeight = in.height - IF_CROP_MAX_H;
+	while (ifWidth >= minIfWidth) {
+		while (ifHeight >= minIfHeight) {
+			Size iif{ ifWidth, ifHeight };
+			calculateBDS(pipe, iif, gdc, sf, pipeConfigs);
+			ifHeight -= IF_ALIGN_H;
+		}
+
+		ifWidth -= IF_ALIGN_W;
+	}
+
+	/* Repeat search by scaling width first. */
+	ifWidth = utils::alignUp(in.width, IF_ALIGN_W);
+	ifHeight = utils::alignUp(in.height, IF_ALIGN_H);
+	minIfWidth = in.width - IF_CROP_MAX_W;
+	minIfHeight = in.height - IF_CROP_MAX_H;
+	while (ifHeight >= minIfHeight) {
+		/*
+		 * \todo This procedure is probably broken:
+		 * https://github.com/intel/intel-ipu3-pipecfg/issues/2
+		 */
+		while (ifWidth >= minIfWidth) {
+			Size iif{ ifWidth, ifHeight };
+			calculateBDS(pipe, iif, gdc, sf, pipeConfigs);
+			ifWidth -= IF_ALIGN_W;
+		}
+
+		ifHeight -= IF_ALIGN_H;
+	}
+
+	if (pipeConfigs.size() == 0) {
+		LOG(IPU3, Error) << "Failed to calculate pipe configuration";
+		return {};
+	}
+
+	/*
+	 * Pick the first configuration with the largest field of view. With
+	 * the MinimumBandwidth policy, pick instead the configuration with the
+	 * smallest BDS output among the ones with the largest field of view,
+	 * which minimizes the amount of data processed by the blocks following
+	 * the BDS.
+	 */
+	FOV bestFov = calcFOV(pipe->input, pipeConfigs[0]);
+	unsigned int bestIndex = 0;
+	unsigned int p = 0;
+	for (const auto &pipeConfig : pipeConfigs) {
+		FOV fov = calcFOV(pipe->input, pipeConfig);
+		if (fov.isLarger(bestFov)) {
+			bestFov = fov;
+			bestIndex = p;
+		} else if (policy == ImgUDevice::PipeConfigPolicy::MinimumBandwidth &&
+			   !bestFov.isLarger(fov) &&
+			   pipeConfig.bds.width * pipeConfig.bds.height <
+			   pipeConfigs[bestIndex].bds.width * pipeConfigs[bestIndex].bds.height) {
+			bestIndex = p;
+		}
+
+		++p;
+	}
+
+	LOG(IPU3, Debug) << "Computed pipe configuration: ";
+	LOG(IPU3, Debug) << "IF: " << pipeConfigs[bestIndex].iif.toString();
+	LOG(IPU3, Debug) << "BDS: " << pipeConfigs[bestIndex].bds.toString();
+	LOG(IPU3, Debug) << "GDC: " << pipeConfigs[bestIndex].gdc.toString();
+
+	return pipeConfigs[bestIndex];
+}
+
 } /* namespace */
 
 /**
@@ -333,6 +440,22 @@ FOV calcFOV(const Size &in, const ImgUDevice::PipeConfig &pipe)
  * \brief The requested viewfinder output size
  */
 
+/**
+ * \enum ImgUDevice::PipeConfigPolicy
+ * \brief Select the pipe configuration among the valid candidates
+ *
+ * \var ImgUDevice::PipeConfigPolicy::LargestFov
+ * \brief Pick the first candidate with the largest field of view
+ *
+ * \var ImgUDevice::PipeConfigPolicy::MinimumBandwidth
+ * \brief Pick the candidate with the smallest BDS output among the ones with
+ * the largest field of view
+ *
+ * Both policies produce the same field of view. The MinimumBandwidth policy
+ * reduces the amount of data processed after the BDS, at the cost of a smaller
+ * image being fed to the GDC, which also changes the IPA statistics grid.
+ */
+
 /**
  * \brief Initialize components of the ImgU instance
  * \param[in] mediaDevice The ImgU instance media device
@@ -394,93 +517,49 @@ int ImgUDevice::init(MediaDevice *media, unsigned int index)
 /**
  * \brief Calculate the ImgU pipe configuration parameters
  * \param[in] pipe The requested ImgU configuration
+ * \param[in] policy The policy used to select the pipe configuration
+ *
+ * The search for the pipe configuration is expensive, and is performed for
+ * every validation and configuration of the camera with the same sizes. Its
+ * results only depend on the input and output sizes and on the \a policy, and
+ * are cached.
+ *
+ * \context This function is \threadsafe.
+ *
  * \return An ImgUDevice::PipeConfig instance on success, an empty configuration
  * otherwise
  */
-ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(Pipe *pipe)
+ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(Pipe *pipe,
+						       PipeConfigPolicy policy)
 {
-	pipeConfigs.clear();
+	using Key = std::array<unsigned int, 7>;
 
-	LOG(IPU3, Debug) << "Calculating pipe configuration for: ";
-	LOG(IPU3, Debug) << "input: " << pipe->input.toString();
-	LOG(IPU3, Debug) << "main: " << pipe->main.toString();
-	LOG(IPU3, Debug) << "vf: " << pipe->viewfinder.toString();
+	static Mutex mutex;
+	static std::map<Key, PipeConfig> cache;
 
-	const Size &in = pipe->input;
+	const Key key = {
+		pipe->input.width, pipe->input.height,
+		pipe->main.width, pipe->main.height,
+		pipe->viewfinder.width, pipe->viewfinder.height,
+		static_cast<unsigned int>(policy),
+	};
 
-	/*
-	 * \todo Filter out all resolutions < IF_CROP_MAX.
-	 * See https://bugs.libcamera.org/show_bug.cgi?id=32
-	 */
-	if (in.width < IF_CROP_MAX_W || in.height < IF_CROP_MAX_H) {
-		LOG(IPU3, Error) << "Input resolution " << in.toString()
-				 << " not supported";
-		return {};
-	}
-
-	Size gdc = calculateGDC(pipe);
-
-	float bdsSF = static_cast<float>(in.width) / gdc.width;
-	float sf = findScaleFactor(bdsSF, bdsScalingFactors, true);
+	MutexLocker locker(mutex);
 
-	/* Populate the configurations vector by scaling width and height. */
-	unsigned int ifWidth = utils::alignUp(in.width, IF_ALIGN_W);
-	unsigned int ifHeight = utils::alignUp(in.height, IF_ALIGN_H);
-	unsigned int minIfWidth = in.width - IF_CROP_MAX_W;
-	unsigned int minIfHeight = in.height - IF_CROP_MAX_H;
-	while (ifWidth >= minIfWidth) {
-		while (ifHeight >= minIfHeight) {
-			Size iif{ ifWidth, ifHeight };
-			calculateBDS(pipe, iif, gdc, sf);
-			ifHeight -= IF_ALIGN_H;
-		}
-
-		ifWidth -= IF_ALIGN_W;
-	}
-
-	/* Repeat search by scaling width first. */
-	ifWidth = utils::alignUp(in.width, IF_ALIGN_W);
-	ifHeight = utils::alignUp(in.height, IF_ALIGN_H);
-	minIfWidth = in.width - IF_CROP_MAX_W;
-	minIfHeight = in.height - IF_CROP_MAX_H;
-	while (ifHeight >= minIfHeight) {
-		/*
-		 * \todo This procedure is probably broken:
-		 * https://github.com/intel/intel-ipu3-pipecfg/issues/2
-		 */
-		while (ifWidth >= minIfWidth) {
-			Size iif{ ifWidth, ifHeight };
-			calculateBDS(pipe, iif, gdc, sf);
-			ifWidth -= IF_ALIGN_W;
-		}
-
-		ifHeight -= IF_ALIGN_H;
+	auto it = cache.find(key);
+	if (it != cache.end()) {
+		LOG(IPU3, Debug) << "Using cached pipe configuration";
+		return it->second;
 	}
 
-	if (pipeConfigs.size() == 0) {
-		LOG(IPU3, Error) << "Failed to calculate pipe configuration";
-		return {};
-	}
-
-	FOV bestFov = calcFOV(pipe->input, pipeConfigs[0]);
-	unsigned int bestIndex = 0;
-	unsigned int p = 0;
-	for (auto pipeConfig : pipeConfigs) {
-		FOV fov = calcFOV(pipe->input, pipeConfig);
-		if (fov.isLarger(bestFov)) {
-			bestFov = fov;
-			bestIndex = p;
-		}
+	PipeConfig pipeConfig = searchPipeConfig(pipe, policy);
 
-		++p;
-	}
+	if (cache.size() >= PIPE_CONFIG_CACHE_SIZE)
+		cache.clear();
 
-	LOG(IPU3, Debug) << "Computed pipe configuration: ";
-	LOG(IPU3, Debug) << "IF: " << pipeConfigs[bestIndex].iif.toString();
-	LOG(IPU3, Debug) << "BDS: " << pipeConfigs[bestIndex].bds.toString();
-	LOG(IPU3, Debug) << "GDC: " << pipeConfigs[bestIndex].gdc.toString();
+	cache[key] = pipeConfig;
 
-	return pipeConfigs[bestIndex];
+	return pipeConfig;
 }
 
 /**
@@ -41,9 +41,15 @@ public:
 		Size viewfinder;
 	};
 
+	enum class PipeConfigPolicy {
+		LargestFov,
+		MinimumBandwidth,
+	};
+
 	int init(MediaDevice *media, unsigned int index);
 
-	PipeConfig calculatePipeConfig(Pipe *pipe);
+	PipeConfig calculatePipeConfig(Pipe *pipe,
+				       PipeConfigPolicy policy = PipeConfigPolicy::LargestFov);
 
 	int configure(const PipeConfig &pipeConfig, V4L2DeviceFormat *inputFormat);
 
@@ -6,12 +6,18 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <iomanip>
+#include <limits>
 #include <memory>
 #include <queue>
+#include <set>
+#include <stdlib.h>
 #include <vector>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/thread_pool.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
@@ -29,6 +35,7 @@
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/tracepoints.h"
 
 #include "cio2.h"
 #include "frames.h"
@@ -47,6 +54,34 @@ static constexpr unsigned int IMGU_OUTPUT_HEIGHT_ALIGN = 4;
 static constexpr unsigned int IMGU_OUTPUT_WIDTH_MARGIN = 64;
 static constexpr unsigned int IMGU_OUTPUT_HEIGHT_MARGIN = 32;
 static constexpr Size IPU3ViewfinderSize(1280, 720);
+static constexpr unsigned int IPU3_MAX_ZSL_FRAMES = 8;
+
+/*
+ * The number of frames kept by the CIO2 for zero shutter lag operation is
+ * read from the LIBCAMERA_IPU3_ZSL_FRAMES environment variable. Zero shutter
+ * lag is disabled by default.
+ */
+static unsigned int zslDepthFromEnv()
+{
+	const char *depth = utils::secure_getenv("LIBCAMERA_IPU3_ZSL_FRAMES");
+	if (!depth || *depth == '\0')
+		return 0;
+
+	unsigned long value = strtoul(depth, nullptr, 10);
+	return std::min<unsigned long>(value, IPU3_MAX_ZSL_FRAMES);
+}
+
+/*
+ * The ImgU pipe configuration minimizing the BDS output size is selected when
+ * the LIBCAMERA_IPU3_MINIMIZE_BANDWIDTH environment variable is set.
+ */
+static ImgUDevice::PipeConfigPolicy pipeConfigPolicyFromEnv()
+{
+	if (utils::secure_getenv("LIBCAMERA_IPU3_MINIMIZE_BANDWIDTH"))
+		return ImgUDevice::PipeConfigPolicy::MinimumBandwidth;
+
+	return ImgUDevice::PipeConfigPolicy::LargestFov;
+}
 
 static const ControlInfoMap::Map IPU3Controls = {
 	{ &controls::draft::PipelineDepth, ControlInfo(2, 3) },
@@ -56,11 +91,15 @@ class IPU3CameraData : public CameraData
 {
 public:
 	IPU3CameraData(PipelineHandler *pipe)
-		: CameraData(pipe), exposureTime_(0), supportsFlips_(false)
+		: CameraData(pipe), imgu_(nullptr), acquiredImgu_(nullptr),
+		  exposureTime_(0), supportsFlips_(false),
+		  zslDepth_(zslDepthFromEnv()),
+		  pipeConfigPolicy_(pipeConfigPolicyFromEnv())
 	{
 	}
 
 	int loadIPA();
+	void setImgU(ImgUDevice *imgu);
 
 	void imguOutputBufferReady(FrameBuffer *buffer);
 	void cio2BufferReady(FrameBuffer *buffer);
@@ -71,6 +110,8 @@ public:
 
 	CIO2Device cio2_;
 	ImgUDevice *imgu_;
+	/* ImgU pipe reserved when acquiring the camera, protected by imguLock_. */
+	ImgUDevice *acquiredImgu_;
 
 	Stream outStream_;
 	Stream vfStream_;
@@ -80,11 +121,14 @@ public:
 	Rectangle cropRegion_;
 	bool supportsFlips_;
 	Transform rotationTransform_;
+	unsigned int zslDepth_;
+	ImgUDevice::PipeConfigPolicy pipeConfigPolicy_;
 
 	std::unique_ptr<DelayedControls> delayedCtrls_;
 	IPU3Frames frameInfos_;
 
 	std::unique_ptr<ipa::ipu3::IPAProxyIPU3> ipa_;
+	std::vector<IPABuffer> ipaBuffers_;
 
 	std::queue<Request *> pendingRequests_;
 
@@ -137,8 +181,11 @@ public:
 	int configure(Camera *camera, CameraConfiguration *config) override;
 
 	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       unsigned int count,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
+	int prepare(Camera *camera, const ControlList *controls) override;
+	void unprepare(Camera *camera) override;
 	int start(Camera *camera, const ControlList *controls) override;
 	void stop(Camera *camera) override;
 
@@ -146,6 +193,10 @@ public:
 
 	bool match(DeviceEnumerator *enumerator) override;
 
+protected:
+	bool acquireDevice(Camera *camera) override;
+	void releaseDevice(Camera *camera) override;
+
 private:
 	IPU3CameraData *cameraData(const Camera *camera)
 	{
@@ -156,7 +207,10 @@ private:
 	int initControls(IPU3CameraData *data);
 	int registerCameras();
 
-	int allocateBuffers(Camera *camera);
+	void releaseImgU(ImgUDevice *imgu);
+
+	void allocateBuffers(Camera *camera, ThreadPool &pool, int *result);
+	void mapBuffers(Camera *camera);
 	int freeBuffers(Camera *camera);
 
 	ImgUDevice imgu0_;
@@ -164,7 +218,13 @@ private:
 	MediaDevice *cio2MediaDev_;
 	MediaDevice *imguMediaDev_;
 
-	std::vector<IPABuffer> ipaBuffers_;
+	/*
+	 * ImgU pipes reserved by the cameras currently acquired. Cameras are
+	 * acquired and released in the application threads, the reservations
+	 * are protected by imguLock_.
+	 */
+	Mutex imguLock_;
+	std::set<ImgUDevice *> acquiredImgus_;
 };
 
 IPU3CameraConfiguration::IPU3CameraConfiguration(IPU3CameraData *data)
@@ -312,8 +372,9 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 			cfg->size = cio2Configuration_.size;
 			cfg->pixelFormat = cio2Configuration_.pixelFormat;
 			cfg->bufferCount = cio2Configuration_.bufferCount;
-			cfg->stride = info.stride(cfg->size.width, 0, 64);
-			cfg->frameSize = info.frameSize(cfg->size, 64);
+			FrameLayout layout = info.frameLayout(cfg->size, 64);
+			cfg->stride = layout.planes[0].stride;
+			cfg->frameSize = layout.frameSize;
 			cfg->setStream(const_cast<Stream *>(&data_->rawStream_));
 
 			LOG(IPU3, Debug) << "Assigned " << cfg->toString()
@@ -356,8 +417,9 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 
 			cfg->pixelFormat = formats::NV12;
 			cfg->bufferCount = IPU3_BUFFER_COUNT;
-			cfg->stride = info.stride(cfg->size.width, 0, 1);
-			cfg->frameSize = info.frameSize(cfg->size, 1);
+			FrameLayout layout = info.frameLayout(cfg->size);
+			cfg->stride = layout.planes[0].stride;
+			cfg->frameSize = layout.frameSize;
 
 			/*
 			 * Use the main output stream in case only one stream is
@@ -395,7 +457,8 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 
 	/* Only compute the ImgU configuration if a YUV stream has been requested. */
 	if (yuvCount) {
-		pipeConfig_ = data_->imgu_->calculatePipeConfig(&pipe);
+		pipeConfig_ = data_->imgu_->calculatePipeConfig(&pipe,
+								data_->pipeConfigPolicy_);
 		if (pipeConfig_.isNull()) {
 			LOG(IPU3, Error) << "Failed to calculate pipe configuration: "
 					 << "unsupported resolutions.";
@@ -508,40 +571,39 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	Stream *outStream = &data->outStream_;
 	Stream *vfStream = &data->vfStream_;
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
 	V4L2DeviceFormat outputFormat;
 	int ret;
 
 	/*
-	 * FIXME: enabled links in one ImgU pipe interfere with capture
-	 * operations on the other one. This can be easily triggered by
-	 * capturing from one camera and then trying to capture from the other
-	 * one right after, without disabling media links on the first used
-	 * pipe.
-	 *
-	 * The tricky part here is where to disable links on the ImgU instance
-	 * which is currently not in use:
-	 * 1) Link enable/disable cannot be done at start()/stop() time as video
-	 * devices needs to be linked first before format can be configured on
-	 * them.
-	 * 2) As link enable has to be done at the least in configure(),
-	 * before configuring formats, the only place where to disable links
-	 * would be 'stop()', but the Camera class state machine allows
-	 * start()<->stop() sequences without any configure() in between.
-	 *
-	 * As of now, disable all links in the ImgU media graph before
-	 * configuring the device, to allow alternate the usage of the two
-	 * ImgU pipes.
-	 *
-	 * As a consequence, a Camera using an ImgU shall be configured before
-	 * any start()/stop() sequence. An application that wants to
-	 * pre-configure all the camera and then start/stop them alternatively
-	 * without going through any re-configuration (a sequence that is
-	 * allowed by the Camera state machine) would now fail on the IPU3.
+	 * Route the camera frames to the ImgU pipe reserved when the camera
+	 * was acquired. This is done here, in the pipeline handler thread, as
+	 * the ImgU signals are emitted in this thread.
 	 */
-	ret = imguMediaDev_->disableLinks();
-	if (ret)
-		return ret;
+	std::set<ImgUDevice *> acquiredImgus;
+	{
+		MutexLocker locker(imguLock_);
+		data->setImgU(data->acquiredImgu_);
+		acquiredImgus = acquiredImgus_;
+	}
+
+	ImgUDevice *imgu = data->imgu_;
+
+	/*
+	 * Enabled links in an ImgU pipe that isn't in use interfere with
+	 * capture operations on the other one. Pipes are reserved by cameras
+	 * when they are acquired, and their links are disabled when the
+	 * camera is released. Disable the links of the pipes not in use here
+	 * as well, as they may have been left enabled by another process.
+	 * The pipe used by another running camera is left untouched.
+	 */
+	for (ImgUDevice *pipe : { &imgu0_, &imgu1_ }) {
+		if (acquiredImgus.count(pipe))
+			continue;
+
+		ret = pipe->enableLinks(false);
+		if (ret)
+			return ret;
+	}
 
 	/*
 	 * \todo: Enable links selectively based on the requested streams.
@@ -670,10 +732,10 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 }
 
 int PipelineHandlerIPU3::exportFrameBuffers(Camera *camera, Stream *stream,
+					    unsigned int count,
 					    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	IPU3CameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
 
 	if (stream == &data->outStream_)
 		return data->imgu_->output_->exportBuffers(count, buffers);
@@ -693,12 +755,17 @@ int PipelineHandlerIPU3::exportFrameBuffers(Camera *camera, Stream *stream,
  * In order to be able to start the 'viewfinder' and 'stat' nodes, we need
  * memory to be reserved.
  */
-int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
+/*
+ * Allocate the ImgU buffers in the pool. The result is stored in the result
+ * argument, and the caller must wait for the pool to become idle before using
+ * the buffers.
+ */
+void PipelineHandlerIPU3::allocateBuffers(Camera *camera, ThreadPool &pool,
+					  int *result)
 {
 	IPU3CameraData *data = cameraData(camera);
 	ImgUDevice *imgu = data->imgu_;
 	unsigned int bufferCount;
-	int ret;
 
 	bufferCount = std::max({
 		data->outStream_.configuration().bufferCount,
@@ -706,30 +773,39 @@ int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
 		data->rawStream_.configuration().bufferCount,
 	});
 
-	ret = imgu->allocateBuffers(bufferCount);
-	if (ret < 0)
-		return ret;
+	pool.run([imgu, bufferCount, result]() {
+		int ret = imgu->allocateBuffers(bufferCount);
+		*result = ret < 0 ? ret : 0;
+	});
+}
+
+void PipelineHandlerIPU3::mapBuffers(Camera *camera)
+{
+	IPU3CameraData *data = cameraData(camera);
+	ImgUDevice *imgu = data->imgu_;
 
 	/* Map buffers to the IPA. */
 	unsigned int ipaBufferId = 1;
 
 	for (const std::unique_ptr<FrameBuffer> &buffer : imgu->paramBuffers_) {
 		buffer->setCookie(ipaBufferId++);
-		ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
+		data->ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
 	}
 
 	for (const std::unique_ptr<FrameBuffer> &buffer : imgu->statBuffers_) {
 		buffer->setCookie(ipaBufferId++);
-		ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
+		data->ipaBuffers_.emplace_back(buffer->cookie(), buffer->planes());
 	}
 
-	data->ipa_->mapBuffers(ipaBuffers_);
+	/*
+	 * Don't wait for the IPA to map the buffers. Calls are processed in
+	 * order, the buffers are mapped before the IPA handles the next call.
+	 */
+	data->ipa_->mapBuffersAsync(data->ipaBuffers_, [] {});
 
 	data->frameInfos_.init(imgu->paramBuffers_, imgu->statBuffers_);
 	data->frameInfos_.bufferAvailable.connect(
 		data, &IPU3CameraData::queuePendingRequests);
-
-	return 0;
 }
 
 int PipelineHandlerIPU3::freeBuffers(Camera *camera)
@@ -739,32 +815,77 @@ int PipelineHandlerIPU3::freeBuffers(Camera *camera)
 	data->frameInfos_.clear();
 
 	std::vector<unsigned int> ids;
-	for (IPABuffer &ipabuf : ipaBuffers_)
+	for (IPABuffer &ipabuf : data->ipaBuffers_)
 		ids.push_back(ipabuf.id);
 
-	data->ipa_->unmapBuffers(ids);
-	ipaBuffers_.clear();
+	data->ipa_->unmapBuffersAsync(ids, [] {});
+	data->ipaBuffers_.clear();
 
 	data->imgu_->freeBuffers();
 
 	return 0;
 }
 
-int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+int PipelineHandlerIPU3::prepare(Camera *camera, [[maybe_unused]] const ControlList *controls)
 {
 	IPU3CameraData *data = cameraData(camera);
 	CIO2Device *cio2 = &data->cio2_;
 	ImgUDevice *imgu = data->imgu_;
+	ThreadPool pool(1, "IPU3Buffers");
+	int allocRet = 0;
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = allocateBuffers(camera);
-	if (ret)
-		return ret;
+	/*
+	 * Allocate buffers for internal pipeline usage. The allocation doesn't
+	 * involve the IPA, run it in a separate thread while the IPA starts.
+	 */
+	allocateBuffers(camera, pool, &allocRet);
 
 	ret = data->ipa_->start();
-	if (ret)
-		goto error;
+	pool.wait();
+
+	if (allocRet) {
+		if (!ret)
+			data->ipa_->stop();
+		return allocRet;
+	}
+
+	if (ret) {
+		imgu->freeBuffers();
+		return ret;
+	}
+
+	mapBuffers(camera);
+
+	/*
+	 * The CIO2 internal buffers are sized to the number of frames in
+	 * flight, plus the frames kept for zero shutter lag operation.
+	 */
+	ret = cio2->allocateBuffers(imgu->paramBuffers_.size(), data->zslDepth_);
+	if (ret) {
+		data->ipa_->stop();
+		freeBuffers(camera);
+		return ret;
+	}
+
+	return 0;
+}
+
+void PipelineHandlerIPU3::unprepare(Camera *camera)
+{
+	IPU3CameraData *data = cameraData(camera);
+
+	data->ipa_->stop();
+	data->cio2_.freeBuffers();
+	freeBuffers(camera);
+}
+
+int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+{
+	IPU3CameraData *data = cameraData(camera);
+	CIO2Device *cio2 = &data->cio2_;
+	ImgUDevice *imgu = data->imgu_;
+	int ret;
 
 	/*
 	 * Start the ImgU video devices, buffers will be queued to the
@@ -783,8 +904,6 @@ int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlLis
 error:
 	imgu->stop();
 	cio2->stop();
-	data->ipa_->stop();
-	freeBuffers(camera);
 	LOG(IPU3, Error) << "Failed to start camera " << camera->id();
 
 	return ret;
@@ -797,14 +916,12 @@ void PipelineHandlerIPU3::stop(Camera *camera)
 
 	data->cancelPendingRequests();
 
-	data->ipa_->stop();
-
 	ret |= data->imgu_->stop();
 	ret |= data->cio2_.stop();
 	if (ret)
 		LOG(IPU3, Warning) << "Failed to stop camera " << camera->id();
 
-	freeBuffers(camera);
+	unprepare(camera);
 }
 
 void IPU3CameraData::cancelPendingRequests()
@@ -828,17 +945,37 @@ void IPU3CameraData::queuePendingRequests()
 	while (!pendingRequests_.empty()) {
 		Request *request = pendingRequests_.front();
 
+		/* Skip requests that have become stale while waiting. */
+		if (pipe_->cancelExpiredRequest(request)) {
+			pendingRequests_.pop();
+			continue;
+		}
+
 		IPU3Frames::Info *info = frameInfos_.create(request);
 		if (!info)
 			break;
 
+		/*
+		 * In zero shutter lag mode, serve requests without a raw
+		 * stream buffer with a frame already captured by the CIO2,
+		 * selected by the ZeroShutterLagTimestamp control if present.
+		 */
+		FrameBuffer *reqRawBuffer = request->findBuffer(&rawStream_);
+		FrameBuffer *rawBuffer = nullptr;
+		bool captured = false;
+
+		if (!reqRawBuffer) {
+			rawBuffer = cio2_.takeCapturedBuffer(request);
+			captured = rawBuffer != nullptr;
+		}
+
 		/*
 		 * Queue a buffer on the CIO2, using the raw stream buffer
 		 * provided in the request, if any, or a CIO2 internal buffer
 		 * otherwise.
 		 */
-		FrameBuffer *reqRawBuffer = request->findBuffer(&rawStream_);
-		FrameBuffer *rawBuffer = cio2_.queueBuffer(request, reqRawBuffer);
+		if (!rawBuffer)
+			rawBuffer = cio2_.queueBuffer(request, reqRawBuffer);
 		/*
 		 * \todo If queueBuffer fails in queuing a buffer to the device,
 		 * report the request as error by cancelling the request and
@@ -858,6 +995,10 @@ void IPU3CameraData::queuePendingRequests()
 		ipa_->processEvent(ev);
 
 		pendingRequests_.pop();
+
+		/* Captured frames are processed right away. */
+		if (captured)
+			cio2BufferReady(rawBuffer);
 	}
 }
 
@@ -967,6 +1108,11 @@ int PipelineHandlerIPU3::initControls(IPU3CameraData *data)
 		controls[&controls::draft::TestPatternMode] = ControlInfo(values);
 	}
 
+	/* Frames can be selected from the history in zero shutter lag mode. */
+	if (data->zslDepth_)
+		controls[&controls::ZeroShutterLagTimestamp] =
+			ControlInfo(INT64_C(0), std::numeric_limits<int64_t>::max());
+
 	/*
 	 * Compute the scaler crop limits.
 	 *
@@ -1068,10 +1214,35 @@ int PipelineHandlerIPU3::registerCameras()
 	 * image sensor is connected to it and the sensor can produce images
 	 * in a compatible format.
 	 */
+	std::array<std::unique_ptr<IPU3CameraData>, 4> cameraData;
+	std::array<int, 4> sensorStatus;
+	std::vector<CameraSensor *> sensors;
+	std::vector<unsigned int> sensorIds;
+
+	/* Probe the sensors of all CSI-2 receivers concurrently. */
+	for (unsigned int id = 0; id < 4; ++id) {
+		cameraData[id] = std::make_unique<IPU3CameraData>(this);
+		sensorStatus[id] = -ENODEV;
+
+		CameraSensor *sensor =
+			cameraData[id]->cio2_.createSensor(cio2MediaDev_, id);
+		if (!sensor)
+			continue;
+
+		sensors.push_back(sensor);
+		sensorIds.push_back(id);
+	}
+
+	std::vector<int> results = CameraSensor::init(sensors);
+	for (unsigned int i = 0; i < sensorIds.size(); ++i)
+		sensorStatus[sensorIds[i]] = results[i];
+
 	unsigned int numCameras = 0;
-	for (unsigned int id = 0; id < 4 && numCameras < 2; ++id) {
-		std::unique_ptr<IPU3CameraData> data =
-			std::make_unique<IPU3CameraData>(this);
+	for (unsigned int id = 0; id < 4; ++id) {
+		if (sensorStatus[id])
+			continue;
+
+		std::unique_ptr<IPU3CameraData> data = std::move(cameraData[id]);
 		std::set<Stream *> streams = {
 			&data->outStream_,
 			&data->vfStream_,
@@ -1094,14 +1265,11 @@ int PipelineHandlerIPU3::registerCameras()
 		if (ret)
 			continue;
 
-		/*
-		 * \todo Read delay values from the sensor itself or from a
-		 * a sensor database. For now use generic values taken from
-		 * the Raspberry Pi and listed as 'generic values'.
-		 */
+		const CameraSensorProperties::SensorDelays &delays =
+			cio2->sensor()->sensorDelays();
 		std::unordered_map<uint32_t, DelayedControls::ControlParams> params = {
-			{ V4L2_CID_ANALOGUE_GAIN, { 1, false } },
-			{ V4L2_CID_EXPOSURE, { 2, false } },
+			{ V4L2_CID_ANALOGUE_GAIN, { delays.gainDelay, false } },
+			{ V4L2_CID_EXPOSURE, { delays.exposureDelay, false } },
 		};
 
 		data->delayedCtrls_ =
@@ -1130,13 +1298,15 @@ int PipelineHandlerIPU3::registerCameras()
 			/* We assume the sensor supports VFLIP too. */
 			data->supportsFlips_ = true;
 
-		/**
-		 * \todo Dynamically assign ImgU and output devices to each
-		 * stream and camera; as of now, limit support to two cameras
-		 * only, and assign imgu0 to the first one and imgu1 to the
-		 * second.
+		/*
+		 * The ImgU pipe is reserved when the camera is acquired. Give
+		 * the cameras alternating preferred pipes, to keep the
+		 * historical assignment of imgu0 to the first camera and imgu1
+		 * to the second one when both are used. The pipe is only used
+		 * to compute configurations until the camera is configured.
 		 */
-		data->imgu_ = numCameras ? &imgu1_ : &imgu0_;
+		data->imgu_ = numCameras % 2 ? &imgu1_ : &imgu0_;
+		data->acquiredImgu_ = data->imgu_;
 
 		/*
 		 * Connect video devices' 'bufferReady' signals to their
@@ -1150,16 +1320,6 @@ int PipelineHandlerIPU3::registerCameras()
 					&IPU3CameraData::cio2BufferReady);
 		data->cio2_.bufferAvailable.connect(
 			data.get(), &IPU3CameraData::queuePendingRequests);
-		data->imgu_->input_->bufferReady.connect(&data->cio2_,
-					&CIO2Device::tryReturnBuffer);
-		data->imgu_->output_->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
-		data->imgu_->viewfinder_->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
-		data->imgu_->param_->bufferReady.connect(data.get(),
-					&IPU3CameraData::paramBufferReady);
-		data->imgu_->stat_->bufferReady.connect(data.get(),
-					&IPU3CameraData::statBufferReady);
 
 		/* Create and register the Camera instance. */
 		std::string cameraId = cio2->sensor()->id();
@@ -1179,6 +1339,108 @@ int PipelineHandlerIPU3::registerCameras()
 	return numCameras ? 0 : -ENODEV;
 }
 
+bool PipelineHandlerIPU3::acquireDevice(Camera *camera)
+{
+	IPU3CameraData *data = cameraData(camera);
+
+	MutexLocker locker(imguLock_);
+
+	/*
+	 * The two ImgU pipes can process frames for two cameras concurrently.
+	 * Reserve a free pipe for the camera, preferring the one it used last.
+	 * The pipe is connected to the camera when it is configured.
+	 */
+	ImgUDevice *imgu = nullptr;
+	for (ImgUDevice *pipe : { data->acquiredImgu_, &imgu0_, &imgu1_ }) {
+		if (!acquiredImgus_.count(pipe)) {
+			imgu = pipe;
+			break;
+		}
+	}
+
+	if (!imgu) {
+		LOG(IPU3, Info)
+			<< "No ImgU pipe available for camera " << camera->id();
+		return false;
+	}
+
+	acquiredImgus_.insert(imgu);
+	data->acquiredImgu_ = imgu;
+
+	LOG(IPU3, Debug)
+		<< "Reserved " << (imgu == &imgu0_ ? "imgu0" : "imgu1")
+		<< " for camera " << camera->id();
+
+	return true;
+}
+
+void PipelineHandlerIPU3::releaseDevice(Camera *camera)
+{
+	IPU3CameraData *data = cameraData(camera);
+
+	MutexLocker locker(imguLock_);
+
+	acquiredImgus_.erase(data->acquiredImgu_);
+
+	/*
+	 * Don't let the links of the idle pipe disturb the other one. The
+	 * links are disabled in the pipeline handler thread, without waiting,
+	 * as this runs in the application thread.
+	 */
+	invokeMethod(&PipelineHandlerIPU3::releaseImgU, ConnectionTypeQueued,
+		     data->acquiredImgu_);
+}
+
+void PipelineHandlerIPU3::releaseImgU(ImgUDevice *imgu)
+{
+	{
+		MutexLocker locker(imguLock_);
+
+		/* The pipe may have been reserved again in the meantime. */
+		if (acquiredImgus_.count(imgu))
+			return;
+	}
+
+	if (imgu->enableLinks(false))
+		LOG(IPU3, Warning) << "Failed to disable ImgU links";
+}
+
+/**
+ * \brief Route the processing of the camera frames to an ImgU pipe
+ * \param[in] imgu The ImgU pipe
+ *
+ * Connect the ImgU video devices 'bufferReady' signals to the camera data
+ * slots, after disconnecting the ones of the previously assigned pipe.
+ */
+void IPU3CameraData::setImgU(ImgUDevice *imgu)
+{
+	/*
+	 * The pipe may already be the current one, but its signals are only
+	 * connected once the camera is configured. Disconnecting signals that
+	 * are not connected is harmless.
+	 */
+	if (imgu_) {
+		imgu_->input_->bufferReady.disconnect(&cio2_);
+		imgu_->output_->bufferReady.disconnect(this);
+		imgu_->viewfinder_->bufferReady.disconnect(this);
+		imgu_->param_->bufferReady.disconnect(this);
+		imgu_->stat_->bufferReady.disconnect(this);
+	}
+
+	imgu_ = imgu;
+
+	imgu_->input_->bufferReady.connect(&cio2_,
+					   &CIO2Device::tryReturnBuffer);
+	imgu_->output_->bufferReady.connect(this,
+					    &IPU3CameraData::imguOutputBufferReady);
+	imgu_->viewfinder_->bufferReady.connect(this,
+						&IPU3CameraData::imguOutputBufferReady);
+	imgu_->param_->bufferReady.connect(this,
+					   &IPU3CameraData::paramBufferReady);
+	imgu_->stat_->bufferReady.connect(this,
+					  &IPU3CameraData::statBufferReady);
+}
+
 int IPU3CameraData::loadIPA()
 {
 	ipa_ = IPAManager::createIPA<ipa::ipu3::IPAProxyIPU3>(pipe_, 1, 1);
@@ -1245,6 +1507,9 @@ void IPU3CameraData::queueFrameAction(unsigned int id,
 				imgu_->viewfinder_->queueBuffer(outbuffer);
 		}
 
+		LIBCAMERA_TRACEPOINT(pipeline_isp_queue, "ipu3", id,
+				     info->rawBuffer);
+
 		imgu_->param_->queueBuffer(info->paramBuffer);
 		imgu_->stat_->queueBuffer(info->statBuffer);
 		imgu_->input_->queueBuffer(info->rawBuffer);
@@ -1257,7 +1522,9 @@ void IPU3CameraData::queueFrameAction(unsigned int id,
 			break;
 
 		Request *request = info->request;
-		request->metadata().merge(action.controls);
+		pipe_->recordLatency(request, RequestLatencyStats::IpaProcessing,
+				     utils::clock::now() - info->statsReadyTime);
+		pipe_->completeMetadata(request, action.controls);
 
 		info->metadataProcessed = true;
 		if (frameInfos_.tryComplete(info))
@@ -1324,8 +1591,9 @@ void IPU3CameraData::cio2BufferReady(FrameBuffer *buffer)
 	 * \todo The sensor timestamp should be better estimated by connecting
 	 * to the V4L2Device::frameStart signal.
 	 */
-	request->metadata().set(controls::SensorTimestamp,
-				buffer->metadata().timestamp);
+	ControlList metadata(controls::controls);
+	metadata.set(controls::SensorTimestamp, buffer->metadata().timestamp);
+	pipe_->completeMetadata(request, metadata);
 
 	/* If the buffer is cancelled force a complete of the whole request. */
 	if (buffer->metadata().status == FrameMetadata::FrameCancelled) {
@@ -1396,6 +1664,7 @@ void IPU3CameraData::statBufferReady(FrameBuffer *buffer)
 	ev.frame = info->id;
 	ev.bufferId = info->statBuffer->cookie();
 	ev.frameTimestamp = request->metadata().get(controls::SensorTimestamp);
+	info->statsReadyTime = utils::clock::now();
 	ipa_->processEvent(ev);
 }
 
@@ -6,10 +6,16 @@
  */
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <chrono>
 #include <fcntl.h>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
+#include <string.h>
+#include <sys/stat.h>
 #include <unordered_set>
 
 #include <libcamera/camera.h>
@@ -23,6 +29,8 @@
 #include <libcamera/property_ids.h>
 #include <libcamera/request.h>
 
+#include <libcamera/base/thread.h>
+#include <libcamera/base/thread_pool.h>
 #include <libcamera/base/utils.h>
 
 #include <linux/bcm2835-isp.h>
@@ -32,13 +40,17 @@
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/delayed_controls.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/dma_heaps.h"
 #include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/formats.h"
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/media_device.h"
+#include "libcamera/internal/memory_tracker.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/raw_frame_ring.h"
+#include "libcamera/internal/tracepoints.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
-#include "dma_heaps.h"
 #include "rpi_stream.h"
 
 namespace libcamera {
@@ -128,9 +140,196 @@ V4L2DeviceFormat findBestMode(V4L2VideoDevice::Formats &formatsMap,
 	return bestMode;
 }
 
+/*
+ * The maximum number of frames that can be processed concurrently by the IPA
+ * and the ISP.
+ */
+constexpr unsigned int MaxPipelineDepth = 3;
+
+/*
+ * Limits for the number of buffers allocated for the internal streams, and
+ * the estimated latency between the capture of a frame and its submission to
+ * the ISP used to size the pools until it has been measured.
+ */
+constexpr unsigned int MinInternalBuffers = 3;
+constexpr unsigned int MaxInternalBuffers = 10;
+constexpr std::chrono::nanoseconds DefaultCaptureLatency = std::chrono::milliseconds(50);
+
+/*
+ * The capture latency estimate follows increases immediately, and decays
+ * towards lower measurements by 1/CaptureLatencyDecay of the difference per
+ * frame, so that a single stall doesn't size the pools forever.
+ */
+constexpr unsigned int CaptureLatencyDecay = 16;
+
+/*
+ * By default, the IPA prepares the ISP parameters for a frame only once the
+ * previous frame has been fully processed. The LIBCAMERA_RPI_PIPELINE_DEPTH
+ * environment variable allows the IPA to prepare the next frames while the ISP
+ * processes the current one, at the cost of control algorithms operating on
+ * statistics that are older by one frame. The ISP still processes one frame at
+ * a time, with the controls prepared for that frame.
+ */
+unsigned int pipelineDepthFromEnv()
+{
+	const char *depth = utils::secure_getenv("LIBCAMERA_RPI_PIPELINE_DEPTH");
+	if (!depth || *depth == '\0')
+		return 1;
+
+	unsigned long value = strtoul(depth, nullptr, 10);
+	return std::clamp<unsigned long>(value, 1, MaxPipelineDepth);
+}
+
+/*
+ * The LIBCAMERA_RPI_ZSL_FRAMES environment variable sets the number of Bayer
+ * frames kept while no request is pending, to serve requests that contain the
+ * ZeroShutterLagTimestamp control. Zero shutter lag is disabled by default.
+ */
+constexpr unsigned int MaxZslFrames = 4;
+
+unsigned int zslFramesFromEnv()
+{
+	const char *frames = utils::secure_getenv("LIBCAMERA_RPI_ZSL_FRAMES");
+	if (!frames || *frames == '\0')
+		return 0;
+
+	unsigned long value = strtoul(frames, nullptr, 10);
+	return std::min<unsigned long>(value, MaxZslFrames);
+}
+
+/*
+ * The LIBCAMERA_RPI_EARLY_RAW environment variable enables completing RAW
+ * stream buffers as soon as the frame is associated with its request, while
+ * the ISP still reads them. Otherwise RAW buffers are completed once the ISP
+ * releases them.
+ */
+bool earlyRawFromEnv()
+{
+	return utils::secure_getenv("LIBCAMERA_RPI_EARLY_RAW") != nullptr;
+}
+
+/*
+ * A third processed stream can be requested for analysis purposes, for instance
+ * to feed a neural network. The ISP has no third output, the stream is instead
+ * downscaled on the CPU from the ISP Output1 image of the same frame. Its size
+ * is limited to bound the processing time added to the frames that carry it.
+ */
+constexpr Size MinAnalysisSize = { 16, 16 };
+constexpr Size MaxAnalysisSize = { 640, 480 };
+
+/*
+ * Downscale an image plane, averaging the 2x2 block of source pixels closest to
+ * each destination pixel. The cost only depends on the destination size.
+ */
+void downscalePlane(const uint8_t *src, const Size &srcSize, unsigned int srcStride,
+		    uint8_t *dst, const Size &dstSize, unsigned int dstStride)
+{
+	for (unsigned int y = 0; y < dstSize.height; ++y) {
+		unsigned int sy = y * srcSize.height / dstSize.height;
+		const uint8_t *line0 = src + sy * srcStride;
+		const uint8_t *line1 = sy + 1 < srcSize.height ? line0 + srcStride : line0;
+		uint8_t *out = dst + y * dstStride;
+
+		for (unsigned int x = 0; x < dstSize.width; ++x) {
+			unsigned int sx0 = x * srcSize.width / dstSize.width;
+			unsigned int sx1 = std::min(sx0 + 1, srcSize.width - 1);
+
+			out[x] = (line0[sx0] + line0[sx1] + line1[sx0] + line1[sx1] + 2) / 4;
+		}
+	}
+}
+
+/*
+ * Downscale a YUV420 image. The source chroma planes are located from the frame
+ * size, as the ISP may pad the luma plane.
+ */
+void downscaleYUV420(const uint8_t *src, const StreamConfiguration &srcCfg,
+		     uint8_t *dst, const StreamConfiguration &dstCfg)
+{
+	const unsigned int srcLumaSize = srcCfg.frameSize * 2 / 3;
+	const unsigned int srcChromaSize = srcCfg.frameSize / 6;
+	const unsigned int dstLumaSize = dstCfg.stride * dstCfg.size.height;
+	const unsigned int dstChromaSize = dstLumaSize / 4;
+
+	downscalePlane(src, srcCfg.size, srcCfg.stride,
+		       dst, dstCfg.size, dstCfg.stride);
+
+	src += srcLumaSize;
+	dst += dstLumaSize;
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		downscalePlane(src, srcCfg.size / 2, srcCfg.stride / 2,
+			       dst, dstCfg.size / 2, dstCfg.stride / 2);
+
+		src += srcChromaSize;
+		dst += dstChromaSize;
+	}
+}
+
 enum class Unicam : unsigned int { Image, Embedded };
 enum class Isp : unsigned int { Input, Output0, Output1, Stats };
 
+/*
+ * Fixed-size FIFO of the buffers dequeued from a Unicam node. The capacity is
+ * set to the number of buffers of the node, which bounds the number of
+ * entries. It only grows if external buffers are added to the node while
+ * streaming.
+ */
+template<typename T>
+class BufferRing
+{
+public:
+	BufferRing()
+		: head_(0), count_(0)
+	{
+	}
+
+	void reset(unsigned int size)
+	{
+		entries_ = std::vector<T>(size);
+		head_ = 0;
+		count_ = 0;
+	}
+
+	bool empty() const { return !count_; }
+	unsigned int size() const { return count_; }
+
+	T &front() { return entries_[head_]; }
+
+	void push(T value)
+	{
+		if (count_ == entries_.size())
+			grow();
+
+		entries_[(head_ + count_) % entries_.size()] = std::move(value);
+		count_++;
+	}
+
+	void pop()
+	{
+		ASSERT(count_);
+		entries_[head_] = T{};
+		head_ = (head_ + 1) % entries_.size();
+		count_--;
+	}
+
+private:
+	void grow()
+	{
+		std::vector<T> entries(std::max<size_t>(entries_.size() * 2, 1));
+
+		for (unsigned int i = 0; i < count_; ++i)
+			entries[i] = std::move(entries_[(head_ + i) % entries_.size()]);
+
+		entries_ = std::move(entries);
+		head_ = 0;
+	}
+
+	std::vector<T> entries_;
+	unsigned int head_;
+	unsigned int count_;
+};
+
 } /* namespace */
 
 class RPiCameraData : public CameraData
@@ -139,8 +338,27 @@ public:
 	RPiCameraData(PipelineHandler *pipe)
 		: CameraData(pipe), state_(State::Stopped),
 		  supportsFlips_(false), flipsAlterBayerOrder_(false),
-		  dropFrameCount_(0), ispOutputCount_(0)
+		  dropFrameCount_(0), pipelineDepth_(pipelineDepthFromEnv()),
+		  zslFrames_(zslFramesFromEnv()), earlyRaw_(earlyRawFromEnv()),
+		  captureLatency_(0),
+		  framesInFlight_(0), ipaCompleteCount_(0),
+		  ispPreparePending_(false), ispOutputCount_(0), ispBusy_(false),
+		  unmatchedBayerCount_(0), unmatchedEmbeddedCount_(0)
 	{
+		controlThread_.setName("RPiControls");
+	}
+
+	~RPiCameraData()
+	{
+		/*
+		 * Hand the Unicam events back to this thread and stop the
+		 * control thread before destroying any of the members it uses.
+		 */
+		if (unicam_[Unicam::Image].dev())
+			unicam_[Unicam::Image].dev()->setEventThread(Thread::current());
+
+		controlThread_.exit();
+		controlThread_.wait();
 	}
 
 	void frameStarted(uint32_t sequence);
@@ -161,10 +379,14 @@ public:
 	void ispOutputDequeue(FrameBuffer *buffer);
 
 	void clearIncompleteRequests();
+	void resetFrames();
 	void handleStreamBuffer(FrameBuffer *buffer, RPi::Stream *stream);
 	void handleExternalBuffer(FrameBuffer *buffer, RPi::Stream *stream);
+	void fillAnalysisBuffer(Request *request, FrameBuffer *source);
 	void handleState();
 	void applyScalerCrop(const ControlList &controls);
+	void findCroppedMode(const V4L2VideoDevice::Formats &formatsMap,
+			     const Size &outputSize, V4L2DeviceFormat *mode);
 
 	std::unique_ptr<ipa::RPi::IPAProxyRPi> ipa_;
 
@@ -174,31 +396,51 @@ public:
 	RPi::Device<Isp, 4> isp_;
 	/* The vector below is just for convenience when iterating over all streams. */
 	std::vector<RPi::Stream *> streams_;
+	/*
+	 * The analysis stream isn't backed by a device, and is thus not part of
+	 * streams_. Its buffers are filled from the ISP Output1 buffers.
+	 */
+	RPi::Stream analysis_;
 	/* Stores the ids of the buffers mapped in the IPA. */
 	std::unordered_set<unsigned int> ipaBuffers_;
 
-	/* DMAHEAP allocation helper. */
-	RPi::DmaHeap dmaHeap_;
-	FileDescriptor lsTable_;
+	/*
+	 * DMAHEAP allocation helper. One lens shading table is allocated per
+	 * frame that can be in flight, the IPA writes the table of a frame
+	 * while the ISP may still read the previous ones.
+	 */
+	DmaHeap dmaHeap_;
+	std::vector<FileDescriptor> lsTables_;
+	MemoryTracker::Allocation lsTableMemory_;
 
+	/*
+	 * Frame start events are handled in a dedicated thread, to write the
+	 * sensor controls within the vertical blanking regardless of the load
+	 * of the pipeline handler thread. The delayed controls are shared
+	 * between the two threads and protected by delayedCtrlsMutex_.
+	 */
+	Thread controlThread_;
+	Mutex delayedCtrlsMutex_;
 	std::unique_ptr<DelayedControls> delayedCtrls_;
 	bool sensorMetadata_;
 
 	/*
-	 * All the functions in this class are called from a single calling
-	 * thread. So, we do not need to have any mutex to protect access to any
-	 * of the variables below.
+	 * All the functions in this class, except frameStarted(), are called
+	 * from a single calling thread. So, we do not need to have any mutex
+	 * to protect access to any of the variables below.
 	 */
-	enum class State { Stopped, Idle, Busy, IpaComplete };
+	enum class State { Stopped, Running };
 	State state_;
 
 	struct BayerFrame {
 		FrameBuffer *buffer;
 		ControlList controls;
+		/* A request was waiting for a frame when this one was captured. */
+		bool requestWaiting;
 	};
 
-	std::queue<BayerFrame> bayerQueue_;
-	std::queue<FrameBuffer *> embeddedQueue_;
+	BufferRing<BayerFrame> bayerQueue_;
+	BufferRing<FrameBuffer *> embeddedQueue_;
 	std::deque<Request *> requestQueue_;
 
 	/*
@@ -215,17 +457,71 @@ public:
 	Rectangle ispCrop_; /* crop in ISP (camera mode) pixels */
 	Rectangle scalerCrop_; /* crop in sensor native pixels */
 	Size ispMinCropSize_;
+	Rectangle requestedCrop_; /* last ScalerCrop requested by the application */
+	Rectangle cropHint_; /* crop to preserve when selecting the sensor mode */
 
 	unsigned int dropFrameCount_;
 
+	/* Start configuration returned by the IPA when preparing the camera. */
+	ipa::RPi::StartConfig startConfig_;
+
+	/* Maximum number of frames processed concurrently by the IPA and ISP. */
+	unsigned int pipelineDepth_;
+
+	/* Number of Bayer frames kept for zero shutter lag capture. */
+	unsigned int zslFrames_;
+	RawFrameRing zslRing_;
+
+	/* Complete RAW buffers before the ISP has released them. */
+	bool earlyRaw_;
+
+	/*
+	 * Estimate of the latency between the capture of a frame and its
+	 * submission to the IPA, kept across configurations to size the
+	 * internal buffer pools. Only frames captured while a request was
+	 * waiting are measured, as the latency of the other frames includes
+	 * the time spent waiting for the application.
+	 */
+	std::chrono::nanoseconds captureLatency_;
+
+	unsigned int internalBufferCount(const ControlList *controls) const;
+
 private:
 	void checkRequestCompleted();
 	void fillRequestMetadata(const ControlList &bufferControls,
 				 Request *request);
 	void tryRunPipeline();
 	bool findMatchingBuffers(BayerFrame &bayerFrame, FrameBuffer *&embeddedBuffer);
+	void stashZslFrames();
+	void queueIspJob();
 
+	/*
+	 * The frames in flight are associated, in order, with the requests at
+	 * the front of requestQueue_. The IPA completes frames in order, the
+	 * first ipaCompleteCount_ frames are waiting for their buffers only.
+	 */
+	unsigned int framesInFlight_;
+	unsigned int ipaCompleteCount_;
+	bool ispPreparePending_;
 	unsigned int ispOutputCount_;
+
+	/*
+	 * Frames prepared by the IPA are queued to the ISP one at a time, with
+	 * their ISP controls applied only once the previous frame has been
+	 * processed.
+	 */
+	struct IspJob {
+		FrameBuffer *buffer;
+		ControlList controls;
+	};
+
+	ControlList ispControls_;
+	std::queue<IspJob> ispJobs_;
+	bool ispBusy_;
+
+	/* Number of Unicam buffers dropped as they couldn't be matched. */
+	unsigned int unmatchedBayerCount_;
+	unsigned int unmatchedEmbeddedCount_;
 };
 
 class RPiCameraConfiguration : public CameraConfiguration
@@ -238,6 +534,9 @@ public:
 	/* Cache the combinedTransform_ that will be applied to the sensor */
 	Transform combinedTransform_;
 
+	/* Index of the analysis stream configuration, or -1 if none. */
+	int analysisIndex_;
+
 private:
 	const RPiCameraData *data_;
 };
@@ -251,11 +550,18 @@ public:
 	int configure(Camera *camera, CameraConfiguration *config) override;
 
 	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       unsigned int count,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
+	int prepare(Camera *camera, const ControlList *controls) override;
+	void unprepare(Camera *camera) override;
 	int start(Camera *camera, const ControlList *controls) override;
 	void stop(Camera *camera) override;
 
+	int reconfigure(Camera *camera, CameraConfiguration *config) override;
+
+	void releaseDevice(Camera *camera) override;
+
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
@@ -266,17 +572,21 @@ private:
 		return static_cast<RPiCameraData *>(PipelineHandler::cameraData(camera));
 	}
 
+	void stopDevices(Camera *camera);
 	int queueAllBuffers(Camera *camera);
-	int prepareBuffers(Camera *camera);
+	void allocateBuffers(Camera *camera, const ControlList *controls,
+			     ThreadPool &pool, std::atomic<int> *error);
+	void prepareBuffers(Camera *camera);
 	void freeBuffers(Camera *camera);
 	void mapBuffers(Camera *camera, const RPi::BufferMap &buffers, unsigned int mask);
+	void unmapBuffers(Camera *camera, unsigned int mask);
 
 	MediaDevice *unicam_;
 	MediaDevice *isp_;
 };
 
 RPiCameraConfiguration::RPiCameraConfiguration(const RPiCameraData *data)
-	: CameraConfiguration(), data_(data)
+	: CameraConfiguration(), analysisIndex_(-1), data_(data)
 {
 }
 
@@ -343,7 +653,7 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 	combinedTransform_ = combined;
 
 	unsigned int rawCount = 0, outCount = 0, count = 0, maxIndex = 0;
-	std::pair<int, Size> outSize[2];
+	std::pair<int, Size> outSize[3];
 	Size maxSize;
 	for (StreamConfiguration &cfg : config_) {
 		if (isRaw(cfg.pixelFormat)) {
@@ -397,18 +707,41 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 
 		count++;
 
-		/* Can only output 1 RAW stream, or 2 YUV/RGB streams. */
-		if (rawCount > 1 || outCount > 2) {
+		/*
+		 * Can only output 1 RAW stream, and 2 YUV/RGB streams from the
+		 * ISP plus the analysis stream.
+		 */
+		if (rawCount > 1 || outCount > 3) {
 			LOG(RPI, Error) << "Invalid number of streams requested";
 			return Invalid;
 		}
 	}
 
+	/*
+	 * With three processed streams, the smallest one is the analysis
+	 * stream, and the other two are produced by the ISP.
+	 */
+	int analysisIndex = -1;
+	if (outCount == 3) {
+		for (unsigned int i = 0; i < outCount; i++) {
+			if (i == maxIndex)
+				continue;
+
+			if (analysisIndex == -1 ||
+			    outSize[i].second < outSize[analysisIndex].second)
+				analysisIndex = i;
+		}
+	}
+
 	/*
 	 * Now do any fixups needed. For the two ISP outputs, one stream must be
 	 * equal or smaller than the other in all dimensions.
 	 */
+	int output1Index = -1;
 	for (unsigned int i = 0; i < outCount; i++) {
+		if (static_cast<int>(i) == analysisIndex)
+			continue;
+
 		outSize[i].second.width = std::min(outSize[i].second.width,
 						   maxSize.width);
 		outSize[i].second.height = std::min(outSize[i].second.height,
@@ -432,10 +765,12 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 		PixelFormat &cfgPixFmt = cfg.pixelFormat;
 		V4L2VideoDevice *dev;
 
-		if (i == maxIndex)
+		if (i == maxIndex) {
 			dev = data_->isp_[Isp::Output0].dev();
-		else
+		} else {
 			dev = data_->isp_[Isp::Output1].dev();
+			output1Index = outSize[i].first;
+		}
 
 		V4L2VideoDevice::Formats fmts = dev->formats();
 
@@ -445,6 +780,13 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 			status = Adjusted;
 		}
 
+		/* The analysis stream is downscaled from a YUV420 Output1. */
+		if (analysisIndex != -1 && i != maxIndex &&
+		    cfgPixFmt != formats::YUV420) {
+			cfgPixFmt = formats::YUV420;
+			status = Adjusted;
+		}
+
 		V4L2DeviceFormat format;
 		format.fourcc = dev->toV4L2PixelFormat(cfg.pixelFormat);
 		format.size = cfg.size;
@@ -458,6 +800,37 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 
 	}
 
+	/*
+	 * The analysis stream is YUV420, and can't be larger than the Output1
+	 * image it is downscaled from.
+	 */
+	if (analysisIndex != -1) {
+		StreamConfiguration &cfg = config_.at(outSize[analysisIndex].first);
+		const Size &output1Size = config_.at(output1Index).size;
+
+		if (cfg.pixelFormat != formats::YUV420) {
+			cfg.pixelFormat = formats::YUV420;
+			status = Adjusted;
+		}
+
+		Size size = cfg.size.boundedTo(MaxAnalysisSize)
+				    .boundedTo(output1Size)
+				    .expandedTo(MinAnalysisSize)
+				    .alignedDownTo(2, 2);
+		if (cfg.size != size) {
+			cfg.size = size;
+			status = Adjusted;
+		}
+
+		const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+		cfg.stride = info.stride(cfg.size.width, 0);
+		cfg.frameSize = info.frameSize(cfg.size);
+
+		analysisIndex_ = outSize[analysisIndex].first;
+	} else {
+		analysisIndex_ = -1;
+	}
+
 	return status;
 }
 
@@ -534,18 +907,28 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 			return nullptr;
 		}
 
-		if (rawCount > 1 || outCount > 2) {
+		if (rawCount > 1 || outCount > 3) {
 			LOG(RPI, Error) << "Invalid stream roles requested";
 			delete config;
 			return nullptr;
 		}
 
-		/* Translate the V4L2PixelFormat to PixelFormat. */
 		std::map<PixelFormat, std::vector<SizeRange>> deviceFormats;
-		for (const auto &format : fmts) {
-			PixelFormat pf = format.first.toPixelFormat();
-			if (pf.isValid())
-				deviceFormats[pf] = format.second;
+		if (role != StreamRole::Raw && outCount == 3) {
+			/*
+			 * The third processed stream is the analysis stream,
+			 * downscaled on the CPU.
+			 */
+			pixelFormat = formats::YUV420;
+			size = { 320, 240 };
+			deviceFormats[pixelFormat] = { SizeRange(MinAnalysisSize, MaxAnalysisSize) };
+		} else {
+			/* Translate the V4L2PixelFormat to PixelFormat. */
+			for (const auto &format : fmts) {
+				PixelFormat pf = format.first.toPixelFormat();
+				if (pf.isValid())
+					deviceFormats[pf] = format.second;
+			}
 		}
 
 		/* Add the stream format based on the device node used for the use case. */
@@ -567,9 +950,22 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	RPiCameraData *data = cameraData(camera);
 	int ret;
 
-	/* Start by resetting the Unicam and ISP stream states. */
-	for (auto const stream : data->streams_)
+	/*
+	 * Start by resetting the Unicam and ISP stream states. The ISP
+	 * statistics buffers are kept across configurations, see
+	 * allocateBuffers().
+	 */
+	for (auto const stream : data->streams_) {
+		if (stream == &data->isp_[Isp::Stats] && stream->hasBuffers())
+			continue;
+
 		stream->reset();
+	}
+
+	data->analysis_.reset();
+
+	const int analysisIndex =
+		static_cast<const RPiCameraConfiguration *>(config)->analysisIndex_;
 
 	Size maxSize, sensorSize;
 	unsigned int maxIndex = 0;
@@ -582,6 +978,9 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	for (unsigned i = 0; i < config->size(); i++) {
 		StreamConfiguration &cfg = config->at(i);
 
+		if (static_cast<int>(i) == analysisIndex)
+			continue;
+
 		if (isRaw(cfg.pixelFormat)) {
 			/*
 			 * If we have been given a RAW stream, use that size
@@ -601,6 +1000,14 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	V4L2VideoDevice::Formats fmts = data->unicam_[Unicam::Image].dev()->formats();
 	V4L2DeviceFormat sensorFormat = findBestMode(fmts, rawStream ? sensorSize : maxSize);
 
+	/*
+	 * When reconfiguring a zoomed camera, prefer a smaller cropped or
+	 * binned sensor mode that still covers the crop, to reduce the
+	 * bandwidth and allow higher frame rates.
+	 */
+	if (!rawStream && !data->cropHint_.isNull())
+		data->findCroppedMode(fmts, maxSize, &sensorFormat);
+
 	/*
 	 * Unicam image output format. The ISP input format gets set at start,
 	 * just in case we have swapped bayer orders due to flips.
@@ -642,6 +1049,12 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 			continue;
 		}
 
+		if (static_cast<int>(i) == analysisIndex) {
+			cfg.setStream(&data->analysis_);
+			data->analysis_.setExternal(true);
+			continue;
+		}
+
 		/* The largest resolution gets routed to the ISP Output 0 node. */
 		RPi::Stream *stream = i == maxIndex ? &data->isp_[Isp::Output0]
 						    : &data->isp_[Isp::Output1];
@@ -729,14 +1142,19 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 		}
 	}
 
-	/* ISP statistics output format. */
-	format = {};
-	format.fourcc = V4L2PixelFormat(V4L2_META_FMT_BCM2835_ISP_STATS);
-	ret = data->isp_[Isp::Stats].dev()->setFormat(&format);
-	if (ret) {
-		LOG(RPI, Error) << "Failed to set format on ISP stats stream: "
-				<< format.toString();
-		return ret;
+	/*
+	 * ISP statistics output format. It never changes, and can't be set
+	 * while buffers are allocated.
+	 */
+	if (!data->isp_[Isp::Stats].hasBuffers()) {
+		format = {};
+		format.fourcc = V4L2PixelFormat(V4L2_META_FMT_BCM2835_ISP_STATS);
+		ret = data->isp_[Isp::Stats].dev()->setFormat(&format);
+		if (ret) {
+			LOG(RPI, Error) << "Failed to set format on ISP stats stream: "
+					<< format.toString();
+			return ret;
+		}
 	}
 
 	/* Figure out the smallest selection the ISP will allow. */
@@ -790,14 +1208,65 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	 */
 	data->properties_.set(properties::ScalerCropMaximum, data->sensorInfo_.analogCrop);
 
+	/* Restore the crop of the camera before the reconfiguration. */
+	if (!ret && !data->cropHint_.isNull()) {
+		ControlList cropControls(controls::controls);
+		cropControls.set(controls::ScalerCrop, data->cropHint_);
+		data->applyScalerCrop(cropControls);
+	}
+
 	return ret;
 }
 
-int PipelineHandlerRPi::exportFrameBuffers([[maybe_unused]] Camera *camera, Stream *stream,
+int PipelineHandlerRPi::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	RPiCameraData *data = cameraData(camera);
+
+	/*
+	 * The sensor mode can't be changed while streaming, applications
+	 * reconfigure the camera to switch to a mode better suited to the
+	 * current digital zoom. Keep the crop across the reconfiguration and
+	 * let configure() select the sensor mode accordingly.
+	 */
+	data->cropHint_ = data->requestedCrop_;
+	int ret = PipelineHandler::reconfigure(camera, config);
+	data->cropHint_ = {};
+
+	return ret;
+}
+
+void PipelineHandlerRPi::releaseDevice(Camera *camera)
+{
+	cameraData(camera)->dmaHeap_.clearPool();
+}
+
+int PipelineHandlerRPi::exportFrameBuffers(Camera *camera, Stream *stream,
+					   unsigned int count,
 					   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
+	RPiCameraData *data = cameraData(camera);
+
+	/* The analysis stream buffers are only accessed by the CPU. */
+	if (stream == &data->analysis_) {
+		unsigned int size = stream->configuration().frameSize;
+
+		for (unsigned int i = 0; i < count; ++i) {
+			FrameBuffer::Plane plane;
+			plane.fd = data->dmaHeap_.alloc("analysis", size);
+			if (!plane.fd.isValid()) {
+				LOG(RPI, Error) << "Failed to allocate analysis buffer";
+				buffers->clear();
+				return -ENOMEM;
+			}
+
+			plane.length = size;
+			buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+		}
+
+		return count;
+	}
+
 	RPi::Stream *s = static_cast<RPi::Stream *>(stream);
-	unsigned int count = stream->configuration().bufferCount;
 	int ret = s->dev()->exportBuffers(count, buffers);
 
 	s->setExportedBuffers(buffers);
@@ -805,26 +1274,75 @@ int PipelineHandlerRPi::exportFrameBuffers([[maybe_unused]] Camera *camera, Stre
 	return ret;
 }
 
-int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
+int PipelineHandlerRPi::prepare(Camera *camera, const ControlList *controls)
 {
 	RPiCameraData *data = cameraData(camera);
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = prepareBuffers(camera);
+	/*
+	 * Allocate buffers for internal pipeline usage. The V4L2 buffer
+	 * allocations don't involve the IPA, run them in a thread pool while
+	 * the IPA is started to reduce the latency to the first frame.
+	 */
+	ThreadPool pool(data->streams_.size(), "RPiBuffers");
+	std::atomic<int> allocError = 0;
+
+	allocateBuffers(camera, controls, pool, &allocError);
+
+	/* Start the IPA. */
+	data->startConfig_ = {};
+	data->ipa_->start(controls ? *controls : ControlList{}, &data->startConfig_);
+
+	pool.wait();
+
+	/*
+	 * Free the recycled buffers that haven't been reused by this
+	 * configuration, the pool only holds the buffers of the last session.
+	 */
+	data->dmaHeap_.clearPool();
+
+	ret = allocError;
 	if (ret) {
 		LOG(RPI, Error) << "Failed to allocate buffers";
-		stop(camera);
+		unprepare(camera);
 		return ret;
 	}
 
+	/* Pass the buffers it needs to the IPA. */
+	prepareBuffers(camera);
+
 	/* Check if a ScalerCrop control was specified. */
 	if (controls)
 		data->applyScalerCrop(*controls);
 
-	/* Start the IPA. */
-	ipa::RPi::StartConfig startConfig;
-	data->ipa_->start(controls ? *controls : ControlList{}, &startConfig);
+	return 0;
+}
+
+void PipelineHandlerRPi::unprepare(Camera *camera)
+{
+	RPiCameraData *data = cameraData(camera);
+
+	/* Stop the IPA. */
+	data->ipa_->stop();
+
+	freeBuffers(camera);
+}
+
+int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
+{
+	RPiCameraData *data = cameraData(camera);
+	ipa::RPi::StartConfig &startConfig = data->startConfig_;
+	int ret;
+
+	/* Size the buffer queues and reset the frame tracking state. */
+	data->resetFrames();
+
+	/*
+	 * Check if a ScalerCrop control was specified. The controls passed to
+	 * prepare() have already been applied, applying them again is harmless.
+	 */
+	if (controls)
+		data->applyScalerCrop(*controls);
 
 	/* Apply any gain/exposure settings that the IPA may have passed back. */
 	if (!startConfig.controls.empty())
@@ -837,7 +1355,7 @@ int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
 	ret = queueAllBuffers(camera);
 	if (ret) {
 		LOG(RPI, Error) << "Failed to queue buffers";
-		stop(camera);
+		stopDevices(camera);
 		return ret;
 	}
 
@@ -849,7 +1367,7 @@ int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
 	data->unicam_[Unicam::Image].dev()->getFormat(&sensorFormat);
 	ret = data->isp_[Isp::Input].dev()->setFormat(&sensorFormat);
 	if (ret) {
-		stop(camera);
+		stopDevices(camera);
 		return ret;
 	}
 
@@ -860,15 +1378,18 @@ int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
 	 * Reset the delayed controls with the gain and exposure values set by
 	 * the IPA.
 	 */
-	data->delayedCtrls_->reset();
+	{
+		MutexLocker locker(data->delayedCtrlsMutex_);
+		data->delayedCtrls_->reset();
+	}
 
-	data->state_ = RPiCameraData::State::Idle;
+	data->state_ = RPiCameraData::State::Running;
 
 	/* Start all streams. */
 	for (auto const stream : data->streams_) {
 		ret = stream->dev()->streamOn();
 		if (ret) {
-			stop(camera);
+			stopDevices(camera);
 			return ret;
 		}
 	}
@@ -877,6 +1398,17 @@ int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
 }
 
 void PipelineHandlerRPi::stop(Camera *camera)
+{
+	stopDevices(camera);
+	unprepare(camera);
+}
+
+/*
+ * Stop streaming and return the buffers queued to the devices, keeping the
+ * resources acquired by prepare(). The Camera class calls unprepare() when
+ * start() fails.
+ */
+void PipelineHandlerRPi::stopDevices(Camera *camera)
 {
 	RPiCameraData *data = cameraData(camera);
 
@@ -889,13 +1421,7 @@ void PipelineHandlerRPi::stop(Camera *camera)
 		stream->dev()->streamOff();
 
 	data->clearIncompleteRequests();
-	data->bayerQueue_ = {};
-	data->embeddedQueue_ = {};
-
-	/* Stop the IPA. */
-	data->ipa_->stop();
-
-	freeBuffers(camera);
+	data->resetFrames();
 }
 
 int PipelineHandlerRPi::queueRequestDevice(Camera *camera, Request *request)
@@ -905,6 +1431,13 @@ int PipelineHandlerRPi::queueRequestDevice(Camera *camera, Request *request)
 	if (data->state_ == RPiCameraData::State::Stopped)
 		return -EINVAL;
 
+	/* The analysis buffer is filled from the Output1 buffer of the request. */
+	if (request->findBuffer(&data->analysis_) &&
+	    !request->findBuffer(&data->isp_[Isp::Output1])) {
+		LOG(RPI, Error) << "Analysis stream requires an ISP Output1 buffer";
+		return -EINVAL;
+	}
+
 	LOG(RPI, Debug) << "queueRequestDevice: New request.";
 
 	/* Push all buffers supplied in the Request to the respective streams. */
@@ -969,6 +1502,15 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	if (!data->dmaHeap_.isValid())
 		return false;
 
+	/*
+	 * Internal buffers are allocated from the CMA heap and recycled when
+	 * the camera stops, to avoid reallocating contiguous memory when it is
+	 * restarted. The pool is bounded by start(), which frees the pooled
+	 * buffers that haven't been reused, and emptied when the camera is
+	 * released.
+	 */
+	data->dmaHeap_.setPoolLimit(std::numeric_limits<std::size_t>::max());
+
 	/* Locate and open the unicam video streams. */
 	data->unicam_[Unicam::Embedded] = RPi::Stream("Unicam Embedded", unicam_->getEntityByName("unicam-embedded"));
 	data->unicam_[Unicam::Image] = RPi::Stream("Unicam Image", unicam_->getEntityByName("unicam-image"));
@@ -1023,9 +1565,20 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	for (auto &stream : data->isp_)
 		data->streams_.push_back(&stream);
 
+	/*
+	 * The Unicam and ISP nodes complete buffers in bursts, for instance
+	 * the ISP outputs and statistics of a frame, or the image and embedded
+	 * data from Unicam. Drain all ready buffers on each event to avoid a
+	 * trip through the event loop for every buffer.
+	 */
 	for (auto stream : data->streams_) {
 		if (stream->dev()->open())
 			return false;
+
+		stream->dev()->setBufferDrainingEnabled(true);
+
+		if (!stream->isImporter())
+			stream->setDmaHeap(&data->dmaHeap_);
 	}
 
 	/*
@@ -1040,8 +1593,27 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	data->delayedCtrls_ = std::make_unique<DelayedControls>(data->unicam_[Unicam::Image].dev(), params);
 	data->sensorMetadata_ = sensorConfig.sensorMetadata;
 
-	/* Register the controls that the Raspberry Pi IPA can handle. */
-	data->controlInfo_ = RPi::Controls;
+	/* Handle frame start events in the control thread. */
+	data->controlThread_.start();
+	data->unicam_[Unicam::Image].dev()->setEventThread(&data->controlThread_);
+
+	/*
+	 * Register the controls that the Raspberry Pi IPA can handle, and the
+	 * zero shutter lag control handled by the pipeline handler if enabled.
+	 */
+	if (data->zslFrames_) {
+		ControlInfoMap::Map controls;
+		for (const auto &[id, info] : RPi::Controls)
+			controls.emplace(id, info);
+
+		controls[&controls::ZeroShutterLagTimestamp] =
+			ControlInfo(INT64_C(0), std::numeric_limits<int64_t>::max());
+
+		data->controlInfo_ = ControlInfoMap(std::move(controls),
+						    controls::controls);
+	} else {
+		data->controlInfo_ = RPi::Controls;
+	}
 	/* Initialize the camera properties. */
 	data->properties_ = data->sensor_->properties();
 
@@ -1102,6 +1674,7 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	streams.insert(&data->unicam_[Unicam::Image]);
 	streams.insert(&data->isp_[Isp::Output0]);
 	streams.insert(&data->isp_[Isp::Output1]);
+	streams.insert(&data->analysis_);
 
 	/* Create and register the camera. */
 	std::shared_ptr<Camera> camera =
@@ -1144,38 +1717,119 @@ int PipelineHandlerRPi::queueAllBuffers(Camera *camera)
 	return 0;
 }
 
-int PipelineHandlerRPi::prepareBuffers(Camera *camera)
+/*
+ * Allocate the buffers of all streams. The allocations run concurrently in the
+ * pool, errors are reported through the error argument, and the caller must
+ * wait for the pool to become idle before using the buffers.
+ */
+void PipelineHandlerRPi::allocateBuffers(Camera *camera, const ControlList *controls,
+					 ThreadPool &pool, std::atomic<int> *error)
 {
 	RPiCameraData *data = cameraData(camera);
-	int ret;
 
 	/*
-	 * Decide how many internal buffers to allocate. For now, simply look
-	 * at how many external buffers will be provided. We'll need to improve
-	 * this logic. However, we really must have all streams allocate the same
-	 * number of buffers to simplify error handling in queueRequestDevice().
+	 * Decide how many internal buffers to allocate. Streams used by the
+	 * application must all allocate the same number of buffers, to
+	 * simplify error handling in queueRequestDevice(). Streams used
+	 * internally only get a number of buffers sized from the frame rate
+	 * and the capture latency.
 	 */
 	unsigned int maxBuffers = 0;
 	for (const Stream *s : camera->streams())
 		if (static_cast<const RPi::Stream *>(s)->isExternal())
 			maxBuffers = std::max(maxBuffers, s->configuration().bufferCount);
 
+	unsigned int internalBuffers = data->internalBufferCount(controls);
+
+	LOG(RPI, Debug) << "Allocating " << maxBuffers << " buffers for external "
+			<< "streams and " << internalBuffers << " for internal streams";
+
+	/*
+	 * The ISP statistics buffers have a fixed size, and are kept allocated
+	 * and mapped in the IPA across configurations. Reuse them if there are
+	 * enough, or reallocate them otherwise.
+	 */
+	RPi::Stream &stats = data->isp_[Isp::Stats];
+	bool statsReused = stats.reuseBuffers(internalBuffers);
+	if (!statsReused && stats.hasBuffers()) {
+		unmapBuffers(camera, ipa::RPi::MaskStats);
+		stats.releaseBuffers();
+	}
+
 	for (auto const stream : data->streams_) {
-		ret = stream->prepareBuffers(maxBuffers);
-		if (ret < 0)
-			return ret;
+		if (stream == &stats && statsReused)
+			continue;
+
+		/* Zero shutter lag frames are held in Unicam buffers. */
+		unsigned int count = internalBuffers;
+		if (stream == &data->unicam_[Unicam::Image])
+			count += data->zslFrames_;
+
+		if (stream->isExternal())
+			count = maxBuffers;
+
+		pool.run([stream, count, error]() {
+			int ret = stream->prepareBuffers(count);
+			if (ret < 0)
+				*error = ret;
+		});
 	}
+}
+
+void PipelineHandlerRPi::prepareBuffers(Camera *camera)
+{
+	RPiCameraData *data = cameraData(camera);
+
+	for (RPi::Stream *stream : data->streams_)
+		stream->trackBuffers(camera->id());
 
 	/*
 	 * Pass the stats and embedded data buffers to the IPA. No other
-	 * buffers need to be passed.
+	 * buffers need to be passed. Reused stats buffers are still mapped.
 	 */
-	mapBuffers(camera, data->isp_[Isp::Stats].getBuffers(), ipa::RPi::MaskStats);
+	bool statsMapped = std::any_of(data->ipaBuffers_.begin(), data->ipaBuffers_.end(),
+				       [](unsigned int id) { return id & ipa::RPi::MaskStats; });
+	if (!statsMapped)
+		mapBuffers(camera, data->isp_[Isp::Stats].getBuffers(), ipa::RPi::MaskStats);
 	if (data->sensorMetadata_)
 		mapBuffers(camera, data->unicam_[Unicam::Embedded].getBuffers(),
 			   ipa::RPi::MaskEmbeddedData);
+}
 
-	return 0;
+/*
+ * Compute the number of buffers for the internal streams. Enough buffers are
+ * needed to cover one frame being captured, one queued to Unicam, the frames
+ * waiting to be submitted to the ISP during the capture latency, and the
+ * frames in flight in the ISP. The shortest frame duration allowed by the
+ * sensor mode and the frame duration limits is used, so that low frame rate
+ * modes, which usually have large frames, use less memory.
+ */
+unsigned int RPiCameraData::internalBufferCount(const ControlList *controls) const
+{
+	using namespace std::chrono;
+
+	if (!sensorInfo_.pixelRate)
+		return MinInternalBuffers;
+
+	nanoseconds frameDuration(sensorInfo_.minFrameLength * sensorInfo_.lineLength *
+				  1000000000ULL / sensorInfo_.pixelRate);
+
+	if (controls && controls->contains(controls::FrameDurationLimits)) {
+		Span<const int64_t> limits =
+			controls->get(controls::FrameDurationLimits);
+		frameDuration = std::max<nanoseconds>(frameDuration,
+						      microseconds(limits[0]));
+	}
+
+	if (frameDuration <= nanoseconds(0))
+		return MinInternalBuffers;
+
+	nanoseconds latency = captureLatency_.count() ? captureLatency_
+						      : DefaultCaptureLatency;
+	unsigned int count = 2 + pipelineDepth_ +
+			     (latency.count() + frameDuration.count() - 1) / frameDuration.count();
+
+	return std::clamp(count, MinInternalBuffers, MaxInternalBuffers);
 }
 
 void PipelineHandlerRPi::mapBuffers(Camera *camera, const RPi::BufferMap &buffers, unsigned int mask)
@@ -1198,24 +1852,52 @@ void PipelineHandlerRPi::mapBuffers(Camera *camera, const RPi::BufferMap &buffer
 	data->ipa_->mapBuffers(ipaBuffers);
 }
 
-void PipelineHandlerRPi::freeBuffers(Camera *camera)
+void PipelineHandlerRPi::unmapBuffers(Camera *camera, unsigned int mask)
 {
 	RPiCameraData *data = cameraData(camera);
+	std::vector<unsigned int> ipaBuffers;
+
+	/* Unmap all the buffers of the type identified by the mask. */
+	for (auto it = data->ipaBuffers_.begin(); it != data->ipaBuffers_.end();) {
+		if (!(*it & mask)) {
+			++it;
+			continue;
+		}
+
+		ipaBuffers.push_back(*it);
+		it = data->ipaBuffers_.erase(it);
+	}
 
-	/* Copy the buffer ids from the unordered_set to a vector to pass to the IPA. */
-	std::vector<unsigned int> ipaBuffers(data->ipaBuffers_.begin(), data->ipaBuffers_.end());
 	data->ipa_->unmapBuffers(ipaBuffers);
-	data->ipaBuffers_.clear();
+}
+
+void PipelineHandlerRPi::freeBuffers(Camera *camera)
+{
+	RPiCameraData *data = cameraData(camera);
+
+	/*
+	 * Free all buffers but the ISP statistics buffers, which are kept for
+	 * the next configuration.
+	 */
+	unmapBuffers(camera, ipa::RPi::MaskEmbeddedData);
+
+	for (auto const stream : data->streams_) {
+		if (stream == &data->isp_[Isp::Stats])
+			continue;
 
-	for (auto const stream : data->streams_)
 		stream->releaseBuffers();
+	}
 }
 
 void RPiCameraData::frameStarted(uint32_t sequence)
 {
 	LOG(RPI, Debug) << "frame start " << sequence;
 
-	/* Write any controls for the next frame as soon as we can. */
+	/*
+	 * Write any controls for the next frame as soon as we can. This runs
+	 * in the control thread.
+	 */
+	MutexLocker locker(delayedCtrlsMutex_);
 	delayedCtrls_->applyControls(sequence);
 }
 
@@ -1235,13 +1917,29 @@ int RPiCameraData::loadIPA(ipa::RPi::SensorConfig *sensorConfig)
 	/*
 	 * The configuration (tuning file) is made from the sensor name unless
 	 * the environment variable overrides it.
+	 *
+	 * Prefer the compiled binary version of the tuning file when it is
+	 * installed alongside the JSON file and is up to date, as it loads
+	 * faster.
 	 */
 	std::string configurationFile;
 	char const *configFromEnv = utils::secure_getenv("LIBCAMERA_RPI_TUNING_FILE");
-	if (!configFromEnv || *configFromEnv == '\0')
+	if (!configFromEnv || *configFromEnv == '\0') {
 		configurationFile = ipa_->configurationFile(sensor_->model() + ".json");
-	else
+
+		std::string binaryFile = configurationFile;
+		if (!binaryFile.empty())
+			binaryFile.replace(binaryFile.size() - 5, 5, ".bin");
+
+		struct stat jsonStat, binaryStat;
+		if (!binaryFile.empty() &&
+		    !stat(configurationFile.c_str(), &jsonStat) &&
+		    !stat(binaryFile.c_str(), &binaryStat) &&
+		    binaryStat.st_mtime >= jsonStat.st_mtime)
+			configurationFile = binaryFile;
+	} else {
 		configurationFile = std::string(configFromEnv);
+	}
 
 	IPASettings settings(configurationFile, sensor_->model());
 
@@ -1274,18 +1972,28 @@ int RPiCameraData::configureIPA(const CameraConfiguration *config)
 	/* Always send the user transform to the IPA. */
 	ipaConfig.transform = static_cast<unsigned int>(config->transform);
 
-	/* Allocate the lens shading table via dmaHeap and pass to the IPA. */
-	if (!lsTable_.isValid()) {
-		lsTable_ = dmaHeap_.alloc("ls_grid", ipa::RPi::MaxLsGridSize);
-		if (!lsTable_.isValid())
-			return -ENOMEM;
+	/* Allocate the lens shading tables via dmaHeap and pass to the IPA. */
+	if (lsTables_.empty()) {
+		while (lsTables_.size() < pipelineDepth_) {
+			FileDescriptor lsTable = dmaHeap_.alloc("ls_grid", ipa::RPi::MaxLsGridSize);
+			if (!lsTable.isValid()) {
+				lsTables_.clear();
+				return -ENOMEM;
+			}
+
+			lsTables_.push_back(std::move(lsTable));
+		}
+
+		lsTableMemory_ = MemoryTracker::instance()->track(sensor_->id(), "ls_grid",
+								  MemoryUsage::Category::IPABuffers,
+								  pipelineDepth_ * ipa::RPi::MaxLsGridSize);
 
-		/* Allow the IPA to mmap the LS table via the file descriptor. */
+		/* Allow the IPA to mmap the LS tables via the file descriptors. */
 		/*
-		 * \todo Investigate if mapping the lens shading table buffer
+		 * \todo Investigate if mapping the lens shading table buffers
 		 * could be handled with mapBuffers().
 		 */
-		ipaConfig.lsTableHandle = lsTable_;
+		ipaConfig.lsTableHandles = lsTables_;
 	}
 
 	/* We store the IPACameraSensorInfo for digital zoom calculations. */
@@ -1330,11 +2038,16 @@ void RPiCameraData::statsMetadataComplete(uint32_t bufferId, const ControlList &
 
 	handleStreamBuffer(buffer, &isp_[Isp::Stats]);
 
-	/* Add to the Request metadata buffer what the IPA has provided. */
-	Request *request = requestQueue_.front();
-	request->metadata().merge(controls);
+	/*
+	 * Add to the Request metadata buffer what the IPA has provided. The
+	 * IPA completes frames in order, this is the oldest frame it hasn't
+	 * completed yet.
+	 */
+	ASSERT(ipaCompleteCount_ < framesInFlight_);
+	Request *request = requestQueue_[ipaCompleteCount_];
+	pipe_->completeMetadata(request, controls);
 
-	state_ = State::IpaComplete;
+	ipaCompleteCount_++;
 	handleState();
 }
 
@@ -1345,14 +2058,40 @@ void RPiCameraData::runIsp(uint32_t bufferId)
 
 	FrameBuffer *buffer = unicam_[Unicam::Image].getBuffers().at(bufferId);
 
-	LOG(RPI, Debug) << "Input re-queue to ISP, buffer id " << bufferId
-			<< ", timestamp: " << buffer->metadata().timestamp;
+	/* Take the ISP controls the IPA has prepared for this frame. */
+	ispJobs_.push({ buffer, std::move(ispControls_) });
+	ispControls_.clear();
 
-	isp_[Isp::Input].queueBuffer(buffer);
-	ispOutputCount_ = 0;
+	queueIspJob();
+
+	ispPreparePending_ = false;
 	handleState();
 }
 
+void RPiCameraData::queueIspJob()
+{
+	if (ispBusy_ || ispJobs_.empty())
+		return;
+
+	IspJob &job = ispJobs_.front();
+
+	if (!job.controls.empty())
+		isp_[Isp::Input].dev()->setControls(&job.controls);
+
+	LOG(RPI, Debug) << "Input re-queue to ISP, buffer id "
+			<< unicam_[Unicam::Image].getBufferId(job.buffer)
+			<< ", timestamp: " << job.buffer->metadata().timestamp;
+
+	LIBCAMERA_TRACEPOINT(pipeline_isp_queue, "raspberrypi",
+			     job.buffer->metadata().sequence, job.buffer);
+
+	isp_[Isp::Input].queueBuffer(job.buffer);
+	ispOutputCount_ = 0;
+	ispBusy_ = true;
+
+	ispJobs_.pop();
+}
+
 void RPiCameraData::embeddedComplete(uint32_t bufferId)
 {
 	if (state_ == State::Stopped)
@@ -1373,16 +2112,27 @@ void RPiCameraData::setIspControls(const ControlList &controls)
 		Span<uint8_t> s = value.data();
 		bcm2835_isp_lens_shading *ls =
 			reinterpret_cast<bcm2835_isp_lens_shading *>(s.data());
-		ls->dmabuf = lsTable_.fd();
+
+		/* The IPA identifies the table it has written by its index. */
+		ASSERT(static_cast<unsigned int>(ls->dmabuf) < lsTables_.size());
+		ls->dmabuf = lsTables_[ls->dmabuf].fd();
 	}
 
-	isp_[Isp::Input].dev()->setControls(&ctrls);
+	/* The controls are applied when the frame is queued to the ISP. */
+	ispControls_ = std::move(ctrls);
 	handleState();
 }
 
 void RPiCameraData::setDelayedControls(const ControlList &controls)
 {
-	if (!delayedCtrls_->push(controls))
+	bool ret;
+
+	{
+		MutexLocker locker(delayedCtrlsMutex_);
+		ret = delayedCtrls_->push(controls);
+	}
+
+	if (!ret)
 		LOG(RPI, Error) << "V4L2 DelayedControl set failed";
 	handleState();
 }
@@ -1437,13 +2187,18 @@ void RPiCameraData::unicamBufferDequeue(FrameBuffer *buffer)
 		 * Lookup the sensor controls used for this frame sequence from
 		 * DelayedControl and queue them along with the frame buffer.
 		 */
-		ControlList ctrl = delayedCtrls_->get(buffer->metadata().sequence);
+		ControlList ctrl;
+		{
+			MutexLocker locker(delayedCtrlsMutex_);
+			ctrl = delayedCtrls_->get(buffer->metadata().sequence);
+		}
 		/*
 		 * Add the frame timestamp to the ControlList for the IPA to use
 		 * as it does not receive the FrameBuffer object.
 		 */
 		ctrl.set(controls::SensorTimestamp, buffer->metadata().timestamp);
-		bayerQueue_.push({ buffer, std::move(ctrl) });
+		bool requestWaiting = requestQueue_.size() > framesInFlight_;
+		bayerQueue_.push({ buffer, std::move(ctrl), requestWaiting });
 	} else {
 		embeddedQueue_.push(buffer);
 	}
@@ -1460,8 +2215,25 @@ void RPiCameraData::ispInputDequeue(FrameBuffer *buffer)
 			<< ", buffer id " << unicam_[Unicam::Image].getBufferId(buffer)
 			<< ", timestamp: " << buffer->metadata().timestamp;
 
-	/* The ISP input buffer gets re-queued into Unicam. */
-	handleStreamBuffer(buffer, &unicam_[Unicam::Image]);
+	/* The ISP is done with this frame, start processing the next one. */
+	ispBusy_ = false;
+	queueIspJob();
+
+	RPi::Stream &raw = unicam_[Unicam::Image];
+
+	/*
+	 * A RAW buffer lent to the application has already been completed.
+	 * Release it, and stop tracking it unless the application has queued
+	 * it again in the meantime. Otherwise the ISP input buffer gets
+	 * re-queued into Unicam.
+	 */
+	if (raw.isHeld(buffer)) {
+		if (!raw.releaseHeldBuffer(buffer))
+			handleExternalBuffer(buffer, &raw);
+	} else {
+		handleStreamBuffer(buffer, &raw);
+	}
+
 	handleState();
 }
 
@@ -1540,15 +2312,28 @@ void RPiCameraData::handleStreamBuffer(FrameBuffer *buffer, RPi::Stream *stream)
 		/*
 		 * It is possible to be here without a pending request, so check
 		 * that we actually have one to action, otherwise we just return
-		 * buffer back to the stream.
+		 * buffer back to the stream. When multiple frames are in flight
+		 * the buffer may belong to any of their requests.
 		 */
-		Request *request = requestQueue_.empty() ? nullptr : requestQueue_.front();
-		if (!dropFrameCount_ && request && request->findBuffer(stream) == buffer) {
+		Request *request = nullptr;
+		unsigned int count = std::max(framesInFlight_, 1U);
+		for (unsigned int i = 0; i < count && i < requestQueue_.size(); ++i) {
+			if (requestQueue_[i]->findBuffer(stream) == buffer) {
+				request = requestQueue_[i];
+				break;
+			}
+		}
+
+		if (!dropFrameCount_ && request) {
 			/*
 			 * Check if this is an externally provided buffer, and if
 			 * so, we must stop tracking it in the pipeline handler.
 			 */
 			handleExternalBuffer(buffer, stream);
+
+			if (stream == &isp_[Isp::Output1])
+				fillAnalysisBuffer(request, buffer);
+
 			/*
 			 * Tag the buffer as completed, returning it to the
 			 * application.
@@ -1578,68 +2363,126 @@ void RPiCameraData::handleExternalBuffer(FrameBuffer *buffer, RPi::Stream *strea
 	stream->removeExternalBuffer(buffer);
 }
 
-void RPiCameraData::handleState()
+/*
+ * Fill the analysis stream buffer of the request, if any, by downscaling the
+ * Output1 image. This runs in the pipeline handler thread before the Output1
+ * buffer is completed, and is bounded by the maximum analysis stream size.
+ */
+void RPiCameraData::fillAnalysisBuffer(Request *request, FrameBuffer *source)
 {
-	switch (state_) {
-	case State::Stopped:
-	case State::Busy:
-		break;
-
-	case State::IpaComplete:
-		/* If the request is completed, we will switch to Idle state. */
-		checkRequestCompleted();
-		/*
-		 * No break here, we want to try running the pipeline again.
-		 * The fallthrough clause below suppresses compiler warnings.
-		 */
-		[[fallthrough]];
+	FrameBuffer *buffer = request->findBuffer(&analysis_);
+	if (!buffer)
+		return;
+
+	const FrameMetadata &sourceMetadata = source->metadata();
+	const MappedFrameBuffer *in = nullptr;
+	const MappedFrameBuffer *out = nullptr;
+	int ret = 0;
+
+	if (sourceMetadata.status == FrameMetadata::FrameSuccess) {
+		ret = source->_d()->map(MappedFrameBuffer::MapFlag::Read, &in);
+		if (!ret)
+			ret = buffer->_d()->map(MappedFrameBuffer::MapFlag::Write, &out);
+		if (ret < 0)
+			LOG(RPI, Error) << "Failed to map analysis buffers: "
+					<< strerror(-ret);
+	}
 
-	case State::Idle:
-		tryRunPipeline();
-		break;
+	if (!in || !out) {
+		buffer->cancel();
+		pipe_->completeBuffer(request, buffer);
+		return;
 	}
+
+	const StreamConfiguration &dstCfg = analysis_.configuration();
+	downscaleYUV420(in->maps()[0].data(), isp_[Isp::Output1].configuration(),
+			out->maps()[0].data(), dstCfg);
+
+	FrameMetadata &metadata = buffer->_d()->metadata();
+	metadata.status = FrameMetadata::FrameSuccess;
+	metadata.sequence = sourceMetadata.sequence;
+	metadata.timestamp = sourceMetadata.timestamp;
+	metadata.planes.resize(1);
+	metadata.planes[0].bytesused = dstCfg.frameSize;
+
+	pipe_->completeBuffer(request, buffer);
+}
+
+void RPiCameraData::handleState()
+{
+	if (state_ == State::Stopped)
+		return;
+
+	/* Retire the completed frames first to make room for new ones. */
+	checkRequestCompleted();
+	tryRunPipeline();
 }
 
 void RPiCameraData::checkRequestCompleted()
 {
-	bool requestCompleted = false;
-	/*
-	 * If we are dropping this frame, do not touch the request, simply
-	 * change the state to IDLE when ready.
-	 */
-	if (!dropFrameCount_) {
-		Request *request = requestQueue_.front();
-		if (request->hasPendingBuffers())
+	/* Must wait for metadata to be filled in before completing. */
+	while (ipaCompleteCount_) {
+		/*
+		 * If we are dropping this frame, do not touch the request,
+		 * simply retire the frame when ready. Make sure we have three
+		 * outputs completed in the case of a dropped frame. Frames
+		 * are not pipelined while dropping, so this is the only frame
+		 * in flight.
+		 */
+		if (dropFrameCount_) {
+			if (ispOutputCount_ != 3)
+				return;
+
+			framesInFlight_--;
+			ipaCompleteCount_--;
+
+			dropFrameCount_--;
+			LOG(RPI, Info) << "Dropping frame at the request of the IPA ("
+				       << dropFrameCount_ << " left)";
 			return;
+		}
 
-		/* Must wait for metadata to be filled in before completing. */
-		if (state_ != State::IpaComplete)
+		Request *request = requestQueue_.front();
+		if (request->hasPendingBuffers())
 			return;
 
 		pipe_->completeRequest(request);
 		requestQueue_.pop_front();
-		requestCompleted = true;
+
+		framesInFlight_--;
+		ipaCompleteCount_--;
 	}
+}
+
+void RPiCameraData::resetFrames()
+{
+	framesInFlight_ = 0;
+	ipaCompleteCount_ = 0;
+	ispPreparePending_ = false;
+
+	ispControls_.clear();
+	ispJobs_ = {};
+	ispBusy_ = false;
+
+	bayerQueue_.reset(unicam_[Unicam::Image].getBuffers().size());
+	embeddedQueue_.reset(unicam_[Unicam::Embedded].getBuffers().size());
 
 	/*
-	 * Make sure we have three outputs completed in the case of a dropped
-	 * frame.
+	 * Zero shutter lag frames are held by the pipeline handler, which is
+	 * only possible with internal Unicam buffers.
 	 */
-	if (state_ == State::IpaComplete &&
-	    ((ispOutputCount_ == 3 && dropFrameCount_) || requestCompleted)) {
-		state_ = State::Idle;
-		if (dropFrameCount_) {
-			dropFrameCount_--;
-			LOG(RPI, Info) << "Dropping frame at the request of the IPA ("
-				       << dropFrameCount_ << " left)";
-		}
-	}
+	bool zslSupported = !unicam_[Unicam::Image].isExternal() &&
+			    !(sensorMetadata_ && unicam_[Unicam::Embedded].isExternal());
+	zslRing_.reset(zslSupported ? zslFrames_ : 0);
+	unmatchedBayerCount_ = 0;
+	unmatchedEmbeddedCount_ = 0;
 }
 
 void RPiCameraData::applyScalerCrop(const ControlList &controls)
 {
 	if (controls.contains(controls::ScalerCrop)) {
 		Rectangle nativeCrop = controls.get<Rectangle>(controls::ScalerCrop);
+		requestedCrop_ = nativeCrop;
 
 		if (!nativeCrop.width || !nativeCrop.height)
 			nativeCrop = { 0, 0, 1, 1 };
@@ -1675,6 +2518,62 @@ void RPiCameraData::applyScalerCrop(const ControlList &controls)
 	}
 }
 
+/*
+ * Select the smallest sensor mode, with the same format as the mode selected
+ * from the output size, that reads out the whole crop and doesn't need to be
+ * upscaled to the output size. Sensors implement those modes with binning or
+ * by cropping the pixel array. The analogue crop of a mode is only known once
+ * it has been applied, the candidate modes are thus set on the sensor in turn.
+ */
+void RPiCameraData::findCroppedMode(const V4L2VideoDevice::Formats &formatsMap,
+				    const Size &outputSize, V4L2DeviceFormat *mode)
+{
+	const Rectangle &crop = cropHint_;
+
+	auto iter = formatsMap.find(mode->fourcc);
+	if (iter == formatsMap.end())
+		return;
+
+	V4L2DeviceFormat bestMode = *mode;
+	uint64_t bestArea = static_cast<uint64_t>(mode->size.width) * mode->size.height;
+
+	for (const SizeRange &sz : iter->second) {
+		const Size &size = sz.max;
+		if (static_cast<uint64_t>(size.width) * size.height >= bestArea)
+			continue;
+
+		V4L2DeviceFormat format{};
+		format.fourcc = mode->fourcc;
+		format.size = size;
+		int ret = unicam_[Unicam::Image].dev()->setFormat(&format);
+		if (ret || format.size != size || format.fourcc != mode->fourcc)
+			continue;
+
+		IPACameraSensorInfo info;
+		if (sensor_->sensorInfo(&info) || info.analogCrop.isNull())
+			continue;
+
+		if (crop.boundedTo(info.analogCrop) != crop)
+			continue;
+
+		uint64_t width = static_cast<uint64_t>(crop.width) *
+				 info.outputSize.width / info.analogCrop.width;
+		uint64_t height = static_cast<uint64_t>(crop.height) *
+				  info.outputSize.height / info.analogCrop.height;
+		if (width < outputSize.width || height < outputSize.height)
+			continue;
+
+		bestMode = format;
+		bestArea = static_cast<uint64_t>(size.width) * size.height;
+	}
+
+	if (bestMode.size != mode->size)
+		LOG(RPI, Info) << "Using mode " << bestMode.toString()
+			       << " for crop " << crop.toString();
+
+	*mode = bestMode;
+}
+
 void RPiCameraData::fillRequestMetadata(const ControlList &bufferControls,
 					Request *request)
 {
@@ -1689,16 +2588,71 @@ void RPiCameraData::tryRunPipeline()
 	FrameBuffer *embeddedBuffer;
 	BayerFrame bayerFrame;
 
-	/* If any of our request or buffer queues are empty, we cannot proceed. */
-	if (state_ != State::Idle || requestQueue_.empty() ||
-	    bayerQueue_.empty() || (embeddedQueue_.empty() && sensorMetadata_))
+	/*
+	 * The IPA prepares one frame at a time, and up to pipelineDepth_
+	 * frames can be in flight. Don't pipeline frames while dropping them,
+	 * as dropped frames don't consume requests.
+	 */
+	unsigned int depth = dropFrameCount_ ? 1 : pipelineDepth_;
+	if (state_ != State::Running)
+		return;
+
+	stashZslFrames();
+
+	if (ispPreparePending_ || framesInFlight_ >= depth)
 		return;
 
-	if (!findMatchingBuffers(bayerFrame, embeddedBuffer))
+	/* If there's no request to action, we cannot proceed. */
+	if (requestQueue_.size() <= framesInFlight_)
 		return;
 
-	/* Take the first request from the queue and action the IPA. */
-	Request *request = requestQueue_.front();
+	/* Take the first request not in flight from the queue and action the IPA. */
+	Request *request = requestQueue_[framesInFlight_];
+
+	/*
+	 * Serve zero shutter lag requests with a frame captured before they
+	 * were queued. The embedded data buffer has been returned to Unicam
+	 * already, the IPA uses the sensor controls of the frame instead.
+	 */
+	std::optional<RawFrameRing::Frame> zslFrame;
+	if (RawFrameRing::requested(request))
+		zslFrame = zslRing_.take(RawFrameRing::requestedTimestamp(request));
+
+	if (zslFrame) {
+		bayerFrame = { zslFrame->buffer, std::move(zslFrame->metadata), false };
+		embeddedBuffer = nullptr;
+	} else {
+		/* If any of our buffer queues are empty, we cannot proceed. */
+		if (bayerQueue_.empty() || (embeddedQueue_.empty() && sensorMetadata_))
+			return;
+
+		if (!findMatchingBuffers(bayerFrame, embeddedBuffer))
+			return;
+
+		/* Track the capture latency to size the buffer pools on next start. */
+		if (bayerFrame.requestWaiting) {
+			std::chrono::nanoseconds latency =
+				utils::clock::now().time_since_epoch() -
+				std::chrono::nanoseconds(bayerFrame.buffer->metadata().timestamp);
+			if (latency > captureLatency_)
+				captureLatency_ = latency;
+			else
+				captureLatency_ -= (captureLatency_ - latency) / CaptureLatencyDecay;
+		}
+	}
+
+	/*
+	 * If the Bayer buffer is the RAW buffer of the request and early RAW
+	 * completion is enabled, lend it to the application right away instead
+	 * of waiting for the ISP to release it. The stream holds the buffer
+	 * until the ISP input buffer is dequeued.
+	 */
+	RPi::Stream &raw = unicam_[Unicam::Image];
+	if (earlyRaw_ && raw.isExternal() && !dropFrameCount_ &&
+	    request->findBuffer(&raw) == bayerFrame.buffer) {
+		raw.holdBuffer(bayerFrame.buffer);
+		pipe_->completeBuffer(request, bayerFrame.buffer);
+	}
 
 	/* See if a new ScalerCrop value needs to be applied. */
 	applyScalerCrop(request->controls());
@@ -1718,8 +2672,9 @@ void RPiCameraData::tryRunPipeline()
 	 */
 	ipa_->signalQueueRequest(request->controls());
 
-	/* Set our state to say the pipeline is active. */
-	state_ = State::Busy;
+	/* Track the frame until the IPA has prepared the ISP parameters. */
+	framesInFlight_++;
+	ispPreparePending_ = true;
 
 	unsigned int bayerId = unicam_[Unicam::Image].getBufferId(bayerFrame.buffer);
 
@@ -1745,124 +2700,113 @@ void RPiCameraData::tryRunPipeline()
 
 bool RPiCameraData::findMatchingBuffers(BayerFrame &bayerFrame, FrameBuffer *&embeddedBuffer)
 {
-	unsigned int embeddedRequeueCount = 0, bayerRequeueCount = 0;
-
-	/* Loop until we find a matching bayer and embedded data buffer. */
-	while (!bayerQueue_.empty()) {
-		/* Start with the front of the bayer queue. */
-		FrameBuffer *bayerBuffer = bayerQueue_.front().buffer;
+	embeddedBuffer = nullptr;
 
-		/*
-		 * Find the embedded data buffer with a matching timestamp to pass to
-		 * the IPA. Any embedded buffers with a timestamp lower than the
-		 * current bayer buffer will be removed and re-queued to the driver.
-		 */
-		uint64_t ts = bayerBuffer->metadata().timestamp;
-		embeddedBuffer = nullptr;
-		while (!embeddedQueue_.empty()) {
-			FrameBuffer *b = embeddedQueue_.front();
-			if (!unicam_[Unicam::Embedded].isExternal() && b->metadata().timestamp < ts) {
-				embeddedQueue_.pop();
-				unicam_[Unicam::Embedded].queueBuffer(b);
-				embeddedRequeueCount++;
-				LOG(RPI, Warning) << "Dropping unmatched input frame in stream "
-						  << unicam_[Unicam::Embedded].name();
-			} else if (unicam_[Unicam::Embedded].isExternal() || b->metadata().timestamp == ts) {
-				/* We pop the item from the queue lower down. */
-				embeddedBuffer = b;
-				break;
-			} else {
-				break; /* Only higher timestamps from here. */
-			}
-		}
+	if (bayerQueue_.empty())
+		return false;
 
-		if (!embeddedBuffer) {
-			bool flushedBuffers = false;
-
-			LOG(RPI, Debug) << "Could not find matching embedded buffer";
-
-			if (!sensorMetadata_) {
-				/*
-				 * If there is no sensor metadata, simply return the
-				 * first bayer frame in the queue.
-				 */
-				LOG(RPI, Debug) << "Returning bayer frame without a match";
-				bayerFrame = std::move(bayerQueue_.front());
-				bayerQueue_.pop();
-				embeddedBuffer = nullptr;
-				return true;
-			}
+	/*
+	 * If there is no sensor metadata, simply return the first bayer frame
+	 * in the queue.
+	 */
+	if (!sensorMetadata_) {
+		bayerFrame = std::move(bayerQueue_.front());
+		bayerQueue_.pop();
+		return true;
+	}
 
-			if (!embeddedQueue_.empty()) {
-				/*
-				 * Not found a matching embedded buffer for the bayer buffer in
-				 * the front of the queue. This buffer is now orphaned, so requeue
-				 * it back to the device.
-				 */
-				unicam_[Unicam::Image].queueBuffer(bayerQueue_.front().buffer);
-				bayerQueue_.pop();
-				bayerRequeueCount++;
-				LOG(RPI, Warning) << "Dropping unmatched input frame in stream "
-						  << unicam_[Unicam::Image].name();
-			}
+	/*
+	 * Embedded data buffers provided by the application are not matched,
+	 * pair the first buffers in the queues.
+	 */
+	if (unicam_[Unicam::Embedded].isExternal()) {
+		if (embeddedQueue_.empty())
+			return false;
 
-			/*
-			 * If we have requeued all available embedded data buffers in this loop,
-			 * then we are fully out of sync, so might as well requeue all the pending
-			 * bayer buffers.
-			 */
-			if (embeddedRequeueCount == unicam_[Unicam::Embedded].getBuffers().size()) {
-				/* The embedded queue must be empty at this point! */
-				ASSERT(embeddedQueue_.empty());
-
-				LOG(RPI, Warning) << "Flushing bayer stream!";
-				while (!bayerQueue_.empty()) {
-					unicam_[Unicam::Image].queueBuffer(bayerQueue_.front().buffer);
-					bayerQueue_.pop();
-				}
-				flushedBuffers = true;
-			}
+		bayerFrame = std::move(bayerQueue_.front());
+		bayerQueue_.pop();
+		embeddedBuffer = embeddedQueue_.front();
+		embeddedQueue_.pop();
+		return true;
+	}
 
-			/*
-			 * Similar to the above, if we have requeued all available bayer buffers in
-			 * the loop, then we are fully out of sync, so might as well requeue all the
-			 * pending embedded data buffers.
-			 */
-			if (bayerRequeueCount == unicam_[Unicam::Image].getBuffers().size()) {
-				/* The bayer queue must be empty at this point! */
-				ASSERT(bayerQueue_.empty());
-
-				LOG(RPI, Warning) << "Flushing embedded data stream!";
-				while (!embeddedQueue_.empty()) {
-					unicam_[Unicam::Embedded].queueBuffer(embeddedQueue_.front());
-					embeddedQueue_.pop();
-				}
-				flushedBuffers = true;
-			}
+	/*
+	 * Both queues are ordered by timestamp. Compare the buffers at the
+	 * front of the queues: if the timestamps match we have found a pair,
+	 * otherwise the buffer with the lowest timestamp can never be matched
+	 * and is requeued to the device.
+	 */
+	while (!bayerQueue_.empty() && !embeddedQueue_.empty()) {
+		FrameBuffer *bayerBuffer = bayerQueue_.front().buffer;
+		FrameBuffer *buffer = embeddedQueue_.front();
+		uint64_t bayerTs = bayerBuffer->metadata().timestamp;
+		uint64_t embeddedTs = buffer->metadata().timestamp;
 
-			/*
-			 * If the embedded queue has become empty, we cannot do any more.
-			 * Similarly, if we have flushed any one of our queues, we cannot do
-			 * any more. Return from here without a buffer pair.
-			 */
-			if (embeddedQueue_.empty() || flushedBuffers)
-				return false;
-		} else {
-			/*
-			 * We have found a matching bayer and embedded data buffer, so
-			 * nothing more to do apart from assigning the bayer frame and
-			 * popping the buffers from the queue.
-			 */
+		if (bayerTs == embeddedTs) {
 			bayerFrame = std::move(bayerQueue_.front());
 			bayerQueue_.pop();
+			embeddedBuffer = buffer;
 			embeddedQueue_.pop();
 			return true;
 		}
+
+		if (embeddedTs < bayerTs) {
+			embeddedQueue_.pop();
+			unicam_[Unicam::Embedded].queueBuffer(buffer);
+			unmatchedEmbeddedCount_++;
+
+			LOG_RATELIMITED(RPI, Warning, std::chrono::seconds(1))
+				<< "Dropping unmatched input frame in stream "
+				<< unicam_[Unicam::Embedded].name() << " ("
+				<< unmatchedEmbeddedCount_ << " dropped)";
+		} else {
+			bayerQueue_.pop();
+			unicam_[Unicam::Image].queueBuffer(bayerBuffer);
+			unmatchedBayerCount_++;
+
+			LOG_RATELIMITED(RPI, Warning, std::chrono::seconds(1))
+				<< "Dropping unmatched input frame in stream "
+				<< unicam_[Unicam::Image].name() << " ("
+				<< unmatchedBayerCount_ << " dropped)";
+		}
 	}
 
+	/* Wait for the buffer matching the front of the non-empty queue. */
+	LOG(RPI, Debug) << "Could not find matching embedded buffer";
+
 	return false;
 }
 
+void RPiCameraData::stashZslFrames()
+{
+	if (!zslRing_.capacity() || dropFrameCount_)
+		return;
+
+	/*
+	 * Keep in the Bayer queue the frames that will be consumed by the
+	 * requests waiting to be actioned, and move the older ones to the zero
+	 * shutter lag ring. Frames evicted from the ring are requeued to
+	 * Unicam.
+	 */
+	unsigned int waiting = requestQueue_.size() - framesInFlight_;
+
+	while (bayerQueue_.size() > waiting) {
+		FrameBuffer *embeddedBuffer;
+		BayerFrame bayerFrame;
+
+		if (!findMatchingBuffers(bayerFrame, embeddedBuffer))
+			break;
+
+		if (embeddedBuffer)
+			unicam_[Unicam::Embedded].queueBuffer(embeddedBuffer);
+
+		FrameBuffer *evicted = zslRing_.push(bayerFrame.buffer,
+						     std::move(bayerFrame.controls));
+		if (evicted)
+			unicam_[Unicam::Image].queueBuffer(evicted);
+	}
+}
+
 REGISTER_PIPELINE_HANDLER(PipelineHandlerRPi)
 
 } /* namespace libcamera */
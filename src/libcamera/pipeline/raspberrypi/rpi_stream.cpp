@@ -10,6 +10,8 @@
 
 #include <libcamera/ipa/raspberrypi_ipa_interface.h>
 
+#include "libcamera/internal/memory_tracker.h"
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(RPISTREAM)
@@ -50,6 +52,16 @@ void Stream::setExportedBuffers(std::vector<std::unique_ptr<FrameBuffer>> *buffe
 		bufferMap_.emplace(id_.get(), buffer.get());
 }
 
+/*
+ * Allocate the internal buffers from a dma-heap instead of exporting them from
+ * the video device. Released buffers are then returned to the heap recycling
+ * pool, and reused when the stream is restarted.
+ */
+void Stream::setDmaHeap(DmaHeap *dmaHeap)
+{
+	dmaHeap_ = dmaHeap;
+}
+
 const BufferMap &Stream::getBuffers() const
 {
 	return bufferMap_;
@@ -90,8 +102,11 @@ int Stream::prepareBuffers(unsigned int count)
 
 	if (!importOnly_) {
 		if (count) {
-			/* Export some frame buffers for internal use. */
-			ret = dev_->exportBuffers(count, &internalBuffers_);
+			/* Allocate or export some frame buffers for internal use. */
+			if (dmaHeap_)
+				ret = allocateBuffers(count);
+			else
+				ret = dev_->exportBuffers(count, &internalBuffers_);
 			if (ret < 0)
 				return ret;
 
@@ -110,6 +125,39 @@ int Stream::prepareBuffers(unsigned int count)
 	return dev_->importBuffers(count);
 }
 
+bool Stream::hasBuffers() const
+{
+	return !internalBuffers_.empty();
+}
+
+/* Account the memory of the internal buffers for the camera. */
+void Stream::trackBuffers(const std::string &camera)
+{
+	for (auto const &buffer : internalBuffers_)
+		MemoryTracker::track(buffer.get(), camera, name_,
+				     MemoryUsage::Category::InternalBuffers);
+}
+
+/*
+ * Make all the internal buffers of the stream available again, instead of
+ * allocating new ones with prepareBuffers(), if at least count buffers have
+ * been allocated. This is only possible for internal streams whose format
+ * doesn't change between configurations.
+ */
+bool Stream::reuseBuffers(unsigned int count)
+{
+	if (external_ || internalBuffers_.size() < std::max(count, 1U))
+		return false;
+
+	availableBuffers_ = std::queue<FrameBuffer *>{};
+	requestBuffers_ = std::queue<FrameBuffer *>{};
+
+	for (auto const &buffer : internalBuffers_)
+		availableBuffers_.push(buffer.get());
+
+	return true;
+}
+
 int Stream::queueBuffer(FrameBuffer *buffer)
 {
 	/*
@@ -133,11 +181,19 @@ int Stream::queueBuffer(FrameBuffer *buffer)
 		availableBuffers_.pop();
 	}
 
+	/*
+	 * If the buffer is still in use by the pipeline, it must wait until
+	 * it gets released.
+	 */
+	auto held = heldBuffers_.find(buffer);
+	if (held != heldBuffers_.end())
+		held->second = true;
+
 	/*
 	 * If no earlier requests are pending to be queued we can go ahead and
 	 * queue this buffer into the device.
 	 */
-	if (requestBuffers_.empty())
+	if (requestBuffers_.empty() && held == heldBuffers_.end())
 		return queueToDevice(buffer);
 
 	/*
@@ -164,9 +220,50 @@ void Stream::returnBuffer(FrameBuffer *buffer)
 	 * Do we have any Request buffers that are waiting to be queued?
 	 * If so, do it now as availableBuffers_ will not be empty.
 	 */
+	queueRequestBuffers();
+}
+
+/*
+ * Lend a buffer to the application while the pipeline keeps using it. The
+ * buffer is not queued to the device, even if the application queues it again,
+ * until releaseHeldBuffer() is called.
+ */
+void Stream::holdBuffer(FrameBuffer *buffer)
+{
+	heldBuffers_.emplace(buffer, false);
+}
+
+bool Stream::isHeld(FrameBuffer *buffer) const
+{
+	return heldBuffers_.count(buffer);
+}
+
+/*
+ * Release a buffer held with holdBuffer(), and queue it to the device if the
+ * application has queued it again. Return true in that case, false otherwise.
+ */
+bool Stream::releaseHeldBuffer(FrameBuffer *buffer)
+{
+	auto it = heldBuffers_.find(buffer);
+	ASSERT(it != heldBuffers_.end());
+
+	bool requeued = it->second;
+	heldBuffers_.erase(it);
+
+	queueRequestBuffers();
+
+	return requeued;
+}
+
+void Stream::queueRequestBuffers()
+{
 	while (!requestBuffers_.empty()) {
 		FrameBuffer *requestBuffer = requestBuffers_.front();
 
+		/* Buffers must be queued in order, wait for the held buffer. */
+		if (requestBuffer && heldBuffers_.count(requestBuffer))
+			break;
+
 		if (!requestBuffer) {
 			/*
 			 * We want to queue an internal buffer, but none
@@ -190,37 +287,97 @@ void Stream::returnBuffer(FrameBuffer *buffer)
 
 int Stream::queueAllBuffers()
 {
-	int ret;
-
 	if (external_)
 		return 0;
 
-	while (!availableBuffers_.empty()) {
-		ret = queueBuffer(availableBuffers_.front());
-		if (ret < 0)
-			return ret;
+	/*
+	 * Internal streams never defer buffers to requestBuffers_, so all the
+	 * available buffers can be queued to the device in one go.
+	 */
+	std::vector<FrameBuffer *> buffers;
+	buffers.reserve(availableBuffers_.size());
 
+	while (!availableBuffers_.empty()) {
+		buffers.push_back(availableBuffers_.front());
 		availableBuffers_.pop();
 	}
 
-	return 0;
+	unsigned int queued;
+	int ret = dev_->queueBuffers(buffers, &queued);
+	if (ret) {
+		LOG(RPISTREAM, Error) << "Failed to queue buffers for "
+				      << name_;
+
+		/* Keep the buffers that haven't been queued available. */
+		for (unsigned int i = queued; i < buffers.size(); i++)
+			availableBuffers_.push(buffers[i]);
+	}
+
+	return ret;
 }
 
 void Stream::releaseBuffers()
 {
 	dev_->releaseBuffers();
+
+	/*
+	 * Recycle the dma-heap buffers once the device and the FrameBuffer
+	 * instances don't reference them anymore.
+	 */
+	std::vector<FileDescriptor> fds;
+	if (dmaHeap_) {
+		for (auto const &buffer : internalBuffers_) {
+			for (const FrameBuffer::Plane &plane : buffer->planes())
+				fds.push_back(plane.fd);
+		}
+	}
+
 	clearBuffers();
+
+	for (FileDescriptor &fd : fds)
+		dmaHeap_->recycle(std::move(fd));
 }
 
 void Stream::clearBuffers()
 {
 	availableBuffers_ = std::queue<FrameBuffer *>{};
 	requestBuffers_ = std::queue<FrameBuffer *>{};
+	heldBuffers_.clear();
 	internalBuffers_.clear();
 	bufferMap_.clear();
 	id_.reset();
 }
 
+int Stream::allocateBuffers(unsigned int count)
+{
+	V4L2DeviceFormat format;
+	int ret = dev_->getFormat(&format);
+	if (ret < 0)
+		return ret;
+
+	for (unsigned int i = 0; i < count; i++) {
+		std::vector<FrameBuffer::Plane> planes;
+
+		for (unsigned int p = 0; p < format.planesCount; p++) {
+			FrameBuffer::Plane plane;
+			plane.fd = dmaHeap_->alloc(name_.c_str(), format.planes[p].size);
+			if (!plane.fd.isValid()) {
+				LOG(RPISTREAM, Error)
+					<< "Failed to allocate buffer for " << name_;
+				internalBuffers_.clear();
+				return -ENOMEM;
+			}
+
+			plane.length = format.planes[p].size;
+			planes.push_back(std::move(plane));
+		}
+
+		internalBuffers_.push_back(std::make_unique<FrameBuffer>(std::move(planes)));
+	}
+
+	return count;
+}
+
 int Stream::queueToDevice(FrameBuffer *buffer)
 {
 	LOG(RPISTREAM, Debug) << "Queuing buffer " << getBufferId(buffer)
@@ -16,6 +16,7 @@
 #include <libcamera/ipa/raspberrypi_ipa_interface.h>
 #include <libcamera/stream.h>
 
+#include "libcamera/internal/dma_heaps.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
 namespace libcamera {
@@ -32,13 +33,15 @@ class Stream : public libcamera::Stream
 {
 public:
 	Stream()
-		: id_(ipa::RPi::MaskID)
+		: external_(false), importOnly_(false), id_(ipa::RPi::MaskID),
+		  dmaHeap_(nullptr)
 	{
 	}
 
 	Stream(const char *name, MediaEntity *dev, bool importOnly = false)
 		: external_(false), importOnly_(importOnly), name_(name),
-		  dev_(std::make_unique<V4L2VideoDevice>(dev)), id_(ipa::RPi::MaskID)
+		  dev_(std::make_unique<V4L2VideoDevice>(dev)), id_(ipa::RPi::MaskID),
+		  dmaHeap_(nullptr)
 	{
 	}
 
@@ -51,6 +54,7 @@ public:
 	bool isExternal() const;
 
 	void setExportedBuffers(std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	void setDmaHeap(DmaHeap *dmaHeap);
 	const BufferMap &getBuffers() const;
 	int getBufferId(FrameBuffer *buffer) const;
 
@@ -58,9 +62,16 @@ public:
 	void removeExternalBuffer(FrameBuffer *buffer);
 
 	int prepareBuffers(unsigned int count);
+	bool hasBuffers() const;
+	void trackBuffers(const std::string &camera);
+	bool reuseBuffers(unsigned int count);
 	int queueBuffer(FrameBuffer *buffer);
 	void returnBuffer(FrameBuffer *buffer);
 
+	void holdBuffer(FrameBuffer *buffer);
+	bool isHeld(FrameBuffer *buffer) const;
+	bool releaseHeldBuffer(FrameBuffer *buffer);
+
 	int queueAllBuffers();
 	void releaseBuffers();
 
@@ -104,6 +115,8 @@ private:
 	};
 
 	void clearBuffers();
+	int allocateBuffers(unsigned int count);
+	void queueRequestBuffers();
 	int queueToDevice(FrameBuffer *buffer);
 
 	/*
@@ -144,11 +157,22 @@ private:
 	 */
 	std::queue<FrameBuffer *> requestBuffers_;
 
+	/*
+	 * Buffers handed back to the application while the pipeline still
+	 * uses them. They can't be queued to the device before being released,
+	 * the mapped value records whether the application has queued the
+	 * buffer again in the meantime.
+	 */
+	std::unordered_map<FrameBuffer *, bool> heldBuffers_;
+
 	/*
 	 * This is a list of buffers exported internally. Need to keep this around
 	 * as the stream needs to maintain ownership of these buffers.
 	 */
 	std::vector<std::unique_ptr<FrameBuffer>> internalBuffers_;
+
+	/* Heap the internal buffers are allocated from, if any. */
+	DmaHeap *dmaHeap_;
 };
 
 /*
@@ -9,8 +9,8 @@
 #include <array>
 #include <iomanip>
 #include <memory>
-#include <numeric>
 #include <queue>
+#include <vector>
 
 #include <linux/media-bus-format.h>
 
@@ -30,9 +30,11 @@
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/delayed_controls.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/tracepoints.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
@@ -42,6 +44,13 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(RkISP1)
 
+/*
+ * Number of parameters and statistics buffers allocated on top of the number
+ * of frames in flight, to let the IPA fill the parameters of the next frames
+ * while the current ones are processed by the ISP.
+ */
+static constexpr unsigned int RKISP1_PARAM_STAT_LOOKAHEAD = 2;
+
 class PipelineHandlerRkISP1;
 class RkISP1CameraData;
 
@@ -56,6 +65,8 @@ struct RkISP1FrameInfo {
 
 	bool paramDequeued;
 	bool metadataProcessed;
+
+	utils::time_point statsReadyTime;
 };
 
 class RkISP1Frames
@@ -63,6 +74,8 @@ class RkISP1Frames
 public:
 	RkISP1Frames(PipelineHandler *pipe);
 
+	void init(unsigned int count);
+
 	RkISP1FrameInfo *create(const RkISP1CameraData *data, Request *request);
 	int destroy(unsigned int frame);
 	void clear();
@@ -71,9 +84,18 @@ public:
 	RkISP1FrameInfo *find(FrameBuffer *buffer);
 	RkISP1FrameInfo *find(Request *request);
 
+	void releaseParamBuffer(RkISP1FrameInfo *info);
+	void releaseStatBuffer(RkISP1FrameInfo *info);
+
 private:
+	RkISP1FrameInfo *slot(unsigned int frame);
+
 	PipelineHandlerRkISP1 *pipe_;
-	std::map<unsigned int, RkISP1FrameInfo *> frameInfo_;
+
+	/* Frame information, indexed by request sequence modulo the size. */
+	std::vector<RkISP1FrameInfo> frameInfo_;
+	/* Index in frameInfo_ of the frame information, by frame number. */
+	std::vector<RkISP1FrameInfo *> frames_;
 };
 
 class RkISP1CameraData : public CameraData
@@ -117,8 +139,16 @@ public:
 
 	const V4L2SubdeviceFormat &sensorFormat() { return sensorFormat_; }
 
+	/*
+	 * Number of bytes written to memory per frame by the outputs, for the
+	 * path assignment selected by validate().
+	 */
+	uint64_t bandwidth() const { return bandwidth_; }
+
 private:
-	bool fitsAllPaths(const StreamConfiguration &cfg);
+	Status assignPaths(const std::vector<RkISP1Path *> &paths,
+			   std::vector<StreamConfiguration> *configs,
+			   uint64_t *bandwidth) const;
 
 	/*
 	 * The RkISP1CameraData instance is guaranteed to be valid as long as the
@@ -129,6 +159,7 @@ private:
 	const RkISP1CameraData *data_;
 
 	V4L2SubdeviceFormat sensorFormat_;
+	uint64_t bandwidth_;
 };
 
 class PipelineHandlerRkISP1 : public PipelineHandler
@@ -141,8 +172,11 @@ public:
 	int configure(Camera *camera, CameraConfiguration *config) override;
 
 	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       unsigned int count,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
+	int prepare(Camera *camera, const ControlList *controls) override;
+	void unprepare(Camera *camera) override;
 	int start(Camera *camera, const ControlList *controls) override;
 	void stop(Camera *camera) override;
 
@@ -193,6 +227,25 @@ RkISP1Frames::RkISP1Frames(PipelineHandler *pipe)
 {
 }
 
+void RkISP1Frames::init(unsigned int count)
+{
+	/*
+	 * Each frame in flight holds a parameters buffer until it is dequeued,
+	 * so there can't be more frames in flight than parameters buffers plus
+	 * capture buffers. Entries are free when they have no request.
+	 */
+	frameInfo_.assign(count, {});
+	frames_.assign(count, nullptr);
+}
+
+RkISP1FrameInfo *RkISP1Frames::slot(unsigned int frame)
+{
+	if (frames_.empty())
+		return nullptr;
+
+	return frames_[frame % frames_.size()];
+}
+
 RkISP1FrameInfo *RkISP1Frames::create(const RkISP1CameraData *data, Request *request)
 {
 	unsigned int frame = data->frame_;
@@ -209,13 +262,29 @@ RkISP1FrameInfo *RkISP1Frames::create(const RkISP1CameraData *data, Request *req
 	}
 	FrameBuffer *statBuffer = pipe_->availableStatBuffers_.front();
 
+	RkISP1FrameInfo *info = &frameInfo_[request->sequence() % frameInfo_.size()];
+	if (info->request) {
+		LOG(RkISP1, Error) << "Frame information underrun";
+		return nullptr;
+	}
+
+	/*
+	 * Frame numbers may jump when the sensor skips frames. Skip frame
+	 * numbers whose slot is still in use, at most count - 1 of them are
+	 * in flight as the information slot of the request is free.
+	 */
+	while (slot(frame))
+		frame++;
+
 	FrameBuffer *mainPathBuffer = request->findBuffer(&data->mainPathStream_);
 	FrameBuffer *selfPathBuffer = request->findBuffer(&data->selfPathStream_);
 
 	pipe_->availableParamBuffers_.pop();
 	pipe_->availableStatBuffers_.pop();
 
-	RkISP1FrameInfo *info = new RkISP1FrameInfo;
+	/* Associate the internal buffers with the request for find(). */
+	paramBuffer->_d()->setRequest(request);
+	statBuffer->_d()->setRequest(request);
 
 	info->frame = frame;
 	info->request = request;
@@ -226,7 +295,7 @@ RkISP1FrameInfo *RkISP1Frames::create(const RkISP1CameraData *data, Request *req
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
 
-	frameInfo_[frame] = info;
+	frames_[frame % frames_.size()] = info;
 
 	return info;
 }
@@ -237,36 +306,35 @@ int RkISP1Frames::destroy(unsigned int frame)
 	if (!info)
 		return -ENOENT;
 
-	pipe_->availableParamBuffers_.push(info->paramBuffer);
-	pipe_->availableStatBuffers_.push(info->statBuffer);
+	releaseParamBuffer(info);
+	releaseStatBuffer(info);
 
-	frameInfo_.erase(info->frame);
-
-	delete info;
+	frames_[frame % frames_.size()] = nullptr;
+	info->request = nullptr;
 
 	return 0;
 }
 
 void RkISP1Frames::clear()
 {
-	for (const auto &entry : frameInfo_) {
-		RkISP1FrameInfo *info = entry.second;
+	for (RkISP1FrameInfo &info : frameInfo_) {
+		if (!info.request)
+			continue;
 
-		pipe_->availableParamBuffers_.push(info->paramBuffer);
-		pipe_->availableStatBuffers_.push(info->statBuffer);
+		releaseParamBuffer(&info);
+		releaseStatBuffer(&info);
 
-		delete info;
+		info.request = nullptr;
 	}
 
-	frameInfo_.clear();
+	std::fill(frames_.begin(), frames_.end(), nullptr);
 }
 
 RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 {
-	auto itInfo = frameInfo_.find(frame);
-
-	if (itInfo != frameInfo_.end())
-		return itInfo->second;
+	RkISP1FrameInfo *info = slot(frame);
+	if (info && info->frame == frame)
+		return info;
 
 	LOG(RkISP1, Fatal) << "Can't locate info from frame";
 
@@ -275,13 +343,15 @@ RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 
 RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->paramBuffer == buffer ||
-		    info->statBuffer == buffer ||
-		    info->mainPathBuffer == buffer ||
-		    info->selfPathBuffer == buffer)
+	/*
+	 * The parameters, statistics and request buffers are associated with
+	 * the request until they complete.
+	 */
+	Request *request = buffer->request();
+	if (request && !frameInfo_.empty()) {
+		RkISP1FrameInfo *info =
+			&frameInfo_[request->sequence() % frameInfo_.size()];
+		if (info->request == request)
 			return info;
 	}
 
@@ -292,9 +362,9 @@ RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 
 RkISP1FrameInfo *RkISP1Frames::find(Request *request)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
+	if (!frameInfo_.empty()) {
+		RkISP1FrameInfo *info =
+			&frameInfo_[request->sequence() % frameInfo_.size()];
 		if (info->request == request)
 			return info;
 	}
@@ -304,6 +374,32 @@ RkISP1FrameInfo *RkISP1Frames::find(Request *request)
 	return nullptr;
 }
 
+/*
+ * The parameters and statistics buffers are returned to the pool as soon as
+ * the ISP and the IPA are done with them, without waiting for the request to
+ * complete, to make them available to the next frames. They are detached from
+ * the request, which may complete before they are used again.
+ */
+void RkISP1Frames::releaseParamBuffer(RkISP1FrameInfo *info)
+{
+	if (!info->paramBuffer)
+		return;
+
+	info->paramBuffer->_d()->setRequest(nullptr);
+	pipe_->availableParamBuffers_.push(info->paramBuffer);
+	info->paramBuffer = nullptr;
+}
+
+void RkISP1Frames::releaseStatBuffer(RkISP1FrameInfo *info)
+{
+	if (!info->statBuffer)
+		return;
+
+	info->statBuffer->_d()->setRequest(nullptr);
+	pipe_->availableStatBuffers_.push(info->statBuffer);
+	info->statBuffer = nullptr;
+}
+
 int RkISP1CameraData::loadIPA(unsigned int hwRevision)
 {
 	ipa_ = IPAManager::createIPA<ipa::rkisp1::IPAProxyRkISP1>(pipe_, 1, 1);
@@ -313,7 +409,7 @@ int RkISP1CameraData::loadIPA(unsigned int hwRevision)
 	ipa_->queueFrameAction.connect(this,
 				       &RkISP1CameraData::queueFrameAction);
 
-	int ret = ipa_->init(hwRevision);
+	int ret = ipa_->init(IPASettings{ "", sensor_->model() }, hwRevision);
 	if (ret < 0) {
 		LOG(RkISP1, Error) << "IPA initialization failure";
 		return ret;
@@ -337,6 +433,14 @@ void RkISP1CameraData::queueFrameAction(unsigned int frame,
 		if (!info)
 			break;
 
+		/* Trace the capture buffer, which carries the frame timestamp. */
+		FrameBuffer *captureBuffer = info->mainPathBuffer
+					   ? info->mainPathBuffer
+					   : info->selfPathBuffer;
+		if (captureBuffer)
+			LIBCAMERA_TRACEPOINT(pipeline_isp_queue, "rkisp1", frame,
+					     captureBuffer);
+
 		pipe->param_->queueBuffer(info->paramBuffer);
 		pipe->stat_->queueBuffer(info->statBuffer);
 
@@ -366,33 +470,52 @@ void RkISP1CameraData::metadataReady(unsigned int frame, const ControlList &meta
 	if (!info)
 		return;
 
-	info->request->metadata().merge(metadata);
+	pipe->recordLatency(info->request, RequestLatencyStats::IpaProcessing,
+			    utils::clock::now() - info->statsReadyTime);
+	pipe->completeMetadata(info->request, metadata);
 	info->metadataProcessed = true;
 
+	/* The IPA is done with the statistics. */
+	frameInfo_.releaseStatBuffer(info);
+
 	pipe->tryCompleteRequest(info->request);
 }
 
 RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
 						     RkISP1CameraData *data)
-	: CameraConfiguration()
+	: CameraConfiguration(), bandwidth_(0)
 {
 	camera_ = camera->shared_from_this();
 	data_ = data;
 }
 
-bool RkISP1CameraConfiguration::fitsAllPaths(const StreamConfiguration &cfg)
+/*
+ * Validate the stream configurations with the stream at index i assigned to
+ * paths[i], and compute the memory bandwidth written by the ISP in bytes per
+ * frame. The configurations are adjusted in place.
+ */
+CameraConfiguration::Status
+RkISP1CameraConfiguration::assignPaths(const std::vector<RkISP1Path *> &paths,
+				       std::vector<StreamConfiguration> *configs,
+				       uint64_t *bandwidth) const
 {
-	StreamConfiguration config;
+	Status status = Valid;
 
-	config = cfg;
-	if (data_->mainPath_->validate(&config) != Valid)
-		return false;
+	*bandwidth = 0;
 
-	config = cfg;
-	if (data_->selfPath_->validate(&config) != Valid)
-		return false;
+	for (unsigned int i = 0; i < configs->size(); ++i) {
+		StreamConfiguration &cfg = (*configs)[i];
 
-	return true;
+		Status ret = paths[i]->validate(&cfg);
+		if (ret == Invalid)
+			return Invalid;
+		if (ret == Adjusted)
+			status = Adjusted;
+
+		*bandwidth += cfg.frameSize;
+	}
+
+	return status;
 }
 
 CameraConfiguration::Status RkISP1CameraConfiguration::validate()
@@ -415,72 +538,69 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 	}
 
 	/*
-	 * If there are more than one stream in the configuration figure out the
-	 * order to evaluate the streams. The first stream has the highest
-	 * priority but if both main path and self path can satisfy it evaluate
-	 * the second stream first as the first stream is guaranteed to work
-	 * with whichever path is not used by the second one.
+	 * Evaluate all the possible assignments of streams to paths, and pick
+	 * the one that requires the least adjustments, favouring the
+	 * configuration of the first stream as it has the highest priority.
+	 * Among equivalent assignments, pick the one that minimizes the memory
+	 * bandwidth, and the main path for the first stream otherwise.
 	 */
-	std::vector<unsigned int> order(config_.size());
-	std::iota(order.begin(), order.end(), 0);
-	if (config_.size() == 2 && fitsAllPaths(config_[0]))
-		std::reverse(order.begin(), order.end());
+	std::vector<std::vector<RkISP1Path *>> assignments = {
+		{ data_->mainPath_, data_->selfPath_ },
+		{ data_->selfPath_, data_->mainPath_ },
+	};
 
-	bool mainPathAvailable = true;
-	bool selfPathAvailable = true;
-	for (unsigned int index : order) {
-		StreamConfiguration &cfg = config_[index];
-
-		/* Try to match stream without adjusting configuration. */
-		if (mainPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->mainPath_->validate(&tryCfg) == Valid) {
-				mainPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->mainPathStream_));
-				continue;
-			}
-		}
+	std::vector<StreamConfiguration> bestConfigs;
+	const std::vector<RkISP1Path *> *bestPaths = nullptr;
+	Status bestStatus = Invalid;
+	bool bestFirstValid = false;
+	uint64_t bestBandwidth = 0;
 
-		if (selfPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->selfPath_->validate(&tryCfg) == Valid) {
-				selfPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->selfPathStream_));
-				continue;
-			}
-		}
+	for (std::vector<RkISP1Path *> &paths : assignments) {
+		std::vector<StreamConfiguration> configs = config_;
+		uint64_t bandwidth;
 
-		/* Try to match stream allowing adjusting configuration. */
-		if (mainPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->mainPath_->validate(&tryCfg) == Adjusted) {
-				mainPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->mainPathStream_));
-				status = Adjusted;
-				continue;
-			}
-		}
+		Status ret = assignPaths(paths, &configs, &bandwidth);
+		if (ret == Invalid)
+			continue;
 
-		if (selfPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->selfPath_->validate(&tryCfg) == Adjusted) {
-				selfPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->selfPathStream_));
-				status = Adjusted;
-				continue;
-			}
-		}
+		bool firstValid = configs[0].pixelFormat == config_[0].pixelFormat &&
+				  configs[0].size == config_[0].size;
 
-		/* All paths rejected configuraiton. */
-		LOG(RkISP1, Debug) << "Camera configuration not supported "
-				   << cfg.toString();
+		bool better = !bestPaths ||
+			      (ret == Valid && bestStatus != Valid) ||
+			      (ret == bestStatus && firstValid && !bestFirstValid) ||
+			      (ret == bestStatus && firstValid == bestFirstValid &&
+			       bandwidth < bestBandwidth);
+		if (!better)
+			continue;
+
+		bestConfigs = std::move(configs);
+		bestPaths = &paths;
+		bestStatus = ret;
+		bestFirstValid = firstValid;
+		bestBandwidth = bandwidth;
+	}
+
+	if (!bestPaths) {
+		LOG(RkISP1, Debug) << "Camera configuration not supported";
 		return Invalid;
 	}
 
+	if (bestStatus == Adjusted)
+		status = Adjusted;
+
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		StreamConfiguration &cfg = config_[i];
+		const Stream *stream = (*bestPaths)[i] == data_->mainPath_
+				     ? &data_->mainPathStream_
+				     : &data_->selfPathStream_;
+
+		cfg = bestConfigs[i];
+		cfg.setStream(const_cast<Stream *>(stream));
+	}
+
+	bandwidth_ = bestBandwidth;
+
 	/* Select the sensor format. */
 	Size maxSize;
 	for (const StreamConfiguration &cfg : config_)
@@ -658,6 +778,17 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 		ret = 0;
 	}
 
+	/* Report the memory bandwidth of the outputs at the maximum frame rate. */
+	uint64_t frameLength = static_cast<uint64_t>(sensorInfo.minFrameLength) *
+			       sensorInfo.lineLength;
+	if (frameLength && sensorInfo.pixelRate) {
+		uint64_t bandwidth = config->bandwidth() * sensorInfo.pixelRate /
+				     frameLength;
+		LOG(RkISP1, Debug)
+			<< "Expected output bandwidth " << bandwidth / 1000000
+			<< " MB/s (" << config->bandwidth() << " bytes per frame)";
+	}
+
 	std::map<uint32_t, ControlInfoMap> entityControls;
 	entityControls.emplace(0, data->sensor_->controls());
 
@@ -670,10 +801,10 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 }
 
 int PipelineHandlerRkISP1::exportFrameBuffers([[maybe_unused]] Camera *camera, Stream *stream,
+					      unsigned int count,
 					      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
 
 	if (stream == &data->mainPathStream_)
 		return mainPath_.exportBuffers(count, buffers);
@@ -694,11 +825,13 @@ int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 		data->selfPathStream_.configuration().bufferCount,
 	});
 
-	ret = param_->allocateBuffers(maxCount, &paramBuffers_);
+	unsigned int ispCount = maxCount + RKISP1_PARAM_STAT_LOOKAHEAD;
+
+	ret = param_->allocateBuffers(ispCount, &paramBuffers_);
 	if (ret < 0)
 		goto error;
 
-	ret = stat_->allocateBuffers(maxCount, &statBuffers_);
+	ret = stat_->allocateBuffers(ispCount, &statBuffers_);
 	if (ret < 0)
 		goto error;
 
@@ -716,7 +849,12 @@ int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 		availableStatBuffers_.push(buffer.get());
 	}
 
-	data->ipa_->mapBuffers(data->ipaBuffers_);
+	/*
+	 * Don't wait for the IPA to map the buffers. Calls are processed in
+	 * order, the buffers are mapped before the IPA handles the next call.
+	 */
+	data->ipa_->mapBuffersAsync(data->ipaBuffers_, [] {});
+	data->frameInfo_.init(paramBuffers_.size() + maxCount);
 
 	return 0;
 
@@ -744,7 +882,7 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 	for (IPABuffer &ipabuf : data->ipaBuffers_)
 		ids.push_back(ipabuf.id);
 
-	data->ipa_->unmapBuffers(ids);
+	data->ipa_->unmapBuffersAsync(ids, [] {});
 	data->ipaBuffers_.clear();
 
 	if (param_->releaseBuffers())
@@ -756,7 +894,7 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 	return 0;
 }
 
-int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+int PipelineHandlerRkISP1::prepare(Camera *camera, [[maybe_unused]] const ControlList *controls)
 {
 	RkISP1CameraData *data = cameraData(camera);
 	int ret;
@@ -774,12 +912,27 @@ int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlL
 		return ret;
 	}
 
+	return 0;
+}
+
+void PipelineHandlerRkISP1::unprepare(Camera *camera)
+{
+	RkISP1CameraData *data = cameraData(camera);
+
+	data->ipa_->stop();
+
+	freeBuffers(camera);
+}
+
+int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+{
+	RkISP1CameraData *data = cameraData(camera);
+	int ret;
+
 	data->frame_ = 0;
 
 	ret = param_->streamOn();
 	if (ret) {
-		data->ipa_->stop();
-		freeBuffers(camera);
 		LOG(RkISP1, Error)
 			<< "Failed to start parameters " << camera->id();
 		return ret;
@@ -788,8 +941,6 @@ int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlL
 	ret = stat_->streamOn();
 	if (ret) {
 		param_->streamOff();
-		data->ipa_->stop();
-		freeBuffers(camera);
 		LOG(RkISP1, Error)
 			<< "Failed to start statistics " << camera->id();
 		return ret;
@@ -800,8 +951,6 @@ int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlL
 		if (ret) {
 			param_->streamOff();
 			stat_->streamOff();
-			data->ipa_->stop();
-			freeBuffers(camera);
 			return ret;
 		}
 	}
@@ -812,8 +961,6 @@ int PipelineHandlerRkISP1::start(Camera *camera, [[maybe_unused]] const ControlL
 			mainPath_.stop();
 			param_->streamOff();
 			stat_->streamOff();
-			data->ipa_->stop();
-			freeBuffers(camera);
 			return ret;
 		}
 	}
@@ -831,8 +978,6 @@ void PipelineHandlerRkISP1::stop(Camera *camera)
 
 	isp_->setFrameStartEnabled(false);
 
-	data->ipa_->stop();
-
 	selfPath_.stop();
 	mainPath_.stop();
 
@@ -849,7 +994,7 @@ void PipelineHandlerRkISP1::stop(Camera *camera)
 	ASSERT(data->queuedRequests_.empty());
 	data->frameInfo_.clear();
 
-	freeBuffers(camera);
+	unprepare(camera);
 
 	activeCamera_ = nullptr;
 }
@@ -864,12 +1009,12 @@ int PipelineHandlerRkISP1::queueRequestDevice(Camera *camera, Request *request)
 
 	ipa::rkisp1::RkISP1Event ev;
 	ev.op = ipa::rkisp1::EventQueueRequest;
-	ev.frame = data->frame_;
+	ev.frame = info->frame;
 	ev.bufferId = info->paramBuffer->cookie();
 	ev.controls = request->controls();
 	data->ipa_->processEvent(ev);
 
-	data->frame_++;
+	data->frame_ = info->frame + 1;
 
 	return 0;
 }
@@ -946,14 +1091,11 @@ int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
 	/* Initialize the camera properties. */
 	data->properties_ = data->sensor_->properties();
 
-	/*
-	 * \todo Read dealy values from the sensor itself or from a
-	 * a sensor database. For now use generic values taken from
-	 * the Raspberry Pi and listed as generic values.
-	 */
+	const CameraSensorProperties::SensorDelays &delays =
+		data->sensor_->sensorDelays();
 	std::unordered_map<uint32_t, DelayedControls::ControlParams> params = {
-		{ V4L2_CID_ANALOGUE_GAIN, { 1, false } },
-		{ V4L2_CID_EXPOSURE, { 2, false } },
+		{ V4L2_CID_ANALOGUE_GAIN, { delays.gainDelay, false } },
+		{ V4L2_CID_EXPOSURE, { delays.exposureDelay, false } },
 	};
 
 	data->delayedCtrls_ =
@@ -1078,8 +1220,9 @@ void PipelineHandlerRkISP1::bufferReady(FrameBuffer *buffer)
 	 * \todo The sensor timestamp should be better estimated by connecting
 	 * to the V4L2Device::frameStart signal.
 	 */
-	request->metadata().set(controls::SensorTimestamp,
-				buffer->metadata().timestamp);
+	ControlList metadata(controls::controls);
+	metadata.set(controls::SensorTimestamp, buffer->metadata().timestamp);
+	completeMetadata(request, metadata);
 
 	completeBuffer(request, buffer);
 	tryCompleteRequest(request);
@@ -1095,6 +1238,8 @@ void PipelineHandlerRkISP1::paramReady(FrameBuffer *buffer)
 		return;
 
 	info->paramDequeued = true;
+	data->frameInfo_.releaseParamBuffer(info);
+
 	tryCompleteRequest(info->request);
 }
 
@@ -1109,6 +1254,7 @@ void PipelineHandlerRkISP1::statReady(FrameBuffer *buffer)
 
 	if (buffer->metadata().status == FrameMetadata::FrameCancelled) {
 		info->metadataProcessed = true;
+		data->frameInfo_.releaseStatBuffer(info);
 		tryCompleteRequest(info->request);
 		return;
 	}
@@ -1120,6 +1266,7 @@ void PipelineHandlerRkISP1::statReady(FrameBuffer *buffer)
 	ev.op = ipa::rkisp1::EventSignalStatBuffer;
 	ev.frame = info->frame;
 	ev.bufferId = info->statBuffer->cookie();
+	info->statsReadyTime = utils::clock::now();
 	data->ipa_->processEvent(ev);
 }
 
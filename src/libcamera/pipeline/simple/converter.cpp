@@ -29,10 +29,11 @@ LOG_DECLARE_CATEGORY(SimplePipeline)
  * SimpleConverter::Stream
  */
 
-SimpleConverter::Stream::Stream(SimpleConverter *converter, unsigned int index)
+SimpleConverter::Stream::Stream(SimpleConverter *converter, unsigned int index,
+				const std::string &deviceNode)
 	: converter_(converter), index_(index)
 {
-	m2m_ = std::make_unique<V4L2M2MDevice>(converter->deviceNode_);
+	m2m_ = std::make_unique<V4L2M2MDevice>(deviceNode);
 
 	m2m_->output()->bufferReady.connect(this, &Stream::outputBufferReady);
 	m2m_->capture()->bufferReady.connect(this, &Stream::captureBufferReady);
@@ -136,18 +137,14 @@ void SimpleConverter::Stream::stop()
 	m2m_->output()->releaseBuffers();
 }
 
-int SimpleConverter::Stream::queueBuffers(FrameBuffer *input,
-					  FrameBuffer *output)
+int SimpleConverter::Stream::queueInput(FrameBuffer *input)
 {
-	int ret = m2m_->output()->queueBuffer(input);
-	if (ret < 0)
-		return ret;
-
-	ret = m2m_->capture()->queueBuffer(output);
-	if (ret < 0)
-		return ret;
+	return m2m_->output()->queueBuffer(input);
+}
 
-	return 0;
+int SimpleConverter::Stream::queueOutput(FrameBuffer *output)
+{
+	return m2m_->capture()->queueBuffer(output);
 }
 
 std::string SimpleConverter::Stream::logPrefix() const
@@ -176,23 +173,34 @@ void SimpleConverter::Stream::captureBufferReady(FrameBuffer *buffer)
  * SimpleConverter
  */
 
-SimpleConverter::SimpleConverter(MediaDevice *media)
+/*
+ * The converter can be backed by multiple instances of the same mem2mem device.
+ * The streams are spread across the devices, to convert frames for different
+ * streams in parallel. All devices are assumed to have identical capabilities,
+ * the first one is used to enumerate them.
+ */
+SimpleConverter::SimpleConverter(const std::vector<MediaDevice *> &media)
 {
 	/*
-	 * Locate the video node. There's no need to validate the pipeline
-	 * further, the caller guarantees that this is a V4L2 mem2mem device.
+	 * Locate the video nodes. There's no need to validate the pipelines
+	 * further, the caller guarantees that these are V4L2 mem2mem devices.
 	 */
-	const std::vector<MediaEntity *> &entities = media->entities();
-	auto it = std::find_if(entities.begin(), entities.end(),
-			       [](MediaEntity *entity) {
-				       return entity->function() == MEDIA_ENT_F_IO_V4L;
-			       });
-	if (it == entities.end())
-		return;
+	for (MediaDevice *device : media) {
+		const std::vector<MediaEntity *> &entities = device->entities();
+		auto it = std::find_if(entities.begin(), entities.end(),
+				       [](MediaEntity *entity) {
+					       return entity->function() == MEDIA_ENT_F_IO_V4L;
+				       });
+		if (it == entities.end())
+			continue;
+
+		deviceNodes_.push_back((*it)->deviceNode());
+	}
 
-	deviceNode_ = (*it)->deviceNode();
+	if (deviceNodes_.empty())
+		return;
 
-	m2m_ = std::make_unique<V4L2M2MDevice>(deviceNode_);
+	m2m_ = std::make_unique<V4L2M2MDevice>(deviceNodes_[0]);
 	int ret = m2m_->open();
 	if (ret < 0) {
 		m2m_.reset();
@@ -300,7 +308,8 @@ int SimpleConverter::configure(const StreamConfiguration &inputCfg,
 	streams_.reserve(outputCfgs.size());
 
 	for (unsigned int i = 0; i < outputCfgs.size(); ++i) {
-		Stream &stream = streams_.emplace_back(this, i);
+		const std::string &deviceNode = deviceNodes_[i % deviceNodes_.size()];
+		Stream &stream = streams_.emplace_back(this, i, deviceNode);
 
 		if (!stream.isValid()) {
 			LOG(SimplePipeline, Error)
@@ -352,10 +361,19 @@ void SimpleConverter::stop()
 		stream.stop();
 }
 
+/*
+ * Queue the input buffer and the output buffers. If no buffer can be queued,
+ * an error is returned, and the caller retains ownership of all buffers.
+ * Otherwise the buffers are returned through the inputBufferReady and
+ * outputBufferReady signals. If only some of the streams accept the buffers,
+ * the output buffers of the other streams are cancelled and returned right
+ * away.
+ */
 int SimpleConverter::queueBuffers(FrameBuffer *input,
 				  const std::map<unsigned int, FrameBuffer *> &outputs)
 {
 	unsigned int mask = 0;
+	int error = 0;
 	int ret;
 
 	/*
@@ -377,21 +395,70 @@ int SimpleConverter::queueBuffers(FrameBuffer *input,
 		mask |= 1 << index;
 	}
 
-	/* Queue the input and output buffers to all the streams. */
+	/*
+	 * Queue the output buffers to all the streams first, and the input
+	 * buffer then, for the conversions on all devices to start as close
+	 * to each other as possible. A stream that has accepted an output
+	 * buffer holds it until the stream is stopped, even if the input
+	 * buffer can't be queued.
+	 */
+	unsigned int queued = 0;
+
 	for (auto [index, buffer] : outputs) {
-		ret = streams_[index].queueBuffers(input, buffer);
-		if (ret < 0)
-			return ret;
+		ret = streams_[index].queueOutput(buffer);
+		if (ret < 0) {
+			error = ret;
+			continue;
+		}
+
+		queued |= 1 << index;
+	}
+
+	if (!queued)
+		return error;
+
+	unsigned int inputRefs = 0;
+
+	for (auto [index, buffer] : outputs) {
+		if (!(queued & (1 << index)))
+			continue;
+
+		ret = streams_[index].queueInput(input);
+		if (ret < 0) {
+			error = ret;
+			continue;
+		}
+
+		inputRefs++;
 	}
 
 	/*
-	 * Add the input buffer to the queue, with the number of streams as a
-	 * reference count. Completion of the input buffer will be signalled by
-	 * the stream that releases the last reference.
+	 * Add the input buffer to the queue, with the number of streams that
+	 * hold it as a reference count. Completion of the input buffer will be
+	 * signalled by the stream that releases the last reference.
 	 */
-	queue_.emplace(std::piecewise_construct,
-		       std::forward_as_tuple(input),
-		       std::forward_as_tuple(outputs.size()));
+	if (inputRefs)
+		queue_.emplace(std::piecewise_construct,
+			       std::forward_as_tuple(input),
+			       std::forward_as_tuple(inputRefs));
+
+	if (!error)
+		return 0;
+
+	LOG(SimplePipeline, Error)
+		<< "Failed to queue buffers to all streams: " << strerror(-error);
+
+	/* Return the buffers that no stream holds. */
+	for (auto [index, buffer] : outputs) {
+		if (queued & (1 << index))
+			continue;
+
+		buffer->cancel();
+		outputBufferReady.emit(buffer);
+	}
+
+	if (!inputRefs)
+		inputBufferReady.emit(input);
 
 	return 0;
 }
@@ -29,38 +29,64 @@ class SizeRange;
 struct StreamConfiguration;
 class V4L2M2MDevice;
 
-class SimpleConverter
+class Converter
 {
 public:
-	SimpleConverter(MediaDevice *media);
+	virtual ~Converter() = default;
 
-	bool isValid() const { return m2m_ != nullptr; }
+	virtual bool isValid() const = 0;
 
-	std::vector<PixelFormat> formats(PixelFormat input);
-	SizeRange sizes(const Size &input);
+	virtual std::vector<PixelFormat> formats(PixelFormat input) = 0;
+	virtual SizeRange sizes(const Size &input) = 0;
+
+	virtual std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) = 0;
+
+	virtual int configure(const StreamConfiguration &inputCfg,
+			      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg) = 0;
+	virtual int exportBuffers(unsigned int ouput, unsigned int count,
+				  std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
+
+	virtual int start() = 0;
+	virtual void stop() = 0;
+
+	virtual int queueBuffers(FrameBuffer *input,
+				 const std::map<unsigned int, FrameBuffer *> &outputs) = 0;
+
+	Signal<FrameBuffer *> inputBufferReady;
+	Signal<FrameBuffer *> outputBufferReady;
+};
+
+class SimpleConverter : public Converter
+{
+public:
+	SimpleConverter(const std::vector<MediaDevice *> &media);
+
+	bool isValid() const override { return m2m_ != nullptr; }
+
+	std::vector<PixelFormat> formats(PixelFormat input) override;
+	SizeRange sizes(const Size &input) override;
 
 	std::tuple<unsigned int, unsigned int>
-	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size);
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
 
 	int configure(const StreamConfiguration &inputCfg,
-		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg);
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg) override;
 	int exportBuffers(unsigned int ouput, unsigned int count,
-			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
-	int start();
-	void stop();
+	int start() override;
+	void stop() override;
 
 	int queueBuffers(FrameBuffer *input,
-			 const std::map<unsigned int, FrameBuffer *> &outputs);
-
-	Signal<FrameBuffer *> inputBufferReady;
-	Signal<FrameBuffer *> outputBufferReady;
+			 const std::map<unsigned int, FrameBuffer *> &outputs) override;
 
 private:
 	class Stream : protected Loggable
 	{
 	public:
-		Stream(SimpleConverter *converter, unsigned int index);
+		Stream(SimpleConverter *converter, unsigned int index,
+		       const std::string &deviceNode);
 
 		bool isValid() const { return m2m_ != nullptr; }
 
@@ -72,7 +98,8 @@ private:
 		int start();
 		void stop();
 
-		int queueBuffers(FrameBuffer *input, FrameBuffer *output);
+		int queueInput(FrameBuffer *input);
+		int queueOutput(FrameBuffer *output);
 
 	protected:
 		std::string logPrefix() const override;
@@ -89,7 +116,7 @@ private:
 		unsigned int outputBufferCount_;
 	};
 
-	std::string deviceNode_;
+	std::vector<std::string> deviceNodes_;
 	std::unique_ptr<V4L2M2MDevice> m2m_;
 
 	std::vector<Stream> streams_;
@@ -13,6 +13,7 @@
 #include <memory>
 #include <queue>
 #include <set>
+#include <stdlib.h>
 #include <string>
 #include <string.h>
 #include <unordered_map>
@@ -22,6 +23,7 @@
 #include <linux/media-bus-format.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
@@ -36,11 +38,30 @@
 #include "libcamera/internal/v4l2_videodevice.h"
 
 #include "converter.h"
+#include "software_isp.h"
 
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(SimplePipeline)
 
+namespace {
+
+/* Number of captured frames being converted concurrently. */
+constexpr unsigned int kDefaultConverterDepth = 2;
+constexpr unsigned int kMaxConverterDepth = 8;
+
+unsigned int converterDepthFromEnv()
+{
+	const char *depth = utils::secure_getenv("LIBCAMERA_SIMPLE_CONVERTER_DEPTH");
+	if (!depth || *depth == '\0')
+		return kDefaultConverterDepth;
+
+	unsigned long value = strtoul(depth, nullptr, 10);
+	return std::clamp<unsigned long>(value, 1, kMaxConverterDepth);
+}
+
+} /* namespace */
+
 /* -----------------------------------------------------------------------------
  *
  * Overview
@@ -138,6 +159,13 @@ struct SimplePipelineInfo {
 
 namespace {
 
+/*
+ * Maximum number of streams supported by a camera. Converter instances are only
+ * acquired up to that limit, leaving the others to other pipeline handler
+ * instances.
+ */
+static constexpr unsigned int kMaxStreams = 3;
+
 static const SimplePipelineInfo supportedDevices[] = {
 	{ "imx7-csi", { { "pxp", 1 } } },
 	{ "qcom-camss", {} },
@@ -189,6 +217,8 @@ public:
 	std::vector<std::unique_ptr<FrameBuffer>> converterBuffers_;
 	bool useConverter_;
 	std::queue<std::map<unsigned int, FrameBuffer *>> converterQueue_;
+	unsigned int converterInFlight_;
+	unsigned int droppedFrames_;
 };
 
 class SimpleCameraConfiguration : public CameraConfiguration
@@ -228,6 +258,7 @@ public:
 	int configure(Camera *camera, CameraConfiguration *config) override;
 
 	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       unsigned int count,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
 	int start(Camera *camera, const ControlList *controls) override;
@@ -237,14 +268,12 @@ public:
 
 	V4L2VideoDevice *video(const MediaEntity *entity);
 	V4L2Subdevice *subdev(const MediaEntity *entity);
-	SimpleConverter *converter() { return converter_.get(); }
+	Converter *converter() { return converter_.get(); }
 
 protected:
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 private:
-	static constexpr unsigned int kNumInternalBuffers = 3;
-
 	SimpleCameraData *cameraData(const Camera *camera)
 	{
 		return static_cast<SimpleCameraData *>(
@@ -261,7 +290,14 @@ private:
 	std::map<const MediaEntity *, std::unique_ptr<V4L2VideoDevice>> videos_;
 	std::map<const MediaEntity *, V4L2Subdevice> subdevs_;
 
-	std::unique_ptr<SimpleConverter> converter_;
+	std::unique_ptr<Converter> converter_;
+
+	/*
+	 * Maximum number of captured frames handed to the converter and not
+	 * returned yet. Capture continues in the remaining internal buffers.
+	 */
+	unsigned int converterDepth_;
+	unsigned int numInternalBuffers_;
 
 	Camera *activeCamera_;
 };
@@ -273,7 +309,8 @@ private:
 SimpleCameraData::SimpleCameraData(SimplePipelineHandler *pipe,
 				   unsigned int numStreams,
 				   MediaEntity *sensor)
-	: CameraData(pipe), streams_(numStreams)
+	: CameraData(pipe), streams_(numStreams), useConverter_(false),
+	  converterInFlight_(0), droppedFrames_(0)
 {
 	int ret;
 
@@ -355,7 +392,7 @@ SimpleCameraData::SimpleCameraData(SimplePipelineHandler *pipe,
 int SimpleCameraData::init()
 {
 	SimplePipelineHandler *pipe = static_cast<SimplePipelineHandler *>(pipe_);
-	SimpleConverter *converter = pipe->converter();
+	Converter *converter = pipe->converter();
 	int ret;
 
 	/*
@@ -406,12 +443,20 @@ int SimpleCameraData::init()
 			config.captureFormat = pixelFormat;
 			config.captureSize = format.size;
 
-			if (!converter) {
+			if (converter)
+				config.outputFormats = converter->formats(pixelFormat);
+
+			if (config.outputFormats.empty()) {
 				config.outputFormats = { pixelFormat };
 				config.outputSizes = config.captureSize;
 			} else {
-				config.outputFormats = converter->formats(pixelFormat);
 				config.outputSizes = converter->sizes(format.size);
+
+				/* Keep the capture format available for raw capture. */
+				if (std::find(config.outputFormats.begin(),
+					      config.outputFormats.end(),
+					      pixelFormat) == config.outputFormats.end())
+					config.outputFormats.push_back(pixelFormat);
 			}
 
 			configs_.push_back(config);
@@ -581,7 +626,7 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 
 	/* Adjust the requested streams. */
 	SimplePipelineHandler *pipe = static_cast<SimplePipelineHandler *>(data_->pipe_);
-	SimpleConverter *converter = pipe->converter();
+	Converter *converter = pipe->converter();
 
 	/*
 	 * Enable usage of the converter when producing multiple streams, as
@@ -656,8 +701,13 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
  */
 
 SimplePipelineHandler::SimplePipelineHandler(CameraManager *manager)
-	: PipelineHandler(manager)
+	: PipelineHandler(manager), converterDepth_(converterDepthFromEnv())
 {
+	/*
+	 * Allocate one internal buffer per frame being converted, plus two
+	 * buffers to keep capturing while the converter is busy.
+	 */
+	numInternalBuffers_ = converterDepth_ + 2;
 }
 
 CameraConfiguration *SimplePipelineHandler::generateConfiguration(Camera *camera,
@@ -768,16 +818,21 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 	inputCfg.pixelFormat = pipeConfig->captureFormat;
 	inputCfg.size = pipeConfig->captureSize;
 	inputCfg.stride = captureFormat.planes[0].bpl;
-	inputCfg.bufferCount = kNumInternalBuffers;
+	inputCfg.bufferCount = numInternalBuffers_;
+
+	/* The software ISP subtracts the black level of the sensor. */
+	SoftwareIsp *isp = dynamic_cast<SoftwareIsp *>(converter_.get());
+	if (isp)
+		isp->setBlackLevel(data->sensor_->blackLevel());
 
 	return converter_->configure(inputCfg, outputCfgs);
 }
 
 int SimplePipelineHandler::exportFrameBuffers(Camera *camera, Stream *stream,
+					      unsigned int count,
 					      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	SimpleCameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
 
 	/*
 	 * Export buffers on the converter or capture video node, depending on
@@ -801,7 +856,7 @@ int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlL
 		 * When using the converter allocate a fixed number of internal
 		 * buffers.
 		 */
-		ret = video->allocateBuffers(kNumInternalBuffers,
+		ret = video->allocateBuffers(numInternalBuffers_,
 					     &data->converterBuffers_);
 	} else {
 		/* Otherwise, prepare for using buffers from the only stream. */
@@ -824,6 +879,9 @@ int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlL
 			return ret;
 		}
 
+		data->converterInFlight_ = 0;
+		data->droppedFrames_ = 0;
+
 		/* Queue all internal buffers for capture. */
 		for (std::unique_ptr<FrameBuffer> &buffer : data->converterBuffers_)
 			video->queueBuffer(buffer.get());
@@ -839,9 +897,15 @@ void SimplePipelineHandler::stop(Camera *camera)
 	SimpleCameraData *data = cameraData(camera);
 	V4L2VideoDevice *video = data->video_;
 
-	if (data->useConverter_)
+	if (data->useConverter_) {
 		converter_->stop();
 
+		if (data->droppedFrames_)
+			LOG(SimplePipeline, Info)
+				<< data->droppedFrames_
+				<< " frames dropped as the converter fell behind";
+	}
+
 	video->streamOff();
 	video->releaseBuffers();
 
@@ -945,7 +1009,7 @@ std::vector<MediaEntity *> SimplePipelineHandler::locateSensors()
 bool SimplePipelineHandler::match(DeviceEnumerator *enumerator)
 {
 	const SimplePipelineInfo *info = nullptr;
-	MediaDevice *converter = nullptr;
+	std::vector<MediaDevice *> converters;
 	unsigned int numStreams = 1;
 
 	for (const SimplePipelineInfo &inf : supportedDevices) {
@@ -960,11 +1024,25 @@ bool SimplePipelineHandler::match(DeviceEnumerator *enumerator)
 	if (!media_)
 		return false;
 
+	/*
+	 * Acquire instances of the first converter found, each of them adds to
+	 * the number of streams supported by the camera, up to kMaxStreams.
+	 */
 	for (const auto &[name, streams] : info->converters) {
 		DeviceMatch converterMatch(name);
-		converter = acquireMediaDevice(enumerator, converterMatch);
-		if (converter) {
-			numStreams = streams;
+
+		while (streams * converters.size() < kMaxStreams) {
+			MediaDevice *converter = acquireMediaDevice(enumerator,
+								    converterMatch);
+			if (!converter)
+				break;
+
+			converters.push_back(converter);
+		}
+
+		if (!converters.empty()) {
+			numStreams = std::min<unsigned int>(streams * converters.size(),
+							    kMaxStreams);
 			break;
 		}
 	}
@@ -977,18 +1055,28 @@ bool SimplePipelineHandler::match(DeviceEnumerator *enumerator)
 	}
 
 	/* Open the converter, if any. */
-	if (converter) {
-		converter_ = std::make_unique<SimpleConverter>(converter);
+	if (!converters.empty()) {
+		converter_ = std::make_unique<SimpleConverter>(converters);
 		if (!converter_->isValid()) {
 			LOG(SimplePipeline, Warning)
 				<< "Failed to create converter, disabling format conversion";
 			converter_.reset();
-		} else {
-			converter_->inputBufferReady.connect(this, &SimplePipelineHandler::converterInputDone);
-			converter_->outputBufferReady.connect(this, &SimplePipelineHandler::converterOutputDone);
+			numStreams = 1;
 		}
 	}
 
+	/*
+	 * Fall back to the software ISP when no hardware converter is
+	 * available, to produce processed images from raw Bayer sensors.
+	 */
+	if (!converter_) {
+		LOG(SimplePipeline, Debug) << "Using software ISP";
+		converter_ = std::make_unique<SoftwareIsp>();
+	}
+
+	converter_->inputBufferReady.connect(this, &SimplePipelineHandler::converterInputDone);
+	converter_->outputBufferReady.connect(this, &SimplePipelineHandler::converterOutputDone);
+
 	/*
 	 * Create one camera data instance for each sensor and gather all
 	 * entities in all pipelines.
@@ -1168,8 +1256,54 @@ void SimplePipelineHandler::bufferReady(FrameBuffer *buffer)
 			return;
 		}
 
-		converter_->queueBuffers(buffer, data->converterQueue_.front());
+		/*
+		 * Drop the frame if the converter is still busy with the
+		 * maximum number of frames, the request will be completed
+		 * with the next one. This keeps latency bounded instead of
+		 * accumulating captured frames when conversion is slower than
+		 * capture.
+		 */
+		if (data->converterInFlight_ >= converterDepth_) {
+			data->droppedFrames_++;
+			LOG(SimplePipeline, Debug)
+				<< "Converter busy, dropping frame "
+				<< buffer->metadata().sequence;
+			data->video_->queueBuffer(buffer);
+			return;
+		}
+
+		std::map<unsigned int, FrameBuffer *> outputs =
+			std::move(data->converterQueue_.front());
 		data->converterQueue_.pop();
+
+		/*
+		 * The converter may return buffers synchronously, account for
+		 * the frame before queueing it. On failure the converter holds
+		 * none of the buffers, requeue the input for capture and
+		 * cancel all outputs.
+		 */
+		data->converterInFlight_++;
+
+		int ret = converter_->queueBuffers(buffer, outputs);
+		if (ret < 0) {
+			LOG(SimplePipeline, Error)
+				<< "Failed to queue buffers to the converter: "
+				<< strerror(-ret);
+			data->converterInFlight_--;
+			data->video_->queueBuffer(buffer);
+
+			for (auto &item : outputs) {
+				FrameBuffer *outputBuffer = item.second;
+				outputBuffer->cancel();
+				request = outputBuffer->request();
+				completeBuffer(request, outputBuffer);
+			}
+
+			if (request)
+				completeRequest(request);
+			return;
+		}
+
 		return;
 	}
 
@@ -1183,6 +1317,8 @@ void SimplePipelineHandler::converterInputDone(FrameBuffer *buffer)
 	ASSERT(activeCamera_);
 	SimpleCameraData *data = cameraData(activeCamera_);
 
+	data->converterInFlight_--;
+
 	/* Queue the input buffer back for capture. */
 	data->video_->queueBuffer(buffer);
 }
@@ -0,0 +1,569 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * software_isp.cpp - Software ISP for simple pipeline handler
+ */
+
+#include "software_isp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/v4l2_pixelformat.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(SimplePipeline)
+
+namespace {
+
+enum Channel : unsigned int {
+	Red = 0,
+	Green = 1,
+	Blue = 2,
+};
+
+/* Colour of the pixels at (0, 0), (1, 0), (0, 1) and (1, 1), per Bayer order. */
+constexpr std::array<std::array<Channel, 4>, 4> bayerPatterns = { {
+	{ Blue, Green, Green, Red },	/* BGGR */
+	{ Green, Blue, Red, Green },	/* GBRG */
+	{ Green, Red, Blue, Green },	/* GRBG */
+	{ Red, Green, Green, Blue },	/* RGGB */
+} };
+
+const std::vector<PixelFormat> outputFormats = {
+	formats::RGB888,
+	formats::BGR888,
+	formats::XRGB8888,
+	formats::YUYV,
+};
+
+/*
+ * Black level used when the sensor black level is unknown, expressed in the
+ * 16-bit pixel range (16 for 8-bit samples).
+ */
+constexpr uint16_t kDefaultBlackLevel = 4096;
+constexpr double kGamma = 2.2;
+
+/* Limits and convergence speed of the grey world white balance gains. */
+constexpr double kMinGain = 0.5;
+constexpr double kMaxGain = 4.0;
+constexpr double kGainSpeed = 0.5;
+
+/* Statistics are gathered on one pixel out of kStatsStep in each direction. */
+constexpr unsigned int kStatsStep = 4;
+
+/* Number of strips per frame processed by each worker thread. */
+constexpr unsigned int kStripsPerWorker = 2;
+
+} /* namespace */
+
+/*
+ * The SoftwareIsp converts raw Bayer frames to RGB or YUV on the CPU, for
+ * platforms that have no hardware converter. Each frame is split in horizontal
+ * strips processed in parallel by a thread pool. The processing steps are
+ * bilinear demosaicing, and a per-channel lookup table applying the black
+ * level, grey world white balance gains computed from the previous frames and
+ * gamma. The inner loops operate on whole lines of unpacked samples to let the
+ * compiler vectorize them.
+ */
+SoftwareIsp::SoftwareIsp()
+	: inputStride_(0), strips_(0),
+	  heap_(DmaHeap::DmaHeapFlag::Cma | DmaHeap::DmaHeapFlag::System),
+	  nextJobId_(0), blackLevel_(kDefaultBlackLevel), gains_({ 1.0, 1.0, 1.0 })
+{
+}
+
+SoftwareIsp::~SoftwareIsp()
+{
+	stop();
+}
+
+BayerFormat SoftwareIsp::bayerFormat(const PixelFormat &pixelFormat)
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+	if (!info.isValid() || info.colourEncoding != PixelFormatInfo::ColourEncodingRAW)
+		return {};
+
+	BayerFormat format =
+		BayerFormat::fromV4L2PixelFormat(V4L2PixelFormat::fromPixelFormat(pixelFormat, false));
+	if (!format.isValid() || format.order == BayerFormat::MONO)
+		return {};
+
+	switch (format.packing) {
+	case BayerFormat::None:
+		if (format.bitDepth > 16)
+			return {};
+		break;
+	case BayerFormat::CSI2Packed:
+		if (format.bitDepth != 10 && format.bitDepth != 12 &&
+		    format.bitDepth != 14)
+			return {};
+		break;
+	default:
+		return {};
+	}
+
+	return format;
+}
+
+std::vector<PixelFormat> SoftwareIsp::formats(PixelFormat input)
+{
+	if (!bayerFormat(input).isValid())
+		return {};
+
+	return outputFormats;
+}
+
+SizeRange SoftwareIsp::sizes(const Size &input)
+{
+	/* Demosaicing operates on 2x2 blocks and doesn't scale. */
+	Size size = input.alignedDownTo(2, 2);
+	return SizeRange(size, size);
+}
+
+std::tuple<unsigned int, unsigned int>
+SoftwareIsp::strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size)
+{
+	if (std::find(outputFormats.begin(), outputFormats.end(), pixelFormat) ==
+	    outputFormats.end())
+		return std::make_tuple(0, 0);
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+	FrameLayout layout = info.frameLayout(size);
+	return std::make_tuple(layout.planes[0].stride, layout.frameSize);
+}
+
+int SoftwareIsp::configure(const StreamConfiguration &inputCfg,
+			   const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+{
+	inputFormat_ = bayerFormat(inputCfg.pixelFormat);
+	if (!inputFormat_.isValid()) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported input format " << inputCfg.pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	inputSize_ = inputCfg.size.alignedDownTo(2, 2);
+	inputStride_ = inputCfg.stride;
+
+	if (inputSize_.width < 2 || inputSize_.height < 2)
+		return -EINVAL;
+
+	if (inputStride_ < inputFormat_.lineSize(inputSize_.width)) {
+		LOG(SimplePipeline, Error)
+			<< "Input stride " << inputStride_ << " too small";
+		return -EINVAL;
+	}
+
+	outputs_.clear();
+
+	for (const StreamConfiguration &cfg : outputCfgs) {
+		Output output;
+		output.pixelFormat = cfg.pixelFormat;
+		output.size = cfg.size;
+		std::tie(output.stride, output.frameSize) =
+			strideAndFrameSize(cfg.pixelFormat, cfg.size);
+
+		if (!output.stride || cfg.size != inputSize_) {
+			LOG(SimplePipeline, Error)
+				<< "Unsupported output configuration " << cfg.toString();
+			outputs_.clear();
+			return -EINVAL;
+		}
+
+		outputs_.push_back(output);
+	}
+
+	return 0;
+}
+
+int SoftwareIsp::exportBuffers(unsigned int output, unsigned int count,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (output >= outputs_.size())
+		return -EINVAL;
+
+	unsigned int size = outputs_[output].frameSize;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		FileDescriptor fd;
+
+		if (heap_.isValid()) {
+			fd = heap_.alloc("libcamera-swisp", size);
+		} else {
+			int memfd = memfd_create("libcamera-swisp", MFD_CLOEXEC);
+			if (memfd >= 0 && ftruncate(memfd, size) < 0) {
+				close(memfd);
+				memfd = -1;
+			}
+
+			fd = FileDescriptor(std::move(memfd));
+		}
+
+		if (!fd.isValid()) {
+			LOG(SimplePipeline, Error) << "Failed to allocate buffer";
+			buffers->clear();
+			return -ENOMEM;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = std::move(fd);
+		plane.length = size;
+
+		buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+	}
+
+	return count;
+}
+
+int SoftwareIsp::start()
+{
+	pool_ = std::make_unique<ThreadPool>(0, "SoftwareIsp");
+	strips_ = std::min(pool_->size() * kStripsPerWorker, inputSize_.height / 2);
+
+	gains_ = { 1.0, 1.0, 1.0 };
+	tables_.reset();
+
+	return 0;
+}
+
+void SoftwareIsp::stop()
+{
+	if (!pool_)
+		return;
+
+	/*
+	 * Wait for the strips being processed and complete the jobs directly.
+	 * The pending strip completion notifications reference jobs by id, and
+	 * are ignored when delivered later.
+	 */
+	pool_->wait();
+	pool_.reset();
+
+	while (!jobs_.empty()) {
+		std::unique_ptr<Job> job = std::move(jobs_.front());
+		jobs_.pop_front();
+		jobDone(std::move(job));
+	}
+
+	queue_.clear();
+}
+
+int SoftwareIsp::queueBuffers(FrameBuffer *input,
+			      const std::map<unsigned int, FrameBuffer *> &outputs)
+{
+	if (outputs.empty() || !pool_)
+		return -EINVAL;
+
+	for (auto [index, buffer] : outputs) {
+		if (!buffer || index >= outputs_.size())
+			return -EINVAL;
+	}
+
+	const MappedFrameBuffer *in;
+	int ret = input->_d()->map(MappedFrameBuffer::MapFlag::Read, &in);
+	if (ret < 0)
+		return ret;
+
+	/* Map all outputs first, to queue either all jobs or none. */
+	std::map<unsigned int, const MappedFrameBuffer *> mapped;
+	for (auto [index, buffer] : outputs) {
+		const MappedFrameBuffer *out;
+		ret = buffer->_d()->map(MappedFrameBuffer::MapFlag::Write, &out);
+		if (ret < 0)
+			return ret;
+
+		mapped[index] = out;
+	}
+
+	if (!tables_)
+		updateTables({});
+
+	for (auto [index, buffer] : outputs) {
+		const MappedFrameBuffer *out = mapped[index];
+
+		std::unique_ptr<Job> job = std::make_unique<Job>();
+		job->id = nextJobId_++;
+		job->input = input;
+		job->output = buffer;
+		job->index = index;
+		job->src = in->maps()[0].data();
+		job->dst = out->maps()[0].data();
+		job->tables = tables_;
+		job->stats.assign(strips_, {});
+		job->pending = strips_;
+
+		Job *ptr = job.get();
+		jobs_.push_back(std::move(job));
+
+		for (unsigned int strip = 0; strip < strips_; ++strip)
+			pool_->run([this, ptr, strip]() {
+				processStrip(ptr, strip);
+				return ptr->id;
+			}, this, &SoftwareIsp::stripDone);
+	}
+
+	queue_[input] += outputs.size();
+
+	return 0;
+}
+
+/*
+ * Set the black level subtracted from the input samples, expressed in the
+ * 16-bit pixel range. A value of 0 selects a default black level.
+ */
+void SoftwareIsp::setBlackLevel(uint16_t blackLevel)
+{
+	blackLevel_ = blackLevel ? blackLevel : kDefaultBlackLevel;
+}
+
+void SoftwareIsp::unpackLine(const uint8_t *src, uint16_t *dst) const
+{
+	const unsigned int width = inputSize_.width;
+
+	/* Leave room for one sample of padding on each side. */
+	uint16_t *line = dst + 1;
+
+	inputFormat_.unpackLine(src, line, width);
+
+	/* Mirror the samples by two pixels to preserve the Bayer pattern. */
+	line[-1] = line[1];
+	line[width] = line[width - 2];
+}
+
+void SoftwareIsp::processStrip(Job *job, unsigned int strip) const
+{
+	const unsigned int width = inputSize_.width;
+	const unsigned int height = inputSize_.height;
+	const Output &output = outputs_[job->index];
+	const Tables &tables = *job->tables;
+	const std::array<Channel, 4> &pattern = bayerPatterns[inputFormat_.order];
+	Statistics &stats = job->stats[strip];
+
+	/* Split the frame in strips of even heights. */
+	unsigned int y0 = height / 2 * strip / strips_ * 2;
+	unsigned int y1 = height / 2 * (strip + 1) / strips_ * 2;
+
+	/*
+	 * Lines of unpacked samples, with one sample of padding on each side,
+	 * for the previous, current and next input lines.
+	 */
+	std::array<std::vector<uint16_t>, 3> lines;
+	for (std::vector<uint16_t> &line : lines)
+		line.resize(width + 2);
+
+	std::array<std::vector<uint16_t>, 3> rgb;
+	for (std::vector<uint16_t> &line : rgb)
+		line.resize(width);
+
+	/* Mirror the lines by two to preserve the Bayer pattern. */
+	auto inputLine = [&](int y) {
+		if (y < 0)
+			y = 1;
+		else if (y >= static_cast<int>(height))
+			y = height - 2;
+		return job->src + y * inputStride_;
+	};
+
+	stats = {};
+
+	for (unsigned int y = y0; y < y1; ++y) {
+		if (y == y0) {
+			unpackLine(inputLine(y - 1), lines[0].data());
+			unpackLine(inputLine(y), lines[1].data());
+		} else {
+			std::rotate(lines.begin(), lines.begin() + 1, lines.end());
+		}
+		unpackLine(inputLine(y + 1), lines[2].data());
+
+		const uint16_t *prev = lines[0].data() + 1;
+		const uint16_t *cur = lines[1].data() + 1;
+		const uint16_t *next = lines[2].data() + 1;
+
+		/* Demosaic the line with bilinear interpolation. */
+		for (int x = 0; x < static_cast<int>(width); ++x) {
+			Channel colour = pattern[(y & 1) * 2 + (x & 1)];
+			unsigned int cross = cur[x - 1] + cur[x + 1] + prev[x] + next[x];
+			unsigned int diag = prev[x - 1] + prev[x + 1] + next[x - 1] + next[x + 1];
+
+			if (colour == Green) {
+				/* The horizontal neighbours have the colour of the line. */
+				Channel horizontal = pattern[(y & 1) * 2 + ((x + 1) & 1)];
+				Channel vertical = horizontal == Red ? Blue : Red;
+
+				rgb[Green][x] = cur[x];
+				rgb[horizontal][x] = (cur[x - 1] + cur[x + 1]) / 2;
+				rgb[vertical][x] = (prev[x] + next[x]) / 2;
+			} else {
+				Channel other = colour == Red ? Blue : Red;
+
+				rgb[colour][x] = cur[x];
+				rgb[Green][x] = cross / 4;
+				rgb[other][x] = diag / 4;
+			}
+		}
+
+		if (y % kStatsStep == 0) {
+			for (unsigned int x = 0; x < width; x += kStatsStep) {
+				stats.sum[Red] += rgb[Red][x];
+				stats.sum[Green] += rgb[Green][x];
+				stats.sum[Blue] += rgb[Blue][x];
+			}
+			stats.count += (width + kStatsStep - 1) / kStatsStep;
+		}
+
+		/* Apply the lookup tables and write the output line. */
+		const uint8_t *lutR = tables.lut[Red].data();
+		const uint8_t *lutG = tables.lut[Green].data();
+		const uint8_t *lutB = tables.lut[Blue].data();
+		const uint16_t *r = rgb[Red].data();
+		const uint16_t *g = rgb[Green].data();
+		const uint16_t *b = rgb[Blue].data();
+		uint8_t *dst = job->dst + y * output.stride;
+
+		switch (output.pixelFormat) {
+		case formats::RGB888:
+			for (unsigned int x = 0; x < width; ++x) {
+				dst[3 * x] = lutB[b[x]];
+				dst[3 * x + 1] = lutG[g[x]];
+				dst[3 * x + 2] = lutR[r[x]];
+			}
+			break;
+
+		case formats::BGR888:
+			for (unsigned int x = 0; x < width; ++x) {
+				dst[3 * x] = lutR[r[x]];
+				dst[3 * x + 1] = lutG[g[x]];
+				dst[3 * x + 2] = lutB[b[x]];
+			}
+			break;
+
+		case formats::XRGB8888:
+			for (unsigned int x = 0; x < width; ++x) {
+				dst[4 * x] = lutB[b[x]];
+				dst[4 * x + 1] = lutG[g[x]];
+				dst[4 * x + 2] = lutR[r[x]];
+				dst[4 * x + 3] = 0xff;
+			}
+			break;
+
+		case formats::YUYV:
+			for (unsigned int x = 0; x < width; x += 2) {
+				int r0 = lutR[r[x]], g0 = lutG[g[x]], b0 = lutB[b[x]];
+				int r1 = lutR[r[x + 1]], g1 = lutG[g[x + 1]], b1 = lutB[b[x + 1]];
+				int rs = r0 + r1, gs = g0 + g1, bs = b0 + b1;
+
+				/* BT.601 limited range. */
+				dst[2 * x] = 16 + ((66 * r0 + 129 * g0 + 25 * b0 + 128) >> 8);
+				dst[2 * x + 1] = 128 + ((-38 * rs - 74 * gs + 112 * bs + 256) >> 9);
+				dst[2 * x + 2] = 16 + ((66 * r1 + 129 * g1 + 25 * b1 + 128) >> 8);
+				dst[2 * x + 3] = 128 + ((112 * rs - 94 * gs - 18 * bs + 256) >> 9);
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+void SoftwareIsp::stripDone(unsigned int id)
+{
+	/* Jobs completed by stop() are not in the list anymore. */
+	auto iter = std::find_if(jobs_.begin(), jobs_.end(),
+				 [id](const std::unique_ptr<Job> &j) {
+					 return j->id == id;
+				 });
+	if (iter == jobs_.end())
+		return;
+
+	if (--(*iter)->pending)
+		return;
+
+	std::unique_ptr<Job> done = std::move(*iter);
+	jobs_.erase(iter);
+
+	jobDone(std::move(done));
+}
+
+void SoftwareIsp::jobDone(std::unique_ptr<Job> done)
+{
+	/* Update the white balance for the next frames. */
+	updateTables(*done);
+
+	FrameMetadata &metadata = done->output->_d()->metadata();
+	const FrameMetadata &inputMetadata = done->input->metadata();
+	metadata.status = FrameMetadata::FrameSuccess;
+	metadata.sequence = inputMetadata.sequence;
+	metadata.timestamp = inputMetadata.timestamp;
+	metadata.planes.resize(1);
+	metadata.planes[0].bytesused = outputs_[done->index].frameSize;
+
+	outputBufferReady.emit(done->output);
+
+	auto it = queue_.find(done->input);
+	if (it != queue_.end() && !--it->second) {
+		inputBufferReady.emit(done->input);
+		queue_.erase(it);
+	}
+}
+
+void SoftwareIsp::updateTables(const Job &job)
+{
+	const unsigned int maxValue = (1 << inputFormat_.bitDepth) - 1;
+	const double blackLevel = blackLevel_ >> (16 - inputFormat_.bitDepth);
+
+	/* Compute the grey world gains from the frame statistics. */
+	Statistics stats = {};
+	for (const Statistics &s : job.stats) {
+		for (unsigned int c = 0; c < 3; ++c)
+			stats.sum[c] += s.sum[c];
+		stats.count += s.count;
+	}
+
+	if (stats.count) {
+		std::array<double, 3> means;
+		for (unsigned int c = 0; c < 3; ++c)
+			means[c] = std::max(static_cast<double>(stats.sum[c]) / stats.count - blackLevel,
+					    1.0);
+
+		for (Channel c : { Red, Blue }) {
+			double gain = std::clamp(means[Green] / means[c], kMinGain, kMaxGain);
+			gains_[c] += (gain - gains_[c]) * kGainSpeed;
+		}
+	}
+
+	/* Build new tables, the previous ones may still be in use by jobs. */
+	auto tables = std::make_shared<Tables>();
+	const double range = maxValue - blackLevel;
+
+	for (unsigned int c = 0; c < 3; ++c) {
+		std::vector<uint8_t> &lut = tables->lut[c];
+		lut.resize(maxValue + 1);
+
+		for (unsigned int v = 0; v <= maxValue; ++v) {
+			double value = std::max(v - blackLevel, 0.0) / range * gains_[c];
+			value = std::pow(std::min(value, 1.0), 1.0 / kGamma);
+			lut[v] = static_cast<uint8_t>(value * 255.0 + 0.5);
+		}
+	}
+
+	tables_ = std::move(tables);
+}
+
+} /* namespace libcamera */
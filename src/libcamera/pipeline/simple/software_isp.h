@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * software_isp.h - Software ISP for simple pipeline handler
+ */
+
+#ifndef __LIBCAMERA_PIPELINE_SIMPLE_SOFTWARE_ISP_H__
+#define __LIBCAMERA_PIPELINE_SIMPLE_SOFTWARE_ISP_H__
+
+#include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread_pool.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/dma_heaps.h"
+
+#include "converter.h"
+
+namespace libcamera {
+
+class SoftwareIsp : public Converter, public Object
+{
+public:
+	SoftwareIsp();
+	~SoftwareIsp();
+
+	bool isValid() const override { return true; }
+
+	std::vector<PixelFormat> formats(PixelFormat input) override;
+	SizeRange sizes(const Size &input) override;
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
+
+	int configure(const StreamConfiguration &inputCfg,
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs) override;
+	int exportBuffers(unsigned int output, unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start() override;
+	void stop() override;
+
+	int queueBuffers(FrameBuffer *input,
+			 const std::map<unsigned int, FrameBuffer *> &outputs) override;
+
+	void setBlackLevel(uint16_t blackLevel);
+
+private:
+	/* Per-channel lookup tables applying black level, gains and gamma. */
+	struct Tables {
+		std::array<std::vector<uint8_t>, 3> lut;
+	};
+
+	/* Sums of the demosaiced pixel values, per channel. */
+	struct Statistics {
+		std::array<uint64_t, 3> sum;
+		uint64_t count;
+	};
+
+	struct Output {
+		PixelFormat pixelFormat;
+		Size size;
+		unsigned int stride;
+		unsigned int frameSize;
+	};
+
+	struct Job {
+		unsigned int id;
+
+		FrameBuffer *input;
+		FrameBuffer *output;
+		unsigned int index;
+
+		const uint8_t *src;
+		uint8_t *dst;
+
+		std::shared_ptr<const Tables> tables;
+		std::vector<Statistics> stats;
+		unsigned int pending;
+	};
+
+	static BayerFormat bayerFormat(const PixelFormat &pixelFormat);
+
+	void unpackLine(const uint8_t *src, uint16_t *dst) const;
+	void processStrip(Job *job, unsigned int strip) const;
+	void stripDone(unsigned int id);
+	void jobDone(std::unique_ptr<Job> done);
+
+	void updateTables(const Job &job);
+
+	BayerFormat inputFormat_;
+	Size inputSize_;
+	unsigned int inputStride_;
+	std::vector<Output> outputs_;
+
+	std::unique_ptr<ThreadPool> pool_;
+	unsigned int strips_;
+
+	DmaHeap heap_;
+
+	std::list<std::unique_ptr<Job>> jobs_;
+	std::map<FrameBuffer *, unsigned int> queue_;
+	unsigned int nextJobId_;
+
+	uint16_t blackLevel_;
+	std::array<double, 3> gains_;
+	std::shared_ptr<const Tables> tables_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_SIMPLE_SOFTWARE_ISP_H__ */
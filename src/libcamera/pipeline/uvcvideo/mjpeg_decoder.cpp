@@ -0,0 +1,632 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder.cpp - MJPEG decoder for the UVC pipeline handler
+ */
+
+#include "mjpeg_decoder.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/message.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/thread_pool.h>
+#include <libcamera/base/utils.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/dma_heaps.h"
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/media_device.h"
+#include "libcamera/internal/v4l2_videodevice.h"
+
+#if HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+#endif
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(UVC)
+
+namespace {
+
+/* -----------------------------------------------------------------------------
+ * V4L2 mem2mem decoder
+ */
+
+class MjpegDecoderV4L2 : public MjpegDecoder
+{
+public:
+	MjpegDecoderV4L2(std::unique_ptr<V4L2M2MDevice> m2m,
+			 const V4L2PixelFormat &inputFormat);
+
+	static std::unique_ptr<MjpegDecoder> probe(const std::string &deviceNode);
+
+	const char *name() const override { return "v4l2"; }
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const Size &size) override;
+
+	int configure(const Size &size, unsigned int inputBufferCount,
+		      unsigned int outputBufferCount) override;
+	int exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start() override;
+	void stop() override;
+
+	int decode(FrameBuffer *input, FrameBuffer *output) override;
+
+private:
+	void outputBufferDone(FrameBuffer *buffer);
+	void captureBufferDone(FrameBuffer *buffer);
+
+	std::unique_ptr<V4L2M2MDevice> m2m_;
+	V4L2PixelFormat inputFormat_;
+
+	unsigned int inputBufferCount_;
+	unsigned int outputBufferCount_;
+};
+
+MjpegDecoderV4L2::MjpegDecoderV4L2(std::unique_ptr<V4L2M2MDevice> m2m,
+				   const V4L2PixelFormat &inputFormat)
+	: m2m_(std::move(m2m)), inputFormat_(inputFormat),
+	  inputBufferCount_(0), outputBufferCount_(0)
+{
+	m2m_->output()->bufferReady.connect(this, &MjpegDecoderV4L2::outputBufferDone);
+	m2m_->capture()->bufferReady.connect(this, &MjpegDecoderV4L2::captureBufferDone);
+}
+
+std::unique_ptr<MjpegDecoder> MjpegDecoderV4L2::probe(const std::string &deviceNode)
+{
+	/*
+	 * Check the device capabilities before opening it as a mem2mem
+	 * device, to avoid logging errors for all the other video nodes.
+	 */
+	int fd = ::open(deviceNode.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+
+	struct v4l2_capability caps = {};
+	int ret = ioctl(fd, VIDIOC_QUERYCAP, &caps);
+	::close(fd);
+
+	if (ret < 0)
+		return nullptr;
+
+	uint32_t deviceCaps = caps.capabilities & V4L2_CAP_DEVICE_CAPS
+			    ? caps.device_caps : caps.capabilities;
+	if (!(deviceCaps & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE)) ||
+	    !(deviceCaps & V4L2_CAP_STREAMING))
+		return nullptr;
+
+	auto m2m = std::make_unique<V4L2M2MDevice>(deviceNode);
+	if (m2m->open() < 0)
+		return nullptr;
+
+	/* The decoder must consume JPEG or MJPEG and produce NV12. */
+	V4L2PixelFormat inputFormat;
+	for (const auto &format : m2m->output()->formats()) {
+		if (format.first == V4L2PixelFormat(V4L2_PIX_FMT_MJPEG) ||
+		    format.first == V4L2PixelFormat(V4L2_PIX_FMT_JPEG)) {
+			inputFormat = format.first;
+			break;
+		}
+	}
+
+	if (!inputFormat.isValid())
+		return nullptr;
+
+	V4L2DeviceFormat format;
+	format.fourcc = inputFormat;
+	format.size = { 640, 480 };
+	if (m2m->output()->setFormat(&format) < 0)
+		return nullptr;
+
+	V4L2PixelFormat nv12 = m2m->capture()->toV4L2PixelFormat(formats::NV12);
+	V4L2VideoDevice::Formats captureFormats = m2m->capture()->formats();
+	if (captureFormats.find(nv12) == captureFormats.end())
+		return nullptr;
+
+	LOG(UVC, Debug) << "Using MJPEG decoder " << deviceNode;
+
+	return std::make_unique<MjpegDecoderV4L2>(std::move(m2m), inputFormat);
+}
+
+std::tuple<unsigned int, unsigned int>
+MjpegDecoderV4L2::strideAndFrameSize(const Size &size)
+{
+	V4L2DeviceFormat format;
+	format.fourcc = m2m_->capture()->toV4L2PixelFormat(formats::NV12);
+	format.size = size;
+
+	int ret = m2m_->capture()->tryFormat(&format);
+	if (ret < 0)
+		return std::make_tuple(0, 0);
+
+	unsigned int frameSize = 0;
+	for (unsigned int i = 0; i < format.planesCount; ++i)
+		frameSize += format.planes[i].size;
+
+	return std::make_tuple(format.planes[0].bpl, frameSize);
+}
+
+int MjpegDecoderV4L2::configure(const Size &size, unsigned int inputBufferCount,
+				unsigned int outputBufferCount)
+{
+	V4L2DeviceFormat format;
+	format.fourcc = inputFormat_;
+	format.size = size;
+
+	int ret = m2m_->output()->setFormat(&format);
+	if (ret < 0) {
+		LOG(UVC, Error)
+			<< "Failed to set decoder input format: " << strerror(-ret);
+		return ret;
+	}
+
+	V4L2PixelFormat nv12 = m2m_->capture()->toV4L2PixelFormat(formats::NV12);
+	format = {};
+	format.fourcc = nv12;
+	format.size = size;
+
+	ret = m2m_->capture()->setFormat(&format);
+	if (ret < 0) {
+		LOG(UVC, Error)
+			<< "Failed to set decoder output format: " << strerror(-ret);
+		return ret;
+	}
+
+	if (format.fourcc != nv12 || format.size != size) {
+		LOG(UVC, Error)
+			<< "Decoder output format not supported (got "
+			<< format.toString() << ")";
+		return -EINVAL;
+	}
+
+	inputBufferCount_ = inputBufferCount;
+	outputBufferCount_ = outputBufferCount;
+
+	return 0;
+}
+
+int MjpegDecoderV4L2::exportBuffers(unsigned int count,
+				    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	return m2m_->capture()->exportBuffers(count, buffers);
+}
+
+int MjpegDecoderV4L2::start()
+{
+	int ret = m2m_->output()->importBuffers(inputBufferCount_);
+	if (ret < 0)
+		return ret;
+
+	ret = m2m_->capture()->importBuffers(outputBufferCount_);
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	ret = m2m_->output()->streamOn();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	ret = m2m_->capture()->streamOn();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	return 0;
+}
+
+void MjpegDecoderV4L2::stop()
+{
+	m2m_->capture()->streamOff();
+	m2m_->output()->streamOff();
+	m2m_->capture()->releaseBuffers();
+	m2m_->output()->releaseBuffers();
+}
+
+int MjpegDecoderV4L2::decode(FrameBuffer *input, FrameBuffer *output)
+{
+	int ret = m2m_->capture()->queueBuffer(output);
+	if (ret < 0)
+		return ret;
+
+	return m2m_->output()->queueBuffer(input);
+}
+
+void MjpegDecoderV4L2::outputBufferDone(FrameBuffer *buffer)
+{
+	inputBufferReady.emit(buffer);
+}
+
+void MjpegDecoderV4L2::captureBufferDone(FrameBuffer *buffer)
+{
+	outputBufferReady.emit(buffer);
+}
+
+#if HAVE_LIBJPEG
+
+/* -----------------------------------------------------------------------------
+ * libjpeg decoder
+ */
+
+class MjpegDecoderJpeg : public MjpegDecoder, public Object
+{
+public:
+	MjpegDecoderJpeg();
+	~MjpegDecoderJpeg();
+
+	const char *name() const override { return "libjpeg"; }
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const Size &size) override;
+
+	int configure(const Size &size, unsigned int inputBufferCount,
+		      unsigned int outputBufferCount) override;
+	int exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	int start() override;
+	void stop() override;
+
+	int decode(FrameBuffer *input, FrameBuffer *output) override;
+
+private:
+	struct Job {
+		FrameBuffer *input;
+		FrameBuffer *output;
+
+		const uint8_t *src;
+		size_t srcSize;
+		uint8_t *y;
+		uint8_t *uv;
+
+		bool success;
+	};
+
+	struct ErrorManager {
+		struct jpeg_error_mgr pub;
+		jmp_buf escape;
+	};
+
+	static void errorExit(j_common_ptr cinfo);
+	static void outputMessage(j_common_ptr cinfo);
+
+	bool decodeFrame(const Job &job) const;
+	void decodeDone(Job job);
+
+	Size size_;
+	unsigned int stride_;
+	unsigned int frameSize_;
+
+	DmaHeap heap_;
+	std::unique_ptr<ThreadPool> pool_;
+};
+
+MjpegDecoderJpeg::MjpegDecoderJpeg()
+	: stride_(0), frameSize_(0),
+	  heap_(DmaHeap::DmaHeapFlag::Cma | DmaHeap::DmaHeapFlag::System)
+{
+}
+
+MjpegDecoderJpeg::~MjpegDecoderJpeg()
+{
+	stop();
+}
+
+std::tuple<unsigned int, unsigned int>
+MjpegDecoderJpeg::strideAndFrameSize(const Size &size)
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(formats::NV12);
+	FrameLayout layout = info.frameLayout(size);
+	return std::make_tuple(layout.planes[0].stride, layout.frameSize);
+}
+
+int MjpegDecoderJpeg::configure(const Size &size,
+				[[maybe_unused]] unsigned int inputBufferCount,
+				[[maybe_unused]] unsigned int outputBufferCount)
+{
+	size_ = size;
+	std::tie(stride_, frameSize_) = strideAndFrameSize(size);
+
+	return 0;
+}
+
+int MjpegDecoderJpeg::exportBuffers(unsigned int count,
+				    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	for (unsigned int i = 0; i < count; ++i) {
+		FileDescriptor fd;
+
+		if (heap_.isValid()) {
+			fd = heap_.alloc("libcamera-mjpeg", frameSize_);
+		} else {
+			int memfd = memfd_create("libcamera-mjpeg", MFD_CLOEXEC);
+			if (memfd >= 0 && ftruncate(memfd, frameSize_) < 0) {
+				close(memfd);
+				memfd = -1;
+			}
+
+			fd = FileDescriptor(std::move(memfd));
+		}
+
+		if (!fd.isValid()) {
+			LOG(UVC, Error) << "Failed to allocate buffer";
+			buffers->clear();
+			return -ENOMEM;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = std::move(fd);
+		plane.length = frameSize_;
+
+		buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+	}
+
+	return count;
+}
+
+int MjpegDecoderJpeg::start()
+{
+	/* Frames are decoded in parallel, one per worker. */
+	pool_ = std::make_unique<ThreadPool>(0, "MjpegDecoder");
+	return 0;
+}
+
+void MjpegDecoderJpeg::stop()
+{
+	if (!pool_)
+		return;
+
+	pool_->wait();
+	thread()->dispatchMessages(Message::Type::InvokeMessage);
+	pool_.reset();
+}
+
+int MjpegDecoderJpeg::decode(FrameBuffer *input, FrameBuffer *output)
+{
+	if (!pool_)
+		return -EINVAL;
+
+	const MappedFrameBuffer *in;
+	int ret = input->_d()->map(MappedFrameBuffer::MapFlag::Read, &in);
+	if (ret < 0)
+		return ret;
+
+	const MappedFrameBuffer *out;
+	ret = output->_d()->map(MappedFrameBuffer::MapFlag::Write, &out);
+	if (ret < 0)
+		return ret;
+
+	Job job{};
+	job.input = input;
+	job.output = output;
+	job.src = in->maps()[0].data();
+	job.srcSize = std::min<size_t>(input->metadata().planes[0].bytesused,
+				       in->maps()[0].size());
+
+	/*
+	 * Support both contiguous NV12 buffers, and buffers with one plane
+	 * per component.
+	 */
+	const std::vector<MappedFrameBuffer::Plane> &planes = out->maps();
+	size_t lumaSize = stride_ * size_.height;
+
+	if (planes.size() == 1 && planes[0].size() >= frameSize_) {
+		job.y = planes[0].data();
+		job.uv = planes[0].data() + lumaSize;
+	} else if (planes.size() == 2 && planes[0].size() >= lumaSize &&
+		   planes[1].size() >= frameSize_ - lumaSize) {
+		job.y = planes[0].data();
+		job.uv = planes[1].data();
+	} else {
+		LOG(UVC, Error) << "Invalid output buffer";
+		return -EINVAL;
+	}
+
+	pool_->run([this, job]() {
+		Job result = job;
+		result.success = decodeFrame(job);
+		return result;
+	}, this, &MjpegDecoderJpeg::decodeDone);
+
+	return 0;
+}
+
+void MjpegDecoderJpeg::errorExit(j_common_ptr cinfo)
+{
+	ErrorManager *err = reinterpret_cast<ErrorManager *>(cinfo->err);
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(err->escape, 1);
+}
+
+void MjpegDecoderJpeg::outputMessage(j_common_ptr cinfo)
+{
+	char message[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, message);
+	LOG(UVC, Debug) << "libjpeg: " << message;
+}
+
+bool MjpegDecoderJpeg::decodeFrame(const Job &job) const
+{
+	const unsigned int width = size_.width;
+	const unsigned int height = size_.height;
+
+	/* Allocate the line buffers before setting the longjmp target. */
+	std::vector<uint8_t> lines(width * 3 * 2);
+	JSAMPROW rows[2] = { lines.data(), lines.data() + width * 3 };
+
+	struct jpeg_decompress_struct cinfo;
+	ErrorManager err;
+
+	cinfo.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = &MjpegDecoderJpeg::errorExit;
+	err.pub.output_message = &MjpegDecoderJpeg::outputMessage;
+
+	if (setjmp(err.escape)) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, const_cast<unsigned char *>(job.src), job.srcSize);
+
+	if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK ||
+	    cinfo.image_width != width || cinfo.image_height != height) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	/*
+	 * Decode to YCbCr to skip the colour space conversion, and trade a bit
+	 * of quality for speed as the frames are meant for live streaming.
+	 * The NV12 output uses the full range BT.601 encoding of JFIF.
+	 */
+	cinfo.out_color_space = JCS_YCbCr;
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.do_fancy_upsampling = FALSE;
+
+	jpeg_start_decompress(&cinfo);
+
+	/* Decode two lines at a time and subsample the chroma by 2x2. */
+	while (cinfo.output_scanline < height) {
+		unsigned int y = cinfo.output_scanline;
+		unsigned int count = 0;
+
+		while (count < 2 && cinfo.output_scanline < height)
+			count += jpeg_read_scanlines(&cinfo, rows + count, 2 - count);
+
+		const uint8_t *line0 = rows[0];
+		const uint8_t *line1 = count == 2 ? rows[1] : rows[0];
+		uint8_t *luma0 = job.y + y * stride_;
+		uint8_t *luma1 = luma0 + stride_;
+		uint8_t *chroma = job.uv + y / 2 * stride_;
+
+		for (unsigned int x = 0; x < width; ++x)
+			luma0[x] = line0[x * 3];
+
+		if (count == 2) {
+			for (unsigned int x = 0; x < width; ++x)
+				luma1[x] = line1[x * 3];
+		}
+
+		for (unsigned int x = 0; x < width / 2; ++x) {
+			const uint8_t *p0 = line0 + x * 6;
+			const uint8_t *p1 = line1 + x * 6;
+
+			chroma[x * 2] = (p0[1] + p0[4] + p1[1] + p1[4] + 2) / 4;
+			chroma[x * 2 + 1] = (p0[2] + p0[5] + p1[2] + p1[5] + 2) / 4;
+		}
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+
+	return true;
+}
+
+void MjpegDecoderJpeg::decodeDone(Job job)
+{
+	FrameMetadata &metadata = job.output->_d()->metadata();
+	const FrameMetadata &inputMetadata = job.input->metadata();
+
+	metadata.status = job.success ? FrameMetadata::FrameSuccess
+				      : FrameMetadata::FrameError;
+	metadata.sequence = inputMetadata.sequence;
+	metadata.timestamp = inputMetadata.timestamp;
+	metadata.planes.resize(1);
+	metadata.planes[0].bytesused = frameSize_;
+
+	inputBufferReady.emit(job.input);
+	outputBufferReady.emit(job.output);
+}
+
+#endif /* HAVE_LIBJPEG */
+
+/* Drivers of the mem2mem JPEG decoders, looked up through media devices. */
+const char *const v4l2DecoderDrivers[] = {
+	"coda",
+	"mtk-jpeg",
+	"mxc-jpeg",
+	"rcar_jpu",
+	"s5p-jpeg",
+};
+
+std::unique_ptr<MjpegDecoder> probeV4L2Decoder(DeviceEnumerator *enumerator)
+{
+	for (const char *driver : v4l2DecoderDrivers) {
+		std::shared_ptr<MediaDevice> media = enumerator->search(DeviceMatch(driver));
+		if (!media)
+			continue;
+
+		for (const MediaEntity *entity : media->entities()) {
+			if (entity->function() != MEDIA_ENT_F_IO_V4L)
+				continue;
+
+			std::unique_ptr<MjpegDecoder> decoder =
+				MjpegDecoderV4L2::probe(entity->deviceNode());
+			if (decoder)
+				return decoder;
+		}
+	}
+
+	return nullptr;
+}
+
+} /* namespace */
+
+/*
+ * Decoding is disabled by default, and is enabled with the
+ * LIBCAMERA_UVC_MJPEG_DECODER environment variable. Decoding is performed by the
+ * first V4L2 mem2mem device known to the device enumerator that can decode JPEG
+ * to NV12. If no such device exists, the decoder falls back to libjpeg when
+ * libcamera has been compiled with libjpeg support. The mem2mem devices are not
+ * acquired, as they can be shared between cameras.
+ */
+std::unique_ptr<MjpegDecoder> MjpegDecoder::create(DeviceEnumerator *enumerator)
+{
+	const char *env = utils::secure_getenv("LIBCAMERA_UVC_MJPEG_DECODER");
+	std::string type = env ? env : "";
+
+	bool any = type == "auto";
+
+	if (any || type == "v4l2") {
+		std::unique_ptr<MjpegDecoder> decoder = probeV4L2Decoder(enumerator);
+		if (decoder)
+			return decoder;
+	}
+
+#if HAVE_LIBJPEG
+	if (any || type == "libjpeg")
+		return std::make_unique<MjpegDecoderJpeg>();
+#endif
+
+	return nullptr;
+}
+
+} /* namespace libcamera */
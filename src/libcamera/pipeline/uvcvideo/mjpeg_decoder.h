@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder.h - MJPEG decoder for the UVC pipeline handler
+ */
+
+#ifndef __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_H__
+#define __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_H__
+
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <libcamera/base/signal.h>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class DeviceEnumerator;
+class FrameBuffer;
+
+class MjpegDecoder
+{
+public:
+	virtual ~MjpegDecoder() = default;
+
+	static std::unique_ptr<MjpegDecoder> create(DeviceEnumerator *enumerator);
+
+	virtual const char *name() const = 0;
+
+	virtual std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const Size &size) = 0;
+
+	virtual int configure(const Size &size, unsigned int inputBufferCount,
+			      unsigned int outputBufferCount) = 0;
+	virtual int exportBuffers(unsigned int count,
+				  std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
+
+	virtual int start() = 0;
+	virtual void stop() = 0;
+
+	virtual int decode(FrameBuffer *input, FrameBuffer *output) = 0;
+
+	Signal<FrameBuffer *> inputBufferReady;
+	Signal<FrameBuffer *> outputBufferReady;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_H__ */
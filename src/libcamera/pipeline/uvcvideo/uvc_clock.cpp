@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * uvc_clock.cpp - UVC device clock recovery
+ */
+
+#include "uvc_clock.h"
+
+#include <string.h>
+
+namespace libcamera {
+
+namespace {
+
+/*
+ * Layout of the V4L2_META_FMT_UVC blocks, see struct uvc_meta_buf in the
+ * kernel UAPI headers. Each block stores the host timestamp and USB frame
+ * number at which a packet has been received, followed by the UVC payload
+ * header of the packet.
+ */
+constexpr size_t kMetaHeaderSize = 12;
+constexpr size_t kMetaLengthOffset = 10;
+
+/* UVC payload header bmHeaderInfo fields. */
+constexpr uint8_t kStreamPts = 1 << 2;
+constexpr uint8_t kStreamScr = 1 << 3;
+
+/*
+ * Number of SCR samples used to estimate the relationship between the device
+ * and host clocks. With one sample per frame, this covers about a second.
+ */
+constexpr unsigned int kMaxSamples = 32;
+constexpr unsigned int kMinSamples = 8;
+
+uint32_t readLE32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) |
+	       (static_cast<uint32_t>(data[3]) << 24);
+}
+
+} /* namespace */
+
+/*
+ * UVC devices timestamp frames with their own clock, in the PTS field of the
+ * payload headers. They also periodically report the value of their clock
+ * when a packet is sent, in the SCR field. The host timestamp recorded by the
+ * kernel for each packet is affected by the USB transfer scheduling jitter,
+ * but a linear fit of the host timestamps against the device clock values over
+ * a window of samples averages the jitter out. The fit is then used to convert
+ * the PTS of each frame to the host clock.
+ *
+ * \todo Use the USB SOF counter to improve accuracy further
+ */
+UVCClock::UVCClock()
+{
+	reset();
+}
+
+void UVCClock::reset()
+{
+	samples_.clear();
+	lastStc_ = 0;
+	stc_ = 0;
+
+	valid_ = false;
+	refStc_ = 0;
+	refTimestamp_ = 0;
+	slope_ = 0.0;
+	offset_ = 0.0;
+}
+
+/*
+ * Parse a V4L2_META_FMT_UVC buffer, update the clock model with the most
+ * recent SCR, and return the PTS of the frame if the device reports it. The
+ * buffer is parsed in place.
+ */
+std::optional<uint32_t> UVCClock::parse(Span<const uint8_t> data)
+{
+	std::optional<uint32_t> pts;
+	std::optional<std::pair<uint32_t, uint64_t>> scr;
+
+	size_t offset = 0;
+	while (data.size() - offset >= kMetaHeaderSize) {
+		const uint8_t *block = data.data() + offset;
+		size_t length = block[kMetaLengthOffset];
+		if (data.size() - offset - kMetaHeaderSize < length)
+			break;
+
+		uint64_t timestamp;
+		memcpy(&timestamp, block, sizeof(timestamp));
+
+		const uint8_t *header = block + kMetaHeaderSize;
+		offset += kMetaHeaderSize + length;
+
+		if (length < 2 || header[0] > length)
+			continue;
+
+		uint8_t info = header[1];
+		size_t pos = 2;
+
+		if (info & kStreamPts) {
+			if (header[0] < pos + 4)
+				continue;
+			if (!pts)
+				pts = readLE32(header + pos);
+			pos += 4;
+		}
+
+		if (info & kStreamScr) {
+			if (header[0] < pos + 6)
+				continue;
+			scr = { readLE32(header + pos), timestamp };
+		}
+	}
+
+	if (scr)
+		addSample(scr->first, scr->second);
+
+	return pts;
+}
+
+void UVCClock::addSample(uint32_t stc, uint64_t timestamp)
+{
+	/* Unwrap the 32-bit device clock. */
+	if (samples_.empty())
+		stc_ = stc;
+	else
+		stc_ += static_cast<int32_t>(stc - lastStc_);
+
+	lastStc_ = stc;
+
+	/* Devices may repeat the same SCR, ignore duplicates. */
+	if (!samples_.empty() && samples_.back().stc == stc_)
+		return;
+
+	/* Restart from scratch if the clock jumps back. */
+	if (!samples_.empty() && (stc_ < samples_.back().stc ||
+				  timestamp < samples_.back().timestamp)) {
+		reset();
+		stc_ = stc;
+		lastStc_ = stc;
+	}
+
+	samples_.push_back({ stc_, timestamp });
+	if (samples_.size() > kMaxSamples)
+		samples_.pop_front();
+
+	update();
+}
+
+void UVCClock::update()
+{
+	valid_ = false;
+
+	if (samples_.size() < kMinSamples)
+		return;
+
+	/*
+	 * Fit timestamp = slope * stc + offset with a least squares linear
+	 * regression. Use values relative to the first sample to preserve
+	 * precision.
+	 */
+	refStc_ = samples_.front().stc;
+	refTimestamp_ = samples_.front().timestamp;
+
+	double sumX = 0.0, sumY = 0.0;
+	for (const Sample &sample : samples_) {
+		sumX += sample.stc - refStc_;
+		sumY += static_cast<double>(sample.timestamp - refTimestamp_);
+	}
+
+	double meanX = sumX / samples_.size();
+	double meanY = sumY / samples_.size();
+	double covariance = 0.0, variance = 0.0;
+
+	for (const Sample &sample : samples_) {
+		double x = sample.stc - refStc_ - meanX;
+		double y = static_cast<double>(sample.timestamp - refTimestamp_) - meanY;
+		covariance += x * y;
+		variance += x * x;
+	}
+
+	if (variance <= 0.0)
+		return;
+
+	slope_ = covariance / variance;
+	offset_ = meanY - slope_ * meanX;
+
+	/* Reject nonsensical clocks. */
+	valid_ = slope_ > 0.0;
+}
+
+/* Convert a device PTS to a host timestamp, in nanoseconds. */
+uint64_t UVCClock::timestamp(uint32_t pts) const
+{
+	/* The PTS is close to the most recent SCR, unwrap it relative to it. */
+	int64_t stc = stc_ + static_cast<int32_t>(pts - lastStc_);
+	double value = slope_ * (stc - refStc_) + offset_;
+
+	return refTimestamp_ + static_cast<int64_t>(value);
+}
+
+} /* namespace libcamera */
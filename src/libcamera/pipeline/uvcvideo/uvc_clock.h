@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * uvc_clock.h - UVC device clock recovery
+ */
+
+#ifndef __LIBCAMERA_PIPELINE_UVCVIDEO_UVC_CLOCK_H__
+#define __LIBCAMERA_PIPELINE_UVCVIDEO_UVC_CLOCK_H__
+
+#include <deque>
+#include <optional>
+#include <stdint.h>
+
+#include <libcamera/base/span.h>
+
+namespace libcamera {
+
+class UVCClock
+{
+public:
+	UVCClock();
+
+	void reset();
+
+	std::optional<uint32_t> parse(Span<const uint8_t> data);
+	void addSample(uint32_t stc, uint64_t timestamp);
+
+	bool isValid() const { return valid_; }
+	uint64_t timestamp(uint32_t pts) const;
+
+private:
+	struct Sample {
+		int64_t stc;
+		uint64_t timestamp;
+	};
+
+	void update();
+
+	std::deque<Sample> samples_;
+	uint32_t lastStc_;
+	int64_t stc_;
+
+	bool valid_;
+	int64_t refStc_;
+	uint64_t refTimestamp_;
+	double slope_;
+	double offset_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_UVCVIDEO_UVC_CLOCK_H__ */
@@ -10,6 +10,8 @@
 #include <iomanip>
 #include <math.h>
 #include <memory>
+#include <optional>
+#include <queue>
 #include <tuple>
 
 #include <libcamera/base/log.h>
@@ -18,16 +20,22 @@
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
+#include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/framebuffer.h"
+#include "libcamera/internal/mapped_framebuffer.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/sysfs.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
+#include "mjpeg_decoder.h"
+#include "uvc_clock.h"
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(UVC)
@@ -36,7 +44,7 @@ class UVCCameraData : public CameraData
 {
 public:
 	UVCCameraData(PipelineHandler *pipe)
-		: CameraData(pipe)
+		: CameraData(pipe), decode_(false)
 	{
 	}
 
@@ -44,9 +52,39 @@ public:
 	void addControl(uint32_t cid, const ControlInfo &v4l2info,
 			ControlInfoMap::Map *ctrls);
 	void bufferReady(FrameBuffer *buffer);
+	void metadataReady(FrameBuffer *buffer);
+	void processBuffer(FrameBuffer *buffer);
+	void flushBuffers();
+	void decoderInputDone(FrameBuffer *buffer);
+	void decoderOutputDone(FrameBuffer *buffer);
+
+	std::map<PixelFormat, std::vector<SizeRange>> deviceFormats() const;
+	bool needsDecode(const PixelFormat &pixelFormat) const;
 
 	std::unique_ptr<V4L2VideoDevice> video_;
 	Stream stream_;
+
+	/*
+	 * MJPEG frames are decoded to NV12 when the camera doesn't produce
+	 * NV12 natively. The frames are then captured to internal buffers,
+	 * and decoded to the request buffers.
+	 */
+	std::unique_ptr<MjpegDecoder> decoder_;
+	bool decode_;
+	std::vector<std::unique_ptr<FrameBuffer>> decodeBuffers_;
+	std::queue<Request *> pendingRequests_;
+
+	/*
+	 * The UVC metadata node, when available, provides the payload headers
+	 * used to recover the device clock. Captured frames wait for their
+	 * metadata before being completed.
+	 */
+	std::unique_ptr<V4L2VideoDevice> metadata_;
+	std::vector<std::unique_ptr<FrameBuffer>> metadataBuffers_;
+	UVCClock clock_;
+	std::map<uint32_t, uint64_t> frameTimestamps_;
+	std::queue<FrameBuffer *> waitingBuffers_;
+	std::optional<uint32_t> metadataSequence_;
 };
 
 class UVCCameraConfiguration : public CameraConfiguration
@@ -70,16 +108,23 @@ public:
 	int configure(Camera *camera, CameraConfiguration *config) override;
 
 	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       unsigned int count,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
+	int prepare(Camera *camera, const ControlList *controls) override;
+	void unprepare(Camera *camera) override;
 	int start(Camera *camera, const ControlList *controls) override;
 	void stop(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
+	bool supportsDedicatedThread() const override { return true; }
 
 private:
+	static constexpr unsigned int kNumDecodeBuffers = 4;
+	static constexpr unsigned int kNumMetadataBuffers = 8;
+
 	std::string generateId(const UVCCameraData *data);
 
 	int processControl(ControlList *controls, unsigned int id,
@@ -150,16 +195,26 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 
 	cfg.bufferCount = 4;
 
+	bool decode = data_->needsDecode(cfg.pixelFormat);
+
 	V4L2DeviceFormat format;
-	format.fourcc = data_->video_->toV4L2PixelFormat(cfg.pixelFormat);
+	format.fourcc = data_->video_->toV4L2PixelFormat(decode ? formats::MJPEG
+								 : cfg.pixelFormat);
 	format.size = cfg.size;
 
 	int ret = data_->video_->tryFormat(&format);
 	if (ret)
 		return Invalid;
 
-	cfg.stride = format.planes[0].bpl;
-	cfg.frameSize = format.planes[0].size;
+	if (decode) {
+		std::tie(cfg.stride, cfg.frameSize) =
+			data_->decoder_->strideAndFrameSize(cfg.size);
+		if (!cfg.stride)
+			return Invalid;
+	} else {
+		cfg.stride = format.planes[0].bpl;
+		cfg.frameSize = format.planes[0].size;
+	}
 
 	return status;
 }
@@ -178,18 +233,17 @@ CameraConfiguration *PipelineHandlerUVC::generateConfiguration(Camera *camera,
 	if (roles.empty())
 		return config;
 
-	V4L2VideoDevice::Formats v4l2Formats = data->video_->formats();
-	std::map<PixelFormat, std::vector<SizeRange>> deviceFormats;
-	for (const auto &format : v4l2Formats) {
-		PixelFormat pixelFormat = format.first.toPixelFormat();
-		if (pixelFormat.isValid())
-			deviceFormats[pixelFormat] = format.second;
-	}
-
-	StreamFormats formats(deviceFormats);
+	StreamFormats formats(data->deviceFormats());
 	StreamConfiguration cfg(formats);
 
-	cfg.pixelFormat = formats.pixelformats().front();
+	/* Default to a native format, decoding is only used when requested. */
+	const std::vector<PixelFormat> pixelFormats = formats.pixelformats();
+	auto native = std::find_if(pixelFormats.begin(), pixelFormats.end(),
+				   [data](const PixelFormat &pixelFormat) {
+					   return !data->needsDecode(pixelFormat);
+				   });
+	cfg.pixelFormat = native != pixelFormats.end() ? *native
+						       : pixelFormats.front();
 	cfg.size = formats.sizes(cfg.pixelFormat).back();
 	cfg.bufferCount = 4;
 
@@ -206,8 +260,11 @@ int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 	StreamConfiguration &cfg = config->at(0);
 	int ret;
 
+	data->decode_ = data->needsDecode(cfg.pixelFormat);
+	PixelFormat captureFormat = data->decode_ ? formats::MJPEG : cfg.pixelFormat;
+
 	V4L2DeviceFormat format;
-	format.fourcc = data->video_->toV4L2PixelFormat(cfg.pixelFormat);
+	format.fourcc = data->video_->toV4L2PixelFormat(captureFormat);
 	format.size = cfg.size;
 
 	ret = data->video_->setFormat(&format);
@@ -215,46 +272,150 @@ int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 		return ret;
 
 	if (format.size != cfg.size ||
-	    format.fourcc != data->video_->toV4L2PixelFormat(cfg.pixelFormat))
+	    format.fourcc != data->video_->toV4L2PixelFormat(captureFormat))
 		return -EINVAL;
 
+	if (data->decode_) {
+		ret = data->decoder_->configure(cfg.size, kNumDecodeBuffers,
+						cfg.bufferCount);
+		if (ret)
+			return ret;
+
+		LOG(UVC, Debug)
+			<< "Decoding MJPEG to NV12 with "
+			<< data->decoder_->name() << " decoder";
+	}
+
 	cfg.setStream(&data->stream_);
 
 	return 0;
 }
 
 int PipelineHandlerUVC::exportFrameBuffers(Camera *camera, Stream *stream,
+					   unsigned int count,
 					   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	UVCCameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
+
+	if (data->decode_)
+		return data->decoder_->exportBuffers(count, buffers);
 
 	return data->video_->exportBuffers(count, buffers);
 }
 
-int PipelineHandlerUVC::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+int PipelineHandlerUVC::prepare(Camera *camera, [[maybe_unused]] const ControlList *controls)
 {
 	UVCCameraData *data = cameraData(camera);
 	unsigned int count = data->stream_.configuration().bufferCount;
+	int ret;
 
-	int ret = data->video_->importBuffers(count);
+	/*
+	 * When decoding, capture to internal buffers, the request buffers are
+	 * filled by the decoder.
+	 */
+	if (data->decode_)
+		ret = data->video_->allocateBuffers(kNumDecodeBuffers,
+						    &data->decodeBuffers_);
+	else
+		ret = data->video_->importBuffers(count);
 	if (ret < 0)
 		return ret;
 
+	if (data->metadata_) {
+		ret = data->metadata_->allocateBuffers(kNumMetadataBuffers,
+						       &data->metadataBuffers_);
+		if (ret < 0) {
+			unprepare(camera);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+void PipelineHandlerUVC::unprepare(Camera *camera)
+{
+	UVCCameraData *data = cameraData(camera);
+	data->video_->releaseBuffers();
+	data->decodeBuffers_.clear();
+
+	if (data->metadata_) {
+		data->metadata_->releaseBuffers();
+		data->metadataBuffers_.clear();
+	}
+}
+
+int PipelineHandlerUVC::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+{
+	UVCCameraData *data = cameraData(camera);
+	int ret;
+
+	if (data->metadata_) {
+		data->clock_.reset();
+		data->frameTimestamps_.clear();
+		data->metadataSequence_.reset();
+
+		ret = data->metadata_->streamOn();
+		if (ret < 0)
+			return ret;
+
+		for (std::unique_ptr<FrameBuffer> &buffer : data->metadataBuffers_)
+			data->metadata_->queueBuffer(buffer.get());
+	}
+
+	if (data->decode_) {
+		ret = data->decoder_->start();
+		if (ret < 0) {
+			if (data->metadata_)
+				data->metadata_->streamOff();
+			return ret;
+		}
+	}
+
 	ret = data->video_->streamOn();
 	if (ret < 0) {
-		data->video_->releaseBuffers();
+		if (data->decode_)
+			data->decoder_->stop();
+		if (data->metadata_)
+			data->metadata_->streamOff();
 		return ret;
 	}
 
+	if (data->decode_) {
+		for (std::unique_ptr<FrameBuffer> &buffer : data->decodeBuffers_)
+			data->video_->queueBuffer(buffer.get());
+	}
+
 	return 0;
 }
 
 void PipelineHandlerUVC::stop(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
+
+	/* Complete the frames still waiting for their metadata. */
+	data->flushBuffers();
+
+	if (data->decode_)
+		data->decoder_->stop();
+
 	data->video_->streamOff();
-	data->video_->releaseBuffers();
+
+	if (data->metadata_)
+		data->metadata_->streamOff();
+
+	/* Cancel the requests still waiting for a frame. */
+	while (!data->pendingRequests_.empty()) {
+		Request *request = data->pendingRequests_.front();
+		data->pendingRequests_.pop();
+
+		FrameBuffer *buffer = request->findBuffer(&data->stream_);
+		buffer->cancel();
+		completeBuffer(request, buffer);
+		completeRequest(request);
+	}
+
+	unprepare(camera);
 }
 
 int PipelineHandlerUVC::processControl(ControlList *controls, unsigned int id,
@@ -378,6 +539,12 @@ int PipelineHandlerUVC::queueRequestDevice(Camera *camera, Request *request)
 	if (ret < 0)
 		return ret;
 
+	/* The request will be completed with the next captured frame. */
+	if (data->decode_) {
+		data->pendingRequests_.push(request);
+		return 0;
+	}
+
 	ret = data->video_->queueBuffer(buffer);
 	if (ret < 0)
 		return ret;
@@ -462,6 +629,18 @@ bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 	if (data->init(media))
 		return false;
 
+	/* Create an MJPEG decoder if the camera can benefit from it. */
+	const std::map<PixelFormat, std::vector<SizeRange>> deviceFormats =
+		data->deviceFormats();
+	if (deviceFormats.count(formats::MJPEG) &&
+	    !deviceFormats.count(formats::NV12)) {
+		data->decoder_ = MjpegDecoder::create(enumerator);
+		if (data->decoder_) {
+			data->decoder_->inputBufferReady.connect(data.get(), &UVCCameraData::decoderInputDone);
+			data->decoder_->outputBufferReady.connect(data.get(), &UVCCameraData::decoderOutputDone);
+		}
+	}
+
 	/* Create and register the camera. */
 	std::string id = generateId(data.get());
 	if (id.empty()) {
@@ -502,6 +681,26 @@ int UVCCameraData::init(MediaDevice *media)
 
 	video_->bufferReady.connect(this, &UVCCameraData::bufferReady);
 
+	/* Open the metadata node, if any. */
+	for (MediaEntity *e : entities) {
+		if (e == *entity || e->function() != MEDIA_ENT_F_IO_V4L)
+			continue;
+
+		auto metadata = std::make_unique<V4L2VideoDevice>(e);
+		if (metadata->open() || !metadata->caps().isMetaCapture())
+			continue;
+
+		V4L2DeviceFormat format;
+		format.fourcc = V4L2PixelFormat(V4L2_META_FMT_UVC);
+		if (metadata->setFormat(&format) ||
+		    format.fourcc != V4L2PixelFormat(V4L2_META_FMT_UVC))
+			continue;
+
+		metadata_ = std::move(metadata);
+		metadata_->bufferReady.connect(this, &UVCCameraData::metadataReady);
+		break;
+	}
+
 	/*
 	 * \todo Find a way to tell internal and external UVC cameras apart.
 	 * Until then, treat all UVC cameras as external.
@@ -658,13 +857,164 @@ void UVCCameraData::addControl(uint32_t cid, const ControlInfo &v4l2Info,
 	ctrls->emplace(id, info);
 }
 
+std::map<PixelFormat, std::vector<SizeRange>> UVCCameraData::deviceFormats() const
+{
+	std::map<PixelFormat, std::vector<SizeRange>> formats;
+
+	for (const auto &format : video_->formats()) {
+		PixelFormat pixelFormat = format.first.toPixelFormat();
+		if (pixelFormat.isValid())
+			formats[pixelFormat] = format.second;
+	}
+
+	/* Expose the MJPEG sizes in NV12 when a decoder is available. */
+	if (decoder_) {
+		auto mjpeg = formats.find(formats::MJPEG);
+		if (mjpeg != formats.end())
+			formats.emplace(formats::NV12, mjpeg->second);
+	}
+
+	return formats;
+}
+
+bool UVCCameraData::needsDecode(const PixelFormat &pixelFormat) const
+{
+	/* The decoder is only created when the camera has no native NV12. */
+	return decoder_ && pixelFormat == formats::NV12;
+}
+
 void UVCCameraData::bufferReady(FrameBuffer *buffer)
 {
+	/*
+	 * Wait for the frame metadata, unless the metadata for a later frame
+	 * has already been received. Don't hold more than two frames to avoid
+	 * stalling if metadata buffers are lost.
+	 */
+	if (metadata_ && buffer->metadata().status != FrameMetadata::FrameCancelled) {
+		uint32_t sequence = buffer->metadata().sequence;
+
+		if (!metadataSequence_ ||
+		    static_cast<int32_t>(sequence - *metadataSequence_) > 0) {
+			waitingBuffers_.push(buffer);
+			if (waitingBuffers_.size() <= 2)
+				return;
+
+			buffer = waitingBuffers_.front();
+			waitingBuffers_.pop();
+		}
+	}
+
+	processBuffer(buffer);
+}
+
+void UVCCameraData::metadataReady(FrameBuffer *buffer)
+{
+	if (buffer->metadata().status == FrameMetadata::FrameCancelled)
+		return;
+
+	uint32_t sequence = buffer->metadata().sequence;
+
+	if (buffer->metadata().status == FrameMetadata::FrameSuccess) {
+		const MappedFrameBuffer *map;
+		if (!buffer->_d()->map(MappedFrameBuffer::MapFlag::Read, &map)) {
+			Span<const uint8_t> data = map->maps()[0];
+			data = data.first(std::min<size_t>(buffer->metadata().planes[0].bytesused,
+							   data.size()));
+
+			std::optional<uint32_t> pts = clock_.parse(data);
+			if (pts && clock_.isValid())
+				frameTimestamps_[sequence] = clock_.timestamp(*pts);
+		}
+	}
+
+	metadataSequence_ = sequence;
+	metadata_->queueBuffer(buffer);
+
+	/* Complete the frames whose metadata has been received. */
+	while (!waitingBuffers_.empty()) {
+		FrameBuffer *frame = waitingBuffers_.front();
+		if (static_cast<int32_t>(frame->metadata().sequence - sequence) > 0)
+			break;
+
+		waitingBuffers_.pop();
+		processBuffer(frame);
+	}
+}
+
+void UVCCameraData::flushBuffers()
+{
+	while (!waitingBuffers_.empty()) {
+		FrameBuffer *buffer = waitingBuffers_.front();
+		waitingBuffers_.pop();
+		processBuffer(buffer);
+	}
+}
+
+void UVCCameraData::processBuffer(FrameBuffer *buffer)
+{
+	/*
+	 * Use the timestamp recovered from the device clock if available,
+	 * and fall back to the buffer timestamp otherwise.
+	 */
+	uint64_t timestamp = buffer->metadata().timestamp;
+
+	auto iter = frameTimestamps_.find(buffer->metadata().sequence);
+	if (iter != frameTimestamps_.end())
+		timestamp = iter->second;
+
+	/* Drop the timestamps of this and older frames. */
+	while (!frameTimestamps_.empty() &&
+	       static_cast<int32_t>(frameTimestamps_.begin()->first -
+				    buffer->metadata().sequence) <= 0)
+		frameTimestamps_.erase(frameTimestamps_.begin());
+
+	if (decode_) {
+		if (buffer->metadata().status == FrameMetadata::FrameCancelled)
+			return;
+
+		/* Requeue the frame if there's no request to complete. */
+		if (pendingRequests_.empty()) {
+			video_->queueBuffer(buffer);
+			return;
+		}
+
+		Request *request = pendingRequests_.front();
+		pendingRequests_.pop();
+
+		FrameBuffer *output = request->findBuffer(&stream_);
+		request->metadata().set(controls::SensorTimestamp, timestamp);
+
+		int ret = -EIO;
+		if (buffer->metadata().status == FrameMetadata::FrameSuccess)
+			ret = decoder_->decode(buffer, output);
+
+		if (ret < 0) {
+			video_->queueBuffer(buffer);
+			output->cancel();
+			pipe_->completeBuffer(request, output);
+			pipe_->completeRequest(request);
+		}
+
+		return;
+	}
+
 	Request *request = buffer->request();
 
-	/* \todo Use the UVC metadata to calculate a more precise timestamp */
-	request->metadata().set(controls::SensorTimestamp,
-				buffer->metadata().timestamp);
+	request->metadata().set(controls::SensorTimestamp, timestamp);
+
+	pipe_->completeBuffer(request, buffer);
+	pipe_->completeRequest(request);
+}
+
+void UVCCameraData::decoderInputDone(FrameBuffer *buffer)
+{
+	/* Queue the MJPEG buffer back for capture. */
+	video_->queueBuffer(buffer);
+}
+
+void UVCCameraData::decoderOutputDone(FrameBuffer *buffer)
+{
+	Request *request = buffer->request();
 
 	pipe_->completeBuffer(request, buffer);
 	pipe_->completeRequest(request);
@@ -6,15 +6,22 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <iomanip>
 #include <map>
 #include <math.h>
+#include <queue>
+#include <random>
+#include <stdlib.h>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include <linux/media-bus-format.h>
 #include <linux/version.h>
 
 #include <libcamera/base/log.h>
+#include <libcamera/base/timer.h>
 #include <libcamera/base/utils.h>
 
 #include <libcamera/camera.h>
@@ -31,6 +38,7 @@
 
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/framebuffer.h"
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
@@ -41,17 +49,88 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(VIMC)
 
+namespace {
+
+/*
+ * Synthetic load parameters, to benchmark the libcamera core without
+ * hardware. When the frame rate is set, frames are generated by a timer
+ * instead of being captured from the vimc device. Times are expressed in
+ * microseconds.
+ */
+struct SyntheticLoad {
+	unsigned int frameRate;
+	unsigned int frameJitter;
+	unsigned int ipaTime;
+	unsigned int ipaJitter;
+	unsigned int statsSize;
+
+	bool enabled() const
+	{
+		return frameRate || ipaTime || ipaJitter || statsSize;
+	}
+};
+
+SyntheticLoad syntheticLoadFromEnv()
+{
+	SyntheticLoad load = {};
+
+	const char *env = utils::secure_getenv("LIBCAMERA_VIMC_LOAD");
+	if (!env)
+		return load;
+
+	static const std::map<std::string, unsigned int SyntheticLoad::*> keys{
+		{ "fps", &SyntheticLoad::frameRate },
+		{ "frame-jitter", &SyntheticLoad::frameJitter },
+		{ "ipa-time", &SyntheticLoad::ipaTime },
+		{ "ipa-jitter", &SyntheticLoad::ipaJitter },
+		{ "stats-size", &SyntheticLoad::statsSize },
+	};
+
+	for (const std::string &entry : utils::split(env, ",")) {
+		if (entry.empty())
+			continue;
+
+		size_t pos = entry.find('=');
+		auto key = keys.find(entry.substr(0, pos));
+		if (pos == std::string::npos || key == keys.end()) {
+			LOG(VIMC, Warning)
+				<< "Ignoring invalid synthetic load entry '"
+				<< entry << "'";
+			continue;
+		}
+
+		load.*key->second = strtoul(entry.c_str() + pos + 1, nullptr, 10);
+	}
+
+	/* Stay within the range of a sensible frame duration. */
+	load.frameRate = std::min(load.frameRate, 10000U);
+	load.statsSize = std::min(load.statsSize, 16U << 20);
+
+	return load;
+}
+
+} /* namespace */
+
 class VimcCameraData : public CameraData
 {
 public:
 	VimcCameraData(PipelineHandler *pipe, MediaDevice *media)
-		: CameraData(pipe), media_(media)
+		: CameraData(pipe), media_(media), load_(syntheticLoadFromEnv()),
+		  frame_(0), sequence_(0), underruns_(0)
 	{
 	}
 
 	int init();
+	int setFormats(const StreamConfiguration &cfg);
+	bool isPrepared(const StreamConfiguration &cfg) const;
 	void bufferReady(FrameBuffer *buffer);
 
+	void startSynthetic();
+	void stopSynthetic();
+	void queueSynthetic(FrameBuffer *buffer);
+	void statsProcessed(uint32_t frame);
+	void cancelIpaFrames();
+
 	MediaDevice *media_;
 	std::unique_ptr<CameraSensor> sensor_;
 	std::unique_ptr<V4L2Subdevice> debayer_;
@@ -61,6 +140,30 @@ public:
 	Stream stream_;
 
 	std::unique_ptr<ipa::vimc::IPAProxyVimc> ipa_;
+
+	SyntheticLoad load_;
+
+	/* Configurations that reconfigure() can switch to without a restart. */
+	std::vector<std::pair<PixelFormat, Size>> preparedFormats_;
+
+private:
+	void frameReady(FrameBuffer *buffer);
+	void completeFrame(FrameBuffer *buffer);
+	void generateFrame(Timer *timer);
+	void scheduleFrame();
+
+	/* Buffers waiting for the IPA, indexed by frame number. */
+	std::map<uint32_t, FrameBuffer *> ipaFrames_;
+	std::vector<uint8_t> stats_;
+	uint32_t frame_;
+
+	/* Synthetic frame source. */
+	Timer frameTimer_;
+	std::chrono::steady_clock::time_point nextFrame_;
+	std::queue<FrameBuffer *> syntheticBuffers_;
+	std::minstd_rand random_;
+	uint32_t sequence_;
+	unsigned int underruns_;
 };
 
 class VimcCameraConfiguration : public CameraConfiguration
@@ -84,10 +187,16 @@ public:
 	int configure(Camera *camera, CameraConfiguration *config) override;
 
 	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       unsigned int count,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 
+	int prepare(Camera *camera, const ControlList *controls) override;
+	void unprepare(Camera *camera) override;
 	int start(Camera *camera, const ControlList *controls) override;
 	void stop(Camera *camera) override;
+	int prepareConfiguration(Camera *camera,
+				 CameraConfiguration *config) override;
+	int reconfigure(Camera *camera, CameraConfiguration *config) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
@@ -234,64 +343,13 @@ int PipelineHandlerVimc::configure(Camera *camera, CameraConfiguration *config)
 {
 	VimcCameraData *data = cameraData(camera);
 	StreamConfiguration &cfg = config->at(0);
-	int ret;
-
-	/* The scaler hardcodes a x3 scale-up ratio. */
-	V4L2SubdeviceFormat subformat = {};
-	subformat.mbus_code = MEDIA_BUS_FMT_SGRBG8_1X8;
-	subformat.size = { cfg.size.width / 3, cfg.size.height / 3 };
 
-	ret = data->sensor_->setFormat(&subformat);
+	int ret = data->setFormats(cfg);
 	if (ret)
 		return ret;
 
-	ret = data->debayer_->setFormat(0, &subformat);
-	if (ret)
-		return ret;
-
-	subformat.mbus_code = pixelformats.find(cfg.pixelFormat)->second;
-	ret = data->debayer_->setFormat(1, &subformat);
-	if (ret)
-		return ret;
-
-	ret = data->scaler_->setFormat(0, &subformat);
-	if (ret)
-		return ret;
-
-	if (data->media_->version() >= KERNEL_VERSION(5, 6, 0)) {
-		Rectangle crop{ 0, 0, subformat.size };
-		ret = data->scaler_->setSelection(0, V4L2_SEL_TGT_CROP, &crop);
-		if (ret)
-			return ret;
-	}
-
-	subformat.size = cfg.size;
-	ret = data->scaler_->setFormat(1, &subformat);
-	if (ret)
-		return ret;
-
-	V4L2DeviceFormat format;
-	format.fourcc = data->video_->toV4L2PixelFormat(cfg.pixelFormat);
-	format.size = cfg.size;
-
-	ret = data->video_->setFormat(&format);
-	if (ret)
-		return ret;
-
-	if (format.size != cfg.size ||
-	    format.fourcc != data->video_->toV4L2PixelFormat(cfg.pixelFormat))
-		return -EINVAL;
-
-	/*
-	 * Format has to be set on the raw capture video node, otherwise the
-	 * vimc driver will fail pipeline validation.
-	 */
-	format.fourcc = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG8);
-	format.size = { cfg.size.width / 3, cfg.size.height / 3 };
-
-	ret = data->raw_->setFormat(&format);
-	if (ret)
-		return ret;
+	/* The current configuration can always be switched back to. */
+	data->preparedFormats_ = { { cfg.pixelFormat, cfg.size } };
 
 	cfg.setStream(&data->stream_);
 
@@ -299,15 +357,15 @@ int PipelineHandlerVimc::configure(Camera *camera, CameraConfiguration *config)
 }
 
 int PipelineHandlerVimc::exportFrameBuffers(Camera *camera, Stream *stream,
+					    unsigned int count,
 					    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	VimcCameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
 
 	return data->video_->exportBuffers(count, buffers);
 }
 
-int PipelineHandlerVimc::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+int PipelineHandlerVimc::prepare(Camera *camera, [[maybe_unused]] const ControlList *controls)
 {
 	VimcCameraData *data = cameraData(camera);
 	unsigned int count = data->stream_.configuration().bufferCount;
@@ -322,22 +380,117 @@ int PipelineHandlerVimc::start(Camera *camera, [[maybe_unused]] const ControlLis
 		return ret;
 	}
 
-	ret = data->video_->streamOn();
-	if (ret < 0) {
-		data->ipa_->stop();
-		data->video_->releaseBuffers();
+	return 0;
+}
+
+void PipelineHandlerVimc::unprepare(Camera *camera)
+{
+	VimcCameraData *data = cameraData(camera);
+	data->ipa_->stop();
+	data->video_->releaseBuffers();
+}
+
+int PipelineHandlerVimc::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+{
+	VimcCameraData *data = cameraData(camera);
+
+	if (data->load_.frameRate) {
+		data->startSynthetic();
+		return 0;
+	}
+
+	return data->video_->streamOn();
+}
+
+void PipelineHandlerVimc::stop(Camera *camera)
+{
+	VimcCameraData *data = cameraData(camera);
+
+	if (data->load_.frameRate)
+		data->stopSynthetic();
+	else
+		data->video_->streamOff();
+
+	/* Cancel the frames still waiting for the IPA, in both modes. */
+	data->cancelIpaFrames();
+
+	unprepare(camera);
+}
+
+int PipelineHandlerVimc::prepareConfiguration(Camera *camera,
+					      CameraConfiguration *config)
+{
+	VimcCameraData *data = cameraData(camera);
+	const StreamConfiguration &cfg = config->at(0);
+
+	if (data->isPrepared(cfg))
+		return 0;
+
+	/*
+	 * The format of the capture video node has been checked by validate(),
+	 * check the format of the raw capture video node that configure() sets
+	 * as well.
+	 */
+	V4L2DeviceFormat format;
+	format.fourcc = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG8);
+	format.size = { cfg.size.width / 3, cfg.size.height / 3 };
+
+	int ret = data->raw_->tryFormat(&format);
+	if (ret)
 		return ret;
+
+	if (format.size != Size(cfg.size.width / 3, cfg.size.height / 3)) {
+		LOG(VIMC, Error)
+			<< "Raw capture size " << format.size.toString()
+			<< " not supported";
+		return -EINVAL;
 	}
 
+	data->preparedFormats_.emplace_back(cfg.pixelFormat, cfg.size);
+
 	return 0;
 }
 
-void PipelineHandlerVimc::stop(Camera *camera)
+int PipelineHandlerVimc::reconfigure(Camera *camera, CameraConfiguration *config)
 {
 	VimcCameraData *data = cameraData(camera);
-	data->video_->streamOff();
-	data->ipa_->stop();
+	StreamConfiguration &cfg = config->at(0);
+
+	if (!data->isPrepared(cfg))
+		return PipelineHandler::reconfigure(camera, config);
+
+	/*
+	 * Stop streaming and swap the formats, keeping the IPA running. The
+	 * buffers have to be released to change the format of the capture
+	 * video node.
+	 */
+	if (data->load_.frameRate)
+		data->stopSynthetic();
+	else
+		data->video_->streamOff();
+
+	data->cancelIpaFrames();
+	cancelWaitingRequests(camera);
+
+	ASSERT(!hasPendingRequests(camera));
+
 	data->video_->releaseBuffers();
+
+	int ret = data->setFormats(cfg);
+	if (!ret)
+		ret = data->video_->importBuffers(cfg.bufferCount);
+	if (ret < 0) {
+		data->ipa_->stop();
+		return ret;
+	}
+
+	cfg.setStream(&data->stream_);
+
+	ret = start(camera, nullptr);
+	if (ret)
+		unprepare(camera);
+
+	return ret;
 }
 
 int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
@@ -395,6 +548,11 @@ int PipelineHandlerVimc::queueRequestDevice(Camera *camera, Request *request)
 	if (ret < 0)
 		return ret;
 
+	if (data->load_.frameRate) {
+		data->queueSynthetic(buffer);
+		return 0;
+	}
+
 	ret = data->video_->queueBuffer(buffer);
 	if (ret < 0)
 		return ret;
@@ -432,9 +590,20 @@ bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
 		return false;
 	}
 
+	data->ipa_->statsProcessed.connect(data.get(), &VimcCameraData::statsProcessed);
+
 	std::string conf = data->ipa_->configurationFile("vimc.conf");
 	data->ipa_->init(IPASettings{ conf, data->sensor_->model() });
 
+	if (data->load_.enabled()) {
+		LOG(VIMC, Info)
+			<< "Synthetic load enabled: " << data->load_.frameRate
+			<< " fps, " << data->load_.ipaTime << "us IPA time, "
+			<< data->load_.statsSize << " bytes of statistics";
+
+		data->ipa_->configure({ data->load_.ipaTime, data->load_.ipaJitter });
+	}
+
 	/* Create and register the camera. */
 	std::set<Stream *> streams{ &data->stream_ };
 	std::shared_ptr<Camera> camera =
@@ -479,6 +648,7 @@ int VimcCameraData::init()
 		return -ENODEV;
 
 	video_->bufferReady.connect(this, &VimcCameraData::bufferReady);
+	frameTimer_.timeout.connect(this, &VimcCameraData::generateFrame);
 
 	raw_ = V4L2VideoDevice::fromEntityName(media_, "Raw Capture 1");
 	if (raw_->open())
@@ -520,13 +690,215 @@ int VimcCameraData::init()
 	return 0;
 }
 
+int VimcCameraData::setFormats(const StreamConfiguration &cfg)
+{
+	int ret;
+
+	/* The scaler hardcodes a x3 scale-up ratio. */
+	V4L2SubdeviceFormat subformat = {};
+	subformat.mbus_code = MEDIA_BUS_FMT_SGRBG8_1X8;
+	subformat.size = { cfg.size.width / 3, cfg.size.height / 3 };
+
+	ret = sensor_->setFormat(&subformat);
+	if (ret)
+		return ret;
+
+	ret = debayer_->setFormat(0, &subformat);
+	if (ret)
+		return ret;
+
+	subformat.mbus_code = pixelformats.find(cfg.pixelFormat)->second;
+	ret = debayer_->setFormat(1, &subformat);
+	if (ret)
+		return ret;
+
+	ret = scaler_->setFormat(0, &subformat);
+	if (ret)
+		return ret;
+
+	if (media_->version() >= KERNEL_VERSION(5, 6, 0)) {
+		Rectangle crop{ 0, 0, subformat.size };
+		ret = scaler_->setSelection(0, V4L2_SEL_TGT_CROP, &crop);
+		if (ret)
+			return ret;
+	}
+
+	subformat.size = cfg.size;
+	ret = scaler_->setFormat(1, &subformat);
+	if (ret)
+		return ret;
+
+	V4L2DeviceFormat format;
+	format.fourcc = video_->toV4L2PixelFormat(cfg.pixelFormat);
+	format.size = cfg.size;
+
+	ret = video_->setFormat(&format);
+	if (ret)
+		return ret;
+
+	if (format.size != cfg.size ||
+	    format.fourcc != video_->toV4L2PixelFormat(cfg.pixelFormat))
+		return -EINVAL;
+
+	/*
+	 * Format has to be set on the raw capture video node, otherwise the
+	 * vimc driver will fail pipeline validation.
+	 */
+	format.fourcc = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG8);
+	format.size = { cfg.size.width / 3, cfg.size.height / 3 };
+
+	ret = raw_->setFormat(&format);
+	if (ret)
+		return ret;
+
+	return 0;
+}
+
+bool VimcCameraData::isPrepared(const StreamConfiguration &cfg) const
+{
+	return std::find(preparedFormats_.begin(), preparedFormats_.end(),
+			 std::make_pair(cfg.pixelFormat, cfg.size)) !=
+	       preparedFormats_.end();
+}
+
 void VimcCameraData::bufferReady(FrameBuffer *buffer)
+{
+	if (buffer->metadata().status == FrameMetadata::FrameCancelled) {
+		completeFrame(buffer);
+		return;
+	}
+
+	frameReady(buffer);
+}
+
+void VimcCameraData::frameReady(FrameBuffer *buffer)
+{
+	if (!load_.enabled()) {
+		completeFrame(buffer);
+		return;
+	}
+
+	/*
+	 * Hand the statistics to the IPA and complete the request once it has
+	 * processed them, to emulate the per-frame IPA round trip of real
+	 * pipelines.
+	 */
+	uint32_t frame = frame_++;
+	ipaFrames_[frame] = buffer;
+
+	stats_.resize(load_.statsSize);
+	std::fill(stats_.begin(), stats_.end(), frame & 0xff);
+
+	ipa_->processStats(frame, stats_);
+}
+
+void VimcCameraData::statsProcessed(uint32_t frame)
+{
+	auto it = ipaFrames_.find(frame);
+	if (it == ipaFrames_.end())
+		return;
+
+	FrameBuffer *buffer = it->second;
+	ipaFrames_.erase(it);
+
+	completeFrame(buffer);
+}
+
+void VimcCameraData::cancelIpaFrames()
+{
+	/* Late notifications from the IPA for these frames are ignored. */
+	for (auto &[frame, buffer] : ipaFrames_) {
+		buffer->cancel();
+		completeFrame(buffer);
+	}
+	ipaFrames_.clear();
+}
+
+void VimcCameraData::startSynthetic()
+{
+	sequence_ = 0;
+	underruns_ = 0;
+
+	nextFrame_ = std::chrono::steady_clock::now();
+	scheduleFrame();
+}
+
+void VimcCameraData::stopSynthetic()
+{
+	frameTimer_.stop();
+
+	while (!syntheticBuffers_.empty()) {
+		FrameBuffer *buffer = syntheticBuffers_.front();
+		syntheticBuffers_.pop();
+
+		buffer->cancel();
+		completeFrame(buffer);
+	}
+
+	LOG(VIMC, Info)
+		<< "Generated " << sequence_ << " synthetic frames, "
+		<< underruns_ << " without buffer";
+}
+
+void VimcCameraData::queueSynthetic(FrameBuffer *buffer)
+{
+	syntheticBuffers_.push(buffer);
+}
+
+void VimcCameraData::generateFrame([[maybe_unused]] Timer *timer)
+{
+	using namespace std::chrono;
+
+	uint32_t sequence = sequence_++;
+
+	if (syntheticBuffers_.empty()) {
+		/* Drop the frame, as the device would. */
+		underruns_++;
+	} else {
+		FrameBuffer *buffer = syntheticBuffers_.front();
+		syntheticBuffers_.pop();
+
+		auto now = steady_clock::now().time_since_epoch();
+
+		FrameMetadata &metadata = buffer->_d()->metadata();
+		metadata.status = FrameMetadata::FrameSuccess;
+		metadata.sequence = sequence;
+		metadata.timestamp = duration_cast<nanoseconds>(now).count();
+		metadata.planes.resize(buffer->planes().size());
+		for (unsigned int i = 0; i < buffer->planes().size(); ++i)
+			metadata.planes[i].bytesused = buffer->planes()[i].length;
+
+		frameReady(buffer);
+	}
+
+	scheduleFrame();
+}
+
+void VimcCameraData::scheduleFrame()
+{
+	using namespace std::chrono;
+
+	/*
+	 * Schedule the next frame relative to the ideal frame time, to avoid
+	 * accumulating drift, and delay it by a random jitter.
+	 */
+	nextFrame_ += nanoseconds(1000000000 / load_.frameRate);
+
+	auto deadline = nextFrame_;
+	if (load_.frameJitter)
+		deadline += microseconds(random_() % (load_.frameJitter + 1));
+
+	frameTimer_.start(deadline);
+}
+
+void VimcCameraData::completeFrame(FrameBuffer *buffer)
 {
 	Request *request = buffer->request();
 
 	/* Record the sensor's timestamp in the request metadata. */
-	request->metadata().set(controls::SensorTimestamp,
-				buffer->metadata().timestamp);
+	ControlList metadata(controls::controls);
+	metadata.set(controls::SensorTimestamp, buffer->metadata().timestamp);
+	pipe_->completeMetadata(request, metadata);
 
 	pipe_->completeBuffer(request, buffer);
 	pipe_->completeRequest(request);
@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/pipeline_handler.h"
 
+#include <algorithm>
 #include <sys/sysmacros.h>
 
 #include <libcamera/base/log.h>
@@ -16,6 +17,7 @@
 #include <libcamera/camera_manager.h>
 #include <libcamera/framebuffer.h>
 
+#include "libcamera/internal/camera.h"
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/tracepoints.h"
@@ -109,6 +111,16 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * over its lifetime.
  */
 
+/**
+ * \var CameraData::outOfOrderCompletion_
+ * \brief Allow requests to complete out of order
+ *
+ * When set to false, completed requests are returned to the application in
+ * submission order. When set to true, they are returned as soon as they
+ * complete. This is controlled by the application through
+ * Camera::setCompletionOrder().
+ */
+
 /**
  * \class PipelineHandler
  * \brief Create and manage cameras based on a set of media devices
@@ -132,7 +144,7 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * respective factories.
  */
 PipelineHandler::PipelineHandler(CameraManager *manager)
-	: manager_(manager)
+	: manager_(manager), useCount_(0)
 {
 }
 
@@ -169,12 +181,31 @@ PipelineHandler::~PipelineHandler()
  * If this function returns true, a new instance of the pipeline handler will
  * be created and its match() function called.
  *
- * \context This function is called from the CameraManager thread.
+ * \context This function is called from the CameraManager thread, or from
+ * the pipeline handler thread if supportsDedicatedThread() returns true.
  *
  * \return true if media devices have been acquired and camera instances
  * created, or false otherwise
  */
 
+/**
+ * \fn PipelineHandler::supportsDedicatedThread()
+ * \brief Check if the pipeline handler can run in its own thread
+ *
+ * Pipeline handlers run by default in the CameraManager thread, which then
+ * handles the events of all cameras in the system. When a large number of
+ * cameras is present, this thread can become a bottleneck. Pipeline handlers
+ * that don't share state between instances, and don't rely on running in the
+ * CameraManager thread, can override this function to return true. The camera
+ * manager may then move them to a pipeline thread, shared by a bounded number
+ * of pipeline handler instances, before calling match(). All the pipeline
+ * handler functions, as well as the event notifiers and timers it creates,
+ * will then run in that thread.
+ *
+ * \return True if the pipeline handler can run in a dedicated thread, false
+ * otherwise
+ */
+
 /**
  * \brief Search and acquire a MediaDevice matching a device pattern
  * \param[in] enumerator Enumerator containing all media devices in the system
@@ -207,31 +238,53 @@ MediaDevice *PipelineHandler::acquireMediaDevice(DeviceEnumerator *enumerator,
 }
 
 /**
- * \brief Lock all media devices acquired by the pipeline
+ * \brief Lock the pipeline handler for use by \a camera
+ * \param[in] camera The camera being acquired
+ *
+ * The media devices acquired by the pipeline are locked when the first camera
+ * is acquired, to prevent other processes from using them. The pipeline
+ * handler acquireDevice() function then decides if \a camera can be used
+ * concurrently with the cameras already in use.
  *
  * This function shall not be called from pipeline handler implementation, as
  * the Camera class handles locking directly.
  *
  * \context This function is \threadsafe.
  *
- * \return True if the devices could be locked, false otherwise
+ * \return True if the camera could be locked, false otherwise
  * \sa unlock()
  * \sa MediaDevice::lock()
  */
-bool PipelineHandler::lock()
+bool PipelineHandler::lock(Camera *camera)
 {
-	for (std::shared_ptr<MediaDevice> &media : mediaDevices_) {
-		if (!media->lock()) {
-			unlock();
-			return false;
+	MutexLocker locker(lock_);
+
+	if (useCount_ == 0) {
+		for (std::shared_ptr<MediaDevice> &media : mediaDevices_) {
+			if (!media->lock()) {
+				unlockMediaDevices();
+				return false;
+			}
 		}
 	}
 
+	if (!acquireDevice(camera)) {
+		if (useCount_ == 0)
+			unlockMediaDevices();
+
+		return false;
+	}
+
+	++useCount_;
+
 	return true;
 }
 
 /**
- * \brief Unlock all media devices acquired by the pipeline
+ * \brief Unlock the pipeline handler for \a camera
+ * \param[in] camera The camera being released
+ *
+ * The media devices are unlocked when the last camera in use is released.
  *
  * This function shall not be called from pipeline handler implementation, as
  * the Camera class handles locking directly.
@@ -240,7 +293,19 @@ bool PipelineHandler::lock()
  *
  * \sa lock()
  */
-void PipelineHandler::unlock()
+void PipelineHandler::unlock(Camera *camera)
+{
+	MutexLocker locker(lock_);
+
+	ASSERT(useCount_);
+
+	releaseDevice(camera);
+
+	if (--useCount_ == 0)
+		unlockMediaDevices();
+}
+
+void PipelineHandler::unlockMediaDevices()
 {
 	for (std::shared_ptr<MediaDevice> &media : mediaDevices_)
 		media->unlock();
@@ -323,10 +388,13 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
  * \brief Allocate and export buffers for \a stream
  * \param[in] camera The camera
  * \param[in] stream The stream to allocate buffers for
+ * \param[in] count The number of buffers to allocate
  * \param[out] buffers Array of buffers successfully allocated
  *
- * This function allocates buffers for the \a stream from the devices associated
- * with the stream in the corresponding pipeline handler. Those buffers shall be
+ * This function allocates \a count buffers for the \a stream from the devices
+ * associated with the stream in the corresponding pipeline handler. The number
+ * of buffers may be lower than the stream's bufferCount, when applications
+ * allocate buffers incrementally. Those buffers shall be
  * suitable to be added to a Request for the stream, and shall be mappable to
  * the CPU through their associated dmabufs with mmap().
  *
@@ -342,6 +410,50 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
  * otherwise
  */
 
+/**
+ * \brief Prepare a group of streams for capture
+ * \param[in] camera The camera to prepare
+ * \param[in] controls Controls to be applied before starting the Camera
+ *
+ * Acquire all the resources needed to capture from the group of streams that
+ * have been configured for capture by \a configure(), such as buffers and IPA
+ * modules, without starting streaming. This allows a subsequent call to
+ * start() to start streaming with minimal latency.
+ *
+ * The Camera class always calls prepare() before start(), either explicitly
+ * at the request of the application, or as part of Camera::start(). In the
+ * latter case the same \a controls are passed to both functions, and pipeline
+ * handlers shall ensure that applying them twice has no adverse effect.
+ *
+ * The default implementation does nothing. Pipeline handlers that don't
+ * override it perform all the work in start().
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::prepare([[maybe_unused]] Camera *camera,
+			     [[maybe_unused]] const ControlList *controls)
+{
+	return 0;
+}
+
+/**
+ * \brief Release the resources acquired by prepare()
+ * \param[in] camera The camera to unprepare
+ *
+ * This function is called when a prepared camera is stopped without having
+ * been started, or when start() fails. It shall release all the resources
+ * acquired by prepare().
+ *
+ * The default implementation does nothing.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::unprepare([[maybe_unused]] Camera *camera)
+{
+}
+
 /**
  * \fn PipelineHandler::start()
  * \brief Start capturing from a group of streams
@@ -351,7 +463,11 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
  * Start the group of streams that have been configured for capture by
  * \a configure(). The intended caller of this function is the Camera class
  * which will in turn be called from the application to indicate that it has
- * configured the streams and is ready to capture.
+ * configured the streams and is ready to capture. The camera has been
+ * prepared with prepare() when this function is called.
+ *
+ * If this function fails, it shall undo its own operations only. The Camera
+ * class then calls unprepare() to release the resources acquired by prepare().
  *
  * \context This function is called from the CameraManager thread.
  *
@@ -365,9 +481,78 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
  *
  * This function stops capturing and processing requests immediately. All
  * pending requests are cancelled and complete immediately in an error state.
+ * The resources acquired by prepare() shall be released as well.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+
+/**
+ * \brief Prepare an alternate configuration for a camera
+ * \param[in] camera The camera
+ * \param[in] config The alternate camera configuration, already validated
+ *
+ * This function prepares the resources needed to switch the \a camera to
+ * \a config with reconfigure(), without affecting the current configuration of
+ * the camera. Pipeline handlers that implement a fast reconfigure() shall
+ * override it to check that the \a config can be applied and to record the
+ * device formats it requires, such that reconfigure() only has to apply them.
+ * The prepared configurations shall be discarded by configure().
+ *
+ * The default implementation doesn't prepare anything, and reconfigure() then
+ * performs a full stop and restart of the pipeline.
  *
  * \context This function is called from the CameraManager thread.
+ *
+ * \return 0 on success or a negative error code otherwise
  */
+int PipelineHandler::prepareConfiguration([[maybe_unused]] Camera *camera,
+					  [[maybe_unused]] CameraConfiguration *config)
+{
+	return 0;
+}
+
+/**
+ * \brief Switch a running camera to a new configuration
+ * \param[in] camera The camera to reconfigure
+ * \param[in] config The new camera configuration, already validated
+ *
+ * This function applies a new configuration to a running camera. All pending
+ * requests are cancelled, the new configuration is applied, and the camera is
+ * restarted, ready to process requests with the new configuration.
+ *
+ * The default implementation stops the camera with stop(), configures it with
+ * configure() and restarts it with prepare() and start(). Pipeline handlers may
+ * override this function to implement a faster switch to configurations
+ * prepared with prepareConfiguration(), for instance by keeping the IPA module
+ * and the internal buffers that don't depend on the configuration, and only
+ * switching the formats of the video devices.
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return 0 on success or a negative error code otherwise. On error the camera
+ * is left stopped.
+ */
+int PipelineHandler::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	stop(camera);
+	cancelWaitingRequests(camera);
+
+	ASSERT(!hasPendingRequests(camera));
+
+	int ret = configure(camera, config);
+	if (ret)
+		return ret;
+
+	ret = prepare(camera, nullptr);
+	if (ret)
+		return ret;
+
+	ret = start(camera, nullptr);
+	if (ret)
+		unprepare(camera);
+
+	return ret;
+}
 
 /**
  * \brief Determine if the camera has any requests pending
@@ -381,7 +566,7 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
 bool PipelineHandler::hasPendingRequests(const Camera *camera) const
 {
 	const CameraData *data = cameraData(camera);
-	return !data->queuedRequests_.empty();
+	return !data->waitingRequests_.empty() || !data->queuedRequests_.empty();
 }
 
 /**
@@ -390,10 +575,17 @@ bool PipelineHandler::hasPendingRequests(const Camera *camera) const
  * \param[in] request The request to queue
  *
  * This function queues a capture request to the pipeline handler for
- * processing. The request is first added to the internal list of queued
- * requests, and then passed to the pipeline handler with a call to
- * queueRequestDevice(). If the pipeline handler fails in queuing the request
- * to the hardware the request is cancelled.
+ * processing. The request is first added to the internal list of waiting
+ * requests, until all the acquire fences of its buffers are signalled. It is
+ * then added to the internal list of queued requests, and passed to the
+ * pipeline handler with a call to queueRequestDevice(). Requests are passed to
+ * the pipeline handler in the order they have been queued, a request waiting
+ * for its fences delays all the requests queued after it. If the fences are not
+ * signalled in time, or if the pipeline handler fails in queuing the request to
+ * the hardware, the request is cancelled.
+ *
+ * Waiting for fences doesn't block the CameraManager thread, as it is handled
+ * through event notifiers.
  *
  * Keeping track of queued requests ensures automatic completion of all requests
  * when the pipeline handler is stopped with stop(). Request completion shall be
@@ -402,15 +594,77 @@ bool PipelineHandler::hasPendingRequests(const Camera *camera) const
  * \context This function is called from the CameraManager thread.
  */
 void PipelineHandler::queueRequest(Request *request)
+{
+	prepareRequest(request);
+}
+
+/**
+ * \fn PipelineHandler::queueRequests()
+ * \brief Queue multiple requests
+ * \param[in] requests The requests to queue
+ *
+ * This function queues all the \a requests in order, as if queueRequest() was
+ * called for each of them. It allows the Camera to hand a batch of requests to
+ * the pipeline handler with a single cross-thread call.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::queueRequests(const std::vector<Request *> &requests)
+{
+	for (Request *request : requests)
+		prepareRequest(request);
+}
+
+void PipelineHandler::prepareRequest(Request *request)
 {
 	LIBCAMERA_TRACEPOINT(request_queue, request);
 
+	request->queueTime_ = utils::clock::now();
+	request->deviceTime_ = {};
+
+	Camera *camera = request->camera_;
+	CameraData *data = cameraData(camera);
+	data->waitingRequests_.push(request);
+
+	/*
+	 * \todo Make the fence timeout configurable. It currently matches the
+	 * timeout used by the Android HAL.
+	 *
+	 * Don't wait for the fences past the request deadline, if any.
+	 */
+	std::chrono::milliseconds timeout(300);
+	if (request->deadline() != utils::time_point{}) {
+		auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+			request->deadline() - request->queueTime_);
+		timeout = std::clamp(remaining, std::chrono::milliseconds(0), timeout);
+	}
+
+	request->prepared.connect(this, &PipelineHandler::doQueueRequests);
+	request->prepare(timeout);
+}
+
+void PipelineHandler::doQueueRequest(Request *request)
+{
 	Camera *camera = request->camera_;
 	CameraData *data = cameraData(camera);
 	data->queuedRequests_.push_back(request);
 
 	request->sequence_ = data->requestSequence_++;
 
+	/* Requests whose fences have timed out are cancelled. */
+	if (request->cancelled_) {
+		request->cancel();
+		completeRequest(request);
+		return;
+	}
+
+	if (cancelExpiredRequest(request))
+		return;
+
+	request->deviceTime_ = utils::clock::now();
+	camera->recordLatency(RequestLatencyStats::QueueToDevice,
+			      request->deviceTime_ - request->queueTime_);
+
 	int ret = queueRequestDevice(camera, request);
 	if (ret) {
 		request->cancel();
@@ -418,6 +672,48 @@ void PipelineHandler::queueRequest(Request *request)
 	}
 }
 
+void PipelineHandler::doQueueRequests(Request *request)
+{
+	request->prepared.disconnect(this);
+
+	CameraData *data = cameraData(request->camera_);
+
+	while (!data->waitingRequests_.empty()) {
+		Request *req = data->waitingRequests_.front();
+		if (!req->prepared_)
+			break;
+
+		data->waitingRequests_.pop();
+		doQueueRequest(req);
+	}
+}
+
+/**
+ * \brief Cancel the requests waiting for their fences
+ * \param[in] camera The camera
+ *
+ * This function cancels and completes all the requests of the \a camera that
+ * are still waiting for their acquire fences to be signalled. The fences that
+ * haven't been signalled are kept in the buffers. It is called when stopping
+ * the camera, after the pipeline handler has been stopped with stop().
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::cancelWaitingRequests(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	while (!data->waitingRequests_.empty()) {
+		Request *request = data->waitingRequests_.front();
+		data->waitingRequests_.pop();
+
+		request->prepared.disconnect(this);
+		request->cancelPrepare();
+
+		doQueueRequest(request);
+	}
+}
+
 /**
  * \fn PipelineHandler::queueRequestDevice()
  * \brief Queue a request to the device
@@ -447,6 +743,9 @@ void PipelineHandler::queueRequest(Request *request)
  * pipeline handlers a chance to perform any operation that may still be
  * needed. They shall complete requests explicitly with completeRequest().
  *
+ * The completion of the buffer is recorded in the statistics of its stream,
+ * as reported by Camera::streamStats().
+ *
  * \context This function shall be called from the CameraManager thread.
  *
  * \return True if all buffers contained in the request have completed, false
@@ -455,10 +754,47 @@ void PipelineHandler::queueRequest(Request *request)
 bool PipelineHandler::completeBuffer(Request *request, FrameBuffer *buffer)
 {
 	Camera *camera = request->camera_;
+
+	if (request->deviceTime_ != utils::time_point{})
+		camera->recordLatency(RequestLatencyStats::DeviceToBuffer,
+				      utils::clock::now() - request->deviceTime_);
+
+	for (const auto &[stream, buf] : request->buffers()) {
+		if (buf == buffer) {
+			camera->recordBuffer(stream, buffer);
+			break;
+		}
+	}
+
 	camera->bufferCompleted.emit(request, buffer);
 	return request->completeBuffer(buffer);
 }
 
+/**
+ * \brief Signal the availability of part of the metadata of a request
+ * \param[in] request The request the metadata belongs to
+ * \param[in] metadata The metadata that has become available
+ *
+ * This function shall be called by pipeline handlers to report \a metadata for
+ * the \a request before the request completes. The \a metadata is merged in
+ * the request metadata list, and reported to applications through the
+ * Camera::metadataAvailable signal. Pipeline handlers should report metadata as
+ * soon as it is known, and shall report each control once only.
+ *
+ * \context This function shall be called from the CameraManager thread.
+ */
+void PipelineHandler::completeMetadata(Request *request,
+				       const ControlList &metadata)
+{
+	if (metadata.empty())
+		return;
+
+	request->metadata().merge(metadata);
+
+	Camera *camera = request->camera_;
+	camera->metadataAvailable.emit(request, metadata);
+}
+
 /**
  * \brief Signal request completion
  * \param[in] request The request that has completed
@@ -469,7 +805,9 @@ bool PipelineHandler::completeBuffer(Request *request, FrameBuffer *buffer)
  *
  * This function ensures that requests will be returned to the application in
  * submission order, the pipeline handler may call it on any complete request
- * without any ordering constraint.
+ * without any ordering constraint. If the application has selected out of
+ * order completion with Camera::setCompletionOrder(), the request is instead
+ * returned to the application immediately.
  *
  * \context This function shall be called from the CameraManager thread.
  */
@@ -481,6 +819,17 @@ void PipelineHandler::completeRequest(Request *request)
 
 	CameraData *data = cameraData(camera);
 
+	if (data->outOfOrderCompletion_) {
+		auto it = std::find(data->queuedRequests_.begin(),
+				    data->queuedRequests_.end(), request);
+		ASSERT(it != data->queuedRequests_.end());
+
+		data->queuedRequests_.erase(it);
+		recordCompletion(camera, request);
+		camera->requestComplete(request);
+		return;
+	}
+
 	while (!data->queuedRequests_.empty()) {
 		Request *req = data->queuedRequests_.front();
 		if (req->status() == Request::RequestPending)
@@ -488,10 +837,81 @@ void PipelineHandler::completeRequest(Request *request)
 
 		ASSERT(!req->hasPendingBuffers());
 		data->queuedRequests_.pop_front();
+		recordCompletion(camera, req);
 		camera->requestComplete(req);
 	}
 }
 
+/**
+ * \brief Cancel a request if its deadline has passed
+ * \param[in] request The request
+ *
+ * This function checks if the deadline of the \a request, set by the
+ * application with Request::setDeadline(), has passed. If so, the request is
+ * cancelled and completed, returning its buffers to the application.
+ *
+ * The PipelineHandler base class checks the deadline before calling
+ * queueRequestDevice(). Pipeline handlers that queue requests internally
+ * before submitting them to the hardware should call this function before
+ * submission, in order to skip stale requests under overload.
+ *
+ * \context This function shall be called from the CameraManager thread.
+ *
+ * \return True if the request has been cancelled, false otherwise
+ */
+bool PipelineHandler::cancelExpiredRequest(Request *request)
+{
+	if (!request->expired())
+		return false;
+
+	LOG(Pipeline, Debug)
+		<< "Request " << request->cookie() << " missed its deadline";
+
+	request->cancel();
+	completeRequest(request);
+
+	return true;
+}
+
+/**
+ * \brief Record a latency measurement for a request
+ * \param[in] request The request the measurement relates to
+ * \param[in] stage The request processing stage
+ * \param[in] latency The measured latency
+ *
+ * Most of the request processing stages are measured by the PipelineHandler
+ * base class. Pipeline handlers shall call this function to report the
+ * latencies of stages specific to their implementation, such as
+ * RequestLatencyStats::IpaProcessing.
+ */
+void PipelineHandler::recordLatency(Request *request,
+				    RequestLatencyStats::Stage stage,
+				    std::chrono::nanoseconds latency)
+{
+	request->camera_->recordLatency(stage, latency);
+}
+
+void PipelineHandler::recordCompletion(Camera *camera, Request *request)
+{
+	if (request->deviceTime_ == utils::time_point{})
+		return;
+
+	camera->recordLatency(RequestLatencyStats::Completion,
+			      utils::clock::now() - request->deviceTime_);
+}
+
+/**
+ * \brief Set the order in which requests complete for a camera
+ * \param[in] camera The camera
+ * \param[in] enable True to complete requests out of order
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::setOutOfOrderCompletion(Camera *camera, bool enable)
+{
+	cameraData(camera)->outOfOrderCompletion_ = enable;
+}
+
 /**
  * \brief Register a camera to the camera manager and pipeline handler
  * \param[in] camera The camera to be added
@@ -510,6 +930,8 @@ void PipelineHandler::registerCamera(std::shared_ptr<Camera> camera,
 	cameraData_[camera.get()] = std::move(data);
 	cameras_.push_back(camera);
 
+	camera->_d()->updateSupportedControls();
+
 	if (mediaDevices_.empty())
 		LOG(Pipeline, Fatal)
 			<< "Registering camera with no media devices!";
@@ -601,6 +1023,35 @@ void PipelineHandler::disconnect()
 	}
 }
 
+/**
+ * \brief Acquire resources associated with a camera
+ * \param[in] camera The camera being acquired
+ *
+ * Pipeline handlers may override this function to allocate the hardware
+ * resources needed by \a camera, and to decide whether it can operate
+ * concurrently with the cameras already in use. The function is called with
+ * the pipeline handler lock held, after the media devices have been locked.
+ *
+ * The default implementation allows a single camera to be used at a time.
+ *
+ * \return True if \a camera can be used, false otherwise
+ */
+bool PipelineHandler::acquireDevice([[maybe_unused]] Camera *camera)
+{
+	return useCount_ == 0;
+}
+
+/**
+ * \brief Release resources associated with a camera
+ * \param[in] camera The camera being released
+ *
+ * Pipeline handlers may override this function to release the resources
+ * allocated by acquireDevice(). The default implementation does nothing.
+ */
+void PipelineHandler::releaseDevice([[maybe_unused]] Camera *camera)
+{
+}
+
 /**
  * \brief Retrieve the pipeline-specific data associated with a Camera
  * \param[in] camera The camera whose data to retrieve
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * queue_status.cpp - Request queue health of a camera
+ */
+
+#include <libcamera/queue_status.h>
+
+#include <algorithm>
+
+/**
+ * \file queue_status.h
+ * \brief Request queue health of a camera
+ */
+
+namespace libcamera {
+
+/**
+ * \class QueueStatus
+ * \brief Health of the request queue of a camera
+ *
+ * Applications control the latency of a camera through the number of requests
+ * they keep queued. Queuing too few requests starves the pipeline, and the
+ * frames captured while no request is available are dropped. Queuing too many
+ * requests doesn't drop frames, but the requests wait in the pipeline handler
+ * queues, which increases the latency without any other benefit.
+ *
+ * The QueueStatus reports the number of requests queued to the camera and not
+ * completed yet, the number of times the pipeline ran out of requests while
+ * the camera was running, and the request depth recommended to avoid
+ * starvation with the lowest latency. Applications can compare queued() with
+ * recommendedDepth() to throttle the rate at which they queue requests, and
+ * increase their depth when starvations() grows.
+ *
+ * The recommended depth is computed from the time the pipeline takes to
+ * process a frame, from its capture by the sensor to the completion of the
+ * request, and the frame interval. The number of requests processed
+ * concurrently is the processing time divided by the frame interval, rounded
+ * up, and one more request is needed for the pipeline to capture the next
+ * frame. The depth is increased by one every time the pipeline starves after
+ * the application has queued at least the recommended number of requests, to
+ * account for the time the application takes to queue requests back.
+ *
+ * The queue status of a camera is retrieved with Camera::queueStatus(), and
+ * its changes are signalled by Camera::queueStatusChanged.
+ */
+
+QueueStatus::QueueStatus()
+	: queued_(0), peak_(0)
+{
+	reset();
+}
+
+/**
+ * \brief Record a request queued by the application
+ */
+void QueueStatus::requestQueued()
+{
+	queued_++;
+	peak_ = std::max(peak_, queued_);
+}
+
+/**
+ * \brief Record the completion of a request
+ * \param[in] starved True if the pipeline has no more request to process
+ *
+ * \return True if the completion is a starvation event, false otherwise
+ */
+bool QueueStatus::requestCompleted(bool starved)
+{
+	if (queued_)
+		queued_--;
+
+	if (!starved)
+		return false;
+
+	starvations_++;
+
+	/*
+	 * The peak depth is tracked between starvation events, if it reached
+	 * the recommended depth the application isn't to blame.
+	 */
+	if (depth_ && peak_ >= recommendedDepth())
+		margin_++;
+	peak_ = queued_;
+
+	return true;
+}
+
+/**
+ * \brief Update the recommended depth from pipeline timings
+ * \param[in] processing The mean time from frame capture to request completion
+ * \param[in] interval The frame interval
+ *
+ * Update the recommended depth from the \a processing time of the pipeline and
+ * the frame \a interval. Null intervals are ignored.
+ *
+ * \return True if the recommended depth has changed, false otherwise
+ */
+bool QueueStatus::updateDepth(std::chrono::nanoseconds processing,
+			      std::chrono::nanoseconds interval)
+{
+	if (interval.count() <= 0)
+		return false;
+
+	unsigned int depth = (processing.count() + interval.count() - 1)
+			   / interval.count() + 1;
+	depth = std::max(depth, 2U);
+
+	if (depth == depth_)
+		return false;
+
+	depth_ = depth;
+	return true;
+}
+
+/**
+ * \brief Reset the starvation count and the recommended depth
+ *
+ * The number of queued requests isn't affected.
+ */
+void QueueStatus::reset()
+{
+	starvations_ = 0;
+	depth_ = 0;
+	margin_ = 0;
+}
+
+/**
+ * \fn QueueStatus::queued()
+ * \brief Retrieve the number of requests queued to the camera
+ * \return The number of requests queued by the application and not completed
+ */
+
+/**
+ * \fn QueueStatus::starvations()
+ * \brief Retrieve the number of starvation events
+ *
+ * A starvation event occurs when a request completes while the camera is
+ * running and no other request is queued to the pipeline handler.
+ *
+ * \return The number of starvation events since the camera has been started
+ */
+
+/**
+ * \brief Retrieve the recommended request depth
+ * \return The number of requests the application should keep queued, or 0 if
+ * no frame has been captured yet
+ */
+unsigned int QueueStatus::recommendedDepth() const
+{
+	if (!depth_)
+		return 0;
+
+	return depth_ + margin_;
+}
+
+} /* namespace libcamera */
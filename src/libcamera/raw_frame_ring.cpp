@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * raw_frame_ring.cpp - Ring of recently captured RAW frames
+ */
+
+#include "libcamera/internal/raw_frame_ring.h"
+
+#include <iterator>
+#include <stdlib.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/request.h>
+
+/**
+ * \file raw_frame_ring.h
+ * \brief Ring of recently captured RAW frames for zero shutter lag capture
+ */
+
+namespace libcamera {
+
+/**
+ * \class RawFrameRing
+ * \brief Keep the most recent RAW frames captured by a pipeline handler
+ *
+ * Requests queued to a camera are usually served with frames captured after
+ * the request has been queued, which introduces a shutter lag of at least one
+ * frame, and often more, for still captures. Pipeline handlers that support
+ * zero shutter lag operation keep their RAW capture device streaming in the
+ * absence of requests, and store the most recent frames, along with their
+ * metadata, in a RawFrameRing. Requests that contain the
+ * controls::ZeroShutterLagTimestamp control are then served by a frame taken
+ * from the ring, selected by its timestamp.
+ *
+ * The ring has a fixed capacity. Pushing a frame to a full ring evicts the
+ * oldest frame, whose buffer is returned to the caller to be requeued to the
+ * capture device. Frames are identified by the controls::SensorTimestamp value
+ * stored in their metadata.
+ *
+ * The ring doesn't own the buffers it stores, and is not thread-safe.
+ */
+
+/**
+ * \struct RawFrameRing::Frame
+ * \brief A RAW frame stored in the ring
+ *
+ * \var RawFrameRing::Frame::buffer
+ * \brief The buffer containing the frame
+ *
+ * \var RawFrameRing::Frame::metadata
+ * \brief The frame metadata, including at least controls::SensorTimestamp
+ */
+
+/**
+ * \brief Construct an empty RawFrameRing with zero capacity
+ *
+ * A ring with zero capacity doesn't store any frame, which disables zero
+ * shutter lag operation.
+ */
+RawFrameRing::RawFrameRing()
+	: capacity_(0)
+{
+}
+
+/**
+ * \brief Empty the ring and set its capacity
+ * \param[in] capacity The maximum number of frames stored in the ring
+ *
+ * The buffers of the frames stored in the ring are dropped. Pipeline handlers
+ * shall call this function when the capture device is stopped, or use clear()
+ * to retrieve the buffers.
+ */
+void RawFrameRing::reset(unsigned int capacity)
+{
+	capacity_ = capacity;
+	frames_.clear();
+}
+
+/**
+ * \brief Empty the ring
+ * \return The buffers of the frames that were stored in the ring, oldest first
+ */
+std::vector<FrameBuffer *> RawFrameRing::clear()
+{
+	std::vector<FrameBuffer *> buffers;
+	buffers.reserve(frames_.size());
+
+	for (const Frame &frame : frames_)
+		buffers.push_back(frame.buffer);
+
+	frames_.clear();
+
+	return buffers;
+}
+
+/**
+ * \fn RawFrameRing::capacity()
+ * \brief Retrieve the maximum number of frames stored in the ring
+ * \return The ring capacity
+ */
+
+/**
+ * \fn RawFrameRing::size()
+ * \brief Retrieve the number of frames stored in the ring
+ * \return The number of frames stored in the ring
+ */
+
+/**
+ * \fn RawFrameRing::empty()
+ * \brief Check if the ring is empty
+ * \return True if the ring doesn't contain any frame, false otherwise
+ */
+
+/**
+ * \brief Store a captured frame in the ring
+ * \param[in] buffer The buffer containing the frame
+ * \param[in] metadata The frame metadata
+ *
+ * Frames shall be pushed in capture order. If the ring is full, the oldest
+ * frame is evicted. If the ring has zero capacity, \a buffer is returned
+ * immediately.
+ *
+ * \return The buffer of the evicted frame, to be requeued to the capture
+ * device, or nullptr if no frame has been evicted
+ */
+FrameBuffer *RawFrameRing::push(FrameBuffer *buffer, ControlList metadata)
+{
+	if (!capacity_)
+		return buffer;
+
+	FrameBuffer *evicted = nullptr;
+
+	if (frames_.size() >= capacity_) {
+		evicted = frames_.front().buffer;
+		frames_.pop_front();
+	}
+
+	frames_.push_back({ buffer, std::move(metadata) });
+
+	return evicted;
+}
+
+/**
+ * \brief Take a frame out of the ring
+ * \param[in] timestamp The timestamp of the frame to take, in nanoseconds
+ *
+ * Select the frame whose timestamp is the closest to \a timestamp and remove
+ * it from the ring. A \a timestamp of 0 selects the most recent frame. The
+ * other frames are kept in the ring, to be selected by later requests.
+ *
+ * \return The selected frame, or std::nullopt if the ring is empty
+ */
+std::optional<RawFrameRing::Frame> RawFrameRing::take(int64_t timestamp)
+{
+	if (frames_.empty())
+		return std::nullopt;
+
+	auto best = std::prev(frames_.end());
+
+	if (timestamp > 0) {
+		int64_t bestDelta = INT64_MAX;
+
+		for (auto it = frames_.begin(); it != frames_.end(); ++it) {
+			int64_t delta = std::abs(frameTimestamp(*it) - timestamp);
+			if (delta < bestDelta) {
+				bestDelta = delta;
+				best = it;
+			}
+		}
+	}
+
+	Frame frame = std::move(*best);
+	frames_.erase(best);
+
+	return frame;
+}
+
+/**
+ * \brief Check if a request asks for a zero shutter lag capture
+ * \param[in] request The request
+ * \return True if \a request contains the controls::ZeroShutterLagTimestamp
+ * control, false otherwise
+ */
+bool RawFrameRing::requested(Request *request)
+{
+	return request->controls().contains(controls::ZeroShutterLagTimestamp);
+}
+
+/**
+ * \brief Retrieve the timestamp of the frame requested by a request
+ * \param[in] request The request
+ * \return The value of the controls::ZeroShutterLagTimestamp control in
+ * \a request, or 0 if the control isn't present
+ */
+int64_t RawFrameRing::requestedTimestamp(Request *request)
+{
+	return request->controls().get(controls::ZeroShutterLagTimestamp);
+}
+
+int64_t RawFrameRing::frameTimestamp(const Frame &frame)
+{
+	return frame.metadata.get(controls::SensorTimestamp);
+}
+
+} /* namespace libcamera */
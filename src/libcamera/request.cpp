@@ -7,13 +7,17 @@
 
 #include <libcamera/request.h>
 
+#include <algorithm>
 #include <map>
 #include <sstream>
 
+#include <libcamera/base/event_notifier.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/timer.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
+#include <libcamera/fence.h>
 #include <libcamera/framebuffer.h>
 #include <libcamera/stream.h>
 
@@ -75,7 +79,7 @@ LOG_DEFINE_CATEGORY(Request)
  */
 Request::Request(Camera *camera, uint64_t cookie)
 	: camera_(camera), sequence_(0), cookie_(cookie),
-	  status_(RequestPending), cancelled_(false)
+	  status_(RequestPending), cancelled_(false), prepared_(false)
 {
 	/**
 	 * \todo Should the Camera expose a validator instance, to avoid
@@ -87,7 +91,7 @@ Request::Request(Camera *camera, uint64_t cookie)
 	/**
 	 * \todo: Add a validator for metadata controls.
 	 */
-	metadata_ = new ControlList(controls::controls);
+	metadata_ = std::make_shared<ControlList>(controls::controls);
 
 	LIBCAMERA_TRACEPOINT(request_construct, this);
 
@@ -98,7 +102,6 @@ Request::~Request()
 {
 	LIBCAMERA_TRACEPOINT(request_destroy, this);
 
-	delete metadata_;
 	delete controls_;
 	delete validator_;
 }
@@ -112,28 +115,53 @@ Request::~Request()
  * prior to queueing the request to the camera, in lieu of constructing a new
  * request. The application can reuse the buffers that were previously added
  * to the request via addBuffer() by setting \a flags to ReuseBuffers.
+ *
+ * The memory used to track the request buffers is retained across reuse, so
+ * that subsequent calls to addBuffer() don't allocate memory as long as the
+ * request isn't given more buffers than it had previously. Recycling requests
+ * is thus preferred to creating new requests for each frame, see RequestPool.
+ *
+ * Acquire fences still associated with the request buffers are destroyed.
  */
 void Request::reuse(ReuseFlag flags)
 {
 	LIBCAMERA_TRACEPOINT(request_reuse, this);
 
+	clearFences();
+
 	pending_.clear();
 	if (flags & ReuseBuffers) {
 		for (auto pair : bufferMap_) {
 			FrameBuffer *buffer = pair.second;
 			buffer->_d()->setRequest(this);
-			pending_.insert(buffer);
+			pending_.push_back(buffer);
 		}
 	} else {
-		bufferMap_.clear();
+		/*
+		 * Keep the map nodes aside to reuse them in addBuffer(), in
+		 * order to avoid memory allocations when the request is
+		 * recycled.
+		 */
+		while (!bufferMap_.empty())
+			freeNodes_.push_back(bufferMap_.extract(bufferMap_.begin()));
 	}
 
+	deadline_ = {};
 	sequence_ = 0;
 	status_ = RequestPending;
 	cancelled_ = false;
+	prepared_ = false;
 
 	controls_->clear();
-	metadata_->clear();
+
+	/*
+	 * Detach from the metadata if it is still referenced through
+	 * sharedMetadata(), as it must not be modified anymore.
+	 */
+	if (metadata_.use_count() > 1)
+		metadata_ = std::make_shared<ControlList>(controls::controls);
+	else
+		metadata_->clear();
 }
 
 /**
@@ -166,19 +194,31 @@ void Request::reuse(ReuseFlag flags)
  * \brief Add a FrameBuffer with its associated Stream to the Request
  * \param[in] stream The stream the buffer belongs to
  * \param[in] buffer The FrameBuffer to add to the request
+ * \param[in] fence The optional acquire fence guarding the buffer
  *
  * A reference to the buffer is stored in the request. The caller is responsible
  * for ensuring that the buffer will remain valid until the request complete
  * callback is called.
  *
+ * If the buffer can't be written to immediately, for instance because another
+ * device still accesses it, an acquire \a fence can be passed along with the
+ * buffer. When the request is queued, libcamera waits for all the fences of the
+ * request to be signalled before queueing the request to the device, without
+ * blocking the caller. Fences that are signalled are destroyed. If a fence
+ * isn't signalled within a timeout, the request is cancelled, and the fences
+ * that haven't been signalled can be retrieved with
+ * FrameBuffer::releaseFence().
+ *
  * A request can only contain one buffer per stream. If a buffer has already
  * been added to the request for the same stream, this function returns -EEXIST.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -EEXIST The request already contains a buffer for the stream
- * \retval -EINVAL The buffer does not reference a valid Stream
+ * \retval -EINVAL The buffer does not reference a valid Stream, or the fence
+ * is invalid
  */
-int Request::addBuffer(const Stream *stream, FrameBuffer *buffer)
+int Request::addBuffer(const Stream *stream, FrameBuffer *buffer,
+		       std::unique_ptr<Fence> fence)
 {
 	if (!stream) {
 		LOG(Request, Error) << "Invalid stream reference";
@@ -191,9 +231,25 @@ int Request::addBuffer(const Stream *stream, FrameBuffer *buffer)
 		return -EEXIST;
 	}
 
+	if (fence && !fence->isValid()) {
+		LOG(Request, Error) << "Invalid fence";
+		return -EINVAL;
+	}
+
+	buffer->_d()->setFence(std::move(fence));
 	buffer->_d()->setRequest(this);
-	pending_.insert(buffer);
-	bufferMap_[stream] = buffer;
+	pending_.push_back(buffer);
+
+	if (!freeNodes_.empty()) {
+		BufferMap::node_type node = std::move(freeNodes_.back());
+		freeNodes_.pop_back();
+
+		node.key() = stream;
+		node.mapped() = buffer;
+		bufferMap_.insert(std::move(node));
+	} else {
+		bufferMap_[stream] = buffer;
+	}
 
 	return 0;
 }
@@ -230,6 +286,63 @@ FrameBuffer *Request::findBuffer(const Stream *stream) const
  * \return The metadata associated with the request
  */
 
+/**
+ * \fn Request::sharedMetadata()
+ * \brief Retrieve a shared reference to the request's metadata
+ *
+ * Applications often need to keep the metadata of a completed request around
+ * after recycling the request, or to pass it to multiple consumers. This
+ * function returns a reference-counted pointer to the request metadata, which
+ * can be retained and shared without copying the metadata.
+ *
+ * The metadata is immutable once the request has completed, and this function
+ * shall thus only be called after request completion. When the request is
+ * reused, it detaches from the metadata if it is still referenced, and the
+ * shared metadata stays valid and unmodified until the last reference to it
+ * is dropped.
+ *
+ * \return A shared pointer to the metadata associated with the request
+ */
+
+/**
+ * \fn Request::setDeadline()
+ * \brief Set the deadline for processing the request
+ * \param[in] deadline The time after which the request isn't useful anymore
+ *
+ * Applications that consume frames in real time are often not interested in
+ * frames captured too late, for instance when the camera is overloaded and
+ * requests accumulate. Setting a deadline on a request allows the pipeline
+ * handler to skip the request if it hasn't been queued to the device by the
+ * \a deadline. Skipped requests are cancelled and complete immediately with
+ * the RequestCancelled status, returning their buffers to the application
+ * without capturing frames.
+ *
+ * Requests that have been queued to the device before their deadline are
+ * processed normally, even if they complete after the deadline.
+ *
+ * A default-constructed time point disables the deadline, which is the
+ * default. The deadline is reset by reuse().
+ */
+
+/**
+ * \fn Request::deadline()
+ * \brief Retrieve the deadline for processing the request
+ * \return The request deadline, or a default-constructed time point if the
+ * request has no deadline
+ */
+
+/**
+ * \brief Check if the request deadline has passed
+ * \return True if the request has a deadline and it has passed, false otherwise
+ */
+bool Request::expired() const
+{
+	if (deadline_ == std::chrono::steady_clock::time_point{})
+		return false;
+
+	return std::chrono::steady_clock::now() > deadline_;
+}
+
 /**
  * \fn Request::sequence()
  * \brief Retrieve the sequence number for the request
@@ -240,7 +353,8 @@ FrameBuffer *Request::findBuffer(const Stream *stream) const
  * between camera stop/start sequences.
  *
  * It can be used to support debugging and identifying the flow of requests
- * through a pipeline, but does not guarantee to represent the sequence number
+ * through a pipeline, or to reorder requests completed out of order (see
+ * Camera::setCompletionOrder()), but does not guarantee to represent the sequence number
  * of any images in the stream. The sequence number is stored as an unsigned
  * integer and will wrap when overflowed.
  *
@@ -333,8 +447,9 @@ bool Request::completeBuffer(FrameBuffer *buffer)
 {
 	LIBCAMERA_TRACEPOINT(request_complete_buffer, this, buffer);
 
-	int ret = pending_.erase(buffer);
-	ASSERT(ret == 1);
+	auto it = std::find(pending_.begin(), pending_.end(), buffer);
+	ASSERT(it != pending_.end());
+	pending_.erase(it);
 
 	buffer->_d()->setRequest(nullptr);
 
@@ -344,6 +459,109 @@ bool Request::completeBuffer(FrameBuffer *buffer)
 	return !hasPendingBuffers();
 }
 
+/**
+ * \var Request::prepared
+ * \brief Signal emitted when the request is ready to be queued to the device
+ *
+ * The signal is emitted by prepare() once all the acquire fences of the
+ * request have been signalled, or when waiting for the fences has timed out.
+ * In the latter case the request is marked as cancelled.
+ */
+
+/**
+ * \brief Prepare the request to be queued to the device
+ * \param[in] timeout The maximum time to wait for the fences
+ *
+ * Wait for all the acquire fences associated with the request buffers to be
+ * signalled, and emit the prepared signal. The wait is asynchronous, through
+ * event notifiers running in the event loop of the calling thread. If the
+ * request has no fence, the prepared signal is emitted synchronously.
+ *
+ * If the fences are not all signalled within \a timeout, the request is marked
+ * as cancelled before emitting the prepared signal.
+ */
+void Request::prepare(std::chrono::milliseconds timeout)
+{
+	for (FrameBuffer *buffer : pending_) {
+		const Fence *fence = buffer->_d()->fence();
+		if (!fence)
+			continue;
+
+		std::unique_ptr<EventNotifier> notifier =
+			std::make_unique<EventNotifier>(fence->fd().fd(),
+							EventNotifier::Read);
+		notifier->activated.connect(this, &Request::notifierActivated);
+		notifiers_[buffer] = std::move(notifier);
+	}
+
+	if (notifiers_.empty()) {
+		prepared_ = true;
+		prepared.emit(this);
+		return;
+	}
+
+	timer_ = std::make_unique<Timer>();
+	timer_->timeout.connect(this, &Request::timeout);
+	timer_->start(timeout);
+}
+
+void Request::notifierActivated(EventNotifier *notifier)
+{
+	for (auto it = notifiers_.begin(); it != notifiers_.end(); ++it) {
+		if (it->second.get() != notifier)
+			continue;
+
+		/* The fence has been signalled, it can be destroyed. */
+		it->first->_d()->setFence(nullptr);
+		notifiers_.erase(it);
+		break;
+	}
+
+	if (!notifiers_.empty())
+		return;
+
+	timer_.reset();
+
+	prepared_ = true;
+	prepared.emit(this);
+}
+
+void Request::timeout([[maybe_unused]] Timer *timer)
+{
+	LOG(Request, Debug) << "Request prepare timeout: " << cookie_;
+
+	cancelPrepare();
+	prepared.emit(this);
+}
+
+/**
+ * \brief Stop waiting for the fences and mark the request as cancelled
+ *
+ * The fences that haven't been signalled are kept attached to their buffers,
+ * for applications to retrieve them with FrameBuffer::releaseFence().
+ */
+void Request::cancelPrepare()
+{
+	notifiers_.clear();
+	if (timer_)
+		timer_->stop();
+
+	cancelled_ = true;
+	prepared_ = true;
+}
+
+/**
+ * \brief Stop waiting for the fences and destroy the fences of all buffers
+ */
+void Request::clearFences()
+{
+	notifiers_.clear();
+	timer_.reset();
+
+	for (auto pair : bufferMap_)
+		pair.second->_d()->setFence(nullptr);
+}
+
 /**
  * \brief Generate a string representation of the Request internals
  *
@@ -0,0 +1,214 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * request_pool.cpp - Pool of reusable capture requests
+ */
+
+#include <libcamera/request_pool.h>
+
+#include <errno.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/camera.h>
+
+/**
+ * \file request_pool.h
+ * \brief Pool of reusable capture requests
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Request)
+
+class RequestPool::Private : public Extensible::Private
+{
+	LIBCAMERA_DECLARE_PUBLIC(RequestPool)
+
+public:
+	Private(std::shared_ptr<Camera> camera);
+
+	std::shared_ptr<Camera> camera_;
+
+	mutable std::mutex mutex_;
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::map<const Request *, bool> lent_;
+	std::vector<Request *> free_;
+};
+
+RequestPool::Private::Private(std::shared_ptr<Camera> camera)
+	: camera_(camera)
+{
+}
+
+/**
+ * \class RequestPool
+ * \brief A pool of requests recycled for the lifetime of a capture session
+ *
+ * Creating and destroying a Request for every frame allocates and frees memory
+ * in the hot path of the application. Requests are instead meant to be created
+ * once and recycled with Request::reuse(), which retains the memory used by
+ * the request internal containers. The RequestPool implements this pattern.
+ *
+ * Requests are created with allocate() when the camera is configured, and
+ * are owned by the pool. A request is acquired from the pool with acquire(),
+ * filled and queued to the camera, and returned to the pool with release()
+ * once it has completed. Releasing a request resets it for reuse, optionally
+ * keeping its buffers. A request is lent to a single user at a time.
+ *
+ * The RequestPool is thread-safe. Requests can thus be released from the
+ * Camera::requestCompleted signal handler, and acquired from any other
+ * application thread.
+ */
+
+/**
+ * \brief Construct a RequestPool for the requests of \a camera
+ * \param[in] camera The camera the requests are created for
+ */
+RequestPool::RequestPool(std::shared_ptr<Camera> camera)
+	: Extensible(new Private(camera))
+{
+}
+
+RequestPool::~RequestPool()
+{
+	const Private *const d = _d();
+
+	if (d->free_.size() != d->requests_.size())
+		LOG(Request, Warning)
+			<< "Destroying pool with "
+			<< d->requests_.size() - d->free_.size()
+			<< " requests still lent";
+}
+
+/**
+ * \brief Create requests in the pool
+ * \param[in] count The number of requests to create
+ *
+ * Create \a count requests with Camera::createRequest() and add them to the
+ * pool. The requests are created with a cookie equal to their index in the
+ * pool, starting at 0 for the first request ever allocated. This function may
+ * be called multiple times to grow the pool.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EACCES The camera is not in a state where requests can be created
+ */
+int RequestPool::allocate(unsigned int count)
+{
+	Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	std::vector<std::unique_ptr<Request>> requests;
+	requests.reserve(count);
+
+	for (unsigned int i = 0; i < count; i++) {
+		std::unique_ptr<Request> request =
+			d->camera_->createRequest(d->requests_.size() + i);
+		if (!request) {
+			LOG(Request, Error) << "Failed to create requests";
+			return -EACCES;
+		}
+
+		requests.push_back(std::move(request));
+	}
+
+	d->free_.reserve(d->requests_.size() + count);
+
+	/* Store the new requests in reverse order to lend them in order. */
+	std::vector<Request *> free;
+	for (auto it = requests.rbegin(); it != requests.rend(); ++it) {
+		d->lent_[it->get()] = false;
+		free.push_back(it->get());
+	}
+
+	d->free_.insert(d->free_.begin(), free.begin(), free.end());
+
+	for (std::unique_ptr<Request> &request : requests)
+		d->requests_.push_back(std::move(request));
+
+	return 0;
+}
+
+/**
+ * \brief Acquire a free request from the pool
+ *
+ * Requests are lent in the reverse order of their release.
+ *
+ * \return A free request ready to be filled, or nullptr if all requests are
+ * lent
+ */
+Request *RequestPool::acquire()
+{
+	Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	if (d->free_.empty())
+		return nullptr;
+
+	Request *request = d->free_.back();
+	d->free_.pop_back();
+	d->lent_[request] = true;
+
+	return request;
+}
+
+/**
+ * \brief Return a request to the pool
+ * \param[in] request The request to return
+ * \param[in] flags Indicate whether or not to keep the request buffers
+ *
+ * The \a request is reset with Request::reuse(), passing \a flags to control
+ * whether the buffers are kept for the next user of the request. The request
+ * shall not be queued to the camera when it is released.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a request doesn't belong to the pool or isn't lent
+ */
+int RequestPool::release(Request *request, Request::ReuseFlag flags)
+{
+	Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	auto it = d->lent_.find(request);
+	if (it == d->lent_.end() || !it->second) {
+		LOG(Request, Error) << "Request not lent by the pool";
+		return -EINVAL;
+	}
+
+	request->reuse(flags);
+
+	it->second = false;
+	d->free_.push_back(request);
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the number of requests in the pool
+ * \return The total number of requests, free or lent
+ */
+unsigned int RequestPool::size() const
+{
+	const Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	return d->requests_.size();
+}
+
+/**
+ * \brief Retrieve the number of free requests in the pool
+ * \return The number of requests available for acquire()
+ */
+unsigned int RequestPool::available() const
+{
+	const Private *const d = _d();
+	std::lock_guard<std::mutex> locker(d->mutex_);
+
+	return d->free_.size();
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * stream_stats.cpp - Per-stream frame statistics
+ */
+
+#include <libcamera/stream_stats.h>
+
+#include <sstream>
+
+#include <libcamera/framebuffer.h>
+
+/**
+ * \file stream_stats.h
+ * \brief Per-stream frame statistics
+ */
+
+namespace libcamera {
+
+/**
+ * \class StreamStats
+ * \brief Frame delivery statistics of a stream
+ *
+ * The StreamStats accumulates statistics about the buffers completed for a
+ * stream of a camera: the number of frames delivered, dropped and erroneous,
+ * the interval and jitter between consecutive frames, and the latency from
+ * the capture of a frame by the sensor to the completion of its buffer.
+ *
+ * Dropped frames are detected from gaps in the FrameMetadata::sequence numbers
+ * of the completed buffers. The frame interval is measured between the
+ * completion times of consecutive buffers, as the frames are delivered to the
+ * application, and the jitter is the absolute difference between two
+ * consecutive frame intervals. A sequence number lower than or equal to the
+ * previous one is considered as the start of a new capture session, and no
+ * interval is measured across sessions.
+ *
+ * The statistics of the streams of a camera are retrieved with
+ * Camera::streamStats().
+ */
+
+StreamStats::StreamStats()
+{
+	reset();
+}
+
+/**
+ * \brief Record the completion of a buffer
+ * \param[in] metadata The metadata of the completed buffer
+ * \param[in] completion The buffer completion time, on the CLOCK_MONOTONIC
+ * time base
+ *
+ * Cancelled buffers are ignored. The latency is recorded only for buffers with
+ * a valid timestamp.
+ */
+void StreamStats::record(const FrameMetadata &metadata,
+			 std::chrono::nanoseconds completion)
+{
+	if (metadata.status == FrameMetadata::FrameCancelled)
+		return;
+
+	if (metadata.status == FrameMetadata::FrameError)
+		errors_++;
+
+	frames_++;
+
+	if (metadata.timestamp)
+		latency_.record(completion - std::chrono::nanoseconds(metadata.timestamp));
+
+	if (running_ && metadata.sequence > lastSequence_) {
+		dropped_ += metadata.sequence - lastSequence_ - 1;
+
+		std::chrono::nanoseconds interval = completion - lastCompletion_;
+		interval_.record(interval);
+
+		if (lastInterval_.count())
+			jitter_.record(interval > lastInterval_
+				       ? interval - lastInterval_
+				       : lastInterval_ - interval);
+
+		lastInterval_ = interval;
+	} else {
+		lastInterval_ = std::chrono::nanoseconds(0);
+	}
+
+	running_ = true;
+	lastSequence_ = metadata.sequence;
+	lastCompletion_ = completion;
+}
+
+/**
+ * \brief Discard all statistics
+ */
+void StreamStats::reset()
+{
+	frames_ = 0;
+	dropped_ = 0;
+	errors_ = 0;
+
+	interval_.reset();
+	jitter_.reset();
+	latency_.reset();
+
+	running_ = false;
+	lastSequence_ = 0;
+	lastCompletion_ = std::chrono::nanoseconds(0);
+	lastInterval_ = std::chrono::nanoseconds(0);
+}
+
+/**
+ * \fn StreamStats::frames()
+ * \brief Retrieve the number of frames delivered
+ *
+ * The number of frames includes erroneous frames.
+ *
+ * \return The number of buffers completed, excluding cancelled buffers
+ */
+
+/**
+ * \fn StreamStats::dropped()
+ * \brief Retrieve the number of frames dropped
+ * \return The number of frames missing from the sequence of delivered frames
+ */
+
+/**
+ * \fn StreamStats::errors()
+ * \brief Retrieve the number of erroneous frames
+ * \return The number of buffers completed with FrameMetadata::FrameError
+ */
+
+/**
+ * \brief Retrieve the mean frame rate
+ * \return The mean frame rate in frames per second, computed from the mean
+ * frame interval, or 0 if less than two frames have been delivered
+ */
+double StreamStats::frameRate() const
+{
+	std::chrono::nanoseconds mean = interval_.mean();
+	if (!mean.count())
+		return 0.0;
+
+	return 1e9 / mean.count();
+}
+
+/**
+ * \fn StreamStats::frameInterval()
+ * \brief Retrieve the histogram of the intervals between delivered frames
+ * \return The frame interval histogram
+ */
+
+/**
+ * \fn StreamStats::jitter()
+ * \brief Retrieve the histogram of the frame interval jitter
+ * \return The histogram of the differences between consecutive frame intervals
+ */
+
+/**
+ * \fn StreamStats::latency()
+ * \brief Retrieve the histogram of the capture to completion latency
+ * \return The histogram of the time from the frame timestamp to the buffer
+ * completion
+ */
+
+/**
+ * \brief Export the statistics in JSON format
+ *
+ * The statistics are exported as a JSON object containing the frame, drop and
+ * error counts, the mean frame rate, and the frame interval, jitter and
+ * latency histograms as documented in LatencyHistogram::toJson().
+ *
+ * \return A string containing the JSON representation of the statistics
+ */
+std::string StreamStats::toJson() const
+{
+	std::ostringstream ss;
+
+	ss << "{ \"frames\": " << frames_
+	   << ", \"dropped\": " << dropped_
+	   << ", \"errors\": " << errors_
+	   << ", \"fps\": " << frameRate()
+	   << ", \"interval\": " << interval_.toJson()
+	   << ", \"jitter\": " << jitter_.toJson()
+	   << ", \"latency\": " << latency_.toJson()
+	   << " }";
+
+	return ss.str();
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,494 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * trace_recorder.cpp - In-process trace event recorder
+ */
+
+#include "libcamera/internal/trace_recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <libcamera/base/log.h>
+#include <libcamera/base/utils.h>
+
+/**
+ * \file trace_recorder.h
+ * \brief In-process trace event recorder
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Trace)
+
+namespace {
+
+constexpr unsigned int DefaultSize = 4096;
+
+std::atomic<int> signalFd = -1;
+
+void writeString(std::ostream &stream, const char *str)
+{
+	stream << '"';
+
+	for (; *str; ++str) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\')
+			stream << '\\' << c;
+		else if (c < 0x20)
+			stream << "\\u" << std::hex << std::setw(4)
+			       << std::setfill('0') << static_cast<unsigned int>(c)
+			       << std::dec << std::setfill(' ');
+		else
+			stream << c;
+	}
+
+	stream << '"';
+}
+
+bool endsWith(const std::string &str, const char *suffix)
+{
+	size_t len = strlen(suffix);
+	return str.size() >= len && !str.compare(str.size() - len, len, suffix);
+}
+
+} /* namespace */
+
+/*
+ * Each thread records events in its own ring, without locking. The ring
+ * overwrites the oldest events when full. Readers copy the ring contents and
+ * discard the events that may have been overwritten during the copy.
+ */
+class TraceRecorder::Ring
+{
+public:
+	Ring(unsigned int size)
+		: events_(size), head_(0)
+	{
+		tid_ = syscall(SYS_gettid);
+
+		char name[16] = {};
+		pthread_getname_np(pthread_self(), name, sizeof(name));
+		name_ = name;
+	}
+
+	Event *next()
+	{
+		return &events_[head_.load(std::memory_order_relaxed) % events_.size()];
+	}
+
+	void commit()
+	{
+		head_.store(head_.load(std::memory_order_relaxed) + 1,
+			    std::memory_order_release);
+	}
+
+	std::vector<Event> snapshot() const
+	{
+		const uint64_t size = events_.size();
+		uint64_t head = head_.load(std::memory_order_acquire);
+		uint64_t first = head >= size ? head - size + 1 : 0;
+
+		std::vector<Event> events;
+		events.reserve(head - first);
+		for (uint64_t i = first; i < head; ++i)
+			events.push_back(events_[i % size]);
+
+		/* Drop the events overwritten by the writer in the meantime. */
+		uint64_t tail = head_.load(std::memory_order_acquire);
+		uint64_t valid = tail >= size ? tail - size + 1 : 0;
+		if (valid > first)
+			events.erase(events.begin(),
+				     events.begin() + std::min(valid - first, head - first));
+
+		return events;
+	}
+
+	pid_t tid_;
+	std::string name_;
+
+private:
+	std::vector<Event> events_;
+	std::atomic<uint64_t> head_;
+};
+
+/**
+ * \class TraceRecorder
+ * \brief Record trace events in memory and export them in Chrome JSON format
+ *
+ * The TraceRecorder provides an alternative to LTTng to capture the libcamera
+ * tracepoints, for systems where LTTng isn't available. When recording is
+ * enabled, the events emitted with LIBCAMERA_TRACEPOINT() are stored in
+ * memory, in a fixed-size ring buffer per thread, without locking. The events
+ * can then be exported at any time in the Chrome trace event JSON format,
+ * which can be loaded in the Perfetto UI or in chrome://tracing.
+ *
+ * Each event stores its timestamp, name, and the values of the fields defined
+ * for the tracepoint in its TP_FIELDS, as they would be recorded by LTTng, up
+ * to MaxFields fields. String fields are truncated to 23 characters. Events
+ * whose name ends with _begin or _end are exported as the beginning and end of
+ * a duration, named after their string fields, and all other events as
+ * instant events.
+ *
+ * Recording is enabled by setting the LIBCAMERA_TRACE_FILE environment
+ * variable to the path of the output file. The events are then written to the
+ * file when the process exits, and every time the process receives SIGUSR2,
+ * unless the application has installed its own handler for that signal.
+ * Recording can also be controlled at runtime with start() and stop().
+ */
+
+/**
+ * \var TraceRecorder::MaxFields
+ * \brief The maximum number of fields stored per event
+ */
+
+/**
+ * \struct TraceRecorder::Hex
+ * \brief Wrapper for integer fields exported in hexadecimal
+ *
+ * \var TraceRecorder::Hex::value
+ * \brief The field value
+ */
+
+/**
+ * \struct TraceRecorder::Field
+ * \brief A trace event field
+ *
+ * \var TraceRecorder::Field::type
+ * \brief The field type
+ *
+ * \var TraceRecorder::Field::i
+ * \brief The value of a signed integer field
+ *
+ * \var TraceRecorder::Field::u
+ * \brief The value of an unsigned or hexadecimal integer field
+ *
+ * \var TraceRecorder::Field::d
+ * \brief The value of a floating point field
+ *
+ * \var TraceRecorder::Field::s
+ * \brief The value of a string field, truncated and nul-terminated
+ */
+
+/**
+ * \enum TraceRecorder::Field::Type
+ * \brief The type of a trace event field
+ * \var TraceRecorder::Field::None
+ * \brief The field type isn't supported, no value is stored
+ * \var TraceRecorder::Field::Int
+ * \brief Signed integer or enumeration
+ * \var TraceRecorder::Field::UInt
+ * \brief Unsigned integer or boolean
+ * \var TraceRecorder::Field::Hex
+ * \brief Integer exported in hexadecimal, or pointer
+ * \var TraceRecorder::Field::Double
+ * \brief Floating point value
+ * \var TraceRecorder::Field::String
+ * \brief String
+ */
+
+/**
+ * \struct TraceRecorder::Event
+ * \brief A trace event
+ *
+ * \var TraceRecorder::Event::timestamp
+ * \brief The event timestamp in nanoseconds, on the CLOCK_MONOTONIC time base
+ *
+ * \var TraceRecorder::Event::name
+ * \brief The event name
+ *
+ * \var TraceRecorder::Event::fieldNames
+ * \brief The names of the event fields
+ *
+ * \var TraceRecorder::Event::numFields
+ * \brief The number of fields stored in \a fields
+ *
+ * \var TraceRecorder::Event::fields
+ * \brief The event fields
+ */
+
+std::atomic<bool> TraceRecorder::enabled_ = false;
+thread_local TraceRecorder::Ring *TraceRecorder::ring_ = nullptr;
+
+TraceRecorder::TraceRecorder()
+	: size_(DefaultSize), pipe_{ -1, -1 }
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_TRACE_FILE");
+	if (!path || !*path)
+		return;
+
+	path_ = path;
+	setupSignal();
+	start();
+}
+
+TraceRecorder::~TraceRecorder()
+{
+	stop();
+
+	if (thread_.joinable()) {
+		signal(SIGUSR2, SIG_DFL);
+		signalFd = -1;
+
+		char quit = 'q';
+		if (write(pipe_[1], &quit, 1) == 1)
+			thread_.join();
+		else
+			thread_.detach();
+	}
+
+	if (pipe_[0] != -1) {
+		close(pipe_[0]);
+		close(pipe_[1]);
+	}
+
+	if (!path_.empty())
+		dump(path_);
+}
+
+/**
+ * \brief Retrieve the trace recorder instance
+ *
+ * The TraceRecorder is a singleton and can't be constructed manually. This
+ * function shall instead be used to retrieve the single global instance of
+ * the recorder.
+ *
+ * \return The trace recorder instance
+ */
+TraceRecorder *TraceRecorder::instance()
+{
+	static TraceRecorder instance;
+	return &instance;
+}
+
+/**
+ * \fn TraceRecorder::enabled()
+ * \brief Check if recording is enabled
+ *
+ * This function is called by LIBCAMERA_TRACEPOINT() before evaluating the
+ * tracepoint fields, and is cheap enough to be called on every tracepoint.
+ *
+ * \return True if recording is enabled, false otherwise
+ */
+
+/**
+ * \brief Start recording events
+ * \param[in] size The number of events stored per thread, 0 to keep the
+ * current size
+ *
+ * The \a size applies to the threads that record their first event after this
+ * call. Events recorded before a stop() call are kept.
+ */
+void TraceRecorder::start(unsigned int size)
+{
+	{
+		MutexLocker locker(mutex_);
+		if (size)
+			size_ = size;
+	}
+
+	enabled_.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * \brief Stop recording events
+ *
+ * The events recorded so far are kept and can still be exported with dump().
+ */
+void TraceRecorder::stop()
+{
+	enabled_.store(false, std::memory_order_relaxed);
+}
+
+/**
+ * \brief Export the recorded events in Chrome trace event JSON format
+ * \param[in] stream The output stream
+ *
+ * This function may be called while recording is enabled. Events recorded
+ * while the export is in progress may not be included.
+ */
+void TraceRecorder::dump(std::ostream &stream) const
+{
+	MutexLocker locker(mutex_);
+
+	const pid_t pid = getpid();
+	bool first = true;
+
+	stream << "{ \"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+
+	for (const std::unique_ptr<Ring> &ring : rings_) {
+		stream << (first ? "\n" : ",\n")
+		       << "{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+		       << ", \"tid\": " << ring->tid_ << ", \"args\": { \"name\": ";
+		writeString(stream, ring->name_.c_str());
+		stream << " } }";
+		first = false;
+
+		for (const Event &event : ring->snapshot()) {
+			std::string name = event.name;
+			const char *phase = "i";
+
+			if (endsWith(name, "_begin") || endsWith(name, "_end")) {
+				phase = endsWith(name, "_begin") ? "B" : "E";
+
+				/* Name durations after their string fields. */
+				std::string label;
+				for (unsigned int i = 0; i < event.numFields; ++i) {
+					if (event.fields[i].type != Field::String)
+						continue;
+
+					if (!label.empty())
+						label += ':';
+					label += event.fields[i].s;
+				}
+
+				if (label.empty())
+					label = name.substr(0, name.rfind('_'));
+
+				name = label;
+			}
+
+			stream << ",\n{ \"name\": ";
+			writeString(stream, name.c_str());
+			stream << ", \"cat\": \"libcamera\", \"ph\": \"" << phase << "\"";
+			if (phase[0] == 'i')
+				stream << ", \"s\": \"t\"";
+			stream << ", \"ts\": " << event.timestamp / 1000 << "."
+			       << std::setw(3) << std::setfill('0')
+			       << event.timestamp % 1000 << std::setfill(' ')
+			       << ", \"pid\": " << pid << ", \"tid\": " << ring->tid_
+			       << ", \"args\": {";
+
+			for (unsigned int i = 0; i < event.numFields; ++i) {
+				const Field &field = event.fields[i];
+
+				stream << (i ? ", " : " ");
+				writeString(stream, event.fieldNames[i]);
+				stream << ": ";
+
+				switch (field.type) {
+				case Field::Int:
+					stream << field.i;
+					break;
+				case Field::UInt:
+					stream << field.u;
+					break;
+				case Field::Hex:
+					stream << "\"0x" << std::hex << field.u << std::dec << "\"";
+					break;
+				case Field::Double:
+					stream << field.d;
+					break;
+				case Field::String:
+					writeString(stream, field.s);
+					break;
+				case Field::None:
+				default:
+					stream << "null";
+					break;
+				}
+			}
+
+			stream << (event.numFields ? " } }" : "} }");
+		}
+	}
+
+	stream << "\n] }\n";
+}
+
+/**
+ * \brief Export the recorded events to a file in Chrome trace event JSON format
+ * \param[in] path The path to the output file
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int TraceRecorder::dump(const std::string &path) const
+{
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file.good()) {
+		int ret = -errno;
+		LOG(Trace, Error) << "Failed to open trace file " << path;
+		return ret;
+	}
+
+	dump(file);
+
+	return 0;
+}
+
+TraceRecorder::Event *TraceRecorder::beginEvent()
+{
+	if (!ring_) {
+		MutexLocker locker(mutex_);
+		rings_.push_back(std::make_unique<Ring>(size_));
+		ring_ = rings_.back().get();
+	}
+
+	Event *event = ring_->next();
+	event->timestamp = utils::clock::now().time_since_epoch().count();
+
+	return event;
+}
+
+void TraceRecorder::endEvent()
+{
+	ring_->commit();
+}
+
+void TraceRecorder::setupSignal()
+{
+	struct sigaction action;
+	if (sigaction(SIGUSR2, nullptr, &action) ||
+	    action.sa_handler != SIG_DFL)
+		return;
+
+	if (pipe2(pipe_, O_CLOEXEC | O_NONBLOCK)) {
+		pipe_[0] = pipe_[1] = -1;
+		return;
+	}
+
+	/* Only the write end needs to be non-blocking. */
+	fcntl(pipe_[0], F_SETFL, 0);
+
+	signalFd = pipe_[1];
+	thread_ = std::thread(&TraceRecorder::signalThread, this);
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = &TraceRecorder::signalHandler;
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &action, nullptr);
+}
+
+void TraceRecorder::signalThread()
+{
+	while (true) {
+		char command;
+		ssize_t ret = read(pipe_[0], &command, 1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret != 1 || command == 'q')
+			break;
+
+		dump(path_);
+	}
+}
+
+void TraceRecorder::signalHandler([[maybe_unused]] int signal)
+{
+	int fd = signalFd.load(std::memory_order_relaxed);
+	if (fd == -1)
+		return;
+
+	char command = 'd';
+	[[maybe_unused]] ssize_t ret = write(fd, &command, 1);
+}
+
+} /* namespace libcamera */
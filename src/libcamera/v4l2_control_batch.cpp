@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * v4l2_control_batch.cpp - Batched V4L2 control writes for multiple devices
+ */
+
+#include "libcamera/internal/v4l2_control_batch.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <libcamera/base/log.h>
+
+#include "libcamera/internal/v4l2_device.h"
+
+/**
+ * \file v4l2_control_batch.h
+ * \brief Batched V4L2 control writes for multiple devices
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(V4L2)
+
+/**
+ * \class V4L2ControlBatch
+ * \brief Gather V4L2 control writes for multiple devices and submit them together
+ *
+ * Pipeline handlers commonly need to update controls on several devices (such
+ * as a camera sensor, a lens and a flash) for the same frame, usually from the
+ * frame start event handler, where the writes have to complete within the
+ * vertical blanking interval. Writing the controls of each device as they get
+ * computed spreads the ioctls over the time taken to compute them.
+ *
+ * The V4L2ControlBatch gathers the control lists for all devices with add(),
+ * and writes them back to back with commit(). When a MediaRequest is passed to
+ * commit(), the controls are instead bound to the request and get applied by
+ * the kernel when the request is queued.
+ *
+ * Lists are written in the order they have been added, and multiple lists can
+ * be added for the same device when controls need to be written separately,
+ * for instance to write VBLANK before EXPOSURE. The batch retains the storage
+ * of its lists across commits, so it doesn't allocate memory once it has
+ * reached its working size.
+ */
+
+/**
+ * \brief Construct an empty V4L2ControlBatch
+ */
+V4L2ControlBatch::V4L2ControlBatch()
+	: size_(0)
+{
+}
+
+/**
+ * \fn V4L2ControlBatch::empty()
+ * \brief Check if the batch contains no control list
+ * \return True if the batch is empty, false otherwise
+ */
+
+/**
+ * \fn V4L2ControlBatch::size()
+ * \brief Retrieve the number of control lists in the batch
+ * \return The number of control lists in the batch
+ */
+
+/**
+ * \fn V4L2ControlBatch::device()
+ * \brief Retrieve the device of a control list in the batch
+ * \param[in] index The index of the control list, in the order it was added
+ *
+ * The \a index shall be lower than size().
+ *
+ * \return The device the control list at \a index is written to
+ */
+
+/**
+ * \fn V4L2ControlBatch::controls()
+ * \brief Retrieve a control list in the batch
+ * \param[in] index The index of the control list, in the order it was added
+ *
+ * The \a index shall be lower than size().
+ *
+ * \return The control list at \a index
+ */
+
+/**
+ * \brief Add a list of controls to write to a device
+ * \param[in] device The device to write the controls to
+ * \param[in] controls The controls to write
+ *
+ * Empty control lists are ignored.
+ */
+void V4L2ControlBatch::add(V4L2Device *device, const ControlList &controls)
+{
+	if (controls.empty())
+		return;
+
+	if (size_ == entries_.size()) {
+		entries_.push_back({ device, controls });
+	} else {
+		Entry &entry = entries_[size_];
+		entry.device = device;
+		entry.controls = controls;
+	}
+
+	size_++;
+}
+
+/**
+ * \brief Remove all control lists from the batch
+ */
+void V4L2ControlBatch::clear()
+{
+	for (unsigned int i = 0; i < size_; ++i)
+		entries_[i].controls.clear();
+
+	size_ = 0;
+}
+
+/**
+ * \brief Write all the control lists to their devices
+ * \param[in] request An optional media request to bind the controls to
+ *
+ * Write the control lists to their device with V4L2Device::setControls(), in
+ * the order they have been added. An error writing one list doesn't prevent
+ * the following lists from being written. The batch is cleared once all lists
+ * have been written.
+ *
+ * \return 0 on success or the first negative error code otherwise, -EIO if
+ * a list has only been partially written
+ */
+int V4L2ControlBatch::commit(MediaRequest *request)
+{
+	int ret = 0;
+
+	for (unsigned int i = 0; i < size_; ++i) {
+		Entry &entry = entries_[i];
+
+		int err = entry.device->setControls(&entry.controls, request);
+		if (!err)
+			continue;
+
+		/* A positive value is the index of the control that failed. */
+		LOG(V4L2, Error)
+			<< "Failed to write controls to "
+			<< entry.device->deviceNode() << ": "
+			<< (err < 0 ? strerror(-err) : "partial write");
+
+		if (!ret)
+			ret = err < 0 ? err : -EIO;
+	}
+
+	clear();
+
+	return ret;
+}
+
+} /* namespace libcamera */
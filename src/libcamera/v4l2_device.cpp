@@ -18,8 +18,10 @@
 
 #include <libcamera/base/event_notifier.h>
 #include <libcamera/base/log.h>
+#include <libcamera/base/thread.h>
 #include <libcamera/base/utils.h>
 
+#include "libcamera/internal/media_request.h"
 #include "libcamera/internal/sysfs.h"
 
 /**
@@ -138,6 +140,8 @@ void V4L2Device::close()
 
 	delete fdEventNotifier_;
 
+	controlsCache_.clear();
+
 	if (::close(fd_) < 0)
 		LOG(V4L2, Error) << "Failed to close V4L2 device: "
 				 << strerror(errno);
@@ -163,6 +167,13 @@ void V4L2Device::close()
  * This function reads the value of all controls contained in \a ids, and
  * returns their values as a ControlList.
  *
+ * The values of controls that are not volatile are cached when read or
+ * written, and returned from the cache without accessing the device. Controls
+ * flagged with V4L2_CTRL_FLAG_VOLATILE and controls with a payload are always
+ * read from the device. The cache is invalidated when controls are written,
+ * when the control information is updated, and when the device format or
+ * selection rectangles are changed as they may affect control values.
+ *
  * If any control in \a ids is not supported by the device, is disabled (i.e.
  * has the V4L2_CTRL_FLAG_DISABLED flag set), or if any other error occurs
  * during validation of the requested controls, no control is read and this
@@ -189,15 +200,20 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 		ctrls.set(id, {});
 	}
 
-	std::vector<v4l2_ext_control> v4l2Ctrls(ids.size());
-	memset(v4l2Ctrls.data(), 0, sizeof(v4l2_ext_control) * ctrls.size());
+	std::vector<v4l2_ext_control> v4l2Ctrls;
+	v4l2Ctrls.reserve(ctrls.size());
 
-	unsigned int i = 0;
 	for (auto &ctrl : ctrls) {
 		unsigned int id = ctrl.first;
 		const struct v4l2_query_ext_ctrl &info = controlInfo_[id];
 
-		v4l2_ext_control &v4l2Ctrl = v4l2Ctrls[i++];
+		/* Serve the control from the cache if possible. */
+		if (isCacheable(info) && controlsCache_.contains(id)) {
+			ctrl.second = controlsCache_.get(id);
+			continue;
+		}
+
+		v4l2_ext_control &v4l2Ctrl = v4l2Ctrls.emplace_back();
 		v4l2Ctrl.id = id;
 
 		if (info.flags & V4L2_CTRL_FLAG_HAS_PAYLOAD) {
@@ -224,6 +240,9 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 		}
 	}
 
+	if (v4l2Ctrls.empty())
+		return ctrls;
+
 	struct v4l2_ext_controls v4l2ExtCtrls = {};
 	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
 	v4l2ExtCtrls.controls = v4l2Ctrls.data();
@@ -248,6 +267,7 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 	}
 
 	updateControls(&ctrls, v4l2Ctrls);
+	cacheControls(ctrls, v4l2Ctrls);
 
 	return ctrls;
 }
@@ -255,11 +275,16 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 /**
  * \brief Write controls to the device
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to bind the controls to (optional)
  *
  * This function writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
  * \a ctrls entry.
  *
+ * If a media \a request is specified, the controls are not applied
+ * immediately, but are stored in the request and applied atomically with the
+ * other operations bound to the request when it is processed by the kernel.
+ *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
  * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, if any other error
  * occurs during validation of the requested controls, no control is written and
@@ -274,7 +299,7 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int V4L2Device::setControls(ControlList *ctrls)
+int V4L2Device::setControls(ControlList *ctrls, MediaRequest *request)
 {
 	if (ctrls->empty())
 		return 0;
@@ -323,7 +348,12 @@ int V4L2Device::setControls(ControlList *ctrls)
 	}
 
 	struct v4l2_ext_controls v4l2ExtCtrls = {};
-	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	} else {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	}
 	v4l2ExtCtrls.controls = v4l2Ctrls.data();
 	v4l2ExtCtrls.count = v4l2Ctrls.size();
 
@@ -348,9 +378,50 @@ int V4L2Device::setControls(ControlList *ctrls)
 
 	updateControls(ctrls, v4l2Ctrls);
 
+	/*
+	 * Writing a control may change the value of other controls, invalidate
+	 * the cache and store the values that have been applied. Controls
+	 * bound to a request are only applied when the request is queued.
+	 */
+	invalidateControlsCache();
+	if (!request)
+		cacheControls(*ctrls, v4l2Ctrls);
+
+	/*
+	 * Controls that modify the buffer layout, such as flips on Bayer
+	 * sensors, may change the formats enumerated by the device.
+	 */
+	if (!request) {
+		for (const v4l2_ext_control &v4l2Ctrl : v4l2Ctrls) {
+			const auto iter = controlInfo_.find(v4l2Ctrl.id);
+			if (iter != controlInfo_.end() &&
+			    iter->second.flags & V4L2_CTRL_FLAG_MODIFY_LAYOUT) {
+				invalidateFormatsCache();
+				break;
+			}
+		}
+	}
+
 	return ret;
 }
 
+/**
+ * \brief Invalidate the cached formats enumerated from the device
+ *
+ * Enumerating the formats supported by a device requires a large number of
+ * ioctl calls. Derived classes may thus cache the result of the enumeration.
+ * The cache is automatically invalidated when the device is closed and when
+ * the device configuration is changed in a way that may affect the supported
+ * formats. This function allows invalidating the cache explicitly, for
+ * instance when the device configuration has been changed through a different
+ * device.
+ *
+ * The default implementation does nothing.
+ */
+void V4L2Device::invalidateFormatsCache()
+{
+}
+
 /**
  * \brief Retrieve the v4l2_query_ext_ctrl information for the given control
  * \param[in] id The V4L2 control id
@@ -417,7 +488,11 @@ int V4L2Device::setFrameStartEnabled(bool enable)
 	if (enable && ret)
 		return ret;
 
-	fdEventNotifier_->setEnabled(enable);
+	if (fdEventNotifier_->thread() == Thread::current())
+		fdEventNotifier_->setEnabled(enable);
+	else
+		fdEventNotifier_->invokeMethod(&EventNotifier::setEnabled,
+					       ConnectionTypeBlocking, enable);
 	frameStartEnabled_ = enable;
 
 	return ret;
@@ -428,6 +503,34 @@ int V4L2Device::setFrameStartEnabled(bool enable)
  * \brief A Signal emitted when capture of a frame has started
  */
 
+/**
+ * \brief Deliver device events in a given thread
+ * \param[in] thread The thread in which to handle events
+ *
+ * Device events, and the signals they trigger such as frameStart, are handled
+ * by default in the thread that opened the device. This function moves event
+ * handling to \a thread, to make time-critical processing of events, such as
+ * writing sensor controls at frame start, independent of the load of the
+ * thread that owns the device. Slots connected to the event signals are then
+ * invoked in \a thread, unless they are bound to an Object.
+ *
+ * If the events are handled in another thread than the calling thread, that
+ * thread shall be running, and this function blocks until event handling has
+ * been moved. Event handling shall be moved back to the thread that owns the
+ * device before the \a thread is stopped.
+ */
+void V4L2Device::setEventThread(Thread *thread)
+{
+	if (!fdEventNotifier_)
+		return;
+
+	if (fdEventNotifier_->thread() == Thread::current())
+		fdEventNotifier_->moveToThread(thread);
+	else
+		fdEventNotifier_->invokeMethod(&EventNotifier::moveToThread,
+					       ConnectionTypeBlocking, thread);
+}
+
 /**
  * \brief Perform an IOCTL system call on the device node
  * \param[in] request The IOCTL request code
@@ -637,6 +740,8 @@ void V4L2Device::listControls()
  */
 void V4L2Device::updateControlInfo()
 {
+	invalidateControlsCache();
+
 	for (auto &[controlId, info] : controls_) {
 		unsigned int id = controlId->id();
 
@@ -703,6 +808,44 @@ void V4L2Device::updateControls(ControlList *ctrls,
 	}
 }
 
+/*
+ * \brief Store the values of the V4L2 controls in \a v4l2Ctrls in the cache
+ * \param[in] ctrls List of V4L2 controls holding the values to cache
+ * \param[in] v4l2Ctrls List of V4L2 extended controls read or written
+ */
+void V4L2Device::cacheControls(const ControlList &ctrls,
+			       Span<const v4l2_ext_control> v4l2Ctrls)
+{
+	for (const v4l2_ext_control &v4l2Ctrl : v4l2Ctrls) {
+		const unsigned int id = v4l2Ctrl.id;
+
+		const auto iter = controlInfo_.find(id);
+		if (iter == controlInfo_.end() || !isCacheable(iter->second))
+			continue;
+
+		controlsCache_.set(id, ctrls.get(id));
+	}
+}
+
+/**
+ * \brief Invalidate the cached control values
+ *
+ * Drop all control values cached by getControls() and setControls(). This
+ * function shall be called by derived classes when an operation on the device,
+ * such as a format change, may change the value of controls.
+ */
+void V4L2Device::invalidateControlsCache()
+{
+	controlsCache_.clear();
+}
+
+bool V4L2Device::isCacheable(const struct v4l2_query_ext_ctrl &ctrl)
+{
+	return !(ctrl.flags & (V4L2_CTRL_FLAG_VOLATILE |
+			       V4L2_CTRL_FLAG_WRITE_ONLY |
+			       V4L2_CTRL_FLAG_HAS_PAYLOAD));
+}
+
 /**
  * \brief Slot to handle V4L2 events from the V4L2 device
  * \param[in] notifier The event notifier
@@ -8,8 +8,10 @@
 
 #include "libcamera/internal/v4l2_pixelformat.h"
 
+#include <algorithm>
+#include <array>
 #include <ctype.h>
-#include <map>
+#include <iterator>
 #include <string.h>
 
 #include <libcamera/base/log.h>
@@ -45,7 +47,12 @@ LOG_DECLARE_CATEGORY(V4L2)
 
 namespace {
 
-const std::map<V4L2PixelFormat, PixelFormat> vpf2pf{
+struct FormatMapping {
+	V4L2PixelFormat v4l2Format;
+	PixelFormat format;
+};
+
+constexpr FormatMapping vpf2pf[] = {
 	/* RGB formats. */
 	{ V4L2PixelFormat(V4L2_PIX_FMT_RGB565), formats::RGB565 },
 	{ V4L2PixelFormat(V4L2_PIX_FMT_RGB565X), formats::RGB565_BE },
@@ -107,6 +114,26 @@ const std::map<V4L2PixelFormat, PixelFormat> vpf2pf{
 	{ V4L2PixelFormat(V4L2_PIX_FMT_MJPEG), formats::MJPEG },
 };
 
+constexpr size_t kNumMappings = std::size(vpf2pf);
+
+/* Sort the mappings by V4L2 format at compile time, for binary search. */
+constexpr std::array<FormatMapping, kNumMappings> sortMappings()
+{
+	std::array<FormatMapping, kNumMappings> mappings{};
+
+	for (size_t i = 0; i < kNumMappings; ++i) {
+		size_t j = i;
+		for (; j > 0 && vpf2pf[i].v4l2Format.fourcc() <
+				mappings[j - 1].v4l2Format.fourcc(); --j)
+			mappings[j] = mappings[j - 1];
+		mappings[j] = vpf2pf[i];
+	}
+
+	return mappings;
+}
+
+constexpr std::array<FormatMapping, kNumMappings> sortedMappings = sortMappings();
+
 } /* namespace */
 
 /**
@@ -177,15 +204,18 @@ std::string V4L2PixelFormat::toString() const
  */
 PixelFormat V4L2PixelFormat::toPixelFormat() const
 {
-	const auto iter = vpf2pf.find(*this);
-	if (iter == vpf2pf.end()) {
+	const auto iter = std::lower_bound(sortedMappings.begin(), sortedMappings.end(),
+					   fourcc_, [](const FormatMapping &mapping, uint32_t fourcc) {
+						   return mapping.v4l2Format.fourcc() < fourcc;
+					   });
+	if (iter == sortedMappings.end() || iter->v4l2Format.fourcc() != fourcc_) {
 		LOG(V4L2, Warning)
 			<< "Unsupported V4L2 pixel format "
 			<< toString();
 		return PixelFormat();
 	}
 
-	return iter->second;
+	return iter->format;
 }
 
 /**
@@ -255,6 +255,16 @@ int V4L2Subdevice::open()
 	return V4L2Device::open(O_RDWR);
 }
 
+/**
+ * \brief Close the subdevice, releasing any resources acquired by open()
+ */
+void V4L2Subdevice::close()
+{
+	formatsCache_.clear();
+
+	V4L2Device::close();
+}
+
 /**
  * \fn V4L2Subdevice::entity()
  * \brief Retrieve the media entity associated with the subdevice
@@ -330,6 +340,13 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
 		return ret;
 	}
 
+	/*
+	 * The supported frame sizes and the control values may depend on the
+	 * selection rectangles.
+	 */
+	invalidateFormatsCache();
+	invalidateControlsCache();
+
 	rect->x = sel.r.left;
 	rect->y = sel.r.top;
 	rect->width = sel.r.width;
@@ -344,6 +361,11 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
  * Enumerate all media bus codes and frame sizes supported by the subdevice on
  * a \a pad.
  *
+ * The enumeration result is cached until the device is closed or the cache is
+ * invalidated. As the formats supported on a pad may depend on the formats
+ * and selection rectangles configured on other pads, the cache is invalidated
+ * when an active format or a selection rectangle is set.
+ *
  * \return A list of the supported device formats
  */
 V4L2Subdevice::Formats V4L2Subdevice::formats(unsigned int pad)
@@ -355,6 +377,10 @@ V4L2Subdevice::Formats V4L2Subdevice::formats(unsigned int pad)
 		return {};
 	}
 
+	auto it = formatsCache_.find(pad);
+	if (it != formatsCache_.end())
+		return it->second;
+
 	for (unsigned int code : enumPadCodes(pad)) {
 		std::vector<SizeRange> sizes = enumPadSizes(pad, code);
 		if (sizes.empty())
@@ -369,9 +395,21 @@ V4L2Subdevice::Formats V4L2Subdevice::formats(unsigned int pad)
 		}
 	}
 
+	formatsCache_[pad] = formats;
+
 	return formats;
 }
 
+/**
+ * \brief Invalidate the cached formats enumerated from the subdevice
+ *
+ * \sa V4L2Device::invalidateFormatsCache()
+ */
+void V4L2Subdevice::invalidateFormatsCache()
+{
+	formatsCache_.clear();
+}
+
 /**
  * \brief Retrieve the image format set on one of the V4L2 subdevice pads
  * \param[in] pad The 0-indexed pad number the format is to be retrieved from
@@ -434,6 +472,12 @@ int V4L2Subdevice::setFormat(unsigned int pad, V4L2SubdeviceFormat *format,
 		return ret;
 	}
 
+	/* Controls such as the blanking intervals depend on the format. */
+	if (whence == ActiveFormat) {
+		invalidateFormatsCache();
+		invalidateControlsCache();
+	}
+
 	format->size.width = subdevFmt.format.width;
 	format->size.height = subdevFmt.format.height;
 	format->mbus_code = subdevFmt.format.code;
@@ -27,6 +27,8 @@
 
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/media_object.h"
+#include "libcamera/internal/media_request.h"
+#include "libcamera/internal/tracepoints.h"
 
 /**
  * \file v4l2_videodevice.h
@@ -152,6 +154,34 @@ LOG_DECLARE_CATEGORY(V4L2)
  * index associations to help selecting V4L2 buffers. It tracks, for every
  * entry, if the V4L2 buffer is in use, and offers lookup of the best free V4L2
  * buffer for a set of dmabufs.
+ *
+ * As lookups are performed every time a buffer is queued, the cache indexes
+ * its entries by a hash of the dmabuf file descriptors and plane lengths, and
+ * keeps the free entries sorted according to the eviction policy. Both cache
+ * hits and selection of the entry to evict on cache misses are thus performed
+ * without scanning all entries.
+ */
+
+/**
+ * \enum V4L2BufferCache::EvictionPolicy
+ * \brief The policy used to select the entry to evict on cache misses
+ *
+ * Regardless of the policy, free entries that have never been associated with
+ * dmabufs are always used before evicting an existing association.
+ *
+ * \var V4L2BufferCache::EvictionPolicy::LeastRecentlyUsed
+ * \brief Evict the free entry that has been used least recently
+ *
+ * This is the default policy, and is best suited to buffers being queued in
+ * a round-robin fashion.
+ *
+ * \var V4L2BufferCache::EvictionPolicy::LeastFrequentlyUsed
+ * \brief Evict the free entry that has been used the least number of times,
+ * or the least recently used entry in case of a tie
+ *
+ * This policy is best suited to clients that cycle through a small set of hot
+ * buffers and occasionally queue buffers from a larger pool, as it keeps the
+ * hot buffers mapped.
  */
 
 /**
@@ -163,9 +193,9 @@ LOG_DECLARE_CATEGORY(V4L2)
  * buffer import, with buffers added to the cache as they are queued.
  */
 V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
-	: lastUsedCounter_(1), missCounter_(0)
+	: policy_(EvictionPolicy::LeastRecentlyUsed), lastUsedCounter_(1)
 {
-	cache_.resize(numEntries);
+	addEntries(numEntries);
 }
 
 /**
@@ -177,20 +207,117 @@ V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
  * allocated.
  */
 V4L2BufferCache::V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
-	: lastUsedCounter_(1), missCounter_(0)
+	: policy_(EvictionPolicy::LeastRecentlyUsed), lastUsedCounter_(1)
 {
-	for (const std::unique_ptr<FrameBuffer> &buffer : buffers)
-		cache_.emplace_back(true,
-				    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
-				    *buffer.get());
+	addEntries(buffers);
 }
 
 V4L2BufferCache::~V4L2BufferCache()
 {
-	if (missCounter_ > cache_.size())
-		LOG(V4L2, Debug) << "Cache misses: " << missCounter_;
+	if (stats_.misses > cache_.size())
+		LOG(V4L2, Debug)
+			<< "Cache hits: " << stats_.hits
+			<< ", misses: " << stats_.misses
+			<< ", evictions: " << stats_.evictions;
+}
+
+/**
+ * \struct V4L2BufferCache::Statistics
+ * \brief Usage statistics of a V4L2BufferCache
+ *
+ * The statistics count the outcome of every lookup performed with
+ * V4L2BufferCache::get(). A cache miss requires the kernel to map the dmabufs
+ * of the FrameBuffer at VIDIOC_QBUF time, and an eviction additionally
+ * requires the dmabufs previously associated with the V4L2 buffer to be
+ * unmapped. A high number of evictions compared to the number of lookups is a
+ * sign that the cache is too small for the number of buffers in rotation.
+ *
+ * \var V4L2BufferCache::Statistics::hits
+ * \brief The number of lookups that found a V4L2 buffer previously used with
+ * the same dmabufs
+ *
+ * \var V4L2BufferCache::Statistics::misses
+ * \brief The number of lookups that didn't find a V4L2 buffer previously used
+ * with the same dmabufs, including lookups that failed due to no V4L2 buffer
+ * being free
+ *
+ * \var V4L2BufferCache::Statistics::evictions
+ * \brief The number of cache misses that replaced a previous association
+ * between a V4L2 buffer and a set of dmabufs
+ */
+
+/**
+ * \brief Add \a numEntries empty entries to the cache
+ * \param[in] numEntries Number of entries to add
+ *
+ * Grow the cache by \a numEntries entries all marked as unused. The new
+ * entries are associated with the V4L2 buffer indexes following the existing
+ * entries.
+ */
+void V4L2BufferCache::addEntries(unsigned int numEntries)
+{
+	for (unsigned int i = 0; i < numEntries; i++) {
+		unsigned int index = cache_.size();
+		cache_.emplace_back();
+
+		freeEntries_.insert(evictionKey(index));
+	}
+}
+
+/**
+ * \brief Add entries pre-populated with \a buffers to the cache
+ * \param[in] buffers Array of buffers to pre-populate the new entries with
+ *
+ * Grow the cache by one entry for each buffer in \a buffers. The new entries
+ * are associated with the V4L2 buffer indexes following the existing entries.
+ */
+void V4L2BufferCache::addEntries(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+{
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+		unsigned int index = cache_.size();
+		const Entry &entry =
+			cache_.emplace_back(true,
+					    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
+					    *buffer.get());
+
+		index_.emplace(entry.hash_, index);
+		freeEntries_.insert(evictionKey(index));
+	}
 }
 
+/**
+ * \fn V4L2BufferCache::evictionPolicy()
+ * \brief Retrieve the cache eviction policy
+ * \return The cache eviction policy
+ */
+
+/**
+ * \brief Set the cache eviction policy
+ * \param[in] policy The eviction policy
+ *
+ * The eviction policy can be changed at any time, and applies to all the
+ * subsequent lookups.
+ */
+void V4L2BufferCache::setEvictionPolicy(EvictionPolicy policy)
+{
+	if (policy == policy_)
+		return;
+
+	policy_ = policy;
+
+	freeEntries_.clear();
+	for (unsigned int index = 0; index < cache_.size(); index++) {
+		if (cache_[index].free_)
+			freeEntries_.insert(evictionKey(index));
+	}
+}
+
+/**
+ * \fn V4L2BufferCache::size()
+ * \brief Retrieve the number of entries in the cache
+ * \return The number of entries in the cache
+ */
+
 /**
  * \brief Find the best V4L2 buffer for a FrameBuffer
  * \param[in] buffer The FrameBuffer
@@ -198,46 +325,63 @@ V4L2BufferCache::~V4L2BufferCache()
  * Find the best V4L2 buffer index to be used for the FrameBuffer \a buffer
  * based on previous mappings of frame buffers to V4L2 buffers. If a free V4L2
  * buffer previously used with the same dmabufs as \a buffer is found in the
- * cache, return its index. Otherwise return the index of the first free V4L2
- * buffer and record its association with the dmabufs of \a buffer.
+ * cache, return its index. Otherwise return the index of the least recently
+ * used free V4L2 buffer and record its association with the dmabufs of
+ * \a buffer.
  *
  * \return The index of the best V4L2 buffer, or -ENOENT if no free V4L2 buffer
  * is available
  */
 int V4L2BufferCache::get(const FrameBuffer &buffer)
 {
+	uint64_t hash = Entry::hash(buffer);
 	bool hit = false;
 	int use = -1;
-	uint64_t oldest = UINT64_MAX;
-
-	for (unsigned int index = 0; index < cache_.size(); index++) {
-		const Entry &entry = cache_[index];
 
-		if (!entry.free_)
-			continue;
+	/* Try to find a cache hit by comparing the planes. */
+	auto range = index_.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		const Entry &entry = cache_[it->second];
 
-		/* Try to find a cache hit by comparing the planes. */
-		if (entry == buffer) {
+		if (entry.free_ && entry == buffer) {
 			hit = true;
-			use = index;
+			use = it->second;
 			break;
 		}
+	}
 
-		if (entry.lastUsed_ < oldest) {
-			use = index;
-			oldest = entry.lastUsed_;
-		}
+	/* Otherwise pick the free entry to evict according to the policy. */
+	if (!hit && !freeEntries_.empty())
+		use = std::get<2>(*freeEntries_.begin());
+
+	if (hit) {
+		stats_.hits++;
+	} else {
+		stats_.misses++;
+		if (use >= 0 && cache_[use].isValid())
+			stats_.evictions++;
 	}
 
-	if (!hit)
-		missCounter_++;
+	LIBCAMERA_TRACEPOINT(v4l2_buffer_cache_get, this, use, hit);
 
 	if (use < 0)
 		return -ENOENT;
 
-	cache_[use] = Entry(false,
-			    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
-			    buffer);
+	Entry &entry = cache_[use];
+	uint64_t lastUsed = lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel);
+
+	freeEntries_.erase(evictionKey(use));
+
+	if (hit) {
+		entry.free_ = false;
+		entry.lastUsed_ = lastUsed;
+	} else {
+		removeFromIndex(use);
+		entry = Entry(false, lastUsed, buffer);
+		index_.emplace(entry.hash_, use);
+	}
+
+	entry.uses_++;
 
 	return use;
 }
@@ -249,16 +393,69 @@ int V4L2BufferCache::get(const FrameBuffer &buffer)
 void V4L2BufferCache::put(unsigned int index)
 {
 	ASSERT(index < cache_.size());
-	cache_[index].free_ = true;
+
+	Entry &entry = cache_[index];
+	if (entry.free_)
+		return;
+
+	entry.free_ = true;
+	freeEntries_.insert(evictionKey(index));
+}
+
+/**
+ * \fn V4L2BufferCache::statistics()
+ * \brief Retrieve the cache usage statistics
+ *
+ * The statistics are accumulated since the cache was created or since the
+ * last call to resetStatistics().
+ *
+ * \return The cache usage statistics
+ */
+
+/**
+ * \brief Reset the cache usage statistics
+ */
+void V4L2BufferCache::resetStatistics()
+{
+	stats_ = {};
+}
+
+V4L2BufferCache::EvictionKey V4L2BufferCache::evictionKey(unsigned int index) const
+{
+	const Entry &entry = cache_[index];
+
+	switch (policy_) {
+	case EvictionPolicy::LeastFrequentlyUsed:
+		return { entry.uses_, entry.lastUsed_, index };
+
+	case EvictionPolicy::LeastRecentlyUsed:
+	default:
+		return { entry.lastUsed_, 0, index };
+	}
+}
+
+void V4L2BufferCache::removeFromIndex(unsigned int index)
+{
+	const Entry &entry = cache_[index];
+	if (!entry.isValid())
+		return;
+
+	auto range = index_.equal_range(entry.hash_);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == index) {
+			index_.erase(it);
+			return;
+		}
+	}
 }
 
 V4L2BufferCache::Entry::Entry()
-	: free_(true), lastUsed_(0)
+	: free_(true), lastUsed_(0), uses_(0), hash_(0)
 {
 }
 
 V4L2BufferCache::Entry::Entry(bool free, uint64_t lastUsed, const FrameBuffer &buffer)
-	: free_(free), lastUsed_(lastUsed)
+	: free_(free), lastUsed_(lastUsed), uses_(0), hash_(hash(buffer))
 {
 	for (const FrameBuffer::Plane &plane : buffer.planes())
 		planes_.emplace_back(plane);
@@ -278,6 +475,19 @@ bool V4L2BufferCache::Entry::operator==(const FrameBuffer &buffer) const
 	return true;
 }
 
+uint64_t V4L2BufferCache::Entry::hash(const FrameBuffer &buffer)
+{
+	/* Combine the plane fds and lengths with the FNV-1a hash function. */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (const FrameBuffer::Plane &plane : buffer.planes()) {
+		hash = (hash ^ static_cast<uint32_t>(plane.fd.fd())) * 0x100000001b3ULL;
+		hash = (hash ^ plane.length) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
 /**
  * \class V4L2DeviceFormat
  * \brief The V4L2 video device image format and sizes
@@ -481,8 +691,10 @@ const std::string V4L2DeviceFormat::toString() const
  * \param[in] deviceNode The file-system path to the video device node
  */
 V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
-	: V4L2Device(deviceNode), cache_(nullptr), fdBufferNotifier_(nullptr),
-	  streaming_(false)
+	: V4L2Device(deviceNode), cache_(nullptr),
+	  cachePolicy_(V4L2BufferCache::EvictionPolicy::LeastRecentlyUsed),
+	  cacheMaxEntries_(0), cacheEvictionThreshold_(0.25f), queuedCount_(0),
+	  fdBufferNotifier_(nullptr), drainBuffers_(false), streaming_(false)
 {
 	/*
 	 * We default to an MMAP based CAPTURE video device, however this will
@@ -490,6 +702,7 @@ V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
 	 */
 	bufferType_ = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 	memoryType_ = V4L2_MEMORY_MMAP;
+	bufferCaps_ = 0;
 }
 
 /**
@@ -682,6 +895,8 @@ void V4L2VideoDevice::close()
 	releaseBuffers();
 	delete fdBufferNotifier_;
 
+	formatsCache_.clear();
+
 	V4L2Device::close();
 }
 
@@ -761,12 +976,20 @@ int V4L2VideoDevice::tryFormat(V4L2DeviceFormat *format)
  */
 int V4L2VideoDevice::setFormat(V4L2DeviceFormat *format)
 {
+	int ret;
+
 	if (caps_.isMeta())
-		return trySetFormatMeta(format, true);
+		ret = trySetFormatMeta(format, true);
 	else if (caps_.isMultiplanar())
-		return trySetFormatMultiplane(format, true);
+		ret = trySetFormatMultiplane(format, true);
 	else
-		return trySetFormatSingleplane(format, true);
+		ret = trySetFormatSingleplane(format, true);
+
+	/* Control values may depend on the format. */
+	if (!ret)
+		invalidateControlsCache();
+
+	return ret;
 }
 
 int V4L2VideoDevice::getFormatMeta(V4L2DeviceFormat *format)
@@ -958,10 +1181,23 @@ int V4L2VideoDevice::trySetFormatSingleplane(V4L2DeviceFormat *format, bool set)
  * If the \a code argument is not zero, only formats compatible with that media
  * bus code will be enumerated.
  *
+ * The enumeration result is cached until the device is closed or the cache is
+ * invalidated with invalidateFormatsCache(). Memory-to-memory devices are not
+ * cached, as the formats supported on one side of the device depend on the
+ * format configured on the other side.
+ *
  * \return A list of the supported video device formats
  */
 V4L2VideoDevice::Formats V4L2VideoDevice::formats(uint32_t code)
 {
+	bool cacheable = !caps_.isM2M();
+
+	if (cacheable) {
+		auto it = formatsCache_.find(code);
+		if (it != formatsCache_.end())
+			return it->second;
+	}
+
 	Formats formats;
 
 	for (V4L2PixelFormat pixelFormat : enumPixelformats(code)) {
@@ -979,9 +1215,22 @@ V4L2VideoDevice::Formats V4L2VideoDevice::formats(uint32_t code)
 		formats.emplace(pixelFormat, sizes);
 	}
 
+	if (cacheable)
+		formatsCache_[code] = formats;
+
 	return formats;
 }
 
+/**
+ * \brief Invalidate the cached formats enumerated from the video device
+ *
+ * \sa V4L2Device::invalidateFormatsCache()
+ */
+void V4L2VideoDevice::invalidateFormatsCache()
+{
+	formatsCache_.clear();
+}
+
 std::vector<V4L2PixelFormat> V4L2VideoDevice::enumPixelformats(uint32_t code)
 {
 	std::vector<V4L2PixelFormat> formats;
@@ -1103,6 +1352,8 @@ int V4L2VideoDevice::setSelection(unsigned int target, Rectangle *rect)
 		return ret;
 	}
 
+	invalidateControlsCache();
+
 	rect->x = sel.r.left;
 	rect->y = sel.r.top;
 	rect->width = sel.r.width;
@@ -1138,6 +1389,15 @@ int V4L2VideoDevice::requestBuffers(unsigned int count,
 
 	LOG(V4L2, Debug) << rb.count << " buffers requested.";
 
+	bufferCaps_ = rb.capabilities;
+
+	/*
+	 * Size the queued buffers table to the number of V4L2 buffers, to
+	 * avoid memory allocations when queuing and dequeuing buffers.
+	 */
+	queuedBuffers_.assign(rb.count, nullptr);
+	queuedCount_ = 0;
+
 	return 0;
 }
 
@@ -1172,6 +1432,8 @@ int V4L2VideoDevice::allocateBuffers(unsigned int count,
 		return ret;
 
 	cache_ = new V4L2BufferCache(*buffers);
+	cache_->setEvictionPolicy(cachePolicy_);
+	cacheWindowStart_ = {};
 	memoryType_ = V4L2_MEMORY_MMAP;
 
 	return ret;
@@ -1347,12 +1609,143 @@ int V4L2VideoDevice::importBuffers(unsigned int count)
 		return ret;
 
 	cache_ = new V4L2BufferCache(count);
+	cache_->setEvictionPolicy(cachePolicy_);
+	cacheWindowStart_ = {};
 
 	LOG(V4L2, Debug) << "Prepared to import " << count << " buffers";
 
 	return 0;
 }
 
+/**
+ * \brief Add buffers to the buffers allocated or imported on the video device
+ * \param[in] count Number of buffers to add
+ * \param[out] buffers Vector to store the newly allocated buffers
+ *
+ * This function grows the pool of buffers previously initialized with
+ * allocateBuffers() or importBuffers() by \a count buffers, using the
+ * VIDIOC_CREATE_BUFS ioctl. Unlike releasing and reallocating buffers, this
+ * can be done while the video device is streaming, and allows absorbing load
+ * spikes by increasing the number of buffers in flight.
+ *
+ * When the device operates in MMAP mode (after allocateBuffers()), the new
+ * buffers are allocated using the currently active format on the device and
+ * exported as FrameBuffer objects appended to \a buffers, which must then not
+ * be null. When the device operates in DMABUF mode (after importBuffers()),
+ * the device is prepared to import \a count additional buffers, and
+ * \a buffers is ignored.
+ *
+ * The driver may create less buffers than requested. V4L2 doesn't allow
+ * freeing a subset of the buffers, all the buffers, including the ones added
+ * by this function, are freed by releaseBuffers().
+ *
+ * \return The number of buffers added on success or a negative error code
+ * otherwise
+ * \retval -EINVAL No buffers have been allocated or imported, or \a buffers
+ * is null in MMAP mode
+ */
+int V4L2VideoDevice::addBuffers(unsigned int count,
+				std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (!cache_) {
+		LOG(V4L2, Error) << "Buffers must be allocated or imported first";
+		return -EINVAL;
+	}
+
+	if (memoryType_ == V4L2_MEMORY_MMAP && !buffers) {
+		LOG(V4L2, Error) << "Allocated buffers can't be discarded";
+		return -EINVAL;
+	}
+
+	struct v4l2_create_buffers create = {};
+	create.count = count;
+	create.memory = memoryType_;
+	create.format.type = bufferType_;
+
+	int ret = ioctl(VIDIOC_G_FMT, &create.format);
+	if (ret) {
+		LOG(V4L2, Error) << "Unable to get format: " << strerror(-ret);
+		return ret;
+	}
+
+	/*
+	 * Allocated buffers are associated with their V4L2 buffer by the
+	 * cache, which requires the indexes to be contiguous. Buffers created
+	 * by VIDIOC_CREATE_BUFS can only be freed along with all the other
+	 * buffers, check the index the driver will use with a zero count first
+	 * to avoid leaking buffers that can't be used.
+	 */
+	if (memoryType_ == V4L2_MEMORY_MMAP) {
+		create.count = 0;
+
+		ret = ioctl(VIDIOC_CREATE_BUFS, &create);
+		if (ret < 0) {
+			LOG(V4L2, Error)
+				<< "Unable to query buffers index: "
+				<< strerror(-ret);
+			return ret;
+		}
+
+		if (create.index != cache_->size()) {
+			LOG(V4L2, Error)
+				<< "Unexpected buffer index " << create.index;
+			return -EINVAL;
+		}
+
+		create.count = count;
+	}
+
+	ret = ioctl(VIDIOC_CREATE_BUFS, &create);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to create " << count << " buffers: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	if (!create.count) {
+		LOG(V4L2, Error) << "No buffer created by the driver";
+		return -ENOMEM;
+	}
+
+	unsigned int total = create.index + create.count;
+
+	if (memoryType_ == V4L2_MEMORY_MMAP) {
+		std::vector<std::unique_ptr<FrameBuffer>> newBuffers;
+		for (unsigned int i = create.index; i < total; ++i) {
+			std::unique_ptr<FrameBuffer> buffer = createBuffer(i);
+			if (!buffer) {
+				LOG(V4L2, Error) << "Unable to create buffer";
+				return -EINVAL;
+			}
+
+			newBuffers.push_back(std::move(buffer));
+		}
+
+		cache_->addEntries(newBuffers);
+
+		for (std::unique_ptr<FrameBuffer> &buffer : newBuffers)
+			buffers->push_back(std::move(buffer));
+	} else {
+		/*
+		 * The driver may have provided more buffers than requested at
+		 * importBuffers() time, add them to the cache as well. The
+		 * cache may already hold more entries than the driver reports,
+		 * if it has been grown independently.
+		 */
+		if (total > cache_->size())
+			cache_->addEntries(total - cache_->size());
+	}
+
+	if (queuedBuffers_.size() < total)
+		queuedBuffers_.resize(total, nullptr);
+
+	LOG(V4L2, Debug)
+		<< "Added " << create.count << " buffers, " << total << " total";
+
+	return create.count;
+}
+
 /**
  * \brief Release resources allocated by allocateBuffers() or importBuffers()
  *
@@ -1371,26 +1764,156 @@ int V4L2VideoDevice::releaseBuffers()
 	return requestBuffers(0, memoryType_);
 }
 
+/**
+ * \brief Retrieve the usage statistics of the V4L2 buffer cache
+ *
+ * The V4L2 buffer cache is created when buffers are allocated or imported, and
+ * destroyed when they are released. The statistics are thus accumulated since
+ * the last call to allocateBuffers() or importBuffers(). This function is
+ * mostly useful for devices operating in import mode, where cache misses
+ * result in dmabufs being remapped by the kernel.
+ *
+ * \return The buffer cache statistics, or zeroed statistics if no buffers are
+ * allocated or imported
+ */
+V4L2BufferCache::Statistics V4L2VideoDevice::bufferCacheStatistics() const
+{
+	if (!cache_)
+		return {};
+
+	return cache_->statistics();
+}
+
+/**
+ * \brief Set the eviction policy of the V4L2 buffer cache
+ * \param[in] policy The eviction policy
+ *
+ * The policy applies to the current buffer cache, if any, and to all caches
+ * created by subsequent calls to allocateBuffers() and importBuffers().
+ */
+void V4L2VideoDevice::setBufferCacheEvictionPolicy(V4L2BufferCache::EvictionPolicy policy)
+{
+	cachePolicy_ = policy;
+
+	if (cache_)
+		cache_->setEvictionPolicy(policy);
+}
+
+/**
+ * \brief Enable automatic growth of the V4L2 buffer cache
+ * \param[in] maxEntries The maximum number of V4L2 buffers, 0 to disable
+ * growth
+ * \param[in] evictionThreshold The ratio of evictions to cache lookups above
+ * which the cache is grown
+ *
+ * When importing buffers, clients that rotate more dmabufs than the number of
+ * V4L2 buffers passed to importBuffers() cause constant cache evictions, each
+ * of them requiring dmabufs to be unmapped and remapped by the kernel. This
+ * function enables monitoring of the cache eviction rate. When the ratio of
+ * evictions to cache lookups exceeds \a evictionThreshold over a window of a
+ * few rotations of the cache, additional V4L2 buffers are created with
+ * addBuffers(), up to \a maxEntries buffers in total.
+ *
+ * Automatic growth only applies to devices operating in DMABUF mode.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a evictionThreshold is not in the ]0, 1] range
+ */
+int V4L2VideoDevice::setBufferCacheGrowth(unsigned int maxEntries,
+					  float evictionThreshold)
+{
+	if (evictionThreshold <= 0.0f || evictionThreshold > 1.0f) {
+		LOG(V4L2, Error)
+			<< "Invalid eviction threshold " << evictionThreshold;
+		return -EINVAL;
+	}
+
+	cacheMaxEntries_ = maxEntries;
+	cacheEvictionThreshold_ = evictionThreshold;
+
+	if (cache_)
+		cacheWindowStart_ = cache_->statistics();
+
+	return 0;
+}
+
+/**
+ * \brief Grow the V4L2 buffer cache if the eviction rate is too high
+ */
+void V4L2VideoDevice::growBufferCache()
+{
+	if (!cacheMaxEntries_ || memoryType_ != V4L2_MEMORY_DMABUF)
+		return;
+
+	unsigned int size = cache_->size();
+	if (size >= cacheMaxEntries_)
+		return;
+
+	const V4L2BufferCache::Statistics &stats = cache_->statistics();
+	uint64_t lookups = stats.hits + stats.misses;
+	uint64_t windowStart = cacheWindowStart_.hits + cacheWindowStart_.misses;
+
+	/* Restart the window if the statistics have been reset. */
+	if (lookups < windowStart) {
+		cacheWindowStart_ = stats;
+		return;
+	}
+
+	/* Evaluate the eviction rate over a few rotations of the cache. */
+	lookups -= windowStart;
+	if (lookups < size * 4)
+		return;
+
+	uint64_t evictions = stats.evictions - cacheWindowStart_.evictions;
+	cacheWindowStart_ = stats;
+
+	if (evictions <= lookups * cacheEvictionThreshold_)
+		return;
+
+	unsigned int count = std::min(std::max(size / 2, 1U),
+				      cacheMaxEntries_ - size);
+
+	LOG(V4L2, Debug)
+		<< evictions << " cache evictions in " << lookups
+		<< " lookups, adding " << count << " buffers";
+
+	addBuffers(count);
+}
+
+/**
+ * \fn V4L2VideoDevice::supportsRequests()
+ * \brief Check if the video device supports the media request API
+ *
+ * The information is reported by the driver when buffers are allocated or
+ * imported, this function shall thus only be called after allocateBuffers()
+ * or importBuffers().
+ *
+ * \return True if buffers can be bound to media requests, false otherwise
+ */
+
 /**
  * \brief Queue a buffer to the video device
  * \param[in] buffer The buffer to be queued
+ * \param[in] request The media request to bind the buffer to (optional)
  *
  * For capture video devices the \a buffer will be filled with data by the
  * device. For output video devices the \a buffer shall contain valid data and
  * will be processed by the device. Once the device has finished processing the
  * buffer, it will be available for dequeue.
  *
+ * If a media \a request is specified, the buffer is bound to the request and
+ * will only be processed by the device once the request is queued with
+ * MediaRequest::queue(). This allows controls set on the same request to be
+ * applied to the frame captured in \a buffer. Support for the request API
+ * can be checked with supportsRequests().
+ *
  * The best available V4L2 buffer is picked for \a buffer using the V4L2 buffer
  * cache.
  *
  * \return 0 on success or a negative error code otherwise
  */
-int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
+int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer, MediaRequest *request)
 {
-	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
-	struct v4l2_buffer buf = {};
-	int ret;
-
 	/*
 	 * Pipeline handlers should not requeue buffers after releasing the
 	 * buffers on the device. Any occurence of this error should be fixed
@@ -1401,6 +1924,95 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 		return -ENOENT;
 	}
 
+	bool wasEmpty = !queuedCount_;
+
+	int ret = enqueueBuffer(buffer, request);
+	if (ret < 0)
+		return ret;
+
+	LOG(V4L2, Debug) << "Queued buffer " << ret;
+
+	if (wasEmpty)
+		fdBufferNotifier_->setEnabled(true);
+
+	growBufferCache();
+
+	return 0;
+}
+
+/**
+ * \brief Queue multiple buffers to the video device
+ * \param[in] buffers The buffers to be queued
+ * \param[out] queued The number of buffers queued, may be nullptr
+ *
+ * This function queues all the \a buffers to the video device in order, and
+ * behaves as if queueBuffer() was called for each of them. It is meant to be
+ * used when a large number of buffers need to be queued at once, typically
+ * when starting a stream or when requeuing buffers after a stall, and avoids
+ * the per-buffer bookkeeping and logging overhead of queueBuffer().
+ *
+ * If a buffer fails to be queued, the buffers that precede it in \a buffers
+ * stay queued, and the buffers that follow it are not queued. The number of
+ * buffers successfully queued is returned in \a queued, if not null, for the
+ * caller to recover the buffers that haven't been queued.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::queueBuffers(Span<FrameBuffer *const> buffers,
+				  unsigned int *queued)
+{
+	unsigned int count = 0;
+
+	if (queued)
+		*queued = 0;
+
+	if (!cache_) {
+		LOG(V4L2, Fatal) << "No BufferCache available to queue.";
+		return -ENOENT;
+	}
+
+	bool wasEmpty = !queuedCount_;
+	int ret = 0;
+
+	for (FrameBuffer *buffer : buffers) {
+		ret = enqueueBuffer(buffer, nullptr);
+		if (ret < 0)
+			break;
+
+		count++;
+	}
+
+	LOG(V4L2, Debug) << "Queued " << count << " buffers";
+
+	if (wasEmpty && count)
+		fdBufferNotifier_->setEnabled(true);
+
+	growBufferCache();
+
+	if (queued)
+		*queued = count;
+
+	return ret < 0 ? ret : 0;
+}
+
+/**
+ * \brief Queue a single buffer to the video device
+ * \param[in] buffer The buffer to be queued
+ * \param[in] request The media request to bind the buffer to, or nullptr
+ *
+ * This function implements the common part of queueBuffer() and
+ * queueBuffers(). It picks a V4L2 buffer for \a buffer from the cache, queues
+ * it to the device and records it in the queued buffers, but leaves enabling
+ * the buffer notifier to the caller.
+ *
+ * \return The V4L2 buffer index on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::enqueueBuffer(FrameBuffer *buffer, MediaRequest *request)
+{
+	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
+	struct v4l2_buffer buf = {};
+	int ret;
+
 	ret = cache_->get(*buffer);
 	if (ret < 0)
 		return ret;
@@ -1410,6 +2022,11 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 	buf.memory = memoryType_;
 	buf.field = V4L2_FIELD_NONE;
 
+	if (request) {
+		buf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf.request_fd = request->fd();
+	}
+
 	bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(buf.type);
 	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
 
@@ -1447,20 +2064,55 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 		buf.timestamp.tv_usec = (metadata.timestamp / 1000) % 1000000;
 	}
 
-	LOG(V4L2, Debug) << "Queueing buffer " << buf.index;
-
 	ret = ioctl(VIDIOC_QBUF, &buf);
 	if (ret < 0) {
 		LOG(V4L2, Error)
 			<< "Failed to queue buffer " << buf.index << ": "
 			<< strerror(-ret);
+		cache_->put(buf.index);
 		return ret;
 	}
 
-	if (queuedBuffers_.empty())
-		fdBufferNotifier_->setEnabled(true);
+	LIBCAMERA_TRACEPOINT(v4l2_buffer_queue, this, &buf);
 
 	queuedBuffers_[buf.index] = buffer;
+	queuedCount_++;
+
+	return buf.index;
+}
+
+/**
+ * \brief Enable or disable draining of all ready buffers on each event
+ * \param[in] enable True to drain all ready buffers, false to dequeue a single
+ * buffer per event
+ *
+ * By default, a single buffer is dequeued and emitted through the bufferReady
+ * signal each time the video device signals that buffers are available. At
+ * high frame rates, or when the event loop has been blocked for some time,
+ * multiple buffers may be ready at once, and dequeuing them one by one costs
+ * a round-trip through the event dispatcher for each buffer.
+ *
+ * When buffer draining is enabled, buffers are dequeued and emitted in a loop
+ * until the device reports that no more buffers are ready. This requires the
+ * device file descriptor to be in non-blocking mode, which is always the case
+ * for devices opened with open(), but may not be the case for devices opened
+ * from an existing file handle.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The device file descriptor is in blocking mode
+ */
+int V4L2VideoDevice::setBufferDrainingEnabled(bool enable)
+{
+	if (enable) {
+		int flags = fcntl(fd(), F_GETFL);
+		if (flags < 0 || !(flags & O_NONBLOCK)) {
+			LOG(V4L2, Error)
+				<< "Buffer draining requires a non-blocking device";
+			return -EINVAL;
+		}
+	}
+
+	drainBuffers_ = enable;
 
 	return 0;
 }
@@ -1470,7 +2122,8 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
  * \param[in] notifier The event notifier
  *
  * When this slot is called, a Buffer has become available from the device, and
- * will be emitted through the bufferReady Signal.
+ * will be emitted through the bufferReady Signal. If buffer draining is
+ * enabled, all other buffers ready to be dequeued are emitted as well.
  *
  * For Capture video devices the FrameBuffer will contain valid data.
  * For Output video devices the FrameBuffer can be considered empty.
@@ -1483,6 +2136,22 @@ void V4L2VideoDevice::bufferAvailable([[maybe_unused]] EventNotifier *notifier)
 
 	/* Notify anyone listening to the device. */
 	bufferReady.emit(buffer);
+
+	if (!drainBuffers_)
+		return;
+
+	/*
+	 * Dequeue all the other buffers that are already available. The
+	 * bufferReady handlers may stop the stream, in which case all the
+	 * queued buffers have been returned and the loop terminates.
+	 */
+	while (queuedCount_) {
+		buffer = dequeueBuffer();
+		if (!buffer)
+			break;
+
+		bufferReady.emit(buffer);
+	}
 }
 
 /**
@@ -1496,20 +2165,29 @@ void V4L2VideoDevice::bufferAvailable([[maybe_unused]] EventNotifier *notifier)
 FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 {
 	struct v4l2_buffer buf = {};
-	struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
 	int ret;
 
 	buf.type = bufferType_;
 	buf.memory = memoryType_;
 
+	/*
+	 * Single-planar buffers, which include all metadata buffers, don't
+	 * need the planes array. Skip its initialization as metadata devices
+	 * complete buffers at the full sensor frame rate.
+	 */
 	bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(buf.type);
 
 	if (multiPlanar) {
+		memset(planes, 0, sizeof(planes));
 		buf.length = VIDEO_MAX_PLANES;
 		buf.m.planes = planes;
 	}
 
 	ret = ioctl(VIDIOC_DQBUF, &buf);
+	if (ret == -EAGAIN)
+		return nullptr;
+
 	if (ret < 0) {
 		LOG(V4L2, Error)
 			<< "Failed to dequeue buffer: " << strerror(-ret);
@@ -1518,30 +2196,45 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 
 	LOG(V4L2, Debug) << "Dequeuing buffer " << buf.index;
 
+	if (buf.index >= queuedBuffers_.size() || !queuedBuffers_[buf.index]) {
+		LOG(V4L2, Error)
+			<< "Dequeued unexpected buffer " << buf.index;
+		return nullptr;
+	}
+
 	cache_->put(buf.index);
 
-	auto it = queuedBuffers_.find(buf.index);
-	FrameBuffer *buffer = it->second;
-	queuedBuffers_.erase(it);
+	FrameBuffer *buffer = queuedBuffers_[buf.index];
+	queuedBuffers_[buf.index] = nullptr;
+	queuedCount_--;
 
-	if (queuedBuffers_.empty())
+	if (!queuedCount_)
 		fdBufferNotifier_->setEnabled(false);
 
-	buffer->metadata_.status = buf.flags & V4L2_BUF_FLAG_ERROR
-				 ? FrameMetadata::FrameError
-				 : FrameMetadata::FrameSuccess;
-	buffer->metadata_.sequence = buf.sequence;
-	buffer->metadata_.timestamp = buf.timestamp.tv_sec * 1000000000ULL
-				    + buf.timestamp.tv_usec * 1000ULL;
+	FrameMetadata &metadata = buffer->metadata_;
+
+	metadata.status = buf.flags & V4L2_BUF_FLAG_ERROR
+			? FrameMetadata::FrameError
+			: FrameMetadata::FrameSuccess;
+	metadata.sequence = buf.sequence;
+	metadata.timestamp = buf.timestamp.tv_sec * 1000000000ULL
+			   + buf.timestamp.tv_usec * 1000ULL;
 
-	buffer->metadata_.planes.clear();
+	/*
+	 * Update the planes metadata in place, the number of planes of a
+	 * buffer doesn't change between dequeues.
+	 */
 	if (multiPlanar) {
+		metadata.planes.resize(buf.length);
 		for (unsigned int nplane = 0; nplane < buf.length; nplane++)
-			buffer->metadata_.planes.push_back({ planes[nplane].bytesused });
+			metadata.planes[nplane].bytesused = planes[nplane].bytesused;
 	} else {
-		buffer->metadata_.planes.push_back({ buf.bytesused });
+		metadata.planes.resize(1);
+		metadata.planes[0].bytesused = buf.bytesused;
 	}
 
+	LIBCAMERA_TRACEPOINT(v4l2_buffer_dequeue, this, &buf);
+
 	return buffer;
 }
 
@@ -1587,7 +2280,7 @@ int V4L2VideoDevice::streamOff()
 {
 	int ret;
 
-	if (!streaming_ && queuedBuffers_.empty())
+	if (!streaming_ && !queuedCount_)
 		return 0;
 
 	ret = ioctl(VIDIOC_STREAMOFF, &bufferType_);
@@ -1598,14 +2291,18 @@ int V4L2VideoDevice::streamOff()
 	}
 
 	/* Send back all queued buffers. */
-	for (auto it : queuedBuffers_) {
-		FrameBuffer *buffer = it.second;
+	for (FrameBuffer *&buffer : queuedBuffers_) {
+		if (!buffer)
+			continue;
 
-		buffer->metadata_.status = FrameMetadata::FrameCancelled;
-		bufferReady.emit(buffer);
+		FrameBuffer *cancelled = buffer;
+		buffer = nullptr;
+		queuedCount_--;
+
+		cancelled->metadata_.status = FrameMetadata::FrameCancelled;
+		bufferReady.emit(cancelled);
 	}
 
-	queuedBuffers_.clear();
 	fdBufferNotifier_->setEnabled(false);
 	streaming_ = false;
 
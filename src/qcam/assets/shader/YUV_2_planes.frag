@@ -12,6 +12,7 @@ precision mediump float;
 varying vec2 textureOut;
 uniform sampler2D tex_y;
 uniform sampler2D tex_u;
+uniform float tex_uv_rg;
 
 void main(void)
 {
@@ -23,13 +24,21 @@ void main(void)
 		vec3(1.596, -0.813, 0.000)
 	);
 
+	/*
+	 * The chroma plane is stored in the luminance and alpha components of
+	 * uploaded textures, and in the red and green components of textures
+	 * imported from dmabufs, as selected by tex_uv_rg.
+	 */
+	vec4 uv = texture2D(tex_u, textureOut);
+	float uv1 = mix(uv.a, uv.g, tex_uv_rg);
+
 	yuv.x = texture2D(tex_y, textureOut).r - 0.063;
 #if defined(YUV_PATTERN_UV)
-	yuv.y = texture2D(tex_u, textureOut).r - 0.500;
-	yuv.z = texture2D(tex_u, textureOut).a - 0.500;
+	yuv.y = uv.r - 0.500;
+	yuv.z = uv1 - 0.500;
 #elif defined(YUV_PATTERN_VU)
-	yuv.y = texture2D(tex_u, textureOut).a - 0.500;
-	yuv.z = texture2D(tex_u, textureOut).r - 0.500;
+	yuv.y = uv1 - 0.500;
+	yuv.z = uv.r - 0.500;
 #else
 #error Invalid pattern
 #endif
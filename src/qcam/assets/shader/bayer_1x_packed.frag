@@ -66,6 +66,14 @@ uniform vec2 tex_bayer_first_red;
 
 uniform sampler2D tex_y;
 
+/*
+ * Black levels in the [0, 1] range, white balance gains and colour correction
+ * matrix, applied after demosaicing. The defaults leave the colours unchanged.
+ */
+uniform vec3 tex_black_level;
+uniform vec3 tex_wb_gains;
+uniform mat3 tex_ccm;
+
 void main(void)
 {
 	vec3 rgb;
@@ -212,5 +220,8 @@ void main(void)
 			vec3(patterns.y, C, patterns.x) :
 			vec3(patterns.wz, C));
 
+	rgb = (rgb - tex_black_level) / (vec3(1.0) - tex_black_level);
+	rgb = clamp(tex_ccm * (rgb * tex_wb_gains), 0.0, 1.0);
+
 	gl_FragColor = vec4(rgb, 1.0);
 }
@@ -18,6 +18,13 @@ Copyright (C) 2021, Linaro
 
 /** Monochrome RGBA or GL_LUMINANCE Bayer encoded texture.*/
 uniform sampler2D       tex_y;
+
+/** Black levels in the [0, 1] range, white balance gains and colour correction
+ *  matrix, applied after demosaicing. The defaults leave the colours unchanged.
+ */
+uniform vec3            tex_black_level;
+uniform vec3            tex_wb_gains;
+uniform mat3            tex_ccm;
 varying vec4            center;
 varying vec4            yCoord;
 varying vec4            xCoord;
@@ -94,11 +101,16 @@ void main(void) {
     PATTERN.xw  += kB.xw * B;
     PATTERN.xz  += kF.xz * F;
 
-    gl_FragColor.rgb = (alternate.y == 0.0) ?
+    vec3 rgb = (alternate.y == 0.0) ?
         ((alternate.x == 0.0) ?
             vec3(C, PATTERN.xy) :
             vec3(PATTERN.z, C, PATTERN.w)) :
         ((alternate.x == 0.0) ?
             vec3(PATTERN.w, C, PATTERN.z) :
             vec3(PATTERN.yx, C));
+
+    rgb = (rgb - tex_black_level) / (vec3(1.0) - tex_black_level);
+    rgb = clamp(tex_ccm * (rgb * tex_wb_gains), 0.0, 1.0);
+
+    gl_FragColor = vec4(rgb, 1.0);
 }
@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <iostream>
 #include <map>
+#include <vector>
 
 #include <tiffio.h>
 
@@ -17,6 +18,9 @@
 #include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 
+#include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/v4l2_pixelformat.h"
+
 using namespace libcamera;
 
 enum CFAPatternColour : uint8_t {
@@ -28,8 +32,6 @@ enum CFAPatternColour : uint8_t {
 struct FormatInfo {
 	uint8_t bitsPerSample;
 	CFAPatternColour pattern[4];
-	void (*packScanline)(void *output, const void *input,
-			     unsigned int width);
 	void (*thumbScanline)(const FormatInfo &info, void *output,
 			      const void *input, unsigned int width,
 			      unsigned int stride);
@@ -126,34 +128,40 @@ struct Matrix3d {
 	float m[9];
 };
 
-void packScanlineSBGGR10P(void *output, const void *input, unsigned int width)
+/*
+ * Pack a line of samples unpacked to 16 bits in the DNG RAW layout. Samples are
+ * scaled from the \a bitDepth of the format to \a bitsPerSample, and stored
+ * most significant bits first without padding, or as native 16-bit words.
+ */
+void packScanline(void *output, const uint16_t *samples, unsigned int width,
+		  unsigned int bitDepth, unsigned int bitsPerSample)
 {
-	const uint8_t *in = static_cast<const uint8_t *>(input);
-	uint8_t *out = static_cast<uint8_t *>(output);
+	const unsigned int shift = bitsPerSample - bitDepth;
+
+	if (bitsPerSample == 16) {
+		uint16_t *out = static_cast<uint16_t *>(output);
 
-	/* \todo Can this be made more efficient? */
-	for (unsigned int x = 0; x < width; x += 4) {
-		*out++ = in[0];
-		*out++ = (in[4] & 0x03) << 6 | in[1] >> 2;
-		*out++ = (in[1] & 0x03) << 6 | (in[4] & 0x0c) << 2 | in[2] >> 4;
-		*out++ = (in[2] & 0x0f) << 4 | (in[4] & 0x30) >> 2 | in[3] >> 6;
-		*out++ = (in[3] & 0x3f) << 2 | (in[4] & 0xc0) >> 6;
-		in += 5;
+		for (unsigned int x = 0; x < width; x++)
+			*out++ = samples[x] << shift;
+		return;
 	}
-}
 
-void packScanlineSBGGR12P(void *output, const void *input, unsigned int width)
-{
-	const uint8_t *in = static_cast<const uint8_t *>(input);
 	uint8_t *out = static_cast<uint8_t *>(output);
+	uint32_t bits = 0;
+	unsigned int count = 0;
+
+	for (unsigned int x = 0; x < width; x++) {
+		bits = bits << bitsPerSample | (samples[x] << shift);
+		count += bitsPerSample;
 
-	/* \todo Can this be made more efficient? */
-	for (unsigned int i = 0; i < width; i += 2) {
-		*out++ = in[0];
-		*out++ = (in[2] & 0x0f) << 4 | in[1] >> 4;
-		*out++ = (in[1] & 0x0f) << 4 | in[2] >> 4;
-		in += 3;
+		while (count >= 8) {
+			count -= 8;
+			*out++ = bits >> count;
+		}
 	}
+
+	if (count)
+		*out++ = bits << (8 - count);
 }
 
 void thumbScanlineSBGGRxxP(const FormatInfo &info, void *output,
@@ -175,47 +183,6 @@ void thumbScanlineSBGGRxxP(const FormatInfo &info, void *output,
 	}
 }
 
-void packScanlineIPU3(void *output, const void *input, unsigned int width)
-{
-	const uint8_t *in = static_cast<const uint8_t *>(input);
-	uint16_t *out = static_cast<uint16_t *>(output);
-
-	/*
-	 * Upscale the 10-bit format to 16-bit as it's not trivial to pack it
-	 * as 10-bit without gaps.
-	 *
-	 * \todo Improve packing to keep the 10-bit sample size.
-	 */
-	unsigned int x = 0;
-	while (true) {
-		for (unsigned int i = 0; i < 6; i++) {
-			*out++ = (in[1] & 0x03) << 14 | (in[0] & 0xff) << 6;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[2] & 0x0f) << 12 | (in[1] & 0xfc) << 4;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[3] & 0x3f) << 10 | (in[2] & 0xf0) << 2;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[4] & 0xff) <<  8 | (in[3] & 0xc0) << 0;
-			if (++x >= width)
-				return;
-
-			in += 5;
-		}
-
-		*out++ = (in[1] & 0x03) << 14 | (in[0] & 0xff) << 6;
-		if (++x >= width)
-			return;
-
-		in += 2;
-	}
-}
-
 void thumbScanlineIPU3([[maybe_unused]] const FormatInfo &info, void *output,
 		       const void *input, unsigned int width,
 		       unsigned int stride)
@@ -277,73 +244,61 @@ static const std::map<PixelFormat, FormatInfo> formatInfo = {
 	{ formats::SBGGR10_CSI2P, {
 		.bitsPerSample = 10,
 		.pattern = { CFAPatternBlue, CFAPatternGreen, CFAPatternGreen, CFAPatternRed },
-		.packScanline = packScanlineSBGGR10P,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SGBRG10_CSI2P, {
 		.bitsPerSample = 10,
 		.pattern = { CFAPatternGreen, CFAPatternBlue, CFAPatternRed, CFAPatternGreen },
-		.packScanline = packScanlineSBGGR10P,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SGRBG10_CSI2P, {
 		.bitsPerSample = 10,
 		.pattern = { CFAPatternGreen, CFAPatternRed, CFAPatternBlue, CFAPatternGreen },
-		.packScanline = packScanlineSBGGR10P,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SRGGB10_CSI2P, {
 		.bitsPerSample = 10,
 		.pattern = { CFAPatternRed, CFAPatternGreen, CFAPatternGreen, CFAPatternBlue },
-		.packScanline = packScanlineSBGGR10P,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SBGGR12_CSI2P, {
 		.bitsPerSample = 12,
 		.pattern = { CFAPatternBlue, CFAPatternGreen, CFAPatternGreen, CFAPatternRed },
-		.packScanline = packScanlineSBGGR12P,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SGBRG12_CSI2P, {
 		.bitsPerSample = 12,
 		.pattern = { CFAPatternGreen, CFAPatternBlue, CFAPatternRed, CFAPatternGreen },
-		.packScanline = packScanlineSBGGR12P,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SGRBG12_CSI2P, {
 		.bitsPerSample = 12,
 		.pattern = { CFAPatternGreen, CFAPatternRed, CFAPatternBlue, CFAPatternGreen },
-		.packScanline = packScanlineSBGGR12P,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SRGGB12_CSI2P, {
 		.bitsPerSample = 12,
 		.pattern = { CFAPatternRed, CFAPatternGreen, CFAPatternGreen, CFAPatternBlue },
-		.packScanline = packScanlineSBGGR12P,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SBGGR10_IPU3, {
 		.bitsPerSample = 16,
 		.pattern = { CFAPatternBlue, CFAPatternGreen, CFAPatternGreen, CFAPatternRed },
-		.packScanline = packScanlineIPU3,
 		.thumbScanline = thumbScanlineIPU3,
 	} },
 	{ formats::SGBRG10_IPU3, {
 		.bitsPerSample = 16,
 		.pattern = { CFAPatternGreen, CFAPatternBlue, CFAPatternRed, CFAPatternGreen },
-		.packScanline = packScanlineIPU3,
 		.thumbScanline = thumbScanlineIPU3,
 	} },
 	{ formats::SGRBG10_IPU3, {
 		.bitsPerSample = 16,
 		.pattern = { CFAPatternGreen, CFAPatternRed, CFAPatternBlue, CFAPatternGreen },
-		.packScanline = packScanlineIPU3,
 		.thumbScanline = thumbScanlineIPU3,
 	} },
 	{ formats::SRGGB10_IPU3, {
 		.bitsPerSample = 16,
 		.pattern = { CFAPatternRed, CFAPatternGreen, CFAPatternGreen, CFAPatternBlue },
-		.packScanline = packScanlineIPU3,
 		.thumbScanline = thumbScanlineIPU3,
 	} },
 };
@@ -553,9 +508,15 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 	TIFFSetField(tif, TIFFTAG_WHITELEVEL, 1, &whiteLevel);
 
 	/* Write RAW content. */
+	const BayerFormat bayer = BayerFormat::fromV4L2PixelFormat(
+		V4L2PixelFormat::fromPixelFormat(config.pixelFormat, false));
+	std::vector<uint16_t> samples(config.size.width);
+
 	row = static_cast<const uint8_t *>(data);
 	for (unsigned int y = 0; y < config.size.height; y++) {
-		info->packScanline(&scanline, row, config.size.width);
+		bayer.unpackLine(row, samples.data(), config.size.width);
+		packScanline(&scanline, samples.data(), config.size.width,
+			     bayer.bitDepth, info->bitsPerSample);
 
 		if (TIFFWriteScanline(tif, &scanline, y, 0) != 1) {
 			std::cerr << "Failed to write RAW scanline"
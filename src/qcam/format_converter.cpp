@@ -7,9 +7,18 @@
 
 #include "format_converter.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <functional>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <QImage>
+#include <QRunnable>
 
 #include <libcamera/formats.h>
 
@@ -27,6 +36,33 @@
 #define CLIP(x)			CLAMP(x,0,255)
 #endif
 
+/*
+ * Frames smaller than this are converted in the caller's thread, as the cost
+ * of dispatching strips to the thread pool would outweigh the gain.
+ */
+static constexpr unsigned int kParallelThreshold = 640 * 480;
+
+namespace {
+
+class StripTask : public QRunnable
+{
+public:
+	StripTask(std::function<void()> func)
+		: func_(std::move(func))
+	{
+	}
+
+	void run() override
+	{
+		func_();
+	}
+
+private:
+	std::function<void()> func_;
+};
+
+} /* namespace */
+
 int FormatConverter::configure(const libcamera::PixelFormat &format,
 			       const QSize &size)
 {
@@ -157,86 +193,345 @@ int FormatConverter::configure(const libcamera::PixelFormat &format,
 void FormatConverter::convert(const unsigned char *src, size_t size,
 			      QImage *dst)
 {
+	ConvertFunc func;
+
 	switch (formatFamily_) {
 	case MJPEG:
 		dst->loadFromData(src, size, "JPEG");
-		break;
+		return;
 	case YUV:
-		convertYUV(src, dst->bits());
+		func = &FormatConverter::convertYUV;
 		break;
 	case RGB:
-		convertRGB(src, dst->bits());
+		func = &FormatConverter::convertRGB;
 		break;
 	case NV:
-		convertNV(src, dst->bits());
+		func = &FormatConverter::convertNV;
 		break;
+	default:
+		return;
 	};
+
+	unsigned char *bits = dst->bits();
+
+	/*
+	 * Split large frames in strips of rows, converted concurrently by the
+	 * thread pool and the caller's thread.
+	 */
+	unsigned int strips = 1;
+	if (width_ * height_ >= kParallelThreshold)
+		strips = std::clamp<unsigned int>(pool_.maxThreadCount(), 1,
+						  height_);
+
+	for (unsigned int strip = 1; strip < strips; ++strip) {
+		unsigned int begin = height_ * strip / strips;
+		unsigned int end = height_ * (strip + 1) / strips;
+
+		pool_.start(new StripTask([this, func, src, bits, begin, end]() {
+			(this->*func)(src, bits, begin, end);
+		}));
+	}
+
+	(this->*func)(src, bits, 0, height_ / strips);
+
+	if (strips > 1)
+		pool_.waitForDone();
+}
+
+/*
+ * The row conversion functions below process one chroma sample per iteration,
+ * and compute its contributions once for all the luma samples it applies to.
+ * Horizontally subsampled NV and packed YUV rows are converted by SIMD kernels
+ * when available, the scalar loops convert the remaining pixels. All
+ * implementations produce identical results.
+ */
+static inline void yuv_to_rgb32(int y, int r_uv, int g_uv, int b_uv,
+				unsigned char *dst)
+{
+	int c = 298 * (y - 16) + 128;
+
+	dst[0] = CLIP((c + b_uv) >> RGBSHIFT);
+	dst[1] = CLIP((c + g_uv) >> RGBSHIFT);
+	dst[2] = CLIP((c + r_uv) >> RGBSHIFT);
+	dst[3] = 0xff;
 }
 
-static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
+#if defined(__SSE2__)
+
+static inline __m128i sse2_pair(int16_t first, int16_t second)
+{
+	return _mm_set1_epi32(static_cast<uint16_t>(first) |
+			      static_cast<uint32_t>(static_cast<uint16_t>(second)) << 16);
+}
+
+/*
+ * Convert 8 pixels. The luma samples are stored as 16-bit integers in y, and
+ * the chroma samples of pixels 0-3 and 4-7 as pairs of 16-bit integers, offset
+ * by -128, in uv_lo and uv_hi. The order of the chroma samples in the pairs is
+ * reflected by the coefficients in k, for the blue, green and red components.
+ */
+static inline void sse2_convert8(__m128i y, __m128i uv_lo, __m128i uv_hi,
+				 const __m128i *k, unsigned char *dst)
 {
-	int c = y - 16;
-	int d = u - 128;
-	int e = v - 128;
-	*r = CLIP(( 298 * c           + 409 * e + 128) >> RGBSHIFT);
-	*g = CLIP(( 298 * c - 100 * d - 208 * e + 128) >> RGBSHIFT);
-	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
+	/* Compute 298 * (y - 16) + 128 with a multiply-add of (y - 16, 1). */
+	const __m128i ky = sse2_pair(298, 128);
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i rgb[3];
+
+	y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	__m128i c_lo = _mm_madd_epi16(_mm_unpacklo_epi16(y, one), ky);
+	__m128i c_hi = _mm_madd_epi16(_mm_unpackhi_epi16(y, one), ky);
+
+	for (unsigned int i = 0; i < 3; i++) {
+		__m128i lo = _mm_srai_epi32(_mm_add_epi32(c_lo, _mm_madd_epi16(uv_lo, k[i])),
+					    RGBSHIFT);
+		__m128i hi = _mm_srai_epi32(_mm_add_epi32(c_hi, _mm_madd_epi16(uv_hi, k[i])),
+					    RGBSHIFT);
+		__m128i value = _mm_packs_epi32(lo, hi);
+		rgb[i] = _mm_packus_epi16(value, value);
+	}
+
+	__m128i bg = _mm_unpacklo_epi8(rgb[0], rgb[1]);
+	__m128i ra = _mm_unpacklo_epi8(rgb[2], _mm_set1_epi8(-1));
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+			 _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16),
+			 _mm_unpackhi_epi16(bg, ra));
+}
+
+static inline void sse2_coefficients(bool swap, __m128i *k)
+{
+	if (!swap) {
+		k[0] = sse2_pair(516, 0);
+		k[1] = sse2_pair(-100, -208);
+		k[2] = sse2_pair(0, 409);
+	} else {
+		k[0] = sse2_pair(0, 516);
+		k[1] = sse2_pair(-208, -100);
+		k[2] = sse2_pair(409, 0);
+	}
 }
 
-void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst)
+/* Convert the first pixels of a row with 2x horizontally subsampled chroma. */
+static unsigned int convert_nv_row_simd(const unsigned char *src_y,
+					const unsigned char *src_c,
+					unsigned int width, bool swap,
+					unsigned char *dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i offset = _mm_set1_epi16(128);
+	__m128i k[3];
+	unsigned int x;
+
+	sse2_coefficients(swap, k);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i y = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src_y + x));
+		__m128i c = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src_c + x));
+
+		y = _mm_unpacklo_epi8(y, zero);
+		c = _mm_sub_epi16(_mm_unpacklo_epi8(c, zero), offset);
+
+		/* Duplicate the chroma pairs for the two pixels they cover. */
+		sse2_convert8(y, _mm_unpacklo_epi32(c, c), _mm_unpackhi_epi32(c, c),
+			      k, dst + x * 4);
+	}
+
+	return x;
+}
+
+/* Convert the first pixels of a packed YUV row. */
+static unsigned int convert_yuv_row_simd(const unsigned char *src,
+					 unsigned int width, unsigned int y_pos,
+					 unsigned int cb_pos, unsigned char *dst)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	const __m128i offset = _mm_set1_epi16(128);
+	__m128i k[3];
+	unsigned int x;
+
+	/* The chroma pairs are stored in the Cr, Cb order for VYUY and YVYU. */
+	sse2_coefficients(cb_pos >= 2, k);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2));
+		__m128i even = _mm_and_si128(pixels, mask);
+		__m128i odd = _mm_srli_epi16(pixels, 8);
+		__m128i y = y_pos & 1 ? odd : even;
+		__m128i c = _mm_sub_epi16(y_pos & 1 ? even : odd, offset);
+
+		sse2_convert8(y, _mm_unpacklo_epi32(c, c), _mm_unpackhi_epi32(c, c),
+			      k, dst + x * 4);
+	}
+
+	return x;
+}
+
+#elif defined(__ARM_NEON)
+
+static inline uint8x8_t neon_component(int16x8_t c, int16x8_t d, int16x8_t e,
+				       int16_t kd, int16_t ke)
+{
+	int32x4_t lo = vmull_n_s16(vget_low_s16(c), 298);
+	int32x4_t hi = vmull_n_s16(vget_high_s16(c), 298);
+
+	lo = vmlal_n_s16(lo, vget_low_s16(d), kd);
+	hi = vmlal_n_s16(hi, vget_high_s16(d), kd);
+	lo = vmlal_n_s16(lo, vget_low_s16(e), ke);
+	hi = vmlal_n_s16(hi, vget_high_s16(e), ke);
+
+	/* Round, shift and clip to [0, 255]. */
+	int16x8_t value = vcombine_s16(vqrshrn_n_s32(lo, RGBSHIFT),
+				       vqrshrn_n_s32(hi, RGBSHIFT));
+	return vqmovun_s16(value);
+}
+
+/* Convert 8 pixels from their luma and chroma samples. */
+static inline void neon_convert8(uint8x8_t y, uint8x8_t u, uint8x8_t v,
+				 unsigned char *dst)
+{
+	int16x8_t c = vreinterpretq_s16_u16(vsubl_u8(y, vdup_n_u8(16)));
+	int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(u, vdup_n_u8(128)));
+	int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(v, vdup_n_u8(128)));
+	uint8x8x4_t bgra;
+
+	bgra.val[0] = neon_component(c, d, e, 516, 0);
+	bgra.val[1] = neon_component(c, d, e, -100, -208);
+	bgra.val[2] = neon_component(c, d, e, 0, 409);
+	bgra.val[3] = vdup_n_u8(0xff);
+
+	vst4_u8(dst, bgra);
+}
+
+/* Convert the first pixels of a row with 2x horizontally subsampled chroma. */
+static unsigned int convert_nv_row_simd(const unsigned char *src_y,
+					const unsigned char *src_c,
+					unsigned int width, bool swap,
+					unsigned char *dst)
+{
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x8x2_t c = vld2_u8(src_c + x);
+		uint8x8x2_t u = vzip_u8(c.val[swap ? 1 : 0], c.val[swap ? 1 : 0]);
+		uint8x8x2_t v = vzip_u8(c.val[swap ? 0 : 1], c.val[swap ? 0 : 1]);
+
+		neon_convert8(vld1_u8(src_y + x), u.val[0], v.val[0], dst + x * 4);
+		neon_convert8(vld1_u8(src_y + x + 8), u.val[1], v.val[1],
+			      dst + x * 4 + 32);
+	}
+
+	return x;
+}
+
+/* Convert the first pixels of a packed YUV row. */
+static unsigned int convert_yuv_row_simd(const unsigned char *src,
+					 unsigned int width, unsigned int y_pos,
+					 unsigned int cb_pos, unsigned char *dst)
+{
+	unsigned int cr_pos = (cb_pos + 2) % 4;
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		/* De-interleave the bytes of 8 macropixels. */
+		uint8x8x4_t pixels = vld4_u8(src + x * 2);
+		uint8x8x2_t y = vzip_u8(pixels.val[y_pos], pixels.val[y_pos + 2]);
+		uint8x8x2_t u = vzip_u8(pixels.val[cb_pos], pixels.val[cb_pos]);
+		uint8x8x2_t v = vzip_u8(pixels.val[cr_pos], pixels.val[cr_pos]);
+
+		neon_convert8(y.val[0], u.val[0], v.val[0], dst + x * 4);
+		neon_convert8(y.val[1], u.val[1], v.val[1], dst + x * 4 + 32);
+	}
+
+	return x;
+}
+
+#else
+
+static unsigned int convert_nv_row_simd([[maybe_unused]] const unsigned char *src_y,
+					[[maybe_unused]] const unsigned char *src_c,
+					[[maybe_unused]] unsigned int width,
+					[[maybe_unused]] bool swap,
+					[[maybe_unused]] unsigned char *dst)
+{
+	return 0;
+}
+
+static unsigned int convert_yuv_row_simd([[maybe_unused]] const unsigned char *src,
+					 [[maybe_unused]] unsigned int width,
+					 [[maybe_unused]] unsigned int y_pos,
+					 [[maybe_unused]] unsigned int cb_pos,
+					 [[maybe_unused]] unsigned char *dst)
+{
+	return 0;
+}
+
+#endif
+
+template<unsigned int HorzSubSample, bool Swap>
+static void convert_nv_row(const unsigned char *src_y,
+			   const unsigned char *src_c, unsigned int width,
+			   unsigned char *dst)
+{
+	constexpr unsigned int cb_pos = Swap ? 1 : 0;
+	constexpr unsigned int cr_pos = Swap ? 0 : 1;
+	unsigned int start = 0;
+
+	if (HorzSubSample == 2)
+		start = convert_nv_row_simd(src_y, src_c, width, Swap, dst) / 2;
+
+	for (unsigned int x = start; x < width / HorzSubSample; x++) {
+		int d = src_c[x * 2 + cb_pos] - 128;
+		int e = src_c[x * 2 + cr_pos] - 128;
+		int r_uv = 409 * e;
+		int g_uv = -100 * d - 208 * e;
+		int b_uv = 516 * d;
+
+		for (unsigned int i = 0; i < HorzSubSample; i++)
+			yuv_to_rgb32(src_y[x * HorzSubSample + i], r_uv, g_uv,
+				     b_uv, dst + (x * HorzSubSample + i) * 4);
+	}
+}
+
+void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst,
+				unsigned int begin, unsigned int end)
 {
 	unsigned int c_stride = width_ * (2 / horzSubSample_);
-	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
-	unsigned int cb_pos = nvSwap_ ? 1 : 0;
-	unsigned int cr_pos = nvSwap_ ? 0 : 1;
 	const unsigned char *src_c = src + width_ * height_;
-	int r, g, b;
-
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *src_y = src + y * width_;
-		const unsigned char *src_cb = src_c + (y / vertSubSample_) *
-					      c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample_) *
-					      c_stride + cr_pos;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += c_inc;
-			src_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += 2;
-			src_cr += 2;
-			dst += 4;
-		}
-	}
+	void (*convert_row)(const unsigned char *, const unsigned char *,
+			    unsigned int, unsigned char *);
+
+	if (horzSubSample_ == 1)
+		convert_row = nvSwap_ ? convert_nv_row<1, true>
+				      : convert_nv_row<1, false>;
+	else
+		convert_row = nvSwap_ ? convert_nv_row<2, true>
+				      : convert_nv_row<2, false>;
+
+	for (unsigned int y = begin; y < end; y++)
+		convert_row(src + y * width_,
+			    src_c + (y / vertSubSample_) * c_stride,
+			    width_, dst + y * width_ * 4);
 }
 
-void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst,
+				 unsigned int begin, unsigned int end)
 {
 	unsigned int x, y;
-	int r, g, b;
 
-	for (y = 0; y < height_; y++) {
-		for (x = 0; x < width_; x++) {
-			r = src[bpp_ * x + r_pos_];
-			g = src[bpp_ * x + g_pos_];
-			b = src[bpp_ * x + b_pos_];
+	src += begin * width_ * bpp_;
+	dst += begin * width_ * 4;
+
+	for (y = begin; y < end; y++) {
+		const unsigned char *src_r = src + r_pos_;
+		const unsigned char *src_g = src + g_pos_;
+		const unsigned char *src_b = src + b_pos_;
 
-			dst[4 * x + 0] = b;
-			dst[4 * x + 1] = g;
-			dst[4 * x + 2] = r;
+		for (x = 0; x < width_; x++) {
+			dst[4 * x + 0] = src_b[bpp_ * x];
+			dst[4 * x + 1] = src_g[bpp_ * x];
+			dst[4 * x + 2] = src_r[bpp_ * x];
 			dst[4 * x + 3] = 0xff;
 		}
 
@@ -245,40 +540,32 @@ void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
 	}
 }
 
-void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst,
+				 unsigned int begin, unsigned int end)
 {
-	unsigned int src_x, src_y, dst_x, dst_y;
-	unsigned int src_stride;
-	unsigned int dst_stride;
-	unsigned int cr_pos;
-	int r, g, b, y, cr, cb;
-
-	cr_pos = (cb_pos_ + 2) % 4;
-	src_stride = width_ * 2;
-	dst_stride = width_ * 4;
-
-	for (src_y = 0, dst_y = 0; dst_y < height_; src_y++, dst_y++) {
-		for (src_x = 0, dst_x = 0; dst_x < width_; ) {
-			cb = src[src_y * src_stride + src_x * 4 + cb_pos_];
-			cr = src[src_y * src_stride + src_x * 4 + cr_pos];
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_ + 2];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			src_x++;
+	unsigned int src_stride = width_ * 2;
+	unsigned int dst_stride = width_ * 4;
+	unsigned int cr_pos = (cb_pos_ + 2) % 4;
+
+	for (unsigned int y = begin; y < end; y++) {
+		const unsigned char *line = src + y * src_stride;
+		unsigned char *out = dst + y * dst_stride;
+
+		unsigned int start = convert_yuv_row_simd(line, width_, y_pos_,
+							  cb_pos_, out) / 2;
+
+		/* Each 4 bytes macropixel stores two luma samples. */
+		for (unsigned int x = start; x < width_ / 2; x++) {
+			const unsigned char *pixel = line + x * 4;
+			int d = pixel[cb_pos_] - 128;
+			int e = pixel[cr_pos] - 128;
+			int r_uv = 409 * e;
+			int g_uv = -100 * d - 208 * e;
+			int b_uv = 516 * d;
+
+			yuv_to_rgb32(pixel[y_pos_], r_uv, g_uv, b_uv, out + x * 8);
+			yuv_to_rgb32(pixel[y_pos_ + 2], r_uv, g_uv, b_uv,
+				     out + x * 8 + 4);
 		}
 	}
 }
@@ -10,6 +10,7 @@
 #include <stddef.h>
 
 #include <QSize>
+#include <QThreadPool>
 
 #include <libcamera/pixel_format.h>
 
@@ -30,9 +31,17 @@ private:
 		YUV,
 	};
 
-	void convertNV(const unsigned char *src, unsigned char *dst);
-	void convertRGB(const unsigned char *src, unsigned char *dst);
-	void convertYUV(const unsigned char *src, unsigned char *dst);
+	using ConvertFunc = void (FormatConverter::*)(const unsigned char *src,
+						      unsigned char *dst,
+						      unsigned int begin,
+						      unsigned int end);
+
+	void convertNV(const unsigned char *src, unsigned char *dst,
+		       unsigned int begin, unsigned int end);
+	void convertRGB(const unsigned char *src, unsigned char *dst,
+			unsigned int begin, unsigned int end);
+	void convertYUV(const unsigned char *src, unsigned char *dst,
+			unsigned int begin, unsigned int end);
 
 	libcamera::PixelFormat format_;
 	unsigned int width_;
@@ -54,6 +63,9 @@ private:
 	/* YUV parameters */
 	unsigned int y_pos_;
 	unsigned int cb_pos_;
+
+	/* Workers converting strips of rows concurrently */
+	QThreadPool pool_;
 };
 
 #endif /* __QCAM_FORMAT_CONVERTER_H__ */
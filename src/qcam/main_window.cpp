@@ -7,6 +7,7 @@
 
 #include "main_window.h"
 
+#include <functional>
 #include <iomanip>
 #include <string>
 #include <sys/mman.h>
@@ -18,6 +19,7 @@
 #include <QImageWriter>
 #include <QInputDialog>
 #include <QMutexLocker>
+#include <QRunnable>
 #include <QStandardPaths>
 #include <QTimer>
 #include <QToolBar>
@@ -93,12 +95,55 @@ private:
 	PlugEvent plugEvent_;
 };
 
+#ifdef HAVE_DNG
+/**
+ * \brief Task writing a raw frame to a DNG file in a worker thread
+ *
+ * The request is reused as soon as it has been processed, the task thus holds
+ * copies of the stream configuration and request metadata. The frame buffer
+ * isn't copied, the task borrows it and calls the \a done function once the
+ * file has been written, to return the buffer to the free queue.
+ */
+class DNGWriteTask : public QRunnable
+{
+public:
+	DNGWriteTask(std::string filename, std::shared_ptr<Camera> camera,
+		     const StreamConfiguration &config,
+		     const ControlList &metadata, const FrameBuffer *buffer,
+		     const void *data, std::function<void()> done)
+		: filename_(std::move(filename)), camera_(std::move(camera)),
+		  config_(config), metadata_(metadata), buffer_(buffer),
+		  data_(data), done_(std::move(done))
+	{
+	}
+
+	void run() override
+	{
+		DNGWriter::write(filename_.c_str(), camera_.get(), config_,
+				 metadata_, buffer_, data_);
+		done_();
+	}
+
+private:
+	std::string filename_;
+	std::shared_ptr<Camera> camera_;
+	StreamConfiguration config_;
+	ControlList metadata_;
+	const FrameBuffer *buffer_;
+	const void *data_;
+	std::function<void()> done_;
+};
+#endif
+
 MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
 	: saveRaw_(nullptr), options_(options), cm_(cm), allocator_(nullptr),
 	  isCapturing_(false), captureRaw_(false)
 {
 	int ret;
 
+	/* Write DNG files one at a time, in capture order. */
+	dngThreadPool_.setMaxThreadCount(1);
+
 	/*
 	 * Initialize the UI: Create the toolbar, set the window title and
 	 * create the viewfinder widget.
@@ -570,6 +615,9 @@ void MainWindow::stopCapture()
 	if (ret)
 		qInfo() << "Failed to stop capture";
 
+	/* Wait for pending DNG writes before unmapping and freeing buffers. */
+	dngThreadPool_.waitForDone();
+
 	camera_->requestCompleted.disconnect(this, &MainWindow::requestComplete);
 
 	for (auto &iter : mappedBuffers_) {
@@ -673,10 +721,23 @@ void MainWindow::processRaw(FrameBuffer *buffer,
 							"DNG Files (*.dng)");
 
 	if (!filename.isEmpty()) {
+		/*
+		 * Write the file in the background to avoid stalling the
+		 * viewfinder, and requeue the buffer when done.
+		 */
 		const MappedBuffer &mapped = mappedBuffers_[buffer];
-		DNGWriter::write(filename.toStdString().c_str(), camera_.get(),
-				 rawStream_->configuration(), metadata, buffer,
-				 mapped.memory);
+		const Stream *stream = rawStream_;
+
+		auto done = [this, stream, buffer]() {
+			QMutexLocker locker(&mutex_);
+			freeBuffers_[stream].enqueue(buffer);
+		};
+
+		dngThreadPool_.start(new DNGWriteTask(filename.toStdString(), camera_,
+						      rawStream_->configuration(),
+						      metadata, buffer, mapped.memory,
+						      std::move(done)));
+		return;
 	}
 #endif
 
@@ -726,7 +787,8 @@ void MainWindow::processCapture()
 
 	/* Process buffers. */
 	if (request->buffers().count(vfStream_))
-		processViewfinder(request->buffers().at(vfStream_));
+		processViewfinder(request->buffers().at(vfStream_),
+				  request->metadata());
 
 	if (request->buffers().count(rawStream_))
 		processRaw(request->buffers().at(rawStream_), request->metadata());
@@ -736,23 +798,25 @@ void MainWindow::processCapture()
 	freeQueue_.enqueue(request);
 }
 
-void MainWindow::processViewfinder(FrameBuffer *buffer)
+void MainWindow::processViewfinder(FrameBuffer *buffer,
+				   const ControlList &metadata)
 {
 	framesCaptured_++;
 
-	const FrameMetadata &metadata = buffer->metadata();
+	const FrameMetadata &frameMetadata = buffer->metadata();
 
-	double fps = metadata.timestamp - lastBufferTime_;
+	double fps = frameMetadata.timestamp - lastBufferTime_;
 	fps = lastBufferTime_ && fps ? 1000000000.0 / fps : 0.0;
-	lastBufferTime_ = metadata.timestamp;
+	lastBufferTime_ = frameMetadata.timestamp;
 
 	qDebug().noquote()
-		<< QString("seq: %1").arg(metadata.sequence, 6, 10, QLatin1Char('0'))
-		<< "bytesused:" << metadata.planes[0].bytesused
-		<< "timestamp:" << metadata.timestamp
+		<< QString("seq: %1").arg(frameMetadata.sequence, 6, 10, QLatin1Char('0'))
+		<< "bytesused:" << frameMetadata.planes[0].bytesused
+		<< "timestamp:" << frameMetadata.timestamp
 		<< "fps:" << Qt::fixed << qSetRealNumberPrecision(2) << fps;
 
 	/* Render the frame on the viewfinder. */
+	viewfinder_->setMetadata(metadata);
 	viewfinder_->render(buffer, &mappedBuffers_[buffer]);
 }
 
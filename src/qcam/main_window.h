@@ -16,6 +16,7 @@
 #include <QMutex>
 #include <QObject>
 #include <QQueue>
+#include <QThreadPool>
 #include <QTimer>
 
 #include <libcamera/camera.h>
@@ -82,7 +83,7 @@ private:
 	void requestComplete(Request *request);
 	void processCapture();
 	void processHotplug(HotplugEvent *e);
-	void processViewfinder(FrameBuffer *buffer);
+	void processViewfinder(FrameBuffer *buffer, const ControlList &metadata);
 
 	/* UI elements */
 	QToolBar *toolbar_;
@@ -118,6 +119,9 @@ private:
 	QQueue<Request *> freeQueue_;
 	QMutex mutex_; /* Protects freeBuffers_, doneQueue_, and freeQueue_ */
 
+	/* Writes DNG files in the background */
+	QThreadPool dngThreadPool_;
+
 	uint64_t lastBufferTime_;
 	QElapsedTimer frameRateInterval_;
 	uint32_t previousFrames_;
@@ -11,6 +11,7 @@
 #include <QList>
 #include <QSize>
 
+#include <libcamera/controls.h>
 #include <libcamera/formats.h>
 #include <libcamera/framebuffer.h>
 
@@ -28,6 +29,7 @@ public:
 
 	virtual int setFormat(const libcamera::PixelFormat &format, const QSize &size) = 0;
 	virtual void render(libcamera::FrameBuffer *buffer, MappedBuffer *map) = 0;
+	virtual void setMetadata([[maybe_unused]] const libcamera::ControlList &metadata) {}
 	virtual void stop() = 0;
 
 	virtual QImage getCurrentImage() = 0;
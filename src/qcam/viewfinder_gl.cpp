@@ -7,10 +7,19 @@
 
 #include "viewfinder_gl.h"
 
+#include <string.h>
+
 #include <QByteArray>
 #include <QFile>
 #include <QImage>
 
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <linux/drm_fourcc.h>
+#endif
+
+#include <libcamera/control_ids.h>
 #include <libcamera/formats.h>
 
 static const QList<libcamera::PixelFormat> supportedFormats{
@@ -53,14 +62,35 @@ static const QList<libcamera::PixelFormat> supportedFormats{
 	libcamera::formats::SRGGB12_CSI2P,
 };
 
+#ifdef HAVE_EGL
+/*
+ * The GL_OES_EGL_image entry point isn't declared by the desktop OpenGL
+ * headers, define its prototype locally.
+ */
+typedef void (*EGLImageTargetTexture2DOESProc)(GLenum target, void *image);
+
+static PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHRProc;
+static PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHRProc;
+static EGLImageTargetTexture2DOESProc glEGLImageTargetTexture2DOESProc;
+#endif
+
 ViewFinderGL::ViewFinderGL(QWidget *parent)
 	: QOpenGLWidget(parent), buffer_(nullptr), data_(nullptr),
 	  vertexBuffer_(QOpenGLBuffer::VertexBuffer)
 {
+	resetProcessing();
+
+#ifdef HAVE_EGL
+	dmabufImport_ = false;
+	eglDisplay_ = EGL_NO_DISPLAY;
+#endif
 }
 
 ViewFinderGL::~ViewFinderGL()
 {
+#ifdef HAVE_EGL
+	clearImportedTextures();
+#endif
 	removeShader();
 }
 
@@ -89,6 +119,11 @@ int ViewFinderGL::setFormat(const libcamera::PixelFormat &format,
 		format_ = format;
 	}
 
+#ifdef HAVE_EGL
+	/* The imported textures depend on the format and size. */
+	clearImportedTextures();
+#endif
+
 	size_ = size;
 
 	updateGeometry();
@@ -101,6 +136,16 @@ void ViewFinderGL::stop()
 		renderComplete(buffer_);
 		buffer_ = nullptr;
 	}
+
+	resetProcessing();
+
+#ifdef HAVE_EGL
+	/*
+	 * The frame buffers are freed when the camera stops, release the
+	 * images imported from their dmabufs.
+	 */
+	clearImportedTextures();
+#endif
 }
 
 QImage ViewFinderGL::getCurrentImage()
@@ -129,6 +174,44 @@ void ViewFinderGL::render(libcamera::FrameBuffer *buffer, MappedBuffer *map)
 	buffer_ = buffer;
 }
 
+/*
+ * Raw Bayer frames are processed in the shaders with the black levels, colour
+ * gains and colour correction matrix reported in the metadata of the request,
+ * to preview them close to the output of the ISP. Parameters missing from the
+ * metadata keep their previous value, or default to no processing.
+ */
+void ViewFinderGL::setMetadata(const libcamera::ControlList &metadata)
+{
+	if (metadata.contains(libcamera::controls::SensorBlackLevels)) {
+		const auto levels = metadata.get(libcamera::controls::SensorBlackLevels);
+		if (levels.size() == 4) {
+			/* Average the two green channels, in the [0, 1] range. */
+			blackLevel_ = QVector3D(levels[0],
+						(levels[1] + levels[2]) / 2.0f,
+						levels[3]) / 65536.0f;
+		}
+	}
+
+	if (metadata.contains(libcamera::controls::ColourGains)) {
+		const auto gains = metadata.get(libcamera::controls::ColourGains);
+		if (gains.size() == 2)
+			wbGains_ = QVector3D(gains[0], 1.0f, gains[1]);
+	}
+
+	if (metadata.contains(libcamera::controls::ColourCorrectionMatrix)) {
+		const auto ccm = metadata.get(libcamera::controls::ColourCorrectionMatrix);
+		if (ccm.size() == 9)
+			ccm_ = QMatrix3x3(ccm.data());
+	}
+}
+
+void ViewFinderGL::resetProcessing()
+{
+	blackLevel_ = QVector3D(0.0f, 0.0f, 0.0f);
+	wbGains_ = QVector3D(1.0f, 1.0f, 1.0f);
+	ccm_.setToIdentity();
+}
+
 bool ViewFinderGL::selectFormat(const libcamera::PixelFormat &format)
 {
 	bool ret = true;
@@ -401,6 +484,10 @@ bool ViewFinderGL::createFragmentShader()
 	textureUniformStep_ = shaderProgram_.uniformLocation("tex_step");
 	textureUniformSize_ = shaderProgram_.uniformLocation("tex_size");
 	textureUniformBayerFirstRed_ = shaderProgram_.uniformLocation("tex_bayer_first_red");
+	textureUniformRG_ = shaderProgram_.uniformLocation("tex_uv_rg");
+	textureUniformBlackLevel_ = shaderProgram_.uniformLocation("tex_black_level");
+	textureUniformWbGains_ = shaderProgram_.uniformLocation("tex_wb_gains");
+	textureUniformCcm_ = shaderProgram_.uniformLocation("tex_ccm");
 
 	/* Create the textures. */
 	for (std::unique_ptr<QOpenGLTexture> &texture : textures_) {
@@ -414,9 +501,9 @@ bool ViewFinderGL::createFragmentShader()
 	return true;
 }
 
-void ViewFinderGL::configureTexture(QOpenGLTexture &texture)
+void ViewFinderGL::configureTexture(GLuint texture)
 {
-	glBindTexture(GL_TEXTURE_2D, texture.textureId());
+	glBindTexture(GL_TEXTURE_2D, texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
 			textureMinMagFilters_);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
@@ -425,6 +512,172 @@ void ViewFinderGL::configureTexture(QOpenGLTexture &texture)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 }
 
+/*
+ * Fill the texture bound to texture unit \a index with the data of the current
+ * buffer, starting at \a offset bytes. The texture is imported from the dmabuf
+ * of the buffer when supported, and uploaded from its CPU mapping otherwise.
+ * Return true if the texture has been imported.
+ */
+bool ViewFinderGL::uploadTexture(unsigned int index, GLenum format,
+				 unsigned int width, unsigned int height,
+				 unsigned int offset)
+{
+	glActiveTexture(GL_TEXTURE0 + index);
+
+#ifdef HAVE_EGL
+	if (dmabufImport_ && buffer_) {
+		const ImportedTexture *imported =
+			importTexture(index, format, width, height, offset);
+		if (imported) {
+			configureTexture(imported->texture);
+			return true;
+		}
+	}
+#endif
+
+	configureTexture(textures_[index]->textureId());
+	glTexImage2D(GL_TEXTURE_2D,
+		     0,
+		     format,
+		     width,
+		     height,
+		     0,
+		     format,
+		     GL_UNSIGNED_BYTE,
+		     data_ + offset);
+
+	return false;
+}
+
+#ifdef HAVE_EGL
+void ViewFinderGL::initializeDmabufImport()
+{
+	dmabufImport_ = false;
+
+	/* The context is created through GLX on some platforms. */
+	eglDisplay_ = eglGetCurrentDisplay();
+	if (eglDisplay_ == EGL_NO_DISPLAY)
+		return;
+
+	const char *extensions = eglQueryString(eglDisplay_, EGL_EXTENSIONS);
+	if (!extensions || !strstr(extensions, "EGL_EXT_image_dma_buf_import"))
+		return;
+
+	if (!context()->hasExtension("GL_OES_EGL_image"))
+		return;
+
+	eglCreateImageKHRProc = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+		eglGetProcAddress("eglCreateImageKHR"));
+	eglDestroyImageKHRProc = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+		eglGetProcAddress("eglDestroyImageKHR"));
+	glEGLImageTargetTexture2DOESProc = reinterpret_cast<EGLImageTargetTexture2DOESProc>(
+		eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+
+	if (!eglCreateImageKHRProc || !eglDestroyImageKHRProc ||
+	    !glEGLImageTargetTexture2DOESProc)
+		return;
+
+	dmabufImport_ = true;
+}
+
+/*
+ * Import the region of the current buffer starting at \a offset bytes as a
+ * texture. The frame buffers are reused for the whole capture session, the
+ * textures are thus cached per buffer and texture unit, and only imported the
+ * first time a buffer is rendered.
+ */
+const ViewFinderGL::ImportedTexture *
+ViewFinderGL::importTexture(unsigned int index, GLenum format,
+			    unsigned int width, unsigned int height,
+			    unsigned int offset)
+{
+	ImportedTexture &imported = importedTextures_[buffer_][index];
+	if (imported.image)
+		return &imported;
+
+	/*
+	 * Pick the DRM format whose memory layout matches the texel layout
+	 * of the GL format used for uploads.
+	 */
+	uint32_t fourcc;
+	unsigned int bpp;
+
+	switch (format) {
+	case GL_LUMINANCE:
+		fourcc = DRM_FORMAT_R8;
+		bpp = 1;
+		break;
+	case GL_LUMINANCE_ALPHA:
+		fourcc = DRM_FORMAT_GR88;
+		bpp = 2;
+		break;
+	case GL_RGB:
+		fourcc = DRM_FORMAT_BGR888;
+		bpp = 3;
+		break;
+	case GL_RGBA:
+		fourcc = DRM_FORMAT_ABGR8888;
+		bpp = 4;
+		break;
+	default:
+		return nullptr;
+	}
+
+	const EGLint attribs[] = {
+		EGL_WIDTH, static_cast<EGLint>(width),
+		EGL_HEIGHT, static_cast<EGLint>(height),
+		EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(fourcc),
+		EGL_DMA_BUF_PLANE0_FD_EXT, buffer_->planes()[0].fd.fd(),
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<EGLint>(offset),
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(width * bpp),
+		EGL_NONE,
+	};
+
+	EGLImageKHR image = eglCreateImageKHRProc(eglDisplay_, EGL_NO_CONTEXT,
+						  EGL_LINUX_DMA_BUF_EXT,
+						  nullptr, attribs);
+	if (image == EGL_NO_IMAGE_KHR) {
+		/*
+		 * Textures already imported for the current frame stay valid
+		 * until the cache is cleared, fall back to uploads for all
+		 * subsequent textures.
+		 */
+		qWarning() << "[ViewFinderGL]:"
+			   << "dmabuf import failed, falling back to uploads";
+		dmabufImport_ = false;
+		return nullptr;
+	}
+
+	glGenTextures(1, &imported.texture);
+	glBindTexture(GL_TEXTURE_2D, imported.texture);
+	glEGLImageTargetTexture2DOESProc(GL_TEXTURE_2D, image);
+	imported.image = image;
+
+	return &imported;
+}
+
+void ViewFinderGL::clearImportedTextures()
+{
+	if (importedTextures_.empty())
+		return;
+
+	makeCurrent();
+
+	for (auto &[buffer, textures] : importedTextures_) {
+		for (ImportedTexture &imported : textures) {
+			if (imported.texture)
+				glDeleteTextures(1, &imported.texture);
+			if (imported.image)
+				eglDestroyImageKHRProc(eglDisplay_, imported.image);
+		}
+	}
+
+	importedTextures_.clear();
+
+	doneCurrent();
+}
+#endif
+
 void ViewFinderGL::removeShader()
 {
 	if (shaderProgram_.isLinked()) {
@@ -439,6 +692,10 @@ void ViewFinderGL::initializeGL()
 	glEnable(GL_TEXTURE_2D);
 	glDisable(GL_DEPTH_TEST);
 
+#ifdef HAVE_EGL
+	initializeDmabufImport();
+#endif
+
 	static const GLfloat coordinates[2][4][2]{
 		{
 			/* Vertex coordinates */
@@ -469,6 +726,8 @@ void ViewFinderGL::initializeGL()
 
 void ViewFinderGL::doRender()
 {
+	bool imported;
+
 	switch (format_) {
 	case libcamera::formats::NV12:
 	case libcamera::formats::NV21:
@@ -477,119 +736,56 @@ void ViewFinderGL::doRender()
 	case libcamera::formats::NV24:
 	case libcamera::formats::NV42:
 		/* Activate texture Y */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_LUMINANCE, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 
 		/* Activate texture UV/VU */
-		glActiveTexture(GL_TEXTURE1);
-		configureTexture(*textures_[1]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE_ALPHA,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_LUMINANCE_ALPHA,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height());
+		imported = uploadTexture(1, GL_LUMINANCE_ALPHA,
+					 size_.width() / horzSubSample_,
+					 size_.height() / vertSubSample_,
+					 size_.width() * size_.height());
 		shaderProgram_.setUniformValue(textureUniformU_, 1);
+		shaderProgram_.setUniformValue(textureUniformRG_,
+					       imported ? 1.0f : 0.0f);
 		break;
 
 	case libcamera::formats::YUV420:
 		/* Activate texture Y */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_LUMINANCE, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 
 		/* Activate texture U */
-		glActiveTexture(GL_TEXTURE1);
-		configureTexture(*textures_[1]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height());
+		uploadTexture(1, GL_LUMINANCE,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height());
 		shaderProgram_.setUniformValue(textureUniformU_, 1);
 
 		/* Activate texture V */
-		glActiveTexture(GL_TEXTURE2);
-		configureTexture(*textures_[2]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height() * 5 / 4);
+		uploadTexture(2, GL_LUMINANCE,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height() * 5 / 4);
 		shaderProgram_.setUniformValue(textureUniformV_, 2);
 		break;
 
 	case libcamera::formats::YVU420:
 		/* Activate texture Y */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_LUMINANCE, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 
 		/* Activate texture V */
-		glActiveTexture(GL_TEXTURE2);
-		configureTexture(*textures_[2]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height());
+		uploadTexture(2, GL_LUMINANCE,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height());
 		shaderProgram_.setUniformValue(textureUniformV_, 2);
 
 		/* Activate texture U */
-		glActiveTexture(GL_TEXTURE1);
-		configureTexture(*textures_[1]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height() * 5 / 4);
+		uploadTexture(1, GL_LUMINANCE,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height() * 5 / 4);
 		shaderProgram_.setUniformValue(textureUniformU_, 1);
 		break;
 
@@ -602,17 +798,7 @@ void ViewFinderGL::doRender()
 		 * OpenGL texel size with the 4 bytes repeating pattern in YUV.
 		 * The texture width is thus half of the image with.
 		 */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RGBA,
-			     size_.width() / 2,
-			     size_.height(),
-			     0,
-			     GL_RGBA,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RGBA, size_.width() / 2, size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 
 		/*
@@ -630,33 +816,13 @@ void ViewFinderGL::doRender()
 	case libcamera::formats::ARGB8888:
 	case libcamera::formats::BGRA8888:
 	case libcamera::formats::RGBA8888:
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RGBA,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_RGBA,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RGBA, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 		break;
 
 	case libcamera::formats::BGR888:
 	case libcamera::formats::RGB888:
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RGB,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_RGB,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RGB, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 		break;
 
@@ -677,17 +843,7 @@ void ViewFinderGL::doRender()
 		 * are stored in a GL_LUMINANCE texture. The texture width is
 		 * equal to the stride.
 		 */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_LUMINANCE,
-			     stride_,
-			     size_.height(),
-			     0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_LUMINANCE, stride_, size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 		shaderProgram_.setUniformValue(textureUniformBayerFirstRed_,
 					       firstRed_);
@@ -697,6 +853,10 @@ void ViewFinderGL::doRender()
 		shaderProgram_.setUniformValue(textureUniformStep_,
 					       1.0f / (stride_ - 1),
 					       1.0f / (size_.height() - 1));
+		shaderProgram_.setUniformValue(textureUniformBlackLevel_,
+					       blackLevel_);
+		shaderProgram_.setUniformValue(textureUniformWbGains_, wbGains_);
+		shaderProgram_.setUniformValue(textureUniformCcm_, ccm_);
 		break;
 
 	default:
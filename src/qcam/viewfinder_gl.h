@@ -9,8 +9,10 @@
 #define __VIEWFINDER_GL_H__
 
 #include <array>
+#include <map>
 #include <memory>
 
+#include <QGenericMatrix>
 #include <QImage>
 #include <QMutex>
 #include <QOpenGLBuffer>
@@ -20,6 +22,7 @@
 #include <QOpenGLTexture>
 #include <QOpenGLWidget>
 #include <QSize>
+#include <QVector3D>
 
 #include <libcamera/formats.h>
 #include <libcamera/framebuffer.h>
@@ -40,6 +43,7 @@ public:
 
 	int setFormat(const libcamera::PixelFormat &format, const QSize &size) override;
 	void render(libcamera::FrameBuffer *buffer, MappedBuffer *map) override;
+	void setMetadata(const libcamera::ControlList &metadata) override;
 	void stop() override;
 
 	QImage getCurrentImage() override;
@@ -56,7 +60,9 @@ protected:
 private:
 	bool selectFormat(const libcamera::PixelFormat &format);
 
-	void configureTexture(QOpenGLTexture &texture);
+	void configureTexture(GLuint texture);
+	bool uploadTexture(unsigned int index, GLenum format, unsigned int width,
+			   unsigned int height, unsigned int offset);
 	bool createFragmentShader();
 	bool createVertexShader();
 	void removeShader();
@@ -99,6 +105,42 @@ private:
 	GLuint textureUniformBayerFirstRed_;
 	QPointF firstRed_;
 
+	/* Raw Bayer processing parameters, from the frame metadata */
+	void resetProcessing();
+
+	GLuint textureUniformBlackLevel_;
+	GLuint textureUniformWbGains_;
+	GLuint textureUniformCcm_;
+	QVector3D blackLevel_;
+	QVector3D wbGains_;
+	QMatrix3x3 ccm_;
+
+	/* Chroma texture layout, for semi-planar YUV formats */
+	GLuint textureUniformRG_;
+
+#ifdef HAVE_EGL
+	/*
+	 * Textures imported from the dmabufs of the frame buffers, indexed by
+	 * texture unit. The images are cached for the lifetime of the frame
+	 * buffers to avoid importing them for every frame.
+	 */
+	struct ImportedTexture {
+		void *image;
+		GLuint texture;
+	};
+
+	void initializeDmabufImport();
+	const ImportedTexture *importTexture(unsigned int index, GLenum format,
+					     unsigned int width, unsigned int height,
+					     unsigned int offset);
+	void clearImportedTextures();
+
+	bool dmabufImport_;
+	void *eglDisplay_;
+	std::map<libcamera::FrameBuffer *,
+		 std::array<ImportedTexture, 3>> importedTextures_;
+#endif
+
 	QMutex mutex_; /* Prevent concurrent access to image_ */
 };
 
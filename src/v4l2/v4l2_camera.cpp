@@ -7,7 +7,9 @@
 
 #include "v4l2_camera.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <libcamera/base/log.h>
@@ -18,7 +20,8 @@ LOG_DECLARE_CATEGORY(V4L2Compat)
 
 V4L2Camera::V4L2Camera(std::shared_ptr<Camera> camera)
 	: camera_(camera), isRunning_(false), bufferAllocator_(nullptr),
-	  efd_(-1), bufferAvailableCount_(0)
+	  external_(false), completionHead_(0), completionTail_(0), efd_(-1),
+	  bufferAvailableCount_(0)
 {
 	camera_->requestCompleted.connect(this, &V4L2Camera::requestComplete);
 }
@@ -50,6 +53,7 @@ int V4L2Camera::open(StreamConfiguration *streamConfig)
 void V4L2Camera::close()
 {
 	requestPool_.clear();
+	externalBuffers_.clear();
 
 	delete bufferAllocator_;
 	bufferAllocator_ = nullptr;
@@ -67,17 +71,16 @@ void V4L2Camera::unbind()
 	efd_ = -1;
 }
 
-std::vector<V4L2Camera::Buffer> V4L2Camera::completedBuffers()
+bool V4L2Camera::completedBuffer(Buffer *buffer)
 {
-	std::vector<Buffer> v;
+	unsigned int head = completionHead_.load(std::memory_order_relaxed);
+	if (head == completionTail_.load(std::memory_order_acquire))
+		return false;
 
-	bufferLock_.lock();
-	for (std::unique_ptr<Buffer> &metadata : completedBuffers_)
-		v.push_back(*metadata.get());
-	completedBuffers_.clear();
-	bufferLock_.unlock();
+	*buffer = completions_[head & (completions_.size() - 1)];
+	completionHead_.store(head + 1, std::memory_order_release);
 
-	return v;
+	return true;
 }
 
 void V4L2Camera::requestComplete(Request *request)
@@ -86,24 +89,55 @@ void V4L2Camera::requestComplete(Request *request)
 		return;
 
 	/* We only have one stream at the moment. */
-	bufferLock_.lock();
 	FrameBuffer *buffer = request->buffers().begin()->second;
-	std::unique_ptr<Buffer> metadata =
-		std::make_unique<Buffer>(request->cookie(), buffer->metadata());
-	completedBuffers_.push_back(std::move(metadata));
-	bufferLock_.unlock();
+	Buffer completed(request->cookie(), buffer->metadata());
+
+	/*
+	 * The ring can't overflow, as it is large enough to store all buffers,
+	 * and each buffer completes at most once until it is dequeued.
+	 */
+	unsigned int tail = completionTail_.load(std::memory_order_relaxed);
+	completions_[tail & (completions_.size() - 1)] = completed;
+	completionTail_.store(tail + 1, std::memory_order_release);
 
 	uint64_t data = 1;
-	int ret = ::write(efd_, &data, sizeof(data));
-	if (ret != sizeof(data))
-		LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
+	int ret;
+
+	std::vector<unsigned int> requeue;
 
 	request->reuse();
 	{
 		MutexLocker locker(bufferMutex_);
-		bufferAvailableCount_++;
+
+		/* Share the buffer with all readers. */
+		for (auto &[efd, reader] : readers_) {
+			if (reader.pending) {
+				releaseBufferLocked(reader.pending->index_, &requeue);
+			} else {
+				ret = ::write(efd, &data, sizeof(data));
+				if (ret != sizeof(data))
+					LOG(V4L2Compat, Error)
+						<< "Failed to signal eventfd POLLIN";
+			}
+
+			reader.pending = completed;
+			bufferRefs_[completed.index_]++;
+		}
+
+		/*
+		 * The eventfd only signals that buffers are available, write
+		 * to it when the first buffer becomes available, the dequeue
+		 * side clears it when the last one is dequeued.
+		 */
+		if (bufferAvailableCount_++ == 0 && efd_ >= 0) {
+			ret = ::write(efd_, &data, sizeof(data));
+			if (ret != sizeof(data))
+				LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
+		}
 	}
 	bufferCV_.notify_all();
+
+	requeueBuffers(requeue);
 }
 
 int V4L2Camera::configure(StreamConfiguration *streamConfigOut,
@@ -157,14 +191,37 @@ int V4L2Camera::validateConfiguration(const PixelFormat &pixelFormat,
 	return 0;
 }
 
-int V4L2Camera::allocBuffers(unsigned int count)
+int V4L2Camera::allocBuffers(unsigned int count, bool external)
 {
 	Stream *stream = config_->at(0).stream();
-
-	int ret = bufferAllocator_->allocate(stream);
+	int ret = count;
+
+	/*
+	 * External buffers are imported from dmabufs provided by the
+	 * application when queued, only the requests are created here.
+	 */
+	external_ = external;
+	if (external_)
+		externalBuffers_.resize(count);
+	else
+		ret = bufferAllocator_->allocate(stream);
 	if (ret < 0)
 		return ret;
 
+	{
+		MutexLocker locker(bufferMutex_);
+		bufferRefs_.assign(count, 0);
+		deferred_.assign(count, false);
+	}
+
+	unsigned int size = 1;
+	while (size < count)
+		size <<= 1;
+
+	completions_.resize(size);
+	completionHead_ = 0;
+	completionTail_ = 0;
+
 	for (unsigned int i = 0; i < count; i++) {
 		std::unique_ptr<Request> request = camera_->createRequest(i);
 		if (!request) {
@@ -182,12 +239,27 @@ void V4L2Camera::freeBuffers()
 	pendingRequests_.clear();
 	requestPool_.clear();
 
+	{
+		MutexLocker locker(bufferMutex_);
+		bufferRefs_.clear();
+		deferred_.clear();
+	}
+
+	if (external_) {
+		externalBuffers_.clear();
+		external_ = false;
+		return;
+	}
+
 	Stream *stream = config_->at(0).stream();
 	bufferAllocator_->free(stream);
 }
 
 FileDescriptor V4L2Camera::getBufferFd(unsigned int index)
 {
+	if (external_)
+		return FileDescriptor();
+
 	Stream *stream = config_->at(0).stream();
 	const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
 		bufferAllocator_->buffers(stream);
@@ -236,9 +308,33 @@ int V4L2Camera::streamOff()
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
+	/* The camera is stopped, no more buffers can complete. */
+	completionHead_ = 0;
+	completionTail_ = 0;
+
 	{
 		MutexLocker locker(bufferMutex_);
 		isRunning_ = false;
+
+		if (bufferAvailableCount_)
+			clearEventLocked();
+		bufferAvailableCount_ = 0;
+
+		/* All buffers are returned to the readers. */
+		for (auto &[efd, reader] : readers_) {
+			if (reader.pending) {
+				uint64_t data;
+				if (::read(efd, &data, sizeof(data)) != sizeof(data))
+					LOG(V4L2Compat, Error)
+						<< "Failed to clear eventfd POLLIN";
+			}
+
+			reader.pending.reset();
+			reader.held.clear();
+		}
+
+		std::fill(bufferRefs_.begin(), bufferRefs_.end(), 0);
+		std::fill(deferred_.begin(), deferred_.end(), false);
 	}
 	bufferCV_.notify_all();
 
@@ -247,26 +343,93 @@ int V4L2Camera::streamOff()
 
 int V4L2Camera::qbuf(unsigned int index)
 {
-	if (index >= requestPool_.size()) {
+	if (index >= requestPool_.size() || external_) {
 		LOG(V4L2Compat, Error) << "Invalid index";
 		return -EINVAL;
 	}
-	Request *request = requestPool_[index].get();
 
 	Stream *stream = config_->at(0).stream();
 	FrameBuffer *buffer = bufferAllocator_->buffers(stream)[index].get();
+
+	return queueBuffer(index, buffer);
+}
+
+int V4L2Camera::qbuf(unsigned int index, int fd, unsigned int length)
+{
+	if (index >= requestPool_.size() || !external_) {
+		LOG(V4L2Compat, Error) << "Invalid index";
+		return -EINVAL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		LOG(V4L2Compat, Error) << "Invalid dmabuf fd " << fd;
+		return -EINVAL;
+	}
+
+	/*
+	 * Applications usually queue the same dmabuf for a given index. Reuse
+	 * the FrameBuffer in that case, to let the pipeline handler cache its
+	 * import, and wrap the dmabuf in a new FrameBuffer otherwise.
+	 */
+	std::unique_ptr<FrameBuffer> &buffer = externalBuffers_[index];
+	if (buffer) {
+		const FrameBuffer::Plane &plane = buffer->planes()[0];
+		struct stat current;
+
+		if (plane.length != length ||
+		    fstat(plane.fd.fd(), &current) < 0 ||
+		    current.st_dev != st.st_dev || current.st_ino != st.st_ino)
+			buffer.reset();
+	}
+
+	if (!buffer) {
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(fd);
+		plane.length = length;
+
+		if (!plane.fd.isValid())
+			return -ENOMEM;
+
+		buffer = std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane });
+	}
+
+	return queueBuffer(index, buffer.get());
+}
+
+int V4L2Camera::queueBuffer(unsigned int index, FrameBuffer *buffer)
+{
+	Request *request = requestPool_[index].get();
+	Stream *stream = config_->at(0).stream();
+
 	int ret = request->addBuffer(stream, buffer);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error) << "Can't set buffer for request";
 		return -ENOMEM;
 	}
 
+	/* Wait for all readers to release the buffer before requeuing it. */
+	{
+		MutexLocker locker(bufferMutex_);
+		if (bufferRefs_[index]) {
+			deferred_[index] = true;
+			return 0;
+		}
+	}
+
+	return queueRequest(index);
+}
+
+int V4L2Camera::queueRequest(unsigned int index)
+{
+	Request *request = requestPool_[index].get();
+
 	if (!isRunning_) {
 		pendingRequests_.push_back(request);
 		return 0;
 	}
 
-	ret = camera_->queueRequest(request);
+	int ret = camera_->queueRequest(request);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error) << "Can't queue request";
 		return ret == -EACCES ? -EBUSY : ret;
@@ -281,8 +444,8 @@ void V4L2Camera::waitForBufferAvailable()
 	bufferCV_.wait(locker, [&] {
 			       return bufferAvailableCount_ >= 1 || !isRunning_;
 		       });
-	if (isRunning_)
-		bufferAvailableCount_--;
+	if (isRunning_ && --bufferAvailableCount_ == 0)
+		clearEventLocked();
 }
 
 bool V4L2Camera::isBufferAvailable()
@@ -291,11 +454,126 @@ bool V4L2Camera::isBufferAvailable()
 	if (bufferAvailableCount_ < 1)
 		return false;
 
-	bufferAvailableCount_--;
+	if (--bufferAvailableCount_ == 0)
+		clearEventLocked();
+
 	return true;
 }
 
+void V4L2Camera::clearEventLocked()
+{
+	if (efd_ < 0)
+		return;
+
+	uint64_t data;
+	int ret = ::read(efd_, &data, sizeof(data));
+	if (ret != sizeof(data))
+		LOG(V4L2Compat, Error) << "Failed to clear eventfd POLLIN";
+}
+
 bool V4L2Camera::isRunning()
 {
 	return isRunning_;
 }
+
+void V4L2Camera::addReader(int efd)
+{
+	MutexLocker locker(bufferMutex_);
+	readers_[efd];
+}
+
+void V4L2Camera::removeReader(int efd)
+{
+	std::vector<unsigned int> requeue;
+
+	{
+		MutexLocker locker(bufferMutex_);
+
+		auto iter = readers_.find(efd);
+		if (iter == readers_.end())
+			return;
+
+		Reader &reader = iter->second;
+		if (reader.pending) {
+			releaseBufferLocked(reader.pending->index_, &requeue);
+
+			uint64_t data;
+			if (::read(efd, &data, sizeof(data)) != sizeof(data))
+				LOG(V4L2Compat, Error)
+					<< "Failed to clear eventfd POLLIN";
+		}
+		for (unsigned int index : reader.held)
+			releaseBufferLocked(index, &requeue);
+
+		readers_.erase(iter);
+	}
+
+	/* Wake up the reader if it is waiting for a buffer. */
+	bufferCV_.notify_all();
+
+	requeueBuffers(requeue);
+}
+
+void V4L2Camera::waitForReaderBuffer(int efd)
+{
+	MutexLocker locker(bufferMutex_);
+	bufferCV_.wait(locker, [&] {
+			       auto iter = readers_.find(efd);
+			       return iter == readers_.end() ||
+				      iter->second.pending || !isRunning_;
+		       });
+}
+
+std::optional<V4L2Camera::Buffer> V4L2Camera::dequeueReaderBuffer(int efd)
+{
+	MutexLocker locker(bufferMutex_);
+
+	auto iter = readers_.find(efd);
+	if (iter == readers_.end() || !iter->second.pending)
+		return std::nullopt;
+
+	Reader &reader = iter->second;
+	std::optional<Buffer> buffer = std::move(reader.pending);
+	reader.pending.reset();
+	reader.held.insert(buffer->index_);
+
+	return buffer;
+}
+
+int V4L2Camera::releaseReaderBuffer(int efd, unsigned int index)
+{
+	std::vector<unsigned int> requeue;
+
+	{
+		MutexLocker locker(bufferMutex_);
+
+		auto iter = readers_.find(efd);
+		if (iter == readers_.end() || !iter->second.held.erase(index))
+			return -EINVAL;
+
+		releaseBufferLocked(index, &requeue);
+	}
+
+	requeueBuffers(requeue);
+
+	return 0;
+}
+
+void V4L2Camera::releaseBufferLocked(unsigned int index,
+				     std::vector<unsigned int> *requeue)
+{
+	if (index >= bufferRefs_.size() || !bufferRefs_[index])
+		return;
+
+	if (--bufferRefs_[index] || !deferred_[index])
+		return;
+
+	deferred_[index] = false;
+	requeue->push_back(index);
+}
+
+void V4L2Camera::requeueBuffers(const std::vector<unsigned int> &indices)
+{
+	for (unsigned int index : indices)
+		queueRequest(index);
+}
@@ -8,9 +8,14 @@
 #ifndef __V4L2_CAMERA_H__
 #define __V4L2_CAMERA_H__
 
+#include <atomic>
 #include <deque>
+#include <map>
 #include <mutex>
+#include <optional>
+#include <set>
 #include <utility>
+#include <vector>
 
 #include <libcamera/base/semaphore.h>
 
@@ -24,14 +29,29 @@ using namespace libcamera;
 class V4L2Camera
 {
 public:
+	/*
+	 * Buffers only store the metadata reported by V4L2, to be copied
+	 * without memory allocation.
+	 */
 	struct Buffer {
+		Buffer()
+			: index_(0), status_(FrameMetadata::FrameCancelled),
+			  sequence_(0), timestamp_(0), bytesused_(0)
+		{
+		}
+
 		Buffer(unsigned int index, const FrameMetadata &data)
-			: index_(index), data_(data)
+			: index_(index), status_(data.status),
+			  sequence_(data.sequence), timestamp_(data.timestamp),
+			  bytesused_(data.planes.empty() ? 0 : data.planes[0].bytesused)
 		{
 		}
 
 		unsigned int index_;
-		FrameMetadata data_;
+		FrameMetadata::Status status_;
+		unsigned int sequence_;
+		uint64_t timestamp_;
+		unsigned int bytesused_;
 	};
 
 	V4L2Camera(std::shared_ptr<Camera> camera);
@@ -42,7 +62,7 @@ public:
 	void bind(int efd);
 	void unbind();
 
-	std::vector<Buffer> completedBuffers();
+	bool completedBuffer(Buffer *buffer);
 
 	int configure(StreamConfiguration *streamConfigOut,
 		      const Size &size, const PixelFormat &pixelformat,
@@ -51,7 +71,7 @@ public:
 				  const Size &size,
 				  StreamConfiguration *streamConfigOut);
 
-	int allocBuffers(unsigned int count);
+	int allocBuffers(unsigned int count, bool external);
 	void freeBuffers();
 	FileDescriptor getBufferFd(unsigned int index);
 
@@ -59,33 +79,72 @@ public:
 	int streamOff();
 
 	int qbuf(unsigned int index);
+	int qbuf(unsigned int index, int fd, unsigned int length);
 
 	void waitForBufferAvailable();
 	bool isBufferAvailable();
 
+	void addReader(int efd);
+	void removeReader(int efd);
+	void waitForReaderBuffer(int efd);
+	std::optional<Buffer> dequeueReaderBuffer(int efd);
+	int releaseReaderBuffer(int efd, unsigned int index);
+
 	bool isRunning();
 
 private:
 	void requestComplete(Request *request);
+	int queueBuffer(unsigned int index, FrameBuffer *buffer);
+	int queueRequest(unsigned int index);
+	void releaseBufferLocked(unsigned int index,
+				 std::vector<unsigned int> *requeue);
+	void requeueBuffers(const std::vector<unsigned int> &indices);
+	void clearEventLocked();
 
 	std::shared_ptr<Camera> camera_;
 	std::unique_ptr<CameraConfiguration> config_;
 
 	bool isRunning_;
 
-	std::mutex bufferLock_;
 	FrameBufferAllocator *bufferAllocator_;
+	std::vector<std::unique_ptr<FrameBuffer>> externalBuffers_;
+	bool external_;
 
 	std::vector<std::unique_ptr<Request>> requestPool_;
 
 	std::deque<Request *> pendingRequests_;
-	std::deque<std::unique_ptr<Buffer>> completedBuffers_;
+
+	/*
+	 * Single producer, single consumer ring of completed buffers, produced
+	 * by the camera thread and consumed by the proxy. Its size is a power
+	 * of two large enough to store all buffers, and it is only resized
+	 * when the camera is stopped.
+	 */
+	std::vector<Buffer> completions_;
+	std::atomic<unsigned int> completionHead_;
+	std::atomic<unsigned int> completionTail_;
 
 	int efd_;
 
 	Mutex bufferMutex_;
 	std::condition_variable bufferCV_;
 	unsigned int bufferAvailableCount_;
+
+	/*
+	 * Additional files receive the completed buffers of the owner file.
+	 * Each reader holds at most one pending buffer, replaced by newer ones
+	 * if not dequeued in time, and the buffers it has dequeued. Buffers
+	 * referenced by readers are requeued to the camera only once all
+	 * readers have released them. Protected by bufferMutex_.
+	 */
+	struct Reader {
+		std::optional<Buffer> pending;
+		std::set<unsigned int> held;
+	};
+
+	std::map<int, Reader> readers_;
+	std::vector<unsigned int> bufferRefs_;
+	std::vector<bool> deferred_;
 };
 
 #endif /* __V4L2_CAMERA_H__ */
@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <array>
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/videodev2.h>
 #include <set>
 #include <string.h>
@@ -38,7 +39,7 @@ LOG_DECLARE_CATEGORY(V4L2Compat)
 V4L2CameraProxy::V4L2CameraProxy(unsigned int index,
 				 std::shared_ptr<Camera> camera)
 	: refcount_(0), index_(index), bufferCount_(0), currentBuf_(0),
-	  vcam_(std::make_unique<V4L2Camera>(camera)), owner_(nullptr)
+	  memory_(V4L2_MEMORY_MMAP), vcam_(std::make_unique<V4L2Camera>(camera)), owner_(nullptr)
 {
 	querycap(camera);
 }
@@ -85,6 +86,7 @@ void V4L2CameraProxy::close(V4L2CameraFile *file)
 
 	files_.erase(file);
 
+	releaseReader(file);
 	release(file);
 
 	if (--refcount_ > 0)
@@ -93,15 +95,21 @@ void V4L2CameraProxy::close(V4L2CameraFile *file)
 	vcam_->close();
 }
 
-void *V4L2CameraProxy::mmap(void *addr, size_t length, int prot, int flags,
-			    off64_t offset)
+void *V4L2CameraProxy::mmap(V4L2CameraFile *file, void *addr, size_t length,
+			    int prot, int flags, off64_t offset)
 {
 	LOG(V4L2Compat, Debug) << "Servicing mmap";
 
 	MutexLocker locker(proxyMutex_);
 
+	/* Readers share the buffers of the owner, and can't write to them. */
+	if (isReader(file)) {
+		if (prot != PROT_READ) {
+			errno = EACCES;
+			return MAP_FAILED;
+		}
 	/* \todo Validate prot and flags properly. */
-	if (prot != (PROT_READ | PROT_WRITE)) {
+	} else if (prot != (PROT_READ | PROT_WRITE)) {
 		errno = EINVAL;
 		return MAP_FAILED;
 	}
@@ -157,9 +165,16 @@ bool V4L2CameraProxy::validateBufferType(uint32_t type)
 	return type == V4L2_BUF_TYPE_VIDEO_CAPTURE;
 }
 
+/*
+ * Buffers are either allocated by libcamera and mapped or exported by the
+ * application, or imported from dmabufs provided by the application.
+ *
+ * \todo Support V4L2_MEMORY_USERPTR. libcamera requires buffers to be backed
+ * by dmabufs, which would require copying frames to the user pointers.
+ */
 bool V4L2CameraProxy::validateMemoryType(uint32_t memory)
 {
-	return memory == V4L2_MEMORY_MMAP;
+	return memory == V4L2_MEMORY_MMAP || memory == V4L2_MEMORY_DMABUF;
 }
 
 void V4L2CameraProxy::setFmtFromConfig(const StreamConfiguration &streamConfig)
@@ -205,27 +220,29 @@ void V4L2CameraProxy::querycap(std::shared_ptr<Camera> camera)
 
 void V4L2CameraProxy::updateBuffers()
 {
-	std::vector<V4L2Camera::Buffer> completedBuffers = vcam_->completedBuffers();
-	for (const V4L2Camera::Buffer &buffer : completedBuffers) {
-		const FrameMetadata &fmd = buffer.data_;
-		struct v4l2_buffer &buf = buffers_[buffer.index_];
-
-		switch (fmd.status) {
-		case FrameMetadata::FrameSuccess:
-			buf.bytesused = fmd.planes[0].bytesused;
-			buf.field = V4L2_FIELD_NONE;
-			buf.timestamp.tv_sec = fmd.timestamp / 1000000000;
-			buf.timestamp.tv_usec = fmd.timestamp % 1000000;
-			buf.sequence = fmd.sequence;
-
-			buf.flags |= V4L2_BUF_FLAG_DONE;
-			break;
-		case FrameMetadata::FrameError:
-			buf.flags |= V4L2_BUF_FLAG_ERROR;
-			break;
-		default:
-			break;
-		}
+	V4L2Camera::Buffer buffer;
+	while (vcam_->completedBuffer(&buffer))
+		fillBuffer(buffer, &buffers_[buffer.index_]);
+}
+
+void V4L2CameraProxy::fillBuffer(const V4L2Camera::Buffer &buffer,
+				 struct v4l2_buffer *buf)
+{
+	switch (buffer.status_) {
+	case FrameMetadata::FrameSuccess:
+		buf->bytesused = buffer.bytesused_;
+		buf->field = V4L2_FIELD_NONE;
+		buf->timestamp.tv_sec = buffer.timestamp_ / 1000000000;
+		buf->timestamp.tv_usec = buffer.timestamp_ % 1000000;
+		buf->sequence = buffer.sequence_;
+
+		buf->flags |= V4L2_BUF_FLAG_DONE;
+		break;
+	case FrameMetadata::FrameError:
+		buf->flags |= V4L2_BUF_FLAG_ERROR;
+		break;
+	default:
+		break;
 	}
 }
 
@@ -465,12 +482,35 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 	if (file->priority() < maxPriority())
 		return -EBUSY;
 
-	if (!hasOwnership(file) && owner_)
-		return -EBUSY;
-
-	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP
+			  | V4L2_BUF_CAP_SUPPORTS_DMABUF;
 	memset(arg->reserved, 0, sizeof(arg->reserved));
 
+	/*
+	 * When the proxy is owned by another file, share its MMAP buffers. The
+	 * number of buffers is set by the owner.
+	 */
+	if (!hasOwnership(file) && owner_) {
+		if (arg->count == 0) {
+			releaseReader(file);
+			return 0;
+		}
+
+		if (arg->memory != V4L2_MEMORY_MMAP || memory_ != V4L2_MEMORY_MMAP ||
+		    !bufferCount_)
+			return -EBUSY;
+
+		if (readers_.insert(file).second)
+			vcam_->addReader(file->efd());
+
+		arg->count = bufferCount_;
+
+		LOG(V4L2Compat, Debug) << "Sharing " << arg->count
+				       << " buffers with fd = " << file->efd();
+
+		return 0;
+	}
+
 	if (arg->count == 0) {
 		/* \todo Add buffer orphaning support */
 		if (!mmaps_.empty())
@@ -479,6 +519,9 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 		if (vcam_->isRunning())
 			return -EBUSY;
 
+		if (!readers_.empty())
+			return -EBUSY;
+
 		freeBuffers();
 		release(file);
 
@@ -501,7 +544,9 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 	arg->count = streamConfig_.bufferCount;
 	bufferCount_ = arg->count;
 
-	ret = vcam_->allocBuffers(arg->count);
+	memory_ = arg->memory;
+
+	ret = vcam_->allocBuffers(arg->count, memory_ == V4L2_MEMORY_DMABUF);
 	if (ret < 0) {
 		arg->count = 0;
 		return ret;
@@ -512,8 +557,11 @@ int V4L2CameraProxy::vidioc_reqbufs(V4L2CameraFile *file, struct v4l2_requestbuf
 		struct v4l2_buffer buf = {};
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.length = v4l2PixFormat_.sizeimage;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.m.offset = i * v4l2PixFormat_.sizeimage;
+		buf.memory = memory_;
+		if (memory_ == V4L2_MEMORY_DMABUF)
+			buf.m.fd = -1;
+		else
+			buf.m.offset = i * v4l2PixFormat_.sizeimage;
 		buf.index = i;
 		buf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
 
@@ -553,6 +601,9 @@ int V4L2CameraProxy::vidioc_qbuf(V4L2CameraFile *file, struct v4l2_buffer *arg)
 	if (arg->index >= bufferCount_)
 		return -EINVAL;
 
+	if (isReader(file))
+		return readerQbuf(file, arg);
+
 	if (buffers_[arg->index].flags & V4L2_BUF_FLAG_QUEUED)
 		return -EINVAL;
 
@@ -560,13 +611,30 @@ int V4L2CameraProxy::vidioc_qbuf(V4L2CameraFile *file, struct v4l2_buffer *arg)
 		return -EBUSY;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory) ||
+	    arg->memory != memory_ ||
 	    arg->index >= bufferCount_)
 		return -EINVAL;
 
-	int ret = vcam_->qbuf(arg->index);
-	if (ret < 0)
-		return ret;
+	struct v4l2_buffer &buf = buffers_[arg->index];
+	int ret;
+
+	if (memory_ == V4L2_MEMORY_DMABUF) {
+		/* A zero length means the dmabuf covers the whole image. */
+		unsigned int length = arg->length ? arg->length : sizeimage_;
+		if (arg->m.fd < 0 || length < sizeimage_)
+			return -EINVAL;
+
+		ret = vcam_->qbuf(arg->index, arg->m.fd, length);
+		if (ret < 0)
+			return ret;
+
+		buf.m.fd = arg->m.fd;
+		buf.length = length;
+	} else {
+		ret = vcam_->qbuf(arg->index);
+		if (ret < 0)
+			return ret;
+	}
 
 	buffers_[arg->index].flags |= V4L2_BUF_FLAG_QUEUED;
 
@@ -583,6 +651,9 @@ int V4L2CameraProxy::vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
 	if (arg->index >= bufferCount_)
 		return -EINVAL;
 
+	if (isReader(file))
+		return readerDqbuf(file, arg, locker);
+
 	if (!hasOwnership(file))
 		return -EBUSY;
 
@@ -590,7 +661,7 @@ int V4L2CameraProxy::vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
 		return -EINVAL;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory))
+	    arg->memory != memory_)
 		return -EINVAL;
 
 	if (!file->nonBlocking()) {
@@ -612,16 +683,12 @@ int V4L2CameraProxy::vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
 	struct v4l2_buffer &buf = buffers_[currentBuf_];
 
 	buf.flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE);
-	buf.length = sizeimage_;
+	if (memory_ == V4L2_MEMORY_MMAP)
+		buf.length = sizeimage_;
 	*arg = buf;
 
 	currentBuf_ = (currentBuf_ + 1) % bufferCount_;
 
-	uint64_t data;
-	int ret = ::read(file->efd(), &data, sizeof(data));
-	if (ret != sizeof(data))
-		LOG(V4L2Compat, Error) << "Failed to clear eventfd POLLIN";
-
 	return 0;
 }
 
@@ -638,6 +705,10 @@ int V4L2CameraProxy::vidioc_streamon(V4L2CameraFile *file, int *arg)
 	if (file->priority() < maxPriority())
 		return -EBUSY;
 
+	/* Readers receive buffers only while the owner is streaming. */
+	if (isReader(file))
+		return 0;
+
 	if (!hasOwnership(file))
 		return -EBUSY;
 
@@ -659,6 +730,13 @@ int V4L2CameraProxy::vidioc_streamoff(V4L2CameraFile *file, int *arg)
 	if (file->priority() < maxPriority())
 		return -EBUSY;
 
+	/* Return all the buffers held by the reader. */
+	if (isReader(file)) {
+		vcam_->removeReader(file->efd());
+		vcam_->addReader(file->efd());
+		return 0;
+	}
+
 	if (!hasOwnership(file) && owner_)
 		return -EBUSY;
 
@@ -670,6 +748,37 @@ int V4L2CameraProxy::vidioc_streamoff(V4L2CameraFile *file, int *arg)
 	return ret;
 }
 
+int V4L2CameraProxy::vidioc_expbuf(V4L2CameraFile *file, struct v4l2_exportbuffer *arg)
+{
+	LOG(V4L2Compat, Debug) << "Servicing vidioc_expbuf, index = "
+			       << arg->index << " fd = " << file->efd();
+
+	if (!validateBufferType(arg->type))
+		return -EINVAL;
+
+	/* Only buffers allocated by libcamera can be exported. */
+	if (memory_ != V4L2_MEMORY_MMAP || arg->index >= bufferCount_ ||
+	    arg->plane != 0)
+		return -EINVAL;
+
+	if (arg->flags & ~(O_CLOEXEC | O_ACCMODE))
+		return -EINVAL;
+
+	FileDescriptor fd = vcam_->getBufferFd(arg->index);
+	if (!fd.isValid())
+		return -EINVAL;
+
+	int cmd = arg->flags & O_CLOEXEC ? F_DUPFD_CLOEXEC : F_DUPFD;
+	int ret = ::fcntl(fd.fd(), cmd, 0);
+	if (ret < 0)
+		return -errno;
+
+	arg->fd = ret;
+	memset(arg->reserved, 0, sizeof(arg->reserved));
+
+	return 0;
+}
+
 const std::set<unsigned long> V4L2CameraProxy::supportedIoctls_ = {
 	VIDIOC_QUERYCAP,
 	VIDIOC_ENUM_FRAMESIZES,
@@ -688,6 +797,7 @@ const std::set<unsigned long> V4L2CameraProxy::supportedIoctls_ = {
 	VIDIOC_DQBUF,
 	VIDIOC_STREAMON,
 	VIDIOC_STREAMOFF,
+	VIDIOC_EXPBUF,
 };
 
 int V4L2CameraProxy::ioctl(V4L2CameraFile *file, unsigned long request, void *arg)
@@ -762,6 +872,9 @@ int V4L2CameraProxy::ioctl(V4L2CameraFile *file, unsigned long request, void *ar
 	case VIDIOC_STREAMOFF:
 		ret = vidioc_streamoff(file, static_cast<int *>(arg));
 		break;
+	case VIDIOC_EXPBUF:
+		ret = vidioc_expbuf(file, static_cast<struct v4l2_exportbuffer *>(arg));
+		break;
 	default:
 		ret = -ENOTTY;
 		break;
@@ -815,3 +928,78 @@ void V4L2CameraProxy::release(V4L2CameraFile *file)
 
 	owner_ = nullptr;
 }
+
+bool V4L2CameraProxy::isReader(V4L2CameraFile *file)
+{
+	return readers_.find(file) != readers_.end();
+}
+
+void V4L2CameraProxy::releaseReader(V4L2CameraFile *file)
+{
+	if (!readers_.erase(file))
+		return;
+
+	vcam_->removeReader(file->efd());
+}
+
+int V4L2CameraProxy::readerQbuf(V4L2CameraFile *file, struct v4l2_buffer *arg)
+{
+	if (!validateBufferType(arg->type) ||
+	    arg->memory != V4L2_MEMORY_MMAP)
+		return -EINVAL;
+
+	/*
+	 * Buffers are queued implicitly to readers when the owner captures
+	 * them. Queuing a buffer returns the reference held by the reader,
+	 * queuing a buffer that isn't held is a no-op.
+	 */
+	vcam_->releaseReaderBuffer(file->efd(), arg->index);
+
+	arg->flags = (buffers_[arg->index].flags & V4L2_BUF_FLAG_MAPPED)
+		   | V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+
+	return 0;
+}
+
+int V4L2CameraProxy::readerDqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
+				 MutexLocker *locker)
+{
+	if (!vcam_->isRunning())
+		return -EINVAL;
+
+	if (!validateBufferType(arg->type) ||
+	    arg->memory != V4L2_MEMORY_MMAP)
+		return -EINVAL;
+
+	std::optional<V4L2Camera::Buffer> buffer =
+		vcam_->dequeueReaderBuffer(file->efd());
+
+	if (!buffer && !file->nonBlocking()) {
+		locker->unlock();
+		vcam_->waitForReaderBuffer(file->efd());
+		locker->lock();
+
+		/* The reader may have been released while waiting. */
+		if (!isReader(file) || !vcam_->isRunning())
+			return -EINVAL;
+
+		buffer = vcam_->dequeueReaderBuffer(file->efd());
+	}
+
+	if (!buffer)
+		return -EAGAIN;
+
+	struct v4l2_buffer buf = buffers_[buffer->index_];
+	buf.flags &= V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	fillBuffer(*buffer, &buf);
+	buf.flags &= ~V4L2_BUF_FLAG_DONE;
+	buf.length = sizeimage_;
+	*arg = buf;
+
+	uint64_t data;
+	int ret = ::read(file->efd(), &data, sizeof(data));
+	if (ret != sizeof(data))
+		LOG(V4L2Compat, Error) << "Failed to clear eventfd POLLIN";
+
+	return 0;
+}
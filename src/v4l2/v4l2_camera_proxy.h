@@ -30,7 +30,8 @@ public:
 
 	int open(V4L2CameraFile *file);
 	void close(V4L2CameraFile *file);
-	void *mmap(void *addr, size_t length, int prot, int flags, off64_t offset);
+	void *mmap(V4L2CameraFile *file, void *addr, size_t length, int prot,
+		   int flags, off64_t offset);
 	int munmap(void *addr, size_t length);
 
 	int ioctl(V4L2CameraFile *file, unsigned long request, void *arg);
@@ -44,6 +45,7 @@ private:
 	enum v4l2_priority maxPriority();
 	void updateBuffers();
 	void freeBuffers();
+	void fillBuffer(const V4L2Camera::Buffer &buffer, struct v4l2_buffer *buf);
 
 	int vidioc_querycap(struct v4l2_capability *arg);
 	int vidioc_enum_framesizes(V4L2CameraFile *file, struct v4l2_frmsizeenum *arg);
@@ -62,11 +64,18 @@ private:
 	int vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg, MutexLocker *locker);
 	int vidioc_streamon(V4L2CameraFile *file, int *arg);
 	int vidioc_streamoff(V4L2CameraFile *file, int *arg);
+	int vidioc_expbuf(V4L2CameraFile *file, struct v4l2_exportbuffer *arg);
 
 	bool hasOwnership(V4L2CameraFile *file);
 	int acquire(V4L2CameraFile *file);
 	void release(V4L2CameraFile *file);
 
+	bool isReader(V4L2CameraFile *file);
+	void releaseReader(V4L2CameraFile *file);
+	int readerQbuf(V4L2CameraFile *file, struct v4l2_buffer *arg);
+	int readerDqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg,
+			MutexLocker *locker);
+
 	static const std::set<unsigned long> supportedIoctls_;
 
 	unsigned int refcount_;
@@ -76,6 +85,7 @@ private:
 	unsigned int bufferCount_;
 	unsigned int currentBuf_;
 	unsigned int sizeimage_;
+	uint32_t memory_;
 
 	struct v4l2_capability capabilities_;
 	struct v4l2_pix_format v4l2PixFormat_;
@@ -98,6 +108,15 @@ private:
 	 */
 	V4L2CameraFile *owner_;
 
+	/*
+	 * Files that request MMAP buffers while the proxy is owned by another
+	 * file become readers. They share the buffers of the owner, receive
+	 * references to the buffers it captures, and can only map them
+	 * read-only. A buffer is requeued to the camera once the owner and all
+	 * readers have queued it back.
+	 */
+	std::set<V4L2CameraFile *> readers_;
+
 	/* This mutex is to serialize access to the proxy. */
 	Mutex proxyMutex_;
 };
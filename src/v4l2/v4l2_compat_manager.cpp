@@ -40,8 +40,11 @@ void get_symbol(T &func, const char *name)
 } /* namespace */
 
 V4L2CompatManager::V4L2CompatManager()
-	: cm_(nullptr)
+	: highFds_(0), mmapCount_(0), cm_(nullptr)
 {
+	for (std::atomic<uint64_t> &word : fdBitmap_)
+		word.store(0, std::memory_order_relaxed);
+
 	get_symbol(fops_.openat, "openat64");
 	get_symbol(fops_.dup, "dup");
 	get_symbol(fops_.close, "close");
@@ -97,8 +100,39 @@ V4L2CompatManager *V4L2CompatManager::instance()
 	return &instance;
 }
 
+bool V4L2CompatManager::isCameraFd(int fd) const
+{
+	if (fd < 0)
+		return false;
+
+	if (static_cast<unsigned int>(fd) >= kMaxBitmapFds)
+		return highFds_.load(std::memory_order_acquire) != 0;
+
+	uint64_t word = fdBitmap_[fd / 64].load(std::memory_order_acquire);
+	return word & (1ULL << (fd % 64));
+}
+
+void V4L2CompatManager::addFile(int fd, std::shared_ptr<V4L2CameraFile> file)
+{
+	std::lock_guard<std::mutex> locker(lock_);
+
+	if (!files_.emplace(fd, std::move(file)).second)
+		return;
+
+	if (static_cast<unsigned int>(fd) >= kMaxBitmapFds)
+		highFds_.fetch_add(1, std::memory_order_release);
+	else
+		fdBitmap_[fd / 64].fetch_or(1ULL << (fd % 64),
+					    std::memory_order_release);
+}
+
 std::shared_ptr<V4L2CameraFile> V4L2CompatManager::cameraFile(int fd)
 {
+	if (!isCameraFd(fd))
+		return nullptr;
+
+	std::lock_guard<std::mutex> locker(lock_);
+
 	auto file = files_.find(fd);
 	if (file == files_.end())
 		return nullptr;
@@ -156,7 +190,7 @@ int V4L2CompatManager::openat(int dirfd, const char *path, int oflag, mode_t mod
 		return efd;
 
 	V4L2CameraProxy *proxy = proxies_[ret].get();
-	files_.emplace(efd, std::make_shared<V4L2CameraFile>(efd, oflag & O_NONBLOCK, proxy));
+	addFile(efd, std::make_shared<V4L2CameraFile>(efd, oflag & O_NONBLOCK, proxy));
 
 	return efd;
 }
@@ -167,18 +201,36 @@ int V4L2CompatManager::dup(int oldfd)
 	if (newfd < 0)
 		return newfd;
 
-	auto file = files_.find(oldfd);
-	if (file != files_.end())
-		files_[newfd] = file->second;
+	std::shared_ptr<V4L2CameraFile> file = cameraFile(oldfd);
+	if (file)
+		addFile(newfd, std::move(file));
 
 	return newfd;
 }
 
 int V4L2CompatManager::close(int fd)
 {
-	auto file = files_.find(fd);
-	if (file != files_.end())
-		files_.erase(file);
+	/*
+	 * Remove the file before closing the fd, as the fd number may be
+	 * reused by a concurrent open as soon as it is closed.
+	 */
+	if (isCameraFd(fd)) {
+		std::shared_ptr<V4L2CameraFile> file;
+		std::lock_guard<std::mutex> locker(lock_);
+
+		auto iter = files_.find(fd);
+		if (iter != files_.end()) {
+			/* Release the file after the lock. */
+			file = std::move(iter->second);
+			files_.erase(iter);
+
+			if (static_cast<unsigned int>(fd) >= kMaxBitmapFds)
+				highFds_.fetch_sub(1, std::memory_order_release);
+			else
+				fdBitmap_[fd / 64].fetch_and(~(1ULL << (fd % 64)),
+							     std::memory_order_release);
+		}
+	}
 
 	/* We still need to close the eventfd. */
 	return fops_.close(fd);
@@ -191,7 +243,8 @@ void *V4L2CompatManager::mmap(void *addr, size_t length, int prot, int flags,
 	if (!file)
 		return fops_.mmap(addr, length, prot, flags, fd, offset);
 
-	void *map = file->proxy()->mmap(addr, length, prot, flags, offset);
+	void *map = file->proxy()->mmap(file.get(), addr, length, prot, flags,
+					offset);
 	if (map == MAP_FAILED)
 		return map;
 
@@ -199,23 +252,37 @@ void *V4L2CompatManager::mmap(void *addr, size_t length, int prot, int flags,
 	 * Map to V4L2CameraProxy directly to prevent adding more references
 	 * to V4L2CameraFile.
 	 */
+	std::lock_guard<std::mutex> locker(lock_);
 	mmaps_[map] = file->proxy();
+	mmapCount_.fetch_add(1, std::memory_order_release);
+
 	return map;
 }
 
 int V4L2CompatManager::munmap(void *addr, size_t length)
 {
+	/* Skip the lookup when no camera buffer is mapped. */
+	if (!mmapCount_.load(std::memory_order_acquire))
+		return fops_.munmap(addr, length);
+
+	std::unique_lock<std::mutex> locker(lock_);
+
 	auto device = mmaps_.find(addr);
-	if (device == mmaps_.end())
+	if (device == mmaps_.end()) {
+		locker.unlock();
 		return fops_.munmap(addr, length);
+	}
 
 	V4L2CameraProxy *proxy = device->second;
+	locker.unlock();
 
 	int ret = proxy->munmap(addr, length);
 	if (ret < 0)
 		return ret;
 
-	mmaps_.erase(device);
+	locker.lock();
+	if (mmaps_.erase(addr))
+		mmapCount_.fetch_sub(1, std::memory_order_release);
 
 	return 0;
 }
@@ -8,9 +8,13 @@
 #ifndef __V4L2_COMPAT_MANAGER_H__
 #define __V4L2_COMPAT_MANAGER_H__
 
+#include <array>
+#include <atomic>
 #include <fcntl.h>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <stdint.h>
 #include <sys/types.h>
 #include <vector>
 
@@ -62,11 +66,28 @@ private:
 	int getCameraIndex(int fd);
 	std::shared_ptr<V4L2CameraFile> cameraFile(int fd);
 
+	bool isCameraFd(int fd) const;
+	void addFile(int fd, std::shared_ptr<V4L2CameraFile> file);
+
+	/*
+	 * Bitmap of the fds that refer to camera files, checked without
+	 * locking to quickly pass through operations on other fds. Camera fds
+	 * beyond the size of the bitmap are only counted.
+	 */
+	static constexpr unsigned int kMaxBitmapFds = 65536;
+
+	std::array<std::atomic<uint64_t>, kMaxBitmapFds / 64> fdBitmap_;
+	std::atomic<unsigned int> highFds_;
+	std::atomic<unsigned int> mmapCount_;
+
 	FileOperations fops_;
 
 	CameraManager *cm_;
 
 	std::vector<std::unique_ptr<V4L2CameraProxy>> proxies_;
+
+	/* Protects the files_ and mmaps_ maps. */
+	std::mutex lock_;
 	std::map<int, std::shared_ptr<V4L2CameraFile>> files_;
 	std::map<void *, V4L2CameraProxy *> mmaps_;
 };
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_v4l2_test.cpp - Test the Android HAL V4L2 JPEG encoder
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/stream.h>
+
+#include "jpeg/encoder_v4l2.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(JPEG)
+
+class EncoderV4L2Test : public Test
+{
+protected:
+	int testWriteJpeg()
+	{
+		/* SOI, JFIF APP0 segment, and the start of the entropy data. */
+		const std::vector<uint8_t> jpeg = {
+			0xff, 0xd8,
+			0xff, 0xe0, 0x00, 0x04, 0x4a, 0x46,
+			0xff, 0xdb, 0x12, 0x34,
+		};
+		const std::vector<uint8_t> exif = { 0x45, 0x78, 0x69, 0x66 };
+		const std::vector<uint8_t> expected = {
+			0xff, 0xd8,
+			0xff, 0xe1, 0x00, 0x06, 0x45, 0x78, 0x69, 0x66,
+			0xff, 0xdb, 0x12, 0x34,
+		};
+
+		/* The APP0 segment is replaced by the EXIF APP1 segment. */
+		std::vector<uint8_t> output(64);
+		int ret = EncoderV4L2::writeJpeg(jpeg, output, exif);
+		if (ret != static_cast<int>(expected.size())) {
+			cerr << "Invalid JPEG size " << ret << " with EXIF" << endl;
+			return TestFail;
+		}
+
+		output.resize(ret);
+		if (output != expected) {
+			cerr << "Invalid JPEG data with EXIF" << endl;
+			return TestFail;
+		}
+
+		/* Without EXIF data, the encoder output is copied untouched. */
+		output.assign(64, 0);
+		ret = EncoderV4L2::writeJpeg(jpeg, output, {});
+		output.resize(ret > 0 ? ret : 0);
+		if (output != jpeg) {
+			cerr << "Invalid JPEG data without EXIF" << endl;
+			return TestFail;
+		}
+
+		output.assign(expected.size() - 1, 0);
+		ret = EncoderV4L2::writeJpeg(jpeg, output, exif);
+		if (ret != -ENOSPC) {
+			cerr << "Destination overflow not detected" << endl;
+			return TestFail;
+		}
+
+		/* Data without a SOI marker and truncated segments are rejected. */
+		output.assign(64, 0);
+		const std::vector<uint8_t> invalid(jpeg.begin() + 2, jpeg.end());
+		ret = EncoderV4L2::writeJpeg(invalid, output, exif);
+		if (ret != -EINVAL) {
+			cerr << "Missing SOI marker not detected" << endl;
+			return TestFail;
+		}
+
+		const std::vector<uint8_t> truncated(jpeg.begin(), jpeg.begin() + 7);
+		ret = EncoderV4L2::writeJpeg(truncated, output, exif);
+		if (ret != -EINVAL) {
+			cerr << "Truncated APP0 segment not detected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testDisabled()
+	{
+		StreamConfiguration cfg;
+		cfg.pixelFormat = formats::NV12;
+		cfg.size = { 640, 480 };
+
+		/* The hardware encoder can be disabled by the user. */
+		setenv("LIBCAMERA_ANDROID_JPEG_ENCODER", "libjpeg", 1);
+
+		EncoderV4L2 encoder;
+		if (encoder.configure(cfg) != -ENODEV) {
+			cerr << "Hardware encoder used when disabled" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret = testWriteJpeg();
+		if (ret != TestPass)
+			return ret;
+
+		return testDisabled();
+	}
+
+	void cleanup() override
+	{
+		unsetenv("LIBCAMERA_ANDROID_JPEG_ENCODER");
+	}
+};
+
+TEST_REGISTER(EncoderV4L2Test)
@@ -5,7 +5,10 @@
  * bayer_format.cpp - BayerFormat class tests
  */
 
+#include <algorithm>
+#include <errno.h>
 #include <iostream>
+#include <vector>
 
 #include <libcamera/transform.h>
 
@@ -204,6 +207,65 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Unpack and repack lines of every supported packing with
+		 * widths that don't match the packing groups, and make sure
+		 * the data survives the round trip.
+		 */
+		const BayerFormat packedFormats[] = {
+			{ BayerFormat::BGGR, 8, BayerFormat::None },
+			{ BayerFormat::BGGR, 10, BayerFormat::None },
+			{ BayerFormat::BGGR, 10, BayerFormat::CSI2Packed },
+			{ BayerFormat::BGGR, 12, BayerFormat::CSI2Packed },
+			{ BayerFormat::BGGR, 14, BayerFormat::CSI2Packed },
+			{ BayerFormat::BGGR, 10, BayerFormat::IPU3Packed },
+		};
+
+		for (const BayerFormat &format : packedFormats) {
+			for (unsigned int width : { 1U, 7U, 24U, 51U, 640U }) {
+				std::vector<uint16_t> pixels(width);
+				for (unsigned int x = 0; x < width; ++x)
+					pixels[x] = (x * 2654435761U >> 7) &
+						    ((1 << format.bitDepth) - 1);
+
+				std::vector<uint8_t> line(format.lineSize(width));
+				std::vector<uint16_t> unpacked(width);
+
+				if (line.empty() ||
+				    format.packLine(pixels.data(), line.data(), width) ||
+				    format.unpackLine(line.data(), unpacked.data(), width)) {
+					cerr << "Failed to pack " << format.toString()
+					     << endl;
+					return TestFail;
+				}
+
+				if (unpacked != pixels) {
+					cerr << "Round trip of " << format.toString()
+					     << " with width " << width
+					     << " doesn't preserve pixels" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		/* Check the CSI-2 packed layout against a known line. */
+		const uint8_t csi2Line[] = { 0x12, 0x34, 0x56, 0x78, 0xe4 };
+		const uint16_t csi2Pixels[] = { 0x048, 0x0d1, 0x15a, 0x1e3 };
+		uint16_t pixels[4];
+
+		bayerFmt = BayerFormat(BayerFormat::BGGR, 10, BayerFormat::CSI2Packed);
+		if (bayerFmt.unpackLine(csi2Line, pixels, 4) ||
+		    !std::equal(pixels, pixels + 4, csi2Pixels)) {
+			cerr << "Incorrect CSI-2 10-bit unpacking" << endl;
+			return TestFail;
+		}
+
+		bayerFmt = BayerFormat(BayerFormat::BGGR, 16, BayerFormat::CSI2Packed);
+		if (bayerFmt.lineSize(4) || bayerFmt.unpackLine(csi2Line, pixels, 4) != -EINVAL) {
+			cerr << "Unsupported packing should be rejected" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
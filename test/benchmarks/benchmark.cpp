@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * benchmark.cpp - libcamera benchmark base class
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace std::chrono;
+
+Benchmark::Benchmark(const std::string &name)
+	: name_(name)
+{
+}
+
+/*
+ * Measure the time taken by an operation. The \a operation function is called
+ * with the number of iterations to run, and shall perform the operation that
+ * many times before returning, including waiting for the completion of any
+ * asynchronous processing.
+ */
+void Benchmark::measure(const std::string &name, const Operation &operation)
+{
+	/* Warm up caches and calibrate the batch size. */
+	unsigned int iterations = 1;
+	while (true) {
+		auto start = steady_clock::now();
+		operation(iterations);
+		auto duration = steady_clock::now() - start;
+
+		if (duration >= MinBatchDuration || iterations >= (1U << 30))
+			break;
+
+		iterations *= 2;
+	}
+
+	std::vector<double> samples;
+	for (unsigned int i = 0; i < Repetitions; i++) {
+		auto start = steady_clock::now();
+		operation(iterations);
+		nanoseconds duration = steady_clock::now() - start;
+
+		samples.push_back(static_cast<double>(duration.count()) / iterations);
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	std::cout << "{ \"benchmark\": \"" << name_ << "\""
+		  << ", \"name\": \"" << name << "\""
+		  << ", \"iterations\": " << iterations
+		  << ", \"repetitions\": " << Repetitions
+		  << ", \"ns_per_op\": " << samples[samples.size() / 2]
+		  << ", \"min_ns_per_op\": " << samples.front()
+		  << ", \"max_ns_per_op\": " << samples.back()
+		  << " }" << std::endl;
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * benchmark.h - libcamera benchmark base class
+ */
+#ifndef __TEST_BENCHMARK_H__
+#define __TEST_BENCHMARK_H__
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include "test.h"
+
+/*
+ * Benchmarks run each measured operation in batches, doubling the batch size
+ * until a batch lasts at least MinBatchDuration, and then time Repetitions
+ * batches of that size. The results are printed one per line in JSON format,
+ * and contain the median, minimum and maximum time per operation in
+ * nanoseconds.
+ */
+class Benchmark : public Test
+{
+public:
+	Benchmark(const std::string &name);
+
+protected:
+	using Operation = std::function<void(unsigned int iterations)>;
+
+	void measure(const std::string &name, const Operation &operation);
+
+	template<typename T>
+	static void doNotOptimize(T const &value)
+	{
+		asm volatile("" : : "r,m"(value) : "memory");
+	}
+
+private:
+	static constexpr unsigned int Repetitions = 5;
+	static constexpr std::chrono::milliseconds MinBatchDuration{ 20 };
+
+	std::string name_;
+};
+
+#define BENCHMARK_REGISTER(klass) TEST_REGISTER(klass)
+
+#endif /* __TEST_BENCHMARK_H__ */
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * buffers.cpp - V4L2BufferCache and MappedFrameBuffer benchmarks
+ */
+
+#include <iostream>
+#include <memory>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/file_descriptor.h>
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/mapped_framebuffer.h"
+#include "libcamera/internal/v4l2_videodevice.h"
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class BuffersBenchmark : public Benchmark
+{
+public:
+	BuffersBenchmark()
+		: Benchmark("buffers")
+	{
+	}
+
+protected:
+	static constexpr unsigned int NumBuffers = 8;
+	static constexpr unsigned int BufferSize = 640 * 480 * 2;
+
+	int init() override
+	{
+		/* Back the buffers with memfds, no device is needed. */
+		for (unsigned int i = 0; i < NumBuffers; i++) {
+			int fd = memfd_create("benchmark", MFD_CLOEXEC);
+			if (fd < 0 || ftruncate(fd, BufferSize) < 0) {
+				std::cerr << "Failed to create buffer" << std::endl;
+				return TestFail;
+			}
+
+			FrameBuffer::Plane plane;
+			plane.fd = FileDescriptor(std::move(fd));
+			plane.length = BufferSize;
+
+			buffers_.push_back(std::make_unique<FrameBuffer>(
+				std::vector<FrameBuffer::Plane>{ plane }));
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		/* All buffers fit in the cache, every lookup is a hit. */
+		V4L2BufferCache hot(buffers_);
+
+		measure("buffer-cache-hit", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				int index = hot.get(*buffers_[i % NumBuffers]);
+				hot.put(index);
+			}
+		});
+
+		/* Half of the buffers fit in the cache, lookups miss. */
+		V4L2BufferCache cold(NumBuffers / 2);
+
+		measure("buffer-cache-miss", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				int index = cold.get(*buffers_[i % NumBuffers]);
+				cold.put(index);
+			}
+		});
+
+		measure("mapped-framebuffer", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				MappedFrameBuffer map(buffers_[i % NumBuffers].get(),
+						      MappedFrameBuffer::MapFlag::Read);
+				doNotOptimize(map.maps()[0][0]);
+			}
+		});
+
+		return TestPass;
+	}
+
+private:
+	std::vector<std::unique_ptr<FrameBuffer>> buffers_;
+};
+
+BENCHMARK_REGISTER(BuffersBenchmark)
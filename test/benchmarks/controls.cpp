@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * controls.cpp - ControlList benchmarks
+ */
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class ControlListBenchmark : public Benchmark
+{
+public:
+	ControlListBenchmark()
+		: Benchmark("controls"),
+		  infoMap_({ { &controls::AeEnable, ControlInfo(false, true) },
+			     { &controls::Brightness, ControlInfo(-1.0f, 1.0f) },
+			     { &controls::Contrast, ControlInfo(0.0f, 2.0f) },
+			     { &controls::Saturation, ControlInfo(0.0f, 2.0f) },
+			     { &controls::ExposureTime, ControlInfo(1, 66666) },
+			     { &controls::AnalogueGain, ControlInfo(1.0f, 16.0f) } },
+			   controls::controls)
+	{
+	}
+
+protected:
+	void fill(ControlList &list)
+	{
+		list.set(controls::AeEnable, false);
+		list.set(controls::Brightness, 0.5f);
+		list.set(controls::Contrast, 1.2f);
+		list.set(controls::Saturation, 0.2f);
+		list.set(controls::ExposureTime, 33333);
+		list.set(controls::AnalogueGain, 2.0f);
+	}
+
+	int run() override
+	{
+		measure("set", [&](unsigned int iterations) {
+			ControlList list(infoMap_);
+			for (unsigned int i = 0; i < iterations; i++)
+				fill(list);
+			doNotOptimize(list);
+		});
+
+		ControlList list(infoMap_);
+		fill(list);
+
+		measure("get", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				doNotOptimize(list.get(controls::ExposureTime));
+				doNotOptimize(list.get(controls::AnalogueGain));
+			}
+		});
+
+		measure("merge", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				ControlList merged(infoMap_);
+				merged.merge(list);
+				doNotOptimize(merged);
+			}
+		});
+
+		measure("copy", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				ControlList copy = list;
+				doNotOptimize(copy);
+			}
+		});
+
+		return TestPass;
+	}
+
+private:
+	ControlInfoMap infoMap_;
+};
+
+BENCHMARK_REGISTER(ControlListBenchmark)
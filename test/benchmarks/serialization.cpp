@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * serialization.cpp - ControlSerializer and IPADataSerializer benchmarks
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/control_serializer.h"
+#include "libcamera/internal/ipa_data_serializer.h"
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class SerializationBenchmark : public Benchmark
+{
+public:
+	SerializationBenchmark()
+		: Benchmark("serialization"),
+		  infoMap_({ { &controls::AeEnable, ControlInfo(false, true) },
+			     { &controls::Brightness, ControlInfo(-1.0f, 1.0f) },
+			     { &controls::Contrast, ControlInfo(0.0f, 2.0f) },
+			     { &controls::Saturation, ControlInfo(0.0f, 2.0f) },
+			     { &controls::ExposureTime, ControlInfo(1, 66666) },
+			     { &controls::AnalogueGain, ControlInfo(1.0f, 16.0f) } },
+			   controls::controls),
+		  list_(infoMap_)
+	{
+	}
+
+protected:
+	int init() override
+	{
+		list_.set(controls::AeEnable, false);
+		list_.set(controls::Brightness, 0.5f);
+		list_.set(controls::Contrast, 1.2f);
+		list_.set(controls::Saturation, 0.2f);
+		list_.set(controls::ExposureTime, 33333);
+		list_.set(controls::AnalogueGain, 2.0f);
+
+		return TestPass;
+	}
+
+	int benchmarkControlSerializer()
+	{
+		ControlSerializer serializer;
+		ControlSerializer deserializer;
+
+		std::vector<uint8_t> infoData(serializer.binarySize(infoMap_));
+		ByteStreamBuffer infoBuffer(infoData.data(), infoData.size());
+		if (serializer.serialize(infoMap_, infoBuffer) < 0)
+			return TestFail;
+
+		infoBuffer = ByteStreamBuffer(const_cast<const uint8_t *>(infoData.data()),
+					      infoData.size());
+		if (deserializer.deserialize<ControlInfoMap>(infoBuffer).empty())
+			return TestFail;
+
+		std::vector<uint8_t> listData(serializer.binarySize(list_));
+
+		measure("control-serializer-serialize", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				ByteStreamBuffer buffer(listData.data(), listData.size());
+				serializer.serialize(list_, buffer);
+				doNotOptimize(listData);
+			}
+		});
+
+		measure("control-serializer-deserialize", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				ByteStreamBuffer buffer(const_cast<const uint8_t *>(listData.data()),
+							listData.size());
+				ControlList list = deserializer.deserialize<ControlList>(buffer);
+				doNotOptimize(list);
+			}
+		});
+
+		serializer.setDeltaEncoding(true);
+		std::vector<uint8_t> deltaData;
+
+		measure("control-serializer-serialize-delta", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				deltaData.clear();
+				list_.set(controls::ExposureTime, 10000 + i % 100);
+				serializer.serialize(list_, deltaData);
+				doNotOptimize(deltaData);
+			}
+		});
+
+		return TestPass;
+	}
+
+	void benchmarkIPADataSerializer()
+	{
+		ControlSerializer serializer;
+		ControlSerializer deserializer;
+		std::vector<uint8_t> data;
+		std::vector<int32_t> fds;
+
+		/* Serialize the ControlInfoMap once, as done by IPA proxies. */
+		IPADataSerializer<ControlList>::serialize(list_, data, fds, &serializer);
+		IPADataSerializer<ControlList>::deserialize(data, fds, &deserializer);
+
+		measure("ipa-data-serializer-control-list", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				data.clear();
+				fds.clear();
+				IPADataSerializer<ControlList>::serialize(list_, data, fds,
+									  &serializer);
+				ControlList list =
+					IPADataSerializer<ControlList>::deserialize(data, fds,
+										    &deserializer);
+				doNotOptimize(list);
+			}
+		});
+
+		std::vector<uint32_t> vector(1024);
+		for (unsigned int i = 0; i < vector.size(); i++)
+			vector[i] = i;
+
+		measure("ipa-data-serializer-vector", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				data.clear();
+				fds.clear();
+				IPADataSerializer<std::vector<uint32_t>>::serialize(vector, data, fds);
+				std::vector<uint32_t> out =
+					IPADataSerializer<std::vector<uint32_t>>::deserialize(data, fds);
+				doNotOptimize(out);
+			}
+		});
+
+		std::map<uint32_t, std::string> map;
+		for (unsigned int i = 0; i < 16; i++)
+			map[i] = "value " + std::to_string(i);
+
+		measure("ipa-data-serializer-map", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++) {
+				data.clear();
+				fds.clear();
+				IPADataSerializer<std::map<uint32_t, std::string>>::serialize(map, data, fds);
+				std::map<uint32_t, std::string> out =
+					IPADataSerializer<std::map<uint32_t, std::string>>::deserialize(data, fds);
+				doNotOptimize(out);
+			}
+		});
+	}
+
+	int run() override
+	{
+		if (benchmarkControlSerializer() != TestPass)
+			return TestFail;
+
+		benchmarkIPADataSerializer();
+
+		return TestPass;
+	}
+
+private:
+	ControlInfoMap infoMap_;
+	ControlList list_;
+};
+
+BENCHMARK_REGISTER(SerializationBenchmark)
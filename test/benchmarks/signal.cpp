@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * signal.cpp - Signal and message benchmarks
+ */
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <libcamera/base/message.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: count_(0)
+	{
+	}
+
+	void slot(unsigned int value)
+	{
+		count_.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	void wait(unsigned int count)
+	{
+		while (count_.load(std::memory_order_relaxed) < count)
+			std::this_thread::yield();
+
+		count_ = 0;
+	}
+
+	std::atomic<unsigned int> count_;
+
+protected:
+	void message(Message *msg) override
+	{
+		if (msg->type() != Message::UserMessage) {
+			Object::message(msg);
+			return;
+		}
+
+		count_.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+
+class SignalBenchmark : public Benchmark
+{
+public:
+	SignalBenchmark()
+		: Benchmark("signal")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		remote_.moveToThread(&thread_);
+		thread_.start();
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		Signal<unsigned int> signal;
+
+		signal.connect(&local_, &Receiver::slot);
+
+		measure("emit-direct", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++)
+				signal.emit(1);
+			local_.wait(iterations);
+		});
+
+		signal.disconnect();
+		signal.connect(&remote_, &Receiver::slot);
+
+		measure("emit-queued", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++)
+				signal.emit(1);
+			remote_.wait(iterations);
+		});
+
+		measure("post-message", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++)
+				remote_.postMessage(std::make_unique<Message>(Message::UserMessage));
+			remote_.wait(iterations);
+		});
+
+		measure("post-message-local", [&](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; i++)
+				local_.postMessage(std::make_unique<Message>(Message::UserMessage));
+			Thread::current()->dispatchMessages();
+			local_.wait(iterations);
+		});
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	Thread thread_;
+	Receiver local_;
+	Receiver remote_;
+};
+
+BENCHMARK_REGISTER(SignalBenchmark)
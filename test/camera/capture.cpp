@@ -7,6 +7,7 @@
 
 #include <iostream>
 
+#include <libcamera/control_ids.h>
 #include <libcamera/framebuffer_allocator.h>
 
 #include <libcamera/base/event_dispatcher.h>
@@ -31,6 +32,17 @@ public:
 protected:
 	unsigned int completeBuffersCount_;
 	unsigned int completeRequestsCount_;
+	unsigned int partialMetadataErrors_;
+	Request *partialMetadataRequest_;
+
+	void metadataAvailable(Request *request, const ControlList &metadata)
+	{
+		if (!metadata.contains(controls::SensorTimestamp) ||
+		    !request->metadata().contains(controls::SensorTimestamp))
+			partialMetadataErrors_++;
+
+		partialMetadataRequest_ = request;
+	}
 
 	void bufferComplete([[maybe_unused]] Request *request,
 			    FrameBuffer *buffer)
@@ -50,6 +62,11 @@ protected:
 
 		completeRequestsCount_++;
 
+		/* The partial metadata must be reported before completion. */
+		if (partialMetadataRequest_ != request)
+			partialMetadataErrors_++;
+		partialMetadataRequest_ = nullptr;
+
 		/* Create a new request. */
 		const Stream *stream = buffers.begin()->first;
 		FrameBuffer *buffer = buffers.begin()->second;
@@ -117,8 +134,11 @@ protected:
 
 		completeRequestsCount_ = 0;
 		completeBuffersCount_ = 0;
+		partialMetadataErrors_ = 0;
+		partialMetadataRequest_ = nullptr;
 
 		camera_->bufferCompleted.connect(this, &Capture::bufferComplete);
+		camera_->metadataAvailable.connect(this, &Capture::metadataAvailable);
 		camera_->requestCompleted.connect(this, &Capture::requestComplete);
 
 		if (camera_->start()) {
@@ -154,6 +174,12 @@ protected:
 			return TestFail;
 		}
 
+		if (partialMetadataErrors_) {
+			cout << "Invalid partial metadata reported "
+			     << partialMetadataErrors_ << " times" << endl;
+			return TestFail;
+		}
+
 		if (camera_->stop()) {
 			cout << "Failed to stop camera" << endl;
 			return TestFail;
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera request completion order test
+ */
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+class CompletionOrderTest : public CameraTest, public Test
+{
+public:
+	CompletionOrderTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		completed_.push_back(request->cookie());
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &CompletionOrderTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int setup(bool outOfOrder)
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (outOfOrder &&
+		    camera_->setCompletionOrder(Camera::CompletionOrder::OutOfOrder)) {
+			cout << "Failed to set the completion order" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 2) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		uint64_t cookie = 0;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest(cookie++);
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to associate buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		return TestPass;
+	}
+
+	int capture()
+	{
+		completed_.clear();
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The last request has already missed its deadline. It is
+		 * cancelled as soon as it is queued, while the requests queued
+		 * before it wait for frames to be captured.
+		 */
+		requests_.back()->setDeadline(std::chrono::steady_clock::now() - 1ms);
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && completed_.size() < requests_.size())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (completed_.size() != requests_.size()) {
+			cout << "Only " << completed_.size() << " of "
+			     << requests_.size() << " requests completed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void teardown()
+	{
+		requests_.clear();
+		allocator_.reset();
+		camera_->release();
+	}
+
+	int run() override
+	{
+		/* Out of order, the expired request completes first. */
+		int ret = setup(true);
+		if (ret != TestPass)
+			return ret;
+
+		ret = capture();
+		if (ret != TestPass)
+			return ret;
+
+		if (completed_.front() != requests_.back()->cookie()) {
+			cout << "Cancelled request not completed out of order" << endl;
+			return TestFail;
+		}
+
+		teardown();
+
+		/*
+		 * Releasing the camera restores in-order completion for the next
+		 * user, the expired request completes last.
+		 */
+		ret = setup(false);
+		if (ret != TestPass)
+			return ret;
+
+		ret = capture();
+		if (ret != TestPass)
+			return ret;
+
+		for (unsigned int i = 0; i < completed_.size(); i++) {
+			if (completed_[i] != requests_[i]->cookie()) {
+				cout << "Request " << requests_[i]->cookie()
+				     << " not completed in order" << endl;
+				return TestFail;
+			}
+		}
+
+		teardown();
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::unique_ptr<FrameBufferAllocator> allocator_;
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::vector<uint64_t> completed_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CompletionOrderTest)
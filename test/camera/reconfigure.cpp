@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera Camera reconfiguration test
+ */
+
+#include <iostream>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class Reconfigure : public CameraTest, public Test
+{
+public:
+	Reconfigure()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() == Request::RequestCancelled) {
+			cancelledRequestsCount_++;
+			return;
+		}
+
+		completeRequestsCount_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int capture(const Size &size)
+	{
+		completeRequestsCount_ = 0;
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			request->reuse(Request::ReuseBuffers);
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(500);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (completeRequestsCount_ < requests_.size() * 2) {
+			cout << "Failed to capture enough frames at "
+			     << size.toString() << " (got "
+			     << completeRequestsCount_ << ")" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		allocator_.reset();
+	}
+
+	int reconfigure(const Size &size)
+	{
+		cancelledRequestsCount_ = 0;
+		config_->at(0).size = size;
+
+		if (camera_->reconfigure(config_.get())) {
+			cout << "Failed to reconfigure camera to "
+			     << size.toString() << endl;
+			return TestFail;
+		}
+
+		if (config_->at(0).stream() != stream_ ||
+		    stream_->configuration().size != size) {
+			cout << "Stream configuration not updated" << endl;
+			return TestFail;
+		}
+
+		if (!cancelledRequestsCount_) {
+			cout << "No request cancelled by reconfiguration" << endl;
+			return TestFail;
+		}
+
+		return capture(size);
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		/* Configurations can't be prepared before configuring the camera. */
+		if (camera_->prepareConfiguration(config_.get()) != -EACCES) {
+			cout << "Configuration prepared on unconfigured camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Allocate buffers for the default configuration, they are large
+		 * enough to be used with the smaller configuration below.
+		 */
+		stream_ = config_->at(0).stream();
+		if (allocator_->allocate(stream_) < 0)
+			return TestFail;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream_)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream_, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		/* Reconfiguring a camera that isn't running must fail. */
+		if (camera_->reconfigure(config_.get()) != -EACCES) {
+			cout << "Stopped camera reconfigured" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &Reconfigure::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		const Size defaultSize = config_->at(0).size;
+		int ret = capture(defaultSize);
+		if (ret != TestPass)
+			return ret;
+
+		/* An invalid configuration must leave the camera running. */
+		std::unique_ptr<CameraConfiguration> invalid =
+			camera_->generateConfiguration({});
+		if (invalid && camera_->reconfigure(invalid.get()) != -EINVAL) {
+			cout << "Invalid configuration accepted" << endl;
+			return TestFail;
+		}
+
+		if (invalid && camera_->prepareConfiguration(invalid.get()) != -EINVAL) {
+			cout << "Invalid configuration prepared" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Prepare a smaller configuration while running and switch to
+		 * it, then switch back to the configuration the camera has been
+		 * configured with. Both switches can use the prepared path.
+		 */
+		std::unique_ptr<CameraConfiguration> prepared =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		prepared->at(0).size = { 960, 540 };
+
+		if (camera_->prepareConfiguration(prepared.get())) {
+			cout << "Failed to prepare configuration" << endl;
+			return TestFail;
+		}
+
+		ret = reconfigure(prepared->at(0).size);
+		if (ret != TestPass)
+			return ret;
+
+		ret = reconfigure(defaultSize);
+		if (ret != TestPass)
+			return ret;
+
+		/* Unprepared configurations go through a full restart. */
+		ret = reconfigure({ 1440, 810 });
+		if (ret != TestPass)
+			return ret;
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	unsigned int completeRequestsCount_;
+	unsigned int cancelledRequestsCount_;
+
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::unique_ptr<CameraConfiguration> config_;
+	Stream *stream_;
+	std::unique_ptr<FrameBufferAllocator> allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(Reconfigure)
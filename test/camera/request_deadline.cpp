@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera request deadline test
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+using namespace std::chrono_literals;
+
+namespace {
+
+class RequestDeadlineTest : public CameraTest, public Test
+{
+public:
+	RequestDeadlineTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() == Request::RequestCancelled) {
+			cancelledRequestsCount_++;
+
+			/* The buffers of skipped requests are cancelled too. */
+			for (const auto &[stream, buffer] : request->buffers()) {
+				if (buffer->metadata().status != FrameMetadata::FrameCancelled)
+					bufferErrors_++;
+			}
+		} else {
+			completeRequestsCount_++;
+		}
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+
+		return TestPass;
+	}
+
+	int testExpired()
+	{
+		std::unique_ptr<Request> request = camera_->createRequest();
+
+		if (request->expired()) {
+			cout << "Request without deadline reported as expired" << endl;
+			return TestFail;
+		}
+
+		request->setDeadline(std::chrono::steady_clock::now() + 1h);
+		if (request->expired()) {
+			cout << "Request with future deadline reported as expired" << endl;
+			return TestFail;
+		}
+
+		request->setDeadline(std::chrono::steady_clock::now() - 1ms);
+		if (!request->expired()) {
+			cout << "Request with past deadline not reported as expired" << endl;
+			return TestFail;
+		}
+
+		request->reuse();
+		if (request->expired() ||
+		    request->deadline() != std::chrono::steady_clock::time_point{}) {
+			cout << "Request deadline not reset by reuse()" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int capture(std::chrono::steady_clock::duration deadline)
+	{
+		cancelledRequestsCount_ = 0;
+		completeRequestsCount_ = 0;
+		bufferErrors_ = 0;
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			request->setDeadline(std::chrono::steady_clock::now() + deadline);
+
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() &&
+		       cancelledRequestsCount_ + completeRequestsCount_ < requests_.size())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			const Request::BufferMap buffers = request->buffers();
+
+			request->reuse();
+			for (const auto &[stream, buffer] : buffers)
+				request->addBuffer(stream, buffer);
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret = testExpired();
+		if (ret != TestPass)
+			return ret;
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+
+		ret = allocator_->allocate(stream);
+		if (ret < 0)
+			return TestFail;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to associate buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		camera_->requestCompleted.connect(this, &RequestDeadlineTest::requestComplete);
+
+		/* Requests whose deadline has already passed must be skipped. */
+		ret = capture(-1ms);
+		if (ret != TestPass)
+			return ret;
+
+		if (cancelledRequestsCount_ != requests_.size() ||
+		    completeRequestsCount_ != 0) {
+			cout << "Expired requests not skipped (" << cancelledRequestsCount_
+			     << " cancelled, " << completeRequestsCount_
+			     << " completed)" << endl;
+			return TestFail;
+		}
+
+		if (bufferErrors_) {
+			cout << "Buffers of expired requests not cancelled" << endl;
+			return TestFail;
+		}
+
+		/* Requests with a distant deadline must be processed normally. */
+		ret = capture(1h);
+		if (ret != TestPass)
+			return ret;
+
+		if (completeRequestsCount_ != requests_.size() ||
+		    cancelledRequestsCount_ != 0) {
+			cout << "Requests with pending deadline not processed ("
+			     << completeRequestsCount_ << " completed, "
+			     << cancelledRequestsCount_ << " cancelled)" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	unsigned int cancelledRequestsCount_;
+	unsigned int completeRequestsCount_;
+	unsigned int bufferErrors_;
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::unique_ptr<FrameBufferAllocator> allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestDeadlineTest)
@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera RequestPool test
+ */
+
+#include <iostream>
+
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/request_pool.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class RequestPoolTest : public CameraTest, public Test
+{
+public:
+	RequestPoolTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		/* Recycle the request with its buffer through the pool. */
+		if (pool_->release(request, Request::ReuseBuffers)) {
+			status_ = TestFail;
+			return;
+		}
+
+		Request *next = pool_->acquire();
+		if (next != request) {
+			status_ = TestFail;
+			return;
+		}
+
+		camera_->queueRequest(next);
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+		pool_ = std::make_unique<RequestPool>(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		pool_.reset();
+		allocator_.reset();
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		/* Requests can't be created before configuring the camera. */
+		if (pool_->allocate(1) != -EACCES) {
+			cout << "Pool allocated requests for unconfigured camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+
+		int ret = allocator_->allocate(stream);
+		if (ret < 0)
+			return TestFail;
+
+		const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
+			allocator_->buffers(stream);
+
+		if (pool_->allocate(buffers.size())) {
+			cout << "Failed to allocate requests" << endl;
+			return TestFail;
+		}
+
+		if (pool_->size() != buffers.size() ||
+		    pool_->available() != buffers.size()) {
+			cout << "Invalid pool size" << endl;
+			return TestFail;
+		}
+
+		/* Requests are lent in order, once each. */
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < buffers.size(); i++) {
+			Request *request = pool_->acquire();
+			if (!request || request->cookie() != i) {
+				cout << "Unexpected request " << i << " lent" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream, buffers[i].get())) {
+				cout << "Failed to associate buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		if (pool_->acquire() || pool_->available()) {
+			cout << "Request lent from exhausted pool" << endl;
+			return TestFail;
+		}
+
+		Request foreign(camera_.get());
+		if (pool_->release(&foreign) != -EINVAL) {
+			cout << "Foreign request released to the pool" << endl;
+			return TestFail;
+		}
+
+		completeRequestsCount_ = 0;
+		camera_->requestCompleted.connect(this, &RequestPoolTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (Request *request : requests) {
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (status_ != TestPass) {
+			cout << "Failed to recycle requests" << endl;
+			return TestFail;
+		}
+
+		if (completeRequestsCount_ < buffers.size() * 2) {
+			cout << "Failed to capture enough frames (got "
+			     << completeRequestsCount_ << " expected at least "
+			     << buffers.size() * 2 << ")" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	unsigned int completeRequestsCount_;
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::unique_ptr<FrameBufferAllocator> allocator_;
+	std::unique_ptr<RequestPool> pool_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestPoolTest)
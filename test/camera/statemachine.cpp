@@ -41,6 +41,9 @@ protected:
 		if (camera_->queueRequest(&request) != -EACCES)
 			return TestFail;
 
+		if (camera_->setCompletionOrder(Camera::CompletionOrder::OutOfOrder) != -EACCES)
+			return TestFail;
+
 		/* Test operations which should pass. */
 		if (camera_->release())
 			return TestFail;
@@ -75,6 +78,9 @@ protected:
 		if (camera_->stop())
 			return TestFail;
 
+		if (camera_->setCompletionOrder(Camera::CompletionOrder::OutOfOrder))
+			return TestFail;
+
 		/* Test valid state transitions, end in Configured state. */
 		if (camera_->release())
 			return TestFail;
@@ -98,11 +104,18 @@ protected:
 		if (camera_->queueRequest(&request1) != -EACCES)
 			return TestFail;
 
+		Request *requests[] = { &request1 };
+		if (camera_->queueRequests(requests) != -EACCES)
+			return TestFail;
+
 		/* Test operations which should pass. */
 		std::unique_ptr<Request> request2 = camera_->createRequest();
 		if (!request2)
 			return TestFail;
 
+		if (camera_->setCompletionOrder(Camera::CompletionOrder::InOrder))
+			return TestFail;
+
 		if (camera_->stop())
 			return TestFail;
 
@@ -122,6 +135,25 @@ protected:
 		if (allocator_->allocate(stream) < 0)
 			return TestFail;
 
+		/* Test preparing the camera and releasing the resources. */
+		if (camera_->prepare())
+			return TestFail;
+
+		if (camera_->prepare() != -EACCES)
+			return TestFail;
+
+		if (camera_->configure(defconf_.get()) != -EACCES)
+			return TestFail;
+
+		if (camera_->release() != -EBUSY)
+			return TestFail;
+
+		if (camera_->stop())
+			return TestFail;
+
+		if (camera_->prepare())
+			return TestFail;
+
 		if (camera_->start())
 			return TestFail;
 
@@ -143,6 +175,12 @@ protected:
 		if (camera_->start() != -EACCES)
 			return TestFail;
 
+		if (camera_->prepare() != -EACCES)
+			return TestFail;
+
+		if (camera_->setCompletionOrder(Camera::CompletionOrder::OutOfOrder) != -EACCES)
+			return TestFail;
+
 		/* Test operations which should pass. */
 		std::unique_ptr<Request> request = camera_->createRequest();
 		if (!request)
@@ -155,6 +193,25 @@ protected:
 		if (camera_->queueRequest(request.get()))
 			return TestFail;
 
+		/* A batch containing an invalid request is rejected as a whole. */
+		std::unique_ptr<Request> request2 = camera_->createRequest();
+		std::unique_ptr<Request> request3 = camera_->createRequest();
+		if (!request2 || !request3)
+			return TestFail;
+
+		if (request2->addBuffer(stream, allocator_->buffers(stream)[1].get()))
+			return TestFail;
+
+		std::vector<Request *> requests = { request2.get(), request3.get() };
+		if (camera_->queueRequests(requests) != -EINVAL)
+			return TestFail;
+
+		if (request3->addBuffer(stream, allocator_->buffers(stream)[2].get()))
+			return TestFail;
+
+		if (camera_->queueRequests(requests))
+			return TestFail;
+
 		/* Test valid state transitions, end in Available state. */
 		if (camera_->stop())
 			return TestFail;
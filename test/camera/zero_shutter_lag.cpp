@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera zero shutter lag test
+ */
+
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <vector>
+
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer_allocator.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+class ZeroShutterLagTest : public Test
+{
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completed_.push_back(request);
+	}
+
+	int init() override
+	{
+		/* Zero shutter lag is opt-in, enable it before enumerating cameras. */
+		setenv("LIBCAMERA_IPU3_ZSL_FRAMES", "4", 1);
+		setenv("LIBCAMERA_RPI_ZSL_FRAMES", "4", 1);
+
+		cm_ = std::make_unique<CameraManager>();
+		if (cm_->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		for (const std::shared_ptr<Camera> &camera : cm_->cameras()) {
+			if (camera->controls().count(&controls::ZeroShutterLagTimestamp)) {
+				camera_ = camera;
+				break;
+			}
+		}
+
+		if (!camera_) {
+			cout << "No camera supports zero shutter lag" << endl;
+			return TestSkip;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::StillCapture });
+		if (!config_ || config_->size() != 1) {
+			cerr << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+
+		return TestPass;
+	}
+
+	int waitForRequests(unsigned int count)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(2000);
+		while (timer.isRunning() && completed_.size() < count)
+			dispatcher->processEvents();
+
+		if (completed_.size() < count) {
+			cerr << "Timeout waiting for requests" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cerr << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cerr << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 2) {
+			cerr << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cerr << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		camera_->requestCompleted.connect(this, &ZeroShutterLagTest::requestComplete);
+
+		if (camera_->start()) {
+			cerr << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		/* Capture a frame to populate the history. */
+		if (camera_->queueRequest(requests_[0].get())) {
+			cerr << "Failed to queue request" << endl;
+			return TestFail;
+		}
+
+		if (waitForRequests(1) != TestPass)
+			return TestFail;
+
+		const ControlList &metadata = completed_[0]->metadata();
+		if (!metadata.contains(controls::SensorTimestamp)) {
+			cerr << "Request has no sensor timestamp" << endl;
+			return TestFail;
+		}
+
+		int64_t timestamp = metadata.get(controls::SensorTimestamp);
+
+		/* Request the frame previously captured from the history. */
+		Request *request = requests_[1].get();
+		request->controls().set(controls::ZeroShutterLagTimestamp, timestamp);
+
+		if (camera_->queueRequest(request)) {
+			cerr << "Failed to queue zero shutter lag request" << endl;
+			return TestFail;
+		}
+
+		if (waitForRequests(2) != TestPass)
+			return TestFail;
+
+		int64_t zslTimestamp = completed_[1]->metadata().get(controls::SensorTimestamp);
+
+		if (camera_->stop()) {
+			cerr << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (zslTimestamp != timestamp) {
+			cerr << "Zero shutter lag request served with frame "
+			     << zslTimestamp << ", expected " << timestamp << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		requests_.clear();
+		allocator_.reset();
+
+		if (camera_) {
+			camera_->release();
+			camera_.reset();
+		}
+
+		if (cm_)
+			cm_->stop();
+
+		unsetenv("LIBCAMERA_IPU3_ZSL_FRAMES");
+		unsetenv("LIBCAMERA_RPI_ZSL_FRAMES");
+	}
+
+private:
+	std::unique_ptr<CameraManager> cm_;
+	std::shared_ptr<Camera> camera_;
+	std::unique_ptr<CameraConfiguration> config_;
+	std::unique_ptr<FrameBufferAllocator> allocator_;
+
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::vector<Request *> completed_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(ZeroShutterLagTest)
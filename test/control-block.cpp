@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * control-block.cpp - ControlBlock tests
+ */
+
+#include <iostream>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/control_block.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class ControlBlockTest : public Test
+{
+protected:
+	int run() override
+	{
+		ControlBlock block;
+
+		if (!block.empty() || block.contains(controls::Brightness)) {
+			cout << "Block should be empty" << endl;
+			return TestFail;
+		}
+
+		block.set(controls::Brightness, 0.5f);
+		block.set(controls::ColourGains, { 1.5f, 2.5f });
+		block.set(controls::draft::NoiseReductionMode,
+			  static_cast<int32_t>(controls::draft::NoiseReductionModeFast));
+
+		if (block.size() != 3 || block.get(controls::Brightness) != 0.5f ||
+		    block.get(controls::ColourGains)[1] != 2.5f ||
+		    block.get(controls::draft::NoiseReductionMode) !=
+			    controls::draft::NoiseReductionModeFast) {
+			cout << "Failed to retrieve control values" << endl;
+			return TestFail;
+		}
+
+		/* Out of range IDs must be rejected. */
+		block.set(controls::MaxControlId + 1, ControlValue(1));
+		if (block.size() != 3) {
+			cout << "Out of range control stored" << endl;
+			return TestFail;
+		}
+
+		/* Convert to a ControlList and back. */
+		ControlList list(controls::controls);
+		list.set(controls::Contrast, 1.2f);
+		block.toControlList(list);
+
+		if (list.size() != 4 || list.get(controls::Brightness) != 0.5f ||
+		    list.get(controls::ColourGains)[0] != 1.5f) {
+			cout << "Failed to convert to a ControlList" << endl;
+			return TestFail;
+		}
+
+		block.clear();
+		if (!block.empty() || block.contains(controls::Brightness)) {
+			cout << "Block not cleared" << endl;
+			return TestFail;
+		}
+
+		block.merge(list);
+		if (block.size() != 4 || block.get(controls::Contrast) != 1.2f) {
+			cout << "Failed to merge a ControlList" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlBlockTest)
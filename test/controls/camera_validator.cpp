@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_validator.cpp - CameraControlValidator tests
+ */
+
+#include <iostream>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/camera_controls.h"
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class CameraValidatorTest : public CameraTest, public Test
+{
+public:
+	CameraValidatorTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		return status_;
+	}
+
+	/*
+	 * Check that the validator accepts exactly the controls listed in the
+	 * camera's ControlInfoMap.
+	 */
+	int checkControls(const CameraControlValidator &validator)
+	{
+		const ControlInfoMap &infoMap = camera_->controls();
+
+		for (const auto &[id, ctrl] : controls::controls) {
+			bool supported = infoMap.find(id) != infoMap.end();
+
+			if (validator.validate(id) != supported) {
+				cout << "Control " << ctrl->name() << " "
+				     << (supported ? "rejected" : "accepted")
+				     << " by validator" << endl;
+				return TestFail;
+			}
+		}
+
+		if (validator.validate(0)) {
+			cout << "Invalid control ID 0 accepted by validator" << endl;
+			return TestFail;
+		}
+
+		if (validator.validate(controls::MaxControlId + 1)) {
+			cout << "Out of range control ID accepted by validator" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		CameraControlValidator validator(camera_.get());
+
+		if (!validator.validate(controls::Brightness.id())) {
+			cout << "Brightness control rejected by validator" << endl;
+			return TestFail;
+		}
+
+		int ret = checkControls(validator);
+		if (ret != TestPass)
+			return ret;
+
+		/* The table of supported controls is updated by configure(). */
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get())) {
+			cout << "Failed to configure the camera" << endl;
+			return TestFail;
+		}
+
+		ret = checkControls(validator);
+		if (ret != TestPass)
+			return ret;
+
+		/* Setting an unsupported control in a request must be rejected. */
+		std::unique_ptr<Request> request = camera_->createRequest();
+		const ControlInfoMap &infoMap = camera_->controls();
+
+		for (const auto &[id, ctrl] : controls::controls) {
+			if (infoMap.find(id) != infoMap.end())
+				continue;
+
+			request->controls().set(id, ControlValue());
+			if (request->controls().contains(id)) {
+				cout << "Unsupported control " << ctrl->name()
+				     << " set in request" << endl;
+				return TestFail;
+			}
+
+			break;
+		}
+
+		camera_->release();
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(CameraValidatorTest)
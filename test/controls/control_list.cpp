@@ -196,6 +196,17 @@ protected:
 			return TestFail;
 		}
 
+		/* Verify that the controls are iterated in ascending ID order. */
+		unsigned int prevId = 0;
+		for (const auto &[id, value] : mergeList) {
+			if (id < prevId) {
+				cout << "Controls not sorted by ID" << endl;
+				return TestFail;
+			}
+
+			prevId = id;
+		}
+
 		return TestPass;
 	}
 };
@@ -7,6 +7,8 @@
 
 #include <algorithm>
 #include <iostream>
+#include <numeric>
+#include <vector>
 
 #include <libcamera/controls.h>
 
@@ -257,6 +259,35 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Copy and move of arrays stored inline and in external
+		 * storage.
+		 */
+		for (unsigned int size : { 9U, 16U }) {
+			std::vector<float> matrix(size);
+			std::iota(matrix.begin(), matrix.end(), 0.5f);
+
+			value.set(Span<const float>(matrix));
+			ControlValue copy = value;
+			ControlValue moved = std::move(copy);
+
+			Span<const float> valueResult = value.get<Span<const float>>();
+			Span<const float> movedResult = moved.get<Span<const float>>();
+			if (!std::equal(matrix.begin(), matrix.end(),
+					valueResult.begin(), valueResult.end()) ||
+			    !std::equal(matrix.begin(), matrix.end(),
+					movedResult.begin(), movedResult.end())) {
+				cerr << "Control value mismatch after copying "
+				     << size << " elements array" << endl;
+				return TestFail;
+			}
+
+			if (!copy.isNone()) {
+				cerr << "Moved control value not empty" << endl;
+				return TestFail;
+			}
+		}
+
 		return TestPass;
 	}
 };
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * coroutine.cpp - Coroutine support test
+ */
+
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include <libcamera/base/coroutine.h>
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/object.h>
+#include <libcamera/base/signal.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class Worker : public Object
+{
+public:
+	Thread *process(unsigned int value, unsigned int *result)
+	{
+		*result = value * 2;
+		return Thread::current();
+	}
+};
+
+class CoroutineTest : public Test
+{
+protected:
+	Task<unsigned int> square(unsigned int value)
+	{
+		co_return value * value;
+	}
+
+	Task<> test()
+	{
+		passed_ = co_await sequence();
+	}
+
+	Task<bool> sequence()
+	{
+		Thread *mainThread = Thread::current();
+
+		/* Test awaiting tasks. */
+		unsigned int value = co_await square(3);
+		value += co_await square(4);
+		if (value != 25) {
+			cout << "Invalid task result " << value << endl;
+			co_return false;
+		}
+
+		/* Test awaiting a signal emitted from a different thread. */
+		auto [number, text] = co_await awaitSignal(signal_);
+		if (Thread::current() != mainThread || number != 42 || text != "libcamera") {
+			cout << "Invalid signal emission" << endl;
+			co_return false;
+		}
+
+		/* Test awaiting an event notifier. */
+		co_await awaitNotifier(notifier_.get());
+		if (Thread::current() != mainThread) {
+			cout << "Notifier resumed in wrong thread" << endl;
+			co_return false;
+		}
+
+		char data;
+		if (read(pipefd_[0], &data, 1) != 1) {
+			cout << "Notifier resumed without data" << endl;
+			co_return false;
+		}
+
+		/* Test invoking a method in a different thread. */
+		unsigned int result = 0;
+		Thread *thread = co_await invokeAsync(&worker_, &Worker::process, 21U, &result);
+		if (thread != &workerThread_ || result != 42 ||
+		    Thread::current() != mainThread) {
+			cout << "Asynchronous invocation failed" << endl;
+			co_return false;
+		}
+
+		co_return true;
+	}
+
+	void emit()
+	{
+		signal_.emit(42, "libcamera");
+	}
+
+	int init()
+	{
+		if (pipe(pipefd_))
+			return TestFail;
+
+		notifier_ = std::make_unique<EventNotifier>(pipefd_[0], EventNotifier::Read);
+		notifier_->setEnabled(false);
+
+		emitter_.moveToThread(&workerThread_);
+		worker_.moveToThread(&workerThread_);
+		workerThread_.start();
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		Task<> task = test();
+		task.start();
+
+		/* The task is now waiting for the signal. */
+		emitter_.invokeMethod(&Emitter::emit, ConnectionTypeQueued, this);
+
+		/* Make the notifier ready for when the task waits for it. */
+		if (write(pipefd_[1], "x", 1) != 1)
+			return TestFail;
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+
+		timeout.start(1000);
+		while (timeout.isRunning() && !task.done())
+			dispatcher->processEvents();
+
+		if (!task.done()) {
+			cout << "Coroutine didn't complete" << endl;
+			return TestFail;
+		}
+
+		return passed_ ? TestPass : TestFail;
+	}
+
+	void cleanup()
+	{
+		workerThread_.exit(0);
+		workerThread_.wait();
+
+		notifier_.reset();
+		close(pipefd_[0]);
+		close(pipefd_[1]);
+	}
+
+private:
+	class Emitter : public Object
+	{
+	public:
+		void emit(CoroutineTest *test)
+		{
+			test->emit();
+		}
+	};
+
+	Signal<int, std::string> signal_;
+	std::unique_ptr<EventNotifier> notifier_;
+	int pipefd_[2];
+	bool passed_ = false;
+
+	Thread workerThread_;
+	Emitter emitter_;
+	Worker worker_;
+};
+
+TEST_REGISTER(CoroutineTest)
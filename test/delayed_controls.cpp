@@ -10,6 +10,7 @@
 #include "libcamera/internal/delayed_controls.h"
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/media_device.h"
+#include "libcamera/internal/v4l2_control_batch.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
 #include "test.h"
@@ -268,6 +269,157 @@ protected:
 		return TestPass;
 	}
 
+	int dualControlsPriorityGroups()
+	{
+		static const unsigned int historyDepth = 4;
+
+		std::unordered_map<uint32_t, DelayedControls::ControlParams> delays = {
+			{ V4L2_CID_BRIGHTNESS, { 1, false, 1 } },
+			{ V4L2_CID_CONTRAST, { 2, false, 0 } },
+		};
+		std::unique_ptr<DelayedControls> delayed =
+			std::make_unique<DelayedControls>(dev_.get(), delays,
+							  historyDepth);
+		ControlList ctrls;
+
+		/* Reset control to value that will be first two frames in test. */
+		int32_t expected = 100;
+		ctrls.set(V4L2_CID_BRIGHTNESS, expected);
+		ctrls.set(V4L2_CID_CONTRAST, expected + 1);
+		dev_->setControls(&ctrls);
+		delayed->reset();
+
+		/* Trigger the first frame start event */
+		delayed->applyControls(0);
+
+		/* Test dual controls split in two priority groups. */
+		for (unsigned int i = 1; i < 100; i++) {
+			int32_t value = 10 + i;
+
+			ctrls.set(V4L2_CID_BRIGHTNESS, value);
+			ctrls.set(V4L2_CID_CONTRAST, value + 1);
+			delayed->push(ctrls);
+
+			/*
+			 * The groups must be written separately, in decreasing
+			 * priority order. Brightness has a shorter delay and is
+			 * first written for frame 2.
+			 */
+			V4L2ControlBatch batch;
+			delayed->collectControls(i, &batch);
+
+			bool ordered;
+			if (i < 2)
+				ordered = batch.size() == 1 &&
+					  batch.controls(0).size() == 1 &&
+					  batch.controls(0).contains(V4L2_CID_CONTRAST);
+			else
+				ordered = batch.size() == 2 &&
+					  batch.controls(0).size() == 1 &&
+					  batch.controls(0).contains(V4L2_CID_BRIGHTNESS) &&
+					  batch.controls(1).size() == 1 &&
+					  batch.controls(1).contains(V4L2_CID_CONTRAST);
+
+			if (!ordered) {
+				cerr << "Failed priority groups order"
+				     << " frame " << i << endl;
+				return TestFail;
+			}
+
+			if (batch.commit()) {
+				cerr << "Failed to commit batch" << endl;
+				return TestFail;
+			}
+
+			ControlList result = delayed->get(i);
+			int32_t brightness = result.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+			int32_t contrast = result.get(V4L2_CID_CONTRAST).get<int32_t>();
+			if (brightness != expected || contrast != expected + 1) {
+				cerr << "Failed priority groups"
+				     << " frame " << i
+				     << " brightness " << brightness
+				     << " contrast " << contrast
+				     << " expected " << expected
+				     << endl;
+				return TestFail;
+			}
+
+			expected = i < 2 ? expected : value - 1;
+		}
+
+		return TestPass;
+	}
+
+	int singleControlBatched()
+	{
+		std::unordered_map<uint32_t, DelayedControls::ControlParams> delays = {
+			{ V4L2_CID_BRIGHTNESS, { 1, false } },
+		};
+		std::unique_ptr<DelayedControls> delayed =
+			std::make_unique<DelayedControls>(dev_.get(), delays);
+		V4L2ControlBatch batch;
+		ControlList ctrls;
+
+		/* Reset control to value that will be first in test. */
+		int32_t expected = 4;
+		ctrls.set(V4L2_CID_BRIGHTNESS, expected);
+		dev_->setControls(&ctrls);
+		delayed->reset();
+
+		/* Trigger the first frame start event */
+		delayed->collectControls(0, &batch);
+		if (batch.commit()) {
+			cerr << "Failed to commit batch" << endl;
+			return TestFail;
+		}
+
+		/* Test controls written through a batch. */
+		for (unsigned int i = 1; i < 100; i++) {
+			int32_t value = 10 + i;
+
+			ctrls.set(V4L2_CID_BRIGHTNESS, value);
+			delayed->push(ctrls);
+
+			delayed->collectControls(i, &batch);
+			if (batch.size() != 1) {
+				cerr << "Unexpected batch size " << batch.size()
+				     << " frame " << i << endl;
+				return TestFail;
+			}
+
+			if (batch.commit() || !batch.empty()) {
+				cerr << "Failed to commit batch" << endl;
+				return TestFail;
+			}
+
+			ControlList device = dev_->getControls({ V4L2_CID_BRIGHTNESS });
+			int32_t written = device.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+			if (written != value) {
+				cerr << "Failed batched write"
+				     << " frame " << i
+				     << " expected " << value
+				     << " got " << written
+				     << endl;
+				return TestFail;
+			}
+
+			ControlList result = delayed->get(i);
+			int32_t brightness = result.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+			if (brightness != expected) {
+				cerr << "Failed batched control"
+				     << " frame " << i
+				     << " expected " << expected
+				     << " got " << brightness
+				     << endl;
+				return TestFail;
+			}
+
+			expected = value;
+		}
+
+		return TestPass;
+	}
+
 	int run() override
 	{
 		int ret;
@@ -302,6 +454,16 @@ protected:
 		if (ret)
 			return ret;
 
+		/* Test priority groups with a reduced history depth. */
+		ret = dualControlsPriorityGroups();
+		if (ret)
+			return ret;
+
+		/* Test controls written through a batch. */
+		ret = singleControlBatched();
+		if (ret)
+			return ret;
+
 		return TestPass;
 	}
 
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * device-cache.cpp - Persistent device cache test
+ */
+
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "libcamera/internal/device_cache.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DeviceCacheTest : public Test
+{
+protected:
+	int init()
+	{
+		char dir[] = "/tmp/libcamera.device-cache.XXXXXX";
+		if (!mkdtemp(dir)) {
+			cerr << "Failed to create temporary directory" << endl;
+			return TestFail;
+		}
+
+		dir_ = dir;
+		path_ = dir_ + "/cache";
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		const vector<uint8_t> data1 = { 1, 2, 3, 4 };
+		const vector<uint8_t> data2 = { 5, 6 };
+		vector<uint8_t> data;
+
+		/* A disabled cache never stores entries. */
+		{
+			DeviceCache cache("");
+			cache.store("key1", data1);
+			if (cache.enabled() || cache.lookup("key1", &data) || cache.save()) {
+				cerr << "Disabled cache stored an entry" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Store entries and reload them. */
+		{
+			DeviceCache cache(path_);
+			cache.store("key1", data1);
+			cache.store("key2", data2);
+			if (cache.save()) {
+				cerr << "Failed to save cache" << endl;
+				return TestFail;
+			}
+		}
+
+		{
+			DeviceCache cache(path_);
+			if (!cache.lookup("key1", &data) || data != data1) {
+				cerr << "Failed to reload cache entry" << endl;
+				return TestFail;
+			}
+
+			if (cache.lookup("key3", &data)) {
+				cerr << "Found non-existent cache entry" << endl;
+				return TestFail;
+			}
+
+			/* key2 is unused and gets pruned. */
+			cache.save();
+		}
+
+		{
+			DeviceCache cache(path_);
+			if (!cache.lookup("key1", &data) || data != data1) {
+				cerr << "Used cache entry has been pruned" << endl;
+				return TestFail;
+			}
+
+			if (cache.lookup("key2", &data)) {
+				cerr << "Unused cache entry hasn't been pruned" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Cache files writable by other users are ignored. */
+		chmod(path_.c_str(), 0666);
+
+		{
+			DeviceCache cache(path_);
+			if (cache.lookup("key1", &data)) {
+				cerr << "Cache with unsafe permissions loaded" << endl;
+				return TestFail;
+			}
+		}
+
+		chmod(path_.c_str(), 0600);
+
+		/* Truncated cache files are discarded. */
+		if (truncate(path_.c_str(), 16) < 0) {
+			cerr << "Failed to truncate cache" << endl;
+			return TestFail;
+		}
+
+		{
+			DeviceCache cache(path_);
+			if (cache.lookup("key1", &data)) {
+				cerr << "Truncated cache loaded" << endl;
+				return TestFail;
+			}
+		}
+
+		if (!DeviceCache::nodeId(dir_ + "/missing").empty()) {
+			cerr << "Identifier returned for missing device node" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		unlink(path_.c_str());
+		rmdir(dir_.c_str());
+	}
+
+private:
+	string dir_;
+	string path_;
+};
+
+TEST_REGISTER(DeviceCacheTest)
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * dma-heap.cpp - DmaHeap recycling pool test
+ */
+
+#include <iostream>
+#include <sys/stat.h>
+
+#include "libcamera/internal/dma_heaps.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class DmaHeapTest : public Test
+{
+protected:
+	static ino_t inode(const FileDescriptor &fd)
+	{
+		struct stat st;
+		if (fstat(fd.fd(), &st) < 0)
+			return 0;
+
+		return st.st_ino;
+	}
+
+	int init() override
+	{
+		heap_ = std::make_unique<DmaHeap>(DmaHeap::DmaHeapFlag::Cma |
+						  DmaHeap::DmaHeapFlag::System);
+		if (!heap_->isValid()) {
+			cout << "No dma-heap available" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		constexpr std::size_t size = 64 * 1024;
+
+		/* The pool is disabled by default. */
+		FileDescriptor fd = heap_->alloc("test", size);
+		if (!fd.isValid()) {
+			cout << "Failed to allocate buffer" << endl;
+			return TestFail;
+		}
+
+		heap_->recycle(std::move(fd));
+		if (heap_->poolSize()) {
+			cout << "Buffer pooled with the pool disabled" << endl;
+			return TestFail;
+		}
+
+		/* Recycled buffers are reused for allocations of a similar size. */
+		heap_->setPoolLimit(4 * size);
+
+		fd = heap_->alloc("test", size);
+		ino_t ino = inode(fd);
+		heap_->recycle(std::move(fd));
+		if (heap_->poolSize() != size) {
+			cout << "Buffer not pooled" << endl;
+			return TestFail;
+		}
+
+		fd = heap_->alloc("test", size - 4096);
+		if (!fd.isValid() || inode(fd) != ino || heap_->poolSize()) {
+			cout << "Pooled buffer not reused" << endl;
+			return TestFail;
+		}
+
+		/* Buffers too large for the allocation are not reused. */
+		heap_->recycle(std::move(fd));
+		fd = heap_->alloc("test", size / 2);
+		if (!fd.isValid() || inode(fd) == ino || heap_->poolSize() != size) {
+			cout << "Oversized pooled buffer reused" << endl;
+			return TestFail;
+		}
+
+		/* Buffers exceeding the limit are freed. */
+		FileDescriptor large = heap_->alloc("test", 4 * size);
+		heap_->recycle(std::move(large));
+		if (heap_->poolSize() != size) {
+			cout << "Pool limit exceeded" << endl;
+			return TestFail;
+		}
+
+		/* Lowering the limit and clearing the pool free pooled buffers. */
+		heap_->recycle(std::move(fd));
+		heap_->setPoolLimit(size);
+		if (heap_->poolSize() > size) {
+			cout << "Pool not trimmed to the new limit" << endl;
+			return TestFail;
+		}
+
+		heap_->clearPool();
+		if (heap_->poolSize()) {
+			cout << "Pool not cleared" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::unique_ptr<DmaHeap> heap_;
+};
+
+TEST_REGISTER(DmaHeapTest)
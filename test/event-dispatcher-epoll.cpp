@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * event-dispatcher-epoll.cpp - Epoll-based event dispatcher test
+ */
+
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/event_dispatcher_epoll.h>
+#include <libcamera/base/event_notifier.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class EventDispatcherEpollTest : public Test
+{
+protected:
+	static constexpr unsigned int NumPipes = 40;
+
+	void readReady(EventNotifier *notifier)
+	{
+		char data[16];
+		ssize_t ret = read(notifier->fd(), data, sizeof(data));
+		if (ret > 0)
+			notified_.push_back(notifier->fd());
+	}
+
+	void readReadyOnce(EventNotifier *notifier)
+	{
+		readReady(notifier);
+		notifier->setEnabled(false);
+	}
+
+	int init()
+	{
+		if (Thread::current()->setEventDispatcher(std::make_unique<EventDispatcherEpoll>())) {
+			cout << "Failed to set event dispatcher" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < NumPipes; i++) {
+			int fds[2];
+			if (pipe(fds) < 0)
+				return TestFail;
+
+			pipes_.push_back({ fds[0], fds[1] });
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		if (!dynamic_cast<EventDispatcherEpoll *>(dispatcher)) {
+			cout << "Thread doesn't use the epoll dispatcher" << endl;
+			return TestFail;
+		}
+
+		if (!Thread::current()->setEventDispatcher(std::make_unique<EventDispatcherEpoll>())) {
+			cout << "Event dispatcher replaced while in use" << endl;
+			return TestFail;
+		}
+
+		std::vector<std::unique_ptr<EventNotifier>> notifiers;
+		for (const auto &fds : pipes_) {
+			notifiers.push_back(std::make_unique<EventNotifier>(fds.first, EventNotifier::Read));
+			notifiers.back()->activated.connect(this, &EventDispatcherEpollTest::readReady);
+		}
+
+		Timer timeout;
+
+		/*
+		 * Test notifications with more ready fds than the number of
+		 * events retrieved at once.
+		 */
+		for (const auto &fds : pipes_) {
+			if (write(fds.second, "x", 1) != 1) {
+				cout << "Pipe write failed" << endl;
+				return TestFail;
+			}
+		}
+
+		timeout.start(100);
+		while (timeout.isRunning() && notified_.size() < pipes_.size())
+			dispatcher->processEvents();
+		timeout.stop();
+
+		if (notified_.size() != pipes_.size()) {
+			cout << "Event notifier read ready test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test that no notification is reported without data. */
+		notified_.clear();
+
+		timeout.start(100);
+		dispatcher->processEvents();
+		timeout.stop();
+
+		if (!notified_.empty()) {
+			cout << "Event notifier read no ready test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test notifier disabling and enabling. */
+		notifiers[0]->setEnabled(false);
+
+		if (write(pipes_[0].second, "x", 1) != 1) {
+			cout << "Pipe write failed" << endl;
+			return TestFail;
+		}
+
+		timeout.start(100);
+		dispatcher->processEvents();
+		timeout.stop();
+
+		if (!notified_.empty()) {
+			cout << "Event notifier read disabling failed" << endl;
+			return TestFail;
+		}
+
+		notifiers[0]->setEnabled(true);
+
+		timeout.start(100);
+		dispatcher->processEvents();
+		timeout.stop();
+
+		if (notified_.size() != 1 || notified_[0] != pipes_[0].first) {
+			cout << "Event notifier read enabling test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test notifiers disabling themselves from their handler. */
+		notified_.clear();
+
+		for (unsigned int i = 0; i < 2; i++) {
+			notifiers[i]->activated.disconnect();
+			notifiers[i]->activated.connect(this, &EventDispatcherEpollTest::readReadyOnce);
+
+			if (write(pipes_[i].second, "xx", 2) != 2) {
+				cout << "Pipe write failed" << endl;
+				return TestFail;
+			}
+		}
+
+		timeout.start(100);
+		dispatcher->processEvents();
+		timeout.stop();
+
+		if (notified_.size() != 2 || notifiers[0]->enabled() ||
+		    notifiers[1]->enabled()) {
+			cout << "Event notifier self-disabling test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test notifier destruction. */
+		notifiers.clear();
+		notified_.clear();
+
+		if (write(pipes_[2].second, "x", 1) != 1) {
+			cout << "Pipe write failed" << endl;
+			return TestFail;
+		}
+
+		timeout.start(100);
+		dispatcher->processEvents();
+
+		if (!notified_.empty() || timeout.isRunning()) {
+			cout << "Event notifier destruction test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test interruption. */
+		timeout.start(1000);
+		dispatcher->interrupt();
+		dispatcher->processEvents();
+
+		if (!timeout.isRunning()) {
+			cout << "Event processing immediate interruption failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		for (const auto &fds : pipes_) {
+			close(fds.first);
+			close(fds.second);
+		}
+	}
+
+private:
+	std::vector<std::pair<int, int>> pipes_;
+	std::vector<int> notified_;
+};
+
+TEST_REGISTER(EventDispatcherEpollTest)
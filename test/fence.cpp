@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * fence.cpp - Fence test
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <memory>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/fence.h>
+#include <libcamera/file_descriptor.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class FenceTest : public Test
+{
+protected:
+	int run() override
+	{
+		/* An empty file descriptor makes an invalid fence. */
+		Fence invalid{ FileDescriptor() };
+		if (invalid.isValid()) {
+			cout << "Fence without file descriptor is valid" << endl;
+			return TestFail;
+		}
+
+		int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (efd < 0) {
+			cout << "Failed to create eventfd" << endl;
+			return TestFail;
+		}
+
+		FileDescriptor fd(std::move(efd));
+		std::unique_ptr<Fence> fence = std::make_unique<Fence>(fd);
+		if (!fence->isValid() || fence->fd().fd() != fd.fd()) {
+			cout << "Invalid fence" << endl;
+			return TestFail;
+		}
+
+		Stream stream;
+		FrameBuffer buffer(std::vector<FrameBuffer::Plane>{});
+		Request request(nullptr);
+
+		/* Invalid fences are rejected. */
+		int ret = request.addBuffer(&stream, &buffer,
+					    std::make_unique<Fence>(FileDescriptor()));
+		if (ret != -EINVAL) {
+			cout << "Invalid fence accepted by request" << endl;
+			return TestFail;
+		}
+
+		ret = request.addBuffer(&stream, &buffer, std::move(fence));
+		if (ret) {
+			cout << "Failed to add buffer with fence" << endl;
+			return TestFail;
+		}
+
+		/* The fence can be retrieved back from the buffer, once. */
+		std::unique_ptr<Fence> released = buffer.releaseFence();
+		if (!released || released->fd().fd() != fd.fd()) {
+			cout << "Failed to release fence" << endl;
+			return TestFail;
+		}
+
+		if (buffer.releaseFence()) {
+			cout << "Fence released twice" << endl;
+			return TestFail;
+		}
+
+		/* Reusing the request drops the fences. */
+		ret = request.addBuffer(&stream, &buffer, std::move(released));
+		if (ret != -EEXIST) {
+			cout << "Buffer added twice to request" << endl;
+			return TestFail;
+		}
+
+		request.reuse();
+		ret = request.addBuffer(&stream, &buffer, std::make_unique<Fence>(fd));
+		if (ret) {
+			cout << "Failed to add buffer after reuse" << endl;
+			return TestFail;
+		}
+
+		request.reuse();
+		if (buffer.releaseFence()) {
+			cout << "Fence not cleared by request reuse" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(FenceTest)
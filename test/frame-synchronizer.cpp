@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame-synchronizer.cpp - FrameSynchronizer test
+ */
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/frame_synchronizer.h>
+#include <libcamera/request.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class FrameSynchronizerTest : public Test
+{
+protected:
+	void framesMatched(const std::vector<Request *> &requests)
+	{
+		matched_.push_back(requests);
+	}
+
+	void frameDropped([[maybe_unused]] unsigned int index, Request *request)
+	{
+		dropped_.push_back(request);
+	}
+
+	Request *createRequest(int64_t timestamp)
+	{
+		requests_.push_back(std::make_unique<Request>(nullptr));
+		Request *request = requests_.back().get();
+		request->metadata().set(controls::SensorTimestamp, timestamp);
+		return request;
+	}
+
+	int run() override
+	{
+		using namespace std::chrono_literals;
+
+		FrameSynchronizer sync(2, 1ms);
+		sync.framesMatched.connect(this, &FrameSynchronizerTest::framesMatched);
+		sync.frameDropped.connect(this, &FrameSynchronizerTest::frameDropped);
+
+		/* Frames within the tolerance are matched. */
+		Request *left0 = createRequest(10000000);
+		Request *right0 = createRequest(10500000);
+		sync.addRequest(0, left0);
+		if (!matched_.empty()) {
+			cout << "Frames matched with a single camera" << endl;
+			return TestFail;
+		}
+
+		sync.addRequest(1, right0);
+		if (matched_.size() != 1 || matched_[0][0] != left0 ||
+		    matched_[0][1] != right0) {
+			cout << "Failed to match frames" << endl;
+			return TestFail;
+		}
+
+		/* A frame missing from one camera causes a drop on the other. */
+		Request *left1 = createRequest(43000000);
+		Request *left2 = createRequest(76000000);
+		Request *right2 = createRequest(75500000);
+		sync.addRequest(0, left1);
+		sync.addRequest(0, left2);
+		sync.addRequest(1, right2);
+
+		if (dropped_.size() != 1 || dropped_[0] != left1) {
+			cout << "Unmatched frame not dropped" << endl;
+			return TestFail;
+		}
+
+		if (matched_.size() != 2 || matched_[1][0] != left2 ||
+		    matched_[1][1] != right2) {
+			cout << "Failed to match frames after a drop" << endl;
+			return TestFail;
+		}
+
+		/* Frames without a timestamp are dropped immediately. */
+		requests_.push_back(std::make_unique<Request>(nullptr));
+		Request *noTimestamp = requests_.back().get();
+		sync.addRequest(1, noTimestamp);
+		if (dropped_.size() != 2 || dropped_[1] != noTimestamp) {
+			cout << "Frame without timestamp not dropped" << endl;
+			return TestFail;
+		}
+
+		/* Flushing drops the pending frames. */
+		Request *left3 = createRequest(109000000);
+		sync.addRequest(0, left3);
+		sync.flush();
+		if (dropped_.size() != 3 || dropped_[2] != left3) {
+			cout << "Pending frame not dropped by flush" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::vector<std::vector<Request *>> matched_;
+	std::vector<Request *> dropped_;
+};
+
+TEST_REGISTER(FrameSynchronizerTest)
@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * framebuffer-pool.cpp - FrameBufferPool test
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/framebuffer_pool.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class FrameBufferPoolTest : public Test
+{
+protected:
+	int init() override
+	{
+		for (unsigned int i = 0; i < numBuffers; i++)
+			buffers_.push_back(std::make_unique<FrameBuffer>(
+				std::vector<FrameBuffer::Plane>{}));
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		FrameBufferPool pool(buffers_);
+
+		if (pool.size() != numBuffers || pool.available() != numBuffers) {
+			cout << "Invalid initial pool size" << endl;
+			return TestFail;
+		}
+
+		/* Buffers are lent in order, once each. */
+		std::vector<FrameBuffer *> lent;
+		for (unsigned int i = 0; i < numBuffers; i++) {
+			FrameBuffer *buffer = pool.acquire();
+			if (buffer != buffers_[i].get()) {
+				cout << "Unexpected buffer " << i << " lent" << endl;
+				return TestFail;
+			}
+
+			lent.push_back(buffer);
+		}
+
+		if (pool.acquire() || pool.available() != 0) {
+			cout << "Pool should be exhausted" << endl;
+			return TestFail;
+		}
+
+		/* The most recently released buffer is lent first. */
+		if (pool.release(lent[1]) || pool.release(lent[2])) {
+			cout << "Failed to release buffers" << endl;
+			return TestFail;
+		}
+
+		if (pool.acquire() != lent[2]) {
+			cout << "Most recently released buffer not reused" << endl;
+			return TestFail;
+		}
+
+		/* Releasing a buffer twice or an unknown buffer shall fail. */
+		if (pool.release(lent[1]) != -EINVAL) {
+			cout << "Double release not detected" << endl;
+			return TestFail;
+		}
+
+		FrameBuffer other(std::vector<FrameBuffer::Plane>{});
+		if (pool.release(&other) != -EINVAL) {
+			cout << "Release of foreign buffer not detected" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * A shared buffer returns to the pool when its last reference
+		 * is released.
+		 */
+		if (pool.ref(lent[0]) || pool.ref(lent[0]) ||
+		    pool.refCount(lent[0]) != 3) {
+			cout << "Failed to reference lent buffer" << endl;
+			return TestFail;
+		}
+
+		if (pool.ref(lent[1]) != -EINVAL || pool.ref(&other) != -EINVAL) {
+			cout << "Reference to a free or foreign buffer not detected"
+			     << endl;
+			return TestFail;
+		}
+
+		pool.release(lent[0]);
+		pool.release(lent[0]);
+		if (pool.available() != 1 || pool.refCount(lent[0]) != 1) {
+			cout << "Shared buffer returned to the pool early" << endl;
+			return TestFail;
+		}
+
+		for (FrameBuffer *buffer : { lent[0], lent[2], lent[3] })
+			pool.release(buffer);
+
+		if (pool.available() != numBuffers) {
+			cout << "Buffers not all returned to the pool" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	static constexpr unsigned int numBuffers = 4;
+
+	std::vector<std::unique_ptr<FrameBuffer>> buffers_;
+};
+
+TEST_REGISTER(FrameBufferPoolTest)
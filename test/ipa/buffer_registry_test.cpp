@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * buffer_registry_test.cpp - Test the libipa BufferRegistry
+ */
+
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/ipa/core_ipa_interface.h>
+
+#include "libipa/buffer_registry.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class BufferRegistryTest : public Test
+{
+protected:
+	static constexpr unsigned int BufferSize = 4096;
+
+	int init() override
+	{
+		for (unsigned int i = 0; i < 2; i++) {
+			int fd = memfd_create("buffer-registry-test", MFD_CLOEXEC);
+			if (fd < 0 || ftruncate(fd, BufferSize) < 0) {
+				cerr << "Failed to create test buffer" << endl;
+				return TestFail;
+			}
+
+			FrameBuffer::Plane plane;
+			plane.fd = FileDescriptor(std::move(fd));
+			plane.length = BufferSize;
+
+			buffers_.emplace_back(i + 1, std::vector<FrameBuffer::Plane>{ plane });
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		BufferRegistry registry;
+
+		if (registry.map(buffers_) < 0) {
+			cerr << "Failed to map buffers" << endl;
+			return TestFail;
+		}
+
+		for (const IPABuffer &buffer : buffers_) {
+			if (!registry.contains(buffer.id) ||
+			    registry.plane(buffer.id).size() != BufferSize) {
+				cerr << "Buffer " << buffer.id << " not registered" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Writes through an access scope reach the buffer memory. */
+		{
+			BufferRegistry::Access access(registry, 1,
+						      MappedFrameBuffer::MapFlag::Write);
+			uint32_t *data = access.data<uint32_t>();
+			if (!access.isValid() || !data) {
+				cerr << "Failed to access buffer" << endl;
+				return TestFail;
+			}
+
+			*data = 0xcafe;
+
+			/* Only one access scope may be active at a time. */
+			BufferRegistry::Access nested(registry, 1,
+						      MappedFrameBuffer::MapFlag::Read);
+			if (nested.isValid()) {
+				cerr << "Nested access not rejected" << endl;
+				return TestFail;
+			}
+		}
+
+		uint32_t value;
+		if (pread(buffers_[0].planes[0].fd.fd(), &value, sizeof(value), 0) !=
+			    sizeof(value) ||
+		    value != 0xcafe) {
+			cerr << "Buffer write not visible" << endl;
+			return TestFail;
+		}
+
+		/* The access must have ended, a new one can be started. */
+		{
+			BufferRegistry::Access access(registry, 1,
+						      MappedFrameBuffer::MapFlag::Read);
+			const uint32_t *data = access.data<const uint32_t>();
+			if (!data || *data != 0xcafe) {
+				cerr << "Failed to read buffer" << endl;
+				return TestFail;
+			}
+
+			/* Accessing a type larger than the buffer fails. */
+			struct Large {
+				uint8_t data[BufferSize + 1];
+			};
+
+			if (access.data<Large>()) {
+				cerr << "Oversized access not rejected" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Unknown buffers can't be accessed. */
+		{
+			BufferRegistry::Access access(registry, 42,
+						      MappedFrameBuffer::MapFlag::Read);
+			if (access.isValid() || access.data<uint32_t>() ||
+			    !registry.plane(42).empty()) {
+				cerr << "Unknown buffer accessed" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Unmapped buffers are unregistered, the others are kept. */
+		registry.unmap({ 1, 42 });
+		if (registry.contains(1) || !registry.contains(2)) {
+			cerr << "Failed to unmap buffer" << endl;
+			return TestFail;
+		}
+
+		registry.clear();
+		if (registry.contains(2)) {
+			cerr << "Failed to clear registry" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::vector<IPABuffer> buffers_;
+};
+
+TEST_REGISTER(BufferRegistryTest)
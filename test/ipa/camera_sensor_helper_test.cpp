@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_sensor_helper_test.cpp - Test the libipa camera sensor helper gain tables
+ */
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "libipa/camera_sensor_helper.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class CameraSensorHelperTest : public Test
+{
+protected:
+	int testSensor(const string &model, uint32_t minCode, uint32_t maxCode)
+	{
+		unique_ptr<CameraSensorHelper> reference =
+			CameraSensorHelperFactory::create(model);
+		unique_ptr<CameraSensorHelper> helper =
+			CameraSensorHelperFactory::create(model);
+		if (!reference || !helper) {
+			cerr << "No helper for " << model << endl;
+			return TestFail;
+		}
+
+		helper->prepareGainCodes(minCode, maxCode);
+
+		for (uint32_t code = minCode; code <= maxCode; ++code) {
+			double gain = reference->gain(code);
+
+			if (helper->gain(code) != gain) {
+				cerr << model << ": gain mismatch for code "
+				     << code << endl;
+				return TestFail;
+			}
+
+			/* Exact gains map back to their code. */
+			if (helper->gainCode(gain) != code) {
+				cerr << model << ": code mismatch for gain "
+				     << gain << endl;
+				return TestFail;
+			}
+
+			/* Gains between two codes are rounded down. */
+			if (code < maxCode) {
+				double next = reference->gain(code + 1);
+				if (helper->gainCode((gain + next) / 2) != code) {
+					cerr << model << ": bad quantization at code "
+					     << code << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		/* Out of range gains are clamped to the table limits. */
+		if (helper->gainCode(0.0) != minCode ||
+		    helper->gainCode(1000.0) != maxCode) {
+			cerr << model << ": gain codes not clamped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (testSensor("imx258", 0, 480) != TestPass)
+			return TestFail;
+
+		if (testSensor("ov5670", 128, 2047) != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(CameraSensorHelperTest)
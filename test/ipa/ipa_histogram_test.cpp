@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_histogram_test.cpp - Test the libipa Histogram against a reference
+ */
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "libipa/histogram.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+class IPAHistogramTest : public Test
+{
+protected:
+	/* Walk the bins, as the original implementation did. */
+	double referenceMean(const vector<uint64_t> &cumulative,
+			     double lowPoint, double highPoint)
+	{
+		double sumBinFreq = 0, cumulFreq = 0;
+
+		for (double next = floor(lowPoint) + 1.0; next <= ceil(highPoint);
+		     lowPoint = next, next += 1.0) {
+			int bin = floor(lowPoint);
+			double freq = (cumulative[bin + 1] - cumulative[bin]) *
+				      (std::min(next, highPoint) - lowPoint);
+			sumBinFreq += bin * freq;
+			cumulFreq += freq;
+		}
+
+		return sumBinFreq / cumulFreq + 0.5;
+	}
+
+	int run()
+	{
+		static constexpr double quantiles[][2] = {
+			{ 0.0, 1.0 }, { 0.98, 1.0 }, { 0.1, 0.9 },
+			{ 0.5, 0.51 }, { 0.0, 0.02 },
+		};
+
+		mt19937 gen(42);
+
+		for (unsigned int iter = 0; iter < 100; iter++) {
+			vector<uint32_t> data(256);
+			for (uint32_t &value : data)
+				value = gen() % 4 ? gen() % 1000 : 0;
+
+			vector<uint64_t> cumulative(1, 0);
+			for (uint32_t value : data)
+				cumulative.push_back(cumulative.back() + value);
+
+			Histogram histogram{ Span<const uint32_t>(data) };
+			if (histogram.bins() != data.size() ||
+			    histogram.total() != cumulative.back()) {
+				cerr << "Invalid histogram size or total" << endl;
+				return TestFail;
+			}
+
+			for (const auto &q : quantiles) {
+				double lowPoint = histogram.quantile(q[0]);
+				double highPoint = histogram.quantile(q[1]);
+				double expected = referenceMean(cumulative, lowPoint,
+								highPoint);
+				double mean = histogram.interQuantileMean(q[0], q[1]);
+
+				if (std::abs(mean - expected) > 1e-6 * expected) {
+					cerr << "Inter-quantile mean [" << q[0] << ", "
+					     << q[1] << "] is " << mean
+					     << ", expected " << expected << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(IPAHistogramTest)
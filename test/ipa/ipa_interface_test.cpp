@@ -143,6 +143,27 @@ protected:
 			return TestFail;
 		}
 
+		/* Test the IPA call statistics. */
+		std::vector<IPAProxy::CallStats> stats = ipa_->callStats();
+		if (stats.size() != 3) {
+			cerr << "Invalid number of IPA call statistics" << endl;
+			return TestFail;
+		}
+
+		for (const IPAProxy::CallStats &call : stats) {
+			if (call.latency.count() != 1) {
+				cerr << "Invalid call count for " << call.name
+				     << "(): " << call.latency.count() << endl;
+				return TestFail;
+			}
+		}
+
+		ipa_->resetCallStats();
+		if (ipa_->callStats()[0].latency.count() != 0) {
+			cerr << "Failed to reset IPA call statistics" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_module_cache_test.cpp - Test the persistent IPA module information cache
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libcamera/internal/ipa_module_cache.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAModuleCacheTest : public Test
+{
+protected:
+	int init() override
+	{
+		char dir[] = "/tmp/libcamera.ipa_module_cache.XXXXXX";
+		if (!mkdtemp(dir)) {
+			cerr << "Failed to create temporary directory" << endl;
+			return TestFail;
+		}
+
+		dir_ = dir;
+		cachePath_ = dir_ + "/cache/ipa_modules.cache";
+		modulePath_ = dir_ + "/ipa_test.so";
+		otherPath_ = dir_ + "/ipa_other.so";
+
+		return writeFile(modulePath_, "module") &&
+		       writeFile(otherPath_, "other module") ? TestPass : TestFail;
+	}
+
+	int run() override
+	{
+		const IPAModuleInfo testInfo = {
+			IPA_MODULE_API_VERSION,
+			1,
+			"PipelineHandlerTest",
+			"test",
+		};
+
+		IPAModuleInfo info;
+
+		/* Populate the cache and write it to disk. */
+		{
+			IPAModuleCache cache(cachePath_);
+
+			if (cache.lookup(modulePath_, &info)) {
+				cerr << "Empty cache has entries" << endl;
+				return TestFail;
+			}
+
+			cache.store(modulePath_, testInfo);
+
+			if (cache.save()) {
+				cerr << "Failed to save cache" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Verify the entry is retrieved from disk. */
+		{
+			IPAModuleCache cache(cachePath_);
+
+			if (!cache.lookup(modulePath_, &info) ||
+			    memcmp(&info, &testInfo, sizeof(info))) {
+				cerr << "Cached module information mismatch" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Modifying the module invalidates the entry. */
+		if (!writeFile(modulePath_, "modified module"))
+			return TestFail;
+
+		{
+			IPAModuleCache cache(cachePath_);
+
+			if (cache.lookup(modulePath_, &info)) {
+				cerr << "Stale entry not invalidated by module" << endl;
+				return TestFail;
+			}
+
+			cache.store(modulePath_, testInfo);
+			cache.save();
+		}
+
+		/*
+		 * Saving a cache merges the entries it hasn't looked up, as well
+		 * as the entries written by other caches since it was loaded.
+		 */
+		{
+			IPAModuleCache first(cachePath_);
+			IPAModuleCache second(cachePath_);
+
+			first.store(otherPath_, testInfo);
+			first.save();
+
+			second.store(modulePath_, testInfo);
+			second.save();
+		}
+
+		{
+			IPAModuleCache cache(cachePath_);
+
+			if (!cache.lookup(otherPath_, &info)) {
+				cerr << "Entry dropped when saving another cache" << endl;
+				return TestFail;
+			}
+
+			cache.store(otherPath_, testInfo);
+			cache.save();
+		}
+
+		{
+			IPAModuleCache cache(cachePath_);
+
+			if (!cache.lookup(modulePath_, &info)) {
+				cerr << "Entry not looked up dropped on save" << endl;
+				return TestFail;
+			}
+		}
+
+		/* A cache file writable by other users is ignored. */
+		chmod(cachePath_.c_str(), 0666);
+
+		{
+			IPAModuleCache cache(cachePath_);
+
+			if (cache.lookup(modulePath_, &info)) {
+				cerr << "Unsafe cache file not ignored" << endl;
+				return TestFail;
+			}
+		}
+
+		chmod(cachePath_.c_str(), 0600);
+
+		/* A truncated cache file is discarded. */
+		if (truncate(cachePath_.c_str(), 64) < 0) {
+			cerr << "Failed to truncate cache file" << endl;
+			return TestFail;
+		}
+
+		{
+			IPAModuleCache cache(cachePath_);
+
+			if (cache.lookup(modulePath_, &info)) {
+				cerr << "Invalid cache file not discarded" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		unlink(cachePath_.c_str());
+		rmdir((dir_ + "/cache").c_str());
+		unlink(modulePath_.c_str());
+		unlink(otherPath_.c_str());
+		rmdir(dir_.c_str());
+	}
+
+private:
+	bool writeFile(const string &path, const string &content)
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0) {
+			cerr << "Failed to create " << path << endl;
+			return false;
+		}
+
+		ssize_t ret = write(fd, content.data(), content.size());
+		close(fd);
+
+		return ret == static_cast<ssize_t>(content.size());
+	}
+
+	string dir_;
+	string cachePath_;
+	string modulePath_;
+	string otherPath_;
+};
+
+TEST_REGISTER(IPAModuleCacheTest)
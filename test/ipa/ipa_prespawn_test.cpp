@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_prespawn_test.cpp - Test the hand over of pre-spawned IPA proxy workers
+ */
+
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <stdlib.h>
+#include <string>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <libcamera/ipa/vimc_ipa_proxy.h>
+
+#include "libcamera/internal/ipa_manager.h"
+#include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/process.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAPrespawnTest : public Test
+{
+protected:
+	int init() override
+	{
+		/* Isolate the vimc IPA and bypass the module information cache. */
+		setenv("LIBCAMERA_IPA_FORCE_ISOLATION", "1", 1);
+		setenv("LIBCAMERA_IPA_PRESPAWN_WORKERS", "1", 1);
+		setenv("LIBCAMERA_IPA_MODULE_CACHE", "", 1);
+
+		ipaManager_ = make_unique<IPAManager>();
+
+		std::vector<PipelineHandlerFactory *> &factories =
+			PipelineHandlerFactory::factories();
+		for (PipelineHandlerFactory *factory : factories) {
+			if (factory->name() == "PipelineHandlerVimc") {
+				pipe_ = factory->create(nullptr);
+				break;
+			}
+		}
+
+		if (!pipe_) {
+			cerr << "Vimc pipeline not found" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		ipaManager_->startWorkers();
+
+		std::set<pid_t> workers = children();
+		if (workers.size() != 1) {
+			cerr << "Expected one pre-spawned worker, found "
+			     << workers.size() << endl;
+			return TestFail;
+		}
+
+		/* The proxy must be handed the pre-spawned worker. */
+		ipa_ = IPAManager::createIPA<ipa::vimc::IPAProxyVimc>(pipe_.get(), 0, 0);
+		if (!ipa_) {
+			cerr << "Failed to create VIMC IPA interface" << endl;
+			return TestFail;
+		}
+
+		if (children() != workers) {
+			cerr << "Pre-spawned worker not handed over" << endl;
+			return TestFail;
+		}
+
+		std::string conf = ipa_->configurationFile("vimc.conf");
+		if (ipa_->init(IPASettings{ conf, "vimc" }) < 0) {
+			cerr << "Failed to initialize IPA in pre-spawned worker" << endl;
+			return TestFail;
+		}
+
+		/* Releasing the idle workers must not affect claimed ones. */
+		ipaManager_->releaseWorkers();
+
+		if (children() != workers) {
+			cerr << "Claimed worker terminated" << endl;
+			return TestFail;
+		}
+
+		/* A second proxy for the same module spawns a new worker. */
+		std::unique_ptr<ipa::vimc::IPAProxyVimc> ipa =
+			IPAManager::createIPA<ipa::vimc::IPAProxyVimc>(pipe_.get(), 0, 0);
+		if (!ipa) {
+			cerr << "Failed to create second VIMC IPA interface" << endl;
+			return TestFail;
+		}
+
+		if (children().size() != 2) {
+			cerr << "Second proxy didn't spawn a new worker" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		ipa_.reset();
+		ipaManager_.reset();
+
+		unsetenv("LIBCAMERA_IPA_FORCE_ISOLATION");
+		unsetenv("LIBCAMERA_IPA_PRESPAWN_WORKERS");
+		unsetenv("LIBCAMERA_IPA_MODULE_CACHE");
+	}
+
+private:
+	static std::set<pid_t> children()
+	{
+		std::set<pid_t> pids;
+
+		DIR *dir = opendir("/proc/self/task");
+		if (!dir)
+			return pids;
+
+		struct dirent *ent;
+		while ((ent = readdir(dir)) != nullptr) {
+			if (ent->d_name[0] == '.')
+				continue;
+
+			std::ifstream file(std::string("/proc/self/task/") +
+					   ent->d_name + "/children");
+			pid_t pid;
+			while (file >> pid)
+				pids.insert(pid);
+		}
+
+		closedir(dir);
+
+		return pids;
+	}
+
+	ProcessManager processManager_;
+
+	std::shared_ptr<PipelineHandler> pipe_;
+	std::unique_ptr<ipa::vimc::IPAProxyVimc> ipa_;
+	std::unique_ptr<IPAManager> ipaManager_;
+};
+
+TEST_REGISTER(IPAPrespawnTest)
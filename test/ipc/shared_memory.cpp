@@ -0,0 +1,256 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * shared_memory.cpp - Shared memory IPC test
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <numeric>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include "libcamera/internal/ipc_shared_memory.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class SharedMemoryTest : public Test
+{
+protected:
+	int init()
+	{
+		int fd = first_.create();
+		if (fd < 0) {
+			cerr << "Failed to create IPC channel" << endl;
+			return TestFail;
+		}
+
+		if (second_.bind(fd)) {
+			cerr << "Failed to bind IPC channel" << endl;
+			return TestFail;
+		}
+
+		second_.readyRead.connect(this, &SharedMemoryTest::readyRead);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		/* Test message ordering through the ring, in both directions. */
+		for (unsigned int i = 0; i < 1000; i++) {
+			IPCSharedMemory::Payload message, response;
+
+			message.data.resize(1 + i % 700);
+			std::iota(message.data.begin(), message.data.end(), i);
+
+			if (first_.send(message)) {
+				cerr << "Failed to send message " << i << endl;
+				return TestFail;
+			}
+
+			if (second_.receive(&response) || response.data != message.data) {
+				cerr << "Failed to receive message " << i << endl;
+				return TestFail;
+			}
+
+			if (second_.send(response) || first_.receive(&message) ||
+			    message.data != response.data) {
+				cerr << "Failed to send reply " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (second_.receive(nullptr) != -EAGAIN) {
+			cerr << "Unexpected message in ring" << endl;
+			return TestFail;
+		}
+
+		/* Test file descriptor passing. */
+		int memfd = memfd_create("shared-memory-test", MFD_CLOEXEC);
+		if (memfd < 0 || ftruncate(memfd, 4096) < 0) {
+			cerr << "Failed to create test file" << endl;
+			return TestFail;
+		}
+
+		IPCSharedMemory::Payload message, response;
+		message.data = { 1, 2, 3 };
+		message.fds = { memfd };
+
+		if (first_.send(message) || second_.receive(&response) ||
+		    response.data != message.data || response.fds.size() != 1) {
+			cerr << "Failed to pass file descriptor" << endl;
+			return TestFail;
+		}
+
+		struct stat st;
+		if (fstat(response.fds[0], &st) < 0 || st.st_size != 4096) {
+			cerr << "Invalid file descriptor received" << endl;
+			return TestFail;
+		}
+
+		::close(response.fds[0]);
+
+		/*
+		 * Test that a registered file descriptor is passed again as a
+		 * new file descriptor owned by the receiver.
+		 */
+		for (unsigned int i = 0; i < 3; i++) {
+			response = {};
+			if (first_.send(message) || second_.receive(&response) ||
+			    response.fds.size() != 1) {
+				cerr << "Failed to pass registered file descriptor" << endl;
+				return TestFail;
+			}
+
+			if (fstat(response.fds[0], &st) < 0 || st.st_size != 4096) {
+				cerr << "Invalid registered file descriptor" << endl;
+				return TestFail;
+			}
+
+			::close(response.fds[0]);
+		}
+
+		/* Test eviction of file descriptors from the registry. */
+		for (unsigned int i = 0; i < IPCSharedMemory::MaxRegisteredFds * 2; i++) {
+			int fd = memfd_create("shared-memory-test", MFD_CLOEXEC);
+			if (fd < 0 || ftruncate(fd, i + 1) < 0) {
+				cerr << "Failed to create test file" << endl;
+				return TestFail;
+			}
+
+			message.fds = { memfd, fd };
+			response = {};
+
+			int ret = first_.send(message);
+			::close(fd);
+
+			if (ret || second_.receive(&response) ||
+			    response.fds.size() != 2) {
+				cerr << "Failed to pass file descriptors " << i << endl;
+				return TestFail;
+			}
+
+			bool valid = fstat(response.fds[0], &st) == 0 && st.st_size == 4096 &&
+				     fstat(response.fds[1], &st) == 0 &&
+				     st.st_size == static_cast<off_t>(i + 1);
+
+			::close(response.fds[0]);
+			::close(response.fds[1]);
+
+			if (!valid) {
+				cerr << "Invalid file descriptors received " << i << endl;
+				return TestFail;
+			}
+		}
+
+		::close(memfd);
+
+		/*
+		 * Test that registered file descriptors not used by recent
+		 * messages are released on both ends.
+		 */
+		unsigned int openFds = countOpenFds();
+
+		message.fds = {};
+		for (unsigned int i = 0; i <= IPCSharedMemory::MaxIdleMessages; i++) {
+			response = {};
+			if (first_.send(message) || second_.receive(&response)) {
+				cerr << "Failed to pass message " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (countOpenFds() + 2 * IPCSharedMemory::MaxRegisteredFds != openFds) {
+			cerr << "Idle file descriptors not released" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Test messages that don't fit in the ring, and are carried by
+		 * the socket instead, keep their order.
+		 */
+		std::vector<IPCSharedMemory::Payload> messages(3);
+		for (unsigned int i = 0; i < messages.size(); i++) {
+			messages[i].data.resize(100 * 1024, i);
+			if (first_.send(messages[i])) {
+				cerr << "Failed to send large message " << i << endl;
+				return TestFail;
+			}
+		}
+
+		/* Test the readyRead signal. */
+		received_.clear();
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		timeout.start(1000);
+		while (timeout.isRunning() && received_.size() < messages.size())
+			dispatcher->processEvents();
+
+		if (received_.size() != messages.size()) {
+			cerr << "Failed to receive large messages" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < messages.size(); i++) {
+			if (received_[i].data != messages[i].data) {
+				cerr << "Large message " << i << " mismatch" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	unsigned int countOpenFds()
+	{
+		DIR *dir = opendir("/proc/self/fd");
+		if (!dir)
+			return 0;
+
+		unsigned int count = 0;
+		while (readdir(dir))
+			count++;
+
+		closedir(dir);
+
+		return count;
+	}
+
+	void cleanup()
+	{
+		first_.close();
+		second_.close();
+	}
+
+private:
+	void readyRead(IPCSharedMemory *ipc)
+	{
+		IPCSharedMemory::Payload payload;
+		if (ipc->receive(&payload)) {
+			cerr << "Receive message failed" << endl;
+			return;
+		}
+
+		received_.push_back(std::move(payload));
+	}
+
+	IPCSharedMemory first_;
+	IPCSharedMemory second_;
+
+	std::vector<IPCSharedMemory::Payload> received_;
+};
+
+TEST_REGISTER(SharedMemoryTest)
@@ -76,7 +76,7 @@ private:
 			return;
 		}
 
-		IPCMessage ipcMessage(message);
+		IPCMessage ipcMessage(std::move(message));
 		uint32_t cmd = ipcMessage.header().cmd;
 
 		switch (cmd) {
@@ -93,7 +93,8 @@ private:
 			tie(buf, ignore) = IPADataSerializer<int32_t>::serialize(value_);
 			response.data().insert(response.data().end(), buf.begin(), buf.end());
 
-			ret = ipc_.send(response.payload());
+			ret = ipc_.send(response.data(), response.serializedHeader(),
+					response.fds());
 			if (ret < 0) {
 				cerr << "Reply failed" << endl;
 				stop(ret);
@@ -158,6 +159,30 @@ protected:
 		return IPADataSerializer<int32_t>::deserialize(buf.data());
 	}
 
+	int getValueAsync()
+	{
+		IPCMessage msg(CmdGetSync);
+		int value = -ETIMEDOUT;
+
+		int ret = ipc_->callAsync(msg,
+			[&value](int result, const IPCMessage &reply) {
+				value = result < 0 ? result
+					: IPADataSerializer<int32_t>::deserialize(reply.data());
+			});
+		if (ret < 0) {
+			cerr << "Failed to call get value asynchronously" << endl;
+			return ret;
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		timeout.start(1000);
+		while (timeout.isRunning() && value == -ETIMEDOUT)
+			dispatcher->processEvents();
+
+		return value;
+	}
+
 	int exit()
 	{
 		IPCMessage msg(CmdExit);
@@ -199,6 +224,13 @@ protected:
 			return TestFail;
 		}
 
+		ret = getValueAsync();
+		if (ret != kChangedValue) {
+			cerr << "Wrong asynchronous value, expected " << kChangedValue
+			     << ", got " << ret << endl;
+			return TestFail;
+		}
+
 		ret = exit();
 		if (ret < 0) {
 			cerr << "Failed to exit: " << strerror(-ret) << endl;
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * latency-stats.cpp - Request latency statistics test
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include <libcamera/latency_stats.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+class LatencyStatsTest : public Test
+{
+protected:
+	int run() override
+	{
+		LatencyHistogram histogram;
+
+		if (histogram.count() || histogram.percentile(99).count() ||
+		    histogram.mean().count()) {
+			cout << "Histogram not empty after construction" << endl;
+			return TestFail;
+		}
+
+		/* Record latencies of 1ms to 100ms in 1ms increments. */
+		for (unsigned int i = 1; i <= 100; i++)
+			histogram.record(std::chrono::milliseconds(i));
+
+		if (histogram.count() != 100 || histogram.min() != 1ms ||
+		    histogram.max() != 100ms || histogram.mean() != 50500us) {
+			cout << "Invalid histogram statistics" << endl;
+			return TestFail;
+		}
+
+		/* Percentiles are accurate to 12.5%. */
+		struct {
+			double percent;
+			std::chrono::nanoseconds expected;
+		} percentiles[] = {
+			{ 0, 1ms },
+			{ 50, 50ms },
+			{ 90, 90ms },
+			{ 99, 99ms },
+			{ 100, 100ms },
+		};
+
+		for (const auto &p : percentiles) {
+			std::chrono::nanoseconds value = histogram.percentile(p.percent);
+			if (value < p.expected || value > p.expected * 1.125 ||
+			    value > histogram.max()) {
+				cout << "Invalid p" << p.percent << " percentile "
+				     << value.count() << "ns" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Out of range values are clamped. */
+		histogram.record(-1ms);
+		histogram.record(std::chrono::hours(24 * 365));
+		if (histogram.count() != 102 || histogram.min() != 0ns) {
+			cout << "Invalid handling of out of range values" << endl;
+			return TestFail;
+		}
+
+		histogram.reset();
+		if (histogram.count() || histogram.max().count()) {
+			cout << "Histogram not empty after reset" << endl;
+			return TestFail;
+		}
+
+		/* Test the statistics of all stages and the JSON export. */
+		RequestLatencyStats stats;
+		stats.record(RequestLatencyStats::DeviceToBuffer, 30ms);
+
+		if (stats.histogram(RequestLatencyStats::DeviceToBuffer).count() != 1 ||
+		    stats.histogram(RequestLatencyStats::Completion).count() != 0) {
+			cout << "Latency recorded in the wrong stage" << endl;
+			return TestFail;
+		}
+
+		std::string json = stats.toJson();
+		for (unsigned int i = 0; i < RequestLatencyStats::NumStages; i++) {
+			std::string name = RequestLatencyStats::stageName(
+				static_cast<RequestLatencyStats::Stage>(i));
+			if (json.find("\"" + name + "\": {") == std::string::npos) {
+				cout << "Stage " << name << " missing from JSON: "
+				     << json << endl;
+				return TestFail;
+			}
+		}
+
+		if (json.find("\"count\": 1, ") == std::string::npos) {
+			cout << "Invalid JSON export: " << json << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(LatencyStatsTest)
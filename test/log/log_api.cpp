@@ -6,6 +6,7 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <fcntl.h>
 #include <iostream>
 #include <list>
@@ -15,6 +16,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
 
 #include <libcamera/base/log.h>
 
@@ -107,6 +109,60 @@ protected:
 		return verifyOutput(iss);
 	}
 
+	int testBinaryFile()
+	{
+		int fd = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+		if (fd < 0) {
+			cerr << "Failed to open tmp log file" << endl;
+			return TestFail;
+		}
+
+		char path[32];
+		snprintf(path, sizeof(path), "/proc/self/fd/%u", fd);
+
+		if (logSetFile(path, true) < 0) {
+			cerr << "Failed to set binary log file" << endl;
+			close(fd);
+			return TestFail;
+		}
+
+		doLogging();
+
+		/* Close the log file to flush it. */
+		logSetTarget(LoggingTargetNone);
+
+		char buf[1000];
+		lseek(fd, 0, SEEK_SET);
+		ssize_t size = read(fd, buf, sizeof(buf));
+		close(fd);
+
+		if (size < 8) {
+			cerr << "Failed to read binary log file" << endl;
+			return TestFail;
+		}
+
+		const uint32_t magic = 0x4c43424c;
+		if (memcmp(buf, &magic, sizeof(magic))) {
+			cerr << "Invalid binary log header" << endl;
+			return TestFail;
+		}
+
+		string data(buf, size);
+		for (const char *msg : { "good 1", "good 3", "good 5" }) {
+			if (data.find(msg) == string::npos) {
+				cerr << "Missing binary log message" << endl;
+				return TestFail;
+			}
+		}
+
+		if (data.find("bad") != string::npos) {
+			cerr << "Unexpected binary log message" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int testStream()
 	{
 		stringstream log;
@@ -118,6 +174,125 @@ protected:
 		return verifyOutput(log);
 	}
 
+	int testAsync()
+	{
+		stringstream log;
+		logSetStream(&log);
+		logSetAsync(true);
+
+		doLogging();
+
+		/* Disabling asynchronous logging flushes the queued messages. */
+		logSetAsync(false);
+
+		int ret = verifyOutput(log);
+		if (ret != TestPass)
+			return ret;
+
+		/*
+		 * Flood the log from a single thread. Messages may be dropped,
+		 * but each of them must be either written or accounted for.
+		 */
+		static constexpr unsigned int NumMessages = 10000;
+
+		stringstream flood;
+		logSetStream(&flood);
+		logSetAsync(true);
+
+		logSetLevel("LogAPITest", "DEBUG");
+		for (unsigned int i = 0; i < NumMessages; i++)
+			LOG(LogAPITest, Info) << "message " << i;
+
+		logSetAsync(false);
+		logSetStream(&log);
+
+		unsigned int written = 0;
+		unsigned int dropped = 0;
+		string line;
+		while (getline(flood, line)) {
+			size_t pos = line.find(" log messages dropped");
+			if (pos == string::npos) {
+				written++;
+				continue;
+			}
+
+			size_t start = line.rfind(' ', pos - 1) + 1;
+			dropped += stoul(line.substr(start, pos - start));
+		}
+
+		if (written + dropped != NumMessages) {
+			cout << "Asynchronous log lost " << NumMessages - written - dropped
+			     << " messages" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testDisabled()
+	{
+		unsigned int evaluated = 0;
+		auto evaluate = [&]() { return ++evaluated; };
+
+		stringstream log;
+		logSetStream(&log);
+
+		/* Operands of disabled messages must not be evaluated. */
+		logSetLevel("LogAPITest", "WARN");
+		LOG(LogAPITest, Debug) << "bad " << evaluate();
+		LOG(LogAPITest, Info) << "bad " << evaluate();
+		if (evaluated)
+			LOG(LogAPITest, Info) << "bad";
+		else
+			LOG(LogAPITest, Warning) << "good " << evaluate();
+
+		if (evaluated != 1 || log.str().find("bad") != string::npos) {
+			cout << "Disabled log message evaluated" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testSampled()
+	{
+		stringstream log;
+		logSetStream(&log);
+		logSetLevel("LogAPITest", "DEBUG");
+
+		for (unsigned int i = 0; i < 10; i++)
+			LOG_EVERY_N(LogAPITest, Info, 4) << "sampled " << i;
+
+		for (unsigned int i = 0; i < 10; i++)
+			LOG_RATELIMITED(LogAPITest, Info, std::chrono::hours(1))
+				<< "limited " << i;
+
+		vector<string> lines;
+		string line;
+		while (getline(log, line))
+			lines.push_back(line);
+
+		static const char *const expected[] = {
+			"sampled 0", "sampled 4", "sampled 8", "limited 0",
+		};
+
+		if (lines.size() != std::size(expected)) {
+			cout << "Unexpected number of sampled log lines" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < lines.size(); i++) {
+			const string &msg = expected[i];
+			if (lines[i].size() < msg.size() ||
+			    lines[i].compare(lines[i].size() - msg.size(), msg.size(), msg)) {
+				cout << "Incorrect sampled log line " << lines[i] << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
 	int testTarget()
 	{
 		logSetTarget(LoggingTargetNone);
@@ -139,10 +314,26 @@ protected:
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testBinaryFile();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testStream();
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testAsync();
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testDisabled();
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testSampled();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testTarget();
 		if (ret != TestPass)
 			return TestFail;
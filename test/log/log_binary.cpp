@@ -0,0 +1,269 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * log_binary.cpp - Binary log file format test
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/log.h>
+
+#include <libcamera/logging.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(LogBinaryTest)
+
+namespace {
+
+enum RecordType : uint8_t {
+	RecordCategory = 1,
+	RecordLocation = 2,
+	RecordMessage = 3,
+	RecordText = 4,
+};
+
+struct Message {
+	uint64_t timestamp;
+	uint8_t severity;
+	uint16_t category;
+	uint32_t location;
+	string text;
+};
+
+class Reader
+{
+public:
+	Reader(const vector<uint8_t> &data)
+		: data_(data), offset_(0), error_(false)
+	{
+	}
+
+	bool atEnd() const { return offset_ == data_.size(); }
+	bool error() const { return error_; }
+
+	template<typename T>
+	T read()
+	{
+		T value{};
+		if (data_.size() - offset_ < sizeof(value)) {
+			error_ = true;
+			offset_ = data_.size();
+			return value;
+		}
+
+		memcpy(&value, data_.data() + offset_, sizeof(value));
+		offset_ += sizeof(value);
+		return value;
+	}
+
+	string readString(size_t length)
+	{
+		if (data_.size() - offset_ < length) {
+			error_ = true;
+			offset_ = data_.size();
+			return {};
+		}
+
+		string str(reinterpret_cast<const char *>(data_.data() + offset_), length);
+		offset_ += length;
+		return str;
+	}
+
+private:
+	const vector<uint8_t> &data_;
+	size_t offset_;
+	bool error_;
+};
+
+} /* namespace */
+
+class LogBinaryTest : public Test
+{
+protected:
+	int init() override
+	{
+		fd_ = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+		if (fd_ < 0) {
+			cerr << "Failed to open tmp log file" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		char path[32];
+		snprintf(path, sizeof(path), "/proc/self/fd/%u", fd_);
+
+		if (logSetFile(path, true) < 0) {
+			cerr << "Failed to set binary log file" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Log from one location, which also registers the category, and
+		 * then from another location several times.
+		 */
+		LOG(LogBinaryTest, Warning) << "warning";
+
+		logSetLevel("LogBinaryTest", "DEBUG");
+
+		for (unsigned int i = 1; i < 4; i++)
+			LOG(LogBinaryTest, Debug) << "message " << i;
+
+		/* Close the log file to flush it. */
+		logSetTarget(LoggingTargetNone);
+
+		struct stat st;
+		if (fstat(fd_, &st) < 0) {
+			cerr << "Failed to stat log file" << endl;
+			return TestFail;
+		}
+
+		vector<uint8_t> data(st.st_size);
+		if (pread(fd_, data.data(), data.size(), 0) != st.st_size) {
+			cerr << "Failed to read log file" << endl;
+			return TestFail;
+		}
+
+		Reader reader(data);
+
+		if (reader.read<uint32_t>() != 0x4c43424c ||
+		    reader.read<uint32_t>() != 1) {
+			cerr << "Invalid binary log header" << endl;
+			return TestFail;
+		}
+
+		map<uint16_t, string> categories;
+		map<uint32_t, pair<string, uint32_t>> locations;
+		vector<Message> messages;
+
+		while (!reader.atEnd()) {
+			uint8_t type = reader.read<uint8_t>();
+
+			switch (type) {
+			case RecordCategory: {
+				uint16_t id = reader.read<uint16_t>();
+				uint16_t length = reader.read<uint16_t>();
+				string name = reader.readString(length);
+
+				if (!categories.emplace(id, name).second) {
+					cerr << "Category " << id << " defined twice" << endl;
+					return TestFail;
+				}
+				break;
+			}
+
+			case RecordLocation: {
+				uint32_t id = reader.read<uint32_t>();
+				uint32_t line = reader.read<uint32_t>();
+				uint16_t length = reader.read<uint16_t>();
+				string file = reader.readString(length);
+
+				if (!locations.emplace(id, make_pair(file, line)).second) {
+					cerr << "Location " << id << " defined twice" << endl;
+					return TestFail;
+				}
+				break;
+			}
+
+			case RecordMessage: {
+				Message msg;
+				msg.timestamp = reader.read<uint64_t>();
+				reader.read<uint32_t>();
+				msg.severity = reader.read<uint8_t>();
+				msg.category = reader.read<uint16_t>();
+				msg.location = reader.read<uint32_t>();
+				msg.text = reader.readString(reader.read<uint32_t>());
+
+				/* Definitions must precede their first use. */
+				if (!categories.count(msg.category) ||
+				    !locations.count(msg.location)) {
+					cerr << "Message references undefined ids" << endl;
+					return TestFail;
+				}
+
+				messages.push_back(msg);
+				break;
+			}
+
+			case RecordText:
+				reader.readString(reader.read<uint32_t>());
+				break;
+
+			default:
+				cerr << "Invalid record type " << unsigned(type) << endl;
+				return TestFail;
+			}
+
+			if (reader.error()) {
+				cerr << "Truncated record" << endl;
+				return TestFail;
+			}
+		}
+
+		if (messages.size() != 4) {
+			cerr << "Expected 4 messages, got " << messages.size() << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < messages.size(); i++) {
+			const Message &msg = messages[i];
+			string text = i ? "message " + to_string(i) : "warning";
+			LogSeverity severity = i ? LogDebug : LogWarning;
+
+			if (msg.text != text || msg.severity != severity ||
+			    categories[msg.category] != "LogBinaryTest") {
+				cerr << "Message " << i << " mismatch" << endl;
+				return TestFail;
+			}
+
+			if (locations[msg.location].first != "log_binary.cpp") {
+				cerr << "Invalid location for message " << i << endl;
+				return TestFail;
+			}
+
+			if (i && msg.timestamp < messages[i - 1].timestamp) {
+				cerr << "Message timestamps not monotonic" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Messages from the same location share a location id. */
+		if (messages[1].location != messages[3].location ||
+		    messages[0].location == messages[1].location ||
+		    locations.size() != 2 || categories.size() != 1) {
+			cerr << "Locations or categories not deduplicated" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+private:
+	int fd_;
+};
+
+TEST_REGISTER(LogBinaryTest)
@@ -6,6 +6,7 @@
  */
 
 #include <iostream>
+#include <memory>
 
 #include <libcamera/framebuffer_allocator.h>
 
@@ -102,6 +103,41 @@ protected:
 			return TestFail;
 		}
 
+		/* Persistent maps should be shared between instances. */
+		const MappedFrameBuffer::MapFlags persistent =
+			MappedFrameBuffer::MapFlag::Read |
+			MappedFrameBuffer::MapFlag::Persistent;
+
+		std::unique_ptr<MappedFrameBuffer> cached =
+			std::make_unique<MappedFrameBuffer>(buffer.get(), persistent);
+		if (!cached->isValid()) {
+			cout << "Failed to map persistent buffer" << endl;
+			return TestFail;
+		}
+
+		uint8_t *data = cached->maps()[0].data();
+		cached.reset();
+
+		MappedFrameBuffer cachedAgain(buffer.get(), persistent);
+		if (!cachedAgain.isValid() || cachedAgain.maps()[0].data() != data) {
+			cout << "Persistent map not reused" << endl;
+			return TestFail;
+		}
+
+		/* The persistent map must stay accessible. */
+		if (cachedAgain.beginCpuAccess(MappedFrameBuffer::MapFlag::Read)) {
+			cout << "Failed to begin CPU access" << endl;
+			return TestFail;
+		}
+
+		volatile uint8_t value = cachedAgain.maps()[0][0];
+		(void)value;
+
+		if (cachedAgain.endCpuAccess()) {
+			cout << "Failed to end CPU access" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
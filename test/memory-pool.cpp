@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * memory-pool.cpp - Memory pool tests
+ */
+
+#include <iostream>
+#include <memory>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/memory_pool.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class MemoryPoolTest : public Test
+{
+protected:
+	int run()
+	{
+		/* Test that freed blocks are reused by the same thread. */
+		void *block = MemoryPool::allocate(48);
+		memset(block, 0xa5, 48);
+		MemoryPool::deallocate(block, 48);
+
+		void *other = MemoryPool::allocate(40);
+		MemoryPool::deallocate(other, 40);
+
+		if (other != block) {
+			cerr << "Freed block not reused" << endl;
+			return TestFail;
+		}
+
+		/* Test allocations larger than the pooled sizes. */
+		block = MemoryPool::allocate(MemoryPool::MaxBlockSize + 1);
+		memset(block, 0xa5, MemoryPool::MaxBlockSize + 1);
+		MemoryPool::deallocate(block, MemoryPool::MaxBlockSize + 1);
+
+		/*
+		 * Test blocks allocated in one thread and freed in another, in
+		 * amounts that exceed the thread caches.
+		 */
+		for (unsigned int round = 0; round < 10; round++) {
+			std::vector<void *> blocks;
+
+			std::thread producer([&]() {
+				for (unsigned int i = 0; i < 1000; i++) {
+					size_t size = 16 + i % MemoryPool::MaxBlockSize;
+					void *ptr = MemoryPool::allocate(size);
+					memset(ptr, i, size);
+					blocks.push_back(ptr);
+				}
+			});
+			producer.join();
+
+			std::thread consumer([&]() {
+				for (unsigned int i = 0; i < blocks.size(); i++) {
+					size_t size = 16 + i % MemoryPool::MaxBlockSize;
+					MemoryPool::deallocate(blocks[i], size);
+				}
+			});
+			consumer.join();
+		}
+
+		/* Test the allocator with a shared pointer. */
+		std::shared_ptr<std::vector<int>> ptr =
+			std::allocate_shared<std::vector<int>>(PoolAllocator<std::vector<int>>(),
+							       3, 42);
+		if (ptr->size() != 3 || (*ptr)[2] != 42) {
+			cerr << "Invalid object allocated with PoolAllocator" << endl;
+			return TestFail;
+		}
+
+		ptr.reset();
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MemoryPoolTest)
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * memory-tracker.cpp - Memory accounting test
+ */
+
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/memory_usage.h>
+
+#include "libcamera/internal/memory_tracker.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class MemoryTrackerTest : public Test
+{
+protected:
+	uint64_t bytes(const std::string &camera, const std::string &stream,
+		       MemoryUsage::Category category)
+	{
+		for (const MemoryUsage &entry : MemoryTracker::instance()->usage()) {
+			if (entry.camera == camera && entry.stream == stream &&
+			    entry.category == category)
+				return entry.bytes;
+		}
+
+		return 0;
+	}
+
+	int run() override
+	{
+		MemoryTracker *tracker = MemoryTracker::instance();
+		constexpr auto Internal = MemoryUsage::Category::InternalBuffers;
+		constexpr auto FrameBuffers = MemoryUsage::Category::FrameBuffers;
+
+		if (!tracker->usage().empty()) {
+			cout << "Memory usage not empty at startup" << endl;
+			return TestFail;
+		}
+
+		/* Allocations of the same stream and category are summed. */
+		MemoryTracker::Allocation a = tracker->track("cam0", "raw", Internal, 1000);
+		MemoryTracker::Allocation b = tracker->track("cam0", "raw", Internal, 500);
+		MemoryTracker::Allocation c = tracker->track("cam0", "stats", Internal, 64);
+		MemoryTracker::Allocation d = tracker->track("cam1", "raw", Internal, 2000);
+
+		if (tracker->usage().size() != 3 ||
+		    bytes("cam0", "raw", Internal) != 1500 ||
+		    bytes("cam0", "stats", Internal) != 64 ||
+		    bytes("cam1", "raw", Internal) != 2000) {
+			cout << "Invalid memory usage breakdown" << endl;
+			return TestFail;
+		}
+
+		/* Entries are sorted by camera and stream. */
+		std::vector<MemoryUsage> usage = tracker->usage();
+		if (usage[0].stream != "raw" || usage[1].stream != "stats" ||
+		    usage[2].camera != "cam1") {
+			cout << "Memory usage not sorted" << endl;
+			return TestFail;
+		}
+
+		/* Moving an allocation keeps a single record. */
+		MemoryTracker::Allocation moved = std::move(b);
+		if (b.isValid() || !moved.isValid() ||
+		    bytes("cam0", "raw", Internal) != 1500) {
+			cout << "Moving an allocation changed the usage" << endl;
+			return TestFail;
+		}
+
+		/* Released allocations are removed. */
+		moved.reset();
+		d = MemoryTracker::Allocation();
+		if (bytes("cam0", "raw", Internal) != 1000 ||
+		    bytes("cam1", "raw", Internal) != 0) {
+			cout << "Released allocations still accounted" << endl;
+			return TestFail;
+		}
+
+		/* Frame buffers are accounted until they are destroyed. */
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(0);
+		plane.length = 4096;
+
+		{
+			FrameBuffer buffer({ plane, plane });
+			MemoryTracker::track(&buffer, "cam0", "640x480-NV12",
+					     FrameBuffers);
+			if (bytes("cam0", "640x480-NV12", FrameBuffers) != 8192) {
+				cout << "Invalid frame buffer size" << endl;
+				return TestFail;
+			}
+
+			/* Tracking a buffer again replaces its record. */
+			MemoryTracker::track(&buffer, "cam0", "640x480-NV12",
+					     FrameBuffers);
+			if (bytes("cam0", "640x480-NV12", FrameBuffers) != 8192) {
+				cout << "Frame buffer tracked twice" << endl;
+				return TestFail;
+			}
+		}
+
+		if (bytes("cam0", "640x480-NV12", FrameBuffers) != 0) {
+			cout << "Destroyed frame buffer still accounted" << endl;
+			return TestFail;
+		}
+
+		a.reset();
+		c.reset();
+		if (!tracker->usage().empty()) {
+			cout << "Memory usage not empty after release" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MemoryTrackerTest)
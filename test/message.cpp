@@ -5,10 +5,12 @@
  * message.cpp - Messages test
  */
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <memory>
 #include <thread>
+#include <vector>
 
 #include <libcamera/base/message.h>
 #include <libcamera/base/thread.h>
@@ -111,6 +113,51 @@ protected:
 	}
 };
 
+class SequenceMessage : public Message
+{
+public:
+	SequenceMessage(unsigned int producer, unsigned int sequence)
+		: Message(Message::None), producer_(producer), sequence_(sequence)
+	{
+	}
+
+	unsigned int producer_;
+	unsigned int sequence_;
+};
+
+class OrderedMessageReceiver : public Object
+{
+public:
+	OrderedMessageReceiver(unsigned int producers)
+		: next_(producers, 0), received_(0), ordered_(true)
+	{
+	}
+
+	unsigned int received() const { return received_; }
+	bool ordered() const { return ordered_; }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != Message::None) {
+			Object::message(msg);
+			return;
+		}
+
+		SequenceMessage *seq = static_cast<SequenceMessage *>(msg);
+		if (seq->sequence_ != next_[seq->producer_])
+			ordered_ = false;
+
+		next_[seq->producer_] = seq->sequence_ + 1;
+		received_++;
+	}
+
+private:
+	std::vector<unsigned int> next_;
+	std::atomic<unsigned int> received_;
+	bool ordered_;
+};
+
 class MessageTest : public Test
 {
 protected:
@@ -182,6 +229,43 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test that messages posted concurrently from multiple threads
+		 * are all delivered, in posting order for each thread.
+		 */
+		constexpr unsigned int numProducers = 4;
+		constexpr unsigned int numMessages = 10000;
+
+		OrderedMessageReceiver orderedReceiver(numProducers);
+		orderedReceiver.moveToThread(&thread_);
+
+		std::vector<std::thread> producers;
+		for (unsigned int i = 0; i < numProducers; i++) {
+			producers.emplace_back([&orderedReceiver, i]() {
+				for (unsigned int j = 0; j < numMessages; j++)
+					orderedReceiver.postMessage(std::make_unique<SequenceMessage>(i, j));
+			});
+		}
+
+		for (std::thread &producer : producers)
+			producer.join();
+
+		for (unsigned int i = 0; i < 100; i++) {
+			if (orderedReceiver.received() == numProducers * numMessages)
+				break;
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		if (orderedReceiver.received() != numProducers * numMessages) {
+			cout << "Concurrently posted messages lost" << endl;
+			return TestFail;
+		}
+
+		if (!orderedReceiver.ordered()) {
+			cout << "Concurrently posted messages out of order" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
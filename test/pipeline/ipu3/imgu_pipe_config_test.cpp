@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * imgu_pipe_config_test.cpp - Test the ImgU pipe configuration selection
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+#include "imgu.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ImgUPipeConfigTest : public Test
+{
+protected:
+	using Policy = ImgUDevice::PipeConfigPolicy;
+
+	struct TestCase {
+		ImgUDevice::Pipe pipe;
+		/* Previous choice, kept as the default. */
+		Size largestFovIf;
+		Size largestFovBds;
+		/* Choice of the minimum bandwidth policy. */
+		Size minimumBandwidthIf;
+		Size minimumBandwidthBds;
+	};
+
+	/* Field of view of a pipe configuration, as computed by the ImgU. */
+	static pair<float, float> fov(const Size &in, const ImgUDevice::PipeConfig &config)
+	{
+		float inW = static_cast<float>(in.width);
+		float inH = static_cast<float>(in.height);
+		float ifCropW = static_cast<float>(in.width - config.iif.width);
+		float ifCropH = static_cast<float>(in.height - config.iif.height);
+		float gdcCropW = static_cast<float>(config.bds.width - config.gdc.width) * config.bds_sf;
+		float gdcCropH = static_cast<float>(config.bds.height - config.gdc.height) * config.bds_sf;
+
+		return { (inW - (ifCropW + gdcCropW)) / inW,
+			 (inH - (ifCropH + gdcCropH)) / inH };
+	}
+
+	int checkPolicies(const ImgUDevice::Pipe &pipe)
+	{
+		ImgUDevice::Pipe p = pipe;
+
+		ImgUDevice::PipeConfig largestFov =
+			imgu_.calculatePipeConfig(&p, Policy::LargestFov);
+		ImgUDevice::PipeConfig minimumBandwidth =
+			imgu_.calculatePipeConfig(&p, Policy::MinimumBandwidth);
+
+		if (largestFov.isNull() || minimumBandwidth.isNull()) {
+			cerr << "Failed to calculate pipe configuration for "
+			     << pipe.input.toString() << " -> "
+			     << pipe.main.toString() << endl;
+			return TestFail;
+		}
+
+		if (minimumBandwidth.gdc != largestFov.gdc ||
+		    fov(pipe.input, minimumBandwidth) != fov(pipe.input, largestFov)) {
+			cerr << "Minimum bandwidth policy changes the output for "
+			     << pipe.input.toString() << " -> "
+			     << pipe.main.toString() << endl;
+			return TestFail;
+		}
+
+		if (minimumBandwidth.bds.width * minimumBandwidth.bds.height >
+		    largestFov.bds.width * largestFov.bds.height) {
+			cerr << "Minimum bandwidth policy increases the BDS output for "
+			     << pipe.input.toString() << " -> "
+			     << pipe.main.toString() << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		const std::vector<TestCase> testCases = {
+			{ { { 2592, 1944 }, { 1920, 1080 }, {} },
+			  { 2592, 1476 }, { 2304, 1312 },
+			  { 2592, 1404 }, { 2304, 1248 } },
+			{ { { 4224, 3136 }, { 1920, 1080 }, {} },
+			  { 4224, 2508 }, { 2048, 1216 },
+			  { 4224, 2376 }, { 2048, 1152 } },
+			{ { { 2592, 1944 }, { 1280, 720 }, { 1280, 720 } },
+			  { 2592, 1464 }, { 1296, 732 },
+			  { 2584, 1456 }, { 1292, 728 } },
+			{ { { 4224, 3136 }, { 1920, 1440 }, {} },
+			  { 4224, 3036 }, { 2048, 1472 },
+			  { 4224, 3036 }, { 2048, 1472 } },
+		};
+
+		for (const TestCase &testCase : testCases) {
+			ImgUDevice::Pipe pipe = testCase.pipe;
+
+			ImgUDevice::PipeConfig config = imgu_.calculatePipeConfig(&pipe);
+			if (config.iif != testCase.largestFovIf ||
+			    config.bds != testCase.largestFovBds) {
+				cerr << "Default pipe configuration changed for "
+				     << pipe.input.toString() << " -> "
+				     << pipe.main.toString() << ": IF "
+				     << config.iif.toString() << ", BDS "
+				     << config.bds.toString() << endl;
+				return TestFail;
+			}
+
+			config = imgu_.calculatePipeConfig(&pipe, Policy::MinimumBandwidth);
+			if (config.iif != testCase.minimumBandwidthIf ||
+			    config.bds != testCase.minimumBandwidthBds) {
+				cerr << "Unexpected minimum bandwidth configuration for "
+				     << pipe.input.toString() << " -> "
+				     << pipe.main.toString() << ": IF "
+				     << config.iif.toString() << ", BDS "
+				     << config.bds.toString() << endl;
+				return TestFail;
+			}
+		}
+
+		/*
+		 * For all other sizes, the minimum bandwidth policy must keep
+		 * the field of view, and never increase the BDS output.
+		 */
+		const std::vector<Size> inputs = {
+			{ 4224, 3136 }, { 2592, 1944 },
+		};
+		const std::vector<Size> outputs = {
+			{ 3840, 2160 }, { 1920, 1080 }, { 1280, 720 }, { 640, 480 },
+		};
+
+		for (const Size &input : inputs) {
+			for (const Size &output : outputs) {
+				if (output.width > input.width ||
+				    output.height > input.height)
+					continue;
+
+				int ret = checkPolicies({ input, output, {} });
+				if (ret != TestPass)
+					return ret;
+
+				ret = checkPolicies({ input, output, { 1280, 720 } });
+				if (ret != TestPass)
+					return ret;
+			}
+		}
+
+		return TestPass;
+	}
+
+private:
+	ImgUDevice imgu_;
+};
+
+TEST_REGISTER(ImgUPipeConfigTest)
@@ -0,0 +1,346 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * software_isp_test.cpp - Test the simple pipeline handler software ISP
+ */
+
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+
+#include "software_isp.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class SoftwareIspTest : public Test
+{
+protected:
+	static constexpr unsigned int kWidth = 6;
+	static constexpr unsigned int kHeight = 8;
+
+	int init() override
+	{
+		isp_ = std::make_unique<SoftwareIsp>();
+		isp_->outputBufferReady.connect(this, &SoftwareIspTest::outputReady);
+
+		return TestPass;
+	}
+
+	void outputReady([[maybe_unused]] FrameBuffer *buffer)
+	{
+		completed_++;
+	}
+
+	/* Create a raw frame, filling each line with the \a fill function. */
+	std::unique_ptr<FrameBuffer>
+	createInput(unsigned int stride,
+		    const std::function<void(uint8_t *line, unsigned int y)> &fill)
+	{
+		unsigned int size = stride * kHeight;
+
+		int fd = memfd_create("software-isp-test", MFD_CLOEXEC);
+		if (fd < 0 || ftruncate(fd, size) < 0)
+			return nullptr;
+
+		void *mem = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mem == MAP_FAILED) {
+			close(fd);
+			return nullptr;
+		}
+
+		uint8_t *data = static_cast<uint8_t *>(mem);
+		for (unsigned int y = 0; y < kHeight; ++y)
+			fill(data + y * stride, y);
+
+		munmap(mem, size);
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(std::move(fd));
+		plane.length = size;
+
+		return std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane });
+	}
+
+	int configure(const PixelFormat &format, unsigned int stride)
+	{
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = format;
+		inputCfg.size = { kWidth, kHeight };
+		inputCfg.stride = stride;
+
+		StreamConfiguration outputCfg;
+		outputCfg.pixelFormat = formats::BGR888;
+		outputCfg.size = { kWidth, kHeight };
+
+		if (isp_->configure(inputCfg, { outputCfg }) < 0) {
+			cerr << "Failed to configure the software ISP" << endl;
+			return TestFail;
+		}
+
+		output_.clear();
+		if (isp_->exportBuffers(0, 1, &output_) != 1) {
+			cerr << "Failed to allocate output buffer" << endl;
+			return TestFail;
+		}
+
+		std::tie(outputStride_, std::ignore) =
+			isp_->strideAndFrameSize(formats::BGR888, { kWidth, kHeight });
+
+		return TestPass;
+	}
+
+	/* Process \a input and retrieve the output pixels as RGB triplets. */
+	int process(FrameBuffer *input, std::vector<uint8_t> *pixels)
+	{
+		completed_ = 0;
+
+		if (isp_->queueBuffers(input, { { 0, output_[0].get() } }) < 0) {
+			cerr << "Failed to queue buffers" << endl;
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && !completed_)
+			dispatcher->processEvents();
+
+		if (!completed_) {
+			cerr << "Timeout processing frame" << endl;
+			return TestFail;
+		}
+
+		const FrameBuffer::Plane &plane = output_[0]->planes()[0];
+		void *mem = mmap(nullptr, plane.length, PROT_READ, MAP_SHARED,
+				 plane.fd.fd(), 0);
+		if (mem == MAP_FAILED) {
+			cerr << "Failed to map output buffer" << endl;
+			return TestFail;
+		}
+
+		const uint8_t *data = static_cast<const uint8_t *>(mem);
+		pixels->clear();
+		for (unsigned int y = 0; y < kHeight; ++y)
+			pixels->insert(pixels->end(), data + y * outputStride_,
+				       data + y * outputStride_ + kWidth * 3);
+
+		munmap(mem, plane.length);
+
+		return TestPass;
+	}
+
+	/* Compute the output of the tone curve for a sample with unity gain. */
+	static uint8_t expected(unsigned int value, unsigned int bitDepth)
+	{
+		double blackLevel = 16 << (bitDepth - 8);
+		double range = (1 << bitDepth) - 1 - blackLevel;
+		return std::pow((value - blackLevel) / range, 1.0 / 2.2) * 255.0 + 0.5;
+	}
+
+	/*
+	 * Check that all output pixels have the expected red, green and blue
+	 * values, which also validates the demosaicing of uniform colour planes.
+	 */
+	int checkPixels(const std::vector<uint8_t> &pixels, uint8_t r, uint8_t g,
+			uint8_t b)
+	{
+		for (unsigned int i = 0; i < pixels.size(); i += 3) {
+			if (pixels[i] != r || pixels[i + 1] != g || pixels[i + 2] != b) {
+				cerr << "Pixel " << i / 3 % kWidth << "x" << i / 3 / kWidth
+				     << " is (" << unsigned(pixels[i]) << ", "
+				     << unsigned(pixels[i + 1]) << ", "
+				     << unsigned(pixels[i + 2]) << "), expected ("
+				     << unsigned(r) << ", " << unsigned(g) << ", "
+				     << unsigned(b) << ")" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testPacked()
+	{
+		/*
+		 * Use a width that isn't a multiple of 4 to exercise the partial
+		 * group of samples at the end of the lines.
+		 */
+		const unsigned int stride = 10;
+
+		if (configure(formats::SRGGB10_CSI2P, stride) != TestPass)
+			return TestFail;
+
+		/* Fill the frame with the 10-bit value 512. */
+		std::unique_ptr<FrameBuffer> input =
+			createInput(stride, [](uint8_t *line, [[maybe_unused]] unsigned int y) {
+				for (unsigned int x = 0; x < 10; x += 5) {
+					memset(line + x, 0x80, 4);
+					line[x + 4] = 0;
+				}
+			});
+		if (!input)
+			return TestFail;
+
+		isp_->start();
+
+		std::vector<uint8_t> pixels;
+		int ret = process(input.get(), &pixels);
+
+		isp_->stop();
+
+		if (ret != TestPass)
+			return ret;
+
+		uint8_t value = expected(512, 10);
+		if (checkPixels(pixels, value, value, value) != TestPass) {
+			cerr << "Invalid CSI-2 packed frame processing" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testWhiteBalance()
+	{
+		const unsigned int stride = kWidth;
+
+		if (configure(formats::SRGGB8, stride) != TestPass)
+			return TestFail;
+
+		/* Red samples are half the green and blue samples above black. */
+		std::unique_ptr<FrameBuffer> input =
+			createInput(stride, [](uint8_t *line, unsigned int y) {
+				for (unsigned int x = 0; x < kWidth; ++x)
+					line[x] = !(y & 1) && !(x & 1) ? 72 : 128;
+			});
+		if (!input)
+			return TestFail;
+
+		isp_->start();
+
+		/* The first frame is processed with unity gains. */
+		std::vector<uint8_t> pixels;
+		int ret = process(input.get(), &pixels);
+		if (ret != TestPass) {
+			isp_->stop();
+			return ret;
+		}
+
+		ret = checkPixels(pixels, expected(72, 8), expected(128, 8),
+				  expected(128, 8));
+		if (ret != TestPass) {
+			cerr << "Invalid demosaicing or lookup tables" << endl;
+			isp_->stop();
+			return ret;
+		}
+
+		/* The grey world gains converge over the next frames. */
+		for (unsigned int i = 0; i < 16; ++i) {
+			ret = process(input.get(), &pixels);
+			if (ret != TestPass) {
+				isp_->stop();
+				return ret;
+			}
+		}
+
+		isp_->stop();
+
+		uint8_t green = expected(128, 8);
+		if (std::abs(pixels[0] - green) > 1 || pixels[1] != green ||
+		    pixels[2] != green) {
+			cerr << "White balance didn't converge, got ("
+			     << unsigned(pixels[0]) << ", " << unsigned(pixels[1])
+			     << ", " << unsigned(pixels[2]) << ")" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testStop()
+	{
+		const unsigned int stride = kWidth;
+
+		if (configure(formats::SRGGB8, stride) != TestPass)
+			return TestFail;
+
+		std::unique_ptr<FrameBuffer> input =
+			createInput(stride, [](uint8_t *line, [[maybe_unused]] unsigned int y) {
+				memset(line, 128, kWidth);
+			});
+		if (!input)
+			return TestFail;
+
+		isp_->start();
+
+		completed_ = 0;
+		if (isp_->queueBuffers(input.get(), { { 0, output_[0].get() } }) < 0) {
+			cerr << "Failed to queue buffers" << endl;
+			isp_->stop();
+			return TestFail;
+		}
+
+		/* Stopping must complete the pending jobs synchronously. */
+		isp_->stop();
+
+		if (completed_ != 1) {
+			cerr << "Pending job not completed by stop()" << endl;
+			return TestFail;
+		}
+
+		/* Late strip completion notifications must be ignored. */
+		Thread::current()->dispatchMessages();
+
+		if (completed_ != 1) {
+			cerr << "Job completed twice" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret = testPacked();
+		if (ret != TestPass)
+			return ret;
+
+		ret = testWhiteBalance();
+		if (ret != TestPass)
+			return ret;
+
+		return testStop();
+	}
+
+	void cleanup() override
+	{
+		output_.clear();
+		isp_.reset();
+	}
+
+private:
+	std::unique_ptr<SoftwareIsp> isp_;
+	std::vector<std::unique_ptr<FrameBuffer>> output_;
+	unsigned int outputStride_;
+	unsigned int completed_;
+};
+
+TEST_REGISTER(SoftwareIspTest)
@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder_test.cpp - Test the UVC pipeline handler MJPEG decoder
+ */
+
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include <libcamera/base/event_dispatcher.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/timer.h>
+
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/framebuffer.h"
+
+#include "mjpeg_decoder.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class MjpegDecoderTest : public Test
+{
+protected:
+	static constexpr unsigned int kWidth = 64;
+	static constexpr unsigned int kHeight = 32;
+
+	/* Colour of the test image, in full range BT.601 YCbCr. */
+	static constexpr uint8_t kY = 100;
+	static constexpr uint8_t kCb = 80;
+	static constexpr uint8_t kCr = 160;
+
+	void outputReady(FrameBuffer *buffer)
+	{
+		status_ = buffer->metadata().status;
+		completed_ = true;
+	}
+
+	/* Encode a uniform image to JPEG in a memory buffer. */
+	static std::vector<uint8_t> encode()
+	{
+		struct jpeg_compress_struct cinfo;
+		struct jpeg_error_mgr jerr;
+		unsigned char *data = nullptr;
+		unsigned long size = 0;
+
+		cinfo.err = jpeg_std_error(&jerr);
+		jpeg_create_compress(&cinfo);
+		jpeg_mem_dest(&cinfo, &data, &size);
+
+		cinfo.image_width = kWidth;
+		cinfo.image_height = kHeight;
+		cinfo.input_components = 3;
+		cinfo.in_color_space = JCS_YCbCr;
+
+		jpeg_set_defaults(&cinfo);
+		jpeg_set_quality(&cinfo, 100, TRUE);
+		jpeg_start_compress(&cinfo, TRUE);
+
+		std::vector<uint8_t> line(kWidth * 3);
+		for (unsigned int x = 0; x < kWidth; ++x) {
+			line[x * 3] = kY;
+			line[x * 3 + 1] = kCb;
+			line[x * 3 + 2] = kCr;
+		}
+
+		while (cinfo.next_scanline < kHeight) {
+			JSAMPROW row = line.data();
+			jpeg_write_scanlines(&cinfo, &row, 1);
+		}
+
+		jpeg_finish_compress(&cinfo);
+		jpeg_destroy_compress(&cinfo);
+
+		std::vector<uint8_t> jpeg(data, data + size);
+		free(data);
+
+		return jpeg;
+	}
+
+	static std::unique_ptr<FrameBuffer> createInput(const std::vector<uint8_t> &jpeg)
+	{
+		int fd = memfd_create("mjpeg-decoder-test", MFD_CLOEXEC);
+		if (fd < 0)
+			return nullptr;
+
+		if (write(fd, jpeg.data(), jpeg.size()) != static_cast<ssize_t>(jpeg.size())) {
+			close(fd);
+			return nullptr;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(std::move(fd));
+		plane.length = jpeg.size();
+
+		auto buffer = std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane });
+
+		FrameMetadata &metadata = buffer->_d()->metadata();
+		metadata.status = FrameMetadata::FrameSuccess;
+		metadata.planes.resize(1);
+		metadata.planes[0].bytesused = jpeg.size();
+
+		return buffer;
+	}
+
+	static bool near(uint8_t value, uint8_t expected)
+	{
+		return abs(value - expected) <= 2;
+	}
+
+	int run() override
+	{
+		/* Decoding is opt-in. */
+		unsetenv("LIBCAMERA_UVC_MJPEG_DECODER");
+		if (MjpegDecoder::create(nullptr)) {
+			cerr << "Decoder created without being enabled" << endl;
+			return TestFail;
+		}
+
+		setenv("LIBCAMERA_UVC_MJPEG_DECODER", "libjpeg", 1);
+		std::unique_ptr<MjpegDecoder> decoder = MjpegDecoder::create(nullptr);
+		if (!decoder || strcmp(decoder->name(), "libjpeg")) {
+			cerr << "Failed to create libjpeg decoder" << endl;
+			return TestFail;
+		}
+
+		decoder->outputBufferReady.connect(this, &MjpegDecoderTest::outputReady);
+
+		unsigned int stride, frameSize;
+		std::tie(stride, frameSize) = decoder->strideAndFrameSize({ kWidth, kHeight });
+		if (stride < kWidth || frameSize < stride * kHeight * 3 / 2) {
+			cerr << "Invalid NV12 frame layout" << endl;
+			return TestFail;
+		}
+
+		if (decoder->configure({ kWidth, kHeight }, 1, 1) < 0) {
+			cerr << "Failed to configure decoder" << endl;
+			return TestFail;
+		}
+
+		std::vector<std::unique_ptr<FrameBuffer>> outputs;
+		if (decoder->exportBuffers(1, &outputs) != 1) {
+			cerr << "Failed to allocate output buffer" << endl;
+			return TestFail;
+		}
+
+		std::unique_ptr<FrameBuffer> input = createInput(encode());
+		if (!input) {
+			cerr << "Failed to create input buffer" << endl;
+			return TestFail;
+		}
+
+		if (decoder->start() < 0) {
+			cerr << "Failed to start decoder" << endl;
+			return TestFail;
+		}
+
+		completed_ = false;
+		if (decoder->decode(input.get(), outputs[0].get()) < 0) {
+			cerr << "Failed to queue frame for decoding" << endl;
+			decoder->stop();
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && !completed_)
+			dispatcher->processEvents();
+
+		decoder->stop();
+
+		if (!completed_ || status_ != FrameMetadata::FrameSuccess) {
+			cerr << "Frame not decoded" << endl;
+			return TestFail;
+		}
+
+		/* Verify the luma and the subsampled chroma planes. */
+		const FrameBuffer::Plane &plane = outputs[0]->planes()[0];
+		void *mem = mmap(nullptr, plane.length, PROT_READ, MAP_SHARED,
+				 plane.fd.fd(), 0);
+		if (mem == MAP_FAILED) {
+			cerr << "Failed to map output buffer" << endl;
+			return TestFail;
+		}
+
+		const uint8_t *luma = static_cast<const uint8_t *>(mem);
+		const uint8_t *chroma = luma + stride * kHeight;
+		int ret = TestPass;
+
+		for (unsigned int y = 0; y < kHeight && ret == TestPass; ++y) {
+			for (unsigned int x = 0; x < kWidth; ++x) {
+				if (!near(luma[y * stride + x], kY)) {
+					cerr << "Invalid luma at " << x << "x" << y << endl;
+					ret = TestFail;
+					break;
+				}
+			}
+		}
+
+		for (unsigned int y = 0; y < kHeight / 2 && ret == TestPass; ++y) {
+			for (unsigned int x = 0; x < kWidth / 2; ++x) {
+				const uint8_t *uv = chroma + y * stride + x * 2;
+				if (!near(uv[0], kCb) || !near(uv[1], kCr)) {
+					cerr << "Invalid chroma at " << x << "x" << y << endl;
+					ret = TestFail;
+					break;
+				}
+			}
+		}
+
+		munmap(mem, plane.length);
+
+		return ret;
+	}
+
+	void cleanup() override
+	{
+		unsetenv("LIBCAMERA_UVC_MJPEG_DECODER");
+	}
+
+private:
+	bool completed_;
+	FrameMetadata::Status status_;
+};
+
+TEST_REGISTER(MjpegDecoderTest)
@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * uvc_clock_test.cpp - Test the UVC pipeline handler clock recovery
+ */
+
+#include <iostream>
+#include <optional>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include "uvc_clock.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class UVCClockTest : public Test
+{
+protected:
+	/* Device clock frequency, and host time of device clock 0, in ns. */
+	static constexpr uint64_t kFrequency = 30000000;
+	static constexpr uint64_t kBaseTime = 1000000000000ULL;
+
+	/* Frame interval, in device clock ticks (30 fps). */
+	static constexpr uint32_t kFrameTicks = kFrequency / 30;
+
+	static uint64_t hostTime(int64_t stc)
+	{
+		return kBaseTime + stc * 1000000000 / static_cast<int64_t>(kFrequency);
+	}
+
+	static void writeLE32(uint8_t *data, uint32_t value)
+	{
+		data[0] = value;
+		data[1] = value >> 8;
+		data[2] = value >> 16;
+		data[3] = value >> 24;
+	}
+
+	/*
+	 * Append a V4L2_META_FMT_UVC block to \a data, with a UVC payload
+	 * header that contains the PTS and SCR if requested.
+	 */
+	static void appendBlock(std::vector<uint8_t> &data, uint64_t timestamp,
+				const uint32_t *pts, const uint32_t *scr)
+	{
+		uint8_t header[12] = {};
+		uint8_t length = 2;
+
+		header[1] = 0x80;
+
+		if (pts) {
+			header[1] |= 1 << 2;
+			writeLE32(header + length, *pts);
+			length += 4;
+		}
+
+		if (scr) {
+			header[1] |= 1 << 3;
+			writeLE32(header + length, *scr);
+			length += 6;
+		}
+
+		header[0] = length;
+
+		uint8_t block[12] = {};
+		memcpy(block, &timestamp, sizeof(timestamp));
+		block[10] = length;
+
+		data.insert(data.end(), block, block + sizeof(block));
+		data.insert(data.end(), header, header + length);
+	}
+
+	/*
+	 * Feed \a count frames to the clock, starting at device clock \a stc,
+	 * with host timestamps affected by a deterministic jitter.
+	 */
+	void feed(UVCClock &clock, uint32_t stc, unsigned int count)
+	{
+		static const int64_t jitter[] = { 40000, -25000, 10000, -40000, 15000 };
+
+		for (unsigned int i = 0; i < count; ++i) {
+			uint32_t scr = stc + i * kFrameTicks;
+			int64_t unwrapped = static_cast<int64_t>(stc) + i * kFrameTicks;
+			uint64_t timestamp = hostTime(unwrapped) + jitter[i % 5];
+
+			std::vector<uint8_t> data;
+			appendBlock(data, timestamp, &scr, &scr);
+			clock.parse(data);
+		}
+	}
+
+	int testParse()
+	{
+		UVCClock clock;
+		std::vector<uint8_t> data;
+		uint32_t pts = 0x12345678;
+		uint32_t otherPts = 0x9abcdef0;
+		uint32_t scr = 0x1000;
+
+		/* Blocks without a PTS report none. */
+		appendBlock(data, hostTime(0), nullptr, &scr);
+		if (clock.parse(data)) {
+			cerr << "PTS reported without PTS field" << endl;
+			return TestFail;
+		}
+
+		/* The PTS of the first block carrying one is reported. */
+		data.clear();
+		appendBlock(data, hostTime(0), nullptr, nullptr);
+		appendBlock(data, hostTime(0), &pts, nullptr);
+		appendBlock(data, hostTime(0), &otherPts, &scr);
+
+		std::optional<uint32_t> result = clock.parse(data);
+		if (!result || *result != pts) {
+			cerr << "Invalid PTS parsed" << endl;
+			return TestFail;
+		}
+
+		/* Truncated blocks are ignored. */
+		data.resize(data.size() - 3);
+		result = clock.parse(data);
+		if (!result || *result != pts) {
+			cerr << "Truncated block not handled" << endl;
+			return TestFail;
+		}
+
+		result = clock.parse(Span<const uint8_t>(data.data(), 5));
+		if (result) {
+			cerr << "PTS parsed from truncated header" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testFit(uint32_t stc)
+	{
+		UVCClock clock;
+
+		/* The clock needs several samples to become valid. */
+		feed(clock, stc, 4);
+		if (clock.isValid()) {
+			cerr << "Clock valid with too few samples" << endl;
+			return TestFail;
+		}
+
+		feed(clock, stc + 4 * kFrameTicks, 28);
+		if (!clock.isValid()) {
+			cerr << "Clock not valid after 32 samples" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Convert the PTS of the next frames, which are slightly ahead
+		 * of the last SCR, and check the fit averages the jitter out.
+		 */
+		for (unsigned int i = 31; i < 34; ++i) {
+			uint32_t pts = stc + i * kFrameTicks + kFrameTicks / 2;
+			int64_t unwrapped = static_cast<int64_t>(stc) + i * kFrameTicks +
+					    kFrameTicks / 2;
+			int64_t error = clock.timestamp(pts) - hostTime(unwrapped);
+
+			if (error < -20000 || error > 20000) {
+				cerr << "Timestamp error " << error << " ns for STC "
+				     << stc << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testReset()
+	{
+		UVCClock clock;
+
+		feed(clock, 0x10000000, 16);
+		if (!clock.isValid()) {
+			cerr << "Clock not valid" << endl;
+			return TestFail;
+		}
+
+		/* A device clock jumping back restarts the estimation. */
+		feed(clock, 0x1000, 1);
+		if (clock.isValid()) {
+			cerr << "Clock not reset when jumping back" << endl;
+			return TestFail;
+		}
+
+		/* Duplicate SCRs don't count as samples. */
+		for (unsigned int i = 0; i < 16; ++i) {
+			std::vector<uint8_t> data;
+			uint32_t scr = 0x2000;
+			appendBlock(data, hostTime(0x2000) + i * 1000, nullptr, &scr);
+			clock.parse(data);
+		}
+
+		if (clock.isValid()) {
+			cerr << "Duplicate SCRs counted as samples" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret = testParse();
+		if (ret != TestPass)
+			return ret;
+
+		ret = testFit(0x1000);
+		if (ret != TestPass)
+			return ret;
+
+		/* Wrap the 32-bit device clock in the middle of the samples. */
+		ret = testFit(0xffffffff - 10 * kFrameTicks);
+		if (ret != TestPass)
+			return ret;
+
+		return testReset();
+	}
+};
+
+TEST_REGISTER(UVCClockTest)
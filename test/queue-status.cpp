@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * queue-status.cpp - Request queue health test
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include <libcamera/queue_status.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+class QueueStatusTest : public Test
+{
+protected:
+	int run() override
+	{
+		QueueStatus status;
+
+		if (status.queued() || status.starvations() ||
+		    status.recommendedDepth()) {
+			cout << "Status not empty after construction" << endl;
+			return TestFail;
+		}
+
+		/* Null frame intervals are ignored. */
+		if (status.updateDepth(10ms, 0ms) || status.recommendedDepth()) {
+			cout << "Null frame interval not ignored" << endl;
+			return TestFail;
+		}
+
+		/* A pipeline faster than the frame rate needs two requests. */
+		if (!status.updateDepth(10ms, 33ms) || status.recommendedDepth() != 2) {
+			cout << "Invalid depth for fast pipeline: "
+			     << status.recommendedDepth() << endl;
+			return TestFail;
+		}
+
+		if (status.updateDepth(12ms, 33ms)) {
+			cout << "Unchanged depth reported as changed" << endl;
+			return TestFail;
+		}
+
+		/* 70ms of processing at 30fps span three frames. */
+		if (!status.updateDepth(70ms, 33ms) || status.recommendedDepth() != 4) {
+			cout << "Invalid depth for slow pipeline: "
+			     << status.recommendedDepth() << endl;
+			return TestFail;
+		}
+
+		/* Completions without starvation only update the count. */
+		for (unsigned int i = 0; i < 3; i++)
+			status.requestQueued();
+
+		if (status.requestCompleted(false) || status.queued() != 2) {
+			cout << "Invalid completion handling" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Starving with less requests than recommended doesn't change
+		 * the depth.
+		 */
+		status.requestCompleted(false);
+		if (!status.requestCompleted(true) || status.starvations() != 1 ||
+		    status.queued() || status.recommendedDepth() != 4) {
+			cout << "Invalid starvation with a shallow queue" << endl;
+			return TestFail;
+		}
+
+		/* Starving with the recommended depth increases it. */
+		for (unsigned int i = 0; i < 4; i++)
+			status.requestQueued();
+		for (unsigned int i = 0; i < 3; i++)
+			status.requestCompleted(false);
+
+		if (!status.requestCompleted(true) || status.starvations() != 2 ||
+		    status.recommendedDepth() != 5) {
+			cout << "Invalid starvation with the recommended depth: "
+			     << status.recommendedDepth() << endl;
+			return TestFail;
+		}
+
+		/* Reset keeps the queued requests. */
+		status.requestQueued();
+		status.reset();
+		if (status.queued() != 1 || status.starvations() ||
+		    status.recommendedDepth()) {
+			cout << "Invalid reset" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(QueueStatusTest)
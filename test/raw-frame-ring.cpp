@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * raw-frame-ring.cpp - RAW frame ring test
+ */
+
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer.h>
+
+#include "libcamera/internal/raw_frame_ring.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class RawFrameRingTest : public Test
+{
+protected:
+	int init()
+	{
+		for (unsigned int i = 0; i < 5; ++i)
+			buffers_.push_back(make_unique<FrameBuffer>(vector<FrameBuffer::Plane>{}));
+
+		return TestPass;
+	}
+
+	FrameBuffer *push(RawFrameRing &ring, unsigned int index)
+	{
+		ControlList metadata(controls::controls);
+		metadata.set(controls::SensorTimestamp, static_cast<int64_t>(index + 1) * 1000);
+
+		return ring.push(buffers_[index].get(), std::move(metadata));
+	}
+
+	int run()
+	{
+		RawFrameRing ring;
+
+		/* A ring with zero capacity returns the frames immediately. */
+		if (push(ring, 0) != buffers_[0].get() || !ring.empty()) {
+			cerr << "Frame stored in a disabled ring" << endl;
+			return TestFail;
+		}
+
+		ring.reset(3);
+
+		if (ring.take()) {
+			cerr << "Frame taken from an empty ring" << endl;
+			return TestFail;
+		}
+
+		/* Fill the ring, the oldest frames get evicted. */
+		for (unsigned int i = 0; i < 5; ++i) {
+			FrameBuffer *evicted = push(ring, i);
+			FrameBuffer *expected = i < 3 ? nullptr : buffers_[i - 3].get();
+
+			if (evicted != expected) {
+				cerr << "Unexpected buffer evicted for frame " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (ring.size() != 3) {
+			cerr << "Invalid ring size " << ring.size() << endl;
+			return TestFail;
+		}
+
+		/* Select a frame by timestamp, the closest frame is taken. */
+		optional<RawFrameRing::Frame> frame = ring.take(3900);
+		if (!frame || frame->buffer != buffers_[3].get() ||
+		    frame->metadata.get(controls::SensorTimestamp) != 4000) {
+			cerr << "Failed to select the frame by timestamp" << endl;
+			return TestFail;
+		}
+
+		/* A null timestamp selects the most recent frame. */
+		frame = ring.take();
+		if (!frame || frame->buffer != buffers_[4].get()) {
+			cerr << "Failed to select the most recent frame" << endl;
+			return TestFail;
+		}
+
+		vector<FrameBuffer *> remaining = ring.clear();
+		if (remaining.size() != 1 || remaining[0] != buffers_[2].get() ||
+		    !ring.empty()) {
+			cerr << "Failed to clear the ring" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	vector<unique_ptr<FrameBuffer>> buffers_;
+};
+
+TEST_REGISTER(RawFrameRingTest)
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * request-metadata.cpp - Request shared metadata test
+ */
+
+#include <iostream>
+#include <memory>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/request.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class RequestMetadataTest : public Test
+{
+protected:
+	int run() override
+	{
+		Request request(nullptr);
+
+		request.metadata().set(controls::SensorTimestamp, 1000);
+
+		/* The shared metadata references the request metadata. */
+		std::shared_ptr<const ControlList> metadata = request.sharedMetadata();
+		if (metadata.get() != &request.metadata()) {
+			cout << "Shared metadata is a copy" << endl;
+			return TestFail;
+		}
+
+		/* Reusing the request must not modify the shared metadata. */
+		request.reuse();
+		if (!request.metadata().empty()) {
+			cout << "Request metadata not cleared by reuse" << endl;
+			return TestFail;
+		}
+
+		if (metadata.get() == &request.metadata() ||
+		    metadata->get(controls::SensorTimestamp) != 1000) {
+			cout << "Shared metadata modified by request reuse" << endl;
+			return TestFail;
+		}
+
+		/* Without references, the metadata is recycled in place. */
+		metadata.reset();
+		const ControlList *current = &request.metadata();
+		request.metadata().set(controls::SensorTimestamp, 2000);
+		request.reuse();
+
+		if (&request.metadata() != current || !request.metadata().empty()) {
+			cout << "Request metadata not recycled" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(RequestMetadataTest)
@@ -10,6 +10,7 @@
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
+#include <libcamera/ipa/ipa_controls.h>
 
 #include "libcamera/internal/byte_stream_buffer.h"
 #include "libcamera/internal/control_serializer.h"
@@ -169,6 +170,258 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Serialize the list twice with delta encoding, the second time
+		 * with a modified value and a removed control, and verify that
+		 * the delta is smaller than the full list and deserializes to
+		 * the modified list.
+		 */
+		serializer.setDeltaEncoding(true);
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			if (i == 1) {
+				list = ControlList(infoMap);
+				list.set(controls::Brightness, 0.5f);
+				list.set(controls::Contrast, 1.5f);
+			}
+
+			size = serializer.binarySize(list);
+			listData.resize(size);
+			buffer = ByteStreamBuffer(listData.data(), listData.size());
+
+			ret = serializer.serialize(list, buffer);
+			if (ret < 0) {
+				cerr << "Failed to serialize ControlList with delta"
+				     << endl;
+				return TestFail;
+			}
+
+			if (i == 1 && buffer.offset() >= size) {
+				cerr << "Delta-encoded ControlList not smaller" << endl;
+				return TestFail;
+			}
+
+			buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+						  buffer.offset());
+
+			newList = deserializer.deserialize<ControlList>(buffer);
+			if (buffer.overflow() || !equals(list, newList)) {
+				cerr << "Delta-encoded list doesn't match original"
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		/* Serialize the list in a single pass at the end of a vector. */
+		list.set(controls::Saturation, 0.8f);
+		listData.clear();
+
+		ret = serializer.serialize(list, listData);
+		if (ret < 0) {
+			cerr << "Failed to serialize ControlList to vector" << endl;
+			return TestFail;
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+					  listData.size());
+
+		newList = deserializer.deserialize<ControlList>(buffer);
+		if (buffer.overflow() || !equals(list, newList)) {
+			cerr << "List serialized to vector doesn't match original"
+			     << endl;
+			return TestFail;
+		}
+
+		if (deserializer.takeError()) {
+			cerr << "Unexpected deserialization error" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Drop a delta-encoded list, the next delta references a base
+		 * the deserializer doesn't have and must be reported as an
+		 * error.
+		 */
+		for (unsigned int i = 0; i < 2; ++i) {
+			list.set(controls::Saturation, 0.6f + i * 0.1f);
+			listData.clear();
+
+			ret = serializer.serialize(list, listData);
+			if (ret < 0) {
+				cerr << "Failed to serialize ControlList to vector" << endl;
+				return TestFail;
+			}
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+					  listData.size());
+
+		newList = deserializer.deserialize<ControlList>(buffer);
+		if (!newList.empty() || deserializer.takeError() != -EPROTO) {
+			cerr << "Missing delta base not reported" << endl;
+			return TestFail;
+		}
+
+		if (deserializer.takeError()) {
+			cerr << "Deserialization error not cleared" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Restarting delta encoding after the loss sends full lists,
+		 * which resynchronizes the deserializer for the next deltas.
+		 */
+		serializer.restartDeltaEncoding();
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			list.set(controls::Saturation, 0.9f + i * 0.1f);
+			listData.clear();
+
+			ret = serializer.serialize(list, listData);
+			if (ret < 0) {
+				cerr << "Failed to serialize ControlList to vector" << endl;
+				return TestFail;
+			}
+
+			buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+						  listData.size());
+
+			newList = deserializer.deserialize<ControlList>(buffer);
+			if (deserializer.takeError() || !equals(list, newList)) {
+				cerr << "Delta encoding not resynchronized" << endl;
+				return TestFail;
+			}
+		}
+
+		/*
+		 * Serialize a copy of the control info map, it should be sent
+		 * as a reference to the cached map. A modified map should be
+		 * serialized in full.
+		 */
+		ControlInfoMap infoMapCopy = infoMap;
+		size = serializer.binarySize(infoMapCopy);
+		infoData.resize(size);
+		buffer = ByteStreamBuffer(infoData.data(), infoData.size());
+
+		ret = serializer.serialize(infoMapCopy, buffer);
+		if (ret < 0 || buffer.offset() != sizeof(struct ipa_controls_header)) {
+			cerr << "Identical ControlInfoMap not serialized as a reference"
+			     << endl;
+			return TestFail;
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(infoData.data()),
+					  buffer.offset());
+
+		newInfoMap = deserializer.deserialize<ControlInfoMap>(buffer);
+		if (buffer.overflow() || !equals(infoMap, newInfoMap)) {
+			cerr << "ControlInfoMap reference doesn't match original"
+			     << endl;
+			return TestFail;
+		}
+
+		ControlInfoMap::Map modified;
+		for (const auto &[id, info] : infoMap)
+			modified.emplace(id, info);
+		modified[&controls::Brightness] = ControlInfo(-2.0f, 2.0f);
+		ControlInfoMap modifiedMap(std::move(modified), infoMap.idmap());
+
+		size = serializer.binarySize(modifiedMap);
+		infoData.resize(size);
+		buffer = ByteStreamBuffer(infoData.data(), infoData.size());
+
+		ret = serializer.serialize(modifiedMap, buffer);
+		if (ret < 0 || buffer.offset() != size) {
+			cerr << "Modified ControlInfoMap not serialized in full"
+			     << endl;
+			return TestFail;
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(infoData.data()),
+					  infoData.size());
+
+		newInfoMap = deserializer.deserialize<ControlInfoMap>(buffer);
+		if (!equals(modifiedMap, newInfoMap)) {
+			cerr << "Modified ControlInfoMap doesn't match original"
+			     << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Serialize many different control info maps to fill the
+		 * cache. The least recently used maps are evicted, and a copy
+		 * of the original map must then be serialized in full and be
+		 * usable to serialize control lists.
+		 */
+		for (unsigned int i = 0; i < 20; ++i) {
+			ControlInfoMap::Map other;
+			for (const auto &[id, info] : infoMap)
+				other.emplace(id, info);
+			other[&controls::Brightness] = ControlInfo(-3.0f - i, 3.0f + i);
+			ControlInfoMap otherMap(std::move(other), infoMap.idmap());
+
+			infoData.resize(serializer.binarySize(otherMap));
+			buffer = ByteStreamBuffer(infoData.data(), infoData.size());
+
+			ret = serializer.serialize(otherMap, buffer);
+			if (ret < 0) {
+				cerr << "Failed to serialize ControlInfoMap" << endl;
+				return TestFail;
+			}
+
+			buffer = ByteStreamBuffer(const_cast<const uint8_t *>(infoData.data()),
+						  infoData.size());
+
+			newInfoMap = deserializer.deserialize<ControlInfoMap>(buffer);
+			if (deserializer.takeError() || !equals(otherMap, newInfoMap)) {
+				cerr << "Failed to deserialize ControlInfoMap " << i
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		size = serializer.binarySize(infoMapCopy);
+		infoData.resize(size);
+		buffer = ByteStreamBuffer(infoData.data(), infoData.size());
+
+		ret = serializer.serialize(infoMapCopy, buffer);
+		if (ret < 0 || buffer.offset() != size) {
+			cerr << "Evicted ControlInfoMap not serialized in full"
+			     << endl;
+			return TestFail;
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(infoData.data()),
+					  infoData.size());
+
+		newInfoMap = deserializer.deserialize<ControlInfoMap>(buffer);
+		if (deserializer.takeError() || !equals(infoMap, newInfoMap)) {
+			cerr << "Evicted ControlInfoMap doesn't match original"
+			     << endl;
+			return TestFail;
+		}
+
+		ControlList copyList(infoMapCopy);
+		copyList.set(controls::Brightness, 0.3f);
+
+		listData.clear();
+		ret = serializer.serialize(copyList, listData);
+		if (ret < 0) {
+			cerr << "Failed to serialize ControlList after eviction"
+			     << endl;
+			return TestFail;
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+					  listData.size());
+
+		newList = deserializer.deserialize<ControlList>(buffer);
+		if (deserializer.takeError() || !equals(copyList, newList)) {
+			cerr << "ControlList doesn't match original after eviction"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -98,6 +98,61 @@ if (struct1.field != struct2.field) {				\
 		TEST_FIELD_EQUALITY(v[1], w[1], s3);
 		TEST_FIELD_EQUALITY(v[1], w[1], i);
 
+		/* Test structs serialized with a single copy */
+		if (!IPADataSerializer<ipa::test::TestFlatStruct>::FlatLayout ||
+		    IPADataSerializer<ipa::test::TestPaddedStruct>::FlatLayout) {
+			cerr << "Incorrect flat layout detection" << endl;
+			return TestFail;
+		}
+
+		ipa::test::TestFlatStruct f, g;
+		f.u = 0xdeadbeef;
+		f.i = -42;
+		f.op = ipa::test::IPAOperationStop;
+		f.f = 1.5f;
+		f.l = 0x0123456789abcdefULL;
+
+		std::tie(serialized, ignore) =
+			IPADataSerializer<ipa::test::TestFlatStruct>::serialize(f);
+
+		/* The flat layout must match the field by field serialization. */
+		if (serialized.size() != 24 ||
+		    readPOD<uint32_t>(serialized, 0) != f.u ||
+		    readPOD<int32_t>(serialized, 4) != f.i ||
+		    readPOD<uint32_t>(serialized, 8) != static_cast<uint32_t>(f.op) ||
+		    readPOD<float>(serialized, 12) != f.f ||
+		    readPOD<uint64_t>(serialized, 16) != f.l) {
+			cerr << "Incorrect flat struct serialization" << endl;
+			return TestFail;
+		}
+
+		g = IPADataSerializer<ipa::test::TestFlatStruct>::deserialize(serialized);
+
+		if (g.u != f.u || g.i != f.i || g.op != f.op || g.f != f.f ||
+		    g.l != f.l) {
+			cerr << "Deserialized flat struct doesn't match original" << endl;
+			return TestFail;
+		}
+
+		ipa::test::TestPaddedStruct p, q;
+		p.b = 0x12;
+		p.u = 0x3456789a;
+
+		std::tie(serialized, ignore) =
+			IPADataSerializer<ipa::test::TestPaddedStruct>::serialize(p);
+
+		if (serialized.size() != 5) {
+			cerr << "Padded struct serialized with padding" << endl;
+			return TestFail;
+		}
+
+		q = IPADataSerializer<ipa::test::TestPaddedStruct>::deserialize(serialized);
+
+		if (q.b != p.b || q.u != p.u) {
+			cerr << "Deserialized padded struct doesn't match original" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -144,6 +144,10 @@ protected:
 		if (ret != TestPass)
 			return ret;
 
+		ret = testAppend();
+		if (ret != TestPass)
+			return ret;
+
 		return TestPass;
 	}
 
@@ -435,6 +439,43 @@ private:
 
 		return TestPass;
 	}
+
+	int testAppend()
+	{
+		std::map<std::string, std::vector<uint32_t>> mapVec = {
+			{ "foo", { 1, 2, 3 } },
+			{ "bar", {} },
+			{ "baz", { 4, 5 } },
+		};
+
+		std::vector<uint8_t> ref;
+		std::tie(ref, std::ignore) =
+			IPADataSerializer<decltype(mapVec)>::serialize(mapVec);
+
+		/*
+		 * Serialize in buffers that already hold data, the serialized
+		 * data must be appended unmodified.
+		 */
+		std::vector<uint8_t> buf = { 0xaa, 0x55 };
+		std::vector<int32_t> fds;
+
+		IPADataSerializer<decltype(mapVec)>::serialize(mapVec, buf, fds);
+
+		if (!fds.empty() || buf.size() != ref.size() + 2 ||
+		    buf[0] != 0xaa || buf[1] != 0x55 ||
+		    !std::equal(ref.begin(), ref.end(), buf.begin() + 2)) {
+			cerr << "Appended serialization doesn't match" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> data(buf.begin() + 2, buf.end());
+		if (IPADataSerializer<decltype(mapVec)>::deserialize(data) != mapVec) {
+			cerr << "Deserialized appended map doesn't match original" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
 };
 
 TEST_REGISTER(IPADataSerializerTest)
@@ -74,6 +74,35 @@ protected:
 		signalVoid_.disconnect(this, &SignalTest::slotDisconnect);
 	}
 
+	void slotDeleteSignal(int value)
+	{
+		values_[0] = value;
+		delete signalDynamic_;
+		signalDynamic_ = nullptr;
+	}
+
+	void slotDisconnectOther(int value)
+	{
+		values_[0] = value;
+		signalInt_.disconnect(this, &SignalTest::slotInteger2);
+	}
+
+	void slotConnectOther(int value)
+	{
+		values_[0] = value;
+		signalInt_.connect(this, &SignalTest::slotInteger2);
+	}
+
+	void slotEmitDynamic(int value)
+	{
+		/* Emit once more, the nested emission deletes the signal. */
+		if (nestedEmission_)
+			return;
+
+		nestedEmission_ = true;
+		signalDynamic_->emit(value);
+	}
+
 	void slotInteger1(int value)
 	{
 		values_[0] = value;
@@ -184,6 +213,59 @@ protected:
 			return TestFail;
 		}
 
+		/* Test disconnection of a subsequent slot from slot. */
+		memset(values_, 0, sizeof(values_));
+		signalInt_.connect(this, &SignalTest::slotDisconnectOther);
+		signalInt_.connect(this, &SignalTest::slotInteger2);
+		signalInt_.emit(42);
+
+		if (values_[0] != 42 || values_[1] != 0) {
+			cout << "Signal disconnection of other slot test failed" << endl;
+			return TestFail;
+		}
+
+		signalInt_.disconnect();
+
+		/* Test that slots connected from a slot are called on the next emission. */
+		memset(values_, 0, sizeof(values_));
+		signalInt_.connect(this, &SignalTest::slotConnectOther);
+		signalInt_.emit(42);
+
+		if (values_[0] != 42 || values_[1] != 0) {
+			cout << "Signal connection from slot test failed" << endl;
+			return TestFail;
+		}
+
+		signalInt_.emit(43);
+
+		if (values_[0] != 43 || values_[1] != 43) {
+			cout << "Signal connection from slot test failed" << endl;
+			return TestFail;
+		}
+
+		signalInt_.disconnect();
+
+		/*
+		 * Test destruction of the signal from a slot, including from a
+		 * nested emission. The emission must stop without accessing
+		 * the signal.
+		 */
+		for (unsigned int nested = 0; nested < 2; nested++) {
+			memset(values_, 0, sizeof(values_));
+			nestedEmission_ = false;
+			signalDynamic_ = new Signal<int>();
+			if (nested)
+				signalDynamic_->connect(this, &SignalTest::slotEmitDynamic);
+			signalDynamic_->connect(this, &SignalTest::slotDeleteSignal);
+			signalDynamic_->connect(this, &SignalTest::slotInteger2);
+			signalDynamic_->emit(42);
+
+			if (signalDynamic_ || values_[0] != 42 || values_[1] != 0) {
+				cout << "Signal deletion from slot test failed" << endl;
+				return TestFail;
+			}
+		}
+
 		/*
 		 * Test connecting to slots that return a value. This targets
 		 * compilation, there's no need to check runtime results.
@@ -308,6 +390,8 @@ private:
 	Signal<> signalVoid_;
 	Signal<int> signalInt_;
 	Signal<int, const std::string &> signalMultiArgs_;
+	Signal<int> *signalDynamic_;
+	bool nestedEmission_;
 
 	bool called_;
 	int values_[3];
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * stream-stats.cpp - Per-stream frame statistics test
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream_stats.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+using namespace std::chrono_literals;
+
+class StreamStatsTest : public Test
+{
+protected:
+	void record(StreamStats &stats, uint32_t sequence,
+		    std::chrono::nanoseconds completion,
+		    FrameMetadata::Status status = FrameMetadata::FrameSuccess)
+	{
+		FrameMetadata metadata{};
+		metadata.status = status;
+		metadata.sequence = sequence;
+		metadata.timestamp = (completion - 5ms).count();
+
+		stats.record(metadata, completion);
+	}
+
+	int run() override
+	{
+		StreamStats stats;
+
+		if (stats.frames() || stats.dropped() || stats.frameRate() != 0.0) {
+			cout << "Statistics not empty after construction" << endl;
+			return TestFail;
+		}
+
+		/* Deliver 10 frames at 20fps, with frames 4 and 5 dropped. */
+		std::chrono::nanoseconds time = 1s;
+		for (uint32_t sequence = 0; sequence < 12; sequence++, time += 50ms) {
+			if (sequence == 4 || sequence == 5)
+				continue;
+
+			record(stats, sequence, time);
+		}
+
+		if (stats.frames() != 10 || stats.dropped() != 2 || stats.errors()) {
+			cout << "Invalid frame counts " << stats.frames() << ", "
+			     << stats.dropped() << ", " << stats.errors() << endl;
+			return TestFail;
+		}
+
+		if (stats.latency().count() != 10 || stats.latency().mean() != 5ms) {
+			cout << "Invalid latency" << endl;
+			return TestFail;
+		}
+
+		/* 9 intervals, one of which spans the dropped frames. */
+		if (stats.frameInterval().count() != 9 ||
+		    stats.frameInterval().min() != 50ms ||
+		    stats.frameInterval().max() != 150ms ||
+		    stats.jitter().count() != 8 || stats.jitter().max() != 100ms) {
+			cout << "Invalid frame interval or jitter" << endl;
+			return TestFail;
+		}
+
+		/* Cancelled frames are ignored, erroneous frames are counted. */
+		record(stats, 12, time, FrameMetadata::FrameCancelled);
+		record(stats, 12, time, FrameMetadata::FrameError);
+		if (stats.frames() != 11 || stats.errors() != 1) {
+			cout << "Invalid handling of cancelled or erroneous frames" << endl;
+			return TestFail;
+		}
+
+		/* A lower sequence number starts a new session. */
+		record(stats, 0, time + 10s);
+		if (stats.dropped() != 2 || stats.frameInterval().count() != 10) {
+			cout << "Invalid handling of sequence restart" << endl;
+			return TestFail;
+		}
+
+		std::string json = stats.toJson();
+		if (json.find("\"frames\": 12, \"dropped\": 2, \"errors\": 1") == std::string::npos ||
+		    json.find("\"jitter\": {") == std::string::npos) {
+			cout << "Invalid JSON export: " << json << endl;
+			return TestFail;
+		}
+
+		stats.reset();
+		if (stats.frames() || stats.frameInterval().count()) {
+			cout << "Statistics not empty after reset" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(StreamStatsTest)
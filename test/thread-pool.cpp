@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * thread-pool.cpp - Thread pool test
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <libcamera/base/object.h>
+#include <libcamera/base/thread.h>
+#include <libcamera/base/thread_pool.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: completed_(0), sum_(0)
+	{
+	}
+
+	void completed()
+	{
+		if (Thread::current() == thread())
+			completed_++;
+	}
+
+	void result(unsigned int value)
+	{
+		if (Thread::current() == thread())
+			sum_ += value;
+	}
+
+	unsigned int completed_;
+	unsigned int sum_;
+};
+
+class ThreadPoolTest : public Test
+{
+protected:
+	static constexpr unsigned int NumWorkers = 4;
+	static constexpr unsigned int NumTasks = 1000;
+
+	int run()
+	{
+		ThreadPool pool(NumWorkers);
+		if (pool.size() != NumWorkers) {
+			cout << "Invalid number of workers" << endl;
+			return TestFail;
+		}
+
+		/* Test running tasks, including tasks queued by tasks. */
+		std::atomic<unsigned int> count = 0;
+
+		for (unsigned int i = 0; i < NumTasks; i++) {
+			pool.run([&]() {
+				count++;
+				pool.run([&]() { count++; });
+			});
+		}
+
+		pool.wait();
+
+		if (count != NumTasks * 2) {
+			cout << "Only " << count << " tasks out of "
+			     << NumTasks * 2 << " have run" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Test work stealing, with all tasks queued to the same worker
+		 * by a task.
+		 */
+		std::mutex mutex;
+		std::set<std::thread::id> threads;
+
+		pool.run([&]() {
+			for (unsigned int i = 0; i < NumWorkers * 4; i++) {
+				pool.run([&]() {
+					this_thread::sleep_for(chrono::milliseconds(10));
+
+					std::lock_guard<std::mutex> locker(mutex);
+					threads.insert(this_thread::get_id());
+				});
+			}
+		});
+
+		pool.wait();
+
+		if (threads.size() < 2) {
+			cout << "Tasks have not been stolen" << endl;
+			return TestFail;
+		}
+
+		/* Test completion callbacks. */
+		Receiver receiver;
+
+		for (unsigned int i = 1; i <= 10; i++) {
+			pool.run([]() {}, &receiver, &Receiver::completed);
+			pool.run([i]() { return i; }, &receiver, &Receiver::result);
+		}
+
+		/*
+		 * All completion calls have been queued when wait() returns,
+		 * dispatch them.
+		 */
+		pool.wait();
+		Thread::current()->dispatchMessages();
+
+		if (receiver.completed_ != 10 || receiver.sum_ != 55) {
+			cout << "Completion callbacks failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ThreadPoolTest)
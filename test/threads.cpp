@@ -8,6 +8,10 @@
 #include <chrono>
 #include <iostream>
 #include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
 #include <thread>
 
 #include <libcamera/base/thread.h>
@@ -35,6 +39,24 @@ private:
 	chrono::steady_clock::duration duration_;
 };
 
+class AttributesThread : public Thread
+{
+public:
+	std::string name_;
+	cpu_set_t cpus_;
+
+protected:
+	void run()
+	{
+		char name[16] = {};
+		pthread_getname_np(pthread_self(), name, sizeof(name));
+		name_ = name;
+
+		CPU_ZERO(&cpus_);
+		sched_getaffinity(0, sizeof(cpus_), &cpus_);
+	}
+};
+
 class ThreadTest : public Test
 {
 protected:
@@ -118,6 +140,70 @@ protected:
 			return TestFail;
 		}
 
+		/* Test thread name and affinity. */
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		sched_getaffinity(0, sizeof(allowed), &allowed);
+
+		std::vector<unsigned int> cpus;
+		for (unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed)) {
+				cpus.push_back(cpu);
+				break;
+			}
+		}
+
+		std::unique_ptr<AttributesThread> attrThread =
+			std::make_unique<AttributesThread>();
+		attrThread->setName("TestThreadWithALongName");
+
+		if (attrThread->setAffinity(cpus)) {
+			cout << "Failed to set thread affinity" << endl;
+			return TestFail;
+		}
+
+		if (attrThread->setAffinity({}) != -EINVAL ||
+		    attrThread->setScheduling(SCHED_FIFO, 1000) != -EINVAL) {
+			cout << "Invalid thread attributes not rejected" << endl;
+			return TestFail;
+		}
+
+		if (attrThread->setScheduling(SCHED_OTHER)) {
+			cout << "Failed to set thread scheduling policy" << endl;
+			return TestFail;
+		}
+
+		attrThread->start();
+		attrThread->wait();
+
+		if (attrThread->name_ != "TestThreadWithA") {
+			cout << "Invalid thread name " << attrThread->name_ << endl;
+			return TestFail;
+		}
+
+		if (CPU_COUNT(&attrThread->cpus_) != 1 ||
+		    !CPU_ISSET(cpus[0], &attrThread->cpus_)) {
+			cout << "Invalid thread affinity" << endl;
+			return TestFail;
+		}
+
+		/* Test thread affinity overridden from the environment. */
+		std::string affinity = "Other=0;Test*=" + std::to_string(cpus[0]);
+		setenv("LIBCAMERA_THREAD_AFFINITY", affinity.c_str(), 1);
+
+		attrThread = std::make_unique<AttributesThread>();
+		attrThread->setName("TestEnv");
+		attrThread->start();
+		attrThread->wait();
+
+		unsetenv("LIBCAMERA_THREAD_AFFINITY");
+
+		if (CPU_COUNT(&attrThread->cpus_) != 1 ||
+		    !CPU_ISSET(cpus[0], &attrThread->cpus_)) {
+			cout << "Thread affinity from environment not applied" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
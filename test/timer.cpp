@@ -7,6 +7,8 @@
 
 #include <chrono>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include <libcamera/base/event_dispatcher.h>
 #include <libcamera/base/thread.h>
@@ -189,6 +191,44 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Many timers, with shared deadlines, restarted with both
+		 * earlier and later deadlines.
+		 */
+		std::vector<std::unique_ptr<ManagedTimer>> timers;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < 100; i++) {
+			timers.push_back(std::make_unique<ManagedTimer>());
+			timers.back()->start(now + std::chrono::milliseconds(100 + i % 10 * 20));
+		}
+
+		for (unsigned int i = 0; i < timers.size(); i += 2)
+			timers[i]->start(now + std::chrono::milliseconds(50 + (i * 7) % 200));
+
+		Timer timeout;
+		timeout.start(1000);
+
+		auto running = [&]() {
+			for (const auto &t : timers) {
+				if (t->isRunning())
+					return true;
+			}
+			return false;
+		};
+
+		while (timeout.isRunning() && running())
+			dispatcher->processEvents();
+
+		for (const auto &t : timers) {
+			if (t->hasFailed()) {
+				cout << "Many timers test failed" << endl;
+				return TestFail;
+			}
+		}
+
+		timers.clear();
+
 		/*
 		 * Test that dynamically allocated timers are stopped when
 		 * deleted. This will result in a crash on failure.
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * trace-recorder.cpp - In-process trace recorder test
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "libcamera/internal/trace_recorder.h"
+#include "libcamera/internal/tracepoints.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+constexpr const char *fieldNames[] = { "count", "offset", "ratio", "flags", "name" };
+
+} /* namespace */
+
+class TraceRecorderTest : public Test
+{
+protected:
+	bool contains(const string &trace, const string &text)
+	{
+		if (trace.find(text) != string::npos)
+			return true;
+
+		cout << "Trace doesn't contain '" << text << "'" << endl;
+		return false;
+	}
+
+	int run()
+	{
+		TraceRecorder *recorder = TraceRecorder::instance();
+
+		/*
+		 * Events must not be recorded before recording starts. Stop
+		 * recording first in case LIBCAMERA_TRACE_FILE is set.
+		 */
+		recorder->stop();
+		LIBCAMERA_TRACEPOINT_IPA_BEGIN(disabled, process);
+		LIBCAMERA_TRACEPOINT_IPA_END(disabled, process);
+
+		recorder->start(16);
+
+		LIBCAMERA_TRACEPOINT_IPA_BEGIN(test, process);
+		TraceRecorder::record("test_fields", fieldNames, 42U, -7, 0.5,
+				      TraceRecorder::Hex{ 0xbeef }, "a string field");
+		LIBCAMERA_TRACEPOINT_IPA_END(test, process);
+
+		thread worker([]() {
+			static constexpr const char *names[] = { "index" };
+			for (unsigned int i = 0; i < 100; ++i)
+				TraceRecorder::record("test_thread", names, i);
+		});
+		worker.join();
+
+		recorder->stop();
+
+		/* Events must not be recorded after recording stops. */
+		LIBCAMERA_TRACEPOINT_IPA_BEGIN(stopped, process);
+
+		stringstream stream;
+		recorder->dump(stream);
+		string trace = stream.str();
+
+		if (!contains(trace, "\"traceEvents\"") ||
+		    !contains(trace, "\"ph\": \"B\"") ||
+		    !contains(trace, "\"ph\": \"E\"") ||
+		    !contains(trace, "\"name\": \"test:process\"") ||
+		    !contains(trace, "\"count\": 42") ||
+		    !contains(trace, "\"offset\": -7") ||
+		    !contains(trace, "\"ratio\": 0.5") ||
+		    !contains(trace, "\"flags\": \"0xbeef\"") ||
+		    !contains(trace, "\"name\": \"a string field\""))
+			return TestFail;
+
+		if (trace.find("disabled") != string::npos ||
+		    trace.find("stopped") != string::npos) {
+			cout << "Events recorded while recording was disabled" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The worker ring keeps the most recent events only, with one
+		 * entry reserved for the event being recorded.
+		 */
+		if (!contains(trace, "\"index\": 99") ||
+		    !contains(trace, "\"index\": 85"))
+			return TestFail;
+
+		if (trace.find("\"index\": 84") != string::npos) {
+			cout << "Ring buffer overwritten events not dropped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(TraceRecorderTest)
@@ -126,6 +126,28 @@ public:
 		return TestPass;
 	}
 
+	/*
+	 * Test that the cache statistics match the expected number of hits,
+	 * misses and evictions.
+	 */
+	int testStatistics(const V4L2BufferCache *cache, uint64_t hits,
+			   uint64_t misses, uint64_t evictions)
+	{
+		const V4L2BufferCache::Statistics &stats = cache->statistics();
+
+		if (stats.hits != hits || stats.misses != misses ||
+		    stats.evictions != evictions) {
+			std::cout << "Unexpected cache statistics: "
+				  << stats.hits << "/" << stats.misses << "/"
+				  << stats.evictions << ", expected "
+				  << hits << "/" << misses << "/" << evictions
+				  << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int init() override
 	{
 		std::random_device rd;
@@ -138,6 +160,44 @@ public:
 		return TestPass;
 	}
 
+	/*
+	 * Test that a hot buffer stays cached with the least frequently used
+	 * eviction policy while cold buffers cycle through the other entries.
+	 */
+	int testFrequent(V4L2BufferCache *cache,
+			 const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+	{
+		const FrameBuffer &hot = *buffers[0];
+
+		for (unsigned int i = 0; i < 10; i++) {
+			int index = cache->get(hot);
+			cache->put(index);
+		}
+
+		cache->resetStatistics();
+
+		for (unsigned int i = 0; i < 100; i++) {
+			/* Use more cold buffers than there are cache entries. */
+			for (unsigned int j = 0; j < cache->size(); j++) {
+				unsigned int cold = 1 + (i * cache->size() + j) % (buffers.size() - 1);
+				int index = cache->get(*buffers[cold]);
+				cache->put(index);
+			}
+
+			int index = cache->get(hot);
+			cache->put(index);
+		}
+
+		const V4L2BufferCache::Statistics &stats = cache->statistics();
+		if (stats.hits != 100) {
+			std::cout << "Hot buffer evicted from the cache"
+				  << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int run() override
 	{
 		const unsigned int numBuffers = 8;
@@ -171,6 +231,9 @@ public:
 		if (testSequential(&cacheFromBuffers, buffers) != TestPass)
 			return TestFail;
 
+		if (testStatistics(&cacheFromBuffers, numBuffers * 100, 0, 0) != TestPass)
+			return TestFail;
+
 		if (testRandom(&cacheFromBuffers, buffers) != TestPass)
 			return TestFail;
 
@@ -186,6 +249,14 @@ public:
 		if (testSequential(&cacheFromNumbers, buffers) != TestPass)
 			return TestFail;
 
+		if (testStatistics(&cacheFromNumbers, numBuffers * 99,
+				   numBuffers, 0) != TestPass)
+			return TestFail;
+
+		cacheFromNumbers.resetStatistics();
+		if (testStatistics(&cacheFromNumbers, 0, 0, 0) != TestPass)
+			return TestFail;
+
 		if (testRandom(&cacheFromNumbers, buffers) != TestPass)
 			return TestFail;
 
@@ -204,6 +275,36 @@ public:
 		if (testHot(&cacheHalf, buffers, numBuffers / 2) != TestPass)
 			return TestFail;
 
+		/*
+		 * Test cache grown from half the size of number of buffers
+		 * used to the number of buffers.
+		 */
+		V4L2BufferCache cacheGrown(numBuffers / 2);
+		cacheGrown.addEntries(numBuffers - numBuffers / 2);
+
+		if (cacheGrown.size() != numBuffers) {
+			std::cout << "Cache has " << cacheGrown.size()
+				  << " entries, expected " << numBuffers
+				  << std::endl;
+			return TestFail;
+		}
+
+		if (testSequential(&cacheGrown, buffers) != TestPass)
+			return TestFail;
+
+		if (testHot(&cacheGrown, buffers, numBuffers) != TestPass)
+			return TestFail;
+
+		/*
+		 * Test cache a quarter the size of number of buffers used with
+		 * the least frequently used eviction policy.
+		 */
+		V4L2BufferCache cacheFrequent(numBuffers / 4);
+		cacheFrequent.setEvictionPolicy(V4L2BufferCache::EvictionPolicy::LeastFrequentlyUsed);
+
+		if (testFrequent(&cacheFrequent, buffers) != TestPass)
+			return TestFail;
+
 		return TestPass;
 	}
 
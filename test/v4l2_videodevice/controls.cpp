@@ -134,6 +134,19 @@ protected:
 			return TestFail;
 		}
 
+		/* Test reading back cached controls. */
+		for (unsigned int i = 0; i < 2; ++i) {
+			ControlList values = capture_->getControls({ V4L2_CID_BRIGHTNESS,
+								     V4L2_CID_CONTRAST,
+								     V4L2_CID_SATURATION });
+			if (values.get(V4L2_CID_BRIGHTNESS) != brightness.min() ||
+			    values.get(V4L2_CID_CONTRAST) != contrast.max() ||
+			    values.get(V4L2_CID_SATURATION) != saturation.min().get<int32_t>() + 1) {
+				cerr << "Incorrect value for read back controls" << endl;
+				return TestFail;
+			}
+		}
+
 		return TestPass;
 	}
 };
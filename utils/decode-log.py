@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2021, Google Inc.
+#
+# decode-log.py - Convert a libcamera binary log file to text
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x4c43424c
+VERSION = 1
+
+RECORD_CATEGORY = 1
+RECORD_LOCATION = 2
+RECORD_MESSAGE = 3
+RECORD_TEXT = 4
+
+SEVERITIES = ['DEBUG', ' INFO', ' WARN', 'ERROR', 'FATAL']
+
+
+class DecodeError(Exception):
+    pass
+
+
+class Reader(object):
+    def __init__(self, data, endian):
+        self.__data = data
+        self.__endian = endian
+        self.__offset = 0
+
+    def eof(self):
+        return self.__offset >= len(self.__data)
+
+    def read(self, fmt):
+        fmt = self.__endian + fmt
+        size = struct.calcsize(fmt)
+        if self.__offset + size > len(self.__data):
+            raise DecodeError('Truncated record at offset %u' % self.__offset)
+
+        values = struct.unpack_from(fmt, self.__data, self.__offset)
+        self.__offset += size
+        return values
+
+    def read_string(self, length):
+        if self.__offset + length > len(self.__data):
+            raise DecodeError('Truncated string at offset %u' % self.__offset)
+
+        value = self.__data[self.__offset:self.__offset + length]
+        self.__offset += length
+        return value.decode('utf-8', errors='replace')
+
+
+def format_timestamp(ns):
+    secs = ns // 1000000000
+    return '%u:%02u:%02u.%09u' % (secs // 3600, (secs // 60) % 60, secs % 60,
+                                  ns % 1000000000)
+
+
+def decode(data, output):
+    if len(data) < 8:
+        raise DecodeError('File too short')
+
+    for endian in ['<', '>']:
+        magic, version = struct.unpack_from(endian + 'II', data)
+        if magic == MAGIC:
+            break
+    else:
+        raise DecodeError('Invalid magic number')
+
+    if version != VERSION:
+        raise DecodeError('Unsupported format version %u' % version)
+
+    reader = Reader(data[8:], endian)
+    categories = {}
+    locations = {}
+
+    while not reader.eof():
+        type, = reader.read('B')
+
+        if type == RECORD_CATEGORY:
+            id, length = reader.read('HH')
+            categories[id] = reader.read_string(length)
+
+        elif type == RECORD_LOCATION:
+            id, line, length = reader.read('IIH')
+            locations[id] = '%s:%u' % (reader.read_string(length), line)
+
+        elif type == RECORD_MESSAGE:
+            timestamp, tid, severity, category, location, length = reader.read('QIBHII')
+            msg = reader.read_string(length)
+
+            severity = SEVERITIES[severity] if severity < len(SEVERITIES) else 'UNKWN'
+            output.write('[%s] [%u] %s %s %s %s\n' %
+                         (format_timestamp(timestamp), tid, severity,
+                          categories.get(category, '<unknown>'),
+                          locations.get(location, '<unknown>'), msg))
+
+        elif type == RECORD_TEXT:
+            length, = reader.read('I')
+            output.write(reader.read_string(length))
+
+        else:
+            raise DecodeError('Unknown record type %u' % type)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Convert a libcamera binary log file to text')
+    parser.add_argument('-o', '--output', type=str,
+                        help='Output file name (defaults to standard output)')
+    parser.add_argument('input', type=str,
+                        help='Binary log file, as written with LIBCAMERA_LOG_FORMAT=binary')
+    args = parser.parse_args(argv[1:])
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+
+    output = open(args.output, 'w') if args.output else sys.stdout
+
+    try:
+        decode(data, output)
+    except DecodeError as e:
+        sys.stderr.write('%s: %s\n' % (args.input, e))
+        return 1
+    finally:
+        if args.output:
+            output.close()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
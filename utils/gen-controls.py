@@ -175,6 +175,7 @@ def generate_h(controls):
 
     return {
         'ids': '\n'.join(ids),
+        'max_id': id_value - 1,
         'controls': '\n'.join(ctrls),
         'draft_controls': '\n'.join(draft_ctrls)
     }
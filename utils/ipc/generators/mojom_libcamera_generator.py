@@ -199,6 +199,28 @@ def MethodReturnValue(method):
         return GetNameForElement(first_output)
     return 'void'
 
+def MethodAsyncCallback(method):
+    args = []
+    if MethodReturnValue(method) != 'void':
+        args.append(MethodReturnValue(method))
+    for param in MethodParamOutputs(method):
+        args.append('const %s &' % GetNameForElement(param))
+    return 'std::function<void(%s)>' % ', '.join(args)
+
+def MethodAsyncParameters(method):
+    params = []
+    for param in method.parameters:
+        params.append('const %s %s%s' % (GetNameForElement(param),
+                                         '&' if not IsPod(param) else '',
+                                         param.mojom_name))
+    params.append(f'{MethodAsyncCallback(method)} callback')
+    return params
+
+def HasAsyncVariant(method):
+    # init(), start() and stop() manage the proxy state, and have no variant
+    return (not IsAsync(method) and
+            method.mojom_name not in ['init', 'start', 'stop'])
+
 def IsAsync(method):
     # Events are always async
     if re.match("^IPA.*EventInterface$", method.interface.mojom_name):
@@ -220,6 +242,13 @@ def IsControls(element):
 def IsEnum(element):
     return mojom.IsEnumKind(element.kind)
 
+def IsFlatStruct(element):
+    return len(element.fields) > 0 and \
+           all(IsPod(field) or IsEnum(field) for field in element.fields)
+
+def FlatSize(element):
+    return sum(int(BitWidth(field)) // 8 for field in element.fields)
+
 def IsFd(element):
     return mojom.IsStructKind(element.kind) and element.kind.mojom_name == "FileDescriptor"
 
@@ -401,6 +430,8 @@ class Generator(generator.Generator):
             'choose': Choose,
             'comma_sep': CommaSep,
             'default_value': GetDefaultValue,
+            'flat_size': FlatSize,
+            'has_async_variant': HasAsyncVariant,
             'has_default_fields': HasDefaultFields,
             'has_fd': HasFd,
             'is_async': IsAsync,
@@ -408,10 +439,13 @@ class Generator(generator.Generator):
             'is_controls': IsControls,
             'is_enum': IsEnum,
             'is_fd': IsFd,
+            'is_flat_struct': IsFlatStruct,
             'is_map': IsMap,
             'is_plain_struct': IsPlainStruct,
             'is_pod': IsPod,
             'is_str': IsStr,
+            'method_async_callback': MethodAsyncCallback,
+            'method_async_parameters': MethodAsyncParameters,
             'method_input_has_fd': MethodInputHasFd,
             'method_output_has_fd': MethodOutputHasFd,
             'method_param_names': MethodParamNames,
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Copyright (C) 2021, Google Inc.
+#
+# compile-tuning.py - Compile a Raspberry Pi tuning file to the binary format
+#
+# The binary format stores the tree of the JSON tuning file so that the IPA
+# can load it without parsing text. All integers are 32-bit little-endian
+# unsigned values. The file starts with a header
+#
+#   magic    "RPTB"
+#   version  1
+#
+# followed by the root node. Each node is stored as
+#
+#   key length, key bytes
+#   value length, value bytes
+#   number of children, children nodes
+#
+# Objects store their members as children, arrays store their elements as
+# children with an empty key, and scalars are stored as the text of their JSON
+# representation, in the same way as boost::property_tree::read_json().
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b'RPTB'
+VERSION = 1
+
+
+class Node:
+    def __init__(self, value='', children=None):
+        self.value = value
+        self.children = children or []
+
+
+def build(value):
+    # Numbers are parsed as strings to preserve their exact representation.
+    if isinstance(value, list) and value and isinstance(value[0], tuple):
+        return Node(children=[(key, build(child)) for key, child in value])
+    if isinstance(value, list):
+        return Node(children=[('', build(child)) for child in value])
+    if value is True:
+        return Node('true')
+    if value is False:
+        return Node('false')
+    if value is None:
+        return Node('null')
+    return Node(value)
+
+
+def pairs_hook(pairs):
+    # Keep duplicate keys and the order of members, as boost does. Empty
+    # objects are represented by an empty list.
+    return [tuple(pair) for pair in pairs]
+
+
+def write_string(out, string):
+    data = string.encode('utf-8')
+    out.append(struct.pack('<I', len(data)))
+    out.append(data)
+
+
+def write_node(out, key, node):
+    write_string(out, key)
+    write_string(out, node.value)
+    out.append(struct.pack('<I', len(node.children)))
+    for child_key, child in node.children:
+        write_node(out, child_key, child)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description='Compile a Raspberry Pi JSON tuning file to the binary format')
+    parser.add_argument('input', type=str, help='Input JSON tuning file')
+    parser.add_argument('output', type=str, help='Output binary tuning file')
+    args = parser.parse_args(argv[1:])
+
+    with open(args.input, 'r') as f:
+        tree = json.load(f, object_pairs_hook=pairs_hook,
+                         parse_int=str, parse_float=str,
+                         parse_constant=str)
+
+    out = [MAGIC, struct.pack('<I', VERSION)]
+    write_node(out, '', build(tree))
+
+    with open(args.output, 'wb') as f:
+        f.write(b''.join(out))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2021, Google Inc.
+#
+# analyze-frame-trace.py - Extract per-frame statistics from libcamera lttng traces
+
+import argparse
+import bt2
+import statistics as stats
+import sys
+
+
+class Samples(object):
+    def __init__(self):
+        self.samples = {}
+
+    def add(self, key, value):
+        self.samples.setdefault(key, []).append(value)
+
+    def rows(self):
+        rows = []
+        for k, v in sorted(self.samples.items()):
+            mean = int(stats.mean(v))
+            stddev = int(stats.stdev(v)) if len(v) > 1 else 0
+            rows.append([k, str(len(v)), str(min(v)), str(max(v)),
+                         str(mean), str(stddev)])
+        return rows
+
+
+def print_table(title, rows):
+    if len(rows) <= 1:
+        return
+
+    # Get maximum string width for every column
+    widths = []
+    for i in range(len(rows[0])):
+        widths.append(max([len(row[i]) for row in rows]))
+
+    print(title)
+    for row in rows:
+        fmt = [row[i].rjust(widths[i]) for i in range(1, len(row))]
+        print(' '.join([row[0].ljust(widths[0])] + fmt))
+    print()
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+            description='Gather per-frame statistics on V4L2 buffers, ISP queueing and controls')
+    parser.add_argument('-d', '--device', type=str,
+                        help='Name of the video device node to filter for')
+    parser.add_argument('trace_path', type=str,
+                        help='Path to lttng trace (eg. ~/lttng-traces/demo-20201029-184003)')
+    args = parser.parse_args(argv[1:])
+
+    # (device, index) -> queue timestamp
+    queued = {}
+    # device -> (last dequeue timestamp, last sequence)
+    last_dequeue = {}
+    # buffer timestamp -> (device, dequeue timestamp)
+    captured = {}
+
+    residency = Samples()
+    intervals = Samples()
+    isp_latency = Samples()
+    controls = Samples()
+    drops = {}
+    errors = {}
+
+    traces = bt2.TraceCollectionMessageIterator(args.trace_path)
+    for msg in traces:
+        if type(msg) is not bt2._EventMessageConst:
+            continue
+
+        event = msg.event.name
+        payload = msg.event.payload_field
+        timestamp_ns = msg.default_clock_snapshot.ns_from_origin
+
+        if event in ['libcamera:v4l2_buffer_queue', 'libcamera:v4l2_buffer_dequeue']:
+            device = str(payload['device'])
+            if args.device is not None and device != args.device:
+                continue
+
+            index = int(payload['index'])
+
+            if event == 'libcamera:v4l2_buffer_queue':
+                queued[(device, index)] = timestamp_ns
+                continue
+
+            ts = queued.pop((device, index), None)
+            if ts is not None:
+                residency.add(device, timestamp_ns - ts)
+
+            sequence = int(payload['sequence'])
+            if device in last_dequeue:
+                last_ts, last_seq = last_dequeue[device]
+                intervals.add(device, timestamp_ns - last_ts)
+                if sequence > last_seq + 1:
+                    drops[device] = drops.get(device, 0) + sequence - last_seq - 1
+            last_dequeue[device] = (timestamp_ns, sequence)
+
+            # V4L2_BUF_FLAG_ERROR
+            if int(payload['flags']) & 0x40:
+                errors[device] = errors.get(device, 0) + 1
+
+            if int(payload['timestamp']):
+                captured[int(payload['timestamp'])] = (device, timestamp_ns)
+
+        elif event == 'libcamera:pipeline_isp_queue':
+            capture = captured.pop(int(payload['timestamp']), None)
+            if capture is not None:
+                key = f'{payload["pipeline_name"]}:{capture[0]}'
+                isp_latency.add(key, timestamp_ns - capture[1])
+
+        elif event == 'libcamera:delayed_controls_apply':
+            controls.add('delayed controls written per frame', int(payload['count']))
+
+        elif event == 'libcamera:camera_sensor_set_controls':
+            controls.add(f'{payload["model"]} controls per write', int(payload['count']))
+
+    header = ['count', 'min', 'max', 'mean', 'stddev']
+
+    print_table('Buffer residency in driver (queue to dequeue, ns)',
+                [['device'] + header] + residency.rows())
+    print_table('Interval between dequeued buffers (ns)',
+                [['device'] + header] + intervals.rows())
+    print_table('Latency from capture to ISP queue (ns)',
+                [['pipeline:capture device'] + header] + isp_latency.rows())
+    print_table('Controls', [['controls'] + header] + controls.rows())
+
+    rows = [['device', 'dropped', 'errors']]
+    for device in sorted(last_dequeue.keys()):
+        rows.append([device, str(drops.get(device, 0)), str(errors.get(device, 0))])
+    print_table('Dropped and erroneous frames', rows)
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -29,7 +29,7 @@ def main(argv):
     traces = bt2.TraceCollectionMessageIterator(args.trace_path)
     for msg in traces:
         if type(msg) is not bt2._EventMessageConst or \
-           'pipeline_name' not in msg.event.payload_field or \
+           'function_name' not in msg.event.payload_field or \
            (args.pipeline is not None and \
             msg.event.payload_field['pipeline_name'] != args.pipeline):
             continue
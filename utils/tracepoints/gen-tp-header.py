@@ -9,8 +9,125 @@
 import datetime
 import jinja2
 import os
+import re
 import sys
 
+
+def split_args(string):
+    # Split a macro arguments list on the commas that are not nested in
+    # parentheses
+    args = []
+    depth = 0
+    arg = ''
+
+    for c in string:
+        if c == ',' and depth == 0:
+            args.append(arg.strip())
+            arg = ''
+            continue
+
+        if c == '(':
+            depth += 1
+        elif c == ')':
+            depth -= 1
+
+        arg += c
+
+    if arg.strip():
+        args.append(arg.strip())
+
+    return args
+
+
+def find_macros(source, regex):
+    # Return the name and arguments of all invocations of the macros whose
+    # name matches regex in source
+    macros = []
+
+    for match in re.finditer(r'\b(' + regex + r')\s*\(', source):
+        depth = 1
+        pos = match.end()
+        while depth:
+            if source[pos] == '(':
+                depth += 1
+            elif source[pos] == ')':
+                depth -= 1
+            pos += 1
+
+        macros.append((match.group(1), split_args(source[match.end():pos - 1])))
+
+    return macros
+
+
+def parse_fields(fields):
+    # Extract the name and the value expression of each field. The field type
+    # is used to cast the value, as done by lttng.
+    names = []
+    values = []
+
+    for macro, args in find_macros(fields, r'ctf_\w+'):
+        if macro == 'ctf_string':
+            names.append(args[0])
+            values.append(args[1])
+        elif macro == 'ctf_integer':
+            names.append(args[1])
+            values.append(f'static_cast<{args[0]}>({args[2]})')
+        elif macro == 'ctf_integer_hex':
+            names.append(args[1])
+            values.append(f'libcamera::TraceRecorder::Hex{{ static_cast<{args[0]}>({args[2]}) }}')
+        elif macro == 'ctf_enum':
+            names.append(args[3])
+            values.append(f'static_cast<{args[2]}>({args[4]})')
+        else:
+            raise RuntimeError(f'Unsupported field type {macro}')
+
+    return names, values
+
+
+def parse_events(source):
+    # Extract the name, arguments and fields of every event, to record them
+    # with the TraceRecorder
+    classes = {}
+    events = []
+
+    for macro, args in find_macros(source, r'TRACEPOINT_EVENT\w*'):
+        if macro == 'TRACEPOINT_EVENT_CLASS':
+            classes[args[1]] = args[3]
+        elif macro == 'TRACEPOINT_EVENT':
+            events.append((args[1], args[2], args[3]))
+        elif macro == 'TRACEPOINT_EVENT_INSTANCE':
+            events.append((args[2], args[3], classes[args[1]]))
+
+    result = []
+    for name, tp_args, tp_fields in events:
+        tp_args = split_args(tp_args[len('TP_ARGS('):-1])
+        params = [f'[[maybe_unused]] {tp_args[i]} {tp_args[i + 1]}'
+                  for i in range(0, len(tp_args), 2)]
+
+        fields, values = parse_fields(tp_fields[len('TP_FIELDS('):-1])
+        values = [' '.join(value.split()) for value in values]
+
+        result.append({
+            'name': name,
+            'params': ', '.join(params),
+            'fields': ', '.join([f'"{field}"' for field in fields]),
+            'values': ', '.join(values),
+        })
+
+    return result
+
+
+def parse_includes(source):
+    # Collect the headers needed by the tracepoints fields
+    includes = []
+
+    for include in re.findall(r'^#include .*$', source, re.MULTILINE):
+        if include not in includes:
+            includes.append(include)
+
+    return includes
+
+
 def main(argv):
     if len(argv) < 3:
         print(f'Usage: {argv[0]} output template tp_files...')
@@ -27,7 +144,9 @@ def main(argv):
         source += open(fname, 'r', encoding='utf-8').read() + '\n\n'
 
     template = jinja2.Template(open(template, 'r', encoding='utf-8').read())
-    string = template.render(year=year, path=path, source=source)
+    string = template.render(year=year, path=path, source=source,
+                             events=parse_events(source),
+                             includes=parse_includes(source))
 
     f = open(output, 'w', encoding='utf-8').write(string)
 